@@ -19,12 +19,12 @@ namespace {
 template <typename Stream, typename Data>
 bool SerializeDB(Stream& stream, const Data& data)
 {
-    // Write and commit header, data
+    // Write and commit header, data, hashing it on the way out so that data
+    // is serialized only once
     try {
-        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
-        stream << FLATDATA(Params().MessageStart()) << data;
-        hasher << FLATDATA(Params().MessageStart()) << data;
-        stream << hasher.GetHash();
+        CHashedSourceWriter<Stream> hashwriter(&stream);
+        hashwriter << FLATDATA(Params().MessageStart()) << data;
+        stream << hashwriter.GetHash();
     } catch (const std::exception& e) {
         return error("%s: Serialize or I/O error - %s", __func__, e.what());
     }
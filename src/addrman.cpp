@@ -9,6 +9,8 @@
 #include <serialize.h>
 #include <streams.h>
 
+#include <limits>
+
 int CAddrInfo::GetTriedBucket(const uint256& nKey) const
 {
     uint64_t hash1 = (CHashWriter(SER_GETHASH, 0) << nKey << GetKey()).GetHash().GetCheapHash();
@@ -67,12 +69,12 @@ double CAddrInfo::GetChance(int64_t nNow) const
 
 CAddrInfo* CAddrMan::Find(const CNetAddr& addr, int* pnId)
 {
-    std::map<CNetAddr, int>::iterator it = mapAddr.find(addr);
+    auto it = mapAddr.find(addr);
     if (it == mapAddr.end())
         return nullptr;
     if (pnId)
         *pnId = (*it).second;
-    std::map<int, CAddrInfo>::iterator it2 = mapInfo.find((*it).second);
+    auto it2 = mapInfo.find((*it).second);
     if (it2 != mapInfo.end())
         return &(*it2).second;
     return nullptr;
@@ -81,13 +83,14 @@ CAddrInfo* CAddrMan::Find(const CNetAddr& addr, int* pnId)
 CAddrInfo* CAddrMan::Create(const CAddress& addr, const CNetAddr& addrSource, int* pnId)
 {
     int nId = nIdCount++;
-    mapInfo[nId] = CAddrInfo(addr, addrSource);
+    CAddrInfo& info = mapInfo[nId];
+    info = CAddrInfo(addr, addrSource);
     mapAddr[addr] = nId;
-    mapInfo[nId].nRandomPos = vRandom.size();
+    info.nRandomPos = vRandom.size();
     vRandom.push_back(nId);
     if (pnId)
         *pnId = nId;
-    return &mapInfo[nId];
+    return &info;
 }
 
 void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2)
@@ -100,11 +103,13 @@ void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2)
     int nId1 = vRandom[nRndPos1];
     int nId2 = vRandom[nRndPos2];
 
-    assert(mapInfo.count(nId1) == 1);
-    assert(mapInfo.count(nId2) == 1);
+    auto it1 = mapInfo.find(nId1);
+    auto it2 = mapInfo.find(nId2);
+    assert(it1 != mapInfo.end());
+    assert(it2 != mapInfo.end());
 
-    mapInfo[nId1].nRandomPos = nRndPos2;
-    mapInfo[nId2].nRandomPos = nRndPos1;
+    it1->second.nRandomPos = nRndPos2;
+    it2->second.nRandomPos = nRndPos1;
 
     vRandom[nRndPos1] = nId2;
     vRandom[nRndPos2] = nId1;
@@ -112,15 +117,16 @@ void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2)
 
 void CAddrMan::Delete(int nId)
 {
-    assert(mapInfo.count(nId) != 0);
-    CAddrInfo& info = mapInfo[nId];
+    auto it = mapInfo.find(nId);
+    assert(it != mapInfo.end());
+    CAddrInfo& info = it->second;
     assert(!info.fInTried);
     assert(info.nRefCount == 0);
 
     SwapRandom(info.nRandomPos, vRandom.size() - 1);
     vRandom.pop_back();
     mapAddr.erase(info);
-    mapInfo.erase(nId);
+    mapInfo.erase(it);
     nNew--;
 }
 
@@ -336,12 +342,15 @@ void CAddrMan::Attempt_(const CService& addr, bool fCountFailure, int64_t nTime)
 
 CAddrInfo CAddrMan::Select_(bool newOnly)
 {
-    if (size() == 0)
+    if (vRandom.empty())
         return CAddrInfo();
 
     if (newOnly && nNew == 0)
         return CAddrInfo();
 
+    // Adjusted time takes its own lock; read it once rather than per candidate.
+    int64_t nNow = GetAdjustedTime();
+
     // Use a 50% chance for choosing between tried and new table entries.
     if (!newOnly &&
        (nTried > 0 && (nNew == 0 || RandomInt(2) == 0))) { 
@@ -355,9 +364,10 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
                 nKBucketPos = (nKBucketPos + insecure_rand.randbits(ADDRMAN_BUCKET_SIZE_LOG2)) % ADDRMAN_BUCKET_SIZE;
             }
             int nId = vvTried[nKBucket][nKBucketPos];
-            assert(mapInfo.count(nId) == 1);
-            CAddrInfo& info = mapInfo[nId];
-            if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
+            auto it = mapInfo.find(nId);
+            assert(it != mapInfo.end());
+            const CAddrInfo& info = it->second;
+            if (RandomInt(1 << 30) < fChanceFactor * info.GetChance(nNow) * (1 << 30))
                 return info;
             fChanceFactor *= 1.2;
         }
@@ -372,9 +382,10 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
                 nUBucketPos = (nUBucketPos + insecure_rand.randbits(ADDRMAN_BUCKET_SIZE_LOG2)) % ADDRMAN_BUCKET_SIZE;
             }
             int nId = vvNew[nUBucket][nUBucketPos];
-            assert(mapInfo.count(nId) == 1);
-            CAddrInfo& info = mapInfo[nId];
-            if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
+            auto it = mapInfo.find(nId);
+            assert(it != mapInfo.end());
+            const CAddrInfo& info = it->second;
+            if (RandomInt(1 << 30) < fChanceFactor * info.GetChance(nNow) * (1 << 30))
                 return info;
             fChanceFactor *= 1.2;
         }
@@ -465,6 +476,9 @@ void CAddrMan::GetAddr_(std::vector<CAddress>& vAddr)
     if (nNodes > ADDRMAN_GETADDR_MAX)
         nNodes = ADDRMAN_GETADDR_MAX;
 
+    vAddr.reserve(nNodes);
+    int64_t nNow = GetAdjustedTime();
+
     // gather a list of random nodes, skipping those of low quality
     for (unsigned int n = 0; n < vRandom.size(); n++) {
         if (vAddr.size() >= nNodes)
@@ -472,10 +486,11 @@ void CAddrMan::GetAddr_(std::vector<CAddress>& vAddr)
 
         int nRndPos = RandomInt(vRandom.size() - n) + n;
         SwapRandom(n, nRndPos);
-        assert(mapInfo.count(vRandom[n]) == 1);
+        auto it = mapInfo.find(vRandom[n]);
+        assert(it != mapInfo.end());
 
-        const CAddrInfo& ai = mapInfo[vRandom[n]];
-        if (!ai.IsTerrible())
+        const CAddrInfo& ai = it->second;
+        if (!ai.IsTerrible(nNow))
             vAddr.push_back(ai);
     }
 }
@@ -519,5 +534,5 @@ void CAddrMan::SetServices_(const CService& addr, ServiceFlags nServices)
 }
 
 int CAddrMan::RandomInt(int nMax){
-    return GetRandInt(nMax);
+    return insecure_rand.randrange(nMax);
 }
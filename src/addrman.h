@@ -16,6 +16,7 @@
 #include <map>
 #include <set>
 #include <stdint.h>
+#include <unordered_map>
 #include <vector>
 
 /**
@@ -189,10 +190,10 @@ private:
     int nIdCount;
 
     //! table with information about all nIds
-    std::map<int, CAddrInfo> mapInfo;
+    std::unordered_map<int, CAddrInfo> mapInfo;
 
     //! find an nId based on its network address
-    std::map<CNetAddr, int> mapAddr;
+    std::unordered_map<CNetAddr, int, CNetAddrHasher> mapAddr;
 
     //! randomly-ordered vector of all nIds
     std::vector<int> vRandom;
@@ -250,7 +251,7 @@ protected:
     //! Select an address to connect to, if newOnly is set to true, only the new table is selected from.
     CAddrInfo Select_(bool newOnly);
 
-    //! Wraps GetRandInt to allow tests to override RandomInt and make it determinismistic.
+    //! Draws from insecure_rand; virtual to allow tests to override RandomInt and make it determinismistic.
     virtual int RandomInt(int nMax);
 
 #ifdef DEBUG_ADDRMAN
@@ -270,26 +271,29 @@ protected:
 public:
     /**
      * serialized format:
-     * * version byte (currently 1)
+     * * version byte (currently 2)
      * * 0x20 + nKey (serialized as if it were a vector, for backward compatibility)
      * * nNew
      * * nTried
      * * number of "new" buckets XOR 2**30
+     * * (version 2) number of "tried" buckets, and bucket size
      * * all nNew addrinfos in vvNew
-     * * all nTried addrinfos in vvTried
+     * * all nTried addrinfos in vvTried, each followed (version 2) by its bucket and position
      * * for each bucket:
      *   * number of elements
-     *   * for each element: index
+     *   * for each element: index, and (version 2) position in the bucket
      *
      * 2**30 is xorred with the number of buckets to make addrman deserializer v0 detect it
      * as incompatible. This is necessary because it did not check the version number on
      * deserialization.
      *
-     * Notice that vvTried, mapAddr and vVector are never encoded explicitly;
-     * they are instead reconstructed from the other information.
+     * Notice that mapAddr and vVector are never encoded explicitly; they are instead
+     * reconstructed from the other information.
      *
-     * vvNew is serialized, but only used if ADDRMAN_UNKNOWN_BUCKET_COUNT didn't change,
-     * otherwise it is reconstructed as well.
+     * vvNew and vvTried are serialized, but only used if the ADDRMAN_ bucket parameters
+     * didn't change, otherwise they are reconstructed as well. Version 2 stores the bucket
+     * positions so that loading does not have to hash every entry again to place it; a
+     * stored position that does not fit is recomputed.
      *
      * This format is more complex, but significantly smaller (at most 1.5 MiB), and supports
      * changes to the ADDRMAN_ parameters without breaking the on-disk structure.
@@ -302,7 +306,7 @@ public:
     {
         LOCK(cs);
 
-        unsigned char nVersion = 1;
+        unsigned char nVersion = 2;
         s << nVersion;
         s << ((unsigned char)32);
         s << nKey;
@@ -311,24 +315,32 @@ public:
 
         int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT ^ (1 << 30);
         s << nUBuckets;
-        std::map<int, int> mapUnkIds;
+        int nKBuckets = ADDRMAN_TRIED_BUCKET_COUNT;
+        int nBucketSize = ADDRMAN_BUCKET_SIZE;
+        s << nKBuckets;
+        s << nBucketSize;
+        std::unordered_map<int, int> mapUnkIds;
+        mapUnkIds.reserve(nNew);
         int nIds = 0;
         for (const auto& entry : mapInfo) {
-            mapUnkIds[entry.first] = nIds;
             const CAddrInfo &info = entry.second;
             if (info.nRefCount) {
                 assert(nIds != nNew); // this means nNew was wrong, oh ow
+                mapUnkIds[entry.first] = nIds;
                 s << info;
                 nIds++;
             }
         }
         nIds = 0;
-        for (const auto& entry : mapInfo) {
-            const CAddrInfo &info = entry.second;
-            if (info.fInTried) {
-                assert(nIds != nTried); // this means nTried was wrong, oh ow
-                s << info;
-                nIds++;
+        for (int bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++) {
+            for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
+                if (vvTried[bucket][i] != -1) {
+                    assert(nIds != nTried); // this means nTried was wrong, oh ow
+                    s << mapInfo.at(vvTried[bucket][i]);
+                    s << bucket;
+                    s << i;
+                    nIds++;
+                }
             }
         }
         for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
@@ -342,6 +354,7 @@ public:
                 if (vvNew[bucket][i] != -1) {
                     int nIndex = mapUnkIds[vvNew[bucket][i]];
                     s << nIndex;
+                    s << i;
                 }
             }
         }
@@ -367,6 +380,12 @@ public:
         if (nVersion != 0) {
             nUBuckets ^= (1 << 30);
         }
+        int nKBuckets = 0;
+        int nBucketSize = 0;
+        if (nVersion >= 2) {
+            s >> nKBuckets;
+            s >> nBucketSize;
+        }
 
         if (nNew > ADDRMAN_NEW_BUCKET_COUNT * ADDRMAN_BUCKET_SIZE) {
             throw std::ios_base::failure("Corrupt CAddrMan serialization, nNew exceeds limit.");
@@ -376,6 +395,15 @@ public:
             throw std::ios_base::failure("Corrupt CAddrMan serialization, nTried exceeds limit.");
         }
 
+        // The new table data can be used if the version is known and the bucket count
+        // matches; stored positions additionally need the same bucket layout.
+        const bool fNewTable = (nVersion == 1 || nVersion == 2) && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT;
+        const bool fPositions = nVersion == 2 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT &&
+            nKBuckets == ADDRMAN_TRIED_BUCKET_COUNT && nBucketSize == ADDRMAN_BUCKET_SIZE;
+
+        mapInfo.reserve(nNew + nTried);
+        mapAddr.reserve(nNew + nTried);
+
         // Deserialize entries from the new table.
         for (int n = 0; n < nNew; n++) {
             CAddrInfo &info = mapInfo[n];
@@ -383,7 +411,7 @@ public:
             mapAddr[info] = n;
             info.nRandomPos = vRandom.size();
             vRandom.push_back(n);
-            if (nVersion != 1 || nUBuckets != ADDRMAN_NEW_BUCKET_COUNT) {
+            if (!fNewTable) {
                 // In case the new table data cannot be used (nVersion unknown, or bucket count wrong),
                 // immediately try to give them a reference based on their primary source address.
                 int nUBucket = info.GetNewBucket(nKey);
@@ -401,8 +429,17 @@ public:
         for (int n = 0; n < nTried; n++) {
             CAddrInfo info;
             s >> info;
-            int nKBucket = info.GetTriedBucket(nKey);
-            int nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
+            int nKBucket = -1;
+            int nKBucketPos = -1;
+            if (nVersion >= 2) {
+                s >> nKBucket;
+                s >> nKBucketPos;
+            }
+            if (!fPositions || nKBucket < 0 || nKBucket >= ADDRMAN_TRIED_BUCKET_COUNT ||
+                nKBucketPos < 0 || nKBucketPos >= ADDRMAN_BUCKET_SIZE) {
+                nKBucket = info.GetTriedBucket(nKey);
+                nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
+            }
             if (vvTried[nKBucket][nKBucketPos] == -1) {
                 info.nRandomPos = vRandom.size();
                 info.fInTried = true;
@@ -424,10 +461,16 @@ public:
             for (int n = 0; n < nSize; n++) {
                 int nIndex = 0;
                 s >> nIndex;
-                if (nIndex >= 0 && nIndex < nNew) {
+                int nUBucketPos = -1;
+                if (nVersion >= 2) {
+                    s >> nUBucketPos;
+                }
+                if (fNewTable && nIndex >= 0 && nIndex < nNew) {
                     CAddrInfo &info = mapInfo[nIndex];
-                    int nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
-                    if (nVersion == 1 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
+                    if (!fPositions || nUBucketPos < 0 || nUBucketPos >= ADDRMAN_BUCKET_SIZE) {
+                        nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
+                    }
+                    if (vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
                         info.nRefCount++;
                         vvNew[bucket][nUBucketPos] = nIndex;
                     }
@@ -437,9 +480,9 @@ public:
 
         // Prune new entries with refcount 0 (as a result of collisions).
         int nLostUnk = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
+        for (std::unordered_map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
             if (it->second.fInTried == false && it->second.nRefCount == 0) {
-                std::map<int, CAddrInfo>::const_iterator itCopy = it++;
+                std::unordered_map<int, CAddrInfo>::const_iterator itCopy = it++;
                 Delete(itCopy->first);
                 nLostUnk++;
             } else {
@@ -21,6 +21,32 @@
 /** All alphanumeric characters except for "0", "I", "O", and "l" */
 static const char* pszBase58 = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
 
+static const int8_t mapBase58[256] = {
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1, 0, 1, 2, 3, 4, 5, 6, 7, 8,-1,-1,-1,-1,-1,-1,
+    -1, 9,10,11,12,13,14,15,16,-1,17,18,19,20,21,-1,
+    22,23,24,25,26,27,28,29,30,31,32,-1,-1,-1,-1,-1,
+    -1,33,34,35,36,37,38,39,40,41,42,43,-1,44,45,46,
+    47,48,49,50,51,52,53,54,55,56,57,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+};
+
+// The conversions work on whole limbs rather than single digits: five
+// base58 digits (58^5 < 2^32) or four bytes are taken in at a time, which
+// takes about twenty times fewer steps than going digit by digit.
+
+/** Five base58 digits */
+static const uint32_t BASE58_LIMB = 58 * 58 * 58 * 58 * 58;
+
 bool DecodeBase58(const char* psz, std::vector<unsigned char>& vch)
 {
     // Skip leading spaces.
@@ -28,46 +54,58 @@ bool DecodeBase58(const char* psz, std::vector<unsigned char>& vch)
         psz++;
     // Skip and count leading '1's.
     int zeroes = 0;
-    int length = 0;
     while (*psz == '1') {
         zeroes++;
         psz++;
     }
-    // Allocate enough space in big-endian base256 representation.
-    int size = strlen(psz) * 733 /1000 + 1; // log(58) / log(256), rounded up.
-    std::vector<unsigned char> b256(size);
-    // Process the characters.
+    // Little-endian base 2^32 limbs, enough for log(58) / log(256) bytes per character.
+    std::vector<uint32_t> limbs;
+    limbs.reserve(strlen(psz) * 733 / 1000 / 4 + 1);
+    // Apply "limbs = limbs * mul + chunk", where chunk holds the last characters.
+    auto apply = [&limbs](uint32_t mul, uint32_t chunk) {
+        uint64_t carry = chunk;
+        for (uint32_t& limb : limbs) {
+            carry += (uint64_t)limb * mul;
+            limb = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if (carry != 0)
+            limbs.push_back((uint32_t)carry);
+    };
+    // Process the characters, five at a time.
+    uint32_t chunk = 0;
+    uint32_t mul = 1;
     while (*psz && !isspace(*psz)) {
         // Decode base58 character
-        const char* ch = strchr(pszBase58, *psz);
-        if (ch == nullptr)
+        int digit = mapBase58[(uint8_t)*psz];
+        if (digit == -1)
             return false;
-        // Apply "b256 = b256 * 58 + ch".
-        int carry = ch - pszBase58;
-        int i = 0;
-        for (std::vector<unsigned char>::reverse_iterator it = b256.rbegin(); (carry != 0 || i < length) && (it != b256.rend()); ++it, ++i) {
-            carry += 58 * (*it);
-            *it = carry % 256;
-            carry /= 256;
+        chunk = chunk * 58 + digit;
+        mul *= 58;
+        if (mul == BASE58_LIMB) {
+            apply(mul, chunk);
+            chunk = 0;
+            mul = 1;
         }
-        assert(carry == 0);
-        length = i;
         psz++;
     }
+    if (mul != 1)
+        apply(mul, chunk);
     // Skip trailing spaces.
     while (isspace(*psz))
         psz++;
     if (*psz != 0)
         return false;
-    // Skip leading zeroes in b256.
-    std::vector<unsigned char>::iterator it = b256.begin() + (size - length);
-    while (it != b256.end() && *it == 0)
-        it++;
-    // Copy result into output vector.
-    vch.reserve(zeroes + (b256.end() - it));
+    // Copy result into output vector, skipping leading zeroes of the top limb.
+    vch.reserve(zeroes + limbs.size() * 4);
     vch.assign(zeroes, 0x00);
-    while (it != b256.end())
-        vch.push_back(*(it++));
+    for (size_t i = limbs.size(); i-- > 0; ) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            unsigned char byte = limbs[i] >> shift;
+            if (byte != 0 || vch.size() > (size_t)zeroes || i + 1 < limbs.size())
+                vch.push_back(byte);
+        }
+    }
     return true;
 }
 
@@ -75,39 +113,51 @@ std::string EncodeBase58(const unsigned char* pbegin, const unsigned char* pend)
 {
     // Skip & count leading zeroes.
     int zeroes = 0;
-    int length = 0;
     while (pbegin != pend && *pbegin == 0) {
         pbegin++;
         zeroes++;
     }
-    // Allocate enough space in big-endian base58 representation.
-    int size = (pend - pbegin) * 138 / 100 + 1; // log(256) / log(58), rounded up.
-    std::vector<unsigned char> b58(size);
-    // Process the bytes.
+    // Little-endian limbs of five base58 digits, enough for log(256) / log(58) digits per byte.
+    std::vector<uint32_t> limbs;
+    limbs.reserve((pend - pbegin) * 138 / 100 / 5 + 1);
+    // Process the bytes, four at a time.
     while (pbegin != pend) {
-        int carry = *pbegin;
-        int i = 0;
-        // Apply "b58 = b58 * 256 + ch".
-        for (std::vector<unsigned char>::reverse_iterator it = b58.rbegin(); (carry != 0 || i < length) && (it != b58.rend()); it++, i++) {
-            carry += 256 * (*it);
-            *it = carry % 58;
-            carry /= 58;
+        int shift = 0;
+        uint64_t carry = 0;
+        while (pbegin != pend && shift < 32) {
+            carry = (carry << 8) | *pbegin;
+            shift += 8;
+            pbegin++;
+        }
+        // Apply "limbs = limbs * 2^shift + carry".
+        for (uint32_t& limb : limbs) {
+            carry += (uint64_t)limb << shift;
+            limb = carry % BASE58_LIMB;
+            carry /= BASE58_LIMB;
+        }
+        while (carry != 0) {
+            limbs.push_back(carry % BASE58_LIMB);
+            carry /= BASE58_LIMB;
         }
-
-        assert(carry == 0);
-        length = i;
-        pbegin++;
     }
-    // Skip leading zeroes in base58 result.
-    std::vector<unsigned char>::iterator it = b58.begin() + (size - length);
-    while (it != b58.end() && *it == 0)
-        it++;
-    // Translate the result into a string.
+    // Translate the result into a string, skipping leading zeroes of the top limb.
     std::string str;
-    str.reserve(zeroes + (b58.end() - it));
+    str.reserve(zeroes + limbs.size() * 5);
     str.assign(zeroes, '1');
-    while (it != b58.end())
-        str += pszBase58[*(it++)];
+    for (size_t i = limbs.size(); i-- > 0; ) {
+        char digits[5];
+        uint32_t limb = limbs[i];
+        for (int j = 4; j >= 0; j--) {
+            digits[j] = pszBase58[limb % 58];
+            limb /= 58;
+        }
+        int skip = 0;
+        if (i + 1 == limbs.size()) {
+            while (digits[skip] == '1')
+                skip++;
+        }
+        str.append(digits + skip, 5 - skip);
+    }
     return str;
 }
 
@@ -240,6 +290,7 @@ public:
     std::string operator()(const WitnessV0KeyHash& id) const
     {
         std::vector<unsigned char> data = {0};
+        data.reserve(1 + (id.size() * 8 + 4) / 5);
         ConvertBits<8, 5, true>(data, id.begin(), id.end());
         return bech32::Encode(m_params.Bech32HRP(), data);
     }
@@ -247,6 +298,7 @@ public:
     std::string operator()(const WitnessV0ScriptHash& id) const
     {
         std::vector<unsigned char> data = {0};
+        data.reserve(1 + (id.size() * 8 + 4) / 5);
         ConvertBits<8, 5, true>(data, id.begin(), id.end());
         return bech32::Encode(m_params.Bech32HRP(), data);
     }
@@ -257,6 +309,7 @@ public:
             return {};
         }
         std::vector<unsigned char> data = {(unsigned char)id.version};
+        data.reserve(1 + (id.length * 8 + 4) / 5);
         ConvertBits<8, 5, true>(data, id.program, id.program + id.length);
         return bech32::Encode(m_params.Bech32HRP(), data);
     }
@@ -291,6 +344,7 @@ CTxDestination DecodeDestination(const std::string& str, const CChainParams& par
         // Bech32 decoding
         int version = bech.second[0]; // The first 5 bit symbol is the witness version (0-16)
         // The rest of the symbols are converted witness program bytes.
+        data.reserve(((bech.second.size() - 1) * 5) / 8);
         if (ConvertBits<5, 8, false>(data, bech.second.begin() + 1, bech.second.end())) {
             if (version == 0) {
                 {
@@ -0,0 +1,111 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <addrman.h>
+#include <random.h>
+#include <util.h>
+
+#include <vector>
+
+/* A "source" is a source address from which we have received a bunch of other addresses. */
+
+static constexpr size_t NUM_SOURCES = 64;
+static constexpr size_t NUM_ADDRESSES_PER_SOURCE = 256;
+
+static std::vector<CAddress> g_sources;
+static std::vector<std::vector<CAddress>> g_addresses;
+
+static CAddress RandomAddress(FastRandomContext& rand, int64_t nTime)
+{
+    struct in_addr addr;
+    // Keep the first octet in 1..126 so that every address is routable
+    uint32_t nIP = ((1 + rand.randrange(126)) << 24) | rand.randbits(24);
+    addr.s_addr = htonl(nIP);
+    CAddress ret(CService(addr, 8333), NODE_NETWORK);
+    ret.nTime = nTime;
+    return ret;
+}
+
+static void CreateAddresses()
+{
+    if (g_sources.size() > 0) { // already created
+        return;
+    }
+
+    FastRandomContext rand(true);
+    int64_t nNow = GetAdjustedTime();
+
+    g_sources.resize(NUM_SOURCES);
+    g_addresses.resize(NUM_SOURCES);
+    for (size_t source_i = 0; source_i < NUM_SOURCES; ++source_i) {
+        g_sources[source_i] = RandomAddress(rand, nNow);
+        g_addresses[source_i].resize(NUM_ADDRESSES_PER_SOURCE);
+        for (size_t addr_i = 0; addr_i < NUM_ADDRESSES_PER_SOURCE; ++addr_i) {
+            g_addresses[source_i][addr_i] = RandomAddress(rand, nNow);
+        }
+    }
+}
+
+static void AddAddressesToAddrMan(CAddrMan& addrman)
+{
+    for (size_t source_i = 0; source_i < NUM_SOURCES; ++source_i) {
+        addrman.Add(g_addresses[source_i], g_sources[source_i]);
+    }
+}
+
+static void FillAddrMan(CAddrMan& addrman)
+{
+    CreateAddresses();
+
+    AddAddressesToAddrMan(addrman);
+
+    // Move a share of the addresses to tried, as a long-running node would have
+    for (size_t source_i = 0; source_i < NUM_SOURCES; source_i += 4) {
+        for (const CAddress& addr : g_addresses[source_i]) {
+            addrman.Good(addr);
+        }
+    }
+}
+
+/* Benchmarks */
+
+static void AddrManAdd(benchmark::State& state)
+{
+    CreateAddresses();
+
+    while (state.KeepRunning()) {
+        CAddrMan addrman;
+        AddAddressesToAddrMan(addrman);
+    }
+}
+
+static void AddrManSelect(benchmark::State& state)
+{
+    CAddrMan addrman;
+
+    FillAddrMan(addrman);
+
+    while (state.KeepRunning()) {
+        const auto& address = addrman.Select();
+        assert(address.GetPort() > 0);
+    }
+}
+
+static void AddrManGetAddr(benchmark::State& state)
+{
+    CAddrMan addrman;
+
+    FillAddrMan(addrman);
+
+    while (state.KeepRunning()) {
+        const auto& addresses = addrman.GetAddr();
+        assert(addresses.size() > 0);
+    }
+}
+
+BENCHMARK(AddrManAdd, 5);
+BENCHMARK(AddrManSelect, 1000000);
+BENCHMARK(AddrManGetAddr, 500);
@@ -6,6 +6,8 @@
 
 #include <validation.h>
 #include <base58.h>
+#include <bech32.h>
+#include <utilstrencodings.h>
 
 #include <array>
 #include <vector>
@@ -54,6 +56,45 @@ static void Base58Decode(benchmark::State& state)
 }
 
 
+static void Base58CheckDecode(benchmark::State& state)
+{
+    const char* addr = "17VZNX1SN5NtKa8UQFxwQbFeFc3iqRYhem";
+    std::vector<unsigned char> vch;
+    while (state.KeepRunning()) {
+        DecodeBase58Check(addr, vch);
+    }
+}
+
+
+static void Bech32Encode(benchmark::State& state)
+{
+    static const std::array<unsigned char, 32> buff = {
+        {
+            17, 79, 8, 99, 150, 189, 208, 162, 22, 23, 203, 163, 36, 58, 147,
+            227, 139, 2, 215, 100, 91, 38, 11, 141, 253, 40, 117, 21, 16, 90,
+            200, 24
+        }
+    };
+    std::vector<unsigned char> vch = {0};
+    ConvertBits<8, 5, true>(vch, buff.begin(), buff.end());
+    while (state.KeepRunning()) {
+        bech32::Encode("bc", vch);
+    }
+}
+
+
+static void Bech32Decode(benchmark::State& state)
+{
+    const std::string addr = "bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4";
+    while (state.KeepRunning()) {
+        bech32::Decode(addr);
+    }
+}
+
+
 BENCHMARK(Base58Encode, 470 * 1000);
 BENCHMARK(Base58CheckEncode, 320 * 1000);
 BENCHMARK(Base58Decode, 800 * 1000);
+BENCHMARK(Base58CheckDecode, 320 * 1000);
+BENCHMARK(Bech32Encode, 800 * 1000);
+BENCHMARK(Bech32Decode, 800 * 1000);
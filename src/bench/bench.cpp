@@ -5,12 +5,67 @@
 #include <bench/bench.h>
 #include <bench/perf.h>
 
+#include <tinyformat.h>
+
 #include <assert.h>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
 #include <regex>
 #include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+#include <univalue.h>
+
+namespace {
+
+/** Linear interpolation between the closest ranks of a sorted, non-empty vector */
+double Percentile(const std::vector<double>& sorted, double percent)
+{
+    double rank = (sorted.size() - 1) * percent / 100;
+    size_t lower = static_cast<size_t>(rank);
+    if (lower + 1 >= sorted.size()) return sorted.back();
+    return sorted[lower] + (rank - lower) * (sorted[lower + 1] - sorted[lower]);
+}
+
+/** Summary of the per-iteration results of the evaluations of a benchmark */
+struct Stats {
+    double total = 0;
+    double min = 0;
+    double max = 0;
+    double mean = 0;
+    double median = 0;
+    double p25 = 0;
+    double p75 = 0;
+    //! Medians per iteration, 0 where they were not counted
+    double cycles = 0;
+    double instructions = 0;
+
+    explicit Stats(const benchmark::State& state)
+    {
+        auto results = state.m_elapsed_results;
+        if (results.empty()) return;
+        std::sort(results.begin(), results.end());
+        total = state.m_num_iters * std::accumulate(results.begin(), results.end(), 0.0);
+        min = results.front();
+        max = results.back();
+        mean = total / state.m_num_iters / results.size();
+        median = Percentile(results, 50);
+        p25 = Percentile(results, 25);
+        p75 = Percentile(results, 75);
+
+        auto cycles_results = state.m_cycles_results;
+        std::sort(cycles_results.begin(), cycles_results.end());
+        cycles = Percentile(cycles_results, 50);
+        auto instructions_results = state.m_instructions_results;
+        std::sort(instructions_results.begin(), instructions_results.end());
+        instructions = Percentile(instructions_results, 50);
+    }
+};
+
+} // namespace
 
 void benchmark::ConsolePrinter::header()
 {
@@ -19,31 +74,124 @@ void benchmark::ConsolePrinter::header()
 
 void benchmark::ConsolePrinter::result(const State& state)
 {
-    auto results = state.m_elapsed_results;
-    std::sort(results.begin(), results.end());
+    Stats stats(state);
+    std::cout << std::setprecision(6);
+    std::cout << state.m_name << ", " << state.m_num_evals << ", " << state.m_num_iters << ", " << stats.total << ", " << stats.min << ", " << stats.max << ", " << stats.median << std::endl;
+}
 
-    double total = state.m_num_iters * std::accumulate(results.begin(), results.end(), 0.0);
+void benchmark::ConsolePrinter::footer() {}
 
-    double front = 0;
-    double back = 0;
-    double median = 0;
+void benchmark::JsonPrinter::header()
+{
+    std::cout << "{\"benchmarks\": [" << std::endl;
+}
 
-    if (!results.empty()) {
-        front = results.front();
-        back = results.back();
+void benchmark::JsonPrinter::result(const State& state)
+{
+    Stats stats(state);
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("name", state.m_name);
+    result.pushKV("evals", (uint64_t)state.m_num_evals);
+    result.pushKV("iterations", (uint64_t)state.m_num_iters);
+    if (!state.m_elapsed_results.empty()) {
+        result.pushKV("total", stats.total);
+        result.pushKV("min", stats.min);
+        result.pushKV("max", stats.max);
+        result.pushKV("mean", stats.mean);
+        result.pushKV("median", stats.median);
+        result.pushKV("p25", stats.p25);
+        result.pushKV("p75", stats.p75);
+        if (stats.cycles > 0) result.pushKV("cycles", stats.cycles);
+        if (stats.instructions > 0) result.pushKV("instructions", stats.instructions);
+    }
+    std::cout << m_prefix << result.write() << std::endl;
+    m_prefix = ",";
+}
+
+void benchmark::JsonPrinter::footer()
+{
+    std::cout << "]}" << std::endl;
+}
 
-        size_t mid = results.size() / 2;
-        median = results[mid];
-        if (0 == results.size() % 2) {
-            median = (results[mid] + results[mid + 1]) / 2;
+void benchmark::CsvPrinter::header()
+{
+    std::cout << "name,evals,iterations,total,min,max,mean,median,p25,p75,cycles,instructions" << std::endl;
+}
+
+void benchmark::CsvPrinter::result(const State& state)
+{
+    Stats stats(state);
+    std::cout << std::setprecision(6);
+    std::cout << state.m_name << "," << state.m_num_evals << "," << state.m_num_iters << "," << stats.total << "," << stats.min << "," << stats.max << ","
+              << stats.mean << "," << stats.median << "," << stats.p25 << "," << stats.p75 << ",";
+    // Leave the counters empty where they were not counted
+    if (stats.cycles > 0) std::cout << stats.cycles;
+    std::cout << ",";
+    if (stats.instructions > 0) std::cout << stats.instructions;
+    std::cout << std::endl;
+}
+
+void benchmark::CsvPrinter::footer() {}
+
+std::map<std::string, double> benchmark::BaselineComparison::ReadBaseline(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error(strprintf("Cannot open baseline %s", path));
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    UniValue baseline;
+    if (!baseline.read(contents.str()) || !baseline.isObject() || !baseline["benchmarks"].isArray()) {
+        throw std::runtime_error(strprintf("Baseline %s is not the output of -printer=json", path));
+    }
+    std::map<std::string, double> medians;
+    for (const UniValue& result : baseline["benchmarks"].getValues()) {
+        if (result["name"].isStr() && result["median"].isNum()) {
+            medians[result["name"].get_str()] = result["median"].get_real();
         }
     }
+    return medians;
+}
 
-    std::cout << std::setprecision(6);
-    std::cout << state.m_name << ", " << state.m_num_evals << ", " << state.m_num_iters << ", " << total << ", " << front << ", " << back << ", " << median << std::endl;
+benchmark::BaselineComparison::BaselineComparison(Printer& printer, std::map<std::string, double> baseline, double threshold_percent)
+    : m_printer(printer), m_baseline(std::move(baseline)), m_threshold_percent(threshold_percent)
+{
+}
+
+void benchmark::BaselineComparison::header()
+{
+    m_printer.header();
+}
+
+void benchmark::BaselineComparison::result(const State& state)
+{
+    m_printer.result(state);
+    if (state.m_elapsed_results.empty()) return;
+
+    double median = Stats(state).median;
+    auto it = m_baseline.find(state.m_name);
+    if (it == m_baseline.end() || it->second <= 0) {
+        m_lines.push_back(strprintf("%s, %g, -, -, new", state.m_name, median));
+        return;
+    }
+    double change = (median / it->second - 1) * 100;
+    bool regression = change > m_threshold_percent;
+    if (regression) m_regressions++;
+    m_lines.push_back(strprintf("%s, %g, %g, %+.1f%%, %s", state.m_name, median, it->second, change, regression ? "REGRESSION" : "ok"));
+}
+
+// The comparison goes to stderr, to keep the output of the printer intact
+void benchmark::BaselineComparison::footer()
+{
+    m_printer.footer();
+    std::cerr << strprintf("# Benchmark, median, baseline median, change, result (threshold %g%%)", m_threshold_percent) << std::endl;
+    for (const std::string& line : m_lines) {
+        std::cerr << line << std::endl;
+    }
+    std::cerr << strprintf("# %d regression(s)", m_regressions) << std::endl;
 }
 
-void benchmark::ConsolePrinter::footer() {}
 benchmark::PlotlyPrinter::PlotlyPrinter(std::string plotly_url, int64_t width, int64_t height)
     : m_plotly_url(plotly_url), m_width(width), m_height(height)
 {
@@ -133,8 +281,12 @@ void benchmark::BenchRunner::RunAll(Printer& printer, uint64_t num_evals, double
 bool benchmark::State::UpdateTimer(const benchmark::time_point current_time)
 {
     if (m_start_time != time_point()) {
+        uint64_t cycles = perf_cpucycles();
+        uint64_t instructions = perf_instructions();
         std::chrono::duration<double> diff = current_time - m_start_time;
         m_elapsed_results.push_back(diff.count() / m_num_iters);
+        m_cycles_results.push_back(cycles && m_start_cycles ? double(cycles - m_start_cycles) / m_num_iters : 0);
+        m_instructions_results.push_back(instructions && m_start_instructions ? double(instructions - m_start_instructions) / m_num_iters : 0);
 
         if (m_elapsed_results.size() == m_num_evals) {
             return false;
@@ -5,6 +5,8 @@
 #ifndef BITCOIN_BENCH_BENCH_H
 #define BITCOIN_BENCH_BENCH_H
 
+#include <bench/perf.h>
+
 #include <functional>
 #include <limits>
 #include <map>
@@ -59,7 +61,12 @@ public:
     const uint64_t m_num_iters;
     const uint64_t m_num_evals;
     std::vector<double> m_elapsed_results;
+    //! CPU cycles and instructions per iteration of each evaluation, 0 where they cannot be counted
+    std::vector<double> m_cycles_results;
+    std::vector<double> m_instructions_results;
     time_point m_start_time;
+    uint64_t m_start_cycles = 0;
+    uint64_t m_start_instructions = 0;
 
     bool UpdateTimer(time_point finish_time);
 
@@ -75,6 +82,8 @@ public:
 
         bool result = UpdateTimer(clock::now());
         // measure again so runtime of UpdateTimer is not included
+        m_start_instructions = perf_instructions();
+        m_start_cycles = perf_cpucycles();
         m_start_time = clock::now();
         return result;
     }
@@ -116,6 +125,51 @@ public:
     void footer();
 };
 
+// one JSON object with the statistics of all benchmarks, which -baseline reads
+class JsonPrinter : public Printer
+{
+public:
+    void header();
+    void result(const State& state);
+    void footer();
+
+private:
+    const char* m_prefix = "";
+};
+
+// one line of comma-separated statistics per benchmark
+class CsvPrinter : public Printer
+{
+public:
+    void header();
+    void result(const State& state);
+    void footer();
+};
+
+// passes results on to another printer, and compares their medians with a
+// baseline written by JsonPrinter
+class BaselineComparison : public Printer
+{
+public:
+    /** Medians of a JsonPrinter output by benchmark name. Throws std::runtime_error if it cannot be read. */
+    static std::map<std::string, double> ReadBaseline(const std::string& path);
+
+    BaselineComparison(Printer& printer, std::map<std::string, double> baseline, double threshold_percent);
+    void header();
+    void result(const State& state);
+    void footer();
+
+    /** Benchmarks whose median exceeds the baseline's by more than the threshold */
+    int Regressions() const { return m_regressions; }
+
+private:
+    Printer& m_printer;
+    const std::map<std::string, double> m_baseline;
+    const double m_threshold_percent;
+    std::vector<std::string> m_lines;
+    int m_regressions = 0;
+};
+
 // creates box plot with plotly.js
 class PlotlyPrinter : public Printer
 {
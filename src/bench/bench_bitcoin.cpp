@@ -4,7 +4,9 @@
 
 #include <bench/bench.h>
 
+#include <crypto/aes.h>
 #include <crypto/sha256.h>
+#include <dbwrapper.h>
 #include <key.h>
 #include <validation.h>
 #include <util.h>
@@ -21,6 +23,10 @@ static const char* DEFAULT_BENCH_PRINTER = "console";
 static const char* DEFAULT_PLOT_PLOTLYURL = "https://cdn.plot.ly/plotly-latest.min.js";
 static const int64_t DEFAULT_PLOT_WIDTH = 1024;
 static const int64_t DEFAULT_PLOT_HEIGHT = 768;
+static const char* DEFAULT_REGRESSION_THRESHOLD = "10";
+static const int64_t DEFAULT_COINSDB_COINS = 250000;
+static const int64_t DEFAULT_WALLET_TXS = 10000;
+static const int64_t DEFAULT_WALLET_KEYS = 10000;
 
 int
 main(int argc, char** argv)
@@ -34,15 +40,22 @@ main(int argc, char** argv)
                   << HelpMessageOpt("-evals=<n>", strprintf(_("Number of measurement evaluations to perform. (default: %u)"), DEFAULT_BENCH_EVALUATIONS))
                   << HelpMessageOpt("-filter=<regex>", strprintf(_("Regular expression filter to select benchmark by name (default: %s)"), DEFAULT_BENCH_FILTER))
                   << HelpMessageOpt("-scaling=<n>", strprintf(_("Scaling factor for benchmark's runtime (default: %u)"), DEFAULT_BENCH_SCALING))
-                  << HelpMessageOpt("-printer=(console|plot)", strprintf(_("Choose printer format. console: print data to console. plot: Print results as HTML graph (default: %s)"), DEFAULT_BENCH_PRINTER))
+                  << HelpMessageOpt("-printer=(console|plot|json|csv)", strprintf(_("Choose printer format. console: print data to console. plot: Print results as HTML graph. json, csv: print statistics and, where available, CPU cycles and instructions per iteration (default: %s)"), DEFAULT_BENCH_PRINTER))
                   << HelpMessageOpt("-plot-plotlyurl=<uri>", strprintf(_("URL to use for plotly.js (default: %s)"), DEFAULT_PLOT_PLOTLYURL))
                   << HelpMessageOpt("-plot-width=<x>", strprintf(_("Plot width in pixel (default: %u)"), DEFAULT_PLOT_WIDTH))
-                  << HelpMessageOpt("-plot-height=<x>", strprintf(_("Plot height in pixel (default: %u)"), DEFAULT_PLOT_HEIGHT));
+                  << HelpMessageOpt("-plot-height=<x>", strprintf(_("Plot height in pixel (default: %u)"), DEFAULT_PLOT_HEIGHT))
+                  << HelpMessageOpt("-coinsdb-coins=<n>", strprintf(_("Coins in the chainstate of the CoinsDB benchmarks (default: %u)"), DEFAULT_COINSDB_COINS))
+                  << HelpMessageOpt("-wallet-txs=<n>", strprintf(_("Transactions in the wallets of the Wallet benchmarks (default: %u)"), DEFAULT_WALLET_TXS))
+                  << HelpMessageOpt("-wallet-keys=<n>", strprintf(_("Keys in the keypools of the wallets of the Wallet benchmarks (default: %u)"), DEFAULT_WALLET_KEYS))
+                  << HelpMessageOpt("-dbprofile=<profile>", strprintf(_("Tune the databases of the benchmarks for the storage: %s (default: %s)"), ListDBProfiles(), DEFAULT_DB_PROFILE))
+                  << HelpMessageOpt("-baseline=<file>", _("Compare the median times with those of a file written with -printer=json, print the comparison to stderr and exit with an error if any regressed"))
+                  << HelpMessageOpt("-regression-threshold=<percent>", strprintf(_("Increase of a median time over the baseline reported as a regression (default: %s)"), DEFAULT_REGRESSION_THRESHOLD));
 
         return 0;
     }
 
     SHA256AutoDetect();
+    AESAutoDetect();
     RandomInit();
     ECC_Start();
     SetupEnvironment();
@@ -63,9 +76,28 @@ main(int argc, char** argv)
             gArgs.GetArg("-plot-plotlyurl", DEFAULT_PLOT_PLOTLYURL),
             gArgs.GetArg("-plot-width", DEFAULT_PLOT_WIDTH),
             gArgs.GetArg("-plot-height", DEFAULT_PLOT_HEIGHT)));
+    } else if ("json" == printer_arg) {
+        printer.reset(new benchmark::JsonPrinter());
+    } else if ("csv" == printer_arg) {
+        printer.reset(new benchmark::CsvPrinter());
     }
 
-    benchmark::BenchRunner::RunAll(*printer, evaluations, scaling_factor, regex_filter, is_list_only);
+    std::unique_ptr<benchmark::BaselineComparison> comparison;
+    if (gArgs.IsArgSet("-baseline")) {
+        try {
+            comparison.reset(new benchmark::BaselineComparison(*printer,
+                benchmark::BaselineComparison::ReadBaseline(gArgs.GetArg("-baseline", "")),
+                boost::lexical_cast<double>(gArgs.GetArg("-regression-threshold", DEFAULT_REGRESSION_THRESHOLD))));
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            ECC_Stop();
+            return EXIT_FAILURE;
+        }
+    }
+
+    benchmark::BenchRunner::RunAll(comparison ? *comparison : *printer, evaluations, scaling_factor, regex_filter, is_list_only);
 
+    int ret = comparison && comparison->Regressions() > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
     ECC_Stop();
+    return ret;
 }
@@ -0,0 +1,53 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <blockencodings.h>
+#include <streams.h>
+#include <txmempool.h>
+
+namespace block_bench {
+#include <bench/data/block413567.raw.h>
+} // namespace block_bench
+
+static void AddTx(const CTransactionRef& tx, CTxMemPool& pool)
+{
+    LockPoints lp;
+    pool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(tx, 1000, 0, 1, false, 4, lp));
+}
+
+// Reconstruct a full block from its compact form against a large mempool that
+// holds all of the block's transactions, scanned in insertion order.
+static void CompactBlockInitData(benchmark::State& state)
+{
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+
+    CTxMemPool pool;
+    for (int i = 0; i < 50000; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << i;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        tx.vout[0].nValue = i;
+        AddTx(MakeTransactionRef(tx), pool);
+    }
+    for (size_t i = 1; i < block.vtx.size(); i++)
+        AddTx(block.vtx[i], pool);
+
+    const CBlockHeaderAndShortTxIDs cmpctblock(block, true);
+    const std::vector<std::pair<uint256, CTransactionRef>> extra_txn;
+
+    while (state.KeepRunning()) {
+        PartiallyDownloadedBlock partialBlock(&pool);
+        assert(partialBlock.InitData(cmpctblock, extra_txn) == READ_STATUS_OK);
+    }
+}
+
+BENCHMARK(CompactBlockInitData, 100);
@@ -0,0 +1,167 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/chain.h>
+
+#include <chainparams.h>
+#include <consensus/consensus.h>
+#include <consensus/merkle.h>
+#include <consensus/validation.h>
+#include <policy/policy.h>
+#include <policy/rbf.h>
+#include <pubkey.h>
+#include <pow.h>
+#include <random.h>
+#include <script/sigcache.h>
+#include <script/standard.h>
+#include <timedata.h>
+#include <txmempool.h>
+#include <util.h>
+#include <utiltime.h>
+#include <validation.h>
+#include <validationinterface.h>
+
+/** Outputs of each transaction funding the coins of CreateCoins */
+static const int FUNDING_OUTPUTS = 2000;
+/** Funding transactions mined per block, to stay below the block weight limit */
+static const int FUNDING_TXS_PER_BLOCK = 8;
+
+static const CScript REDEEM_SCRIPT = CScript() << OP_TRUE;
+const CScript P2SH_OP_TRUE = GetScriptForDestination(CScriptID(REDEEM_SCRIPT));
+
+CMutableTransaction SpendCoins(const std::vector<BenchCoin>& vInputs, int nOutputs, CAmount nFeeRate, CAmount nFeeExtra, std::vector<BenchCoin>& vOutputs, CAmount& nFee)
+{
+    CMutableTransaction tx;
+    CAmount nValueIn = 0;
+    for (const BenchCoin& coin : vInputs) {
+        tx.vin.emplace_back(coin.outpoint, CScript() << ToByteVector(REDEEM_SCRIPT), MAX_BIP125_RBF_SEQUENCE);
+        nValueIn += coin.nValue;
+    }
+    tx.vout.resize(nOutputs, CTxOut(0, P2SH_OP_TRUE));
+    // The size does not depend on the values
+    nFee = nFeeRate * ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION) + nFeeExtra;
+    const CAmount nValueOut = nValueIn - nFee;
+    for (int i = 0; i < nOutputs; i++) {
+        tx.vout[i].nValue = nValueOut / nOutputs + (i == 0 ? nValueOut % nOutputs : 0);
+        assert(!IsDust(tx.vout[i], ::dustRelayFee));
+    }
+    const uint256 hash = tx.GetHash();
+    for (int i = 0; i < nOutputs; i++)
+        vOutputs.push_back(BenchCoin{COutPoint(hash, i), tx.vout[i].nValue});
+    return tx;
+}
+
+RegtestChainSetup::RegtestChainSetup(int64_t nDbCacheMiB) :
+    m_prev_coin_cache_usage(nCoinCacheUsage), m_prev_script_check_threads(nScriptCheckThreads)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    InitSignatureCache();
+    InitScriptExecutionCache();
+
+    ClearDatadirCache();
+    m_path = fs::temp_directory_path() / strprintf("bench_bitcoin_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+    fs::create_directories(m_path);
+    gArgs.ForceSetArg("-datadir", m_path.string());
+
+    // Split the cache as init does for -dbcache
+    int64_t nTotalCache = nDbCacheMiB << 20;
+    int64_t nBlockTreeDBCache = std::min(nTotalCache / 8, nMaxBlockDBCache << 20);
+    nTotalCache -= nBlockTreeDBCache;
+    int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23));
+    nTotalCache -= nCoinDBCache;
+    nCoinCacheUsage = nTotalCache;
+
+    m_threads.create_thread(boost::bind(&CScheduler::serviceQueue, &m_scheduler));
+    GetMainSignals().RegisterBackgroundSignalScheduler(m_scheduler);
+
+    pblocktree.reset(new CBlockTreeDB(nBlockTreeDBCache, false, true));
+    pcoinsdbview.reset(new CCoinsViewDB(nCoinDBCache, false, true));
+    pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get()));
+    CValidationState state;
+    assert(LoadGenesisBlock(Params()));
+    assert(ActivateBestChain(state, Params()));
+}
+
+RegtestChainSetup::~RegtestChainSetup()
+{
+    m_threads.interrupt_all();
+    m_threads.join_all();
+    GetMainSignals().FlushBackgroundCallbacks();
+    GetMainSignals().UnregisterBackgroundSignalScheduler();
+    mempool.clear();
+    UnloadBlockIndex();
+    pcoinsTip.reset();
+    pcoinsdbview.reset();
+    pblocktree.reset();
+    nCoinCacheUsage = m_prev_coin_cache_usage;
+    nScriptCheckThreads = m_prev_script_check_threads;
+    fs::remove_all(m_path);
+}
+
+void RegtestChainSetup::StartScriptCheckThreads(int nPar)
+{
+    // -par counts the thread connecting the block
+    nScriptCheckThreads = nPar > 1 ? nPar : 0;
+    for (int i = 0; i < nPar - 1; i++)
+        m_threads.create_thread(&ThreadScriptCheck);
+}
+
+CBlock RegtestChainSetup::MineBlock(const std::vector<CMutableTransaction>& txs, const CScript& scriptPubKey)
+{
+    const Consensus::Params& consensus = Params().GetConsensus();
+    CBlock block;
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindexPrev = chainActive.Tip();
+        block.nVersion = ComputeBlockVersion(pindexPrev, consensus);
+        block.hashPrevBlock = pindexPrev->GetBlockHash();
+        block.nTime = std::max(pindexPrev->GetMedianTimePast() + 1, GetAdjustedTime());
+        block.nBits = GetNextWorkRequired(pindexPrev, &block, consensus);
+
+        const int nHeight = pindexPrev->nHeight + 1;
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].prevout.SetNull();
+        coinbase.vin[0].scriptSig = CScript() << nHeight << OP_0;
+        coinbase.vout.emplace_back(GetBlockSubsidy(nHeight, consensus), scriptPubKey);
+        block.vtx.push_back(MakeTransactionRef(std::move(coinbase)));
+        for (const CMutableTransaction& tx : txs)
+            block.vtx.push_back(MakeTransactionRef(tx));
+        GenerateCoinbaseCommitment(block, pindexPrev, consensus);
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    while (!CheckProofOfWork(block.GetHash(), block.nBits, consensus))
+        ++block.nNonce;
+
+    bool fNewBlock;
+    assert(ProcessNewBlock(Params(), std::make_shared<const CBlock>(block), true, &fNewBlock));
+    LOCK(cs_main);
+    assert(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    return block;
+}
+
+std::vector<BenchCoin> RegtestChainSetup::CreateCoins(int nCoins)
+{
+    // Mine the coinbases funding the coins, and make them mature
+    const int nFundingTxs = (nCoins + FUNDING_OUTPUTS - 1) / FUNDING_OUTPUTS;
+    std::vector<CTransactionRef> vCoinbases;
+    for (int i = 0; i < nFundingTxs; i++)
+        vCoinbases.push_back(MineBlock({}, P2SH_OP_TRUE).vtx[0]);
+    for (int i = 0; i < COINBASE_MATURITY; i++)
+        MineBlock({}, P2SH_OP_TRUE);
+
+    std::vector<BenchCoin> vCoins;
+    std::vector<CMutableTransaction> vFunding;
+    for (const CTransactionRef& coinbase : vCoinbases) {
+        CAmount nFee;
+        vFunding.push_back(SpendCoins({BenchCoin{COutPoint(coinbase->GetHash(), 0), coinbase->vout[0].nValue}}, FUNDING_OUTPUTS, 1, 0, vCoins, nFee));
+        if (vFunding.size() == FUNDING_TXS_PER_BLOCK) {
+            MineBlock(vFunding, P2SH_OP_TRUE);
+            vFunding.clear();
+        }
+    }
+    if (!vFunding.empty())
+        MineBlock(vFunding, P2SH_OP_TRUE);
+    return vCoins;
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_CHAIN_H
+#define BITCOIN_BENCH_CHAIN_H
+
+#include <amount.h>
+#include <fs.h>
+#include <primitives/block.h>
+#include <scheduler.h>
+#include <script/script.h>
+#include <txdb.h>
+
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+
+/** An output a benchmark can spend, and its value */
+struct BenchCoin {
+    COutPoint outpoint;
+    CAmount nValue;
+};
+
+/** A standard P2SH of OP_TRUE, so that spending it needs no signature */
+extern const CScript P2SH_OP_TRUE;
+
+/**
+ * Create a transaction spending vInputs, which pay to P2SH_OP_TRUE, to
+ * nOutputs equal outputs paying to it too, with a fee of nFeeRate satoshis
+ * per byte plus nFeeExtra; append its outputs to vOutputs. All transactions
+ * signal replaceability.
+ */
+CMutableTransaction SpendCoins(const std::vector<BenchCoin>& vInputs, int nOutputs, CAmount nFeeRate, CAmount nFeeExtra, std::vector<BenchCoin>& vOutputs, CAmount& nFee);
+
+/**
+ * A regtest chain in a temporary data directory, for the benchmarks of
+ * validation and mining. Sets up the block and coins databases and the
+ * background scheduler as init does, splitting nDbCacheMiB of -dbcache
+ * between their caches, and restores the globals it changes when destroyed.
+ */
+class RegtestChainSetup
+{
+public:
+    explicit RegtestChainSetup(int64_t nDbCacheMiB = nDefaultDbCache);
+    ~RegtestChainSetup();
+
+    /** Start script check threads as -par=nPar does */
+    void StartScriptCheckThreads(int nPar);
+
+    /** Mine a block of txs on the tip, its coinbase paying to scriptPubKey */
+    CBlock MineBlock(const std::vector<CMutableTransaction>& txs, const CScript& scriptPubKey);
+
+    /** Mine the blocks creating at least nCoins mature coins paying to P2SH_OP_TRUE */
+    std::vector<BenchCoin> CreateCoins(int nCoins);
+
+    /** The scheduler the validation interface queue runs on */
+    CScheduler& GetScheduler() { return m_scheduler; }
+
+private:
+    fs::path m_path;
+    CScheduler m_scheduler;
+    boost::thread_group m_threads;
+    size_t m_prev_coin_cache_usage;
+    int m_prev_script_check_threads;
+};
+
+#endif // BITCOIN_BENCH_CHAIN_H
@@ -16,6 +16,12 @@ namespace block_bench {
 // These are the two major time-sinks which happen after we have fully received
 // a block off the wire, but before we can relay the block on to peers using
 // compact block relay.
+//
+// Most of the deserialization time goes to heap allocations: for this block
+// (1557 transactions, 4887 inputs, 3581 outputs) that is about 6 per
+// transaction, namely the shared_ptr of the CTransactionRef, vin and vout,
+// plus every script longer than the 28 bytes a CScript stores inline, which
+// includes nearly all scriptSigs. Destroying the block frees as many again.
 
 static void DeserializeBlockTest(benchmark::State& state)
 {
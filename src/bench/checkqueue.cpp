@@ -6,6 +6,7 @@
 #include <util.h>
 #include <validation.h>
 #include <checkqueue.h>
+#include <hash.h>
 #include <prevector.h>
 #include <vector>
 #include <boost/thread/thread.hpp>
@@ -60,3 +61,65 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.join_all();
 }
 BENCHMARK(CCheckQueueSpeedPrevectorJob, 1400);
+
+// Scaling sweep over the number of worker threads, for both schedulers. Every
+// check does a small, fixed amount of hashing, so that the measured time
+// reflects how well the checks are spread over the workers.
+static void CCheckQueueScaling(benchmark::State& state, int nThreads, bool fWorkStealing)
+{
+    struct HashJob {
+        uint256 h;
+        HashJob() {}
+        explicit HashJob(FastRandomContext& insecure_rand) : h(insecure_rand.rand256()) {}
+        bool operator()()
+        {
+            for (int i = 0; i < 64; ++i) {
+                h = Hash(h.begin(), h.end());
+            }
+            return true;
+        }
+        void swap(HashJob& x) { std::swap(h, x.h); }
+    };
+    CCheckQueue<HashJob> queue {QUEUE_BATCH_SIZE, fWorkStealing};
+    boost::thread_group tg;
+    // The master joins as the last worker.
+    for (auto x = 0; x < nThreads - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        FastRandomContext insecure_rand(true);
+        CCheckQueueControl<HashJob> control(&queue);
+        for (size_t b = 0; b < BATCHES; ++b) {
+            std::vector<HashJob> vChecks;
+            vChecks.reserve(BATCH_SIZE);
+            for (size_t x = 0; x < BATCH_SIZE; ++x)
+                vChecks.emplace_back(insecure_rand);
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void CCheckQueueScaling_1(benchmark::State& state) { CCheckQueueScaling(state, 1, false); }
+static void CCheckQueueScaling_2(benchmark::State& state) { CCheckQueueScaling(state, 2, false); }
+static void CCheckQueueScaling_4(benchmark::State& state) { CCheckQueueScaling(state, 4, false); }
+static void CCheckQueueScaling_8(benchmark::State& state) { CCheckQueueScaling(state, 8, false); }
+static void CCheckQueueScaling_16(benchmark::State& state) { CCheckQueueScaling(state, 16, false); }
+static void CCheckQueueScalingWorkStealing_1(benchmark::State& state) { CCheckQueueScaling(state, 1, true); }
+static void CCheckQueueScalingWorkStealing_2(benchmark::State& state) { CCheckQueueScaling(state, 2, true); }
+static void CCheckQueueScalingWorkStealing_4(benchmark::State& state) { CCheckQueueScaling(state, 4, true); }
+static void CCheckQueueScalingWorkStealing_8(benchmark::State& state) { CCheckQueueScaling(state, 8, true); }
+static void CCheckQueueScalingWorkStealing_16(benchmark::State& state) { CCheckQueueScaling(state, 16, true); }
+
+BENCHMARK(CCheckQueueScaling_1, 20);
+BENCHMARK(CCheckQueueScaling_2, 40);
+BENCHMARK(CCheckQueueScaling_4, 80);
+BENCHMARK(CCheckQueueScaling_8, 160);
+BENCHMARK(CCheckQueueScaling_16, 320);
+BENCHMARK(CCheckQueueScalingWorkStealing_1, 20);
+BENCHMARK(CCheckQueueScalingWorkStealing_2, 40);
+BENCHMARK(CCheckQueueScalingWorkStealing_4, 80);
+BENCHMARK(CCheckQueueScalingWorkStealing_8, 160);
+BENCHMARK(CCheckQueueScalingWorkStealing_16, 320);
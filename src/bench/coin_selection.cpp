@@ -3,6 +3,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <bench/bench.h>
+#include <random.h>
+#include <wallet/coinselection.h>
 #include <wallet/wallet.h>
 
 #include <set>
@@ -57,3 +59,53 @@ static void CoinSelection(benchmark::State& state)
 }
 
 BENCHMARK(CoinSelection, 650);
+
+// Branch and bound search for a change-free match in large pools of coins of
+// random values. The target is the sum of a few of them, so a match exists,
+// but the search may also settle on another one within the cost of change.
+static void CoinSelectionBnB(benchmark::State& state, int nUtxos)
+{
+    const CWallet wallet;
+    std::vector<COutput> vCoins;
+    LOCK(wallet.cs_wallet);
+
+    FastRandomContext rand(true);
+    for (int i = 0; i < nUtxos; i++) {
+        addCoin(1000 + rand.randrange(COIN), wallet, vCoins);
+        vCoins.back().nInputBytes = 148;
+    }
+
+    CoinSelectionParams params;
+    params.use_bnb = true;
+    params.effective_fee = CFeeRate(1000);
+    params.not_input_fees = params.effective_fee.GetFee(10 + 34);
+    params.cost_of_change = params.effective_fee.GetFee(34) + params.effective_fee.GetFee(148);
+
+    CAmount nTarget = 0;
+    for (int i = 0; i < 5; i++)
+        nTarget += vCoins[rand.randrange(vCoins.size())].tx->tx->vout[0].nValue;
+
+    while (state.KeepRunning()) {
+        std::set<CInputCoin> setCoinsRet;
+        CAmount nValueRet;
+        bool success = wallet.SelectCoinsMinConf(nTarget, 1, 6, 0, vCoins, setCoinsRet, nValueRet, params);
+        assert(success);
+        assert(nValueRet >= nTarget);
+    }
+
+    for (COutput output : vCoins)
+        delete output.tx;
+}
+
+static void CoinSelectionBnB10k(benchmark::State& state)
+{
+    CoinSelectionBnB(state, 10000);
+}
+
+static void CoinSelectionBnB100k(benchmark::State& state)
+{
+    CoinSelectionBnB(state, 100000);
+}
+
+BENCHMARK(CoinSelectionBnB10k, 100);
+BENCHMARK(CoinSelectionBnB100k, 10);
@@ -0,0 +1,306 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <chainparams.h>
+#include <coins.h>
+#include <dbwrapper.h>
+#include <fs.h>
+#include <random.h>
+#include <txdb.h>
+#include <util.h>
+#include <utiltime.h>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+
+/** Coins of the chainstate the benchmarks share, unless -coinsdb-coins is set (same default as in bench_bitcoin.cpp) */
+static const int64_t DEFAULT_COINSDB_COINS = 250000;
+/** Coins written per BatchWrite while building the chainstate */
+static const int BUILD_BATCH_COINS = 50000;
+/** Coins looked up, or spent and created, per iteration */
+static const int LOOKUP_COINS = 1000;
+static const int FLUSH_COINS = 10000;
+/** Cache of the cold variants: too small to hold the blocks of LOOKUP_COINS random coins */
+static const size_t COLD_CACHE = 1 << 20;
+
+namespace {
+
+/**
+ * An on-disk chainstate of -coinsdb-coins synthesized coins in a temporary
+ * directory, built once per -coinsbackend and shared by the benchmarks, which
+ * leave it at the same size. LevelDB is opened with the -dbprofile options,
+ * so that their effect can be measured.
+ */
+class CoinsDBFixture
+{
+public:
+    explicit CoinsDBFixture(const std::string& strBackend);
+    ~CoinsDBFixture();
+
+    /** Reopen the database with an nCacheSize byte cache, dropping what it held */
+    CCoinsViewStore& Open(size_t nCacheSize);
+    /** Reopen the database with a cache holding all of it, and read all the coins into it */
+    CCoinsViewStore& OpenWarm();
+
+    Coin RandomCoin();
+    const COutPoint& RandomOutPoint() { return m_outpoints[m_rng.randrange(m_outpoints.size())]; }
+    /** Replace the outpoints of spent coins with those of created ones */
+    void Replace(const COutPoint& spent, const COutPoint& created);
+
+    std::vector<COutPoint> m_outpoints;
+    uint256 m_best_block;
+
+private:
+    const std::string m_backend;
+    fs::path m_path;
+    FastRandomContext m_rng{true};
+    std::unique_ptr<CCoinsViewStore> m_view;
+    std::map<COutPoint, size_t> m_positions;
+};
+
+CoinsDBFixture::CoinsDBFixture(const std::string& strBackend) : m_backend(strBackend)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    m_path = fs::temp_directory_path() / strprintf("bench_bitcoin_coinsdb_%s_%lu_%i", m_backend, (unsigned long)GetTime(), (int)GetRand(100000));
+    fs::create_directories(m_path);
+    m_best_block = m_rng.rand256();
+
+    CCoinsViewStore& view = Open(nMaxCoinsDBCache << 20);
+    const int64_t nCoins = gArgs.GetArg("-coinsdb-coins", DEFAULT_COINSDB_COINS);
+    CCoinsMap mapCoins;
+    while ((int64_t)m_outpoints.size() < nCoins) {
+        // Transactions of one to four outputs
+        const uint256 txid = m_rng.rand256();
+        const int nOutputs = 1 + m_rng.randrange(4);
+        for (int i = 0; i < nOutputs && (int64_t)m_outpoints.size() < nCoins; i++) {
+            CCoinsCacheEntry& entry = mapCoins[COutPoint(txid, i)];
+            entry.coin = RandomCoin();
+            entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+            m_positions[COutPoint(txid, i)] = m_outpoints.size();
+            m_outpoints.emplace_back(txid, i);
+        }
+        if (mapCoins.size() >= BUILD_BATCH_COINS)
+            assert(view.BatchWrite(mapCoins, m_best_block));
+    }
+    assert(view.BatchWrite(mapCoins, m_best_block));
+    // Settle the database as a node's would be after a while
+    view.CompactRange(COutPoint(uint256(), 0), COutPoint(uint256S(std::string(64, 'f')), std::numeric_limits<uint32_t>::max()));
+}
+
+CoinsDBFixture::~CoinsDBFixture()
+{
+    m_view.reset();
+    fs::remove_all(m_path);
+}
+
+CCoinsViewStore& CoinsDBFixture::Open(size_t nCacheSize)
+{
+    m_view.reset();
+    // Other benchmarks may have pointed -datadir elsewhere since
+    gArgs.ForceSetArg("-datadir", m_path.string());
+    ClearDatadirCache();
+    DBOptions dboptions;
+    assert(GetDBProfile(gArgs.GetArg("-dbprofile", DEFAULT_DB_PROFILE), DBKind::CHAINSTATE, dboptions));
+    m_view = OpenCoinsViewStore(m_backend, nCacheSize, false, false, dboptions);
+    return *m_view;
+}
+
+CCoinsViewStore& CoinsDBFixture::OpenWarm()
+{
+    // With room for the write buffers, which take half of the cache by default
+    const size_t nSize = Open(COLD_CACHE).EstimateSize();
+    CCoinsViewStore& view = Open(std::max(COLD_CACHE, 4 * nSize));
+    Coin coin;
+    for (const COutPoint& outpoint : m_outpoints)
+        assert(view.GetCoin(outpoint, coin));
+    return view;
+}
+
+Coin CoinsDBFixture::RandomCoin()
+{
+    // Half P2WPKH and half P2PKH, created at any height
+    CScript script;
+    const std::vector<unsigned char> hash = m_rng.randbytes(20);
+    if (m_rng.randbool()) {
+        script << OP_0 << hash;
+    } else {
+        script << OP_DUP << OP_HASH160 << hash << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    return Coin(CTxOut(m_rng.randrange(100000000), script), 1 + m_rng.randrange(500000), false);
+}
+
+void CoinsDBFixture::Replace(const COutPoint& spent, const COutPoint& created)
+{
+    auto it = m_positions.find(spent);
+    assert(it != m_positions.end());
+    const size_t nPos = it->second;
+    m_positions.erase(it);
+    m_positions[created] = nPos;
+    m_outpoints[nPos] = created;
+}
+
+CoinsDBFixture& GetCoinsDB(bool fLog = false)
+{
+    if (fLog) {
+        static CoinsDBFixture fixture("log");
+        return fixture;
+    }
+    static CoinsDBFixture fixture("leveldb");
+    return fixture;
+}
+
+} // namespace
+
+// Look up random coins, one read each
+static void CoinsDBGetCoinBench(benchmark::State& state, bool fWarm, bool fLog = false)
+{
+    CoinsDBFixture& fixture = GetCoinsDB(fLog);
+    CCoinsViewStore& view = fWarm ? fixture.OpenWarm() : fixture.Open(COLD_CACHE);
+    Coin coin;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < LOOKUP_COINS; i++)
+            assert(view.GetCoin(fixture.RandomOutPoint(), coin));
+    }
+}
+
+// Look up random coins with one GetCoins, which LevelDB serves with one CDBWrapper::ReadMany
+static void CoinsDBGetCoinsBench(benchmark::State& state, bool fWarm, bool fLog = false)
+{
+    CoinsDBFixture& fixture = GetCoinsDB(fLog);
+    CCoinsViewStore& view = fWarm ? fixture.OpenWarm() : fixture.Open(COLD_CACHE);
+    std::vector<COutPoint> outpoints(LOOKUP_COINS);
+    std::vector<Coin> coins;
+    while (state.KeepRunning()) {
+        for (COutPoint& outpoint : outpoints)
+            outpoint = fixture.RandomOutPoint();
+        assert(view.GetCoins(outpoints, coins) == outpoints.size());
+    }
+}
+
+// Read every coin in the order of their keys, as gettxoutsetinfo does
+static void CoinsDBCursorScanBench(benchmark::State& state, bool fLog)
+{
+    CoinsDBFixture& fixture = GetCoinsDB(fLog);
+    CCoinsViewStore& view = fixture.Open(nMaxCoinsDBCache << 20);
+    while (state.KeepRunning()) {
+        std::unique_ptr<CCoinsViewCursor> cursor(view.Cursor());
+        COutPoint key;
+        Coin coin;
+        size_t nCoins = 0;
+        for (; cursor->Valid(); cursor->Next()) {
+            assert(cursor->GetKey(key) && cursor->GetValue(coin));
+            nCoins++;
+        }
+        assert(nCoins == fixture.m_outpoints.size());
+    }
+}
+
+// Serialize a batch of coins into a CDBBatch without writing it
+static void CoinsDBBatchBuild(benchmark::State& state)
+{
+    CoinsDBFixture& fixture = GetCoinsDB();
+    CCoinsViewStore& view = fixture.Open(nMaxCoinsDBCache << 20);
+    std::vector<std::pair<COutPoint, Coin>> vCoins;
+    for (int i = 0; i < FLUSH_COINS; i++)
+        vCoins.emplace_back(COutPoint(GetRandHash(), i % 4), fixture.RandomCoin());
+    CDBBatch batch(*view.GetDB());
+    while (state.KeepRunning()) {
+        batch.Clear();
+        for (const auto& coin : vCoins)
+            batch.Write(std::make_pair('C', coin.first), coin.second);
+    }
+}
+
+// Flush FLUSH_COINS new dirty coins, erasing the ones of the previous
+// iteration in the same batch, so that the database keeps its size
+static void CoinsDBFlushBench(benchmark::State& state, bool fLog)
+{
+    CoinsDBFixture& fixture = GetCoinsDB(fLog);
+    CCoinsViewStore& view = fixture.Open(nMaxCoinsDBCache << 20);
+    std::vector<COutPoint> vPrevious;
+    while (state.KeepRunning()) {
+        CCoinsMap mapCoins;
+        for (const COutPoint& outpoint : vPrevious)
+            mapCoins[outpoint].flags = CCoinsCacheEntry::DIRTY;
+        vPrevious.clear();
+        const uint256 txid = GetRandHash();
+        for (int i = 0; i < FLUSH_COINS; i++) {
+            vPrevious.emplace_back(txid, i);
+            CCoinsCacheEntry& entry = mapCoins[vPrevious.back()];
+            entry.coin = fixture.RandomCoin();
+            entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+        }
+        assert(view.BatchWrite(mapCoins, fixture.m_best_block));
+    }
+    // Leave the database as it was
+    CCoinsMap mapCoins;
+    for (const COutPoint& outpoint : vPrevious)
+        mapCoins[outpoint].flags = CCoinsCacheEntry::DIRTY;
+    assert(view.BatchWrite(mapCoins, fixture.m_best_block));
+}
+
+// What connecting a block does to the database: look up LOOKUP_COINS random
+// coins, and flush them spent along with as many new coins
+static void CoinsDBMixedBench(benchmark::State& state, bool fWarm, bool fLog = false)
+{
+    CoinsDBFixture& fixture = GetCoinsDB(fLog);
+    CCoinsViewStore& view = fWarm ? fixture.OpenWarm() : fixture.Open(COLD_CACHE);
+    while (state.KeepRunning()) {
+        CCoinsMap mapCoins;
+        const uint256 txid = GetRandHash();
+        for (int i = 0; i < LOOKUP_COINS; i++) {
+            const COutPoint spent = fixture.RandomOutPoint();
+            CCoinsCacheEntry& entry = mapCoins[spent];
+            if (entry.flags)
+                continue;
+            assert(view.GetCoin(spent, entry.coin));
+            entry.coin.Clear();
+            entry.flags = CCoinsCacheEntry::DIRTY;
+
+            const COutPoint created(txid, i);
+            CCoinsCacheEntry& createdEntry = mapCoins[created];
+            createdEntry.coin = fixture.RandomCoin();
+            createdEntry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+            fixture.Replace(spent, created);
+        }
+        assert(view.BatchWrite(mapCoins, fixture.m_best_block));
+    }
+}
+
+static void CoinsDBGetCoinCold(benchmark::State& state) { CoinsDBGetCoinBench(state, false); }
+static void CoinsDBGetCoinWarm(benchmark::State& state) { CoinsDBGetCoinBench(state, true); }
+static void CoinsDBGetCoinsCold(benchmark::State& state) { CoinsDBGetCoinsBench(state, false); }
+static void CoinsDBGetCoinsWarm(benchmark::State& state) { CoinsDBGetCoinsBench(state, true); }
+static void CoinsDBMixedCold(benchmark::State& state) { CoinsDBMixedBench(state, false); }
+static void CoinsDBMixedWarm(benchmark::State& state) { CoinsDBMixedBench(state, true); }
+static void CoinsDBCursorScan(benchmark::State& state) { CoinsDBCursorScanBench(state, false); }
+static void CoinsDBFlush(benchmark::State& state) { CoinsDBFlushBench(state, false); }
+
+// The same on the log backend, whose reads only go through the OS page cache,
+// which OpenWarm fills
+static void CoinsLogGetCoin(benchmark::State& state) { CoinsDBGetCoinBench(state, true, true); }
+static void CoinsLogGetCoins(benchmark::State& state) { CoinsDBGetCoinsBench(state, true, true); }
+static void CoinsLogCursorScan(benchmark::State& state) { CoinsDBCursorScanBench(state, true); }
+static void CoinsLogFlush(benchmark::State& state) { CoinsDBFlushBench(state, true); }
+static void CoinsLogMixed(benchmark::State& state) { CoinsDBMixedBench(state, true, true); }
+
+BENCHMARK(CoinsDBGetCoinCold, 100);
+BENCHMARK(CoinsDBGetCoinWarm, 500);
+BENCHMARK(CoinsDBGetCoinsCold, 100);
+BENCHMARK(CoinsDBGetCoinsWarm, 500);
+BENCHMARK(CoinsDBCursorScan, 2);
+BENCHMARK(CoinsDBBatchBuild, 50);
+BENCHMARK(CoinsDBFlush, 10);
+BENCHMARK(CoinsDBMixedCold, 50);
+BENCHMARK(CoinsDBMixedWarm, 100);
+BENCHMARK(CoinsLogGetCoin, 500);
+BENCHMARK(CoinsLogGetCoins, 500);
+BENCHMARK(CoinsLogCursorScan, 2);
+BENCHMARK(CoinsLogFlush, 10);
+BENCHMARK(CoinsLogMixed, 100);
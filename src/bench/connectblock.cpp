@@ -0,0 +1,122 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <bench/chain.h>
+
+#include <chainparams.h>
+#include <consensus/consensus.h>
+#include <key.h>
+#include <keystore.h>
+#include <script/sign.h>
+#include <script/standard.h>
+#include <validation.h>
+#include <validationinterface.h>
+
+/** Outputs of the transaction creating the coins the measured blocks spend */
+static const int FIXTURE_OUTPUTS = 4000;
+/** Blocks disconnected and connected again by each iteration */
+static const int MEASURED_BLOCKS = 2;
+static const int FIXTURE_KEYS = 16;
+
+namespace {
+
+/**
+ * A regtest chain in a temporary data directory, flushed to disk, whose last
+ * MEASURED_BLOCKS blocks spend a synthesized UTXO set: two-input, two-output
+ * transactions signed for a mix of P2PKH and P2WPKH coins, for FIXTURE_OUTPUTS
+ * inputs in all.
+ */
+class ConnectBlockFixture
+{
+public:
+    ConnectBlockFixture(int nPar, int64_t nDbCacheMiB);
+
+    /**
+     * Disconnect the measured blocks from a view over the coins database, and
+     * connect them again, as -checklevel=4 does at startup: this reads the
+     * blocks and undo data from disk, looks the inputs up in the database and
+     * verifies their scripts on the script check threads.
+     */
+    void Run();
+
+private:
+    RegtestChainSetup m_chain;
+    CBasicKeyStore m_keystore;
+    std::vector<CScript> m_scripts;
+};
+
+// The smallest -dbcache still holds the coins of all the measured blocks, so
+// that VerifyDB disconnects all of them
+ConnectBlockFixture::ConnectBlockFixture(int nPar, int64_t nDbCacheMiB) : m_chain(nDbCacheMiB)
+{
+    m_chain.StartScriptCheckThreads(nPar);
+
+    for (int i = 0; i < FIXTURE_KEYS; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        m_keystore.AddKey(key);
+        CKeyID keyid = key.GetPubKey().GetID();
+        m_scripts.push_back(GetScriptForDestination(keyid));
+        m_scripts.push_back(GetScriptForDestination(WitnessV0KeyHash(keyid)));
+    }
+
+    // Fan the first coinbase out to the coins the measured blocks spend
+    CTransactionRef coinbase = m_chain.MineBlock({}, m_scripts[0]).vtx[0];
+    for (int i = 1; i < COINBASE_MATURITY; i++)
+        m_chain.MineBlock({}, m_scripts[0]);
+    CMutableTransaction fanout;
+    fanout.vin.emplace_back(COutPoint(coinbase->GetHash(), 0));
+    const CAmount nValue = coinbase->vout[0].nValue / FIXTURE_OUTPUTS;
+    for (int i = 0; i < FIXTURE_OUTPUTS; i++)
+        fanout.vout.emplace_back(nValue, m_scripts[i % m_scripts.size()]);
+    assert(SignSignature(m_keystore, *coinbase, fanout, 0, SIGHASH_ALL));
+    const CTransaction txFanout(fanout);
+    m_chain.MineBlock({fanout}, m_scripts[0]);
+
+    int nOutput = 0;
+    for (int i = 0; i < MEASURED_BLOCKS; i++) {
+        std::vector<CMutableTransaction> txs;
+        while (nOutput < FIXTURE_OUTPUTS * (i + 1) / MEASURED_BLOCKS) {
+            CMutableTransaction tx;
+            for (int j = 0; j < 2; j++) {
+                tx.vin.emplace_back(COutPoint(txFanout.GetHash(), nOutput + j));
+                tx.vout.emplace_back(nValue - 1000, m_scripts[(nOutput + j + 1) % m_scripts.size()]);
+            }
+            for (int j = 0; j < 2; j++)
+                assert(SignSignature(m_keystore, txFanout, tx, j, SIGHASH_ALL));
+            txs.push_back(tx);
+            nOutput += 2;
+        }
+        m_chain.MineBlock(txs, m_scripts[0]);
+    }
+
+    // Leave the UTXO set in the coins database, with nothing in the cache
+    SyncWithValidationInterfaceQueue();
+    FlushStateToDisk();
+}
+
+void ConnectBlockFixture::Run()
+{
+    // VerifyDB goes nCheckDepth blocks below the tip
+    assert(CVerifyDB().VerifyDB(Params(), pcoinsdbview.get(), 4, MEASURED_BLOCKS - 1));
+}
+
+} // namespace
+
+static void ConnectBlockBench(benchmark::State& state, int nPar, int64_t nDbCacheMiB)
+{
+    ConnectBlockFixture fixture(nPar, nDbCacheMiB);
+    while (state.KeepRunning()) {
+        fixture.Run();
+    }
+}
+
+static void ConnectBlockSerial(benchmark::State& state) { ConnectBlockBench(state, 1, nDefaultDbCache); }
+static void ConnectBlockParallel(benchmark::State& state) { ConnectBlockBench(state, 4, nDefaultDbCache); }
+static void ConnectBlockSmallCache(benchmark::State& state) { ConnectBlockBench(state, 4, nMinDbCache); }
+
+BENCHMARK(ConnectBlockSerial, 4);
+BENCHMARK(ConnectBlockParallel, 12);
+BENCHMARK(ConnectBlockSmallCache, 12);
@@ -10,6 +10,7 @@
 #include <random.h>
 #include <uint256.h>
 #include <utiltime.h>
+#include <crypto/chacha20.h>
 #include <crypto/ripemd160.h>
 #include <crypto/sha1.h>
 #include <crypto/sha256.h>
@@ -52,6 +53,14 @@ static void SHA256_32b(benchmark::State& state)
     }
 }
 
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning()) {
+        SHA256D64(in.data(), in.data(), 1024);
+    }
+}
+
 static void SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -60,6 +69,15 @@ static void SHA512(benchmark::State& state)
         CSHA512().Write(in.data(), in.size()).Finalize(hash);
 }
 
+static void CHACHA20(benchmark::State& state)
+{
+    std::vector<uint8_t> key(32, 0);
+    std::vector<uint8_t> out(BUFFER_SIZE);
+    ChaCha20 rng(key.data(), key.size());
+    while (state.KeepRunning())
+        rng.Output(out.data(), out.size());
+}
+
 static void SipHash_32b(benchmark::State& state)
 {
     uint256 x;
@@ -78,6 +96,15 @@ static void FastRandom_32bit(benchmark::State& state)
     }
 }
 
+static void FastRandom_256bit(benchmark::State& state)
+{
+    FastRandomContext rng(true);
+    uint256 x;
+    while (state.KeepRunning()) {
+        x = rng.rand256();
+    }
+}
+
 static void FastRandom_1bit(benchmark::State& state)
 {
     FastRandomContext rng(true);
@@ -91,8 +118,11 @@ BENCHMARK(RIPEMD160, 440);
 BENCHMARK(SHA1, 570);
 BENCHMARK(SHA256, 340);
 BENCHMARK(SHA512, 330);
+BENCHMARK(CHACHA20, 500);
 
 BENCHMARK(SHA256_32b, 4700 * 1000);
+BENCHMARK(SHA256D64_1024, 7400);
 BENCHMARK(SipHash_32b, 40 * 1000 * 1000);
 BENCHMARK(FastRandom_32bit, 110 * 1000 * 1000);
+BENCHMARK(FastRandom_256bit, 30 * 1000 * 1000);
 BENCHMARK(FastRandom_1bit, 440 * 1000 * 1000);
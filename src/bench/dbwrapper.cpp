@@ -0,0 +1,56 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <dbwrapper.h>
+#include <fs.h>
+#include <random.h>
+#include <streams.h>
+#include <uint256.h>
+
+#include <vector>
+
+/** Bytes obfuscated per iteration, about what a flush of a thousand coins writes */
+static const size_t XOR_BYTES = 64 * 1024;
+/** Values written and read per iteration */
+static const int DB_VALUES = 1000;
+
+// Obfuscate a stream with an eight byte key, as every database value is
+static void DBWrapperXor(benchmark::State& state)
+{
+    FastRandomContext rng(true);
+    const std::vector<unsigned char> key = rng.randbytes(8);
+    const std::vector<unsigned char> data = rng.randbytes(XOR_BYTES);
+    CDataStream ss(data, SER_DISK, 0);
+    while (state.KeepRunning()) {
+        ss.Xor(key);
+    }
+}
+
+// Write values of the size of a coin to an obfuscated in-memory database,
+// and read them back one by one
+static void DBWrapperWriteRead(benchmark::State& state)
+{
+    CDBWrapper db(fs::path("bench_dbwrapper"), 1 << 20, true /* fMemory */, false, true /* obfuscate */);
+    FastRandomContext rng(true);
+    std::vector<uint256> keys;
+    std::vector<std::vector<unsigned char>> values;
+    for (int i = 0; i < DB_VALUES; i++) {
+        keys.push_back(rng.rand256());
+        values.push_back(rng.randbytes(40));
+    }
+    std::vector<unsigned char> value;
+    while (state.KeepRunning()) {
+        CDBBatch batch(db);
+        for (int i = 0; i < DB_VALUES; i++)
+            batch.Write(keys[i], values[i]);
+        db.WriteBatch(batch);
+        for (int i = 0; i < DB_VALUES; i++)
+            assert(db.Read(keys[i], value));
+    }
+}
+
+BENCHMARK(DBWrapperXor, 20000);
+BENCHMARK(DBWrapperWriteRead, 50);
@@ -0,0 +1,51 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <httpworkqueue.h>
+
+#include <boost/thread/thread.hpp>
+
+static const int WORKERS = 4;
+static const size_t QUEUE_DEPTH = 16;
+static const int ITEMS = 1000;
+static const int CLIENTS = 4;
+
+// One producer, like the HTTP event loop thread, hands trivial items to the
+// workers, so that the measured time is that of queueing and waking up.
+static void HTTPWorkQueueThroughput(benchmark::State& state, bool fFair)
+{
+    struct Item {
+        void operator()() {}
+    };
+    WorkQueue<Item> queue(QUEUE_DEPTH, fFair);
+    boost::thread_group tg;
+    for (int x = 0; x < WORKERS; ++x) {
+        tg.create_thread([&]{queue.Run();});
+    }
+    const std::string clients[CLIENTS] = {"a", "b", "c", "d"};
+    uint64_t nTotal = 0;
+    HTTPServerStats stats;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < ITEMS; ++i) {
+            Item* item = new Item;
+            // Retry items rejected because the queue is full
+            while (!queue.Enqueue(item, clients[i % CLIENTS])) {
+                boost::this_thread::yield();
+            }
+        }
+        nTotal += ITEMS;
+        do {
+            queue.GetStats(stats);
+        } while (stats.nRequestsHandled < nTotal);
+    }
+    queue.Interrupt();
+    tg.join_all();
+}
+
+static void HTTPWorkQueue(benchmark::State& state) { HTTPWorkQueueThroughput(state, false); }
+static void HTTPWorkQueueFair(benchmark::State& state) { HTTPWorkQueueThroughput(state, true); }
+
+BENCHMARK(HTTPWorkQueue, 100);
+BENCHMARK(HTTPWorkQueueFair, 100);
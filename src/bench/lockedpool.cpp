@@ -6,7 +6,9 @@
 
 #include <support/lockedpool.h>
 
+#include <assert.h>
 #include <iostream>
+#include <thread>
 #include <vector>
 
 #define ASIZE 2048
@@ -43,4 +45,56 @@ static void BenchLockedPool(benchmark::State& state)
     addr.clear();
 }
 
+/** Allocations per thread and iteration, of the sizes of keys and key material */
+#define KITER 1000
+#define KLIVE 16
+
+// Allocate and free like signing does: a few live keys at a time, each
+// freed shortly after it was allocated
+static void LockedPoolKeys(LockedPool& pool)
+{
+    void* live[KLIVE] = {};
+    for (int x=0; x<KITER; ++x) {
+        void*& slot = live[x % KLIVE];
+        pool.free(slot);
+        slot = pool.alloc(x & 1 ? 32 : 64);
+        assert(slot);
+    }
+    for (void* ptr: live)
+        pool.free(ptr);
+}
+
+static void LockedPoolThreads(benchmark::State& state, int threads)
+{
+    LockedPool& pool = LockedPoolManager::Instance();
+    while (state.KeepRunning()) {
+        std::vector<std::thread> workers;
+        for (int t=0; t<threads; ++t)
+            workers.emplace_back([&pool] { LockedPoolKeys(pool); });
+        for (std::thread& worker: workers)
+            worker.join();
+    }
+}
+
+static void LockedPoolManagerSingle(benchmark::State& state)
+{
+    LockedPool& pool = LockedPoolManager::Instance();
+    while (state.KeepRunning()) {
+        LockedPoolKeys(pool);
+    }
+}
+
+static void LockedPoolManager4Threads(benchmark::State& state)
+{
+    LockedPoolThreads(state, 4);
+}
+
+static void LockedPoolManager8Threads(benchmark::State& state)
+{
+    LockedPoolThreads(state, 8);
+}
+
 BENCHMARK(BenchLockedPool, 530);
+BENCHMARK(LockedPoolManagerSingle, 5000);
+BENCHMARK(LockedPoolManager4Threads, 500);
+BENCHMARK(LockedPoolManager8Threads, 250);
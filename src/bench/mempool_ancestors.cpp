@@ -0,0 +1,100 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <policy/policy.h>
+#include <txmempool.h>
+#include <validation.h>
+
+#include <limits>
+#include <vector>
+
+static void AddTx(const CTransactionRef& tx, CTxMemPool& pool)
+{
+    int64_t nTime = 0;
+    unsigned int nHeight = 1;
+    bool spendsCoinbase = false;
+    unsigned int sigOpCost = 4;
+    LockPoints lp;
+    pool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(tx, 1000, nTime, nHeight, spendsCoinbase, sigOpCost, lp));
+}
+
+/**
+ * Build a mempool of nChains chains of DEFAULT_ANCESTOR_LIMIT transactions.
+ * Every transaction in a chain spends the first output of its predecessor and
+ * the second output of the transaction two before it, so that ancestors are
+ * reached along more than one path. Returns the last transaction of each
+ * chain in vTips and the first in vRoots.
+ */
+static void CreateChains(CTxMemPool& pool, int nChains, std::vector<CTransactionRef>& vRoots, std::vector<CTransactionRef>& vTips)
+{
+    LOCK(pool.cs);
+    for (int nChain = 0; nChain < nChains; nChain++) {
+        std::vector<CTransactionRef> vChain;
+        for (unsigned int i = 0; i < DEFAULT_ANCESTOR_LIMIT; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(i < 2 ? 1 : 2);
+            if (i == 0) {
+                tx.vin[0].prevout.SetNull();
+                tx.vin[0].scriptSig = CScript() << nChain;
+            } else {
+                tx.vin[0].prevout = COutPoint(vChain[i - 1]->GetHash(), 0);
+                if (i >= 2) {
+                    tx.vin[1].prevout = COutPoint(vChain[i - 2]->GetHash(), 1);
+                }
+            }
+            tx.vout.resize(2);
+            tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+            tx.vout[0].nValue = COIN;
+            tx.vout[1].scriptPubKey = CScript() << OP_TRUE;
+            tx.vout[1].nValue = COIN;
+            vChain.push_back(MakeTransactionRef(tx));
+            AddTx(vChain.back(), pool);
+        }
+        vRoots.push_back(vChain.front());
+        vTips.push_back(vChain.back());
+    }
+}
+
+static const int CHAINS = 100;
+static const uint64_t NO_LIMIT = std::numeric_limits<uint64_t>::max();
+
+// Walk the ancestors of the tip of every chain, as done when a transaction
+// spending it is accepted or mined
+static void MempoolAncestorsChain(benchmark::State& state)
+{
+    CTxMemPool pool;
+    std::vector<CTransactionRef> vRoots, vTips;
+    CreateChains(pool, CHAINS, vRoots, vTips);
+
+    LOCK(pool.cs);
+    while (state.KeepRunning()) {
+        for (const CTransactionRef& tx : vTips) {
+            CTxMemPool::setEntries setAncestors;
+            std::string dummy;
+            pool.CalculateMemPoolAncestors(*pool.mapTx.find(tx->GetHash()), setAncestors, NO_LIMIT, NO_LIMIT, NO_LIMIT, NO_LIMIT, dummy, false);
+            assert(setAncestors.size() == DEFAULT_ANCESTOR_LIMIT - 1);
+        }
+    }
+}
+
+// Walk the descendants of the root of every chain, as done when it is removed
+static void MempoolDescendantsChain(benchmark::State& state)
+{
+    CTxMemPool pool;
+    std::vector<CTransactionRef> vRoots, vTips;
+    CreateChains(pool, CHAINS, vRoots, vTips);
+
+    LOCK(pool.cs);
+    while (state.KeepRunning()) {
+        for (const CTransactionRef& tx : vRoots) {
+            CTxMemPool::setEntries setDescendants;
+            pool.CalculateDescendants(pool.mapTx.find(tx->GetHash()), setDescendants);
+            assert(setDescendants.size() == DEFAULT_ANCESTOR_LIMIT);
+        }
+    }
+}
+
+BENCHMARK(MempoolAncestorsChain, 100);
+BENCHMARK(MempoolDescendantsChain, 100);
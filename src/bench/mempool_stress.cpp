@@ -0,0 +1,246 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <bench/chain.h>
+
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <miner.h>
+#include <random.h>
+#include <txmempool.h>
+#include <validation.h>
+
+#include <limits>
+
+/** Transactions of a cluster: a chain, a fan-out and CPFP_PAIRS parents with a child */
+static const int CPFP_PAIRS = 5;
+static const int CLUSTER_TXS = DEFAULT_ANCESTOR_LIMIT + DEFAULT_DESCENDANT_LIMIT + 2 * CPFP_PAIRS;
+static const int CLUSTER_COINS = 2 + CPFP_PAIRS;
+/** Confirmed coins left for the benchmarks to spend */
+static const int SPARE_COINS = 1000;
+
+static const int ACCEPT_CHAINS = 10;
+static const int ACCEPT_CHAIN_LENGTH = 5;
+static const int REPLACE_COINS = 20;
+/** Whole clusters, so that no transaction left behind has a parent removed */
+static const int REMOVE_FOR_BLOCK_CLUSTERS = 33;
+
+static const uint64_t NO_LIMIT = std::numeric_limits<uint64_t>::max();
+
+namespace {
+
+/**
+ * A regtest chain with a mempool of about nEntries transactions, made of
+ * clusters of the shapes that stress it most: a chain of DEFAULT_ANCESTOR_LIMIT
+ * transactions, a parent with DEFAULT_DESCENDANT_LIMIT - 1 children, and
+ * CPFP_PAIRS low fee parents with a high fee child. Their fee rates are spread
+ * between 1 and 20 satoshis per byte. Entries are added without validation,
+ * like the other mempool benchmarks, but all spend confirmed coins or each
+ * other, so that a block template of them is valid.
+ */
+class MempoolFixture
+{
+public:
+    explicit MempoolFixture(int nEntries);
+
+    /** Add a transaction to the mempool without validation */
+    void Add(const CTransactionRef& tx, CAmount nFee);
+
+    /** Add the entries no longer in the mempool back, parents first */
+    void Refill();
+
+    /** The transactions added, parents first, with their fees */
+    std::vector<std::pair<CTransactionRef, CAmount>> m_entries;
+    /** The tips of the chains, a child of each fan-out and the CPFP children */
+    std::vector<CTransactionRef> m_leaves;
+    /** Confirmed coins no mempool transaction spends */
+    std::vector<BenchCoin> m_spare;
+
+private:
+    RegtestChainSetup m_chain;
+    FastRandomContext m_rng{true};
+
+    CTransactionRef AddSpend(const std::vector<BenchCoin>& vInputs, int nOutputs, CAmount nFeeRate, std::vector<BenchCoin>& vOutputs);
+};
+
+MempoolFixture::MempoolFixture(int nEntries)
+{
+    const int nCoins = nEntries / CLUSTER_TXS * CLUSTER_COINS + SPARE_COINS;
+    std::vector<BenchCoin> vCoins = m_chain.CreateCoins(nCoins);
+
+    auto itCoin = vCoins.begin();
+    while ((int)m_entries.size() + CLUSTER_TXS <= nEntries) {
+        std::vector<BenchCoin> vOutputs;
+        CTransactionRef tx;
+
+        // A chain of DEFAULT_ANCESTOR_LIMIT transactions
+        std::vector<BenchCoin> vInputs{*itCoin++};
+        for (unsigned int i = 0; i < DEFAULT_ANCESTOR_LIMIT; i++) {
+            vOutputs.clear();
+            tx = AddSpend(vInputs, 1, 1 + m_rng.randrange(20), vOutputs);
+            vInputs = vOutputs;
+        }
+        m_leaves.push_back(tx);
+
+        // A parent with as many children as it may have
+        std::vector<BenchCoin> vChildren;
+        AddSpend({*itCoin++}, DEFAULT_DESCENDANT_LIMIT - 1, 1 + m_rng.randrange(20), vChildren);
+        for (const BenchCoin& child : vChildren) {
+            vOutputs.clear();
+            tx = AddSpend({child}, 1, 1 + m_rng.randrange(20), vOutputs);
+        }
+        m_leaves.push_back(tx);
+
+        // Parents paying the minimum, and their children paying for them
+        for (int i = 0; i < CPFP_PAIRS; i++) {
+            std::vector<BenchCoin> vParent;
+            AddSpend({*itCoin++}, 1, 1, vParent);
+            vOutputs.clear();
+            m_leaves.push_back(AddSpend(vParent, 1, 50, vOutputs));
+        }
+    }
+    m_spare.assign(itCoin, vCoins.end());
+}
+
+CTransactionRef MempoolFixture::AddSpend(const std::vector<BenchCoin>& vInputs, int nOutputs, CAmount nFeeRate, std::vector<BenchCoin>& vOutputs)
+{
+    CAmount nFee;
+    CTransactionRef tx = MakeTransactionRef(SpendCoins(vInputs, nOutputs, nFeeRate, 0, vOutputs, nFee));
+    Add(tx, nFee);
+    m_entries.emplace_back(tx, nFee);
+    return tx;
+}
+
+void MempoolFixture::Add(const CTransactionRef& tx, CAmount nFee)
+{
+    LOCK2(cs_main, mempool.cs);
+    LockPoints lp;
+    mempool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(tx, nFee, GetTime(), chainActive.Height(), false, 4, lp));
+}
+
+void MempoolFixture::Refill()
+{
+    for (const auto& entry : m_entries) {
+        if (!mempool.exists(entry.first->GetHash()))
+            Add(entry.first, entry.second);
+    }
+}
+
+} // namespace
+
+static const int ENTRIES = 50000;
+static const int ENTRIES_LARGE = 300000;
+
+// Accept chains of new transactions spending confirmed coins, and remove them
+// again. Their values change every round, so that the script execution cache
+// does not help.
+static void MempoolAccept(benchmark::State& state)
+{
+    MempoolFixture fixture(ENTRIES);
+    CAmount nRound = 0;
+    while (state.KeepRunning()) {
+        LOCK(cs_main);
+        std::vector<CTransactionRef> vRoots;
+        for (int i = 0; i < ACCEPT_CHAINS; i++) {
+            std::vector<BenchCoin> vInputs{fixture.m_spare[i]};
+            for (int j = 0; j < ACCEPT_CHAIN_LENGTH; j++) {
+                std::vector<BenchCoin> vOutputs;
+                CAmount nFee;
+                CTransactionRef tx = MakeTransactionRef(SpendCoins(vInputs, 1, 2, nRound, vOutputs, nFee));
+                CValidationState validationState;
+                assert(AcceptToMemoryPool(mempool, validationState, tx, nullptr, nullptr, false, 0));
+                if (j == 0)
+                    vRoots.push_back(tx);
+                vInputs = vOutputs;
+            }
+        }
+        for (const CTransactionRef& tx : vRoots)
+            mempool.removeRecursive(*tx);
+        nRound++;
+    }
+}
+
+// Rounds of replacing a transaction that has a child, with one paying more,
+// and giving the replacement a child in turn
+static void MempoolReplace(benchmark::State& state)
+{
+    MempoolFixture fixture(ENTRIES);
+    CAmount nRound = 0;
+    while (state.KeepRunning()) {
+        LOCK(cs_main);
+        for (int i = 0; i < REPLACE_COINS; i++) {
+            std::vector<BenchCoin> vOutputs;
+            CAmount nFee;
+            CTransactionRef parent = MakeTransactionRef(SpendCoins({fixture.m_spare[i]}, 1, 1, nRound * 1000, vOutputs, nFee));
+            CValidationState validationState;
+            assert(AcceptToMemoryPool(mempool, validationState, parent, nullptr, nullptr, false, 0));
+            std::vector<BenchCoin> vChildOutputs;
+            CTransactionRef child = MakeTransactionRef(SpendCoins(vOutputs, 1, 2, 0, vChildOutputs, nFee));
+            assert(AcceptToMemoryPool(mempool, validationState, child, nullptr, nullptr, false, 0));
+        }
+        nRound++;
+    }
+}
+
+// Walk the ancestors of the leaves of every cluster
+static void MempoolAncestorsLarge(benchmark::State& state)
+{
+    MempoolFixture fixture(ENTRIES);
+    LOCK(mempool.cs);
+    while (state.KeepRunning()) {
+        for (const CTransactionRef& tx : fixture.m_leaves) {
+            CTxMemPool::setEntries setAncestors;
+            std::string dummy;
+            mempool.CalculateMemPoolAncestors(*mempool.mapTx.find(tx->GetHash()), setAncestors, NO_LIMIT, NO_LIMIT, NO_LIMIT, NO_LIMIT, dummy, false);
+        }
+    }
+}
+
+// Remove a block's worth of transactions, and add them back
+static void MempoolRemoveForBlock(benchmark::State& state)
+{
+    MempoolFixture fixture(ENTRIES);
+    std::vector<CTransactionRef> vtx;
+    for (int i = 0; i < REMOVE_FOR_BLOCK_CLUSTERS * CLUSTER_TXS; i++)
+        vtx.push_back(fixture.m_entries[i].first);
+    while (state.KeepRunning()) {
+        LOCK(cs_main);
+        mempool.removeForBlock(vtx, chainActive.Height() + 1);
+        fixture.Refill();
+    }
+}
+
+// Evict a tenth of the mempool, and add it back
+static void MempoolTrimToSizeBench(benchmark::State& state, int nEntries)
+{
+    MempoolFixture fixture(nEntries);
+    const size_t nUsage = mempool.DynamicMemoryUsage();
+    while (state.KeepRunning()) {
+        mempool.TrimToSize(nUsage * 9 / 10);
+        fixture.Refill();
+    }
+}
+
+static void AssembleBlockBench(benchmark::State& state, int nEntries)
+{
+    MempoolFixture fixture(nEntries);
+    while (state.KeepRunning()) {
+        assert(BlockAssembler(Params()).CreateNewBlock(P2SH_OP_TRUE));
+    }
+}
+
+static void MempoolTrimToSize(benchmark::State& state) { MempoolTrimToSizeBench(state, ENTRIES); }
+static void MempoolTrimToSizeLarge(benchmark::State& state) { MempoolTrimToSizeBench(state, ENTRIES_LARGE); }
+static void AssembleBlock(benchmark::State& state) { AssembleBlockBench(state, ENTRIES); }
+static void AssembleBlockLarge(benchmark::State& state) { AssembleBlockBench(state, ENTRIES_LARGE); }
+
+BENCHMARK(MempoolAccept, 20);
+BENCHMARK(MempoolReplace, 50);
+BENCHMARK(MempoolAncestorsLarge, 20);
+BENCHMARK(MempoolRemoveForBlock, 20);
+BENCHMARK(MempoolTrimToSize, 10);
+BENCHMARK(MempoolTrimToSizeLarge, 2);
+BENCHMARK(AssembleBlock, 10);
+BENCHMARK(AssembleBlockLarge, 5);
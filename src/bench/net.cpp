@@ -0,0 +1,472 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <bench/chain.h>
+
+#include <arith_uint256.h>
+#include <blockencodings.h>
+#include <chainparams.h>
+#include <hash.h>
+#include <net.h>
+#include <net_processing.h>
+#include <netbase.h>
+#include <netmessagemaker.h>
+#include <protocol.h>
+#include <random.h>
+#include <streams.h>
+#include <sync.h>
+#include <txmempool.h>
+#include <util.h>
+#include <utiltime.h>
+#include <validation.h>
+#include <validationinterface.h>
+#include <version.h>
+
+#ifndef WIN32
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+/** Fake peers each benchmark connects to the node */
+static const int PEERS = 8;
+/** Transactions one peer relays to the others in each iteration */
+static const int RELAY_TXS = 10;
+/** Transactions of each of the two blocks peers request */
+static const int BLOCK_TXS = 500;
+/** Longest wait for the node to answer before a benchmark gives up */
+static const int64_t ANSWER_TIMEOUT_SECONDS = 60;
+
+namespace {
+
+/** CPU time of the threads of this process by name, in clock ticks */
+std::map<std::string, uint64_t> GetThreadCPUTicks()
+{
+    std::map<std::string, uint64_t> mapTicks;
+#ifdef __linux__
+    for (fs::directory_iterator it("/proc/self/task"); it != fs::directory_iterator(); ++it) {
+        std::string strName, strStat;
+        std::ifstream comm((it->path() / "comm").string());
+        std::getline(comm, strName);
+        std::ifstream stat((it->path() / "stat").string());
+        std::getline(stat, strStat);
+        // The fields after the parenthesized name start with the third,
+        // utime and stime are the 14th and 15th
+        size_t nPos = strStat.rfind(')');
+        if (strName.empty() || nPos == std::string::npos)
+            continue;
+        std::istringstream fields(strStat.substr(nPos + 1));
+        std::string strField;
+        uint64_t nTicks = 0;
+        for (int i = 3; i <= 15 && fields >> strField; i++) {
+            if (i >= 14)
+                nTicks += std::stoull(strField);
+        }
+        mapTicks[strName] += nTicks;
+    }
+#endif
+    return mapTicks;
+}
+
+/**
+ * A node with a CConnman and PeerLogicValidation on a regtest chain, and fake
+ * peers connected to it over socket pairs: the node takes one end of each as
+ * an inbound peer, the harness drives the other. A thread per peer reads what
+ * the node sends, answering pings and requesting the transactions announced to
+ * it, so that the benchmarks measure the node's socket and message handler
+ * threads rather than the peers.
+ *
+ * Report() prints, for the time since Connect(), the messages per second the
+ * peers sent and received, the latencies of the answers the benchmark timed,
+ * and the CPU use of each thread of the process by name.
+ */
+class NetLoadHarness
+{
+public:
+    NetLoadHarness();
+    ~NetLoadHarness();
+
+    /** Start the node, connect nPeers peers, and complete their handshakes */
+    void Connect(int nPeers, SocketEventsMode mode, int nMessageHandlerThreads);
+
+    /** Send a message from a peer to the node, unless it disconnected */
+    void Send(int nPeer, const CSerializedNetMsg& msg);
+
+    /** Time the answer to a request: until peer nPeer receives key */
+    void StartTimer(int nPeer, const uint256& key);
+
+    /** Wait until the peers have received nCount messages of strCommand in all */
+    void WaitForReceived(const std::string& strCommand, int64_t nCount);
+
+    void Report(const std::string& strName);
+
+    RegtestChainSetup m_chain;
+
+private:
+    struct Peer {
+        SOCKET hSocket;
+        //! The end the node owns
+        SOCKET hNodeSocket;
+        CCriticalSection cs_send;
+        std::thread thread;
+    };
+
+    std::unique_ptr<CConnman> m_connman;
+    std::unique_ptr<PeerLogicValidation> m_peer_logic;
+    std::vector<std::unique_ptr<Peer>> m_peers;
+    bool m_prev_listen;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::map<std::string, int64_t> m_received;
+    std::map<std::pair<int, uint256>, int64_t> m_timers;
+    std::vector<int64_t> m_latencies;
+    std::atomic<int64_t> m_messages{0};
+    int64_t m_start_micros = 0;
+    std::map<std::string, uint64_t> m_start_ticks;
+
+    void ThreadRead(int nPeer);
+    void ProcessMessage(int nPeer, const std::string& strCommand, CDataStream& vRecv);
+    void StopTimer(int nPeer, const uint256& key);
+};
+
+NetLoadHarness::NetLoadHarness() : m_prev_listen(fListen)
+{
+    // No listening sockets, and no connections but the peers'
+    fListen = false;
+    gArgs.ForceSetArg("-dnsseed", "0");
+}
+
+NetLoadHarness::~NetLoadHarness()
+{
+    if (m_connman) {
+        m_connman->Interrupt();
+        m_connman->Stop();
+    }
+    for (const auto& peer : m_peers) {
+        shutdown(peer->hSocket, SHUT_RDWR);
+        peer->thread.join();
+        CloseSocket(peer->hSocket);
+    }
+    if (m_peer_logic)
+        UnregisterValidationInterface(m_peer_logic.get());
+    // Drop the tasks the node scheduled before destroying it
+    m_chain.GetScheduler().stop(false);
+    m_connman.reset();
+    m_peer_logic.reset();
+    fListen = m_prev_listen;
+}
+
+void NetLoadHarness::Connect(int nPeers, SocketEventsMode mode, int nMessageHandlerThreads)
+{
+    m_connman.reset(new CConnman(GetRand(std::numeric_limits<uint64_t>::max()), GetRand(std::numeric_limits<uint64_t>::max())));
+    m_peer_logic.reset(new PeerLogicValidation(m_connman.get(), m_chain.GetScheduler()));
+    RegisterValidationInterface(m_peer_logic.get(), true);
+
+    CConnman::Options options;
+    options.nLocalServices = ServiceFlags(NODE_NETWORK | NODE_WITNESS);
+    options.nMaxConnections = nPeers;
+    {
+        LOCK(cs_main);
+        options.nBestHeight = chainActive.Height();
+    }
+    options.m_msgproc = m_peer_logic.get();
+    options.nSendBufferMaxSize = 1000 * DEFAULT_MAXSENDBUFFER;
+    options.nReceiveFloodSize = 1000 * DEFAULT_MAXRECEIVEBUFFER;
+    options.m_use_addrman_outgoing = false;
+    options.socketEventsMode = mode;
+    options.nMessageHandlerThreads = nMessageHandlerThreads;
+    assert(m_connman->Start(m_chain.GetScheduler(), options));
+
+    for (int i = 0; i < nPeers; i++) {
+        int fds[2];
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        m_peers.emplace_back(new Peer);
+        m_peers.back()->hSocket = fds[1];
+        m_peers.back()->hNodeSocket = fds[0];
+    }
+    // Whitelisted, so that transactions are announced to them without the
+    // random trickle delay of inbound peers
+    for (int i = 0; i < nPeers; i++) {
+        m_peers[i]->thread = std::thread(&NetLoadHarness::ThreadRead, this, i);
+        CAddress addr(LookupNumeric(strprintf("10.0.%d.%d", i / 256, i % 256).c_str(), Params().GetDefaultPort()), NODE_NONE);
+        m_connman->CreateNodeFromAcceptedSocket(m_peers[i]->hNodeSocket, true, addr);
+    }
+
+    const CNetMsgMaker initMsgMaker(INIT_PROTO_VERSION);
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    for (int i = 0; i < nPeers; i++) {
+        const uint64_t nServices = NODE_NETWORK | NODE_WITNESS;
+        Send(i, initMsgMaker.Make(NetMsgType::VERSION, PROTOCOL_VERSION, nServices, GetTime(),
+            CAddress(CService(), NODE_NONE), CAddress(CService(), ServiceFlags(nServices)),
+            GetRand(std::numeric_limits<uint64_t>::max()), std::string("/bench/"), 0, true));
+    }
+    WaitForReceived(NetMsgType::VERACK, nPeers);
+    for (int i = 0; i < nPeers; i++) {
+        Send(i, msgMaker.Make(NetMsgType::VERACK));
+        Send(i, msgMaker.Make(NetMsgType::SENDCMPCT, false, uint64_t{2}));
+    }
+    // The node answers the verack with its preferences
+    WaitForReceived(NetMsgType::SENDHEADERS, nPeers);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_messages = 0;
+    m_latencies.clear();
+    m_start_micros = GetTimeMicros();
+    m_start_ticks = GetThreadCPUTicks();
+}
+
+void NetLoadHarness::Send(int nPeer, const CSerializedNetMsg& msg)
+{
+    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), msg.data.size());
+    uint256 hash = Hash(msg.data.data(), msg.data.data() + msg.data.size());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    std::vector<unsigned char> vData;
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, vData, 0, hdr};
+    vData.insert(vData.end(), msg.data.begin(), msg.data.end());
+
+    Peer& peer = *m_peers[nPeer];
+    LOCK(peer.cs_send);
+    size_t nSent = 0;
+    while (nSent < vData.size()) {
+        ssize_t nBytes = send(peer.hSocket, vData.data() + nSent, vData.size() - nSent, MSG_NOSIGNAL);
+        if (nBytes <= 0)
+            return;
+        nSent += nBytes;
+    }
+    m_messages++;
+}
+
+void NetLoadHarness::StartTimer(int nPeer, const uint256& key)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_timers[std::make_pair(nPeer, key)] = GetTimeMicros();
+}
+
+void NetLoadHarness::StopTimer(int nPeer, const uint256& key)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto it = m_timers.find(std::make_pair(nPeer, key));
+    if (it != m_timers.end()) {
+        m_latencies.push_back(GetTimeMicros() - it->second);
+        m_timers.erase(it);
+    }
+}
+
+void NetLoadHarness::WaitForReceived(const std::string& strCommand, int64_t nCount)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    assert(m_cond.wait_for(lock, std::chrono::seconds(ANSWER_TIMEOUT_SECONDS), [&] { return m_received[strCommand] >= nCount; }));
+}
+
+void NetLoadHarness::ThreadRead(int nPeer)
+{
+    RenameThread("bench-peer");
+    const SOCKET hSocket = m_peers[nPeer]->hSocket;
+    std::vector<char> vBuffer;
+    char pchBuf[0x10000];
+    while (true) {
+        ssize_t nBytes = recv(hSocket, pchBuf, sizeof(pchBuf), 0);
+        if (nBytes <= 0)
+            return;
+        vBuffer.insert(vBuffer.end(), pchBuf, pchBuf + nBytes);
+
+        size_t nPos = 0;
+        while (vBuffer.size() - nPos >= CMessageHeader::HEADER_SIZE) {
+            CDataStream hdrStream(vBuffer.data() + nPos, vBuffer.data() + nPos + CMessageHeader::HEADER_SIZE, SER_NETWORK, INIT_PROTO_VERSION);
+            CMessageHeader hdr(Params().MessageStart());
+            hdrStream >> hdr;
+            assert(hdr.IsValid(Params().MessageStart()));
+            if (vBuffer.size() - nPos - CMessageHeader::HEADER_SIZE < hdr.nMessageSize)
+                break;
+            const char* pchPayload = vBuffer.data() + nPos + CMessageHeader::HEADER_SIZE;
+            CDataStream vRecv(pchPayload, pchPayload + hdr.nMessageSize, SER_NETWORK, PROTOCOL_VERSION);
+            nPos += CMessageHeader::HEADER_SIZE + hdr.nMessageSize;
+            ProcessMessage(nPeer, hdr.GetCommand(), vRecv);
+        }
+        vBuffer.erase(vBuffer.begin(), vBuffer.begin() + nPos);
+    }
+}
+
+void NetLoadHarness::ProcessMessage(int nPeer, const std::string& strCommand, CDataStream& vRecv)
+{
+    m_messages++;
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    if (strCommand == NetMsgType::PING) {
+        uint64_t nonce;
+        vRecv >> nonce;
+        Send(nPeer, msgMaker.Make(NetMsgType::PONG, nonce));
+    } else if (strCommand == NetMsgType::PONG) {
+        uint64_t nonce;
+        vRecv >> nonce;
+        StopTimer(nPeer, ArithToUint256(arith_uint256(nonce)));
+    } else if (strCommand == NetMsgType::INV) {
+        std::vector<CInv> vInv, vGetData;
+        vRecv >> vInv;
+        for (const CInv& inv : vInv) {
+            if (inv.type == MSG_TX)
+                vGetData.push_back(inv);
+        }
+        if (!vGetData.empty())
+            Send(nPeer, msgMaker.Make(NetMsgType::GETDATA, vGetData));
+    } else if (strCommand == NetMsgType::TX) {
+        CTransactionRef tx;
+        vRecv >> tx;
+        StopTimer(nPeer, tx->GetHash());
+    } else if (strCommand == NetMsgType::CMPCTBLOCK) {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        StopTimer(nPeer, cmpctblock.header.GetHash());
+    } else if (strCommand == NetMsgType::BLOCK) {
+        CBlock block;
+        vRecv >> block;
+        StopTimer(nPeer, block.GetHash());
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_received[strCommand]++;
+    m_cond.notify_all();
+}
+
+void NetLoadHarness::Report(const std::string& strName)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const double dSeconds = (GetTimeMicros() - m_start_micros) * 0.000001;
+    std::string strReport = strprintf("%s: %d peers, %.0f messages/s", strName, m_peers.size(), m_messages / dSeconds);
+    if (!m_latencies.empty()) {
+        std::sort(m_latencies.begin(), m_latencies.end());
+        auto percentile = [&](int n) { return m_latencies[(m_latencies.size() - 1) * n / 100]; };
+        strReport += strprintf(", latency p50 %dus p90 %dus p99 %dus max %dus", percentile(50), percentile(90), percentile(99), m_latencies.back());
+    }
+    const double dTicksPerSecond = sysconf(_SC_CLK_TCK);
+    for (const auto& ticks : GetThreadCPUTicks()) {
+        auto it = m_start_ticks.find(ticks.first);
+        const uint64_t nTicks = ticks.second - (it == m_start_ticks.end() ? 0 : std::min(it->second, ticks.second));
+        strReport += strprintf(", %s %.0f%% CPU", ticks.first, 100 * nTicks / dTicksPerSecond / dSeconds);
+    }
+    std::cerr << strReport << std::endl;
+}
+
+/** The mode -socketevents defaults to in this build */
+SocketEventsMode DefaultSocketEventsMode()
+{
+    SocketEventsMode mode;
+    assert(GetSocketEventsMode(DEFAULT_SOCKETEVENTS, mode));
+    return mode;
+}
+
+} // namespace
+
+// Every peer pings the node, and waits for its pong
+static void NetPingPongBench(benchmark::State& state, const std::string& strName, SocketEventsMode mode, int nMessageHandlerThreads)
+{
+    NetLoadHarness harness;
+    harness.Connect(PEERS, mode, nMessageHandlerThreads);
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    FastRandomContext rng(true);
+    int64_t nPongs = 0;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < PEERS; i++) {
+            const uint64_t nonce = rng.rand64();
+            harness.StartTimer(i, ArithToUint256(arith_uint256(nonce)));
+            harness.Send(i, msgMaker.Make(NetMsgType::PING, nonce));
+        }
+        nPongs += PEERS;
+        harness.WaitForReceived(NetMsgType::PONG, nPongs);
+    }
+    harness.Report(strName);
+}
+
+// One peer sends the node new transactions, which it validates and announces
+// to the other peers; they request them with getdata, and the iteration ends
+// when all of them have all of the transactions. They are removed from the
+// mempool again, and spend the same coins with other values the next round.
+static void NetTxRelayBench(benchmark::State& state, const std::string& strName, SocketEventsMode mode, int nMessageHandlerThreads)
+{
+    NetLoadHarness harness;
+    const std::vector<BenchCoin> vCoins = harness.m_chain.CreateCoins(RELAY_TXS);
+    harness.Connect(PEERS, mode, nMessageHandlerThreads);
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    CAmount nRound = 0;
+    int64_t nTxs = 0;
+    while (state.KeepRunning()) {
+        std::vector<CTransactionRef> vtx;
+        for (int i = 0; i < RELAY_TXS; i++) {
+            std::vector<BenchCoin> vOutputs;
+            CAmount nFee;
+            vtx.push_back(MakeTransactionRef(SpendCoins({vCoins[i]}, 1, 2, nRound, vOutputs, nFee)));
+            for (int j = 1; j < PEERS; j++)
+                harness.StartTimer(j, vtx.back()->GetHash());
+        }
+        for (const CTransactionRef& tx : vtx)
+            harness.Send(0, msgMaker.Make(NetMsgType::TX, *tx));
+        nTxs += RELAY_TXS * (PEERS - 1);
+        harness.WaitForReceived(NetMsgType::TX, nTxs);
+
+        LOCK(cs_main);
+        for (const CTransactionRef& tx : vtx)
+            mempool.removeRecursive(*tx);
+        nRound++;
+    }
+    harness.Report(strName);
+}
+
+// Every peer requests the tip as a compact block and its parent as a full
+// block, both full of transactions
+static void NetGetBlocksBench(benchmark::State& state, const std::string& strName, SocketEventsMode mode, int nMessageHandlerThreads)
+{
+    NetLoadHarness harness;
+    const std::vector<BenchCoin> vCoins = harness.m_chain.CreateCoins(2 * BLOCK_TXS);
+    std::vector<uint256> vHashes;
+    for (int i = 0; i < 2; i++) {
+        std::vector<CMutableTransaction> txs;
+        for (int j = 0; j < BLOCK_TXS; j++) {
+            std::vector<BenchCoin> vOutputs;
+            CAmount nFee;
+            txs.push_back(SpendCoins({vCoins[i * BLOCK_TXS + j]}, 1, 1, 0, vOutputs, nFee));
+        }
+        vHashes.push_back(harness.m_chain.MineBlock(txs, P2SH_OP_TRUE).GetHash());
+    }
+    harness.Connect(PEERS, mode, nMessageHandlerThreads);
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    int64_t nBlocks = 0;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < PEERS; i++) {
+            harness.StartTimer(i, vHashes[1]);
+            harness.StartTimer(i, vHashes[0]);
+            harness.Send(i, msgMaker.Make(NetMsgType::GETDATA, std::vector<CInv>{CInv(MSG_CMPCT_BLOCK, vHashes[1]), CInv(MSG_BLOCK, vHashes[0])}));
+        }
+        nBlocks += PEERS;
+        harness.WaitForReceived(NetMsgType::CMPCTBLOCK, nBlocks);
+        harness.WaitForReceived(NetMsgType::BLOCK, nBlocks);
+    }
+    harness.Report(strName);
+}
+
+static void NetPingPong(benchmark::State& state) { NetPingPongBench(state, "NetPingPong", DefaultSocketEventsMode(), 1); }
+static void NetPingPongSelect(benchmark::State& state) { NetPingPongBench(state, "NetPingPongSelect", SocketEventsMode::SELECT, 1); }
+static void NetPingPongShards(benchmark::State& state) { NetPingPongBench(state, "NetPingPongShards", DefaultSocketEventsMode(), 4); }
+static void NetTxRelay(benchmark::State& state) { NetTxRelayBench(state, "NetTxRelay", DefaultSocketEventsMode(), 1); }
+static void NetTxRelayShards(benchmark::State& state) { NetTxRelayBench(state, "NetTxRelayShards", DefaultSocketEventsMode(), 4); }
+static void NetGetBlocks(benchmark::State& state) { NetGetBlocksBench(state, "NetGetBlocks", DefaultSocketEventsMode(), 1); }
+
+BENCHMARK(NetPingPong, 1000);
+BENCHMARK(NetPingPongSelect, 1000);
+BENCHMARK(NetPingPongShards, 1000);
+BENCHMARK(NetTxRelay, 50);
+BENCHMARK(NetTxRelayShards, 50);
+BENCHMARK(NetGetBlocks, 100);
+
+#endif // WIN32
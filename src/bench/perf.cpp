@@ -4,50 +4,84 @@
 
 #include <bench/perf.h>
 
-#if defined(__i386__) || defined(__x86_64__)
-
-/* These architectures support querying the cycle counter
- * from user space, no need for any syscall overhead.
- */
-void perf_init(void) { }
-void perf_fini(void) { }
-
-#elif defined(__linux__)
+#if defined(__linux__)
 
+#include <string.h>
 #include <unistd.h>
 #include <sys/syscall.h>
 #include <linux/perf_event.h>
 
-static int fd = -1;
-static struct perf_event_attr attr;
-
-void perf_init(void)
+/* Hardware counters of the calling thread, which may be unavailable, for
+ * instance with a restrictive kernel.perf_event_paranoid.
+ */
+static int perf_open(uint64_t config)
 {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
     attr.type = PERF_TYPE_HARDWARE;
-    attr.config = PERF_COUNT_HW_CPU_CYCLES;
-    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    attr.config = config;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
 }
 
-void perf_fini(void)
+static uint64_t perf_read(int fd)
 {
-    if (fd != -1) {
-        close(fd);
+    uint64_t result = 0;
+    if (fd == -1 || read(fd, &result, sizeof(result)) < (ssize_t)sizeof(result)) {
+        return 0;
     }
+    return result;
 }
 
+static int fd_instructions = -1;
+#if !defined(__i386__) && !defined(__x86_64__)
+static int fd_cycles = -1;
+
 uint64_t perf_cpucycles(void)
 {
-    uint64_t result = 0;
-    if (fd == -1 || read(fd, &result, sizeof(result)) < (ssize_t)sizeof(result)) {
-        return 0;
+    return perf_read(fd_cycles);
+}
+#endif
+
+uint64_t perf_instructions(void)
+{
+    return perf_read(fd_instructions);
+}
+
+void perf_init(void)
+{
+    fd_instructions = perf_open(PERF_COUNT_HW_INSTRUCTIONS);
+#if !defined(__i386__) && !defined(__x86_64__)
+    fd_cycles = perf_open(PERF_COUNT_HW_CPU_CYCLES);
+#endif
+}
+
+void perf_fini(void)
+{
+    if (fd_instructions != -1) {
+        close(fd_instructions);
     }
-    return result;
+#if !defined(__i386__) && !defined(__x86_64__)
+    if (fd_cycles != -1) {
+        close(fd_cycles);
+    }
+#endif
 }
 
+#elif defined(__i386__) || defined(__x86_64__)
+
+/* These architectures support querying the cycle counter
+ * from user space, no need for any syscall overhead.
+ */
+void perf_init(void) { }
+void perf_fini(void) { }
+uint64_t perf_instructions(void) { return 0; }
+
 #else /* Unhandled platform */
 
 void perf_init(void) { }
 void perf_fini(void) { }
 uint64_t perf_cpucycles(void) { return 0; }
+uint64_t perf_instructions(void) { return 0; }
 
 #endif
@@ -31,6 +31,9 @@ uint64_t perf_cpucycles(void);
 
 #endif
 
+/** Instructions retired by the calling thread, or 0 where they cannot be counted */
+uint64_t perf_instructions(void);
+
 void perf_init(void);
 void perf_fini(void);
 
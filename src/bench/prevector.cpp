@@ -0,0 +1,153 @@
+// Copyright (c) 2015-2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <prevector.h>
+#include <serialize.h>
+#include <streams.h>
+
+#include <utility>
+
+/** An element with a constructor, which takes the loops over elements rather than the byte copies */
+struct nontrivial_t {
+    int x;
+    nontrivial_t() : x(-1) {}
+    ADD_SERIALIZE_METHODS;
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) { READWRITE(x); }
+};
+
+/** A byte element, as in CScript */
+typedef unsigned char trivial_t;
+
+static_assert(!std::is_trivial<nontrivial_t>::value, "nontrivial_t is not trivial");
+static_assert(std::is_trivial<trivial_t>::value, "trivial_t is trivial");
+
+template <typename T>
+static void PrevectorDestructor(benchmark::State& state)
+{
+    while (state.KeepRunning()) {
+        for (auto x = 0; x < 1000; ++x) {
+            prevector<28, T> t0;
+            prevector<28, T> t1;
+            t0.resize(28);
+            t1.resize(29);
+        }
+    }
+}
+
+template <typename T>
+static void PrevectorClear(benchmark::State& state)
+{
+    while (state.KeepRunning()) {
+        for (auto x = 0; x < 1000; ++x) {
+            prevector<28, T> t0;
+            prevector<28, T> t1;
+            t0.resize(28);
+            t0.clear();
+            t1.resize(29);
+            t0.clear();
+        }
+    }
+}
+
+template <typename T>
+static void PrevectorResize(benchmark::State& state)
+{
+    while (state.KeepRunning()) {
+        prevector<28, T> t0;
+        prevector<28, T> t1;
+        for (auto x = 0; x < 1000; ++x) {
+            t0.resize(28);
+            t0.resize(0);
+            t1.resize(29);
+            t1.resize(0);
+        }
+    }
+}
+
+// Copy construct and assign a direct and an indirect prevector, as scripts are copied
+template <typename T>
+static void PrevectorCopy(benchmark::State& state)
+{
+    prevector<28, T> small(20, T());
+    prevector<28, T> large(100, T());
+    while (state.KeepRunning()) {
+        for (auto x = 0; x < 1000; ++x) {
+            prevector<28, T> t0(small);
+            prevector<28, T> t1(large);
+            t0 = large;
+            t1 = small;
+        }
+    }
+}
+
+// Move an indirect prevector back and forth, which only passes its storage on
+template <typename T>
+static void PrevectorMove(benchmark::State& state)
+{
+    prevector<28, T> t0(100, T());
+    while (state.KeepRunning()) {
+        for (auto x = 0; x < 1000; ++x) {
+            prevector<28, T> t1(std::move(t0));
+            t0 = std::move(t1);
+        }
+    }
+}
+
+// Build from a range and insert into the middle
+template <typename T>
+static void PrevectorInsert(benchmark::State& state)
+{
+    const std::vector<T> src(20);
+    while (state.KeepRunning()) {
+        for (auto x = 0; x < 1000; ++x) {
+            prevector<28, T> t0(src.begin(), src.end());
+            t0.insert(t0.begin() + 10, src.begin(), src.end());
+            t0.insert(t0.begin() + 5, 10, T());
+        }
+    }
+}
+
+template <typename T>
+static void PrevectorDeserialize(benchmark::State& state)
+{
+    CDataStream s0(SER_NETWORK, 0);
+    prevector<28, T> t0;
+    t0.resize(28);
+    for (auto x = 0; x < 900; ++x) {
+        s0 << t0;
+    }
+    t0.resize(100);
+    for (auto x = 0; x < 101; ++x) {
+        s0 << t0;
+    }
+    while (state.KeepRunning()) {
+        prevector<28, T> t1;
+        for (auto x = 0; x < 1000; ++x) {
+            s0 >> t1;
+        }
+        s0.Rewind(s0.size());
+    }
+}
+
+#define PREVECTOR_TEST(name, nontrivops, trivops)                       \
+    static void Prevector##name##Nontrivial(benchmark::State& state)    \
+    {                                                                   \
+        Prevector##name<nontrivial_t>(state);                           \
+    }                                                                   \
+    BENCHMARK(Prevector##name##Nontrivial, nontrivops);                 \
+    static void Prevector##name##Trivial(benchmark::State& state)       \
+    {                                                                   \
+        Prevector##name<trivial_t>(state);                              \
+    }                                                                   \
+    BENCHMARK(Prevector##name##Trivial, trivops);
+
+PREVECTOR_TEST(Clear, 28300, 88600)
+PREVECTOR_TEST(Destructor, 28800, 88900)
+PREVECTOR_TEST(Resize, 28900, 90300)
+PREVECTOR_TEST(Copy, 3000, 20000)
+PREVECTOR_TEST(Move, 50000, 50000)
+PREVECTOR_TEST(Insert, 3000, 20000)
+PREVECTOR_TEST(Deserialize, 6800, 52000)
@@ -6,6 +6,7 @@
 
 #include <bench/bench.h>
 #include <bloom.h>
+#include <random.h>
 
 static void RollingBloom(benchmark::State& state)
 {
@@ -29,4 +30,33 @@ static void RollingBloom(benchmark::State& state)
     }
 }
 
+// Per-peer inventory filter, as filterInventoryKnown is used in SendMessages:
+// a full filter checked against a batch of announcement candidates.
+static void RollingBloomInventory(benchmark::State& state, bool fBatch)
+{
+    FastRandomContext rand(true);
+    CRollingBloomFilter filter(50000, 0.000001);
+    for (int i = 0; i < 50000; i++)
+        filter.insert(rand.rand256());
+    std::vector<uint256> vHashes(1000);
+    for (uint256& hash : vHashes)
+        hash = rand.rand256();
+
+    uint64_t match = 0;
+    while (state.KeepRunning()) {
+        if (fBatch) {
+            for (bool fContained : filter.contains(vHashes))
+                match += fContained;
+        } else {
+            for (const uint256& hash : vHashes)
+                match += filter.contains(hash);
+        }
+    }
+}
+
+static void RollingBloomInventoryBatch(benchmark::State& state) { RollingBloomInventory(state, true); }
+static void RollingBloomInventorySingle(benchmark::State& state) { RollingBloomInventory(state, false); }
+
 BENCHMARK(RollingBloom, 1500 * 1000);
+BENCHMARK(RollingBloomInventoryBatch, 1000);
+BENCHMARK(RollingBloomInventorySingle, 1000);
@@ -0,0 +1,80 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <chainparams.h>
+#include <core_io.h>
+#include <primitives/block.h>
+#include <streams.h>
+#include <version.h>
+
+#include <univalue.h>
+
+namespace block_bench {
+#include <bench/data/block413567.raw.h>
+} // namespace block_bench
+
+// The transactions of block 413567 as getblock with verbosity 2 reports them,
+// which makes for about 6.7MB of JSON: mostly hex strings, amounts and short
+// keys in nested objects, the shape of the large RPC payloads.
+
+static CBlock DeserializeBenchBlock()
+{
+    // scriptPubKey addresses are encoded for the selected chain
+    SelectParams(CBaseChainParams::MAIN);
+
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+    return block;
+}
+
+static UniValue BlockTxsToJSON(const CBlock& block)
+{
+    UniValue txs(UniValue::VARR);
+    for (const auto& tx : block.vtx) {
+        UniValue objTx(UniValue::VOBJ);
+        TxToUniv(*tx, uint256(), objTx, true);
+        txs.push_back(objTx);
+    }
+    return txs;
+}
+
+static void RpcJsonEncodeBlock(benchmark::State& state)
+{
+    const CBlock block = DeserializeBenchBlock();
+
+    while (state.KeepRunning()) {
+        UniValue txs = BlockTxsToJSON(block);
+        assert(txs.size() == block.vtx.size());
+    }
+}
+
+static void RpcJsonWriteBlock(benchmark::State& state)
+{
+    const UniValue txs = BlockTxsToJSON(DeserializeBenchBlock());
+
+    while (state.KeepRunning()) {
+        std::string str = txs.write();
+        assert(!str.empty());
+    }
+}
+
+static void RpcJsonParseBlock(benchmark::State& state)
+{
+    const std::string str = BlockTxsToJSON(DeserializeBenchBlock()).write();
+
+    while (state.KeepRunning()) {
+        UniValue txs;
+        bool ok = txs.read(str);
+        assert(ok);
+    }
+}
+
+BENCHMARK(RpcJsonEncodeBlock, 10);
+BENCHMARK(RpcJsonWriteBlock, 10);
+BENCHMARK(RpcJsonParseBlock, 10);
@@ -0,0 +1,45 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <random.h>
+#include <utilstrencodings.h>
+
+#include <string>
+#include <vector>
+
+// About the size of a large block or raw transaction passed through RPC
+static const size_t HEX_BENCH_BYTES = 1000000;
+
+static void HexStrEncode(benchmark::State& state)
+{
+    FastRandomContext rng(true);
+    const std::vector<unsigned char> data = rng.randbytes(HEX_BENCH_BYTES);
+    while (state.KeepRunning()) {
+        HexStr(data);
+    }
+}
+
+static void ParseHexDecode(benchmark::State& state)
+{
+    FastRandomContext rng(true);
+    const std::string str = HexStr(rng.randbytes(HEX_BENCH_BYTES));
+    while (state.KeepRunning()) {
+        ParseHex(str);
+    }
+}
+
+static void IsHexCheck(benchmark::State& state)
+{
+    FastRandomContext rng(true);
+    const std::string str = HexStr(rng.randbytes(HEX_BENCH_BYTES));
+    while (state.KeepRunning()) {
+        IsHex(str);
+    }
+}
+
+BENCHMARK(HexStrEncode, 50);
+BENCHMARK(ParseHexDecode, 50);
+BENCHMARK(IsHexCheck, 100);
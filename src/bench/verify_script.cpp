@@ -4,10 +4,12 @@
 
 #include <bench/bench.h>
 #include <key.h>
+#include <random.h>
 #if defined(HAVE_CONSENSUS_LIB)
 #include <script/bitcoinconsensus.h>
 #endif
 #include <script/script.h>
+#include <script/sigcache.h>
 #include <script/sign.h>
 #include <streams.h>
 
@@ -105,4 +107,230 @@ static void VerifyScriptBench(benchmark::State& state)
     }
 }
 
+// End-to-end verification of a P2PKH spend, dominated by the elliptic curve
+// multiplication whose precomputed table --with-ecmult-window sizes.
+static void VerifyScriptP2PKHBench(benchmark::State& state)
+{
+    const int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_LOW_S;
+    ECCVerifyHandle verify_handle;
+
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CScript scriptPubKey = CScript() << OP_DUP << OP_HASH160 << ToByteVector(pubkey.GetID()) << OP_EQUALVERIFY << OP_CHECKSIG;
+    CTransaction txCredit = BuildCreditingTransaction(scriptPubKey);
+    CMutableTransaction txSpend = BuildSpendingTransaction(CScript(), txCredit);
+    std::vector<unsigned char> vchSig;
+    key.Sign(SignatureHash(scriptPubKey, txSpend, 0, SIGHASH_ALL, txCredit.vout[0].nValue, SIGVERSION_BASE), vchSig);
+    vchSig.push_back(static_cast<unsigned char>(SIGHASH_ALL));
+    txSpend.vin[0].scriptSig = CScript() << vchSig << ToByteVector(pubkey);
+    const CTransaction tx(txSpend);
+    PrecomputedTransactionData txdata(tx);
+
+    while (state.KeepRunning()) {
+        ScriptError err;
+        bool success = VerifyScript(tx.vin[0].scriptSig, scriptPubKey, nullptr, flags, TransactionSignatureChecker(&tx, 0, txCredit.vout[0].nValue, txdata), &err);
+        assert(err == SCRIPT_ERR_OK);
+        assert(success);
+    }
+}
+
+/** Accepts any well-encoded signature, so only the interpreter itself is measured */
+class AcceptingSignatureChecker : public BaseSignatureChecker
+{
+public:
+    bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const override
+    {
+        return true;
+    }
+};
+
+// Interpreter overhead over the common script types: P2PKH, P2WPKH and a
+// 2-of-3 P2SH multisig, without the cost of signature verification.
+static void VerifyScriptMixBench(benchmark::State& state)
+{
+    const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_STRICTENC | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_LOW_S | SCRIPT_VERIFY_NULLDUMMY;
+
+    CKey keys[3];
+    std::vector<unsigned char> sigs[3];
+    for (int i = 0; i < 3; i++) {
+        keys[i].MakeNewKey(true);
+        keys[i].Sign(uint256S("beef"), sigs[i]);
+        sigs[i].push_back(static_cast<unsigned char>(SIGHASH_ALL));
+    }
+    const std::vector<unsigned char> vchPubKey = ToByteVector(keys[0].GetPubKey());
+    const std::vector<unsigned char> vchPubKeyHash = ToByteVector(keys[0].GetPubKey().GetID());
+
+    struct ScriptCase {
+        CScript scriptSig;
+        CScript scriptPubKey;
+        CScriptWitness witness;
+    };
+    std::vector<ScriptCase> cases(3);
+
+    cases[0].scriptSig = CScript() << sigs[0] << vchPubKey;
+    cases[0].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << vchPubKeyHash << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    cases[1].scriptPubKey = CScript() << OP_0 << vchPubKeyHash;
+    cases[1].witness.stack = {sigs[0], vchPubKey};
+
+    CScript redeemScript = CScript() << OP_2 << ToByteVector(keys[0].GetPubKey()) << ToByteVector(keys[1].GetPubKey()) << ToByteVector(keys[2].GetPubKey()) << OP_3 << OP_CHECKMULTISIG;
+    cases[2].scriptSig = CScript() << OP_0 << sigs[1] << sigs[2] << ToByteVector(redeemScript);
+    cases[2].scriptPubKey = CScript() << OP_HASH160 << ToByteVector(Hash160(redeemScript.begin(), redeemScript.end())) << OP_EQUAL;
+
+    const AcceptingSignatureChecker checker;
+    while (state.KeepRunning()) {
+        for (const ScriptCase& test : cases) {
+            ScriptError err;
+            bool success = VerifyScript(test.scriptSig, test.scriptPubKey, &test.witness, flags, checker, &err);
+            assert(err == SCRIPT_ERR_OK);
+            assert(success);
+        }
+    }
+}
+
+// The standard single key spends: P2PKH, P2WPKH and P2SH-P2WPKH, through the
+// fast paths of VerifyScript or through the interpreter, without the cost of
+// signature verification.
+static void VerifyScriptStandard(benchmark::State& state, bool fGeneric)
+{
+    const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_STRICTENC | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_LOW_S |
+                               SCRIPT_VERIFY_NULLFAIL | SCRIPT_VERIFY_MINIMALDATA | SCRIPT_VERIFY_CLEANSTACK | SCRIPT_VERIFY_WITNESS_PUBKEYTYPE;
+
+    CKey key;
+    key.MakeNewKey(true);
+    std::vector<unsigned char> vchSig;
+    key.Sign(uint256S("beef"), vchSig);
+    vchSig.push_back(static_cast<unsigned char>(SIGHASH_ALL));
+    const std::vector<unsigned char> vchPubKey = ToByteVector(key.GetPubKey());
+    const std::vector<unsigned char> vchPubKeyHash = ToByteVector(key.GetPubKey().GetID());
+
+    struct ScriptCase {
+        CScript scriptSig;
+        CScript scriptPubKey;
+        CScriptWitness witness;
+    };
+    std::vector<ScriptCase> cases(3);
+
+    cases[0].scriptSig = CScript() << vchSig << vchPubKey;
+    cases[0].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << vchPubKeyHash << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    cases[1].scriptPubKey = CScript() << OP_0 << vchPubKeyHash;
+    cases[1].witness.stack = {vchSig, vchPubKey};
+
+    cases[2].scriptSig = CScript() << ToByteVector(cases[1].scriptPubKey);
+    cases[2].scriptPubKey = CScript() << OP_HASH160 << ToByteVector(Hash160(cases[1].scriptPubKey.begin(), cases[1].scriptPubKey.end())) << OP_EQUAL;
+    cases[2].witness = cases[1].witness;
+
+    const AcceptingSignatureChecker checker;
+    while (state.KeepRunning()) {
+        for (const ScriptCase& test : cases) {
+            ScriptError err;
+            bool success = fGeneric ? VerifyScriptGeneric(test.scriptSig, test.scriptPubKey, &test.witness, flags, checker, &err) :
+                                      VerifyScript(test.scriptSig, test.scriptPubKey, &test.witness, flags, checker, &err);
+            assert(err == SCRIPT_ERR_OK);
+            assert(success);
+        }
+    }
+}
+
+static void VerifyScriptStandardFast(benchmark::State& state) { VerifyScriptStandard(state, false); }
+static void VerifyScriptStandardGeneric(benchmark::State& state) { VerifyScriptStandard(state, true); }
+
+/** Keys and signatures per key in the repeated key benchmarks */
+static const int REPEATED_KEYS = 20;
+static const int SIGNATURES_PER_KEY = 10;
+
+// Verification of signatures in a block where every key signs several inputs,
+// as outputs of busy wallets and multisig cosigners do, with and without the
+// cache of decoded public keys.
+static void VerifyRepeatedKeys(benchmark::State& state, bool fPubKeyCache)
+{
+    ECCVerifyHandle verify_handle;
+    struct Signature {
+        CPubKey pubkey;
+        uint256 hash;
+        std::vector<unsigned char> vchSig;
+    };
+    std::vector<Signature> sigs;
+    for (int i = 0; i < REPEATED_KEYS; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        for (int j = 0; j < SIGNATURES_PER_KEY; j++) {
+            Signature sig;
+            sig.pubkey = key.GetPubKey();
+            sig.hash = GetRandHash();
+            key.Sign(sig.hash, sig.vchSig);
+            sigs.push_back(sig);
+        }
+    }
+
+    while (state.KeepRunning()) {
+        for (const Signature& sig : sigs) {
+            bool success = fPubKeyCache ? VerifyWithPubKeyCache(sig.pubkey, sig.hash, sig.vchSig) : sig.pubkey.Verify(sig.hash, sig.vchSig);
+            assert(success);
+        }
+    }
+}
+
+static void VerifyRepeatedKeysCached(benchmark::State& state) { VerifyRepeatedKeys(state, true); }
+static void VerifyRepeatedKeysUncached(benchmark::State& state) { VerifyRepeatedKeys(state, false); }
+
+/** Inputs of the transaction in the legacy signature hash benchmarks */
+static const unsigned int LEGACY_BENCH_INPUTS = 200;
+
+static CMutableTransaction BuildLegacyManyInputsTransaction(CScript& scriptPubKey)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    scriptPubKey = CScript() << OP_DUP << OP_HASH160 << ToByteVector(key.GetPubKey().GetID()) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    CMutableTransaction tx;
+    tx.nVersion = 1;
+    tx.vin.resize(LEGACY_BENCH_INPUTS);
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        tx.vin[i].prevout.hash = uint256S("cafe");
+        tx.vin[i].prevout.n = i;
+    }
+    tx.vout.resize(2);
+    for (CTxOut& txout : tx.vout) {
+        txout.scriptPubKey = scriptPubKey;
+        txout.nValue = 1;
+    }
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        std::vector<unsigned char> vchSig;
+        key.Sign(SignatureHash(scriptPubKey, tx, i, SIGHASH_ALL, 0, SIGVERSION_BASE), vchSig);
+        vchSig.push_back(static_cast<unsigned char>(SIGHASH_ALL));
+        tx.vin[i].scriptSig = CScript() << vchSig << ToByteVector(key.GetPubKey());
+    }
+    return tx;
+}
+
+// Signature hashes of every input of a large legacy transaction, as computed
+// while verifying it, with and without the precomputed transaction data.
+static void LegacySignatureHashes(benchmark::State& state, bool fPrecompute)
+{
+    CScript scriptPubKey;
+    const CTransaction tx(BuildLegacyManyInputsTransaction(scriptPubKey));
+
+    while (state.KeepRunning()) {
+        PrecomputedTransactionData txdata(tx);
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            uint256 hash = SignatureHash(scriptPubKey, tx, i, SIGHASH_ALL, 0, SIGVERSION_BASE, fPrecompute ? &txdata : nullptr);
+            assert(!hash.IsNull());
+        }
+    }
+}
+
+static void LegacySignatureHashesPrecomputed(benchmark::State& state) { LegacySignatureHashes(state, true); }
+static void LegacySignatureHashesSerialized(benchmark::State& state) { LegacySignatureHashes(state, false); }
+
 BENCHMARK(VerifyScriptBench, 6300);
+BENCHMARK(VerifyScriptP2PKHBench, 6300);
+BENCHMARK(VerifyScriptMixBench, 100000);
+BENCHMARK(VerifyScriptStandardFast, 100000);
+BENCHMARK(VerifyScriptStandardGeneric, 100000);
+BENCHMARK(VerifyRepeatedKeysCached, 20);
+BENCHMARK(VerifyRepeatedKeysUncached, 20);
+BENCHMARK(LegacySignatureHashesPrecomputed, 100);
+BENCHMARK(LegacySignatureHashesSerialized, 100);
@@ -0,0 +1,266 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <bench/chain.h>
+
+#include <chain.h>
+#include <random.h>
+#include <rpc/server.h>
+#include <script/standard.h>
+#include <util.h>
+#include <validation.h>
+#include <wallet/coincontrol.h>
+#include <wallet/db.h>
+#include <wallet/wallet.h>
+#include <wallet/walletdb.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <univalue.h>
+
+UniValue listtransactions(const JSONRPCRequest& request);
+UniValue listtransactionspage(const JSONRPCRequest& request);
+
+/** Transactions and keys of the wallets, unless -wallet-txs and -wallet-keys are set (same defaults as in bench_bitcoin.cpp) */
+static const int64_t DEFAULT_WALLET_TXS = 10000;
+static const int64_t DEFAULT_WALLET_KEYS = 10000;
+/** Blocks the transactions of the wallets are spread over */
+static const int WALLET_BLOCKS = 10;
+/** Transactions which are not the wallet's, matched against it per iteration */
+static const int SYNC_TXS = 1000;
+/** Keys added to the keypool per iteration */
+static const int TOPUP_KEYS = 100;
+/** Entries per page of the listtransactions benchmarks */
+static const int LIST_COUNT = 100;
+
+namespace {
+
+/**
+ * A wallet in the in-memory BDB environment with -wallet-keys HD keys and
+ * -wallet-txs synthesized transactions, confirmed in the blocks of a short
+ * regtest chain. Each transaction has an input which is not the wallet's, or
+ * for one in four the first output of the previous one, and pays one of the
+ * keys and a script which is not the wallet's, so that the wallet has both
+ * spent and unspent coins. The wallet is the only one in vpwallets, for the
+ * RPC calls.
+ */
+class WalletFixture
+{
+public:
+    WalletFixture();
+    ~WalletFixture();
+
+    /** Open the wallet file again in a new CWallet */
+    std::unique_ptr<CWallet> Load();
+
+    CWallet& GetWallet() { return *m_wallet; }
+    const CScript& ForeignScript() const { return m_foreign_script; }
+
+private:
+    RegtestChainSetup m_chain;
+    std::unique_ptr<CWallet> m_wallet;
+    std::string m_filename;
+    CScript m_foreign_script;
+};
+
+WalletFixture::WalletFixture()
+{
+    for (int i = 0; i < WALLET_BLOCKS; i++)
+        m_chain.MineBlock({}, P2SH_OP_TRUE);
+
+    assert(!bitdb.IsMock());
+    bitdb.MakeMock();
+    g_address_type = OUTPUT_TYPE_DEFAULT;
+    g_change_type = OUTPUT_TYPE_DEFAULT;
+
+    m_filename = strprintf("bench_wallet_%i.dat", (int)GetRand(100000));
+    bool fFirstRun;
+    m_wallet.reset(new CWallet(std::unique_ptr<CWalletDBWrapper>(new CWalletDBWrapper(&bitdb, m_filename))));
+    assert(m_wallet->LoadWallet(fFirstRun) == DB_LOAD_OK);
+    m_wallet->SetMinVersion(FEATURE_LATEST);
+    assert(m_wallet->SetHDMasterKey(m_wallet->GenerateNewHDMasterKey()));
+
+    const int64_t nKeys = std::max<int64_t>(1, gArgs.GetArg("-wallet-keys", DEFAULT_WALLET_KEYS));
+    const int64_t nTxs = std::max<int64_t>(1, gArgs.GetArg("-wallet-txs", DEFAULT_WALLET_TXS));
+    assert(m_wallet->TopUpKeyPool(nKeys));
+    std::vector<CScript> vScripts;
+    for (const CKeyID& keyid : m_wallet->GetKeys())
+        vScripts.push_back(GetScriptForDestination(keyid));
+
+    CKey key;
+    key.MakeNewKey(true);
+    m_foreign_script = GetScriptForDestination(key.GetPubKey().GetID());
+
+    LOCK2(cs_main, m_wallet->cs_wallet);
+    uint256 hashPrev;
+    for (int64_t i = 0; i < nTxs; i++) {
+        CMutableTransaction tx;
+        if (i % 4 == 0 && !hashPrev.IsNull()) {
+            tx.vin.emplace_back(COutPoint(hashPrev, 0));
+        } else {
+            tx.vin.emplace_back(COutPoint(GetRandHash(), 0));
+        }
+        tx.vout.emplace_back(COIN + GetRand(COIN), vScripts[i % vScripts.size()]);
+        tx.vout.emplace_back(COIN, m_foreign_script);
+        CWalletTx wtx(m_wallet.get(), MakeTransactionRef(std::move(tx)));
+        wtx.SetMerkleBranch(chainActive[1 + i % chainActive.Height()], 1 + i / chainActive.Height());
+        assert(m_wallet->AddToWallet(wtx, false));
+        hashPrev = wtx.GetHash();
+    }
+    vpwallets.push_back(m_wallet.get());
+}
+
+WalletFixture::~WalletFixture()
+{
+    vpwallets.erase(std::remove(vpwallets.begin(), vpwallets.end(), m_wallet.get()), vpwallets.end());
+    m_wallet.reset();
+    bitdb.Flush(true);
+    bitdb.Reset();
+}
+
+std::unique_ptr<CWallet> WalletFixture::Load()
+{
+    bool fFirstRun;
+    std::unique_ptr<CWallet> wallet(new CWallet(std::unique_ptr<CWalletDBWrapper>(new CWalletDBWrapper(&bitdb, m_filename))));
+    assert(wallet->LoadWallet(fFirstRun) == DB_LOAD_OK);
+    return wallet;
+}
+
+} // namespace
+
+static void WalletLoad(benchmark::State& state)
+{
+    WalletFixture fixture;
+    while (state.KeepRunning()) {
+        std::unique_ptr<CWallet> wallet = fixture.Load();
+        assert(wallet->mapWallet.size() == fixture.GetWallet().mapWallet.size());
+    }
+}
+
+// Balances of a wallet which did not change since the last call, and of one
+// which has to look at all its transactions again
+static void WalletGetBalance(benchmark::State& state)
+{
+    WalletFixture fixture;
+    CWallet& wallet = fixture.GetWallet();
+    assert(wallet.GetBalance() > 0);
+    while (state.KeepRunning()) {
+        wallet.GetBalance();
+    }
+}
+
+static void WalletGetBalanceDirty(benchmark::State& state)
+{
+    WalletFixture fixture;
+    CWallet& wallet = fixture.GetWallet();
+    while (state.KeepRunning()) {
+        wallet.MarkDirty();
+        wallet.GetBalance();
+    }
+}
+
+static void WalletAvailableCoins(benchmark::State& state)
+{
+    WalletFixture fixture;
+    CWallet& wallet = fixture.GetWallet();
+    LOCK2(cs_main, wallet.cs_wallet);
+    while (state.KeepRunning()) {
+        std::vector<COutput> vCoins;
+        wallet.AvailableCoins(vCoins);
+        assert(!vCoins.empty());
+    }
+}
+
+// Selecting the coins, creating change and signing a payment, which is not
+// committed, so that each iteration selects from the same coins
+static void WalletCreateTransaction(benchmark::State& state)
+{
+    WalletFixture fixture;
+    CWallet& wallet = fixture.GetWallet();
+    const std::vector<CRecipient> vecSend = {{fixture.ForeignScript(), 5 * COIN, false}};
+    while (state.KeepRunning()) {
+        CWalletTx wtx;
+        CReserveKey reservekey(&wallet);
+        CAmount nFee;
+        int nChangePos = -1;
+        std::string strError;
+        assert(wallet.CreateTransaction(vecSend, wtx, reservekey, nFee, nChangePos, strError, CCoinControl()));
+        reservekey.ReturnKey();
+    }
+}
+
+// A page from the middle of the history, with the skip of listtransactions
+// and with the cursor of listtransactionspage
+static void WalletListTransactions(benchmark::State& state)
+{
+    WalletFixture fixture;
+    JSONRPCRequest request;
+    request.params = UniValue(UniValue::VARR);
+    request.params.push_back("*");
+    request.params.push_back(LIST_COUNT);
+    request.params.push_back((int)(fixture.GetWallet().mapWallet.size() / 2));
+    while (state.KeepRunning()) {
+        listtransactions(request);
+    }
+}
+
+static void WalletListTransactionsPage(benchmark::State& state)
+{
+    WalletFixture fixture;
+    JSONRPCRequest request;
+    request.params = UniValue(UniValue::VARR);
+    request.params.push_back(LIST_COUNT);
+    request.params.push_back((int64_t)(fixture.GetWallet().mapWallet.size() / 2));
+    while (state.KeepRunning()) {
+        listtransactionspage(request);
+    }
+}
+
+// Matching transactions which are not the wallet's against its keys, as for
+// each transaction of a block or the mempool
+static void WalletSyncTransaction(benchmark::State& state)
+{
+    WalletFixture fixture;
+    CWallet& wallet = fixture.GetWallet();
+    std::vector<CTransactionRef> vtx;
+    for (int i = 0; i < SYNC_TXS; i++) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(COutPoint(GetRandHash(), 0));
+        tx.vin.emplace_back(COutPoint(GetRandHash(), 1));
+        tx.vout.emplace_back(COIN, fixture.ForeignScript());
+        tx.vout.emplace_back(COIN, P2SH_OP_TRUE);
+        vtx.push_back(MakeTransactionRef(std::move(tx)));
+    }
+    const size_t nWalletTxs = wallet.mapWallet.size();
+    while (state.KeepRunning()) {
+        for (const CTransactionRef& tx : vtx) {
+            wallet.TransactionAddedToMempool(tx);
+        }
+    }
+    assert(wallet.mapWallet.size() == nWalletTxs);
+}
+
+static void WalletTopUpKeyPool(benchmark::State& state)
+{
+    WalletFixture fixture;
+    CWallet& wallet = fixture.GetWallet();
+    unsigned int nSize = std::max<int64_t>(1, gArgs.GetArg("-wallet-keys", DEFAULT_WALLET_KEYS));
+    while (state.KeepRunning()) {
+        nSize += TOPUP_KEYS;
+        assert(wallet.TopUpKeyPool(nSize));
+    }
+}
+
+BENCHMARK(WalletLoad, 2);
+BENCHMARK(WalletGetBalance, 2000);
+BENCHMARK(WalletGetBalanceDirty, 20);
+BENCHMARK(WalletAvailableCoins, 20);
+BENCHMARK(WalletCreateTransaction, 20);
+BENCHMARK(WalletListTransactions, 200);
+BENCHMARK(WalletListTransactionsPage, 2000);
+BENCHMARK(WalletSyncTransaction, 20);
+BENCHMARK(WalletTopUpKeyPool, 2);
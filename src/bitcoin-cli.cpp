@@ -18,6 +18,8 @@
 #include <memory>
 #include <stdio.h>
 
+#include <boost/algorithm/string.hpp>
+
 #include <event2/buffer.h>
 #include <event2/keyvalq_struct.h>
 #include <support/events.h>
@@ -28,6 +30,8 @@ static const char DEFAULT_RPCCONNECT[] = "127.0.0.1";
 static const int DEFAULT_HTTP_CLIENT_TIMEOUT=900;
 static const bool DEFAULT_NAMED=false;
 static const int CONTINUE_EXECUTION=-1;
+static const int DEFAULT_BATCH_SIZE=1;
+static const int MAX_BATCH_SIZE=10000;
 
 std::string HelpMessageCli()
 {
@@ -36,6 +40,8 @@ std::string HelpMessageCli()
     std::string strUsage;
     strUsage += HelpMessageGroup(_("Options:"));
     strUsage += HelpMessageOpt("-?", _("This help message"));
+    strUsage += HelpMessageOpt("-batch", _("Read commands from standard input, one per line as <command> [params] separated by spaces, send them over one connection, and write the result of each on one line, in order. Errors are written as \"error: \" followed by the JSON error, in place of the result"));
+    strUsage += HelpMessageOpt("-batchsize=<n>", strprintf(_("Send the commands of -batch in JSON-RPC batches of up to <n> (default: %d)"), DEFAULT_BATCH_SIZE));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), BITCOIN_CONF_FILENAME));
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-getinfo", _("Get general information from the remote server. Note that unlike server-side RPC calls, the results of -getinfo is the result of multiple non-atomic requests. Some entries in the result may represent results from different states (e.g. wallet balance may be as of a different block from the chain state reported)"));
@@ -90,7 +96,8 @@ static int AppInitRPC(int argc, char* argv[])
                   "  bitcoin-cli [options] <command> [params]  " + strprintf(_("Send command to %s"), _(PACKAGE_NAME)) + "\n" +
                   "  bitcoin-cli [options] -named <command> [name=value] ... " + strprintf(_("Send command to %s (with named arguments)"), _(PACKAGE_NAME)) + "\n" +
                   "  bitcoin-cli [options] help                " + _("List commands") + "\n" +
-                  "  bitcoin-cli [options] help <command>      " + _("Get help for a command") + "\n";
+                  "  bitcoin-cli [options] help <command>      " + _("Get help for a command") + "\n" +
+                  "  bitcoin-cli [options] -batch              " + _("Send the commands read from standard input") + "\n";
 
             strUsage += "\n" + HelpMessageCli();
         }
@@ -131,11 +138,12 @@ static int AppInitRPC(int argc, char* argv[])
 /** Reply structure for request_done to fill in */
 struct HTTPReply
 {
-    HTTPReply(): status(0), error(-1) {}
+    HTTPReply(): status(0), error(-1), done(false) {}
 
     int status;
     int error;
     std::string body;
+    bool done;
 };
 
 const char *http_errorstring(int code)
@@ -163,6 +171,7 @@ const char *http_errorstring(int code)
 static void http_request_done(struct evhttp_request *req, void *ctx)
 {
     HTTPReply *reply = static_cast<HTTPReply*>(ctx);
+    reply->done = true;
 
     if (req == nullptr) {
         /* If req is nullptr, it means an error occurred while connecting: the
@@ -285,99 +294,219 @@ public:
     }
 };
 
-static UniValue CallRPC(BaseRequestHandler *rh, const std::string& strMethod, const std::vector<std::string>& args)
+/**
+ * Connection to the RPC server. With fKeepAlive it is kept open between
+ * requests, rather than closed by the server after the first.
+ */
+class RPCConnection
 {
+private:
     std::string host;
-    // In preference order, we choose the following for the port:
-    //     1. -rpcport
-    //     2. port in -rpcconnect (ie following : in ipv4 or ]: in ipv6)
-    //     3. default port for chain
-    int port = BaseParams().RPCPort();
-    SplitHostPort(gArgs.GetArg("-rpcconnect", DEFAULT_RPCCONNECT), port, host);
-    port = gArgs.GetArg("-rpcport", port);
-
-    // Obtain event base
-    raii_event_base base = obtain_event_base();
-
-    // Synchronously look up hostname
-    raii_evhttp_connection evcon = obtain_evhttp_connection_base(base.get(), host, port);
-    evhttp_connection_set_timeout(evcon.get(), gArgs.GetArg("-rpcclienttimeout", DEFAULT_HTTP_CLIENT_TIMEOUT));
-
-    HTTPReply response;
-    raii_evhttp_request req = obtain_evhttp_request(http_request_done, (void*)&response);
-    if (req == nullptr)
-        throw std::runtime_error("create http request failed");
-#if LIBEVENT_VERSION_NUMBER >= 0x02010300
-    evhttp_request_set_error_cb(req.get(), http_error_cb);
-#endif
-
-    // Get credentials
+    raii_event_base base;
+    raii_evhttp_connection evcon;
     std::string strRPCUserColonPass;
-    if (gArgs.GetArg("-rpcpassword", "") == "") {
-        // Try fall back to cookie-based authentication if no password is provided
-        if (!GetAuthCookie(&strRPCUserColonPass)) {
-            throw std::runtime_error(strprintf(
-                _("Could not locate RPC credentials. No authentication cookie could be found, and RPC password is not set.  See -rpcpassword and -stdinrpcpass.  Configuration file: (%s)"),
-                    GetConfigFile(gArgs.GetArg("-conf", BITCOIN_CONF_FILENAME)).string().c_str()));
+    std::string endpoint;
+    bool fKeepAlive;
+
+public:
+    explicit RPCConnection(bool fKeepAliveIn) : base(obtain_event_base()), fKeepAlive(fKeepAliveIn)
+    {
+        // In preference order, we choose the following for the port:
+        //     1. -rpcport
+        //     2. port in -rpcconnect (ie following : in ipv4 or ]: in ipv6)
+        //     3. default port for chain
+        int port = BaseParams().RPCPort();
+        SplitHostPort(gArgs.GetArg("-rpcconnect", DEFAULT_RPCCONNECT), port, host);
+        port = gArgs.GetArg("-rpcport", port);
+
+        // Synchronously look up hostname
+        evcon = obtain_evhttp_connection_base(base.get(), host, port);
+        evhttp_connection_set_timeout(evcon.get(), gArgs.GetArg("-rpcclienttimeout", DEFAULT_HTTP_CLIENT_TIMEOUT));
+
+        // Get credentials
+        if (gArgs.GetArg("-rpcpassword", "") == "") {
+            // Try fall back to cookie-based authentication if no password is provided
+            if (!GetAuthCookie(&strRPCUserColonPass)) {
+                throw std::runtime_error(strprintf(
+                    _("Could not locate RPC credentials. No authentication cookie could be found, and RPC password is not set.  See -rpcpassword and -stdinrpcpass.  Configuration file: (%s)"),
+                        GetConfigFile(gArgs.GetArg("-conf", BITCOIN_CONF_FILENAME)).string().c_str()));
 
+            }
+        } else {
+            strRPCUserColonPass = gArgs.GetArg("-rpcuser", "") + ":" + gArgs.GetArg("-rpcpassword", "");
+        }
+
+        // check if we should use a special wallet endpoint
+        endpoint = "/";
+        std::string walletName = gArgs.GetArg("-rpcwallet", "");
+        if (!walletName.empty()) {
+            char *encodedURI = evhttp_uriencode(walletName.c_str(), walletName.size(), false);
+            if (encodedURI) {
+                endpoint = "/wallet/"+ std::string(encodedURI);
+                free(encodedURI);
+            }
+            else {
+                throw CConnectionFailed("uri-encode failed");
+            }
         }
-    } else {
-        strRPCUserColonPass = gArgs.GetArg("-rpcuser", "") + ":" + gArgs.GetArg("-rpcpassword", "");
     }
 
-    struct evkeyvalq* output_headers = evhttp_request_get_output_headers(req.get());
-    assert(output_headers);
-    evhttp_add_header(output_headers, "Host", host.c_str());
-    evhttp_add_header(output_headers, "Connection", "close");
-    evhttp_add_header(output_headers, "Authorization", (std::string("Basic ") + EncodeBase64(strRPCUserColonPass)).c_str());
-
-    // Attach request data
-    std::string strRequest = rh->PrepareRequest(strMethod, args).write() + "\n";
-    struct evbuffer* output_buffer = evhttp_request_get_output_buffer(req.get());
-    assert(output_buffer);
-    evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
-
-    // check if we should use a special wallet endpoint
-    std::string endpoint = "/";
-    std::string walletName = gArgs.GetArg("-rpcwallet", "");
-    if (!walletName.empty()) {
-        char *encodedURI = evhttp_uriencode(walletName.c_str(), walletName.size(), false);
-        if (encodedURI) {
-            endpoint = "/wallet/"+ std::string(encodedURI);
-            free(encodedURI);
+    /** Send a request and wait for the reply to it */
+    UniValue Request(const UniValue& request)
+    {
+        HTTPReply response;
+        raii_evhttp_request req = obtain_evhttp_request(http_request_done, (void*)&response);
+        if (req == nullptr)
+            throw std::runtime_error("create http request failed");
+#if LIBEVENT_VERSION_NUMBER >= 0x02010300
+        evhttp_request_set_error_cb(req.get(), http_error_cb);
+#endif
+
+        struct evkeyvalq* output_headers = evhttp_request_get_output_headers(req.get());
+        assert(output_headers);
+        evhttp_add_header(output_headers, "Host", host.c_str());
+        evhttp_add_header(output_headers, "Connection", fKeepAlive ? "keep-alive" : "close");
+        evhttp_add_header(output_headers, "Authorization", (std::string("Basic ") + EncodeBase64(strRPCUserColonPass)).c_str());
+
+        // Attach request data
+        std::string strRequest = request.write() + "\n";
+        struct evbuffer* output_buffer = evhttp_request_get_output_buffer(req.get());
+        assert(output_buffer);
+        evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
+
+        int r = evhttp_make_request(evcon.get(), req.get(), EVHTTP_REQ_POST, endpoint.c_str());
+        req.release(); // ownership moved to evcon in above call
+        if (r != 0) {
+            throw CConnectionFailed("send http request failed");
         }
-        else {
-            throw CConnectionFailed("uri-encode failed");
+
+        // A connection kept alive keeps waiting for events once the reply
+        // is in, so only run the loop until it is
+        while (!response.done) {
+            if (event_base_loop(base.get(), EVLOOP_ONCE) != 0)
+                break;
         }
+
+        if (response.status == 0)
+            throw CConnectionFailed(strprintf("couldn't connect to server: %s (code %d)\n(make sure server is running and you are connecting to the correct RPC port)", http_errorstring(response.error), response.error));
+        else if (response.status == HTTP_UNAUTHORIZED)
+            throw std::runtime_error("incorrect rpcuser or rpcpassword (authorization failed)");
+        else if (response.status >= 400 && response.status != HTTP_BAD_REQUEST && response.status != HTTP_NOT_FOUND && response.status != HTTP_INTERNAL_SERVER_ERROR)
+            throw std::runtime_error(strprintf("server returned HTTP error %d", response.status));
+        else if (response.body.empty())
+            throw std::runtime_error("no response from server");
+
+        // Parse reply
+        UniValue valReply(UniValue::VSTR);
+        if (!valReply.read(response.body))
+            throw std::runtime_error("couldn't parse reply from server");
+        return valReply;
     }
-    int r = evhttp_make_request(evcon.get(), req.get(), EVHTTP_REQ_POST, endpoint.c_str());
-    req.release(); // ownership moved to evcon in above call
-    if (r != 0) {
-        throw CConnectionFailed("send http request failed");
-    }
+};
 
-    event_base_dispatch(base.get());
-
-    if (response.status == 0)
-        throw CConnectionFailed(strprintf("couldn't connect to server: %s (code %d)\n(make sure server is running and you are connecting to the correct RPC port)", http_errorstring(response.error), response.error));
-    else if (response.status == HTTP_UNAUTHORIZED)
-        throw std::runtime_error("incorrect rpcuser or rpcpassword (authorization failed)");
-    else if (response.status >= 400 && response.status != HTTP_BAD_REQUEST && response.status != HTTP_NOT_FOUND && response.status != HTTP_INTERNAL_SERVER_ERROR)
-        throw std::runtime_error(strprintf("server returned HTTP error %d", response.status));
-    else if (response.body.empty())
-        throw std::runtime_error("no response from server");
-
-    // Parse reply
-    UniValue valReply(UniValue::VSTR);
-    if (!valReply.read(response.body))
-        throw std::runtime_error("couldn't parse reply from server");
-    const UniValue reply = rh->ProcessReply(valReply);
+static UniValue CallRPC(BaseRequestHandler *rh, const std::string& strMethod, const std::vector<std::string>& args)
+{
+    RPCConnection connection(false);
+    const UniValue reply = rh->ProcessReply(connection.Request(rh->PrepareRequest(strMethod, args)));
     if (reply.empty())
         throw std::runtime_error("expected reply to have result, error and id properties");
 
     return reply;
 }
 
+/** Send the commands of a -batch chunk as one JSON-RPC batch, and write their results */
+static bool CallBatchRPC(RPCConnection& connection, const std::vector<std::string>& lines)
+{
+    std::vector<std::string> results(lines.size());
+    std::vector<bool> failed(lines.size());
+    UniValue request(UniValue::VARR);
+    for (size_t i = 0; i < lines.size(); i++) {
+        std::vector<std::string> args;
+        boost::split(args, lines[i], boost::is_any_of(" \t"), boost::token_compress_on);
+        const std::string method = args[0];
+        args.erase(args.begin());
+        try {
+            UniValue params = gArgs.GetBoolArg("-named", DEFAULT_NAMED) ? RPCConvertNamedValues(method, args) : RPCConvertValues(method, args);
+            request.push_back(JSONRPCRequestObj(method, params, (int)i));
+        } catch (const std::exception& e) {
+            // Not sent; the reply has nothing for this id
+            results[i] = std::string("error: ") + JSONRPCError(RPC_INVALID_PARAMETER, e.what()).write();
+            failed[i] = true;
+        }
+    }
+
+    if (!request.empty()) {
+        const std::vector<UniValue> replies = JSONRPCProcessBatchReply(connection.Request(request), lines.size());
+        for (size_t i = 0; i < lines.size(); i++) {
+            if (failed[i])
+                continue;
+            const UniValue& result = find_value(replies[i], "result");
+            const UniValue& error = find_value(replies[i], "error");
+            if (replies[i].isNull()) {
+                results[i] = "error: no reply";
+                failed[i] = true;
+            } else if (!error.isNull()) {
+                results[i] = "error: " + error.write();
+                failed[i] = true;
+            } else if (result.isStr()) {
+                results[i] = result.get_str();
+            } else if (!result.isNull()) {
+                results[i] = result.write();
+            }
+        }
+    }
+
+    bool fFailed = false;
+    for (size_t i = 0; i < lines.size(); i++) {
+        fprintf(stdout, "%s\n", results[i].c_str());
+        fFailed |= failed[i];
+    }
+    fflush(stdout);
+    return !fFailed;
+}
+
+/**
+ * Run -batch: read the commands from standard input, send them -batchsize
+ * at a time over one connection, and write their results in order.
+ */
+static int CommandLineBatchRPC()
+{
+    const size_t nBatchSize = std::max(1, std::min(MAX_BATCH_SIZE, (int)gArgs.GetArg("-batchsize", DEFAULT_BATCH_SIZE)));
+    const bool fWait = gArgs.GetBoolArg("-rpcwait", false);
+    RPCConnection connection(true);
+    bool fFailed = false;
+    std::vector<std::string> lines;
+    std::string line;
+    bool fEOF = false;
+    while (!fEOF) {
+        lines.clear();
+        while (lines.size() < nBatchSize) {
+            if (!std::getline(std::cin, line)) {
+                fEOF = true;
+                break;
+            }
+            boost::algorithm::trim(line);
+            if (!line.empty())
+                lines.push_back(line);
+        }
+        if (lines.empty())
+            break;
+
+        // Execute and handle connection failures with -rpcwait
+        while (true) {
+            try {
+                fFailed |= !CallBatchRPC(connection, lines);
+                break;
+            } catch (const CConnectionFailed&) {
+                if (!fWait)
+                    throw;
+                MilliSleep(1000);
+            }
+        }
+    }
+    return fFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int CommandLineRPC(int argc, char *argv[])
 {
     std::string strPrint;
@@ -395,6 +524,11 @@ int CommandLineRPC(int argc, char *argv[])
             }
             gArgs.ForceSetArg("-rpcpassword", rpcPass);
         }
+        if (gArgs.GetBoolArg("-batch", false)) {
+            if (argc > 1 || gArgs.GetBoolArg("-stdin", false) || gArgs.GetBoolArg("-getinfo", false))
+                throw std::runtime_error("-batch takes its commands from standard input only");
+            return CommandLineBatchRPC();
+        }
         std::vector<std::string> args = std::vector<std::string>(&argv[1], &argv[argc]);
         if (gArgs.GetBoolArg("-stdin", false)) {
             // Read one arg per line from stdin and append
@@ -22,14 +22,22 @@
 #include <utilmoneystr.h>
 #include <utilstrencodings.h>
 
+#include <atomic>
+#include <iostream>
 #include <memory>
 #include <stdio.h>
+#include <system_error>
+#include <thread>
 
 #include <boost/algorithm/string.hpp>
 
 static bool fCreateBlank;
-static std::map<std::string,UniValue> registers;
+typedef std::map<std::string,UniValue> Registers;
 static const int CONTINUE_EXECUTION=-1;
+/** Lines of -batch input read and processed at once */
+static const size_t BATCH_LINES = 1000;
+static const int DEFAULT_BATCH_THREADS = 1;
+static const int MAX_BATCH_THREADS = 64;
 
 //
 // This function returns either one of EXIT_ codes when it's expected to stop the process or
@@ -59,12 +67,16 @@ static int AppInitRawTx(int argc, char* argv[])
             _("Usage:") + "\n" +
               "  bitcoin-tx [options] <hex-tx> [commands]  " + _("Update hex-encoded bitcoin transaction") + "\n" +
               "  bitcoin-tx [options] -create [commands]   " + _("Create hex-encoded bitcoin transaction") + "\n" +
+              "  bitcoin-tx [options] -batch [commands]    " + _("Update or create a hex-encoded bitcoin transaction for every line of standard input") + "\n" +
               "\n";
 
         fprintf(stdout, "%s", strUsage.c_str());
 
         strUsage = HelpMessageGroup(_("Options:"));
         strUsage += HelpMessageOpt("-?", _("This help message"));
+        strUsage += HelpMessageOpt("-batch", _("Read lines of <hex-tx> [commands], or of [commands] with -create, from standard input, and write a line with the resultant transaction or error for each, in order. "
+            "Commands are separated by spaces, and empty lines are skipped. Register commands on the command line are run once, before all lines; the other commands on the command line are applied to every transaction after those of its line."));
+        strUsage += HelpMessageOpt("-batchthreads=<n>", strprintf(_("Process the lines of -batch on up to <n> threads (default: %d)"), DEFAULT_BATCH_THREADS));
         strUsage += HelpMessageOpt("-create", _("Create new, empty TX."));
         strUsage += HelpMessageOpt("-json", _("Select JSON output"));
         strUsage += HelpMessageOpt("-txid", _("Output only the hex-encoded transaction id of the resultant transaction."));
@@ -111,7 +123,7 @@ static int AppInitRawTx(int argc, char* argv[])
     return CONTINUE_EXECUTION;
 }
 
-static void RegisterSetJson(const std::string& key, const std::string& rawJson)
+static void RegisterSetJson(Registers& registers, const std::string& key, const std::string& rawJson)
 {
     UniValue val;
     if (!val.read(rawJson)) {
@@ -122,7 +134,7 @@ static void RegisterSetJson(const std::string& key, const std::string& rawJson)
     registers[key] = val;
 }
 
-static void RegisterSet(const std::string& strInput)
+static void RegisterSet(Registers& registers, const std::string& strInput)
 {
     // separate NAME:VALUE in string
     size_t pos = strInput.find(':');
@@ -134,10 +146,10 @@ static void RegisterSet(const std::string& strInput)
     std::string key = strInput.substr(0, pos);
     std::string valStr = strInput.substr(pos + 1, std::string::npos);
 
-    RegisterSetJson(key, valStr);
+    RegisterSetJson(registers, key, valStr);
 }
 
-static void RegisterLoad(const std::string& strInput)
+static void RegisterLoad(Registers& registers, const std::string& strInput)
 {
     // separate NAME:FILENAME in string
     size_t pos = strInput.find(':');
@@ -175,7 +187,7 @@ static void RegisterLoad(const std::string& strInput)
     }
 
     // evaluate as JSON buffer register
-    RegisterSetJson(key, valStr);
+    RegisterSetJson(registers, key, valStr);
 }
 
 static CAmount ExtractAndValidateValue(const std::string& strValue)
@@ -538,7 +550,7 @@ static CAmount AmountFromValue(const UniValue& value)
     return amount;
 }
 
-static void MutateTxSign(CMutableTransaction& tx, const std::string& flagStr)
+static void MutateTxSign(CMutableTransaction& tx, const std::string& flagStr, Registers& registers)
 {
     int nHashType = SIGHASH_ALL;
 
@@ -681,8 +693,11 @@ public:
     }
 };
 
+//! Started once for all transactions of -batch, rather than by every command needing it
+static std::unique_ptr<Secp256k1Init> g_secp256k1;
+
 static void MutateTx(CMutableTransaction& tx, const std::string& command,
-                     const std::string& commandVal)
+                     const std::string& commandVal, Registers& registers)
 {
     std::unique_ptr<Secp256k1Init> ecc;
 
@@ -704,10 +719,10 @@ static void MutateTx(CMutableTransaction& tx, const std::string& command,
     else if (command == "outaddr")
         MutateTxAddOutAddr(tx, commandVal);
     else if (command == "outpubkey") {
-        ecc.reset(new Secp256k1Init());
+        if (!g_secp256k1) ecc.reset(new Secp256k1Init());
         MutateTxAddOutPubKey(tx, commandVal);
     } else if (command == "outmultisig") {
-        ecc.reset(new Secp256k1Init());
+        if (!g_secp256k1) ecc.reset(new Secp256k1Init());
         MutateTxAddOutMultiSig(tx, commandVal);
     } else if (command == "outscript")
         MutateTxAddOutScript(tx, commandVal);
@@ -715,15 +730,15 @@ static void MutateTx(CMutableTransaction& tx, const std::string& command,
         MutateTxAddOutData(tx, commandVal);
 
     else if (command == "sign") {
-        ecc.reset(new Secp256k1Init());
-        MutateTxSign(tx, commandVal);
+        if (!g_secp256k1) ecc.reset(new Secp256k1Init());
+        MutateTxSign(tx, commandVal, registers);
     }
 
     else if (command == "load")
-        RegisterLoad(commandVal);
+        RegisterLoad(registers, commandVal);
 
     else if (command == "set")
-        RegisterSet(commandVal);
+        RegisterSet(registers, commandVal);
 
     else
         throw std::runtime_error("unknown command");
@@ -782,6 +797,129 @@ static std::string readStdin()
     return ret;
 }
 
+static void SplitCommand(const std::string& arg, std::string& key, std::string& value)
+{
+    size_t eqpos = arg.find('=');
+    if (eqpos == std::string::npos)
+        key = arg;
+    else {
+        key = arg.substr(0, eqpos);
+        value = arg.substr(eqpos + 1);
+    }
+}
+
+/** The output for a line of -batch, the same as OutputTx but always on one line */
+static std::string BatchRawTx(const std::string& line, const std::vector<std::pair<std::string, std::string>>& commands, const Registers& registersIn)
+{
+    std::vector<std::string> args;
+    boost::split(args, line, boost::is_any_of(" \t"), boost::token_compress_on);
+
+    CMutableTransaction tx;
+    size_t startArg = 0;
+    if (!fCreateBlank) {
+        if (!DecodeHexTx(tx, args[0], true))
+            throw std::runtime_error("invalid transaction encoding");
+        startArg = 1;
+    }
+
+    Registers registers(registersIn);
+    for (size_t i = startArg; i < args.size(); i++) {
+        std::string key, value;
+        SplitCommand(args[i], key, value);
+        MutateTx(tx, key, value, registers);
+    }
+    for (const auto& command : commands) {
+        MutateTx(tx, command.first, command.second, registers);
+    }
+
+    if (gArgs.GetBoolArg("-json", false)) {
+        UniValue entry(UniValue::VOBJ);
+        TxToUniv(tx, uint256(), entry);
+        return entry.write();
+    } else if (gArgs.GetBoolArg("-txid", false)) {
+        return tx.GetHash().GetHex();
+    }
+    return EncodeHexTx(tx);
+}
+
+/**
+ * Run -batch: read standard input BATCH_LINES lines at a time, process them
+ * on up to -batchthreads threads, and write their results in order. Errors
+ * are written in place of the transaction, so that every line of input has
+ * its line of output.
+ */
+static int CommandLineBatchRawTx(int argc, char* argv[])
+{
+    Registers registers;
+    std::vector<std::pair<std::string, std::string>> commands;
+    for (int i = 1; i < argc; i++) {
+        std::string key, value;
+        SplitCommand(argv[i], key, value);
+        if (key == "load" || key == "set") {
+            CMutableTransaction txDummy;
+            MutateTx(txDummy, key, value, registers);
+        } else {
+            commands.emplace_back(key, value);
+        }
+    }
+
+    g_secp256k1.reset(new Secp256k1Init());
+    const int nThreads = std::max(1, std::min(MAX_BATCH_THREADS, (int)gArgs.GetArg("-batchthreads", DEFAULT_BATCH_THREADS)));
+    bool fFailed = false;
+    std::vector<std::string> lines;
+    std::vector<std::string> results;
+    std::vector<char> failed;
+    std::string line;
+    while (true) {
+        lines.clear();
+        while (lines.size() < BATCH_LINES && std::getline(std::cin, line)) {
+            boost::algorithm::trim(line);
+            if (!line.empty())
+                lines.push_back(line);
+        }
+        if (lines.empty())
+            break;
+
+        results.assign(lines.size(), std::string());
+        failed.assign(lines.size(), 0);
+        std::atomic<size_t> nNext(0);
+        auto worker = [&]() {
+            size_t i;
+            while ((i = nNext++) < lines.size()) {
+                try {
+                    results[i] = BatchRawTx(lines[i], commands, registers);
+                } catch (const std::exception& e) {
+                    results[i] = std::string("error: ") + e.what();
+                    failed[i] = 1;
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        for (int t = 1; t < nThreads && (size_t)t < lines.size(); t++) {
+            try {
+                threads.emplace_back(worker);
+            } catch (const std::system_error&) {
+                break;
+            }
+        }
+        worker();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        for (size_t i = 0; i < lines.size(); i++) {
+            fprintf(stdout, "%s\n", results[i].c_str());
+            fFailed |= failed[i];
+        }
+        fflush(stdout);
+    }
+    g_secp256k1.reset();
+
+    if (std::cin.bad())
+        throw std::runtime_error("error reading stdin");
+    return fFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 static int CommandLineRawTx(int argc, char* argv[])
 {
     std::string strPrint;
@@ -794,6 +932,10 @@ static int CommandLineRawTx(int argc, char* argv[])
             argv++;
         }
 
+        if (gArgs.GetBoolArg("-batch", false))
+            return CommandLineBatchRawTx(argc, argv);
+
+        Registers registers;
         CMutableTransaction tx;
         int startArg;
 
@@ -815,17 +957,10 @@ static int CommandLineRawTx(int argc, char* argv[])
             startArg = 1;
 
         for (int i = startArg; i < argc; i++) {
-            std::string arg = argv[i];
             std::string key, value;
-            size_t eqpos = arg.find('=');
-            if (eqpos == std::string::npos)
-                key = arg;
-            else {
-                key = arg.substr(0, eqpos);
-                value = arg.substr(eqpos + 1);
-            }
+            SplitCommand(argv[i], key, value);
 
-            MutateTx(tx, key, value);
+            MutateTx(tx, key, value, registers);
         }
 
         OutputTx(tx);
@@ -0,0 +1,172 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockcompression.h>
+
+#include <crypto/common.h>
+#include <serialize.h>
+
+#include <algorithm>
+#include <string.h>
+
+/** Shortest match */
+static const size_t MIN_MATCH = 4;
+/** A match ends at least this many bytes before the end, which are literals */
+static const size_t LAST_LITERALS = 5;
+/** No match starts in the last bytes */
+static const size_t MATCH_FIND_LIMIT = 12;
+static const size_t MAX_OFFSET = 65535;
+static const int HASH_BITS = 16;
+/** Misses after which the search skips ahead faster, through incompressible data */
+static const int SKIP_TRIGGER = 6;
+
+static inline uint32_t HashSequence(uint32_t nSequence)
+{
+    return (nSequence * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/** Append a length that did not fit the 4 bits of the token */
+static void WriteLengthExtension(std::vector<unsigned char>& out, size_t nLength)
+{
+    while (nLength >= 255) {
+        out.push_back(255);
+        nLength -= 255;
+    }
+    out.push_back((unsigned char)nLength);
+}
+
+static void WriteSequence(std::vector<unsigned char>& out, const unsigned char* literals, size_t nLiterals, size_t nOffset, size_t nMatch)
+{
+    const size_t nMatchCode = nMatch - MIN_MATCH;
+    out.push_back((unsigned char)((std::min<size_t>(nLiterals, 15) << 4) | std::min<size_t>(nMatchCode, 15)));
+    if (nLiterals >= 15)
+        WriteLengthExtension(out, nLiterals - 15);
+    out.insert(out.end(), literals, literals + nLiterals);
+    if (nMatch == 0)
+        return;
+    out.push_back((unsigned char)(nOffset & 0xff));
+    out.push_back((unsigned char)(nOffset >> 8));
+    if (nMatchCode >= 15)
+        WriteLengthExtension(out, nMatchCode - 15);
+}
+
+void LZCompress(const unsigned char* data, size_t size, std::vector<unsigned char>& out)
+{
+    out.clear();
+    out.reserve(size + size / 255 + 16);
+
+    size_t nAnchor = 0;
+    if (size > MATCH_FIND_LIMIT) {
+        std::vector<uint32_t> table(1 << HASH_BITS, 0);
+        const size_t nMatchEnd = size - LAST_LITERALS;
+        size_t nPos = 0;
+        int nMisses = 0;
+        while (nPos + MATCH_FIND_LIMIT <= size) {
+            const uint32_t nSequence = ReadLE32(data + nPos);
+            uint32_t& nCandidate = table[HashSequence(nSequence)];
+            const size_t nRef = nCandidate;
+            nCandidate = nPos;
+            if (nRef >= nPos || nPos - nRef > MAX_OFFSET || ReadLE32(data + nRef) != nSequence) {
+                nPos += 1 + (nMisses++ >> SKIP_TRIGGER);
+                continue;
+            }
+            size_t nMatch = MIN_MATCH;
+            while (nPos + nMatch < nMatchEnd && data[nRef + nMatch] == data[nPos + nMatch])
+                nMatch++;
+            WriteSequence(out, data + nAnchor, nPos - nAnchor, nPos - nRef, nMatch);
+            nPos += nMatch;
+            nAnchor = nPos;
+            nMisses = 0;
+        }
+    }
+    WriteSequence(out, data + nAnchor, size - nAnchor, 0, 0);
+}
+
+/** Read a length that did not fit the 4 bits of the token */
+static bool ReadLengthExtension(const unsigned char* data, size_t size, size_t& nPos, size_t& nLength)
+{
+    unsigned char nByte;
+    do {
+        if (nPos >= size)
+            return false;
+        nByte = data[nPos++];
+        nLength += nByte;
+    } while (nByte == 255);
+    return true;
+}
+
+bool LZDecompress(const unsigned char* data, size_t size, unsigned char* out, size_t nOutSize)
+{
+    size_t nPos = 0;
+    size_t nOut = 0;
+    while (true) {
+        if (nPos >= size)
+            return false;
+        const unsigned char nToken = data[nPos++];
+
+        size_t nLiterals = nToken >> 4;
+        if (nLiterals == 15 && !ReadLengthExtension(data, size, nPos, nLiterals))
+            return false;
+        if (nLiterals > size - nPos || nLiterals > nOutSize - nOut)
+            return false;
+        if (nLiterals > 0)
+            memcpy(out + nOut, data + nPos, nLiterals);
+        nPos += nLiterals;
+        nOut += nLiterals;
+        // The last sequence has no match
+        if (nPos == size)
+            break;
+
+        if (size - nPos < 2)
+            return false;
+        const size_t nOffset = data[nPos] | (data[nPos + 1] << 8);
+        nPos += 2;
+        if (nOffset == 0 || nOffset > nOut)
+            return false;
+        size_t nMatch = nToken & 15;
+        if (nMatch == 15 && !ReadLengthExtension(data, size, nPos, nMatch))
+            return false;
+        nMatch += MIN_MATCH;
+        if (nMatch > nOutSize - nOut)
+            return false;
+        // The match may overlap the bytes it produces
+        const unsigned char* pchFrom = out + nOut - nOffset;
+        if (nOffset >= nMatch) {
+            memcpy(out + nOut, pchFrom, nMatch);
+        } else {
+            for (size_t i = 0; i < nMatch; i++)
+                out[nOut + i] = pchFrom[i];
+        }
+        nOut += nMatch;
+    }
+    return nOut == nOutSize;
+}
+
+void CompressRecord(std::vector<unsigned char>& record)
+{
+    if (record.size() <= 8)
+        return;
+    std::vector<unsigned char> compressed;
+    LZCompress(record.data() + 8, record.size() - 8, compressed);
+    // The uncompressed size comes in front of the compressed data
+    if (compressed.size() + 4 >= record.size() - 8)
+        return;
+    WriteLE32(record.data() + 4, (uint32_t)(compressed.size() + 4) | COMPRESSED_RECORD_FLAG);
+    unsigned char nRawSize[4];
+    WriteLE32(nRawSize, (uint32_t)(record.size() - 8));
+    record.resize(8);
+    record.insert(record.end(), nRawSize, nRawSize + 4);
+    record.insert(record.end(), compressed.begin(), compressed.end());
+}
+
+bool DecompressRecord(const unsigned char* data, size_t size, std::vector<unsigned char>& out)
+{
+    if (size < 4)
+        return false;
+    const uint32_t nRawSize = ReadLE32(data);
+    if (nRawSize > MAX_SIZE)
+        return false;
+    out.resize(nRawSize);
+    return LZDecompress(data + 4, size - 4, out.data(), nRawSize);
+}
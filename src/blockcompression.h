@@ -0,0 +1,40 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCOMPRESSION_H
+#define BITCOIN_BLOCKCOMPRESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Optional compression of the records of the block and undo files
+ * (-blockcompression).
+ *
+ * A record is an index header, the network magic and a 32-bit size, followed
+ * by the serialized block, or by the undo data and its checksum. The size of
+ * a compressed record has COMPRESSED_RECORD_FLAG set, and then counts a
+ * 32-bit uncompressed size followed by the compressed data. Every record is
+ * compressed on its own, so it is still found at its CDiskBlockPos, and
+ * records that do not shrink are left raw; a file may hold both.
+ */
+static const uint32_t COMPRESSED_RECORD_FLAG = 0x80000000;
+
+/** Compress the data of a record, after its index header, in place if that makes the record smaller. */
+void CompressRecord(std::vector<unsigned char>& record);
+/** Decompress the data of a compressed record (after the size in its index header) into out. */
+bool DecompressRecord(const unsigned char* data, size_t size, std::vector<unsigned char>& out);
+
+/**
+ * A fast LZ77 codec in the style of LZ4: byte aligned sequences of literals
+ * and matches of at least 4 bytes within the previous 64KiB, found with a
+ * single hash table probe. It trades ratio for speed, so that reading a
+ * compressed block costs less than reading the bytes it saves.
+ */
+void LZCompress(const unsigned char* data, size_t size, std::vector<unsigned char>& out);
+/** Decompress exactly nOutSize bytes into out. Returns false on corrupt input. */
+bool LZDecompress(const unsigned char* data, size_t size, unsigned char* out, size_t nOutSize);
+
+#endif // BITCOIN_BLOCKCOMPRESSION_H
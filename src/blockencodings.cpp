@@ -13,18 +13,34 @@
 #include <validation.h>
 #include <util.h>
 
-#include <unordered_map>
+#include <limits>
 
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
+        CBlockHeaderAndShortTxIDs(block, fUseWTXID, std::vector<bool>()) {}
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID, const std::vector<bool>& vPrefill) :
         nonce(GetRand(std::numeric_limits<uint64_t>::max())),
-        shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block) {
+        prefilledtxn(1), header(block) {
     FillShortTxIDSelector();
-    //TODO: Use our mempool prior to block acceptance to predictively fill more than just the coinbase
     prefilledtxn[0] = {0, block.vtx[0]};
+    std::vector<const uint256*> vHashes;
+    vHashes.reserve(block.vtx.size() - 1);
+    size_t nLastPrefilled = 0;
     for (size_t i = 1; i < block.vtx.size(); i++) {
+        if (i < vPrefill.size() && vPrefill[i]) {
+            prefilledtxn.push_back({(uint16_t)(i - nLastPrefilled - 1), block.vtx[i]});
+            nLastPrefilled = i;
+            continue;
+        }
         const CTransaction& tx = *block.vtx[i];
-        shorttxids[i - 1] = GetShortID(fUseWTXID ? tx.GetWitnessHash() : tx.GetHash());
+        vHashes.push_back(fUseWTXID ? &tx.GetWitnessHash() : &tx.GetHash());
     }
+    shorttxids.resize(vHashes.size());
+    size_t i = 0;
+    for (; i + SIPHASH_LANES <= vHashes.size(); i += SIPHASH_LANES)
+        GetShortIDs(&vHashes[i], &shorttxids[i]);
+    for (; i < vHashes.size(); i++)
+        shorttxids[i] = GetShortID(*vHashes[i]);
 }
 
 void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const {
@@ -43,6 +59,92 @@ uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const {
     return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffL;
 }
 
+void CBlockHeaderAndShortTxIDs::GetShortIDs(const uint256* const txhashes[SIPHASH_LANES], uint64_t shortids[SIPHASH_LANES]) const {
+    SipHashUint256Lanes(shorttxidk0, shorttxidk1, txhashes, shortids);
+    for (size_t l = 0; l < SIPHASH_LANES; l++)
+        shortids[l] &= 0xffffffffffffL;
+}
+
+namespace {
+
+/** Longest probe sequence accepted in a ShortIdTable */
+static const size_t MAX_SHORTID_PROBES = 64;
+
+/**
+ * Open-addressing table from short id to position in the block, in a single
+ * flat allocation. Slots are chosen from the short id mixed with a salt of our
+ * own, so a peer picking its short ids can't make them cluster; an overlong
+ * probe sequence is treated like an overfull bucket and fails the block.
+ */
+class ShortIdTable
+{
+private:
+    struct Slot {
+        uint64_t shortid;
+        uint16_t index;
+    };
+    // Short ids are 48 bits wide, so this never matches one
+    static const uint64_t EMPTY = std::numeric_limits<uint64_t>::max();
+
+    std::vector<Slot> slots;
+    size_t mask;
+    size_t count;
+
+    size_t Start(uint64_t shortid) const
+    {
+        static const uint64_t salt = GetRand(std::numeric_limits<uint64_t>::max());
+        uint64_t x = shortid ^ salt;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return (x ^ (x >> 31)) & mask;
+    }
+
+public:
+    explicit ShortIdTable(size_t nElements) : count(0)
+    {
+        // Keep the table at most half full
+        size_t nSlots = 16;
+        while (nSlots < 2 * nElements)
+            nSlots <<= 1;
+        slots.assign(nSlots, Slot{EMPTY, 0});
+        mask = nSlots - 1;
+    }
+
+    size_t size() const { return count; }
+
+    /** Returns false for a short id already present or a table too unevenly filled */
+    bool Insert(uint64_t shortid, uint16_t index)
+    {
+        size_t pos = Start(shortid);
+        for (size_t i = 0; i < MAX_SHORTID_PROBES; i++, pos = (pos + 1) & mask) {
+            if (slots[pos].shortid == EMPTY) {
+                slots[pos] = Slot{shortid, index};
+                count++;
+                return true;
+            }
+            if (slots[pos].shortid == shortid)
+                return false;
+        }
+        return false;
+    }
+
+    bool Find(uint64_t shortid, uint16_t& index) const
+    {
+        size_t pos = Start(shortid);
+        for (size_t i = 0; i < MAX_SHORTID_PROBES; i++, pos = (pos + 1) & mask) {
+            if (slots[pos].shortid == shortid) {
+                index = slots[pos].index;
+                return true;
+            }
+            if (slots[pos].shortid == EMPTY)
+                return false;
+        }
+        return false;
+    }
+};
+
+} // namespace
+
 
 
 ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn) {
@@ -77,89 +179,99 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     // Because well-formed cmpctblock messages will have a (relatively) uniform distribution
     // of short IDs, any highly-uneven distribution of elements can be safely treated as a
     // READ_STATUS_FAILED.
-    std::unordered_map<uint64_t, uint16_t> shorttxids(cmpctblock.shorttxids.size());
+    ShortIdTable shorttxids(cmpctblock.shorttxids.size());
     uint16_t index_offset = 0;
     for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
         while (txn_available[i + index_offset])
             index_offset++;
-        shorttxids[cmpctblock.shorttxids[i]] = i + index_offset;
-        // To determine the chance that the number of entries in a bucket exceeds N,
-        // we use the fact that the number of elements in a single bucket is
-        // binomially distributed (with n = the number of shorttxids S, and p =
-        // 1 / the number of buckets), that in the worst case the number of buckets is
-        // equal to S (due to std::unordered_map having a default load factor of 1.0),
-        // and that the chance for any bucket to exceed N elements is at most
-        // buckets * (the chance that any given bucket is above N elements).
-        // Thus: P(max_elements_per_bucket > N) <= S * (1 - cdf(binomial(n=S,p=1/S), N)).
-        // If we assume blocks of up to 16000, allowing 12 elements per bucket should
-        // only fail once per ~1 million block transfers (per peer and connection).
-        if (shorttxids.bucket_size(shorttxids.bucket(cmpctblock.shorttxids[i])) > 12)
-            return READ_STATUS_FAILED;
+        // TODO: in the shortid-collision case, we should instead request both transactions
+        // which collided. Falling back to full-block-request here is overkill.
+        // With the table at most half full, a probe sequence of MAX_SHORTID_PROBES
+        // slots should not occur in practice for short ids that are actually random.
+        if (!shorttxids.Insert(cmpctblock.shorttxids[i], i + index_offset))
+            return READ_STATUS_FAILED; // Short ID collision
     }
-    // TODO: in the shortid-collision case, we should instead request both transactions
-    // which collided. Falling back to full-block-request here is overkill.
-    if (shorttxids.size() != cmpctblock.shorttxids.size())
-        return READ_STATUS_FAILED; // Short ID collision
 
     std::vector<bool> have_txn(txn_available.size());
     {
     LOCK(pool->cs);
     const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
-    for (size_t i = 0; i < vTxHashes.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = vTxHashes[i].second->GetSharedTx();
-                have_txn[idit->second]  = true;
-                mempool_count++;
-            } else {
-                // If we find two mempool txn that match the short id, just request it.
-                // This should be rare enough that the extra bandwidth doesn't matter,
-                // but eating a round-trip due to FillBlock failure would be annoying
-                if (txn_available[idit->second]) {
-                    txn_available[idit->second].reset();
-                    mempool_count--;
+    // Hash the mempool SIPHASH_LANES transactions at a time; a short final
+    // batch repeats its last hash to fill the remaining lanes.
+    for (size_t i = 0; i < vTxHashes.size() && mempool_count < shorttxids.size(); i += SIPHASH_LANES) {
+        const size_t nLanes = std::min(SIPHASH_LANES, vTxHashes.size() - i);
+        const uint256* txhashes[SIPHASH_LANES];
+        for (size_t l = 0; l < SIPHASH_LANES; l++)
+            txhashes[l] = &vTxHashes[i + std::min(l, nLanes - 1)].first;
+        uint64_t shortids[SIPHASH_LANES];
+        cmpctblock.GetShortIDs(txhashes, shortids);
+
+        for (size_t l = 0; l < nLanes; l++) {
+            uint16_t index;
+            if (shorttxids.Find(shortids[l], index)) {
+                if (!have_txn[index]) {
+                    txn_available[index] = vTxHashes[i + l].second->GetSharedTx();
+                    have_txn[index]  = true;
+                    mempool_count++;
+                } else {
+                    // If we find two mempool txn that match the short id, just request it.
+                    // This should be rare enough that the extra bandwidth doesn't matter,
+                    // but eating a round-trip due to FillBlock failure would be annoying
+                    if (txn_available[index]) {
+                        txn_available[index].reset();
+                        mempool_count--;
+                    }
                 }
             }
+            // Though ideally we'd continue scanning for the two-txn-match-shortid case,
+            // the performance win of an early exit here is too good to pass up and worth
+            // the extra risk.
+            if (mempool_count == shorttxids.size())
+                break;
         }
-        // Though ideally we'd continue scanning for the two-txn-match-shortid case,
-        // the performance win of an early exit here is too good to pass up and worth
-        // the extra risk.
-        if (mempool_count == shorttxids.size())
-            break;
     }
     }
 
-    for (size_t i = 0; i < extra_txn.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(extra_txn[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = extra_txn[i].second;
-                have_txn[idit->second]  = true;
-                mempool_count++;
-                extra_count++;
-            } else {
-                // If we find two mempool/extra txn that match the short id, just
-                // request it.
-                // This should be rare enough that the extra bandwidth doesn't matter,
-                // but eating a round-trip due to FillBlock failure would be annoying
-                // Note that we don't want duplication between extra_txn and mempool to
-                // trigger this case, so we compare witness hashes first
-                if (txn_available[idit->second] &&
-                        txn_available[idit->second]->GetWitnessHash() != extra_txn[i].second->GetWitnessHash()) {
-                    txn_available[idit->second].reset();
-                    mempool_count--;
-                    extra_count--;
+    // Every slot may already be filled from the mempool. The extra
+    // transactions are hashed in batches the same way.
+    for (size_t i = 0; i < extra_txn.size() && mempool_count < shorttxids.size(); i += SIPHASH_LANES) {
+        const size_t nLanes = std::min(SIPHASH_LANES, extra_txn.size() - i);
+        const uint256* txhashes[SIPHASH_LANES];
+        for (size_t l = 0; l < SIPHASH_LANES; l++)
+            txhashes[l] = &extra_txn[i + std::min(l, nLanes - 1)].first;
+        uint64_t shortids[SIPHASH_LANES];
+        cmpctblock.GetShortIDs(txhashes, shortids);
+
+        for (size_t l = 0; l < nLanes; l++) {
+            const CTransactionRef& tx = extra_txn[i + l].second;
+            uint16_t index;
+            if (shorttxids.Find(shortids[l], index)) {
+                if (!have_txn[index]) {
+                    txn_available[index] = tx;
+                    have_txn[index]  = true;
+                    mempool_count++;
+                    extra_count++;
+                } else {
+                    // If we find two mempool/extra txn that match the short id, just
+                    // request it.
+                    // This should be rare enough that the extra bandwidth doesn't matter,
+                    // but eating a round-trip due to FillBlock failure would be annoying
+                    // Note that we don't want duplication between extra_txn and mempool to
+                    // trigger this case, so we compare witness hashes first
+                    if (txn_available[index] &&
+                            txn_available[index]->GetWitnessHash() != tx->GetWitnessHash()) {
+                        txn_available[index].reset();
+                        mempool_count--;
+                        extra_count--;
+                    }
                 }
             }
+            // Though ideally we'd continue scanning for the two-txn-match-shortid case,
+            // the performance win of an early exit here is too good to pass up and worth
+            // the extra risk.
+            if (mempool_count == shorttxids.size())
+                break;
         }
-        // Though ideally we'd continue scanning for the two-txn-match-shortid case,
-        // the performance win of an early exit here is too good to pass up and worth
-        // the extra risk.
-        if (mempool_count == shorttxids.size())
-            break;
     }
 
     LogPrint(BCLog::CMPCTBLOCK, "Initialized PartiallyDownloadedBlock for block %s using a cmpctblock of size %lu\n", cmpctblock.header.GetHash().ToString(), GetSerializeSize(cmpctblock, SER_NETWORK, PROTOCOL_VERSION));
@@ -5,6 +5,7 @@
 #ifndef BITCOIN_BLOCK_ENCODINGS_H
 #define BITCOIN_BLOCK_ENCODINGS_H
 
+#include <hash.h>
 #include <primitives/block.h>
 
 #include <memory>
@@ -149,8 +150,12 @@ public:
     CBlockHeaderAndShortTxIDs() {}
 
     CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID);
+    /** Also prefill the transactions flagged in vPrefill, indexed by position in the block */
+    CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID, const std::vector<bool>& vPrefill);
 
     uint64_t GetShortID(const uint256& txhash) const;
+    /** GetShortID of SIPHASH_LANES hashes at once */
+    void GetShortIDs(const uint256* const txhashes[SIPHASH_LANES], uint64_t shortids[SIPHASH_LANES]) const;
 
     size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
 
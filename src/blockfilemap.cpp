@@ -0,0 +1,154 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilemap.h>
+
+#include <compat.h>
+#include <util.h>
+
+#include <limits>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+std::shared_ptr<const CMappedFile> CMappedFile::Open(const fs::path& path)
+{
+#ifdef WIN32
+    HANDLE hFile = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    LARGE_INTEGER nFileSize;
+    if (!GetFileSizeEx(hFile, &nFileSize) || nFileSize.QuadPart <= 0 || (uint64_t)nFileSize.QuadPart > std::numeric_limits<size_t>::max()) {
+        CloseHandle(hFile);
+        return nullptr;
+    }
+    HANDLE hMapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(hFile);
+    if (hMapping == nullptr) {
+        return nullptr;
+    }
+    // The view keeps the mapping object alive.
+    void* p = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(hMapping);
+    if (p == nullptr) {
+        return nullptr;
+    }
+    return std::shared_ptr<const CMappedFile>(new CMappedFile(static_cast<const unsigned char*>(p), (size_t)nFileSize.QuadPart));
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || (uint64_t)st.st_size > std::numeric_limits<size_t>::max()) {
+        close(fd);
+        return nullptr;
+    }
+    // The mapping stays valid after the descriptor is closed.
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+    return std::shared_ptr<const CMappedFile>(new CMappedFile(static_cast<const unsigned char*>(p), (size_t)st.st_size));
+#endif
+}
+
+CMappedFile::~CMappedFile()
+{
+#ifdef WIN32
+    UnmapViewOfFile(pchData);
+#else
+    munmap(const_cast<unsigned char*>(pchData), nSize);
+#endif
+}
+
+void CBlockFileMapCache::EraseMapping(std::map<int, MappingList::iterator>::iterator it)
+{
+    nMappedBytes -= it->second->second->size();
+    listMappings.erase(it->second);
+    mapMappings.erase(it);
+}
+
+void CBlockFileMapCache::SetMaxBytes(size_t nMaxBytesIn)
+{
+    LOCK(cs);
+    nMaxBytes = nMaxBytesIn;
+    while (nMappedBytes > nMaxBytes) {
+        EraseMapping(mapMappings.find(listMappings.back().first));
+    }
+}
+
+void CBlockFileMapCache::SetFinalizedFiles(int nFiles)
+{
+    LOCK(cs);
+    nFinalizedFiles = nFiles;
+    auto it = mapMappings.lower_bound(nFiles);
+    while (it != mapMappings.end()) {
+        EraseMapping(it++);
+    }
+}
+
+std::shared_ptr<const CMappedFile> CBlockFileMapCache::Get(int nFile, const fs::path& path)
+{
+    LOCK(cs);
+    if (nMaxBytes == 0 || nFile < 0 || nFile >= nFinalizedFiles) {
+        return nullptr;
+    }
+    auto it = mapMappings.find(nFile);
+    if (it != mapMappings.end()) {
+        listMappings.splice(listMappings.begin(), listMappings, it->second);
+        return it->second->second;
+    }
+
+    std::shared_ptr<const CMappedFile> mapping = CMappedFile::Open(path);
+    if (!mapping) {
+        LogPrint(BCLog::BENCH, "%s: unable to map %s\n", __func__, path.string());
+        return nullptr;
+    }
+    if (mapping->size() > nMaxBytes) {
+        return nullptr;
+    }
+    while (nMappedBytes + mapping->size() > nMaxBytes) {
+        EraseMapping(mapMappings.find(listMappings.back().first));
+    }
+    listMappings.emplace_front(nFile, mapping);
+    mapMappings.emplace(nFile, listMappings.begin());
+    nMappedBytes += mapping->size();
+    return mapping;
+}
+
+void CBlockFileMapCache::Erase(int nFile)
+{
+    LOCK(cs);
+    auto it = mapMappings.find(nFile);
+    if (it != mapMappings.end()) {
+        EraseMapping(it);
+    }
+}
+
+void CBlockFileMapCache::Clear()
+{
+    LOCK(cs);
+    listMappings.clear();
+    mapMappings.clear();
+    nMappedBytes = 0;
+}
+
+size_t CBlockFileMapCache::MappedBytes() const
+{
+    LOCK(cs);
+    return nMappedBytes;
+}
+
+size_t CBlockFileMapCache::Count() const
+{
+    LOCK(cs);
+    return mapMappings.size();
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include <fs.h>
+#include <sync.h>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <stddef.h>
+
+/** A read-only memory mapping of a whole file. */
+class CMappedFile
+{
+private:
+    const unsigned char* pchData;
+    size_t nSize;
+
+    CMappedFile(const unsigned char* pchDataIn, size_t nSizeIn) : pchData(pchDataIn), nSize(nSizeIn) {}
+
+public:
+    /** Map the file at path. Returns nullptr if it is empty or cannot be mapped. */
+    static std::shared_ptr<const CMappedFile> Open(const fs::path& path);
+
+    ~CMappedFile();
+    CMappedFile(const CMappedFile&) = delete;
+    CMappedFile& operator=(const CMappedFile&) = delete;
+
+    const unsigned char* data() const { return pchData; }
+    size_t size() const { return nSize; }
+};
+
+/**
+ * Memory mappings of the block files that are no longer appended to, so that
+ * blocks can be deserialized straight from the page cache instead of through
+ * many small freads.
+ *
+ * Only files with a number below the one set by SetFinalizedFiles are mapped;
+ * the file that is written to may still grow or be truncated. The least
+ * recently used mappings are dropped to keep the mapped size below the
+ * limit. A mapping that is dropped while a reader still holds it is unmapped
+ * once that reader releases it.
+ */
+class CBlockFileMapCache
+{
+private:
+    typedef std::list<std::pair<int, std::shared_ptr<const CMappedFile>>> MappingList;
+
+    mutable CCriticalSection cs;
+    size_t nMaxBytes;
+    size_t nMappedBytes;
+    int nFinalizedFiles;
+    //! Most recently used first
+    MappingList listMappings;
+    std::map<int, MappingList::iterator> mapMappings;
+
+    void EraseMapping(std::map<int, MappingList::iterator>::iterator it);
+
+public:
+    explicit CBlockFileMapCache(size_t nMaxBytesIn = 0) : nMaxBytes(nMaxBytesIn), nMappedBytes(0), nFinalizedFiles(0) {}
+
+    /** Limit the total size of the mappings. 0 disables mapping. */
+    void SetMaxBytes(size_t nMaxBytesIn);
+    /** Files below nFiles no longer change. Mappings of later files are dropped. */
+    void SetFinalizedFiles(int nFiles);
+
+    /**
+     * Return the mapping of file nFile, which is found at path, mapping it if
+     * needed. Returns nullptr if the file is not finalized, is larger than
+     * the limit, or cannot be mapped; the caller then reads the file instead.
+     */
+    std::shared_ptr<const CMappedFile> Get(int nFile, const fs::path& path);
+    /** Drop the mapping of a file, e.g. because it is deleted. */
+    void Erase(int nFile);
+    void Clear();
+
+    size_t MappedBytes() const;
+    size_t Count() const;
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
@@ -0,0 +1,91 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfileunlinker.h>
+
+#include <util.h>
+
+CBlockFileUnlinker::CBlockFileUnlinker(UnlinkFileFn unlinkFileIn) : unlinkFile(std::move(unlinkFileIn)), fRunning(false), fStop(false) {}
+
+CBlockFileUnlinker::~CBlockFileUnlinker()
+{
+    Stop();
+}
+
+void CBlockFileUnlinker::ThreadUnlink()
+{
+    RenameThread("bitcoin-blkunlink");
+    std::unique_lock<std::mutex> lock(cs);
+    while (true) {
+        condQueued.wait(lock, [this] { return fStop || !queue.empty(); });
+        if (queue.empty())
+            return;
+
+        // The file stays queued, so that Flush waits for it, until it is deleted
+        const int nFile = queue.front();
+        lock.unlock();
+        unlinkFile(nFile);
+        lock.lock();
+
+        queue.pop_front();
+        condUnlinked.notify_all();
+    }
+}
+
+void CBlockFileUnlinker::Start()
+{
+    std::lock_guard<std::mutex> lock(cs);
+    if (fRunning)
+        return;
+    fRunning = true;
+    fStop = false;
+    thread = std::thread(&CBlockFileUnlinker::ThreadUnlink, this);
+}
+
+void CBlockFileUnlinker::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (!fRunning)
+            return;
+        // Later files are deleted by the caller, while the thread deletes the queued ones
+        fRunning = false;
+        fStop = true;
+    }
+    condQueued.notify_all();
+    thread.join();
+}
+
+bool CBlockFileUnlinker::IsRunning() const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return fRunning;
+}
+
+void CBlockFileUnlinker::Unlink(const std::set<int>& setFiles)
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (fRunning) {
+            queue.insert(queue.end(), setFiles.begin(), setFiles.end());
+            condQueued.notify_one();
+            return;
+        }
+    }
+    for (int nFile : setFiles) {
+        unlinkFile(nFile);
+    }
+}
+
+void CBlockFileUnlinker::Flush()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    condUnlinked.wait(lock, [this] { return queue.empty(); });
+}
+
+size_t CBlockFileUnlinker::QueuedFiles() const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return queue.size();
+}
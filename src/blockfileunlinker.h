@@ -0,0 +1,68 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEUNLINKER_H
+#define BITCOIN_BLOCKFILEUNLINKER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+
+/**
+ * Deletes pruned blk and rev files on a thread of its own, so that pruning
+ * many files at once does not hold up validation.
+ *
+ * Files are queued only after the block index no longer refers to them, so
+ * nothing reads them any more; a file left behind by a shutdown or crash
+ * before it was deleted is only wasted space. Flush waits until the queue
+ * is empty.
+ *
+ * When the thread is not running, files are deleted on the calling thread.
+ */
+class CBlockFileUnlinker
+{
+public:
+    /** Delete the blk and rev files numbered nFile */
+    typedef std::function<void(int nFile)> UnlinkFileFn;
+
+private:
+    const UnlinkFileFn unlinkFile;
+
+    mutable std::mutex cs;
+    //! Signalled when files are queued or the thread is asked to stop
+    std::condition_variable condQueued;
+    //! Signalled when files have been deleted
+    std::condition_variable condUnlinked;
+    //! Files waiting to be deleted, and the one being deleted, in order
+    std::deque<int> queue;
+    bool fRunning;
+    bool fStop;
+    std::thread thread;
+
+    void ThreadUnlink();
+
+public:
+    explicit CBlockFileUnlinker(UnlinkFileFn unlinkFileIn);
+    ~CBlockFileUnlinker();
+    CBlockFileUnlinker(const CBlockFileUnlinker&) = delete;
+    CBlockFileUnlinker& operator=(const CBlockFileUnlinker&) = delete;
+
+    /** Start the unlinker thread */
+    void Start();
+    /** Delete the queued files and stop the thread */
+    void Stop();
+    bool IsRunning() const;
+
+    /** Delete the files in setFiles, in the background if the thread is running */
+    void Unlink(const std::set<int>& setFiles);
+    /** Wait until all queued files are deleted */
+    void Flush();
+
+    size_t QueuedFiles() const;
+};
+
+#endif // BITCOIN_BLOCKFILEUNLINKER_H
@@ -0,0 +1,122 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilewriter.h>
+
+#include <util.h>
+
+CBlockFileWriter::CBlockFileWriter(OpenFileFn openFileIn) : openFile(std::move(openFileIn)), nMaxQueueBytes(0), nQueuedBytes(0), fRunning(false), fStop(false), fFailed(false) {}
+
+CBlockFileWriter::~CBlockFileWriter()
+{
+    Stop();
+}
+
+bool CBlockFileWriter::WriteRecord(const PendingWrite& write) const
+{
+    FILE* file = openFile(write.pos, write.fUndo);
+    if (!file)
+        return error("%s: failed to open the %s file for %s", __func__, write.fUndo ? "undo" : "block", write.pos.ToString());
+    bool fOk = fwrite(write.record->data(), 1, write.record->size(), file) == write.record->size();
+    // Closing flushes the stdio buffer to the OS
+    if (fclose(file) != 0)
+        fOk = false;
+    if (!fOk)
+        return error("%s: failed to write %u bytes of %s data at %s", __func__, write.record->size(), write.fUndo ? "undo" : "block", write.pos.ToString());
+    return true;
+}
+
+void CBlockFileWriter::ThreadWrite()
+{
+    RenameThread("bitcoin-blkwrite");
+    std::unique_lock<std::mutex> lock(cs);
+    while (true) {
+        condQueued.wait(lock, [this] { return fStop || !queue.empty(); });
+        if (queue.empty())
+            return;
+
+        // The record stays queued, and readable, until it is written
+        const PendingWrite& write = queue.front();
+        lock.unlock();
+        bool fOk = WriteRecord(write);
+        lock.lock();
+
+        if (!fOk)
+            fFailed = true;
+        mapPending.erase(Key(write.pos, write.fUndo));
+        nQueuedBytes -= write.record->size();
+        queue.pop_front();
+        condWritten.notify_all();
+    }
+}
+
+void CBlockFileWriter::Start(size_t nMaxQueueBytesIn)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    if (fRunning)
+        return;
+    nMaxQueueBytes = nMaxQueueBytesIn;
+    fRunning = true;
+    fStop = false;
+    thread = std::thread(&CBlockFileWriter::ThreadWrite, this);
+}
+
+void CBlockFileWriter::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (!fRunning)
+            return;
+        // Later records are written by the caller, while the thread writes out the queue
+        fRunning = false;
+        fStop = true;
+    }
+    condQueued.notify_all();
+    thread.join();
+}
+
+bool CBlockFileWriter::IsRunning() const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return fRunning;
+}
+
+bool CBlockFileWriter::Write(const CDiskBlockPos& pos, bool fUndo, Record record)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    if (fFailed)
+        return false;
+    // A record larger than the queue is queued on its own
+    condWritten.wait(lock, [&] { return !fRunning || queue.empty() || nQueuedBytes + record->size() <= nMaxQueueBytes; });
+    if (!fRunning) {
+        lock.unlock();
+        return WriteRecord(PendingWrite{pos, fUndo, std::move(record)});
+    }
+
+    nQueuedBytes += record->size();
+    mapPending[Key(pos, fUndo)] = record;
+    queue.push_back(PendingWrite{pos, fUndo, std::move(record)});
+    condQueued.notify_one();
+    return true;
+}
+
+CBlockFileWriter::Record CBlockFileWriter::GetPending(const CDiskBlockPos& pos, bool fUndo) const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    auto it = mapPending.find(Key(pos, fUndo));
+    return it == mapPending.end() ? nullptr : it->second;
+}
+
+bool CBlockFileWriter::Flush()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    condWritten.wait(lock, [this] { return queue.empty(); });
+    return !fFailed;
+}
+
+size_t CBlockFileWriter::QueuedBytes() const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return nQueuedBytes;
+}
@@ -0,0 +1,94 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEWRITER_H
+#define BITCOIN_BLOCKFILEWRITER_H
+
+#include <chain.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+/**
+ * Writes serialized blocks and undo data to the blk and rev files on a
+ * thread of its own, so that validation does not wait for the writes.
+ *
+ * Records are written in the order they are queued. Until a record is
+ * written it can be read back with GetPending, so that readers never see a
+ * partially written file. Flush waits until the queue is empty; the files
+ * must be flushed before the block index that refers to them is written.
+ *
+ * When the thread is not running, records are written on the calling thread.
+ */
+class CBlockFileWriter
+{
+public:
+    typedef std::shared_ptr<const std::vector<unsigned char>> Record;
+    /** Open the blk (or rev, if fUndo) file of pos for writing at pos */
+    typedef std::function<FILE*(const CDiskBlockPos& pos, bool fUndo)> OpenFileFn;
+
+private:
+    struct PendingWrite {
+        CDiskBlockPos pos;
+        bool fUndo;
+        Record record;
+    };
+    typedef std::tuple<bool, int, unsigned int> PendingKey;
+
+    const OpenFileFn openFile;
+
+    mutable std::mutex cs;
+    //! Signalled when records are queued or the thread is asked to stop
+    std::condition_variable condQueued;
+    //! Signalled when records have been written
+    std::condition_variable condWritten;
+    std::deque<PendingWrite> queue;
+    std::map<PendingKey, Record> mapPending;
+    size_t nMaxQueueBytes;
+    size_t nQueuedBytes;
+    bool fRunning;
+    bool fStop;
+    //! A write failed; the files can no longer be trusted
+    bool fFailed;
+    std::thread thread;
+
+    static PendingKey Key(const CDiskBlockPos& pos, bool fUndo) { return std::make_tuple(fUndo, pos.nFile, pos.nPos); }
+    bool WriteRecord(const PendingWrite& write) const;
+    void ThreadWrite();
+
+public:
+    explicit CBlockFileWriter(OpenFileFn openFileIn);
+    ~CBlockFileWriter();
+    CBlockFileWriter(const CBlockFileWriter&) = delete;
+    CBlockFileWriter& operator=(const CBlockFileWriter&) = delete;
+
+    /** Start the writer thread, queueing up to nMaxQueueBytesIn bytes before Write blocks */
+    void Start(size_t nMaxQueueBytesIn);
+    /** Write out the queue and stop the thread */
+    void Stop();
+    bool IsRunning() const;
+
+    /**
+     * Write record, which begins with the index header, at pos. Waits while
+     * the queue is full. Returns false if the record or an earlier one could
+     * not be written.
+     */
+    bool Write(const CDiskBlockPos& pos, bool fUndo, Record record);
+    /** Return the queued record at pos, or nullptr if it is not queued (any more) */
+    Record GetPending(const CDiskBlockPos& pos, bool fUndo) const;
+    /** Wait until all queued records are written. Returns false if any write failed. */
+    bool Flush();
+
+    size_t QueuedBytes() const;
+};
+
+#endif // BITCOIN_BLOCKFILEWRITER_H
@@ -0,0 +1,258 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilter.h>
+
+#include <coins.h>
+#include <hash.h>
+#include <primitives/transaction.h>
+#include <script/script.h>
+#include <streams.h>
+#include <undo.h>
+#include <version.h>
+
+#include <algorithm>
+#include <limits>
+
+/** Map a uniformly distributed 64-bit value onto [0, n), as floor(x * n / 2^64) */
+static uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return (static_cast<unsigned __int128>(x) * static_cast<unsigned __int128>(n)) >> 64;
+#else
+    // High 64 bits of the 128-bit product, from 32-bit halves
+    uint64_t x_hi = x >> 32, x_lo = x & 0xFFFFFFFF;
+    uint64_t n_hi = n >> 32, n_lo = n & 0xFFFFFFFF;
+    uint64_t ac = x_hi * n_hi;
+    uint64_t ad = x_hi * n_lo;
+    uint64_t bc = x_lo * n_hi;
+    uint64_t bd = x_lo * n_lo;
+    uint64_t mid34 = (bd >> 32) + (bc & 0xFFFFFFFF) + (ad & 0xFFFFFFFF);
+    return ac + (bc >> 32) + (ad >> 32) + (mid34 >> 32);
+#endif
+}
+
+template <typename OStream>
+static void GolombRiceEncode(BitStreamWriter<OStream>& bitwriter, uint8_t P, uint64_t x)
+{
+    // The quotient is written in unary, as q ones followed by a zero
+    uint64_t q = x >> P;
+    while (q > 0) {
+        int nbits = q <= 64 ? static_cast<int>(q) : 64;
+        bitwriter.Write(~0ULL, nbits);
+        q -= nbits;
+    }
+    bitwriter.Write(0, 1);
+
+    // The remainder is written in its low P bits
+    bitwriter.Write(x, P);
+}
+
+template <typename IStream>
+static uint64_t GolombRiceDecode(BitStreamReader<IStream>& bitreader, uint8_t P)
+{
+    uint64_t q = 0;
+    while (bitreader.Read(1) == 1) {
+        ++q;
+    }
+    uint64_t r = bitreader.Read(P);
+    return (q << P) + r;
+}
+
+GCSFilter::GCSFilter(uint64_t k0, uint64_t k1, uint8_t P, uint32_t M) :
+    m_k0(k0), m_k1(k1), m_P(P), m_M(M), m_N(0), m_F(0)
+{
+    CVectorWriter stream(SER_NETWORK, PROTOCOL_VERSION, m_encoded, 0);
+    WriteCompactSize(stream, m_N);
+}
+
+GCSFilter::GCSFilter(uint64_t k0, uint64_t k1, uint8_t P, uint32_t M, std::vector<unsigned char> vEncoded) :
+    m_k0(k0), m_k1(k1), m_P(P), m_M(M), m_encoded(std::move(vEncoded))
+{
+    CSpanReader stream(SER_NETWORK, PROTOCOL_VERSION, m_encoded.data(), m_encoded.size());
+
+    uint64_t N = ReadCompactSize(stream);
+    if (N > std::numeric_limits<uint32_t>::max()) {
+        throw std::ios_base::failure("N must be <2^32");
+    }
+    m_N = static_cast<uint32_t>(N);
+    m_F = static_cast<uint64_t>(m_N) * static_cast<uint64_t>(m_M);
+
+    // Decode all elements to check that the encoding is well-formed
+    BitStreamReader<CSpanReader> bitreader(stream);
+    for (uint64_t i = 0; i < m_N; ++i) {
+        GolombRiceDecode(bitreader, m_P);
+    }
+    if (!stream.empty()) {
+        throw std::ios_base::failure("encoded filter contains excess data");
+    }
+}
+
+GCSFilter::GCSFilter(uint64_t k0, uint64_t k1, uint8_t P, uint32_t M, const ElementSet& elements) :
+    m_k0(k0), m_k1(k1), m_P(P), m_M(M)
+{
+    size_t nElements = elements.size();
+    if (nElements > std::numeric_limits<uint32_t>::max()) {
+        throw std::invalid_argument("N must be <2^32");
+    }
+    m_N = static_cast<uint32_t>(nElements);
+    m_F = static_cast<uint64_t>(m_N) * static_cast<uint64_t>(m_M);
+
+    CVectorWriter stream(SER_NETWORK, PROTOCOL_VERSION, m_encoded, 0);
+    WriteCompactSize(stream, m_N);
+    if (elements.empty()) {
+        return;
+    }
+
+    BitStreamWriter<CVectorWriter> bitwriter(stream);
+    uint64_t last_value = 0;
+    for (uint64_t value : BuildHashedSet(elements)) {
+        GolombRiceEncode(bitwriter, m_P, value - last_value);
+        last_value = value;
+    }
+    bitwriter.Flush();
+}
+
+uint64_t GCSFilter::HashToRange(const Element& element) const
+{
+    uint64_t hash = CSipHasher(m_k0, m_k1).Write(element.data(), element.size()).Finalize();
+    return MapIntoRange(hash, m_F);
+}
+
+std::vector<uint64_t> GCSFilter::BuildHashedSet(const ElementSet& elements) const
+{
+    std::vector<uint64_t> vHashed;
+    vHashed.reserve(elements.size());
+    for (const Element& element : elements) {
+        vHashed.push_back(HashToRange(element));
+    }
+    std::sort(vHashed.begin(), vHashed.end());
+    return vHashed;
+}
+
+bool GCSFilter::MatchInternal(const uint64_t* pElementHashes, size_t nSize) const
+{
+    CSpanReader stream(SER_NETWORK, PROTOCOL_VERSION, m_encoded.data(), m_encoded.size());
+
+    // Seek past the encoded N
+    ReadCompactSize(stream);
+    BitStreamReader<CSpanReader> bitreader(stream);
+
+    uint64_t value = 0;
+    size_t nHashesIndex = 0;
+    for (uint32_t i = 0; i < m_N; ++i) {
+        value += GolombRiceDecode(bitreader, m_P);
+
+        // Both lists are sorted, so walk them side by side
+        while (true) {
+            if (nHashesIndex == nSize) {
+                return false;
+            } else if (pElementHashes[nHashesIndex] == value) {
+                return true;
+            } else if (pElementHashes[nHashesIndex] > value) {
+                break;
+            }
+            nHashesIndex++;
+        }
+    }
+    return false;
+}
+
+bool GCSFilter::Match(const Element& element) const
+{
+    uint64_t query = HashToRange(element);
+    return MatchInternal(&query, 1);
+}
+
+bool GCSFilter::MatchAny(const ElementSet& elements) const
+{
+    const std::vector<uint64_t> vQueries = BuildHashedSet(elements);
+    return MatchInternal(vQueries.data(), vQueries.size());
+}
+
+std::string BlockFilterTypeName(BlockFilterType filter_type)
+{
+    switch (filter_type) {
+    case BlockFilterType::BASIC: return "basic";
+    case BlockFilterType::INVALID: return "";
+    }
+    return "";
+}
+
+GCSFilter::ElementSet BasicFilterElements(const CBlock& block, const CBlockUndo& block_undo)
+{
+    GCSFilter::ElementSet elements;
+
+    for (const CTransactionRef& tx : block.vtx) {
+        for (const CTxOut& txout : tx->vout) {
+            const CScript& script = txout.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            elements.emplace(script.begin(), script.end());
+        }
+    }
+
+    for (const CTxUndo& tx_undo : block_undo.vtxundo) {
+        for (const Coin& prevout : tx_undo.vprevout) {
+            const CScript& script = prevout.out.scriptPubKey;
+            if (script.empty())
+                continue;
+            elements.emplace(script.begin(), script.end());
+        }
+    }
+
+    return elements;
+}
+
+BlockFilter::BlockFilter(BlockFilterType filter_type, const uint256& block_hash, std::vector<unsigned char> vEncoded) :
+    m_filter_type(filter_type), m_block_hash(block_hash)
+{
+    uint64_t k0, k1;
+    uint8_t P;
+    uint32_t M;
+    if (!BuildParams(k0, k1, P, M)) {
+        throw std::invalid_argument("unknown filter_type");
+    }
+    m_filter = GCSFilter(k0, k1, P, M, std::move(vEncoded));
+}
+
+BlockFilter::BlockFilter(BlockFilterType filter_type, const CBlock& block, const CBlockUndo& block_undo) :
+    m_filter_type(filter_type), m_block_hash(block.GetHash())
+{
+    uint64_t k0, k1;
+    uint8_t P;
+    uint32_t M;
+    if (!BuildParams(k0, k1, P, M)) {
+        throw std::invalid_argument("unknown filter_type");
+    }
+    m_filter = GCSFilter(k0, k1, P, M, BasicFilterElements(block, block_undo));
+}
+
+bool BlockFilter::BuildParams(uint64_t& k0, uint64_t& k1, uint8_t& P, uint32_t& M) const
+{
+    switch (m_filter_type) {
+    case BlockFilterType::BASIC:
+        // The SipHash key is the first 16 bytes of the block hash
+        k0 = m_block_hash.GetUint64(0);
+        k1 = m_block_hash.GetUint64(1);
+        P = BASIC_FILTER_P;
+        M = BASIC_FILTER_M;
+        return true;
+    case BlockFilterType::INVALID:
+        return false;
+    }
+    return false;
+}
+
+uint256 BlockFilter::GetHash() const
+{
+    const std::vector<unsigned char>& vEncoded = GetEncodedFilter();
+    return Hash(vEncoded.begin(), vEncoded.end());
+}
+
+uint256 BlockFilter::ComputeHeader(const uint256& prev_header) const
+{
+    const uint256& filter_hash = GetHash();
+    return Hash(filter_hash.begin(), filter_hash.end(), prev_header.begin(), prev_header.end());
+}
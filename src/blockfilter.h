@@ -0,0 +1,137 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include <primitives/block.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class CBlockUndo;
+
+/**
+ * A Golomb-Rice coded set (GCS) as described in BIP 158. Every element is
+ * hashed onto [0, N * M), and the sorted hashes are stored as Golomb-Rice coded
+ * differences with parameter P. An element that is not in the set matches with
+ * probability 1/M.
+ */
+class GCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+    /** An empty filter */
+    explicit GCSFilter(uint64_t k0 = 0, uint64_t k1 = 0, uint8_t P = 0, uint32_t M = 0);
+
+    /** Reconstruct a filter from its encoding. Throws std::ios_base::failure if it is malformed. */
+    GCSFilter(uint64_t k0, uint64_t k1, uint8_t P, uint32_t M, std::vector<unsigned char> vEncoded);
+
+    /** Build a filter of a set of elements */
+    GCSFilter(uint64_t k0, uint64_t k1, uint8_t P, uint32_t M, const ElementSet& elements);
+
+    uint32_t GetN() const { return m_N; }
+    const std::vector<unsigned char>& GetEncoded() const { return m_encoded; }
+
+    /** Whether the element may be in the set. False positives occur with probability 1/M. */
+    bool Match(const Element& element) const;
+
+    /** Whether any of the elements may be in the set, decoding the filter only once */
+    bool MatchAny(const ElementSet& elements) const;
+
+private:
+    uint64_t m_k0;
+    uint64_t m_k1;
+    uint8_t m_P;
+    uint32_t m_M;
+    uint32_t m_N;
+    uint64_t m_F; //!< Range of element hashes, N * M
+    std::vector<unsigned char> m_encoded;
+
+    uint64_t HashToRange(const Element& element) const;
+    std::vector<uint64_t> BuildHashedSet(const ElementSet& elements) const;
+    bool MatchInternal(const uint64_t* pElementHashes, size_t nSize) const;
+};
+
+constexpr uint8_t BASIC_FILTER_P = 19;
+constexpr uint32_t BASIC_FILTER_M = 784931;
+
+enum class BlockFilterType : uint8_t
+{
+    BASIC = 0,
+    INVALID = 255,
+};
+
+/** Name of a filter type, as used by the RPC interface; empty if unknown */
+std::string BlockFilterTypeName(BlockFilterType filter_type);
+
+/** The elements of the basic filter of a block: the output scripts it creates, and those it spends */
+GCSFilter::ElementSet BasicFilterElements(const CBlock& block, const CBlockUndo& block_undo);
+
+/**
+ * The filter of a block, keyed with its hash, that a client can test its
+ * scripts against to learn whether the block is of interest (BIP 157).
+ */
+class BlockFilter
+{
+private:
+    BlockFilterType m_filter_type;
+    uint256 m_block_hash;
+    GCSFilter m_filter;
+
+    bool BuildParams(uint64_t& k0, uint64_t& k1, uint8_t& P, uint32_t& M) const;
+
+public:
+    BlockFilter() : m_filter_type(BlockFilterType::INVALID) {}
+
+    /** Reconstruct a filter from its encoding. Throws std::ios_base::failure if it is malformed. */
+    BlockFilter(BlockFilterType filter_type, const uint256& block_hash, std::vector<unsigned char> vEncoded);
+
+    /** Compute the filter of a block, given the undo data of its spent outputs */
+    BlockFilter(BlockFilterType filter_type, const CBlock& block, const CBlockUndo& block_undo);
+
+    BlockFilterType GetFilterType() const { return m_filter_type; }
+    const uint256& GetBlockHash() const { return m_block_hash; }
+    const GCSFilter& GetFilter() const { return m_filter; }
+    const std::vector<unsigned char>& GetEncodedFilter() const { return m_filter.GetEncoded(); }
+
+    /** Double SHA256 of the encoded filter */
+    uint256 GetHash() const;
+
+    /** The filter header, which commits to this filter and all earlier ones */
+    uint256 ComputeHeader(const uint256& prev_header) const;
+
+    template <typename Stream>
+    void Serialize(Stream& s) const {
+        s << static_cast<uint8_t>(m_filter_type)
+          << m_block_hash
+          << m_filter.GetEncoded();
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s) {
+        std::vector<unsigned char> vEncoded;
+        uint8_t filter_type;
+        s >> filter_type
+          >> m_block_hash
+          >> vEncoded;
+        m_filter_type = static_cast<BlockFilterType>(filter_type);
+
+        uint64_t k0, k1;
+        uint8_t P;
+        uint32_t M;
+        if (!BuildParams(k0, k1, P, M)) {
+            throw std::ios_base::failure("unknown filter_type");
+        }
+        m_filter = GCSFilter(k0, k1, P, M, std::move(vEncoded));
+    }
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
@@ -6,6 +6,7 @@
 
 #include <primitives/transaction.h>
 #include <hash.h>
+#include <memusage.h>
 #include <script/script.h>
 #include <script/standard.h>
 #include <random.h>
@@ -230,23 +231,28 @@ CRollingBloomFilter::CRollingBloomFilter(const unsigned int nElements, const dou
      * =>          nFilterBits = -nHashFuncs * nMaxElements / log(1.0 - exp(logFpRate / nHashFuncs))
      */
     uint32_t nFilterBits = (uint32_t)ceil(-1.0 * nHashFuncs * nMaxElements / log(1.0 - exp(logFpRate / nHashFuncs)));
-    data.clear();
     /* For each data element we need to store 2 bits. If both bits are 0, the
      * bit is treated as unset. If the bits are (01), (10), or (11), the bit is
      * treated as set in generation 1, 2, or 3 respectively.
      * These bits are stored in separate integers: position P corresponds to bit
      * (P & 63) of the integers data[(P >> 6) * 2] and data[(P >> 6) * 2 + 1]. */
-    data.resize(((nFilterBits + 63) / 64) << 1);
+    nDataSize = ((nFilterBits + 63) / 64) << 1;
     reset();
 }
 
-/* Similar to CBloomFilter::Hash */
-static inline uint32_t RollingBloomHash(unsigned int nHashNum, uint32_t nTweak, const std::vector<unsigned char>& vDataToHash) {
-    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash);
+/* Map a 32-bit value evenly onto [0, n) without a division */
+static inline uint32_t FastRange32(uint32_t x, uint32_t n) {
+    return ((uint64_t)x * (uint64_t)n) >> 32;
 }
 
-void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+/* All probes of an element are derived from one keyed 64-bit SipHash of it:
+ * probe n is at h1 + n * h2 (Kirsch and Mitzenmacher, "Less Hashing, Same
+ * Performance"), which keeps the false positive rate of independent hash
+ * functions while hashing the element once instead of nHashFuncs times. */
+void CRollingBloomFilter::insertHash(uint64_t nHash)
 {
+    if (data.empty())
+        data.resize(nDataSize);
     if (nEntriesThisGeneration == nEntriesPerGeneration) {
         nEntriesThisGeneration = 0;
         nGeneration++;
@@ -265,48 +271,77 @@ void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
     }
     nEntriesThisGeneration++;
 
+    const uint32_t nPositions = data.size() * 32;
+    uint32_t h1 = nHash, h2 = nHash >> 32;
     for (int n = 0; n < nHashFuncs; n++) {
-        uint32_t h = RollingBloomHash(n, nTweak, vKey);
-        int bit = h & 0x3F;
-        uint32_t pos = (h >> 6) % data.size();
-        /* The lowest bit of pos is ignored, and set to zero for the first bit, and to one for the second. */
-        data[pos & ~1] = (data[pos & ~1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration & 1)) << bit;
+        uint32_t p = FastRange32(h1 + n * h2, nPositions);
+        int bit = p & 0x3F;
+        /* Position p lives in the pair data[(p >> 6) * 2] and data[(p >> 6) * 2 + 1]. */
+        uint32_t pos = (p >> 6) << 1;
+        data[pos] = (data[pos] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration & 1)) << bit;
         data[pos | 1] = (data[pos | 1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration >> 1)) << bit;
     }
 }
 
-void CRollingBloomFilter::insert(const uint256& hash)
-{
-    std::vector<unsigned char> vData(hash.begin(), hash.end());
-    insert(vData);
-}
-
-bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
+bool CRollingBloomFilter::containsHash(uint64_t nHash) const
 {
+    if (data.empty())
+        return false;
+    const uint32_t nPositions = data.size() * 32;
+    uint32_t h1 = nHash, h2 = nHash >> 32;
     for (int n = 0; n < nHashFuncs; n++) {
-        uint32_t h = RollingBloomHash(n, nTweak, vKey);
-        int bit = h & 0x3F;
-        uint32_t pos = (h >> 6) % data.size();
-        /* If the relevant bit is not set in either data[pos & ~1] or data[pos | 1], the filter does not contain vKey */
-        if (!(((data[pos & ~1] | data[pos | 1]) >> bit) & 1)) {
+        uint32_t p = FastRange32(h1 + n * h2, nPositions);
+        int bit = p & 0x3F;
+        uint32_t pos = (p >> 6) << 1;
+        /* If the relevant bit is not set in either data[pos] or data[pos | 1], the filter does not contain the element */
+        if (!(((data[pos] | data[pos | 1]) >> bit) & 1)) {
             return false;
         }
     }
     return true;
 }
 
+void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+{
+    insertHash(CSipHasher(nTweak0, nTweak1).Write(vKey.data(), vKey.size()).Finalize());
+}
+
+/* SipHashUint256 equals CSipHasher over the 32 bytes, so both forms of a hash match. */
+void CRollingBloomFilter::insert(const uint256& hash)
+{
+    insertHash(SipHashUint256(nTweak0, nTweak1, hash));
+}
+
+bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
+{
+    return containsHash(CSipHasher(nTweak0, nTweak1).Write(vKey.data(), vKey.size()).Finalize());
+}
+
 bool CRollingBloomFilter::contains(const uint256& hash) const
 {
-    std::vector<unsigned char> vData(hash.begin(), hash.end());
-    return contains(vData);
+    return containsHash(SipHashUint256(nTweak0, nTweak1, hash));
+}
+
+std::vector<bool> CRollingBloomFilter::contains(const std::vector<uint256>& vHashes) const
+{
+    std::vector<bool> vContained(vHashes.size());
+    for (size_t i = 0; i < vHashes.size(); i++)
+        vContained[i] = contains(vHashes[i]);
+    return vContained;
 }
 
 void CRollingBloomFilter::reset()
 {
-    nTweak = GetRand(std::numeric_limits<unsigned int>::max());
+    nTweak0 = GetRand(std::numeric_limits<uint64_t>::max());
+    nTweak1 = GetRand(std::numeric_limits<uint64_t>::max());
     nEntriesThisGeneration = 0;
     nGeneration = 1;
     for (std::vector<uint64_t>::iterator it = data.begin(); it != data.end(); it++) {
         *it = 0;
     }
 }
+
+size_t CRollingBloomFilter::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(data);
+}
@@ -105,9 +105,9 @@ public:
 /**
  * RollingBloomFilter is a probabilistic "keep track of most recently inserted" set.
  * Construct it with the number of items to keep track of, and a false-positive
- * rate. Unlike CBloomFilter, by default nTweak is set to a cryptographically
+ * rate. Unlike CBloomFilter, the hash is keyed with a cryptographically
  * secure random value for you. Similarly rather than clear() the method
- * reset() is provided, which also changes nTweak to decrease the impact of
+ * reset() is provided, which also changes the key to decrease the impact of
  * false-positives.
  *
  * contains(item) will always return true if item was one of the last N to 1.5*N
@@ -128,15 +128,25 @@ public:
     void insert(const uint256& hash);
     bool contains(const std::vector<unsigned char>& vKey) const;
     bool contains(const uint256& hash) const;
+    /** contains() of every hash in vHashes, in the same order */
+    std::vector<bool> contains(const std::vector<uint256>& vHashes) const;
 
     void reset();
 
+    size_t DynamicMemoryUsage() const;
+
 private:
+    void insertHash(uint64_t nHash);
+    bool containsHash(uint64_t nHash) const;
+
     int nEntriesPerGeneration;
     int nEntriesThisGeneration;
     int nGeneration;
+    //! Size of data; it is only allocated by the first insert, as many filters stay empty
+    uint32_t nDataSize;
     std::vector<uint64_t> data;
-    unsigned int nTweak;
+    uint64_t nTweak0;
+    uint64_t nTweak1;
     int nHashFuncs;
 };
 
@@ -5,6 +5,48 @@
 
 #include <chain.h>
 
+#include <support/allocators/pool.h>
+
+#include <mutex>
+
+namespace {
+/** The memory of the block index entries */
+struct BlockIndexArena {
+    std::mutex cs;
+    PoolResource<sizeof(CBlockIndex), alignof(CBlockIndex)> resource;
+
+    BlockIndexArena() : resource(1 << 20) { resource.UseLargePages(); }
+};
+
+BlockIndexArena& GetBlockIndexArena()
+{
+    // Never destroyed, as entries may still be deleted during static destruction
+    static BlockIndexArena* arena = new BlockIndexArena();
+    return *arena;
+}
+} // namespace
+
+void* CBlockIndex::operator new(size_t nSize)
+{
+    BlockIndexArena& arena = GetBlockIndexArena();
+    std::lock_guard<std::mutex> lock(arena.cs);
+    return arena.resource.Allocate(nSize, alignof(CBlockIndex));
+}
+
+void CBlockIndex::operator delete(void* p, size_t nSize)
+{
+    BlockIndexArena& arena = GetBlockIndexArena();
+    std::lock_guard<std::mutex> lock(arena.cs);
+    arena.resource.Deallocate(p, nSize, alignof(CBlockIndex));
+}
+
+size_t CBlockIndex::ArenaUsage()
+{
+    BlockIndexArena& arena = GetBlockIndexArena();
+    std::lock_guard<std::mutex> lock(arena.cs);
+    return arena.resource.NumAllocatedChunks() * arena.resource.ChunkSizeBytes();
+}
+
 /**
  * CChain implementation
  */
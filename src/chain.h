@@ -180,6 +180,10 @@ enum BlockStatus: uint32_t {
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
 };
 
+//! Largest nStatus and nFile values a CBlockIndex can hold
+static const uint32_t MAX_BLOCK_STATUS = 0xff;
+static const int MAX_BLOCK_FILE = 0x7fffff;
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -193,6 +197,8 @@ enum BlockStatus: uint32_t {
 class CBlockIndex
 {
 public:
+    // Members are ordered to avoid padding. Keep it so when adding any.
+
     //! pointer to the hash of the block, if any. Memory is owned by this CBlockIndex
     const uint256* phashBlock;//指向block hash
 
@@ -202,11 +208,18 @@ public:
     //! pointer to the index of some further predecessor of this block
     CBlockIndex* pskip;//指向该区块更远的祖先
 
+    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
+    //链上直到这个区块的总工作量，仅存于内存
+    arith_uint256 nChainWork;
+
     //! height of the entry in the chain. The genesis block has height 0
     int nHeight;//该区块的高度，创世区块高度为０
 
-    //! Which # file this block is stored in (blk?????.dat)
-    int nFile;//block存储的文件编号:blk????.dat，rec?????.dat(回滚数据)
+    //! Which # file this block is stored in (blk?????.dat). Shares a word with nStatus.
+    int nFile : 24;//block存储的文件编号:blk????.dat，rec?????.dat(回滚数据)
+
+    //! Verification status of this block. See enum BlockStatus, whose flags must fit in these bits
+    uint32_t nStatus : 8;//该区块的状态
 
     //! Byte offset within blk?????.dat where this block's data is stored
     unsigned int nDataPos;//block在存储文件中的偏移量
@@ -214,10 +227,6 @@ public:
     //! Byte offset within rev?????.dat where this block's undo data is stored
     unsigned int nUndoPos;//block回滚数据的偏移量
 
-    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
-    //链上直到这个区块的总工作量，仅存于内存
-    arith_uint256 nChainWork;
-
     //! Number of transactions in this block.
     //! Note: in a potential headers-first mode, this number cannot be relied upon
     //该区块的交易数量，注意：在潜在的区块头优先的模式中，这个数靠不住
@@ -229,9 +238,6 @@ public:
     //链上直到这个区块的总交易量，仅存于内存，必要的时候可以换成64位数据存储，但在2030年之前应该够用
     unsigned int nChainTx;
 
-    //! Verification status of this block. See enum BlockStatus
-    uint32_t nStatus;//该区块的状态
-
     //! block header
     //区块头数据
     int32_t nVersion;
@@ -287,6 +293,13 @@ public:
         nNonce         = block.nNonce;
     }
 
+    //! Entries are carved out of large chunks of memory shared by all of them,
+    //! rather than allocated one by one (see chain.cpp)
+    static void* operator new(size_t nSize);
+    static void operator delete(void* p, size_t nSize);
+    //! Bytes reserved for all entries
+    static size_t ArenaUsage();
+
     //获取位置
     CDiskBlockPos GetBlockPos() const {
         CDiskBlockPos ret;
@@ -423,10 +436,19 @@ public:
             READWRITE(VARINT(_nVersion));
 
         READWRITE(VARINT(nHeight));
-        READWRITE(VARINT(nStatus));
+        // nStatus and nFile are bit-fields, which cannot be serialized in place
+        uint32_t nStatusDisk = nStatus;
+        int nFileDisk = nFile;
+        READWRITE(VARINT(nStatusDisk));
         READWRITE(VARINT(nTx));
-        if (nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO))
-            READWRITE(VARINT(nFile));
+        if (nStatusDisk & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO))
+            READWRITE(VARINT(nFileDisk));
+        if (ser_action.ForRead()) {
+            if (nStatusDisk > MAX_BLOCK_STATUS || nFileDisk < 0 || nFileDisk > MAX_BLOCK_FILE)
+                throw std::ios_base::failure("CDiskBlockIndex: status or file number out of range");
+            nStatus = nStatusDisk;
+            nFile = nFileDisk;
+        }
         if (nStatus & BLOCK_HAVE_DATA)
             READWRITE(VARINT(nDataPos));
         if (nStatus & BLOCK_HAVE_UNDO)
@@ -525,4 +547,49 @@ public:
     CBlockIndex* FindEarliestAtLeast(int64_t nTime) const;
 };
 
+/**
+ * An immutable view of a chain as of one tip. It offers the lookups of CChain,
+ * but answers them by walking the ancestors of the tip, which only depend on
+ * the fields of CBlockIndex that never change once the entry is in the block
+ * index (pprev, pskip, nHeight and the header). So unlike CChain, a snapshot
+ * can be used without cs_main, as long as the block index is not unloaded.
+ */
+class CChainSnapshot {
+private:
+    const CBlockIndex* pindexTip;
+
+public:
+    explicit CChainSnapshot(const CBlockIndex* pindexTipIn = nullptr) : pindexTip(pindexTipIn) {}
+
+    /** Returns the index entry for the tip of this chain, or nullptr if none. */
+    const CBlockIndex* Tip() const {
+        return pindexTip;
+    }
+
+    /** Returns the index entry at a particular height in this chain, or nullptr if no such height exists. */
+    const CBlockIndex* operator[](int nHeight) const {
+        if (nHeight < 0 || nHeight > Height())
+            return nullptr;
+        return pindexTip->GetAncestor(nHeight);
+    }
+
+    /** Check whether a block is present in this chain. */
+    bool Contains(const CBlockIndex* pindex) const {
+        return (*this)[pindex->nHeight] == pindex;
+    }
+
+    /** Find the successor of a block in this chain, or nullptr if the given index is not found or is the tip. */
+    const CBlockIndex* Next(const CBlockIndex* pindex) const {
+        if (Contains(pindex))
+            return (*this)[pindex->nHeight + 1];
+        else
+            return nullptr;
+    }
+
+    /** Return the maximal height in the chain. Is equal to chain.Tip() ? chain.Tip()->nHeight : -1. */
+    int Height() const {
+        return pindexTip ? pindexTip->nHeight : -1;
+    }
+};
+
 #endif // BITCOIN_CHAIN_H
@@ -25,6 +25,12 @@ struct CCheckpointData {
     MapCheckpoints mapCheckpoints;
 };
 
+/**
+ * UTXO snapshots that loadtxoutset accepts without a user-supplied hash:
+ * base block hash -> hash_serialized_2 of the UTXO set at that block.
+ */
+typedef std::map<uint256, uint256> MapAssumeutxo;
+
 struct ChainTxData {
     int64_t nTime;
     int64_t nTxCount;
@@ -72,6 +78,7 @@ public:
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
     const ChainTxData& TxData() const { return chainTxData; }
+    const MapAssumeutxo& Assumeutxo() const { return mapAssumeutxo; }
     void UpdateVersionBitsParameters(Consensus::DeploymentPos d, int64_t nStartTime, int64_t nTimeout);
 protected:
     CChainParams() {}
@@ -91,6 +98,7 @@ protected:
     bool fMineBlocksOnDemand;
     CCheckpointData checkpointData;
     ChainTxData chainTxData;
+    MapAssumeutxo mapAssumeutxo;
 };
 
 /**
@@ -8,6 +8,10 @@
 #include <sync.h>
 
 #include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -25,6 +29,12 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * In work-stealing mode, every worker owns a deque of checks instead of
+  * sharing a single queue. Batches are handed out to the deques in round-robin
+  * order, workers take from the back of their own deque and steal from the
+  * front of others' when it runs empty, and completion is tracked with atomic
+  * counters so that the shared mutex is only taken to sleep or wake up.
   */
 template <typename T>
 class CCheckQueue
@@ -62,6 +72,98 @@ private:
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! Whether checks are scheduled over per-worker deques with work stealing.
+    bool fWorkStealing;
+
+    //! A worker's own deque of checks, used in work-stealing mode.
+    struct WorkerQueue {
+        boost::mutex mutex;
+        std::deque<T> checks;
+    };
+
+    //! The per-worker deques; slot 0 belongs to the master.
+    std::unique_ptr<WorkerQueue[]> workerQueues;
+
+    //! The number of registered workers (including the master) in work-stealing mode.
+    std::atomic<int> nWorkers;
+
+    //! The worker deque that receives the next batch.
+    unsigned int nNextQueue;
+
+    //! Number of checks sitting in the worker deques, not yet taken by any worker.
+    std::atomic<unsigned int> nQueued;
+
+    //! Number of checks that haven't completed yet, in work-stealing mode.
+    std::atomic<unsigned int> nUnfinished;
+
+    //! The temporary evaluation result, in work-stealing mode.
+    std::atomic<bool> fAllOkStealing;
+
+    /** Take a check for worker nSelf: from the back of its own deque, or stolen from the front of another's. */
+    bool Take(int nSelf, T& check)
+    {
+        const int nCount = nWorkers.load();
+        for (int i = 0; i < nCount; i++) {
+            WorkerQueue& wq = workerQueues[(nSelf + i) % nCount];
+            boost::unique_lock<boost::mutex> lock(wq.mutex);
+            if (wq.checks.empty())
+                continue;
+            if (i == 0) {
+                check.swap(wq.checks.back());
+                wq.checks.pop_back();
+            } else {
+                check.swap(wq.checks.front());
+                wq.checks.pop_front();
+            }
+            nQueued--;
+            return true;
+        }
+        return false;
+    }
+
+    /** Execute a taken check, and account for its completion. */
+    void Execute(T& check)
+    {
+        if (fAllOkStealing.load(std::memory_order_relaxed) && !check())
+            fAllOkStealing = false;
+        {
+            // Destroy the check's resources now rather than when it is next overwritten.
+            T done;
+            done.swap(check);
+        }
+        if (--nUnfinished == 0) {
+            // We processed the last element; inform the master it can exit and return the result
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
+    }
+
+    /** Work-stealing counterpart of Loop. */
+    bool LoopStealing(bool fMaster = false)
+    {
+        const int nSelf = fMaster ? 0 : nWorkers++;
+        assert(nSelf < MAX_STEALING_WORKERS);
+        T check;
+        while (true) {
+            if (Take(nSelf, check)) {
+                Execute(check);
+                continue;
+            }
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                if (nUnfinished == 0) {
+                    // reset the status for new work later
+                    return fAllOkStealing.exchange(true);
+                }
+                if (nQueued == 0)
+                    condMaster.wait(lock);
+            } else {
+                while (nQueued == 0)
+                    condWorker.wait(lock);
+            }
+        }
+    }
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
@@ -124,27 +226,62 @@ private:
     }
 
 public:
+    //! Maximum number of workers (including the master) in work-stealing mode
+    static const int MAX_STEALING_WORKERS = 64;
+
     //! Mutex to ensure only one concurrent CCheckQueueControl
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    explicit CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
+    explicit CCheckQueue(unsigned int nBatchSizeIn, bool fWorkStealingIn = false) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn),
+        fWorkStealing(fWorkStealingIn), workerQueues(new WorkerQueue[MAX_STEALING_WORKERS]), nWorkers(1), nNextQueue(0), nQueued(0), nUnfinished(0), fAllOkStealing(true) {}
+
+    //! Select the scheduler. Must be called before any worker thread is started.
+    void SetWorkStealing(bool fWorkStealingIn)
+    {
+        fWorkStealing = fWorkStealingIn;
+    }
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        if (fWorkStealing) {
+            LoopStealing();
+        } else {
+            Loop();
+        }
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        return fWorkStealing ? LoopStealing(true) : Loop(true);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
+        if (fWorkStealing) {
+            if (vChecks.empty())
+                return;
+            // Account for the checks before they become visible to the workers.
+            nUnfinished += vChecks.size();
+            nQueued += vChecks.size();
+            {
+                WorkerQueue& wq = workerQueues[nNextQueue++ % nWorkers.load()];
+                boost::unique_lock<boost::mutex> lock(wq.mutex);
+                for (T& check : vChecks) {
+                    wq.checks.push_back(T());
+                    check.swap(wq.checks.back());
+                }
+            }
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
+            return;
+        }
         boost::unique_lock<boost::mutex> lock(mutex);
         for (T& check : vChecks) {
             queue.push_back(T());
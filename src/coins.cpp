@@ -5,14 +5,33 @@
 #include <coins.h>
 
 #include <consensus/consensus.h>
+#include <metrics.h>
+#include <primitives/block.h>
 #include <random.h>
+#include <trace.h>
+
+#include <set>
 
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
-bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) { return false; }
 CCoinsViewCursor *CCoinsView::Cursor() const { return nullptr; }
 
+size_t CCoinsView::GetCoins(const std::vector<COutPoint>& outpoints, std::vector<Coin>& coins) const
+{
+    coins.resize(outpoints.size());
+    size_t nFound = 0;
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        if (GetCoin(outpoints[i], coins[i]) && !coins[i].IsSpent()) {
+            nFound++;
+        } else {
+            coins[i].Clear();
+        }
+    }
+    return nFound;
+}
+
 bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
 {
     Coin coin;
@@ -25,24 +44,34 @@ bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 std::vector<uint256> CCoinsViewBacked::GetHeadBlocks() const { return base->GetHeadBlocks(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) { return base->BatchWrite(mapCoins, hashBlock, fErase); }
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cacheCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), CCoinsMap::allocator_type(&cacheCoinsMemoryResource)), cachedCoinsUsage(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
 }
 
+size_t CCoinsViewCache::MapMemoryUsage() const {
+    return memusage::DynamicUsage(cacheCoins);
+}
+
 CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
     CCoinsMap::iterator it = cacheCoins.find(outpoint);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        TRACE3(utxocache, hit, this, outpoint.hash.begin(), outpoint.n);
+        if (pMetricHits) pMetricHits->Add();
         return it;
+    }
     Coin tmp;
-    if (!base->GetCoin(outpoint, tmp))
+    bool fFound = base->GetCoin(outpoint, tmp);
+    if (pMetricMisses) pMetricMisses->Add();
+    TRACE4(utxocache, miss, this, outpoint.hash.begin(), outpoint.n, fFound);
+    if (!fFound)
         return cacheCoins.end();
     CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp))).first;
     if (ret->second.coin.IsSpent()) {
@@ -54,6 +83,102 @@ CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const
     return ret;
 }
 
+size_t CCoinsViewCache::FetchCoins(const std::vector<COutPoint>& outpoints) const {
+    std::vector<COutPoint> vMissing;
+    for (const COutPoint& outpoint : outpoints) {
+        if (!cacheCoins.count(outpoint)) {
+            vMissing.push_back(outpoint);
+        }
+    }
+    if (pMetricHits) pMetricHits->Add(outpoints.size() - vMissing.size());
+    if (pMetricMisses) pMetricMisses->Add(vMissing.size());
+    if (vMissing.empty()) return 0;
+    std::vector<Coin> vCoins;
+    base->GetCoins(vMissing, vCoins);
+    size_t nLoaded = 0;
+    for (size_t i = 0; i < vMissing.size(); i++) {
+        // Mirror FetchCoin: only cache what the backing view has, and only once.
+        if (vCoins[i].IsSpent()) continue;
+        CCoinsMap::iterator it;
+        bool inserted;
+        std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(vMissing[i]), std::forward_as_tuple(std::move(vCoins[i])));
+        if (!inserted) continue;
+        cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+        nLoaded++;
+    }
+    return nLoaded;
+}
+
+void CCoinsViewCache::UseLargePages() {
+    assert(cacheCoins.empty());
+    fLargePages = true;
+    ReallocateCache();
+}
+
+std::vector<COutPoint> CCoinsViewCache::GetCachedOutpoints() const {
+    // Count the coins of each height, then place them youngest first
+    std::vector<size_t> vHeightPos;
+    for (const auto& entry : cacheCoins) {
+        if (entry.second.coin.IsSpent()) continue;
+        const uint32_t nHeight = entry.second.coin.nHeight;
+        if (nHeight >= vHeightPos.size()) vHeightPos.resize(nHeight + 1);
+        vHeightPos[nHeight]++;
+    }
+    size_t nPos = 0;
+    for (auto it = vHeightPos.rbegin(); it != vHeightPos.rend(); ++it) {
+        const size_t nCount = *it;
+        *it = nPos;
+        nPos += nCount;
+    }
+    std::vector<COutPoint> outpoints(nPos);
+    for (const auto& entry : cacheCoins) {
+        if (entry.second.coin.IsSpent()) continue;
+        outpoints[vHeightPos[entry.second.coin.nHeight]++] = entry.first;
+    }
+    return outpoints;
+}
+
+size_t CCoinsViewCache::FetchInputs(const CTransaction& tx) const {
+    if (tx.IsCoinBase()) return 0;
+    std::vector<COutPoint> outpoints;
+    outpoints.reserve(tx.vin.size());
+    for (const CTxIn& txin : tx.vin) {
+        outpoints.push_back(txin.prevout);
+    }
+    return FetchCoins(outpoints);
+}
+
+size_t CCoinsViewCache::FetchInputs(const CBlock& block) const {
+    std::set<uint256> setBlockTxids;
+    std::vector<COutPoint> outpoints;
+    for (const CTransactionRef& tx : block.vtx) {
+        setBlockTxids.insert(tx->GetHash());
+        if (tx->IsCoinBase()) continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (!setBlockTxids.count(txin.prevout.hash)) {
+                outpoints.push_back(txin.prevout);
+            }
+        }
+    }
+    return FetchCoins(outpoints);
+}
+
+size_t CCoinsViewCache::GetCoins(const std::vector<COutPoint>& outpoints, std::vector<Coin>& coins) const {
+    FetchCoins(outpoints);
+    coins.resize(outpoints.size());
+    size_t nFound = 0;
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        CCoinsMap::const_iterator it = cacheCoins.find(outpoints[i]);
+        if (it != cacheCoins.end() && !it->second.coin.IsSpent()) {
+            coins[i] = it->second.coin;
+            nFound++;
+        } else {
+            coins[i].Clear();
+        }
+    }
+    return nFound;
+}
+
 bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it != cacheCoins.end()) {
@@ -69,6 +194,9 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
     CCoinsMap::iterator it;
     bool inserted;
     std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::tuple<>());
+    if (fJournal) {
+        Journal(outpoint, inserted ? cacheCoins.end() : it);
+    }
     bool fresh = false;
     if (!inserted) {
         cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
@@ -98,6 +226,9 @@ void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool
 bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
     CCoinsMap::iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) return false;
+    if (fJournal) {
+        Journal(outpoint, it);
+    }
     cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
     if (moveout) {
         *moveout = std::move(it->second.coin);
@@ -142,8 +273,9 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = mapCoins.erase(it)) {
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn, bool fErase) {
+    assert(!fJournal);
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = fErase ? mapCoins.erase(it) : std::next(it)) {
         // Ignore non-dirty entries (optimization).
         if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
             continue;
@@ -156,7 +288,11 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                 // Otherwise we will need to create it in the parent
                 // and move the data up and mark it as dirty
                 CCoinsCacheEntry& entry = cacheCoins[it->first];
-                entry.coin = std::move(it->second.coin);
+                if (fErase) {
+                    entry.coin = std::move(it->second.coin);
+                } else {
+                    entry.coin = it->second.coin;
+                }
                 cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
                 entry.flags = CCoinsCacheEntry::DIRTY;
                 // We can mark it FRESH in the parent if it was FRESH in the child
@@ -185,7 +321,11 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
             } else {
                 // A normal modification.
                 cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
-                itUs->second.coin = std::move(it->second.coin);
+                if (fErase) {
+                    itUs->second.coin = std::move(it->second.coin);
+                } else {
+                    itUs->second.coin = it->second.coin;
+                }
                 cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
                 itUs->second.flags |= CCoinsCacheEntry::DIRTY;
                 // NOTE: It is possible the child has a FRESH flag here in
@@ -200,13 +340,122 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
     return true;
 }
 
+void CCoinsViewCache::Journal(const COutPoint& outpoint, CCoinsMap::const_iterator it) {
+    if (it == cacheCoins.end()) {
+        vJournal.push_back(JournalEntry{outpoint, false, CCoinsCacheEntry()});
+    } else {
+        vJournal.push_back(JournalEntry{outpoint, true, it->second});
+    }
+}
+
+void CCoinsViewCache::BeginJournal() {
+    assert(!fJournal);
+    fJournal = true;
+    hashBlockJournal = hashBlock;
+}
+
+void CCoinsViewCache::CommitJournal() {
+    assert(fJournal);
+    fJournal = false;
+    // Keep the capacity for the next block
+    vJournal.clear();
+}
+
+void CCoinsViewCache::RollbackJournal() {
+    assert(fJournal);
+    // Entries loaded from the base while the journal was open are not in it:
+    // they are unmodified, so they can stay.
+    for (auto it = vJournal.rbegin(); it != vJournal.rend(); ++it) {
+        CCoinsMap::iterator itUs = cacheCoins.find(it->outpoint);
+        if (itUs != cacheCoins.end()) {
+            cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
+            if (!it->fExisted) {
+                cacheCoins.erase(itUs);
+                continue;
+            }
+            itUs->second = std::move(it->entry);
+        } else if (it->fExisted) {
+            itUs = cacheCoins.emplace(it->outpoint, std::move(it->entry)).first;
+        } else {
+            continue;
+        }
+        cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
+    }
+    hashBlock = hashBlockJournal;
+    fJournal = false;
+    vJournal.clear();
+}
+
 bool CCoinsViewCache::Flush() {
+    assert(!fJournal);
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    ReallocateCache();
     return fOk;
 }
 
+bool CCoinsViewCache::Sync() {
+    assert(!fJournal);
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, false);
+    // The base now has all our modifications: drop the spent entries and
+    // keep the others as unmodified.
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (it->second.coin.IsSpent()) {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+        } else {
+            it->second.flags = 0;
+            ++it;
+        }
+    }
+    return fOk;
+}
+
+size_t CCoinsViewCache::Trim(size_t nTargetUsage) {
+    assert(!fJournal);
+    if (DynamicMemoryUsage() <= nTargetUsage) {
+        return 0;
+    }
+    // Find the lowest height up to which evicting every unmodified entry
+    // makes enough room. The node size used is a lower bound, so this may
+    // pick a higher height than needed; eviction below stops early then.
+    std::vector<size_t> vHeightUsage;
+    for (const auto& entry : cacheCoins) {
+        if (entry.second.flags != 0) continue;
+        const uint32_t nHeight = entry.second.coin.nHeight;
+        if (nHeight >= vHeightUsage.size()) vHeightUsage.resize(nHeight + 1);
+        vHeightUsage[nHeight] += sizeof(CCoinsMap::value_type) + entry.second.coin.DynamicMemoryUsage();
+    }
+    const size_t nExcess = DynamicMemoryUsage() - nTargetUsage;
+    size_t nFreed = 0;
+    uint32_t nMaxHeight = 0;
+    while (nMaxHeight + 1 < vHeightUsage.size() && nFreed + vHeightUsage[nMaxHeight] < nExcess) {
+        nFreed += vHeightUsage[nMaxHeight++];
+    }
+    size_t nEvicted = 0;
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end() && DynamicMemoryUsage() > nTargetUsage;) {
+        if (it->second.flags == 0 && it->second.coin.nHeight <= nMaxHeight) {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+            nEvicted++;
+        } else {
+            ++it;
+        }
+    }
+    return nEvicted;
+}
+
+void CCoinsViewCache::ReallocateCache()
+{
+    assert(cacheCoins.empty());
+    cacheCoins.~CCoinsMap();
+    cacheCoinsMemoryResource.~CCoinsMapMemoryResource();
+    ::new (&cacheCoinsMemoryResource) CCoinsMapMemoryResource();
+    if (fLargePages) cacheCoinsMemoryResource.UseLargePages();
+    ::new (&cacheCoins) CCoinsMap(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), CCoinsMap::allocator_type(&cacheCoinsMemoryResource));
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -12,13 +12,18 @@
 #include <hash.h>
 #include <memusage.h>
 #include <serialize.h>
+#include <support/allocators/pool.h>
 #include <uint256.h>
 
 #include <assert.h>
 #include <stdint.h>
 
+#include <functional>
 #include <unordered_map>
 
+class CBlock;
+class CMetricCounter;
+
 /**
  * A UTXO entry.
  *
@@ -119,7 +124,15 @@ struct CCoinsCacheEntry
     explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * The nodes of a CCoinsMap are drawn from a PoolResource when it is given one
+ * (as CCoinsViewCache does), saving the per-node malloc overhead. The block
+ * size leaves room for the node's next pointer and cached hash.
+ */
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>,
+                           PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>,
+                                         sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) + sizeof(void*) * 4>> CCoinsMap;
+typedef CCoinsMap::allocator_type::ResourceType CCoinsMapMemoryResource;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -157,6 +170,11 @@ public:
     //检测utxo是否未花费
     virtual bool HaveCoin(const COutPoint &outpoint) const;
 
+    //! Retrieve the Coins for many outpoints at once, as GetCoin would. coins is
+    //! resized to outpoints.size(), with a spent Coin for each one not found.
+    //! Returns the number of unspent coins found.
+    virtual size_t GetCoins(const std::vector<COutPoint>& outpoints, std::vector<Coin>& coins) const;
+
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 GetBestBlock() const;
 
@@ -167,8 +185,9 @@ public:
     virtual std::vector<uint256> GetHeadBlocks() const;
 
     //! Do a bulk modification (multiple Coin changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! The passed mapCoins can be modified, and is emptied if fErase is set;
+    //! otherwise its entries are left in place (and only read).
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase = true);
 
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
@@ -194,7 +213,7 @@ public:
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase = true) override;
     CCoinsViewCursor *Cursor() const override;
     size_t EstimateSize() const override;
 };
@@ -209,14 +228,43 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    mutable CCoinsMapMemoryResource cacheCoinsMemoryResource;
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    //! Whether cacheCoinsMemoryResource takes its chunks from large pages
+    bool fLargePages = false;
+
+    //! Counters of lookups found in this cache, and passed on to the view below, if set
+    CMetricCounter* pMetricHits = nullptr;
+    CMetricCounter* pMetricMisses = nullptr;
+
+    //! The state an entry had before AddCoin or SpendCoin changed it while the journal was open
+    struct JournalEntry {
+        COutPoint outpoint;
+        //! Whether the entry was in the cache at all
+        bool fExisted;
+        CCoinsCacheEntry entry;
+    };
+    bool fJournal = false;
+    uint256 hashBlockJournal;
+    std::vector<JournalEntry> vJournal;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
+    /** Allocate the coins of this (still empty) cache from large pages, if enabled (see support/largepages.h) */
+    void UseLargePages();
+
+    /** Count the lookups of coins in this cache in the given metrics (see metrics.h) */
+    void SetMetrics(CMetricCounter* hits, CMetricCounter* misses)
+    {
+        pMetricHits = hits;
+        pMetricMisses = misses;
+    }
+
     /**
      * By deleting the copy constructor, we prevent accidentally using it when one intends to create a cache on top of a base cache.
      */
@@ -225,9 +273,10 @@ public:
     // Standard CCoinsView methods
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
+    size_t GetCoins(const std::vector<COutPoint>& outpoints, std::vector<Coin>& coins) const override;
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase = true) override;
     CCoinsViewCursor* Cursor() const override {
         throw std::logic_error("CCoinsViewCache cursor iteration not supported.");
     }
@@ -239,6 +288,25 @@ public:
      */
     bool HaveCoinInCache(const COutPoint &outpoint) const;
 
+    /**
+     * Load the given outpoints which are not in this cache yet with a single
+     * GetCoins call to the backing view. Returns the number of coins loaded.
+     */
+    size_t FetchCoins(const std::vector<COutPoint>& outpoints) const;
+
+    /**
+     * Get the outpoints of the unspent coins in this cache, those of the
+     * youngest coins first: the ones Trim() evicts last.
+     */
+    std::vector<COutPoint> GetCachedOutpoints() const;
+
+    //! Load all the inputs of tx which are not cached yet, see FetchCoins().
+    size_t FetchInputs(const CTransaction& tx) const;
+
+    //! Load all the inputs of block which are not cached yet and not created
+    //! within the block itself, see FetchCoins().
+    size_t FetchInputs(const CBlock& block) const;
+
     /**
      * Return a reference to Coin in the cache, or a pruned one if not found. This is
      * more efficient than GetCoin.
@@ -264,6 +332,28 @@ public:
      */
     bool SpendCoin(const COutPoint &outpoint, Coin* moveto = nullptr);
 
+    /**
+     * Start recording the changes AddCoin, SpendCoin and SetBestBlock make to
+     * this cache, so that RollbackJournal() can undo them. This lets a block be
+     * connected to the cache itself rather than to a CCoinsViewCache on top of
+     * it, which would copy every coin it touches into a map of its own and
+     * insert them again into this one on Flush().
+     * The cache must not be flushed, synced, trimmed or written to with
+     * BatchWrite while the journal is open.
+     */
+    void BeginJournal();
+
+    //! Keep the changes made since BeginJournal() and close the journal
+    void CommitJournal();
+
+    /**
+     * Undo the changes made since BeginJournal() and close the journal.
+     * Coins loaded from the base in the meantime stay cached, unmodified.
+     */
+    void RollbackJournal();
+
+    bool HasJournal() const { return fJournal; }
+
     /**
      * Push the modifications applied to this cache to its base.
      * Failure to call this method before destruction will cause the changes to be forgotten.
@@ -271,6 +361,20 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base like Flush(),
+     * but keep the unspent entries cached (as unmodified ones).
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool Sync();
+
+    /**
+     * Evict unmodified entries, those of the oldest coins first, until the
+     * memory usage of the cache is at most nTargetUsage (or only modified
+     * entries remain). Returns the number of entries evicted.
+     */
+    size_t Trim(size_t nTargetUsage);
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
@@ -282,6 +386,8 @@ public:
 
     //! Calculate the size of the cache (in bytes)
     size_t DynamicMemoryUsage() const;
+    //! Bytes of DynamicMemoryUsage taken by the map itself, as allocated from its pool
+    size_t MapMemoryUsage() const;
 
     /** 
      * Amount of bitcoins coming in to a transaction
@@ -298,6 +404,36 @@ public:
 
 private:
     CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
+
+    //! Record the state of the entry of outpoint (it, or none) in the journal, if it is open
+    void Journal(const COutPoint& outpoint, CCoinsMap::const_iterator it);
+
+    //! Give the (empty) cache a new memory resource, returning the old one's chunks to the system.
+    void ReallocateCache();
+};
+
+/**
+ * Keeps the journal of a CCoinsViewCache open for its lifetime and rolls the
+ * changes back on destruction unless Commit() was called.
+ */
+class CCoinsViewCacheJournal
+{
+private:
+    CCoinsViewCache& cache;
+    bool fCommitted;
+
+public:
+    explicit CCoinsViewCacheJournal(CCoinsViewCache& cacheIn) : cache(cacheIn), fCommitted(false) { cache.BeginJournal(); }
+    ~CCoinsViewCacheJournal() { if (!fCommitted) cache.RollbackJournal(); }
+    CCoinsViewCacheJournal(const CCoinsViewCacheJournal&) = delete;
+    CCoinsViewCacheJournal& operator=(const CCoinsViewCacheJournal&) = delete;
+
+    void Commit()
+    {
+        assert(!fCommitted);
+        cache.CommitJournal();
+        fCommitted = true;
+    }
 };
 
 //! Utility function to add all of a transaction's outputs to a cache.
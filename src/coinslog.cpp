@@ -0,0 +1,610 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinslog.h>
+
+#include <clientversion.h>
+#include <coinstats.h>
+#include <compressor.h>
+#include <crypto/common.h>
+#include <hash.h>
+#include <random.h>
+#include <util.h>
+#include <utiltime.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+/**
+ * The log starts with a header of COINS_LOG_MAGIC, COINS_LOG_VERSION and the
+ * eight byte obfuscation key. Every record after it is
+ *
+ *   uint32 payload size | payload | uint32 SipHash of the payload
+ *
+ * XORed with the key, aligned to the start of the file. The payload starts
+ * with its type.
+ */
+static const unsigned char COINS_LOG_MAGIC[4] = {'c', 'l', 'o', 'g'};
+static const uint32_t COINS_LOG_VERSION = 1;
+static const uint64_t COINS_LOG_HEADER_SIZE = 16;
+//! Bytes a record takes besides its payload
+static const uint64_t COINS_LOG_RECORD_OVERHEAD = 8;
+//! Limits of CoinsLogLocation
+static const uint64_t COINS_LOG_MAX_SIZE = uint64_t{1} << 40;
+static const uint64_t COINS_LOG_MAX_RECORD_SIZE = (1 << 24) - 1;
+
+static const unsigned char LOG_COIN = 'C';            //!< outpoint, coin
+static const unsigned char LOG_ERASE = 'E';           //!< outpoint
+static const unsigned char LOG_COIN_STATS = 'S';      //!< CIncrementalCoinsStats
+static const unsigned char LOG_ERASE_COIN_STATS = 's';
+static const unsigned char LOG_COMMIT = 'B';          //!< best block
+
+//! Serialization version of the payloads, whose coins are of COINS_FORMAT_WITNESS_TEMPLATES
+static const int COINS_LOG_SER_VERSION = CLIENT_VERSION | SERIALIZE_SCRIPT_WITNESS_TEMPLATES;
+
+static bool SeekTo(FILE* file, uint64_t nPos)
+{
+#ifdef WIN32
+    return _fseeki64(file, nPos, SEEK_SET) == 0;
+#else
+    return fseeko(file, nPos, SEEK_SET) == 0;
+#endif
+}
+
+static uint64_t GetFileSize(FILE* file)
+{
+#ifdef WIN32
+    if (_fseeki64(file, 0, SEEK_END) != 0) return 0;
+    return _ftelli64(file);
+#else
+    if (fseeko(file, 0, SEEK_END) != 0) return 0;
+    return ftello(file);
+#endif
+}
+
+//! XOR size bytes, which are at nPos in the log, with the key
+static void Obfuscate(unsigned char* data, size_t size, uint64_t nPos, const CoinsLogKey& key)
+{
+    std::vector<unsigned char> rotated(key.obfuscate.size());
+    for (size_t i = 0; i < rotated.size(); i++) {
+        rotated[i] = key.obfuscate[(nPos + i) % rotated.size()];
+    }
+    XorWithKey(data, size, rotated);
+}
+
+static uint32_t Checksum(const unsigned char* data, size_t size, const CoinsLogKey& key)
+{
+    return CSipHasher(key.checksum, 0).Write(data, size).Finalize();
+}
+
+//! Append the record of payload, which is to be written at nPos, to buffer
+static void EncodeRecord(std::vector<unsigned char>& buffer, uint64_t nPos, const unsigned char* payload, size_t nPayload, const CoinsLogKey& key)
+{
+    const size_t nOffset = buffer.size();
+    buffer.resize(nOffset + nPayload + COINS_LOG_RECORD_OVERHEAD);
+    unsigned char* record = buffer.data() + nOffset;
+    WriteLE32(record, nPayload);
+    memcpy(record + 4, payload, nPayload);
+    WriteLE32(record + 4 + nPayload, Checksum(payload, nPayload, key));
+    Obfuscate(record, nPayload + COINS_LOG_RECORD_OVERHEAD, nPos, key);
+}
+
+//! Read the record at the position of file, which is nPos, or return false if it is truncated or corrupt
+static bool ReadNextRecord(FILE* file, uint64_t nPos, const CoinsLogKey& key, std::vector<unsigned char>& payload)
+{
+    unsigned char header[4];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header)) {
+        return false;
+    }
+    Obfuscate(header, sizeof(header), nPos, key);
+    const uint32_t nPayload = ReadLE32(header);
+    if (nPayload == 0 || nPayload + COINS_LOG_RECORD_OVERHEAD > COINS_LOG_MAX_RECORD_SIZE) {
+        return false;
+    }
+    payload.resize(nPayload + 4);
+    if (fread(payload.data(), 1, payload.size(), file) != payload.size()) {
+        return false;
+    }
+    Obfuscate(payload.data(), payload.size(), nPos + 4, key);
+    const uint32_t nChecksum = ReadLE32(payload.data() + nPayload);
+    payload.resize(nPayload);
+    return nChecksum == Checksum(payload.data(), nPayload, key);
+}
+
+//! Read the record at location, throwing if it cannot be read
+static void ReadRecordAt(FILE* file, const CoinsLogLocation& location, const CoinsLogKey& key, std::vector<unsigned char>& payload)
+{
+    if (!SeekTo(file, location.nPos) || !ReadNextRecord(file, location.nPos, key, payload) || payload.size() + COINS_LOG_RECORD_OVERHEAD != location.nSize) {
+        throw std::runtime_error(strprintf("Unable to read the record at %u of the coins log", (uint64_t)location.nPos));
+    }
+}
+
+static void ReadCoinAt(FILE* file, const CoinsLogLocation& location, const CoinsLogKey& key, Coin& coin)
+{
+    std::vector<unsigned char> payload;
+    ReadRecordAt(file, location, key, payload);
+    CSpanReader reader(SER_DISK, COINS_LOG_SER_VERSION, payload.data(), payload.size());
+    unsigned char type;
+    COutPoint outpoint;
+    reader >> type >> outpoint.hash >> VARINT(outpoint.n);
+    if (type != LOG_COIN) {
+        throw std::runtime_error(strprintf("Unexpected record at %u of the coins log", (uint64_t)location.nPos));
+    }
+    reader >> coin;
+}
+
+static bool WriteHeader(FILE* file, const CoinsLogKey& key)
+{
+    unsigned char header[COINS_LOG_HEADER_SIZE];
+    memcpy(header, COINS_LOG_MAGIC, 4);
+    WriteLE32(header + 4, COINS_LOG_VERSION);
+    memcpy(header + 8, key.obfuscate.data(), 8);
+    return SeekTo(file, 0) && fwrite(header, 1, sizeof(header), file) == sizeof(header) && fflush(file) == 0;
+}
+
+CCoinsViewLog::CCoinsViewLog(const fs::path& path) : m_path(path / COINS_LOG_FILENAME), m_size(COINS_LOG_HEADER_SIZE), m_live_bytes(0)
+{
+    TryCreateDirectories(path);
+    m_key.obfuscate.resize(8);
+    m_file = fsbridge::fopen(m_path, "rb+");
+    if (!m_file) {
+        // A new chainstate
+        m_file = fsbridge::fopen(m_path, "wb+");
+        if (!m_file) {
+            throw std::runtime_error(strprintf("Unable to create %s", m_path.string()));
+        }
+        GetRandBytes(m_key.obfuscate.data(), m_key.obfuscate.size());
+        m_key.checksum = ReadLE64(m_key.obfuscate.data());
+        if (!WriteHeader(m_file, m_key)) {
+            fclose(m_file);
+            throw std::runtime_error(strprintf("Unable to write to %s", m_path.string()));
+        }
+        LogPrintf("Created coins log %s\n", m_path.string());
+        return;
+    }
+
+    unsigned char header[COINS_LOG_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), m_file) != sizeof(header) || memcmp(header, COINS_LOG_MAGIC, 4) != 0 || ReadLE32(header + 4) != COINS_LOG_VERSION) {
+        fclose(m_file);
+        throw std::runtime_error(strprintf("%s is not a coins log of version %u", m_path.string(), COINS_LOG_VERSION));
+    }
+    memcpy(m_key.obfuscate.data(), header + 8, 8);
+    m_key.checksum = ReadLE64(m_key.obfuscate.data());
+    const int64_t nStart = GetTimeMillis();
+    try {
+        Load();
+    } catch (...) {
+        fclose(m_file);
+        throw;
+    }
+    LogPrintf("Loaded coins log %s: %u coins in %.2f MiB, %.2f MiB of overwritten records, %dms\n", m_path.string(), m_index.size(),
+        m_live_bytes * (1.0 / 1048576.0), GetDeadBytes() * (1.0 / 1048576.0), GetTimeMillis() - nStart);
+}
+
+CCoinsViewLog::~CCoinsViewLog()
+{
+    LOCK(cs_log);
+    FlushWriteBuffer();
+    fclose(m_file);
+}
+
+void CCoinsViewLog::Load()
+{
+    // Changes of a batch are only applied once its commit record is read
+    std::vector<std::pair<COutPoint, CoinsLogLocation>> vPending;
+    CoinsLogLocation statsPending;
+    uint64_t nPos = COINS_LOG_HEADER_SIZE;
+    uint64_t nCommitted = nPos;
+    std::vector<unsigned char> payload;
+    if (!SeekTo(m_file, nPos)) {
+        throw std::runtime_error(strprintf("Unable to read %s", m_path.string()));
+    }
+    while (ReadNextRecord(m_file, nPos, m_key, payload)) {
+        const CoinsLogLocation location(nPos, payload.size() + COINS_LOG_RECORD_OVERHEAD);
+        try {
+            CSpanReader reader(SER_DISK, COINS_LOG_SER_VERSION, payload.data(), payload.size());
+            unsigned char type;
+            reader >> type;
+            if (type == LOG_COIN || type == LOG_ERASE) {
+                COutPoint outpoint;
+                reader >> outpoint.hash >> VARINT(outpoint.n);
+                vPending.emplace_back(outpoint, type == LOG_COIN ? location : CoinsLogLocation());
+            } else if (type == LOG_COIN_STATS) {
+                statsPending = location;
+            } else if (type == LOG_ERASE_COIN_STATS) {
+                statsPending = CoinsLogLocation();
+            } else if (type == LOG_COMMIT) {
+                reader >> m_best_block;
+                for (const auto& change : vPending) {
+                    SetLocation(change.first, change.second);
+                }
+                vPending.clear();
+                m_stats = statsPending;
+                nCommitted = nPos + location.nSize;
+            } else {
+                break;
+            }
+        } catch (const std::ios_base::failure&) {
+            break;
+        }
+        nPos += location.nSize;
+    }
+
+    const uint64_t nFileSize = GetFileSize(m_file);
+    if (nFileSize > nCommitted) {
+        LogPrintf("Discarding the last %u bytes of %s, which are not part of a complete batch\n", nFileSize - nCommitted, m_path.string());
+        if (!TruncateFile(m_file, nCommitted)) {
+            throw std::runtime_error(strprintf("Unable to truncate %s", m_path.string()));
+        }
+    }
+    m_size = nCommitted;
+}
+
+void CCoinsViewLog::SetLocation(const COutPoint& outpoint, const CoinsLogLocation& location)
+{
+    auto it = m_index.find(outpoint);
+    if (it != m_index.end()) {
+        m_live_bytes -= it->second.nSize;
+        if (location.nSize == 0) {
+            m_index.erase(it);
+            return;
+        }
+        it->second = location;
+    } else if (location.nSize != 0) {
+        m_index.emplace(outpoint, location);
+    }
+    m_live_bytes += location.nSize;
+}
+
+CoinsLogLocation CCoinsViewLog::Append(const CDataStream& payload)
+{
+    const uint64_t nPos = m_size + m_write_buffer.size();
+    const uint64_t nSize = payload.size() + COINS_LOG_RECORD_OVERHEAD;
+    if (nSize > COINS_LOG_MAX_RECORD_SIZE) {
+        throw std::runtime_error(strprintf("Record of %u bytes too large for the coins log", nSize));
+    }
+    EncodeRecord(m_write_buffer, nPos, (const unsigned char*)payload.data(), payload.size(), m_key);
+    return CoinsLogLocation(nPos, nSize);
+}
+
+bool CCoinsViewLog::FlushWriteBuffer()
+{
+    if (m_write_buffer.empty()) {
+        return true;
+    }
+    if (m_size + m_write_buffer.size() > COINS_LOG_MAX_SIZE) {
+        return error("%s: %s would grow beyond %u bytes", __func__, m_path.string(), COINS_LOG_MAX_SIZE);
+    }
+    if (!SeekTo(m_file, m_size) || fwrite(m_write_buffer.data(), 1, m_write_buffer.size(), m_file) != m_write_buffer.size() || fflush(m_file) != 0) {
+        return error("%s: failed to write to %s", __func__, m_path.string());
+    }
+    m_size += m_write_buffer.size();
+    m_write_buffer.clear();
+    return true;
+}
+
+bool CCoinsViewLog::GetCoin(const COutPoint& outpoint, Coin& coin) const
+{
+    LOCK(cs_log);
+    auto it = m_index.find(outpoint);
+    if (it == m_index.end()) {
+        return false;
+    }
+    ReadCoinAt(m_file, it->second, m_key, coin);
+    return true;
+}
+
+bool CCoinsViewLog::HaveCoin(const COutPoint& outpoint) const
+{
+    LOCK(cs_log);
+    return m_index.count(outpoint);
+}
+
+size_t CCoinsViewLog::GetCoins(const std::vector<COutPoint>& outpoints, std::vector<Coin>& coins) const
+{
+    coins.assign(outpoints.size(), Coin());
+    std::vector<std::pair<CoinsLogLocation, size_t>> vReads;
+    LOCK(cs_log);
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        auto it = m_index.find(outpoints[i]);
+        if (it != m_index.end()) {
+            vReads.emplace_back(it->second, i);
+        }
+    }
+    std::sort(vReads.begin(), vReads.end(), [](const std::pair<CoinsLogLocation, size_t>& a, const std::pair<CoinsLogLocation, size_t>& b) {
+        return a.first.nPos < b.first.nPos;
+    });
+    for (const auto& read : vReads) {
+        ReadCoinAt(m_file, read.first, m_key, coins[read.second]);
+    }
+    return vReads.size();
+}
+
+uint256 CCoinsViewLog::GetBestBlock() const
+{
+    LOCK(cs_log);
+    return m_best_block;
+}
+
+std::vector<uint256> CCoinsViewLog::GetHeadBlocks() const
+{
+    return std::vector<uint256>();
+}
+
+bool CCoinsViewLog::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase)
+{
+    assert(!hashBlock.IsNull());
+    LOCK(cs_log);
+    m_sorted_index.reset();
+    size_t count = 0;
+    size_t changed = 0;
+    CDataStream payload(SER_DISK, COINS_LOG_SER_VERSION);
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            const COutPoint& outpoint = it->first;
+            payload.clear();
+            if (!it->second.coin.IsSpent()) {
+                payload << LOG_COIN << outpoint.hash << VARINT(outpoint.n) << it->second.coin;
+                SetLocation(outpoint, Append(payload));
+            } else if (m_index.count(outpoint)) {
+                payload << LOG_ERASE << outpoint.hash << VARINT(outpoint.n);
+                Append(payload);
+                SetLocation(outpoint, CoinsLogLocation());
+            }
+            changed++;
+        }
+        count++;
+        if (fErase) {
+            it = mapCoins.erase(it);
+        } else {
+            ++it;
+        }
+        if (m_write_buffer.size() > COINS_LOG_WRITE_BUFFER_SIZE && !FlushWriteBuffer()) {
+            return false;
+        }
+    }
+
+    CoinsLogLocation stats;
+    payload.clear();
+    if (m_coins_stats && m_coins_stats->hashBlock == hashBlock) {
+        payload << LOG_COIN_STATS << *m_coins_stats;
+        stats = Append(payload);
+    } else if (m_stats.nSize != 0) {
+        payload << LOG_ERASE_COIN_STATS;
+        Append(payload);
+    }
+    payload.clear();
+    payload << LOG_COMMIT << hashBlock;
+    Append(payload);
+    if (!FlushWriteBuffer()) {
+        return false;
+    }
+    m_stats = stats;
+    m_best_block = hashBlock;
+    LogPrint(BCLog::COINDB, "Committed %u changed transaction outputs (out of %u) to coins log...\n", (unsigned int)changed, (unsigned int)count);
+
+    const uint64_t nDead = GetDeadBytes();
+    if (nDead > std::max(m_live_bytes, COINS_LOG_MIN_COMPACT_SIZE)) {
+        Compact();
+    }
+    return true;
+}
+
+CCoinsViewCursor* CCoinsViewLog::Cursor(const COutPoint& start) const
+{
+    LOCK(cs_log);
+    if (!m_sorted_index) {
+        std::shared_ptr<CoinsLogSortedIndex> sorted = std::make_shared<CoinsLogSortedIndex>(m_index.begin(), m_index.end());
+        std::sort(sorted->begin(), sorted->end(), [](const std::pair<COutPoint, CoinsLogLocation>& a, const std::pair<COutPoint, CoinsLogLocation>& b) {
+            return a.first < b.first;
+        });
+        m_sorted_index = std::move(sorted);
+    }
+    // Its own handle, so that it can be read without cs_log
+    FILE* file = fsbridge::fopen(m_path, "rb");
+    if (!file) {
+        throw std::runtime_error(strprintf("Unable to open %s", m_path.string()));
+    }
+    auto it = std::lower_bound(m_sorted_index->begin(), m_sorted_index->end(), start, [](const std::pair<COutPoint, CoinsLogLocation>& a, const COutPoint& b) {
+        return a.first < b;
+    });
+    return new CCoinsViewLogCursor(m_best_block, file, m_key, m_sorted_index, it - m_sorted_index->begin());
+}
+
+size_t CCoinsViewLog::EstimateSize() const
+{
+    LOCK(cs_log);
+    return m_size;
+}
+
+bool CCoinsViewLog::ReadCoinsStats(CIncrementalCoinsStats& stats) const
+{
+    LOCK(cs_log);
+    if (m_stats.nSize == 0) {
+        return false;
+    }
+    try {
+        std::vector<unsigned char> payload;
+        ReadRecordAt(m_file, m_stats, m_key, payload);
+        CSpanReader reader(SER_DISK, COINS_LOG_SER_VERSION, payload.data(), payload.size());
+        unsigned char type;
+        reader >> type >> stats;
+        return type == LOG_COIN_STATS;
+    } catch (const std::exception& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+}
+
+bool CCoinsViewLog::Sync()
+{
+    LOCK(cs_log);
+    if (!FlushWriteBuffer()) {
+        return false;
+    }
+    FileCommit(m_file);
+    return true;
+}
+
+void CCoinsViewLog::CompactRange(const COutPoint& begin, const COutPoint& end)
+{
+    if (!begin.hash.IsNull() || begin.n != 0) {
+        return;
+    }
+    LOCK(cs_log);
+    if (GetDeadBytes() > m_live_bytes / 16) {
+        Compact();
+    }
+}
+
+uint64_t CCoinsViewLog::GetDeadBytes() const
+{
+    LOCK(cs_log);
+    return m_size - COINS_LOG_HEADER_SIZE - m_live_bytes;
+}
+
+bool CCoinsViewLog::WriteCompacted(FILE* file, std::vector<std::pair<COutPoint, CoinsLogLocation>>& vMoved, CoinsLogLocation& stats, uint64_t& nSize)
+{
+    if (!WriteHeader(file, m_key)) {
+        return false;
+    }
+    nSize = COINS_LOG_HEADER_SIZE;
+    vMoved.reserve(m_index.size());
+    std::vector<unsigned char> buffer;
+    std::vector<unsigned char> payload;
+    // Copy the live records in the order of the log, which reads it sequentially
+    uint64_t nPos = COINS_LOG_HEADER_SIZE;
+    if (!SeekTo(m_file, nPos)) {
+        return false;
+    }
+    while (nPos < m_size) {
+        if (!ReadNextRecord(m_file, nPos, m_key, payload)) {
+            return false;
+        }
+        const uint64_t nRecordSize = payload.size() + COINS_LOG_RECORD_OVERHEAD;
+        const CoinsLogLocation location(nSize + buffer.size(), nRecordSize);
+        if (payload[0] == LOG_COIN) {
+            CSpanReader reader(SER_DISK, COINS_LOG_SER_VERSION, payload.data() + 1, payload.size() - 1);
+            COutPoint outpoint;
+            reader >> outpoint.hash >> VARINT(outpoint.n);
+            auto it = m_index.find(outpoint);
+            if (it != m_index.end() && it->second.nPos == nPos) {
+                vMoved.emplace_back(outpoint, location);
+                EncodeRecord(buffer, location.nPos, payload.data(), payload.size(), m_key);
+            }
+        } else if (payload[0] == LOG_COIN_STATS && m_stats.nSize != 0 && m_stats.nPos == nPos) {
+            stats = location;
+            EncodeRecord(buffer, location.nPos, payload.data(), payload.size(), m_key);
+        }
+        nPos += nRecordSize;
+        if (buffer.size() > COINS_LOG_WRITE_BUFFER_SIZE) {
+            if (fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+                return false;
+            }
+            nSize += buffer.size();
+            buffer.clear();
+        }
+    }
+
+    CDataStream commit(SER_DISK, COINS_LOG_SER_VERSION);
+    commit << LOG_COMMIT << m_best_block;
+    EncodeRecord(buffer, nSize + buffer.size(), (const unsigned char*)commit.data(), commit.size(), m_key);
+    if (fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size() || fflush(file) != 0) {
+        return false;
+    }
+    nSize += buffer.size();
+    FileCommit(file);
+    return vMoved.size() == m_index.size();
+}
+
+bool CCoinsViewLog::Compact()
+{
+    LOCK(cs_log);
+    if (!FlushWriteBuffer()) {
+        return false;
+    }
+    const int64_t nStart = GetTimeMillis();
+    const fs::path pathNew = m_path.parent_path() / (std::string(COINS_LOG_FILENAME) + ".new");
+    FILE* fileNew = fsbridge::fopen(pathNew, "wb+");
+    if (!fileNew) {
+        return error("%s: unable to create %s", __func__, pathNew.string());
+    }
+    std::vector<std::pair<COutPoint, CoinsLogLocation>> vMoved;
+    CoinsLogLocation stats;
+    uint64_t nSize = 0;
+    bool fWritten;
+    try {
+        fWritten = WriteCompacted(fileNew, vMoved, stats, nSize);
+    } catch (const std::ios_base::failure&) {
+        fWritten = false;
+    }
+    fclose(fileNew);
+    if (!fWritten) {
+        fs::remove(pathNew);
+        return error("%s: failed to write %s", __func__, pathNew.string());
+    }
+
+    // The log is closed first, since an open file cannot be replaced everywhere
+    fclose(m_file);
+    const bool fRenamed = RenameOver(pathNew, m_path);
+    m_file = fsbridge::fopen(m_path, "rb+");
+    if (!m_file) {
+        throw std::runtime_error(strprintf("Unable to reopen %s", m_path.string()));
+    }
+    if (!fRenamed) {
+        fs::remove(pathNew);
+        return error("%s: unable to replace %s", __func__, m_path.string());
+    }
+
+    LogPrint(BCLog::COINDB, "Compacted coins log from %.2f to %.2f MiB in %dms\n", m_size * (1.0 / 1048576.0), nSize * (1.0 / 1048576.0), GetTimeMillis() - nStart);
+    for (const auto& moved : vMoved) {
+        m_index[moved.first] = moved.second;
+    }
+    m_stats = stats;
+    m_size = nSize;
+    m_sorted_index.reset();
+    return true;
+}
+
+CCoinsViewLogCursor::~CCoinsViewLogCursor()
+{
+    fclose(m_file);
+}
+
+bool CCoinsViewLogCursor::GetKey(COutPoint& key) const
+{
+    if (!Valid()) {
+        return false;
+    }
+    key = (*m_index)[m_pos].first;
+    return true;
+}
+
+bool CCoinsViewLogCursor::GetValue(Coin& coin) const
+{
+    if (!Valid()) {
+        return false;
+    }
+    try {
+        ReadCoinAt(m_file, (*m_index)[m_pos].second, m_key, coin);
+    } catch (const std::exception& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+    return true;
+}
+
+unsigned int CCoinsViewLogCursor::GetValueSize() const
+{
+    return Valid() ? (*m_index)[m_pos].second.nSize : 0;
+}
+
+bool CCoinsViewLogCursor::Valid() const
+{
+    return m_pos < m_index->size();
+}
+
+void CCoinsViewLogCursor::Next()
+{
+    m_pos++;
+}
@@ -0,0 +1,146 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSLOG_H
+#define BITCOIN_COINSLOG_H
+
+#include <coins.h>
+#include <fs.h>
+#include <streams.h>
+#include <sync.h>
+#include <txdb.h>
+#include <uint256.h>
+
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//! Name of the log in the chainstate directory
+static const char* const COINS_LOG_FILENAME = "coins.log";
+//! Write buffer of CCoinsViewLog::BatchWrite in bytes
+static const size_t COINS_LOG_WRITE_BUFFER_SIZE = 1 << 20;
+//! The log is only compacted once it has at least this many bytes of overwritten and erased records
+static const uint64_t COINS_LOG_MIN_COMPACT_SIZE = 64 << 20;
+
+/** Where a record is in the log */
+struct CoinsLogLocation
+{
+    uint64_t nPos : 40;
+    //! Size of the whole record, or 0 for none
+    uint64_t nSize : 24;
+
+    CoinsLogLocation() : nPos(0), nSize(0) {}
+    CoinsLogLocation(uint64_t nPosIn, uint64_t nSizeIn) : nPos(nPosIn), nSize(nSizeIn) {}
+};
+
+/** The keys the records of a log are obfuscated and checksummed with */
+struct CoinsLogKey
+{
+    std::vector<unsigned char> obfuscate;
+    uint64_t checksum;
+};
+
+typedef std::vector<std::pair<COutPoint, CoinsLogLocation>> CoinsLogSortedIndex;
+
+/**
+ * CCoinsView backed by an append-only log of coin records (chainstate/coins.log)
+ * and an in-memory hash table from each unspent outpoint to its record, so
+ * that a lookup is one read and a flush is one sequential write.
+ *
+ * Each BatchWrite appends the changed coins and a commit record carrying the
+ * best block; records after the last commit are discarded on load, which
+ * makes batches atomic. Once overwritten and erased records take more space
+ * than the live ones, the live records are copied into a new log, which
+ * replaces the old one.
+ *
+ * The index takes memory in proportion to the number of coins, and writes
+ * hold off reads for their duration.
+ */
+class CCoinsViewLog final : public CCoinsViewStore
+{
+private:
+    const fs::path m_path;
+    mutable CCriticalSection cs_log;
+    FILE* m_file;
+    CoinsLogKey m_key;
+    //! Bytes in the file, not counting m_write_buffer
+    uint64_t m_size;
+    //! Bytes of the records in m_index
+    uint64_t m_live_bytes;
+    std::vector<unsigned char> m_write_buffer;
+    std::unordered_map<COutPoint, CoinsLogLocation, SaltedOutpointHasher> m_index;
+    CoinsLogLocation m_stats;
+    uint256 m_best_block;
+    //! m_index in the order of the outpoints, shared by cursors until the next write
+    mutable std::shared_ptr<const CoinsLogSortedIndex> m_sorted_index;
+
+    void Load();
+    void SetLocation(const COutPoint& outpoint, const CoinsLogLocation& location);
+    //! Add a record with payload to the write buffer
+    CoinsLogLocation Append(const CDataStream& payload);
+    bool FlushWriteBuffer();
+    bool WriteCompacted(FILE* file, std::vector<std::pair<COutPoint, CoinsLogLocation>>& vMoved, CoinsLogLocation& stats, uint64_t& nSize);
+
+public:
+    //! Open the log in directory path, creating a new one if there is none
+    explicit CCoinsViewLog(const fs::path& path);
+    ~CCoinsViewLog();
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const override;
+    bool HaveCoin(const COutPoint& outpoint) const override;
+    //! Reads the records in the order of the log
+    size_t GetCoins(const std::vector<COutPoint>& outpoints, std::vector<Coin>& coins) const override;
+    uint256 GetBestBlock() const override;
+    //! Always empty, since batches are atomic
+    std::vector<uint256> GetHeadBlocks() const override;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase = true) override;
+    using CCoinsViewStore::Cursor;
+    CCoinsViewCursor* Cursor(const COutPoint& start) const override;
+
+    //! The log always holds coins of COINS_FORMAT_WITNESS_TEMPLATES
+    int GetFormat() const override { return COINS_FORMAT_WITNESS_TEMPLATES; }
+    size_t EstimateSize() const override;
+
+    bool ReadCoinsStats(CIncrementalCoinsStats& stats) const override;
+
+    bool Sync() override;
+
+    //! The log can only be compacted as a whole, which this does when the range starts at the first outpoint and a sixteenth of the log is dead
+    void CompactRange(const COutPoint& begin, const COutPoint& end) override;
+    //! Replace the log with one of only the live records. A failure leaves the log as it was.
+    bool Compact();
+
+    //! Bytes of records which were overwritten or erased, and of the stats and commit records
+    uint64_t GetDeadBytes() const;
+};
+
+/** Specialization of CCoinsViewCursor to iterate over a snapshot of a CCoinsViewLog */
+class CCoinsViewLogCursor : public CCoinsViewCursor
+{
+public:
+    ~CCoinsViewLogCursor();
+
+    bool GetKey(COutPoint& key) const override;
+    bool GetValue(Coin& coin) const override;
+    unsigned int GetValueSize() const override;
+
+    bool Valid() const override;
+    void Next() override;
+
+private:
+    CCoinsViewLogCursor(const uint256& hashBlockIn, FILE* fileIn, const CoinsLogKey& keyIn, std::shared_ptr<const CoinsLogSortedIndex> indexIn, size_t nIndexIn) :
+        CCoinsViewCursor(hashBlockIn), m_file(fileIn), m_key(keyIn), m_index(std::move(indexIn)), m_pos(nIndexIn) {}
+    //! The log as of the snapshot, which compaction does not change
+    FILE* m_file;
+    const CoinsLogKey m_key;
+    const std::shared_ptr<const CoinsLogSortedIndex> m_index;
+    size_t m_pos;
+
+    friend class CCoinsViewLog;
+};
+
+#endif // BITCOIN_COINSLOG_H
@@ -0,0 +1,149 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinstats.h>
+
+#include <chain.h>
+#include <coins.h>
+#include <primitives/block.h>
+#include <streams.h>
+#include <undo.h>
+#include <util.h>
+#include <version.h>
+
+#include <boost/thread/thread.hpp> // boost::this_thread::interruption_point
+
+#include <memory>
+
+uint64_t GetBogoSize(const CScript& scriptPubKey)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + scriptPubKey.size() /* scriptPubKey */;
+}
+
+namespace {
+
+/** The serialization of a coin hashed into the MuHash */
+CDataStream CoinElement(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << (uint32_t)(coin.nHeight * 2 + coin.fCoinBase);
+    ss << coin.out;
+    return ss;
+}
+
+/**
+ * The coinbases of these blocks were overwritten by the later duplicates at
+ * heights 91842 and 91880 (see BIP30), so their outputs never entered the set.
+ */
+bool IsBIP30Unspendable(const CBlockIndex* pindex)
+{
+    return (pindex->nHeight == 91722 && pindex->GetBlockHash() == uint256S("0x00000000000271a2dc26e7667f8419f2e15416dc6955e5a6c6cdf3f2574dd08e")) ||
+           (pindex->nHeight == 91812 && pindex->GetBlockHash() == uint256S("0x00000000000af0aed4792b1acee3d966af36cf5def14935db8de83d6f9306f2f"));
+}
+
+}
+
+void CIncrementalCoinsStats::AddCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss = CoinElement(outpoint, coin);
+    muhash.Insert((const unsigned char*)ss.data(), ss.size());
+    nTransactionOutputs++;
+    nTotalAmount += coin.out.nValue;
+    nBogoSize += GetBogoSize(coin.out.scriptPubKey);
+}
+
+void CIncrementalCoinsStats::RemoveCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss = CoinElement(outpoint, coin);
+    muhash.Remove((const unsigned char*)ss.data(), ss.size());
+    nTransactionOutputs--;
+    nTotalAmount -= coin.out.nValue;
+    nBogoSize -= GetBogoSize(coin.out.scriptPubKey);
+}
+
+void CIncrementalCoinsStats::ConnectBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    if (!pindex->pprev) {
+        // The outputs of the genesis block are not part of the UTXO set.
+        if (hashBlock.IsNull() && nTransactionOutputs == 0) hashBlock = pindex->GetBlockHash();
+        return;
+    }
+    if (hashBlock != pindex->pprev->GetBlockHash()) return;
+    assert(blockundo.vtxundo.size() + 1 == block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        if (tx.IsCoinBase() && IsBIP30Unspendable(pindex)) continue;
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            if (tx.vout[j].scriptPubKey.IsUnspendable()) continue;
+            AddCoin(COutPoint(tx.GetHash(), j), Coin(tx.vout[j], pindex->nHeight, tx.IsCoinBase()));
+        }
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                RemoveCoin(tx.vin[j].prevout, txundo.vprevout[j]);
+            }
+        }
+    }
+    hashBlock = pindex->GetBlockHash();
+}
+
+void CIncrementalCoinsStats::DisconnectBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    if (hashBlock != pindex->GetBlockHash()) return;
+    assert(blockundo.vtxundo.size() + 1 == block.vtx.size());
+    for (const CTxUndo& txundo : blockundo.vtxundo) {
+        for (const Coin& coin : txundo.vprevout) {
+            // Undo data written before 0.15 may lack the height of the spent coin.
+            if (coin.nHeight == 0) {
+                hashBlock.SetNull();
+                return;
+            }
+        }
+    }
+    for (size_t i = block.vtx.size(); i-- > 0;) {
+        const CTransaction& tx = *block.vtx[i];
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                AddCoin(tx.vin[j].prevout, txundo.vprevout[j]);
+            }
+        }
+        if (tx.IsCoinBase() && IsBIP30Unspendable(pindex)) continue;
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            if (tx.vout[j].scriptPubKey.IsUnspendable()) continue;
+            RemoveCoin(COutPoint(tx.GetHash(), j), Coin(tx.vout[j], pindex->nHeight, tx.IsCoinBase()));
+        }
+    }
+    hashBlock = pindex->pprev->GetBlockHash();
+}
+
+bool CIncrementalCoinsStats::Compute(CCoinsView* view)
+{
+    *this = CIncrementalCoinsStats();
+    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+    assert(pcursor);
+    uint256 hashCursor = pcursor->GetBestBlock();
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+            return error("%s: unable to read value", __func__);
+        }
+        AddCoin(key, coin);
+        pcursor->Next();
+    }
+    hashBlock = hashCursor;
+    return true;
+}
+
+uint256 CIncrementalCoinsStats::GetMuHash() const
+{
+    MuHash3072 copy(muhash);
+    uint256 ret;
+    copy.Finalize(ret.begin());
+    return ret;
+}
@@ -0,0 +1,70 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATS_H
+#define BITCOIN_COINSTATS_H
+
+#include <amount.h>
+#include <crypto/muhash.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <stdint.h>
+
+class CBlock;
+class CBlockIndex;
+class CBlockUndo;
+class CCoinsView;
+class COutPoint;
+class CScript;
+class Coin;
+
+/** The contribution of an output to the "bogosize" of gettxoutsetinfo, a rough measure of the UTXO set size */
+uint64_t GetBogoSize(const CScript& scriptPubKey);
+
+/**
+ * Statistics of the UTXO set and a MuHash3072 commitment to it, kept up to
+ * date block by block so that gettxoutsetinfo can report them without
+ * scanning the chainstate database.
+ *
+ * hashBlock is the block they describe; they are only valid while it is the
+ * chain tip. Blocks that do not extend or remove hashBlock are ignored.
+ */
+class CIncrementalCoinsStats
+{
+public:
+    uint256 hashBlock;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    CAmount nTotalAmount;
+    MuHash3072 muhash;
+
+    CIncrementalCoinsStats() : nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
+
+    void AddCoin(const COutPoint& outpoint, const Coin& coin);
+    void RemoveCoin(const COutPoint& outpoint, const Coin& coin);
+
+    //! Apply the changes of block, if its parent is hashBlock
+    void ConnectBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex);
+    //! Revert the changes of block, if it is hashBlock
+    void DisconnectBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex);
+
+    //! Recompute everything from the coins in view
+    bool Compute(CCoinsView* view);
+
+    uint256 GetMuHash() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nBogoSize);
+        READWRITE(nTotalAmount);
+        READWRITE(muhash);
+    }
+};
+
+#endif // BITCOIN_COINSTATS_H
@@ -38,6 +38,7 @@
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <net/if.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -72,6 +73,23 @@ typedef unsigned int SOCKET;
 #else
 #define MAX_PATH            1024
 #endif
+
+#if !defined(WIN32) && !defined(IOV_MAX)
+#define IOV_MAX             16 // POSIX minimum for _XOPEN_IOV_MAX
+#endif
+
+// Socket readiness backends available besides select(). WIN32's WSAPoll is
+// unreliable and macOS poll() mishandles some descriptors, so those keep
+// select() or kqueue respectively.
+#if !defined(WIN32) && !defined(__APPLE__)
+#define USE_POLL
+#endif
+#if defined(__linux__)
+#define USE_EPOLL
+#endif
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__)
+#define USE_KQUEUE
+#endif
 #ifdef _MSC_VER
 #if !defined(ssize_t)
 #ifdef _WIN64
@@ -87,7 +105,7 @@ size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
 bool static inline IsSelectableSocket(const SOCKET& s) {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_POLL)
     return true;
 #else
     return (s < FD_SETSIZE);
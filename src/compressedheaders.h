@@ -0,0 +1,154 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COMPRESSEDHEADERS_H
+#define BITCOIN_COMPRESSEDHEADERS_H
+
+#include <primitives/block.h>
+#include <serialize.h>
+
+#include <stdint.h>
+#include <algorithm>
+#include <ios>
+#include <limits>
+#include <vector>
+
+/** Default for -compressedheaders */
+static const bool DEFAULT_COMPRESSED_HEADERS = false;
+/** Version of the encoding announced in "sendcmphdrs" */
+static const uint32_t COMPRESSED_HEADERS_VERSION = 1;
+
+/**
+ * A list of block headers as sent in a "cmpheaders" message. Compared to a
+ * "headers" message, which spends 81 bytes on every header, it leaves out
+ * what follows from the headers before it:
+ *
+ * - hashPrevBlock, when it is the hash of the previous header (always sent
+ *   for the first one);
+ * - nVersion, when it is one of the last seven distinct versions, which it
+ *   then refers to by index;
+ * - nBits, when it did not change;
+ * - and the transaction count, which is always zero.
+ *
+ * nTime is sent as a variable-length difference to the previous header's
+ * time, so a typical header takes 39 or 40 bytes.
+ */
+class CCompressedHeaders
+{
+public:
+    /** Distinct versions, most recent first, that a header can refer back to */
+    static const size_t VERSION_TABLE_SIZE = 7;
+
+    std::vector<CBlockHeader> headers;
+
+    CCompressedHeaders() {}
+    explicit CCompressedHeaders(std::vector<CBlockHeader> headersIn) : headers(std::move(headersIn)) {}
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        WriteCompactSize(s, headers.size());
+        std::vector<int32_t> vVersions;
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
+            const CBlockHeader* prev = i > 0 ? &headers[i - 1] : nullptr;
+            uint8_t nFlags = 0;
+            const uint8_t nVersionIndex = FindVersion(vVersions, header.nVersion);
+            nFlags |= nVersionIndex;
+            if (!prev || prev->nBits != header.nBits)
+                nFlags |= FLAG_BITS;
+            if (!prev || prev->GetHash() != header.hashPrevBlock)
+                nFlags |= FLAG_PREV_HASH;
+            s << nFlags;
+            if (nVersionIndex == VERSION_NEW)
+                s << header.nVersion;
+            UseVersion(vVersions, header.nVersion);
+            if (nFlags & FLAG_PREV_HASH)
+                s << header.hashPrevBlock;
+            s << header.hashMerkleRoot;
+            WriteVarInt<Stream, uint64_t>(s, ZigZag((int64_t)header.nTime - (prev ? (int64_t)prev->nTime : 0)));
+            if (nFlags & FLAG_BITS)
+                s << header.nBits;
+            s << header.nNonce;
+        }
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        headers.clear();
+        const uint64_t nCount = ReadCompactSize(s);
+        std::vector<int32_t> vVersions;
+        for (uint64_t i = 0; i < nCount; i++) {
+            const bool fFirst = headers.empty();
+            uint8_t nFlags;
+            s >> nFlags;
+            if (nFlags & ~(VERSION_MASK | FLAG_BITS | FLAG_PREV_HASH))
+                throw std::ios_base::failure("CCompressedHeaders: unknown flags");
+            if (fFirst && (nFlags & (FLAG_BITS | FLAG_PREV_HASH)) != (FLAG_BITS | FLAG_PREV_HASH))
+                throw std::ios_base::failure("CCompressedHeaders: first header incomplete");
+            CBlockHeader header;
+            const uint8_t nVersionIndex = nFlags & VERSION_MASK;
+            if (nVersionIndex == VERSION_NEW) {
+                s >> header.nVersion;
+            } else if (nVersionIndex < vVersions.size()) {
+                header.nVersion = vVersions[nVersionIndex];
+            } else {
+                throw std::ios_base::failure("CCompressedHeaders: unknown version index");
+            }
+            UseVersion(vVersions, header.nVersion);
+            if (nFlags & FLAG_PREV_HASH) {
+                s >> header.hashPrevBlock;
+            } else {
+                header.hashPrevBlock = headers.back().GetHash();
+            }
+            s >> header.hashMerkleRoot;
+            const int64_t nTimeDelta = UnZigZag(ReadVarInt<Stream, uint64_t>(s));
+            const int64_t nTime = (fFirst ? 0 : (int64_t)headers.back().nTime) + std::max<int64_t>(std::min<int64_t>(nTimeDelta, 1LL << 32), -(1LL << 32));
+            if (nTime < 0 || nTime > (int64_t)std::numeric_limits<uint32_t>::max())
+                throw std::ios_base::failure("CCompressedHeaders: time out of range");
+            header.nTime = nTime;
+            if (nFlags & FLAG_BITS) {
+                s >> header.nBits;
+            } else {
+                header.nBits = headers.back().nBits;
+            }
+            s >> header.nNonce;
+            headers.push_back(header);
+        }
+    }
+
+private:
+    //! The low bits of the flags hold the index of the version, or VERSION_NEW
+    static const uint8_t VERSION_MASK = 0x07;
+    static const uint8_t VERSION_NEW = 0x07;
+    static const uint8_t FLAG_BITS = 0x08;
+    static const uint8_t FLAG_PREV_HASH = 0x10;
+
+    static uint64_t ZigZag(int64_t n) { return ((uint64_t)n << 1) ^ (uint64_t)(n >> 63); }
+    static int64_t UnZigZag(uint64_t n) { return (int64_t)(n >> 1) ^ -(int64_t)(n & 1); }
+
+    static uint8_t FindVersion(const std::vector<int32_t>& vVersions, int32_t nVersion)
+    {
+        for (size_t i = 0; i < vVersions.size(); i++) {
+            if (vVersions[i] == nVersion)
+                return i;
+        }
+        return VERSION_NEW;
+    }
+
+    /** Move nVersion to the front of the table, dropping the oldest version if it is full */
+    static void UseVersion(std::vector<int32_t>& vVersions, int32_t nVersion)
+    {
+        const uint8_t nIndex = FindVersion(vVersions, nVersion);
+        if (nIndex != VERSION_NEW) {
+            vVersions.erase(vVersions.begin() + nIndex);
+        } else if (vVersions.size() == VERSION_TABLE_SIZE) {
+            vVersions.pop_back();
+        }
+        vVersions.insert(vVersions.begin(), nVersion);
+    }
+};
+
+#endif // BITCOIN_COMPRESSEDHEADERS_H
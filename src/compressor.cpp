@@ -45,7 +45,25 @@ bool CScriptCompressor::IsToPubKey(CPubKey &pubkey) const
     return false;
 }
 
-bool CScriptCompressor::Compress(std::vector<unsigned char> &out) const
+bool CScriptCompressor::IsToWitnessKeyHash(uint160 &hash) const
+{
+    if (script.size() == 22 && script[0] == OP_0 && script[1] == 20) {
+        memcpy(hash.begin(), &script[2], 20);
+        return true;
+    }
+    return false;
+}
+
+bool CScriptCompressor::IsToWitnessScriptHash(uint256 &hash) const
+{
+    if (script.size() == 34 && script[0] == OP_0 && script[1] == 32) {
+        memcpy(hash.begin(), &script[2], 32);
+        return true;
+    }
+    return false;
+}
+
+bool CScriptCompressor::Compress(std::vector<unsigned char> &out, bool fWitnessTemplates) const
 {
     CKeyID keyID;
     if (IsToKeyID(keyID)) {
@@ -73,14 +91,30 @@ bool CScriptCompressor::Compress(std::vector<unsigned char> &out) const
             return true;
         }
     }
+    if (!fWitnessTemplates)
+        return false;
+    uint160 witnessKeyHash;
+    if (IsToWitnessKeyHash(witnessKeyHash)) {
+        out.resize(21);
+        out[0] = 0x06;
+        memcpy(&out[1], witnessKeyHash.begin(), 20);
+        return true;
+    }
+    uint256 witnessScriptHash;
+    if (IsToWitnessScriptHash(witnessScriptHash)) {
+        out.resize(33);
+        out[0] = 0x07;
+        memcpy(&out[1], witnessScriptHash.begin(), 32);
+        return true;
+    }
     return false;
 }
 
 unsigned int CScriptCompressor::GetSpecialSize(unsigned int nSize) const
 {
-    if (nSize == 0 || nSize == 1)
+    if (nSize == 0 || nSize == 1 || nSize == 6)
         return 20;
-    if (nSize == 2 || nSize == 3 || nSize == 4 || nSize == 5)
+    if (nSize == 2 || nSize == 3 || nSize == 4 || nSize == 5 || nSize == 7)
         return 32;
     return 0;
 }
@@ -113,7 +147,7 @@ bool CScriptCompressor::Decompress(unsigned int nSize, const std::vector<unsigne
         script[34] = OP_CHECKSIG;
         return true;
     case 0x04:
-    case 0x05:
+    case 0x05: {
         unsigned char vch[33] = {};
         vch[0] = nSize - 2;
         memcpy(&vch[1], in.data(), 32);
@@ -127,6 +161,19 @@ bool CScriptCompressor::Decompress(unsigned int nSize, const std::vector<unsigne
         script[66] = OP_CHECKSIG;
         return true;
     }
+    case 0x06:
+        script.resize(22);
+        script[0] = OP_0;
+        script[1] = 20;
+        memcpy(&script[2], in.data(), 20);
+        return true;
+    case 0x07:
+        script.resize(34);
+        script[0] = OP_0;
+        script[1] = 32;
+        memcpy(&script[2], in.data(), 32);
+        return true;
+    }
     return false;
 }
 
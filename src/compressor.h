@@ -14,6 +14,13 @@ class CKeyID;
 class CPubKey;
 class CScriptID;
 
+/**
+ * Stream version flag for the extended script templates of CScriptCompressor.
+ * Only the chainstate of format COINS_FORMAT_WITNESS_TEMPLATES is serialized
+ * with it; the undo data and everything else keep the original encoding.
+ */
+static const int SERIALIZE_SCRIPT_WITNESS_TEMPLATES = 0x08000000;
+
 /** Compact serializer for scripts.
  *
  *  It detects common cases and encodes them much more efficiently.
@@ -22,8 +29,13 @@ class CScriptID;
  *  * Pay to script hash (encoded as 21 bytes)
  *  * Pay to pubkey starting with 0x02, 0x03 or 0x04 (encoded as 33 bytes)
  *
- *  Other scripts up to 121 bytes require 1 byte + script length. Above
- *  that, scripts up to 16505 bytes require 2 bytes + script length.
+ *  With SERIALIZE_SCRIPT_WITNESS_TEMPLATES, 2 more are defined:
+ *  * Pay to witness v0 pubkey hash (encoded as 21 bytes)
+ *  * Pay to witness v0 script hash (encoded as 33 bytes)
+ *
+ *  Other scripts up to 121 bytes (119 with the extended templates) require
+ *  1 byte + script length. Above that, scripts up to 16505 bytes require
+ *  2 bytes + script length.
  */
 class CScriptCompressor
 {
@@ -35,6 +47,9 @@ private:
      * and nHeight of the enclosing transaction.
      */
     static const unsigned int nSpecialScripts = 6;
+    static const unsigned int nSpecialScriptsWitness = 8;
+
+    static unsigned int GetSpecialScripts(int nVersion) { return (nVersion & SERIALIZE_SCRIPT_WITNESS_TEMPLATES) ? nSpecialScriptsWitness : nSpecialScripts; }
 
     CScript &script;
 protected:
@@ -48,8 +63,10 @@ protected:
     bool IsToKeyID(CKeyID &hash) const;
     bool IsToScriptID(CScriptID &hash) const;
     bool IsToPubKey(CPubKey &pubkey) const;
+    bool IsToWitnessKeyHash(uint160 &hash) const;
+    bool IsToWitnessScriptHash(uint256 &hash) const;
 
-    bool Compress(std::vector<unsigned char> &out) const;
+    bool Compress(std::vector<unsigned char> &out, bool fWitnessTemplates = false) const;
     unsigned int GetSpecialSize(unsigned int nSize) const;
     bool Decompress(unsigned int nSize, const std::vector<unsigned char> &out);
 public:
@@ -57,12 +74,13 @@ public:
 
     template<typename Stream>
     void Serialize(Stream &s) const {
+        const unsigned int nSpecial = GetSpecialScripts(s.GetVersion());
         std::vector<unsigned char> compr;
-        if (Compress(compr)) {
+        if (Compress(compr, nSpecial == nSpecialScriptsWitness)) {
             s << CFlatData(compr);
             return;
         }
-        unsigned int nSize = script.size() + nSpecialScripts;
+        unsigned int nSize = script.size() + nSpecial;
         s << VARINT(nSize);
         s << CFlatData(script);
     }
@@ -71,13 +89,14 @@ public:
     void Unserialize(Stream &s) {
         unsigned int nSize = 0;
         s >> VARINT(nSize);
-        if (nSize < nSpecialScripts) {
+        const unsigned int nSpecial = GetSpecialScripts(s.GetVersion());
+        if (nSize < nSpecial) {
             std::vector<unsigned char> vch(GetSpecialSize(nSize), 0x00);
             s >> REF(CFlatData(vch));
             Decompress(nSize, vch);
             return;
         }
-        nSize -= nSpecialScripts;
+        nSize -= nSpecial;
         if (nSize > MAX_SCRIPT_SIZE) {
             // Overly long script, replace with a short invalid one
             script << OP_RETURN;
@@ -22,8 +22,23 @@ UniValue ValueFromAmount(const CAmount& amount)
     int64_t n_abs = (sign ? -amount : amount);
     int64_t quotient = n_abs / COIN;
     int64_t remainder = n_abs % COIN;
-    return UniValue(UniValue::VNUM,
-            strprintf("%s%d.%08d", sign ? "-" : "", quotient, remainder));
+    // Format by hand; this is called for every output of every transaction
+    // written to JSON, where strprintf shows up in profiles
+    char buf[32];
+    char* end = buf + sizeof(buf);
+    char* p = end;
+    for (int i = 0; i < 8; i++) {
+        *--p = '0' + remainder % 10;
+        remainder /= 10;
+    }
+    *--p = '.';
+    do {
+        *--p = '0' + quotient % 10;
+        quotient /= 10;
+    } while (quotient);
+    if (sign)
+        *--p = '-';
+    return UniValue(UniValue::VNUM, std::string(p, end));
 }
 
 std::string FormatScript(const CScript& script)
@@ -164,6 +179,7 @@ void TxToUniv(const CTransaction& tx, const uint256& hashBlock, UniValue& entry,
     entry.pushKV("locktime", (int64_t)tx.nLockTime);
 
     UniValue vin(UniValue::VARR);
+    vin.reserve(tx.vin.size());
     for (unsigned int i = 0; i < tx.vin.size(); i++) {
         const CTxIn& txin = tx.vin[i];
         UniValue in(UniValue::VOBJ);
@@ -190,6 +206,7 @@ void TxToUniv(const CTransaction& tx, const uint256& hashBlock, UniValue& entry,
     entry.pushKV("vin", vin);
 
     UniValue vout(UniValue::VARR);
+    vout.reserve(tx.vout.size());
     for (unsigned int i = 0; i < tx.vout.size(); i++) {
         const CTxOut& txout = tx.vout[i];
 
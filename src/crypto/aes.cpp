@@ -12,6 +12,24 @@ extern "C" {
 #include <crypto/ctaes/ctaes.c>
 }
 
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__))
+#include <cpuid.h>
+#endif
+
+#if defined(ENABLE_AESNI) && !defined(BUILD_BITCOIN_INTERNAL)
+namespace aes_aesni
+{
+void Expand256(unsigned char enc[240], unsigned char dec[240], const unsigned char key[32]);
+void Encrypt256(const unsigned char rk[240], unsigned char out[16], const unsigned char in[16]);
+void Decrypt256(const unsigned char rk[240], unsigned char out[16], const unsigned char in[16]);
+}
+#endif
+
+namespace {
+/** Whether AES256Encrypt and AES256Decrypt use AES-NI, set by AESAutoDetect */
+bool g_aesni = false;
+} // namespace
+
 // for wallet
 
 AES128Encrypt::AES128Encrypt(const unsigned char key[16])
@@ -44,33 +62,63 @@ void AES128Decrypt::Decrypt(unsigned char plaintext[16], const unsigned char cip
     AES128_decrypt(&ctx, 1, plaintext, ciphertext);
 }
 
-AES256Encrypt::AES256Encrypt(const unsigned char key[32])
+AES256Encrypt::AES256Encrypt(const unsigned char key[32]) : fHardware(g_aesni)
 {
+#if defined(ENABLE_AESNI) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (fHardware) {
+        unsigned char dec[AES256_ROUNDKEYS_SIZE];
+        aes_aesni::Expand256(rk, dec, key);
+        memset(dec, 0, sizeof(dec));
+        return;
+    }
+#endif
     AES256_init(&ctx, key);
 }
 
 AES256Encrypt::~AES256Encrypt()
 {
     memset(&ctx, 0, sizeof(ctx));
+    memset(rk, 0, sizeof(rk));
 }
 
 void AES256Encrypt::Encrypt(unsigned char ciphertext[16], const unsigned char plaintext[16]) const
 {
+#if defined(ENABLE_AESNI) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (fHardware) {
+        aes_aesni::Encrypt256(rk, ciphertext, plaintext);
+        return;
+    }
+#endif
     AES256_encrypt(&ctx, 1, ciphertext, plaintext);
 }
 
-AES256Decrypt::AES256Decrypt(const unsigned char key[32])
+AES256Decrypt::AES256Decrypt(const unsigned char key[32]) : fHardware(g_aesni)
 {
+#if defined(ENABLE_AESNI) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (fHardware) {
+        unsigned char enc[AES256_ROUNDKEYS_SIZE];
+        aes_aesni::Expand256(enc, rk, key);
+        memset(enc, 0, sizeof(enc));
+        return;
+    }
+#endif
     AES256_init(&ctx, key);
 }
 
 AES256Decrypt::~AES256Decrypt()
 {
     memset(&ctx, 0, sizeof(ctx));
+    memset(rk, 0, sizeof(rk));
 }
 
 void AES256Decrypt::Decrypt(unsigned char plaintext[16], const unsigned char ciphertext[16]) const
 {
+#if defined(ENABLE_AESNI) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (fHardware) {
+        aes_aesni::Decrypt256(rk, plaintext, ciphertext);
+        return;
+    }
+#endif
     AES256_decrypt(&ctx, 1, plaintext, ciphertext);
 }
 
@@ -216,3 +264,40 @@ int AES128CBCDecrypt::Decrypt(const unsigned char* data, int size, unsigned char
 {
     return CBCDecrypt(dec, iv, data, size, pad, out);
 }
+
+namespace {
+/** Check AES-256 against the example vector of FIPS-197 */
+bool SelfTest()
+{
+    unsigned char key[AES256_KEYSIZE], plain[AES_BLOCKSIZE], out[AES_BLOCKSIZE];
+    static const unsigned char expected[AES_BLOCKSIZE] = {0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89};
+    for (int i = 0; i < AES256_KEYSIZE; i++)
+        key[i] = i;
+    for (int i = 0; i < AES_BLOCKSIZE; i++)
+        plain[i] = i * 0x11;
+    AES256Encrypt(key).Encrypt(out, plain);
+    if (memcmp(out, expected, AES_BLOCKSIZE))
+        return false;
+    AES256Decrypt(key).Decrypt(out, expected);
+    return memcmp(out, plain, AES_BLOCKSIZE) == 0;
+}
+} // namespace
+
+std::string AESAutoDetect()
+{
+    std::string ret = "standard";
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__))
+    uint32_t eax, ebx, ecx, edx;
+    bool have_aesni = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && ((ecx >> 25) & 1);
+#if defined(ENABLE_AESNI) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (have_aesni) {
+        g_aesni = true;
+        ret = "aesni";
+    }
+#endif
+    (void)have_aesni;
+#endif
+
+    assert(SelfTest());
+    return ret;
+}
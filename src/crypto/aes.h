@@ -11,6 +11,8 @@ extern "C" {
 #include <crypto/ctaes/ctaes.h>
 }
 
+#include <string>
+
 static const int AES_BLOCKSIZE = 16;
 static const int AES128_KEYSIZE = 16;
 static const int AES256_KEYSIZE = 32;
@@ -39,11 +41,17 @@ public:
     void Decrypt(unsigned char plaintext[16], const unsigned char ciphertext[16]) const;
 };
 
+/** Round keys of AES-256 for the AES-NI implementation */
+static const int AES256_ROUNDKEYS_SIZE = 240;
+
 /** An encryption class for AES-256. */
 class AES256Encrypt
 {
 private:
     AES256_ctx ctx;
+    //! With AES-NI, the round keys are used instead of ctx
+    bool fHardware;
+    unsigned char rk[AES256_ROUNDKEYS_SIZE];
 
 public:
     explicit AES256Encrypt(const unsigned char key[32]);
@@ -56,6 +64,9 @@ class AES256Decrypt
 {
 private:
     AES256_ctx ctx;
+    //! With AES-NI, the round keys are used instead of ctx
+    bool fHardware;
+    unsigned char rk[AES256_ROUNDKEYS_SIZE];
 
 public:
     explicit AES256Decrypt(const unsigned char key[32]);
@@ -115,4 +126,7 @@ private:
     unsigned char iv[AES_BLOCKSIZE];
 };
 
+/** Autodetect whether AES-256 can use AES-NI, and return a description of the implementation used. */
+std::string AESAutoDetect();
+
 #endif // BITCOIN_CRYPTO_AES_H
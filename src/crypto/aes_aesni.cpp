@@ -0,0 +1,87 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// Based on the AES-256 key expansion in Intel's "Advanced Encryption
+// Standard (AES) New Instructions Set" white paper, by Shay Gueron.
+
+#ifdef ENABLE_AESNI
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace {
+
+inline __m128i __attribute__((always_inline)) ExpandEven(__m128i k0, __m128i assist)
+{
+    assist = _mm_shuffle_epi32(assist, 0xff);
+    k0 = _mm_xor_si128(k0, _mm_slli_si128(k0, 4));
+    k0 = _mm_xor_si128(k0, _mm_slli_si128(k0, 8));
+    return _mm_xor_si128(k0, assist);
+}
+
+inline __m128i __attribute__((always_inline)) ExpandOdd(__m128i k0, __m128i k1)
+{
+    __m128i assist = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(k0, 0x00), 0xaa);
+    k1 = _mm_xor_si128(k1, _mm_slli_si128(k1, 4));
+    k1 = _mm_xor_si128(k1, _mm_slli_si128(k1, 8));
+    return _mm_xor_si128(k1, assist);
+}
+
+} // namespace
+
+namespace aes_aesni {
+
+/** Expand a 256-bit key into the 15 round keys of encryption, and the 15 of decryption */
+void Expand256(unsigned char enc[240], unsigned char dec[240], const unsigned char key[32])
+{
+    __m128i rk[15];
+    rk[0] = _mm_loadu_si128((const __m128i*)key);
+    rk[1] = _mm_loadu_si128((const __m128i*)(key + 16));
+    // The round constant of aeskeygenassist must be an immediate
+#define EXPAND_ROUND(i, rcon) \
+    rk[i] = ExpandEven(rk[i - 2], _mm_aeskeygenassist_si128(rk[i - 1], rcon)); \
+    if (i < 14) rk[i + 1] = ExpandOdd(rk[i], rk[i - 1]);
+    EXPAND_ROUND(2, 0x01)
+    EXPAND_ROUND(4, 0x02)
+    EXPAND_ROUND(6, 0x04)
+    EXPAND_ROUND(8, 0x08)
+    EXPAND_ROUND(10, 0x10)
+    EXPAND_ROUND(12, 0x20)
+    EXPAND_ROUND(14, 0x40)
+#undef EXPAND_ROUND
+
+    for (int i = 0; i < 15; i++) {
+        _mm_storeu_si128((__m128i*)(enc + 16 * i), rk[i]);
+    }
+    // The equivalent inverse cipher uses the round keys in reverse, with InvMixColumns applied to the inner ones
+    _mm_storeu_si128((__m128i*)dec, rk[14]);
+    for (int i = 1; i < 14; i++) {
+        _mm_storeu_si128((__m128i*)(dec + 16 * i), _mm_aesimc_si128(rk[14 - i]));
+    }
+    _mm_storeu_si128((__m128i*)(dec + 16 * 14), rk[0]);
+}
+
+void Encrypt256(const unsigned char rk[240], unsigned char out[16], const unsigned char in[16])
+{
+    __m128i m = _mm_xor_si128(_mm_loadu_si128((const __m128i*)in), _mm_loadu_si128((const __m128i*)rk));
+    for (int i = 1; i < 14; i++) {
+        m = _mm_aesenc_si128(m, _mm_loadu_si128((const __m128i*)(rk + 16 * i)));
+    }
+    m = _mm_aesenclast_si128(m, _mm_loadu_si128((const __m128i*)(rk + 16 * 14)));
+    _mm_storeu_si128((__m128i*)out, m);
+}
+
+void Decrypt256(const unsigned char rk[240], unsigned char out[16], const unsigned char in[16])
+{
+    __m128i m = _mm_xor_si128(_mm_loadu_si128((const __m128i*)in), _mm_loadu_si128((const __m128i*)rk));
+    for (int i = 1; i < 14; i++) {
+        m = _mm_aesdec_si128(m, _mm_loadu_si128((const __m128i*)(rk + 16 * i)));
+    }
+    m = _mm_aesdeclast_si128(m, _mm_loadu_si128((const __m128i*)(rk + 16 * 14)));
+    _mm_storeu_si128((__m128i*)out, m);
+}
+
+} // namespace aes_aesni
+
+#endif
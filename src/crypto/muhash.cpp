@@ -0,0 +1,169 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <crypto/muhash.h>
+
+#include <crypto/chacha20.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+
+#include <limits>
+
+namespace {
+
+/** 2^3072 - MAX_PRIME_DIFF is the modulus */
+const uint32_t MAX_PRIME_DIFF = 1103717;
+
+}
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        limbs[i] = ReadLE32(data + 4 * i);
+    }
+    if (IsOverflow()) FullReduce();
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; ++i) limbs[i] = 0;
+}
+
+bool Num3072::IsOne() const
+{
+    if (limbs[0] != 1) return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != 0) return false;
+    }
+    return true;
+}
+
+/** Whether the value is at least the modulus (it is always below 2^3072). */
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= std::numeric_limits<uint32_t>::max() - MAX_PRIME_DIFF) return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != std::numeric_limits<uint32_t>::max()) return false;
+    }
+    return true;
+}
+
+/** Subtract the modulus, by adding MAX_PRIME_DIFF and dropping the 2^3072 carry. */
+void Num3072::FullReduce()
+{
+    uint64_t c = MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS; ++i) {
+        c += limbs[i];
+        limbs[i] = (uint32_t)c;
+        c >>= 32;
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    // Schoolbook product; a may alias *this, so limbs are only written at the end.
+    uint32_t tmp[2 * LIMBS] = {0};
+    for (int i = 0; i < LIMBS; ++i) {
+        uint64_t c = 0;
+        for (int j = 0; j < LIMBS; ++j) {
+            c += (uint64_t)limbs[i] * a.limbs[j] + tmp[i + j];
+            tmp[i + j] = (uint32_t)c;
+            c >>= 32;
+        }
+        tmp[i + LIMBS] = (uint32_t)c;
+    }
+
+    // As 2^3072 = MAX_PRIME_DIFF (mod p), fold the upper half into the lower one.
+    uint64_t c = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        c += (uint64_t)tmp[i + LIMBS] * MAX_PRIME_DIFF + tmp[i];
+        limbs[i] = (uint32_t)c;
+        c >>= 32;
+    }
+    while (c) {
+        c *= MAX_PRIME_DIFF;
+        for (int i = 0; i < LIMBS && c; ++i) {
+            c += limbs[i];
+            limbs[i] = (uint32_t)c;
+            c >>= 32;
+        }
+    }
+    if (IsOverflow()) FullReduce();
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // By Fermat's little theorem, a^(p-2) is the inverse of a. All bits of
+    // p - 2 = 2^3072 - (MAX_PRIME_DIFF + 2) are set except in the lowest limb.
+    const uint32_t low_limb = 0 - (MAX_PRIME_DIFF + 2);
+    Num3072 r;
+    for (int i = LIMBS * 32 - 1; i >= 0; --i) {
+        r.Multiply(r);
+        if (i >= 32 || ((low_limb >> i) & 1)) {
+            r.Multiply(*this);
+        }
+    }
+    return r;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    if (a.IsOne()) return;
+    Multiply(a.GetInverse());
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE]) const
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        WriteLE32(out + 4 * i, limbs[i]);
+    }
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(hash);
+    unsigned char tmp[Num3072::BYTE_SIZE];
+    ChaCha20(hash, sizeof(hash)).Output(tmp, sizeof(tmp));
+    return Num3072(tmp);
+}
+
+MuHash3072::MuHash3072(const unsigned char* data, size_t len) : m_numerator(ToNum3072(data, len)) {}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    m_numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    m_denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    m_numerator.Multiply(mul.m_numerator);
+    m_denominator.Multiply(mul.m_denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    m_numerator.Multiply(div.m_denominator);
+    m_denominator.Multiply(div.m_numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char* out)
+{
+    m_numerator.Divide(m_denominator);
+    m_denominator.SetToOne();
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    m_numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(out);
+}
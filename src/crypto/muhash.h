@@ -0,0 +1,88 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** An integer modulo 2^3072 - 1103717, the largest 3072-bit safe prime. */
+class Num3072
+{
+public:
+    static constexpr size_t BYTE_SIZE = 384;
+    static constexpr int LIMBS = 96;
+    //! Little-endian 32-bit limbs, always fully reduced
+    uint32_t limbs[LIMBS];
+
+    Num3072() { SetToOne(); }
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    bool IsOne() const;
+    void Multiply(const Num3072& a);
+    void Divide(const Num3072& a);
+    Num3072 GetInverse() const;
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]) const;
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+};
+
+/**
+ * A rolling hash of a set of byte strings, as the product modulo a 3072-bit
+ * prime of their hashes expanded with ChaCha20 (MuHash).
+ *
+ * The result does not depend on the order in which elements are added, and
+ * elements can be removed again, so the hash of a set can be kept up to date
+ * as elements come and go. Removals are accumulated in a separate
+ * denominator, as a division costs a modular inversion; Finalize does that
+ * once.
+ */
+class MuHash3072
+{
+private:
+    Num3072 m_numerator;
+    Num3072 m_denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    MuHash3072() {}
+    //! The set containing one element
+    MuHash3072(const unsigned char* data, size_t len);
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+    //! Union and difference of (multi)sets
+    MuHash3072& operator*=(const MuHash3072& mul);
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    //! Write the 32-byte hash of the set, normalizing the internal state
+    void Finalize(unsigned char* out);
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        unsigned char data[Num3072::BYTE_SIZE];
+        m_numerator.ToBytes(data);
+        s.write((const char*)data, sizeof(data));
+        m_denominator.ToBytes(data);
+        s.write((const char*)data, sizeof(data));
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        unsigned char data[Num3072::BYTE_SIZE];
+        s.read((char*)data, sizeof(data));
+        m_numerator = Num3072(data);
+        s.read((char*)data, sizeof(data));
+        m_denominator = Num3072(data);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
@@ -332,7 +332,8 @@ public:
     /** setup initializes the container to store no more than new_size
      * elements.
      *
-     * setup should only be called once.
+     * setup may be called again to resize the container; the elements stored
+     * before are dropped. It must not run concurrently with any other call.
      *
      * @param new_size the desired number of elements to store
      * @returns the maximum number of elements storable
@@ -342,7 +343,7 @@ public:
         // depth_limit must be at least one otherwise errors can occur.
         depth_limit = static_cast<uint8_t>(std::log2(static_cast<float>(std::max((uint32_t)2, new_size))));
         size = std::max<uint32_t>(2, new_size);
-        table.resize(size);
+        std::vector<Element>(size).swap(table);
         collection_flags.setup(size);
         epoch_flags.resize(size);
         // Set to 45% as described above
@@ -388,8 +389,9 @@ public:
      * now in the table, one previously inserted element is evicted from the
      * table, the entry attempted to be inserted is evicted.
      *
+     * @returns false if an element (possibly e) had to be evicted
      */
-    inline void insert(Element e)
+    inline bool insert(Element e)
     {
         epoch_check();
         uint32_t last_loc = invalid();
@@ -401,7 +403,7 @@ public:
             if (table[loc] == e) {
                 please_keep(loc);
                 epoch_flags[loc] = last_epoch;
-                return;
+                return true;
             }
         for (uint8_t depth = 0; depth < depth_limit; ++depth) {
             // First try to insert to an empty slot, if one exists
@@ -411,7 +413,7 @@ public:
                 table[loc] = std::move(e);
                 please_keep(loc);
                 epoch_flags[loc] = last_epoch;
-                return;
+                return true;
             }
             /** Swap with the element at the location that was
             * not the last one looked at. Example:
@@ -437,6 +439,7 @@ public:
             // Recompute the locs -- unfortunately happens one too many times!
             locs = compute_hashes(e);
         }
+        return false;
     }
 
     /* contains iterates through the hash locations for a given element
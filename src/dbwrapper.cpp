@@ -72,14 +72,64 @@ public:
     }
 };
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+namespace {
+
+struct DBProfile {
+    const char* name;
+    DBOptions chainstate;
+    DBOptions block_index;
+};
+
+// The chainstate is read at random while connecting blocks, the block index
+// mostly at startup and for -txindex lookups.
+const DBProfile DB_PROFILES[] = {
+    {DEFAULT_DB_PROFILE, DEFAULT_DB_OPTIONS, DEFAULT_DB_OPTIONS},
+    // Random reads are cheap: keep most tables open and write large ones, so
+    // that lookups rarely reopen files and compactions run less often.
+    {"ssd", {1000, 4 << 10, 32 << 20, 25, 10}, {256, 4 << 10, 8 << 20, 25, 10}},
+    // Every read is a seek: read larger blocks, and spend more filter bits so
+    // fewer lookups of missing keys touch the disk.
+    {"hdd", {256, 16 << 10, 8 << 20, 25, 14}, {64, 16 << 10, 4 << 20, 25, 10}},
+    // Few file descriptors, and small write buffers leaving most of the
+    // cache for reads.
+    {"lowmem", {24, 4 << 10, 2 << 20, 10, 10}, {8, 4 << 10, 2 << 20, 10, 10}},
+};
+
+}
+
+bool GetDBProfile(const std::string& strProfile, DBKind kind, DBOptions& dboptions)
+{
+    for (const DBProfile& profile : DB_PROFILES) {
+        if (strProfile == profile.name) {
+            dboptions = kind == DBKind::CHAINSTATE ? profile.chainstate : profile.block_index;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string ListDBProfiles()
+{
+    std::string strProfiles;
+    for (const DBProfile& profile : DB_PROFILES) {
+        if (!strProfiles.empty()) strProfiles += ", ";
+        strProfiles += profile.name;
+    }
+    return strProfiles;
+}
+
+static leveldb::Options GetOptions(size_t nCacheSize, const DBOptions& dboptions, size_t& nBlockCacheSize)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.write_buffer_size = nCacheSize * dboptions.write_buffer_percent / 100;
+    // up to two write buffers may be held in memory simultaneously
+    nBlockCacheSize = nCacheSize - 2 * options.write_buffer_size;
+    options.block_cache = leveldb::NewLRUCache(nBlockCacheSize);
+    options.block_size = dboptions.block_size;
+    options.max_file_size = dboptions.max_file_size;
+    options.filter_policy = dboptions.filter_bits ? leveldb::NewBloomFilterPolicy(dboptions.filter_bits) : nullptr;
     options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.max_open_files = dboptions.max_open_files;
     options.info_log = new CBitcoinLevelDBLogger();
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
@@ -89,7 +139,7 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, const DBOptions& dboptionsIn) : dboptions(dboptionsIn), nValueVersion(CLIENT_VERSION)
 {
     //环境以及读写选项初始化
     penv = nullptr;
@@ -97,7 +147,7 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;//同步开启
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, dboptions, nBlockCacheSize);
     options.create_if_missing = true;
     if (fMemory) {
         //使用内存环境
@@ -160,6 +210,15 @@ CDBWrapper::~CDBWrapper()
     options.env = nullptr;
 }
 
+std::string CDBWrapper::GetProperty(const std::string& name) const
+{
+    std::string value;
+    if (!pdb->GetProperty(name, &value)) {
+        return std::string();
+    }
+    return value;
+}
+
 bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
 {
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
@@ -226,4 +285,9 @@ const std::vector<unsigned char>& GetObfuscateKey(const CDBWrapper &w)
     return w.obfuscate_key;
 }
 
+int GetValueVersion(const CDBWrapper &w)
+{
+    return w.nValueVersion;
+}
+
 } // namespace dbwrapper_private
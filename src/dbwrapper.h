@@ -13,6 +13,9 @@
 #include <utilstrencodings.h>
 #include <version.h>
 
+#include <algorithm>
+#include <memory>
+
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
@@ -27,6 +30,36 @@ public:
     explicit dbwrapper_error(const std::string& msg) : std::runtime_error(msg) {}
 };
 
+/** Databases which can be tuned separately by a -dbprofile */
+enum class DBKind {
+    CHAINSTATE,  //!< chainstate/
+    BLOCK_INDEX, //!< blocks/index/, which also holds the txindex
+};
+
+/** LevelDB tuning of one database */
+struct DBOptions {
+    //! Number of table files kept open (each one a file descriptor)
+    int max_open_files;
+    //! Approximate size of the data blocks read from a table file at a time
+    size_t block_size;
+    //! Size of the table files written; larger files mean fewer files and compactions
+    size_t max_file_size;
+    //! Share of the cache in percent for the write buffer, of which up to two
+    //! may be held at once; the rest is the block cache. A larger buffer makes
+    //! level-0 compactions less frequent.
+    int write_buffer_percent;
+    //! Bits per key of the bloom filter (0 for none)
+    int filter_bits;
+};
+
+static const DBOptions DEFAULT_DB_OPTIONS = {64, 4 << 10, 2 << 20, 25, 10};
+static const char* const DEFAULT_DB_PROFILE = "default";
+
+/** Look up the options of a -dbprofile for one database. Returns false if the profile is unknown. */
+bool GetDBProfile(const std::string& strProfile, DBKind kind, DBOptions& dboptions);
+/** Comma-separated names of the -dbprofile values */
+std::string ListDBProfiles();
+
 class CDBWrapper;
 
 /** These should be considered an implementation detail of the specific database.
@@ -45,6 +78,9 @@ void HandleError(const leveldb::Status& status);
 //获取数据库模糊秘钥
 const std::vector<unsigned char>& GetObfuscateKey(const CDBWrapper &w);
 
+/** Serialization version of the values of a CDBWrapper, see CDBWrapper::SetValueVersion. */
+int GetValueVersion(const CDBWrapper &w);
+
 };
 
 //批量更新接口封装(一个批量更新队列)
@@ -66,7 +102,12 @@ public:
     /**
      * @param[in] _parent   CDBWrapper that this batch is to be submitted to
      */
-    explicit CDBBatch(const CDBWrapper &_parent) : parent(_parent), ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION), size_estimate(0) { };
+    explicit CDBBatch(const CDBWrapper &_parent) : parent(_parent), ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, dbwrapper_private::GetValueVersion(_parent)), size_estimate(0) { };
+    /**
+     * @param[in] _parent        CDBWrapper that this batch is to be submitted to
+     * @param[in] nValueVersion  Serialization version of the values, instead of the parent's
+     */
+    CDBBatch(const CDBWrapper &_parent, int nValueVersion) : parent(_parent), ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, nValueVersion), size_estimate(0) { };
 
     void Clear()
     {
@@ -171,7 +212,7 @@ public:
     template<typename V> bool GetValue(V& value) {
         leveldb::Slice slValue = piter->value();
         try {
-            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, dbwrapper_private::GetValueVersion(parent));
             ssValue.Xor(dbwrapper_private::GetObfuscateKey(parent));
             ssValue >> value;
         } catch (const std::exception&) {
@@ -191,6 +232,7 @@ class CDBWrapper
 {
     //友元函数
     friend const std::vector<unsigned char>& dbwrapper_private::GetObfuscateKey(const CDBWrapper &w);
+    friend int dbwrapper_private::GetValueVersion(const CDBWrapper &w);
 private:
     //! custom environment this database is using (may be nullptr in case of default environment)
     leveldb::Env* penv;
@@ -215,6 +257,10 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
+    //! the tuning the database was opened with
+    DBOptions dboptions;
+    size_t nBlockCacheSize;
+
     //! a key used for optional XOR-obfuscation of the database
     //可选的数据库异或模糊秘钥
     std::vector<unsigned char> obfuscate_key;
@@ -223,6 +269,9 @@ private:
     //模糊秘钥存储在leveldb使用的key
     static const std::string OBFUSCATE_KEY_KEY;
 
+    //! the serialization version of the values (the keys always use CLIENT_VERSION)
+    int nValueVersion;
+
     //! the length of the obfuscate key in number of bytes
     //模糊秘钥的长度
     static const unsigned int OBFUSCATE_KEY_NUM_BYTES;
@@ -238,6 +287,7 @@ public:
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
+     * @param[in] dboptions   LevelDB tuning, see GetDBProfile().
      */
     /**
      * @brief CDBWrapper
@@ -247,9 +297,16 @@ public:
      * @param fWipe         是否清空存在的数据
      * @param obfuscate     如果使能，将用模糊秘钥进行异或算法，否则使用0的字节码进行异或算法
      */
-    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, const DBOptions& dboptions = DEFAULT_DB_OPTIONS);
     ~CDBWrapper();
 
+    /**
+     * Serialize the values read and written from now on with nVersion instead
+     * of CLIENT_VERSION, e.g. with flags for a newer format of the database.
+     */
+    void SetValueVersion(int nVersion) { nValueVersion = nVersion; }
+    int GetValueVersion() const { return nValueVersion; }
+
     template <typename K, typename V>
     bool Read(const K& key, V& value) const
     {
@@ -268,8 +325,9 @@ public:
             dbwrapper_private::HandleError(status);
         }
         try {
-            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
-            ssValue.Xor(obfuscate_key);
+            // The value is ours, so it is deobfuscated where it is and read without a copy
+            XorWithKey((unsigned char*)&strValue[0], strValue.size(), obfuscate_key);
+            CSpanReader ssValue(SER_DISK, nValueVersion, (const unsigned char*)strValue.data(), strValue.size());
             ssValue >> value;
         } catch (const std::exception&) {
             return false;
@@ -277,6 +335,63 @@ public:
         return true;
     }
 
+    /**
+     * Read the values of many keys at once. The keys are looked up in the
+     * database's order through a single iterator, which reads a consistent
+     * snapshot and only seeks when the next key is not already under it, and
+     * the serialization buffers are reused. values and vfFound are resized to
+     * keys.size(); values[i] is only meaningful when vfFound[i] is set.
+     * Returns the number of keys found.
+     */
+    template <typename K, typename V>
+    size_t ReadMany(const std::vector<K>& keys, std::vector<V>& values, std::vector<bool>& vfFound) const
+    {
+        values.resize(keys.size());
+        vfFound.assign(keys.size(), false);
+
+        std::vector<std::pair<std::string, size_t>> vSerialized;
+        vSerialized.reserve(keys.size());
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        for (size_t i = 0; i < keys.size(); i++) {
+            ssKey.clear();
+            ssKey << keys[i];
+            vSerialized.emplace_back(ssKey.str(), i);
+        }
+        std::sort(vSerialized.begin(), vSerialized.end());
+
+        size_t nFound = 0;
+        CDataStream ssValue(SER_DISK, nValueVersion);
+        std::unique_ptr<leveldb::Iterator> piter(pdb->NewIterator(readoptions));
+        for (const auto& entry : vSerialized) {
+            leveldb::Slice slKey(entry.first);
+            // The iterator is at the first key not below the previous one, so
+            // it is also at the first key not below this one unless it is smaller.
+            if (!piter->Valid() || piter->key().compare(slKey) < 0) {
+                piter->Seek(slKey);
+            }
+            if (!piter->Valid()) {
+                if (!piter->status().ok()) {
+                    LogPrintf("LevelDB read failure: %s\n", piter->status().ToString());
+                    dbwrapper_private::HandleError(piter->status());
+                }
+                break;
+            }
+            if (piter->key() != slKey) continue;
+            try {
+                leveldb::Slice slValue = piter->value();
+                ssValue.clear();
+                ssValue.write(slValue.data(), slValue.size());
+                ssValue.Xor(obfuscate_key);
+                ssValue >> values[entry.second];
+            } catch (const std::exception&) {
+                continue;
+            }
+            vfFound[entry.second] = true;
+            nFound++;
+        }
+        return nFound;
+    }
+
     template <typename K, typename V>
     bool Write(const K& key, const V& value, bool fSync = false)
     {
@@ -343,6 +458,13 @@ public:
      */
     bool IsEmpty();
 
+    const DBOptions& GetDBOptions() const { return dboptions; }
+    size_t GetBlockCacheSize() const { return nBlockCacheSize; }
+    size_t GetWriteBufferSize() const { return options.write_buffer_size; }
+
+    //! Value of a LevelDB property such as "leveldb.stats", or an empty string if unknown
+    std::string GetProperty(const std::string& name) const;
+
     template<typename K>
     size_t EstimateSize(const K& key_begin, const K& key_end) const
     {
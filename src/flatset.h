@@ -0,0 +1,77 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_FLATSET_H
+#define BITCOIN_FLATSET_H
+
+#include <prevector.h>
+
+#include <algorithm>
+#include <utility>
+
+/* Set kept as a sorted prevector.
+ *
+ * Holds up to N elements without a separate allocation, and larger sets in a
+ * single allocation rather than one tree node per element. Lookups are binary
+ * searches; insert and erase move the elements after the position, so it is
+ * meant for the small sets that are common in practice. As for prevector, T
+ * must be movable by memmove(). Inserting or erasing invalidates iterators.
+ */
+template <unsigned int N, typename T, typename Compare = std::less<T> >
+class flatset {
+private:
+    typedef prevector<N, T> base;
+    base v;
+
+public:
+    typedef typename base::const_iterator iterator;
+    typedef typename base::const_iterator const_iterator;
+    typedef typename base::size_type size_type;
+    typedef T value_type;
+
+    std::pair<const_iterator, bool> insert(const T& value)
+    {
+        typename base::iterator it = std::lower_bound(v.begin(), v.end(), value, Compare());
+        if (it != v.end() && !Compare()(value, *it)) {
+            return std::make_pair(const_iterator(it), false);
+        }
+        return std::make_pair(const_iterator(v.insert(it, value)), true);
+    }
+
+    size_type erase(const T& value)
+    {
+        typename base::iterator it = std::lower_bound(v.begin(), v.end(), value, Compare());
+        if (it == v.end() || Compare()(value, *it)) {
+            return 0;
+        }
+        v.erase(it);
+        return 1;
+    }
+
+    const_iterator find(const T& value) const
+    {
+        const_iterator it = std::lower_bound(v.begin(), v.end(), value, Compare());
+        return (it != v.end() && !Compare()(value, *it)) ? it : v.end();
+    }
+
+    size_type count(const T& value) const { return find(value) != v.end() ? 1 : 0; }
+
+    bool empty() const              { return v.empty(); }
+    size_type size() const          { return v.size(); }
+    void clear()                    { v.clear(); }
+    const_iterator begin() const    { return v.begin(); }
+    const_iterator end() const      { return v.end(); }
+    size_t allocated_memory() const { return v.allocated_memory(); }
+
+    /** Whether this holds the same elements as another sorted container with the same ordering */
+    template <typename C>
+    bool equals(const C& other) const
+    {
+        return size() == other.size() && std::equal(begin(), end(), other.begin(), [](const T& a, const T& b) {
+            return !Compare()(a, b) && !Compare()(b, a);
+        });
+    }
+};
+
+#endif // BITCOIN_FLATSET_H
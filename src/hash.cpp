@@ -245,3 +245,48 @@ uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint3
     SIPROUND;
     return v0 ^ v1 ^ v2 ^ v3;
 }
+
+#define SIPROUND_LANES do { \
+    for (size_t l = 0; l < SIPHASH_LANES; l++) { \
+        v0[l] += v1[l]; v1[l] = ROTL(v1[l], 13); v1[l] ^= v0[l]; \
+        v0[l] = ROTL(v0[l], 32); \
+        v2[l] += v3[l]; v3[l] = ROTL(v3[l], 16); v3[l] ^= v2[l]; \
+        v0[l] += v3[l]; v3[l] = ROTL(v3[l], 21); v3[l] ^= v0[l]; \
+        v2[l] += v1[l]; v1[l] = ROTL(v1[l], 17); v1[l] ^= v2[l]; \
+        v2[l] = ROTL(v2[l], 32); \
+    } \
+} while (0)
+
+void SipHashUint256Lanes(uint64_t k0, uint64_t k1, const uint256* const vals[SIPHASH_LANES], uint64_t out[SIPHASH_LANES])
+{
+    /* Same as SipHashUint256, one lane per value */
+    uint64_t v0[SIPHASH_LANES], v1[SIPHASH_LANES], v2[SIPHASH_LANES], v3[SIPHASH_LANES], d[SIPHASH_LANES];
+    for (size_t l = 0; l < SIPHASH_LANES; l++) {
+        d[l] = vals[l]->GetUint64(0);
+        v0[l] = 0x736f6d6570736575ULL ^ k0;
+        v1[l] = 0x646f72616e646f6dULL ^ k1;
+        v2[l] = 0x6c7967656e657261ULL ^ k0;
+        v3[l] = 0x7465646279746573ULL ^ k1 ^ d[l];
+    }
+    for (int w = 1; w <= 4; w++) {
+        SIPROUND_LANES;
+        SIPROUND_LANES;
+        for (size_t l = 0; l < SIPHASH_LANES; l++) {
+            v0[l] ^= d[l];
+            d[l] = w < 4 ? vals[l]->GetUint64(w) : ((uint64_t)4) << 59;
+            v3[l] ^= d[l];
+        }
+    }
+    SIPROUND_LANES;
+    SIPROUND_LANES;
+    for (size_t l = 0; l < SIPHASH_LANES; l++) {
+        v0[l] ^= d[l];
+        v2[l] ^= 0xFF;
+    }
+    SIPROUND_LANES;
+    SIPROUND_LANES;
+    SIPROUND_LANES;
+    SIPROUND_LANES;
+    for (size_t l = 0; l < SIPHASH_LANES; l++)
+        out[l] = v0[l] ^ v1[l] ^ v2[l] ^ v3[l];
+}
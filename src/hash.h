@@ -195,6 +195,31 @@ public:
     }
 };
 
+/** Writes data to an underlying stream, while hashing the written data. */
+template<typename Source>
+class CHashedSourceWriter : public CHashWriter
+{
+private:
+    Source* source;
+
+public:
+    explicit CHashedSourceWriter(Source* source_) : CHashWriter(source_->GetType(), source_->GetVersion()), source(source_) {}
+
+    void write(const char* pch, size_t nSize)
+    {
+        source->write(pch, nSize);
+        CHashWriter::write(pch, nSize);
+    }
+
+    template<typename T>
+    CHashedSourceWriter<Source>& operator<<(const T& obj)
+    {
+        // Serialize to this stream
+        ::Serialize(*this, obj);
+        return (*this);
+    }
+};
+
 /** Compute the 256-bit hash of an object's serialization. */
 //计算对象的hash值
 template<typename T>
@@ -245,4 +270,10 @@ public:
 uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
 uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra);
 
+/** Number of values hashed together by SipHashUint256Lanes */
+static const size_t SIPHASH_LANES = 4;
+/** SipHashUint256 of several values at once. The lanes are computed in lockstep
+ *  so their rounds are independent of each other and can execute in parallel. */
+void SipHashUint256Lanes(uint64_t k0, uint64_t k1, const uint256* const vals[SIPHASH_LANES], uint64_t out[SIPHASH_LANES]);
+
 #endif // BITCOIN_HASH_H
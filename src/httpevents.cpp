@@ -0,0 +1,239 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <httprpc.h>
+#include <httpserver.h>
+#include <netaddress.h>
+#include <policy/policy.h>
+#include <primitives/block.h>
+#include <primitives/transaction.h>
+#include <rpc/protocol.h>
+#include <threadinterrupt.h>
+#include <util.h>
+#include <validationinterface.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <univalue.h>
+
+/** Most clients following the event stream at once */
+static const size_t MAX_HTTP_EVENT_CLIENTS = 64;
+/** Seconds between the comments that keep idle streams open */
+static const int HTTP_EVENT_KEEPALIVE_INTERVAL = 15;
+
+enum HTTPEventKind {
+    EVENT_BLOCK = 1,
+    EVENT_BLOCKDISCONNECTED = 2,
+    EVENT_TX = 4,
+    EVENT_TXREMOVED = 8,
+    EVENT_ALL = 15,
+};
+
+static const struct {
+    HTTPEventKind kind;
+    const char* name;
+} event_names[] = {
+    {EVENT_BLOCK, "block"},
+    {EVENT_BLOCKDISCONNECTED, "blockdisconnected"},
+    {EVENT_TX, "tx"},
+    {EVENT_TXREMOVED, "txremoved"},
+};
+
+/**
+ * Sends validation events to the clients of /events as Server-Sent Events.
+ * Every event is serialized once, and the same buffer is queued on the
+ * connection of every client that follows it. A client that falls more than
+ * MAX_CHUNKED_REPLY_PENDING bytes behind has its stream ended, rather than
+ * holding up the others or missing events silently; the id of the events
+ * lets it tell where to resume from.
+ */
+class HTTPEventPublisher final : public CValidationInterface
+{
+private:
+    struct Client
+    {
+        std::unique_ptr<HTTPRequest> req;
+        int nEvents;
+        std::string strPeer;
+    };
+
+    std::mutex cs;
+    std::vector<Client> vClients;
+    uint64_t nLastId = 0;
+    bool fStopped = false;
+
+    CThreadInterrupt interrupt;
+    std::thread threadKeepAlive;
+
+    //! Queue data on the clients that follow events of kind nEvents, and end the streams of those that cannot take it
+    void Send(int nEvents, const std::shared_ptr<const std::string>& data)
+    {
+        for (auto it = vClients.begin(); it != vClients.end(); ) {
+            if (!(it->nEvents & nEvents)) {
+                ++it;
+            } else if (!it->req->WriteReplyChunk(data, false)) {
+                LogPrint(BCLog::HTTP, "Ending the event stream of %s, which went away or fell behind\n", it->strPeer);
+                it->req->EndChunkedReply();
+                it = vClients.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void Publish(HTTPEventKind kind, const char* name, const UniValue& data)
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        nLastId++;
+        bool fFollowed = false;
+        for (const Client& client : vClients) {
+            fFollowed |= (client.nEvents & kind) != 0;
+        }
+        if (!fFollowed)
+            return;
+        Send(kind, std::make_shared<const std::string>(strprintf("id: %u\nevent: %s\ndata: %s\n\n", nLastId, name, data.write())));
+    }
+
+    void ThreadKeepAlive()
+    {
+        const auto comment = std::make_shared<const std::string>(":\n\n");
+        while (interrupt.sleep_for(std::chrono::seconds(HTTP_EVENT_KEEPALIVE_INTERVAL))) {
+            std::lock_guard<std::mutex> lock(cs);
+            Send(EVENT_ALL, comment);
+        }
+    }
+
+protected:
+    void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted) override
+    {
+        UniValue data(UniValue::VOBJ);
+        data.pushKV("hash", pindex->GetBlockHash().GetHex());
+        data.pushKV("height", pindex->nHeight);
+        data.pushKV("prev", block->hashPrevBlock.GetHex());
+        data.pushKV("txs", (int64_t)block->vtx.size());
+        Publish(EVENT_BLOCK, "block", data);
+    }
+
+    void BlockDisconnected(const std::shared_ptr<const CBlock>& block) override
+    {
+        UniValue data(UniValue::VOBJ);
+        data.pushKV("hash", block->GetHash().GetHex());
+        data.pushKV("prev", block->hashPrevBlock.GetHex());
+        Publish(EVENT_BLOCKDISCONNECTED, "blockdisconnected", data);
+    }
+
+    void TransactionAddedToMempool(const CTransactionRef& ptx) override
+    {
+        UniValue data(UniValue::VOBJ);
+        data.pushKV("txid", ptx->GetHash().GetHex());
+        data.pushKV("wtxid", ptx->GetWitnessHash().GetHex());
+        data.pushKV("vsize", GetVirtualTransactionSize(*ptx));
+        Publish(EVENT_TX, "tx", data);
+    }
+
+    void TransactionRemovedFromMempool(const CTransactionRef& ptx) override
+    {
+        UniValue data(UniValue::VOBJ);
+        data.pushKV("txid", ptx->GetHash().GetHex());
+        Publish(EVENT_TXREMOVED, "txremoved", data);
+    }
+
+public:
+    HTTPEventPublisher()
+    {
+        threadKeepAlive = std::thread(&TraceThread<std::function<void()>>, "httpevents", std::function<void()>(std::bind(&HTTPEventPublisher::ThreadKeepAlive, this)));
+    }
+
+    /** Start the event stream of a request; false if there are too many clients already */
+    bool Subscribe(HTTPRequest* req, int nEvents)
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (fStopped || vClients.size() >= MAX_HTTP_EVENT_CLIENTS)
+            return false;
+        std::string strPeer = req->GetPeer().ToString();
+        req->WriteHeader("Content-Type", "text/event-stream");
+        req->WriteHeader("Cache-Control", "no-cache");
+        req->StartChunkedReply(HTTP_OK);
+        // Show the stream is open before the first event
+        req->WriteReplyChunk(":\n\n");
+        vClients.push_back(Client{req->Detach(), nEvents, strPeer});
+        return true;
+    }
+
+    /** End all streams */
+    void Stop()
+    {
+        interrupt();
+        if (threadKeepAlive.joinable())
+            threadKeepAlive.join();
+        std::lock_guard<std::mutex> lock(cs);
+        fStopped = true;
+        for (Client& client : vClients) {
+            client.req->EndChunkedReply();
+        }
+        vClients.clear();
+    }
+};
+
+static std::unique_ptr<HTTPEventPublisher> g_http_event_publisher;
+
+static bool http_events_handler(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET) {
+        req->WriteReply(HTTP_BAD_METHOD, "Only GET is allowed");
+        return false;
+    }
+
+    int nEvents = EVENT_ALL;
+    if (!strURIPart.empty()) {
+        if (strURIPart.compare(0, 8, "?events=") != 0) {
+            req->WriteReply(HTTP_BAD_REQUEST, "Invalid query, use ?events=<kind>,...");
+            return false;
+        }
+        nEvents = 0;
+        std::vector<std::string> vNames;
+        boost::split(vNames, strURIPart.substr(8), boost::is_any_of(","));
+        for (const std::string& strName : vNames) {
+            int nKind = 0;
+            for (const auto& event_name : event_names) {
+                if (strName == event_name.name)
+                    nKind = event_name.kind;
+            }
+            if (!nKind) {
+                req->WriteReply(HTTP_BAD_REQUEST, "Unknown event kind " + strName);
+                return false;
+            }
+            nEvents |= nKind;
+        }
+    }
+
+    if (!g_http_event_publisher->Subscribe(req, nEvents)) {
+        req->WriteReply(HTTP_SERVICE_UNAVAILABLE, "Too many event stream clients, or shutting down");
+        return false;
+    }
+    return true;
+}
+
+bool StartHTTPEvents()
+{
+    g_http_event_publisher.reset(new HTTPEventPublisher());
+    RegisterValidationInterface(g_http_event_publisher.get(), true);
+    RegisterHTTPHandler("/events", false, http_events_handler);
+    return true;
+}
+
+void StopHTTPEvents()
+{
+    if (!g_http_event_publisher)
+        return;
+    UnregisterHTTPHandler("/events", false);
+    UnregisterValidationInterface(g_http_event_publisher.get());
+    // Handlers may still be running; the publisher refuses them from now on
+    g_http_event_publisher->Stop();
+}
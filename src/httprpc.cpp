@@ -7,6 +7,7 @@
 #include <base58.h>
 #include <chainparams.h>
 #include <httpserver.h>
+#include <rpc/jsonwriter.h>
 #include <rpc/protocol.h>
 #include <rpc/server.h>
 #include <random.h>
@@ -14,15 +15,21 @@
 #include <util.h>
 #include <utilstrencodings.h>
 #include <ui_interface.h>
+#include <uint256.h>
 #include <crypto/hmac_sha256.h>
 #include <stdio.h>
 
+#include <map>
 #include <memory>
 
 #include <boost/algorithm/string.hpp> // boost::trim
 
 /** WWW-Authenticate to present with 401 Unauthorized response */
 static const char* WWW_AUTH_HEADER_DATA = "Basic realm=\"jsonrpc\"";
+/** Milliseconds a successful authentication is remembered for */
+static const int64_t RPC_AUTH_CACHE_TTL = 60 * 1000;
+/** Most authentications remembered at once */
+static const size_t MAX_RPC_AUTH_CACHE_SIZE = 256;
 
 /** Simple one-shot callback timer to be used by the RPC mechanism to e.g.
  * re-lock the wallet.
@@ -66,6 +73,45 @@ static std::string strRPCUserColonPass;
 /* Stored RPC timer interface (for unregistration) */
 static std::unique_ptr<HTTPRPCTimerInterface> httpRPCTimerInterface;
 
+/** Streams the result of a singleton request into the body of the HTTP reply.
+ * The body is only sent once the method has returned, so an error thrown
+ * half-way can still replace it.
+ */
+class HTTPRPCResultStream : public RPCResultStream
+{
+public:
+    explicit HTTPRPCResultStream(HTTPRequest* _req) : req(_req) {}
+
+    JSONStreamWriter& Begin() override
+    {
+        assert(!writer);
+        HTTPRequest* r = req;
+        writer.reset(new JSONStreamWriter([r](const std::string& s) { r->AppendReply(s); }));
+        writer->BeginObject();
+        writer->Key("result");
+        return *writer;
+    }
+
+    bool IsStarted() const { return writer != nullptr; }
+
+    /** Complete the reply object the same way JSONRPCReply would */
+    void Finish(const UniValue& id)
+    {
+        assert(writer);
+        writer->Key("error");
+        writer->Value(NullUniValue);
+        writer->Key("id");
+        writer->Value(id);
+        writer->EndObject();
+        writer->Flush();
+        req->AppendReply("\n");
+    }
+
+private:
+    HTTPRequest* req;
+    std::unique_ptr<JSONStreamWriter> writer;
+};
+
 static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const UniValue& id)
 {
     // Send error reply from json-rpc error object
@@ -79,10 +125,85 @@ static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const Uni
 
     std::string strReply = JSONRPCReply(NullUniValue, objError, id);
 
+    // Drop any partially streamed result
+    req->ClearReply();
     req->WriteHeader("Content-Type", "application/json");
     req->WriteReply(nStatus, strReply);
 }
 
+/**
+ * Remembers the Authorization headers that were accepted recently, so that
+ * clients making many calls do not have every one of them checked against
+ * each -rpcauth entry again. Headers are keyed by their HMAC under a random
+ * key, so that neither the credentials nor their plain hashes are kept, and
+ * lookups do not depend on them in a way an attacker could time. Only
+ * successes are remembered: a wrong password is always checked in full.
+ */
+class RPCAuthCache
+{
+private:
+    struct Entry
+    {
+        std::string strUser;
+        int64_t nExpiry;
+    };
+
+    CCriticalSection cs;
+    unsigned char key[32];
+    std::map<uint256, Entry> entries;
+
+    uint256 Digest(const std::string& strAuth) const
+    {
+        uint256 digest;
+        CHMAC_SHA256(key, sizeof(key)).Write(reinterpret_cast<const unsigned char*>(strAuth.data()), strAuth.size()).Finalize(digest.begin());
+        return digest;
+    }
+
+public:
+    RPCAuthCache() { GetStrongRandBytes(key, sizeof(key)); }
+
+    bool Lookup(const std::string& strAuth, std::string& strUserOut)
+    {
+        const uint256 digest = Digest(strAuth);
+        LOCK(cs);
+        auto it = entries.find(digest);
+        if (it == entries.end())
+            return false;
+        if (it->second.nExpiry < GetTimeMillis()) {
+            entries.erase(it);
+            return false;
+        }
+        strUserOut = it->second.strUser;
+        return true;
+    }
+
+    void Insert(const std::string& strAuth, const std::string& strUser)
+    {
+        const uint256 digest = Digest(strAuth);
+        const int64_t nNow = GetTimeMillis();
+        LOCK(cs);
+        if (entries.size() >= MAX_RPC_AUTH_CACHE_SIZE) {
+            for (auto it = entries.begin(); it != entries.end(); ) {
+                if (it->second.nExpiry < nNow)
+                    it = entries.erase(it);
+                else
+                    ++it;
+            }
+            if (entries.size() >= MAX_RPC_AUTH_CACHE_SIZE)
+                return;
+        }
+        entries[digest] = Entry{strUser, nNow + RPC_AUTH_CACHE_TTL};
+    }
+
+    void Clear()
+    {
+        LOCK(cs);
+        entries.clear();
+    }
+};
+
+static RPCAuthCache rpcAuthCache;
+
 //This function checks username and password against -rpcauth
 //entries from config file.
 static bool multiUserAuthorized(std::string strUserPass)
@@ -130,6 +251,8 @@ static bool RPCAuthorized(const std::string& strAuth, std::string& strAuthUserna
         return false;
     if (strAuth.substr(0, 6) != "Basic ")
         return false;
+    if (rpcAuthCache.Lookup(strAuth, strAuthUsernameOut))
+        return true;
     std::string strUserPass64 = strAuth.substr(6);
     boost::trim(strUserPass64);
     std::string strUserPass = DecodeBase64(strUserPass64);
@@ -138,10 +261,11 @@ static bool RPCAuthorized(const std::string& strAuth, std::string& strAuthUserna
         strAuthUsernameOut = strUserPass.substr(0, strUserPass.find(':'));
 
     //Check if authorized under single-user field
-    if (TimingResistantEqual(strUserPass, strRPCUserColonPass)) {
+    if (TimingResistantEqual(strUserPass, strRPCUserColonPass) || multiUserAuthorized(strUserPass)) {
+        rpcAuthCache.Insert(strAuth, strAuthUsernameOut);
         return true;
     }
-    return multiUserAuthorized(strUserPass);
+    return false;
 }
 
 static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
@@ -187,10 +311,15 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
+            HTTPRPCResultStream stream(req);
+            jreq.resultStream = &stream;
             UniValue result = tableRPC.execute(jreq);
 
             // Send reply
-            strReply = JSONRPCReply(result, NullUniValue, jreq.id);
+            if (stream.IsStarted())
+                stream.Finish(jreq.id);
+            else
+                strReply = JSONRPCReply(result, NullUniValue, jreq.id);
 
         // array of requests
         } else if (valRequest.isArray())
@@ -254,6 +383,7 @@ void StopHTTPRPC()
 {
     LogPrint(BCLog::RPC, "Stopping HTTP RPC server\n");
     UnregisterHTTPHandler("/", true);
+    rpcAuthCache.Clear();
     if (httpRPCTimerInterface) {
         RPCUnsetTimerInterface(httpRPCTimerInterface.get());
         httpRPCTimerInterface.reset();
@@ -20,6 +20,9 @@ void InterruptHTTPRPC();
  */
 void StopHTTPRPC();
 
+/** Default for -restmaxoutpoints, the most outpoints a batched getutxos request may query */
+static const int DEFAULT_REST_MAX_OUTPOINTS = 1000;
+
 /** Start HTTP REST subsystem.
  * Precondition; HTTP and RPC has been started.
  */
@@ -32,4 +35,16 @@ void InterruptREST();
  */
 void StopREST();
 
+/** Default for -httpevents */
+static const bool DEFAULT_HTTP_EVENTS = false;
+
+/** Start the stream of validation events at /events.
+ * Precondition; HTTP has been started, and validation signals set up.
+ */
+bool StartHTTPEvents();
+/** End the event streams, and stop following validation events.
+ * Precondition; HTTP has not been stopped yet.
+ */
+void StopHTTPEvents();
+
 #endif
@@ -6,6 +6,8 @@
 
 #include <chainparamsbase.h>
 #include <compat.h>
+#include <httpworkqueue.h>
+#include <metrics.h>
 #include <util.h>
 #include <utilstrencodings.h>
 #include <netbase.h>
@@ -13,7 +15,13 @@
 #include <sync.h>
 #include <ui_interface.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -61,67 +69,6 @@ private:
     HTTPRequestHandler func;
 };
 
-/** Simple work queue for distributing work over multiple threads.
- * Work items are simply callable objects.
- */
-template <typename WorkItem>
-class WorkQueue
-{
-private:
-    /** Mutex protects entire object */
-    std::mutex cs;
-    std::condition_variable cond;
-    std::deque<std::unique_ptr<WorkItem>> queue;
-    bool running;
-    size_t maxDepth;
-
-public:
-    explicit WorkQueue(size_t _maxDepth) : running(true),
-                                 maxDepth(_maxDepth)
-    {
-    }
-    /** Precondition: worker threads have all stopped (they have been joined).
-     */
-    ~WorkQueue()
-    {
-    }
-    /** Enqueue a work item */
-    bool Enqueue(WorkItem* item)
-    {
-        std::unique_lock<std::mutex> lock(cs);
-        if (queue.size() >= maxDepth) {
-            return false;
-        }
-        queue.emplace_back(std::unique_ptr<WorkItem>(item));
-        cond.notify_one();
-        return true;
-    }
-    /** Thread function */
-    void Run()
-    {
-        while (true) {
-            std::unique_ptr<WorkItem> i;
-            {
-                std::unique_lock<std::mutex> lock(cs);
-                while (running && queue.empty())
-                    cond.wait(lock);
-                if (!running)
-                    break;
-                i = std::move(queue.front());
-                queue.pop_front();
-            }
-            (*i)();
-        }
-    }
-    /** Interrupt and exit loops */
-    void Interrupt()
-    {
-        std::unique_lock<std::mutex> lock(cs);
-        running = false;
-        cond.notify_all();
-    }
-};
-
 struct HTTPPathHandler
 {
     HTTPPathHandler() {}
@@ -148,6 +95,46 @@ static WorkQueue<HTTPClosure>* workQueue = nullptr;
 std::vector<HTTPPathHandler> pathHandlers;
 //! Bound listening sockets
 std::vector<evhttp_bound_socket *> boundSockets;
+//! Open connections that sent a request; only used by the event loop thread
+static std::set<evhttp_connection*> g_http_connections;
+//! Counters for connection reuse, read by GetHTTPServerStats
+static std::atomic<uint64_t> g_http_connections_total{0};
+static std::atomic<size_t> g_http_connections_open{0};
+static std::atomic<uint64_t> g_http_requests_total{0};
+//! Seconds of inactivity after which libevent closes a connection
+static int g_http_server_timeout = DEFAULT_HTTP_SERVER_TIMEOUT;
+
+/**
+ * Progress of a chunked reply. The worker thread producing the reply waits
+ * on cond while too much of it is pending; the event loop thread lowers
+ * nBuffered as the output buffer of the connection drains, and sets fClosed
+ * when the connection goes away.
+ */
+class HTTPChunkedReply
+{
+public:
+    std::mutex cs;
+    std::condition_variable cond;
+    //! Bytes handed to the event loop thread, not yet in the output buffer
+    size_t nQueued = 0;
+    //! Bytes in the output buffer of the connection
+    size_t nBuffered = 0;
+    bool fClosed = false;
+
+    //! Only used by the event loop thread
+    evhttp_connection* conn = nullptr;
+    evbuffer_cb_entry* cbEntry = nullptr;
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fClosed = true;
+        cond.notify_all();
+    }
+};
+
+//! Chunked replies in progress, by connection; only used by the event loop thread
+static std::map<evhttp_connection*, std::shared_ptr<HTTPChunkedReply>> g_http_chunked_replies;
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -209,9 +196,53 @@ static std::string RequestMethodString(HTTPRequest::RequestMethod m)
     }
 }
 
+/** Output buffer callback of a connection with a chunked reply in progress */
+static void http_chunked_output_cb(struct evbuffer* buffer, const struct evbuffer_cb_info* info, void* arg)
+{
+    HTTPChunkedReply* chunked = static_cast<HTTPChunkedReply*>(arg);
+    std::lock_guard<std::mutex> lock(chunked->cs);
+    chunked->nBuffered = evbuffer_get_length(buffer);
+    chunked->cond.notify_all();
+}
+
+/** Stop following a chunked reply, and let its producer go on. Event loop thread only. */
+static void StopChunkedReply(const std::shared_ptr<HTTPChunkedReply>& chunked, bool fConnectionAlive)
+{
+    if (chunked->cbEntry && fConnectionAlive) {
+        bufferevent* bev = evhttp_connection_get_bufferevent(chunked->conn);
+        evbuffer_remove_cb_entry(bufferevent_get_output(bev), chunked->cbEntry);
+    }
+    chunked->cbEntry = nullptr;
+    auto it = g_http_chunked_replies.find(chunked->conn);
+    if (it != g_http_chunked_replies.end() && it->second == chunked)
+        g_http_chunked_replies.erase(it);
+    chunked->Close();
+}
+
+/** Connection close callback, to keep track of open connections */
+static void http_connection_close_cb(struct evhttp_connection* conn, void* arg)
+{
+    g_http_connections.erase(conn);
+    g_http_connections_open = g_http_connections.size();
+
+    auto it = g_http_chunked_replies.find(conn);
+    if (it != g_http_chunked_replies.end())
+        StopChunkedReply(it->second, true);
+}
+
 /** HTTP request callback */
 static void http_request_cb(struct evhttp_request* req, void* arg)
 {
+    // Count requests per connection, to show whether clients reuse them
+    g_http_requests_total++;
+    if (evhttp_connection* conn = evhttp_request_get_connection(req)) {
+        if (g_http_connections.insert(conn).second) {
+            evhttp_connection_set_closecb(conn, http_connection_close_cb, nullptr);
+            g_http_connections_total++;
+            g_http_connections_open = g_http_connections.size();
+        }
+    }
+
     // Disable reading to work around a libevent bug, fixed in 2.2.0.
     if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
         evhttp_connection* conn = evhttp_request_get_connection(req);
@@ -258,9 +289,11 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
 
     // Dispatch to worker thread
     if (i != iend) {
+        // Requests are queued per connection, for -rpcfairqueue
+        const std::string client = hreq->GetPeer().ToString();
         std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(std::move(hreq), path, i->handler));
         assert(workQueue);
-        if (workQueue->Enqueue(item.get()))
+        if (workQueue->Enqueue(item.get(), client))
             item.release(); /* if true, queue took ownership */
         else {
             LogPrintf("WARNING: request rejected because http work queue depth exceeded, it can be increased with the -rpcworkqueue= setting\n");
@@ -347,6 +380,20 @@ static void libevent_log_cb(int severity, const char *msg)
         LogPrint(BCLog::LIBEVENT, "libevent: %s\n", msg);
 }
 
+/** Serve the metrics for scraping. They are read without authentication, like
+ * the REST interface, so only clients allowed by -rpcallowip get to them.
+ */
+static bool HTTPReq_Metrics(HTTPRequest* req, const std::string&)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET) {
+        req->WriteReply(HTTP_BAD_METHOD, "Only GET requests are supported");
+        return false;
+    }
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+    req->WriteReply(HTTP_OK, RenderMetrics());
+    return true;
+}
+
 bool InitHTTPServer()
 {
     if (!InitHTTPAllowList())
@@ -384,7 +431,8 @@ bool InitHTTPServer()
         return false;
     }
 
-    evhttp_set_timeout(http, gArgs.GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
+    g_http_server_timeout = gArgs.GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT);
+    evhttp_set_timeout(http, g_http_server_timeout);
     evhttp_set_max_headers_size(http, MAX_HEADERS_SIZE);
     evhttp_set_max_body_size(http, MAX_SIZE);
     evhttp_set_gencb(http, http_request_cb, nullptr);
@@ -398,10 +446,17 @@ bool InitHTTPServer()
     int workQueueDepth = std::max((long)gArgs.GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
     LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
 
-    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
+    const bool fFairQueue = gArgs.GetBoolArg("-rpcfairqueue", DEFAULT_HTTP_FAIR_QUEUE);
+    if (fFairQueue)
+        LogPrintf("HTTP: serving connections with waiting requests in turn\n");
+
+    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth, fFairQueue);
     // transfer ownership to eventBase/HTTP via .release()
     eventBase = base_ctr.release();
     eventHTTP = http_ctr.release();
+
+    if (gArgs.GetBoolArg("-metrics", DEFAULT_HTTP_METRICS))
+        RegisterHTTPHandler("/metrics", true, HTTPReq_Metrics);
     return true;
 }
 
@@ -438,6 +493,17 @@ bool StartHTTPServer()
     return true;
 }
 
+bool GetHTTPServerStats(HTTPServerStats& stats)
+{
+    if (!workQueue)
+        return false;
+    workQueue->GetStats(stats);
+    stats.nConnections = g_http_connections_total;
+    stats.nConnectionsOpen = g_http_connections_open;
+    stats.nRequests = g_http_requests_total;
+    return true;
+}
+
 void InterruptHTTPServer()
 {
     LogPrint(BCLog::HTTP, "Interrupting HTTP server\n");
@@ -456,6 +522,7 @@ void InterruptHTTPServer()
 void StopHTTPServer()
 {
     LogPrint(BCLog::HTTP, "Stopping HTTP server\n");
+    UnregisterHTTPHandler("/metrics", true);
     if (workQueue) {
         LogPrint(BCLog::HTTP, "Waiting for HTTP worker threads to exit\n");
         for (auto& thread: g_thread_http_workers) {
@@ -529,7 +596,11 @@ HTTPRequest::HTTPRequest(struct evhttp_request* _req) : req(_req),
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (!replySent && chunked) {
+        // The status was sent already; cut the reply short
+        LogPrintf("%s: Unfinished chunked reply\n", __func__);
+        EndChunkedReply();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -575,6 +646,22 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
     evhttp_add_header(headers, hdr.c_str(), value.c_str());
 }
 
+void HTTPRequest::AppendReply(const std::string& strData)
+{
+    assert(!replySent && req && !chunked);
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    evbuffer_add(evb, strData.data(), strData.size());
+}
+
+void HTTPRequest::ClearReply()
+{
+    assert(!replySent && req && !chunked);
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    evbuffer_drain(evb, evbuffer_get_length(evb));
+}
+
 /** Closure sent to main thread to request a reply to be sent to
  * a HTTP request.
  * Replies must be sent in the main loop in the main http thread,
@@ -582,7 +669,7 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
  */
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
-    assert(!replySent && req);
+    assert(!replySent && req && !chunked);
     // Send event to main http thread to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
@@ -607,6 +694,131 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = nullptr; // transferred back to main thread
 }
 
+void HTTPRequest::StartChunkedReply(int nStatus)
+{
+    assert(!replySent && req && !chunked);
+    chunked = std::make_shared<HTTPChunkedReply>();
+    auto req_copy = req;
+    auto chunked_copy = chunked;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, chunked_copy, nStatus]{
+        evhttp_connection* conn = evhttp_request_get_connection(req_copy);
+        bufferevent* bev = conn ? evhttp_connection_get_bufferevent(conn) : nullptr;
+        if (!bev) {
+            chunked_copy->Close();
+            return;
+        }
+        evhttp_send_reply_start(req_copy, nStatus, nullptr);
+        // Follow the output buffer as it drains, for WriteReplyChunk to wait on
+        chunked_copy->conn = conn;
+        chunked_copy->cbEntry = evbuffer_add_cb(bufferevent_get_output(bev), http_chunked_output_cb, chunked_copy.get());
+        g_http_chunked_replies[conn] = chunked_copy;
+    });
+    ev->trigger(nullptr);
+}
+
+/** Wait, if fWait, until a chunk of nSize can be queued; false if the client went away, or it cannot be queued without waiting */
+bool HTTPRequest::QueueReplyChunk(size_t nSize, bool fWait)
+{
+    assert(!replySent && req && chunked);
+    std::unique_lock<std::mutex> lock(chunked->cs);
+    if (!fWait && chunked->nQueued + chunked->nBuffered > MAX_CHUNKED_REPLY_PENDING)
+        return false;
+    while (!chunked->fClosed && chunked->nQueued + chunked->nBuffered > MAX_CHUNKED_REPLY_PENDING) {
+        // libevent closes a connection that takes nothing for the server
+        // timeout, which wakes us up; this is only a fallback
+        size_t nPending = chunked->nQueued + chunked->nBuffered;
+        if (chunked->cond.wait_for(lock, std::chrono::seconds(2 * g_http_server_timeout)) == std::cv_status::timeout &&
+            chunked->nQueued + chunked->nBuffered >= nPending) {
+            chunked->fClosed = true;
+        }
+    }
+    if (chunked->fClosed)
+        return false;
+    chunked->nQueued += nSize;
+    return true;
+}
+
+/** Hand a filled chunk to the event loop thread, which only moves it into the output buffer */
+void HTTPRequest::SendReplyChunk(struct evbuffer* evb, size_t nSize)
+{
+    auto req_copy = req;
+    auto chunked_copy = chunked;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, chunked_copy, evb, nSize]{
+        {
+            std::lock_guard<std::mutex> lock(chunked_copy->cs);
+            chunked_copy->nQueued -= nSize;
+        }
+        if (chunked_copy->cbEntry && evhttp_request_get_connection(req_copy))
+            evhttp_send_reply_chunk(req_copy, evb);
+        else
+            chunked_copy->Close();
+        evbuffer_free(evb);
+    });
+    ev->trigger(nullptr);
+}
+
+bool HTTPRequest::WriteReplyChunk(const std::string& strData)
+{
+    if (!QueueReplyChunk(strData.size(), true))
+        return false;
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strData.data(), strData.size());
+    SendReplyChunk(evb, strData.size());
+    return true;
+}
+
+/** Release the reference a buffer held on shared chunk data */
+static void http_release_shared_chunk(const void* data, size_t datalen, void* extra)
+{
+    delete static_cast<std::shared_ptr<const std::string>*>(extra);
+}
+
+bool HTTPRequest::WriteReplyChunk(const std::shared_ptr<const std::string>& data, bool fWait)
+{
+    if (!QueueReplyChunk(data->size(), fWait))
+        return false;
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add_reference(evb, data->data(), data->size(), http_release_shared_chunk, new std::shared_ptr<const std::string>(data));
+    SendReplyChunk(evb, data->size());
+    return true;
+}
+
+std::unique_ptr<HTTPRequest> HTTPRequest::Detach()
+{
+    assert(!replySent && req);
+    std::unique_ptr<HTTPRequest> detached(new HTTPRequest(req));
+    detached->chunked = std::move(chunked);
+    req = nullptr;
+    replySent = true;
+    return detached;
+}
+
+void HTTPRequest::EndChunkedReply()
+{
+    assert(!replySent && req && chunked);
+    auto req_copy = req;
+    auto chunked_copy = chunked;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, chunked_copy]{
+        evhttp_connection* conn = evhttp_request_get_connection(req_copy);
+        StopChunkedReply(chunked_copy, conn != nullptr);
+        // Re-enable reading from the socket, as in WriteReply. This is done
+        // first, as ending the reply may free the connection.
+        if (conn && event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
+            bufferevent* bev = evhttp_connection_get_bufferevent(conn);
+            if (bev) {
+                bufferevent_enable(bev, EV_READ | EV_WRITE);
+            }
+        }
+        // Without a connection, this frees the request
+        evhttp_send_reply_end(req_copy);
+    });
+    ev->trigger(nullptr);
+    replySent = true;
+    req = nullptr; // transferred back to main thread
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
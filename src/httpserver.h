@@ -8,15 +8,23 @@
 #include <string>
 #include <stdint.h>
 #include <functional>
+#include <memory>
+#include <vector>
 
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+static const bool DEFAULT_HTTP_FAIR_QUEUE=false;
+static const bool DEFAULT_HTTP_METRICS=false;
+/** Bytes of a chunked reply that may be on their way to the client before the producer waits */
+static const size_t MAX_CHUNKED_REPLY_PENDING = 1024 * 1024;
 
+struct evbuffer;
 struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+class HTTPChunkedReply;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -46,6 +54,44 @@ void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPR
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
+/** Number of buckets of the HTTP timing histograms. Bucket i counts times
+ * below 2^i microseconds (and not counted by bucket i-1); the last bucket
+ * counts all longer times.
+ */
+static const int HTTP_HISTOGRAM_BUCKETS = 26;
+
+/** Statistics of the HTTP server and its work queue, since startup */
+struct HTTPServerStats
+{
+    //! Requests waiting in the work queue now
+    size_t nQueueDepth;
+    //! Maximum number of waiting requests (-rpcworkqueue)
+    size_t nQueueMaxDepth;
+    //! Highest number of waiting requests seen
+    size_t nQueuePeakDepth;
+    //! Connections with requests waiting in the work queue now
+    size_t nQueueClients;
+    //! Whether waiting requests are taken from connections in turn (-rpcfairqueue)
+    bool fFairQueue;
+    //! Requests handled by a worker thread
+    uint64_t nRequestsHandled;
+    //! Requests rejected because the work queue was full
+    uint64_t nRequestsRejected;
+    //! Connections accepted, and open now
+    uint64_t nConnections;
+    size_t nConnectionsOpen;
+    //! Requests received, on all connections
+    uint64_t nRequests;
+    //! Time requests waited in the queue, and took to handle, in microseconds
+    int64_t nWaitTotalMicros;
+    int64_t nHandleTotalMicros;
+    std::vector<uint64_t> vWaitHistogram;
+    std::vector<uint64_t> vHandleHistogram;
+};
+
+/** Get statistics of the HTTP server. Returns false if it is not running. */
+bool GetHTTPServerStats(HTTPServerStats& stats);
+
 /** Return evhttp event base. This can be used by submodules to
  * queue timers or custom events.
  */
@@ -59,6 +105,11 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    //! Progress of a reply started by StartChunkedReply, shared with the event loop thread
+    std::shared_ptr<HTTPChunkedReply> chunked;
+
+    bool QueueReplyChunk(size_t nSize, bool fWait);
+    void SendReplyChunk(struct evbuffer* evb, size_t nSize);
 
 public:
     explicit HTTPRequest(struct evhttp_request* req);
@@ -105,6 +156,15 @@ public:
      */
     void WriteHeader(const std::string& hdr, const std::string& value);
 
+    /**
+     * Append to the body of the reply, for replies produced piece by piece.
+     * The reply is sent by WriteReply, with strReply after what was appended.
+     */
+    void AppendReply(const std::string& strData);
+
+    /** Discard what was appended to the body of the reply. */
+    void ClearReply();
+
     /**
      * Write HTTP reply.
      * nStatus is the HTTP status code to send.
@@ -114,6 +174,43 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a reply whose body is sent piece by piece with chunked transfer
+     * encoding, for replies too large to be held in memory at once. Call this
+     * instead of WriteReply, after the headers are written.
+     */
+    void StartChunkedReply(int nStatus);
+
+    /**
+     * Send a piece of a chunked reply. Waits while more than
+     * MAX_CHUNKED_REPLY_PENDING bytes are still on their way to the client.
+     * Returns false if the client went away, in which case producing the
+     * rest of the reply can be skipped (but EndChunkedReply must be called).
+     */
+    bool WriteReplyChunk(const std::string& strData);
+
+    /**
+     * Send a piece of a chunked reply that is shared with other replies,
+     * without copying it. Without fWait, returns false instead of waiting
+     * when too much of the reply is pending, for producers that must not
+     * be held up by a slow client.
+     */
+    bool WriteReplyChunk(const std::shared_ptr<const std::string>& data, bool fWait);
+
+    /**
+     * Finish a chunked reply.
+     *
+     * @note As with WriteReply, do not call any other HTTPRequest methods after calling this.
+     */
+    void EndChunkedReply();
+
+    /**
+     * Move the request to a new object, for a chunked reply that goes on
+     * after the handler returns. Do not call any other methods of this one
+     * afterwards.
+     */
+    std::unique_ptr<HTTPRequest> Detach();
 };
 
 /** Event handler closure.
@@ -0,0 +1,257 @@
+// Copyright (c) 2015-2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_HTTPWORKQUEUE_H
+#define BITCOIN_HTTPWORKQUEUE_H
+
+#include <httpserver.h>
+#include <support/mpmcqueue.h>
+#include <utiltime.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/** Index of the HTTP_HISTOGRAM_BUCKETS bucket that counts a time */
+static inline int HistogramBucket(int64_t micros)
+{
+    int bucket = 0;
+    while (bucket < HTTP_HISTOGRAM_BUCKETS - 1 && micros >= (int64_t{1} << bucket))
+        bucket++;
+    return bucket;
+}
+
+/** Simple work queue for distributing work over multiple threads.
+ * Work items are simply callable objects.
+ *
+ * Without fairness the items are run in order of arrival, and pass through a
+ * lock-free ring, so that queueing and taking an item does not contend on a
+ * lock. With fairness they are queued per client under a mutex instead: the
+ * clients with waiting items take turns, and no client may occupy more than
+ * half of the queue, so that one client sending many requests cannot starve
+ * the others.
+ *
+ * Idle workers sleep on a condition variable. A worker announces that it is
+ * going to sleep before checking the queue a last time, and Enqueue only
+ * takes the lock to wake one when a worker has announced so; busy workers go
+ * on to the next item without being woken.
+ */
+template <typename WorkItem>
+class WorkQueue
+{
+private:
+    struct QueuedItem {
+        int64_t nQueued;
+        WorkItem* item;
+    };
+
+    const size_t maxDepth;
+    const bool fFair;
+
+    //! Items waiting, or being taken, in either mode
+    std::atomic<size_t> depth;
+    std::atomic<bool> running;
+
+    //! Waiting items without fairness
+    MPMCQueue<QueuedItem> ring;
+
+    //! Waiting items with fairness, per client, and the client taken last
+    std::mutex csFair;
+    std::map<std::string, std::deque<QueuedItem>> queues;
+    std::string lastClient;
+
+    //! Sleeping workers; cs guards the sleeping and waking up, and workerStats
+    std::mutex cs;
+    std::condition_variable cond;
+    std::atomic<int> nIdle;
+
+    /** Statistics of one worker. Only its worker writes them, so they are
+     * updated without atomic read-modify-write operations; they are atomic
+     * only so that GetStats can read them meanwhile.
+     */
+    struct WorkerStats {
+        std::atomic<uint64_t> nHandled;
+        std::atomic<int64_t> nWaitTotalMicros;
+        std::atomic<int64_t> nHandleTotalMicros;
+        std::atomic<uint64_t> vWaitHistogram[HTTP_HISTOGRAM_BUCKETS];
+        std::atomic<uint64_t> vHandleHistogram[HTTP_HISTOGRAM_BUCKETS];
+
+        WorkerStats() : nHandled(0), nWaitTotalMicros(0), nHandleTotalMicros(0)
+        {
+            for (int i = 0; i < HTTP_HISTOGRAM_BUCKETS; i++) {
+                vWaitHistogram[i] = 0;
+                vHandleHistogram[i] = 0;
+            }
+        }
+    };
+
+    template <typename N>
+    static void Add(std::atomic<N>& counter, N n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::atomic<size_t> peakDepth;
+    std::atomic<uint64_t> nRejected;
+    //! One per Run call, guarded by cs
+    std::list<WorkerStats> workerStats;
+
+    bool Pop(QueuedItem& queued)
+    {
+        if (!fFair)
+            return ring.TryPop(queued);
+
+        std::unique_lock<std::mutex> lock(csFair);
+        if (queues.empty())
+            return false;
+        // Take the oldest item of the next client in turn
+        auto it = queues.upper_bound(lastClient);
+        if (it == queues.end())
+            it = queues.begin();
+        lastClient = it->first;
+        queued = it->second.front();
+        it->second.pop_front();
+        if (it->second.empty())
+            queues.erase(it);
+        return true;
+    }
+
+    bool Reject()
+    {
+        depth--;
+        nRejected++;
+        return false;
+    }
+
+public:
+    explicit WorkQueue(size_t _maxDepth, bool _fFair = false) : maxDepth(_maxDepth), fFair(_fFair),
+                                 depth(0), running(true), ring(_fFair ? 1 : _maxDepth), nIdle(0),
+                                 peakDepth(0), nRejected(0)
+    {
+    }
+    /** Precondition: worker threads have all stopped (they have been joined).
+     */
+    ~WorkQueue()
+    {
+        QueuedItem queued;
+        while (Pop(queued))
+            delete queued.item;
+    }
+    /** Enqueue a work item on behalf of a client */
+    bool Enqueue(WorkItem* item, const std::string& client = "")
+    {
+        // Reserve a place first, so that the limit holds in both modes
+        size_t newDepth = ++depth;
+        if (newDepth > maxDepth)
+            return Reject();
+
+        QueuedItem queued = {GetTimeMicros(), item};
+        if (fFair) {
+            std::unique_lock<std::mutex> lock(csFair);
+            std::deque<QueuedItem>& queue = queues[client];
+            if (queue.size() >= std::max<size_t>(maxDepth / 2, 1)) {
+                if (queue.empty())
+                    queues.erase(client);
+                return Reject();
+            }
+            queue.push_back(queued);
+        } else if (!ring.TryPush(queued)) {
+            return Reject();
+        }
+
+        size_t peak = peakDepth.load();
+        while (newDepth > peak && !peakDepth.compare_exchange_weak(peak, newDepth)) {}
+
+        // Pairs with the fence in Run: either the worker going to sleep sees
+        // the item, or we see the worker and wake it
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (nIdle.load() > 0) {
+            std::unique_lock<std::mutex> lock(cs);
+            cond.notify_one();
+        }
+        return true;
+    }
+    /** Thread function */
+    void Run()
+    {
+        WorkerStats* stats;
+        {
+            std::unique_lock<std::mutex> lock(cs);
+            workerStats.emplace_back();
+            stats = &workerStats.back();
+        }
+        while (running) {
+            QueuedItem queued;
+            if (!Pop(queued)) {
+                std::unique_lock<std::mutex> lock(cs);
+                nIdle++;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                bool fPopped;
+                while (!(fPopped = Pop(queued)) && running)
+                    cond.wait(lock);
+                nIdle--;
+                if (!fPopped)
+                    break;
+            }
+            depth--;
+            std::unique_ptr<WorkItem> i(queued.item);
+            if (!running)
+                break;
+
+            int64_t nStart = GetTimeMicros();
+            (*i)();
+            int64_t nEnd = GetTimeMicros();
+            Add(stats->nWaitTotalMicros, nStart - queued.nQueued);
+            Add(stats->nHandleTotalMicros, nEnd - nStart);
+            Add(stats->vWaitHistogram[HistogramBucket(nStart - queued.nQueued)], uint64_t{1});
+            Add(stats->vHandleHistogram[HistogramBucket(nEnd - nStart)], uint64_t{1});
+            Add(stats->nHandled, uint64_t{1});
+        }
+    }
+    /** Interrupt and exit loops */
+    void Interrupt()
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        running = false;
+        cond.notify_all();
+    }
+    /** Fill in the statistics of the queue */
+    void GetStats(HTTPServerStats& stats)
+    {
+        stats.nQueueDepth = depth;
+        stats.nQueueMaxDepth = maxDepth;
+        stats.nQueuePeakDepth = peakDepth;
+        stats.fFairQueue = fFair;
+        if (fFair) {
+            std::unique_lock<std::mutex> lock(csFair);
+            stats.nQueueClients = queues.size();
+        } else {
+            stats.nQueueClients = 0;
+        }
+        stats.nRequestsRejected = nRejected;
+        stats.nRequestsHandled = 0;
+        stats.nWaitTotalMicros = 0;
+        stats.nHandleTotalMicros = 0;
+        stats.vWaitHistogram.assign(HTTP_HISTOGRAM_BUCKETS, 0);
+        stats.vHandleHistogram.assign(HTTP_HISTOGRAM_BUCKETS, 0);
+        std::unique_lock<std::mutex> lock(cs);
+        for (const WorkerStats& worker : workerStats) {
+            stats.nRequestsHandled += worker.nHandled;
+            stats.nWaitTotalMicros += worker.nWaitTotalMicros;
+            stats.nHandleTotalMicros += worker.nHandleTotalMicros;
+            for (int i = 0; i < HTTP_HISTOGRAM_BUCKETS; i++) {
+                stats.vWaitHistogram[i] += worker.vWaitHistogram[i];
+                stats.vHandleHistogram[i] += worker.vHandleHistogram[i];
+            }
+        }
+    }
+};
+
+#endif // BITCOIN_HTTPWORKQUEUE_H
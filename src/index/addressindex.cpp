@@ -0,0 +1,270 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/addressindex.h>
+
+#include <chain.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+#include <undo.h>
+#include <util.h>
+#include <validation.h>
+
+#include <map>
+
+static const char DB_ADDRESS = 'a';
+static const char DB_BALANCE = 'b';
+static const char DB_HEIGHT = 'h';
+
+std::unique_ptr<CAddressIndex> g_addressindex;
+
+uint256 GetScriptHash(const CScript& scriptPubKey)
+{
+    uint256 hash;
+    CSHA256().Write(scriptPubKey.data(), scriptPubKey.size()).Finalize(hash.begin());
+    return hash;
+}
+
+namespace {
+
+/** The key of a history entry; the position is big endian, so that entries are ordered by it */
+struct AddressKey
+{
+    uint256 scripthash;
+    CAddressHistoryPos pos;
+
+    AddressKey() {}
+    AddressKey(const uint256& scripthashIn, const CAddressHistoryPos& posIn) : scripthash(scripthashIn), pos(posIn) {}
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        unsigned char buf[12];
+        WriteBE32(buf, pos.nHeight);
+        WriteBE32(buf + 4, pos.nTxPos);
+        WriteBE32(buf + 8, pos.nIndex);
+        s << scripthash;
+        s.write((const char*)buf, sizeof(buf));
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        unsigned char buf[12];
+        s >> scripthash;
+        s.read((char*)buf, sizeof(buf));
+        pos.nHeight = ReadBE32(buf);
+        pos.nTxPos = ReadBE32(buf + 4);
+        pos.nIndex = ReadBE32(buf + 8);
+    }
+};
+
+/** The value of a history entry; only spends have a prevout */
+struct AddressValue
+{
+    uint256 txid;
+    CAmount nValue;
+    COutPoint prevout;
+
+    AddressValue() : nValue(0) {}
+    AddressValue(const uint256& txidIn, CAmount nValueIn, const COutPoint& prevoutIn = COutPoint()) :
+        txid(txidIn), nValue(nValueIn), prevout(prevoutIn) {}
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        const bool fSpend = !prevout.IsNull();
+        s << fSpend << txid << nValue;
+        if (fSpend)
+            s << prevout;
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        bool fSpend;
+        s >> fSpend >> txid >> nValue;
+        prevout.SetNull();
+        if (fSpend)
+            s >> prevout;
+    }
+};
+
+typedef std::vector<std::pair<AddressKey, AddressValue>> AddressEntries;
+
+/** The entries of a block: the outputs it creates, and the inputs spending the coins of blockundo */
+bool GetBlockEntries(const CBlock& block, const CBlockUndo& blockundo, int nHeight, AddressEntries& entries)
+{
+    if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+        return error("%s: the undo data of block %s does not match it", __func__, block.GetHash().ToString());
+
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            if (txundo.vprevout.size() != tx.vin.size())
+                return error("%s: the undo data of block %s does not match it", __func__, block.GetHash().ToString());
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const CTxOut& out = txundo.vprevout[j].out;
+                entries.emplace_back(AddressKey(GetScriptHash(out.scriptPubKey), CAddressHistoryPos(nHeight, i, j | ADDRESS_INDEX_SPEND_FLAG)),
+                                     AddressValue(tx.GetHash(), out.nValue, tx.vin[j].prevout));
+            }
+        }
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            const CTxOut& out = tx.vout[j];
+            if (out.scriptPubKey.IsUnspendable())
+                continue;
+            entries.emplace_back(AddressKey(GetScriptHash(out.scriptPubKey), CAddressHistoryPos(nHeight, i, j)),
+                                 AddressValue(tx.GetHash(), out.nValue));
+        }
+    }
+    return true;
+}
+
+/** Add the entries to the changes of the balances, or take them off */
+void AddBalanceChanges(const AddressEntries& entries, int nSign, std::map<uint256, CAddressBalance>& changes)
+{
+    for (const auto& entry : entries) {
+        CAddressBalance& change = changes[entry.first.scripthash];
+        if (entry.first.pos.nIndex & ADDRESS_INDEX_SPEND_FLAG) {
+            change.nBalance -= nSign * entry.second.nValue;
+            change.nSpends += nSign;
+        } else {
+            change.nBalance += nSign * entry.second.nValue;
+            change.nReceived += nSign * entry.second.nValue;
+            change.nOutputs += nSign;
+        }
+    }
+}
+
+} // namespace
+
+/** Access to the address index database (indexes/addressindex/) */
+class CAddressIndex::DB : public CIndexDB
+{
+public:
+    explicit DB(size_t nCacheSize, bool fMemory, bool fWipe) :
+        CIndexDB(GetDataDir() / "indexes" / "addressindex", nCacheSize, fMemory, fWipe) {}
+
+    bool ReadBlockHash(int nHeight, uint256& hashBlock) const
+    {
+        return Read(std::make_pair(DB_HEIGHT, nHeight), hashBlock);
+    }
+
+    bool ReadBalance(const uint256& scripthash, CAddressBalance& balance) const
+    {
+        return Read(std::make_pair(DB_BALANCE, scripthash), balance);
+    }
+};
+
+CAddressIndex::CAddressIndex(size_t nCacheSize, bool fMemory, bool fWipe) :
+    pdb(new DB(nCacheSize, fMemory, fWipe)) {}
+
+CAddressIndex::~CAddressIndex()
+{
+    Interrupt();
+    Stop();
+}
+
+bool CAddressIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    CDBBatch batch(*pdb);
+    std::map<uint256, CAddressBalance> changes;
+
+    // Remove the blocks written at this height and above, which are either
+    // this block again, after an unclean shutdown, or were reorganized away
+    for (int nHeight = pindex->nHeight; ; nHeight++) {
+        uint256 hashBlock;
+        if (!pdb->ReadBlockHash(nHeight, hashBlock))
+            break;
+        const CBlockIndex* pindexOld = LookupBlockIndexNoLock(hashBlock);
+        if (!pindexOld)
+            return error("%s: block %s at height %d of the index is not known", __func__, hashBlock.ToString(), nHeight);
+        CBlock blockOld;
+        CBlockUndo blockundoOld;
+        AddressEntries entriesOld;
+        if (!ReadBlockFromDisk(blockOld, pindexOld, consensusParams) || !UndoReadFromDisk(blockundoOld, pindexOld) ||
+            !GetBlockEntries(blockOld, blockundoOld, nHeight, entriesOld))
+            return error("%s: failed to read block %s to remove it from the index", __func__, hashBlock.ToString());
+        for (const auto& entry : entriesOld) {
+            batch.Erase(std::make_pair(DB_ADDRESS, entry.first));
+        }
+        AddBalanceChanges(entriesOld, -1, changes);
+        batch.Erase(std::make_pair(DB_HEIGHT, nHeight));
+    }
+
+    // The genesis block has no undo data, and its output cannot be spent
+    if (pindex->nHeight > 0) {
+        CBlockUndo blockundo;
+        AddressEntries entries;
+        if (!UndoReadFromDisk(blockundo, pindex) || !GetBlockEntries(block, blockundo, pindex->nHeight, entries))
+            return false;
+        for (const auto& entry : entries) {
+            batch.Write(std::make_pair(DB_ADDRESS, entry.first), entry.second);
+        }
+        AddBalanceChanges(entries, 1, changes);
+        batch.Write(std::make_pair(DB_HEIGHT, pindex->nHeight), pindex->GetBlockHash());
+    }
+
+    for (const auto& change : changes) {
+        CAddressBalance balance;
+        pdb->ReadBalance(change.first, balance);
+        balance.nBalance += change.second.nBalance;
+        balance.nReceived += change.second.nReceived;
+        balance.nOutputs += change.second.nOutputs;
+        balance.nSpends += change.second.nSpends;
+        if (balance.nOutputs == 0 && balance.nSpends == 0) {
+            batch.Erase(std::make_pair(DB_BALANCE, change.first));
+        } else {
+            batch.Write(std::make_pair(DB_BALANCE, change.first), balance);
+        }
+    }
+    return pdb->WriteBatch(batch);
+}
+
+CIndexDB& CAddressIndex::GetDB() const
+{
+    return *pdb;
+}
+
+bool CAddressIndex::FindHistory(const uint256& scripthash, const CAddressHistoryPos& start, size_t nMax,
+                                std::vector<CAddressHistoryEntry>& entries, bool& fMore, CAddressHistoryPos& next) const
+{
+    entries.clear();
+    fMore = false;
+
+    std::unique_ptr<CDBIterator> pcursor(pdb->NewIterator());
+    pcursor->Seek(std::make_pair(DB_ADDRESS, AddressKey(scripthash, start)));
+    for (; pcursor->Valid(); pcursor->Next()) {
+        std::pair<char, AddressKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESS || key.second.scripthash != scripthash)
+            break;
+        if (entries.size() == nMax) {
+            fMore = true;
+            next = key.second.pos;
+            break;
+        }
+        AddressValue value;
+        if (!pcursor->GetValue(value))
+            return error("%s: failed to read an entry of script %s", __func__, scripthash.ToString());
+        CAddressHistoryEntry entry;
+        entry.pos = key.second.pos;
+        entry.txid = value.txid;
+        entry.nValue = value.nValue;
+        entry.prevout = value.prevout;
+        entries.push_back(entry);
+    }
+    return true;
+}
+
+bool CAddressIndex::FindBalance(const uint256& scripthash, CAddressBalance& balance) const
+{
+    balance = CAddressBalance();
+    if (!pdb->Exists(std::make_pair(DB_BALANCE, scripthash)))
+        return true;
+    return pdb->ReadBalance(scripthash, balance);
+}
@@ -0,0 +1,118 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_ADDRESSINDEX_H
+#define BITCOIN_INDEX_ADDRESSINDEX_H
+
+#include <amount.h>
+#include <index/base.h>
+#include <primitives/transaction.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <memory>
+#include <vector>
+
+class CScript;
+
+/** Default for -addressindex */
+static const bool DEFAULT_ADDRESSINDEX = false;
+
+/** Scripts are indexed by the SHA256 of the scriptPubKey */
+uint256 GetScriptHash(const CScript& scriptPubKey);
+
+/**
+ * Where an entry is in the history of a script: the height of its block, the
+ * position of its transaction in the block, and the index of the output it
+ * creates, or of the input it spends, with ADDRESS_INDEX_SPEND_FLAG set.
+ * Entries are ordered by position.
+ */
+struct CAddressHistoryPos
+{
+    uint32_t nHeight;
+    uint32_t nTxPos;
+    uint32_t nIndex;
+
+    CAddressHistoryPos() : nHeight(0), nTxPos(0), nIndex(0) {}
+    CAddressHistoryPos(uint32_t nHeightIn, uint32_t nTxPosIn, uint32_t nIndexIn) :
+        nHeight(nHeightIn), nTxPos(nTxPosIn), nIndex(nIndexIn) {}
+};
+
+static const uint32_t ADDRESS_INDEX_SPEND_FLAG = 0x80000000;
+
+/** An output paying to a script, or an input spending one */
+struct CAddressHistoryEntry
+{
+    CAddressHistoryPos pos;
+    uint256 txid;
+    CAmount nValue;
+    //! The output an input spends, null for outputs
+    COutPoint prevout;
+
+    bool IsSpend() const { return pos.nIndex & ADDRESS_INDEX_SPEND_FLAG; }
+};
+
+/** The totals of the history of a script */
+struct CAddressBalance
+{
+    CAmount nBalance;
+    CAmount nReceived;
+    int64_t nOutputs;
+    int64_t nSpends;
+
+    CAddressBalance() : nBalance(0), nReceived(0), nOutputs(0), nSpends(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nBalance);
+        READWRITE(nReceived);
+        READWRITE(nOutputs);
+        READWRITE(nSpends);
+    }
+};
+
+/**
+ * The address index keeps the history of every script of the active chain,
+ * keyed by script hash and ordered by position, so that it can be paged
+ * through with a single seek, along with the balance of every script, in a
+ * database of its own (indexes/addressindex). The scripts that blocks spend
+ * are read from their undo data.
+ *
+ * Unlike those of the other indexes, entries of blocks that were reorganized
+ * away would be found by later lookups. The index records the block it wrote
+ * at every height, and before writing a block removes the entries of the
+ * blocks it had at that height and above, which it reads back from disk.
+ */
+class CAddressIndex final : public CBaseIndex
+{
+private:
+    class DB;
+    const std::unique_ptr<DB> pdb;
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+    CIndexDB& GetDB() const override;
+    const char* GetName() const override { return "addressindex"; }
+
+public:
+    explicit CAddressIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CAddressIndex();
+
+    /**
+     * Look up the history of a script from start on, up to nMax entries. If
+     * there are more, next is set to the position of the first one left out.
+     */
+    bool FindHistory(const uint256& scripthash, const CAddressHistoryPos& start, size_t nMax,
+                     std::vector<CAddressHistoryEntry>& entries, bool& fMore, CAddressHistoryPos& next) const;
+
+    /** Look up the balance of a script; scripts that were never used have an empty one */
+    bool FindBalance(const uint256& scripthash, CAddressBalance& balance) const;
+};
+
+/** The address index, if -addressindex is set */
+extern std::unique_ptr<CAddressIndex> g_addressindex;
+
+#endif // BITCOIN_INDEX_ADDRESSINDEX_H
@@ -0,0 +1,253 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/base.h>
+
+#include <chain.h>
+#include <chainparams.h>
+#include <init.h>
+#include <ui_interface.h>
+#include <util.h>
+#include <validation.h>
+#include <warnings.h>
+
+#include <functional>
+
+static const char DB_BEST_BLOCK = 'B';
+
+//! Seconds between the progress messages of the sync thread
+static const int64_t SYNC_LOG_INTERVAL = 30;
+//! Seconds between the sync thread recording its progress
+static const int64_t SYNC_LOCATOR_WRITE_INTERVAL = 30;
+
+CIndexDB::CIndexDB(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe) :
+    CDBWrapper(path, nCacheSize, fMemory, fWipe) {}
+
+bool CIndexDB::ReadBestBlock(CBlockLocator& locator) const
+{
+    return Read(DB_BEST_BLOCK, locator);
+}
+
+bool CIndexDB::WriteBestBlock(const CBlockLocator& locator)
+{
+    return Write(DB_BEST_BLOCK, locator);
+}
+
+void CBaseIndex::FatalErrorMessage(const std::string& strMessage)
+{
+    SetMiscWarning(strMessage);
+    LogPrintf("*** %s\n", strMessage);
+    uiInterface.ThreadSafeMessageBox(_("Error: A fatal internal error occurred, see debug.log for details"), "", CClientUIInterface::MSG_ERROR);
+    StartShutdown();
+}
+
+CBaseIndex::CBaseIndex() : fSynced(false), pindexBest(nullptr) {}
+
+CBaseIndex::~CBaseIndex() {}
+
+bool CBaseIndex::Init()
+{
+    LOCK(cs_main);
+    CBlockLocator locator;
+    if (!GetDB().ReadBestBlock(locator))
+        locator.SetNull();
+
+    // Whether the index is synced is left to the sync thread, which also runs
+    // PrepareSync first
+    pindexBest = locator.IsNull() ? nullptr : FindForkInGlobalIndex(chainActive, locator);
+    return true;
+}
+
+/** The block after pindexPrev on the way to the active chain tip */
+static const CBlockIndex* NextSyncBlock(const CBlockIndex* pindexPrev)
+{
+    AssertLockHeld(cs_main);
+
+    if (!pindexPrev)
+        return chainActive.Genesis();
+
+    const CBlockIndex* pindex = chainActive.Next(pindexPrev);
+    if (pindex)
+        return pindex;
+
+    // pindexPrev was disconnected: continue from where it forks off the active chain
+    return chainActive.Next(chainActive.FindFork(pindexPrev));
+}
+
+void CBaseIndex::ThreadSync()
+{
+    if (!PrepareSync())
+        return;
+
+    const CChainParams& chainparams = Params();
+    const CBlockIndex* pindex = pindexBest.load();
+    int64_t nLastLog = 0;
+    int64_t nLastLocatorWrite = GetTime();
+    while (true) {
+        if (interrupt) {
+            pindexBest = pindex;
+            WriteBestBlock(pindex);
+            return;
+        }
+
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindexNext = NextSyncBlock(pindex);
+            if (!pindexNext) {
+                // Later blocks are indexed by BlockConnected
+                pindexBest = pindex;
+                fSynced = true;
+                break;
+            }
+            pindex = pindexNext;
+        }
+
+        int64_t nNow = GetTime();
+        if (nLastLog + SYNC_LOG_INTERVAL < nNow) {
+            LogPrintf("Syncing %s with block chain from height %d\n", GetName(), pindex->nHeight);
+            nLastLog = nNow;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus())) {
+            FatalError("%s: failed to read block %s from disk", __func__, pindex->GetBlockHash().ToString());
+            return;
+        }
+        if (!WriteBlock(block, pindex)) {
+            FatalError("%s: failed to write block %s to the %s database", __func__, pindex->GetBlockHash().ToString(), GetName());
+            return;
+        }
+
+        if (nLastLocatorWrite + SYNC_LOCATOR_WRITE_INTERVAL < nNow) {
+            pindexBest = pindex;
+            WriteBestBlock(pindex);
+            nLastLocatorWrite = nNow;
+        }
+    }
+
+    WriteBestBlock(pindex);
+    LogPrintf("%s is enabled at height %d\n", GetName(), pindex ? pindex->nHeight : -1);
+}
+
+bool CBaseIndex::WriteBestBlock(const CBlockIndex* pindex)
+{
+    if (!pindex)
+        return true;
+    CBlockLocator locator;
+    {
+        LOCK(cs_main);
+        locator = chainActive.GetLocator(pindex);
+    }
+    // Failing to record progress only means redoing some of the work on the next start
+    if (!GetDB().WriteBestBlock(locator))
+        return error("%s: failed to write the locator to disk", __func__);
+    return true;
+}
+
+void CBaseIndex::BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted)
+{
+    if (!fSynced)
+        return;
+
+    const CBlockIndex* pindexBestOld = pindexBest.load();
+    if (!pindexBestOld) {
+        if (pindex->nHeight != 0) {
+            FatalError("%s: the first block connected is not the genesis block (height=%d)", __func__, pindex->nHeight);
+            return;
+        }
+    } else if (pindexBestOld->GetAncestor(pindex->nHeight - 1) != pindex->pprev) {
+        // Right after the sync thread has caught up, blocks of a branch that
+        // was reorganized away can still be waiting in the callback queue
+        LogPrintf("%s: WARNING: block %s does not connect to an ancestor of the known best chain (tip=%s); not updating the index\n",
+                  __func__, pindex->GetBlockHash().ToString(), pindexBestOld->GetBlockHash().ToString());
+        return;
+    }
+
+    if (!WriteBlock(*block, pindex)) {
+        FatalError("%s: failed to write block %s to the %s database", __func__, pindex->GetBlockHash().ToString(), GetName());
+        return;
+    }
+    pindexBest = pindex;
+}
+
+void CBaseIndex::SetBestChain(const CBlockLocator& locator)
+{
+    if (!fSynced || locator.IsNull())
+        return;
+
+    const CBlockIndex* pindexLocatorTip = nullptr;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(locator.vHave.front());
+        if (it != mapBlockIndex.end())
+            pindexLocatorTip = it->second;
+    }
+    if (!pindexLocatorTip) {
+        FatalError("%s: first block (hash=%s) in the locator was not found", __func__, locator.vHave.front().ToString());
+        return;
+    }
+
+    // The chainstate is flushed at a block the index may not have reached yet,
+    // if its BlockConnected callbacks are still queued
+    const CBlockIndex* pindexBestOld = pindexBest.load();
+    if (!pindexBestOld || pindexBestOld->GetAncestor(pindexLocatorTip->nHeight) != pindexLocatorTip) {
+        LogPrintf("%s: WARNING: locator contains block (hash=%s) not on the known best chain (tip=%s); not writing it\n",
+                  __func__, pindexLocatorTip->GetBlockHash().ToString(), pindexBestOld ? pindexBestOld->GetBlockHash().ToString() : "null");
+        return;
+    }
+    if (!GetDB().WriteBestBlock(locator))
+        error("%s: failed to write the locator to disk", __func__);
+}
+
+void CBaseIndex::Start()
+{
+    // Register first, so that no block is missed once the sync thread has caught up
+    RegisterValidationInterface(this, true);
+    if (!Init()) {
+        FatalError("%s: %s failed to initialize", __func__, GetName());
+        return;
+    }
+    interrupt.reset();
+    threadSync = std::thread(&TraceThread<std::function<void()>>, GetName(), std::function<void()>(std::bind(&CBaseIndex::ThreadSync, this)));
+}
+
+void CBaseIndex::Interrupt()
+{
+    interrupt();
+}
+
+void CBaseIndex::Stop()
+{
+    UnregisterValidationInterface(this);
+    if (threadSync.joinable()) {
+        Interrupt();
+        threadSync.join();
+    }
+}
+
+int CBaseIndex::GetBestHeight() const
+{
+    const CBlockIndex* pindex = pindexBest.load();
+    return pindex ? pindex->nHeight : -1;
+}
+
+bool CBaseIndex::BlockUntilSyncedToCurrentChain()
+{
+    AssertLockNotHeld(cs_main);
+
+    if (!fSynced)
+        return false;
+
+    {
+        // Skip the queue flush if the index already covers the tip
+        const CBlockIndex* pindexTip = GetChainSnapshot()->Tip();
+        const CBlockIndex* pindex = pindexBest.load();
+        if (!pindexTip || (pindex && pindex->GetAncestor(pindexTip->nHeight) == pindexTip))
+            return true;
+    }
+
+    LogPrintf("%s: %s is catching up on block notifications\n", __func__, GetName());
+    SyncWithValidationInterfaceQueue();
+    return true;
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_BASE_H
+#define BITCOIN_INDEX_BASE_H
+
+#include <dbwrapper.h>
+#include <primitives/block.h>
+#include <primitives/transaction.h>
+#include <threadinterrupt.h>
+#include <tinyformat.h>
+#include <validationinterface.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+class CBlockIndex;
+
+/** The database of an index, which also records the last block the index covers */
+class CIndexDB : public CDBWrapper
+{
+public:
+    CIndexDB(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe);
+
+    bool ReadBestBlock(CBlockLocator& locator) const;
+    bool WriteBestBlock(const CBlockLocator& locator);
+};
+
+/**
+ * Base of the optional indexes of the active chain, each kept in a database
+ * of its own.
+ *
+ * A thread of its own reads the blocks the index is missing from disk, from
+ * where it left off, without holding cs_main for longer than it takes to find
+ * the next block. Once it has caught up, BlockConnected keeps the index up to
+ * date, off the validation thread.
+ */
+class CBaseIndex : public CValidationInterface
+{
+private:
+    //! Whether the index has caught up with the active chain, after which BlockConnected updates it
+    std::atomic<bool> fSynced;
+    //! The last block in the index
+    std::atomic<const CBlockIndex*> pindexBest;
+
+    std::thread threadSync;
+
+    void ThreadSync();
+    bool WriteBestBlock(const CBlockIndex* pindex);
+
+protected:
+    CThreadInterrupt interrupt;
+
+    void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted) override;
+    void SetBestChain(const CBlockLocator& locator) override;
+
+    /** Find where the index left off. Called by Start() before the sync thread runs. */
+    virtual bool Init();
+
+    /** Work the sync thread does before catching up with the chain; false if it must stop */
+    virtual bool PrepareSync() { return true; }
+
+    /** Add a block of the active chain, whose parent is the last block in the index */
+    virtual bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) = 0;
+
+    virtual CIndexDB& GetDB() const = 0;
+
+    /** Name of the index, for log messages and the sync thread */
+    virtual const char* GetName() const = 0;
+
+    /** Log the error, show it to the user, and shut down */
+    static void FatalErrorMessage(const std::string& strMessage);
+
+    template<typename... Args>
+    static void FatalError(const char* fmt, const Args&... args)
+    {
+        FatalErrorMessage(tfm::format(fmt, args...));
+    }
+
+public:
+    CBaseIndex();
+    /** Derived classes must stop the index in their own destructor, while WriteBlock can still be called */
+    virtual ~CBaseIndex();
+    CBaseIndex(const CBaseIndex&) = delete;
+    CBaseIndex& operator=(const CBaseIndex&) = delete;
+
+    /** Start receiving validation callbacks, and the thread that catches up with the active chain */
+    void Start();
+    /** Ask the thread to stop, after it has recorded how far it got */
+    void Interrupt();
+    /** Stop the thread and the validation callbacks */
+    void Stop();
+
+    bool IsSynced() const { return fSynced; }
+    /** Height of the last indexed block, -1 if none */
+    int GetBestHeight() const;
+
+    /**
+     * Wait until the callbacks for the current chain tip have been processed,
+     * so that the index covers it. Returns false right away if the index is
+     * still catching up. Must not be called with cs_main held.
+     */
+    bool BlockUntilSyncedToCurrentChain();
+};
+
+#endif // BITCOIN_INDEX_BASE_H
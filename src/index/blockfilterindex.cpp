@@ -0,0 +1,142 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/blockfilterindex.h>
+
+#include <chain.h>
+#include <coins.h>
+#include <undo.h>
+#include <util.h>
+#include <validation.h>
+
+static const char DB_FILTER = 'f';
+
+std::unique_ptr<CBlockFilterIndex> g_blockfilterindex;
+
+/** What is stored for every block: the filter, its hash and its header */
+struct FilterEntry
+{
+    uint256 hash;
+    uint256 header;
+    std::vector<unsigned char> vEncoded;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hash);
+        READWRITE(header);
+        READWRITE(vEncoded);
+    }
+};
+
+/** Access to the block filter database (indexes/blockfilter/<type>/) */
+class CBlockFilterIndex::DB : public CIndexDB
+{
+public:
+    DB(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe) :
+        CIndexDB(path, nCacheSize, fMemory, fWipe) {}
+
+    bool ReadFilter(const uint256& hashBlock, FilterEntry& entry) const
+    {
+        return Read(std::make_pair(DB_FILTER, hashBlock), entry);
+    }
+
+    bool WriteFilter(const uint256& hashBlock, const FilterEntry& entry)
+    {
+        return Write(std::make_pair(DB_FILTER, hashBlock), entry);
+    }
+};
+
+CBlockFilterIndex::CBlockFilterIndex(BlockFilterType filter_type_in, size_t nCacheSize, bool fMemory, bool fWipe) :
+    filter_type(filter_type_in),
+    pdb(new DB(GetDataDir() / "indexes" / "blockfilter" / BlockFilterTypeName(filter_type_in), nCacheSize, fMemory, fWipe)) {}
+
+CBlockFilterIndex::~CBlockFilterIndex()
+{
+    Interrupt();
+    Stop();
+}
+
+bool CBlockFilterIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    // The genesis block spends nothing and has no undo data
+    CBlockUndo blockundo;
+    uint256 prev_header;
+    if (pindex->nHeight > 0) {
+        if (!UndoReadFromDisk(blockundo, pindex))
+            return false;
+
+        FilterEntry prev;
+        if (!pdb->ReadFilter(pindex->pprev->GetBlockHash(), prev))
+            return error("%s: the filter of the parent of block %s is not in the index", __func__, pindex->GetBlockHash().ToString());
+        prev_header = prev.header;
+    }
+
+    BlockFilter filter(filter_type, block, blockundo);
+
+    FilterEntry entry;
+    entry.hash = filter.GetHash();
+    entry.header = filter.ComputeHeader(prev_header);
+    entry.vEncoded = filter.GetEncodedFilter();
+    return pdb->WriteFilter(pindex->GetBlockHash(), entry);
+}
+
+CIndexDB& CBlockFilterIndex::GetDB() const
+{
+    return *pdb;
+}
+
+bool CBlockFilterIndex::LookupFilter(const CBlockIndex* pindex, BlockFilter& filter) const
+{
+    FilterEntry entry;
+    if (!pdb->ReadFilter(pindex->GetBlockHash(), entry))
+        return false;
+
+    try {
+        filter = BlockFilter(filter_type, pindex->GetBlockHash(), std::move(entry.vEncoded));
+    } catch (const std::exception& e) {
+        return error("%s: the filter of block %s is corrupt: %s", __func__, pindex->GetBlockHash().ToString(), e.what());
+    }
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterHeader(const CBlockIndex* pindex, uint256& header) const
+{
+    FilterEntry entry;
+    if (!pdb->ReadFilter(pindex->GetBlockHash(), entry))
+        return false;
+    header = entry.header;
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterRange(int start_height, const CBlockIndex* pindexStop, std::vector<BlockFilter>& filters) const
+{
+    if (start_height < 0 || start_height > pindexStop->nHeight)
+        return false;
+
+    filters.resize(pindexStop->nHeight - start_height + 1);
+    const CBlockIndex* pindex = pindexStop;
+    for (auto it = filters.rbegin(); it != filters.rend(); ++it, pindex = pindex->pprev) {
+        if (!LookupFilter(pindex, *it))
+            return false;
+    }
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterHashRange(int start_height, const CBlockIndex* pindexStop, std::vector<uint256>& hashes) const
+{
+    if (start_height < 0 || start_height > pindexStop->nHeight)
+        return false;
+
+    hashes.resize(pindexStop->nHeight - start_height + 1);
+    const CBlockIndex* pindex = pindexStop;
+    for (auto it = hashes.rbegin(); it != hashes.rend(); ++it, pindex = pindex->pprev) {
+        FilterEntry entry;
+        if (!pdb->ReadFilter(pindex->GetBlockHash(), entry))
+            return false;
+        *it = entry.hash;
+    }
+    return true;
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_BLOCKFILTERINDEX_H
+#define BITCOIN_INDEX_BLOCKFILTERINDEX_H
+
+#include <blockfilter.h>
+#include <index/base.h>
+#include <uint256.h>
+
+#include <memory>
+#include <vector>
+
+/** Default for -blockfilterindex */
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+
+/**
+ * The block filter index keeps the filter of every block of the active chain
+ * (BIP 158), along with its filter header, in a database of its own
+ * (indexes/blockfilter/<type>). Filters are keyed by block hash, so those of
+ * blocks that were reorganized away stay in the database and are just not
+ * looked up any more.
+ */
+class CBlockFilterIndex final : public CBaseIndex
+{
+private:
+    class DB;
+    const BlockFilterType filter_type;
+    const std::unique_ptr<DB> pdb;
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+    CIndexDB& GetDB() const override;
+    const char* GetName() const override { return "blockfilterindex"; }
+
+public:
+    CBlockFilterIndex(BlockFilterType filter_type, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CBlockFilterIndex();
+
+    BlockFilterType GetFilterType() const { return filter_type; }
+
+    /** Look up the filter of a block */
+    bool LookupFilter(const CBlockIndex* pindex, BlockFilter& filter) const;
+
+    /** Look up the filter header of a block */
+    bool LookupFilterHeader(const CBlockIndex* pindex, uint256& header) const;
+
+    /** Look up the filters of the blocks from start_height up to and including pindexStop */
+    bool LookupFilterRange(int start_height, const CBlockIndex* pindexStop, std::vector<BlockFilter>& filters) const;
+
+    /** Look up the filter hashes of the blocks from start_height up to and including pindexStop */
+    bool LookupFilterHashRange(int start_height, const CBlockIndex* pindexStop, std::vector<uint256>& hashes) const;
+};
+
+/** The basic block filter index, if -blockfilterindex is set */
+extern std::unique_ptr<CBlockFilterIndex> g_blockfilterindex;
+
+#endif // BITCOIN_INDEX_BLOCKFILTERINDEX_H
@@ -0,0 +1,123 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/recenttxindex.h>
+
+#include <util.h>
+#include <validation.h>
+
+std::unique_ptr<CRecentTxIndex> g_recenttxindex;
+
+CRecentTxIndex::CRecentTxIndex(size_t nMaxBlocksIn) : nMaxBlocks(nMaxBlocksIn) {}
+
+void CRecentTxIndex::AddBlock(const CBlock& block, const CDiskBlockPos& pos)
+{
+    AssertLockHeld(cs);
+    CDiskTxPos postx(pos, GetSizeOfCompactSize(block.vtx.size()));
+    RecentBlock recent;
+    recent.hash = block.GetHash();
+    recent.pos = pos;
+    recent.vTxids.reserve(block.vtx.size());
+    for (const CTransactionRef& tx : block.vtx) {
+        recent.vTxids.push_back(tx->GetHash());
+        mapTxPos[tx->GetHash()] = postx;
+        postx.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+    }
+    dequeBlocks.push_back(std::move(recent));
+    while (dequeBlocks.size() > nMaxBlocks) {
+        EvictBlock(dequeBlocks.front());
+        dequeBlocks.pop_front();
+    }
+}
+
+void CRecentTxIndex::EvictBlock(const RecentBlock& recent)
+{
+    AssertLockHeld(cs);
+    for (const uint256& txid : recent.vTxids) {
+        // A transaction may also be in a block indexed later, after a reorg;
+        // it is left to that block then
+        auto it = mapTxPos.find(txid);
+        if (it != mapTxPos.end() && it->second.nFile == recent.pos.nFile && it->second.nPos == recent.pos.nPos) {
+            mapTxPos.erase(it);
+        }
+    }
+}
+
+void CRecentTxIndex::BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted)
+{
+    CDiskBlockPos pos;
+    {
+        LOCK(cs_main);
+        pos = pindex->GetBlockPos();
+    }
+    LOCK(cs);
+    AddBlock(*block, pos);
+}
+
+void CRecentTxIndex::BlockDisconnected(const std::shared_ptr<const CBlock>& block)
+{
+    const uint256 hashBlock = block->GetHash();
+    LOCK(cs);
+    for (auto it = dequeBlocks.rbegin(); it != dequeBlocks.rend(); ++it) {
+        if (it->hash == hashBlock) {
+            EvictBlock(*it);
+            dequeBlocks.erase(std::next(it).base());
+            break;
+        }
+    }
+}
+
+void CRecentTxIndex::Load(const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+    const CBlockIndex* pindex = chainActive.Tip();
+    std::vector<const CBlockIndex*> vpindex;
+    for (; pindex && vpindex.size() < nMaxBlocks && (pindex->nStatus & BLOCK_HAVE_DATA); pindex = pindex->pprev) {
+        vpindex.push_back(pindex);
+    }
+    LOCK(cs);
+    for (auto it = vpindex.rbegin(); it != vpindex.rend(); ++it) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, *it, consensusParams)) {
+            // Only the blocks after it can be indexed in order
+            dequeBlocks.clear();
+            mapTxPos.clear();
+            continue;
+        }
+        AddBlock(block, (*it)->GetBlockPos());
+    }
+    LogPrintf("Indexed the %u transactions of the last %u blocks in memory\n", mapTxPos.size(), dequeBlocks.size());
+}
+
+bool CRecentTxIndex::FindTx(const uint256& txid, uint256& hashBlock, CTransactionRef& tx) const
+{
+    CDiskTxPos postx;
+    {
+        LOCK(cs);
+        auto it = mapTxPos.find(txid);
+        if (it == mapTxPos.end())
+            return false;
+        postx = it->second;
+    }
+
+    CBlockHeader header;
+    if (!ReadTxFromDisk(postx, header, tx))
+        return false;
+    if (tx->GetHash() != txid)
+        return error("%s: txid mismatch", __func__);
+    hashBlock = header.GetHash();
+    return true;
+}
+
+size_t CRecentTxIndex::GetBlockCount() const
+{
+    LOCK(cs);
+    return dequeBlocks.size();
+}
+
+size_t CRecentTxIndex::GetTxCount() const
+{
+    LOCK(cs);
+    return mapTxPos.size();
+}
@@ -0,0 +1,75 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_RECENTTXINDEX_H
+#define BITCOIN_INDEX_RECENTTXINDEX_H
+
+#include <chain.h>
+#include <primitives/transaction.h>
+#include <sync.h>
+#include <txdb.h>
+#include <txmempool.h>
+#include <uint256.h>
+#include <validationinterface.h>
+
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class CChainParams;
+
+/** Default for -recenttxindex, the number of blocks whose transactions are indexed in memory (0 = disabled) */
+static const int DEFAULT_RECENT_TXINDEX_BLOCKS = 0;
+/** Most blocks -recenttxindex may cover */
+static const int MAX_RECENT_TXINDEX_BLOCKS = 10000;
+
+/**
+ * An in-memory index of the positions of the transactions in the most recent
+ * blocks of the active chain, so that getrawtransaction finds recently
+ * confirmed transactions with one read without -txindex. It covers up to
+ * nMaxBlocks blocks, evicting the oldest, and blocks that are disconnected
+ * leave it until it is filled up again by the blocks connected after them.
+ */
+class CRecentTxIndex final : public CValidationInterface
+{
+private:
+    const size_t nMaxBlocks;
+
+    mutable CCriticalSection cs;
+    //! The position of every transaction of the indexed blocks
+    std::unordered_map<uint256, CDiskTxPos, SaltedTxidHasher> mapTxPos;
+
+    struct RecentBlock {
+        uint256 hash;
+        CDiskBlockPos pos;
+        std::vector<uint256> vTxids;
+    };
+    //! The indexed blocks, oldest first
+    std::deque<RecentBlock> dequeBlocks;
+
+    void AddBlock(const CBlock& block, const CDiskBlockPos& pos);
+    void EvictBlock(const RecentBlock& recent);
+
+protected:
+    void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted) override;
+    void BlockDisconnected(const std::shared_ptr<const CBlock>& block) override;
+
+public:
+    explicit CRecentTxIndex(size_t nMaxBlocksIn);
+
+    /** Index the most recent blocks of the active chain, before the index is registered for the blocks connected later */
+    void Load(const Consensus::Params& consensusParams);
+
+    /** Look up a transaction by hash, returning it and the hash of the block that contains it */
+    bool FindTx(const uint256& txid, uint256& hashBlock, CTransactionRef& tx) const;
+
+    size_t GetBlockCount() const;
+    size_t GetTxCount() const;
+};
+
+/** The recent transaction index, if -recenttxindex is set */
+extern std::unique_ptr<CRecentTxIndex> g_recenttxindex;
+
+#endif // BITCOIN_INDEX_RECENTTXINDEX_H
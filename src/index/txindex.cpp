@@ -0,0 +1,122 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/txindex.h>
+
+#include <chain.h>
+#include <txdb.h>
+#include <util.h>
+#include <validation.h>
+
+static const char DB_TXINDEX = 't';
+
+std::unique_ptr<CTxIndex> g_txindex;
+
+/** Access to the txindex database (indexes/txindex/) */
+class CTxIndex::DB : public CIndexDB
+{
+public:
+    explicit DB(size_t nCacheSize, bool fMemory, bool fWipe) :
+        CIndexDB(GetDataDir() / "indexes" / "txindex", nCacheSize, fMemory, fWipe) {}
+
+    bool ReadTxPos(const uint256& txid, CDiskTxPos& pos) const
+    {
+        return Read(std::make_pair(DB_TXINDEX, txid), pos);
+    }
+
+    bool WriteTxs(const std::vector<std::pair<uint256, CDiskTxPos>>& vPos)
+    {
+        CDBBatch batch(*this);
+        for (const auto& tx : vPos) {
+            batch.Write(std::make_pair(DB_TXINDEX, tx.first), tx.second);
+        }
+        return WriteBatch(batch);
+    }
+};
+
+CTxIndex::CTxIndex(size_t nCacheSize, bool fMemory, bool fWipe) :
+    pdb(new DB(nCacheSize, fMemory, fWipe)), fMigrate(false) {}
+
+CTxIndex::~CTxIndex()
+{
+    Interrupt();
+    Stop();
+}
+
+bool CTxIndex::Init()
+{
+    {
+        LOCK(cs_main);
+        CBlockLocator locator;
+        if (!pdb->ReadBestBlock(locator))
+            locator.SetNull();
+
+        // Older versions kept the index in the block tree database, up to the
+        // block the chainstate was last flushed at or later. Record that block
+        // before the first block is connected, so that the sync thread continues
+        // from there once the entries are moved.
+        bool fLegacy = false;
+        pblocktree->ReadFlag("txindex", fLegacy);
+        if (fLegacy && locator.IsNull() && chainActive.Tip()) {
+            if (!pdb->WriteBestBlock(chainActive.GetLocator()))
+                return error("%s: failed to write the locator of the moved transaction index", __func__);
+        }
+        fMigrate = fLegacy;
+    }
+    return CBaseIndex::Init();
+}
+
+bool CTxIndex::PrepareSync()
+{
+    return !fMigrate || MigrateLegacyIndex();
+}
+
+bool CTxIndex::MigrateLegacyIndex()
+{
+    LogPrintf("Moving the transaction index from the block index database to indexes/txindex...\n");
+    if (!pblocktree->MoveTxIndex(*pdb, [this] { return bool(interrupt); })) {
+        if (!interrupt)
+            FatalError("%s: failed to move the transaction index", __func__);
+        return false;
+    }
+    LogPrintf("Moved the transaction index\n");
+    return true;
+}
+
+bool CTxIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    CDiskBlockPos posBlock;
+    {
+        LOCK(cs_main);
+        posBlock = pindex->GetBlockPos();
+    }
+    CDiskTxPos pos(posBlock, GetSizeOfCompactSize(block.vtx.size()));
+    std::vector<std::pair<uint256, CDiskTxPos>> vPos;
+    vPos.reserve(block.vtx.size());
+    for (const CTransactionRef& tx : block.vtx) {
+        vPos.emplace_back(tx->GetHash(), pos);
+        pos.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+    }
+    return pdb->WriteTxs(vPos);
+}
+
+CIndexDB& CTxIndex::GetDB() const
+{
+    return *pdb;
+}
+
+bool CTxIndex::FindTx(const uint256& txid, uint256& hashBlock, CTransactionRef& tx) const
+{
+    CDiskTxPos postx;
+    if (!pdb->ReadTxPos(txid, postx))
+        return false;
+
+    CBlockHeader header;
+    if (!ReadTxFromDisk(postx, header, tx))
+        return false;
+    if (tx->GetHash() != txid)
+        return error("%s: txid mismatch", __func__);
+    hashBlock = header.GetHash();
+    return true;
+}
@@ -0,0 +1,53 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_TXINDEX_H
+#define BITCOIN_INDEX_TXINDEX_H
+
+#include <index/base.h>
+#include <primitives/transaction.h>
+#include <uint256.h>
+
+#include <memory>
+
+struct CDiskTxPos;
+
+/**
+ * The transaction index maps the hash of every transaction in the active
+ * chain to its position in the block files. It lives in a database of its
+ * own (indexes/txindex), which also records the last block it covers.
+ *
+ * The index that older versions wrote to the block tree database is moved to
+ * the new database the first time the index starts.
+ */
+class CTxIndex final : public CBaseIndex
+{
+private:
+    class DB;
+    const std::unique_ptr<DB> pdb;
+
+    //! Whether the index of older versions still has to be moved to pdb
+    bool fMigrate;
+
+    bool MigrateLegacyIndex();
+
+protected:
+    bool Init() override;
+    bool PrepareSync() override;
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+    CIndexDB& GetDB() const override;
+    const char* GetName() const override { return "txindex"; }
+
+public:
+    explicit CTxIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CTxIndex();
+
+    /** Look up a transaction by hash, returning it and the hash of the block that contains it */
+    bool FindTx(const uint256& txid, uint256& hashBlock, CTransactionRef& tx) const;
+};
+
+/** The transaction index, if -txindex is set */
+extern std::unique_ptr<CTxIndex> g_txindex;
+
+#endif // BITCOIN_INDEX_TXINDEX_H
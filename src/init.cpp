@@ -11,20 +11,32 @@
 
 #include <addrman.h>
 #include <amount.h>
+#include <blockfilemap.h>
+#include <blockfileunlinker.h>
+#include <blockfilewriter.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
+#include <coinstats.h>
 #include <compat/sanity.h>
+#include <compressedheaders.h>
 #include <consensus/validation.h>
+#include <crypto/aes.h>
 #include <fs.h>
 #include <httpserver.h>
 #include <httprpc.h>
+#include <index/addressindex.h>
+#include <index/blockfilterindex.h>
+#include <index/recenttxindex.h>
+#include <index/txindex.h>
 #include <key.h>
+#include <metrics.h>
 #include <validation.h>
 #include <miner.h>
 #include <netbase.h>
 #include <net.h>
 #include <net_processing.h>
+#include <notifyqueue.h>
 #include <policy/feerate.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
@@ -35,10 +47,13 @@
 #include <script/standard.h>
 #include <script/sigcache.h>
 #include <scheduler.h>
+#include <support/largepages.h>
+#include <taskpool.h>
 #include <timedata.h>
 #include <txdb.h>
 #include <txmempool.h>
 #include <torcontrol.h>
+#include <udprelay.h>
 #include <ui_interface.h>
 #include <util.h>
 #include <utilmoneystr.h>
@@ -64,20 +79,22 @@
 #include <openssl/crypto.h>
 
 #if ENABLE_ZMQ
+#include <zmq/zmqabstractnotifier.h>
 #include <zmq/zmqnotificationinterface.h>
+#include <zmq/zmqpublisher.h>
+#include <zmq/zmqrpc.h>
 #endif
 
 bool fFeeEstimatesInitialized = false;
 static const bool DEFAULT_PROXYRANDOMIZE = true;
 static const bool DEFAULT_REST_ENABLE = false;
 static const bool DEFAULT_STOPAFTERBLOCKIMPORT = false;
+static const int DEFAULT_SCHEDULER_THREADS = 2;
+static const int MAX_SCHEDULER_THREADS = 16;
 
 std::unique_ptr<CConnman> g_connman;
 std::unique_ptr<PeerLogicValidation> peerLogic;
 
-#if ENABLE_ZMQ
-static CZMQNotificationInterface* pzmqNotificationInterface = nullptr;
-#endif
 
 #ifdef WIN32
 // Win32 LevelDB doesn't use filedescriptors, and the ones used for
@@ -117,6 +134,7 @@ static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
 
 std::atomic<bool> fRequestShutdown(false);
 std::atomic<bool> fDumpMempoolLater(false);
+std::atomic<bool> fDumpCoinsCacheLater(false);
 
 void StartShutdown()
 {
@@ -149,6 +167,15 @@ public:
             abort();
         }
     }
+    size_t GetCoins(const std::vector<COutPoint>& outpoints, std::vector<Coin>& coins) const override {
+        try {
+            return base->GetCoins(outpoints, coins);
+        } catch(const std::runtime_error& e) {
+            uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
+            LogPrintf("Error reading from database: %s\n", e.what());
+            abort();
+        }
+    }
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
@@ -165,6 +192,15 @@ void Interrupt()
     InterruptRPC();
     InterruptREST();
     InterruptTorControl();
+    if (g_txindex) {
+        g_txindex->Interrupt();
+    }
+    if (g_blockfilterindex) {
+        g_blockfilterindex->Interrupt();
+    }
+    if (g_addressindex) {
+        g_addressindex->Interrupt();
+    }
     if (g_connman)
         g_connman->Interrupt();
 }
@@ -186,12 +222,14 @@ void Shutdown()
 
     StopHTTPRPC();
     StopREST();
+    StopHTTPEvents();
     StopRPC();
     StopHTTPServer();
 #ifdef ENABLE_WALLET
     FlushWallets();
 #endif
     MapPort(false);
+    StopUDPRelay();
 
     // Because these depend on each-other, we make sure that neither can be
     // using the other before destroying them.
@@ -206,13 +244,22 @@ void Shutdown()
     // CScheduler/checkqueue threadGroup
     threadGroup.interrupt_all();
     threadGroup.join_all();
+    // Nothing is left to wait for the tasks still queued
+    g_task_pool.Stop();
 
     if (fDumpMempoolLater && gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         DumpMempool();
     }
 
+    // Before the final flush below empties the cache
+    if (fDumpCoinsCacheLater && gArgs.GetBoolArg("-persistcoinscache", DEFAULT_PERSIST_COINS_CACHE) && pcoinsTip != nullptr) {
+        DumpCoinsCache();
+    }
+
     if (fFeeEstimatesInitialized)
     {
+        // Apply the block updates still queued for the estimator before writing it out
+        GetMainSignals().FlushBackgroundCallbacks();
         ::feeEstimator.FlushUnconfirmed(::mempool);
         fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
         CAutoFile est_fileout(fsbridge::fopen(est_path, "wb"), SER_DISK, CLIENT_VERSION);
@@ -232,6 +279,27 @@ void Shutdown()
     // CValidationInterface callbacks, flush them...
     GetMainSignals().FlushBackgroundCallbacks();
 
+    if (g_txindex) {
+        g_txindex->Stop();
+        g_txindex.reset();
+    }
+    if (g_blockfilterindex) {
+        g_blockfilterindex->Stop();
+        g_blockfilterindex.reset();
+    }
+    if (g_addressindex) {
+        g_addressindex->Stop();
+        g_addressindex.reset();
+    }
+    if (g_recenttxindex) {
+        UnregisterValidationInterface(g_recenttxindex.get());
+        g_recenttxindex.reset();
+    }
+    if (g_blocktemplatecache) {
+        UnregisterValidationInterface(g_blocktemplatecache.get());
+        g_blocktemplatecache.reset();
+    }
+
     // Any future callbacks will be dropped. This should absolutely be safe - if
     // missing a callback results in an unrecoverable situation, unclean shutdown
     // would too. The only reason to do the above flushes is to let the wallet catch
@@ -244,19 +312,26 @@ void Shutdown()
             FlushStateToDisk();
         }
         pcoinsTip.reset();
+        pcoinsprefetch.reset();
         pcoinscatcher.reset();
         pcoinsdbview.reset();
+        pcoinsstats.reset();
         pblocktree.reset();
     }
+    // Anything written since the last flush is written out before the thread stops
+    g_blockfilewriter.Stop();
+    // Pruned files still queued are deleted before the thread stops
+    g_blockfileunlinker.Stop();
 #ifdef ENABLE_WALLET
     StopWallets();
 #endif
+    g_notifyqueue.Stop();
 
 #if ENABLE_ZMQ
-    if (pzmqNotificationInterface) {
-        UnregisterValidationInterface(pzmqNotificationInterface);
-        delete pzmqNotificationInterface;
-        pzmqNotificationInterface = nullptr;
+    if (g_zmq_notification_interface) {
+        UnregisterValidationInterface(g_zmq_notification_interface);
+        delete g_zmq_notification_interface;
+        g_zmq_notification_interface = nullptr;
     }
 #endif
 
@@ -276,6 +351,7 @@ void Shutdown()
     globalVerifyHandle.reset();
     ECC_Stop();
     LogPrintf("%s: done\n", __func__);
+    StopLogThread();
 }
 
 /**
@@ -339,11 +415,24 @@ std::string HelpMessage(HelpMessageMode mode)
     std::string strUsage = HelpMessageGroup(_("Options:"));
     strUsage += HelpMessageOpt("-?", _("Print this help message and exit"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
+    strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain an index of the history and balance of every script, used by the getaddresshistory and getaddressbalance rpc calls (default: %u)"), DEFAULT_ADDRESSINDEX));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-autocompactdb", strprintf(_("Compact the chain state database in the background after the initial block download and reorganizations of at least %d blocks (default: %u)"), COMPACTDB_REORG_DEPTH, DEFAULT_AUTOCOMPACTDB));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain an index of the compact filters of all blocks (BIP 158), used by the getblockfilter rpc call (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
+    strUsage += HelpMessageOpt("-blocksdir=<dir>", _("Store the block and undo files (blk?????.dat, rev?????.dat) in <dir> instead of the data directory; the block index stays in the data directory"));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
+    strUsage += HelpMessageOpt("-blockwritequeue=<n>", strprintf(_("Write blocks and undo data on a background thread, queueing up to <n> MiB of them (0 to write on the validation thread, default: %u)"), DEFAULT_BLOCK_WRITE_QUEUE));
+    strUsage += HelpMessageOpt("-blockmmap=<n>", strprintf(_("Read blocks from memory mappings of the block files that are no longer written to, using up to <n> MiB of address space (0 to disable, default: %u)"), DEFAULT_BLOCK_MMAP_SIZE));
+    strUsage += HelpMessageOpt("-blockcompression", strprintf(_("Compress the blocks and undo data written to the block and undo files, which older versions cannot read; peers still receive blocks uncompressed (default: %u)"), DEFAULT_BLOCK_COMPRESSION));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
     strUsage +=HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s, testnet: %s)"), defaultChainParams->GetConsensus().defaultAssumeValid.GetHex(), testnetChainParams->GetConsensus().defaultAssumeValid.GetHex()));
+    strUsage += HelpMessageOpt("-coinsbackend=<backend>", strprintf(_("Store a new chainstate in LevelDB (leveldb), or in an append-only log with an in-memory index, which needs memory in proportion to the UTXO set (log). An existing chainstate keeps its backend unless rebuilt with -reindex-chainstate (default: %s)"), DEFAULT_COINS_BACKEND));
+    strUsage += HelpMessageOpt("-coinstats", strprintf(_("Maintain UTXO set statistics and a MuHash commitment to the UTXO set with every block, so that gettxoutsetinfo \"muhash\" can return them immediately (default: %u)"), DEFAULT_COINSTATS));
+    if (showDebug) {
+        strUsage += HelpMessageOpt("-compactdbinterval=<n>", strprintf("Milliseconds between compacting two of the %d slices of the chain state database (default: %d)", CHAINSTATE_COMPACTION_SLICES, DEFAULT_COMPACTDB_INTERVAL));
+    }
+    strUsage += HelpMessageOpt("-coldblocksdir=<dir>", strprintf(_("Move the block and undo files that are no longer written to, except for the %d most recent ones (see -hotblockfiles), to <dir>, e.g. on slower and cheaper storage; they are read from there"), DEFAULT_HOT_BLOCK_FILES));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), BITCOIN_CONF_FILENAME));
     if (mode == HMM_BITCOIND)
     {
@@ -356,31 +445,69 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize));
     }
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    if (showDebug) {
+        strUsage += HelpMessageOpt("-dbpartialflush", strprintf("When the coins cache is full, write it to disk and evict only the oldest unmodified coins instead of emptying it (default: %u)", DEFAULT_PARTIAL_COINS_FLUSH));
+    }
+    if (showDebug) {
+        strUsage += HelpMessageOpt("-dbcachereclaim", strprintf("After initial block download, give the unused mempool space lent to the coins cache back over %d minutes, evicting unmodified coins rather than flushing the cache to make room (default: %u)", COINS_CACHE_RECLAIM_TIME / 60, DEFAULT_COINS_CACHE_RECLAIM));
+    }
+    if (showDebug) {
+        strUsage += HelpMessageOpt("-hugepages=<mode>", strprintf("Back the coins cache and block index with huge pages: none, transparent (madvise), or explicit (reserved huge pages, falling back to transparent) (default: %s)", DEFAULT_HUGEPAGES));
+        strUsage += HelpMessageOpt("-numapolicy=<policy>", strprintf("Place the memory in huge pages on all NUMA nodes (interleave), on one node (its number), or where it is first used (default) (default: %s)", DEFAULT_NUMA_POLICY));
+    }
+    strUsage += HelpMessageOpt("-dbprofile=<profile>", strprintf(_("Tune the chainstate and block index databases for the storage: %s (default: %s)"), ListDBProfiles(), DEFAULT_DB_PROFILE));
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
+    if (showDebug) {
+        strUsage += HelpMessageOpt("-hotblockfiles=<n>", strprintf("Number of most recent block files -coldblocksdir leaves in the blocks directory (default: %u)", DEFAULT_HOT_BLOCK_FILES));
+        strUsage += HelpMessageOpt("-ibdsyncinterval=<n>", strprintf("During initial block download, only sync the block files and databases to disk every <n> blocks; after a system crash, all blocks since are verified at startup (0 = sync every flush, default: %u)", DEFAULT_IBD_SYNC_INTERVAL));
+    }
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
     strUsage += HelpMessageOpt("-debuglogfile=<file>", strprintf(_("Specify location of debug log file: this can be an absolute path or a path relative to the data directory (default: %s)"), DEFAULT_DEBUGLOGFILE));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-maxorphansize=<n>", strprintf(_("Keep unconnectable transactions in memory below <n> megabytes (default: %u)"), DEFAULT_MAX_ORPHAN_SIZE));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     if (showDebug) {
         strUsage += HelpMessageOpt("-minimumchainwork=<hex>", strprintf("Minimum work assumed to exist on a valid chain in hex (default: %s, testnet: %s)", defaultChainParams->GetConsensus().nMinimumChainWork.GetHex(), testnetChainParams->GetConsensus().nMinimumChainWork.GetHex()));
     }
+    strUsage += HelpMessageOpt("-notifybatch=<n>", strprintf(_("Run a notification command once for up to <n> notifications waiting for it, with %%s replaced by their arguments separated by spaces (default: %u)"), DEFAULT_NOTIFY_BATCH));
+    strUsage += HelpMessageOpt("-notifyqueue=<n>", strprintf(_("Keep up to <n> notification commands waiting for -notifythreads, dropping notifications beyond that (default: %u)"), DEFAULT_NOTIFY_QUEUE));
+    strUsage += HelpMessageOpt("-notifythreads=<n>", strprintf(_("Run the commands of -alertnotify, -blocknotify and -walletnotify on <n> threads (0 to run every command on a thread of its own, default: %u)"), DEFAULT_NOTIFY_THREADS));
+    strUsage += HelpMessageOpt("-persistcoinscache", strprintf(_("Whether to save the coins in the UTXO cache on shutdown and load them again in the background on restart (default: %u)"), DEFAULT_PERSIST_COINS_CACHE));
     strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
     strUsage += HelpMessageOpt("-blockreconstructionextratxn=<n>", strprintf(_("Extra transactions to keep in memory for compact block reconstructions (default: %u)"), DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    if (showDebug) {
+        strUsage += HelpMessageOpt("-parpin", strprintf("Pin each script verification thread to a CPU of its own (default: %u)", DEFAULT_SCRIPTCHECK_PINNING));
+        strUsage += HelpMessageOpt("-parworksteal", strprintf("Schedule script verification over per-thread queues with work stealing (default: %u)", DEFAULT_SCRIPTCHECK_WORK_STEALING));
+        strUsage += HelpMessageOpt("-parpipeline=<n>", strprintf("During initial block download, connect up to <n> consecutive blocks while the script checks of earlier ones are still running (0 = disabled, maximum: %u, default: %u)", MAX_SCRIPTCHECK_PIPELINE_BLOCKS, DEFAULT_SCRIPTCHECK_PIPELINE_BLOCKS));
+        strUsage += HelpMessageOpt("-parprefetch=<n>", strprintf("Set the number of threads reading the coins spent by a block from the chainstate database before it is connected (0 = disabled, maximum: %d, default: %d)", MAX_PREFETCH_THREADS, DEFAULT_PREFETCH_THREADS));
+        strUsage += HelpMessageOpt("-parblockhash", strprintf("Compute the transaction hashes of received and loaded blocks in parallel on the script verification threads (default: %u)", DEFAULT_PARALLEL_BLOCK_HASHING));
+        strUsage += HelpMessageOpt("-schedulerthreads=<n>", strprintf("Set the number of threads running background tasks and validation notifications; each wallet, index and other listener is notified on its own queue, so that they can process blocks and transactions concurrently, and one thread is kept for notifications when there are several (1 to %d, default: %d)", MAX_SCHEDULER_THREADS, DEFAULT_SCHEDULER_THREADS));
+        strUsage += HelpMessageOpt("-parheaders", strprintf("Hash received headers and check their proof of work on as many threads as -par before validating them in order (default: %u)", DEFAULT_PARALLEL_HEADER_CHECKS));
+        strUsage += HelpMessageOpt("-parverifydb", strprintf("Read and check the blocks verified at startup (-checkblocks) on as many threads as -par (default: %u)", DEFAULT_PARALLEL_VERIFYDB));
+        strUsage += HelpMessageOpt("-parreorg", strprintf("Read the blocks and undo data disconnected by a reorganization at once, on as many threads as -par, and disconnect up to 32 blocks at a time into one coins cache layer (default: %u)", DEFAULT_PARALLEL_REORG));
+        strUsage += HelpMessageOpt("-parmempool", strprintf("Verify the scripts of transactions with at least %u inputs entering the mempool, and of all transactions added back after a reorg, on as many threads as -par (default: %u)", MIN_PARALLEL_MEMPOOL_INPUTS, DEFAULT_PARALLEL_MEMPOOL_CHECKS));
+    }
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
     strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by enabling pruning (deleting) of old blocks. This allows the pruneblockchain RPC to be called to delete specific blocks, and enables automatic pruning of old blocks if a target size in MiB is provided. This mode is incompatible with -txindex and -rescan. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >=%u = automatically prune block files to stay under the specified target size in MiB)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
+    strUsage += HelpMessageOpt("-prunebackground", strprintf(_("Delete pruned block and undo files on a background thread instead of while holding up validation (default: %u)"), DEFAULT_PRUNE_BACKGROUND));
+    strUsage += HelpMessageOpt("-prunekeepblocks=<n>", strprintf(_("Keep at least the <n> most recent blocks when pruning, and offer them to peers, even if that exceeds the -prune target (minimum and default: %u)"), MIN_BLOCKS_TO_KEEP));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the blk*.dat files on disk"));
+    strUsage += HelpMessageOpt("-reindexthreads=<n>", strprintf(_("Number of threads parsing and checking the blocks of the blk*.dat files ahead of importing them during -reindex, each holding the blocks of one file in memory (0 to %d, default: %d)"), MAX_REINDEX_THREADS, DEFAULT_REINDEX_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
+    strUsage += HelpMessageOpt("-taskthreads=<n>", strprintf(_("Set the number of threads shared by parallel work other than script verification, such as loading the block index and wallets and scanning the UTXO set (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        -GetNumCores(), MAX_TASK_THREADS, DEFAULT_TASK_THREADS));
+    strUsage += HelpMessageOpt("-recenttxindex=<n>", strprintf(_("Index the transactions of the last <n> blocks in memory, for the getrawtransaction rpc call without -txindex; this takes about 100 bytes per transaction (0 = disabled, maximum: %u, default: %u)"), MAX_RECENT_TXINDEX_BLOCKS, DEFAULT_RECENT_TXINDEX_BLOCKS));
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
@@ -388,7 +515,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-banscore=<n>", strprintf(_("Threshold for disconnecting misbehaving peers (default: %u)"), DEFAULT_BANSCORE_THRESHOLD));
     strUsage += HelpMessageOpt("-bantime=<n>", strprintf(_("Number of seconds to keep misbehaving peers from reconnecting (default: %u)"), DEFAULT_MISBEHAVING_BANTIME));
     strUsage += HelpMessageOpt("-bind=<addr>", _("Bind to given address and always listen on it. Use [host]:port notation for IPv6"));
+    strUsage += HelpMessageOpt("-compressedheaders", strprintf(_("Ask peers that support it to send block headers without the fields implied by the previous header, which roughly halves the bandwidth of headers sync (default: %u)"), DEFAULT_COMPRESSED_HEADERS));
     strUsage += HelpMessageOpt("-connect=<ip>", _("Connect only to the specified node(s); -connect=0 disables automatic connections (the rules for this peer are the same as for -addnode)"));
+    strUsage += HelpMessageOpt("-connectthreads=<n>", strprintf(_("Number of outbound connection attempts, with their name lookups, to make at once (1 to %d, default: %d)"), MAX_CONNECT_THREADS, DEFAULT_CONNECT_THREADS));
     strUsage += HelpMessageOpt("-discover", _("Discover own IP addresses (default: 1 when listening and no -externalip or -proxy)"));
     strUsage += HelpMessageOpt("-dns", _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + strprintf(_("(default: %u)"), DEFAULT_NAME_LOOKUP));
     strUsage += HelpMessageOpt("-dnsseed", _("Query for peer addresses via DNS lookup, if low on addresses (default: 1 unless -connect used)"));
@@ -397,20 +526,26 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-listen", _("Accept connections from outside (default: 1 if no -proxy or -connect)"));
     strUsage += HelpMessageOpt("-listenonion", strprintf(_("Automatically create Tor hidden service (default: %d)"), DEFAULT_LISTEN_ONION));
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
+    strUsage += HelpMessageOpt("-maxhbcmpctpeers=<n>", strprintf(_("Ask at most <n> peers to announce new blocks to us as compact blocks without waiting for a request (default: %u)"), DEFAULT_MAX_HB_CMPCT_PEERS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
+    strUsage += HelpMessageOpt("-msghandlers=<n>", strprintf(_("Number of threads processing peer messages, peers are shared out among them (1 to %d, default: %d)"), MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
+    strUsage += HelpMessageOpt("-peercfilters", strprintf(_("Serve compact block filters to peers (BIP 157), requires -blockfilterindex (default: %u)"), DEFAULT_PEERCFILTERS));
+    strUsage += HelpMessageOpt("-peerbloomprematch", strprintf(_("Match all bloom filtered peers against each new block as it is connected, ahead of their requests (default: %u)"), DEFAULT_PEERBLOOMPREMATCH));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), defaultChainParams->GetDefaultPort(), testnetChainParams->GetDefaultPort()));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Wait for peer sockets to become ready with: %s (default: %s)"), ListSocketEventsModes(), DEFAULT_SOCKETEVENTS));
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
+    strUsage += HelpMessageOpt("-txreconciliation", strprintf(_("Announce transactions by set reconciliation to peers that support it, instead of flooding them with inv messages (default: %u)"), DEFAULT_TXRECONCILIATION));
 #ifdef USE_UPNP
 #if USE_UPNP
     strUsage += HelpMessageOpt("-upnp", _("Use UPnP to map the listening port (default: 1 when listening and no -proxy)"));
@@ -422,6 +557,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-whitelist=<IP address or network>", _("Whitelist peers connecting from the given IP address (e.g. 1.2.3.4) or CIDR notated network (e.g. 1.2.3.0/24). Can be specified multiple times.") +
         " " + _("Whitelisted peers cannot be DoS banned and their transactions are always relayed, even if they are already in the mempool, useful e.g. for a gateway"));
     strUsage += HelpMessageOpt("-maxuploadtarget=<n>", strprintf(_("Tries to keep outbound traffic under the given target (in MiB per 24h), 0 = no limit (default: %d)"), DEFAULT_MAX_UPLOAD_TARGET));
+    strUsage += HelpMessageOpt("-maxuploadrate=<n>", strprintf(_("Limit outbound traffic to <n> KiB per second, leaving room for new blocks before transactions and old blocks; whitelisted peers are not limited. 0 = no limit (default: %d)"), DEFAULT_MAX_UPLOAD_RATE));
+    strUsage += HelpMessageOpt("-udprelayport=<port>", strprintf(_("Send new blocks to, and receive them from, the -udprelaypeer peers over UDP on <port>, as compact blocks with forward error correction; 0 = disabled (default: %u)"), DEFAULT_UDP_RELAY_PORT));
+    strUsage += HelpMessageOpt("-udprelaypeer=<ip>[:<port>]", _("Trusted peer to relay blocks with over UDP, on the -udprelayport port if none is given. Packets are only checked to come from its address, so only use this over networks you trust. Can be specified multiple times."));
+    strUsage += HelpMessageOpt("-uploadrate=<class>:<n>", _("Limit the outbound traffic of a class to <n> KiB per second; <class> can be blockrelay, txrelay, historical or other. Can be specified multiple times."));
 
 #ifdef ENABLE_WALLET
     strUsage += GetWalletHelpString(showDebug);
@@ -433,6 +572,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubsequence=<address>", _("Enable publish hash block and tx sequence in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubhashblockhwm=<n>", strprintf(_("Set publish hash block outbound message high water mark (default: %d)"), DEFAULT_ZMQ_SNDHWM));
+    strUsage += HelpMessageOpt("-zmqpubhashtxhwm=<n>", strprintf(_("Set publish hash transaction outbound message high water mark (default: %d)"), DEFAULT_ZMQ_SNDHWM));
+    strUsage += HelpMessageOpt("-zmqpubrawblockhwm=<n>", strprintf(_("Set publish raw block outbound message high water mark (default: %d)"), DEFAULT_ZMQ_SNDHWM));
+    strUsage += HelpMessageOpt("-zmqpubrawtxhwm=<n>", strprintf(_("Set publish raw transaction outbound message high water mark (default: %d)"), DEFAULT_ZMQ_SNDHWM));
+    strUsage += HelpMessageOpt("-zmqpubsequencehwm=<n>", strprintf(_("Set publish hash sequence outbound message high water mark (default: %d)"), DEFAULT_ZMQ_SNDHWM));
+    strUsage += HelpMessageOpt("-zmqqueuesize=<n>", strprintf(_("Queue up to <n> messages for publishing; further messages are dropped until the queue drains (default: %d)"), DEFAULT_ZMQ_QUEUE_SIZE));
 #endif
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
@@ -462,10 +608,12 @@ std::string HelpMessage(HelpMessageMode mode)
         _("If <category> is not supplied or if <category> = 1, output all debugging information.") + " " + _("<category> can be:") + " " + ListLogCategories() + ".");
     strUsage += HelpMessageOpt("-debugexclude=<category>", strprintf(_("Exclude debugging information for a category. Can be used in conjunction with -debug=1 to output debug logs for all categories except one or more specified categories.")));
     strUsage += HelpMessageOpt("-help-debug", _("Show all debugging options (usage: --help -help-debug)"));
+    strUsage += HelpMessageOpt("-logasync", strprintf(_("Write debug.log from a background thread, dropping lines if it falls %u behind (default: %u)"), LOG_ASYNC_QUEUE_LINES, DEFAULT_LOGASYNC));
     strUsage += HelpMessageOpt("-logips", strprintf(_("Include IP addresses in debug output (default: %u)"), DEFAULT_LOGIPS));
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), DEFAULT_LOGTIMESTAMPS));
     if (showDebug)
     {
+        strUsage += HelpMessageOpt("-lockstats", strprintf("Time how long locks wait and are held at each place they are taken, see getlockstats (default: %u)", DEFAULT_LOCKSTATS));
         strUsage += HelpMessageOpt("-logtimemicros", strprintf("Add microsecond precision to debug timestamps (default: %u)", DEFAULT_LOGTIMEMICROS));
         strUsage += HelpMessageOpt("-mocktime=<n>", "Replace actual time with <n> seconds since epoch (default: 0)");
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit sum of signature cache and script execution cache sizes to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
@@ -500,12 +648,16 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("Block creation options:"));
     strUsage += HelpMessageOpt("-blockmaxweight=<n>", strprintf(_("Set maximum BIP141 block weight (default: %d)"), DEFAULT_BLOCK_MAX_WEIGHT));
     strUsage += HelpMessageOpt("-blockmintxfee=<amt>", strprintf(_("Set lowest fee rate (in %s/kB) for transactions to be included in block creation. (default: %s)"), CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_MIN_TX_FEE)));
+    strUsage += HelpMessageOpt("-fastblocktemplate", strprintf(_("Return new block templates without checking them with a full block validation first; as their transactions were all accepted to the mempool, they are checked in the background, and checked first again after one fails (default: %u)"), DEFAULT_FAST_BLOCK_TEMPLATE));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
 
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), DEFAULT_REST_ENABLE));
+    strUsage += HelpMessageOpt("-httpevents", strprintf(_("Stream block and mempool events to HTTP clients of /events, as Server-Sent Events (default: %u)"), DEFAULT_HTTP_EVENTS));
+    strUsage += HelpMessageOpt("-metrics", strprintf(_("Serve metrics of the node at /metrics on the RPC port, in the Prometheus text format, to clients allowed by -rpcallowip (default: %u)"), DEFAULT_HTTP_METRICS));
+    strUsage += HelpMessageOpt("-restmaxoutpoints=<n>", strprintf(_("Allow up to <n> outpoints in one batched REST getutxos request (default: %u)"), DEFAULT_REST_MAX_OUTPOINTS));
     strUsage += HelpMessageOpt("-rpcbind=<addr>[:port]", _("Bind to given address to listen for JSON-RPC connections. This option is ignored unless -rpcallowip is also passed. Port is optional and overrides -rpcport. Use [host]:port notation for IPv6. This option can be specified multiple times (default: 127.0.0.1 and ::1 i.e., localhost, or if -rpcallowip has been specified, 0.0.0.0 and :: i.e., all addresses)"));
     strUsage += HelpMessageOpt("-rpccookiefile=<loc>", _("Location of the auth cookie (default: data dir)"));
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
@@ -514,10 +666,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), defaultBaseParams->RPCPort(), testnetBaseParams->RPCPort()));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcserialversion", strprintf(_("Sets the serialization of raw transaction or block hex returned in non-verbose mode, non-segwit(0) or segwit(1) (default: %d)"), DEFAULT_RPC_SERIALIZE_VERSION));
+    strUsage += HelpMessageOpt("-rpcbatchthreads=<n>", strprintf(_("Execute consecutive read-only calls of a JSON-RPC batch, such as getrawtransaction and getblockheader, on up to <n> threads per batch (default: %d)"), DEFAULT_RPC_BATCH_THREADS));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
     if (showDebug) {
         strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
+        strUsage += HelpMessageOpt("-rpcfairqueue", strprintf("Serve connections with requests in the work queue in turn, and let no connection take more than half of the queue (default: %u)", DEFAULT_HTTP_FAIR_QUEUE));
     }
 
     return strUsage;
@@ -552,8 +706,7 @@ static void BlockNotifyCallback(bool initialSync, const CBlockIndex *pBlockIndex
 
     std::string strCmd = gArgs.GetArg("-blocknotify", "");
     if (!strCmd.empty()) {
-        boost::replace_all(strCmd, "%s", pBlockIndex->GetBlockHash().GetHex());
-        boost::thread t(runCommand, strCmd); // thread runs free
+        g_notifyqueue.Notify(strCmd, pBlockIndex->GetBlockHash().GetHex());
     }
 }
 
@@ -600,16 +753,20 @@ void CleanupBlockRevFiles()
     // Remove the rev files immediately and insert the blk file paths into an
     // ordered map keyed by block file index.
     LogPrintf("Removing unusable blk?????.dat and rev?????.dat files for -reindex with -prune\n");
-    fs::path blocksdir = GetDataDir() / "blocks";
-    for (fs::directory_iterator it(blocksdir); it != fs::directory_iterator(); it++) {
-        if (fs::is_regular_file(*it) &&
-            it->path().filename().string().length() == 12 &&
-            it->path().filename().string().substr(8,4) == ".dat")
-        {
-            if (it->path().filename().string().substr(0,3) == "blk")
-                mapBlockFiles[it->path().filename().string().substr(3,5)] = it->path();
-            else if (it->path().filename().string().substr(0,3) == "rev")
-                remove(it->path());
+    // Both the blocks directory and -coldblocksdir may hold them.
+    for (const fs::path& blocksdir : {GetBlocksDir(), GetColdBlocksDir()}) {
+        if (blocksdir.empty())
+            continue;
+        for (fs::directory_iterator it(blocksdir); it != fs::directory_iterator(); it++) {
+            if (fs::is_regular_file(*it) &&
+                it->path().filename().string().length() == 12 &&
+                it->path().filename().string().substr(8,4) == ".dat")
+            {
+                if (it->path().filename().string().substr(0,3) == "blk")
+                    mapBlockFiles[it->path().filename().string().substr(3,5)] = it->path();
+                else if (it->path().filename().string().substr(0,3) == "rev")
+                    remove(it->path());
+            }
         }
     }
 
@@ -637,17 +794,23 @@ void ThreadImport(std::vector<fs::path> vImportFiles)
 
     // -reindex
     if (fReindex) {
-        int nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!fs::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(chainparams, file, &pos);
-            nFile++;
+        const int nReindexThreads = std::min(std::max<int>(gArgs.GetArg("-reindexthreads", DEFAULT_REINDEX_THREADS), 0), MAX_REINDEX_THREADS);
+        if (nReindexThreads > 0) {
+            LogPrintf("Reindexing with %d block file parsing threads\n", nReindexThreads);
+            ReindexBlockFiles(chainparams, nReindexThreads);
+        } else {
+            int nFile = 0;
+            while (true) {
+                CDiskBlockPos pos(nFile, 0);
+                if (!fs::exists(GetBlockPosFilename(pos, "blk")))
+                    break; // No block files left to reindex
+                FILE *file = OpenBlockFile(pos, true);
+                if (!file)
+                    break; // This error is logged in OpenBlockFile
+                LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
+                LoadExternalBlockFile(chainparams, file, &pos);
+                nFile++;
+            }
         }
         pblocktree->WriteReindexing(false);
         fReindex = false;
@@ -695,6 +858,10 @@ void ThreadImport(std::vector<fs::path> vImportFiles)
         return;
     }
     } // End scope of CImportingNow
+    if (gArgs.GetBoolArg("-persistcoinscache", DEFAULT_PERSIST_COINS_CACHE)) {
+        LoadCoinsCache();
+        fDumpCoinsCacheLater = !fRequestShutdown;
+    }
     if (gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         LoadMempool();
         fDumpMempoolLater = !fRequestShutdown;
@@ -735,6 +902,8 @@ bool AppInitServers()
         return false;
     if (gArgs.GetBoolArg("-rest", DEFAULT_REST_ENABLE) && !StartREST())
         return false;
+    if (gArgs.GetBoolArg("-httpevents", DEFAULT_HTTP_EVENTS) && !StartHTTPEvents())
+        return false;
     if (!StartHTTPServer())
         return false;
     return true;
@@ -831,6 +1000,7 @@ namespace { // Variables internal to initialization process only
 int nMaxConnections;
 int nUserMaxConnections;
 int nFD;
+SocketEventsMode socketEventsMode = SocketEventsMode::SELECT;
 ServiceFlags nLocalServices = ServiceFlags(NODE_NETWORK | NODE_NETWORK_LIMITED);
 
 } // namespace
@@ -910,7 +1080,25 @@ bool AppInitParameterInteraction()
     if (gArgs.GetArg("-prune", 0)) {
         if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (gArgs.GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Prune mode is incompatible with -blockfilterindex."));
+        if (gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX))
+            return InitError(_("Prune mode is incompatible with -addressindex."));
+    }
+
+    if (!fs::is_directory(GetBlocksDir()))
+        return InitError(strprintf(_("Specified blocks directory \"%s\" does not exist."), gArgs.GetArg("-blocksdir", "")));
+    if (gArgs.IsArgSet("-coldblocksdir")) {
+        if (GetColdBlocksDir().empty())
+            return InitError(strprintf(_("Specified cold blocks directory \"%s\" does not exist."), gArgs.GetArg("-coldblocksdir", "")));
+        if (fs::equivalent(GetColdBlocksDir(), GetBlocksDir()))
+            return InitError(_("Cannot set -coldblocksdir to the blocks directory."));
     }
+    nHotBlockFiles = std::max<int>(gArgs.GetArg("-hotblockfiles", DEFAULT_HOT_BLOCK_FILES), 0);
+
+    // Filters can only be served from the index
+    if (gArgs.GetBoolArg("-peercfilters", DEFAULT_PEERCFILTERS) && !gArgs.GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+        return InitError(_("Cannot set -peercfilters without -blockfilterindex."));
 
     // -bind and -whitebind can't be set when not listening
     size_t nUserBind = gArgs.GetArgs("-bind").size() + gArgs.GetArgs("-whitebind").size();
@@ -918,17 +1106,42 @@ bool AppInitParameterInteraction()
         return InitError("Cannot set -bind or -whitebind together with -listen=0");
     }
 
+    // The database profile may keep more table files open than the default,
+    // which MIN_CORE_FILEDESCRIPTORS accounts for.
+    DBOptions chainstateOptions, blockIndexOptions;
+    const std::string strDBProfile = gArgs.GetArg("-dbprofile", DEFAULT_DB_PROFILE);
+    if (!GetDBProfile(strDBProfile, DBKind::CHAINSTATE, chainstateOptions) || !GetDBProfile(strDBProfile, DBKind::BLOCK_INDEX, blockIndexOptions)) {
+        return InitError(strprintf(_("Unknown -dbprofile '%s' (must be one of: %s)"), strDBProfile, ListDBProfiles()));
+    }
+    if (!IsCoinsBackend(gArgs.GetArg("-coinsbackend", DEFAULT_COINS_BACKEND))) {
+        return InitError(strprintf(_("Unknown -coinsbackend '%s' (must be one of: %s)"), gArgs.GetArg("-coinsbackend", DEFAULT_COINS_BACKEND), "leveldb, log"));
+    }
+    const int nCoreFileDescriptors = MIN_CORE_FILEDESCRIPTORS ? MIN_CORE_FILEDESCRIPTORS + std::max(0, chainstateOptions.max_open_files + blockIndexOptions.max_open_files - 2 * DEFAULT_DB_OPTIONS.max_open_files) : 0;
+
     // Make sure enough file descriptors are available
     int nBind = std::max(nUserBind, size_t(1));
     nUserMaxConnections = gArgs.GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
-    // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
-    nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS);
-    if (nFD < MIN_CORE_FILEDESCRIPTORS)
+    const std::string strSocketEvents = gArgs.GetArg("-socketevents", DEFAULT_SOCKETEVENTS);
+    if (!GetSocketEventsMode(strSocketEvents, socketEventsMode)) {
+        return InitError(strprintf(_("Unknown -socketevents '%s' (must be one of: %s)"), strSocketEvents, ListSocketEventsModes()));
+    }
+
+    // Trim requested connection counts, to fit into system limitations.
+    // Without poll() every socket has to fit an fd_set (see IsSelectableSocket).
+#ifdef USE_POLL
+    const bool fFdSetLimited = socketEventsMode == SocketEventsMode::SELECT;
+#else
+    const bool fFdSetLimited = true;
+#endif
+    if (fFdSetLimited) {
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - nCoreFileDescriptors - MAX_ADDNODE_CONNECTIONS)), 0);
+    }
+    nFD = RaiseFileDescriptorLimit(nMaxConnections + nCoreFileDescriptors + MAX_ADDNODE_CONNECTIONS);
+    if (nFD < nCoreFileDescriptors)
         return InitError(_("Not enough file descriptors available."));
-    nMaxConnections = std::min(nFD - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS, nMaxConnections);
+    nMaxConnections = std::min(nFD - nCoreFileDescriptors - MAX_ADDNODE_CONNECTIONS, nMaxConnections);
 
     if (nMaxConnections < nUserMaxConnections)
         InitWarning(strprintf(_("Reducing -maxconnections from %d to %d, because of system limitations."), nUserMaxConnections, nMaxConnections));
@@ -986,6 +1199,7 @@ bool AppInitParameterInteraction()
         mempool.setSanityCheck(1.0 / ratio);
     }
     fCheckBlockIndex = gArgs.GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
+    g_lock_stats = gArgs.GetBoolArg("-lockstats", DEFAULT_LOCKSTATS);
     fCheckpointsEnabled = gArgs.GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
     hashAssumeValid = uint256S(gArgs.GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
@@ -1023,6 +1237,17 @@ bool AppInitParameterInteraction()
         incrementalRelayFee = CFeeRate(n);
     }
 
+    // Before the block index or the coins cache allocate anything
+    LargePageMode largePageMode;
+    if (!ParseLargePageMode(gArgs.GetArg("-hugepages", DEFAULT_HUGEPAGES), largePageMode))
+        return InitError(strprintf("Unknown -hugepages mode: %s", gArgs.GetArg("-hugepages", DEFAULT_HUGEPAGES)));
+    NumaPolicy numaPolicy;
+    int nNumaNode;
+    if (!ParseNumaPolicy(gArgs.GetArg("-numapolicy", DEFAULT_NUMA_POLICY), numaPolicy, nNumaNode))
+        return InitError(strprintf("Unknown -numapolicy: %s", gArgs.GetArg("-numapolicy", DEFAULT_NUMA_POLICY)));
+    if (!SetLargePageMode(largePageMode, numaPolicy, nNumaNode))
+        InitWarning("-hugepages and -numapolicy are not supported on this system and are ignored.");
+
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = gArgs.GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
     if (nScriptCheckThreads <= 0)
@@ -1031,6 +1256,14 @@ bool AppInitParameterInteraction()
         nScriptCheckThreads = 0;
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+    fPinScriptCheckThreads = gArgs.GetBoolArg("-parpin", DEFAULT_SCRIPTCHECK_PINNING);
+    fParallelBlockHashing = gArgs.GetBoolArg("-parblockhash", DEFAULT_PARALLEL_BLOCK_HASHING);
+    fParallelMempoolChecks = gArgs.GetBoolArg("-parmempool", DEFAULT_PARALLEL_MEMPOOL_CHECKS);
+    fParallelHeaderChecks = gArgs.GetBoolArg("-parheaders", DEFAULT_PARALLEL_HEADER_CHECKS);
+    fParallelVerifyDB = gArgs.GetBoolArg("-parverifydb", DEFAULT_PARALLEL_VERIFYDB);
+    fParallelReorg = gArgs.GetBoolArg("-parreorg", DEFAULT_PARALLEL_REORG);
+    nPrefetchThreads = std::min<int>(std::max<int>(gArgs.GetArg("-parprefetch", DEFAULT_PREFETCH_THREADS), 0), MAX_PREFETCH_THREADS);
+    nScriptCheckPipelineBlocks = std::min<unsigned int>(std::max<int64_t>(gArgs.GetArg("-parpipeline", DEFAULT_SCRIPTCHECK_PIPELINE_BLOCKS), 0), MAX_SCRIPTCHECK_PIPELINE_BLOCKS);
 
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
     int64_t nPruneArg = gArgs.GetArg("-prune", 0);
@@ -1049,6 +1282,16 @@ bool AppInitParameterInteraction()
         LogPrintf("Prune configured to target %uMiB on disk for block and undo files.\n", nPruneTarget / 1024 / 1024);
         fPruneMode = true;
     }
+    if (fPruneMode) {
+        int64_t nKeepBlocksArg = gArgs.GetArg("-prunekeepblocks", MIN_BLOCKS_TO_KEEP);
+        if (nKeepBlocksArg < MIN_BLOCKS_TO_KEEP || nKeepBlocksArg > std::numeric_limits<int>::max()) {
+            return InitError(strprintf(_("-prunekeepblocks must be at least %u."), MIN_BLOCKS_TO_KEEP));
+        }
+        nPruneKeepBlocks = (unsigned int) nKeepBlocksArg;
+        if (nPruneKeepBlocks > MIN_BLOCKS_TO_KEEP) {
+            LogPrintf("Prune keeping the %u most recent blocks.\n", nPruneKeepBlocks);
+        }
+    }
 
     nConnectTimeout = gArgs.GetArg("-timeout", DEFAULT_CONNECT_TIMEOUT);
     if (nConnectTimeout <= 0)
@@ -1106,6 +1349,9 @@ bool AppInitParameterInteraction()
     if (gArgs.GetBoolArg("-peerbloomfilters", DEFAULT_PEERBLOOMFILTERS))
         nLocalServices = ServiceFlags(nLocalServices | NODE_BLOOM);
 
+    if (gArgs.GetBoolArg("-peercfilters", DEFAULT_PEERCFILTERS))
+        nLocalServices = ServiceFlags(nLocalServices | NODE_COMPACT_FILTERS);
+
     if (gArgs.GetArg("-rpcserialversion", DEFAULT_RPC_SERIALIZE_VERSION) < 0)
         return InitError("rpcserialversion must be non-negative.");
 
@@ -1177,6 +1423,8 @@ bool AppInitSanityChecks()
     // Initialize elliptic curve code
     std::string sha256_algo = SHA256AutoDetect();
     LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
+    std::string aes_algo = AESAutoDetect();
+    LogPrintf("Using the '%s' AES implementation\n", aes_algo);
     RandomInit();
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1220,6 +1468,8 @@ bool AppInitMain()
         if (!OpenDebugLog()) {
             return InitError(strprintf("Could not open debug log file %s", GetDebugLogPath().string()));
         }
+        if (gArgs.GetBoolArg("-logasync", DEFAULT_LOGASYNC))
+            StartLogThread();
     }
 
     if (!fLogTimestamps)
@@ -1243,16 +1493,56 @@ bool AppInitMain()
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
+        SetScriptCheckWorkStealing(gArgs.GetBoolArg("-parworksteal", DEFAULT_SCRIPTCHECK_WORK_STEALING));
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        if (fParallelBlockHashing) {
+            for (int i=0; i<nScriptCheckThreads-1; i++)
+                threadGroup.create_thread(&ThreadTxHashCheck);
+        }
+        if (fParallelHeaderChecks) {
+            for (int i=0; i<nScriptCheckThreads-1; i++)
+                threadGroup.create_thread(&ThreadHeaderCheck);
+        }
+        if (fParallelVerifyDB) {
+            for (int i=0; i<nScriptCheckThreads-1; i++)
+                threadGroup.create_thread(&ThreadVerifyDBCheck);
+        }
+        if (fParallelReorg) {
+            for (int i=0; i<nScriptCheckThreads-1; i++)
+                threadGroup.create_thread(&ThreadReorgReadCheck);
+        }
+        // These also check the scripts of transactions loaded from mempool.dat
+        if (fParallelMempoolChecks || gArgs.GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+            for (int i=0; i<nScriptCheckThreads-1; i++)
+                threadGroup.create_thread(&ThreadMempoolScriptCheck);
+        }
+    }
+    int nTaskThreads = gArgs.GetArg("-taskthreads", DEFAULT_TASK_THREADS);
+    if (nTaskThreads <= 0)
+        nTaskThreads += GetNumCores();
+    nTaskThreads = std::max(1, std::min(nTaskThreads, MAX_TASK_THREADS));
+    LogPrintf("Using %u threads for the task pool\n", nTaskThreads);
+    g_task_pool.Start(nTaskThreads);
+    if (nPrefetchThreads) {
+        LogPrintf("Using %u threads for input prefetching\n", nPrefetchThreads);
+        for (int i=0; i<nPrefetchThreads-1; i++)
+            threadGroup.create_thread(&ThreadPrefetchCheck);
     }
 
-    // Start the lightweight task scheduler thread
+    // Start the lightweight task scheduler threads
+    int nSchedulerThreads = std::max(1, std::min(MAX_SCHEDULER_THREADS, (int)gArgs.GetArg("-schedulerthreads", DEFAULT_SCHEDULER_THREADS)));
+    if (nSchedulerThreads > 1) {
+        LogPrintf("Using %u scheduler threads\n", nSchedulerThreads);
+    }
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
-    threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    for (int i = 0; i < nSchedulerThreads; i++) {
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    }
 
     GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
     GetMainSignals().RegisterWithMempoolSignals(mempool);
+    mempool.setDeferFeeEstimates(true);
 
     /* Register RPC commands regardless of -server setting so they will be
      * available in the GUI RPC console even if external calls are disabled.
@@ -1262,6 +1552,9 @@ bool AppInitMain()
 #ifdef ENABLE_WALLET
     RegisterWalletRPC(tableRPC);
 #endif
+#if ENABLE_ZMQ
+    RegisterZMQRPCCommands(tableRPC);
+#endif
 
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
@@ -1293,7 +1586,10 @@ bool AppInitMain()
     CConnman& connman = *g_connman;
 
     peerLogic.reset(new PeerLogicValidation(&connman, scheduler));
-    RegisterValidationInterface(peerLogic.get());
+    RegisterValidationInterface(peerLogic.get(), true);
+
+    g_blocktemplatecache.reset(new BlockTemplateCache(chainparams));
+    RegisterValidationInterface(g_blocktemplatecache.get(), true);
 
     // sanitize comments per BIP-0014, format user agent and check total size
     std::vector<std::string> uacomments;
@@ -1382,10 +1678,10 @@ bool AppInitMain()
     }
 
 #if ENABLE_ZMQ
-    pzmqNotificationInterface = CZMQNotificationInterface::Create();
+    g_zmq_notification_interface = CZMQNotificationInterface::Create();
 
-    if (pzmqNotificationInterface) {
-        RegisterValidationInterface(pzmqNotificationInterface);
+    if (g_zmq_notification_interface) {
+        RegisterValidationInterface(g_zmq_notification_interface, true);
     }
 #endif
     uint64_t nMaxOutboundLimit = 0; //unlimited unless -maxuploadtarget is set
@@ -1404,18 +1700,76 @@ bool AppInitMain()
     int64_t nTotalCache = (gArgs.GetArg("-dbcache", nDefaultDbCache) << 20);
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greater than nMaxDbcache
-    int64_t nBlockTreeDBCache = nTotalCache / 8;
-    nBlockTreeDBCache = std::min(nBlockTreeDBCache, (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
+    int64_t nBlockTreeDBCache = std::min(nTotalCache / 8, nMaxBlockDBCache << 20);
     nTotalCache -= nBlockTreeDBCache;
+    int64_t nTxIndexCache = std::min(nTotalCache / 8, gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxTxIndexCache << 20 : 0);
+    nTotalCache -= nTxIndexCache;
+    int64_t nFilterIndexCache = std::min(nTotalCache / 8, gArgs.GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX) ? nMaxFilterIndexCache << 20 : 0);
+    nTotalCache -= nFilterIndexCache;
+    int64_t nAddressIndexCache = std::min(nTotalCache / 8, gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX) ? nMaxAddressIndexCache << 20 : 0);
+    nTotalCache -= nAddressIndexCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
+    fPartialCoinsFlush = gArgs.GetBoolArg("-dbpartialflush", DEFAULT_PARTIAL_COINS_FLUSH);
+    fCoinsCacheReclaim = gArgs.GetBoolArg("-dbcachereclaim", DEFAULT_COINS_CACHE_RECLAIM);
+    nIBDSyncInterval = std::max<int>(gArgs.GetArg("-ibdsyncinterval", DEFAULT_IBD_SYNC_INTERVAL), 0);
+    fAutoCompactDB = gArgs.GetBoolArg("-autocompactdb", DEFAULT_AUTOCOMPACTDB);
     int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+        LogPrintf("* Using %.1fMiB for transaction index database\n", nTxIndexCache * (1.0 / 1024 / 1024));
+    }
+    if (gArgs.GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX)) {
+        LogPrintf("* Using %.1fMiB for block filter index database\n", nFilterIndexCache * (1.0 / 1024 / 1024));
+    }
+    if (gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
+        LogPrintf("* Using %.1fMiB for address index database\n", nAddressIndexCache * (1.0 / 1024 / 1024));
+    }
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
+    // The profile was checked in AppInitParameterInteraction
+    const std::string strDBProfile = gArgs.GetArg("-dbprofile", DEFAULT_DB_PROFILE);
+    DBOptions chainstateOptions, blockIndexOptions;
+    GetDBProfile(strDBProfile, DBKind::CHAINSTATE, chainstateOptions);
+    GetDBProfile(strDBProfile, DBKind::BLOCK_INDEX, blockIndexOptions);
+    LogPrintf("* Using database profile %s\n", strDBProfile);
+    int64_t nBlockMmapSize = std::max<int64_t>(gArgs.GetArg("-blockmmap", DEFAULT_BLOCK_MMAP_SIZE), 0);
+    if (sizeof(void*) < 8) {
+        // Leave most of a 32-bit address space to everything else
+        nBlockMmapSize = std::min<int64_t>(nBlockMmapSize, 512);
+    }
+    g_blockfilemaps.SetMaxBytes(nBlockMmapSize << 20);
+    if (nBlockMmapSize > 0) {
+        LogPrintf("* Using up to %dMiB of address space for mapping block files\n", nBlockMmapSize);
+    }
+    fBlockCompression = gArgs.GetBoolArg("-blockcompression", DEFAULT_BLOCK_COMPRESSION);
+    if (fBlockCompression) {
+        LogPrintf("* Compressing the blocks and undo data written to disk\n");
+    }
+    int64_t nBlockWriteQueue = std::max<int64_t>(gArgs.GetArg("-blockwritequeue", DEFAULT_BLOCK_WRITE_QUEUE), 0);
+    if (nBlockWriteQueue > 0) {
+        LogPrintf("* Using up to %dMiB for block and undo data waiting to be written\n", nBlockWriteQueue);
+        g_blockfilewriter.Start(nBlockWriteQueue << 20);
+    }
+    if (fPruneMode && gArgs.GetBoolArg("-prunebackground", DEFAULT_PRUNE_BACKGROUND)) {
+        LogPrintf("* Deleting pruned block files in the background\n");
+        g_blockfileunlinker.Start();
+    }
+    int nNotifyThreads = gArgs.GetArg("-notifythreads", DEFAULT_NOTIFY_THREADS);
+    if (nNotifyThreads > 0) {
+        int nNotifyQueue = std::max<int64_t>(gArgs.GetArg("-notifyqueue", DEFAULT_NOTIFY_QUEUE), 1);
+        int nNotifyBatch = std::max<int64_t>(gArgs.GetArg("-notifybatch", DEFAULT_NOTIFY_BATCH), 1);
+        LogPrintf("* Running notification commands on %d threads, queueing up to %d of them\n", nNotifyThreads, nNotifyQueue);
+        g_notifyqueue.Start(nNotifyThreads, nNotifyQueue, nNotifyBatch);
+    }
+
+    if (!GetColdBlocksDir().empty()) {
+        LogPrintf("* Moving block files to %s, keeping the %d most recent ones in %s\n", GetColdBlocksDir().string(), nHotBlockFiles, GetBlocksDir().string());
+        LoadColdBlockFiles();
+    }
 
     bool fLoaded = false;
     while (!fLoaded && !fRequestShutdown) {
@@ -1429,12 +1783,13 @@ bool AppInitMain()
             try {
                 UnloadBlockIndex();
                 pcoinsTip.reset();
+                pcoinsprefetch.reset();
                 pcoinsdbview.reset();
                 pcoinscatcher.reset();
                 // new CBlockTreeDB tries to delete the existing file, which
                 // fails if it's still open from the previous loop. Close it first:
                 pblocktree.reset();
-                pblocktree.reset(new CBlockTreeDB(nBlockTreeDBCache, false, fReset));
+                pblocktree.reset(new CBlockTreeDB(nBlockTreeDBCache, false, fReset, blockIndexOptions));
 
                 if (fReset) {
                     pblocktree->WriteReindexing(true);
@@ -1445,8 +1800,7 @@ bool AppInitMain()
 
                 if (fRequestShutdown) break;
 
-                // LoadBlockIndex will load fTxIndex from the db, or set it if
-                // we're reindexing. It will also load fHavePruned if we've
+                // LoadBlockIndex will load fHavePruned if we've
                 // ever removed a block file from disk.
                 // Note that it also sets fReindex based on the disk flag!
                 // From here on out fReindex and fReset mean something different!
@@ -1460,10 +1814,16 @@ bool AppInitMain()
                 if (!mapBlockIndex.empty() && mapBlockIndex.count(chainparams.GetConsensus().hashGenesisBlock) == 0)
                     return InitError(_("Incorrect or no genesis block found. Wrong datadir for network?"));
 
-                // Check for changed -txindex state
-                if (fTxIndex != gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
-                    strLoadError = _("You need to rebuild the database using -reindex to change -txindex");
-                    break;
+                // The transaction index of older versions is moved to its own
+                // database when -txindex is set, and left unused otherwise
+                bool fLegacyTxIndex = false;
+                pblocktree->ReadFlag("txindex", fLegacyTxIndex);
+                if (fLegacyTxIndex && !gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+                    LogPrintf("Disabling the transaction index kept in the block index database\n");
+                    if (!pblocktree->WriteFlag("txindex", false)) {
+                        strLoadError = _("Error initializing block database");
+                        break;
+                    }
                 }
 
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
@@ -1473,6 +1833,30 @@ bool AppInitMain()
                     break;
                 }
 
+                // The blocks below a UTXO snapshot are not available to rebuild the chainstate from.
+                bool fSnapshotLoading = false;
+                pblocktree->ReadFlag("snapshotloading", fSnapshotLoading);
+                if (fSnapshotLoading && !fReindexChainState) {
+                    strLoadError = _("Loading of a UTXO snapshot was interrupted. You need to rebuild the database using -reindex-chainstate");
+                    break;
+                }
+                if (fSnapshotChainstate && fReindexChainState) {
+                    return InitError(_("The chainstate was loaded from a UTXO snapshot and cannot be rebuilt with -reindex-chainstate. Use full -reindex instead."));
+                }
+                if (fSnapshotChainstate && gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+                    return InitError(_("The chainstate was loaded from a UTXO snapshot, and the blocks below it are not available to build -txindex from."));
+                }
+                if (fSnapshotChainstate && gArgs.GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX)) {
+                    return InitError(_("The chainstate was loaded from a UTXO snapshot, and the blocks below it are not available to build -blockfilterindex from."));
+                }
+                if (fSnapshotChainstate && gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
+                    return InitError(_("The chainstate was loaded from a UTXO snapshot, and the blocks below it are not available to build -addressindex from."));
+                }
+                if (fSnapshotLoading && !pblocktree->WriteFlag("snapshotloading", false)) {
+                    strLoadError = _("Error initializing block database");
+                    break;
+                }
+
                 // At this point blocktree args are consistent with what's on disk.
                 // If we're not mid-reindex (based on disk + args), add a genesis block on disk
                 // (otherwise we use the one already on disk).
@@ -1485,7 +1869,18 @@ bool AppInitMain()
                 // At this point we're either in reindex or we've loaded a useful
                 // block tree into mapBlockIndex!
 
-                pcoinsdbview.reset(new CCoinsViewDB(nCoinDBCache, false, fReset || fReindexChainState));
+                // The storage is chosen when the chainstate is created, and
+                // kept until it is rebuilt
+                std::string strCoinsBackend = gArgs.GetArg("-coinsbackend", DEFAULT_COINS_BACKEND);
+                const std::string strExistingBackend = DetectCoinsBackend(GetDataDir() / "chainstate");
+                if (!fReset && !fReindexChainState && !strExistingBackend.empty() && strExistingBackend != strCoinsBackend) {
+                    if (gArgs.IsArgSet("-coinsbackend")) {
+                        return InitError(strprintf(_("The chainstate is stored with -coinsbackend=%s. Rebuild it with -reindex-chainstate to switch to %s."), strExistingBackend, strCoinsBackend));
+                    }
+                    strCoinsBackend = strExistingBackend;
+                }
+                LogPrintf("Using the %s chainstate backend\n", strCoinsBackend);
+                pcoinsdbview = OpenCoinsViewStore(strCoinsBackend, nCoinDBCache, false, fReset || fReindexChainState, chainstateOptions);
                 pcoinscatcher.reset(new CCoinsViewErrorCatcher(pcoinsdbview.get()));
 
                 // If necessary, upgrade from older database format.
@@ -1502,7 +1897,15 @@ bool AppInitMain()
                 }
 
                 // The on-disk coinsdb is now in a good state, create the cache
-                pcoinsTip.reset(new CCoinsViewCache(pcoinscatcher.get()));
+                if (nPrefetchThreads) {
+                    pcoinsprefetch.reset(new CCoinsViewPrefetch(pcoinscatcher.get(), pcoinsdbview.get()));
+                    pcoinsTip.reset(new CCoinsViewCache(pcoinsprefetch.get()));
+                } else {
+                    pcoinsTip.reset(new CCoinsViewCache(pcoinscatcher.get()));
+                }
+                pcoinsTip->UseLargePages();
+                pcoinsTip->SetMetrics(RegisterMetricCounter("bitcoin_coins_cache_hits_total", "Coins looked up and found in the UTXO cache"),
+                                      RegisterMetricCounter("bitcoin_coins_cache_misses_total", "Coins looked up and read from the chainstate database"));
 
                 bool is_coinsview_empty = fReset || fReindexChainState || pcoinsTip->GetBestBlock().IsNull();
                 if (!is_coinsview_empty) {
@@ -1527,9 +1930,9 @@ bool AppInitMain()
 
                 if (!is_coinsview_empty) {
                     uiInterface.InitMessage(_("Verifying blocks..."));
-                    if (fHavePruned && gArgs.GetArg("-checkblocks", DEFAULT_CHECKBLOCKS) > MIN_BLOCKS_TO_KEEP) {
+                    if (fHavePruned && gArgs.GetArg("-checkblocks", DEFAULT_CHECKBLOCKS) > nPruneKeepBlocks) {
                         LogPrintf("Prune: pruned datadir may not have more than %d blocks; only checking available blocks",
-                            MIN_BLOCKS_TO_KEEP);
+                            nPruneKeepBlocks);
                     }
 
                     {
@@ -1544,8 +1947,16 @@ bool AppInitMain()
                         }
                     }
 
-                    if (!CVerifyDB().VerifyDB(chainparams, pcoinsdbview.get(), gArgs.GetArg("-checklevel", DEFAULT_CHECKLEVEL),
-                                  gArgs.GetArg("-checkblocks", DEFAULT_CHECKBLOCKS))) {
+                    int nCheckLevel = gArgs.GetArg("-checklevel", DEFAULT_CHECKLEVEL);
+                    int nCheckDepth = gArgs.GetArg("-checkblocks", DEFAULT_CHECKBLOCKS);
+                    if (nSyncCheckpointHeight >= 0 && nCheckDepth > 0) {
+                        // The node may have lost writes after the last sync
+                        // checkpoint; verify all the blocks above it
+                        LOCK(cs_main);
+                        nCheckLevel = std::max(nCheckLevel, 3);
+                        nCheckDepth = std::max(nCheckDepth, chainActive.Height() - nSyncCheckpointHeight);
+                    }
+                    if (!CVerifyDB().VerifyDB(chainparams, pcoinsdbview.get(), nCheckLevel, nCheckDepth)) {
                         strLoadError = _("Corrupted block database detected");
                         break;
                     }
@@ -1591,6 +2002,51 @@ bool AppInitMain()
         LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
     }
 
+    if (gArgs.GetBoolArg("-coinstats", DEFAULT_COINSTATS)) {
+        uiInterface.InitMessage(_("Loading UTXO set statistics..."));
+        if (!LoadCoinsStats()) {
+            return InitError(_("Error computing UTXO set statistics"));
+        }
+    }
+
+    // Build the transaction index from where it left off, in the background
+    if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+        g_txindex.reset(new CTxIndex(nTxIndexCache, false, fReindex));
+        g_txindex->Start();
+    }
+
+    // Likewise the block filter index
+    if (gArgs.GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX)) {
+        g_blockfilterindex.reset(new CBlockFilterIndex(BlockFilterType::BASIC, nFilterIndexCache, false, fReindex));
+        g_blockfilterindex->Start();
+    }
+
+    // And the address index
+    if (gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
+        g_addressindex.reset(new CAddressIndex(nAddressIndexCache, false, fReindex));
+        g_addressindex->Start();
+    }
+
+    // Index the transactions of the most recent blocks in memory, unless all
+    // of them are. They are loaded under cs_main, so that the index follows on
+    // from the tip with the first block connected.
+    const int nRecentTxIndexBlocks = std::min<int64_t>(gArgs.GetArg("-recenttxindex", DEFAULT_RECENT_TXINDEX_BLOCKS), MAX_RECENT_TXINDEX_BLOCKS);
+    if (nRecentTxIndexBlocks > 0 && !g_txindex) {
+        LOCK(cs_main);
+        g_recenttxindex.reset(new CRecentTxIndex(nRecentTxIndexBlocks));
+        g_recenttxindex->Load(chainparams.GetConsensus());
+        RegisterValidationInterface(g_recenttxindex.get(), true);
+    }
+
+    // Move old block files to -coldblocksdir, one at a time, in the background.
+    if (!GetColdBlocksDir().empty()) {
+        scheduler.scheduleEvery(MoveColdBlockFiles, COLD_BLOCK_FILES_INTERVAL);
+    }
+
+    // Compact the chainstate in slices, in the background, when requested.
+    const int64_t nCompactDBInterval = std::max<int64_t>(gArgs.GetArg("-compactdbinterval", DEFAULT_COMPACTDB_INTERVAL), 1);
+    scheduler.scheduleEvery(std::bind(CompactChainstateSlice, nCompactDBInterval), nCompactDBInterval);
+
     fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fsbridge::fopen(est_path, "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1615,9 +2071,15 @@ bool AppInitMain()
         nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
         if (!fReindex) {
             uiInterface.InitMessage(_("Pruning blockstore..."));
+            if (fHavePruned)
+                UnlinkLeftoverPrunedFiles();
             PruneAndFlush();
         }
     }
+    if (fSnapshotChainstate && (nLocalServices & NODE_NETWORK)) {
+        LogPrintf("Unsetting NODE_NETWORK as the blocks below the UTXO snapshot are missing\n");
+        nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
+    }
 
     if (chainparams.GetConsensus().vDeployments[Consensus::DEPLOYMENT_SEGWIT].nTimeout != 0) {
         // Only advertise witness capabilities if they have a reasonable start time.
@@ -1699,9 +2161,23 @@ bool AppInitMain()
     connOptions.nSendBufferMaxSize = 1000*gArgs.GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER);
     connOptions.nReceiveFloodSize = 1000*gArgs.GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER);
     connOptions.m_added_nodes = gArgs.GetArgs("-addnode");
+    connOptions.socketEventsMode = socketEventsMode;
+    connOptions.nMessageHandlerThreads = gArgs.GetArg("-msghandlers", DEFAULT_MESSAGE_HANDLER_THREADS);
+    connOptions.nConnectThreads = gArgs.GetArg("-connectthreads", DEFAULT_CONNECT_THREADS);
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
     connOptions.nMaxOutboundLimit = nMaxOutboundLimit;
+    connOptions.nMaxUploadRate = std::min<uint64_t>(std::max<int64_t>(gArgs.GetArg("-maxuploadrate", DEFAULT_MAX_UPLOAD_RATE), 0), MAX_UPLOAD_RATE) * 1024;
+    for (const std::string& strRate : gArgs.GetArgs("-uploadrate")) {
+        const size_t nColon = strRate.find(':');
+        uint64_t nRate;
+        int nClass = 0;
+        while (nClass < UPLOAD_CLASS_COUNT && strRate.substr(0, nColon) != GetUploadClassName((UploadClass)nClass))
+            nClass++;
+        if (nColon == std::string::npos || nClass == UPLOAD_CLASS_COUNT || !ParseUInt64(strRate.substr(nColon + 1), &nRate))
+            return InitError(strprintf(_("Invalid -uploadrate '%s' (must be <class>:<n>, with a class of blockrelay, txrelay, historical or other)"), strRate));
+        connOptions.vUploadClassRates[nClass] = std::min(nRate, MAX_UPLOAD_RATE) * 1024;
+    }
 
     for (const std::string& strBind : gArgs.GetArgs("-bind")) {
         CService addrBind;
@@ -1744,6 +2220,12 @@ bool AppInitMain()
         return false;
     }
 
+    if (gArgs.GetArg("-udprelayport", DEFAULT_UDP_RELAY_PORT) != 0) {
+        std::string strError;
+        if (!StartUDPRelay(strError))
+            return InitError(strError);
+    }
+
     // ********************************************************* Step 12: finished
 
     SetRPCWarmupFinished();
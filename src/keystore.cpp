@@ -5,18 +5,49 @@
 
 #include <keystore.h>
 
+#include <hash.h>
+#include <random.h>
 #include <util.h>
 
+#include <limits>
+
 bool CKeyStore::AddKey(const CKey &key) {
     return AddKeyPubKey(key, key.GetPubKey());
 }
 
+CBasicKeyStore::CBasicKeyStore() :
+    nCandidateK0(GetRand(std::numeric_limits<uint64_t>::max())),
+    nCandidateK1(GetRand(std::numeric_limits<uint64_t>::max()))
+{
+}
+
+uint64_t CBasicKeyStore::CandidateHash(const CScript& script) const
+{
+    return CSipHasher(nCandidateK0, nCandidateK1).Write(script.data(), script.size()).Finalize();
+}
+
+void CBasicKeyStore::AddMineCandidates(const CScript& script)
+{
+    AssertLockHeld(cs_KeyStore);
+    setMineCandidates.insert(CandidateHash(script));
+    setMineCandidates.insert(CandidateHash(GetScriptForDestination(CScriptID(script))));
+}
+
+bool CBasicKeyStore::IsMineCandidate(const CScript& scriptPubKey) const
+{
+    uint64_t hash = CandidateHash(scriptPubKey);
+    LOCK(cs_KeyStore);
+    return setMineCandidates.count(hash) > 0;
+}
+
 void CBasicKeyStore::ImplicitlyLearnRelatedKeyScripts(const CPubKey& pubkey)
 {
     AssertLockHeld(cs_KeyStore);
     CKeyID key_id = pubkey.GetID();
     // We must actually know about this key already.
     assert(HaveKey(key_id) || mapWatchKeys.count(key_id));
+    setMineCandidates.insert(CandidateHash(GetScriptForRawPubKey(pubkey)));
+    setMineCandidates.insert(CandidateHash(GetScriptForDestination(key_id)));
     // This adds the redeemscripts necessary to detect P2WPKH and P2SH-P2WPKH
     // outputs. Technically P2WPKH outputs don't have a redeemscript to be
     // spent. However, our current IsMine logic requires the corresponding
@@ -31,6 +62,7 @@ void CBasicKeyStore::ImplicitlyLearnRelatedKeyScripts(const CPubKey& pubkey)
     if (pubkey.IsCompressed()) {
         CScript script = GetScriptForDestination(WitnessV0KeyHash(key_id));
         // This does not use AddCScript, as it may be overridden.
+        AddMineCandidates(script);
         CScriptID id(script);
         mapScripts[id] = std::move(script);
     }
@@ -94,6 +126,7 @@ bool CBasicKeyStore::AddCScript(const CScript& redeemScript)
 
     LOCK(cs_KeyStore);
     mapScripts[CScriptID(redeemScript)] = redeemScript;
+    AddMineCandidates(redeemScript);
     return true;
 }
 
@@ -145,6 +178,7 @@ bool CBasicKeyStore::AddWatchOnly(const CScript &dest)
 {
     LOCK(cs_KeyStore);
     setWatchOnly.insert(dest);
+    setMineCandidates.insert(CandidateHash(dest));
     CPubKey pubKey;
     if (ExtractPubKey(dest, pubKey)) {
         mapWatchKeys[pubKey.GetID()] = pubKey;
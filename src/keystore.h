@@ -12,6 +12,8 @@
 #include <script/standard.h>
 #include <sync.h>
 
+#include <unordered_set>
+
 #include <boost/signals2/signal.hpp>
 
 /** A virtual base class for key stores */
@@ -44,6 +46,10 @@ public:
     virtual bool RemoveWatchOnly(const CScript &dest) =0;
     virtual bool HaveWatchOnly(const CScript &dest) const =0;
     virtual bool HaveWatchOnly() const =0;
+
+    /** Whether IsMine may consider a P2PK, P2PKH, P2SH, P2WPKH or P2WSH
+     * script to be ours. False means it certainly does not. */
+    virtual bool IsMineCandidate(const CScript& scriptPubKey) const =0;
 };
 
 typedef std::map<CKeyID, CKey> KeyMap;
@@ -60,9 +66,20 @@ protected:
     ScriptMap mapScripts;
     WatchOnlySet setWatchOnly;
 
+    /** Salted hashes of the scripts that IsMineCandidate accepts: for every
+     * key its P2PK and P2PKH scripts, for every script itself and its P2SH
+     * script, and every watch-only script. Nothing is removed, as a stale
+     * candidate only costs a full IsMine check. */
+    std::unordered_set<uint64_t> setMineCandidates;
+    const uint64_t nCandidateK0, nCandidateK1;
+
+    uint64_t CandidateHash(const CScript& script) const;
+    void AddMineCandidates(const CScript& script);
     void ImplicitlyLearnRelatedKeyScripts(const CPubKey& pubkey);
 
 public:
+    CBasicKeyStore();
+
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey) override;
     bool GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const override;
     bool HaveKey(const CKeyID &address) const override;
@@ -77,6 +94,8 @@ public:
     bool RemoveWatchOnly(const CScript &dest) override;
     bool HaveWatchOnly(const CScript &dest) const override;
     bool HaveWatchOnly() const override;
+
+    bool IsMineCandidate(const CScript& scriptPubKey) const override;
 };
 
 typedef std::vector<unsigned char, secure_allocator<unsigned char> > CKeyingMaterial;
@@ -0,0 +1,107 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_LOCKFREEQUEUE_H
+#define BITCOIN_LOCKFREEQUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+/**
+ * Bounded first-in first-out queue that any number of threads may push to
+ * and pop from at once without taking a lock. Pushing to a full queue, or
+ * popping from an empty one, fails rather than waits.
+ *
+ * The slots form a ring; each carries a sequence number that tells whether
+ * it is free for the push at its position or holds the value for the pop at
+ * it, so a thread claims a slot with a single compare-and-swap of the
+ * position and hands it over by storing the sequence number.
+ */
+template <typename T>
+class CLockFreeQueue
+{
+private:
+    struct Slot {
+        std::atomic<size_t> nSequence;
+        T value;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    const size_t nMask;
+    std::atomic<size_t> nPushPos;
+    std::atomic<size_t> nPopPos;
+
+    static size_t RoundUp(size_t n)
+    {
+        size_t nRounded = 2;
+        while (nRounded < n)
+            nRounded <<= 1;
+        return nRounded;
+    }
+
+public:
+    /** Make a queue for at least nCapacity values (rounded up to a power of two) */
+    explicit CLockFreeQueue(size_t nCapacity) :
+        slots(new Slot[RoundUp(nCapacity)]), nMask(RoundUp(nCapacity) - 1), nPushPos(0), nPopPos(0)
+    {
+        for (size_t i = 0; i <= nMask; i++)
+            slots[i].nSequence.store(i, std::memory_order_relaxed);
+    }
+
+    CLockFreeQueue(const CLockFreeQueue&) = delete;
+    CLockFreeQueue& operator=(const CLockFreeQueue&) = delete;
+
+    size_t Capacity() const { return nMask + 1; }
+
+    /** Move value into the queue; return false, leaving value alone, if it is full */
+    bool TryPush(T& value)
+    {
+        size_t nPos = nPushPos.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[nPos & nMask];
+            intptr_t nDiff = (intptr_t)slot->nSequence.load(std::memory_order_acquire) - (intptr_t)nPos;
+            if (nDiff == 0) {
+                if (nPushPos.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (nDiff < 0) {
+                // The slot still holds the value pushed a lap ago
+                return false;
+            } else {
+                nPos = nPushPos.load(std::memory_order_relaxed);
+            }
+        }
+        slot->value = std::move(value);
+        slot->nSequence.store(nPos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Move the oldest value out of the queue; return false if it is empty */
+    bool TryPop(T& value)
+    {
+        size_t nPos = nPopPos.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[nPos & nMask];
+            intptr_t nDiff = (intptr_t)slot->nSequence.load(std::memory_order_acquire) - (intptr_t)(nPos + 1);
+            if (nDiff == 0) {
+                if (nPopPos.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (nDiff < 0) {
+                // The value for this slot has not been pushed yet
+                return false;
+            } else {
+                nPos = nPopPos.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(slot->value);
+        slot->nSequence.store(nPos + nMask + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+#endif // BITCOIN_LOCKFREEQUEUE_H
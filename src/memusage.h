@@ -5,10 +5,14 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include <flatset.h>
 #include <indirectmap.h>
+#include <prevector.h>
+#include <support/allocators/pool.h>
 
 #include <stdlib.h>
 
+#include <list>
 #include <map>
 #include <memory>
 #include <set>
@@ -72,6 +76,15 @@ private:
     X x;
 };
 
+template<typename X>
+struct stl_list_node
+{
+private:
+    void* next;
+    void* prev;
+    X x;
+};
+
 struct stl_shared_counter
 {
     /* Various platforms use different sized counters here.
@@ -93,6 +106,12 @@ static inline size_t DynamicUsage(const prevector<N, X, S, D>& v)
     return MallocUsage(v.allocated_memory());
 }
 
+template<unsigned int N, typename X, typename Y>
+static inline size_t DynamicUsage(const flatset<N, X, Y>& s)
+{
+    return MallocUsage(s.allocated_memory());
+}
+
 template<typename X, typename Y>
 static inline size_t DynamicUsage(const std::set<X, Y>& s)
 {
@@ -117,6 +136,18 @@ static inline size_t IncrementalDynamicUsage(const std::map<X, Y, Z>& m)
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >));
 }
 
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const std::multimap<X, Y, Z>& m)
+{
+    return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >)) * m.size();
+}
+
+template<typename X, typename Y>
+static inline size_t DynamicUsage(const std::list<X, Y>& l)
+{
+    return MallocUsage(sizeof(stl_list_node<X>)) * l.size();
+}
+
 // indirectmap has underlying map with pointer as key
 
 template<typename X, typename Y>
@@ -165,6 +196,20 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+template<typename X, typename Y, typename Z, typename P, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z, P, PoolAllocator<std::pair<const X, Y>, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    const auto* resource = m.get_allocator().resource();
+    if (resource == nullptr) {
+        return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
+    }
+    // The nodes live in the resource's chunks, whose addresses are kept in a
+    // vector. Freed and not yet used blocks are consumed before any new chunk
+    // is allocated, so they are not counted.
+    size_t usage_chunks = MallocUsage(resource->ChunkSizeBytes()) * resource->NumAllocatedChunks() - resource->FreeBytes();
+    return usage_chunks + MallocUsage(sizeof(void*) * resource->NumAllocatedChunks()) + MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
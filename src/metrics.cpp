@@ -0,0 +1,122 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <metrics.h>
+
+#include <tinyformat.h>
+
+#include <assert.h>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+enum class MetricKind { COUNTER, GAUGE, HISTOGRAM };
+
+/** The metrics of one name, by their labels */
+struct MetricFamily
+{
+    MetricKind kind;
+    std::string help;
+    std::map<std::string, std::unique_ptr<CMetricCounter>> counters;
+    std::map<std::string, std::unique_ptr<CMetricGauge>> gauges;
+    std::map<std::string, std::unique_ptr<CMetricHistogram>> histograms;
+};
+
+struct MetricRegistry
+{
+    std::mutex cs;
+    std::map<std::string, MetricFamily> families;
+};
+
+// Metrics are registered during static initialization, so the registry is
+// constructed on first use; it is never destroyed, as metrics may be updated
+// until the very end of shutdown.
+MetricRegistry& GetRegistry()
+{
+    static MetricRegistry* registry = new MetricRegistry();
+    return *registry;
+}
+
+template <typename Metric>
+Metric* Register(std::map<std::string, std::unique_ptr<Metric>> MetricFamily::*members, MetricKind kind,
+                 const std::string& name, const std::string& help, const std::string& labels)
+{
+    MetricRegistry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.cs);
+    auto inserted = registry.families.emplace(name, MetricFamily());
+    MetricFamily& family = inserted.first->second;
+    if (inserted.second) {
+        family.kind = kind;
+        family.help = help;
+    }
+    assert(family.kind == kind);
+    std::unique_ptr<Metric>& metric = (family.*members)[labels];
+    if (!metric)
+        metric.reset(new Metric());
+    return metric.get();
+}
+
+std::string Sample(const std::string& name, const std::string& labels)
+{
+    return labels.empty() ? name : name + "{" + labels + "}";
+}
+
+} // namespace
+
+CMetricCounter* RegisterMetricCounter(const std::string& name, const std::string& help, const std::string& labels)
+{
+    return Register(&MetricFamily::counters, MetricKind::COUNTER, name, help, labels);
+}
+
+CMetricGauge* RegisterMetricGauge(const std::string& name, const std::string& help, const std::string& labels)
+{
+    return Register(&MetricFamily::gauges, MetricKind::GAUGE, name, help, labels);
+}
+
+CMetricHistogram* RegisterMetricHistogram(const std::string& name, const std::string& help, const std::string& labels)
+{
+    return Register(&MetricFamily::histograms, MetricKind::HISTOGRAM, name, help, labels);
+}
+
+std::string RenderMetrics()
+{
+    MetricRegistry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.cs);
+    std::string strOut;
+    for (const auto& entry : registry.families) {
+        const std::string& name = entry.first;
+        const MetricFamily& family = entry.second;
+        strOut += strprintf("# HELP %s %s\n", name, family.help);
+        switch (family.kind) {
+        case MetricKind::COUNTER:
+            strOut += strprintf("# TYPE %s counter\n", name);
+            for (const auto& counter : family.counters)
+                strOut += strprintf("%s %u\n", Sample(name, counter.first), counter.second->Get());
+            break;
+        case MetricKind::GAUGE:
+            strOut += strprintf("# TYPE %s gauge\n", name);
+            for (const auto& gauge : family.gauges)
+                strOut += strprintf("%s %d\n", Sample(name, gauge.first), gauge.second->Get());
+            break;
+        case MetricKind::HISTOGRAM:
+            strOut += strprintf("# TYPE %s histogram\n", name);
+            for (const auto& histogram : family.histograms) {
+                // Buckets are cumulative, and the count is that of the last
+                const std::string strSep = histogram.first.empty() ? "" : ",";
+                uint64_t nCount = 0;
+                for (int i = 0; i < METRIC_HISTOGRAM_BUCKETS; i++) {
+                    nCount += histogram.second->GetBucket(i);
+                    std::string strLe = i == METRIC_HISTOGRAM_BUCKETS - 1 ? "+Inf" : strprintf("%.6f", (int64_t{1} << i) * 0.000001);
+                    strOut += strprintf("%s_bucket{%s%sle=\"%s\"} %u\n", name, histogram.first, strSep, strLe, nCount);
+                }
+                strOut += strprintf("%s %.6f\n", Sample(name + "_sum", histogram.first), histogram.second->GetSumMicros() * 0.000001);
+                strOut += strprintf("%s %u\n", Sample(name + "_count", histogram.first), nCount);
+            }
+            break;
+        }
+    }
+    return strOut;
+}
@@ -0,0 +1,96 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_METRICS_H
+#define BITCOIN_METRICS_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+/**
+ * Counters, gauges and histograms of the node for scraping by a monitoring
+ * system (see -metrics). They are updated with relaxed atomic operations and
+ * read without taking any of the locks of the code they measure, so that
+ * scraping puts no load on the node.
+ *
+ * Metrics are registered by name and labels, and live until shutdown;
+ * registering the same name and labels again returns the same metric.
+ * Registering takes a lock, so do it once and keep the pointer.
+ */
+
+/** Number of buckets of a CMetricHistogram. Bucket i counts durations of at
+ * most 2^i microseconds (and not counted by bucket i-1); the last bucket
+ * counts all longer ones.
+ */
+static const int METRIC_HISTOGRAM_BUCKETS = 26;
+
+/** Value that only goes up */
+class CMetricCounter
+{
+private:
+    std::atomic<uint64_t> nValue{0};
+
+public:
+    void Add(uint64_t n = 1) { nValue.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t Get() const { return nValue.load(std::memory_order_relaxed); }
+};
+
+/** Value that is set to the current level of something */
+class CMetricGauge
+{
+private:
+    std::atomic<int64_t> nValue{0};
+
+public:
+    void Set(int64_t n) { nValue.store(n, std::memory_order_relaxed); }
+    int64_t Get() const { return nValue.load(std::memory_order_relaxed); }
+};
+
+/** Distribution of durations, in power of two buckets of microseconds */
+class CMetricHistogram
+{
+private:
+    std::atomic<uint64_t> vBuckets[METRIC_HISTOGRAM_BUCKETS];
+    std::atomic<int64_t> nSumMicros{0};
+
+public:
+    CMetricHistogram()
+    {
+        for (int i = 0; i < METRIC_HISTOGRAM_BUCKETS; i++)
+            vBuckets[i] = 0;
+    }
+
+    static int Bucket(int64_t nMicros)
+    {
+        int nBucket = 0;
+        while (nBucket < METRIC_HISTOGRAM_BUCKETS - 1 && nMicros > (int64_t{1} << nBucket))
+            nBucket++;
+        return nBucket;
+    }
+
+    void Observe(int64_t nMicros)
+    {
+        vBuckets[Bucket(nMicros)].fetch_add(1, std::memory_order_relaxed);
+        nSumMicros.fetch_add(nMicros, std::memory_order_relaxed);
+    }
+
+    uint64_t GetBucket(int nBucket) const { return vBuckets[nBucket].load(std::memory_order_relaxed); }
+    int64_t GetSumMicros() const { return nSumMicros.load(std::memory_order_relaxed); }
+};
+
+/**
+ * Register a metric. name follows the Prometheus conventions (counters end
+ * in _total, histograms of durations in _seconds); labels is empty or a list
+ * of label="value" pairs separated by commas. All metrics of one name must
+ * be of the same kind and share their help text.
+ */
+CMetricCounter* RegisterMetricCounter(const std::string& name, const std::string& help, const std::string& labels = "");
+CMetricGauge* RegisterMetricGauge(const std::string& name, const std::string& help, const std::string& labels = "");
+CMetricHistogram* RegisterMetricHistogram(const std::string& name, const std::string& help, const std::string& labels = "");
+
+/** Write all metrics in the Prometheus text exposition format */
+std::string RenderMetrics();
+
+#endif // BITCOIN_METRICS_H
@@ -31,6 +31,8 @@
 #include <queue>
 #include <utility>
 
+#include <boost/bind.hpp>
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // BitcoinMiner
@@ -60,14 +62,33 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
     return nNewTime - nOldTime;
 }
 
+/** Set the coinbase of a template, paying the subsidy and nFees to scriptPubKey, and its witness commitment */
+static void FillCoinbase(CBlockTemplate& tmpl, const CScript& scriptPubKey, const CBlockIndex* pindexPrev, CAmount nFees, const Consensus::Params& consensusParams)
+{
+    const int nHeight = pindexPrev->nHeight + 1;
+    CMutableTransaction coinbaseTx;
+    coinbaseTx.vin.resize(1);
+    coinbaseTx.vin[0].prevout.SetNull();
+    coinbaseTx.vout.resize(1);
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKey;
+    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, consensusParams);
+    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    tmpl.block.vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+    tmpl.vchCoinbaseCommitment = GenerateCoinbaseCommitment(tmpl.block, pindexPrev, consensusParams);
+    tmpl.vTxFees[0] = -nFees;
+    tmpl.vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*tmpl.block.vtx[0]);
+}
+
 BlockAssembler::Options::Options() {
     blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE);
     nBlockMaxWeight = DEFAULT_BLOCK_MAX_WEIGHT;
+    fCheckValidityAsync = false;
 }
 
 BlockAssembler::BlockAssembler(const CChainParams& params, const Options& options) : chainparams(params)
 {
     blockMinFeeRate = options.blockMinFeeRate;
+    fCheckValidityAsync = options.fCheckValidityAsync;
     // Limit weight to between 4K and MAX_BLOCK_WEIGHT-4K for sanity:
     nBlockMaxWeight = std::max<size_t>(4000, std::min<size_t>(MAX_BLOCK_WEIGHT - 4000, options.nBlockMaxWeight));
 }
@@ -85,9 +106,37 @@ static BlockAssembler::Options DefaultOptions(const CChainParams& params)
     } else {
         options.blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE);
     }
+    options.fCheckValidityAsync = gArgs.GetBoolArg("-fastblocktemplate", DEFAULT_FAST_BLOCK_TEMPLATE);
     return options;
 }
 
+/** Set once a template checked in the background failed; templates are checked before they are returned from then on */
+static std::atomic<bool> fAsyncValidityFailed(false);
+
+/**
+ * Check a template built on pindexPrev on the validation interface queue, if
+ * pindexPrev is still the tip. All of its transactions passed
+ * AcceptToMemoryPool, so this only catches bugs in the mempool or in block
+ * assembly; when it does, the template is rebuilt on the next request.
+ */
+static void CheckBlockValidityAsync(const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev)
+{
+    CallFunctionInValidationInterfaceQueue([&chainparams, block, pindexPrev] {
+        LOCK(cs_main);
+        if (chainActive.Tip() != pindexPrev)
+            return;
+        CValidationState state;
+        if (TestBlockValidity(state, chainparams, block, pindexPrev, false, false))
+            return;
+        LogPrintf("ERROR: CreateNewBlock: TestBlockValidity failed for a template already returned: %s\n", FormatStateMessage(state));
+        fAsyncValidityFailed = true;
+        // Have getblocktemplate and the template cache build a new template
+        mempool.AddTransactionsUpdated(1);
+        if (g_blocktemplatecache)
+            g_blocktemplatecache->SetStale();
+    });
+}
+
 BlockAssembler::BlockAssembler(const CChainParams& params) : BlockAssembler(params, DefaultOptions(params)) {}
 
 void BlockAssembler::resetBlock()
@@ -157,16 +206,7 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     nLastBlockWeight = nBlockWeight;
 
     // Create coinbase transaction.
-    CMutableTransaction coinbaseTx;
-    coinbaseTx.vin.resize(1);
-    coinbaseTx.vin[0].prevout.SetNull();
-    coinbaseTx.vout.resize(1);
-    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
-    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
-    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
-    pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
-    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
-    pblocktemplate->vTxFees[0] = -nFees;
+    FillCoinbase(*pblocktemplate, scriptPubKeyIn, pindexPrev, nFees, chainparams.GetConsensus());
 
     LogPrintf("CreateNewBlock(): block weight: %u txs: %u fees: %ld sigops %d\n", GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost);
 
@@ -175,11 +215,14 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
     pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
     pblock->nNonce         = 0;
-    pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
 
-    CValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+    if (fCheckValidityAsync && !fAsyncValidityFailed) {
+        CheckBlockValidityAsync(chainparams, *pblock, pindexPrev);
+    } else {
+        CValidationState state;
+        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+        }
     }
     int64_t nTime2 = GetTimeMicros();
 
@@ -457,3 +500,210 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
+
+std::unique_ptr<BlockTemplateCache> g_blocktemplatecache;
+
+BlockTemplateCache::BlockTemplateCache(const CChainParams& params) :
+    chainparams(params), options(DefaultOptions(params)), fActive(false), pindexPrev(nullptr), fMineWitnessTx(true),
+    fIncludeWitness(false), nLockTimeCutoff(0), nBlockWeight(0), nBlockSigOpsCost(0), nFees(0), fStale(false), nTimeBuilt(0)
+{
+    mempool.NotifyEntryAdded.connect(boost::bind(&BlockTemplateCache::MempoolEntryAdded, this, _1));
+    mempool.NotifyEntryRemoved.connect(boost::bind(&BlockTemplateCache::MempoolEntryRemoved, this, _1, _2));
+}
+
+BlockTemplateCache::~BlockTemplateCache()
+{
+    mempool.NotifyEntryAdded.disconnect(boost::bind(&BlockTemplateCache::MempoolEntryAdded, this, _1));
+    mempool.NotifyEntryRemoved.disconnect(boost::bind(&BlockTemplateCache::MempoolEntryRemoved, this, _1, _2));
+}
+
+void BlockTemplateCache::Rebuild(bool fMineWitnessTxIn)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+
+    int64_t nTimeStart = GetTimeMicros();
+    pblocktemplate.reset();
+    setTxids.clear();
+    vPending.clear();
+    std::unique_ptr<CBlockTemplate> pblocktemplateNew = BlockAssembler(chainparams, options).CreateNewBlock(CScript() << OP_TRUE, fMineWitnessTxIn);
+    if (!pblocktemplateNew)
+        return;
+
+    pblocktemplate = std::move(pblocktemplateNew);
+    pindexPrev = chainActive.Tip();
+    fMineWitnessTx = fMineWitnessTxIn;
+    fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus()) && fMineWitnessTx;
+    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                       ? pindexPrev->GetMedianTimePast()
+                       : pblocktemplate->block.GetBlockTime();
+
+    // Same accounting as BlockAssembler, which reserves space for the coinbase
+    nBlockWeight = 4000;
+    nBlockSigOpsCost = 400;
+    nFees = -pblocktemplate->vTxFees[0];
+    const std::vector<CTransactionRef>& vtx = pblocktemplate->block.vtx;
+    for (size_t i = 1; i < vtx.size(); i++) {
+        nBlockWeight += GetTransactionWeight(*vtx[i]);
+        nBlockSigOpsCost += pblocktemplate->vTxSigOpsCost[i];
+        setTxids.insert(vtx[i]->GetHash());
+    }
+    fStale = false;
+    nTimeBuilt = GetTime();
+    LogPrint(BCLog::BENCH, "BlockTemplateCache: rebuilt template on %s with %u txs: %.2fms\n", pindexPrev->GetBlockHash().ToString(), setTxids.size(), 0.001 * (GetTimeMicros() - nTimeStart));
+}
+
+void BlockTemplateCache::AddPending()
+{
+    AssertLockHeld(mempool.cs);
+
+    bool fAdded = false;
+    for (const CTransactionRef& ptx : vPending) {
+        // Skip transactions that left the mempool again
+        CTxMemPool::txiter it = mempool.mapTx.find(ptx->GetHash());
+        if (it != mempool.mapTx.end() && TryAdd(it))
+            fAdded = true;
+    }
+    vPending.clear();
+    if (fAdded)
+        FillCoinbase(*pblocktemplate, CScript() << OP_TRUE, pindexPrev, nFees, chainparams.GetConsensus());
+}
+
+bool BlockTemplateCache::TryAdd(CTxMemPool::txiter it)
+{
+    AssertLockHeld(mempool.cs);
+
+    const CTransaction& tx = it->GetTx();
+    if (setTxids.count(tx.GetHash()))
+        return false;
+
+    // The transaction is a package of its own only if its parents are in already
+    for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(it)) {
+        if (!setTxids.count(parent->GetTx().GetHash())) {
+            fStale = true;
+            return false;
+        }
+    }
+
+    // Not selected by BlockAssembler either
+    if (!IsFinalTx(tx, pindexPrev->nHeight + 1, nLockTimeCutoff))
+        return false;
+    if (!fIncludeWitness && tx.HasWitness())
+        return false;
+    if (it->GetModifiedFee() < options.blockMinFeeRate.GetFee(it->GetTxSize()))
+        return false;
+
+    // Same limits as BlockAssembler::TestPackage. The transaction could still
+    // be a better choice than some already in the template.
+    const uint64_t nMaxWeight = std::max<size_t>(4000, std::min<size_t>(MAX_BLOCK_WEIGHT - 4000, options.nBlockMaxWeight));
+    if (nBlockWeight + WITNESS_SCALE_FACTOR * it->GetTxSize() >= nMaxWeight ||
+        nBlockSigOpsCost + it->GetSigOpCost() >= MAX_BLOCK_SIGOPS_COST) {
+        fStale = true;
+        return false;
+    }
+
+    pblocktemplate->block.vtx.emplace_back(it->GetSharedTx());
+    pblocktemplate->vTxFees.push_back(it->GetFee());
+    pblocktemplate->vTxSigOpsCost.push_back(it->GetSigOpCost());
+    nBlockWeight += it->GetTxWeight();
+    nBlockSigOpsCost += it->GetSigOpCost();
+    nFees += it->GetFee();
+    setTxids.insert(tx.GetHash());
+    return true;
+}
+
+void BlockTemplateCache::Remove(const uint256& txid)
+{
+    std::vector<CTransactionRef>& vtx = pblocktemplate->block.vtx;
+    for (size_t i = 1; i < vtx.size(); i++) {
+        if (vtx[i]->GetHash() != txid)
+            continue;
+        nBlockWeight -= GetTransactionWeight(*vtx[i]);
+        nBlockSigOpsCost -= pblocktemplate->vTxSigOpsCost[i];
+        nFees -= pblocktemplate->vTxFees[i];
+        vtx.erase(vtx.begin() + i);
+        pblocktemplate->vTxFees.erase(pblocktemplate->vTxFees.begin() + i);
+        pblocktemplate->vTxSigOpsCost.erase(pblocktemplate->vTxSigOpsCost.begin() + i);
+        break;
+    }
+    setTxids.erase(txid);
+    FillCoinbase(*pblocktemplate, CScript() << OP_TRUE, pindexPrev, nFees, chainparams.GetConsensus());
+    // The space may fit transactions that were left out
+    fStale = true;
+}
+
+void BlockTemplateCache::MempoolEntryAdded(CTransactionRef ptx)
+{
+    AssertLockHeld(mempool.cs);
+    if (fActive && pblocktemplate)
+        vPending.push_back(std::move(ptx));
+}
+
+void BlockTemplateCache::MempoolEntryRemoved(CTransactionRef ptx, MemPoolRemovalReason reason)
+{
+    AssertLockHeld(mempool.cs);
+    // Transactions that were mined or conflict with a block go with the old tip's template
+    if (reason == MemPoolRemovalReason::BLOCK || reason == MemPoolRemovalReason::CONFLICT)
+        return;
+    if (pblocktemplate && setTxids.count(ptx->GetHash()))
+        Remove(ptx->GetHash());
+}
+
+void BlockTemplateCache::UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload)
+{
+    if (!fActive || fInitialDownload)
+        return;
+
+    LOCK2(cs_main, mempool.cs);
+    try {
+        Rebuild(fMineWitnessTx);
+    } catch (const std::exception& e) {
+        // getblocktemplate tries again, and reports the error
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+}
+
+void BlockTemplateCache::TransactionAddedToMempool(const CTransactionRef& ptx)
+{
+    if (!fActive)
+        return;
+
+    LOCK2(cs_main, mempool.cs);
+    if (!pblocktemplate || pindexPrev != chainActive.Tip())
+        return;
+
+    AddPending();
+    if (fStale && GetTime() - nTimeBuilt >= TEMPLATE_REBUILD_INTERVAL) {
+        try {
+            Rebuild(fMineWitnessTx);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+    }
+}
+
+std::unique_ptr<CBlockTemplate> BlockTemplateCache::GetTemplate(bool fMineWitnessTxIn)
+{
+    AssertLockHeld(cs_main);
+    LOCK(mempool.cs);
+    fActive = true;
+
+    // Clearing the mempool does not notify about the transactions it removes
+    if (!pblocktemplate || pindexPrev != chainActive.Tip() || fMineWitnessTx != fMineWitnessTxIn ||
+        (fStale && GetTime() - nTimeBuilt >= TEMPLATE_REBUILD_INTERVAL) || setTxids.size() > mempool.mapTx.size()) {
+        Rebuild(fMineWitnessTxIn);
+        if (!pblocktemplate)
+            return nullptr;
+    } else {
+        // The callbacks for the latest transactions may still be queued
+        AddPending();
+    }
+    return std::unique_ptr<CBlockTemplate>(new CBlockTemplate(*pblocktemplate));
+}
+
+void BlockTemplateCache::SetStale()
+{
+    LOCK(mempool.cs);
+    fStale = true;
+    nTimeBuilt = 0;
+}
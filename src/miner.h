@@ -8,9 +8,12 @@
 
 #include <primitives/block.h>
 #include <txmempool.h>
+#include <validationinterface.h>
 
+#include <atomic>
 #include <stdint.h>
 #include <memory>
+#include <set>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 
@@ -21,6 +24,8 @@ class CScript;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -fastblocktemplate, check new block templates in the background rather than before returning them */
+static const bool DEFAULT_FAST_BLOCK_TEMPLATE = false;
 
 struct CBlockTemplate
 {
@@ -132,6 +137,7 @@ private:
     bool fIncludeWitness;
     unsigned int nBlockMaxWeight;
     CFeeRate blockMinFeeRate;
+    bool fCheckValidityAsync;
 
     // Information on the current status of the block
     uint64_t nBlockWeight;
@@ -150,6 +156,8 @@ public:
         Options();
         size_t nBlockMaxWeight;
         CFeeRate blockMinFeeRate;
+        //! Run TestBlockValidity on the validation interface queue, after the template is returned
+        bool fCheckValidityAsync;
     };
 
     explicit BlockAssembler(const CChainParams& params);
@@ -192,6 +200,78 @@ private:
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/**
+ * Keeps a block template on the active chain tip up to date as transactions
+ * enter and leave the mempool, so that getblocktemplate does not run the
+ * package selection of BlockAssembler on every call.
+ *
+ * The template is built in full when the tip changes. Transactions added to
+ * the mempool are queued as they arrive and appended, on the scheduler thread
+ * or when a template is requested, if their in-mempool parents are already
+ * in the template and they fit. One that would need a new selection (a child
+ * paying for a parent, a better transaction when the block is full) marks
+ * the template stale, and it is rebuilt at most every
+ * TEMPLATE_REBUILD_INTERVAL seconds. Nothing is done until the first template
+ * is requested.
+ */
+class BlockTemplateCache final : public CValidationInterface
+{
+private:
+    const CChainParams& chainparams;
+    const BlockAssembler::Options options;
+
+    //! Set once a template has been requested
+    std::atomic<bool> fActive;
+
+    // The template and its state, guarded by mempool.cs (and cs_main, when it
+    // is rebuilt). The coinbase pays to OP_TRUE.
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    const CBlockIndex* pindexPrev;
+    bool fMineWitnessTx;
+    bool fIncludeWitness;
+    int64_t nLockTimeCutoff;
+    uint64_t nBlockWeight;
+    int64_t nBlockSigOpsCost;
+    CAmount nFees;
+    std::set<uint256> setTxids;
+    //! Transactions added to the mempool since they were last appended
+    std::vector<CTransactionRef> vPending;
+    //! A full selection could choose better transactions than those in the template
+    bool fStale;
+    int64_t nTimeBuilt;
+
+    /** Build the template in full on the current tip */
+    void Rebuild(bool fMineWitnessTxIn);
+    /** Append the pending transactions that are eligible */
+    void AddPending();
+    /** Append a mempool transaction to the template, if it is eligible. Returns whether it was appended. */
+    bool TryAdd(CTxMemPool::txiter it);
+    /** Take a transaction that left the mempool out of the template */
+    void Remove(const uint256& txid);
+
+    void MempoolEntryAdded(CTransactionRef ptx);
+    void MempoolEntryRemoved(CTransactionRef ptx, MemPoolRemovalReason reason);
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload) override;
+    void TransactionAddedToMempool(const CTransactionRef& ptx) override;
+
+public:
+    //! Seconds a stale template is kept before it is rebuilt
+    static const int64_t TEMPLATE_REBUILD_INTERVAL = 5;
+
+    explicit BlockTemplateCache(const CChainParams& params);
+    ~BlockTemplateCache();
+
+    /** Return a copy of the template on the current tip, building it if needed. Requires cs_main. */
+    std::unique_ptr<CBlockTemplate> GetTemplate(bool fMineWitnessTxIn);
+    /** Select the transactions again on the next request, e.g. after fees were prioritised */
+    void SetStale();
+};
+
+/** The block template getblocktemplate serves, kept up to date in the background */
+extern std::unique_ptr<BlockTemplateCache> g_blocktemplatecache;
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
@@ -14,19 +14,35 @@
 #include <consensus/consensus.h>
 #include <crypto/common.h>
 #include <crypto/sha256.h>
+#include <memusage.h>
+#include <metrics.h>
 #include <primitives/transaction.h>
 #include <netbase.h>
 #include <scheduler.h>
+#include <trace.h>
 #include <ui_interface.h>
 #include <utilstrencodings.h>
 
+#include <algorithm>
+#include <limits>
 #include <memory>
+#include <system_error>
 #ifdef WIN32
 #include <string.h>
 #else
 #include <fcntl.h>
 #endif
 
+#ifdef USE_POLL
+#include <poll.h>
+#endif
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+#ifdef USE_KQUEUE
+#include <sys/event.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -75,6 +91,27 @@ const static std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
 
 static const uint64_t RANDOMIZER_ID_NETGROUP = 0x6c0edd8036ef4036ULL; // SHA256("netgroup")[0:8]
 static const uint64_t RANDOMIZER_ID_LOCALHOSTNONCE = 0xd93e69e2bbfa5735ULL; // SHA256("localhostnonce")[0:8]
+
+/** How long ThreadSocketHandler waits for sockets before checking for sends to flush */
+static const int SOCKET_EVENTS_TIMEOUT_MILLISECONDS = 50;
+/** Most ready sockets taken from epoll or kqueue per wait; the rest are returned by the next one */
+static const int SOCKET_EVENTS_MAX_READY = 1024;
+
+#ifndef WIN32
+/** Most queued send buffers handed to the kernel in a single sendmsg() call */
+static const int SEND_IOV_MAX = IOV_MAX < 1024 ? IOV_MAX : 1024;
+#endif
+
+/** Share of the total upload bucket, in quarters, that each class leaves to the classes above it */
+static const int UPLOAD_CLASS_RESERVE[UPLOAD_CLASS_COUNT] = {0, 0, 1, 2};
+/** Most queued messages the upload budget of a send is worked out over */
+static const size_t UPLOAD_BUDGET_MAX_MESSAGES = 512;
+
+/** Events a socket can be registered for with epoll or kqueue */
+enum SocketEventFlags {
+    SOCKET_EVENT_RECV = (1U << 0),
+    SOCKET_EVENT_SEND = (1U << 1),
+};
 //
 // Global state variables
 //
@@ -86,8 +123,6 @@ std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 static bool vfLimited[NET_MAX] = {};
 std::string strSubVersion;
 
-limitedmap<uint256, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
-
 void CConnman::AddOneShot(const std::string& strDest)
 {
     LOCK(cs_vOneShots);
@@ -496,6 +531,7 @@ void CConnman::ClearBanned()
     {
         LOCK(cs_setBanned);
         setBanned.clear();
+        bannedIndex.Clear();
         setBannedIsDirty = true;
     }
     DumpBanlist(); //store banlist to disk
@@ -506,15 +542,8 @@ void CConnman::ClearBanned()
 bool CConnman::IsBanned(CNetAddr ip)
 {
     LOCK(cs_setBanned);
-    for (const auto& it : setBanned) {
-        CSubNet subNet = it.first;
-        CBanEntry banEntry = it.second;
-
-        if (subNet.Match(ip) && GetTime() < banEntry.nBanUntil) {
-            return true;
-        }
-    }
-    return false;
+    int64_t nBanUntil;
+    return bannedIndex.Find(ip, nBanUntil) && GetTime() < nBanUntil;
 }
 
 bool CConnman::IsBanned(CSubNet subnet)
@@ -550,6 +579,7 @@ void CConnman::Ban(const CSubNet& subNet, const BanReason &banReason, int64_t ba
         LOCK(cs_setBanned);
         if (setBanned[subNet].nBanUntil < banEntry.nBanUntil) {
             setBanned[subNet] = banEntry;
+            bannedIndex.Insert(subNet, banEntry.nBanUntil);
             setBannedIsDirty = true;
         }
         else
@@ -578,6 +608,7 @@ bool CConnman::Unban(const CSubNet &subNet) {
         LOCK(cs_setBanned);
         if (!setBanned.erase(subNet))
             return false;
+        bannedIndex.Erase(subNet);
         setBannedIsDirty = true;
     }
     if(clientInterface)
@@ -598,6 +629,10 @@ void CConnman::SetBanned(const banmap_t &banMap)
 {
     LOCK(cs_setBanned);
     setBanned = banMap;
+    bannedIndex.Clear();
+    for (const auto& entry : setBanned) {
+        bannedIndex.Insert(entry.first, entry.second.nBanUntil);
+    }
     setBannedIsDirty = true;
 }
 
@@ -614,6 +649,7 @@ void CConnman::SweepBanned()
             CBanEntry banEntry = (*it).second;
             if(now > banEntry.nBanUntil)
             {
+                bannedIndex.Erase(subNet);
                 setBanned.erase(it++);
                 setBannedIsDirty = true;
                 notifyUI = true;
@@ -643,11 +679,7 @@ void CConnman::SetBannedSetDirty(bool dirty)
 
 
 bool CConnman::IsWhitelistedRange(const CNetAddr &addr) {
-    for (const CSubNet& subnet : vWhitelistedRange) {
-        if (subnet.Match(addr))
-            return true;
-    }
-    return false;
+    return whitelistedRanges.Match(addr);
 }
 
 std::string CNode::GetAddrName() const {
@@ -701,17 +733,18 @@ void CNode::copyStats(CNodeStats &stats)
     X(fInbound);
     X(m_manual_connection);
     X(nStartingHeight);
-    {
-        LOCK(cs_vSend);
-        X(mapSendBytesPerMsgCmd);
-        X(nSendBytes);
-    }
-    {
-        LOCK(cs_vRecv);
-        X(mapRecvBytesPerMsgCmd);
-        X(nRecvBytes);
-    }
+    // The byte counters are atomics, so polling them doesn't hold up the
+    // socket handler on cs_vSend or cs_vRecv
+    stats.mapSendBytesPerMsgCmd = mapSendBytesPerMsgCmd.Get();
+    X(nSendBytes);
+    stats.mapRecvBytesPerMsgCmd = mapRecvBytesPerMsgCmd.Get();
+    X(nRecvBytes);
     X(fWhitelisted);
+    X(nCmpctBlocksSent);
+    X(nCmpctBlockTxnRequests);
+    X(nCmpctBlocksReceived);
+    X(nCmpctBlocksReconstructed);
+    stats.nMemoryUsage = DynamicMemoryUsage();
 
     // It is common for nodes with good ping times to suddenly become lagged,
     // due to a new block arriving or other large transfer.
@@ -735,6 +768,102 @@ void CNode::copyStats(CNodeStats &stats)
 }
 #undef X
 
+size_t CNode::DynamicMemoryUsage()
+{
+    size_t nUsage = mapSendBytesPerMsgCmd.DynamicMemoryUsage() + mapRecvBytesPerMsgCmd.DynamicMemoryUsage();
+    {
+        LOCK(cs_vSend);
+        nUsage += nSendSize;
+    }
+    {
+        LOCK(cs_vProcessMsg);
+        nUsage += nProcessQueueSize;
+    }
+    nUsage += nRecvPoolSize;
+    {
+        LOCK(cs_vAddrToSend);
+        nUsage += memusage::DynamicUsage(vAddrToSend) + addrKnown.DynamicMemoryUsage();
+    }
+    {
+        LOCK(cs_inventory);
+        nUsage += filterInventoryKnown.DynamicMemoryUsage();
+        nUsage += memusage::DynamicUsage(setInventoryTxToSend) + memusage::DynamicUsage(setReconTxToSend);
+        nUsage += memusage::DynamicUsage(vInventoryBlockToSend) + memusage::DynamicUsage(vBlockHashesToAnnounce);
+    }
+    return nUsage;
+}
+
+/** The known commands, sorted, then NET_MESSAGE_COMMAND_OTHER; a CMsgCmdCounter has a counter for each */
+static const std::vector<std::string>& GetCountedCommands()
+{
+    static const std::vector<std::string> vCommands = [] {
+        std::vector<std::string> vInit = getAllNetMessageTypes();
+        std::sort(vInit.begin(), vInit.end());
+        vInit.push_back(NET_MESSAGE_COMMAND_OTHER);
+        return vInit;
+    }();
+    return vCommands;
+}
+
+CMsgCmdCounter::CMsgCmdCounter() : vCounters(new std::atomic<uint64_t>[GetCountedCommands().size()])
+{
+    for (size_t i = 0; i < GetCountedCommands().size(); i++)
+        vCounters[i] = 0;
+}
+
+void CMsgCmdCounter::Add(const std::string& command, uint64_t nBytes)
+{
+    const std::vector<std::string>& vCommands = GetCountedCommands();
+    const auto itOther = vCommands.end() - 1;
+    auto it = std::lower_bound(vCommands.begin(), itOther, command);
+    if (it == itOther || *it != command)
+        it = itOther;
+    vCounters[it - vCommands.begin()] += nBytes;
+}
+
+mapMsgCmdSize CMsgCmdCounter::Get() const
+{
+    const std::vector<std::string>& vCommands = GetCountedCommands();
+    mapMsgCmdSize mapCounters;
+    for (size_t i = 0; i < vCommands.size(); i++)
+        mapCounters[vCommands[i]] = vCounters[i];
+    return mapCounters;
+}
+
+size_t CMsgCmdCounter::DynamicMemoryUsage() const
+{
+    return memusage::MallocUsage(sizeof(std::atomic<uint64_t>) * GetCountedCommands().size());
+}
+
+/** Metrics of the bytes received and sent per message command */
+struct NetMessageMetrics
+{
+    CMetricCounter* pRecv;
+    CMetricCounter* pSent;
+};
+
+/** The metrics of the command, or of NET_MESSAGE_COMMAND_OTHER for unknown ones */
+static const NetMessageMetrics& GetNetMessageMetrics(const std::string& strCommand)
+{
+    // Built once for all known commands, so that looking them up takes no lock
+    static const std::map<std::string, NetMessageMetrics> mapMetrics = [] {
+        std::map<std::string, NetMessageMetrics> mapInit;
+        std::vector<std::string> vCommands = getAllNetMessageTypes();
+        vCommands.push_back(NET_MESSAGE_COMMAND_OTHER);
+        for (const std::string& strCmd : vCommands) {
+            std::string strLabels = strprintf("command=\"%s\"", strCmd);
+            mapInit[strCmd] = NetMessageMetrics{
+                RegisterMetricCounter("bitcoin_net_received_bytes_total", "Bytes of messages received from peers, headers included", strLabels),
+                RegisterMetricCounter("bitcoin_net_sent_bytes_total", "Bytes of messages sent to peers, headers included", strLabels)};
+        }
+        return mapInit;
+    }();
+    auto it = mapMetrics.find(strCommand);
+    if (it == mapMetrics.end())
+        it = mapMetrics.find(NET_MESSAGE_COMMAND_OTHER);
+    return it->second;
+}
+
 bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete)
 {
     complete = false;
@@ -746,8 +875,15 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
 
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
-            vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            vRecvMsg.back().complete()) {
+            if (!vRecvMsgFree.empty()) {
+                // reuse the buffers of an already processed message
+                vRecvMsg.splice(vRecvMsg.end(), vRecvMsgFree, vRecvMsgFree.begin());
+                nRecvPoolSize -= vRecvMsg.back().GetPoolSize();
+            } else {
+                vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            }
+        }
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -773,20 +909,39 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
 
             //store received bytes per message command
             //to prevent a memory DOS, only allow valid commands
-            mapMsgCmdSize::iterator i = mapRecvBytesPerMsgCmd.find(msg.hdr.pchCommand);
-            if (i == mapRecvBytesPerMsgCmd.end())
-                i = mapRecvBytesPerMsgCmd.find(NET_MESSAGE_COMMAND_OTHER);
-            assert(i != mapRecvBytesPerMsgCmd.end());
-            i->second += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
+            mapRecvBytesPerMsgCmd.Add(msg.hdr.pchCommand, msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE);
+            GetNetMessageMetrics(msg.hdr.pchCommand).pRecv->Add(msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE);
+
+            // The payload was hashed as it arrived, so finishing the checksum
+            // here leaves the message handler only the result to look at.
+            const uint256& hash = msg.GetMessageHash();
+            msg.fChecksumValid = memcmp(hash.begin(), msg.hdr.pchChecksum, CMessageHeader::CHECKSUM_SIZE) == 0;
 
             msg.nTime = nTimeMicros;
             complete = true;
+            TRACE4(net, inbound_message, GetId(), msg.hdr.pchCommand, msg.hdr.nMessageSize, msg.fChecksumValid);
         }
     }
 
     return true;
 }
 
+void CNode::RecycleRecvMsg(std::list<CNetMessage>& msgs, size_t nMaxBuffered)
+{
+    CNetMessage& msg = msgs.front();
+    if (msg.vRecv.capacity() > MAX_RECV_POOL_BUFFER_SIZE)
+        return;
+    size_t nSize = msg.GetPoolSize();
+    LOCK(cs_vProcessMsg);
+    // Pooled buffers and queued messages together stay within the receive
+    // flood size, so an idle pool never holds more than a full queue would.
+    if (nProcessQueueSize + nRecvPoolSize + nSize > nMaxBuffered)
+        return;
+    msg.Reset();
+    vRecvMsgPool.splice(vRecvMsgPool.end(), msgs, msgs.begin());
+    nRecvPoolSize += nSize;
+}
+
 void CNode::SetSendVersion(int nVersionIn)
 {
     // Send version may only be changed in the version message, and
@@ -870,6 +1025,21 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     return nCopy;
 }
 
+void CNetMessage::Reset()
+{
+    hasher.Reset();
+    data_hash.SetNull();
+    in_data = false;
+    hdrbuf.clear();
+    hdrbuf.resize(24);
+    nHdrPos = 0;
+    vRecv.clear();
+    nDataPos = 0;
+    nTime = 0;
+    fChecksumValid = false;
+    SetVersion(INIT_PROTO_VERSION);
+}
+
 const uint256& CNetMessage::GetMessageHash() const
 {
     assert(complete());
@@ -887,32 +1057,77 @@ const uint256& CNetMessage::GetMessageHash() const
 
 
 // requires LOCK(cs_vSend)
-size_t CConnman::SocketSendData(CNode *pnode) const
+bool CConnman::CanSendData(CNode *pnode)
+{
+    if (pnode->vSendMsg.empty())
+        return false;
+    if (pnode->fWhitelisted || !uploadScheduler.IsLimited())
+        return true;
+    return uploadScheduler.GetBudget(pnode->vSendClass, 1, GetTimeMicros()) > 0;
+}
+
+// requires LOCK(cs_vSend)
+size_t CConnman::SocketSendData(CNode *pnode)
 {
     auto it = pnode->vSendMsg.begin();
     size_t nSentSize = 0;
+    // Whitelisted peers are not held back by the upload rate limits
+    const bool fLimit = !pnode->fWhitelisted && uploadScheduler.IsLimited();
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        assert((*it)->size() > pnode->nSendOffset);
+        size_t nBudget = std::numeric_limits<size_t>::max();
+        if (fLimit) {
+            nBudget = uploadScheduler.GetBudget(pnode->vSendClass, UPLOAD_BUDGET_MAX_MESSAGES, GetTimeMicros());
+            if (nBudget == 0)
+                break;
+        }
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+            const auto &data = **it;
+            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, std::min(data.size() - pnode->nSendOffset, nBudget), MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+            // Gather the queued headers and payloads into one call instead of
+            // a send() per buffer.
+            struct iovec iov[SEND_IOV_MAX];
+            int nIov = 0;
+            size_t nOffset = pnode->nSendOffset;
+            for (auto itIov = it; itIov != pnode->vSendMsg.end() && nIov < SEND_IOV_MAX && nBudget > 0; ++itIov, ++nIov) {
+                iov[nIov].iov_base = const_cast<unsigned char*>((*itIov)->data()) + nOffset;
+                iov[nIov].iov_len = std::min((*itIov)->size() - nOffset, nBudget);
+                nBudget -= iov[nIov].iov_len;
+                nOffset = 0;
+            }
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = nIov;
+            nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            uploadScheduler.Consume(pnode->vSendClass, nBytes, fLimit);
+            // Drop every buffer that went out completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nRemaining = (*it)->size() - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+                pnode->nSendSize -= (*it)->size();
                 it++;
-            } else {
+            }
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            if (pnode->nSendOffset != 0) {
                 // could not send full message; stop sending more
                 break;
             }
@@ -934,6 +1149,7 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     if (it == pnode->vSendMsg.end()) {
         assert(pnode->nSendOffset == 0);
         assert(pnode->nSendSize == 0);
+        assert(pnode->vSendClass.empty());
     }
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
     return nSentSize;
@@ -1081,8 +1297,6 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     socklen_t len = sizeof(sockaddr);
     SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
     CAddress addr;
-    int nInbound = 0;
-    int nMaxInbound = nMaxConnections - (nMaxOutbound + nMaxFeeler);
 
     if (hSocket != INVALID_SOCKET) {
         if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr)) {
@@ -1090,14 +1304,6 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         }
     }
 
-    bool whitelisted = hListenSocket.whitelisted || IsWhitelistedRange(addr);
-    {
-        LOCK(cs_vNodes);
-        for (const CNode* pnode : vNodes) {
-            if (pnode->fInbound) nInbound++;
-        }
-    }
-
     if (hSocket == INVALID_SOCKET)
     {
         int nErr = WSAGetLastError();
@@ -1106,6 +1312,20 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
+    CreateNodeFromAcceptedSocket(hSocket, hListenSocket.whitelisted || IsWhitelistedRange(addr), addr);
+}
+
+void CConnman::CreateNodeFromAcceptedSocket(SOCKET hSocket, bool whitelisted, const CAddress& addr)
+{
+    int nInbound = 0;
+    int nMaxInbound = nMaxConnections - (nMaxOutbound + nMaxFeeler);
+    {
+        LOCK(cs_vNodes);
+        for (const CNode* pnode : vNodes) {
+            if (pnode->fInbound) nInbound++;
+        }
+    }
+
     if (!fNetworkActive) {
         LogPrintf("connection from %s dropped: not accepting new connections\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1157,6 +1377,316 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+static const struct {
+    const char* name;
+    SocketEventsMode mode;
+} SOCKET_EVENTS_MODES[] = {
+    {"select", SocketEventsMode::SELECT},
+#ifdef USE_POLL
+    {"poll", SocketEventsMode::POLL},
+#endif
+#ifdef USE_EPOLL
+    {"epoll", SocketEventsMode::EPOLL},
+#endif
+#ifdef USE_KQUEUE
+    {"kqueue", SocketEventsMode::KQUEUE},
+#endif
+};
+
+bool GetSocketEventsMode(const std::string& strMode, SocketEventsMode& mode)
+{
+    for (const auto& entry : SOCKET_EVENTS_MODES) {
+        if (strMode == entry.name) {
+            mode = entry.mode;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string ListSocketEventsModes()
+{
+    std::string strModes;
+    for (const auto& entry : SOCKET_EVENTS_MODES) {
+        if (!strModes.empty()) strModes += ", ";
+        strModes += entry.name;
+    }
+    return strModes;
+}
+
+/** Whether a socket can be added to an fd_set */
+static bool FitsFdSet(SOCKET hSocket)
+{
+#ifdef WIN32
+    return true;
+#else
+    return hSocket < FD_SETSIZE;
+#endif
+}
+
+/** Keep only the sockets of a set that select() reported ready */
+template <typename Pred>
+static void FilterReady(std::set<SOCKET>& sockets, Pred ready)
+{
+    for (auto it = sockets.begin(); it != sockets.end();) {
+        if (ready(*it)) {
+            ++it;
+        } else {
+            it = sockets.erase(it);
+        }
+    }
+}
+
+void CConnman::GenerateSelectSet(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    const bool fRegister = socketEventsFd != -1;
+
+    for (ListenSocket& hListenSocket : vhListenSocket) {
+        recv_set.insert(hListenSocket.socket);
+        if (fRegister) {
+            UpdateSocketEvents(hListenSocket.socket, hListenSocket.nSocketEvents, SOCKET_EVENT_RECV);
+        }
+    }
+
+    LOCK(cs_vNodes);
+    for (CNode* pnode : vNodes)
+    {
+        // Implement the following logic:
+        // * If there is data to send, select() for sending data. As this only
+        //   happens when optimistic write failed, we choose to first drain the
+        //   write buffer in this case before receiving more. This avoids
+        //   needlessly queueing received data, if the remote peer is not themselves
+        //   receiving data. This means properly utilizing TCP flow control signalling.
+        // * Otherwise, if there is space left in the receive buffer, select() for
+        //   receiving data.
+        // * Hand off all complete messages to the processor, to be handled without
+        //   blocking here.
+
+        bool select_recv = !pnode->fPauseRecv;
+        bool select_send;
+        {
+            LOCK(pnode->cs_vSend);
+            select_send = CanSendData(pnode);
+        }
+
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+
+        error_set.insert(pnode->hSocket);
+        int nEvents = 0;
+        if (select_send) {
+            send_set.insert(pnode->hSocket);
+            nEvents = SOCKET_EVENT_SEND;
+        } else if (select_recv) {
+            recv_set.insert(pnode->hSocket);
+            nEvents = SOCKET_EVENT_RECV;
+        }
+        // The socket stays open while cs_hSocket is held, so its descriptor
+        // cannot have been reused by another connection meanwhile.
+        if (fRegister) {
+            UpdateSocketEvents(pnode->hSocket, pnode->nSocketEvents, nEvents);
+        }
+    }
+}
+
+void CConnman::UpdateSocketEvents(SOCKET hSocket, int& nRegistered, int nEvents)
+{
+    if (nRegistered == nEvents)
+        return;
+#ifdef USE_EPOLL
+    if (socketEventsMode == SocketEventsMode::EPOLL) {
+        // Level-triggered: recv() reads at most one buffer per wakeup and
+        // fPauseRecv relies on a socket with unread data waking us again.
+        struct epoll_event event = {};
+        event.data.fd = hSocket;
+        if (nEvents & SOCKET_EVENT_RECV) event.events |= EPOLLIN;
+        if (nEvents & SOCKET_EVENT_SEND) event.events |= EPOLLOUT;
+        // A closed descriptor leaves the epoll set on its own, so one reused
+        // by a new connection has to be added rather than modified.
+        int nOp = nRegistered == -1 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        if (epoll_ctl(socketEventsFd, nOp, hSocket, &event) != 0) {
+            int nErr = WSAGetLastError();
+            LogPrintf("epoll_ctl failed for socket %d: %s\n", hSocket, NetworkErrorString(nErr));
+            return;
+        }
+    }
+#endif
+#ifdef USE_KQUEUE
+    if (socketEventsMode == SocketEventsMode::KQUEUE) {
+        struct kevent changes[2];
+        EV_SET(&changes[0], hSocket, EVFILT_READ, EV_ADD | ((nEvents & SOCKET_EVENT_RECV) ? EV_ENABLE : EV_DISABLE), 0, 0, nullptr);
+        EV_SET(&changes[1], hSocket, EVFILT_WRITE, EV_ADD | ((nEvents & SOCKET_EVENT_SEND) ? EV_ENABLE : EV_DISABLE), 0, 0, nullptr);
+        if (kevent(socketEventsFd, changes, 2, nullptr, 0, nullptr) != 0) {
+            int nErr = WSAGetLastError();
+            LogPrintf("kevent failed for socket %d: %s\n", hSocket, NetworkErrorString(nErr));
+            return;
+        }
+    }
+#endif
+    nRegistered = nEvents;
+}
+
+bool CConnman::SocketEventsSelect(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = SOCKET_EVENTS_TIMEOUT_MILLISECONDS * 1000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+
+    // Sockets beyond FD_SETSIZE cannot be waited on here; -maxconnections is
+    // capped so that connections normally stay below it with this backend.
+    for (SOCKET hSocket : recv_set) {
+        if (!FitsFdSet(hSocket)) continue;
+        FD_SET(hSocket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    for (SOCKET hSocket : send_set) {
+        if (!FitsFdSet(hSocket)) continue;
+        FD_SET(hSocket, &fdsetSend);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    for (SOCKET hSocket : error_set) {
+        if (!FitsFdSet(hSocket)) continue;
+        FD_SET(hSocket, &fdsetError);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    bool have_fds = !recv_set.empty() || !send_set.empty() || !error_set.empty();
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (nSelect == SOCKET_ERROR)
+        return false;
+
+    FilterReady(recv_set, [&](SOCKET hSocket) { return FitsFdSet(hSocket) && FD_ISSET(hSocket, &fdsetRecv); });
+    FilterReady(send_set, [&](SOCKET hSocket) { return FitsFdSet(hSocket) && FD_ISSET(hSocket, &fdsetSend); });
+    FilterReady(error_set, [&](SOCKET hSocket) { return FitsFdSet(hSocket) && FD_ISSET(hSocket, &fdsetError); });
+    return true;
+}
+
+#ifdef USE_POLL
+bool CConnman::SocketEventsPoll(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    std::map<SOCKET, struct pollfd> pollfds;
+    for (SOCKET hSocket : recv_set) {
+        pollfds[hSocket].fd = hSocket;
+        pollfds[hSocket].events |= POLLIN;
+    }
+    for (SOCKET hSocket : send_set) {
+        pollfds[hSocket].fd = hSocket;
+        pollfds[hSocket].events |= POLLOUT;
+    }
+    for (SOCKET hSocket : error_set) {
+        pollfds[hSocket].fd = hSocket;
+    }
+
+    std::vector<struct pollfd> vpollfds;
+    vpollfds.reserve(pollfds.size());
+    for (const auto& it : pollfds) {
+        vpollfds.push_back(it.second);
+    }
+
+    if (poll(vpollfds.data(), vpollfds.size(), SOCKET_EVENTS_TIMEOUT_MILLISECONDS) < 0)
+        return false;
+
+    recv_set.clear();
+    send_set.clear();
+    error_set.clear();
+    for (const struct pollfd& pollfd : vpollfds) {
+        if (pollfd.revents & POLLIN)            recv_set.insert(pollfd.fd);
+        if (pollfd.revents & POLLOUT)           send_set.insert(pollfd.fd);
+        if (pollfd.revents & (POLLERR|POLLHUP)) error_set.insert(pollfd.fd);
+    }
+    return true;
+}
+#endif
+
+#ifdef USE_EPOLL
+bool CConnman::SocketEventsEPoll(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    // GenerateSelectSet already brought the registrations up to date, so
+    // only the ready sockets come back from the kernel.
+    struct epoll_event events[SOCKET_EVENTS_MAX_READY];
+    int nReady = epoll_wait(socketEventsFd, events, SOCKET_EVENTS_MAX_READY, SOCKET_EVENTS_TIMEOUT_MILLISECONDS);
+    if (nReady < 0)
+        return false;
+
+    recv_set.clear();
+    send_set.clear();
+    error_set.clear();
+    for (int i = 0; i < nReady; i++) {
+        SOCKET hSocket = events[i].data.fd;
+        if (events[i].events & EPOLLIN)              recv_set.insert(hSocket);
+        if (events[i].events & EPOLLOUT)             send_set.insert(hSocket);
+        if (events[i].events & (EPOLLERR|EPOLLHUP))  error_set.insert(hSocket);
+    }
+    return true;
+}
+#endif
+
+#ifdef USE_KQUEUE
+bool CConnman::SocketEventsKQueue(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    struct kevent events[SOCKET_EVENTS_MAX_READY];
+    struct timespec timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_nsec = SOCKET_EVENTS_TIMEOUT_MILLISECONDS * 1000 * 1000;
+    int nReady = kevent(socketEventsFd, nullptr, 0, events, SOCKET_EVENTS_MAX_READY, &timeout);
+    if (nReady < 0)
+        return false;
+
+    recv_set.clear();
+    send_set.clear();
+    error_set.clear();
+    for (int i = 0; i < nReady; i++) {
+        SOCKET hSocket = events[i].ident;
+        if (events[i].flags & (EV_EOF|EV_ERROR)) error_set.insert(hSocket);
+        if (events[i].filter == EVFILT_READ)     recv_set.insert(hSocket);
+        if (events[i].filter == EVFILT_WRITE)    send_set.insert(hSocket);
+    }
+    return true;
+}
+#endif
+
+void CConnman::SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    bool have_fds = !recv_set.empty() || !send_set.empty() || !error_set.empty();
+    bool fOK;
+    switch (socketEventsMode) {
+#ifdef USE_POLL
+    case SocketEventsMode::POLL: fOK = SocketEventsPoll(recv_set, send_set, error_set); break;
+#endif
+#ifdef USE_EPOLL
+    case SocketEventsMode::EPOLL: fOK = SocketEventsEPoll(recv_set, send_set, error_set); break;
+#endif
+#ifdef USE_KQUEUE
+    case SocketEventsMode::KQUEUE: fOK = SocketEventsKQueue(recv_set, send_set, error_set); break;
+#endif
+    default: fOK = SocketEventsSelect(recv_set, send_set, error_set); break;
+    }
+
+    if (!fOK)
+    {
+        if (have_fds)
+        {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+        }
+        // Try to receive on every socket we were waiting for; recv() sorts
+        // out which of them actually have data or failed.
+        send_set.clear();
+        error_set.clear();
+        interruptNet.sleep_for(std::chrono::milliseconds(SOCKET_EVENTS_TIMEOUT_MILLISECONDS));
+    }
+}
+
 void CConnman::ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
@@ -1226,91 +1756,18 @@ void CConnman::ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes)
-            {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data.
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
-
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        std::set<SOCKET> recv_set, send_set, error_set;
+        GenerateSelectSet(recv_set, send_set, error_set);
+        SocketEvents(recv_set, send_set, error_set);
         if (interruptNet)
             return;
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
-        }
-
         //
         // Accept new connections
         //
         for (const ListenSocket& hListenSocket : vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && recv_set.count(hListenSocket.socket) > 0)
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1341,9 +1798,9 @@ void CConnman::ThreadSocketHandler()
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+                recvSet = recv_set.count(pnode->hSocket) > 0;
+                sendSet = send_set.count(pnode->hSocket) > 0;
+                errorSet = error_set.count(pnode->hSocket) > 0;
             }
             if (recvSet || errorSet)
             {
@@ -1365,18 +1822,27 @@ void CConnman::ThreadSocketHandler()
                     if (notify) {
                         size_t nSizeAdded = 0;
                         auto it(pnode->vRecvMsg.begin());
-                        for (; it != pnode->vRecvMsg.end(); ++it) {
-                            if (!it->complete())
-                                break;
-                            nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+                        {
+                            LOCK(cs_totalBytesRecv);
+                            for (; it != pnode->vRecvMsg.end(); ++it) {
+                                if (!it->complete())
+                                    break;
+                                nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+                                // only count valid commands, like the per-node totals
+                                mapMsgCmdSize::iterator i = mapTotalBytesRecvPerMsgCmd.find(it->hdr.pchCommand);
+                                if (i == mapTotalBytesRecvPerMsgCmd.end())
+                                    i = mapTotalBytesRecvPerMsgCmd.find(NET_MESSAGE_COMMAND_OTHER);
+                                i->second += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+                            }
                         }
                         {
                             LOCK(pnode->cs_vProcessMsg);
                             pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
+                            pnode->vRecvMsgFree.splice(pnode->vRecvMsgFree.end(), pnode->vRecvMsgPool);
                             pnode->nProcessQueueSize += nSizeAdded;
                             pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
                         }
-                        WakeMessageHandler();
+                        WakeMessageHandler(pnode->GetId());
                     }
                 }
                 else if (nBytes == 0)
@@ -1455,11 +1921,21 @@ void CConnman::ThreadSocketHandler()
 
 void CConnman::WakeMessageHandler()
 {
-    {
-        std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+    std::lock_guard<std::mutex> lock(mutexMsgProc);
+    for (const auto& shard : vMsgProcShards) {
+        shard->fWake = true;
+        shard->cond.notify_one();
     }
-    condMsgProc.notify_one();
+}
+
+void CConnman::WakeMessageHandler(NodeId id)
+{
+    std::lock_guard<std::mutex> lock(mutexMsgProc);
+    if (vMsgProcShards.empty())
+        return;
+    MessageHandlerShard& shard = *vMsgProcShards[id % vMsgProcShards.size()];
+    shard.fWake = true;
+    shard.cond.notify_one();
 }
 
 
@@ -1609,46 +2085,68 @@ void CConnman::ThreadDNSAddressSeed()
     }
 
     const std::vector<std::string> &vSeeds = Params().DNSSeeds();
-    int found = 0;
+    std::atomic<int> found(0);
 
     LogPrintf("Loading addresses from DNS seeds (could take a while)\n");
 
-    for (const std::string &seed : vSeeds) {
-        if (interruptNet) {
-            return;
-        }
-        if (HaveNameProxy()) {
-            AddOneShot(seed);
-        } else {
-            std::vector<CNetAddr> vIPs;
-            std::vector<CAddress> vAdd;
-            ServiceFlags requiredServiceBits = GetDesirableServiceFlags(NODE_NONE);
-            std::string host = strprintf("x%x.%s", requiredServiceBits, seed);
-            CNetAddr resolveSource;
-            if (!resolveSource.SetInternal(host)) {
-                continue;
+    // Seeds are looked up on as many threads as connections are attempted on
+    std::atomic<size_t> nNext(0);
+    auto worker = [&]() {
+        for (size_t i = nNext++; i < vSeeds.size(); i = nNext++) {
+            const std::string& seed = vSeeds[i];
+            if (interruptNet) {
+                return;
             }
-            unsigned int nMaxIPs = 256; // Limits number of IPs learned from a DNS seed
-            if (LookupHost(host.c_str(), vIPs, nMaxIPs, true))
-            {
-                for (const CNetAddr& ip : vIPs)
+            if (HaveNameProxy()) {
+                AddOneShot(seed);
+            } else {
+                std::vector<CNetAddr> vIPs;
+                std::vector<CAddress> vAdd;
+                ServiceFlags requiredServiceBits = GetDesirableServiceFlags(NODE_NONE);
+                std::string host = strprintf("x%x.%s", requiredServiceBits, seed);
+                CNetAddr resolveSource;
+                if (!resolveSource.SetInternal(host)) {
+                    continue;
+                }
+                unsigned int nMaxIPs = 256; // Limits number of IPs learned from a DNS seed
+                if (LookupHost(host.c_str(), vIPs, nMaxIPs, true))
                 {
-                    int nOneDay = 24*3600;
-                    CAddress addr = CAddress(CService(ip, Params().GetDefaultPort()), requiredServiceBits);
-                    addr.nTime = GetTime() - 3*nOneDay - GetRand(4*nOneDay); // use a random age between 3 and 7 days old
-                    vAdd.push_back(addr);
-                    found++;
+                    for (const CNetAddr& ip : vIPs)
+                    {
+                        int nOneDay = 24*3600;
+                        CAddress addr = CAddress(CService(ip, Params().GetDefaultPort()), requiredServiceBits);
+                        addr.nTime = GetTime() - 3*nOneDay - GetRand(4*nOneDay); // use a random age between 3 and 7 days old
+                        vAdd.push_back(addr);
+                        found++;
+                    }
+                    addrman.Add(vAdd, resolveSource);
+                } else {
+                    // We now avoid directly using results from DNS Seeds which do not support service bit filtering,
+                    // instead using them as a oneshot to get nodes with our desired service bits.
+                    AddOneShot(seed);
                 }
-                addrman.Add(vAdd, resolveSource);
-            } else {
-                // We now avoid directly using results from DNS Seeds which do not support service bit filtering,
-                // instead using them as a oneshot to get nodes with our desired service bits.
-                AddOneShot(seed);
             }
         }
+    };
+
+    std::vector<std::thread> threads;
+    const size_t nThreads = std::min((size_t)nConnectThreads, vSeeds.size());
+    for (size_t i = 1; i < nThreads; i++) {
+        try {
+            threads.emplace_back(worker);
+        } catch (const std::system_error&) {
+            break;
+        }
+    }
+    worker();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    if (interruptNet) {
+        return;
     }
 
-    LogPrintf("%d addresses found from DNS seeds\n", found);
+    LogPrintf("%d addresses found from DNS seeds\n", found.load());
 }
 
 
@@ -1692,7 +2190,7 @@ void CConnman::ProcessOneShot()
     CAddress addr;
     CSemaphoreGrant grant(*semOutbound, true);
     if (grant) {
-        OpenNetworkConnection(addr, false, &grant, strDest.c_str(), true);
+        QueueNetworkConnection(addr, false, &grant, strDest.c_str(), true);
     }
 }
 
@@ -1738,7 +2236,7 @@ void CConnman::ThreadOpenConnections(const std::vector<std::string> connect)
             for (const std::string& strAddr : connect)
             {
                 CAddress addr(CService(), NODE_NONE);
-                OpenNetworkConnection(addr, false, nullptr, strAddr.c_str(), false, false, true);
+                QueueNetworkConnection(addr, false, nullptr, strAddr.c_str(), false, false, true);
                 for (int i = 0; i < 10 && i < nLoop; i++)
                 {
                     if (!interruptNet.sleep_for(std::chrono::milliseconds(500)))
@@ -1801,6 +2299,11 @@ void CConnman::ThreadOpenConnections(const std::vector<std::string> connect)
                 }
             }
         }
+        {
+            // Nor to the groups of the peers still being connected to
+            std::lock_guard<std::mutex> lock(mutexConnectionAttempts);
+            setConnected.insert(setConnectingGroups.begin(), setConnectingGroups.end());
+        }
 
         // Feeler Connections
         //
@@ -1877,7 +2380,7 @@ void CConnman::ThreadOpenConnections(const std::vector<std::string> connect)
                 LogPrint(BCLog::NET, "Making feeler connection to %s\n", addrConnect.ToString());
             }
 
-            OpenNetworkConnection(addrConnect, (int)setConnected.size() >= std::min(nMaxConnections - 1, 2), &grant, nullptr, false, fFeeler);
+            QueueNetworkConnection(addrConnect, (int)setConnected.size() >= std::min(nMaxConnections - 1, 2), &grant, nullptr, false, fFeeler);
         }
     }
 }
@@ -1950,7 +2453,7 @@ void CConnman::ThreadOpenAddedConnections()
                 }
                 tried = true;
                 CAddress addr(CService(), NODE_NONE);
-                OpenNetworkConnection(addr, false, &grant, info.strAddedNode.c_str(), false, false, true);
+                QueueNetworkConnection(addr, false, &grant, info.strAddedNode.c_str(), false, false, true);
                 if (!interruptNet.sleep_for(std::chrono::milliseconds(500)))
                     return;
             }
@@ -2001,16 +2504,73 @@ void CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
     }
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::QueueNetworkConnection(const CAddress& addrConnect, bool fCountFailure, CSemaphoreGrant *grantOutbound, const char *pszDest, bool fOneShot, bool fFeeler, bool manual_connection)
+{
+    if (threadConnectionAttempts.empty()) {
+        OpenNetworkConnection(addrConnect, fCountFailure, grantOutbound, pszDest, fOneShot, fFeeler, manual_connection);
+        return;
+    }
+
+    ConnectionAttempt attempt{addrConnect, pszDest ? pszDest : "", fCountFailure, fOneShot, fFeeler, manual_connection, MakeUnique<CSemaphoreGrant>()};
+    if (grantOutbound)
+        grantOutbound->MoveTo(*attempt.grant);
+    const std::string strKey = pszDest ? attempt.strDest : addrConnect.ToStringIPPort();
+    {
+        std::lock_guard<std::mutex> lock(mutexConnectionAttempts);
+        // The same destination may be chosen again before its attempt ends
+        if (flagInterruptConnectionAttempts || !setConnecting.insert(strKey).second)
+            return;
+        if (!pszDest)
+            setConnectingGroups.insert(addrConnect.GetGroup());
+        queueConnectionAttempts.push_back(std::move(attempt));
+    }
+    condConnectionAttempts.notify_one();
+}
+
+void CConnman::ThreadConnectionAttempts()
 {
+    while (true) {
+        ConnectionAttempt attempt;
+        {
+            std::unique_lock<std::mutex> lock(mutexConnectionAttempts);
+            condConnectionAttempts.wait(lock, [this] { return flagInterruptConnectionAttempts || !queueConnectionAttempts.empty(); });
+            if (flagInterruptConnectionAttempts)
+                return;
+            attempt = std::move(queueConnectionAttempts.front());
+            queueConnectionAttempts.pop_front();
+        }
+
+        // If the connection is made, the node takes the grant
+        OpenNetworkConnection(attempt.addrConnect, attempt.fCountFailure, attempt.grant.get(), attempt.strDest.empty() ? nullptr : attempt.strDest.c_str(),
+                              attempt.fOneShot, attempt.fFeeler, attempt.fManual);
+
+        std::lock_guard<std::mutex> lock(mutexConnectionAttempts);
+        if (attempt.strDest.empty()) {
+            setConnecting.erase(attempt.addrConnect.ToStringIPPort());
+            setConnectingGroups.erase(setConnectingGroups.find(attempt.addrConnect.GetGroup()));
+        } else {
+            setConnecting.erase(attempt.strDest);
+        }
+    }
+}
+
+void CConnman::ThreadMessageHandler(int nShard)
+{
+    MessageHandlerShard* shard;
+    {
+        std::lock_guard<std::mutex> lock(mutexMsgProc);
+        shard = vMsgProcShards[nShard].get();
+    }
     while (!flagInterruptMsgProc)
     {
         std::vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy) {
+            for (CNode* pnode : vNodes) {
+                if (pnode->GetId() % nMessageHandlerThreads != nShard)
+                    continue;
                 pnode->AddRef();
+                vNodesCopy.push_back(pnode);
             }
         }
 
@@ -2044,9 +2604,9 @@ void CConnman::ThreadMessageHandler()
 
         std::unique_lock<std::mutex> lock(mutexMsgProc);
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fMsgProcWake; });
+            shard->cond.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [shard] { return shard->fWake; });
         }
-        fMsgProcWake = false;
+        shard->fWake = false;
     }
 }
 
@@ -2212,6 +2772,8 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nSendBufferMaxSize = 0;
     nReceiveFloodSize = 0;
     flagInterruptMsgProc = false;
+    flagInterruptConnectionAttempts = false;
+    socketEventsFd = -1;
     SetTryNewOutboundPeer(false);
 
     Options connOptions;
@@ -2261,10 +2823,17 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
     {
         LOCK(cs_totalBytesRecv);
         nTotalBytesRecv = 0;
+        mapTotalBytesRecvPerMsgCmd.clear();
+        for (const std::string &msg : getAllNetMessageTypes())
+            mapTotalBytesRecvPerMsgCmd[msg] = 0;
+        mapTotalBytesRecvPerMsgCmd[NET_MESSAGE_COMMAND_OTHER] = 0;
     }
+    // Register the metrics of the message commands before any is counted
+    GetNetMessageMetrics(NET_MESSAGE_COMMAND_OTHER);
     {
         LOCK(cs_totalBytesSent);
         nTotalBytesSent = 0;
+        mapTotalBytesSentPerMsgCmd.clear();
         nMaxOutboundTotalBytesSentInCycle = 0;
         nMaxOutboundCycleStartTime = 0;
     }
@@ -2339,7 +2908,25 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
 
     {
         std::unique_lock<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = false;
+        vMsgProcShards.clear();
+        for (int i = 0; i < nMessageHandlerThreads; i++) {
+            vMsgProcShards.push_back(MakeUnique<MessageHandlerShard>());
+        }
+    }
+
+#ifdef USE_EPOLL
+    if (socketEventsMode == SocketEventsMode::EPOLL) {
+        socketEventsFd = epoll_create1(EPOLL_CLOEXEC);
+    }
+#endif
+#ifdef USE_KQUEUE
+    if (socketEventsMode == SocketEventsMode::KQUEUE) {
+        socketEventsFd = kqueue();
+    }
+#endif
+    if ((socketEventsMode == SocketEventsMode::EPOLL || socketEventsMode == SocketEventsMode::KQUEUE) && socketEventsFd == -1) {
+        LogPrintf("Unable to create socket event queue (%s), falling back to select\n", NetworkErrorString(WSAGetLastError()));
+        socketEventsMode = SocketEventsMode::SELECT;
     }
 
     // Send and receive from sockets, accept connections
@@ -2361,11 +2948,24 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         }
         return false;
     }
+    // Make outbound connections on threads of their own if several are to be attempted at once
+    {
+        std::lock_guard<std::mutex> lock(mutexConnectionAttempts);
+        flagInterruptConnectionAttempts = false;
+    }
+    if (nConnectThreads > 1) {
+        for (int i = 0; i < nConnectThreads; i++) {
+            threadConnectionAttempts.push_back(std::thread(&TraceThread<std::function<void()> >, "connect", std::function<void()>(std::bind(&CConnman::ThreadConnectionAttempts, this))));
+        }
+    }
+
     if (connOptions.m_use_addrman_outgoing || !connOptions.m_specified_outgoing.empty())
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this, connOptions.m_specified_outgoing)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        threadMessageHandlers.push_back(std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, i))));
+    }
 
     // Dump network addresses
     scheduler.scheduleEvery(std::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL * 1000);
@@ -2393,8 +2993,17 @@ void CConnman::Interrupt()
     {
         std::lock_guard<std::mutex> lock(mutexMsgProc);
         flagInterruptMsgProc = true;
+        for (const auto& shard : vMsgProcShards) {
+            shard->fWake = true;
+            shard->cond.notify_all();
+        }
     }
-    condMsgProc.notify_all();
+
+    {
+        std::lock_guard<std::mutex> lock(mutexConnectionAttempts);
+        flagInterruptConnectionAttempts = true;
+    }
+    condConnectionAttempts.notify_all();
 
     interruptNet();
     InterruptSocks5(true);
@@ -2414,17 +3023,39 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    for (std::thread& threadMessageHandler : threadMessageHandlers) {
+        if (threadMessageHandler.joinable())
+            threadMessageHandler.join();
+    }
+    threadMessageHandlers.clear();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
         threadOpenAddedConnections.join();
     if (threadDNSAddressSeed.joinable())
         threadDNSAddressSeed.join();
+    for (std::thread& threadConnectionAttempt : threadConnectionAttempts) {
+        if (threadConnectionAttempt.joinable())
+            threadConnectionAttempt.join();
+    }
+    threadConnectionAttempts.clear();
+    {
+        // Attempts never started release their grants here
+        std::lock_guard<std::mutex> lock(mutexConnectionAttempts);
+        queueConnectionAttempts.clear();
+        setConnecting.clear();
+        setConnectingGroups.clear();
+    }
     if (threadSocketHandler.joinable())
         threadSocketHandler.join();
 
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    if (socketEventsFd != -1) {
+        close(socketEventsFd);
+        socketEventsFd = -1;
+    }
+#endif
+
     if (fAddressesInitialized)
     {
         DumpData();
@@ -2537,11 +3168,19 @@ size_t CConnman::GetNodeCount(NumConnections flags)
 void CConnman::GetNodeStats(std::vector<CNodeStats>& vstats)
 {
     vstats.clear();
-    LOCK(cs_vNodes);
-    vstats.reserve(vNodes.size());
-    for (CNode* pnode : vNodes) {
+    std::vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        vNodesCopy = vNodes;
+        for (CNode* pnode : vNodesCopy)
+            pnode->AddRef();
+    }
+    // Collect outside cs_vNodes so nodes can be added and removed meanwhile
+    vstats.reserve(vNodesCopy.size());
+    for (CNode* pnode : vNodesCopy) {
         vstats.emplace_back();
         pnode->copyStats(vstats.back());
+        pnode->Release();
     }
 }
 
@@ -2674,6 +3313,180 @@ uint64_t CConnman::GetTotalBytesSent()
     return nTotalBytesSent;
 }
 
+mapMsgCmdSize CConnman::GetTotalBytesRecvPerMsgCmd()
+{
+    LOCK(cs_totalBytesRecv);
+    return mapTotalBytesRecvPerMsgCmd;
+}
+
+mapMsgCmdSize CConnman::GetTotalBytesSentPerMsgCmd()
+{
+    LOCK(cs_totalBytesSent);
+    return mapTotalBytesSentPerMsgCmd;
+}
+
+uint64_t CConnman::GetMaxUploadRate() const
+{
+    return uploadScheduler.GetTotalRateLimit();
+}
+
+CUploadScheduler::ClassStats CConnman::GetUploadClassStats(UploadClass uploadClass) const
+{
+    return uploadScheduler.GetStats(uploadClass);
+}
+
+UploadClass GetUploadClass(const CSerializedNetMsg& msg)
+{
+    if (msg.historical)
+        return UPLOAD_HISTORICAL;
+    const std::string& command = msg.command;
+    if (command == NetMsgType::CMPCTBLOCK || command == NetMsgType::BLOCKTXN || command == NetMsgType::GETBLOCKTXN ||
+        command == NetMsgType::HEADERS || command == NetMsgType::BLOCK)
+        return UPLOAD_BLOCK_RELAY;
+    if (command == NetMsgType::INV || command == NetMsgType::TX || command == NetMsgType::GETDATA ||
+        command == NetMsgType::NOTFOUND || command == NetMsgType::REQRECON || command == NetMsgType::SKETCH ||
+        command == NetMsgType::RECONCILDIFF)
+        return UPLOAD_TX_RELAY;
+    // Filtered blocks are limited like old blocks by -maxuploadtarget too
+    if (command == NetMsgType::MERKLEBLOCK || command == NetMsgType::CFILTER || command == NetMsgType::CFHEADERS ||
+        command == NetMsgType::CFCHECKPT)
+        return UPLOAD_HISTORICAL;
+    return UPLOAD_OTHER;
+}
+
+const char* GetUploadClassName(UploadClass uploadClass)
+{
+    switch (uploadClass) {
+    case UPLOAD_BLOCK_RELAY: return "blockrelay";
+    case UPLOAD_OTHER: return "other";
+    case UPLOAD_TX_RELAY: return "txrelay";
+    case UPLOAD_HISTORICAL: return "historical";
+    case UPLOAD_CLASS_COUNT: break;
+    }
+    assert(false);
+    return "";
+}
+
+// Tokens are counted in millionths of a byte, so that refills over short
+// intervals are not rounded away.
+CUploadScheduler::CUploadScheduler() : fLimited(false), nTotalRate(0), nTotalTokens(0), nLastRefill(0)
+{
+    vRates.fill(0);
+    vTokens.fill(0);
+    for (int i = 0; i < UPLOAD_CLASS_COUNT; i++) {
+        vBytesSent[i] = 0;
+        vDeferred[i] = 0;
+    }
+}
+
+void CUploadScheduler::SetRateLimits(uint64_t nTotalRateIn, const std::array<uint64_t, UPLOAD_CLASS_COUNT>& vClassRates)
+{
+    LOCK(cs);
+    nTotalRate = nTotalRateIn;
+    nTotalTokens = (int64_t)nTotalRate * 1000000;
+    bool fAnyLimit = nTotalRate != 0;
+    for (int i = 0; i < UPLOAD_CLASS_COUNT; i++) {
+        vRates[i] = vClassRates[i];
+        vTokens[i] = (int64_t)vRates[i] * 1000000;
+        fAnyLimit |= vRates[i] != 0;
+    }
+    nLastRefill = GetTimeMicros();
+    fLimited = fAnyLimit;
+}
+
+uint64_t CUploadScheduler::GetTotalRateLimit() const
+{
+    LOCK(cs);
+    return nTotalRate;
+}
+
+void CUploadScheduler::Refill(int64_t nTimeMicros)
+{
+    if (nTimeMicros <= nLastRefill)
+        return;
+    // A bucket is full after a second, whatever its rate
+    const int64_t nElapsed = std::min<int64_t>(nTimeMicros - nLastRefill, 1000000);
+    nLastRefill = nTimeMicros;
+    if (nTotalRate)
+        nTotalTokens = std::min<int64_t>(nTotalTokens + (int64_t)nTotalRate * nElapsed, (int64_t)nTotalRate * 1000000);
+    for (int i = 0; i < UPLOAD_CLASS_COUNT; i++) {
+        if (vRates[i])
+            vTokens[i] = std::min<int64_t>(vTokens[i] + (int64_t)vRates[i] * nElapsed, (int64_t)vRates[i] * 1000000);
+    }
+}
+
+size_t CUploadScheduler::GetBudget(const Queue& queue, size_t nMaxMessages, int64_t nTimeMicros)
+{
+    LOCK(cs);
+    Refill(nTimeMicros);
+
+    const int64_t nUnlimited = std::numeric_limits<int64_t>::max();
+    std::array<int64_t, UPLOAD_CLASS_COUNT> vLeft;
+    for (int i = 0; i < UPLOAD_CLASS_COUNT; i++) {
+        vLeft[i] = vRates[i] ? vTokens[i] / 1000000 : nUnlimited;
+    }
+    int64_t nTotalLeft = nTotalTokens / 1000000;
+
+    size_t nBudget = 0;
+    for (size_t i = 0; i < queue.size() && i < nMaxMessages; i++) {
+        const UploadClass uploadClass = queue[i].first;
+        int64_t nAvailable = vLeft[uploadClass];
+        if (nTotalRate)
+            nAvailable = std::min<int64_t>(nAvailable, nTotalLeft - (int64_t)(nTotalRate * UPLOAD_CLASS_RESERVE[uploadClass] / 4));
+        if (nAvailable <= 0) {
+            if (nBudget == 0)
+                vDeferred[uploadClass]++;
+            break;
+        }
+        const size_t nTake = std::min<uint64_t>(nAvailable, queue[i].second);
+        nBudget += nTake;
+        if (vRates[uploadClass])
+            vLeft[uploadClass] -= nTake;
+        nTotalLeft -= nTake;
+        if (nTake < queue[i].second)
+            break;
+    }
+    return nBudget;
+}
+
+void CUploadScheduler::Consume(Queue& queue, size_t nBytes, bool fLimit)
+{
+    std::array<int64_t, UPLOAD_CLASS_COUNT> vTaken{};
+    const size_t nTotal = nBytes;
+    while (nBytes > 0) {
+        assert(!queue.empty());
+        auto& front = queue.front();
+        const size_t nTake = std::min(nBytes, front.second);
+        vBytesSent[front.first] += nTake;
+        vTaken[front.first] += nTake;
+        front.second -= nTake;
+        nBytes -= nTake;
+        if (front.second == 0)
+            queue.pop_front();
+    }
+    if (!fLimit || !fLimited)
+        return;
+    LOCK(cs);
+    if (nTotalRate)
+        nTotalTokens -= (int64_t)nTotal * 1000000;
+    for (int i = 0; i < UPLOAD_CLASS_COUNT; i++) {
+        if (vRates[i])
+            vTokens[i] -= vTaken[i] * 1000000;
+    }
+}
+
+CUploadScheduler::ClassStats CUploadScheduler::GetStats(UploadClass uploadClass) const
+{
+    ClassStats stats;
+    {
+        LOCK(cs);
+        stats.nRateLimit = vRates[uploadClass];
+    }
+    stats.nBytesSent = vBytesSent[uploadClass];
+    stats.nDeferred = vDeferred[uploadClass];
+    return stats;
+}
+
 ServiceFlags CConnman::GetLocalServices() const
 {
     return nLocalServices;
@@ -2707,6 +3520,7 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
 {
     nServices = NODE_NONE;
     hSocket = hSocketIn;
+    nSocketEvents = -1;
     nRecvVersion = INIT_PROTO_VERSION;
     nLastSend = 0;
     nLastRecv = 0;
@@ -2734,6 +3548,7 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nNextLocalAddrSend = 0;
     nNextAddrSend = 0;
     nNextInvSend = 0;
+    fTxReconciliation = false;
     fRelayTxes = false;
     fSentAddr = false;
     pfilter = MakeUnique<CBloomFilter>();
@@ -2745,16 +3560,17 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nPingUsecTime = 0;
     fPingQueued = false;
     nMinPingUsecTime = std::numeric_limits<int64_t>::max();
+    nCmpctBlocksSent = 0;
+    nCmpctBlockTxnRequests = 0;
+    nCmpctBlocksReceived = 0;
+    nCmpctBlocksReconstructed = 0;
     minFeeFilter = 0;
     lastSentFeeFilter = 0;
     nextSendTimeFeeFilter = 0;
     fPauseRecv = false;
     fPauseSend = false;
     nProcessQueueSize = 0;
-
-    for (const std::string &msg : getAllNetMessageTypes())
-        mapRecvBytesPerMsgCmd[msg] = 0;
-    mapRecvBytesPerMsgCmd[NET_MESSAGE_COMMAND_OTHER] = 0;
+    nRecvPoolSize = 0;
 
     if (fLogIPs) {
         LogPrint(BCLog::NET, "Added connection to %s peer=%d\n", addrName, id);
@@ -2768,40 +3584,6 @@ CNode::~CNode()
     CloseSocket(hSocket);
 }
 
-void CNode::AskFor(const CInv& inv)
-{
-    if (mapAskFor.size() > MAPASKFOR_MAX_SZ || setAskFor.size() > SETASKFOR_MAX_SZ)
-        return;
-    // a peer may not have multiple non-responded queue positions for a single inv item
-    if (!setAskFor.insert(inv.hash).second)
-        return;
-
-    // We're using mapAskFor as a priority queue,
-    // the key is the earliest time the request can be sent
-    int64_t nRequestTime;
-    limitedmap<uint256, int64_t>::const_iterator it = mapAlreadyAskedFor.find(inv.hash);
-    if (it != mapAlreadyAskedFor.end())
-        nRequestTime = it->second;
-    else
-        nRequestTime = 0;
-    LogPrint(BCLog::NET, "askfor %s  %d (%s) peer=%d\n", inv.ToString(), nRequestTime, DateTimeStrFormat("%H:%M:%S", nRequestTime/1000000), id);
-
-    // Make sure not to reuse time indexes to keep things in the same order
-    int64_t nNow = GetTimeMicros() - 1000000;
-    static int64_t nLastTime;
-    ++nLastTime;
-    nNow = std::max(nNow, nLastTime);
-    nLastTime = nNow;
-
-    // Each retry is 2 minutes after the last
-    nRequestTime = std::max(nRequestTime + 2 * 60 * 1000000, nNow);
-    if (it != mapAlreadyAskedFor.end())
-        mapAlreadyAskedFor.update(it, nRequestTime);
-    else
-        mapAlreadyAskedFor.insert(std::make_pair(inv.hash, nRequestTime));
-    mapAskFor.insert(std::make_pair(nRequestTime, inv));
-}
-
 bool CConnman::NodeFullyConnected(const CNode* pnode)
 {
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
@@ -2809,32 +3591,51 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
 
 void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 {
-    size_t nMessageSize = msg.data.size();
+    // A shared payload is queued by reference and its checksum was computed
+    // when it was serialized; otherwise the message owns its data.
+    std::shared_ptr<const std::vector<unsigned char>> payload;
+    uint256 hash;
+    if (msg.shared_payload) {
+        payload = std::shared_ptr<const std::vector<unsigned char>>(msg.shared_payload, &msg.shared_payload->data);
+        hash = msg.shared_payload->hash;
+    } else {
+        hash = Hash(msg.data.begin(), msg.data.end());
+        payload = std::make_shared<const std::vector<unsigned char>>(std::move(msg.data));
+    }
+    size_t nMessageSize = payload->size();
     size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
+    const UploadClass uploadClass = GetUploadClass(msg);
     LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->GetId());
+    TRACE3(net, outbound_message, pnode->GetId(), msg.command.c_str(), nMessageSize);
 
     std::vector<unsigned char> serializedHeader;
     serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
     CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
     CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
 
+    {
+        LOCK(cs_totalBytesSent);
+        mapTotalBytesSentPerMsgCmd[msg.command] += nTotalSize;
+    }
+    GetNetMessageMetrics(msg.command).pSent->Add(nTotalSize);
+
     size_t nBytesSent = 0;
     {
         LOCK(pnode->cs_vSend);
         bool optimisticSend(pnode->vSendMsg.empty());
 
         //log total amount of bytes per command
-        pnode->mapSendBytesPerMsgCmd[msg.command] += nTotalSize;
+        pnode->mapSendBytesPerMsgCmd.Add(msg.command, nTotalSize);
         pnode->nSendSize += nTotalSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
+        pnode->vSendMsg.push_back(std::make_shared<const std::vector<unsigned char>>(std::move(serializedHeader)));
         if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+            pnode->vSendMsg.push_back(std::move(payload));
+        pnode->vSendClass.emplace_back(uploadClass, nTotalSize);
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
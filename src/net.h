@@ -12,7 +12,6 @@
 #include <bloom.h>
 #include <compat.h>
 #include <hash.h>
-#include <limitedmap.h>
 #include <netaddress.h>
 #include <policy/feerate.h>
 #include <protocol.h>
@@ -21,12 +20,15 @@
 #include <sync.h>
 #include <uint256.h>
 #include <threadinterrupt.h>
+#include <txreconciliation.h>
 
+#include <array>
 #include <atomic>
 #include <deque>
 #include <stdint.h>
 #include <thread>
 #include <memory>
+#include <set>
 #include <condition_variable>
 
 #ifndef WIN32
@@ -59,6 +61,8 @@ static const unsigned int MAX_ADDR_TO_SEND = 1000;
 //接收消息的最大长度为4M
 /** Maximum length of incoming protocol messages (no message over 4 MB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 4 * 1000 * 1000;
+/** Largest receive buffer kept for reuse once its message has been processed */
+static const size_t MAX_RECV_POOL_BUFFER_SIZE = 256 * 1024;
 //版本字段的最大长度
 /** Maximum length of strSubVer in `version` message */
 static const unsigned int MAX_SUBVERSION_LENGTH = 256;
@@ -77,10 +81,6 @@ static const bool DEFAULT_UPNP = USE_UPNP;
 #else
 static const bool DEFAULT_UPNP = false;
 #endif
-/** The maximum number of entries in mapAskFor */
-static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
-/** The maximum number of entries in setAskFor (larger due to getdata latency)*/
-static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
 /** The maximum number of peer connections to maintain. */
 //默认维护的最大连接数
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
@@ -88,6 +88,10 @@ static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
 static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
 /** The default timeframe for -maxuploadtarget. 1 day. */
 static const uint64_t MAX_UPLOAD_TIMEFRAME = 60 * 60 * 24;
+/** The default for -maxuploadrate, in KiB per second. 0 = Unlimited */
+static const uint64_t DEFAULT_MAX_UPLOAD_RATE = 0;
+/** The highest rate -maxuploadrate and -uploadrate take, in KiB per second */
+static const uint64_t MAX_UPLOAD_RATE = 1000000000;
 /** Default for blocks only*/
 //不使能只传递块模式
 static const bool DEFAULT_BLOCKSONLY = false;
@@ -96,6 +100,38 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** -msghandlers default: number of message handler threads, peers are sharded across them */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 1;
+/** Maximum number of message handler threads */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
+/** -connectthreads default: number of outbound connection attempts made at once */
+static const int DEFAULT_CONNECT_THREADS = 1;
+/** Maximum number of outbound connection attempts made at once */
+static const int MAX_CONNECT_THREADS = 16;
+
+/** Ways ThreadSocketHandler can wait for sockets to become ready */
+enum class SocketEventsMode {
+    SELECT, //!< select(), limited to FD_SETSIZE sockets
+    POLL,   //!< poll()
+    EPOLL,  //!< epoll, registrations kept across iterations (Linux)
+    KQUEUE, //!< kqueue, registrations kept across iterations (BSD, macOS)
+};
+
+/** -socketevents default: the most scalable backend this platform has */
+#if defined(USE_EPOLL)
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+#elif defined(USE_KQUEUE)
+static const char* const DEFAULT_SOCKETEVENTS = "kqueue";
+#elif defined(USE_POLL)
+static const char* const DEFAULT_SOCKETEVENTS = "poll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+#endif
+
+/** Look up a -socketevents backend. Returns false if it is unknown or not available in this build. */
+bool GetSocketEventsMode(const std::string& strMode, SocketEventsMode& mode);
+/** Comma-separated names of the -socketevents values available in this build */
+std::string ListSocketEventsModes();
 
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
 //拉黑名单时间
@@ -114,6 +150,21 @@ struct AddedNodeInfo
 class CNodeStats;
 class CClientUIInterface;
 
+/**
+ * A serialized message payload that can be queued for many peers at once,
+ * such as a newly connected block. The bytes and their checksum are computed
+ * once and the send queues of all peers share ownership of them.
+ */
+class CSharedNetPayload
+{
+public:
+    explicit CSharedNetPayload(std::vector<unsigned char>&& dataIn)
+        : data(std::move(dataIn)), hash(Hash(data.begin(), data.end())) {}
+
+    const std::vector<unsigned char> data;
+    const uint256 hash;
+};
+
 struct CSerializedNetMsg
 {
     CSerializedNetMsg() = default;
@@ -125,6 +176,94 @@ struct CSerializedNetMsg
 
     std::vector<unsigned char> data;
     std::string command;
+    std::shared_ptr<const CSharedNetPayload> shared_payload; // sent instead of data when set
+    bool historical = false; // part of serving old blocks, sent as UPLOAD_HISTORICAL
+};
+
+/** Classes of outgoing traffic, from the one the upload scheduler favours most */
+enum UploadClass {
+    UPLOAD_BLOCK_RELAY = 0, //!< cmpctblock, blocktxn, headers and blocks near the tip
+    UPLOAD_OTHER,           //!< handshake, pings, addresses and the other small messages
+    UPLOAD_TX_RELAY,        //!< inv, tx and the other transaction relay messages
+    UPLOAD_HISTORICAL,      //!< old blocks, filtered blocks and their transactions
+    UPLOAD_CLASS_COUNT
+};
+
+/** The class of a message that is about to be sent */
+UploadClass GetUploadClass(const CSerializedNetMsg& msg);
+/** Name of an upload class, as used by -uploadrate and getnettotals */
+const char* GetUploadClassName(UploadClass uploadClass);
+
+/**
+ * Token buckets limiting the upload rate of every class of traffic, and of
+ * all of them together; a rate of 0 is unlimited. Every bucket holds at most
+ * one second of its rate. Classes below UPLOAD_OTHER may only take tokens of
+ * the total bucket while it holds more than a reserve (a quarter of it for
+ * transaction relay, half of it for old blocks), so that on a busy link the
+ * tokens go to new blocks first and old blocks get what is left.
+ *
+ * Send queues are given as the class and unsent size of each of their
+ * messages, oldest first. Tokens are taken when the bytes went out, so
+ * concurrent senders may overdraw a bucket; it is then repaid from the next
+ * refills.
+ */
+class CUploadScheduler
+{
+public:
+    typedef std::deque<std::pair<UploadClass, size_t>> Queue;
+
+    struct ClassStats
+    {
+        uint64_t nRateLimit;
+        uint64_t nBytesSent;
+        uint64_t nDeferred; // times a queue of this class was held back
+    };
+
+    CUploadScheduler();
+
+    /** Set the rates, in bytes per second */
+    void SetRateLimits(uint64_t nTotalRate, const std::array<uint64_t, UPLOAD_CLASS_COUNT>& vClassRates);
+    uint64_t GetTotalRateLimit() const;
+    bool IsLimited() const { return fLimited; }
+
+    /** Bytes of the first nMaxMessages messages of queue that may be sent at nTimeMicros */
+    size_t GetBudget(const Queue& queue, size_t nMaxMessages, int64_t nTimeMicros);
+    /** Take off the bytes that went out from the front of queue, and from the buckets */
+    void Consume(Queue& queue, size_t nBytes, bool fLimit);
+
+    ClassStats GetStats(UploadClass uploadClass) const;
+
+private:
+    mutable CCriticalSection cs;
+    std::atomic<bool> fLimited;
+    uint64_t nTotalRate GUARDED_BY(cs);
+    int64_t nTotalTokens GUARDED_BY(cs);
+    std::array<uint64_t, UPLOAD_CLASS_COUNT> vRates GUARDED_BY(cs);
+    std::array<int64_t, UPLOAD_CLASS_COUNT> vTokens GUARDED_BY(cs);
+    int64_t nLastRefill GUARDED_BY(cs);
+    std::array<std::atomic<uint64_t>, UPLOAD_CLASS_COUNT> vBytesSent;
+    std::array<std::atomic<uint64_t>, UPLOAD_CLASS_COUNT> vDeferred;
+
+    void Refill(int64_t nTimeMicros) EXCLUSIVE_LOCKS_REQUIRED(cs);
+};
+
+typedef std::map<std::string, uint64_t> mapMsgCmdSize; //command, total bytes
+/**
+ * Per-peer byte counters, one for every known command and one for all
+ * others. The list of commands is shared by all peers, which only hold the
+ * counters; these are atomics, so they can be read without a lock.
+ */
+class CMsgCmdCounter
+{
+public:
+    CMsgCmdCounter();
+    void Add(const std::string& command, uint64_t nBytes);
+    //! The counters by command
+    mapMsgCmdSize Get() const;
+    size_t DynamicMemoryUsage() const;
+
+private:
+    std::unique_ptr<std::atomic<uint64_t>[]> vCounters;
 };
 
 class NetEventsInterface;
@@ -159,6 +298,11 @@ public:
         bool m_use_addrman_outgoing = true;
         std::vector<std::string> m_specified_outgoing;
         std::vector<std::string> m_added_nodes;
+        SocketEventsMode socketEventsMode = SocketEventsMode::SELECT;
+        int nMessageHandlerThreads = 1;
+        int nConnectThreads = 1;
+        uint64_t nMaxUploadRate = 0;
+        std::array<uint64_t, UPLOAD_CLASS_COUNT> vUploadClassRates{};
     };
 
     void Init(const Options& connOptions) {
@@ -177,7 +321,14 @@ public:
             nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
             nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
         }
-        vWhitelistedRange = connOptions.vWhitelistedRange;
+        whitelistedRanges.Clear();
+        for (const CSubNet& subnet : connOptions.vWhitelistedRange) {
+            whitelistedRanges.Insert(subnet, 0);
+        }
+        socketEventsMode = connOptions.socketEventsMode;
+        nMessageHandlerThreads = std::max(1, std::min(connOptions.nMessageHandlerThreads, MAX_MESSAGE_HANDLER_THREADS));
+        nConnectThreads = std::max(1, std::min(connOptions.nConnectThreads, MAX_CONNECT_THREADS));
+        uploadScheduler.SetRateLimits(connOptions.nMaxUploadRate, connOptions.vUploadClassRates);
         {
             LOCK(cs_vAddedNodes);
             vAddedNodes = connOptions.m_added_nodes;
@@ -193,6 +344,12 @@ public:
     void SetNetworkActive(bool active);
     void OpenNetworkConnection(const CAddress& addrConnect, bool fCountFailure, CSemaphoreGrant *grantOutbound = nullptr, const char *strDest = nullptr, bool fOneShot = false, bool fFeeler = false, bool manual_connection = false);
     bool CheckIncomingNonce(uint64_t nonce);
+    /**
+     * Create an inbound peer on a connected socket, taking ownership of it.
+     * Used by AcceptConnection, and by the network benchmarks to attach one
+     * end of a socket pair.
+     */
+    void CreateNodeFromAcceptedSocket(SOCKET hSocket, bool whitelisted, const CAddress& addr);
 
     bool ForNode(NodeId id, std::function<bool(CNode* pnode)> func);
 
@@ -318,6 +475,11 @@ public:
 
     uint64_t GetTotalBytesRecv();
     uint64_t GetTotalBytesSent();
+    mapMsgCmdSize GetTotalBytesRecvPerMsgCmd();
+    mapMsgCmdSize GetTotalBytesSentPerMsgCmd();
+    //! Rate limit (in bytes per second, 0 = none) and totals of every class of upload traffic
+    uint64_t GetMaxUploadRate() const;
+    CUploadScheduler::ClassStats GetUploadClassStats(UploadClass uploadClass) const;
 
     void SetBestHeight(int height);
     int GetBestHeight() const;
@@ -327,13 +489,17 @@ public:
 
     unsigned int GetReceiveFloodSize() const;
 
+    /** Wake all message handler threads */
     void WakeMessageHandler();
+    /** Wake the message handler thread that serves the given node */
+    void WakeMessageHandler(NodeId id);
 private:
     struct ListenSocket {
         SOCKET socket;
         bool whitelisted;
+        int nSocketEvents; //!< Events registered with socketEventsFd, -1 if none
 
-        ListenSocket(SOCKET socket_, bool whitelisted_) : socket(socket_), whitelisted(whitelisted_) {}
+        ListenSocket(SOCKET socket_, bool whitelisted_) : socket(socket_), whitelisted(whitelisted_), nSocketEvents(-1) {}
     };
 
     bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhitelisted = false);
@@ -343,11 +509,31 @@ private:
     void AddOneShot(const std::string& strDest);
     void ProcessOneShot();
     void ThreadOpenConnections(std::vector<std::string> connect);
-    void ThreadMessageHandler();
+    void ThreadConnectionAttempts();
+    /** OpenNetworkConnection on one of the connection threads if there are several, so that attempts run at once; a queued attempt takes the grant */
+    void QueueNetworkConnection(const CAddress& addrConnect, bool fCountFailure, CSemaphoreGrant *grantOutbound, const char *strDest = nullptr, bool fOneShot = false, bool fFeeler = false, bool manual_connection = false);
+    void ThreadMessageHandler(int nShard);
     void AcceptConnection(const ListenSocket& hListenSocket);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
+    /** Collect the sockets to wait on for receiving, sending and errors */
+    void GenerateSelectSet(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+    /** Wait up to 50ms for the given sockets, leaving only the ready ones in each set */
+    void SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+    /** Register a socket with socketEventsFd for the given events, if they differ from nRegistered (-1 if not registered yet) */
+    void UpdateSocketEvents(SOCKET hSocket, int& nRegistered, int nEvents);
+    bool SocketEventsSelect(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+#ifdef USE_POLL
+    bool SocketEventsPoll(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+#endif
+#ifdef USE_EPOLL
+    bool SocketEventsEPoll(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+#endif
+#ifdef USE_KQUEUE
+    bool SocketEventsKQueue(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+#endif
+
     uint64_t CalculateKeyedNetGroup(const CAddress& ad) const;
 
     CNode* FindNode(const CNetAddr& ip);
@@ -363,7 +549,9 @@ private:
 
     NodeId GetNewNodeId();
 
-    size_t SocketSendData(CNode *pnode) const;
+    size_t SocketSendData(CNode *pnode);
+    //! Whether the upload scheduler lets the node send now
+    bool CanSendData(CNode *pnode);
     //!check is the banlist has unwritten changes
     bool BannedSetIsDirty();
     //!set the "dirty" flag for the banlist
@@ -386,6 +574,8 @@ private:
     CCriticalSection cs_totalBytesSent;
     uint64_t nTotalBytesRecv GUARDED_BY(cs_totalBytesRecv);
     uint64_t nTotalBytesSent GUARDED_BY(cs_totalBytesSent);
+    mapMsgCmdSize mapTotalBytesRecvPerMsgCmd GUARDED_BY(cs_totalBytesRecv);
+    mapMsgCmdSize mapTotalBytesSentPerMsgCmd GUARDED_BY(cs_totalBytesSent);
 
     // outbound limit & stats
     uint64_t nMaxOutboundTotalBytesSentInCycle GUARDED_BY(cs_totalBytesSent);
@@ -393,16 +583,26 @@ private:
     uint64_t nMaxOutboundLimit GUARDED_BY(cs_totalBytesSent);
     uint64_t nMaxOutboundTimeframe GUARDED_BY(cs_totalBytesSent);
 
+    // Upload rate limits & stats per class of traffic
+    CUploadScheduler uploadScheduler;
+
     // Whitelisted ranges. Any node connecting from these is automatically
     // whitelisted (as well as those connecting to whitelisted binds).
-    std::vector<CSubNet> vWhitelistedRange;
+    CSubNetIndex whitelistedRanges;
 
     unsigned int nSendBufferMaxSize;
     unsigned int nReceiveFloodSize;
 
     std::vector<ListenSocket> vhListenSocket;
+
+    SocketEventsMode socketEventsMode;
+    //! epoll or kqueue descriptor while one of those backends is in use, -1 otherwise
+    int socketEventsFd;
+
     std::atomic<bool> fNetworkActive;
     banmap_t setBanned;
+    //! The subnets of setBanned, with the times their bans end
+    CSubNetIndex bannedIndex;
     CCriticalSection cs_setBanned;
     bool setBannedIsDirty;
     bool fAddressesInitialized;
@@ -432,20 +632,47 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /** One message handler thread. It serves the nodes whose id modulo
+     *  nMessageHandlerThreads is its index, so each node's messages are
+     *  still processed by a single thread and in order. */
+    struct MessageHandlerShard {
+        //! flag for waking the thread, guarded by mutexMsgProc
+        bool fWake = false;
+        std::condition_variable cond;
+    };
+    int nMessageHandlerThreads;
+    std::vector<std::unique_ptr<MessageHandlerShard>> vMsgProcShards;
 
-    std::condition_variable condMsgProc;
     std::mutex mutexMsgProc;
     std::atomic<bool> flagInterruptMsgProc;
 
+    /** An outbound connection attempt waiting for a connection thread */
+    struct ConnectionAttempt {
+        CAddress addrConnect;
+        std::string strDest;
+        bool fCountFailure;
+        bool fOneShot;
+        bool fFeeler;
+        bool fManual;
+        std::unique_ptr<CSemaphoreGrant> grant;
+    };
+    int nConnectThreads;
+    std::mutex mutexConnectionAttempts;
+    std::condition_variable condConnectionAttempts;
+    std::deque<ConnectionAttempt> queueConnectionAttempts;
+    //! Destinations of the attempts queued or running, and the network groups of those to addresses
+    std::set<std::string> setConnecting;
+    std::multiset<std::vector<unsigned char>> setConnectingGroups;
+    bool flagInterruptConnectionAttempts;
+
     CThreadInterrupt interruptNet;
 
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
+    std::vector<std::thread> threadConnectionAttempts;
 
     /** flag for deciding to connect to an extra outbound peer,
      *  in excess of nMaxOutbound
@@ -519,8 +746,6 @@ extern bool fDiscover;
 extern bool fListen;
 extern bool fRelayTxes;
 
-extern limitedmap<uint256, int64_t> mapAlreadyAskedFor;
-
 /** Subversion as sent to the P2P network in `version` messages */
 extern std::string strSubVersion;
 
@@ -531,7 +756,6 @@ struct LocalServiceInfo {
 
 extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
-typedef std::map<std::string, uint64_t> mapMsgCmdSize; //command, total bytes
 
 //节点统计数据
 class CNodeStats
@@ -558,6 +782,11 @@ public:
     double dPingTime;
     double dPingWait;
     double dMinPing;
+    uint64_t nCmpctBlocksSent;
+    uint64_t nCmpctBlockTxnRequests;
+    uint64_t nCmpctBlocksReceived;
+    uint64_t nCmpctBlocksReconstructed;
+    size_t nMemoryUsage;
     // Our address, as reported by the peer
     std::string addrLocal;
     // Address of this peer
@@ -577,14 +806,15 @@ public:
     //解析的数据类型头(false),数据(true)
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;//收到的序列化形式的消息头             // partially received header
+    CPublicDataStream hdrbuf;//收到的序列化形式的消息头             // partially received header
     CMessageHeader hdr;//完整消息头             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;//消息负载数据              // received message data
+    CPublicDataStream vRecv;//消息负载数据              // received message data
     unsigned int nDataPos;
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
+    bool fChecksumValid;            // payload checksum verified by the socket handler once complete
 
     CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
@@ -592,6 +822,7 @@ public:
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
+        fChecksumValid = false;
     }
 
     bool complete() const
@@ -609,6 +840,12 @@ public:
         vRecv.SetVersion(nVersionIn);
     }
 
+    /** Prepare a processed message to receive another one, keeping its buffers */
+    void Reset();
+
+    /** Memory held by a pooled message */
+    size_t GetPoolSize() const { return sizeof(CNetMessage) + hdrbuf.capacity() + vRecv.capacity(); }
+
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
 };
@@ -623,10 +860,12 @@ public:
     // socket
     std::atomic<ServiceFlags> nServices;
     SOCKET hSocket;
+    int nSocketEvents; // events hSocket is registered for with the socket handler's epoll/kqueue, -1 if none
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
-    uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::atomic<uint64_t> nSendBytes;
+    std::deque<std::shared_ptr<const std::vector<unsigned char>>> vSendMsg;
+    CUploadScheduler::Queue vSendClass; // class and unsent size of every message in vSendMsg
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -634,11 +873,15 @@ public:
     CCriticalSection cs_vProcessMsg;
     std::list<CNetMessage> vProcessMsg;
     size_t nProcessQueueSize;
+    // Processed messages handed back by the message handler for reuse
+    std::list<CNetMessage> vRecvMsgPool;
+    // Memory held by vRecvMsgPool and vRecvMsgFree
+    std::atomic<size_t> nRecvPoolSize;
 
     CCriticalSection cs_sendProcessing;
 
     std::deque<CInv> vRecvGetData;
-    uint64_t nRecvBytes;
+    std::atomic<uint64_t> nRecvBytes;
     std::atomic<int> nRecvVersion;
 
     std::atomic<int64_t> nLastSend;
@@ -682,18 +925,22 @@ public:
     std::atomic_bool fPauseSend;
 protected:
 
-    mapMsgCmdSize mapSendBytesPerMsgCmd;
-    mapMsgCmdSize mapRecvBytesPerMsgCmd;
+    CMsgCmdCounter mapSendBytesPerMsgCmd;
+    CMsgCmdCounter mapRecvBytesPerMsgCmd;
 
 public:
     uint256 hashContinue;
     std::atomic<int> nStartingHeight;
 
     // flood relay
+    // Other nodes' message handler threads relay addresses to this node,
+    // so these are guarded by cs_vAddrToSend.
+    CCriticalSection cs_vAddrToSend;
     std::vector<CAddress> vAddrToSend;
+    // The known filters only take memory once something is inserted, so
+    // peers that never relay addresses or transactions stay small
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
-    std::set<uint256> setKnown;
     int64_t nNextAddrSend;
     int64_t nNextLocalAddrSend;
 
@@ -702,13 +949,17 @@ public:
     // Set of transaction ids we still have to announce.
     // They are sorted by the mempool before relay, so the order is not important.
     std::set<uint256> setInventoryTxToSend;
+    // Whether transactions are announced by set reconciliation instead, and
+    // the transaction ids waiting for the next reconciliation round.
+    bool fTxReconciliation;
+    std::set<uint256> setReconTxToSend;
     // List of block ids we still have announce.
     // There is no final sorting before sending, as they are always sent immediately
     // and in the order requested.
     std::vector<uint256> vInventoryBlockToSend;
     CCriticalSection cs_inventory;
-    std::set<uint256> setAskFor;
-    std::multimap<int64_t, CInv> mapAskFor;
+    //! Orphan transactions to reconsider after a parent was accepted, guarded by g_cs_orphans
+    std::set<uint256> orphan_work_set;
     int64_t nNextInvSend;
     // Used for headers announcements - unfiltered blocks to relay
     // Also protected by cs_inventory
@@ -734,6 +985,14 @@ public:
     std::atomic<int64_t> nMinPingUsecTime;
     // Whether a ping is requested.
     std::atomic<bool> fPingQueued;
+
+    // Compact block relay: cmpctblock messages sent to the peer, getblocktxn
+    // requests it answered them with, compact blocks received from it, and
+    // how many of those were reconstructed without a round trip.
+    std::atomic<uint64_t> nCmpctBlocksSent;
+    std::atomic<uint64_t> nCmpctBlockTxnRequests;
+    std::atomic<uint64_t> nCmpctBlocksReceived;
+    std::atomic<uint64_t> nCmpctBlocksReconstructed;
     // Minimum fee rate with which to filter inv's to this node
     CAmount minFeeFilter;
     CCriticalSection cs_feeFilter;
@@ -753,6 +1012,7 @@ private:
     const int nMyStartingHeight;
     int nSendVersion;
     std::list<CNetMessage> vRecvMsg;  // Used only by SocketHandler thread
+    std::list<CNetMessage> vRecvMsgFree;  // Pooled messages taken over from vRecvMsgPool, used only by SocketHandler thread
 
     mutable CCriticalSection cs_addrName;
     std::string addrName;
@@ -781,6 +1041,8 @@ public:
     }
 
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete);
+    /** Return the processed message in msgs to the receive pool if it fits in nMaxBuffered */
+    void RecycleRecvMsg(std::list<CNetMessage>& msgs, size_t nMaxBuffered);
 
     void SetRecvVersion(int nVersionIn)
     {
@@ -812,11 +1074,13 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(_addr.GetKey());
     }
 
     void PushAddress(const CAddress& _addr, FastRandomContext &insecure_rand)
     {
+        LOCK(cs_vAddrToSend);
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
@@ -843,7 +1107,10 @@ public:
         LOCK(cs_inventory);
         if (inv.type == MSG_TX) {
             if (!filterInventoryKnown.contains(inv.hash)) {
-                setInventoryTxToSend.insert(inv.hash);
+                if (fTxReconciliation && setReconTxToSend.size() < MAX_RECON_SET_SIZE)
+                    setReconTxToSend.insert(inv.hash);
+                else
+                    setInventoryTxToSend.insert(inv.hash);
             }
         } else if (inv.type == MSG_BLOCK) {
             vInventoryBlockToSend.push_back(inv.hash);
@@ -856,12 +1123,13 @@ public:
         vBlockHashesToAnnounce.push_back(hash);
     }
 
-    void AskFor(const CInv& inv);
-
     void CloseSocketDisconnect();
 
     void copyStats(CNodeStats &stats);
 
+    //! Memory held by the peer: its send and receive queues, relay state and filters
+    size_t DynamicMemoryUsage();
+
     ServiceFlags GetLocalServices() const
     {
         return nLocalServices;
@@ -8,12 +8,17 @@
 #include <addrman.h>
 #include <arith_uint256.h>
 #include <blockencodings.h>
+#include <blockfilter.h>
 #include <chainparams.h>
+#include <compressedheaders.h>
 #include <consensus/validation.h>
 #include <hash.h>
+#include <index/blockfilterindex.h>
 #include <init.h>
 #include <validation.h>
+#include <memusage.h>
 #include <merkleblock.h>
+#include <metrics.h>
 #include <netmessagemaker.h>
 #include <netbase.h>
 #include <policy/fees.h>
@@ -23,13 +28,19 @@
 #include <random.h>
 #include <reverse_iterator.h>
 #include <scheduler.h>
+#include <taskpool.h>
 #include <tinyformat.h>
 #include <txmempool.h>
+#include <txreconciliation.h>
+#include <txrequest.h>
+#include <udprelay.h>
 #include <ui_interface.h>
 #include <util.h>
 #include <utilmoneystr.h>
 #include <utilstrencodings.h>
 
+#include <deque>
+#include <limits>
 #include <memory>
 
 #if defined(NDEBUG)
@@ -38,29 +49,33 @@
 
 std::atomic<int64_t> nTimeBestReceived(0); // Used only to inform the wallet of when we last received a block
 
-struct IteratorComparator
-{
-    template<typename I>
-    bool operator()(const I& a, const I& b) const
-    {
-        return &(*a) < &(*b);
-    }
-};
-
 struct COrphanTx {
     // When modifying, adapt the copy of this definition in tests/DoS_tests.
     CTransactionRef tx;
     NodeId fromPeer;
     int64_t nTimeExpire;
+    size_t list_pos;
+    size_t nUsage;
 };
 static CCriticalSection g_cs_orphans;
-std::map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(g_cs_orphans);
-std::map<COutPoint, std::set<std::map<uint256, COrphanTx>::iterator, IteratorComparator>> mapOrphanTransactionsByPrev GUARDED_BY(g_cs_orphans);
+// Entries of an unordered_map keep their address across rehashing, so the
+// indexes below refer to orphans by pointer.
+std::unordered_map<uint256, COrphanTx, SaltedTxidHasher> mapOrphanTransactions GUARDED_BY(g_cs_orphans);
+std::unordered_map<COutPoint, std::set<COrphanTx*>, SaltedOutpointHasher> mapOrphanTransactionsByPrev GUARDED_BY(g_cs_orphans);
+/** All orphans in no particular order, so that one can be picked for eviction in constant time */
+static std::vector<COrphanTx*> g_orphan_list GUARDED_BY(g_cs_orphans);
+/** Memory used by the orphans themselves, in bytes */
+static size_t g_orphan_usage GUARDED_BY(g_cs_orphans) = 0;
 void EraseOrphansFor(NodeId peer);
 
 static size_t vExtraTxnForCompactIt GUARDED_BY(g_cs_orphans) = 0;
 static std::vector<std::pair<uint256, CTransactionRef>> vExtraTxnForCompact GUARDED_BY(g_cs_orphans);
 
+/** Transactions recently rejected for their fee alone, which a child may still pay for */
+static std::map<uint256, CTransactionRef> mapLowFeeTxs GUARDED_BY(g_cs_orphans);
+/** Hashes of mapLowFeeTxs in the order they were added, for eviction; may hold erased ones */
+static std::deque<uint256> g_low_fee_order GUARDED_BY(g_cs_orphans);
+
 static const uint64_t RANDOMIZER_ID_ADDRESS_RELAY = 0x3cac0035b5866b90ULL; // SHA256("main address relay")[0:8]
 
 /// Age after which a stale block will no longer be served if requested as
@@ -71,6 +86,13 @@ static const int STALE_RELAY_AGE_LIMIT = 30 * 24 * 60 * 60;
 /// limiting block relay. Set to one week, denominated in seconds.
 static const int HISTORICAL_BLOCK_AGE = 7 * 24 * 60 * 60;
 
+/** Maximum number of blocks a single getcfilters request may cover (BIP 157) */
+static const uint32_t MAX_GETCFILTERS_SIZE = 100;
+/** Maximum number of blocks a single getcfheaders request may cover (BIP 157) */
+static const uint32_t MAX_GETCFHEADERS_SIZE = 2000;
+/** Interval between the filter headers of a cfcheckpt response (BIP 157) */
+static const int CFCHECKPT_INTERVAL = 1000;
+
 // Internal stuff
 namespace {
     /** Number of nodes with fSyncStarted. */
@@ -114,9 +136,13 @@ namespace {
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
+        int64_t nTimeRequested;                                  //!< When the block was requested (in microseconds).
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
+    /** Transactions announced by peers, and the peer each is requested from. Protected by cs_main. */
+    TxRequestTracker g_txrequest GUARDED_BY(cs_main);
+
     /** Stack of nodes which we have set to announce using compact blocks */
     std::list<NodeId> lNodesAnnouncingHeaderAndIDs;
 
@@ -132,13 +158,105 @@ namespace {
     /** When our tip was last updated. */
     std::atomic<int64_t> g_last_tip_update(0);
 
-    /** Relay map, protected by cs_main. */
+    /** Guards the relay map, so answering getdata for transactions does not need cs_main. */
+    CCriticalSection g_cs_relay;
+    /** Relay map, protected by g_cs_relay. */
     typedef std::map<uint256, CTransactionRef> MapRelay;
-    MapRelay mapRelay;
-    /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
-    std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
+    MapRelay mapRelay GUARDED_BY(g_cs_relay);
+    /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by g_cs_relay. */
+    std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration GUARDED_BY(g_cs_relay);
+
+    /**
+     * Transactions waiting to be announced, ranked once for all peers in the
+     * order they are announced in: fewest in-mempool ancestors first, then
+     * highest fee. Peers sort their trickle candidates by these ranks instead
+     * of comparing them against the mempool each time. Protected by g_cs_inv_batch.
+     */
+    struct InvBatchEntry {
+        uint64_t nRank;
+        TxMempoolInfo info;
+    };
+    CCriticalSection g_cs_inv_batch;
+    std::map<uint256, InvBatchEntry> mapInvBatch GUARDED_BY(g_cs_inv_batch);
+    /** Time-ordered list of (expire time, batch entry) pairs, protected by g_cs_inv_batch. */
+    std::deque<std::pair<int64_t, std::map<uint256, InvBatchEntry>::iterator>> vInvBatchExpiration GUARDED_BY(g_cs_inv_batch);
+    uint64_t nInvBatchNextRank GUARDED_BY(g_cs_inv_batch) = 0;
+
+    /**
+     * Locator last built for an outgoing getheaders, and the block it was
+     * built from. A locator only depends on the ancestors of its block, so
+     * it can be reused for as long as getheaders start from the same block.
+     * Protected by cs_main.
+     */
+    const CBlockIndex* pindexLocatorCached GUARDED_BY(cs_main) = nullptr;
+    CBlockLocator locatorCached GUARDED_BY(cs_main);
+
+    /**
+     * Fork points of the locators peers sent recently with getheaders and
+     * getblocks, most recently used first; a syncing peer sends the same
+     * locator until it has our answer, and so do peers at the same tip.
+     * Fork points depend on the active chain and on the blocks we know, so
+     * the entries are dropped when the tip changes or a block index entry is
+     * added. Protected by cs_main.
+     */
+    std::list<std::pair<CBlockLocator, const CBlockIndex*>> listForkPointCache GUARDED_BY(cs_main);
+    const CBlockIndex* pindexForkPointCacheTip GUARDED_BY(cs_main) = nullptr;
+    uint256 hashForkPointCacheTip GUARDED_BY(cs_main);
+    size_t nForkPointCacheBlockIndexSize GUARDED_BY(cs_main) = 0;
 } // namespace
 
+/** Number of fork points of peers' locators kept in listForkPointCache */
+static const size_t FORK_POINT_CACHE_SIZE = 16;
+
+static CMetricCounter* const metricLocatorCacheHits = RegisterMetricCounter("bitcoin_locator_cache_hits_total", "Locators and fork points of locators found in the headers sync caches", "cache=\"locator\"");
+static CMetricCounter* const metricLocatorCacheMisses = RegisterMetricCounter("bitcoin_locator_cache_misses_total", "Locators and fork points of locators computed for the headers sync", "cache=\"locator\"");
+static CMetricCounter* const metricForkPointCacheHits = RegisterMetricCounter("bitcoin_locator_cache_hits_total", "Locators and fork points of locators found in the headers sync caches", "cache=\"fork_point\"");
+static CMetricCounter* const metricForkPointCacheMisses = RegisterMetricCounter("bitcoin_locator_cache_misses_total", "Locators and fork points of locators computed for the headers sync", "cache=\"fork_point\"");
+
+/** chainActive.GetLocator(pindex), reusing the locator last built if it was for the same block */
+static const CBlockLocator& GetCachedLocator(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    // The hash guards against a block index entry reused after the index was unloaded
+    if (pindex && pindex == pindexLocatorCached && !locatorCached.IsNull() && locatorCached.vHave.front() == pindex->GetBlockHash()) {
+        metricLocatorCacheHits->Add();
+        return locatorCached;
+    }
+    metricLocatorCacheMisses->Add();
+    locatorCached = chainActive.GetLocator(pindex);
+    pindexLocatorCached = pindex;
+    return locatorCached;
+}
+
+/** FindForkInGlobalIndex(chainActive, locator), remembered for the locators seen last */
+static const CBlockIndex* FindForkCached(const CBlockLocator& locator)
+{
+    AssertLockHeld(cs_main);
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    const uint256 hashTip = pindexTip ? pindexTip->GetBlockHash() : uint256();
+    if (pindexTip != pindexForkPointCacheTip || hashTip != hashForkPointCacheTip || mapBlockIndex.size() != nForkPointCacheBlockIndexSize) {
+        listForkPointCache.clear();
+        pindexForkPointCacheTip = pindexTip;
+        hashForkPointCacheTip = hashTip;
+        nForkPointCacheBlockIndexSize = mapBlockIndex.size();
+    }
+
+    for (auto it = listForkPointCache.begin(); it != listForkPointCache.end(); ++it) {
+        if (it->first.vHave == locator.vHave) {
+            metricForkPointCacheHits->Add();
+            listForkPointCache.splice(listForkPointCache.begin(), listForkPointCache, it);
+            return it->second;
+        }
+    }
+
+    metricForkPointCacheMisses->Add();
+    const CBlockIndex* pindex = FindForkInGlobalIndex(chainActive, locator);
+    listForkPointCache.emplace_front(locator, pindex);
+    if (listForkPointCache.size() > FORK_POINT_CACHE_SIZE)
+        listForkPointCache.pop_back();
+    return pindex;
+}
+
 namespace {
 
 struct CBlockReject {
@@ -188,6 +306,13 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Moving average of the time the peer takes to deliver a requested block once it
+    //! could start on it (in microseconds), or 0 before the first block.
+    int64_t nBlockServiceTime;
+    //! Moving average of the block download rate from this peer (in bytes per second).
+    int64_t nBlockDownloadRate;
+    //! When the peer last delivered a block we requested from it (in microseconds).
+    int64_t nLastBlockDelivery;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -240,6 +365,25 @@ struct CNodeState {
     //! Time of last new block announcement
     int64_t m_last_block_announcement;
 
+    //! Whether this peer wants "cmpheaders" instead of "headers" messages.
+    bool fWantsCompressedHeaders;
+
+    //! Salt we sent in "sendrecon", 0 if we did not offer set reconciliation
+    uint64_t m_recon_local_salt;
+    //! Whether transactions are announced by set reconciliation with this peer
+    bool m_recon;
+    //! Short id keys derived from both salts
+    uint64_t m_recon_k0;
+    uint64_t m_recon_k1;
+    //! When we start the next round, if we opened the connection
+    int64_t m_next_recon_request;
+    //! Whether we sent "reqrecon" and are waiting for the sketch
+    bool m_recon_requested;
+    //! Whether we sent a sketch and are waiting for "reconcildiff"
+    bool m_recon_sketch_sent;
+    //! Our reconciliation set for the round in progress, by short id
+    std::map<uint32_t, uint256> m_recon_snapshot;
+
     CNodeState(CAddress addrIn, std::string addrNameIn) : address(addrIn), name(addrNameIn) {
         fCurrentlyConnected = false;
         nMisbehavior = 0;
@@ -255,6 +399,9 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nBlockServiceTime = 0;
+        nBlockDownloadRate = 0;
+        nLastBlockDelivery = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
@@ -262,8 +409,16 @@ struct CNodeState {
         fHaveWitness = false;
         fWantsCmpctWitness = false;
         fSupportsDesiredCmpctVersion = false;
+        fWantsCompressedHeaders = false;
         m_chain_sync = { 0, nullptr, false, false };
         m_last_block_announcement = 0;
+        m_recon_local_salt = 0;
+        m_recon = false;
+        m_recon_k0 = 0;
+        m_recon_k1 = 0;
+        m_next_recon_request = 0;
+        m_recon_requested = false;
+        m_recon_sketch_sent = false;
     }
 };
 
@@ -355,7 +510,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex*
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != nullptr, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr)});
+            {hash, pindex, pindex != nullptr, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr), GetTimeMicros()});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -371,6 +526,39 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex*
     return true;
 }
 
+// Requires cs_main.
+// Update the download speed of a peer that delivered a block we requested from it.
+void UpdateBlockDownloadRate(NodeId nodeid, const uint256& hash, size_t nBlockSize) {
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    CNodeState *state = State(nodeid);
+    assert(state != nullptr);
+    // Blocks are sent one after the other, so a block only starts downloading
+    // once it was requested and the one before it was delivered.
+    int64_t nNow = GetTimeMicros();
+    int64_t nServiceTime = std::max<int64_t>(1, nNow - std::max(itInFlight->second.second->nTimeRequested, state->nLastBlockDelivery));
+    int64_t nRate = (int64_t)nBlockSize * 1000000 / nServiceTime;
+    if (state->nBlockServiceTime == 0) {
+        state->nBlockServiceTime = nServiceTime;
+        state->nBlockDownloadRate = nRate;
+    } else {
+        state->nBlockServiceTime = (state->nBlockServiceTime * 7 + nServiceTime) / 8;
+        state->nBlockDownloadRate = (state->nBlockDownloadRate * 7 + nRate) / 8;
+    }
+    state->nLastBlockDelivery = nNow;
+}
+
+// Requires cs_main.
+// Number of blocks to keep requested from a peer: during initial block download,
+// enough to keep a measured peer busy for BLOCK_DOWNLOAD_QUEUE_TIME seconds.
+int GetBlocksInFlightLimit(const CNodeState* state) {
+    if (state->nBlockServiceTime == 0 || !IsInitialBlockDownload())
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    int64_t nLimit = BLOCK_DOWNLOAD_QUEUE_TIME * 1000000LL / state->nBlockServiceTime;
+    return std::max<int64_t>(MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, nLimit));
+}
+
 /** Check whether the last unknown block a peer advertised is not yet known. */
 void ProcessBlockAvailability(NodeId nodeid) {
     CNodeState *state = State(nodeid);
@@ -421,9 +609,12 @@ void MaybeSetPeerAsAnnouncingHeaderAndIDs(NodeId nodeid, CConnman* connman) {
         }
         connman->ForNode(nodeid, [connman](CNode* pfrom){
             uint64_t nCMPCTBLOCKVersion = (pfrom->GetLocalServices() & NODE_WITNESS) ? 2 : 1;
-            if (lNodesAnnouncingHeaderAndIDs.size() >= 3) {
-                // As per BIP152, we only get 3 of our peers to announce
-                // blocks using compact encodings.
+            // As per BIP152, by default we only get 3 of our peers to announce
+            // blocks using compact encodings.
+            size_t nMaxHBPeers = std::max<int64_t>(0, gArgs.GetArg("-maxhbcmpctpeers", DEFAULT_MAX_HB_CMPCT_PEERS));
+            if (nMaxHBPeers == 0)
+                return true;
+            if (lNodesAnnouncingHeaderAndIDs.size() >= nMaxHBPeers) {
                 connman->ForNode(lNodesAnnouncingHeaderAndIDs.front(), [connman, nCMPCTBLOCKVersion](CNode* pnodeStop){
                     connman->PushMessage(pnodeStop, CNetMsgMaker(pnodeStop->GetSendVersion()).Make(NetMsgType::SENDCMPCT, /*fAnnounceUsingCMPCTBLOCK=*/false, nCMPCTBLOCKVersion));
                     return true;
@@ -464,8 +655,9 @@ bool PeerHasHeader(CNodeState *state, const CBlockIndex *pindex)
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const Consensus::Params& consensusParams) {
+ *  at most count entries. If the download window is full, nodeStaller is set to the peer holding
+ *  up its first in-flight block, pindexStalling. */
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const CBlockIndex*& pindexStalling, const Consensus::Params& consensusParams) {
     if (count == 0)
         return;
 
@@ -501,6 +693,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    const CBlockIndex* pindexWaitingFor = nullptr;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -536,6 +729,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        pindexStalling = pindexWaitingFor;
                     }
                     return;
                 }
@@ -546,6 +740,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
@@ -569,6 +764,32 @@ bool IsOutboundDisconnectionCandidate(const CNode *node)
     return !(node->fInbound || node->m_manual_connection || node->fFeeler || node->fOneShot);
 }
 
+/**
+ * Snapshots of each peer's CNodeState, published by the message handler while
+ * it holds cs_main anyway so that reporting them never waits for cs_main.
+ */
+static CCriticalSection cs_node_state_stats;
+static std::map<NodeId, CNodeStateStats> mapNodeStateStats GUARDED_BY(cs_node_state_stats);
+
+static void PublishNodeStateStats(NodeId nodeid, const CNodeState* state) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    CNodeStateStats stats;
+    stats.nMisbehavior = state->nMisbehavior;
+    stats.nSyncHeight = state->pindexBestKnownBlock ? state->pindexBestKnownBlock->nHeight : -1;
+    stats.nCommonHeight = state->pindexLastCommonBlock ? state->pindexLastCommonBlock->nHeight : -1;
+    stats.nBlockServiceTime = state->nBlockServiceTime;
+    stats.nBlockDownloadRate = state->nBlockDownloadRate;
+    stats.nBlocksInFlightLimit = GetBlocksInFlightLimit(state);
+    for (const QueuedBlock& queue : state->vBlocksInFlight) {
+        if (queue.pindex)
+            stats.vHeightInFlight.push_back(queue.pindex->nHeight);
+    }
+    stats.nMemoryUsage = memusage::MallocUsage(sizeof(CNodeState)) + memusage::DynamicUsage(state->rejects) +
+                         memusage::DynamicUsage(state->vBlocksInFlight) + memusage::DynamicUsage(state->m_recon_snapshot);
+    LOCK(cs_node_state_stats);
+    mapNodeStateStats[nodeid] = std::move(stats);
+}
+
 void PeerLogicValidation::InitializeNode(CNode *pnode) {
     CAddress addr = pnode->addr;
     std::string addrName = pnode->GetAddrName();
@@ -576,6 +797,7 @@ void PeerLogicValidation::InitializeNode(CNode *pnode) {
     {
         LOCK(cs_main);
         mapNodeState.emplace_hint(mapNodeState.end(), std::piecewise_construct, std::forward_as_tuple(nodeid), std::forward_as_tuple(addr, std::move(addrName)));
+        PublishNodeStateStats(nodeid, State(nodeid));
     }
     if(!pnode->fInbound)
         PushNodeVersion(pnode, connman, GetTime());
@@ -598,6 +820,7 @@ void PeerLogicValidation::FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTim
         mapBlocksInFlight.erase(entry.hash);
     }
     EraseOrphansFor(nodeid);
+    g_txrequest.DisconnectedPeer(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
     nPeersWithValidatedDownloads -= (state->nBlocksInFlightValidHeaders != 0);
     assert(nPeersWithValidatedDownloads >= 0);
@@ -605,6 +828,10 @@ void PeerLogicValidation::FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTim
     assert(g_outbound_peers_with_protect_from_disconnect >= 0);
 
     mapNodeState.erase(nodeid);
+    {
+        LOCK(cs_node_state_stats);
+        mapNodeStateStats.erase(nodeid);
+    }
 
     if (mapNodeState.empty()) {
         // Do a consistency check after the last peer is removed.
@@ -612,22 +839,17 @@ void PeerLogicValidation::FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTim
         assert(nPreferredDownload == 0);
         assert(nPeersWithValidatedDownloads == 0);
         assert(g_outbound_peers_with_protect_from_disconnect == 0);
+        assert(g_txrequest.Size() == 0);
     }
     LogPrint(BCLog::NET, "Cleared nodestate for peer=%d\n", nodeid);
 }
 
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
-    LOCK(cs_main);
-    CNodeState *state = State(nodeid);
-    if (state == nullptr)
+    LOCK(cs_node_state_stats);
+    auto it = mapNodeStateStats.find(nodeid);
+    if (it == mapNodeStateStats.end())
         return false;
-    stats.nMisbehavior = state->nMisbehavior;
-    stats.nSyncHeight = state->pindexBestKnownBlock ? state->pindexBestKnownBlock->nHeight : -1;
-    stats.nCommonHeight = state->pindexLastCommonBlock ? state->pindexLastCommonBlock->nHeight : -1;
-    for (const QueuedBlock& queue : state->vBlocksInFlight) {
-        if (queue.pindex)
-            stats.vHeightInFlight.push_back(queue.pindex->nHeight);
-    }
+    stats = it->second;
     return true;
 }
 
@@ -667,33 +889,49 @@ bool AddOrphanTx(const CTransactionRef& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRE
         return false;
     }
 
-    auto ret = mapOrphanTransactions.emplace(hash, COrphanTx{tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME});
+    auto ret = mapOrphanTransactions.emplace(hash, COrphanTx{tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME, g_orphan_list.size(), RecursiveDynamicUsage(tx)});
     assert(ret.second);
+    COrphanTx* orphan = &ret.first->second;
+    g_orphan_list.push_back(orphan);
+    g_orphan_usage += orphan->nUsage;
     for (const CTxIn& txin : tx->vin) {
-        mapOrphanTransactionsByPrev[txin.prevout].insert(ret.first);
+        mapOrphanTransactionsByPrev[txin.prevout].insert(orphan);
     }
 
     AddToCompactExtraTransactions(tx);
 
-    LogPrint(BCLog::MEMPOOL, "stored orphan tx %s (mapsz %u outsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
+    LogPrint(BCLog::MEMPOOL, "stored orphan tx %s (mapsz %u outsz %u usage %u)\n", hash.ToString(),
+             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size(), g_orphan_usage);
     return true;
 }
 
 int static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(g_cs_orphans)
 {
-    std::map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
+    auto it = mapOrphanTransactions.find(hash);
     if (it == mapOrphanTransactions.end())
         return 0;
-    for (const CTxIn& txin : it->second.tx->vin)
+    COrphanTx* orphan = &it->second;
+    for (const CTxIn& txin : orphan->tx->vin)
     {
         auto itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
         if (itPrev == mapOrphanTransactionsByPrev.end())
             continue;
-        itPrev->second.erase(it);
+        itPrev->second.erase(orphan);
         if (itPrev->second.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+
+    // Move the last orphan of the list into the freed slot
+    size_t old_pos = orphan->list_pos;
+    assert(g_orphan_list[old_pos] == orphan);
+    if (old_pos + 1 != g_orphan_list.size()) {
+        COrphanTx* last = g_orphan_list.back();
+        g_orphan_list[old_pos] = last;
+        last->list_pos = old_pos;
+    }
+    g_orphan_list.pop_back();
+    g_orphan_usage -= orphan->nUsage;
+
     mapOrphanTransactions.erase(it);
     return 1;
 }
@@ -702,10 +940,10 @@ void EraseOrphansFor(NodeId peer)
 {
     LOCK(g_cs_orphans);
     int nErased = 0;
-    std::map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
+    auto iter = mapOrphanTransactions.begin();
     while (iter != mapOrphanTransactions.end())
     {
-        std::map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
+        auto maybeErase = iter++; // increment to avoid iterator becoming invalid
         if (maybeErase->second.fromPeer == peer)
         {
             nErased += EraseOrphanTx(maybeErase->second.tx->GetHash());
@@ -715,7 +953,7 @@ void EraseOrphansFor(NodeId peer)
 }
 
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxOrphanUsage)
 {
     LOCK(g_cs_orphans);
 
@@ -726,10 +964,10 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
         // Sweep out expired orphan pool entries:
         int nErased = 0;
         int64_t nMinExpTime = nNow + ORPHAN_TX_EXPIRE_TIME - ORPHAN_TX_EXPIRE_INTERVAL;
-        std::map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
+        auto iter = mapOrphanTransactions.begin();
         while (iter != mapOrphanTransactions.end())
         {
-            std::map<uint256, COrphanTx>::iterator maybeErase = iter++;
+            auto maybeErase = iter++;
             if (maybeErase->second.nTimeExpire <= nNow) {
                 nErased += EraseOrphanTx(maybeErase->second.tx->GetHash());
             } else {
@@ -740,14 +978,11 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
         nNextSweep = nMinExpTime + ORPHAN_TX_EXPIRE_INTERVAL;
         if (nErased > 0) LogPrint(BCLog::MEMPOOL, "Erased %d orphan tx due to expiration\n", nErased);
     }
-    while (mapOrphanTransactions.size() > nMaxOrphans)
+    while (!g_orphan_list.empty() && (g_orphan_list.size() > nMaxOrphans || g_orphan_usage > nMaxOrphanUsage))
     {
         // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        std::map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
+        size_t randompos = GetRand(g_orphan_list.size());
+        EraseOrphanTx(g_orphan_list[randompos]->tx->GetHash());
         ++nEvicted;
     }
     return nEvicted;
@@ -798,6 +1033,97 @@ static bool BlockRequestAllowed(const CBlockIndex* pindex, const Consensus::Para
         (GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, consensusParams) < STALE_RELAY_AGE_LIMIT);
 }
 
+/**
+ * The merkleblock of the latest tip for a bloom filtered peer, matched when
+ * the block was connected. It is only valid while the peer's filter is the
+ * one it was matched against, which hashFilter identifies.
+ */
+struct PrematchedMerkleBlock {
+    uint256 hashBlock;
+    uint256 hashFilter;
+    CMerkleBlock merkleBlock;
+    CBloomFilter filterUpdated; //!< the filter after matching, which may have had outpoints added
+};
+
+static CCriticalSection cs_prematched;
+static std::map<NodeId, PrematchedMerkleBlock> mapPrematched GUARDED_BY(cs_prematched);
+static std::atomic<uint64_t> nFilteredBlocksServed{0};
+static std::atomic<uint64_t> nFilteredBlocksPrematched{0};
+static std::atomic<uint64_t> nFilteredBlocksStale{0};
+static std::atomic<uint64_t> nFilteredTxSent{0};
+static std::atomic<uint64_t> nFilterMatchMicros{0};
+
+/**
+ * Match all bloom filtered peers against a newly connected block in one pass,
+ * spread over several threads, so their requests for it are answered without
+ * matching then.
+ */
+static void PrematchFilteredPeers(CConnman* connman, const CBlock& block)
+{
+    std::vector<NodeId> vNodes;
+    std::vector<CBloomFilter> vFilters;
+    connman->ForEachNode([&](CNode* pnode) {
+        LOCK(pnode->cs_filter);
+        if (pnode->pfilter) {
+            vNodes.push_back(pnode->GetId());
+            vFilters.push_back(*pnode->pfilter);
+        }
+    });
+
+    const uint256 hashBlock = block.GetHash();
+    std::vector<PrematchedMerkleBlock> vMatched(vNodes.size());
+    const int64_t nTimeStart = GetTimeMicros();
+    std::atomic<size_t> nNext(0);
+    auto worker = [&]() {
+        for (size_t i = nNext++; i < vNodes.size(); i = nNext++) {
+            PrematchedMerkleBlock& matched = vMatched[i];
+            matched.hashBlock = hashBlock;
+            matched.hashFilter = SerializeHash(vFilters[i]);
+            matched.merkleBlock = CMerkleBlock(block, vFilters[i]);
+            matched.filterUpdated = std::move(vFilters[i]);
+        }
+    };
+    unsigned int nThreads = std::min<unsigned int>(std::max(GetNumCores(), 1), MAX_PREMATCH_THREADS);
+    nThreads = std::min<size_t>(nThreads, vNodes.size());
+    ParallelRun(g_task_pool, TASK_PRIORITY_HIGH, nThreads, worker);
+    nFilterMatchMicros += GetTimeMicros() - nTimeStart;
+
+    LOCK(cs_prematched);
+    mapPrematched.clear();
+    for (size_t i = 0; i < vNodes.size(); i++)
+        mapPrematched.emplace(vNodes[i], std::move(vMatched[i]));
+    LogPrint(BCLog::NET, "Prematched block %s against %u filtered peers in %.2fms\n", hashBlock.ToString(), vNodes.size(), (GetTimeMicros() - nTimeStart) * 0.001);
+}
+
+/** Take a prematched merkleblock for a peer, and bring its filter up to date as matching would have */
+static bool TakePrematchedMerkleBlock(NodeId nodeid, const uint256& hashBlock, CBloomFilter& filter, CMerkleBlock& merkleBlock)
+{
+    LOCK(cs_prematched);
+    auto it = mapPrematched.find(nodeid);
+    if (it == mapPrematched.end() || it->second.hashBlock != hashBlock)
+        return false;
+    if (it->second.hashFilter != SerializeHash(filter)) {
+        nFilteredBlocksStale++;
+        mapPrematched.erase(it);
+        return false;
+    }
+    merkleBlock = std::move(it->second.merkleBlock);
+    filter = std::move(it->second.filterUpdated);
+    mapPrematched.erase(it);
+    return true;
+}
+
+FilteredBlockStats GetFilteredBlockStats()
+{
+    FilteredBlockStats stats;
+    stats.nServed = nFilteredBlocksServed;
+    stats.nPrematched = nFilteredBlocksPrematched;
+    stats.nStale = nFilteredBlocksStale;
+    stats.nTxSent = nFilteredTxSent;
+    stats.nMatchMicros = nFilterMatchMicros;
+    return stats;
+}
+
 PeerLogicValidation::PeerLogicValidation(CConnman* connmanIn, CScheduler &scheduler) : connman(connmanIn), m_stale_tip_check_time(0) {
     // Initialize global variables that cannot be constructed at startup.
     recentRejects.reset(new CRollingBloomFilter(120000, 0.000001));
@@ -812,6 +1138,10 @@ PeerLogicValidation::PeerLogicValidation(CConnman* connmanIn, CScheduler &schedu
 }
 
 void PeerLogicValidation::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex, const std::vector<CTransactionRef>& vtxConflicted) {
+    if (gArgs.GetBoolArg("-peerbloomprematch", DEFAULT_PEERBLOOMPREMATCH) && !IsInitialBlockDownload()) {
+        PrematchFilteredPeers(connman, *pblock);
+    }
+
     LOCK(g_cs_orphans);
 
     std::vector<uint256> vOrphanErase;
@@ -823,10 +1153,8 @@ void PeerLogicValidation::BlockConnected(const std::shared_ptr<const CBlock>& pb
         for (const auto& txin : tx.vin) {
             auto itByPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
             if (itByPrev == mapOrphanTransactionsByPrev.end()) continue;
-            for (auto mi = itByPrev->second.begin(); mi != itByPrev->second.end(); ++mi) {
-                const CTransaction& orphanTx = *(*mi)->second.tx;
-                const uint256& orphanHash = orphanTx.GetHash();
-                vOrphanErase.push_back(orphanHash);
+            for (const COrphanTx* orphan : itByPrev->second) {
+                vOrphanErase.push_back(orphan->tx->GetHash());
             }
         }
     }
@@ -843,16 +1171,141 @@ void PeerLogicValidation::BlockConnected(const std::shared_ptr<const CBlock>& pb
     g_last_tip_update = GetTime();
 }
 
+/** Transactions that entered our mempool less than this many seconds before a block may not have reached all peers */
+static const int64_t CMPCT_PREFILL_RECENT_TX_AGE = 30;
+/** Most transaction bytes prefilled in an outgoing compact block, besides the coinbase */
+static const size_t MAX_CMPCT_PREFILL_BYTES = 20000;
+
+/** Which transactions of a block to send along with its compact form */
+struct CmpctBlockPrefill {
+    //! Transactions we didn't have in our mempool, so peers are unlikely to have them either
+    std::vector<bool> vShared;
+    size_t nSharedBytes;
+    //! Transactions we received shortly before the block, to prefill for peers we haven't exchanged them with
+    std::vector<size_t> vRecent;
+};
+
+static std::shared_ptr<const CmpctBlockPrefill> PredictCmpctBlockPrefill(const CBlock& block)
+{
+    std::shared_ptr<CmpctBlockPrefill> prefill = std::make_shared<CmpctBlockPrefill>();
+    prefill->vShared.resize(block.vtx.size());
+    prefill->nSharedBytes = 0;
+    const int64_t nRecentTime = GetTime() - CMPCT_PREFILL_RECENT_TX_AGE;
+    LOCK(mempool.cs);
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        CTxMemPool::txiter it = mempool.mapTx.find(tx.GetHash());
+        if (it == mempool.mapTx.end()) {
+            size_t nSize = tx.GetTotalSize();
+            if (prefill->nSharedBytes + nSize <= MAX_CMPCT_PREFILL_BYTES) {
+                prefill->vShared[i] = true;
+                prefill->nSharedBytes += nSize;
+            }
+        } else if (it->GetTime() > nRecentTime) {
+            prefill->vRecent.push_back(i);
+        }
+    }
+    return prefill;
+}
+
+/**
+ * Transactions to prefill in a compact block for pnode: the shared prefill,
+ * plus recent transactions the peer neither announced to us nor was
+ * announced by us. Returns false if that is just the shared prefill.
+ */
+static bool GetPeerCmpctBlockPrefill(CNode* pnode, const CBlock& block, const CmpctBlockPrefill& prefill, std::vector<bool>& vPrefill)
+{
+    vPrefill = prefill.vShared;
+    size_t nBytes = prefill.nSharedBytes;
+    bool fExtra = false;
+    LOCK(pnode->cs_inventory);
+    for (size_t i : prefill.vRecent) {
+        const CTransaction& tx = *block.vtx[i];
+        if (pnode->filterInventoryKnown.contains(tx.GetHash()))
+            continue;
+        size_t nSize = tx.GetTotalSize();
+        if (nBytes + nSize > MAX_CMPCT_PREFILL_BYTES)
+            continue;
+        vPrefill[i] = true;
+        nBytes += nSize;
+        fExtra = true;
+    }
+    return fExtra;
+}
+
 // All of the following cache a recent block, and are protected by cs_most_recent_block
 static CCriticalSection cs_most_recent_block;
 static std::shared_ptr<const CBlock> most_recent_block;
 static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block;
+// most_recent_compact_block serialized once for all peers
+static std::shared_ptr<const CSharedNetPayload> most_recent_compact_block_payload;
 static uint256 most_recent_block_hash;
 static bool fWitnessesPresentInMostRecentCompactBlock;
+static std::shared_ptr<const CmpctBlockPrefill> most_recent_block_prefill;
+
+/**
+ * A block close to the tip, kept in memory together with the messages serving
+ * it, so a burst of peers fetching it is answered without disk reads or
+ * serialization. Payloads are filled in as they are first asked for.
+ */
+struct RecentBlockEntry {
+    std::shared_ptr<const CBlock> block;
+    std::shared_ptr<const CSharedNetPayload> payload;            //!< block with witness
+    std::shared_ptr<const CSharedNetPayload> payload_no_witness; //!< block without witness
+    std::shared_ptr<const CSharedNetPayload> payload_compact;    //!< witness compact block
+};
+
+static CCriticalSection cs_recent_blocks;
+static std::map<uint256, RecentBlockEntry> mapRecentBlocks GUARDED_BY(cs_recent_blocks);
+static std::deque<uint256> vRecentBlocksOrder GUARDED_BY(cs_recent_blocks);
+static std::atomic<uint64_t> nRecentBlockHits{0};
+static std::atomic<uint64_t> nRecentBlockMisses{0};
+
+static bool GetRecentBlock(const uint256& hash, RecentBlockEntry& entry)
+{
+    LOCK(cs_recent_blocks);
+    auto it = mapRecentBlocks.find(hash);
+    if (it == mapRecentBlocks.end())
+        return false;
+    entry = it->second;
+    return true;
+}
+
+/** Add a block to the cache, or fill in the payloads a cached one is missing */
+static void CacheRecentBlock(const uint256& hash, const RecentBlockEntry& entry)
+{
+    LOCK(cs_recent_blocks);
+    auto ret = mapRecentBlocks.emplace(hash, entry);
+    if (!ret.second) {
+        RecentBlockEntry& cached = ret.first->second;
+        if (!cached.payload) cached.payload = entry.payload;
+        if (!cached.payload_no_witness) cached.payload_no_witness = entry.payload_no_witness;
+        if (!cached.payload_compact) cached.payload_compact = entry.payload_compact;
+        return;
+    }
+    vRecentBlocksOrder.push_back(hash);
+    while (vRecentBlocksOrder.size() > RECENT_BLOCK_CACHE_SIZE) {
+        mapRecentBlocks.erase(vRecentBlocksOrder.front());
+        vRecentBlocksOrder.pop_front();
+    }
+}
+
+void GetRecentBlockCacheStats(size_t& nBlocks, uint64_t& nHits, uint64_t& nMisses)
+{
+    {
+        LOCK(cs_recent_blocks);
+        nBlocks = mapRecentBlocks.size();
+    }
+    nHits = nRecentBlockHits;
+    nMisses = nRecentBlockMisses;
+}
 
 void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) {
-    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock, true);
+    std::shared_ptr<const CmpctBlockPrefill> prefill = PredictCmpctBlockPrefill(*pblock);
+    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock, true, prefill->vShared);
     const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    std::shared_ptr<const CSharedNetPayload> pcmpctblock_payload = msgMaker.MakePayload(0, *pcmpctblock);
+    UDPRelayBlock(pindex->GetBlockHash(), pcmpctblock_payload->data);
 
     LOCK(cs_main);
 
@@ -869,11 +1322,15 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         most_recent_block_hash = hashBlock;
         most_recent_block = pblock;
         most_recent_compact_block = pcmpctblock;
+        most_recent_compact_block_payload = pcmpctblock_payload;
         fWitnessesPresentInMostRecentCompactBlock = fWitnessEnabled;
+        most_recent_block_prefill = prefill;
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
-        // TODO: Avoid the repeated-serialization here
+    // Pick the peers first, so the announcement then goes out to all of them
+    // back to back.
+    std::vector<CNode*> vAnnounceTo;
+    connman->ForEachNode([pindex, fWitnessEnabled, &vAnnounceTo](CNode* pnode) {
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -882,13 +1339,28 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         // but we don't think they have this one, go ahead and announce it
         if (state.fPreferHeaderAndIDs && (!fWitnessEnabled || state.fWantsCmpctWitness) &&
                 !PeerHasHeader(&state, pindex) && PeerHasHeader(&state, pindex->pprev)) {
-
-            LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
-                    hashBlock.ToString(), pnode->GetId());
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
             state.pindexBestHeaderSent = pindex;
+            pnode->AddRef();
+            vAnnounceTo.push_back(pnode);
         }
     });
+    for (CNode* pnode : vAnnounceTo) {
+        // Peers likely to miss transactions we only just received get a
+        // compact block of their own that carries them.
+        std::vector<bool> vPrefill;
+        if (GetPeerCmpctBlockPrefill(pnode, *pblock, *prefill, vPrefill))
+            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, CBlockHeaderAndShortTxIDs(*pblock, true, vPrefill)));
+        else
+            connman->PushMessage(pnode, msgMaker.MakeShared(NetMsgType::CMPCTBLOCK, pcmpctblock_payload));
+        pnode->nCmpctBlocksSent++;
+        LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
+                hashBlock.ToString(), pnode->GetId());
+        pnode->Release();
+    }
+
+    // Only now serialize the full block, for the peers that will fetch it
+    std::shared_ptr<const CSharedNetPayload> pblock_payload = msgMaker.MakePayload(0, *pblock);
+    CacheRecentBlock(hashBlock, RecentBlockEntry{pblock, pblock_payload, nullptr, pcmpctblock_payload});
 }
 
 void PeerLogicValidation::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) {
@@ -981,7 +1453,7 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 
             {
                 LOCK(g_cs_orphans);
-                if (mapOrphanTransactions.count(inv.hash)) return true;
+                if (mapOrphanTransactions.count(inv.hash) || mapLowFeeTxs.count(inv.hash)) return true;
             }
 
             return recentRejects->contains(inv.hash) ||
@@ -997,6 +1469,18 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
     return true;
 }
 
+/** Track the announcement of a transaction by a peer, to request it from the peer if no better one has it */
+static void AddTxAnnouncement(const CNode* pnode, const CInv& inv, int64_t nNow) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    // Outbound and whitelisted peers are asked first; inbound peers are
+    // cheap to make, so they only get the transaction if those do not
+    // answer, or did not announce it soon enough.
+    const bool fPreferred = !pnode->fInbound || pnode->fWhitelisted;
+    const int64_t nReqTime = fPreferred ? nNow : nNow + TX_REQUEST_NONPREFERRED_DELAY;
+    if (g_txrequest.ReceivedInv(pnode->GetId(), inv, fPreferred, nReqTime))
+        LogPrint(BCLog::NET, "askfor %s peer=%d\n", inv.ToString(), pnode->GetId());
+}
+
 static void RelayTransaction(const CTransaction& tx, CConnman* connman)
 {
     CInv inv(MSG_TX, tx.GetHash());
@@ -1047,11 +1531,13 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
     bool send = false;
     std::shared_ptr<const CBlock> a_recent_block;
     std::shared_ptr<const CBlockHeaderAndShortTxIDs> a_recent_compact_block;
+    std::shared_ptr<const CSharedNetPayload> a_recent_compact_block_payload;
     bool fWitnessesPresentInARecentCompactBlock;
     {
         LOCK(cs_most_recent_block);
         a_recent_block = most_recent_block;
         a_recent_compact_block = most_recent_compact_block;
+        a_recent_compact_block_payload = most_recent_compact_block_payload;
         fWitnessesPresentInARecentCompactBlock = fWitnessesPresentInMostRecentCompactBlock;
     }
 
@@ -1096,9 +1582,10 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
         pfrom->fDisconnect = true;
         send = false;
     }
-    // Avoid leaking prune-height by never sending blocks below the NODE_NETWORK_LIMITED threshold
+    // Avoid leaking prune-height by never sending blocks below the NODE_NETWORK_LIMITED threshold,
+    // or below the recent blocks that -prunekeepblocks always keeps
     if (send && !pfrom->fWhitelisted && (
-            (((pfrom->GetLocalServices() & NODE_NETWORK_LIMITED) == NODE_NETWORK_LIMITED) && ((pfrom->GetLocalServices() & NODE_NETWORK) != NODE_NETWORK) && (chainActive.Tip()->nHeight - mi->second->nHeight > (int)NODE_NETWORK_LIMITED_MIN_BLOCKS + 2 /* add two blocks buffer extension for possible races */) )
+            (((pfrom->GetLocalServices() & NODE_NETWORK_LIMITED) == NODE_NETWORK_LIMITED) && ((pfrom->GetLocalServices() & NODE_NETWORK) != NODE_NETWORK) && (chainActive.Tip()->nHeight - mi->second->nHeight > (int)std::max(NODE_NETWORK_LIMITED_MIN_BLOCKS, nPruneKeepBlocks) + 2 /* add two blocks buffer extension for possible races */) )
        )) {
         LogPrint(BCLog::NET, "Ignore block request below NODE_NETWORK_LIMITED threshold from peer=%d\n", pfrom->GetId());
 
@@ -1111,8 +1598,47 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
     if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
     {
         std::shared_ptr<const CBlock> pblock;
-        if (a_recent_block && a_recent_block->GetHash() == (*mi).second->GetBlockHash()) {
-            pblock = a_recent_block;
+        const uint256 hashBlock = mi->second->GetBlockHash();
+        // Blocks near the tip (including those of a recent reorg) are what
+        // many peers ask for at once; serve them from the cache, where every
+        // peer shares one serialization of each message.
+        RecentBlockEntry recent;
+        const bool fRecent = mi->second->nHeight > chainActive.Height() - (int)RECENT_BLOCK_CACHE_SIZE;
+        bool fRecentUpdated = false;
+        // Blocks away from the tip give way to new blocks and transaction
+        // relay when the upload rate is limited
+        auto pushBlockData = [&](CSerializedNetMsg&& msg) {
+            msg.historical = !fRecent;
+            connman->PushMessage(pfrom, std::move(msg));
+        };
+        if (fRecent) {
+            if (GetRecentBlock(hashBlock, recent)) {
+                nRecentBlockHits++;
+            } else {
+                nRecentBlockMisses++;
+                std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+                if (!ReadBlockFromDisk(*pblockRead, (*mi).second, consensusParams))
+                    assert(!"cannot load block from disk");
+                recent.block = pblockRead;
+                fRecentUpdated = true;
+            }
+            if (inv.type == MSG_WITNESS_BLOCK && !recent.payload) {
+                recent.payload = msgMaker.MakePayload(0, *recent.block);
+                fRecentUpdated = true;
+            } else if (inv.type == MSG_BLOCK && !recent.payload_no_witness) {
+                recent.payload_no_witness = msgMaker.MakePayload(SERIALIZE_TRANSACTION_NO_WITNESS, *recent.block);
+                fRecentUpdated = true;
+            }
+            pblock = recent.block;
+        } else if (inv.type == MSG_WITNESS_BLOCK) {
+            // Blocks are stored with their witnesses, so the bytes on disk are
+            // exactly the message payload; send them without deserializing.
+            CSerializedNetMsg msg;
+            msg.command = NetMsgType::BLOCK;
+            if (!ReadRawBlockFromDisk(msg.data, (*mi).second, Params().MessageStart()))
+                assert(!"cannot load block from disk");
+            pushBlockData(std::move(msg));
+            // pblock stays null as the block has been sent
         } else {
             // Send block from disk
             std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
@@ -1120,11 +1646,19 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
                 assert(!"cannot load block from disk");
             pblock = pblockRead;
         }
-        if (inv.type == MSG_BLOCK)
-            connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
-        else if (inv.type == MSG_WITNESS_BLOCK)
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
-        else if (inv.type == MSG_FILTERED_BLOCK)
+        if (!pblock) {
+            // Already sent
+        } else if (inv.type == MSG_BLOCK) {
+            if (recent.payload_no_witness)
+                pushBlockData(msgMaker.MakeShared(NetMsgType::BLOCK, recent.payload_no_witness));
+            else
+                pushBlockData(msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
+        } else if (inv.type == MSG_WITNESS_BLOCK) {
+            if (recent.payload)
+                pushBlockData(msgMaker.MakeShared(NetMsgType::BLOCK, recent.payload));
+            else
+                pushBlockData(msgMaker.Make(NetMsgType::BLOCK, *pblock));
+        } else if (inv.type == MSG_FILTERED_BLOCK)
         {
             bool sendMerkleBlock = false;
             CMerkleBlock merkleBlock;
@@ -1132,10 +1666,18 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
                 LOCK(pfrom->cs_filter);
                 if (pfrom->pfilter) {
                     sendMerkleBlock = true;
-                    merkleBlock = CMerkleBlock(*pblock, *pfrom->pfilter);
+                    if (TakePrematchedMerkleBlock(pfrom->GetId(), hashBlock, *pfrom->pfilter, merkleBlock)) {
+                        nFilteredBlocksPrematched++;
+                    } else {
+                        const int64_t nTimeStart = GetTimeMicros();
+                        merkleBlock = CMerkleBlock(*pblock, *pfrom->pfilter);
+                        nFilterMatchMicros += GetTimeMicros() - nTimeStart;
+                    }
                 }
             }
             if (sendMerkleBlock) {
+                nFilteredBlocksServed++;
+                nFilteredTxSent += merkleBlock.vMatchedTxn.size();
                 connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
                 // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
                 // This avoids hurting performance by pointlessly requiring a round-trip
@@ -1144,8 +1686,11 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
                 // Thus, the protocol spec specified allows for us to provide duplicate txn here,
                 // however we MUST always provide at least what the remote peer needs
                 typedef std::pair<unsigned int, uint256> PairType;
-                for (PairType& pair : merkleBlock.vMatchedTxn)
-                    connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *pblock->vtx[pair.first]));
+                for (PairType& pair : merkleBlock.vMatchedTxn) {
+                    CSerializedNetMsg msg = msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *pblock->vtx[pair.first]);
+                    msg.historical = true;
+                    connman->PushMessage(pfrom, std::move(msg));
+                }
             }
             // else
                 // no response
@@ -1160,15 +1705,26 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
             int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
             if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
                 if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == mi->second->GetBlockHash()) {
-                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
+                    connman->PushMessage(pfrom, msgMaker.MakeShared(NetMsgType::CMPCTBLOCK, a_recent_compact_block_payload));
+                    pfrom->nCmpctBlocksSent++;
+                } else if (fRecent && fPeerWantsWitness) {
+                    if (!recent.payload_compact) {
+                        recent.payload_compact = msgMaker.MakePayload(0, CBlockHeaderAndShortTxIDs(*pblock, true));
+                        fRecentUpdated = true;
+                    }
+                    connman->PushMessage(pfrom, msgMaker.MakeShared(NetMsgType::CMPCTBLOCK, recent.payload_compact));
+                    pfrom->nCmpctBlocksSent++;
                 } else {
                     CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
                     connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+                    pfrom->nCmpctBlocksSent++;
                 }
             } else {
-                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
+                pushBlockData(msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
             }
         }
+        if (fRecentUpdated)
+            CacheRecentBlock(hashBlock, recent);
 
         // Trigger the peer node to send a getblocks request for the next batch of inventory
         if (inv.hash == pfrom->hashContinue)
@@ -1192,7 +1748,9 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
     std::vector<CInv> vNotFound;
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
     {
-        LOCK(cs_main);
+        // Transactions are served from mapRelay and the mempool, neither of
+        // which needs cs_main.
+        LOCK(g_cs_relay);
 
         while (it != pfrom->vRecvGetData.end() && (it->type == MSG_TX || it->type == MSG_WITNESS_TX)) {
             if (interruptMsgProc)
@@ -1224,7 +1782,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 vNotFound.push_back(inv);
             }
         }
-    } // release cs_main
+    } // release g_cs_relay
 
     if (it != pfrom->vRecvGetData.end() && !pfrom->fPauseSend) {
         const CInv &inv = *it;
@@ -1273,6 +1831,16 @@ inline void static SendBlockTransactions(const CBlock& block, const BlockTransac
     connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCKTXN, resp));
 }
 
+/** Send headers as "cmpheaders" if the peer asked for them, and as "headers" otherwise */
+static void PushHeaders(CNode* pto, CConnman* connman, const CNetMsgMaker& msgMaker, const std::vector<CBlock>& vHeaders, bool fCompressed)
+{
+    if (fCompressed) {
+        connman->PushMessage(pto, msgMaker.Make(NetMsgType::CMPHEADERS, CCompressedHeaders(std::vector<CBlockHeader>(vHeaders.begin(), vHeaders.end()))));
+    } else {
+        connman->PushMessage(pto, msgMaker.Make(NetMsgType::HEADERS, vHeaders));
+    }
+}
+
 bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::vector<CBlockHeader>& headers, const CChainParams& chainparams, bool punish_duplicate_invalid)
 {
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
@@ -1303,7 +1871,7 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
         if (mapBlockIndex.find(headers[0].hashPrevBlock) == mapBlockIndex.end() && nCount < MAX_BLOCKS_TO_ANNOUNCE) {
             nodestate->nUnconnectingHeaders++;
             //发送getheaders消息
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), uint256()));
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, GetCachedLocator(pindexBestHeader), uint256()));
             LogPrint(BCLog::NET, "received header %s: missing prev block %s, sending getheaders (%d) to end (peer=%d, nUnconnectingHeaders=%d)\n",
                     headers[0].GetHash().ToString(),
                     headers[0].hashPrevBlock.ToString(),
@@ -1414,7 +1982,7 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
             // from there instead.
             LogPrint(BCLog::NET, "more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->GetId(), pfrom->nStartingHeight);
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexLast), uint256()));
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, GetCachedLocator(pindexLast), uint256()));
         }
 
         bool fCanDirectFetch = CanDirectFetch(chainparams.GetConsensus());
@@ -1506,7 +2074,306 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
     return true;
 }
 
-bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
+/** Queue the orphans that spend outputs of tx for reprocessing */
+static void AddChildrenToWorkSet(const CTransaction& tx, std::set<uint256>& orphan_work_set) EXCLUSIVE_LOCKS_REQUIRED(g_cs_orphans)
+{
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        auto itByPrev = mapOrphanTransactionsByPrev.find(COutPoint(tx.GetHash(), i));
+        if (itByPrev == mapOrphanTransactionsByPrev.end())
+            continue;
+        for (const COrphanTx* orphan : itByPrev->second) {
+            orphan_work_set.insert(orphan->tx->GetHash());
+        }
+    }
+}
+
+static void AddLowFeeTx(const CTransactionRef& tx) EXCLUSIVE_LOCKS_REQUIRED(g_cs_orphans)
+{
+    if (RecursiveDynamicUsage(*tx) >= 100000 || !mapLowFeeTxs.emplace(tx->GetHash(), tx).second)
+        return;
+    g_low_fee_order.push_back(tx->GetHash());
+    while (g_low_fee_order.size() > MAX_LOW_FEE_TXS) {
+        mapLowFeeTxs.erase(g_low_fee_order.front());
+        g_low_fee_order.pop_front();
+    }
+}
+
+/**
+ * Try to accept ptx as a package together with those of its parents that are
+ * in the orphanage or were rejected for their fee, so that it can pay for them.
+ * Parents spending each other are not supported. Accepted transactions are
+ * relayed and the orphans spending them queued for reprocessing.
+ */
+static bool AcceptWithParents(const CTransactionRef& ptx, CConnman* connman, std::set<uint256>& orphan_work_set, std::list<CTransactionRef>& removed_txn) EXCLUSIVE_LOCKS_REQUIRED(cs_main, g_cs_orphans)
+{
+    std::vector<CTransactionRef> package;
+    std::set<uint256> setParents;
+    for (const CTxIn& txin : ptx->vin) {
+        const uint256& hash = txin.prevout.hash;
+        if (!setParents.insert(hash).second || mempool.exists(hash))
+            continue;
+        auto itLowFee = mapLowFeeTxs.find(hash);
+        if (itLowFee != mapLowFeeTxs.end()) {
+            package.push_back(itLowFee->second);
+            continue;
+        }
+        auto itOrphan = mapOrphanTransactions.find(hash);
+        if (itOrphan != mapOrphanTransactions.end())
+            package.push_back(itOrphan->second.tx);
+    }
+    if (package.empty() || package.size() >= MAX_PACKAGE_COUNT)
+        return false;
+    package.push_back(ptx);
+
+    // As with orphans, nobody is punished for a package that fails
+    CValidationState stateDummy;
+    if (!AcceptPackageToMemoryPool(mempool, stateDummy, package, &removed_txn)) {
+        LogPrint(BCLog::MEMPOOL, "package of %s with %u parents not accepted: %s\n", ptx->GetHash().ToString(),
+            package.size() - 1, FormatStateMessage(stateDummy));
+        return false;
+    }
+    for (const CTransactionRef& tx : package) {
+        LogPrint(BCLog::MEMPOOL, "   accepted package tx %s\n", tx->GetHash().ToString());
+        g_txrequest.ForgetTxHash(tx->GetHash());
+        RelayTransaction(*tx, connman);
+        AddChildrenToWorkSet(*tx, orphan_work_set);
+        EraseOrphanTx(tx->GetHash());
+        mapLowFeeTxs.erase(tx->GetHash());
+    }
+    mempool.check(pcoinsTip.get());
+    return true;
+}
+
+/**
+ * ptx was rejected for its fee alone: keep it for a while in case a child comes
+ * to pay for it, and try it with each of its children already in the orphanage.
+ */
+static bool ProcessLowFeeTx(const CTransactionRef& ptx, CConnman* connman, std::set<uint256>& orphan_work_set, std::list<CTransactionRef>& removed_txn) EXCLUSIVE_LOCKS_REQUIRED(cs_main, g_cs_orphans)
+{
+    AddLowFeeTx(ptx);
+    // Collected first, as accepting a package erases its orphans
+    std::vector<CTransactionRef> vChildren;
+    std::set<uint256> setChildren;
+    for (unsigned int i = 0; i < ptx->vout.size(); i++) {
+        auto itByPrev = mapOrphanTransactionsByPrev.find(COutPoint(ptx->GetHash(), i));
+        if (itByPrev == mapOrphanTransactionsByPrev.end())
+            continue;
+        for (const COrphanTx* orphan : itByPrev->second) {
+            if (setChildren.insert(orphan->tx->GetHash()).second)
+                vChildren.push_back(orphan->tx);
+        }
+    }
+    for (const CTransactionRef& child : vChildren) {
+        if (AcceptWithParents(child, connman, orphan_work_set, removed_txn))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Try orphans from the work set until one of them is accepted to the mempool
+ * or found invalid, so that a single call does a bounded amount of work.
+ */
+static void ProcessOrphanTx(CConnman* connman, std::set<uint256>& orphan_work_set, std::list<CTransactionRef>& removed_txn) EXCLUSIVE_LOCKS_REQUIRED(cs_main, g_cs_orphans)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(g_cs_orphans);
+    bool done = false;
+    while (!done && !orphan_work_set.empty()) {
+        const uint256 orphanHash = *orphan_work_set.begin();
+        orphan_work_set.erase(orphan_work_set.begin());
+
+        auto orphan_it = mapOrphanTransactions.find(orphanHash);
+        if (orphan_it == mapOrphanTransactions.end())
+            continue;
+        const CTransactionRef porphanTx = orphan_it->second.tx;
+        const CTransaction& orphanTx = *porphanTx;
+        NodeId fromPeer = orphan_it->second.fromPeer;
+        bool fMissingInputs2 = false;
+        // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+        // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+        // anyone relaying LegitTxX banned)
+        CValidationState stateDummy;
+
+        if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, &fMissingInputs2, &removed_txn, false /* bypass_limits */, 0 /* nAbsurdFee */)) {
+            LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n", orphanHash.ToString());
+            RelayTransaction(orphanTx, connman);
+            AddChildrenToWorkSet(orphanTx, orphan_work_set);
+            EraseOrphanTx(orphanHash);
+            done = true;
+        }
+        else if (!fMissingInputs2 && stateDummy.GetRejectCode() == REJECT_INSUFFICIENTFEE &&
+                 ProcessLowFeeTx(porphanTx, connman, orphan_work_set, removed_txn))
+        {
+            // One of its children paid for it
+            done = true;
+        }
+        else if (!fMissingInputs2)
+        {
+            int nDos = 0;
+            if (stateDummy.IsInvalid(nDos) && nDos > 0)
+            {
+                // Punish peer that gave us an invalid orphan tx
+                Misbehaving(fromPeer, nDos);
+                LogPrint(BCLog::MEMPOOL, "   invalid orphan tx %s\n", orphanHash.ToString());
+            }
+            // Has inputs but not accepted to mempool
+            // Probably non-standard or insufficient fee
+            LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n", orphanHash.ToString());
+            if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
+                // Do not use rejection cache for witness transactions or
+                // witness-stripped transactions, as they can have been malleated.
+                // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
+                assert(recentRejects);
+                recentRejects->insert(orphanHash);
+            }
+            EraseOrphanTx(orphanHash);
+            done = true;
+        }
+        mempool.check(pcoinsTip.get());
+    }
+}
+
+/**
+ * Validate a BIP 157 request, disconnecting the peer if it is malformed or
+ * filters are not served. On success the stop block and the index to serve
+ * it from are set.
+ */
+static bool PrepareBlockFilterRequest(CNode* pfrom, BlockFilterType filter_type, uint32_t start_height, const uint256& stop_hash, uint32_t max_height_diff,
+                                      const CBlockIndex*& pindexStop, CBlockFilterIndex*& filter_index)
+{
+    if (!(pfrom->GetLocalServices() & NODE_COMPACT_FILTERS) || !g_blockfilterindex) {
+        LogPrint(BCLog::NET, "peer %d requested compact filters, which are not served, disconnecting\n", pfrom->GetId());
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    if (g_blockfilterindex->GetFilterType() != filter_type) {
+        LogPrint(BCLog::NET, "peer %d requested unsupported block filter type: %d\n", pfrom->GetId(), static_cast<uint8_t>(filter_type));
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(stop_hash);
+        if (it == mapBlockIndex.end() || !chainActive.Contains(it->second)) {
+            LogPrint(BCLog::NET, "peer %d requested filters for a block not in the active chain: %s\n", pfrom->GetId(), stop_hash.ToString());
+            pfrom->fDisconnect = true;
+            return false;
+        }
+        pindexStop = it->second;
+    }
+
+    uint32_t stop_height = pindexStop->nHeight;
+    if (start_height > stop_height) {
+        LogPrint(BCLog::NET, "peer %d sent invalid getcfilters/getcfheaders with start height %d and stop height %d\n",
+                 pfrom->GetId(), start_height, stop_height);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    if (stop_height - start_height >= max_height_diff) {
+        LogPrint(BCLog::NET, "peer %d requested too many cfilters/cfheaders: %d / %d\n",
+                 pfrom->GetId(), stop_height - start_height + 1, max_height_diff);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    filter_index = g_blockfilterindex.get();
+    return true;
+}
+
+static void ProcessGetCFilters(CNode* pfrom, CPublicDataStream& vRecv, CConnman* connman)
+{
+    uint8_t filter_type_ser;
+    uint32_t start_height;
+    uint256 stop_hash;
+    vRecv >> filter_type_ser >> start_height >> stop_hash;
+    const BlockFilterType filter_type = static_cast<BlockFilterType>(filter_type_ser);
+
+    const CBlockIndex* pindexStop;
+    CBlockFilterIndex* filter_index;
+    if (!PrepareBlockFilterRequest(pfrom, filter_type, start_height, stop_hash, MAX_GETCFILTERS_SIZE, pindexStop, filter_index))
+        return;
+
+    std::vector<BlockFilter> filters;
+    if (!filter_index->LookupFilterRange(start_height, pindexStop, filters)) {
+        LogPrint(BCLog::NET, "failed to find block filters for height range %d to %s, the index may still be syncing\n",
+                 start_height, stop_hash.ToString());
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    for (const BlockFilter& filter : filters) {
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::CFILTER, filter));
+    }
+}
+
+static void ProcessGetCFHeaders(CNode* pfrom, CPublicDataStream& vRecv, CConnman* connman)
+{
+    uint8_t filter_type_ser;
+    uint32_t start_height;
+    uint256 stop_hash;
+    vRecv >> filter_type_ser >> start_height >> stop_hash;
+    const BlockFilterType filter_type = static_cast<BlockFilterType>(filter_type_ser);
+
+    const CBlockIndex* pindexStop;
+    CBlockFilterIndex* filter_index;
+    if (!PrepareBlockFilterRequest(pfrom, filter_type, start_height, stop_hash, MAX_GETCFHEADERS_SIZE, pindexStop, filter_index))
+        return;
+
+    uint256 prev_header;
+    if (start_height > 0) {
+        const CBlockIndex* pindexPrev = pindexStop->GetAncestor(static_cast<int>(start_height - 1));
+        if (!filter_index->LookupFilterHeader(pindexPrev, prev_header)) {
+            LogPrint(BCLog::NET, "failed to find block filter header for block %s, the index may still be syncing\n",
+                     pindexPrev->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    std::vector<uint256> filter_hashes;
+    if (!filter_index->LookupFilterHashRange(start_height, pindexStop, filter_hashes)) {
+        LogPrint(BCLog::NET, "failed to find block filter hashes for height range %d to %s, the index may still be syncing\n",
+                 start_height, stop_hash.ToString());
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::CFHEADERS, filter_type_ser, pindexStop->GetBlockHash(), prev_header, filter_hashes));
+}
+
+static void ProcessGetCFCheckPt(CNode* pfrom, CPublicDataStream& vRecv, CConnman* connman)
+{
+    uint8_t filter_type_ser;
+    uint256 stop_hash;
+    vRecv >> filter_type_ser >> stop_hash;
+    const BlockFilterType filter_type = static_cast<BlockFilterType>(filter_type_ser);
+
+    const CBlockIndex* pindexStop;
+    CBlockFilterIndex* filter_index;
+    if (!PrepareBlockFilterRequest(pfrom, filter_type, 0, stop_hash, std::numeric_limits<uint32_t>::max(), pindexStop, filter_index))
+        return;
+
+    std::vector<uint256> headers(pindexStop->nHeight / CFCHECKPT_INTERVAL);
+
+    // Walk back from the stop block, so that each ancestor lookup is short
+    const CBlockIndex* pindex = pindexStop;
+    for (int i = headers.size() - 1; i >= 0; i--) {
+        int height = (i + 1) * CFCHECKPT_INTERVAL;
+        pindex = pindex->GetAncestor(height);
+        if (!filter_index->LookupFilterHeader(pindex, headers[i])) {
+            LogPrint(BCLog::NET, "failed to find block filter header for block %s, the index may still be syncing\n",
+                     pindex->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::CFCHECKPT, filter_type_ser, pindexStop->GetBlockHash(), headers));
+}
+
+bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CPublicDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
 {
     LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->GetId());
     if (gArgs.IsArgSet("-dropmessagestest") && GetRand(gArgs.GetArg("-dropmessagestest", 0)) == 0)
@@ -1776,6 +2643,27 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             nCMPCTBLOCKVersion = 1;
             connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion));
         }
+        bool fPeerRelaysTxes;
+        {
+            LOCK(pfrom->cs_filter);
+            fPeerRelaysTxes = pfrom->fRelayTxes;
+        }
+        if (fRelayTxes && fPeerRelaysTxes && gArgs.GetBoolArg("-txreconciliation", DEFAULT_TXRECONCILIATION)) {
+            // Offer to announce transactions by set reconciliation. Peers
+            // that do not know "sendrecon" ignore it and keep flooding.
+            uint64_t nSalt = GetRand(std::numeric_limits<uint64_t>::max()) | 1;
+            {
+                LOCK(cs_main);
+                State(pfrom->GetId())->m_recon_local_salt = nSalt;
+            }
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDRECON, TXRECONCILIATION_VERSION, nSalt));
+        }
+        if (gArgs.GetBoolArg("-compressedheaders", DEFAULT_COMPRESSED_HEADERS)) {
+            // Ask for headers without the fields implied by the previous
+            // ones. Peers that do not know "sendcmphdrs" ignore it and keep
+            // sending "headers".
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPHDRS, COMPRESSED_HEADERS_VERSION));
+        }
         pfrom->fSuccessfullyConnected = true;
     }
 
@@ -1787,6 +2675,136 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         return false;
     }
 
+    else if (strCommand == NetMsgType::SENDRECON)
+    {
+        uint32_t nReconVersion = 0;
+        uint64_t nSalt = 0;
+        vRecv >> nReconVersion >> nSalt;
+        LOCK(cs_main);
+        CNodeState* nodestate = State(pfrom->GetId());
+        // Only used if we offered it as well, which we did on their verack
+        if (nReconVersion >= TXRECONCILIATION_VERSION && nodestate->m_recon_local_salt != 0 && !nodestate->m_recon) {
+            nodestate->m_recon = true;
+            nodestate->m_recon_k0 = std::min(nSalt, nodestate->m_recon_local_salt);
+            nodestate->m_recon_k1 = std::max(nSalt, nodestate->m_recon_local_salt);
+            nodestate->m_next_recon_request = PoissonNextSend(GetTimeMicros(), RECON_REQUEST_INTERVAL);
+            LOCK(pfrom->cs_inventory);
+            pfrom->fTxReconciliation = true;
+            LogPrint(BCLog::NET, "using transaction reconciliation with peer=%d\n", pfrom->GetId());
+        }
+    }
+
+    else if (strCommand == NetMsgType::SENDCMPHDRS)
+    {
+        uint32_t nVersion = 0;
+        vRecv >> nVersion;
+        if (nVersion >= COMPRESSED_HEADERS_VERSION) {
+            LOCK(cs_main);
+            State(pfrom->GetId())->fWantsCompressedHeaders = true;
+            LogPrint(BCLog::NET, "sending compressed headers to peer=%d\n", pfrom->GetId());
+        }
+    }
+
+    else if (strCommand == NetMsgType::REQRECON)
+    {
+        uint32_t nRemoteSetSize = 0;
+        vRecv >> nRemoteSetSize;
+        LOCK(cs_main);
+        CNodeState* nodestate = State(pfrom->GetId());
+        // Rounds are started by the peer that opened the connection
+        if (!nodestate->m_recon || !pfrom->fInbound) {
+            LogPrint(BCLog::NET, "unexpected reqrecon from peer=%d\n", pfrom->GetId());
+            return true;
+        }
+        LOCK(pfrom->cs_inventory);
+        if (nodestate->m_recon_sketch_sent) {
+            // The peer gave up on the previous round, announce its transactions the usual way
+            for (const auto& entry : nodestate->m_recon_snapshot)
+                pfrom->setInventoryTxToSend.insert(entry.second);
+        }
+        nodestate->m_recon_snapshot.clear();
+        for (const uint256& hash : pfrom->setReconTxToSend)
+            nodestate->m_recon_snapshot.emplace(GetReconShortId(nodestate->m_recon_k0, nodestate->m_recon_k1, hash), hash);
+        pfrom->setReconTxToSend.clear();
+        CReconSketch sketch(GetReconSketchCells(nodestate->m_recon_snapshot.size(), nRemoteSetSize));
+        for (const auto& entry : nodestate->m_recon_snapshot)
+            sketch.Insert(entry.first);
+        nodestate->m_recon_sketch_sent = true;
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SKETCH, sketch));
+    }
+
+    else if (strCommand == NetMsgType::SKETCH)
+    {
+        CReconSketch remoteSketch;
+        vRecv >> remoteSketch;
+        LOCK(cs_main);
+        CNodeState* nodestate = State(pfrom->GetId());
+        if (!nodestate->m_recon_requested) {
+            LogPrint(BCLog::NET, "unexpected sketch from peer=%d\n", pfrom->GetId());
+            return true;
+        }
+        nodestate->m_recon_requested = false;
+        std::map<uint32_t, uint256> snapshot;
+        snapshot.swap(nodestate->m_recon_snapshot);
+
+        // Our sketch minus theirs leaves the ids only we have as inserted
+        // and the ids only they have as subtracted.
+        bool fSuccess = false;
+        std::vector<uint32_t> vOnlyLocal, vOnlyRemote;
+        if (remoteSketch.IsValid()) {
+            CReconSketch sketch(remoteSketch.GetCells());
+            for (const auto& entry : snapshot)
+                sketch.Insert(entry.first);
+            sketch.Subtract(remoteSketch);
+            fSuccess = sketch.Decode(vOnlyLocal, vOnlyRemote);
+        }
+        {
+            LOCK(pfrom->cs_inventory);
+            if (fSuccess) {
+                for (uint32_t id : vOnlyLocal) {
+                    auto it = snapshot.find(id);
+                    if (it != snapshot.end())
+                        pfrom->setInventoryTxToSend.insert(it->second);
+                }
+            } else {
+                // Too many differences to decode, both sides announce their whole set
+                for (const auto& entry : snapshot)
+                    pfrom->setInventoryTxToSend.insert(entry.second);
+                vOnlyRemote.clear();
+            }
+        }
+        LogPrint(BCLog::NET, "reconciliation with peer=%d %s: %u local, %u remote differences\n", pfrom->GetId(),
+            fSuccess ? "succeeded" : "failed", vOnlyLocal.size(), vOnlyRemote.size());
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::RECONCILDIFF, fSuccess, vOnlyRemote));
+    }
+
+    else if (strCommand == NetMsgType::RECONCILDIFF)
+    {
+        bool fSuccess = false;
+        std::vector<uint32_t> vAsked;
+        vRecv >> fSuccess >> vAsked;
+        LOCK(cs_main);
+        CNodeState* nodestate = State(pfrom->GetId());
+        if (!nodestate->m_recon_sketch_sent) {
+            LogPrint(BCLog::NET, "unexpected reconcildiff from peer=%d\n", pfrom->GetId());
+            return true;
+        }
+        nodestate->m_recon_sketch_sent = false;
+        std::map<uint32_t, uint256> snapshot;
+        snapshot.swap(nodestate->m_recon_snapshot);
+        LOCK(pfrom->cs_inventory);
+        if (fSuccess) {
+            for (uint32_t id : vAsked) {
+                auto it = snapshot.find(id);
+                if (it != snapshot.end())
+                    pfrom->setInventoryTxToSend.insert(it->second);
+            }
+        } else {
+            for (const auto& entry : snapshot)
+                pfrom->setInventoryTxToSend.insert(entry.second);
+        }
+    }
+
     else if (strCommand == NetMsgType::ADDR)
     {
         std::vector<CAddress> vAddr;
@@ -1908,7 +2926,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                     // fell back to inv we probably have a reorg which we should get the headers for first,
                     // we now only provide a getheaders response here. When we receive the headers, we will
                     // then ask for the blocks we need.
-                    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), inv.hash));
+                    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, GetCachedLocator(pindexBestHeader), inv.hash));
                     LogPrint(BCLog::NET, "getheaders (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->GetId());
                 }
             }
@@ -1918,7 +2936,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 if (fBlocksOnly) {
                     LogPrint(BCLog::NET, "transaction (%s) inv sent in violation of protocol peer=%d\n", inv.hash.ToString(), pfrom->GetId());
                 } else if (!fAlreadyHave && !fImporting && !fReindex && !IsInitialBlockDownload()) {
-                    pfrom->AskFor(inv);
+                    AddTxAnnouncement(pfrom, inv, GetTimeMicros());
                 }
             }
         }
@@ -1973,7 +2991,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         LOCK(cs_main);
 
         // Find the last block the caller has in the main chain
-        const CBlockIndex* pindex = FindForkInGlobalIndex(chainActive, locator);
+        const CBlockIndex* pindex = FindForkCached(locator);
 
         // Send the rest of the chain
         if (pindex)
@@ -1989,7 +3007,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             }
             // If pruning, don't inv blocks unless we have on disk and are likely to still have
             // for some reasonable time window (1 hour) that block relay might require.
-            const int nPrunedBlocksLikelyToHave = MIN_BLOCKS_TO_KEEP - 3600 / chainparams.GetConsensus().nPowTargetSpacing;
+            const int nPrunedBlocksLikelyToHave = nPruneKeepBlocks - 3600 / chainparams.GetConsensus().nPowTargetSpacing;
             if (fPruneMode && (!(pindex->nStatus & BLOCK_HAVE_DATA) || pindex->nHeight <= chainActive.Tip()->nHeight - nPrunedBlocksLikelyToHave))
             {
                 LogPrint(BCLog::NET, " getblocks stopping, pruned or too old block at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -2012,6 +3030,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     {
         BlockTransactionsRequest req;
         vRecv >> req;
+        pfrom->nCmpctBlockTxnRequests++;
 
         std::shared_ptr<const CBlock> recent_block;
         {
@@ -2088,7 +3107,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         else
         {
             // Find the last block the caller has in the main chain
-            pindex = FindForkInGlobalIndex(chainActive, locator);
+            pindex = FindForkCached(locator);
             if (pindex)
                 pindex = chainActive.Next(pindex);
         }
@@ -2116,7 +3135,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         // will re-announce the new block via headers (or compact blocks again)
         // in the SendMessages logic.
         nodestate->pindexBestHeaderSent = pindex ? pindex : chainActive.Tip();
-        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::HEADERS, vHeaders));
+        PushHeaders(pfrom, connman, msgMaker, vHeaders, nodestate->fWantsCompressedHeaders);
     }
 
 
@@ -2130,8 +3149,6 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             return true;
         }
 
-        std::deque<COutPoint> vWorkQueue;
-        std::vector<uint256> vEraseQueue;
         CTransactionRef ptx;
         vRecv >> ptx;
         const CTransaction& tx = *ptx;
@@ -2144,18 +3161,16 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         bool fMissingInputs = false;
         CValidationState state;
 
-        pfrom->setAskFor.erase(inv.hash);
-        mapAlreadyAskedFor.erase(inv.hash);
+        g_txrequest.ReceivedResponse(pfrom->GetId(), inv.hash);
 
         std::list<CTransactionRef> lRemovedTxn;
 
         if (!AlreadyHave(inv) &&
             AcceptToMemoryPool(mempool, state, ptx, &fMissingInputs, &lRemovedTxn, false /* bypass_limits */, 0 /* nAbsurdFee */)) {
             mempool.check(pcoinsTip.get());
+            // No other peer needs to be asked for it any more
+            g_txrequest.ForgetTxHash(tx.GetHash());
             RelayTransaction(tx, connman);
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                vWorkQueue.emplace_back(inv.hash, i);
-            }
 
             pfrom->nLastTXTime = GetTime();
 
@@ -2164,88 +3179,35 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 tx.GetHash().ToString(),
                 mempool.size(), mempool.DynamicMemoryUsage() / 1000);
 
-            // Recursively process any orphan transactions that depended on this one
-            std::set<NodeId> setMisbehaving;
-            while (!vWorkQueue.empty()) {
-                auto itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue.front());
-                vWorkQueue.pop_front();
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (auto mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const CTransactionRef& porphanTx = (*mi)->second.tx;
-                    const CTransaction& orphanTx = *porphanTx;
-                    const uint256& orphanHash = orphanTx.GetHash();
-                    NodeId fromPeer = (*mi)->second.fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, &fMissingInputs2, &lRemovedTxn, false /* bypass_limits */, 0 /* nAbsurdFee */)) {
-                        LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx, connman);
-                        for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
-                            vWorkQueue.emplace_back(orphanHash, i);
-                        }
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint(BCLog::MEMPOOL, "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee
-                        LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
-                            // Do not use rejection cache for witness transactions or
-                            // witness-stripped transactions, as they can have been malleated.
-                            // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                            assert(recentRejects);
-                            recentRejects->insert(orphanHash);
-                        }
-                    }
-                    mempool.check(pcoinsTip.get());
-                }
-            }
-
-            for (uint256 hash : vEraseQueue)
-                EraseOrphanTx(hash);
+            // Orphans that depended on this one are retried from ProcessMessages,
+            // one at a time, so a long chain of them cannot stall this handler
+            AddChildrenToWorkSet(tx, pfrom->orphan_work_set);
         }
         else if (fMissingInputs)
         {
             bool fRejectedParents = false; // It may be the case that the orphans parents have all been rejected
             for (const CTxIn& txin : tx.vin) {
-                if (recentRejects->contains(txin.prevout.hash)) {
+                // Parents rejected for their fee may still be paid for by this one
+                if (recentRejects->contains(txin.prevout.hash) && !mapLowFeeTxs.count(txin.prevout.hash)) {
                     fRejectedParents = true;
                     break;
                 }
             }
-            if (!fRejectedParents) {
+            if (!fRejectedParents && AcceptWithParents(ptx, connman, pfrom->orphan_work_set, lRemovedTxn)) {
+                pfrom->nLastTXTime = GetTime();
+            } else if (!fRejectedParents) {
                 uint32_t nFetchFlags = GetFetchFlags(pfrom);
                 for (const CTxIn& txin : tx.vin) {
                     CInv _inv(MSG_TX | nFetchFlags, txin.prevout.hash);
                     pfrom->AddInventoryKnown(_inv);
-                    if (!AlreadyHave(_inv)) pfrom->AskFor(_inv);
+                    if (!AlreadyHave(_inv)) AddTxAnnouncement(pfrom, _inv, GetTimeMicros());
                 }
                 AddOrphanTx(ptx, pfrom->GetId());
 
                 // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
                 unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, gArgs.GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+                size_t nMaxOrphanUsage = (size_t)std::max((int64_t)0, gArgs.GetArg("-maxorphansize", DEFAULT_MAX_ORPHAN_SIZE)) * 1000000;
+                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx, nMaxOrphanUsage);
                 if (nEvicted > 0) {
                     LogPrint(BCLog::MEMPOOL, "mapOrphan overflow, removed %u tx\n", nEvicted);
                 }
@@ -2255,6 +3217,11 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 // parents so avoid re-requesting it from other peers.
                 recentRejects->insert(tx.GetHash());
             }
+        } else if (state.GetRejectCode() == REJECT_INSUFFICIENTFEE &&
+                   ProcessLowFeeTx(ptx, connman, pfrom->orphan_work_set, lRemovedTxn)) {
+            // A child waiting in the orphanage paid for it
+            pfrom->nLastTXTime = GetTime();
+            state = CValidationState();
         } else {
             if (!tx.HasWitness() && !state.CorruptionPossible()) {
                 // Do not use rejection cache for witness transactions or
@@ -2320,7 +3287,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end()) {
             // Doesn't connect (or is genesis), instead of DoSing in AcceptBlockHeader, request deeper headers
             if (!IsInitialBlockDownload())
-                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), uint256()));
+                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, GetCachedLocator(pindexBestHeader), uint256()));
             return true;
         }
 
@@ -2350,7 +3317,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         // dummy (empty) BLOCKTXN message, to re-use the logic there in
         // completing processing of the putative block (without cs_main).
         bool fProcessBLOCKTXN = false;
-        CDataStream blockTxnMsg(SER_NETWORK, PROTOCOL_VERSION);
+        CPublicDataStream blockTxnMsg(SER_NETWORK, PROTOCOL_VERSION);
 
         // If we end up treating this as a plain headers message, call that as well
         // without cs_main.
@@ -2421,6 +3388,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
                 PartiallyDownloadedBlock& partialBlock = *(*queuedBlockIt)->partialBlock;
                 ReadStatus status = partialBlock.InitData(cmpctblock, vExtraTxnForCompact);
+                pfrom->nCmpctBlocksReceived++;
                 if (status == READ_STATUS_INVALID) {
                     MarkBlockAsReceived(pindex->GetBlockHash()); // Reset in-flight state in case of whitelist
                     Misbehaving(pfrom->GetId(), 100);
@@ -2440,6 +3408,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                         req.indexes.push_back(i);
                 }
                 if (req.indexes.empty()) {
+                    pfrom->nCmpctBlocksReconstructed++;
                     // Dirty hack to jump to BLOCKTXN code (TODO: move message handling into their own functions)
                     BlockTransactions txn;
                     txn.blockhash = cmpctblock.header.GetHash();
@@ -2457,6 +3426,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 // able to without any round trips.
                 PartiallyDownloadedBlock tempBlock(&mempool);
                 ReadStatus status = tempBlock.InitData(cmpctblock, vExtraTxnForCompact);
+                pfrom->nCmpctBlocksReceived++;
                 if (status != READ_STATUS_OK) {
                     // TODO: don't ignore failures
                     return true;
@@ -2464,6 +3434,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 std::vector<CTransactionRef> dummy;
                 status = tempBlock.FillBlock(*pblock, dummy);
                 if (status == READ_STATUS_OK) {
+                    pfrom->nCmpctBlocksReconstructed++;
                     fBlockReconstructed = true;
                 }
             }
@@ -2631,10 +3602,26 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         return ProcessHeadersMessage(pfrom, connman, headers, chainparams, should_punish);
     }
 
+    else if (strCommand == NetMsgType::CMPHEADERS && !fImporting && !fReindex) // Ignore headers received while importing
+    {
+        // The same headers as a HEADERS message, with the implied fields filled in
+        CCompressedHeaders compressed;
+        vRecv >> compressed;
+        if (compressed.headers.size() > MAX_HEADERS_RESULTS) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 20);
+            return error("cmpheaders message size = %u", compressed.headers.size());
+        }
+
+        bool should_punish = !pfrom->fInbound && !pfrom->m_manual_connection;
+        return ProcessHeadersMessage(pfrom, connman, compressed.headers, chainparams, should_punish);
+    }
+
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-        vRecv >> *pblock;
+        size_t nBlockSize = vRecv.size();
+        UnserializeBlock(vRecv, *pblock);
 
         LogPrint(BCLog::NET, "received block %s peer=%d\n", pblock->GetHash().ToString(), pfrom->GetId());
 
@@ -2642,6 +3629,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         const uint256 hash(pblock->GetHash());
         {
             LOCK(cs_main);
+            UpdateBlockDownloadRate(pfrom->GetId(), hash, nBlockSize);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
             forceProcessing |= MarkBlockAsReceived(hash);
@@ -2680,7 +3668,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         std::vector<CAddress> vAddr = connman->GetAddresses();
         FastRandomContext insecure_rand;
         for (const CAddress &addr : vAddr)
@@ -2855,9 +3846,30 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
     }
 
+    else if (strCommand == NetMsgType::GETCFILTERS) {
+        ProcessGetCFilters(pfrom, vRecv, connman);
+    }
+
+    else if (strCommand == NetMsgType::GETCFHEADERS) {
+        ProcessGetCFHeaders(pfrom, vRecv, connman);
+    }
+
+    else if (strCommand == NetMsgType::GETCFCHECKPT) {
+        ProcessGetCFCheckPt(pfrom, vRecv, connman);
+    }
+
     else if (strCommand == NetMsgType::NOTFOUND) {
-        // We do not care about the NOTFOUND message, but logging an Unknown Command
-        // message would be undesirable as we transmit it ourselves.
+        // A notfound for transactions we requested lets the next peer that
+        // announced them be asked, rather than waiting for the request to expire
+        std::vector<CInv> vInv;
+        vRecv >> vInv;
+        if (vInv.size() <= MAX_INV_SZ) {
+            LOCK(cs_main);
+            for (const CInv& inv : vInv) {
+                if ((inv.type & MSG_TYPE_MASK) == MSG_TX)
+                    g_txrequest.ReceivedResponse(pfrom->GetId(), inv.hash);
+            }
+        }
     }
 
     else {
@@ -2870,6 +3882,57 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     return true;
 }
 
+bool ProcessUDPCmpctBlock(const CBlockHeaderAndShortTxIDs& cmpctblock, const CChainParams& chainparams)
+{
+    if (fImporting || fReindex)
+        return false;
+
+    {
+        LOCK(cs_main);
+        // Headers only come over UDP for blocks on top of ones we know; TCP peers take care of the rest
+        if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end())
+            return false;
+    }
+
+    const CBlockIndex *pindex = nullptr;
+    CValidationState state;
+    if (!ProcessNewBlockHeaders({cmpctblock.header}, state, chainparams, &pindex)) {
+        LogPrint(BCLog::NET, "Invalid header via UDP block relay: %s\n", FormatStateMessage(state));
+        return false;
+    }
+
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    {
+        LOCK2(cs_main, g_cs_orphans);
+        assert(pindex);
+        if (pindex->nStatus & BLOCK_HAVE_DATA)
+            return false;
+        // The same limits as for compact blocks reconstructed without being requested
+        if (pindex->nChainWork <= chainActive.Tip()->nChainWork || pindex->nTx != 0 ||
+                !CanDirectFetch(chainparams.GetConsensus()) || pindex->nHeight > chainActive.Height() + 2)
+            return false;
+
+        PartiallyDownloadedBlock tempBlock(&mempool);
+        if (tempBlock.InitData(cmpctblock, vExtraTxnForCompact) != READ_STATUS_OK)
+            return false;
+        // Missing transactions are not asked for; the block comes over TCP instead
+        std::vector<CTransactionRef> dummy;
+        if (tempBlock.FillBlock(*pblock, dummy) != READ_STATUS_OK)
+            return false;
+    }
+
+    bool fNewBlock = false;
+    // See the optimistic reconstruction of compact blocks for why this is
+    // safe to treat as requested.
+    ProcessNewBlock(chainparams, pblock, /*fForceProcessing=*/true, &fNewBlock);
+    LOCK(cs_main);
+    if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS)) {
+        // Stop downloading it from TCP peers
+        MarkBlockAsReceived(pblock->GetHash());
+    }
+    return fNewBlock;
+}
+
 static bool SendRejectsAndCheckIfBanned(CNode* pnode, CConnman* connman)
 {
     AssertLockHeld(cs_main);
@@ -2916,12 +3979,25 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
     if (!pfrom->vRecvGetData.empty())
         ProcessGetData(pfrom, chainparams.GetConsensus(), connman, interruptMsgProc);
 
+    // The work set is only touched from this thread, so it can be checked
+    // without taking the locks first
+    if (!pfrom->orphan_work_set.empty()) {
+        std::list<CTransactionRef> removed_txn;
+        LOCK2(cs_main, g_cs_orphans);
+        ProcessOrphanTx(connman, pfrom->orphan_work_set, removed_txn);
+        for (const CTransactionRef& removedTx : removed_txn)
+            AddToCompactExtraTransactions(removedTx);
+    }
+
     if (pfrom->fDisconnect)
         return false;
 
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return true;
 
+    // Orphans queued by an earlier tx go before later messages from the peer
+    if (!pfrom->orphan_work_set.empty()) return true;
+
     // Don't bother if send buffer is too full to respond anyway
     if (pfrom->fPauseSend)
         return false;
@@ -2959,11 +4035,11 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
     // Message size
     unsigned int nMessageSize = hdr.nMessageSize;
 
-    // Checksum
-    CDataStream& vRecv = msg.vRecv;
-    const uint256& hash = msg.GetMessageHash();
-    if (memcmp(hash.begin(), hdr.pchChecksum, CMessageHeader::CHECKSUM_SIZE) != 0)
+    // Checksum, verified by the socket handler as the message came in
+    CPublicDataStream& vRecv = msg.vRecv;
+    if (!msg.fChecksumValid)
     {
+        const uint256& hash = msg.GetMessageHash();
         LogPrint(BCLog::NET, "%s(%s, %u bytes): CHECKSUM ERROR expected %s was %s\n", __func__,
            SanitizeString(strCommand), nMessageSize,
            HexStr(hash.begin(), hash.begin()+CMessageHeader::CHECKSUM_SIZE),
@@ -3014,6 +4090,9 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
         LogPrint(BCLog::NET, "%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->GetId());
     }
 
+    // Keep the buffers for a later message from this peer
+    pfrom->RecycleRecvMsg(msgs, connman->GetReceiveFloodSize());
+
     LOCK(cs_main);
     SendRejectsAndCheckIfBanned(pfrom, connman);
 
@@ -3059,7 +4138,7 @@ void PeerLogicValidation::ConsiderEviction(CNode *pto, int64_t time_in_seconds)
             } else {
                 assert(state.m_chain_sync.m_work_header);
                 LogPrint(BCLog::NET, "sending getheaders to outbound peer=%d to verify chain work (current best known block:%s, benchmark blockhash: %s)\n", pto->GetId(), state.pindexBestKnownBlock != nullptr ? state.pindexBestKnownBlock->GetBlockHash().ToString() : "<none>", state.m_chain_sync.m_work_header->GetBlockHash().ToString());
-                connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(state.m_chain_sync.m_work_header->pprev), uint256()));
+                connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETHEADERS, GetCachedLocator(state.m_chain_sync.m_work_header->pprev), uint256()));
                 state.m_chain_sync.m_sent_getheaders = true;
                 constexpr int64_t HEADERS_RESPONSE_TIME = 120; // 2 minutes
                 // Bump the timeout to allow a response, which could clear the timeout
@@ -3150,23 +4229,70 @@ void PeerLogicValidation::CheckForStaleTipAndEvictPeers(const Consensus::Params
     }
 }
 
-class CompareInvMempoolOrder
+/** How long a transaction keeps its rank in the announcement batch. Longer than most trickle intervals. */
+static const int64_t INV_BATCH_EXPIRY = 2 * 60 * 1000000;
+
+struct InvTxCandidate {
+    uint64_t nRank;
+    std::set<uint256>::iterator it;
+    TxMempoolInfo info;
+};
+
+class CompareInvTxCandidate
 {
-    CTxMemPool *mp;
 public:
-    explicit CompareInvMempoolOrder(CTxMemPool *_mempool)
-    {
-        mp = _mempool;
-    }
-
-    bool operator()(std::set<uint256>::iterator a, std::set<uint256>::iterator b)
+    bool operator()(const InvTxCandidate& a, const InvTxCandidate& b) const
     {
         /* As std::make_heap produces a max-heap, we want the entries with the
-         * fewest ancestors/highest fee to sort later. */
-        return mp->CompareDepthAndScore(*b, *a);
+         * lowest rank to sort later. */
+        return a.nRank > b.nRank;
     }
 };
 
+/**
+ * Look up the announcement rank of every transaction in setInventoryTxToSend.
+ * Transactions that no peer has trickled yet are ranked among themselves with
+ * the mempool and appended to the shared batch. Ones that already left the
+ * mempool get no info and sort last.
+ */
+static void GetInvTxCandidates(const std::set<uint256>& setInventoryTxToSend, int64_t nNow, std::vector<InvTxCandidate>& vInvTx)
+{
+    vInvTx.reserve(setInventoryTxToSend.size());
+    std::vector<std::set<uint256>::iterator> vUnranked;
+
+    LOCK(g_cs_inv_batch);
+    while (!vInvBatchExpiration.empty() && vInvBatchExpiration.front().first < nNow) {
+        mapInvBatch.erase(vInvBatchExpiration.front().second);
+        vInvBatchExpiration.pop_front();
+    }
+
+    for (std::set<uint256>::iterator it = setInventoryTxToSend.begin(); it != setInventoryTxToSend.end(); it++) {
+        auto mi = mapInvBatch.find(*it);
+        if (mi != mapInvBatch.end()) {
+            vInvTx.push_back(InvTxCandidate{mi->second.nRank, it, mi->second.info});
+        } else {
+            vUnranked.push_back(it);
+        }
+    }
+    if (vUnranked.empty())
+        return;
+
+    LOCK(mempool.cs);
+    std::sort(vUnranked.begin(), vUnranked.end(), [](std::set<uint256>::iterator a, std::set<uint256>::iterator b) {
+        return mempool.CompareDepthAndScore(*a, *b);
+    });
+    for (std::set<uint256>::iterator it : vUnranked) {
+        TxMempoolInfo info = mempool.info(*it);
+        if (!info.tx) {
+            vInvTx.push_back(InvTxCandidate{std::numeric_limits<uint64_t>::max(), it, TxMempoolInfo()});
+            continue;
+        }
+        auto ret = mapInvBatch.emplace(*it, InvBatchEntry{nInvBatchNextRank++, info});
+        vInvBatchExpiration.push_back(std::make_pair(nNow + INV_BATCH_EXPIRY, ret.first));
+        vInvTx.push_back(InvTxCandidate{ret.first->second.nRank, it, std::move(info)});
+    }
+}
+
 bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptMsgProc)
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -3214,6 +4340,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         if (SendRejectsAndCheckIfBanned(pto, connman))
             return true;
         CNodeState &state = *State(pto->GetId());
+        PublishNodeStateStats(pto->GetId(), &state);
 
         // Address refresh broadcast
         int64_t nNow = GetTimeMicros();
@@ -3227,6 +4354,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         //
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
+            LOCK(pto->cs_vAddrToSend);
             std::vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             for (const CAddress& addr : pto->vAddrToSend)
@@ -3272,7 +4400,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                 if (pindexStart->pprev)
                     pindexStart = pindexStart->pprev;
                 LogPrint(BCLog::NET, "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->GetId(), pto->nStartingHeight);
-                connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), uint256()));
+                connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETHEADERS, GetCachedLocator(pindexStart), uint256()));
             }
         }
 
@@ -3364,10 +4492,12 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                     {
                         LOCK(cs_most_recent_block);
                         if (most_recent_block_hash == pBestIndex->GetBlockHash()) {
-                            if (state.fWantsCmpctWitness || !fWitnessesPresentInMostRecentCompactBlock)
-                                connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *most_recent_compact_block));
+                            std::vector<bool> vPrefill;
+                            bool fOwnPrefill = GetPeerCmpctBlockPrefill(pto, *most_recent_block, *most_recent_block_prefill, vPrefill);
+                            if (!fOwnPrefill && (state.fWantsCmpctWitness || !fWitnessesPresentInMostRecentCompactBlock))
+                                connman->PushMessage(pto, msgMaker.MakeShared(NetMsgType::CMPCTBLOCK, most_recent_compact_block_payload));
                             else {
-                                CBlockHeaderAndShortTxIDs cmpctblock(*most_recent_block, state.fWantsCmpctWitness);
+                                CBlockHeaderAndShortTxIDs cmpctblock(*most_recent_block, state.fWantsCmpctWitness, vPrefill);
                                 connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
                             }
                             fGotBlockFromCache = true;
@@ -3380,6 +4510,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                         CBlockHeaderAndShortTxIDs cmpctblock(block, state.fWantsCmpctWitness);
                         connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
                     }
+                    pto->nCmpctBlocksSent++;
                     state.pindexBestHeaderSent = pBestIndex;
                 } else if (state.fPreferHeaders) {
                     if (vHeaders.size() > 1) {
@@ -3391,7 +4522,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                         LogPrint(BCLog::NET, "%s: sending header %s to peer=%d\n", __func__,
                                 vHeaders.front().GetHash().ToString(), pto->GetId());
                     }
-                    connman->PushMessage(pto, msgMaker.Make(NetMsgType::HEADERS, vHeaders));
+                    PushHeaders(pto, connman, msgMaker, vHeaders, state.fWantsCompressedHeaders);
                     state.pindexBestHeaderSent = pBestIndex;
                 } else
                     fRevertToInv = true;
@@ -3492,40 +4623,50 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
 
             // Determine transactions to relay
             if (fSendTrickle) {
-                // Produce a vector with all candidates for sending
-                std::vector<std::set<uint256>::iterator> vInvTx;
-                vInvTx.reserve(pto->setInventoryTxToSend.size());
-                for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end(); it++) {
-                    vInvTx.push_back(it);
+                // Drop what the peer already knows about before ranking the rest,
+                // checking the whole set against the filter in one batch.
+                {
+                    std::vector<uint256> vHashes(pto->setInventoryTxToSend.begin(), pto->setInventoryTxToSend.end());
+                    std::vector<bool> vKnown = pto->filterInventoryKnown.contains(vHashes);
+                    auto it = pto->setInventoryTxToSend.begin();
+                    for (size_t i = 0; i < vKnown.size(); i++) {
+                        if (vKnown[i]) {
+                            it = pto->setInventoryTxToSend.erase(it);
+                        } else {
+                            ++it;
+                        }
+                    }
                 }
+                // Produce a vector with all candidates for sending, ranked
+                // topologically and by fee rate for privacy and priority reasons.
+                std::vector<InvTxCandidate> vInvTx;
+                GetInvTxCandidates(pto->setInventoryTxToSend, nNow, vInvTx);
                 CAmount filterrate = 0;
                 {
                     LOCK(pto->cs_feeFilter);
                     filterrate = pto->minFeeFilter;
                 }
-                // Topologically and fee-rate sort the inventory we send for privacy and priority reasons.
                 // A heap is used so that not all items need sorting if only a few are being sent.
-                CompareInvMempoolOrder compareInvMempoolOrder(&mempool);
-                std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
+                CompareInvTxCandidate compareInvTxCandidate;
+                std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvTxCandidate);
                 // No reason to drain out at many times the network's capacity,
                 // especially since we have many peers and some will draw much shorter delays.
                 unsigned int nRelayedTransactions = 0;
                 LOCK(pto->cs_filter);
                 while (!vInvTx.empty() && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
                     // Fetch the top element from the heap
-                    std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
-                    std::set<uint256>::iterator it = vInvTx.back();
-                    vInvTx.pop_back();
-                    uint256 hash = *it;
+                    std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvTxCandidate);
+                    uint256 hash = *vInvTx.back().it;
+                    TxMempoolInfo txinfo = std::move(vInvTx.back().info);
                     // Remove it from the to-be-sent set
-                    pto->setInventoryTxToSend.erase(it);
+                    pto->setInventoryTxToSend.erase(vInvTx.back().it);
+                    vInvTx.pop_back();
                     // Check if not in the filter already
                     if (pto->filterInventoryKnown.contains(hash)) {
                         continue;
                     }
                     // Not in the mempool anymore? don't bother sending it.
-                    auto txinfo = mempool.info(hash);
-                    if (!txinfo.tx) {
+                    if (!txinfo.tx || !mempool.exists(hash)) {
                         continue;
                     }
                     if (filterrate && txinfo.feeRate.GetFeePerK() < filterrate) {
@@ -3536,6 +4677,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                     vInv.push_back(CInv(MSG_TX, hash));
                     nRelayedTransactions++;
                     {
+                        LOCK(g_cs_relay);
                         // Expire old relay messages
                         while (!vRelayExpiration.empty() && vRelayExpiration.front().first < nNow)
                         {
@@ -3555,6 +4697,22 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                     pto->filterInventoryKnown.insert(hash);
                 }
             }
+
+            // Start a reconciliation round with peers we connected to
+            if (state.m_recon && !pto->fInbound && state.m_next_recon_request < nNow) {
+                state.m_next_recon_request = PoissonNextSend(nNow, RECON_REQUEST_INTERVAL);
+                if (state.m_recon_requested) {
+                    // No sketch for the previous round, announce its transactions the usual way
+                    for (const auto& entry : state.m_recon_snapshot)
+                        pto->setInventoryTxToSend.insert(entry.second);
+                }
+                state.m_recon_snapshot.clear();
+                for (const uint256& hash : pto->setReconTxToSend)
+                    state.m_recon_snapshot.emplace(GetReconShortId(state.m_recon_k0, state.m_recon_k1, hash), hash);
+                pto->setReconTxToSend.clear();
+                state.m_recon_requested = true;
+                connman->PushMessage(pto, msgMaker.Make(NetMsgType::REQRECON, (uint32_t)state.m_recon_snapshot.size()));
+            }
         }
         if (!vInv.empty())
             connman->PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
@@ -3624,10 +4782,25 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        int nBlocksInFlightLimit = GetBlocksInFlightLimit(&state);
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < nBlocksInFlightLimit) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            const CBlockIndex* pindexStalling = nullptr;
+            FindNextBlocksToDownload(pto->GetId(), nBlocksInFlightLimit - state.nBlocksInFlight, vToDownload, staller, pindexStalling, consensusParams);
+            if (state.nBlocksInFlight == 0 && staller != -1 && pindexStalling && state.nBlockServiceTime != 0) {
+                // The window is held up by a block in flight from a slower
+                // peer. Fetch it from this one instead of waiting for the
+                // staller to time out; whichever copy arrives first is used.
+                const CNodeState* stallerState = State(staller);
+                int64_t nInFlightFor = nNow - mapBlocksInFlight[pindexStalling->GetBlockHash()].second->nTimeRequested;
+                if (stallerState->nBlockServiceTime == 0 ? nInFlightFor > 2 * state.nBlockServiceTime : stallerState->nBlockServiceTime > 2 * state.nBlockServiceTime) {
+                    LogPrint(BCLog::NET, "Re-requesting block %s (%d) held up by peer=%d from peer=%d\n", pindexStalling->GetBlockHash().ToString(),
+                        pindexStalling->nHeight, staller, pto->GetId());
+                    vToDownload.push_back(pindexStalling);
+                    staller = -1;
+                }
+            }
             for (const CBlockIndex *pindex : vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
@@ -3646,23 +4819,22 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         //
         // Message: getdata (non-blocks)
         //
-        while (!pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow)
+        for (const CInv& inv : g_txrequest.GetRequestable(pto->GetId(), nNow))
         {
-            const CInv& inv = (*pto->mapAskFor.begin()).second;
             if (!AlreadyHave(inv))
             {
                 LogPrint(BCLog::NET, "Requesting %s peer=%d\n", inv.ToString(), pto->GetId());
                 vGetData.push_back(inv);
+                g_txrequest.RequestedTx(pto->GetId(), inv.hash, nNow + TX_REQUEST_EXPIRY);
                 if (vGetData.size() >= 1000)
                 {
                     connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETDATA, vGetData));
                     vGetData.clear();
                 }
             } else {
-                //If we're not going to ask, don't expect a response.
-                pto->setAskFor.erase(inv.hash);
+                // If we're not going to ask, don't expect a response from any peer.
+                g_txrequest.ForgetTxHash(inv.hash);
             }
-            pto->mapAskFor.erase(pto->mapAskFor.begin());
         }
         if (!vGetData.empty())
             connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETDATA, vGetData));
@@ -3706,5 +4878,7 @@ public:
         // orphan transactions
         mapOrphanTransactions.clear();
         mapOrphanTransactionsByPrev.clear();
+        mapLowFeeTxs.clear();
+        g_low_fee_order.clear();
     }
 } instance_of_cnetprocessingcleanup;
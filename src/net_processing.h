@@ -12,10 +12,14 @@
 
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -maxorphansize, maximum memory used by orphan transactions in megabytes */
+static const unsigned int DEFAULT_MAX_ORPHAN_SIZE = 10;
 /** Expiration time for orphan transactions in seconds */
 static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 /** Minimum time between orphan transactions expire time checks in seconds */
 static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
+/** Number of transactions rejected for their fee alone kept for a child to pay for them */
+static const unsigned int MAX_LOW_FEE_TXS = 100;
 /** Default number of orphan+recently-replaced txn to keep around for block reconstruction */
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
 /** Headers download timeout expressed in microseconds
@@ -34,6 +38,16 @@ static constexpr int64_t STALE_CHECK_INTERVAL = 10 * 60; // 10 minutes
 static constexpr int64_t EXTRA_PEER_CHECK_INTERVAL = 45;
 /** Minimum time an outbound-peer-eviction candidate must be connected for, in order to evict, in seconds */
 static constexpr int64_t MINIMUM_CONNECT_TIME = 30;
+/** Default for -maxhbcmpctpeers, the number of peers asked to announce new blocks to us as compact blocks (BIP152) */
+static const unsigned int DEFAULT_MAX_HB_CMPCT_PEERS = 3;
+/** Number of blocks near the tip kept serialized in memory for serving getdata requests */
+static const unsigned int RECENT_BLOCK_CACHE_SIZE = 6;
+/** Default for -peerbloomprematch, matching every bloom filtered peer against a new tip block as it is connected */
+static const bool DEFAULT_PEERBLOOMPREMATCH = false;
+/** Most threads matching filtered peers against a new block */
+static const unsigned int MAX_PREMATCH_THREADS = 8;
+/** Default for -peercfilters, serving compact block filters (BIP 157) from the block filter index */
+static const bool DEFAULT_PEERCFILTERS = false;
 
 class PeerLogicValidation : public CValidationInterface, public NetEventsInterface {
 private:
@@ -75,11 +89,36 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int64_t nBlockServiceTime;
+    int64_t nBlockDownloadRate;
+    int nBlocksInFlightLimit;
+    size_t nMemoryUsage;
 };
 
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
+/** Get the number of cached recent blocks and how often requests for them were served from memory */
+void GetRecentBlockCacheStats(size_t& nBlocks, uint64_t& nHits, uint64_t& nMisses);
+
+struct FilteredBlockStats {
+    uint64_t nServed;        //!< merkleblock messages sent
+    uint64_t nPrematched;    //!< of which were matched when the block was connected
+    uint64_t nStale;         //!< prematched blocks not used because the peer's filter had changed since
+    uint64_t nTxSent;        //!< matched transactions sent along with the merkleblocks
+    uint64_t nMatchMicros;   //!< time spent matching blocks against filters, in microseconds
+};
+/** Get statistics about serving bloom filtered blocks */
+FilteredBlockStats GetFilteredBlockStats();
+
+class CBlockHeaderAndShortTxIDs;
+class CChainParams;
+/**
+ * Reconstruct and process a compact block received over the UDP block relay,
+ * if it builds on our tip and all of its transactions are known. Returns
+ * whether it was a new block.
+ */
+bool ProcessUDPCmpctBlock(const CBlockHeaderAndShortTxIDs& cmpctblock, const CChainParams& chainparams);
 
 #endif // BITCOIN_NET_PROCESSING_H
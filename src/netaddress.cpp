@@ -5,9 +5,12 @@
 
 #include <netaddress.h>
 #include <hash.h>
+#include <random.h>
 #include <utilstrencodings.h>
 #include <tinyformat.h>
 
+#include <limits>
+
 static const unsigned char pchIPv4[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
 static const unsigned char pchOnionCat[] = {0xFD,0x87,0xD8,0x7E,0xEB,0x43};
 
@@ -733,3 +736,101 @@ bool operator<(const CSubNet& a, const CSubNet& b)
 {
     return (a.network < b.network || (a.network == b.network && memcmp(a.netmask, b.netmask, 16) < 0));
 }
+
+CNetAddrHasher::CNetAddrHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+size_t CNetAddrHasher::operator()(const CNetAddr& addr) const
+{
+    unsigned char ip[16];
+    for (int n = 0; n < 16; n++)
+        ip[n] = addr.GetByte(n);
+    return CSipHasher(k0, k1).Write(ip, sizeof(ip)).Finalize();
+}
+
+int CSubNetIndex::PrefixLength(const CSubNet& subnet)
+{
+    int n = 0;
+    while (n < 16 && subnet.netmask[n] == 0xff)
+        n++;
+    if (n == 16)
+        return 128;
+    const int bits = NetmaskBits(subnet.netmask[n]);
+    if (bits < 0)
+        return -1;
+    for (int x = n + 1; x < 16; x++) {
+        if (subnet.netmask[x] != 0x00)
+            return -1;
+    }
+    return n * 8 + bits;
+}
+
+void CSubNetIndex::Insert(const CSubNet& subnet, int64_t nValue)
+{
+    if (!subnet.IsValid())
+        return;
+    const int nLength = PrefixLength(subnet);
+    if (nLength < 0) {
+        mapOther[subnet] = nValue;
+    } else {
+        mapPrefixes[nLength][subnet.network] = nValue;
+    }
+}
+
+void CSubNetIndex::Erase(const CSubNet& subnet)
+{
+    const int nLength = PrefixLength(subnet);
+    if (nLength < 0) {
+        mapOther.erase(subnet);
+        return;
+    }
+    auto it = mapPrefixes.find(nLength);
+    if (it != mapPrefixes.end() && it->second.erase(subnet.network) && it->second.empty())
+        mapPrefixes.erase(it);
+}
+
+void CSubNetIndex::Clear()
+{
+    mapPrefixes.clear();
+    mapOther.clear();
+}
+
+bool CSubNetIndex::Empty() const
+{
+    return mapPrefixes.empty() && mapOther.empty();
+}
+
+bool CSubNetIndex::Find(const CNetAddr& addr, int64_t& nMaxValue) const
+{
+    if (!addr.IsValid())
+        return false;
+
+    bool fFound = false;
+    // Longest prefixes first, so that each length only clears more bits of
+    // the same copy of the address
+    CNetAddr masked(addr);
+    for (auto it = mapPrefixes.rbegin(); it != mapPrefixes.rend(); ++it) {
+        const int nLength = it->first;
+        for (int n = nLength / 8 + 1; n < 16; n++)
+            masked.ip[n] = 0;
+        if (nLength < 128)
+            masked.ip[nLength / 8] &= (uint8_t)(0xff00 >> (nLength % 8));
+        auto itNetwork = it->second.find(masked);
+        if (itNetwork != it->second.end() && (!fFound || itNetwork->second > nMaxValue)) {
+            nMaxValue = itNetwork->second;
+            fFound = true;
+        }
+    }
+    for (const auto& entry : mapOther) {
+        if (entry.first.Match(addr) && (!fFound || entry.second > nMaxValue)) {
+            nMaxValue = entry.second;
+            fFound = true;
+        }
+    }
+    return fFound;
+}
+
+bool CSubNetIndex::Match(const CNetAddr& addr) const
+{
+    int64_t nValue;
+    return Find(addr, nValue);
+}
@@ -12,8 +12,10 @@
 #include <compat.h>
 #include <serialize.h>
 
+#include <map>
 #include <stdint.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 enum Network
@@ -97,6 +99,7 @@ class CNetAddr
         }
 
         friend class CSubNet;
+        friend class CSubNetIndex;
 };
 
 class CSubNet
@@ -125,6 +128,7 @@ class CSubNet
         friend bool operator==(const CSubNet& a, const CSubNet& b);
         friend bool operator!=(const CSubNet& a, const CSubNet& b);
         friend bool operator<(const CSubNet& a, const CSubNet& b);
+        friend class CSubNetIndex;
 
         ADD_SERIALIZE_METHODS;
 
@@ -136,6 +140,53 @@ class CSubNet
         }
 };
 
+/**
+ * Salted hasher for indexes of addresses, so that peers cannot choose
+ * addresses that all land in the same hash bucket.
+ */
+class CNetAddrHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    CNetAddrHasher();
+
+    size_t operator()(const CNetAddr& addr) const;
+};
+
+/**
+ * A set of subnets, each with a value, that finds the subnets containing an
+ * address without matching it against each of them. Subnets whose netmask is
+ * a prefix are kept by the length of the prefix, and looked up by the address
+ * masked to each length in use, so a lookup costs at most one hash lookup per
+ * prefix length however many subnets there are. The rare netmasks that are
+ * not a prefix are matched one by one.
+ */
+class CSubNetIndex
+{
+private:
+    //! Subnets whose netmask is a prefix, by its length in bits, then by network
+    std::map<int, std::unordered_map<CNetAddr, int64_t, CNetAddrHasher>> mapPrefixes;
+    //! Subnets whose netmask is not a prefix
+    std::map<CSubNet, int64_t> mapOther;
+
+    //! Length of the netmask of subnet if it is a prefix, -1 otherwise
+    static int PrefixLength(const CSubNet& subnet);
+
+public:
+    /** Add a subnet, or change its value; invalid subnets match nothing and are not added */
+    void Insert(const CSubNet& subnet, int64_t nValue);
+    void Erase(const CSubNet& subnet);
+    void Clear();
+    bool Empty() const;
+
+    /** Whether any subnet contains addr; if so, nMaxValue is the largest value among them */
+    bool Find(const CNetAddr& addr, int64_t& nMaxValue) const;
+    bool Match(const CNetAddr& addr) const;
+};
+
 /** A combination of a network address (CNetAddr) and a (TCP) port */
 //服务：地址＋端口
 class CService : public CNetAddr
@@ -30,6 +30,23 @@ public:
         return Make(0, std::move(sCommand), std::forward<Args>(args)...);
     }
 
+    /** Serialize a payload once so it can be sent to several peers with MakeShared. */
+    template <typename... Args>
+    std::shared_ptr<const CSharedNetPayload> MakePayload(int nFlags, Args&&... args) const
+    {
+        std::vector<unsigned char> data;
+        CVectorWriter{ SER_NETWORK, nFlags | nVersion, data, 0, std::forward<Args>(args)... };
+        return std::make_shared<const CSharedNetPayload>(std::move(data));
+    }
+
+    CSerializedNetMsg MakeShared(std::string sCommand, std::shared_ptr<const CSharedNetPayload> payload) const
+    {
+        CSerializedNetMsg msg;
+        msg.command = std::move(sCommand);
+        msg.shared_payload = std::move(payload);
+        return msg;
+    }
+
 private:
     const int nVersion;
 };
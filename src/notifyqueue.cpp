@@ -0,0 +1,119 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <notifyqueue.h>
+
+#include <util.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/thread.hpp>
+
+CNotifyQueue g_notifyqueue;
+
+static std::string FormatCommand(std::string strCommand, const std::vector<std::string>& vArgs)
+{
+    boost::replace_all(strCommand, "%s", boost::algorithm::join(vArgs, " "));
+    return strCommand;
+}
+
+CNotifyQueue::~CNotifyQueue()
+{
+    Stop();
+}
+
+void CNotifyQueue::ThreadRun()
+{
+    RenameThread("bitcoin-notify");
+    std::unique_lock<std::mutex> lock(cs);
+    while (true) {
+        cond.wait(lock, [this] { return fStop || !queue.empty(); });
+        if (fStop)
+            return;
+
+        Job job = std::move(queue.front());
+        queue.pop_front();
+        stats.nRunning++;
+        lock.unlock();
+        runCommand(FormatCommand(job.strCommand, job.vArgs));
+        lock.lock();
+        stats.nRunning--;
+        stats.nCommands++;
+    }
+}
+
+void CNotifyQueue::Start(int nThreads, size_t nMaxQueueIn, size_t nMaxBatchIn)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    if (!threads.empty() || nThreads <= 0)
+        return;
+    nMaxQueue = std::max<size_t>(nMaxQueueIn, 1);
+    nMaxBatch = std::max<size_t>(nMaxBatchIn, 1);
+    fStop = false;
+    stats.nThreads = nThreads;
+    stats.nMaxQueue = nMaxQueue;
+    stats.nMaxBatch = nMaxBatch;
+    for (int i = 0; i < nThreads; i++) {
+        threads.emplace_back(&CNotifyQueue::ThreadRun, this);
+    }
+}
+
+void CNotifyQueue::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (threads.empty())
+            return;
+        fStop = true;
+        if (!queue.empty())
+            LogPrintf("Dropping %u queued notification commands\n", queue.size());
+        stats.nDropped += queue.size();
+        queue.clear();
+    }
+    cond.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    std::lock_guard<std::mutex> lock(cs);
+    threads.clear();
+    stats.nThreads = 0;
+}
+
+void CNotifyQueue::Notify(const std::string& strCommand, const std::string& strArg)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    if (threads.empty() || fStop) {
+        lock.unlock();
+        boost::thread t(runCommand, FormatCommand(strCommand, {strArg})); // thread runs free
+        return;
+    }
+
+    stats.nNotifications++;
+    if (nMaxBatch > 1) {
+        for (auto it = queue.rbegin(); it != queue.rend(); ++it) {
+            if (it->strCommand == strCommand && it->vArgs.size() < nMaxBatch) {
+                it->vArgs.push_back(strArg);
+                stats.nCoalesced++;
+                return;
+            }
+        }
+    }
+    if (queue.size() >= nMaxQueue) {
+        if (!fDropping)
+            LogPrintf("Notification queue is full, dropping notifications until it drains\n");
+        fDropping = true;
+        stats.nDropped++;
+        return;
+    }
+    fDropping = false;
+    queue.push_back(Job{strCommand, {strArg}});
+    cond.notify_one();
+}
+
+CNotifyQueueStats CNotifyQueue::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    CNotifyQueueStats ret = stats;
+    ret.nQueued = queue.size();
+    return ret;
+}
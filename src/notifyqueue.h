@@ -0,0 +1,95 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NOTIFYQUEUE_H
+#define BITCOIN_NOTIFYQUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** Default for -notifythreads, 0 runs every command on a thread of its own */
+static const int DEFAULT_NOTIFY_THREADS = 0;
+/** Default for -notifyqueue */
+static const int DEFAULT_NOTIFY_QUEUE = 1000;
+/** Default for -notifybatch */
+static const int DEFAULT_NOTIFY_BATCH = 1;
+
+/** The counters of a CNotifyQueue */
+struct CNotifyQueueStats
+{
+    int nThreads = 0;
+    size_t nMaxQueue = 0;
+    size_t nMaxBatch = 0;
+    //! Commands waiting for a thread, and being run
+    size_t nQueued = 0;
+    size_t nRunning = 0;
+    //! Notifications queued, merged into a queued command, and dropped because the queue was full
+    uint64_t nNotifications = 0;
+    uint64_t nCoalesced = 0;
+    uint64_t nDropped = 0;
+    //! Commands that were run
+    uint64_t nCommands = 0;
+};
+
+/**
+ * Runs the commands of -blocknotify, -walletnotify and -alertnotify on a
+ * fixed number of threads, rather than on a thread of their own each.
+ *
+ * A notification is a command with %s in it, and the argument to replace it
+ * with. Up to nMaxQueue commands wait for a thread; notifications that come
+ * in while the queue is full are dropped and counted. With nMaxBatch above
+ * one, a notification for a command that is already queued is added to it,
+ * so that the command is run once with up to nMaxBatch arguments, separated
+ * by spaces.
+ *
+ * When the threads are not running, every command is run on a thread of its
+ * own, as it is queued.
+ */
+class CNotifyQueue
+{
+private:
+    struct Job
+    {
+        std::string strCommand;
+        std::vector<std::string> vArgs;
+    };
+
+    mutable std::mutex cs;
+    std::condition_variable cond;
+    std::deque<Job> queue;
+    std::vector<std::thread> threads;
+    size_t nMaxQueue = 0;
+    size_t nMaxBatch = 1;
+    bool fStop = false;
+    //! Whether the last notification was dropped, so that only the first of a run of them is logged
+    bool fDropping = false;
+    CNotifyQueueStats stats;
+
+    void ThreadRun();
+
+public:
+    CNotifyQueue() {}
+    ~CNotifyQueue();
+    CNotifyQueue(const CNotifyQueue&) = delete;
+    CNotifyQueue& operator=(const CNotifyQueue&) = delete;
+
+    /** Start nThreads threads, with up to nMaxQueueIn commands waiting for them */
+    void Start(int nThreads, size_t nMaxQueueIn, size_t nMaxBatchIn);
+    /** Wait for the commands being run, drop those still queued and stop the threads */
+    void Stop();
+
+    /** Run strCommand with %s replaced by strArg */
+    void Notify(const std::string& strCommand, const std::string& strArg);
+
+    CNotifyQueueStats GetStats() const;
+};
+
+extern CNotifyQueue g_notifyqueue;
+
+#endif // BITCOIN_NOTIFYQUEUE_H
@@ -83,11 +83,17 @@ private:
 
     // Count the total # of txs confirmed within Y blocks in each bucket
     // Track the historical moving average of theses totals over blocks
-    std::vector<std::vector<double>> confAvg; // confAvg[Y][X]
+    // The per-period averages are kept period after period in one array, so
+    // decaying them is a single pass over contiguous memory.
+    std::vector<double> confAvg; // confAvg[Y * nBuckets + X]
 
     // Track moving avg of txs which have been evicted from the mempool
     // after failing to be confirmed within Y blocks
-    std::vector<std::vector<double>> failAvg; // failAvg[Y][X]
+    std::vector<double> failAvg; // failAvg[Y * nBuckets + X]
+
+    // Number of periods and buckets the averages above are kept for
+    unsigned int nPeriods;
+    size_t nBuckets;
 
     // Sum the total feerate of all tx's in each bucket
     // Track the historical moving average of this total over blocks
@@ -110,6 +116,8 @@ private:
 
     void resizeInMemoryCounters(size_t newbuckets);
 
+    size_t AvgIndex(unsigned int period, unsigned int bucket) const { return period * nBuckets + bucket; }
+
 public:
     /**
      * Create new TxConfirmStats. This is called by BlockPolicyEstimator's
@@ -159,7 +167,7 @@ public:
                              EstimationResult *result = nullptr) const;
 
     /** Return the max number of confirms we're tracking */
-    unsigned int GetMaxConfirms() const { return scale * confAvg.size(); }
+    unsigned int GetMaxConfirms() const { return scale * nPeriods; }
 
     /** Write state of estimation data to a file*/
     void Write(CAutoFile& fileout) const;
@@ -180,14 +188,10 @@ TxConfirmStats::TxConfirmStats(const std::vector<double>& defaultBuckets,
     decay = _decay;
     assert(_scale != 0 && "_scale must be non-zero");
     scale = _scale;
-    confAvg.resize(maxPeriods);
-    for (unsigned int i = 0; i < maxPeriods; i++) {
-        confAvg[i].resize(buckets.size());
-    }
-    failAvg.resize(maxPeriods);
-    for (unsigned int i = 0; i < maxPeriods; i++) {
-        failAvg[i].resize(buckets.size());
-    }
+    nPeriods = maxPeriods;
+    nBuckets = buckets.size();
+    confAvg.resize(nPeriods * nBuckets);
+    failAvg.resize(nPeriods * nBuckets);
 
     txCtAvg.resize(buckets.size());
     avg.resize(buckets.size());
@@ -221,8 +225,8 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
         return;
     int periodsToConfirm = (blocksToConfirm + scale - 1)/scale;
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
-    for (size_t i = periodsToConfirm; i <= confAvg.size(); i++) {
-        confAvg[i - 1][bucketindex]++;
+    for (size_t i = periodsToConfirm; i <= nPeriods; i++) {
+        confAvg[AvgIndex(i - 1, bucketindex)]++;
     }
     txCtAvg[bucketindex]++;
     avg[bucketindex] += val;
@@ -230,14 +234,14 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
 
 void TxConfirmStats::UpdateMovingAverages()
 {
-    for (unsigned int j = 0; j < buckets.size(); j++) {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay;
-        for (unsigned int i = 0; i < failAvg.size(); i++)
-            failAvg[i][j] = failAvg[i][j] * decay;
-        avg[j] = avg[j] * decay;
-        txCtAvg[j] = txCtAvg[j] * decay;
-    }
+    for (double& val : confAvg)
+        val *= decay;
+    for (double& val : failAvg)
+        val *= decay;
+    for (double& val : avg)
+        val *= decay;
+    for (double& val : txCtAvg)
+        val *= decay;
 }
 
 // returns -1 on error conditions
@@ -285,9 +289,9 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
             newBucketRange = false;
         }
         curFarBucket = bucket;
-        nConf += confAvg[periodTarget - 1][bucket];
+        nConf += confAvg[AvgIndex(periodTarget - 1, bucket)];
         totalNum += txCtAvg[bucket];
-        failNum += failAvg[periodTarget - 1][bucket];
+        failNum += failAvg[AvgIndex(periodTarget - 1, bucket)];
         for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
             extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
         extraNum += oldUnconfTxs[bucket];
@@ -399,8 +403,16 @@ void TxConfirmStats::Write(CAutoFile& fileout) const
     fileout << scale;
     fileout << avg;
     fileout << txCtAvg;
-    fileout << confAvg;
-    fileout << failAvg;
+    // The file keeps one vector of bucket averages per period
+    std::vector<std::vector<double>> periodAvgs(nPeriods);
+    for (unsigned int i = 0; i < nPeriods; i++) {
+        periodAvgs[i].assign(confAvg.begin() + AvgIndex(i, 0), confAvg.begin() + AvgIndex(i + 1, 0));
+    }
+    fileout << periodAvgs;
+    for (unsigned int i = 0; i < nPeriods; i++) {
+        periodAvgs[i].assign(failAvg.begin() + AvgIndex(i, 0), failAvg.begin() + AvgIndex(i + 1, 0));
+    }
+    fileout << periodAvgs;
 }
 
 void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numBuckets)
@@ -428,29 +440,42 @@ void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numBuckets
     if (txCtAvg.size() != numBuckets) {
         throw std::runtime_error("Corrupt estimates file. Mismatch in tx count bucket count");
     }
-    filein >> confAvg;
-    maxPeriods = confAvg.size();
+    std::vector<std::vector<double>> fileConfAvg;
+    filein >> fileConfAvg;
+    maxPeriods = fileConfAvg.size();
     maxConfirms = scale * maxPeriods;
 
     if (maxConfirms <= 0 || maxConfirms > 6 * 24 * 7) { // one week
         throw std::runtime_error("Corrupt estimates file.  Must maintain estimates for between 1 and 1008 (one week) confirms");
     }
     for (unsigned int i = 0; i < maxPeriods; i++) {
-        if (confAvg[i].size() != numBuckets) {
+        if (fileConfAvg[i].size() != numBuckets) {
             throw std::runtime_error("Corrupt estimates file. Mismatch in feerate conf average bucket count");
         }
     }
 
-    filein >> failAvg;
-    if (maxPeriods != failAvg.size()) {
+    std::vector<std::vector<double>> fileFailAvg;
+    filein >> fileFailAvg;
+    if (maxPeriods != fileFailAvg.size()) {
         throw std::runtime_error("Corrupt estimates file. Mismatch in confirms tracked for failures");
     }
     for (unsigned int i = 0; i < maxPeriods; i++) {
-        if (failAvg[i].size() != numBuckets) {
+        if (fileFailAvg[i].size() != numBuckets) {
             throw std::runtime_error("Corrupt estimates file. Mismatch in one of failure average bucket counts");
         }
     }
 
+    nPeriods = maxPeriods;
+    nBuckets = numBuckets;
+    confAvg.clear();
+    failAvg.clear();
+    confAvg.reserve(nPeriods * nBuckets);
+    failAvg.reserve(nPeriods * nBuckets);
+    for (unsigned int i = 0; i < maxPeriods; i++) {
+        confAvg.insert(confAvg.end(), fileConfAvg[i].begin(), fileConfAvg[i].end());
+        failAvg.insert(failAvg.end(), fileFailAvg[i].begin(), fileFailAvg[i].end());
+    }
+
     // Resize the current block variables which aren't stored in the data file
     // to match the number of confirms and buckets
     resizeInMemoryCounters(numBuckets);
@@ -498,17 +523,16 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
     if (!inBlock && (unsigned int)blocksAgo >= scale) { // Only counts as a failure if not confirmed for entire period
         assert(scale != 0);
         unsigned int periodsAgo = blocksAgo / scale;
-        for (size_t i = 0; i < periodsAgo && i < failAvg.size(); i++) {
-            failAvg[i][bucketindex]++;
+        for (size_t i = 0; i < periodsAgo && i < nPeriods; i++) {
+            failAvg[AvgIndex(i, bucketindex)]++;
         }
     }
 }
 
 // This function is called from CTxMemPool::removeUnchecked to ensure
 // txs removed from the mempool for any reason are no longer
-// tracked. Txs that were part of a block have already been removed in
-// processBlockTx to ensure they are never double tracked, but it is
-// of no harm to try to remove them again.
+// tracked. Txs that were part of a block or conflicted with one are
+// removed by processBlock instead, which may run later.
 bool CBlockPolicyEstimator::removeTx(uint256 hash, bool inBlock)
 {
     LOCK(cs_feeEstimator);
@@ -540,12 +564,19 @@ CBlockPolicyEstimator::CBlockPolicyEstimator()
     feeStats = std::unique_ptr<TxConfirmStats>(new TxConfirmStats(buckets, bucketMap, MED_BLOCK_PERIODS, MED_DECAY, MED_SCALE));
     shortStats = std::unique_ptr<TxConfirmStats>(new TxConfirmStats(buckets, bucketMap, SHORT_BLOCK_PERIODS, SHORT_DECAY, SHORT_SCALE));
     longStats = std::unique_ptr<TxConfirmStats>(new TxConfirmStats(buckets, bucketMap, LONG_BLOCK_PERIODS, LONG_DECAY, LONG_SCALE));
+    ClearEstimateCache();
 }
 
 CBlockPolicyEstimator::~CBlockPolicyEstimator()
 {
 }
 
+void CBlockPolicyEstimator::ClearEstimateCache()
+{
+    LOCK(cs_estimate_cache);
+    m_estimate_cache.assign(2 * (longStats->GetMaxConfirms() + 1), CachedEstimate());
+}
+
 void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, bool validFeeEstimate)
 {
     LOCK(cs_feeEstimator);
@@ -585,9 +616,14 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
     assert(bucketIndex == bucketIndex3);
 }
 
-bool CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry* entry)
+CBlockPolicyEstimator::BlockTx::BlockTx(const CTxMemPoolEntry& entry)
+    : hash(entry.GetTx().GetHash()), entryHeight(entry.GetHeight()), feeRate(entry.GetFee(), entry.GetTxSize())
+{
+}
+
+bool CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const BlockTx& tx)
 {
-    if (!removeTx(entry->GetTx().GetHash(), true)) {
+    if (!removeTx(tx.hash, true)) {
         // This transaction wasn't being tracked for fee estimation
         return false;
     }
@@ -595,7 +631,7 @@ bool CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxM
     // How many blocks did it take for miners to include this transaction?
     // blocksToConfirm is 1-based, so a transaction included in the earliest
     // possible block has confirmation count of 1
-    int blocksToConfirm = nBlockHeight - entry->GetHeight();
+    int blocksToConfirm = nBlockHeight - tx.entryHeight;
     if (blocksToConfirm <= 0) {
         // This can't happen because we don't process transactions from a block with a height
         // lower than our greatest seen height
@@ -604,16 +640,14 @@ bool CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxM
     }
 
     // Feerates are stored and reported as BTC-per-kb:
-    CFeeRate feeRate(entry->GetFee(), entry->GetTxSize());
-
-    feeStats->Record(blocksToConfirm, (double)feeRate.GetFeePerK());
-    shortStats->Record(blocksToConfirm, (double)feeRate.GetFeePerK());
-    longStats->Record(blocksToConfirm, (double)feeRate.GetFeePerK());
+    feeStats->Record(blocksToConfirm, (double)tx.feeRate.GetFeePerK());
+    shortStats->Record(blocksToConfirm, (double)tx.feeRate.GetFeePerK());
+    longStats->Record(blocksToConfirm, (double)tx.feeRate.GetFeePerK());
     return true;
 }
 
 void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
-                                         std::vector<const CTxMemPoolEntry*>& entries)
+                                         const std::vector<BlockTx>& txs, const std::vector<uint256>& conflicted)
 {
     LOCK(cs_feeEstimator);
     if (nBlockHeight <= nBestSeenHeight) {
@@ -622,6 +656,13 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
         // And if an attacker can re-org the chain at will, then
         // you've got much bigger problems than "attacker can influence
         // transaction fees."
+        // The transactions have left the mempool all the same.
+        for (const BlockTx& tx : txs) {
+            removeTx(tx.hash, false);
+        }
+        for (const uint256& hash : conflicted) {
+            removeTx(hash, false);
+        }
         return;
     }
 
@@ -642,10 +683,13 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
 
     unsigned int countedTxs = 0;
     // Update averages with data points from current block
-    for (const auto& entry : entries) {
-        if (processBlockTx(nBlockHeight, entry))
+    for (const BlockTx& tx : txs) {
+        if (processBlockTx(nBlockHeight, tx))
             countedTxs++;
     }
+    for (const uint256& hash : conflicted) {
+        removeTx(hash, false);
+    }
 
     if (firstRecordedHeight == 0 && countedTxs > 0) {
         firstRecordedHeight = nBestSeenHeight;
@@ -654,11 +698,13 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
 
 
     LogPrint(BCLog::ESTIMATEFEE, "Blockpolicy estimates updated by %u of %u block txs, since last block %u of %u tracked, mempool map size %u, max target %u from %s\n",
-             countedTxs, entries.size(), trackedTxs, trackedTxs + untrackedTxs, mapMemPoolTxs.size(),
+             countedTxs, txs.size(), trackedTxs, trackedTxs + untrackedTxs, mapMemPoolTxs.size(),
              MaxUsableEstimate(), HistoricalBlockSpan() > BlockSpan() ? "historical" : "current");
 
     trackedTxs = 0;
     untrackedTxs = 0;
+
+    ClearEstimateCache();
 }
 
 CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget) const
@@ -810,6 +856,34 @@ double CBlockPolicyEstimator::estimateConservativeFee(unsigned int doubleTarget,
     return estimate;
 }
 
+CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, FeeCalculation *feeCalc, bool conservative) const
+{
+    // Targets outside the cache are invalid and not worth caching
+    size_t index = confTarget > 0 ? 2 * (size_t)confTarget + conservative : 0;
+    {
+        LOCK(cs_estimate_cache);
+        if (index > 0 && index < m_estimate_cache.size() && m_estimate_cache[index].valid) {
+            if (feeCalc) *feeCalc = m_estimate_cache[index].feeCalc;
+            return m_estimate_cache[index].feeRate;
+        }
+    }
+
+    // Holding cs_feeEstimator until the result is stored keeps processBlock
+    // from clearing the cache in between, so no stale estimate can be stored.
+    LOCK(cs_feeEstimator);
+    CachedEstimate estimate;
+    estimate.feeRate = estimateSmartFeeUncached(confTarget, &estimate.feeCalc, conservative);
+    {
+        LOCK(cs_estimate_cache);
+        if (index > 0 && index < m_estimate_cache.size()) {
+            estimate.valid = true;
+            m_estimate_cache[index] = estimate;
+        }
+    }
+    if (feeCalc) *feeCalc = estimate.feeCalc;
+    return estimate.feeRate;
+}
+
 /** estimateSmartFee returns the max of the feerates calculated with a 60%
  * threshold required at target / 2, an 85% threshold required at target and a
  * 95% threshold required at 2 * target.  Each calculation is performed at the
@@ -817,9 +891,9 @@ double CBlockPolicyEstimator::estimateConservativeFee(unsigned int doubleTarget,
  * estimates, however, required the 95% threshold at 2 * target be met for any
  * longer time horizons also.
  */
-CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, FeeCalculation *feeCalc, bool conservative) const
+CFeeRate CBlockPolicyEstimator::estimateSmartFeeUncached(int confTarget, FeeCalculation *feeCalc, bool conservative) const
 {
-    LOCK(cs_feeEstimator);
+    AssertLockHeld(cs_feeEstimator);
 
     if (feeCalc) {
         feeCalc->desiredTarget = confTarget;
@@ -972,6 +1046,7 @@ bool CBlockPolicyEstimator::Read(CAutoFile& filein)
             nBestSeenHeight = nFileBestSeenHeight;
             historicalFirst = nFileHistoricalFirst;
             historicalBest = nFileHistoricalBest;
+            ClearEstimateCache();
         }
     }
     catch (const std::exception& e) {
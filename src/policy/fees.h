@@ -191,9 +191,20 @@ public:
     CBlockPolicyEstimator();
     ~CBlockPolicyEstimator();
 
-    /** Process all the transactions that have been included in a block */
+    /** What the estimator needs to know about a mempool transaction included in a block */
+    struct BlockTx
+    {
+        uint256 hash;
+        unsigned int entryHeight;
+        CFeeRate feeRate;
+        explicit BlockTx(const CTxMemPoolEntry& entry);
+    };
+
+    /** Process all the transactions that have been included in a block, then
+     *  stop tracking the mempool transactions that conflicted with it. Takes
+     *  copies rather than mempool entries, so it may run after they are gone. */
     void processBlock(unsigned int nBlockHeight,
-                      std::vector<const CTxMemPoolEntry*>& entries);
+                      const std::vector<BlockTx>& txs, const std::vector<uint256>& conflicted);
 
     /** Process a transaction accepted to the mempool*/
     void processTransaction(const CTxMemPoolEntry& entry, bool validFeeEstimate);
@@ -207,7 +218,8 @@ public:
     /** Estimate feerate needed to get be included in a block within confTarget
      *  blocks. If no answer can be given at confTarget, return an estimate at
      *  the closest target where one can be given.  'conservative' estimates are
-     *  valid over longer time horizons also.
+     *  valid over longer time horizons also. Results are computed once per
+     *  block and then served from a cache until the next block is processed.
      */
     CFeeRate estimateSmartFee(int confTarget, FeeCalculation *feeCalc, bool conservative) const;
 
@@ -258,9 +270,27 @@ private:
 
     mutable CCriticalSection cs_feeEstimator;
 
+    /** An estimateSmartFee result remembered until the next block */
+    struct CachedEstimate
+    {
+        bool valid = false;
+        CFeeRate feeRate;
+        FeeCalculation feeCalc;
+    };
+
+    /** estimateSmartFee results since the last block, indexed by 2 * confTarget + conservative.
+     *  Guarded by its own lock so repeated queries do not wait on cs_feeEstimator. */
+    mutable std::vector<CachedEstimate> m_estimate_cache;
+    mutable CCriticalSection cs_estimate_cache;
+
+    /** Forget all cached estimates, called with cs_feeEstimator held whenever the stats change for a new block */
+    void ClearEstimateCache();
+
     /** Process a transaction confirmed in a block*/
-    bool processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry* entry);
+    bool processBlockTx(unsigned int nBlockHeight, const BlockTx& tx);
 
+    /** Helper for estimateSmartFee, computes the estimate that gets cached */
+    CFeeRate estimateSmartFeeUncached(int confTarget, FeeCalculation *feeCalc, bool conservative) const;
     /** Helper for estimateSmartFee */
     double estimateCombinedFee(unsigned int confTarget, double successThreshold, bool checkShorterHorizon, EstimationResult *result) const;
     /** Helper for estimateSmartFee */
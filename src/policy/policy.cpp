@@ -143,6 +143,33 @@ bool IsStandardTx(const CTransaction& tx, std::string& reason, const bool witnes
     return true;
 }
 
+void SolveSpentScripts(const CTransaction& tx, const CCoinsViewCache& mapInputs, std::vector<SpentScriptInfo>& vSpent)
+{
+    vSpent.assign(tx.vin.size(), SpentScriptInfo());
+    if (tx.IsCoinBase())
+        return;
+
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    {
+        const CTxOut& prev = mapInputs.AccessCoin(tx.vin[i].prevout).out;
+        SpentScriptInfo& spent = vSpent[i];
+
+        std::vector<std::vector<unsigned char> > vSolutions;
+        if (!Solver(prev.scriptPubKey, spent.whichType, vSolutions))
+            spent.whichType = TX_NONSTANDARD;
+
+        if (spent.whichType == TX_SCRIPTHASH)
+        {
+            std::vector<std::vector<unsigned char> > stack;
+            // convert the scriptSig into a stack, so we can inspect the redeemScript
+            if (EvalScript(stack, tx.vin[i].scriptSig, SCRIPT_VERIFY_NONE, BaseSignatureChecker(), SIGVERSION_BASE) && !stack.empty()) {
+                spent.fRedeemScript = true;
+                spent.redeemScript = CScript(stack.back().begin(), stack.back().end());
+            }
+        }
+    }
+}
+
 /**
  * Check transaction inputs to mitigate two
  * potential denial-of-service attacks:
@@ -160,31 +187,27 @@ bool IsStandardTx(const CTransaction& tx, std::string& reason, const bool witnes
  *   DUP CHECKSIG DROP ... repeated 100 times... OP_1
  */
 bool AreInputsStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs)
+{
+    std::vector<SpentScriptInfo> vSpent;
+    SolveSpentScripts(tx, mapInputs, vSpent);
+    return AreInputsStandard(tx, vSpent);
+}
+
+bool AreInputsStandard(const CTransaction& tx, const std::vector<SpentScriptInfo>& vSpent)
 {
     if (tx.IsCoinBase())
         return true; // Coinbases don't use vin normally
 
-    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    for (const SpentScriptInfo& spent : vSpent)
     {
-        const CTxOut& prev = mapInputs.AccessCoin(tx.vin[i].prevout).out;
-
-        std::vector<std::vector<unsigned char> > vSolutions;
-        txnouttype whichType;
-        // get the scriptPubKey corresponding to this input:
-        const CScript& prevScript = prev.scriptPubKey;
-        if (!Solver(prevScript, whichType, vSolutions))
+        if (spent.whichType == TX_NONSTANDARD)
             return false;
 
-        if (whichType == TX_SCRIPTHASH)
+        if (spent.whichType == TX_SCRIPTHASH)
         {
-            std::vector<std::vector<unsigned char> > stack;
-            // convert the scriptSig into a stack, so we can inspect the redeemScript
-            if (!EvalScript(stack, tx.vin[i].scriptSig, SCRIPT_VERIFY_NONE, BaseSignatureChecker(), SIGVERSION_BASE))
-                return false;
-            if (stack.empty())
+            if (!spent.fRedeemScript)
                 return false;
-            CScript subscript(stack.back().begin(), stack.back().end());
-            if (subscript.GetSigOpCount(true) > MAX_P2SH_SIGOPS) {
+            if (spent.redeemScript.GetSigOpCount(true) > MAX_P2SH_SIGOPS) {
                 return false;
             }
         }
@@ -194,6 +217,13 @@ bool AreInputsStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs)
 }
 
 bool IsWitnessStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs)
+{
+    std::vector<SpentScriptInfo> vSpent;
+    SolveSpentScripts(tx, mapInputs, vSpent);
+    return IsWitnessStandard(tx, mapInputs, vSpent);
+}
+
+bool IsWitnessStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs, const std::vector<SpentScriptInfo>& vSpent)
 {
     if (tx.IsCoinBase())
         return true; // Coinbases are skipped
@@ -205,22 +235,13 @@ bool IsWitnessStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs)
         if (tx.vin[i].scriptWitness.IsNull())
             continue;
 
-        const CTxOut &prev = mapInputs.AccessCoin(tx.vin[i].prevout).out;
-
-        // get the scriptPubKey corresponding to this input:
-        CScript prevScript = prev.scriptPubKey;
-
-        if (prevScript.IsPayToScriptHash()) {
-            std::vector <std::vector<unsigned char> > stack;
-            // If the scriptPubKey is P2SH, we try to extract the redeemScript casually by converting the scriptSig
-            // into a stack. We do not check IsPushOnly nor compare the hash as these will be done later anyway.
-            // If the check fails at this stage, we know that this txid must be a bad one.
-            if (!EvalScript(stack, tx.vin[i].scriptSig, SCRIPT_VERIFY_NONE, BaseSignatureChecker(), SIGVERSION_BASE))
-                return false;
-            if (stack.empty())
-                return false;
-            prevScript = CScript(stack.back().begin(), stack.back().end());
-        }
+        // If the scriptPubKey is P2SH, the redeemScript was extracted casually by converting the scriptSig
+        // into a stack. We do not check IsPushOnly nor compare the hash as these will be done later anyway.
+        // If that failed, we know that this txid must be a bad one.
+        const SpentScriptInfo& spent = vSpent[i];
+        if (spent.whichType == TX_SCRIPTHASH && !spent.fRedeemScript)
+            return false;
+        const CScript& prevScript = spent.whichType == TX_SCRIPTHASH ? spent.redeemScript : mapInputs.AccessCoin(tx.vin[i].prevout).out.scriptPubKey;
 
         int witnessversion = 0;
         std::vector<unsigned char> witnessprogram;
@@ -12,6 +12,7 @@
 #include <script/standard.h>
 
 #include <string>
+#include <vector>
 
 class CCoinsViewCache;
 class CTxOut;
@@ -80,6 +81,24 @@ CAmount GetDustThreshold(const CTxOut& txout, const CFeeRate& dustRelayFee);
 bool IsDust(const CTxOut& txout, const CFeeRate& dustRelayFee);
 
 bool IsStandard(const CScript& scriptPubKey, txnouttype& whichType, const bool witnessEnabled = false);
+
+/**
+ * What the input checks need to know of the script spent by an input, found
+ * once for all of them rather than by each check again.
+ */
+struct SpentScriptInfo
+{
+    //! Template type of the spent scriptPubKey
+    txnouttype whichType = TX_NONSTANDARD;
+    //! For P2SH, whether the scriptSig evaluates to a non-empty stack
+    bool fRedeemScript = false;
+    //! For P2SH, the top of that stack
+    CScript redeemScript;
+};
+
+/** Solve the scripts spent by the inputs of tx, which must all be in mapInputs */
+void SolveSpentScripts(const CTransaction& tx, const CCoinsViewCache& mapInputs, std::vector<SpentScriptInfo>& vSpent);
+
     /**
      * Check for standard transaction types
      * @return True if all outputs (scriptPubKeys) use only standard transaction forms
@@ -91,12 +110,14 @@ bool IsStandardTx(const CTransaction& tx, std::string& reason, const bool witnes
      * @return True if all inputs (scriptSigs) use only standard transaction forms
      */
 bool AreInputsStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs);
+bool AreInputsStandard(const CTransaction& tx, const std::vector<SpentScriptInfo>& vSpent);
     /**
      * Check if the transaction is over standard P2WSH resources limit:
      * 3600bytes witnessScript size, 80bytes per witness stack element, 100 witness stack elements
      * These limits are adequate for multi-signature up to n-of-100 using OP_CHECKSIG, OP_ADD, and OP_EQUAL,
      */
 bool IsWitnessStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs);
+bool IsWitnessStandard(const CTransaction& tx, const CCoinsViewCache& mapInputs, const std::vector<SpentScriptInfo>& vSpent);
 
 extern CFeeRate incrementalRelayFee;
 extern CFeeRate dustRelayFee;
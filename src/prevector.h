@@ -10,6 +10,7 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <algorithm>
 #include <iterator>
 #include <type_traits>
 
@@ -195,16 +196,55 @@ private:
     T* item_ptr(difference_type pos) { return is_direct() ? direct_ptr(pos) : indirect_ptr(pos); }
     const T* item_ptr(difference_type pos) const { return is_direct() ? direct_ptr(pos) : indirect_ptr(pos); }
 
+    // Construct elements at a raw pointer, which compilers turn into memset/memcpy for byte types,
+    // unlike a loop that works out item_ptr() for every element
+    void fill(T* dst, difference_type count, const T& value = T()) {
+        if (std::is_trivial<T>::value) {
+            std::fill_n(dst, count, value);
+        } else {
+            for (difference_type i = 0; i < count; i++) {
+                new(static_cast<void*>(dst + i)) T(value);
+            }
+        }
+    }
+
+    template<typename InputIterator>
+    void fill(T* dst, InputIterator first, InputIterator last) {
+        copy_construct(dst, first, last, std::is_trivial<T>());
+    }
+
+    // Trivial elements are copied as bytes: std::copy does so for pointers and
+    // std::vector iterators, and the elements of a prevector are contiguous too
+    template<typename InputIterator>
+    void copy_construct(T* dst, InputIterator first, InputIterator last, std::true_type) {
+        std::copy(first, last, dst);
+    }
+
+    void copy_construct(T* dst, const_iterator first, const_iterator last, std::true_type) {
+        memcpy(dst, &(*first), (last - first) * sizeof(T));
+    }
+
+    void copy_construct(T* dst, iterator first, iterator last, std::true_type) {
+        memcpy(dst, &(*first), (last - first) * sizeof(T));
+    }
+
+    template<typename InputIterator>
+    void copy_construct(T* dst, InputIterator first, InputIterator last, std::false_type) {
+        while (first != last) {
+            new(static_cast<void*>(dst)) T(*first);
+            ++dst;
+            ++first;
+        }
+    }
+
 public:
     void assign(size_type n, const T& val) {
         clear();
         if (capacity() < n) {
             change_capacity(n);
         }
-        while (size() < n) {
-            _size++;
-            new(static_cast<void*>(item_ptr(size() - 1))) T(val);
-        }
+        _size += n;
+        fill(item_ptr(0), n, val);
     }
 
     template<typename InputIterator>
@@ -214,11 +254,8 @@ public:
         if (capacity() < n) {
             change_capacity(n);
         }
-        while (first != last) {
-            _size++;
-            new(static_cast<void*>(item_ptr(size() - 1))) T(*first);
-            ++first;
-        }
+        _size += n;
+        fill(item_ptr(0), first, last);
     }
 
     prevector() : _size(0), _union{{}} {}
@@ -229,35 +266,28 @@ public:
 
     explicit prevector(size_type n, const T& val = T()) : _size(0) {
         change_capacity(n);
-        while (size() < n) {
-            _size++;
-            new(static_cast<void*>(item_ptr(size() - 1))) T(val);
-        }
+        _size += n;
+        fill(item_ptr(0), n, val);
     }
 
     template<typename InputIterator>
     prevector(InputIterator first, InputIterator last) : _size(0) {
         size_type n = last - first;
         change_capacity(n);
-        while (first != last) {
-            _size++;
-            new(static_cast<void*>(item_ptr(size() - 1))) T(*first);
-            ++first;
-        }
+        _size += n;
+        fill(item_ptr(0), first, last);
     }
 
     prevector(const prevector<N, T, Size, Diff>& other) : _size(0) {
         change_capacity(other.size());
-        const_iterator it = other.begin();
-        while (it != other.end()) {
-            _size++;
-            new(static_cast<void*>(item_ptr(size() - 1))) T(*it);
-            ++it;
-        }
+        _size += other.size();
+        fill(item_ptr(0), other.begin(), other.end());
     }
 
-    prevector(prevector<N, T, Size, Diff>&& other) : _size(0) {
-        swap(other);
+    // Takes over the heap storage of other, or the bytes of its direct elements,
+    // leaving it empty
+    prevector(prevector<N, T, Size, Diff>&& other) : _size(other._size), _union(other._union) {
+        other._size = 0;
     }
 
     prevector& operator=(const prevector<N, T, Size, Diff>& other) {
@@ -266,12 +296,8 @@ public:
         }
         resize(0);
         change_capacity(other.size());
-        const_iterator it = other.begin();
-        while (it != other.end()) {
-            _size++;
-            new(static_cast<void*>(item_ptr(size() - 1))) T(*it);
-            ++it;
-        }
+        _size += other.size();
+        fill(item_ptr(0), other.begin(), other.end());
         return *this;
     }
 
@@ -315,16 +341,20 @@ public:
     }
 
     void resize(size_type new_size) {
-        if (size() > new_size) {
+        size_type cur_size = size();
+        if (cur_size == new_size) {
+            return;
+        }
+        if (cur_size > new_size) {
             erase(item_ptr(new_size), end());
+            return;
         }
         if (new_size > capacity()) {
             change_capacity(new_size);
         }
-        while (size() < new_size) {
-            _size++;
-            new(static_cast<void*>(item_ptr(size() - 1))) T();
-        }
+        difference_type increase = new_size - cur_size;
+        fill(item_ptr(cur_size), increase);
+        _size += increase;
     }
 
     void reserve(size_type new_capacity) {
@@ -361,9 +391,7 @@ public:
         }
         memmove(item_ptr(p + count), item_ptr(p), (size() - p) * sizeof(T));
         _size += count;
-        for (size_type i = 0; i < count; i++) {
-            new(static_cast<void*>(item_ptr(p + i))) T(value);
-        }
+        fill(item_ptr(p), count, value);
     }
 
     template<typename InputIterator>
@@ -376,11 +404,7 @@ public:
         }
         memmove(item_ptr(p + count), item_ptr(p), (size() - p) * sizeof(T));
         _size += count;
-        while (first != last) {
-            new(static_cast<void*>(item_ptr(p))) T(*first);
-            ++p;
-            ++first;
-        }
+        fill(item_ptr(p), first, last);
     }
 
     iterator erase(iterator pos) {
@@ -67,18 +67,60 @@ uint256 CTransaction::ComputeHash() const
     return SerializeHash(*this, SER_GETHASH, SERIALIZE_TRANSACTION_NO_WITNESS);
 }
 
-uint256 CTransaction::GetWitnessHash() const
+uint256 CTransaction::ComputeWitnessHash() const
 {
     if (!HasWitness()) {
-        return GetHash();
+        return hash;
     }
     return SerializeHash(*this, SER_GETHASH, 0);
 }
 
+unsigned int CTransaction::ComputeLegacySigOpCount() const
+{
+    unsigned int nSigOps = 0;
+    for (const auto& txin : vin) {
+        nSigOps += txin.scriptSig.GetSigOpCount(false);
+    }
+    for (const auto& txout : vout) {
+        nSigOps += txout.scriptPubKey.GetSigOpCount(false);
+    }
+    return nSigOps;
+}
+
 /* For backward compatibility, the hash is initialized to 0. TODO: remove the need for this default constructor entirely. */
-CTransaction::CTransaction() : vin(), vout(), nVersion(CTransaction::CURRENT_VERSION), nLockTime(0), hash() {}
-CTransaction::CTransaction(const CMutableTransaction &tx) : vin(tx.vin), vout(tx.vout), nVersion(tx.nVersion), nLockTime(tx.nLockTime), hash(ComputeHash()) {}
-CTransaction::CTransaction(CMutableTransaction &&tx) : vin(std::move(tx.vin)), vout(std::move(tx.vout)), nVersion(tx.nVersion), nLockTime(tx.nLockTime), hash(ComputeHash()) {}
+CTransaction::CTransaction() : vin(), vout(), nVersion(CTransaction::CURRENT_VERSION), nLockTime(0), hash(), m_witness_hash(), m_legacy_sigops(0) {}
+CTransaction::CTransaction(const CMutableTransaction &tx) : vin(tx.vin), vout(tx.vout), nVersion(tx.nVersion), nLockTime(tx.nLockTime), hash(ComputeHash()), m_witness_hash(ComputeWitnessHash()), m_legacy_sigops(ComputeLegacySigOpCount()) {}
+CTransaction::CTransaction(CMutableTransaction &&tx) : vin(std::move(tx.vin)), vout(std::move(tx.vout)), nVersion(tx.nVersion), nLockTime(tx.nLockTime), hash(ComputeHash()), m_witness_hash(ComputeWitnessHash()), m_legacy_sigops(ComputeLegacySigOpCount()) {}
+
+/** Hash of the transaction without witness, from the bytes it was read from */
+static uint256 HashSerializedRanges(const CTxSerializedRanges& ranges)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    if (!ranges.fWitness) {
+        ss.write((const char*)ranges.begin, ranges.end - ranges.begin);
+        return ss.GetHash();
+    }
+    ss.write((const char*)ranges.begin, 4);
+    ss.write((const char*)ranges.io_begin, ranges.io_end - ranges.io_begin);
+    ss.write((const char*)ranges.end - 4, 4);
+    return ss.GetHash();
+}
+
+/** Hash of the transaction with witness, from the bytes it was read from */
+static uint256 HashSerializedRangesWitness(const CTxSerializedRanges& ranges, const uint256& hash)
+{
+    if (!ranges.fWitness) {
+        return hash;
+    }
+    CHashWriter ss(SER_GETHASH, 0);
+    ss.write((const char*)ranges.begin, ranges.end - ranges.begin);
+    return ss.GetHash();
+}
+
+CTransaction::CTransaction(CDeserializedTransaction&& dtx) : vin(std::move(dtx.tx.vin)), vout(std::move(dtx.tx.vout)), nVersion(dtx.tx.nVersion), nLockTime(dtx.tx.nLockTime),
+    hash(dtx.ranges.begin ? HashSerializedRanges(dtx.ranges) : ComputeHash()),
+    m_witness_hash(dtx.ranges.begin ? HashSerializedRangesWitness(dtx.ranges, hash) : ComputeWitnessHash()),
+    m_legacy_sigops(ComputeLegacySigOpCount()) {}
 
 CAmount CTransaction::GetValueOut() const
 {
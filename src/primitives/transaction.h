@@ -8,6 +8,7 @@
 
 #include <stdint.h>
 #include <amount.h>
+#include <crypto/common.h>
 #include <script/script.h>
 #include <serialize.h>
 #include <uint256.h>
@@ -181,6 +182,25 @@ public:
 };
 
 struct CMutableTransaction;
+struct CDeserializedTransaction;
+
+/**
+ * Where the parts of a transaction were read from, when it was read from a
+ * stream over memory (see StreamReadPos); all null otherwise.
+ */
+struct CTxSerializedRanges
+{
+    //! nVersion
+    const unsigned char* begin = nullptr;
+    //! vin, after the marker and flags of the extended format
+    const unsigned char* io_begin = nullptr;
+    //! Just past vout
+    const unsigned char* io_end = nullptr;
+    //! Just past nLockTime
+    const unsigned char* end = nullptr;
+    //! Whether the extended format with witnesses was read
+    bool fWitness = false;
+};
 
 //序列化与反序列化交易
 /**
@@ -203,19 +223,22 @@ struct CMutableTransaction;
  * - uint32_t nLockTime
  */
 template<typename Stream, typename TxType>
-inline void UnserializeTransaction(TxType& tx, Stream& s) {
+inline void UnserializeTransaction(TxType& tx, Stream& s, CTxSerializedRanges* pranges = nullptr) {
     const bool fAllowWitness = !(s.GetVersion() & SERIALIZE_TRANSACTION_NO_WITNESS);
+    const unsigned char* begin = pranges ? StreamReadPos(s, 0) : nullptr;
 
     s >> tx.nVersion;
     unsigned char flags = 0;
     tx.vin.clear();
     tx.vout.clear();
+    const unsigned char* io_begin = begin ? StreamReadPos(s, 0) : nullptr;
     /* Try to read the vin. In case the dummy is there, this will be read as an empty vector. */
     s >> tx.vin;
     if (tx.vin.size() == 0 && fAllowWitness) {
         /* We read a dummy or an empty vin. */
         s >> flags;
         if (flags != 0) {
+            io_begin = begin ? StreamReadPos(s, 0) : nullptr;
             s >> tx.vin;
             s >> tx.vout;
         }
@@ -223,6 +246,8 @@ inline void UnserializeTransaction(TxType& tx, Stream& s) {
         /* We read a non-empty vin. Assume a normal vout follows. */
         s >> tx.vout;
     }
+    const unsigned char* io_end = begin ? StreamReadPos(s, 0) : nullptr;
+    const bool fWitness = (flags & 1) && fAllowWitness;
     if ((flags & 1) && fAllowWitness) {
         /* The witness flag is present, and we support witnesses. */
         flags ^= 1;
@@ -234,7 +259,18 @@ inline void UnserializeTransaction(TxType& tx, Stream& s) {
         /* Unknown flag in the serialization */
         throw std::ios_base::failure("Unknown transaction optional data");
     }
-    s >> tx.nLockTime;
+    if (!begin) {
+        s >> tx.nLockTime;
+        return;
+    }
+    // Read through a view, as read() may release the buffer once it is all consumed
+    const unsigned char* pLockTime = ReadByteView(s, sizeof(tx.nLockTime), 0);
+    tx.nLockTime = ReadLE32(pLockTime);
+    pranges->begin = begin;
+    pranges->io_begin = io_begin;
+    pranges->io_end = io_end;
+    pranges->end = pLockTime + sizeof(tx.nLockTime);
+    pranges->fWitness = fWitness;
 }
 
 template<typename Stream, typename TxType>
@@ -296,8 +332,15 @@ public:
 private:
     /** Memory only. */
     const uint256 hash;//交易哈希值，只保存于内存之中
+    const uint256 m_witness_hash;
+    const unsigned int m_legacy_sigops;
 
     uint256 ComputeHash() const;
+    uint256 ComputeWitnessHash() const;
+    unsigned int ComputeLegacySigOpCount() const;
+
+    /** Hash the bytes the transaction was read from, where they are known */
+    explicit CTransaction(CDeserializedTransaction&& dtx);
 
 public:
     /** Construct a CTransaction that qualifies as IsNull() */
@@ -318,7 +361,7 @@ public:
     /** This deserializing constructor is provided instead of an Unserialize method.
      *  Unserialize is not possible, since it would require overwriting const fields. */
     template <typename Stream>
-    CTransaction(deserialize_type, Stream& s) : CTransaction(CMutableTransaction(deserialize, s)) {}
+    CTransaction(deserialize_type, Stream& s) : CTransaction(CDeserializedTransaction(deserialize, s)) {}
 
     bool IsNull() const {
         return vin.empty() && vout.empty();
@@ -328,8 +371,15 @@ public:
         return hash;
     }
 
-    // Compute a hash that includes both transaction and witness data
-    uint256 GetWitnessHash() const;
+    // Hash that includes both transaction and witness data, computed at construction
+    const uint256& GetWitnessHash() const {
+        return m_witness_hash;
+    }
+
+    // Legacy sigops of the scripts of the inputs and outputs, counted at construction
+    unsigned int GetLegacySigOpCount() const {
+        return m_legacy_sigops;
+    }
 
     // Return sum of txouts.
     CAmount GetValueOut() const;
@@ -421,6 +471,27 @@ struct CMutableTransaction
     }
 };
 
+/**
+ * A transaction being deserialized into a CTransaction, with where it was
+ * read from, so that its hashes are computed from those bytes rather than by
+ * serializing it again. They are what it serializes to, as sizes must be
+ * encoded canonically and the rest is fixed, except for an extended format
+ * without any witness or an empty vin followed by zero flags; the ranges of
+ * those are dropped.
+ */
+struct CDeserializedTransaction
+{
+    CMutableTransaction tx;
+    CTxSerializedRanges ranges;
+
+    template <typename Stream>
+    CDeserializedTransaction(deserialize_type, Stream& s) {
+        UnserializeTransaction(tx, s, &ranges);
+        if (ranges.begin && (ranges.fWitness ? !tx.HasWitness() : ranges.io_begin != ranges.begin + 4))
+            ranges = CTxSerializedRanges();
+    }
+};
+
 typedef std::shared_ptr<const CTransaction> CTransactionRef;
 static inline CTransactionRef MakeTransactionRef() { return std::make_shared<const CTransaction>(); }
 template <typename Tx> static inline CTransactionRef MakeTransactionRef(Tx&& txIn) { return std::make_shared<const CTransaction>(std::forward<Tx>(txIn)); }
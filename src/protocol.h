@@ -245,6 +245,76 @@ extern const char *GETBLOCKTXN;
  * @since protocol version 70014 as described by BIP 152
  */
 extern const char *BLOCKTXN;
+/**
+ * Contains a 4-byte version number and an 8-byte salt.
+ * Indicates that a node is willing to announce transactions by set
+ * reconciliation instead of flooding "inv" messages. Sent after "verack";
+ * reconciliation is used once both sides have sent it.
+ */
+extern const char *SENDRECON;
+/**
+ * Contains the size of the sender's reconciliation set.
+ * Sent by the node that opened the connection to start a round; the peer
+ * responds with a "sketch".
+ */
+extern const char *REQRECON;
+/**
+ * Contains a CReconSketch of the sender's reconciliation set.
+ * Sent in response to a "reqrecon" message.
+ */
+extern const char *SKETCH;
+/**
+ * Contains a 1-byte success flag and a vector of 4-byte short ids the sender
+ * is missing. Ends the round started by "reqrecon"; the peer announces the
+ * requested transactions, or all of its set if decoding failed.
+ */
+extern const char *RECONCILDIFF;
+/**
+ * Contains a 1-byte filter type, a 4-byte start height and a 32-byte stop
+ * hash. Requests the "cfilter" of every block in that range of the peer's
+ * active chain.
+ * Only available with service bit NODE_COMPACT_FILTERS as described by BIP 157.
+ */
+extern const char *GETCFILTERS;
+/**
+ * Contains a BlockFilter: the filter type, block hash and encoded filter.
+ * Sent in response to a "getcfilters" message.
+ */
+extern const char *CFILTER;
+/**
+ * Same layout as "getcfilters". Requests the hashes of the filters in that
+ * range, along with the filter header of the block before it.
+ * Only available with service bit NODE_COMPACT_FILTERS as described by BIP 157.
+ */
+extern const char *GETCFHEADERS;
+/**
+ * Contains the filter type, the stop hash, the previous filter header and a
+ * vector of filter hashes. Sent in response to a "getcfheaders" message.
+ */
+extern const char *CFHEADERS;
+/**
+ * Contains a 1-byte filter type and a 32-byte stop hash. Requests the filter
+ * headers at every 1000th block up to the stop hash.
+ * Only available with service bit NODE_COMPACT_FILTERS as described by BIP 157.
+ */
+extern const char *GETCFCHECKPT;
+/**
+ * Contains the filter type, the stop hash and a vector of filter headers.
+ * Sent in response to a "getcfcheckpt" message.
+ */
+extern const char *CFCHECKPT;
+/**
+ * Contains a 4-byte version number.
+ * Indicates that a node can decode "cmpheaders" messages, and prefers them to
+ * "headers" messages. Sent after "verack".
+ */
+extern const char *SENDCMPHDRS;
+/**
+ * Contains a CCompressedHeaders object: block headers like a "headers"
+ * message, without the fields implied by the headers before them.
+ * Sent instead of "headers" to peers that sent "sendcmphdrs".
+ */
+extern const char *CMPHEADERS;
 };
 
 /* Get a vector of all valid message types (see above) */
@@ -276,6 +346,9 @@ enum ServiceFlags : uint64_t {
     // NODE_XTHIN means the node supports Xtreme Thinblocks
     // If this is turned off then the node will not service nor make xthin requests
     NODE_XTHIN = (1 << 4),
+    // NODE_COMPACT_FILTERS means the node will serve basic block filters.
+    // See BIP157 and BIP158 for details on how this is implemented.
+    NODE_COMPACT_FILTERS = (1 << 6),
     // NODE_NETWORK_LIMITED means the same as NODE_NETWORK with the limitation of only
     // serving the last 288 (2 day) blocks
     // See BIP159 for details on how this is implemented.
@@ -166,14 +166,28 @@ static int ecdsa_signature_parse_der_lax(const secp256k1_context* ctx, secp256k1
     return 1;
 }
 
+static_assert(sizeof(CDecodedPubKey) == sizeof(secp256k1_pubkey), "CDecodedPubKey must hold a secp256k1_pubkey");
+
 bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
+    CDecodedPubKey decoded;
+    return Decode(decoded) && VerifyDecoded(hash, vchSig, decoded);
+}
+
+bool CPubKey::Decode(CDecodedPubKey& decoded) const {
     if (!IsValid())
         return false;
     secp256k1_pubkey pubkey;
-    secp256k1_ecdsa_signature sig;
     if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, &(*this)[0], size())) {
         return false;
     }
+    memcpy(decoded.data, &pubkey, sizeof(pubkey));
+    return true;
+}
+
+bool CPubKey::VerifyDecoded(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CDecodedPubKey& decoded) {
+    secp256k1_pubkey pubkey;
+    secp256k1_ecdsa_signature sig;
+    memcpy(&pubkey, decoded.data, sizeof(pubkey));
     if (!ecdsa_signature_parse_der_lax(secp256k1_context_verify, &sig, vchSig.data(), vchSig.size())) {
         return false;
     }
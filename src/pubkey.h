@@ -26,6 +26,12 @@ public:
 
 typedef uint256 ChainCode;
 
+/** A public key parsed for signature verification, see CPubKey::Decode. */
+struct CDecodedPubKey
+{
+    unsigned char data[64];
+};
+
 /** An encapsulated public key. */
 class CPubKey
 {
@@ -182,6 +188,16 @@ public:
      */
     bool Verify(const uint256& hash, const std::vector<unsigned char>& vchSig) const;
 
+    /**
+     * Parse this public key into the form signatures are verified against.
+     * For compressed keys this takes a square root, so callers that see the
+     * same key often can keep the result.
+     */
+    bool Decode(CDecodedPubKey& decoded) const;
+
+    //! Verify a DER signature against a public key returned by Decode().
+    static bool VerifyDecoded(const uint256& hash, const std::vector<unsigned char>& vchSig, const CDecodedPubKey& decoded);
+
     /**
      * Check whether a signature is normalized (lower-S).
      */
@@ -27,18 +27,24 @@
 
 class CBlockIndex;
 
-static int64_t nLastHeaderTipUpdateNotification = 0;
-static int64_t nLastBlockTipUpdateNotification = 0;
-
 ClientModel::ClientModel(OptionsModel *_optionsModel, QObject *parent) :
     QObject(parent),
     optionsModel(_optionsModel),
     peerTableModel(0),
     banTableModel(0),
-    pollTimer(0)
+    pollTimer(0),
+    cachedMempoolSize(-1),
+    cachedMempoolDynamicUsage(0),
+    cachedTotalBytesRecv(0),
+    cachedTotalBytesSent(0)
 {
     cachedBestHeaderHeight = -1;
     cachedBestHeaderTime = -1;
+    cachedNumBlocks = -1;
+    cachedLastBlockTime = -1;
+    cachedVerificationProgress = 0.0;
+    fBlockTipPending = false;
+    fHeaderTipPending = false;
     peerTableModel = new PeerTableModel(this);
     banTableModel = new BanTableModel(this);
     pollTimer = new QTimer(this);
@@ -69,10 +75,23 @@ int ClientModel::getNumConnections(unsigned int flags) const
     return 0;
 }
 
+void ClientModel::cacheBlockTip(const CBlockIndex *tip) const
+{
+    cachedNumBlocks = tip->nHeight;
+    cachedLastBlockTime = tip->GetBlockTime();
+    cachedVerificationProgress = GuessVerificationProgress(Params().TxData(), const_cast<CBlockIndex *>(tip));
+}
+
 int ClientModel::getNumBlocks() const
 {
-    LOCK(cs_main);
-    return chainActive.Height();
+    if (cachedNumBlocks == -1) {
+        // make sure we initially populate the cache via a cs_main lock
+        // otherwise we need to wait for a tip update
+        LOCK(cs_main);
+        if (chainActive.Tip())
+            cacheBlockTip(chainActive.Tip());
+    }
+    return cachedNumBlocks;
 }
 
 int ClientModel::getHeaderTipHeight() const
@@ -117,10 +136,14 @@ quint64 ClientModel::getTotalBytesSent() const
 
 QDateTime ClientModel::getLastBlockDate() const
 {
-    LOCK(cs_main);
+    if (cachedLastBlockTime == -1) {
+        LOCK(cs_main);
+        if (chainActive.Tip())
+            cacheBlockTip(chainActive.Tip());
+    }
 
-    if (chainActive.Tip())
-        return QDateTime::fromTime_t(chainActive.Tip()->GetBlockTime());
+    if (cachedLastBlockTime != -1)
+        return QDateTime::fromTime_t(cachedLastBlockTime);
 
     return QDateTime::fromTime_t(Params().GenesisBlock().GetBlockTime()); // Genesis block's time of current network
 }
@@ -140,6 +163,8 @@ double ClientModel::getVerificationProgress(const CBlockIndex *tipIn) const
     CBlockIndex *tip = const_cast<CBlockIndex *>(tipIn);
     if (!tip)
     {
+        if (cachedNumBlocks != -1)
+            return cachedVerificationProgress;
         LOCK(cs_main);
         tip = chainActive.Tip();
     }
@@ -148,10 +173,36 @@ double ClientModel::getVerificationProgress(const CBlockIndex *tipIn) const
 
 void ClientModel::updateTimer()
 {
-    // no locking required at this point
-    // the following calls will acquire the required lock
-    Q_EMIT mempoolSizeChanged(getMempoolSize(), getMempoolDynamicUsage());
-    Q_EMIT bytesChanged(getTotalBytesRecv(), getTotalBytesSent());
+    // deliver the latest tip of any notifications coalesced during initial sync
+    if (fBlockTipPending.exchange(false)) {
+        Q_EMIT numBlocksChanged(cachedNumBlocks, QDateTime::fromTime_t(cachedLastBlockTime), cachedVerificationProgress, false);
+    }
+    if (fHeaderTipPending.exchange(false)) {
+        Q_EMIT numBlocksChanged(cachedBestHeaderHeight, QDateTime::fromTime_t(cachedBestHeaderTime), cachedVerificationProgress, true);
+    }
+
+    // only sample the mempool if validation is not holding it, otherwise
+    // keep showing the last snapshot until the next poll
+    {
+        TRY_LOCK(mempool.cs, lockMempool);
+        if (lockMempool) {
+            long nMempoolSize = getMempoolSize();
+            size_t nMempoolDynamicUsage = getMempoolDynamicUsage();
+            if (nMempoolSize != cachedMempoolSize || nMempoolDynamicUsage != cachedMempoolDynamicUsage) {
+                cachedMempoolSize = nMempoolSize;
+                cachedMempoolDynamicUsage = nMempoolDynamicUsage;
+                Q_EMIT mempoolSizeChanged(nMempoolSize, nMempoolDynamicUsage);
+            }
+        }
+    }
+
+    quint64 nTotalBytesRecv = getTotalBytesRecv();
+    quint64 nTotalBytesSent = getTotalBytesSent();
+    if (nTotalBytesRecv != cachedTotalBytesRecv || nTotalBytesSent != cachedTotalBytesSent) {
+        cachedTotalBytesRecv = nTotalBytesRecv;
+        cachedTotalBytesSent = nTotalBytesSent;
+        Q_EMIT bytesChanged(nTotalBytesRecv, nTotalBytesSent);
+    }
 }
 
 void ClientModel::updateNumConnections(int numConnections)
@@ -287,30 +338,30 @@ static void BannedListChanged(ClientModel *clientmodel)
 
 static void BlockTipChanged(ClientModel *clientmodel, bool initialSync, const CBlockIndex *pIndex, bool fHeader)
 {
-    // lock free async UI updates in case we have a new block tip
-    // during initial sync, only update the UI if the last update
-    // was > 250ms (MODEL_UPDATE_DELAY) ago
-    int64_t now = 0;
-    if (initialSync)
-        now = GetTimeMillis();
-
-    int64_t& nLastUpdateNotification = fHeader ? nLastHeaderTipUpdateNotification : nLastBlockTipUpdateNotification;
-
+    // cache the tip so the UI thread can read it without cs_main
     if (fHeader) {
-        // cache best headers time and height to reduce future cs_main locks
         clientmodel->cachedBestHeaderHeight = pIndex->nHeight;
         clientmodel->cachedBestHeaderTime = pIndex->GetBlockTime();
+    } else {
+        clientmodel->cacheBlockTip(pIndex);
     }
-    // if we are in-sync, update the UI regardless of last update time
-    if (!initialSync || now - nLastUpdateNotification > MODEL_UPDATE_DELAY) {
-        //pass an async signal to the UI thread
-        QMetaObject::invokeMethod(clientmodel, "numBlocksChanged", Qt::QueuedConnection,
-                                  Q_ARG(int, pIndex->nHeight),
-                                  Q_ARG(QDateTime, QDateTime::fromTime_t(pIndex->GetBlockTime())),
-                                  Q_ARG(double, clientmodel->getVerificationProgress(pIndex)),
-                                  Q_ARG(bool, fHeader));
-        nLastUpdateNotification = now;
+
+    // during initial sync, coalesce the notifications and let the next
+    // poll (every MODEL_UPDATE_DELAY) deliver only the latest tip
+    if (initialSync) {
+        if (fHeader)
+            clientmodel->fHeaderTipPending = true;
+        else
+            clientmodel->fBlockTipPending = true;
+        return;
     }
+
+    //pass an async signal to the UI thread
+    QMetaObject::invokeMethod(clientmodel, "numBlocksChanged", Qt::QueuedConnection,
+                              Q_ARG(int, pIndex->nHeight),
+                              Q_ARG(QDateTime, QDateTime::fromTime_t(pIndex->GetBlockTime())),
+                              Q_ARG(double, fHeader ? clientmodel->getVerificationProgress(pIndex) : clientmodel->cachedVerificationProgress.load()),
+                              Q_ARG(bool, fHeader));
 }
 
 void ClientModel::subscribeToCoreSignals()
@@ -83,6 +83,16 @@ public:
     // caches for the best header
     mutable std::atomic<int> cachedBestHeaderHeight;
     mutable std::atomic<int64_t> cachedBestHeaderTime;
+    // caches for the active chain tip, so the GUI does not need cs_main
+    mutable std::atomic<int> cachedNumBlocks;
+    mutable std::atomic<int64_t> cachedLastBlockTime;
+    mutable std::atomic<double> cachedVerificationProgress;
+    // set when a tip update during initial sync waits for the next poll
+    std::atomic<bool> fBlockTipPending;
+    std::atomic<bool> fHeaderTipPending;
+
+    //! Store the active chain tip in the caches above
+    void cacheBlockTip(const CBlockIndex *tip) const;
 
 private:
     OptionsModel *optionsModel;
@@ -91,6 +101,12 @@ private:
 
     QTimer *pollTimer;
 
+    // last values emitted by updateTimer, to skip unchanged updates
+    long cachedMempoolSize;
+    size_t cachedMempoolDynamicUsage;
+    quint64 cachedTotalBytesRecv;
+    quint64 cachedTotalBytesSent;
+
     void subscribeToCoreSignals();
     void unsubscribeFromCoreSignals();
 
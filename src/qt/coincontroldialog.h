@@ -12,10 +12,11 @@
 #include <QDialog>
 #include <QList>
 #include <QMenu>
+#include <QPersistentModelIndex>
 #include <QPoint>
 #include <QString>
-#include <QTreeWidgetItem>
 
+class CoinControlModel;
 class PlatformStyle;
 class WalletModel;
 
@@ -27,17 +28,6 @@ namespace Ui {
 
 #define ASYMP_UTF8 "\xE2\x89\x88"
 
-class CCoinControlWidgetItem : public QTreeWidgetItem
-{
-public:
-    explicit CCoinControlWidgetItem(QTreeWidget *parent, int type = Type) : QTreeWidgetItem(parent, type) {}
-    explicit CCoinControlWidgetItem(int type = Type) : QTreeWidgetItem(type) {}
-    explicit CCoinControlWidgetItem(QTreeWidgetItem *parent, int type = Type) : QTreeWidgetItem(parent, type) {}
-
-    bool operator<(const QTreeWidgetItem &other) const;
-};
-
-
 class CoinControlDialog : public QDialog
 {
     Q_OBJECT
@@ -58,11 +48,12 @@ public:
 private:
     Ui::CoinControlDialog *ui;
     WalletModel *model;
+    CoinControlModel *coinModel;
     int sortColumn;
     Qt::SortOrder sortOrder;
 
     QMenu *contextMenu;
-    QTreeWidgetItem *contextMenuItem;
+    QPersistentModelIndex contextMenuIndex;
     QAction *copyTransactionHashAction;
     QAction *lockAction;
     QAction *unlockAction;
@@ -72,19 +63,6 @@ private:
     void sortView(int, Qt::SortOrder);
     void updateView();
 
-    enum
-    {
-        COLUMN_CHECKBOX = 0,
-        COLUMN_AMOUNT,
-        COLUMN_LABEL,
-        COLUMN_ADDRESS,
-        COLUMN_DATE,
-        COLUMN_CONFIRMATIONS,
-        COLUMN_TXHASH,
-        COLUMN_VOUT_INDEX,
-    };
-    friend class CCoinControlWidgetItem;
-
 private Q_SLOTS:
     void showMenu(const QPoint &);
     void copyAmount();
@@ -102,7 +80,7 @@ private Q_SLOTS:
     void clipboardChange();
     void radioTreeMode(bool);
     void radioListMode(bool);
-    void viewItemChanged(QTreeWidgetItem*, int);
+    void viewSelectionChanged();
     void headerSectionClicked(int);
     void buttonBoxClicked(QAbstractButton*);
     void buttonSelectAllClicked();
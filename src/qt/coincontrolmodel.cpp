@@ -0,0 +1,477 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <qt/coincontrolmodel.h>
+
+#include <qt/addresstablemodel.h>
+#include <qt/bitcoinunits.h>
+#include <qt/guiutil.h>
+#include <qt/optionsmodel.h>
+#include <qt/platformstyle.h>
+#include <qt/walletmodel.h>
+
+#include <base58.h>
+#include <wallet/coincontrol.h>
+#include <wallet/wallet.h>
+
+#include <QIcon>
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+CoinControlModel::CoinControlModel(CCoinControl *_coinControl, const PlatformStyle *_platformStyle, QObject *parent) :
+    QAbstractItemModel(parent),
+    coinControl(_coinControl),
+    platformStyle(_platformStyle),
+    walletModel(0),
+    fTreeMode(false),
+    sortColumn(COLUMN_AMOUNT),
+    sortOrder(Qt::DescendingOrder)
+{
+}
+
+void CoinControlModel::setWalletModel(WalletModel *_walletModel, bool _fTreeMode)
+{
+    beginResetModel();
+    walletModel = _walletModel;
+    fTreeMode = _fTreeMode;
+    vOutputs.clear();
+    vGroups.clear();
+
+    std::map<QString, std::vector<COutput> > mapCoins;
+    walletModel->listCoins(mapCoins);
+    std::vector<COutPoint> vLocked;
+    walletModel->listLockedCoins(vLocked);
+    const std::set<COutPoint> setLocked(vLocked.begin(), vLocked.end());
+
+    for (const std::pair<QString, std::vector<COutput>>& coins : mapCoins) {
+        Group group;
+        group.address = coins.first;
+        group.nSum = 0;
+        group.nSelected = 0;
+        for (const COutput& out : coins.second) {
+            const CTxOut& txout = out.tx->tx->vout[out.i];
+            Output output;
+            output.outpoint = COutPoint(out.tx->GetHash(), out.i);
+            output.nValue = txout.nValue;
+            output.nTime = out.tx->GetTxTime();
+            output.nDepth = out.nDepth;
+            CTxDestination dest;
+            if (ExtractDestination(txout.scriptPubKey, dest))
+                output.address = QString::fromStdString(EncodeDestination(dest));
+            output.nGroup = vGroups.size();
+            output.fLocked = setLocked.count(output.outpoint);
+            if (output.fLocked) {
+                coinControl->UnSelect(output.outpoint); // just to be sure
+            } else if (coinControl->IsSelected(output.outpoint)) {
+                group.nSelected++;
+            }
+            group.nSum += output.nValue;
+            group.vOutputs.push_back(vOutputs.size());
+            vOutputs.push_back(output);
+        }
+        vGroups.push_back(group);
+    }
+
+    vRows.resize(fTreeMode ? vGroups.size() : vOutputs.size());
+    for (size_t i = 0; i < vRows.size(); i++)
+        vRows[i] = i;
+    sortRows();
+    endResetModel();
+}
+
+bool CoinControlModel::isOutput(const QModelIndex &index) const
+{
+    return index.isValid() && (!fTreeMode || index.internalId() != TOP_LEVEL);
+}
+
+size_t CoinControlModel::item(const QModelIndex &index) const
+{
+    if (index.internalId() == TOP_LEVEL)
+        return vRows[index.row()];
+    return vGroups[index.internalId() - 1].vOutputs[index.row()];
+}
+
+QModelIndex CoinControlModel::outputIndex(size_t nOutput, int column) const
+{
+    return createIndex(vOutputRow[nOutput], column, fTreeMode ? vOutputs[nOutput].nGroup + 1 : TOP_LEVEL);
+}
+
+QModelIndex CoinControlModel::groupIndex(size_t nGroup, int column) const
+{
+    return createIndex(vGroupRow[nGroup], column, TOP_LEVEL);
+}
+
+COutPoint CoinControlModel::outPoint(const QModelIndex &index) const
+{
+    if (!isOutput(index))
+        return COutPoint();
+    return vOutputs[item(index)].outpoint;
+}
+
+QString CoinControlModel::labelForAddress(const QString &address) const
+{
+    QString label = walletModel->getAddressTableModel()->labelForAddress(address);
+    if (label.isEmpty())
+        label = tr("(no label)");
+    return label;
+}
+
+QString CoinControlModel::outputLabel(const Output &output, const QString &groupLabel) const
+{
+    if (output.address != vGroups[output.nGroup].address)
+        return tr("(change)");
+    // In tree mode the label is only shown on the group
+    return fTreeMode ? QString() : groupLabel;
+}
+
+QString CoinControlModel::outputAddress(const Output &output) const
+{
+    // In tree mode the address is only shown again for change
+    if (fTreeMode && output.address == vGroups[output.nGroup].address)
+        return QString();
+    return output.address;
+}
+
+QModelIndex CoinControlModel::index(int row, int column, const QModelIndex &parent) const
+{
+    if (!hasIndex(row, column, parent))
+        return QModelIndex();
+    if (!parent.isValid())
+        return createIndex(row, column, TOP_LEVEL);
+    return createIndex(row, column, vRows[parent.row()] + 1);
+}
+
+QModelIndex CoinControlModel::parent(const QModelIndex &index) const
+{
+    if (!index.isValid() || index.internalId() == TOP_LEVEL)
+        return QModelIndex();
+    return groupIndex(index.internalId() - 1, COLUMN_CHECKBOX);
+}
+
+int CoinControlModel::rowCount(const QModelIndex &parent) const
+{
+    if (!parent.isValid())
+        return vRows.size();
+    if (fTreeMode && parent.internalId() == TOP_LEVEL && parent.column() == COLUMN_CHECKBOX)
+        return vGroups[vRows[parent.row()]].vOutputs.size();
+    return 0;
+}
+
+int CoinControlModel::columnCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent);
+    return NUMBER_OF_COLUMNS;
+}
+
+QVariant CoinControlModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || !walletModel)
+        return QVariant();
+    const int nDisplayUnit = walletModel->getOptionsModel()->getDisplayUnit();
+
+    if (isOutput(index)) {
+        const Output& output = vOutputs[item(index)];
+        const Group& group = vGroups[output.nGroup];
+        switch (role) {
+        case Qt::DisplayRole:
+            switch (index.column()) {
+            case COLUMN_AMOUNT:
+                return BitcoinUnits::format(nDisplayUnit, output.nValue);
+            case COLUMN_LABEL:
+                if (output.address != group.address || fTreeMode)
+                    return outputLabel(output, QString());
+                return outputLabel(output, labelForAddress(group.address));
+            case COLUMN_ADDRESS:
+                return outputAddress(output);
+            case COLUMN_DATE:
+                return GUIUtil::dateTimeStr(output.nTime);
+            case COLUMN_CONFIRMATIONS:
+                return QString::number(output.nDepth);
+            }
+            break;
+        case Qt::ToolTipRole:
+            if (index.column() == COLUMN_LABEL && output.address != group.address) {
+                // tooltip from where the change comes from
+                return tr("change from %1 (%2)").arg(labelForAddress(group.address)).arg(group.address);
+            }
+            break;
+        case Qt::CheckStateRole:
+            if (index.column() == COLUMN_CHECKBOX)
+                return coinControl->IsSelected(output.outpoint) ? Qt::Checked : Qt::Unchecked;
+            break;
+        case Qt::DecorationRole:
+            if (index.column() == COLUMN_CHECKBOX && output.fLocked)
+                return platformStyle->SingleColorIcon(":/icons/lock_closed");
+            break;
+        case AddressRole:
+            return output.address.isEmpty() ? group.address : output.address;
+        case LabelRole: {
+            QString label = outputLabel(output, QString());
+            return label.isEmpty() ? labelForAddress(group.address) : label;
+        }
+        case TxHashRole:
+            return QString::fromStdString(output.outpoint.hash.GetHex());
+        }
+        return QVariant();
+    }
+
+    const Group& group = vGroups[item(index)];
+    switch (role) {
+    case Qt::DisplayRole:
+        switch (index.column()) {
+        case COLUMN_CHECKBOX:
+            return "(" + QString::number(group.vOutputs.size()) + ")";
+        case COLUMN_AMOUNT:
+            return BitcoinUnits::format(nDisplayUnit, group.nSum);
+        case COLUMN_LABEL:
+            return labelForAddress(group.address);
+        case COLUMN_ADDRESS:
+            return group.address;
+        }
+        break;
+    case Qt::CheckStateRole:
+        if (index.column() == COLUMN_CHECKBOX) {
+            if (group.nSelected == 0)
+                return Qt::Unchecked;
+            return group.nSelected == group.vOutputs.size() ? Qt::Checked : Qt::PartiallyChecked;
+        }
+        break;
+    case AddressRole:
+        return group.address;
+    case LabelRole:
+        return labelForAddress(group.address);
+    case TxHashRole:
+        return QString();
+    }
+    return QVariant();
+}
+
+bool CoinControlModel::setData(const QModelIndex &index, const QVariant &value, int role)
+{
+    if (!index.isValid() || role != Qt::CheckStateRole || index.column() != COLUMN_CHECKBOX)
+        return false;
+    const bool fSelect = value.toInt() != Qt::Unchecked;
+
+    if (isOutput(index)) {
+        const size_t nOutput = item(index);
+        if (vOutputs[nOutput].fLocked)
+            return false;
+        setSelected(nOutput, fSelect);
+        emitOutputChanged(nOutput);
+    } else {
+        // A group selects or unselects all of its outputs that are not locked
+        const Group& group = vGroups[item(index)];
+        for (size_t nOutput : group.vOutputs) {
+            if (!vOutputs[nOutput].fLocked)
+                setSelected(nOutput, fSelect);
+        }
+        if (!group.vOutputs.empty())
+            Q_EMIT dataChanged(this->index(0, COLUMN_CHECKBOX, index), this->index(group.vOutputs.size() - 1, COLUMN_CHECKBOX, index));
+        Q_EMIT dataChanged(index, index);
+    }
+    Q_EMIT selectionChanged();
+    return true;
+}
+
+QVariant CoinControlModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal)
+        return QVariant();
+    if (role == Qt::DisplayRole) {
+        switch (section) {
+        case COLUMN_AMOUNT:
+            return tr("Amount");
+        case COLUMN_LABEL:
+            return tr("Received with label");
+        case COLUMN_ADDRESS:
+            return tr("Received with address");
+        case COLUMN_DATE:
+            return tr("Date");
+        case COLUMN_CONFIRMATIONS:
+            return tr("Confirmations");
+        }
+        return QString();
+    } else if (role == Qt::ToolTipRole && section == COLUMN_CONFIRMATIONS) {
+        return tr("Confirmed");
+    }
+    return QVariant();
+}
+
+Qt::ItemFlags CoinControlModel::flags(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return Qt::NoItemFlags;
+    Qt::ItemFlags flags = Qt::ItemIsSelectable | Qt::ItemIsUserCheckable;
+    // Locked coins can't be selected
+    if (!isOutput(index) || !vOutputs[item(index)].fLocked)
+        flags |= Qt::ItemIsEnabled;
+    return flags;
+}
+
+void CoinControlModel::sortRows()
+{
+    // Labels are only looked up once per group, and only to sort by them
+    std::vector<QString> vLabels;
+    if (sortColumn == COLUMN_LABEL) {
+        for (const Group& group : vGroups) {
+            vLabels.push_back(labelForAddress(group.address));
+        }
+    }
+
+    auto lessOutput = [&](size_t a, size_t b) {
+        const Output& left = vOutputs[a];
+        const Output& right = vOutputs[b];
+        switch (sortColumn) {
+        case COLUMN_AMOUNT:
+            return left.nValue < right.nValue;
+        case COLUMN_LABEL:
+            return outputLabel(left, vLabels[left.nGroup]).localeAwareCompare(outputLabel(right, vLabels[right.nGroup])) < 0;
+        case COLUMN_ADDRESS:
+            return outputAddress(left).localeAwareCompare(outputAddress(right)) < 0;
+        case COLUMN_DATE:
+            return left.nTime < right.nTime;
+        case COLUMN_CONFIRMATIONS:
+            return left.nDepth < right.nDepth;
+        }
+        return false;
+    };
+    auto lessGroup = [&](size_t a, size_t b) {
+        switch (sortColumn) {
+        case COLUMN_AMOUNT:
+            return vGroups[a].nSum < vGroups[b].nSum;
+        case COLUMN_LABEL:
+            return vLabels[a].localeAwareCompare(vLabels[b]) < 0;
+        case COLUMN_ADDRESS:
+            return vGroups[a].address.localeAwareCompare(vGroups[b].address) < 0;
+        }
+        return false;
+    };
+    const bool fAscending = sortOrder == Qt::AscendingOrder;
+    auto sortOutputs = [&](std::vector<size_t>& v) {
+        std::stable_sort(v.begin(), v.end(), [&](size_t a, size_t b) { return fAscending ? lessOutput(a, b) : lessOutput(b, a); });
+    };
+
+    vOutputRow.resize(vOutputs.size());
+    vGroupRow.resize(vGroups.size());
+    if (fTreeMode) {
+        std::stable_sort(vRows.begin(), vRows.end(), [&](size_t a, size_t b) { return fAscending ? lessGroup(a, b) : lessGroup(b, a); });
+        for (size_t i = 0; i < vRows.size(); i++)
+            vGroupRow[vRows[i]] = i;
+        for (Group& group : vGroups) {
+            sortOutputs(group.vOutputs);
+            for (size_t i = 0; i < group.vOutputs.size(); i++)
+                vOutputRow[group.vOutputs[i]] = i;
+        }
+    } else {
+        sortOutputs(vRows);
+        for (size_t i = 0; i < vRows.size(); i++)
+            vOutputRow[vRows[i]] = i;
+    }
+}
+
+void CoinControlModel::sort(int column, Qt::SortOrder order)
+{
+    sortColumn = column;
+    sortOrder = order;
+    if (!walletModel)
+        return;
+
+    // Rows move, so the indexes views hold on to (expanded groups, the
+    // current row) have to follow the items they were on
+    Q_EMIT layoutAboutToBeChanged();
+    const QModelIndexList oldIndexes = persistentIndexList();
+    std::vector<size_t> vItems;
+    for (const QModelIndex& index : oldIndexes) {
+        vItems.push_back(item(index));
+    }
+    sortRows();
+    QModelIndexList newIndexes;
+    for (int i = 0; i < oldIndexes.size(); i++) {
+        const QModelIndex& index = oldIndexes[i];
+        newIndexes.append(isOutput(index) ? outputIndex(vItems[i], index.column()) : groupIndex(vItems[i], index.column()));
+    }
+    changePersistentIndexList(oldIndexes, newIndexes);
+    Q_EMIT layoutChanged();
+}
+
+void CoinControlModel::setSelected(size_t nOutput, bool fSelect)
+{
+    const Output& output = vOutputs[nOutput];
+    if (coinControl->IsSelected(output.outpoint) == fSelect)
+        return;
+    if (fSelect) {
+        coinControl->Select(output.outpoint);
+        vGroups[output.nGroup].nSelected++;
+    } else {
+        coinControl->UnSelect(output.outpoint);
+        vGroups[output.nGroup].nSelected--;
+    }
+}
+
+void CoinControlModel::emitOutputChanged(size_t nOutput)
+{
+    Q_EMIT dataChanged(outputIndex(nOutput, COLUMN_CHECKBOX), outputIndex(nOutput, NUMBER_OF_COLUMNS - 1));
+    // The check state of the group follows its outputs
+    if (fTreeMode) {
+        const QModelIndex group = groupIndex(vOutputs[nOutput].nGroup, COLUMN_CHECKBOX);
+        Q_EMIT dataChanged(group, group);
+    }
+}
+
+void CoinControlModel::emitAllChanged()
+{
+    if (vRows.empty())
+        return;
+    Q_EMIT dataChanged(index(0, COLUMN_CHECKBOX), index(vRows.size() - 1, COLUMN_CHECKBOX));
+    if (fTreeMode) {
+        for (size_t nGroup = 0; nGroup < vGroups.size(); nGroup++) {
+            const size_t nOutputs = vGroups[nGroup].vOutputs.size();
+            if (nOutputs > 0)
+                Q_EMIT dataChanged(createIndex(0, COLUMN_CHECKBOX, nGroup + 1), createIndex(nOutputs - 1, COLUMN_CHECKBOX, nGroup + 1));
+        }
+    }
+}
+
+void CoinControlModel::lockCoin(const QModelIndex &index)
+{
+    if (!isOutput(index))
+        return;
+    const size_t nOutput = item(index);
+    Output& output = vOutputs[nOutput];
+    setSelected(nOutput, false);
+    walletModel->lockCoin(output.outpoint);
+    output.fLocked = true;
+    emitOutputChanged(nOutput);
+}
+
+void CoinControlModel::unlockCoin(const QModelIndex &index)
+{
+    if (!isOutput(index))
+        return;
+    const size_t nOutput = item(index);
+    Output& output = vOutputs[nOutput];
+    walletModel->unlockCoin(output.outpoint);
+    output.fLocked = false;
+    emitOutputChanged(nOutput);
+}
+
+bool CoinControlModel::hasSelection() const
+{
+    for (const Group& group : vGroups) {
+        if (group.nSelected > 0)
+            return true;
+    }
+    return false;
+}
+
+void CoinControlModel::selectAll(bool fSelect)
+{
+    for (size_t nOutput = 0; nOutput < vOutputs.size(); nOutput++) {
+        if (!vOutputs[nOutput].fLocked)
+            setSelected(nOutput, fSelect);
+    }
+    emitAllChanged();
+}
@@ -0,0 +1,142 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_QT_COINCONTROLMODEL_H
+#define BITCOIN_QT_COINCONTROLMODEL_H
+
+#include <amount.h>
+#include <primitives/transaction.h>
+
+#include <QAbstractItemModel>
+#include <QString>
+
+#include <vector>
+
+class CCoinControl;
+class PlatformStyle;
+class WalletModel;
+
+/**
+ * Model of the outputs shown by the coin control dialog, either as a list or
+ * grouped by the address they were received with.
+ *
+ * Only the few values every row needs for sorting are kept for each output;
+ * the text of a row (amount, label, date) is only formatted when a view asks
+ * for it, so a view only pays for the rows it shows. Sorting is done here, by
+ * reordering the rows, rather than by a view or proxy over every item.
+ *
+ * Check states are those of the CCoinControl selection.
+ */
+class CoinControlModel : public QAbstractItemModel
+{
+    Q_OBJECT
+
+public:
+    explicit CoinControlModel(CCoinControl *coinControl, const PlatformStyle *platformStyle, QObject *parent = 0);
+
+    enum ColumnIndex {
+        COLUMN_CHECKBOX = 0,
+        COLUMN_AMOUNT,
+        COLUMN_LABEL,
+        COLUMN_ADDRESS,
+        COLUMN_DATE,
+        COLUMN_CONFIRMATIONS,
+        NUMBER_OF_COLUMNS
+    };
+
+    enum RoleIndex {
+        /** Address of an output, or of the group it is in if it has none of its own */
+        AddressRole = Qt::UserRole,
+        /** Label of an output, or of the group it is in if it has none of its own */
+        LabelRole,
+        /** Hex transaction id of an output, empty for groups */
+        TxHashRole
+    };
+
+    /** Reload the outputs of the wallet, grouped by address if fTreeMode */
+    void setWalletModel(WalletModel *walletModel, bool fTreeMode);
+
+    /** Whether the row is an output rather than a group */
+    bool isOutput(const QModelIndex &index) const;
+    /** The output of a row; null for groups */
+    COutPoint outPoint(const QModelIndex &index) const;
+    void lockCoin(const QModelIndex &index);
+    void unlockCoin(const QModelIndex &index);
+
+    /** Whether any output is selected */
+    bool hasSelection() const;
+    /** Select all outputs that are not locked, or none */
+    void selectAll(bool fSelect);
+
+    /** @name Methods overridden from QAbstractItemModel
+        @{*/
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const;
+    QModelIndex parent(const QModelIndex &index) const;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role) const;
+    bool setData(const QModelIndex &index, const QVariant &value, int role);
+    QVariant headerData(int section, Qt::Orientation orientation, int role) const;
+    Qt::ItemFlags flags(const QModelIndex &index) const;
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder);
+    /*@}*/
+
+Q_SIGNALS:
+    /** The selection was changed through the model */
+    void selectionChanged();
+
+private:
+    struct Output
+    {
+        COutPoint outpoint;
+        CAmount nValue;
+        int64_t nTime;
+        int nDepth;
+        //! Address of the output itself, empty if it has none
+        QString address;
+        size_t nGroup;
+        bool fLocked;
+    };
+
+    struct Group
+    {
+        QString address;
+        CAmount nSum;
+        //! The outputs of the group, in the order shown
+        std::vector<size_t> vOutputs;
+        size_t nSelected;
+    };
+
+    CCoinControl *coinControl;
+    const PlatformStyle *platformStyle;
+    WalletModel *walletModel;
+    bool fTreeMode;
+    int sortColumn;
+    Qt::SortOrder sortOrder;
+
+    std::vector<Output> vOutputs;
+    std::vector<Group> vGroups;
+    //! The top level rows: groups in tree mode, outputs otherwise
+    std::vector<size_t> vRows;
+    //! Row of every output among its siblings, and of every group
+    std::vector<int> vOutputRow;
+    std::vector<int> vGroupRow;
+
+    static const quintptr TOP_LEVEL = 0;
+
+    //! Item of a row: an output, or a group in tree mode
+    size_t item(const QModelIndex &index) const;
+    QModelIndex outputIndex(size_t nOutput, int column) const;
+    QModelIndex groupIndex(size_t nGroup, int column) const;
+    QString labelForAddress(const QString &address) const;
+    //! Text of the label and address columns of an output
+    QString outputLabel(const Output &output, const QString &groupLabel) const;
+    QString outputAddress(const Output &output) const;
+    void sortRows();
+    void setSelected(size_t nOutput, bool fSelect);
+    void emitOutputChanged(size_t nOutput);
+    void emitAllChanged();
+};
+
+#endif // BITCOIN_QT_COINCONTROLMODEL_H
@@ -6,9 +6,9 @@
 #define BITCOIN_QT_COINCONTROLTREEWIDGET_H
 
 #include <QKeyEvent>
-#include <QTreeWidget>
+#include <QTreeView>
 
-class CoinControlTreeWidget : public QTreeWidget
+class CoinControlTreeWidget : public QTreeView
 {
     Q_OBJECT
 
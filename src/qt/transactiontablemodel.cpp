@@ -20,11 +20,21 @@
 #include <util.h>
 #include <wallet/wallet.h>
 
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 #include <QColor>
 #include <QDateTime>
 #include <QDebug>
 #include <QIcon>
 #include <QList>
+#include <QTimer>
+
+/** Wallet transactions decomposed per lock of the wallet while loading, and
+ *  so the most rows added to the model at once */
+static const int TX_LOAD_BATCH_SIZE = 1000;
 
 // Amount column is right-aligned it contains numbers
 static int column_alignments[] = {
@@ -59,10 +69,18 @@ class TransactionTablePriv
 public:
     TransactionTablePriv(CWallet *_wallet, TransactionTableModel *_parent) :
         wallet(_wallet),
-        parent(_parent)
+        parent(_parent),
+        fStopLoading(false)
     {
     }
 
+    ~TransactionTablePriv()
+    {
+        fStopLoading = true;
+        if (loadThread.joinable())
+            loadThread.join();
+    }
+
     CWallet *wallet;
     TransactionTableModel *parent;
 
@@ -72,20 +90,104 @@ public:
      */
     QList<TransactionRecord> cachedWallet;
 
-    /* Query entire wallet anew from core.
+    /* Batches of records decomposed by loadThread and not yet in
+     * cachedWallet, each sorted by sha256 and following the one before.
+     */
+    std::mutex cs_loaded;
+    std::deque<QList<TransactionRecord>> loaded;
+    std::atomic<bool> fStopLoading;
+    std::thread loadThread;
+
+    /* Query entire wallet anew from core, in the background: the records
+     * are added to the model a batch at a time as they are decomposed.
      */
     void refreshWallet()
     {
         qDebug() << "TransactionTablePriv::refreshWallet";
         cachedWallet.clear();
-        {
-            LOCK2(cs_main, wallet->cs_wallet);
-            for (const auto& entry : wallet->mapWallet)
+        loadThread = std::thread(&TransactionTablePriv::loadWallet, this);
+    }
+
+    void loadWallet()
+    {
+        RenameThread("bitcoin-qt-txload");
+        uint256 last;
+        bool fDone = false;
+        bool fFirst = true;
+        while (!fDone && !fStopLoading) {
+            QList<TransactionRecord> batch;
             {
-                if (TransactionRecord::showTransaction(entry.second))
-                    cachedWallet.append(TransactionRecord::decomposeTransaction(wallet, entry.second));
+                LOCK2(cs_main, wallet->cs_wallet);
+                // Transactions added behind this point are announced by
+                // NotifyTransactionChanged instead
+                auto it = fFirst ? wallet->mapWallet.begin() : wallet->mapWallet.upper_bound(last);
+                for (int n = 0; it != wallet->mapWallet.end() && n < TX_LOAD_BATCH_SIZE; ++it, ++n) {
+                    if (TransactionRecord::showTransaction(it->second))
+                        batch.append(TransactionRecord::decomposeTransaction(wallet, it->second));
+                    last = it->first;
+                }
+                fDone = it == wallet->mapWallet.end();
+                fFirst = false;
+            }
+            if (!batch.isEmpty()) {
+                {
+                    std::lock_guard<std::mutex> lock(cs_loaded);
+                    loaded.push_back(std::move(batch));
+                }
+                QMetaObject::invokeMethod(parent, "fetchLoaded", Qt::QueuedConnection);
+            }
+        }
+        qDebug() << "TransactionTablePriv::loadWallet: done";
+    }
+
+    bool hasLoaded()
+    {
+        std::lock_guard<std::mutex> lock(cs_loaded);
+        return !loaded.empty();
+    }
+
+    /* Move the oldest loaded batch into cachedWallet, returning false if
+     * there is none.
+     */
+    bool mergeLoaded()
+    {
+        QList<TransactionRecord> batch;
+        {
+            std::lock_guard<std::mutex> lock(cs_loaded);
+            if (loaded.empty())
+                return false;
+            batch = std::move(loaded.front());
+            loaded.pop_front();
+        }
+
+        // Loaded rows are not new transactions: no notification balloons
+        bool fWasProcessingQueued = parent->fProcessingQueuedTransactions;
+        parent->fProcessingQueuedTransactions = true;
+        if (cachedWallet.isEmpty() || TxLessThan()(cachedWallet.last(), batch.first())) {
+            parent->beginInsertRows(QModelIndex(), cachedWallet.size(), cachedWallet.size() + batch.size() - 1);
+            cachedWallet.append(batch);
+            parent->endInsertRows();
+        } else {
+            // Transactions announced while loading may be in the model
+            // already; insert the others one at a time
+            for (int i = 0; i < batch.size();) {
+                int j = i + 1;
+                while (j < batch.size() && batch[j].hash == batch[i].hash)
+                    j++;
+                QList<TransactionRecord>::iterator lower = qLowerBound(
+                    cachedWallet.begin(), cachedWallet.end(), batch[i].hash, TxLessThan());
+                if (lower == cachedWallet.end() || lower->hash != batch[i].hash) {
+                    int lowerIndex = lower - cachedWallet.begin();
+                    parent->beginInsertRows(QModelIndex(), lowerIndex, lowerIndex + j - i - 1);
+                    for (int k = i; k < j; k++)
+                        cachedWallet.insert(lowerIndex + k - i, batch[k]);
+                    parent->endInsertRows();
+                }
+                i = j;
             }
         }
+        parent->fProcessingQueuedTransactions = fWasProcessingQueued;
+        return true;
     }
 
     /* Update our model of the wallet incrementally, to synchronize our model of the wallet
@@ -97,6 +199,9 @@ public:
     {
         qDebug() << "TransactionTablePriv::updateWallet: " + QString::fromStdString(hash.ToString()) + " " + QString::number(status);
 
+        // The loaded records are older than the change: take them in first
+        while (mergeLoaded()) {}
+
         // Find bounds of this transaction in model
         QList<TransactionRecord>::iterator lower = qLowerBound(
             cachedWallet.begin(), cachedWallet.end(), hash, TxLessThan());
@@ -271,7 +376,43 @@ void TransactionTableModel::updateTransaction(const QString &hash, int status, b
     uint256 updated;
     updated.SetHex(hash.toStdString());
 
-    priv->updateWallet(updated, status, showTransaction);
+    // Changes come one transaction at a time, many at once when a block is
+    // connected: apply them together once those queued behind are in
+    if (vUpdates.empty())
+        QTimer::singleShot(0, this, SLOT(processUpdates()));
+    vUpdates.push_back(TransactionUpdate{updated, status, showTransaction, fProcessingQueuedTransactions});
+}
+
+void TransactionTableModel::processUpdates()
+{
+    std::vector<TransactionUpdate> updates;
+    updates.swap(vUpdates);
+    bool fWasProcessingQueued = fProcessingQueuedTransactions;
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        for (const TransactionUpdate& update : updates) {
+            fProcessingQueuedTransactions = update.fProcessingQueued;
+            priv->updateWallet(update.hash, update.status, update.showTransaction);
+        }
+    }
+    fProcessingQueuedTransactions = fWasProcessingQueued;
+}
+
+bool TransactionTableModel::canFetchMore(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent);
+    return priv->hasLoaded();
+}
+
+void TransactionTableModel::fetchMore(const QModelIndex &parent)
+{
+    Q_UNUSED(parent);
+    priv->mergeLoaded();
+}
+
+void TransactionTableModel::fetchLoaded()
+{
+    fetchMore(QModelIndex());
 }
 
 void TransactionTableModel::updateConfirmations()
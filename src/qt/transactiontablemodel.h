@@ -6,10 +6,13 @@
 #define BITCOIN_QT_TRANSACTIONTABLEMODEL_H
 
 #include <qt/bitcoinunits.h>
+#include <uint256.h>
 
 #include <QAbstractTableModel>
 #include <QStringList>
 
+#include <vector>
+
 class PlatformStyle;
 class TransactionRecord;
 class TransactionTablePriv;
@@ -17,7 +20,21 @@ class WalletModel;
 
 class CWallet;
 
+/** A change to a wallet transaction, waiting to be applied to the model */
+struct TransactionUpdate
+{
+    uint256 hash;
+    int status;
+    bool showTransaction;
+    //! TransactionTableModel::processingQueuedTransactions when it came
+    bool fProcessingQueued;
+};
+
 /** UI model for the transaction table of a wallet.
+
+    The transactions are decomposed into rows on a thread of their own, and
+    the rows added as they come (see canFetchMore/fetchMore), so that a large
+    wallet does not hold up the GUI.
  */
 class TransactionTableModel : public QAbstractTableModel
 {
@@ -79,6 +96,9 @@ public:
     QVariant data(const QModelIndex &index, int role) const;
     QVariant headerData(int section, Qt::Orientation orientation, int role) const;
     QModelIndex index(int row, int column, const QModelIndex & parent = QModelIndex()) const;
+    /** Whether rows loaded in the background are waiting to be added */
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
     bool processingQueuedTransactions() const { return fProcessingQueuedTransactions; }
 
 private:
@@ -88,6 +108,8 @@ private:
     TransactionTablePriv *priv;
     bool fProcessingQueuedTransactions;
     const PlatformStyle *platformStyle;
+    //! Changes waiting for processUpdates
+    std::vector<TransactionUpdate> vUpdates;
 
     void subscribeToCoreSignals();
     void unsubscribeFromCoreSignals();
@@ -107,6 +129,10 @@ private:
 public Q_SLOTS:
     /* New transaction, or transaction changed status */
     void updateTransaction(const QString &hash, int status, bool showTransaction);
+    /* Apply the changes updateTransaction queued */
+    void processUpdates();
+    /* Add a batch of rows loaded in the background */
+    void fetchLoaded();
     void updateConfirmations();
     void updateDisplayUnit();
     /** Updates the column title to "Amount (DisplayUnit)" and emits headerDataChanged() signal for table headers to react. */
@@ -390,7 +390,7 @@ uint256 FastRandomContext::rand256()
         FillByteBuffer();
     }
     uint256 ret;
-    memcpy(ret.begin(), bytebuf + 64 - bytebuf_size, 32);
+    memcpy(ret.begin(), bytebuf + sizeof(bytebuf) - bytebuf_size, 32);
     bytebuf_size -= 32;
     return ret;
 }
@@ -46,7 +46,8 @@ private:
     bool requires_seed;
     ChaCha20 rng;
 
-    unsigned char bytebuf[64];
+    //! Several ChaCha20 blocks, which it can compute at once
+    unsigned char bytebuf[256];
     int bytebuf_size;
 
     uint64_t bitbuf;
@@ -79,7 +80,7 @@ public:
     uint64_t rand64()
     {
         if (bytebuf_size < 8) FillByteBuffer();
-        uint64_t ret = ReadLE64(bytebuf + 64 - bytebuf_size);
+        uint64_t ret = ReadLE64(bytebuf + sizeof(bytebuf) - bytebuf_size);
         bytebuf_size -= 8;
         return ret;
     }
@@ -10,11 +10,15 @@
 #include <primitives/transaction.h>
 #include <validation.h>
 #include <httpserver.h>
+#include <httprpc.h>
+#include <index/txindex.h>
 #include <rpc/blockchain.h>
 #include <rpc/server.h>
 #include <streams.h>
 #include <sync.h>
 #include <txmempool.h>
+#include <undo.h>
+#include <util.h>
 #include <utilstrencodings.h>
 #include <version.h>
 
@@ -23,6 +27,11 @@
 #include <univalue.h>
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const long MAX_REST_BLOCKS = 20; //allow a max of 20 blocks to be fetched at once
+static const int32_t MAX_REST_RANGE = 10000; //allow a max of 10000 blocks, undo records or headers per range request
+
+//! The most outpoints a batched getutxos request may query (-restmaxoutpoints)
+static uint64_t nRESTMaxOutPoints = DEFAULT_REST_MAX_OUTPOINTS;
 
 enum RetFormat {
     RF_UNDEF,
@@ -113,6 +122,129 @@ static bool ParseHashStr(const std::string& strReq, uint256& v)
     return true;
 }
 
+/**
+ * Append obj preceded by its serialized size as a CompactSize, so that a
+ * response holding several records can be split without parsing them.
+ */
+template <typename T>
+static void SerializeFramed(CDataStream& ss, const T& obj)
+{
+    WriteCompactSize(ss, GetSerializeSize(obj, ss.GetType(), ss.GetVersion()));
+    ss << obj;
+}
+
+/** Reply with serialized data in the binary or hex format */
+static bool RESTSerializedReply(HTTPRequest* req, const RetFormat rf, const CDataStream& ss)
+{
+    switch (rf) {
+    case RF_BINARY: {
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, ss.str());
+        return true;
+    }
+    case RF_HEX: {
+        std::string strHex = HexStr(ss.begin(), ss.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+    }
+    }
+}
+
+/**
+ * Writes a range reply in the binary or hex format as a chunked reply, a
+ * piece at a time, so that the range is never held in memory at once. While
+ * the client is slow to take the data, WriteReplyChunk holds the writer back.
+ */
+class RESTRangeWriter
+{
+public:
+    //! Bytes collected before they are sent
+    static const size_t FLUSH_SIZE = 256 * 1024;
+
+    RESTRangeWriter(HTTPRequest* reqIn, RetFormat rfIn) :
+        req(reqIn), rf(rfIn), ss(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags()), fStarted(false) {}
+
+    /** Where the records go */
+    CDataStream& Stream() { return ss; }
+
+    /** Whether the reply was started, after which errors can no longer be reported */
+    bool IsStarted() const { return fStarted; }
+
+    /** Send what was collected if it is enough. Returns false if the client went away. */
+    bool FlushIfFull()
+    {
+        return ss.size() < FLUSH_SIZE || Flush();
+    }
+
+    /** Send the rest and finish the reply */
+    void Finish()
+    {
+        if (Flush() && rf == RF_HEX)
+            req->WriteReplyChunk("\n");
+        req->EndChunkedReply();
+    }
+
+private:
+    HTTPRequest* req;
+    const RetFormat rf;
+    CDataStream ss;
+    bool fStarted;
+
+    bool Flush()
+    {
+        if (!fStarted) {
+            req->WriteHeader("Content-Type", rf == RF_BINARY ? "application/octet-stream" : "text/plain");
+            req->StartChunkedReply(HTTP_OK);
+            fStarted = true;
+        }
+        bool fOk = ss.empty() || req->WriteReplyChunk(rf == RF_BINARY ? ss.str() : HexStr(ss.begin(), ss.end()));
+        ss.clear();
+        return fOk;
+    }
+};
+
+/**
+ * Report an error in a range reply. Once data was sent, the status cannot
+ * change any more, so the reply is cut short after the last whole record.
+ */
+static bool RESTRangeError(HTTPRequest* req, RESTRangeWriter& writer, const std::string& message)
+{
+    if (!writer.IsStarted())
+        return RESTERR(req, HTTP_NOT_FOUND, message);
+    LogPrintf("REST range reply to %s cut short: %s\n", req->GetURI(), message);
+    writer.Finish();
+    return false;
+}
+
+/**
+ * Parse <start>/<count> of a range request into the blocks of the active
+ * chain at those heights, cut off at the tip. The chain snapshot is used, so
+ * that the blocks are found without waiting for cs_main.
+ */
+static bool ParseBlockRange(HTTPRequest* req, const std::string& strStart, const std::string& strCount, std::vector<const CBlockIndex*>& blocks)
+{
+    int32_t nStart, nCount;
+    if (!ParseInt32(strStart, &nStart) || nStart < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid start height: " + strStart);
+    if (!ParseInt32(strCount, &nCount) || nCount < 1 || nCount > MAX_REST_RANGE)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Count out of range: " + strCount);
+
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
+    if (nStart > chain->Height())
+        return RESTERR(req, HTTP_NOT_FOUND, "Start height after the tip: " + strStart);
+    int nEnd = std::min<int64_t>((int64_t)nStart + nCount - 1, chain->Height());
+
+    blocks.resize(nEnd - nStart + 1);
+    const CBlockIndex* pindex = (*chain)[nEnd];
+    for (int nHeight = nEnd; nHeight >= nStart; nHeight--, pindex = pindex->pprev)
+        blocks[nHeight - nStart] = pindex;
+    return true;
+}
+
 static bool CheckWarmup(HTTPRequest* req)
 {
     std::string statusmessage;
@@ -121,6 +253,27 @@ static bool CheckWarmup(HTTPRequest* req)
     return true;
 }
 
+/** /rest/headers/<start>/<count>: the headers at consecutive heights */
+static bool rest_headers_range(HTTPRequest* req, const RetFormat rf, const std::string& strStart, const std::string& strCount)
+{
+    if (rf != RF_BINARY && rf != RF_HEX)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+
+    std::vector<const CBlockIndex*> blocks;
+    if (!ParseBlockRange(req, strStart, strCount, blocks))
+        return false;
+
+    // The header fields of an index entry never change, so no lock is needed
+    RESTRangeWriter writer(req, rf);
+    for (const CBlockIndex* pindex : blocks) {
+        writer.Stream() << pindex->GetBlockHeader();
+        if (!writer.FlushIfFull())
+            break;
+    }
+    writer.Finish();
+    return true;
+}
+
 static bool rest_headers(HTTPRequest* req,
                          const std::string& strURIPart)
 {
@@ -132,7 +285,10 @@ static bool rest_headers(HTTPRequest* req,
     boost::split(path, param, boost::is_any_of("/"));
 
     if (path.size() != 2)
-        return RESTERR(req, HTTP_BAD_REQUEST, "No header count specified. Use /rest/headers/<count>/<hash>.<ext>.");
+        return RESTERR(req, HTTP_BAD_REQUEST, "No header count specified. Use /rest/headers/<count>/<hash>.<ext> or /rest/headers/<start>/<count>.<ext>.");
+
+    if (!IsHex(path[1]) || path[1].size() != 64)
+        return rest_headers_range(req, rf, path[0], path[1]);
 
     long count = strtol(path[0].c_str(), nullptr, 10);
     if (count < 1 || count > 2000)
@@ -216,7 +372,7 @@ static bool rest_block(HTTPRequest* req,
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
 
         pblockindex = mapBlockIndex[hash];
-        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        if ((fHavePruned || fSnapshotChainstate) && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
         if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
@@ -269,6 +425,155 @@ static bool rest_block_notxdetails(HTTPRequest* req, const std::string& strURIPa
     return rest_block(req, strURIPart, false);
 }
 
+/** /rest/blocks/<start>/<count>: the blocks at consecutive heights, each preceded by its size */
+static bool rest_blocks_range(HTTPRequest* req, const RetFormat rf, const std::string& strStart, const std::string& strCount)
+{
+    if (rf != RF_BINARY && rf != RF_HEX)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+
+    std::vector<const CBlockIndex*> blocks;
+    if (!ParseBlockRange(req, strStart, strCount, blocks))
+        return false;
+
+    // Blocks are stored with witness data, so unless that must be left out,
+    // they are copied from the block files without deserializing them
+    const bool fRaw = !(RPCSerializationFlags() & SERIALIZE_TRANSACTION_NO_WITNESS);
+    RESTRangeWriter writer(req, rf);
+    std::vector<unsigned char> raw;
+    for (const CBlockIndex* pindex : blocks) {
+        if (fRaw) {
+            if (!ReadRawBlockFromDisk(raw, pindex, Params().MessageStart()))
+                return RESTRangeError(req, writer, pindex->GetBlockHash().GetHex() + " not available");
+            WriteCompactSize(writer.Stream(), raw.size());
+            writer.Stream().write((const char*)raw.data(), raw.size());
+        } else {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+                return RESTRangeError(req, writer, pindex->GetBlockHash().GetHex() + " not available");
+            SerializeFramed(writer.Stream(), block);
+        }
+        if (!writer.FlushIfFull())
+            break;
+    }
+    writer.Finish();
+    return true;
+}
+
+static bool rest_blocks(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No block count specified. Use /rest/blocks/<count>/<hash>.<ext> or /rest/blocks/<start>/<count>.<ext>.");
+
+    if (!IsHex(path[1]) || path[1].size() != 64)
+        return rest_blocks_range(req, rf, path[0], path[1]);
+
+    long count = strtol(path[0].c_str(), nullptr, 10);
+    if (count < 1 || count > MAX_REST_BLOCKS)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + path[0]);
+
+    std::string hashStr = path[1];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    if (rf != RF_BINARY && rf != RF_HEX)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+
+    CDataStream ssBlocks(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        const CBlockIndex* pindex = (it != mapBlockIndex.end()) ? it->second : nullptr;
+        if (pindex == nullptr || !chainActive.Contains(pindex))
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found in the active chain");
+
+        for (long i = 0; i < count && pindex != nullptr; i++, pindex = chainActive.Next(pindex)) {
+            if ((fHavePruned || fSnapshotChainstate) && !(pindex->nStatus & BLOCK_HAVE_DATA) && pindex->nTx > 0)
+                return RESTERR(req, HTTP_NOT_FOUND, pindex->GetBlockHash().GetHex() + " not available (pruned data)");
+
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+                return RESTERR(req, HTTP_NOT_FOUND, pindex->GetBlockHash().GetHex() + " not found");
+            SerializeFramed(ssBlocks, block);
+        }
+    }
+
+    return RESTSerializedReply(req, rf, ssBlocks);
+}
+
+/** /rest/blockundo/<start>/<count>: the undo data of blocks at consecutive heights, each preceded by its size */
+static bool rest_blockundo_range(HTTPRequest* req, const RetFormat rf, const std::string& strStart, const std::string& strCount)
+{
+    if (rf != RF_BINARY && rf != RF_HEX)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+
+    std::vector<const CBlockIndex*> blocks;
+    if (!ParseBlockRange(req, strStart, strCount, blocks))
+        return false;
+
+    RESTRangeWriter writer(req, rf);
+    for (const CBlockIndex* pindex : blocks) {
+        // The genesis block spends nothing, so its undo data is empty
+        CBlockUndo blockUndo;
+        if (pindex->pprev && !UndoReadFromDisk(blockUndo, pindex))
+            return RESTRangeError(req, writer, pindex->GetBlockHash().GetHex() + " undo data not available");
+        SerializeFramed(writer.Stream(), blockUndo);
+        if (!writer.FlushIfFull())
+            break;
+    }
+    writer.Finish();
+    return true;
+}
+
+static bool rest_blockundo(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string hashStr;
+    const RetFormat rf = ParseDataFormat(hashStr, strURIPart);
+
+    std::vector<std::string> path;
+    boost::split(path, hashStr, boost::is_any_of("/"));
+    if (path.size() == 2)
+        return rest_blockundo_range(req, rf, path[0], path[1]);
+
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    if (rf != RF_BINARY && rf != RF_HEX)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+
+    CBlockUndo blockUndo;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        if (it == mapBlockIndex.end())
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+
+        // Undo data exists only for blocks that were connected, except the
+        // genesis block, and not pruned since
+        const CBlockIndex* pindex = it->second;
+        if (!(pindex->nStatus & BLOCK_HAVE_UNDO))
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " undo data not available");
+
+        if (!UndoReadFromDisk(blockUndo, pindex))
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " undo data not found");
+    }
+
+    CDataStream ssUndo(SER_NETWORK, PROTOCOL_VERSION);
+    ssUndo << blockUndo;
+
+    return RESTSerializedReply(req, rf, ssUndo);
+}
+
 // A bit of a hack - dependency on a function defined in rpc/blockchain.cpp
 UniValue getblockchaininfo(const JSONRPCRequest& request);
 
@@ -333,8 +638,18 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
         req->WriteReply(HTTP_OK, strJSON);
         return true;
     }
+    case RF_BINARY:
+    case RF_HEX: {
+        CDataStream ssTxs(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+        {
+            LOCK(mempool.cs);
+            for (const CTxMemPoolEntry& e : mempool.mapTx)
+                SerializeFramed(ssTxs, e.GetTx());
+        }
+        return RESTSerializedReply(req, rf, ssTxs);
+    }
     default: {
-        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
     }
     }
 }
@@ -350,6 +665,10 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
+    if (g_txindex) {
+        g_txindex->BlockUntilSyncedToCurrentChain();
+    }
+
     CTransactionRef tx;
     uint256 hashBlock = uint256();
     if (!GetTransaction(hash, tx, Params().GetConsensus(), hashBlock, true))
@@ -570,6 +889,103 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     }
 }
 
+/**
+ * Query many outpoints at once (/rest/getutxos/batch.<bin|hex>). The request
+ * body is the BIP64 binary request; the reply holds the chain height, tip hash
+ * and hit bitmap as in BIP64, followed by the unspent outputs in the
+ * compressed serialization of the UTXO database. The outpoints are looked up
+ * in one bulk call rather than one by one, and up to -restmaxoutpoints may be
+ * queried.
+ */
+static bool rest_getutxos_batch(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (!param.empty())
+        return RESTERR(req, HTTP_BAD_REQUEST, "Outpoints must be sent in the request body");
+
+    std::string strRequest = req->ReadBody();
+    switch (rf) {
+    case RF_HEX: {
+        std::vector<unsigned char> vRequest = ParseHex(strRequest);
+        strRequest.assign(vRequest.begin(), vRequest.end());
+        break;
+    }
+    case RF_BINARY:
+        break;
+    default:
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: bin, hex)");
+    }
+    if (strRequest.empty())
+        return RESTERR(req, HTTP_BAD_REQUEST, "Error: empty request");
+
+    bool fCheckMemPool;
+    std::vector<COutPoint> vOutPoints;
+    try {
+        CDataStream ss(strRequest.data(), strRequest.data() + strRequest.size(), SER_NETWORK, PROTOCOL_VERSION);
+        ss >> fCheckMemPool;
+        // Check the count before reading the outpoints, so that an oversized
+        // request is refused without being deserialized
+        uint64_t nOutPoints = ReadCompactSize(ss);
+        if (nOutPoints > nRESTMaxOutPoints)
+            return RESTERR(req, HTTP_BAD_REQUEST, strprintf("Error: max outpoints exceeded (max: %d, tried: %d)", nRESTMaxOutPoints, nOutPoints));
+        if (nOutPoints * 36 > ss.size())
+            return RESTERR(req, HTTP_BAD_REQUEST, "Parse error");
+        vOutPoints.resize(nOutPoints);
+        for (COutPoint& outpoint : vOutPoints)
+            ss >> outpoint;
+    } catch (const std::ios_base::failure&) {
+        return RESTERR(req, HTTP_BAD_REQUEST, "Parse error");
+    }
+    if (vOutPoints.empty())
+        return RESTERR(req, HTTP_BAD_REQUEST, "Error: empty request");
+
+    std::vector<Coin> coins;
+    std::vector<unsigned char> bitmap((vOutPoints.size() + 7) / 8);
+    size_t nHits = 0;
+    int nHeight;
+    uint256 hashTip;
+    {
+        LOCK2(cs_main, mempool.cs);
+        if (fCheckMemPool) {
+            CCoinsViewMemPool viewMempool(pcoinsTip.get(), mempool);
+            viewMempool.GetCoins(vOutPoints, coins);
+        } else {
+            pcoinsTip->GetCoins(vOutPoints, coins);
+        }
+        for (size_t i = 0; i < vOutPoints.size(); i++) {
+            if (coins[i].IsSpent() || mempool.isSpent(vOutPoints[i])) {
+                coins[i].Clear();
+                continue;
+            }
+            bitmap[i / 8] |= 1 << (i % 8);
+            nHits++;
+        }
+        nHeight = chainActive.Height();
+        hashTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
+    ssGetUTXOResponse << nHeight << hashTip << bitmap;
+    WriteCompactSize(ssGetUTXOResponse, nHits);
+    for (const Coin& coin : coins) {
+        if (!coin.IsSpent())
+            ssGetUTXOResponse << coin;
+    }
+
+    if (rf == RF_HEX) {
+        std::string strHex = HexStr(ssGetUTXOResponse.begin(), ssGetUTXOResponse.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+    req->WriteHeader("Content-Type", "application/octet-stream");
+    req->WriteReply(HTTP_OK, ssGetUTXOResponse.str());
+    return true;
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(HTTPRequest* req, const std::string& strReq);
@@ -577,15 +993,19 @@ static const struct {
       {"/rest/tx/", rest_tx},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
+      {"/rest/blocks/", rest_blocks},
+      {"/rest/blockundo/", rest_blockundo},
       {"/rest/chaininfo", rest_chaininfo},
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
+      {"/rest/getutxos/batch", rest_getutxos_batch},
       {"/rest/getutxos", rest_getutxos},
 };
 
 bool StartREST()
 {
+    nRESTMaxOutPoints = std::max<int64_t>(gArgs.GetArg("-restmaxoutpoints", DEFAULT_REST_MAX_OUTPOINTS), 1);
     for (unsigned int i = 0; i < ARRAYLEN(uri_prefixes); i++)
         RegisterHTTPHandler(uri_prefixes[i].prefix, false, uri_prefixes[i].handler);
     return true;
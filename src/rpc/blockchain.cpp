@@ -6,24 +6,37 @@
 #include <rpc/blockchain.h>
 
 #include <amount.h>
+#include <base58.h>
+#include <blockfilter.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <coins.h>
+#include <coinstats.h>
 #include <consensus/validation.h>
 #include <validation.h>
 #include <core_io.h>
+#include <crypto/common.h>
 #include <policy/feerate.h>
 #include <policy/policy.h>
+#include <random.h>
 #include <primitives/transaction.h>
+#include <rpc/jsonwriter.h>
 #include <rpc/server.h>
+#include <script/standard.h>
 #include <streams.h>
 #include <sync.h>
+#include <taskpool.h>
 #include <txdb.h>
 #include <txmempool.h>
+#include <undo.h>
 #include <util.h>
 #include <utilstrencodings.h>
 #include <hash.h>
+#include <init.h>
+#include <index/addressindex.h>
+#include <index/blockfilterindex.h>
+#include <index/txindex.h>
 #include <validationinterface.h>
 #include <warnings.h>
 
@@ -33,9 +46,11 @@
 
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <condition_variable>
+#include <unordered_set>
 
 struct CUpdatedBlock
 {
@@ -85,15 +100,16 @@ double GetDifficulty(const CBlockIndex* blockindex)
     return GetDifficulty(chainActive, blockindex);
 }
 
-UniValue blockheaderToJSON(const CBlockIndex* blockindex)
+/** Block header to JSON, with the confirmations and next block taken from chain */
+template <typename Chain>
+static UniValue blockheaderToJSON(const Chain& chain, const CBlockIndex* blockindex)
 {
-    AssertLockHeld(cs_main);
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    if (chain.Contains(blockindex))
+        confirmations = chain.Height() - blockindex->nHeight + 1;
     result.push_back(Pair("confirmations", confirmations));
     result.push_back(Pair("height", blockindex->nHeight));
     result.push_back(Pair("version", blockindex->nVersion));
@@ -109,13 +125,20 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 
     if (blockindex->pprev)
         result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
+    const CBlockIndex *pnext = chain.Next(blockindex);
     if (pnext)
         result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+UniValue blockheaderToJSON(const CBlockIndex* blockindex)
+{
+    AssertLockHeld(cs_main);
+    return blockheaderToJSON(chainActive, blockindex);
+}
+
+/** The fields of blockToJSON, with "tx" left null so that it keeps its place */
+static UniValue blockFieldsToJSON(const CBlock& block, const CBlockIndex* blockindex)
 {
     AssertLockHeld(cs_main);
     UniValue result(UniValue::VOBJ);
@@ -132,19 +155,7 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.push_back(Pair("version", block.nVersion));
     result.push_back(Pair("versionHex", strprintf("%08x", block.nVersion)));
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    UniValue txs(UniValue::VARR);
-    for(const auto& tx : block.vtx)
-    {
-        if(txDetails)
-        {
-            UniValue objTx(UniValue::VOBJ);
-            TxToUniv(*tx, uint256(), objTx, true, RPCSerializationFlags());
-            txs.push_back(objTx);
-        }
-        else
-            txs.push_back(tx->GetHash().GetHex());
-    }
-    result.push_back(Pair("tx", txs));
+    result.push_back(Pair("tx", NullUniValue));
     result.push_back(Pair("time", block.GetBlockTime()));
     result.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
     result.push_back(Pair("nonce", (uint64_t)block.nNonce));
@@ -161,6 +172,45 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     return result;
 }
 
+static UniValue blockTxToJSON(const CTransaction& tx, bool txDetails)
+{
+    if (!txDetails)
+        return tx.GetHash().GetHex();
+    UniValue objTx(UniValue::VOBJ);
+    TxToUniv(tx, uint256(), objTx, true, RPCSerializationFlags());
+    return objTx;
+}
+
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+{
+    UniValue result = blockFieldsToJSON(block, blockindex);
+    UniValue txs(UniValue::VARR);
+    for(const auto& tx : block.vtx)
+        txs.push_back(blockTxToJSON(*tx, txDetails));
+    result.pushKV("tx", txs);
+    return result;
+}
+
+void blockToJSON(JSONStreamWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+{
+    const UniValue fields = blockFieldsToJSON(block, blockindex);
+    writer.BeginObject();
+    for (size_t i = 0; i < fields.size(); i++) {
+        const std::string& key = fields.getKeys()[i];
+        writer.Key(key);
+        if (key != "tx") {
+            writer.Value(fields.getValues()[i]);
+            continue;
+        }
+        // Only one transaction is held as a UniValue at a time
+        writer.BeginArray();
+        for (const auto& tx : block.vtx)
+            writer.Value(blockTxToJSON(*tx, txDetails));
+        writer.EndArray();
+    }
+    writer.EndObject();
+}
+
 UniValue getblockcount(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -174,8 +224,7 @@ UniValue getblockcount(const JSONRPCRequest& request)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    return GetChainSnapshot()->Height();
 }
 
 UniValue getbestblockhash(const JSONRPCRequest& request)
@@ -191,8 +240,7 @@ UniValue getbestblockhash(const JSONRPCRequest& request)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    return GetChainSnapshot()->Tip()->GetBlockHash().GetHex();
 }
 
 void RPCNotifyBlockChange(bool ibd, const CBlockIndex * pindex)
@@ -378,29 +426,69 @@ std::string EntryDescriptionString()
            "       ... ]\n";
 }
 
-void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
+/**
+ * The fields of a mempool entry shown by entryToJSON, copied so that the JSON
+ * can be built after mempool.cs is released.
+ */
+struct MempoolEntrySnapshot
+{
+    uint256 hash;
+    uint256 wtxid;
+    size_t nTxSize;
+    CAmount nFee;
+    CAmount nModifiedFee;
+    int64_t nTime;
+    unsigned int nHeight;
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    std::vector<uint256> vDepends;
+};
+
+static void SnapshotEntry(MempoolEntrySnapshot& snapshot, CTxMemPool::txiter it)
 {
     AssertLockHeld(mempool.cs);
 
-    info.push_back(Pair("size", (int)e.GetTxSize()));
-    info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
-    info.push_back(Pair("modifiedfee", ValueFromAmount(e.GetModifiedFee())));
-    info.push_back(Pair("time", e.GetTime()));
-    info.push_back(Pair("height", (int)e.GetHeight()));
-    info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
-    info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
-    info.push_back(Pair("descendantfees", e.GetModFeesWithDescendants()));
-    info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
-    info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
-    info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
-    info.push_back(Pair("wtxid", mempool.vTxHashes[e.vTxHashesIdx].first.ToString()));
-    const CTransaction& tx = e.GetTx();
+    const CTxMemPoolEntry& e = *it;
+    snapshot.hash = e.GetTx().GetHash();
+    snapshot.wtxid = mempool.vTxHashes[e.vTxHashesIdx].first;
+    snapshot.nTxSize = e.GetTxSize();
+    snapshot.nFee = e.GetFee();
+    snapshot.nModifiedFee = e.GetModifiedFee();
+    snapshot.nTime = e.GetTime();
+    snapshot.nHeight = e.GetHeight();
+    snapshot.nCountWithDescendants = e.GetCountWithDescendants();
+    snapshot.nSizeWithDescendants = e.GetSizeWithDescendants();
+    snapshot.nModFeesWithDescendants = e.GetModFeesWithDescendants();
+    snapshot.nCountWithAncestors = e.GetCountWithAncestors();
+    snapshot.nSizeWithAncestors = e.GetSizeWithAncestors();
+    snapshot.nModFeesWithAncestors = e.GetModFeesWithAncestors();
+    // The in-mempool parents are exactly the in-mempool transactions spent
+    snapshot.vDepends.clear();
+    for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(it))
+        snapshot.vDepends.push_back(parent->GetTx().GetHash());
+}
+
+static void entryToJSON(UniValue &info, const MempoolEntrySnapshot &e)
+{
+    info.push_back(Pair("size", (int)e.nTxSize));
+    info.push_back(Pair("fee", ValueFromAmount(e.nFee)));
+    info.push_back(Pair("modifiedfee", ValueFromAmount(e.nModifiedFee)));
+    info.push_back(Pair("time", e.nTime));
+    info.push_back(Pair("height", (int)e.nHeight));
+    info.push_back(Pair("descendantcount", e.nCountWithDescendants));
+    info.push_back(Pair("descendantsize", e.nSizeWithDescendants));
+    info.push_back(Pair("descendantfees", e.nModFeesWithDescendants));
+    info.push_back(Pair("ancestorcount", e.nCountWithAncestors));
+    info.push_back(Pair("ancestorsize", e.nSizeWithAncestors));
+    info.push_back(Pair("ancestorfees", e.nModFeesWithAncestors));
+    info.push_back(Pair("wtxid", e.wtxid.ToString()));
     std::set<std::string> setDepends;
-    for (const CTxIn& txin : tx.vin)
-    {
-        if (mempool.exists(txin.prevout.hash))
-            setDepends.insert(txin.prevout.hash.ToString());
-    }
+    for (const uint256& dep : e.vDepends)
+        setDepends.insert(dep.ToString());
 
     UniValue depends(UniValue::VARR);
     for (const std::string& dep : setDepends)
@@ -411,18 +499,36 @@ void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
     info.push_back(Pair("depends", depends));
 }
 
+void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
+{
+    AssertLockHeld(mempool.cs);
+
+    MempoolEntrySnapshot snapshot;
+    SnapshotEntry(snapshot, mempool.mapTx.iterator_to(e));
+    entryToJSON(info, snapshot);
+}
+
+/** Copy the fields of all mempool entries, holding mempool.cs only meanwhile */
+static std::vector<MempoolEntrySnapshot> SnapshotMempool()
+{
+    LOCK(mempool.cs);
+    std::vector<MempoolEntrySnapshot> vSnapshot(mempool.mapTx.size());
+    size_t i = 0;
+    for (CTxMemPool::txiter it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it)
+        SnapshotEntry(vSnapshot[i++], it);
+    return vSnapshot;
+}
+
 UniValue mempoolToJSON(bool fVerbose)
 {
     if (fVerbose)
     {
-        LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
-        for (const CTxMemPoolEntry& e : mempool.mapTx)
+        for (const MempoolEntrySnapshot& e : SnapshotMempool())
         {
-            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
             entryToJSON(info, e);
-            o.push_back(Pair(hash.ToString(), info));
+            o.push_back(Pair(e.hash.ToString(), info));
         }
         return o;
     }
@@ -439,15 +545,30 @@ UniValue mempoolToJSON(bool fVerbose)
     }
 }
 
+void mempoolToJSON(JSONStreamWriter& writer)
+{
+    writer.BeginObject();
+    for (const MempoolEntrySnapshot& e : SnapshotMempool())
+    {
+        UniValue info(UniValue::VOBJ);
+        entryToJSON(info, e);
+        writer.Key(e.hash.ToString());
+        writer.Value(info);
+    }
+    writer.EndObject();
+}
+
 UniValue getrawmempool(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() > 1)
+    if (request.fHelp || request.params.size() > 2)
         throw std::runtime_error(
-            "getrawmempool ( verbose )\n"
+            "getrawmempool ( verbose mempool_sequence )\n"
             "\nReturns all transaction ids in memory pool as a json array of string transaction ids.\n"
             "\nHint: use getmempoolentry to fetch a specific transaction from the mempool.\n"
             "\nArguments:\n"
             "1. verbose (boolean, optional, default=false) True for a json object, false for array of transaction ids\n"
+            "2. mempool_sequence (boolean, optional, default=false) If verbose=false, also return the mempool sequence\n"
+            "   number to pass to getmempoolchanges. Cannot be combined with verbose=true\n"
             "\nResult: (for verbose = false):\n"
             "[                     (json array of string)\n"
             "  \"transactionid\"     (string) The transaction id\n"
@@ -459,6 +580,14 @@ UniValue getrawmempool(const JSONRPCRequest& request)
             + EntryDescriptionString()
             + "  }, ...\n"
             "}\n"
+            "\nResult: (for verbose = false and mempool_sequence = true):\n"
+            "{                           (json object)\n"
+            "  \"txids\" : [               (json array of string)\n"
+            "    \"transactionid\"         (string) The transaction id\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"mempool_sequence\" : n    (numeric) The number of the last addition to or removal from the mempool\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getrawmempool", "true")
             + HelpExampleRpc("getrawmempool", "true")
@@ -468,9 +597,96 @@ UniValue getrawmempool(const JSONRPCRequest& request)
     if (!request.params[0].isNull())
         fVerbose = request.params[0].get_bool();
 
+    if (!request.params[1].isNull() && request.params[1].get_bool()) {
+        if (fVerbose)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbose results cannot contain the mempool sequence");
+        UniValue txids(UniValue::VARR);
+        uint64_t nSequence;
+        {
+            LOCK(mempool.cs);
+            std::vector<uint256> vtxid;
+            mempool.queryHashes(vtxid);
+            nSequence = mempool.GetSequence();
+            for (const uint256& hash : vtxid)
+                txids.push_back(hash.ToString());
+        }
+        UniValue o(UniValue::VOBJ);
+        o.push_back(Pair("txids", txids));
+        o.push_back(Pair("mempool_sequence", nSequence));
+        return o;
+    }
+
+    if (fVerbose && request.resultStream) {
+        mempoolToJSON(request.resultStream->Begin());
+        return NullUniValue;
+    }
+
     return mempoolToJSON(fVerbose);
 }
 
+UniValue getmempoolchanges(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "getmempoolchanges mempool_sequence\n"
+            "\nReturns the transactions added to and removed from the memory pool since the given mempool\n"
+            "sequence number, as returned by getrawmempool or an earlier call. Transactions both added and\n"
+            "removed since then are not listed. Only the latest " + std::to_string(MEMPOOL_CHANGE_LOG_SIZE) + " changes are known;\n"
+            "for older sequence numbers an error is returned and getrawmempool must be used again.\n"
+            "\nArguments:\n"
+            "1. mempool_sequence  (numeric, required) The mempool sequence number to start from\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"added\" : [ \"transactionid\", ... ],    (json array of string) Transactions now in the mempool\n"
+            "  \"removed\" : [ \"transactionid\", ... ],  (json array of string) Transactions no longer in the mempool\n"
+            "  \"mempool_sequence\" : n                 (numeric) The sequence number to pass next time\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmempoolchanges", "1234")
+            + HelpExampleRpc("getmempoolchanges", "1234")
+        );
+
+    const int64_t nSequence = request.params[0].get_int64();
+    if (nSequence < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative mempool sequence");
+
+    std::vector<std::pair<uint256, bool>> vChanges;
+    uint64_t nNewSequence;
+    {
+        LOCK(mempool.cs);
+        if (!mempool.GetChangesSince(nSequence, vChanges))
+            throw JSONRPCError(RPC_MISC_ERROR, "Changes since this mempool sequence are not known, use getrawmempool");
+        nNewSequence = mempool.GetSequence();
+    }
+
+    // Whether each transaction was there before, from its first change, and
+    // is there now, from its last one
+    std::map<uint256, std::pair<bool, bool>> mapNet;
+    std::vector<uint256> vOrder;
+    for (const auto& change : vChanges) {
+        auto ret = mapNet.emplace(change.first, std::make_pair(!change.second, change.second));
+        if (ret.second)
+            vOrder.push_back(change.first);
+        else
+            ret.first->second.second = change.second;
+    }
+
+    UniValue added(UniValue::VARR);
+    UniValue removed(UniValue::VARR);
+    for (const uint256& hash : vOrder) {
+        const std::pair<bool, bool>& net = mapNet[hash];
+        if (!net.first && net.second)
+            added.push_back(hash.ToString());
+        else if (net.first && !net.second)
+            removed.push_back(hash.ToString());
+    }
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("added", added));
+    ret.push_back(Pair("removed", removed));
+    ret.push_back(Pair("mempool_sequence", nNewSequence));
+    return ret;
+}
+
 UniValue getmempoolancestors(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 2) {
@@ -647,13 +863,13 @@ UniValue getblockhash(const JSONRPCRequest& request)
             + HelpExampleRpc("getblockhash", "1000")
         );
 
-    LOCK(cs_main);
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
 
     int nHeight = request.params[0].get_int();
-    if (nHeight < 0 || nHeight > chainActive.Height())
+    if (nHeight < 0 || nHeight > chain->Height())
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
 
-    CBlockIndex* pblockindex = chainActive[nHeight];
+    const CBlockIndex* pblockindex = (*chain)[nHeight];
     return pblockindex->GetBlockHash().GetHex();
 }
 
@@ -692,8 +908,6 @@ UniValue getblockheader(const JSONRPCRequest& request)
             + HelpExampleRpc("getblockheader", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
-
     std::string strHash = request.params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -701,11 +915,11 @@ UniValue getblockheader(const JSONRPCRequest& request)
     if (!request.params[1].isNull())
         fVerbose = request.params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
+    // The header itself can be read without cs_main
+    const CBlockIndex* pblockindex = LookupBlockIndexNoLock(hash);
+    if (!pblockindex)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
     if (!fVerbose)
     {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
@@ -714,9 +928,576 @@ UniValue getblockheader(const JSONRPCRequest& request)
         return strHex;
     }
 
+    // nTx no longer changes once the block is in the published chain; for
+    // other blocks it may still be set, so those need cs_main.
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
+    if (chain->Contains(pblockindex))
+        return blockheaderToJSON(*chain, pblockindex);
+
+    LOCK(cs_main);
     return blockheaderToJSON(pblockindex);
 }
 
+UniValue getblockfilter(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "getblockfilter \"blockhash\" ( \"filtertype\" )\n"
+            "\nReturns the compact filter (BIP 158) of a block, from the index built with -blockfilterindex.\n"
+            "\nArguments:\n"
+            "1. \"blockhash\"     (string, required) The hash of the block\n"
+            "2. \"filtertype\"    (string, optional, default=\"basic\") The type name of the filter\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : \"hex\",   (string) the hex-encoded filter data\n"
+            "  \"header\" : \"hash\"   (string) the hex-encoded filter header\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\" \"basic\"")
+            + HelpExampleRpc("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\", \"basic\"")
+        );
+
+    uint256 hash(ParseHashV(request.params[0], "blockhash"));
+    std::string strFilterType = BlockFilterTypeName(BlockFilterType::BASIC);
+    if (!request.params[1].isNull())
+        strFilterType = request.params[1].get_str();
+
+    if (!g_blockfilterindex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Index is not enabled, use -blockfilterindex");
+    if (strFilterType != BlockFilterTypeName(g_blockfilterindex->GetFilterType()))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown filtertype");
+
+    const CBlockIndex* pblockindex;
+    bool fInActiveChain;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        if (it == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = it->second;
+        fInActiveChain = chainActive.Contains(pblockindex);
+    }
+
+    bool fIndexReady = g_blockfilterindex->BlockUntilSyncedToCurrentChain();
+
+    BlockFilter filter;
+    uint256 header;
+    if (!g_blockfilterindex->LookupFilter(pblockindex, filter) ||
+        !g_blockfilterindex->LookupFilterHeader(pblockindex, header)) {
+        std::string errmsg = "Filter not found.";
+        if (!fIndexReady) {
+            errmsg += " Block filters are still in the process of being indexed.";
+        } else if (!fInActiveChain) {
+            errmsg += " The block is not in the active chain, and its filter was never indexed.";
+        }
+        throw JSONRPCError(RPC_MISC_ERROR, errmsg);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("filter", HexStr(filter.GetEncodedFilter()));
+    ret.pushKV("header", header.GetHex());
+    return ret;
+}
+
+/** Most entries getaddresshistory returns at once */
+static const int MAX_ADDRESS_HISTORY_COUNT = 10000;
+
+static uint256 ParseAddressScriptHash(const UniValue& param)
+{
+    CTxDestination dest = DecodeDestination(param.get_str());
+    if (!IsValidDestination(dest))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    return GetScriptHash(GetScriptForDestination(dest));
+}
+
+/** A position in the history of a script, as an opaque hex string */
+static std::string EncodeHistoryCursor(const CAddressHistoryPos& pos)
+{
+    return strprintf("%08x%08x%08x", pos.nHeight, pos.nTxPos, pos.nIndex);
+}
+
+static CAddressHistoryPos DecodeHistoryCursor(const std::string& str)
+{
+    if (str.size() != 24 || !IsHex(str))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    std::vector<unsigned char> data = ParseHex(str);
+    return CAddressHistoryPos(ReadBE32(data.data()), ReadBE32(data.data() + 4), ReadBE32(data.data() + 8));
+}
+
+UniValue getaddresshistory(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 4)
+        throw std::runtime_error(
+            "getaddresshistory \"address\" ( from_height count \"cursor\" )\n"
+            "\nReturns the outputs paying to an address, and the inputs spending them, in the order of the active chain,\n"
+            "from the index built with -addressindex. Long histories are returned a page at a time.\n"
+            "\nArguments:\n"
+            "1. \"address\"       (string, required) The address\n"
+            "2. from_height     (numeric, optional, default=0) Start at the first entry of this height\n"
+            "3. count           (numeric, optional, default=1000) Return at most this many entries, up to " + std::to_string(MAX_ADDRESS_HISTORY_COUNT) + "\n"
+            "4. \"cursor\"        (string, optional) Continue with the page \"next\" of an earlier call returned, instead of from_height\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\" : n,          (numeric) the height of the last block in the index\n"
+            "  \"entries\" : [\n"
+            "    {\n"
+            "      \"height\" : n,      (numeric) the height of the block\n"
+            "      \"txid\" : \"hash\",   (string) the transaction\n"
+            "      \"category\" : \"receive|spend\", (string) whether the transaction creates an output or spends one\n"
+            "      \"vout\" : n,        (numeric) the output it creates, for receives\n"
+            "      \"vin\" : n,         (numeric) the input spending an output, for spends\n"
+            "      \"prevout\" : {\"txid\" : \"hash\", \"vout\" : n}, (object) the output spent, for spends\n"
+            "      \"amount\" : x.xxx   (numeric) the value of the output in " + CURRENCY_UNIT + "\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"next\" : \"cursor\"     (string) only if there are more entries, the cursor to get them with\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresshistory", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+            + HelpExampleCli("getaddresshistory", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\" 500000 100")
+            + HelpExampleRpc("getaddresshistory", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\", 500000, 100")
+        );
+
+    const uint256 scripthash = ParseAddressScriptHash(request.params[0]);
+    CAddressHistoryPos start;
+    if (!request.params[1].isNull()) {
+        const int nHeight = request.params[1].get_int();
+        if (nHeight < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative from_height");
+        start = CAddressHistoryPos(nHeight, 0, 0);
+    }
+    int nCount = 1000;
+    if (!request.params[2].isNull()) {
+        nCount = request.params[2].get_int();
+        if (nCount < 1 || nCount > MAX_ADDRESS_HISTORY_COUNT)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("count must be between 1 and %d", MAX_ADDRESS_HISTORY_COUNT));
+    }
+    if (!request.params[3].isNull())
+        start = DecodeHistoryCursor(request.params[3].get_str());
+
+    if (!g_addressindex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Index is not enabled, use -addressindex");
+    g_addressindex->BlockUntilSyncedToCurrentChain();
+    const int nBestHeight = g_addressindex->GetBestHeight();
+
+    std::vector<CAddressHistoryEntry> entries;
+    bool fMore;
+    CAddressHistoryPos next;
+    if (!g_addressindex->FindHistory(scripthash, start, nCount, entries, fMore, next))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("height", nBestHeight);
+    UniValue arr(UniValue::VARR);
+    for (const CAddressHistoryEntry& entry : entries) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("height", (int)entry.pos.nHeight);
+        obj.pushKV("txid", entry.txid.GetHex());
+        if (entry.IsSpend()) {
+            obj.pushKV("category", "spend");
+            obj.pushKV("vin", (int)(entry.pos.nIndex & ~ADDRESS_INDEX_SPEND_FLAG));
+            UniValue prevout(UniValue::VOBJ);
+            prevout.pushKV("txid", entry.prevout.hash.GetHex());
+            prevout.pushKV("vout", (int)entry.prevout.n);
+            obj.pushKV("prevout", prevout);
+        } else {
+            obj.pushKV("category", "receive");
+            obj.pushKV("vout", (int)entry.pos.nIndex);
+        }
+        obj.pushKV("amount", ValueFromAmount(entry.nValue));
+        arr.push_back(obj);
+    }
+    result.pushKV("entries", arr);
+    if (fMore)
+        result.pushKV("next", EncodeHistoryCursor(next));
+    return result;
+}
+
+UniValue getaddressbalance(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "getaddressbalance \"address\"\n"
+            "\nReturns the balance of an address in the active chain, from the index built with -addressindex.\n"
+            "\nArguments:\n"
+            "1. \"address\"       (string, required) The address\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\" : n,        (numeric) the height of the last block in the index\n"
+            "  \"balance\" : x.xxx,   (numeric) the value of the unspent outputs paying to the address in " + CURRENCY_UNIT + "\n"
+            "  \"received\" : x.xxx,  (numeric) the value of all outputs paying to the address in " + CURRENCY_UNIT + "\n"
+            "  \"outputs\" : n,       (numeric) the number of outputs paying to the address\n"
+            "  \"unspent\" : n        (numeric) the number of them that are unspent\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+            + HelpExampleRpc("getaddressbalance", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+        );
+
+    const uint256 scripthash = ParseAddressScriptHash(request.params[0]);
+    if (!g_addressindex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Index is not enabled, use -addressindex");
+    g_addressindex->BlockUntilSyncedToCurrentChain();
+    const int nBestHeight = g_addressindex->GetBestHeight();
+
+    CAddressBalance balance;
+    if (!g_addressindex->FindBalance(scripthash, balance))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("height", nBestHeight);
+    result.pushKV("balance", ValueFromAmount(balance.nBalance));
+    result.pushKV("received", ValueFromAmount(balance.nReceived));
+    result.pushKV("outputs", balance.nOutputs);
+    result.pushKV("unspent", balance.nOutputs - balance.nSpends);
+    return result;
+}
+
+/** Serialized size of the outpoint and other data of a coin besides its output, for utxo_size_inc */
+static const int64_t PER_UTXO_OVERHEAD = sizeof(COutPoint) + sizeof(uint32_t) + sizeof(bool);
+static const int NUM_GETBLOCKSTATS_PERCENTILES = 5;
+//! Most blocks getblockstatsrange computes at once
+static const int MAX_BLOCKSTATS_RANGE = 2016;
+
+static const std::vector<std::string> vBlockStatsNames = {
+    "avgfee", "avgfeerate", "avgtxsize", "blockhash", "feerate_percentiles", "height", "ins", "maxfee",
+    "maxfeerate", "maxtxsize", "medianfee", "mediantime", "mediantxsize", "minfee", "minfeerate",
+    "mintxsize", "outs", "subsidy", "swtotal_size", "swtotal_weight", "swtxs", "time", "total_out",
+    "total_size", "total_weight", "totalfee", "txs", "utxo_increase", "utxo_size_inc",
+};
+
+template <typename T>
+static T CalculateTruncatedMedian(std::vector<T>& scores)
+{
+    const size_t size = scores.size();
+    if (size == 0)
+        return 0;
+    std::sort(scores.begin(), scores.end());
+    if (size % 2 == 0)
+        return (scores[size / 2 - 1] + scores[size / 2]) / 2;
+    return scores[size / 2];
+}
+
+/** The feerates at the 10th, 25th, 50th, 75th and 90th percentile of the weight of a block */
+static void CalculatePercentilesByWeight(CAmount result[NUM_GETBLOCKSTATS_PERCENTILES], std::vector<std::pair<CAmount, int64_t>>& scores, int64_t total_weight)
+{
+    if (scores.empty())
+        return;
+    std::sort(scores.begin(), scores.end());
+    const double weights[NUM_GETBLOCKSTATS_PERCENTILES] = {total_weight / 10.0, total_weight / 4.0, total_weight / 2.0, (total_weight * 3.0) / 4.0, (total_weight * 9.0) / 10.0};
+    int64_t next_percentile_index = 0;
+    int64_t cumulative_weight = 0;
+    for (const auto& element : scores) {
+        cumulative_weight += element.second;
+        while (next_percentile_index < NUM_GETBLOCKSTATS_PERCENTILES && cumulative_weight >= weights[next_percentile_index]) {
+            result[next_percentile_index] = element.first;
+            ++next_percentile_index;
+        }
+    }
+    // Fill any remaining percentiles with the last value
+    for (int64_t i = next_percentile_index; i < NUM_GETBLOCKSTATS_PERCENTILES; i++) {
+        result[i] = scores.back().first;
+    }
+}
+
+/**
+ * Compute the statistics of a block. The values spent come from the undo
+ * data, so no transaction index is needed. Does not need cs_main.
+ */
+static bool GetBlockStats(const CBlockIndex* pindex, UniValue& ret)
+{
+    CBlock block;
+    CBlockUndo blockundo;
+    if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+        return false;
+    // The genesis block has no undo data, and spends nothing
+    if (pindex->nHeight > 0 && !UndoReadFromDisk(blockundo, pindex))
+        return false;
+    if (pindex->nHeight > 0 && blockundo.vtxundo.size() + 1 != block.vtx.size())
+        return error("%s: the undo data of block %s does not match it", __func__, pindex->GetBlockHash().ToString());
+
+    CAmount maxfee = 0, maxfeerate = 0, minfee = MAX_MONEY, minfeerate = MAX_MONEY;
+    CAmount total_out = 0, totalfee = 0;
+    int64_t inputs = 0, maxtxsize = 0, mintxsize = MAX_BLOCK_SERIALIZED_SIZE, outputs = 0;
+    int64_t swtotal_size = 0, swtotal_weight = 0, swtxs = 0, total_size = 0, total_weight = 0, utxo_size_inc = 0;
+    std::vector<CAmount> fee_array;
+    std::vector<std::pair<CAmount, int64_t>> feerate_array;
+    std::vector<int64_t> txsize_array;
+
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        outputs += tx.vout.size();
+        CAmount tx_total_out = 0;
+        for (const CTxOut& out : tx.vout) {
+            tx_total_out += out.nValue;
+            utxo_size_inc += GetSerializeSize(out, SER_NETWORK, PROTOCOL_VERSION) + PER_UTXO_OVERHEAD;
+        }
+        if (tx.IsCoinBase())
+            continue;
+
+        inputs += tx.vin.size();
+        total_out += tx_total_out;
+
+        const int64_t tx_size = GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        const int64_t weight = GetTransactionWeight(tx);
+        txsize_array.push_back(tx_size);
+        maxtxsize = std::max(maxtxsize, tx_size);
+        mintxsize = std::min(mintxsize, tx_size);
+        total_size += tx_size;
+        total_weight += weight;
+        if (tx.HasWitness()) {
+            swtxs++;
+            swtotal_size += tx_size;
+            swtotal_weight += weight;
+        }
+
+        CAmount tx_total_in = 0;
+        for (const Coin& coin : blockundo.vtxundo[i - 1].vprevout) {
+            tx_total_in += coin.out.nValue;
+            utxo_size_inc -= GetSerializeSize(coin.out, SER_NETWORK, PROTOCOL_VERSION) + PER_UTXO_OVERHEAD;
+        }
+        const CAmount txfee = tx_total_in - tx_total_out;
+        fee_array.push_back(txfee);
+        maxfee = std::max(maxfee, txfee);
+        minfee = std::min(minfee, txfee);
+        totalfee += txfee;
+
+        // The feerate is in satoshis per virtual byte
+        const CAmount feerate = weight ? (txfee * WITNESS_SCALE_FACTOR) / weight : 0;
+        feerate_array.emplace_back(feerate, weight);
+        maxfeerate = std::max(maxfeerate, feerate);
+        minfeerate = std::min(minfeerate, feerate);
+    }
+
+    CAmount feerate_percentiles[NUM_GETBLOCKSTATS_PERCENTILES] = {0};
+    CalculatePercentilesByWeight(feerate_percentiles, feerate_array, total_weight);
+    UniValue percentiles(UniValue::VARR);
+    for (int64_t percentile : feerate_percentiles) {
+        percentiles.push_back(percentile);
+    }
+
+    const int64_t txs = block.vtx.size() - 1;
+    ret = UniValue(UniValue::VOBJ);
+    ret.pushKV("avgfee", txs > 0 ? totalfee / txs : 0);
+    ret.pushKV("avgfeerate", total_weight ? (totalfee * WITNESS_SCALE_FACTOR) / total_weight : 0);
+    ret.pushKV("avgtxsize", txs > 0 ? total_size / txs : 0);
+    ret.pushKV("blockhash", pindex->GetBlockHash().GetHex());
+    ret.pushKV("feerate_percentiles", percentiles);
+    ret.pushKV("height", (int64_t)pindex->nHeight);
+    ret.pushKV("ins", inputs);
+    ret.pushKV("maxfee", maxfee);
+    ret.pushKV("maxfeerate", maxfeerate);
+    ret.pushKV("maxtxsize", maxtxsize);
+    ret.pushKV("medianfee", CalculateTruncatedMedian(fee_array));
+    ret.pushKV("mediantime", pindex->GetMedianTimePast());
+    ret.pushKV("mediantxsize", CalculateTruncatedMedian(txsize_array));
+    ret.pushKV("minfee", minfee == MAX_MONEY ? 0 : minfee);
+    ret.pushKV("minfeerate", minfeerate == MAX_MONEY ? 0 : minfeerate);
+    ret.pushKV("mintxsize", mintxsize == MAX_BLOCK_SERIALIZED_SIZE ? 0 : mintxsize);
+    ret.pushKV("outs", outputs);
+    ret.pushKV("subsidy", GetBlockSubsidy(pindex->nHeight, Params().GetConsensus()));
+    ret.pushKV("swtotal_size", swtotal_size);
+    ret.pushKV("swtotal_weight", swtotal_weight);
+    ret.pushKV("swtxs", swtxs);
+    ret.pushKV("time", pindex->GetBlockTime());
+    ret.pushKV("total_out", total_out);
+    ret.pushKV("total_size", total_size);
+    ret.pushKV("total_weight", total_weight);
+    ret.pushKV("totalfee", totalfee);
+    ret.pushKV("txs", txs + 1);
+    ret.pushKV("utxo_increase", outputs - inputs);
+    ret.pushKV("utxo_size_inc", utxo_size_inc);
+    return true;
+}
+
+/** The statistics a getblockstats call selects, all if none */
+static std::set<std::string> ParseBlockStatsSelection(const UniValue& param)
+{
+    std::set<std::string> stats;
+    if (param.isNull())
+        return stats;
+    for (const UniValue& stat : param.get_array().getValues()) {
+        const std::string& name = stat.get_str();
+        if (std::find(vBlockStatsNames.begin(), vBlockStatsNames.end(), name) == vBlockStatsNames.end())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid selected statistic " + name);
+        stats.insert(name);
+    }
+    return stats;
+}
+
+static UniValue SelectBlockStats(const UniValue& all, const std::set<std::string>& stats)
+{
+    if (stats.empty())
+        return all;
+    UniValue ret(UniValue::VOBJ);
+    for (const std::string& name : stats) {
+        ret.pushKV(name, find_value(all, name));
+    }
+    return ret;
+}
+
+static const CBlockIndex* ParseBlockStatsHeight(const UniValue& param)
+{
+    const int nHeight = param.get_int();
+    LOCK(cs_main);
+    if (nHeight < 0 || nHeight > chainActive.Height())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d after current tip %d", nHeight, chainActive.Height()));
+    return chainActive[nHeight];
+}
+
+static void CheckBlockStatsAvailable(const CBlockIndex* pindex)
+{
+    LOCK(cs_main);
+    if (fHavePruned && !(pindex->nStatus & BLOCK_HAVE_UNDO))
+        throw JSONRPCError(RPC_MISC_ERROR, strprintf("Block %d not available (pruned data)", pindex->nHeight));
+}
+
+static const std::string strBlockStatsResult =
+    "{                           (json object)\n"
+    "  \"avgfee\": xxxxx,          (numeric) Average fee in the block\n"
+    "  \"avgfeerate\": xxxxx,      (numeric) Average feerate (in satoshis per virtual byte)\n"
+    "  \"avgtxsize\": xxxxx,       (numeric) Average transaction size\n"
+    "  \"blockhash\": xxxxx,       (string) The block hash (to check for potential reorgs)\n"
+    "  \"feerate_percentiles\": [  (array of numeric) Feerates at the 10th, 25th, 50th, 75th, and 90th percentile weight unit (in satoshis per virtual byte)\n"
+    "      \"10th_percentile_feerate\",\n"
+    "      \"25th_percentile_feerate\",\n"
+    "      \"50th_percentile_feerate\",\n"
+    "      \"75th_percentile_feerate\",\n"
+    "      \"90th_percentile_feerate\",\n"
+    "  ],\n"
+    "  \"height\": xxxxx,          (numeric) The height of the block\n"
+    "  \"ins\": xxxxx,             (numeric) The number of inputs (excluding coinbase)\n"
+    "  \"maxfee\": xxxxx,          (numeric) Maximum fee in the block\n"
+    "  \"maxfeerate\": xxxxx,      (numeric) Maximum feerate (in satoshis per virtual byte)\n"
+    "  \"maxtxsize\": xxxxx,       (numeric) Maximum transaction size\n"
+    "  \"medianfee\": xxxxx,       (numeric) Truncated median fee in the block\n"
+    "  \"mediantime\": xxxxx,      (numeric) The block median time past\n"
+    "  \"mediantxsize\": xxxxx,    (numeric) Truncated median transaction size\n"
+    "  \"minfee\": xxxxx,          (numeric) Minimum fee in the block\n"
+    "  \"minfeerate\": xxxxx,      (numeric) Minimum feerate (in satoshis per virtual byte)\n"
+    "  \"mintxsize\": xxxxx,       (numeric) Minimum transaction size\n"
+    "  \"outs\": xxxxx,            (numeric) The number of outputs\n"
+    "  \"subsidy\": xxxxx,         (numeric) The block subsidy\n"
+    "  \"swtotal_size\": xxxxx,    (numeric) Total size of all segwit transactions\n"
+    "  \"swtotal_weight\": xxxxx,  (numeric) Total weight of all segwit transactions divided by segwit scale factor (4)\n"
+    "  \"swtxs\": xxxxx,           (numeric) The number of segwit transactions\n"
+    "  \"time\": xxxxx,            (numeric) The block time\n"
+    "  \"total_out\": xxxxx,       (numeric) Total amount in all outputs (excluding coinbase and thus reward [ie subsidy + totalfee])\n"
+    "  \"total_size\": xxxxx,      (numeric) Total size of all non-coinbase transactions\n"
+    "  \"total_weight\": xxxxx,    (numeric) Total weight of all non-coinbase transactions divided by segwit scale factor (4)\n"
+    "  \"totalfee\": xxxxx,        (numeric) The fee total\n"
+    "  \"txs\": xxxxx,             (numeric) The number of transactions (including coinbase)\n"
+    "  \"utxo_increase\": xxxxx,   (numeric) The increase/decrease in the number of unspent outputs\n"
+    "  \"utxo_size_inc\": xxxxx,   (numeric) The increase/decrease in size for the utxo index (not discounting op_return and similar)\n"
+    "}\n";
+
+UniValue getblockstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "getblockstats hash_or_height ( stats )\n"
+            "\nCompute per block statistics for a given window. All amounts are in satoshis.\n"
+            "The values spent are read from the undo data, so no transaction index is needed.\n"
+            "It won't work for some heights with pruning.\n"
+            "\nArguments:\n"
+            "1. \"hash_or_height\"     (string or numeric, required) The block hash or height of the target block\n"
+            "2. \"stats\"              (array,  optional) Values to plot, by default all values (see result below)\n"
+            "    [\n"
+            "      \"height\",         (string, optional) Selected statistic\n"
+            "      \"time\",           (string, optional) Selected statistic\n"
+            "      ,...\n"
+            "    ]\n"
+            "\nResult:\n"
+            + strBlockStatsResult +
+            "\nExamples:\n"
+            + HelpExampleCli("getblockstats", "1000 '[\"minfeerate\",\"avgfeerate\"]'")
+            + HelpExampleRpc("getblockstats", "1000 '[\"minfeerate\",\"avgfeerate\"]'")
+        );
+
+    const CBlockIndex* pindex;
+    if (request.params[0].isNum()) {
+        pindex = ParseBlockStatsHeight(request.params[0]);
+    } else {
+        const uint256 hash = ParseHashV(request.params[0], "hash_or_height");
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        if (it == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pindex = it->second;
+        if (!chainActive.Contains(pindex))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block is not in chain %s", Params().NetworkIDString()));
+    }
+    const std::set<std::string> stats = ParseBlockStatsSelection(request.params[1]);
+    CheckBlockStatsAvailable(pindex);
+
+    UniValue ret;
+    if (!GetBlockStats(pindex, ret))
+        throw JSONRPCError(RPC_MISC_ERROR, "Can't read block or undo data from disk");
+    return SelectBlockStats(ret, stats);
+}
+
+UniValue getblockstatsrange(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
+        throw std::runtime_error(
+            "getblockstatsrange start_height end_height ( stats )\n"
+            "\nCompute the statistics of getblockstats for the blocks of the active chain from start_height\n"
+            "to end_height inclusive, at most " + std::to_string(MAX_BLOCKSTATS_RANGE) + " blocks at a time, on multiple threads.\n"
+            "\nArguments:\n"
+            "1. start_height     (numeric, required) The height of the first block\n"
+            "2. end_height       (numeric, required) The height of the last block\n"
+            "3. \"stats\"          (array,  optional) Values to plot, by default all values (see getblockstats)\n"
+            "\nResult:\n"
+            "[                   (json array) The statistics of every block, in order of height\n"
+            "  {...}, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockstatsrange", "1000 1100 '[\"minfeerate\",\"avgfeerate\"]'")
+            + HelpExampleRpc("getblockstatsrange", "1000, 1100, [\"minfeerate\",\"avgfeerate\"]")
+        );
+
+    const CBlockIndex* pindexStart = ParseBlockStatsHeight(request.params[0]);
+    const CBlockIndex* pindexEnd = ParseBlockStatsHeight(request.params[1]);
+    if (pindexEnd->nHeight < pindexStart->nHeight)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "end_height is below start_height");
+    if (pindexEnd->nHeight - pindexStart->nHeight >= MAX_BLOCKSTATS_RANGE)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("At most %d blocks at a time", MAX_BLOCKSTATS_RANGE));
+    const std::set<std::string> stats = ParseBlockStatsSelection(request.params[2]);
+
+    std::vector<const CBlockIndex*> vpindex(pindexEnd->nHeight - pindexStart->nHeight + 1);
+    for (const CBlockIndex* pindex = pindexEnd; pindex != pindexStart->pprev; pindex = pindex->pprev) {
+        vpindex[pindex->nHeight - pindexStart->nHeight] = pindex;
+    }
+    for (const CBlockIndex* pindex : vpindex) {
+        CheckBlockStatsAvailable(pindex);
+    }
+
+    // Each thread takes every nThreads-th block, so that they share the
+    // expensive blocks of busy periods
+    const int nThreads = std::max(1, std::min<int>(std::min(GetNumCores(), 16), vpindex.size()));
+    std::vector<UniValue> vstats(vpindex.size());
+    std::vector<char> vfSuccess(nThreads, true);
+    CTaskGroup group(g_task_pool, TASK_PRIORITY_BACKGROUND);
+    for (int i = 0; i < nThreads; i++) {
+        group.Run([&, i] {
+            for (size_t j = i; j < vpindex.size() && vfSuccess[i]; j += nThreads) {
+                vfSuccess[i] = GetBlockStats(vpindex[j], vstats[j]);
+            }
+        });
+    }
+    group.Wait();
+    for (int i = 0; i < nThreads; i++) {
+        if (!vfSuccess[i])
+            throw JSONRPCError(RPC_MISC_ERROR, "Can't read block or undo data from disk");
+    }
+
+    UniValue ret(UniValue::VARR);
+    for (const UniValue& blockstats : vstats) {
+        ret.push_back(SelectBlockStats(blockstats, stats));
+    }
+    return ret;
+}
+
 UniValue getblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
@@ -787,7 +1568,7 @@ UniValue getblock(const JSONRPCRequest& request)
     CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+    if ((fHavePruned || fSnapshotChainstate) && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
 
     if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
@@ -806,6 +1587,11 @@ UniValue getblock(const JSONRPCRequest& request)
         return strHex;
     }
 
+    if (request.resultStream) {
+        blockToJSON(request.resultStream->Begin(), block, pblockindex, verbosity >= 2);
+        return NullUniValue;
+    }
+
     return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
@@ -834,52 +1620,335 @@ static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash,
         ss << output.second.out.scriptPubKey;
         ss << VARINT(output.second.out.nValue);
         stats.nTransactionOutputs++;
-        stats.nTotalAmount += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
+        stats.nTotalAmount += output.second.out.nValue;
+        stats.nBogoSize += GetBogoSize(output.second.out.scriptPubKey);
+    }
+    ss << VARINT(0);
+}
+
+//! Calculate statistics about the unspent transaction output set
+static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+{
+    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+    assert(pcursor);
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    stats.hashBlock = pcursor->GetBestBlock();
+    {
+        LOCK(cs_main);
+        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
+    }
+    ss << stats.hashBlock;
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            if (!outputs.empty() && key.hash != prevkey) {
+                ApplyStats(stats, ss, prevkey, outputs);
+                outputs.clear();
+            }
+            prevkey = key.hash;
+            outputs[key.n] = std::move(coin);
+        } else {
+            return error("%s: unable to read value", __func__);
+        }
+        pcursor->Next();
+    }
+    if (!outputs.empty()) {
+        ApplyStats(stats, ss, prevkey, outputs);
+    }
+    stats.hashSerialized = ss.GetHash();
+    stats.nDiskSize = view->EstimateSize();
+    return true;
+}
+
+//! Add the statistics of the coins from pcursor on whose txid starts with a byte below nEnd
+static bool GetUTXOStatsRange(CCoinsViewCursor* pcursor, int nEnd, CCoinsStats& stats)
+{
+    uint256 prevkey;
+    while (pcursor->Valid()) {
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+            return error("%s: unable to read value", __func__);
+        }
+        if (*key.hash.begin() >= nEnd) break;
+        if (stats.nTransactionOutputs == 0 || key.hash != prevkey) {
+            stats.nTransactions++;
+            prevkey = key.hash;
+        }
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += coin.out.nValue;
+        stats.nBogoSize += GetBogoSize(coin.out.scriptPubKey);
+        pcursor->Next();
     }
-    ss << VARINT(0);
+    return true;
 }
 
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+//! Calculate the statistics of GetUTXOStats except for the hash, splitting the database across threads
+static bool GetUTXOStatsParallel(CCoinsViewStore* view, CCoinsStats& stats)
 {
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-    assert(pcursor);
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
+    const int nThreads = std::max(1, std::min(GetNumCores(), 16));
+    std::vector<std::unique_ptr<CCoinsViewCursor>> vcursors;
     {
+        // Database iterators see the state as of their creation, and nothing
+        // is written to the database while cs_main is held, so all ranges are
+        // consistent with each other.
         LOCK(cs_main);
+        for (int i = 0; i < nThreads; i++) {
+            uint256 start;
+            *start.begin() = 256 * i / nThreads;
+            vcursors.emplace_back(view->Cursor(COutPoint(start, 0)));
+        }
+        stats.hashBlock = vcursors[0]->GetBestBlock();
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
-    ss << stats.hashBlock;
-    uint256 prevkey;
-    std::map<uint32_t, Coin> outputs;
+
+    std::vector<CCoinsStats> vstats(nThreads);
+    std::vector<char> vfSuccess(nThreads, false);
+    CTaskGroup group(g_task_pool, TASK_PRIORITY_BACKGROUND);
+    for (int i = 0; i < nThreads; i++) {
+        group.Run([&, i] {
+            vfSuccess[i] = GetUTXOStatsRange(vcursors[i].get(), 256 * (i + 1) / nThreads, vstats[i]);
+        });
+    }
+    group.Wait();
+    for (int i = 0; i < nThreads; i++) {
+        if (!vfSuccess[i]) return false;
+        stats.nTransactions += vstats[i].nTransactions;
+        stats.nTransactionOutputs += vstats[i].nTransactionOutputs;
+        stats.nBogoSize += vstats[i].nBogoSize;
+        stats.nTotalAmount += vstats[i].nTotalAmount;
+    }
+    stats.nDiskSize = view->EstimateSize();
+    return true;
+}
+
+/** Hashes the scripts scantxoutset looks for */
+class SaltedScriptHasher
+{
+private:
+    const uint64_t k0, k1;
+
+public:
+    SaltedScriptHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+    size_t operator()(const CScript& script) const
+    {
+        return CSipHasher(k0, k1).Write(script.data(), script.size()).Finalize();
+    }
+};
+
+typedef std::unordered_set<CScript, SaltedScriptHasher> ScriptSet;
+
+static std::atomic<bool> g_scan_in_progress(false);
+static std::atomic<bool> g_should_abort_scan(false);
+//! How much of the chainstate the running scan has covered, in 1/65536 of the key space
+static std::atomic<uint32_t> g_scan_progress(0);
+//! Coins a scanning thread reads between checks for an abort
+static const int SCAN_CHECK_INTERVAL = 8192;
+
+/** Makes sure only one scantxoutset runs at a time */
+class CoinsViewScanReserver
+{
+private:
+    bool fReserved;
+
+public:
+    CoinsViewScanReserver() : fReserved(false) {}
+
+    bool Reserve()
+    {
+        bool expected = false;
+        fReserved = g_scan_in_progress.compare_exchange_strong(expected, true);
+        return fReserved;
+    }
+
+    ~CoinsViewScanReserver()
+    {
+        if (fReserved) {
+            g_scan_in_progress = false;
+        }
+    }
+};
+
+//! Find the coins from pcursor on whose txid starts with a byte below nEnd and whose script is in scripts; false if aborted or unreadable
+static bool ScanUTXOSetRange(CCoinsViewCursor* pcursor, int nBegin, int nEnd, const ScriptSet& scripts, std::vector<std::pair<COutPoint, Coin>>& found, uint64_t& nSearched)
+{
+    uint32_t nCovered = nBegin << 8;
     while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
         COutPoint key;
         Coin coin;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
-                outputs.clear();
-            }
-            prevkey = key.hash;
-            outputs[key.n] = std::move(coin);
-        } else {
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
             return error("%s: unable to read value", __func__);
         }
+        if (*key.hash.begin() >= nEnd) break;
+        if (scripts.count(coin.out.scriptPubKey)) {
+            found.emplace_back(key, std::move(coin));
+        }
+        if (++nSearched % SCAN_CHECK_INTERVAL == 0) {
+            if (g_should_abort_scan || ShutdownRequested()) return false;
+            const uint32_t nPos = (key.hash.begin()[0] << 8) | key.hash.begin()[1];
+            g_scan_progress += nPos - nCovered;
+            nCovered = nPos;
+        }
         pcursor->Next();
     }
-    if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
-    }
-    stats.hashSerialized = ss.GetHash();
-    stats.nDiskSize = view->EstimateSize();
+    g_scan_progress += (nEnd << 8) - nCovered;
     return true;
 }
 
+UniValue scantxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "scantxoutset \"action\" ( [scanobjects,...] )\n"
+            "\nScans the unspent transaction output set for outputs paying to the given addresses or scripts,\n"
+            "reading the chainstate database on multiple threads.\n"
+            "\nArguments:\n"
+            "1. \"action\"        (string, required) \"start\" to scan, \"abort\" to stop the running scan,\n"
+            "                   \"status\" to get the progress of the running scan\n"
+            "2. \"scanobjects\"   (array, required for \"start\") What to look for\n"
+            "    [\n"
+            "      \"address\"       (string) an address\n"
+            "      or\n"
+            "      {\"script\" : \"hex\"} (object) a scriptPubKey\n"
+            "      ,...\n"
+            "    ]\n"
+            "\nResult (for \"start\"):\n"
+            "{\n"
+            "  \"success\" : true|false,   (boolean) false if the scan was aborted\n"
+            "  \"searched_items\" : n,     (numeric) the number of unspent outputs scanned\n"
+            "  \"height\" : n,             (numeric) the height of the block the outputs are unspent at\n"
+            "  \"bestblock\" : \"hash\",     (string) the hash of that block\n"
+            "  \"unspents\" : [\n"
+            "    {\n"
+            "      \"txid\" : \"hash\",      (string) the transaction id\n"
+            "      \"vout\" : n,           (numeric) the output number\n"
+            "      \"scriptPubKey\" : \"hex\", (string) the script\n"
+            "      \"amount\" : x.xxx,     (numeric) the amount in " + CURRENCY_UNIT + "\n"
+            "      \"height\" : n          (numeric) the height of the block the output was created in\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"total_amount\" : x.xxx    (numeric) the total amount of the unspent outputs found\n"
+            "}\n"
+            "\nResult (for \"status\"): {\"progress\" : n} with the percentage scanned, or null if no scan is running\n"
+            "\nResult (for \"abort\"): true if a scan was running\n"
+            "\nExamples:\n"
+            + HelpExampleCli("scantxoutset", "start \"[\\\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\\\"]\"")
+            + HelpExampleCli("scantxoutset", "status")
+            + HelpExampleRpc("scantxoutset", "\"start\", [\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\", {\"script\" : \"51\"}]")
+        );
+
+    RPCTypeCheck(request.params, {UniValue::VSTR, UniValue::VARR});
+
+    const std::string strAction = request.params[0].get_str();
+    if (strAction == "status") {
+        if (!g_scan_in_progress)
+            return NullUniValue;
+        UniValue ret(UniValue::VOBJ);
+        ret.push_back(Pair("progress", (int)((uint64_t)g_scan_progress * 100 / 65536)));
+        return ret;
+    } else if (strAction == "abort") {
+        if (!g_scan_in_progress)
+            return false;
+        g_should_abort_scan = true;
+        return true;
+    } else if (strAction != "start") {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid command " + strAction);
+    }
+
+    if (request.params[1].isNull())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "scanobjects argument is required for the start action");
+    ScriptSet scripts;
+    for (const UniValue& scanobject : request.params[1].get_array().getValues()) {
+        if (scanobject.isStr()) {
+            CTxDestination dest = DecodeDestination(scanobject.get_str());
+            if (!IsValidDestination(dest))
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address " + scanobject.get_str());
+            scripts.insert(GetScriptForDestination(dest));
+        } else if (scanobject.isObject()) {
+            const UniValue& script = find_value(scanobject, "script");
+            if (!script.isStr() || !IsHex(script.get_str()))
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Scan object needs a hex \"script\"");
+            std::vector<unsigned char> data = ParseHex(script.get_str());
+            scripts.insert(CScript(data.begin(), data.end()));
+        } else {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Scan objects are addresses or objects with a \"script\"");
+        }
+    }
+
+    CoinsViewScanReserver reserver;
+    if (!reserver.Reserve())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Scan already in progress, use action \"abort\" or \"status\"");
+    g_should_abort_scan = false;
+    g_scan_progress = 0;
+
+    // As for gettxoutsetinfo, the cursors are created under cs_main so that
+    // all ranges see the same chainstate
+    FlushStateToDisk();
+    const int nThreads = std::max(1, std::min(GetNumCores(), 16));
+    std::vector<std::unique_ptr<CCoinsViewCursor>> vcursors;
+    uint256 hashBlock;
+    int nHeight;
+    {
+        LOCK(cs_main);
+        for (int i = 0; i < nThreads; i++) {
+            uint256 start;
+            *start.begin() = 256 * i / nThreads;
+            vcursors.emplace_back(pcoinsdbview->Cursor(COutPoint(start, 0)));
+        }
+        hashBlock = vcursors[0]->GetBestBlock();
+        nHeight = mapBlockIndex.find(hashBlock)->second->nHeight;
+    }
+
+    std::vector<std::vector<std::pair<COutPoint, Coin>>> vfound(nThreads);
+    std::vector<uint64_t> vsearched(nThreads, 0);
+    std::vector<char> vfSuccess(nThreads, false);
+    CTaskGroup group(g_task_pool, TASK_PRIORITY_BACKGROUND);
+    for (int i = 0; i < nThreads; i++) {
+        group.Run([&, i] {
+            vfSuccess[i] = ScanUTXOSetRange(vcursors[i].get(), 256 * i / nThreads, 256 * (i + 1) / nThreads, scripts, vfound[i], vsearched[i]);
+        });
+    }
+    group.Wait();
+
+    bool fSuccess = true;
+    uint64_t nSearched = 0;
+    for (int i = 0; i < nThreads; i++) {
+        if (!vfSuccess[i]) fSuccess = false;
+        nSearched += vsearched[i];
+    }
+    if (!fSuccess && !g_should_abort_scan && !ShutdownRequested())
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("success", fSuccess));
+    result.push_back(Pair("searched_items", (int64_t)nSearched));
+    result.push_back(Pair("height", nHeight));
+    result.push_back(Pair("bestblock", hashBlock.GetHex()));
+    UniValue unspents(UniValue::VARR);
+    CAmount nTotal = 0;
+    for (const auto& found : vfound) {
+        for (const auto& coin : found) {
+            UniValue unspent(UniValue::VOBJ);
+            unspent.push_back(Pair("txid", coin.first.hash.GetHex()));
+            unspent.push_back(Pair("vout", (int32_t)coin.first.n));
+            unspent.push_back(Pair("scriptPubKey", HexStr(coin.second.out.scriptPubKey.begin(), coin.second.out.scriptPubKey.end())));
+            unspent.push_back(Pair("amount", ValueFromAmount(coin.second.out.nValue)));
+            unspent.push_back(Pair("height", (int32_t)coin.second.nHeight));
+            unspents.push_back(unspent);
+            nTotal += coin.second.out.nValue;
+        }
+    }
+    result.push_back(Pair("unspents", unspents));
+    result.push_back(Pair("total_amount", ValueFromAmount(nTotal)));
+    return result;
+}
+
 UniValue pruneblockchain(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -920,9 +1989,9 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_MISC_ERROR, "Blockchain is too short for pruning.");
     else if (height > chainHeight)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Blockchain is shorter than the attempted prune height.");
-    else if (height > chainHeight - MIN_BLOCKS_TO_KEEP) {
+    else if (height > chainHeight - std::min(nPruneKeepBlocks, chainHeight)) {
         LogPrint(BCLog::RPC, "Attempt to prune blocks close to the tip.  Retaining the minimum number of blocks.");
-        height = chainHeight - MIN_BLOCKS_TO_KEEP;
+        height = chainHeight - std::min(nPruneKeepBlocks, chainHeight);
     }
 
     PruneBlockFilesManual(height);
@@ -931,11 +2000,16 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
 
 UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 1)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless hash_type is \"muhash\".\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"   (string, optional, default: \"hash_serialized_2\") Which UTXO set hash to return:\n"
+            "                 \"hash_serialized_2\" scans the whole set,\n"
+            "                 \"muhash\" returns the statistics maintained with -coinstats right away (without \"transactions\"),\n"
+            "                 \"none\" scans the set on multiple threads and returns no hash\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -943,26 +2017,60 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
             "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs\n"
             "  \"txouts\": n,            (numeric) The number of unspent transaction outputs\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash (only with hash_type \"hash_serialized_2\")\n"
+            "  \"muhash\": \"hash\",     (string) The MuHash3072 of the set (only with hash_type \"muhash\")\n"
             "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\"")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    const std::string hash_type = request.params[0].isNull() ? "hash_serialized_2" : request.params[0].get_str();
     UniValue ret(UniValue::VOBJ);
 
+    if (hash_type == "muhash") {
+        CIncrementalCoinsStats stats;
+        int nHeight;
+        uint64_t nDiskSize;
+        {
+            LOCK(cs_main);
+            if (!pcoinsstats) {
+                throw JSONRPCError(RPC_MISC_ERROR, "UTXO set statistics are not maintained, restart with -coinstats");
+            }
+            if (pcoinsstats->hashBlock != chainActive.Tip()->GetBlockHash()) {
+                throw JSONRPCError(RPC_MISC_ERROR, "UTXO set statistics are out of date, restart to recompute them");
+            }
+            stats = *pcoinsstats;
+            nHeight = chainActive.Height();
+            nDiskSize = pcoinsdbview->EstimateSize();
+        }
+        ret.push_back(Pair("height", (int64_t)nHeight));
+        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+        ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
+        ret.push_back(Pair("muhash", stats.GetMuHash().GetHex()));
+        ret.push_back(Pair("disk_size", nDiskSize));
+        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        return ret;
+    }
+    if (hash_type != "hash_serialized_2" && hash_type != "none") {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type " + hash_type);
+    }
+
     CCoinsStats stats;
     FlushStateToDisk();
-    if (GetUTXOStats(pcoinsdbview.get(), stats)) {
+    if (hash_type == "none" ? GetUTXOStatsParallel(pcoinsdbview.get(), stats) : GetUTXOStats(pcoinsdbview.get(), stats)) {
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
-        ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+        if (hash_type == "hash_serialized_2") {
+            ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+        }
         ret.push_back(Pair("disk_size", stats.nDiskSize));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     } else {
@@ -971,6 +2079,261 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the unspent transaction output set at the current tip to a file, which\n"
+            "loadtxoutset can use to bootstrap a new node.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"     (string, required) The file to write, relative to the data directory if not absolute.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,          (numeric) The number of coins written\n"
+            "  \"base_hash\": \"hex\",          (string) The hash of the block the coins belong to\n"
+            "  \"base_height\": n,            (numeric) The height of that block\n"
+            "  \"nchaintx\": n,               (numeric) The number of transactions in the chain up to that block\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash of the coins, as in gettxoutsetinfo\n"
+            "  \"path\": \"path\"               (string) The absolute path of the file\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    const fs::path temppath = fs::absolute(request.params[0].get_str() + ".incomplete", GetDataDir());
+    if (fs::exists(path)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+    }
+
+    // Hold cs_main throughout, so that the coins database does not move away
+    // from the tip while it is being read twice.
+    LOCK(cs_main);
+    FlushStateToDisk();
+
+    CCoinsStats stats;
+    if (!GetUTXOStats(pcoinsdbview.get(), stats)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+    }
+    const CBlockIndex* pindexBase = mapBlockIndex.find(stats.hashBlock)->second;
+
+    SnapshotMetadata metadata;
+    metadata.base_blockhash = stats.hashBlock;
+    metadata.coins_count = stats.nTransactionOutputs;
+    metadata.nchaintx = pindexBase->nChainTx;
+    metadata.hash_serialized = stats.hashSerialized;
+
+    FILE* filestr = fsbridge::fopen(temppath, "wb");
+    CAutoFile afile(filestr, SER_DISK, CLIENT_VERSION);
+    if (afile.IsNull()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unable to open " + temppath.string() + " for writing");
+    }
+    afile << metadata;
+
+    std::unique_ptr<CCoinsViewCursor> pcursor(pcoinsdbview->Cursor());
+    uint64_t coins_written = 0;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        }
+        afile << key;
+        afile << coin;
+        coins_written++;
+        pcursor->Next();
+    }
+    assert(coins_written == metadata.coins_count);
+
+    FileCommit(afile.Get());
+    afile.fclose();
+    if (!RenameOver(temppath, path)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to rename " + temppath.string() + " to " + path.string());
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_written", coins_written));
+    ret.push_back(Pair("base_hash", pindexBase->GetBlockHash().GetHex()));
+    ret.push_back(Pair("base_height", pindexBase->nHeight));
+    ret.push_back(Pair("nchaintx", metadata.nchaintx));
+    ret.push_back(Pair("hash_serialized_2", metadata.hash_serialized.GetHex()));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
+/**
+ * Read the coins of a UTXO snapshot after its metadata, adding them to view
+ * unless it is null, and return their hash as computed by GetUTXOStats.
+ */
+static uint256 ReadSnapshotCoins(CAutoFile& afile, const SnapshotMetadata& metadata, CCoinsViewCache* view)
+{
+    CCoinsStats stats;
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << metadata.base_blockhash;
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+    for (uint64_t i = 0; i < metadata.coins_count; i++) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        afile >> key;
+        afile >> coin;
+        if (!outputs.empty() && key.hash != prevkey) {
+            ApplyStats(stats, ss, prevkey, outputs);
+            outputs.clear();
+        }
+        if (outputs.count(key.n)) {
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Duplicate coin " + key.ToString() + " in snapshot");
+        }
+        prevkey = key.hash;
+        if (view) {
+            view->AddCoin(key, Coin(coin), false);
+            if (view->DynamicMemoryUsage() > nCoinCacheUsage && !view->Flush()) {
+                throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to write coins to the chainstate database");
+            }
+        }
+        outputs[key.n] = std::move(coin);
+    }
+    if (!outputs.empty()) {
+        ApplyStats(stats, ss, prevkey, outputs);
+    }
+    return ss.GetHash();
+}
+
+//! Return the base block of a snapshot that can be loaded into this node, or throw
+static CBlockIndex* GetSnapshotBase(const SnapshotMetadata& metadata)
+{
+    AssertLockHeld(cs_main);
+    if (g_txindex) {
+        throw JSONRPCError(RPC_MISC_ERROR, "A snapshot cannot be loaded with -txindex enabled");
+    }
+    if (chainActive.Height() != 0) {
+        throw JSONRPCError(RPC_MISC_ERROR, "A snapshot can only be loaded into a node that has not connected any blocks");
+    }
+    BlockMap::iterator mi = mapBlockIndex.find(metadata.base_blockhash);
+    if (mi == mapBlockIndex.end()) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Header of the snapshot base block " + metadata.base_blockhash.GetHex() + " is not known yet");
+    }
+    if (mi->second->nHeight == 0 || pindexBestHeader->GetAncestor(mi->second->nHeight) != mi->second) {
+        throw JSONRPCError(RPC_MISC_ERROR, "The snapshot base block is not in the best header chain");
+    }
+    return mi->second;
+}
+
+UniValue loadtxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "loadtxoutset \"path\" ( \"expected_hash\" )\n"
+            "\nLoad a UTXO set written by dumptxoutset into a node that has not connected any\n"
+            "blocks yet, and continue syncing from the block it was taken at. The blocks below it\n"
+            "are not downloaded or validated; the node treats them like a pruned node would.\n"
+            "The header of the base block must already be known.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"            (string, required) The snapshot file, relative to the data directory if not absolute.\n"
+            "2. \"expected_hash\"   (string, optional) The trusted hash_serialized_2 of the UTXO set at the base block.\n"
+            "                     Required unless the base block has a hash built into the software.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_loaded\": n,     (numeric) The number of coins loaded\n"
+            "  \"tip_hash\": \"hex\",     (string) The hash of the new chain tip\n"
+            "  \"base_height\": n,      (numeric) The height of the new chain tip\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\"")
+        );
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    SnapshotMetadata metadata;
+    uint256 hash;
+    try {
+        // First pass: check the coins against the trusted hash without touching the chainstate.
+        CAutoFile afile(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        if (afile.IsNull()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Unable to open " + path.string());
+        }
+        afile >> metadata;
+        if (metadata.version != SNAPSHOT_VERSION) {
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, strprintf("Unsupported snapshot version %u", metadata.version));
+        }
+        {
+            LOCK(cs_main);
+            GetSnapshotBase(metadata);
+        }
+
+        uint256 expected;
+        if (!request.params[1].isNull()) {
+            expected = ParseHashV(request.params[1], "expected_hash");
+        } else {
+            const MapAssumeutxo& mapAssumeutxo = Params().Assumeutxo();
+            MapAssumeutxo::const_iterator it = mapAssumeutxo.find(metadata.base_blockhash);
+            if (it == mapAssumeutxo.end()) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "No built-in hash for a snapshot at block " + metadata.base_blockhash.GetHex() + ", expected_hash must be given");
+            }
+            expected = it->second;
+        }
+        if (metadata.hash_serialized != expected) {
+            throw JSONRPCError(RPC_VERIFY_ERROR, "Snapshot hash " + metadata.hash_serialized.GetHex() + " does not match the expected hash " + expected.GetHex());
+        }
+        hash = ReadSnapshotCoins(afile, metadata, nullptr);
+    } catch (const std::ios_base::failure& e) {
+        throw JSONRPCError(RPC_DESERIALIZATION_ERROR, std::string("Unable to read snapshot: ") + e.what());
+    }
+    if (hash != metadata.hash_serialized) {
+        throw JSONRPCError(RPC_VERIFY_ERROR, "Snapshot coins hash to " + hash.GetHex() + " instead of " + metadata.hash_serialized.GetHex());
+    }
+
+    CBlockIndex* pindexBase;
+    {
+        LOCK(cs_main);
+        pindexBase = GetSnapshotBase(metadata);
+
+        // Second pass: add the coins. From here on, a failure leaves a chainstate
+        // that only -reindex-chainstate can repair, which the flag tells init.
+        if (!pblocktree->WriteFlag("snapshotloading", true)) {
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to write to the block index database");
+        }
+        try {
+            CAutoFile afile(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+            if (afile.IsNull()) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Unable to open " + path.string());
+            }
+            SnapshotMetadata reread;
+            afile >> reread;
+            hash = ReadSnapshotCoins(afile, reread, pcoinsTip.get());
+        } catch (const std::ios_base::failure& e) {
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, std::string("Unable to read snapshot: ") + e.what());
+        }
+        if (hash != metadata.hash_serialized) {
+            throw JSONRPCError(RPC_VERIFY_ERROR, "Snapshot changed while loading; restart with -reindex-chainstate");
+        }
+
+        CValidationState state;
+        if (!ActivateSnapshot(state, Params(), pindexBase, metadata.nchaintx)) {
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to activate snapshot: " + FormatStateMessage(state));
+        }
+        if (!pblocktree->WriteFlag("snapshotloading", false)) {
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to write to the block index database");
+        }
+    }
+
+    // Connect any blocks we already have on top of the snapshot.
+    CValidationState state;
+    ActivateBestChain(state, Params());
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_loaded", metadata.coins_count));
+    ret.push_back(Pair("tip_hash", pindexBase->GetBlockHash().GetHex()));
+    ret.push_back(Pair("base_height", pindexBase->nHeight));
+    return ret;
+}
+
 UniValue gettxout(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
@@ -1380,6 +2743,11 @@ UniValue mempoolInfoToJSON()
     ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
     ret.push_back(Pair("mempoolminfee", ValueFromAmount(std::max(mempool.GetMinFee(maxmempool), ::minRelayTxFee).GetFeePerK())));
     ret.push_back(Pair("minrelaytxfee", ValueFromAmount(::minRelayTxFee.GetFeePerK())));
+    const MempoolEvictionStats stats = mempool.GetEvictionStats();
+    ret.push_back(Pair("trimmed", stats.nTrimmedTx));
+    ret.push_back(Pair("trimpasses", stats.nTrimPasses));
+    ret.push_back(Pair("trimtime", stats.nTrimTime));
+    ret.push_back(Pair("expired", stats.nExpiredTx));
 
     return ret;
 }
@@ -1398,6 +2766,10 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
             "  \"maxmempool\": xxxxx,         (numeric) Maximum memory usage for the mempool\n"
             "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee rate in " + CURRENCY_UNIT + "/kB for tx to be accepted. Is the maximum of minrelaytxfee and minimum mempool fee\n"
             "  \"minrelaytxfee\": xxxxx       (numeric) Current minimum relay fee for transactions\n"
+            "  \"trimmed\": xxxxx             (numeric) Transactions evicted to keep the mempool under maxmempool\n"
+            "  \"trimpasses\": xxxxx          (numeric) Eviction passes made, each removing a batch of packages\n"
+            "  \"trimtime\": xxxxx            (numeric) Total time spent evicting transactions, in microseconds\n"
+            "  \"expired\": xxxxx             (numeric) Transactions evicted for exceeding the mempool expiry time\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -1618,9 +2990,109 @@ UniValue savemempool(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+static UniValue DBInfoToJSON(const CDBWrapper& db)
+{
+    const DBOptions& dboptions = db.GetDBOptions();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("max_open_files", dboptions.max_open_files));
+    ret.push_back(Pair("block_size", (uint64_t)dboptions.block_size));
+    ret.push_back(Pair("max_file_size", (uint64_t)dboptions.max_file_size));
+    ret.push_back(Pair("write_buffer_size", (uint64_t)db.GetWriteBufferSize()));
+    ret.push_back(Pair("block_cache_size", (uint64_t)db.GetBlockCacheSize()));
+    ret.push_back(Pair("filter_bits", dboptions.filter_bits));
+    ret.push_back(Pair("stats", db.GetProperty("leveldb.stats")));
+    return ret;
+}
+
+UniValue getdbinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0) {
+        throw std::runtime_error(
+            "getdbinfo\n"
+            "\nReturns the effective LevelDB settings of the chainstate and block index databases.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"profile\": \"name\",          (string) The -dbprofile in use\n"
+            "  \"chainstate\": {               (json object) The chainstate database, or null with -coinsbackend=log\n"
+            "    \"max_open_files\": n,        (numeric) Number of table files kept open\n"
+            "    \"block_size\": n,            (numeric) Size of the blocks read from table files in bytes\n"
+            "    \"max_file_size\": n,         (numeric) Size of the table files written in bytes\n"
+            "    \"write_buffer_size\": n,     (numeric) Size of the write buffer in bytes\n"
+            "    \"block_cache_size\": n,      (numeric) Size of the block cache in bytes\n"
+            "    \"filter_bits\": n,           (numeric) Bits per key of the bloom filter, or 0 for none\n"
+            "    \"stats\": \"str\"              (string) The LevelDB \"leveldb.stats\" property\n"
+            "  },\n"
+            "  \"blockindex\": { ... }         (json object) The block index database (including the txindex), as above\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbinfo", "")
+            + HelpExampleRpc("getdbinfo", "")
+        );
+    }
+
+    LOCK(cs_main);
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("profile", gArgs.GetArg("-dbprofile", DEFAULT_DB_PROFILE)));
+    const CDBWrapper* pcoinsdb = pcoinsdbview->GetDB();
+    ret.push_back(Pair("chainstate", pcoinsdb ? DBInfoToJSON(*pcoinsdb) : NullUniValue));
+    ret.push_back(Pair("blockindex", DBInfoToJSON(*pblocktree)));
+    return ret;
+}
+
+UniValue compactchainstate(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1) {
+        throw std::runtime_error(
+            "compactchainstate ( \"command\" )\n"
+            "\nReports on or starts the background compaction of the chain state database.\n"
+            "The database is compacted in " + std::to_string(CHAINSTATE_COMPACTION_SLICES) + " key ranges, one every -compactdbinterval\n"
+            "milliseconds, waiting while the tip is changing. It starts by itself after the\n"
+            "initial block download and large reorganizations unless -autocompactdb=0 is set.\n"
+            "\nArguments:\n"
+            "1. \"command\"    (string, optional, default: \"status\") \"start\" to (re)start a compaction, or \"status\"\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"running\": true|false,       (boolean) Whether a compaction is in progress\n"
+            "  \"reason\": \"str\",             (string) Why the last compaction was started\n"
+            "  \"slices_done\": n,            (numeric) Key ranges compacted so far by the last compaction\n"
+            "  \"slices\": n,                 (numeric) Number of key ranges\n"
+            "  \"start_time\": xxx,           (numeric) When the last compaction started, in seconds since epoch\n"
+            "  \"last_completed_time\": xxx,  (numeric) When a compaction last completed, in seconds since epoch\n"
+            "  \"completed\": n,              (numeric) Number of compactions completed since startup\n"
+            "  \"deferred\": n                (numeric) Number of times a slice waited for the tip to settle\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("compactchainstate", "\"start\"")
+            + HelpExampleRpc("compactchainstate", "")
+        );
+    }
+
+    const std::string strCommand = request.params[0].isNull() ? "status" : request.params[0].get_str();
+    if (strCommand == "start") {
+        StartChainstateCompaction("requested by RPC");
+    } else if (strCommand != "status") {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown command " + strCommand);
+    }
+
+    const ChainstateCompactionStatus status = GetChainstateCompactionStatus();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("running", status.fRunning));
+    ret.push_back(Pair("reason", status.strReason));
+    ret.push_back(Pair("slices_done", status.nSlicesDone));
+    ret.push_back(Pair("slices", CHAINSTATE_COMPACTION_SLICES));
+    ret.push_back(Pair("start_time", status.nStartTime));
+    ret.push_back(Pair("last_completed_time", status.nLastCompletedTime));
+    ret.push_back(Pair("completed", status.nCompleted));
+    ret.push_back(Pair("deferred", status.nDeferred));
+    return ret;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
+    { "blockchain",         "compactchainstate",      &compactchainstate,      {"command"} },
+    { "blockchain",         "getaddressbalance",      &getaddressbalance,      {"address"} },
+    { "blockchain",         "getaddresshistory",      &getaddresshistory,      {"address","from_height","count","cursor"} },
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      {} },
     { "blockchain",         "getchaintxstats",        &getchaintxstats,        {"nblocks", "blockhash"} },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       {} },
@@ -1628,17 +3100,25 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblock",               &getblock,               {"blockhash","verbosity|verbose"} },
     { "blockchain",         "getblockhash",           &getblockhash,           {"height"} },
     { "blockchain",         "getblockheader",         &getblockheader,         {"blockhash","verbose"} },
+    { "blockchain",         "getblockfilter",         &getblockfilter,         {"blockhash","filtertype"} },
+    { "blockchain",         "getblockstats",          &getblockstats,          {"hash_or_height","stats"} },
+    { "blockchain",         "getblockstatsrange",     &getblockstatsrange,     {"start_height","end_height","stats"} },
     { "blockchain",         "getchaintips",           &getchaintips,           {} },
+    { "blockchain",         "getdbinfo",              &getdbinfo,              {} },
     { "blockchain",         "getdifficulty",          &getdifficulty,          {} },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    {"txid","verbose"} },
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  {"txid","verbose"} },
+    { "blockchain",         "getmempoolchanges",      &getmempoolchanges,      {"mempool_sequence"} },
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        {"txid"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose","mempool_sequence"} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {"hash_type"} },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           {"path"} },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           {"path","expected_hash"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
+    { "blockchain",         "scantxoutset",           &scantxoutset,           {"action","scanobjects"} },
     { "blockchain",         "verifychain",            &verifychain,            {"checklevel","nblocks"} },
 
     { "blockchain",         "preciousblock",          &preciousblock,          {"blockhash"} },
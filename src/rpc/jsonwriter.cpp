@@ -0,0 +1,89 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <rpc/jsonwriter.h>
+
+#include <univalue.h>
+
+#include <assert.h>
+
+JSONStreamWriter::JSONStreamWriter(const Sink& sinkIn, size_t nFlushSizeIn) :
+    sink(sinkIn), nFlushSize(nFlushSizeIn), fAfterKey(false)
+{
+    buffer.reserve(nFlushSize);
+}
+
+void JSONStreamWriter::BeginElement()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (!vHasElements.empty()) {
+        if (vHasElements.back())
+            buffer += ',';
+        vHasElements.back() = true;
+    }
+}
+
+void JSONStreamWriter::FlushIfFull()
+{
+    if (buffer.size() >= nFlushSize)
+        Flush();
+}
+
+void JSONStreamWriter::BeginObject()
+{
+    BeginElement();
+    buffer += '{';
+    vHasElements.push_back(false);
+}
+
+void JSONStreamWriter::EndObject()
+{
+    assert(!vHasElements.empty() && !fAfterKey);
+    vHasElements.pop_back();
+    buffer += '}';
+    FlushIfFull();
+}
+
+void JSONStreamWriter::BeginArray()
+{
+    BeginElement();
+    buffer += '[';
+    vHasElements.push_back(false);
+}
+
+void JSONStreamWriter::EndArray()
+{
+    assert(!vHasElements.empty() && !fAfterKey);
+    vHasElements.pop_back();
+    buffer += ']';
+    FlushIfFull();
+}
+
+void JSONStreamWriter::Key(const std::string& key)
+{
+    assert(!vHasElements.empty() && !fAfterKey);
+    BeginElement();
+    // A string value is written with the same escaping as a key
+    buffer += UniValue(key).write();
+    buffer += ':';
+    fAfterKey = true;
+}
+
+void JSONStreamWriter::Value(const UniValue& value)
+{
+    BeginElement();
+    buffer += value.write();
+    FlushIfFull();
+}
+
+void JSONStreamWriter::Flush()
+{
+    if (buffer.empty())
+        return;
+    sink(buffer);
+    buffer.clear();
+}
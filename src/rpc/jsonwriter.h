@@ -0,0 +1,55 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_JSONWRITER_H
+#define BITCOIN_RPC_JSONWRITER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class UniValue;
+
+/**
+ * Writes JSON text piece by piece, in the same compact format as
+ * UniValue::write(), so that large results need not be built as a UniValue
+ * tree first. The text is collected in a buffer which is handed to the sink
+ * whenever it grows beyond the flush size, and by Flush().
+ *
+ * The caller is responsible for a well-formed sequence of calls: one Value
+ * (or nested object or array) after each Key, and keys only in objects.
+ */
+class JSONStreamWriter
+{
+public:
+    typedef std::function<void(const std::string&)> Sink;
+
+    static const size_t DEFAULT_FLUSH_SIZE = 64 * 1024;
+
+    explicit JSONStreamWriter(const Sink& sink, size_t nFlushSize = DEFAULT_FLUSH_SIZE);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    void Key(const std::string& key);
+    void Value(const UniValue& value);
+
+    /** Hand what is buffered to the sink */
+    void Flush();
+
+private:
+    const Sink sink;
+    const size_t nFlushSize;
+    std::string buffer;
+    //! For each open object or array, whether an element was written to it
+    std::vector<bool> vHasElements;
+    bool fAfterKey;
+
+    //! Write the comma between elements, unless a key was just written
+    void BeginElement();
+    void FlushIfFull();
+};
+
+#endif // BITCOIN_RPC_JSONWRITER_H
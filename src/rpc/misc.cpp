@@ -13,10 +13,16 @@
 #include <httpserver.h>
 #include <net.h>
 #include <netbase.h>
+#include <notifyqueue.h>
+#include <policy/policy.h>
 #include <rpc/blockchain.h>
 #include <rpc/server.h>
 #include <rpc/util.h>
+#include <script/sigcache.h>
+#include <sync.h>
 #include <timedata.h>
+#include <txdb.h>
+#include <txmempool.h>
 #include <util.h>
 #include <utilstrencodings.h>
 #ifdef ENABLE_WALLET
@@ -458,6 +464,80 @@ static UniValue RPCLockedMemoryInfo()
     return obj;
 }
 
+static UniValue RPCBlockIndexMemoryInfo()
+{
+    BlockIndexMemoryStats stats = GetBlockIndexMemoryStats();
+    UniValue entries(UniValue::VOBJ);
+    entries.push_back(Pair("header", uint64_t(stats.nHeaderBytes)));
+    entries.push_back(Pair("links", uint64_t(stats.nLinkBytes)));
+    entries.push_back(Pair("chainwork", uint64_t(stats.nChainWorkBytes)));
+    entries.push_back(Pair("position", uint64_t(stats.nPositionBytes)));
+    entries.push_back(Pair("counters", uint64_t(stats.nCounterBytes)));
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("count", uint64_t(stats.nEntries)));
+    obj.push_back(Pair("entry_size", uint64_t(sizeof(CBlockIndex))));
+    obj.push_back(Pair("entries", entries));
+    obj.push_back(Pair("arena", uint64_t(stats.nArenaBytes)));
+    obj.push_back(Pair("map", uint64_t(stats.nMapBytes)));
+    obj.push_back(Pair("total", uint64_t(stats.nArenaBytes + stats.nMapBytes)));
+    return obj;
+}
+
+static UniValue RPCSignatureCacheInfo()
+{
+    SignatureCacheStats stats = GetSignatureCacheStats();
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("max_entries", uint64_t(stats.nMaxElements)));
+    obj.push_back(Pair("bytes", uint64_t(stats.nBytes)));
+    obj.push_back(Pair("hits", stats.nHits));
+    obj.push_back(Pair("misses", stats.nMisses));
+    obj.push_back(Pair("inserts", stats.nInserts));
+    obj.push_back(Pair("evictions", stats.nEvictions));
+    return obj;
+}
+
+static UniValue RPCScriptExecutionCacheInfo()
+{
+    ScriptExecutionCacheStats stats = GetScriptExecutionCacheStats();
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("max_entries", uint64_t(stats.nMaxElements)));
+    obj.push_back(Pair("hits", stats.nHits));
+    obj.push_back(Pair("misses", stats.nMisses));
+    obj.push_back(Pair("inserts", stats.nInserts));
+    obj.push_back(Pair("evictions", stats.nEvictions));
+    obj.push_back(Pair("mempool_hits", stats.nMempoolHits));
+    return obj;
+}
+
+static UniValue RPCCoinsCacheMemoryInfo()
+{
+    LOCK(cs_main);
+    size_t nMapBytes = pcoinsTip ? pcoinsTip->MapMemoryUsage() : 0;
+    size_t nTotalBytes = pcoinsTip ? pcoinsTip->DynamicMemoryUsage() : 0;
+    size_t nPrefetchBytes = pcoinsprefetch ? pcoinsprefetch->DynamicMemoryUsage() : 0;
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("count", uint64_t(pcoinsTip ? pcoinsTip->GetCacheSize() : 0)));
+    obj.push_back(Pair("map", uint64_t(nMapBytes)));
+    obj.push_back(Pair("coins", uint64_t(nTotalBytes - nMapBytes)));
+    obj.push_back(Pair("prefetch", uint64_t(nPrefetchBytes)));
+    obj.push_back(Pair("total", uint64_t(nTotalBytes + nPrefetchBytes)));
+    obj.push_back(Pair("limit", uint64_t(nCoinCacheUsage)));
+    return obj;
+}
+
+static UniValue RPCMempoolMemoryInfo()
+{
+    MempoolMemoryStats stats = mempool.GetMemoryStats();
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("count", uint64_t(mempool.size())));
+    obj.push_back(Pair("entries", uint64_t(stats.nIndexBytes)));
+    obj.push_back(Pair("transactions", uint64_t(stats.nInnerBytes)));
+    obj.push_back(Pair("other", uint64_t(stats.nOtherBytes)));
+    obj.push_back(Pair("total", uint64_t(stats.nIndexBytes + stats.nInnerBytes + stats.nOtherBytes)));
+    obj.push_back(Pair("limit", gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000));
+    return obj;
+}
+
 #ifdef HAVE_MALLOC_INFO
 static std::string RPCMallocInfo()
 {
@@ -477,6 +557,61 @@ static std::string RPCMallocInfo()
 }
 #endif
 
+UniValue getlockstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw std::runtime_error(
+            "getlockstats ( reset )\n"
+            "Returns how long the locks taken at each place in the code waited for and were held, as timed with -lockstats.\n"
+            "Arguments:\n"
+            "1. reset              (boolean, optional, default=false) Start the times over after returning them\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"name\": \"xxx\",              (string) The lock, as the code names it\n"
+            "    \"file\": \"xxx\",              (string) Source file taking it\n"
+            "    \"line\": n,                  (numeric) Source line taking it\n"
+            "    \"locks\": n,                 (numeric) Times it was taken\n"
+            "    \"contended\": n,             (numeric) Times it had to wait for another thread\n"
+            "    \"wait_us\": n,               (numeric) Microseconds spent waiting, in total\n"
+            "    \"max_wait_us\": n,           (numeric) Longest wait in microseconds\n"
+            "    \"hold_us\": n,               (numeric) Microseconds it was held, in total\n"
+            "    \"max_hold_us\": n            (numeric) Longest hold in microseconds\n"
+            "  },...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockstats", "")
+            + HelpExampleRpc("getlockstats", "true")
+        );
+
+    if (!g_lock_stats)
+        throw JSONRPCError(RPC_MISC_ERROR, "Locks are not being timed, start with -lockstats");
+
+    std::vector<LockStats> vStats = GetLockStats();
+    if (!request.params[0].isNull() && request.params[0].get_bool())
+        ResetLockStats();
+
+    // Longest total wait first: those are the locks worth working on
+    std::sort(vStats.begin(), vStats.end(), [](const LockStats& a, const LockStats& b) {
+        return a.wait_micros > b.wait_micros;
+    });
+    UniValue ret(UniValue::VARR);
+    for (const LockStats& stats : vStats) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("name", stats.name));
+        obj.push_back(Pair("file", stats.file));
+        obj.push_back(Pair("line", stats.line));
+        obj.push_back(Pair("locks", stats.locks));
+        obj.push_back(Pair("contended", stats.contended));
+        obj.push_back(Pair("wait_us", stats.wait_micros));
+        obj.push_back(Pair("max_wait_us", stats.max_wait_micros));
+        obj.push_back(Pair("hold_us", stats.hold_micros));
+        obj.push_back(Pair("max_hold_us", stats.max_hold_micros));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
 UniValue getmemoryinfo(const JSONRPCRequest& request)
 {
     /* Please, avoid using the word "pool" here in the RPC interface or help,
@@ -489,6 +624,7 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
             "Arguments:\n"
             "1. \"mode\" determines what kind of information is returned. This argument is optional, the default mode is \"stats\".\n"
             "  - \"stats\" returns general statistics about memory usage in the daemon.\n"
+            "  - \"detailed\" also returns the memory taken by the UTXO cache and the mempool, and their sum with the block index and signature cache.\n"
             "  - \"mallocinfo\" returns an XML string describing low-level heap state (only available if compiled with glibc 2.10+).\n"
             "\nResult (mode \"stats\"):\n"
             "{\n"
@@ -499,8 +635,59 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
             "    \"locked\": xxxxxx,       (numeric) Amount of bytes that succeeded locking. If this number is smaller than total, locking pages failed at some point and key data could be swapped to disk.\n"
             "    \"chunks_used\": xxxxx,   (numeric) Number allocated chunks\n"
             "    \"chunks_free\": xxxxx,   (numeric) Number unused chunks\n"
+            "  },\n"
+            "  \"blockindex\": {           (json object) Information about the block index\n"
+            "    \"count\": xxxxx,         (numeric) Number of entries\n"
+            "    \"entry_size\": xxx,      (numeric) Bytes taken by each entry\n"
+            "    \"entries\": {            (json object) Bytes taken by all entries, per group of fields\n"
+            "      \"header\": xxxxx,      (numeric) Block header fields\n"
+            "      \"links\": xxxxx,       (numeric) Pointers to the hash, parent and skip list ancestor\n"
+            "      \"chainwork\": xxxxx,   (numeric) Total work of the chain up to the block\n"
+            "      \"position\": xxxxx,    (numeric) Status and position on disk\n"
+            "      \"counters\": xxxxx     (numeric) Height, transaction counts, sequence id and maximum time\n"
+            "    },\n"
+            "    \"arena\": xxxxx,         (numeric) Bytes reserved for the entries\n"
+            "    \"map\": xxxxx,           (numeric) Bytes used by the map from block hash to entry\n"
+            "    \"total\": xxxxx          (numeric) Sum of arena and map\n"
+            "  },\n"
+            "  \"sigcache\": {             (json object) Information about the signature cache\n"
+            "    \"max_entries\": xxxxx,   (numeric) Number of signatures the cache can hold\n"
+            "    \"bytes\": xxxxx,         (numeric) Bytes taken by the cache entries\n"
+            "    \"hits\": xxxxx,          (numeric) Lookups that found the signature, since startup\n"
+            "    \"misses\": xxxxx,        (numeric) Lookups that did not find the signature, since startup\n"
+            "    \"inserts\": xxxxx,       (numeric) Signatures added, since startup\n"
+            "    \"evictions\": xxxxx      (numeric) Inserts that pushed a signature out, since startup\n"
+            "  },\n"
+            "  \"scriptcache\": {          (json object) Information about the script execution cache\n"
+            "    \"max_entries\": xxxxx,   (numeric) Number of transactions the cache can hold\n"
+            "    \"hits\": xxxxx,          (numeric) Transactions whose scripts were found already verified, since startup\n"
+            "    \"misses\": xxxxx,        (numeric) Transactions whose scripts had to be run, since startup\n"
+            "    \"inserts\": xxxxx,       (numeric) Transactions added, since startup\n"
+            "    \"evictions\": xxxxx,     (numeric) Inserts that pushed a transaction out, since startup\n"
+            "    \"mempool_hits\": xxxxx   (numeric) Block transactions not looked up because the mempool had verified their scripts\n"
             "  }\n"
             "}\n"
+            "\nResult (mode \"detailed\"):\n"
+            "{\n"
+            "  ...                       Same as mode \"stats\"\n"
+            "  \"coinscache\": {           (json object) Information about the UTXO cache\n"
+            "    \"count\": xxxxx,         (numeric) Number of cached coins\n"
+            "    \"map\": xxxxx,           (numeric) Bytes used by the map of cached coins\n"
+            "    \"coins\": xxxxx,         (numeric) Bytes used by the scripts of the cached coins\n"
+            "    \"prefetch\": xxxxx,      (numeric) Bytes used by coins read ahead of block validation (with -parprefetch)\n"
+            "    \"total\": xxxxx,         (numeric) Sum of map, coins and prefetch\n"
+            "    \"limit\": xxxxx          (numeric) Bytes the cache is flushed at (see -dbcache)\n"
+            "  },\n"
+            "  \"mempool\": {              (json object) Information about the transaction memory pool\n"
+            "    \"count\": xxxxx,         (numeric) Number of transactions\n"
+            "    \"entries\": xxxxx,       (numeric) Bytes allocated for the entries and their indexes\n"
+            "    \"transactions\": xxxxx,  (numeric) Bytes used by the transactions and their in-mempool parents and children\n"
+            "    \"other\": xxxxx,         (numeric) Bytes used by the maps of spent outpoints, fee deltas and links\n"
+            "    \"total\": xxxxx,         (numeric) Sum of entries, transactions and other\n"
+            "    \"limit\": xxxxx          (numeric) Bytes the mempool is trimmed at (see -maxmempool)\n"
+            "  },\n"
+            "  \"total\": xxxxx            (numeric) Bytes used by the block index, signature cache, UTXO cache and mempool together\n"
+            "}\n"
             "\nResult (mode \"mallocinfo\"):\n"
             "\"<malloc version=\"1\">...\"\n"
             "\nExamples:\n"
@@ -512,6 +699,25 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
     if (mode == "stats") {
         UniValue obj(UniValue::VOBJ);
         obj.push_back(Pair("locked", RPCLockedMemoryInfo()));
+        obj.push_back(Pair("blockindex", RPCBlockIndexMemoryInfo()));
+        obj.push_back(Pair("sigcache", RPCSignatureCacheInfo()));
+        obj.push_back(Pair("scriptcache", RPCScriptExecutionCacheInfo()));
+        return obj;
+    } else if (mode == "detailed") {
+        UniValue obj(UniValue::VOBJ);
+        UniValue blockindex = RPCBlockIndexMemoryInfo();
+        UniValue sigcache = RPCSignatureCacheInfo();
+        UniValue coinscache = RPCCoinsCacheMemoryInfo();
+        UniValue mempool = RPCMempoolMemoryInfo();
+        uint64_t nTotal = find_value(blockindex, "total").get_int64() + find_value(sigcache, "bytes").get_int64() +
+                          find_value(coinscache, "total").get_int64() + find_value(mempool, "total").get_int64();
+        obj.push_back(Pair("locked", RPCLockedMemoryInfo()));
+        obj.push_back(Pair("blockindex", blockindex));
+        obj.push_back(Pair("sigcache", sigcache));
+        obj.push_back(Pair("scriptcache", RPCScriptExecutionCacheInfo()));
+        obj.push_back(Pair("coinscache", coinscache));
+        obj.push_back(Pair("mempool", mempool));
+        obj.push_back(Pair("total", nTotal));
         return obj;
     } else if (mode == "mallocinfo") {
 #ifdef HAVE_MALLOC_INFO
@@ -524,6 +730,129 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
     }
 }
 
+/** Histogram as an array of [upper bound in microseconds, count] pairs, leaving out empty buckets */
+static UniValue RPCHistogram(const std::vector<uint64_t>& vHistogram)
+{
+    UniValue ret(UniValue::VARR);
+    for (size_t i = 0; i < vHistogram.size(); i++) {
+        if (vHistogram[i] == 0)
+            continue;
+        UniValue bucket(UniValue::VARR);
+        if (i + 1 < vHistogram.size())
+            bucket.push_back(int64_t{1} << i);
+        else
+            bucket.push_back(NullUniValue);
+        bucket.push_back(vHistogram[i]);
+        ret.push_back(bucket);
+    }
+    return ret;
+}
+
+UniValue gethttpserverinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "gethttpserverinfo\n"
+            "Returns an object containing information about the HTTP server that serves RPC and REST requests, since startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"workqueue\": {            (json object) Information about the queue of requests waiting for a worker thread\n"
+            "    \"depth\": xxxxx,         (numeric) Number of requests waiting now\n"
+            "    \"max_depth\": xxxxx,     (numeric) Number of requests that may wait before new ones are rejected (see -rpcworkqueue)\n"
+            "    \"peak_depth\": xxxxx,    (numeric) Highest number of requests that waited at once\n"
+            "    \"fair\": true|false,     (boolean) Whether connections with waiting requests are served in turn (see -rpcfairqueue)\n"
+            "    \"clients\": xxxxx,       (numeric) Number of connections with requests waiting now (only with -rpcfairqueue)\n"
+            "    \"handled\": xxxxx,       (numeric) Number of requests handled\n"
+            "    \"rejected\": xxxxx       (numeric) Number of requests rejected because the queue was full\n"
+            "  },\n"
+            "  \"wait\": {                 (json object) Time requests waited in the queue\n"
+            "    \"total_us\": xxxxx,      (numeric) Sum in microseconds\n"
+            "    \"histogram\": [          (json array) Counts of requests by time, as [upper bound in microseconds (exclusive, null for no bound), count]; empty buckets are left out\n"
+            "      [xxxxx, xxxxx], ...\n"
+            "    ]\n"
+            "  },\n"
+            "  \"handle\": {               (json object) Time requests took to handle once taken from the queue, like \"wait\"\n"
+            "    ...\n"
+            "  },\n"
+            "  \"connections\": xxxxx,     (numeric) Number of connections that sent a request\n"
+            "  \"connections_open\": xxxxx, (numeric) Number of those connections open now\n"
+            "  \"requests\": xxxxx         (numeric) Number of requests received; more requests than connections means connections were kept alive and reused\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("gethttpserverinfo", "")
+            + HelpExampleRpc("gethttpserverinfo", "")
+        );
+
+    HTTPServerStats stats;
+    if (!GetHTTPServerStats(stats))
+        throw JSONRPCError(RPC_MISC_ERROR, "HTTP server not running");
+
+    UniValue workqueue(UniValue::VOBJ);
+    workqueue.push_back(Pair("depth", (uint64_t)stats.nQueueDepth));
+    workqueue.push_back(Pair("max_depth", (uint64_t)stats.nQueueMaxDepth));
+    workqueue.push_back(Pair("peak_depth", (uint64_t)stats.nQueuePeakDepth));
+    workqueue.push_back(Pair("fair", stats.fFairQueue));
+    if (stats.fFairQueue)
+        workqueue.push_back(Pair("clients", (uint64_t)stats.nQueueClients));
+    workqueue.push_back(Pair("handled", stats.nRequestsHandled));
+    workqueue.push_back(Pair("rejected", stats.nRequestsRejected));
+
+    UniValue wait(UniValue::VOBJ);
+    wait.push_back(Pair("total_us", stats.nWaitTotalMicros));
+    wait.push_back(Pair("histogram", RPCHistogram(stats.vWaitHistogram)));
+
+    UniValue handle(UniValue::VOBJ);
+    handle.push_back(Pair("total_us", stats.nHandleTotalMicros));
+    handle.push_back(Pair("histogram", RPCHistogram(stats.vHandleHistogram)));
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("workqueue", workqueue));
+    obj.push_back(Pair("wait", wait));
+    obj.push_back(Pair("handle", handle));
+    obj.push_back(Pair("connections", stats.nConnections));
+    obj.push_back(Pair("connections_open", (uint64_t)stats.nConnectionsOpen));
+    obj.push_back(Pair("requests", stats.nRequests));
+    return obj;
+}
+
+UniValue getnotifyinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getnotifyinfo\n"
+            "Returns an object containing information about the commands of -alertnotify, -blocknotify and -walletnotify, since startup.\n"
+            "Only commands run on -notifythreads are counted.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"threads\": xxxxx,         (numeric) Number of threads running the commands, 0 if every command runs on a thread of its own\n"
+            "  \"queue_depth\": xxxxx,     (numeric) Number of commands waiting for a thread now\n"
+            "  \"max_queue_depth\": xxxxx, (numeric) Number of commands that may wait before notifications are dropped (see -notifyqueue)\n"
+            "  \"max_batch\": xxxxx,       (numeric) Most notifications a command is run for at once (see -notifybatch)\n"
+            "  \"running\": xxxxx,         (numeric) Number of commands running now\n"
+            "  \"notifications\": xxxxx,   (numeric) Number of notifications received\n"
+            "  \"coalesced\": xxxxx,       (numeric) Number of those added to a command that was already waiting\n"
+            "  \"dropped\": xxxxx,         (numeric) Number of those dropped because the queue was full\n"
+            "  \"commands\": xxxxx         (numeric) Number of commands run\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getnotifyinfo", "")
+            + HelpExampleRpc("getnotifyinfo", "")
+        );
+
+    const CNotifyQueueStats stats = g_notifyqueue.GetStats();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("threads", stats.nThreads));
+    ret.push_back(Pair("queue_depth", (uint64_t)stats.nQueued));
+    ret.push_back(Pair("max_queue_depth", (uint64_t)stats.nMaxQueue));
+    ret.push_back(Pair("max_batch", (uint64_t)stats.nMaxBatch));
+    ret.push_back(Pair("running", (uint64_t)stats.nRunning));
+    ret.push_back(Pair("notifications", stats.nNotifications));
+    ret.push_back(Pair("coalesced", stats.nCoalesced));
+    ret.push_back(Pair("dropped", stats.nDropped));
+    ret.push_back(Pair("commands", stats.nCommands));
+    return ret;
+}
+
 uint32_t getCategoryMask(UniValue cats) {
     cats = cats.get_array();
     uint32_t mask = 0;
@@ -623,6 +952,28 @@ UniValue echo(const JSONRPCRequest& request)
     return request.params;
 }
 
+UniValue setsigcachesize(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "setsigcachesize size\n"
+            "Resize the signature cache, as if the node had been started with -maxsigcachesize=size.\n"
+            "The signatures cached so far are dropped.\n"
+            "\nArguments:\n"
+            "1. size      (numeric, required) Cache size in megabytes\n"
+            "\nResult:\n"
+            "n            (numeric) Number of signatures the cache can hold\n"
+            "\nExamples:\n"
+            + HelpExampleCli("setsigcachesize", "64")
+            + HelpExampleRpc("setsigcachesize", "64")
+        );
+
+    int64_t nSize = request.params[0].get_int64();
+    if (nSize < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "size must not be negative");
+    return uint64_t(ResizeSignatureCache(nSize));
+}
+
 static UniValue getinfo_deprecated(const JSONRPCRequest& request)
 {
     throw JSONRPCError(RPC_METHOD_NOT_FOUND,
@@ -639,7 +990,11 @@ static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getmemoryinfo",          &getmemoryinfo,          {"mode"} },
+    { "control",            "getlockstats",           &getlockstats,           {"reset"} },
+    { "control",            "gethttpserverinfo",      &gethttpserverinfo,      {} },
+    { "control",            "getnotifyinfo",          &getnotifyinfo,          {} },
     { "control",            "logging",                &logging,                {"include", "exclude"}},
+    { "control",            "setsigcachesize",        &setsigcachesize,        {"size"} },
     { "util",               "validateaddress",        &validateaddress,        {"address"} }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         {"nrequired","keys"} },
     { "util",               "verifymessage",          &verifymessage,          {"address","signature","message"} },
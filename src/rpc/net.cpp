@@ -101,7 +101,17 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ],\n"
+            "    \"inflight_limit\": n,       (numeric) The number of blocks we keep requested from this peer\n"
+            "    \"blockservicetime\": n,     (numeric) Average time the peer takes to deliver a block, in seconds (if measured)\n"
+            "    \"blockdownloadrate\": n,    (numeric) Average block download rate from the peer, in bytes per second (if measured)\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
+            "    \"memusage\": n,             (numeric) Approximate memory held for the peer, in bytes, queued messages included\n"
+            "    \"compactblocks\": {\n"
+            "       \"sent\": n,              (numeric) Compact blocks sent to the peer\n"
+            "       \"txn_requested\": n,     (numeric) Getblocktxn requests received from the peer\n"
+            "       \"received\": n,          (numeric) Compact blocks received from the peer that we tried to reconstruct\n"
+            "       \"reconstructed\": n      (numeric) Compact blocks received from the peer that needed no further round trip\n"
+            "    },\n"
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes sent aggregated by message type\n"
             "       ...\n"
@@ -167,8 +177,20 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("inflight_limit", statestats.nBlocksInFlightLimit));
+            if (statestats.nBlockServiceTime > 0) {
+                obj.push_back(Pair("blockservicetime", ((double)statestats.nBlockServiceTime) / 1e6));
+                obj.push_back(Pair("blockdownloadrate", statestats.nBlockDownloadRate));
+            }
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
+        obj.push_back(Pair("memusage", (uint64_t)(stats.nMemoryUsage + (fStateStats ? statestats.nMemoryUsage : 0))));
+        UniValue cmpctBlocks(UniValue::VOBJ);
+        cmpctBlocks.push_back(Pair("sent", stats.nCmpctBlocksSent));
+        cmpctBlocks.push_back(Pair("txn_requested", stats.nCmpctBlockTxnRequests));
+        cmpctBlocks.push_back(Pair("received", stats.nCmpctBlocksReceived));
+        cmpctBlocks.push_back(Pair("reconstructed", stats.nCmpctBlocksReconstructed));
+        obj.push_back(Pair("compactblocks", cmpctBlocks));
 
         UniValue sendPerMsgCmd(UniValue::VOBJ);
         for (const mapMsgCmdSize::value_type &i : stats.mapSendBytesPerMsgCmd) {
@@ -367,6 +389,37 @@ UniValue getnettotals(const JSONRPCRequest& request)
             "    \"serve_historical_blocks\": true|false,  (boolean) True if serving historical blocks\n"
             "    \"bytes_left_in_cycle\": t,               (numeric) Bytes left in current time cycle\n"
             "    \"time_left_in_cycle\": t                 (numeric) Seconds left in current time cycle\n"
+            "  },\n"
+            "  \"uploadrate\": {\n"
+            "    \"limit\": n,               (numeric) Limit of the total upload rate in bytes per second, 0 = none (-maxuploadrate)\n"
+            "    \"classes\": {            (json object) Traffic by class, from the one sent first when the rate is limited\n"
+            "      \"blockrelay\": {        (json object) New blocks and headers; the others are txrelay, historical and other\n"
+            "        \"limit\": n,           (numeric) Limit of the rate of the class in bytes per second, 0 = none (-uploadrate)\n"
+            "        \"bytes_sent\": n,      (numeric) Total bytes sent\n"
+            "        \"deferred\": n         (numeric) Times a peer had to wait to send messages of the class\n"
+            "      },\n"
+            "      ...\n"
+            "    }\n"
+            "  },\n"
+            "  \"recentblockcache\": {\n"
+            "    \"blocks\": n,              (numeric) Blocks near the tip kept serialized in memory\n"
+            "    \"hits\": n,                (numeric) Requests for recent blocks served from memory\n"
+            "    \"misses\": n               (numeric) Requests for recent blocks that had to be read from disk\n"
+            "  },\n"
+            "  \"filteredblocks\": {\n"
+            "    \"served\": n,              (numeric) Bloom filtered blocks (merkleblock) sent to peers\n"
+            "    \"prematched\": n,          (numeric) Of which were matched when the block was connected (-peerbloomprematch)\n"
+            "    \"stale\": n,               (numeric) Prematched blocks not used because the peer's filter had changed\n"
+            "    \"txsent\": n,              (numeric) Matched transactions sent along with the filtered blocks\n"
+            "    \"matchtime\": n            (numeric) Time spent matching blocks against filters, in microseconds\n"
+            "  },\n"
+            "  \"bytessent_per_msg\": {\n"
+            "     \"addr\": n,              (numeric) The total bytes sent to all peers aggregated by message type\n"
+            "     ...\n"
+            "  },\n"
+            "  \"bytesrecv_per_msg\": {\n"
+            "     \"addr\": n,              (numeric) The total bytes received from all peers aggregated by message type\n"
+            "     ...\n"
             "  }\n"
             "}\n"
             "\nExamples:\n"
@@ -389,6 +442,52 @@ UniValue getnettotals(const JSONRPCRequest& request)
     outboundLimit.push_back(Pair("bytes_left_in_cycle", g_connman->GetOutboundTargetBytesLeft()));
     outboundLimit.push_back(Pair("time_left_in_cycle", g_connman->GetMaxOutboundTimeLeftInCycle()));
     obj.push_back(Pair("uploadtarget", outboundLimit));
+
+    UniValue uploadRate(UniValue::VOBJ);
+    uploadRate.push_back(Pair("limit", g_connman->GetMaxUploadRate()));
+    UniValue uploadClasses(UniValue::VOBJ);
+    for (int i = 0; i < UPLOAD_CLASS_COUNT; i++) {
+        const CUploadScheduler::ClassStats stats = g_connman->GetUploadClassStats((UploadClass)i);
+        UniValue uploadClass(UniValue::VOBJ);
+        uploadClass.push_back(Pair("limit", stats.nRateLimit));
+        uploadClass.push_back(Pair("bytes_sent", stats.nBytesSent));
+        uploadClass.push_back(Pair("deferred", stats.nDeferred));
+        uploadClasses.push_back(Pair(GetUploadClassName((UploadClass)i), uploadClass));
+    }
+    uploadRate.push_back(Pair("classes", uploadClasses));
+    obj.push_back(Pair("uploadrate", uploadRate));
+
+    size_t nRecentBlocks;
+    uint64_t nRecentBlockHits, nRecentBlockMisses;
+    GetRecentBlockCacheStats(nRecentBlocks, nRecentBlockHits, nRecentBlockMisses);
+    UniValue recentBlockCache(UniValue::VOBJ);
+    recentBlockCache.push_back(Pair("blocks", (uint64_t)nRecentBlocks));
+    recentBlockCache.push_back(Pair("hits", nRecentBlockHits));
+    recentBlockCache.push_back(Pair("misses", nRecentBlockMisses));
+    obj.push_back(Pair("recentblockcache", recentBlockCache));
+
+    FilteredBlockStats filteredStats = GetFilteredBlockStats();
+    UniValue filteredBlocks(UniValue::VOBJ);
+    filteredBlocks.push_back(Pair("served", filteredStats.nServed));
+    filteredBlocks.push_back(Pair("prematched", filteredStats.nPrematched));
+    filteredBlocks.push_back(Pair("stale", filteredStats.nStale));
+    filteredBlocks.push_back(Pair("txsent", filteredStats.nTxSent));
+    filteredBlocks.push_back(Pair("matchtime", filteredStats.nMatchMicros));
+    obj.push_back(Pair("filteredblocks", filteredBlocks));
+
+    UniValue sendPerMsgCmd(UniValue::VOBJ);
+    for (const mapMsgCmdSize::value_type &i : g_connman->GetTotalBytesSentPerMsgCmd()) {
+        if (i.second > 0)
+            sendPerMsgCmd.push_back(Pair(i.first, i.second));
+    }
+    obj.push_back(Pair("bytessent_per_msg", sendPerMsgCmd));
+
+    UniValue recvPerMsgCmd(UniValue::VOBJ);
+    for (const mapMsgCmdSize::value_type &i : g_connman->GetTotalBytesRecvPerMsgCmd()) {
+        if (i.second > 0)
+            recvPerMsgCmd.push_back(Pair(i.first, i.second));
+    }
+    obj.push_back(Pair("bytesrecv_per_msg", recvPerMsgCmd));
     return obj;
 }
 
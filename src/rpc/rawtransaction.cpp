@@ -8,6 +8,7 @@
 #include <coins.h>
 #include <consensus/validation.h>
 #include <core_io.h>
+#include <index/txindex.h>
 #include <init.h>
 #include <keystore.h>
 #include <validation.h>
@@ -31,7 +32,6 @@
 #include <wallet/wallet.h>
 #endif
 
-#include <future>
 #include <stdint.h>
 
 #include <univalue.h>
@@ -48,11 +48,11 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
 
     if (!hashBlock.IsNull()) {
         entry.push_back(Pair("blockhash", hashBlock.GetHex()));
-        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-        if (mi != mapBlockIndex.end() && (*mi).second) {
-            CBlockIndex* pindex = (*mi).second;
-            if (chainActive.Contains(pindex)) {
-                entry.push_back(Pair("confirmations", 1 + chainActive.Height() - pindex->nHeight));
+        const CBlockIndex* pindex = LookupBlockIndexNoLock(hashBlock);
+        if (pindex) {
+            std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
+            if (chain->Contains(pindex)) {
+                entry.push_back(Pair("confirmations", 1 + chain->Height() - pindex->nHeight));
                 entry.push_back(Pair("time", pindex->GetBlockTime()));
                 entry.push_back(Pair("blocktime", pindex->GetBlockTime()));
             }
@@ -70,7 +70,8 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
 
             "\nNOTE: By default this function only works for mempool transactions. If the -txindex option is\n"
             "enabled, it also works for blockchain transactions. If the block which contains the transaction\n"
-            "is known, its hash can be provided even for nodes without -txindex. Note that if a blockhash is\n"
+            "is known, its hash can be provided even for nodes without -txindex. With -recenttxindex, it also\n"
+            "works for the transactions of the most recent blocks. Note that if a blockhash is\n"
             "provided, only that block will be searched and if the transaction is in the mempool or other\n"
             "blocks, or if this node does not have the given block available, the transaction will not be found.\n"
             "DEPRECATED: for now, it also works for transactions with unspent outputs.\n"
@@ -141,11 +142,17 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
             + HelpExampleCli("getrawtransaction", "\"mytxid\" true \"myblockhash\"")
         );
 
-    LOCK(cs_main);
+    // Wait for the transaction index to catch up with the blocks already connected, without holding cs_main
+    bool f_txindex_ready = false;
+    if (g_txindex && request.params[2].isNull()) {
+        f_txindex_ready = g_txindex->BlockUntilSyncedToCurrentChain();
+    }
 
+    // Neither the mempool nor the transaction index need cs_main;
+    // GetTransaction only takes it to search the blocks without them
     bool in_active_chain = true;
     uint256 hash = ParseHashV(request.params[0], "parameter 1");
-    CBlockIndex* blockindex = nullptr;
+    const CBlockIndex* blockindex = nullptr;
 
     if (hash == Params().GenesisBlock().hashMerkleRoot) {
         // Special exception for the genesis block coinbase transaction
@@ -160,12 +167,11 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
 
     if (!request.params[2].isNull()) {
         uint256 blockhash = ParseHashV(request.params[2], "parameter 3");
-        BlockMap::iterator it = mapBlockIndex.find(blockhash);
-        if (it == mapBlockIndex.end()) {
+        blockindex = LookupBlockIndexNoLock(blockhash);
+        if (!blockindex) {
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block hash not found");
         }
-        blockindex = it->second;
-        in_active_chain = chainActive.Contains(blockindex);
+        in_active_chain = GetChainSnapshot()->Contains(blockindex);
     }
 
     CTransactionRef tx;
@@ -173,14 +179,17 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
     if (!GetTransaction(hash, tx, Params().GetConsensus(), hash_block, true, blockindex)) {
         std::string errmsg;
         if (blockindex) {
+            LOCK(cs_main);
             if (!(blockindex->nStatus & BLOCK_HAVE_DATA)) {
                 throw JSONRPCError(RPC_MISC_ERROR, "Block not available");
             }
             errmsg = "No such transaction found in the provided block";
+        } else if (!g_txindex) {
+            errmsg = "No such mempool transaction. Use -txindex to enable blockchain transaction queries";
+        } else if (!f_txindex_ready) {
+            errmsg = "No such mempool transaction. Blockchain transactions are still in the process of being indexed";
         } else {
-            errmsg = fTxIndex
-              ? "No such mempool or blockchain transaction"
-              : "No such mempool transaction. Use -txindex to enable blockchain transaction queries";
+            errmsg = "No such mempool or blockchain transaction";
         }
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, errmsg + ". Use gettransaction for wallet transactions.");
     }
@@ -230,6 +239,10 @@ UniValue gettxoutproof(const JSONRPCRequest& request)
        oneTxid = hash;
     }
 
+    if (g_txindex && request.params[1].isNull()) {
+        g_txindex->BlockUntilSyncedToCurrentChain();
+    }
+
     LOCK(cs_main);
 
     CBlockIndex* pblockindex = nullptr;
@@ -891,38 +904,58 @@ UniValue signrawtransaction(const JSONRPCRequest& request)
     // Use CTransaction for the constant parts of the
     // transaction to avoid rehashing.
     const CTransaction txConst(mtx);
-    // Sign what we can:
+    // Look the spent coins up first; the view may not be used from several threads
+    std::vector<const Coin*> vCoins(mtx.vin.size());
     for (unsigned int i = 0; i < mtx.vin.size(); i++) {
-        CTxIn& txin = mtx.vin[i];
-        const Coin& coin = view.AccessCoin(txin.prevout);
-        if (coin.IsSpent()) {
-            TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
-            continue;
-        }
-        const CScript& prevPubKey = coin.out.scriptPubKey;
-        const CAmount& amount = coin.out.nValue;
+        const Coin& coin = view.AccessCoin(mtx.vin[i].prevout);
+        if (!coin.IsSpent())
+            vCoins[i] = &coin;
+    }
+
+    // Sign what we can. Every input only depends on txConst and writes its
+    // own slot, so inputs are signed in parallel and applied in order.
+    std::vector<SignatureData> vSigData(mtx.vin.size());
+    ForEachInput(mtx.vin.size(), [&](unsigned int i) {
+        if (!vCoins[i])
+            return;
+        const CScript& prevPubKey = vCoins[i]->out.scriptPubKey;
+        const CAmount& amount = vCoins[i]->out.nValue;
 
         SignatureData sigdata;
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
         if (!fHashSingle || (i < mtx.vout.size()))
-            ProduceSignature(MutableTransactionSignatureCreator(&keystore, &mtx, i, amount, nHashType), prevPubKey, sigdata);
-        sigdata = CombineSignatures(prevPubKey, TransactionSignatureChecker(&txConst, i, amount), sigdata, DataFromTransaction(mtx, i));
-
-        UpdateTransaction(mtx, i, sigdata);
+            ProduceSignature(TransactionSignatureCreator(&keystore, &txConst, i, amount, nHashType), prevPubKey, sigdata);
+        vSigData[i] = CombineSignatures(prevPubKey, TransactionSignatureChecker(&txConst, i, amount), sigdata, DataFromTransaction(mtx, i));
+    });
+    for (unsigned int i = 0; i < mtx.vin.size(); i++) {
+        if (!vCoins[i])
+            continue;
+        UpdateTransaction(mtx, i, vSigData[i]);
 
         // amount must be specified for valid segwit signature
-        if (amount == MAX_MONEY && !txin.scriptWitness.IsNull()) {
-            throw JSONRPCError(RPC_TYPE_ERROR, strprintf("Missing amount for %s", coin.out.ToString()));
+        if (vCoins[i]->out.nValue == MAX_MONEY && !mtx.vin[i].scriptWitness.IsNull()) {
+            throw JSONRPCError(RPC_TYPE_ERROR, strprintf("Missing amount for %s", vCoins[i]->out.ToString()));
         }
+    }
 
-        ScriptError serror = SCRIPT_ERR_OK;
-        if (!VerifyScript(txin.scriptSig, prevPubKey, &txin.scriptWitness, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&txConst, i, amount), &serror)) {
-            if (serror == SCRIPT_ERR_INVALID_STACK_OPERATION) {
-                // Unable to sign input and verification failed (possible attempt to partially sign).
-                TxInErrorToJSON(txin, vErrors, "Unable to sign input, invalid stack size (possibly missing key)");
-            } else {
-                TxInErrorToJSON(txin, vErrors, ScriptErrorString(serror));
-            }
+    std::vector<ScriptError> vScriptErrors(mtx.vin.size(), SCRIPT_ERR_OK);
+    ForEachInput(mtx.vin.size(), [&](unsigned int i) {
+        if (!vCoins[i])
+            return;
+        const CTxIn& txin = mtx.vin[i];
+        VerifyScript(txin.scriptSig, vCoins[i]->out.scriptPubKey, &txin.scriptWitness, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&txConst, i, vCoins[i]->out.nValue), &vScriptErrors[i]);
+    });
+
+    // Report errors in input order
+    for (unsigned int i = 0; i < mtx.vin.size(); i++) {
+        const CTxIn& txin = mtx.vin[i];
+        if (!vCoins[i]) {
+            TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
+        } else if (vScriptErrors[i] == SCRIPT_ERR_INVALID_STACK_OPERATION) {
+            // Unable to sign input and verification failed (possible attempt to partially sign).
+            TxInErrorToJSON(txin, vErrors, "Unable to sign input, invalid stack size (possibly missing key)");
+        } else if (vScriptErrors[i] != SCRIPT_ERR_OK) {
+            TxInErrorToJSON(txin, vErrors, ScriptErrorString(vScriptErrors[i]));
         }
     }
     bool fComplete = vErrors.empty();
@@ -962,7 +995,7 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
 
     ObserveSafeMode();
 
-    std::promise<void> promise;
+    bool fSyncListeners = false;
 
     RPCTypeCheck(request.params, {UniValue::VSTR, UniValue::VBOOL});
 
@@ -1006,21 +1039,18 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
             // where a user might call sendrawtransaction with a transaction
             // to/from their wallet, immediately call some wallet RPC, and get
             // a stale result because callbacks have not yet been processed.
-            CallFunctionInValidationInterfaceQueue([&promise] {
-                promise.set_value();
-            });
+            // The wallets are notified on their own queues, so wait for
+            // those as well as the shared one.
+            fSyncListeners = true;
         }
     } else if (fHaveChain) {
         throw JSONRPCError(RPC_TRANSACTION_ALREADY_IN_CHAIN, "transaction already in block chain");
-    } else {
-        // Make sure we don't block forever if re-sending
-        // a transaction already in mempool.
-        promise.set_value();
     }
 
     } // cs_main
 
-    promise.get_future().wait();
+    if (fSyncListeners)
+        SyncWithValidationInterfaceQueue();
 
     if(!g_connman)
         throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
@@ -8,6 +8,7 @@
 #include <base58.h>
 #include <fs.h>
 #include <init.h>
+#include <metrics.h>
 #include <random.h>
 #include <sync.h>
 #include <ui_interface.h>
@@ -20,7 +21,14 @@
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <memory> // for unique_ptr
+#include <mutex>
+#include <set>
+#include <system_error>
+#include <thread>
 #include <unordered_map>
 
 static bool fRPCRunning = false;
@@ -268,6 +276,11 @@ static const CRPCCommand vRPCCommands[] =
     { "control",            "uptime",                 &uptime,                 {}  },
 };
 
+static CMetricHistogram* RegisterRPCMetric(const std::string& name)
+{
+    return RegisterMetricHistogram("bitcoin_rpc_duration_seconds", "Time taken to execute RPC calls", strprintf("method=\"%s\"", name));
+}
+
 CRPCTable::CRPCTable()
 {
     unsigned int vcidx;
@@ -277,6 +290,7 @@ CRPCTable::CRPCTable()
 
         pcmd = &vRPCCommands[vcidx];
         mapCommands[pcmd->name] = pcmd;
+        mapMetrics[pcmd->name] = RegisterRPCMetric(pcmd->name);
     }
 }
 
@@ -299,6 +313,7 @@ bool CRPCTable::appendCommand(const std::string& name, const CRPCCommand* pcmd)
         return false;
 
     mapCommands[name] = pcmd;
+    mapMetrics[name] = RegisterRPCMetric(name);
     return true;
 }
 
@@ -410,11 +425,88 @@ static UniValue JSONRPCExecOne(JSONRPCRequest jreq, const UniValue& req)
     return rpc_result;
 }
 
+/**
+ * Methods which only read state, so that consecutive batch entries calling
+ * them give the same results in any order. All other entries are executed
+ * on their own, after the entries before them have completed.
+ */
+static const std::set<std::string> setConcurrentBatchMethods = {
+    "decoderawtransaction", "decodescript", "getaddressbalance", "getaddresshistory",
+    "getbestblockhash", "getblock", "getblockcount",
+    "getblockfilter", "getblockhash", "getblockheader", "getmempoolancestors",
+    "getmempooldescendants", "getmempoolentry", "getrawtransaction", "gettxout",
+    "gettxoutproof", "validateaddress", "verifytxoutproof",
+};
+
+static bool IsConcurrentBatchEntry(const UniValue& req)
+{
+    if (!req.isObject())
+        return false;
+    const UniValue& method = find_value(req.get_obj(), "method");
+    return method.isStr() && setConcurrentBatchMethods.count(method.get_str());
+}
+
+/** Execute the entries [reqBegin, reqEnd) of a batch on up to nThreads threads, each writing only its own result */
+static void JSONRPCExecConcurrently(const JSONRPCRequest& jreq, const UniValue& vReq, unsigned int reqBegin, unsigned int reqEnd, unsigned int nThreads, std::vector<UniValue>& vResults)
+{
+    nThreads = std::min(nThreads, reqEnd - reqBegin);
+
+    std::atomic<unsigned int> nNext(reqBegin);
+    std::mutex mutexError;
+    std::exception_ptr error;
+    auto worker = [&]() {
+        try {
+            for (unsigned int reqIdx = nNext++; reqIdx < reqEnd; reqIdx = nNext++)
+                vResults[reqIdx] = JSONRPCExecOne(jreq, vReq[reqIdx]);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutexError);
+            if (!error)
+                error = std::current_exception();
+            nNext = reqEnd;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    if (nThreads > 1)
+        threads.reserve(nThreads - 1);
+    for (unsigned int n = 1; n < nThreads; n++) {
+        try {
+            threads.emplace_back(worker);
+        } catch (const std::system_error&) {
+            // The threads already started and this one share the remaining entries
+            break;
+        }
+    }
+    worker();
+    for (std::thread& thread : threads)
+        thread.join();
+    if (error)
+        std::rethrow_exception(error);
+}
+
 std::string JSONRPCExecBatch(const JSONRPCRequest& jreq, const UniValue& vReq)
 {
+    const unsigned int nThreads = std::max<int64_t>(gArgs.GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS), 1);
+    std::vector<UniValue> vResults(vReq.size());
+    unsigned int reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        unsigned int reqEnd = reqIdx;
+        if (nThreads > 1) {
+            while (reqEnd < vReq.size() && IsConcurrentBatchEntry(vReq[reqEnd]))
+                reqEnd++;
+        }
+        if (reqEnd - reqIdx > 1) {
+            JSONRPCExecConcurrently(jreq, vReq, reqIdx, reqEnd, nThreads, vResults);
+            reqIdx = reqEnd;
+        } else {
+            vResults[reqIdx] = JSONRPCExecOne(jreq, vReq[reqIdx]);
+            reqIdx++;
+        }
+    }
+
     UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(jreq, vReq[reqIdx]));
+    for (const UniValue& result : vResults)
+        ret.push_back(result);
 
     return ret.write() + "\n";
 }
@@ -485,6 +577,13 @@ UniValue CRPCTable::execute(const JSONRPCRequest &request) const
 
     g_rpcSignals.PreCommand(*pcmd);
 
+    // Commands are not added while the server runs, so this needs no lock
+    struct MetricTimer {
+        CMetricHistogram* pMetric;
+        int64_t nStart;
+        ~MetricTimer() { pMetric->Observe(GetTimeMicros() - nStart); }
+    } timer{mapMetrics.find(request.strMethod)->second, GetTimeMicros()};
+
     try
     {
         // Execute, convert arguments to array if necessary
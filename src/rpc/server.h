@@ -18,7 +18,10 @@
 #include <univalue.h>
 
 static const unsigned int DEFAULT_RPC_SERIALIZE_VERSION = 1;
+/** Default for -rpcbatchthreads: entries of a JSON-RPC batch are executed one by one */
+static const int DEFAULT_RPC_BATCH_THREADS = 1;
 
+class CMetricHistogram;
 class CRPCCommand;
 
 namespace RPCServer
@@ -36,6 +39,25 @@ struct UniValueType {
     UniValue::VType type;
 };
 
+class JSONStreamWriter;
+
+/**
+ * Lets a method write a large result as it is produced, instead of building
+ * and returning it as a whole (see JSONRPCRequest::resultStream).
+ */
+class RPCResultStream
+{
+public:
+    virtual ~RPCResultStream() {}
+
+    /**
+     * Start the reply and return the writer to write the result value to;
+     * the method then returns NullUniValue. Errors thrown afterwards are
+     * still reported, replacing what was written.
+     */
+    virtual JSONStreamWriter& Begin() = 0;
+};
+
 class JSONRPCRequest
 {
 public:
@@ -45,8 +67,10 @@ public:
     bool fHelp;
     std::string URI;
     std::string authUser;
+    //! Where the result may be streamed to, or null if it has to be returned
+    RPCResultStream* resultStream;
 
-    JSONRPCRequest() : id(NullUniValue), params(NullUniValue), fHelp(false) {}
+    JSONRPCRequest() : id(NullUniValue), params(NullUniValue), fHelp(false), resultStream(nullptr) {}
     void parse(const UniValue& valRequest);
 };
 
@@ -143,6 +167,8 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    //! Time taken by the calls of each command, see metrics.h
+    std::map<std::string, CMetricHistogram*> mapMetrics;
 public:
     CRPCTable();
     const CRPCCommand* operator[](const std::string& name) const;
@@ -191,6 +217,10 @@ extern std::string HelpExampleRpc(const std::string& methodname, const std::stri
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
+/**
+ * Execute a batch of requests, returning the replies in the same order.
+ * Consecutive read-only entries are executed on up to -rpcbatchthreads threads.
+ */
 std::string JSONRPCExecBatch(const JSONRPCRequest& jreq, const UniValue& vReq);
 
 // Retrieves any serialization flags requested in command line argument
@@ -8,10 +8,11 @@
 #include <reverselock.h>
 
 #include <assert.h>
+#include <algorithm>
 #include <boost/bind.hpp>
 #include <utility>
 
-CScheduler::CScheduler() : nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
+CScheduler::CScheduler() : nThreadsServicingQueue(0), nThreadsRunningNormal(0), stopRequested(false), stopWhenEmpty(false)
 {
 }
 
@@ -30,6 +31,31 @@ static boost::system_time toPosixTime(const boost::chrono::system_clock::time_po
 }
 #endif
 
+bool CScheduler::takeDueTask(Function& f, bool& fNormal, boost::chrono::system_clock::time_point& timeToWaitFor)
+{
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    if (!highPriorityQueue.empty() && highPriorityQueue.begin()->first <= now) {
+        f = std::move(highPriorityQueue.begin()->second);
+        highPriorityQueue.erase(highPriorityQueue.begin());
+        fNormal = false;
+        return true;
+    }
+    // Keep one thread for the HIGH lane, if there is more than one
+    bool fMayRunNormal = nThreadsServicingQueue <= 1 || nThreadsRunningNormal < nThreadsServicingQueue - 1;
+    if (fMayRunNormal && !taskQueue.empty() && taskQueue.begin()->first <= now) {
+        f = std::move(taskQueue.begin()->second);
+        taskQueue.erase(taskQueue.begin());
+        fNormal = true;
+        return true;
+    }
+    timeToWaitFor = boost::chrono::system_clock::time_point::max();
+    if (!highPriorityQueue.empty())
+        timeToWaitFor = highPriorityQueue.begin()->first;
+    if (fMayRunNormal && !taskQueue.empty())
+        timeToWaitFor = std::min(timeToWaitFor, taskQueue.begin()->first);
+    return false;
+}
+
 void CScheduler::serviceQueue()
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
@@ -40,47 +66,51 @@ void CScheduler::serviceQueue()
     // is called.
     while (!shouldStop()) {
         try {
-            if (!shouldStop() && taskQueue.empty()) {
+            if (!shouldStop() && empty()) {
                 reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
                 // Use this chance to get a tiny bit more entropy
                 RandAddSeedSleep();
             }
-            while (!shouldStop() && taskQueue.empty()) {
-                // Wait until there is something to do.
-                newTaskScheduled.wait(lock);
-            }
-
-            // Wait until either there is a new task, or until
-            // the time of the first item on the queue:
 
+            // Wait until there is a task for this thread that is due. If
+            // there are multiple threads, a new task or one finishing may
+            // change which task that is, so look again after every wakeup.
+            Function f;
+            bool fNormal = false;
+            boost::chrono::system_clock::time_point timeToWaitFor;
+            while (!shouldStop() && !takeDueTask(f, fNormal, timeToWaitFor)) {
+                if (timeToWaitFor == boost::chrono::system_clock::time_point::max()) {
+                    newTaskScheduled.wait(lock);
+                } else {
 // wait_until needs boost 1.50 or later; older versions have timed_wait:
 #if BOOST_VERSION < 105000
-            while (!shouldStop() && !taskQueue.empty() &&
-                   newTaskScheduled.timed_wait(lock, toPosixTime(taskQueue.begin()->first))) {
-                // Keep waiting until timeout
-            }
+                    newTaskScheduled.timed_wait(lock, toPosixTime(timeToWaitFor));
 #else
-            // Some boost versions have a conflicting overload of wait_until that returns void.
-            // Explicitly use a template here to avoid hitting that overload.
-            while (!shouldStop() && !taskQueue.empty()) {
-                boost::chrono::system_clock::time_point timeToWaitFor = taskQueue.begin()->first;
-                if (newTaskScheduled.wait_until<>(lock, timeToWaitFor) == boost::cv_status::timeout)
-                    break; // Exit loop after timeout, it means we reached the time of the event
-            }
+                    // Some boost versions have a conflicting overload of wait_until that returns void.
+                    // Explicitly use a template here to avoid hitting that overload.
+                    newTaskScheduled.wait_until<>(lock, timeToWaitFor);
 #endif
-            // If there are multiple threads, the queue can empty while we're waiting (another
-            // thread may service the task we were waiting on).
-            if (shouldStop() || taskQueue.empty())
+                }
+            }
+            if (!f)
                 continue;
 
-            Function f = taskQueue.begin()->second;
-            taskQueue.erase(taskQueue.begin());
-
-            {
+            if (fNormal)
+                ++nThreadsRunningNormal;
+            try {
                 // Unlock before calling f, so it can reschedule itself or another task
                 // without deadlocking:
                 reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
                 f();
+            } catch (...) {
+                if (fNormal)
+                    --nThreadsRunningNormal;
+                throw;
+            }
+            if (fNormal) {
+                --nThreadsRunningNormal;
+                // A thread kept for the HIGH lane may take NORMAL tasks again
+                newTaskScheduled.notify_one();
             }
         } catch (...) {
             --nThreadsServicingQueue;
@@ -103,11 +133,11 @@ void CScheduler::stop(bool drain)
     newTaskScheduled.notify_all();
 }
 
-void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t)
+void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t, Priority priority)
 {
     {
         boost::unique_lock<boost::mutex> lock(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
+        (priority == Priority::HIGH ? highPriorityQueue : taskQueue).insert(std::make_pair(t, f));
     }
     newTaskScheduled.notify_one();
 }
@@ -132,10 +162,14 @@ size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
                              boost::chrono::system_clock::time_point &last) const
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
-    size_t result = taskQueue.size();
-    if (!taskQueue.empty()) {
-        first = taskQueue.begin()->first;
-        last = taskQueue.rbegin()->first;
+    size_t result = taskQueue.size() + highPriorityQueue.size();
+    if (!taskQueue.empty() && !highPriorityQueue.empty()) {
+        first = std::min(taskQueue.begin()->first, highPriorityQueue.begin()->first);
+        last = std::max(taskQueue.rbegin()->first, highPriorityQueue.rbegin()->first);
+    } else if (!empty()) {
+        const auto& queue = taskQueue.empty() ? highPriorityQueue : taskQueue;
+        first = queue.begin()->first;
+        last = queue.rbegin()->first;
     }
     return result;
 }
@@ -155,7 +189,7 @@ void SingleThreadedSchedulerClient::MaybeScheduleProcessQueue() {
         if (m_are_callbacks_running) return;
         if (m_callbacks_pending.empty()) return;
     }
-    m_pscheduler->schedule(std::bind(&SingleThreadedSchedulerClient::ProcessQueue, this));
+    m_pscheduler->schedule(std::bind(&SingleThreadedSchedulerClient::ProcessQueue, this), boost::chrono::system_clock::now(), CScheduler::Priority::HIGH);
 }
 
 void SingleThreadedSchedulerClient::ProcessQueue() {
@@ -42,8 +42,17 @@ public:
 
     typedef std::function<void(void)> Function;
 
+    // Lanes of tasks. Due HIGH tasks run before due NORMAL ones, and when
+    // more than one thread services the queue, one of them is kept free of
+    // NORMAL tasks, so that slow periodic tasks cannot hold back the
+    // validation notifications (which run in the HIGH lane).
+    enum class Priority {
+        HIGH,
+        NORMAL,
+    };
+
     // Call func at/after time t
-    void schedule(Function f, boost::chrono::system_clock::time_point t=boost::chrono::system_clock::now());
+    void schedule(Function f, boost::chrono::system_clock::time_point t=boost::chrono::system_clock::now(), Priority priority=Priority::NORMAL);
 
     // Convenience method: call f once deltaSeconds from now
     void scheduleFromNow(Function f, int64_t deltaMilliSeconds);
@@ -76,12 +85,19 @@ public:
 
 private:
     std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
+    std::multimap<boost::chrono::system_clock::time_point, Function> highPriorityQueue;
     boost::condition_variable newTaskScheduled;
     mutable boost::mutex newTaskMutex;
     int nThreadsServicingQueue;
+    // Threads running a NORMAL task
+    int nThreadsRunningNormal;
     bool stopRequested;
     bool stopWhenEmpty;
-    bool shouldStop() const { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+    bool empty() const { return taskQueue.empty() && highPriorityQueue.empty(); }
+    bool shouldStop() const { return stopRequested || (stopWhenEmpty && empty()); }
+    // Take the task this thread should run now, if any; otherwise set
+    // timeToWaitFor to when one may become due. Called with newTaskMutex held.
+    bool takeDueTask(Function& f, bool& fNormal, boost::chrono::system_clock::time_point& timeToWaitFor);
 };
 
 /**
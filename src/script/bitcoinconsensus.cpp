@@ -10,6 +10,12 @@
 #include <script/interpreter.h>
 #include <version.h>
 
+#include <atomic>
+#include <memory>
+#include <system_error>
+#include <thread>
+#include <vector>
+
 namespace {
 
 /** A class that deserializes a single CTransaction one time. */
@@ -76,6 +82,137 @@ static bool verify_flags(unsigned int flags)
     return (flags & ~(bitcoinconsensus_SCRIPT_FLAGS_VERIFY_ALL)) == 0;
 }
 
+/** Decode the serialized transaction txTo, which must be exactly txToLen bytes */
+static bitcoinconsensus_error decode_transaction(const unsigned char *txTo, unsigned int txToLen, std::unique_ptr<CTransaction>& tx)
+{
+    try {
+        TxInputStream stream(SER_NETWORK, PROTOCOL_VERSION, txTo, txToLen);
+        tx.reset(new CTransaction(deserialize, stream));
+    } catch (const std::exception&) {
+        return bitcoinconsensus_ERR_TX_DESERIALIZE;
+    }
+    if (GetSerializeSize(*tx, SER_NETWORK, PROTOCOL_VERSION) != txToLen) {
+        tx.reset();
+        return bitcoinconsensus_ERR_TX_SIZE_MISMATCH;
+    }
+    return bitcoinconsensus_ERR_OK;
+}
+
+namespace {
+
+/** A decoded transaction whose inputs are to be verified */
+struct TransactionToVerify
+{
+    std::unique_ptr<CTransaction> tx;
+    std::unique_ptr<PrecomputedTransactionData> txdata;
+    const bitcoinconsensus_spent_output *spentOutputs;
+    //! Index of the result of the first input
+    size_t nFirstResult;
+};
+
+/** An input to verify: the transaction of vTxs, and the input in it */
+typedef std::pair<size_t, unsigned int> InputToVerify;
+
+} // namespace
+
+/**
+ * Verify the inputs, on up to nThreads threads including this one; each
+ * thread takes the next input not taken yet until there are none left. The
+ * result of an input is written at the index of its transaction's
+ * nFirstResult plus its own.
+ */
+static void verify_inputs(const std::vector<TransactionToVerify>& vTxs, const std::vector<InputToVerify>& vInputs, unsigned int flags, unsigned int nThreads, std::vector<char>& vResults)
+{
+    std::atomic<size_t> nNext(0);
+    auto worker = [&]() {
+        size_t i;
+        while ((i = nNext++) < vInputs.size()) {
+            const TransactionToVerify& txv = vTxs[vInputs[i].first];
+            const unsigned int nIn = vInputs[i].second;
+            const bitcoinconsensus_spent_output& spent = txv.spentOutputs[nIn];
+            bool fValid;
+            try {
+                const CTransaction& tx = *txv.tx;
+                fValid = VerifyScript(tx.vin[nIn].scriptSig, CScript(spent.scriptPubKey, spent.scriptPubKey + spent.scriptPubKeyLen), &tx.vin[nIn].scriptWitness, flags, TransactionSignatureChecker(&tx, nIn, spent.amount, *txv.txdata), nullptr);
+            } catch (const std::exception&) {
+                fValid = false;
+            }
+            vResults[txv.nFirstResult + nIn] = fValid;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < nThreads && i < vInputs.size(); i++) {
+        try {
+            threads.emplace_back(worker);
+        } catch (const std::system_error&) {
+            // Verify with the threads there are
+            break;
+        }
+    }
+    worker();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+/**
+ * Verify all inputs of the transactions; results has the result of every
+ * transaction, and errs its error.
+ */
+static int verify_transactions(const bitcoinconsensus_transaction *txs, unsigned int txsLen, unsigned int flags, unsigned int nThreads,
+                               int *results, bitcoinconsensus_error* errs, int *inputResults)
+{
+    std::vector<TransactionToVerify> vTxs(txsLen);
+    std::vector<InputToVerify> vInputs;
+    std::vector<bitcoinconsensus_error> vErrors(txsLen, bitcoinconsensus_ERR_OK);
+    size_t nResults = 0;
+    for (unsigned int i = 0; i < txsLen; i++) {
+        TransactionToVerify& txv = vTxs[i];
+        if (!verify_flags(flags)) {
+            vErrors[i] = bitcoinconsensus_ERR_INVALID_FLAGS;
+        } else {
+            vErrors[i] = decode_transaction(txs[i].txTo, txs[i].txToLen, txv.tx);
+        }
+        if (vErrors[i] == bitcoinconsensus_ERR_OK && txv.tx->vin.size() != txs[i].spentOutputsLen) {
+            vErrors[i] = bitcoinconsensus_ERR_SPENT_OUTPUTS_MISMATCH;
+        }
+        txv.nFirstResult = nResults;
+        if (vErrors[i] != bitcoinconsensus_ERR_OK)
+            continue;
+        txv.txdata.reset(new PrecomputedTransactionData(*txv.tx));
+        txv.spentOutputs = txs[i].spentOutputs;
+        for (unsigned int nIn = 0; nIn < txv.tx->vin.size(); nIn++) {
+            vInputs.emplace_back(i, nIn);
+        }
+        nResults += txv.tx->vin.size();
+    }
+
+    std::vector<char> vResults(nResults);
+    verify_inputs(vTxs, vInputs, flags, nThreads, vResults);
+
+    int fAllValid = 1;
+    for (unsigned int i = 0; i < txsLen; i++) {
+        int fValid = vErrors[i] == bitcoinconsensus_ERR_OK;
+        if (fValid) {
+            for (size_t nIn = 0; nIn < vTxs[i].tx->vin.size(); nIn++) {
+                fValid &= vResults[vTxs[i].nFirstResult + nIn];
+            }
+        }
+        if (results)
+            results[i] = fValid;
+        if (errs)
+            errs[i] = vErrors[i];
+        fAllValid &= fValid;
+    }
+    if (inputResults) {
+        for (size_t i = 0; i < nResults; i++) {
+            inputResults[i] = vResults[i];
+        }
+    }
+    return fAllValid;
+}
+
 static int verify_script(const unsigned char *scriptPubKey, unsigned int scriptPubKeyLen, CAmount amount,
                                     const unsigned char *txTo        , unsigned int txToLen,
                                     unsigned int nIn, unsigned int flags, bitcoinconsensus_error* err)
@@ -122,6 +259,30 @@ int bitcoinconsensus_verify_script(const unsigned char *scriptPubKey, unsigned i
     return ::verify_script(scriptPubKey, scriptPubKeyLen, am, txTo, txToLen, nIn, flags, err);
 }
 
+int bitcoinconsensus_verify_transaction(const unsigned char *txTo, unsigned int txToLen,
+                                        const bitcoinconsensus_spent_output *spentOutputs, unsigned int spentOutputsLen,
+                                        unsigned int flags, unsigned int nThreads,
+                                        int *inputResults, bitcoinconsensus_error* err)
+{
+    const bitcoinconsensus_transaction tx = {txTo, txToLen, spentOutputs, spentOutputsLen};
+    try {
+        return ::verify_transactions(&tx, 1, flags, nThreads, nullptr, err, inputResults);
+    } catch (const std::exception&) {
+        return set_error(err, bitcoinconsensus_ERR_TX_DESERIALIZE);
+    }
+}
+
+int bitcoinconsensus_verify_transactions(const bitcoinconsensus_transaction *txs, unsigned int txsLen,
+                                         unsigned int flags, unsigned int nThreads,
+                                         int *results, bitcoinconsensus_error* errs)
+{
+    try {
+        return ::verify_transactions(txs, txsLen, flags, nThreads, results, errs, nullptr);
+    } catch (const std::exception&) {
+        return 0;
+    }
+}
+
 unsigned int bitcoinconsensus_version()
 {
     // Just use the API version for now
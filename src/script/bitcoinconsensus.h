@@ -33,7 +33,7 @@
 extern "C" {
 #endif
 
-#define BITCOINCONSENSUS_API_VER 1
+#define BITCOINCONSENSUS_API_VER 2
 
 typedef enum bitcoinconsensus_error_t
 {
@@ -43,6 +43,7 @@ typedef enum bitcoinconsensus_error_t
     bitcoinconsensus_ERR_TX_DESERIALIZE,
     bitcoinconsensus_ERR_AMOUNT_REQUIRED,
     bitcoinconsensus_ERR_INVALID_FLAGS,
+    bitcoinconsensus_ERR_SPENT_OUTPUTS_MISMATCH,
 } bitcoinconsensus_error;
 
 /** Script verification flags */
@@ -72,6 +73,45 @@ EXPORT_SYMBOL int bitcoinconsensus_verify_script_with_amount(const unsigned char
                                     const unsigned char *txTo        , unsigned int txToLen,
                                     unsigned int nIn, unsigned int flags, bitcoinconsensus_error* err);
 
+/** The output spent by an input */
+typedef struct bitcoinconsensus_spent_output_t
+{
+    const unsigned char *scriptPubKey;
+    unsigned int scriptPubKeyLen;
+    int64_t amount;
+} bitcoinconsensus_spent_output;
+
+/** A serialized transaction, with the outputs spent by its inputs in the order of the inputs */
+typedef struct bitcoinconsensus_transaction_t
+{
+    const unsigned char *txTo;
+    unsigned int txToLen;
+    const bitcoinconsensus_spent_output *spentOutputs;
+    unsigned int spentOutputsLen;
+} bitcoinconsensus_transaction;
+
+/// Returns 1 if every input of the serialized transaction pointed to by txTo
+/// correctly spends the output at the same index of spentOutputs, under the
+/// additional constraints specified by flags. The transaction is decoded, and
+/// its signature hashes precomputed, once for all inputs. The inputs are
+/// verified on up to nThreads threads, the calling thread being one of them.
+/// If not nullptr, inputResults (of spentOutputsLen entries) will have the
+/// result of every input, and err will contain an error/success code for the
+/// operation.
+EXPORT_SYMBOL int bitcoinconsensus_verify_transaction(const unsigned char *txTo, unsigned int txToLen,
+                                                      const bitcoinconsensus_spent_output *spentOutputs, unsigned int spentOutputsLen,
+                                                      unsigned int flags, unsigned int nThreads,
+                                                      int *inputResults, bitcoinconsensus_error* err);
+
+/// Returns 1 if every transaction of txs is valid, as for
+/// bitcoinconsensus_verify_transaction; the inputs of all of them are spread
+/// over the same up to nThreads threads. If not nullptr, results and errs (of
+/// txsLen entries) will have the result and error/success code of every
+/// transaction.
+EXPORT_SYMBOL int bitcoinconsensus_verify_transactions(const bitcoinconsensus_transaction *txs, unsigned int txsLen,
+                                                       unsigned int flags, unsigned int nThreads,
+                                                       int *results, bitcoinconsensus_error* errs);
+
 EXPORT_SYMBOL unsigned int bitcoinconsensus_version();
 
 #ifdef __cplusplus
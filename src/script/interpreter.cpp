@@ -10,8 +10,11 @@
 #include <crypto/sha256.h>
 #include <pubkey.h>
 #include <script/script.h>
+#include <streams.h>
 #include <uint256.h>
 
+#include <limits>
+
 typedef std::vector<unsigned char> valtype;
 
 namespace {
@@ -60,6 +63,58 @@ static inline void popstack(std::vector<valtype>& stack)
     stack.pop_back();
 }
 
+namespace {
+
+/**
+ * The OP_IF/OP_NOTIF nesting of a script being executed. Only whether any
+ * enclosing branch is not executed matters, so this is tracked as a depth and
+ * the position of the first false entry, which needs no allocation and makes
+ * checking whether to execute an opcode constant time.
+ */
+class ConditionStack
+{
+private:
+    static constexpr uint32_t NO_FALSE = std::numeric_limits<uint32_t>::max();
+
+    //! Number of entries on the stack
+    uint32_t m_stack_size = 0;
+    //! Position of the first false entry, or NO_FALSE
+    uint32_t m_first_false_pos = NO_FALSE;
+
+public:
+    bool empty() const { return m_stack_size == 0; }
+    bool all_true() const { return m_first_false_pos == NO_FALSE; }
+    void push_back(bool f)
+    {
+        if (m_first_false_pos == NO_FALSE && !f) {
+            m_first_false_pos = m_stack_size;
+        }
+        ++m_stack_size;
+    }
+    void pop_back()
+    {
+        assert(m_stack_size > 0);
+        --m_stack_size;
+        if (m_first_false_pos == m_stack_size) {
+            m_first_false_pos = NO_FALSE;
+        }
+    }
+    void toggle_top()
+    {
+        assert(m_stack_size > 0);
+        if (m_first_false_pos == NO_FALSE) {
+            // The top is true and becomes the first false entry
+            m_first_false_pos = m_stack_size - 1;
+        } else if (m_first_false_pos == m_stack_size - 1) {
+            // The top is the first false entry and becomes true
+            m_first_false_pos = NO_FALSE;
+        }
+        // Otherwise a deeper entry is false and the top does not matter
+    }
+};
+
+} // namespace
+
 bool static IsCompressedOrUncompressedPubKey(const valtype &vchPubKey) {
     if (vchPubKey.size() < 33) {
         //  Non-canonical public key: too short
@@ -263,7 +318,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
     CScript::const_iterator pbegincodehash = script.begin();
     opcodetype opcode;
     valtype vchPushValue;
-    std::vector<bool> vfExec;
+    ConditionStack vfExec;
     std::vector<valtype> altstack;
     set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
     if (script.size() > MAX_SCRIPT_SIZE)
@@ -275,7 +330,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
     {
         while (pc < pend)
         {
-            bool fExec = !count(vfExec.begin(), vfExec.end(), false);
+            bool fExec = vfExec.all_true();
 
             //
             // Read instruction
@@ -464,7 +519,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                 {
                     if (vfExec.empty())
                         return set_error(serror, SCRIPT_ERR_UNBALANCED_CONDITIONAL);
-                    vfExec.back() = !vfExec.back();
+                    vfExec.toggle_top();
                 }
                 break;
 
@@ -504,7 +559,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                 {
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    altstack.push_back(stacktop(-1));
+                    altstack.push_back(std::move(stacktop(-1)));
                     popstack(stack);
                 }
                 break;
@@ -513,7 +568,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                 {
                     if (altstack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_ALTSTACK_OPERATION);
-                    stack.push_back(altstacktop(-1));
+                    stack.push_back(std::move(altstacktop(-1)));
                     popstack(altstack);
                 }
                 break;
@@ -535,8 +590,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     valtype vch1 = stacktop(-2);
                     valtype vch2 = stacktop(-1);
-                    stack.push_back(vch1);
-                    stack.push_back(vch2);
+                    stack.push_back(std::move(vch1));
+                    stack.push_back(std::move(vch2));
                 }
                 break;
 
@@ -548,9 +603,9 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     valtype vch1 = stacktop(-3);
                     valtype vch2 = stacktop(-2);
                     valtype vch3 = stacktop(-1);
-                    stack.push_back(vch1);
-                    stack.push_back(vch2);
-                    stack.push_back(vch3);
+                    stack.push_back(std::move(vch1));
+                    stack.push_back(std::move(vch2));
+                    stack.push_back(std::move(vch3));
                 }
                 break;
 
@@ -561,8 +616,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     valtype vch1 = stacktop(-4);
                     valtype vch2 = stacktop(-3);
-                    stack.push_back(vch1);
-                    stack.push_back(vch2);
+                    stack.push_back(std::move(vch1));
+                    stack.push_back(std::move(vch2));
                 }
                 break;
 
@@ -574,8 +629,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     valtype vch1 = stacktop(-6);
                     valtype vch2 = stacktop(-5);
                     stack.erase(stack.end()-6, stack.end()-4);
-                    stack.push_back(vch1);
-                    stack.push_back(vch2);
+                    stack.push_back(std::move(vch1));
+                    stack.push_back(std::move(vch2));
                 }
                 break;
 
@@ -596,7 +651,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     valtype vch = stacktop(-1);
                     if (CastToBool(vch))
-                        stack.push_back(vch);
+                        stack.push_back(std::move(vch));
                 }
                 break;
 
@@ -623,7 +678,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     valtype vch = stacktop(-1);
-                    stack.push_back(vch);
+                    stack.push_back(std::move(vch));
                 }
                 break;
 
@@ -642,7 +697,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     valtype vch = stacktop(-2);
-                    stack.push_back(vch);
+                    stack.push_back(std::move(vch));
                 }
                 break;
 
@@ -660,7 +715,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     valtype vch = stacktop(-n-1);
                     if (opcode == OP_ROLL)
                         stack.erase(stack.end()-n-1);
-                    stack.push_back(vch);
+                    stack.push_back(std::move(vch));
                 }
                 break;
 
@@ -691,7 +746,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     valtype vch = stacktop(-1);
-                    stack.insert(stack.end()-2, vch);
+                    stack.insert(stack.end()-2, std::move(vch));
                 }
                 break;
 
@@ -725,9 +780,9 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // zero bytes after it (numerically, 0x01 == 0x0001 == 0x000001)
                     //if (opcode == OP_NOTEQUAL)
                     //    fEqual = !fEqual;
+                    // The result reuses the buffer of the first argument
                     popstack(stack);
-                    popstack(stack);
-                    stack.push_back(fEqual ? vchTrue : vchFalse);
+                    stacktop(-1) = fEqual ? vchTrue : vchFalse;
                     if (opcode == OP_EQUALVERIFY)
                     {
                         if (fEqual)
@@ -855,19 +910,20 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     valtype& vch = stacktop(-1);
-                    valtype vchHash((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
+                    unsigned char vchHash[CSHA256::OUTPUT_SIZE];
+                    size_t nHashSize = (opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32;
                     if (opcode == OP_RIPEMD160)
-                        CRIPEMD160().Write(vch.data(), vch.size()).Finalize(vchHash.data());
+                        CRIPEMD160().Write(vch.data(), vch.size()).Finalize(vchHash);
                     else if (opcode == OP_SHA1)
-                        CSHA1().Write(vch.data(), vch.size()).Finalize(vchHash.data());
+                        CSHA1().Write(vch.data(), vch.size()).Finalize(vchHash);
                     else if (opcode == OP_SHA256)
-                        CSHA256().Write(vch.data(), vch.size()).Finalize(vchHash.data());
+                        CSHA256().Write(vch.data(), vch.size()).Finalize(vchHash);
                     else if (opcode == OP_HASH160)
-                        CHash160().Write(vch.data(), vch.size()).Finalize(vchHash.data());
+                        CHash160().Write(vch.data(), vch.size()).Finalize(vchHash);
                     else if (opcode == OP_HASH256)
-                        CHash256().Write(vch.data(), vch.size()).Finalize(vchHash.data());
-                    popstack(stack);
-                    stack.push_back(vchHash);
+                        CHash256().Write(vch.data(), vch.size()).Finalize(vchHash);
+                    // Replace the input in place, reusing its buffer
+                    vch.assign(vchHash, vchHash + nHashSize);
                 }
                 break;                                   
 
@@ -910,9 +966,9 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     if (!fSuccess && (flags & SCRIPT_VERIFY_NULLFAIL) && vchSig.size())
                         return set_error(serror, SCRIPT_ERR_SIG_NULLFAIL);
 
+                    // The result reuses the buffer of the signature
                     popstack(stack);
-                    popstack(stack);
-                    stack.push_back(fSuccess ? vchTrue : vchFalse);
+                    stacktop(-1) = fSuccess ? vchTrue : vchFalse;
                     if (opcode == OP_CHECKSIGVERIFY)
                     {
                         if (fSuccess)
@@ -1019,9 +1075,9 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     if ((flags & SCRIPT_VERIFY_NULLDUMMY) && stacktop(-1).size())
                         return set_error(serror, SCRIPT_ERR_SIG_NULLDUMMY);
-                    popstack(stack);
 
-                    stack.push_back(fSuccess ? vchTrue : vchFalse);
+                    // The result replaces the dummy argument
+                    stacktop(-1) = fSuccess ? vchTrue : vchFalse;
 
                     if (opcode == OP_CHECKMULTISIGVERIFY)
                     {
@@ -1059,6 +1115,9 @@ namespace {
  * Wrapper that serializes like CTransaction, but with the modifications
  *  required for the signature hash done in-place
  */
+/** Size of an input that is not being signed: prevout, empty script and nSequence */
+static const size_t LEGACY_BLANK_INPUT_SIZE = 32 + 4 + 1 + 4;
+
 class CTransactionSignatureSerializer {
 private:
     const CTransaction& txTo;  //!< reference to the spending transaction (the one being serialized)
@@ -1176,17 +1235,88 @@ uint256 GetOutputsHash(const CTransaction& txTo) {
 
 } // namespace
 
-PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
+const PrecomputedTransactionData::BIP143Hashes& PrecomputedTransactionData::GetBIP143Hashes(const CTransaction& txTo) const
+{
+    std::call_once(onceBIP143, [&] {
+        bip143.hashPrevouts = GetPrevoutHash(txTo);
+        bip143.hashSequence = GetSequenceHash(txTo);
+        bip143.hashOutputs = GetOutputsHash(txTo);
+    });
+    return bip143;
+}
+
+const PrecomputedTransactionData::LegacyMidstates* PrecomputedTransactionData::GetLegacyMidstates(const CTransaction& txTo) const
+{
+    std::call_once(onceLegacy, [&] {
+        // Legacy signature hashes only share work between several inputs, and
+        // only inputs with a scriptSig can be spending non-witness outputs
+        bool fHasScriptSig = false;
+        for (const auto& txin : txTo.vin) {
+            fHasScriptSig |= !txin.scriptSig.empty();
+        }
+        if (txTo.vin.size() < 2 || !fHasScriptSig)
+            return;
+
+        for (int n = 0; n < 2; n++) {
+            // No input is the one being signed, so all of them are blanked
+            CTransactionSignatureSerializer txTmp(txTo, CScript(), txTo.vin.size(), n == 0 ? SIGHASH_ALL : SIGHASH_NONE);
+            CVectorWriter inputs(SER_GETHASH, 0, legacy.vInputs[n], 0);
+            for (unsigned int i = 0; i < txTo.vin.size(); i++) {
+                txTmp.SerializeInput(inputs, i);
+            }
+            assert(legacy.vInputs[n].size() == txTo.vin.size() * LEGACY_BLANK_INPUT_SIZE);
+
+            CHashWriter ss(SER_GETHASH, 0);
+            ss << txTo.nVersion;
+            WriteCompactSize(ss, txTo.vin.size());
+            legacy.vMidstates[n].reserve(txTo.vin.size());
+            for (unsigned int i = 0; i < txTo.vin.size(); i++) {
+                legacy.vMidstates[n].push_back(ss);
+                ss.write((const char*)&legacy.vInputs[n][i * LEGACY_BLANK_INPUT_SIZE], LEGACY_BLANK_INPUT_SIZE);
+            }
+        }
+        CVectorWriter outputs(SER_GETHASH, 0, legacy.vOutputs, 0);
+        outputs << txTo.vout << txTo.nLockTime;
+        fLegacy = true;
+    });
+    return fLegacy ? &legacy : nullptr;
+}
+
+namespace {
+
+/** Legacy signature hash of a transaction whose shared parts are in cache */
+uint256 GetLegacySignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const PrecomputedTransactionData::LegacyMidstates& cache)
 {
-    // Cache is calculated only for transactions with witness
-    if (txTo.HasWitness()) {
-        hashPrevouts = GetPrevoutHash(txTo);
-        hashSequence = GetSequenceHash(txTo);
-        hashOutputs = GetOutputsHash(txTo);
-        ready = true;
+    const bool fHashSingle = (nHashType & 0x1f) == SIGHASH_SINGLE;
+    const bool fHashNone = (nHashType & 0x1f) == SIGHASH_NONE;
+    const int n = (fHashSingle || fHashNone) ? 1 : 0;
+    CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
+
+    // Version and the inputs before nIn
+    CHashWriter ss(cache.vMidstates[n][nIn]);
+    txTmp.SerializeInput(ss, nIn);
+    // The inputs after nIn
+    const std::vector<unsigned char>& inputs = cache.vInputs[n];
+    size_t nOffset = (nIn + 1) * LEGACY_BLANK_INPUT_SIZE;
+    ss.write((const char*)inputs.data() + nOffset, inputs.size() - nOffset);
+    // Outputs and nLockTime
+    if (fHashNone) {
+        WriteCompactSize(ss, 0);
+        ss << txTo.nLockTime;
+    } else if (fHashSingle) {
+        WriteCompactSize(ss, nIn + 1);
+        for (unsigned int nOutput = 0; nOutput <= nIn; nOutput++)
+            txTmp.SerializeOutput(ss, nOutput);
+        ss << txTo.nLockTime;
+    } else {
+        ss.write((const char*)cache.vOutputs.data(), cache.vOutputs.size());
     }
+    ss << nHashType;
+    return ss.GetHash();
 }
 
+} // namespace
+
 uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CAmount& amount, SigVersion sigversion, const PrecomputedTransactionData* cache)
 {
     assert(nIn < txTo.vin.size());
@@ -1195,19 +1325,22 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
         uint256 hashPrevouts;
         uint256 hashSequence;
         uint256 hashOutputs;
-        const bool cacheready = cache && cache->ready;
+        const PrecomputedTransactionData::BIP143Hashes* hashes = nullptr;
+        if (cache && !((nHashType & SIGHASH_ANYONECANPAY) && ((nHashType & 0x1f) == SIGHASH_SINGLE || (nHashType & 0x1f) == SIGHASH_NONE))) {
+            hashes = &cache->GetBIP143Hashes(txTo);
+        }
 
         if (!(nHashType & SIGHASH_ANYONECANPAY)) {
-            hashPrevouts = cacheready ? cache->hashPrevouts : GetPrevoutHash(txTo);
+            hashPrevouts = hashes ? hashes->hashPrevouts : GetPrevoutHash(txTo);
         }
 
         if (!(nHashType & SIGHASH_ANYONECANPAY) && (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
-            hashSequence = cacheready ? cache->hashSequence : GetSequenceHash(txTo);
+            hashSequence = hashes ? hashes->hashSequence : GetSequenceHash(txTo);
         }
 
 
         if ((nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
-            hashOutputs = cacheready ? cache->hashOutputs : GetOutputsHash(txTo);
+            hashOutputs = hashes ? hashes->hashOutputs : GetOutputsHash(txTo);
         } else if ((nHashType & 0x1f) == SIGHASH_SINGLE && nIn < txTo.vout.size()) {
             CHashWriter ss(SER_GETHASH, 0);
             ss << txTo.vout[nIn];
@@ -1247,6 +1380,11 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
         }
     }
 
+    if (cache && !(nHashType & SIGHASH_ANYONECANPAY)) {
+        if (const PrecomputedTransactionData::LegacyMidstates* midstates = cache->GetLegacyMidstates(txTo))
+            return GetLegacySignatureHash(scriptCode, txTo, nIn, nHashType, *midstates);
+    }
+
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
@@ -1417,7 +1555,151 @@ static bool VerifyWitnessProgram(const CScriptWitness& witness, int witversion,
     return true;
 }
 
+namespace {
+
+/** Result of the fast path of a standard script template */
+enum FastVerifyResult {
+    FAST_VERIFY_FALSE,
+    FAST_VERIFY_TRUE,
+    //! Not a spend the fast path handles; left to the interpreter
+    FAST_VERIFY_GENERIC,
+};
+
+} // namespace
+
+/**
+ * Run "DUP HASH160 <keyhash> EQUALVERIFY CHECKSIG" over the stack
+ * [vchSig vchPubKey] without the interpreter, and cast what it leaves on the
+ * stack to bool: the result, and error, EvalScript and the check of the stack
+ * after it would give.
+ */
+static bool VerifyKeyHash(const valtype& vchSig, const valtype& vchPubKey, const unsigned char* keyhash, const CScript& scriptCodeIn, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* serror)
+{
+    unsigned char vchHash[CHash160::OUTPUT_SIZE];
+    CHash160().Write(vchPubKey.data(), vchPubKey.size()).Finalize(vchHash);
+    if (memcmp(vchHash, keyhash, sizeof(vchHash)) != 0)
+        return set_error(serror, SCRIPT_ERR_EQUALVERIFY);
+
+    CScript scriptCode(scriptCodeIn);
+    if (sigversion == SIGVERSION_BASE) {
+        int found = scriptCode.FindAndDelete(CScript(vchSig));
+        if (found > 0 && (flags & SCRIPT_VERIFY_CONST_SCRIPTCODE))
+            return set_error(serror, SCRIPT_ERR_SIG_FINDANDDELETE);
+    }
+
+    if (!CheckSignatureEncoding(vchSig, flags, serror) || !CheckPubKeyEncoding(vchPubKey, flags, sigversion, serror)) {
+        //serror is set
+        return false;
+    }
+    if (!checker.CheckSig(vchSig, vchPubKey, scriptCode, sigversion)) {
+        if ((flags & SCRIPT_VERIFY_NULLFAIL) && vchSig.size())
+            return set_error(serror, SCRIPT_ERR_SIG_NULLFAIL);
+        return set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+    }
+    return true;
+}
+
+/** The rest of VerifyScript for a P2WPKH program, once the program has been left on the stack */
+static FastVerifyResult VerifyWitnessKeyHash(const CScriptWitness& witness, const unsigned char* program, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+{
+    // The program must cast to true to get to the witness at all
+    bool fTrue = false;
+    for (unsigned int i = 0; i < 20 && !fTrue; i++) {
+        fTrue = program[i] != 0 && !(i == 19 && program[i] == 0x80);
+    }
+    if (!fTrue || witness.stack.size() != 2)
+        return FAST_VERIFY_GENERIC;
+    const valtype& vchSig = witness.stack[0];
+    const valtype& vchPubKey = witness.stack[1];
+    if (vchSig.size() > MAX_SCRIPT_ELEMENT_SIZE || vchPubKey.size() > MAX_SCRIPT_ELEMENT_SIZE)
+        return FAST_VERIFY_GENERIC;
+
+    unsigned char script[25] = {OP_DUP, OP_HASH160, 20};
+    memcpy(script + 3, program, 20);
+    script[23] = OP_EQUALVERIFY;
+    script[24] = OP_CHECKSIG;
+    if (!VerifyKeyHash(vchSig, vchPubKey, program, CScript(script, script + sizeof(script)), flags, checker, SIGVERSION_WITNESS_V0, serror))
+        return FAST_VERIFY_FALSE;
+    set_success(serror);
+    return FAST_VERIFY_TRUE;
+}
+
+/**
+ * Verify spends of P2PKH, P2WPKH and P2SH-P2WPKH outputs, which come down to
+ * a hash check and one signature check, without the interpreter, giving the
+ * result and error VerifyScriptGeneric would. Spends in any form the
+ * interpreter could fail on before that, or of any other script, are left to
+ * it.
+ */
+static FastVerifyResult VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness& witness, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+{
+    // Leave the flag combinations VerifyScriptGeneric asserts against to it
+    if ((flags & SCRIPT_VERIFY_WITNESS) && !(flags & SCRIPT_VERIFY_P2SH))
+        return FAST_VERIFY_GENERIC;
+    if ((flags & SCRIPT_VERIFY_CLEANSTACK) && (~flags & (SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS)))
+        return FAST_VERIFY_GENERIC;
+
+    if (scriptPubKey.size() == 25 && scriptPubKey[0] == OP_DUP && scriptPubKey[1] == OP_HASH160 && scriptPubKey[2] == 20 &&
+        scriptPubKey[23] == OP_EQUALVERIFY && scriptPubKey[24] == OP_CHECKSIG) {
+        // P2PKH: the scriptSig must be two pushes the interpreter accepts
+        CScript::const_iterator pc = scriptSig.begin();
+        opcodetype opcode;
+        valtype vchSig, vchPubKey;
+        const bool fRequireMinimal = (flags & SCRIPT_VERIFY_MINIMALDATA) != 0;
+        if (!scriptSig.GetOp(pc, opcode, vchSig) || opcode > OP_PUSHDATA4 || vchSig.size() > MAX_SCRIPT_ELEMENT_SIZE ||
+            (fRequireMinimal && !CheckMinimalPush(vchSig, opcode)))
+            return FAST_VERIFY_GENERIC;
+        if (!scriptSig.GetOp(pc, opcode, vchPubKey) || opcode > OP_PUSHDATA4 || vchPubKey.size() > MAX_SCRIPT_ELEMENT_SIZE ||
+            (fRequireMinimal && !CheckMinimalPush(vchPubKey, opcode)))
+            return FAST_VERIFY_GENERIC;
+        if (pc != scriptSig.end())
+            return FAST_VERIFY_GENERIC;
+
+        if (!VerifyKeyHash(vchSig, vchPubKey, &scriptPubKey[3], scriptPubKey, flags, checker, SIGVERSION_BASE, serror))
+            return FAST_VERIFY_FALSE;
+        if ((flags & SCRIPT_VERIFY_WITNESS) && !witness.IsNull()) {
+            set_error(serror, SCRIPT_ERR_WITNESS_UNEXPECTED);
+            return FAST_VERIFY_FALSE;
+        }
+        set_success(serror);
+        return FAST_VERIFY_TRUE;
+    }
+
+    if (!(flags & SCRIPT_VERIFY_WITNESS))
+        return FAST_VERIFY_GENERIC;
+
+    if (scriptPubKey.size() == 22 && scriptPubKey[0] == OP_0 && scriptPubKey[1] == 20) {
+        // P2WPKH: the scriptSig must be empty
+        if (!scriptSig.empty())
+            return FAST_VERIFY_GENERIC;
+        return VerifyWitnessKeyHash(witness, &scriptPubKey[2], flags, checker, serror);
+    }
+
+    if (scriptPubKey.IsPayToScriptHash()) {
+        // P2SH-P2WPKH: the scriptSig must be exactly the push of a redeem
+        // script "0 <keyhash>" that hashes to the one of the scriptPubKey
+        if (scriptSig.size() != 23 || scriptSig[0] != 22 || scriptSig[1] != OP_0 || scriptSig[2] != 20)
+            return FAST_VERIFY_GENERIC;
+        unsigned char vchHash[CHash160::OUTPUT_SIZE];
+        CHash160().Write(&scriptSig[1], 22).Finalize(vchHash);
+        if (memcmp(vchHash, &scriptPubKey[2], sizeof(vchHash)) != 0)
+            return FAST_VERIFY_GENERIC;
+        return VerifyWitnessKeyHash(witness, &scriptSig[3], flags, checker, serror);
+    }
+
+    return FAST_VERIFY_GENERIC;
+}
+
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+{
+    static const CScriptWitness emptyWitness;
+    FastVerifyResult result = VerifyStandardScript(scriptSig, scriptPubKey, witness ? *witness : emptyWitness, flags, checker, serror);
+    if (result != FAST_VERIFY_GENERIC)
+        return result == FAST_VERIFY_TRUE;
+    return VerifyScriptGeneric(scriptSig, scriptPubKey, witness, flags, checker, serror);
+}
+
+bool VerifyScriptGeneric(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
 {
     static const CScriptWitness emptyWitness;
     if (witness == nullptr) {
@@ -1435,7 +1717,8 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
     if (!EvalScript(stack, scriptSig, flags, checker, SIGVERSION_BASE, serror))
         // serror is set
         return false;
-    if (flags & SCRIPT_VERIFY_P2SH)
+    // Only a P2SH spend evaluates the scriptSig's stack again
+    if ((flags & SCRIPT_VERIFY_P2SH) && scriptPubKey.IsPayToScriptHash())
         stackCopy = stack;
     if (!EvalScript(stack, scriptPubKey, flags, checker, SIGVERSION_BASE, serror))
         // serror is set
@@ -6,9 +6,11 @@
 #ifndef BITCOIN_SCRIPT_INTERPRETER_H
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
+#include <hash.h>
 #include <script/script_error.h>
 #include <primitives/transaction.h>
 
+#include <mutex>
 #include <vector>
 #include <stdint.h>
 #include <string>
@@ -119,12 +121,49 @@ enum
 
 bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned int flags, ScriptError* serror);
 
+/**
+ * Parts of the signature hashes of a transaction that are shared between its
+ * inputs. Each part is only computed when an input first needs it: a
+ * transaction without witness v0 inputs never needs the BIP143 hashes, and
+ * inputs found in the script execution cache need none of them. The script
+ * checks of a transaction run on several threads, so computing them is
+ * thread safe. Must only be used with the transaction it was constructed for.
+ */
 struct PrecomputedTransactionData
 {
-    uint256 hashPrevouts, hashSequence, hashOutputs;
-    bool ready = false;
+    /** The BIP143 hashes of all prevouts, all nSequences and all outputs */
+    struct BIP143Hashes
+    {
+        uint256 hashPrevouts, hashSequence, hashOutputs;
+    };
+
+    /**
+     * Shared parts of the legacy signature hash serialization, so that it is
+     * not rebuilt for every input. Index 0 is for SIGHASH_ALL, index 1 for
+     * SIGHASH_NONE and SIGHASH_SINGLE, which blank the other inputs' nSequence.
+     * vMidstates[n][i] has hashed everything before input i, and vInputs[n]
+     * holds every input serialized as it is when not signed.
+     */
+    struct LegacyMidstates
+    {
+        std::vector<CHashWriter> vMidstates[2];
+        std::vector<unsigned char> vInputs[2];
+        /** All outputs and nLockTime, as serialized for SIGHASH_ALL */
+        std::vector<unsigned char> vOutputs;
+    };
 
-    explicit PrecomputedTransactionData(const CTransaction& tx);
+    explicit PrecomputedTransactionData(const CTransaction& tx) {}
+
+    const BIP143Hashes& GetBIP143Hashes(const CTransaction& txTo) const;
+    /** The legacy midstates, or null if the transaction cannot share any work between its inputs */
+    const LegacyMidstates* GetLegacyMidstates(const CTransaction& txTo) const;
+
+private:
+    mutable std::once_flag onceBIP143;
+    mutable BIP143Hashes bip143;
+    mutable std::once_flag onceLegacy;
+    mutable LegacyMidstates legacy;
+    mutable bool fLegacy = false;
 };
 
 enum SigVersion
@@ -186,6 +225,8 @@ public:
 
 bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* error = nullptr);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror = nullptr);
+/** VerifyScript without its fast paths for standard script templates, which must give the same result and error */
+bool VerifyScriptGeneric(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror = nullptr);
 
 size_t CountWitnessSigOps(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags);
 
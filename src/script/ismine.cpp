@@ -25,6 +25,24 @@ unsigned int HaveKeys(const std::vector<valtype>& pubkeys, const CKeyStore& keys
     return nResult;
 }
 
+/** Whether a script follows a template for which IsMine only looks at keys
+ * and scripts that CKeyStore::IsMineCandidate knows about */
+static bool HasCandidateTemplate(const CScript& script)
+{
+    size_t size = script.size();
+    // P2PKH
+    if (size == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+        script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG)
+        return true;
+    // P2PK, with a compressed or uncompressed key
+    if (((size == 35 && script[0] == 33) || (size == 67 && script[0] == 65)) && script[size - 1] == OP_CHECKSIG)
+        return true;
+    // P2WPKH and P2WSH
+    if (((size == 22 && script[1] == 20) || (size == 34 && script[1] == 32)) && script[0] == OP_0)
+        return true;
+    return script.IsPayToScriptHash();
+}
+
 isminetype IsMine(const CKeyStore& keystore, const CScript& scriptPubKey, SigVersion sigversion)
 {
     bool isInvalid = false;
@@ -47,6 +65,12 @@ isminetype IsMine(const CKeyStore &keystore, const CScript& scriptPubKey, bool&
 {
     isInvalid = false;
 
+    // Most scripts are not ours; rule those out with a single lookup instead
+    // of solving them. Other signature versions can make a script invalid
+    // rather than not ours, so those take the full path.
+    if (sigversion == SIGVERSION_BASE && HasCandidateTemplate(scriptPubKey) && !keystore.IsMineCandidate(scriptPubKey))
+        return ISMINE_NO;
+
     std::vector<valtype> vSolutions;
     txnouttype whichType;
     if (!Solver(scriptPubKey, whichType, vSolutions)) {
@@ -5,6 +5,7 @@
 
 #include <script/sigcache.h>
 
+#include <hash.h>
 #include <memusage.h>
 #include <pubkey.h>
 #include <random.h>
@@ -14,6 +15,9 @@
 #include <cuckoocache.h>
 #include <boost/thread.hpp>
 
+#include <atomic>
+#include <unordered_map>
+
 namespace {
 /**
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
@@ -28,9 +32,15 @@ private:
     typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
     map_type setValid;
     boost::shared_mutex cs_sigcache;
+    size_t nMaxElements;
+
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+    std::atomic<uint64_t> nInserts;
+    std::atomic<uint64_t> nEvictions;
 
 public:
-    CSignatureCache()
+    CSignatureCache() : nMaxElements(0), nHits(0), nMisses(0), nInserts(0), nEvictions(0)
     {
         GetRandBytes(nonce.begin(), 32);
     }
@@ -44,18 +54,50 @@ public:
     bool
     Get(const uint256& entry, const bool erase)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.contains(entry, erase);
+        bool fFound;
+        {
+            // Lookups and erases only touch the atomic collection flags, so
+            // any number of them can share the lock
+            boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+            fFound = setValid.contains(entry, erase);
+        }
+        (fFound ? nHits : nMisses).fetch_add(1, std::memory_order_relaxed);
+        return fFound;
     }
 
     void Set(uint256& entry)
+    {
+        bool fKept;
+        {
+            boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+            fKept = setValid.insert(entry);
+        }
+        nInserts.fetch_add(1, std::memory_order_relaxed);
+        if (!fKept)
+            nEvictions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    //! (Re)size the cache, dropping its contents
+    size_t setup_bytes(size_t n)
     {
         boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.insert(entry);
+        nMaxElements = setValid.setup_bytes(n);
+        return nMaxElements;
     }
-    uint32_t setup_bytes(size_t n)
+
+    SignatureCacheStats GetStats()
     {
-        return setValid.setup_bytes(n);
+        SignatureCacheStats stats;
+        {
+            boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+            stats.nMaxElements = nMaxElements;
+        }
+        stats.nBytes = stats.nMaxElements * sizeof(uint256);
+        stats.nHits = nHits.load(std::memory_order_relaxed);
+        stats.nMisses = nMisses.load(std::memory_order_relaxed);
+        stats.nInserts = nInserts.load(std::memory_order_relaxed);
+        stats.nEvictions = nEvictions.load(std::memory_order_relaxed);
+        return stats;
     }
 };
 
@@ -66,18 +108,101 @@ public:
  * signatureCache could be made local to VerifySignature.
 */
 static CSignatureCache signatureCache;
+
+/** Public keys kept decoded, about 180 bytes each including the map overhead */
+static const size_t PUBKEY_CACHE_ENTRIES = 16384;
+
+/**
+ * Recently verified-against public keys in decoded form. Keys that sign many
+ * inputs (busy wallets, multisig cosigners) then only pay for parsing, and the
+ * square root of a compressed key, once rather than for every signature.
+ */
+class CPubKeyCache
+{
+private:
+    class PubKeyHasher
+    {
+    private:
+        const uint64_t k0, k1;
+
+    public:
+        PubKeyHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+        size_t operator()(const CPubKey& pubkey) const
+        {
+            return CSipHasher(k0, k1).Write(pubkey.begin(), pubkey.size()).Finalize();
+        }
+    };
+
+    std::unordered_map<CPubKey, CDecodedPubKey, PubKeyHasher> mapDecoded;
+    FastRandomContext insecure_rand;
+    boost::shared_mutex cs_pubkeycache;
+
+public:
+    CPubKeyCache()
+    {
+        mapDecoded.reserve(PUBKEY_CACHE_ENTRIES);
+    }
+
+    bool Get(const CPubKey& pubkey, CDecodedPubKey& decoded)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_pubkeycache);
+        auto it = mapDecoded.find(pubkey);
+        if (it == mapDecoded.end())
+            return false;
+        decoded = it->second;
+        return true;
+    }
+
+    void Set(const CPubKey& pubkey, const CDecodedPubKey& decoded)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_pubkeycache);
+        if (mapDecoded.size() >= PUBKEY_CACHE_ENTRIES) {
+            // Evict a random entry: keys in frequent use are soon added back,
+            // while the order of an unordered_map would favour recent ones
+            size_t nBucket = insecure_rand.randrange(mapDecoded.bucket_count());
+            while (mapDecoded.bucket_size(nBucket) == 0)
+                nBucket = (nBucket + 1) % mapDecoded.bucket_count();
+            mapDecoded.erase(mapDecoded.begin(nBucket)->first);
+        }
+        mapDecoded.emplace(pubkey, decoded);
+    }
+};
+
+static CPubKeyCache pubkeyCache;
 } // namespace
 
+bool VerifyWithPubKeyCache(const CPubKey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig)
+{
+    CDecodedPubKey decoded;
+    if (!pubkeyCache.Get(pubkey, decoded)) {
+        if (!pubkey.Decode(decoded))
+            return false;
+        pubkeyCache.Set(pubkey, decoded);
+    }
+    return CPubKey::VerifyDecoded(hash, vchSig, decoded);
+}
+
 // To be called once in AppInitMain/BasicTestingSetup to initialize the
 // signatureCache.
 void InitSignatureCache()
+{
+    ResizeSignatureCache(gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE));
+}
+
+size_t ResizeSignatureCache(int64_t nMaxSigCacheSize)
 {
     // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
     // setup_bytes creates the minimum possible cache (2 elements).
-    size_t nMaxCacheSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, nMaxSigCacheSize / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
     size_t nElems = signatureCache.setup_bytes(nMaxCacheSize);
     LogPrintf("Using %zu MiB out of %zu/2 requested for signature cache, able to store %zu elements\n",
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
+    return nElems;
+}
+
+SignatureCacheStats GetSignatureCacheStats()
+{
+    return signatureCache.GetStats();
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
@@ -86,7 +211,7 @@ bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsig
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
     if (signatureCache.Get(entry, !store))
         return true;
-    if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
+    if (!VerifyWithPubKeyCache(pubkey, sighash, vchSig))
         return false;
     if (store)
         signatureCache.Set(entry);
@@ -53,4 +53,29 @@ public:
 
 void InitSignatureCache();
 
+/**
+ * Verify a DER signature, taking the decoded form of pubkey from a bounded
+ * cache of recently used public keys instead of parsing it every time.
+ */
+bool VerifyWithPubKeyCache(const CPubKey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig);
+
+/**
+ * Resize the signature cache to nMaxSigCacheSize MiB, counted the same way as
+ * -maxsigcachesize. The cached signatures are dropped. Returns the number of
+ * entries the cache can hold.
+ */
+size_t ResizeSignatureCache(int64_t nMaxSigCacheSize);
+
+struct SignatureCacheStats {
+    size_t nMaxElements;
+    size_t nBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+    //! Inserts that pushed an entry out of the cache
+    uint64_t nEvictions;
+};
+
+SignatureCacheStats GetSignatureCacheStats();
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
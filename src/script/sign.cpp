@@ -11,6 +11,14 @@
 #include <primitives/transaction.h>
 #include <script/standard.h>
 #include <uint256.h>
+#include <util.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
 
 
 typedef std::vector<unsigned char> valtype;
@@ -202,6 +210,50 @@ void UpdateTransaction(CMutableTransaction& tx, unsigned int nIn, const Signatur
     tx.vin[nIn].scriptWitness = data.scriptWitness;
 }
 
+void ForEachInput(unsigned int nInputs, const std::function<void(unsigned int)>& fn)
+{
+    unsigned int nThreads = std::min<unsigned int>(std::max(GetNumCores(), 1), MAX_SIGNING_THREADS);
+    nThreads = std::min(nThreads, nInputs / MIN_INPUTS_PER_SIGNING_THREAD);
+    if (nThreads <= 1) {
+        for (unsigned int nIn = 0; nIn < nInputs; nIn++)
+            fn(nIn);
+        return;
+    }
+
+    // Inputs are handed out one at a time, so slow inputs (large multisig)
+    // do not hold up a whole thread's share
+    std::atomic<unsigned int> nNext(0);
+    std::mutex mutexError;
+    std::exception_ptr error;
+    auto worker = [&]() {
+        try {
+            for (unsigned int nIn = nNext++; nIn < nInputs; nIn = nNext++)
+                fn(nIn);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutexError);
+            if (!error)
+                error = std::current_exception();
+            nNext = nInputs;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(nThreads - 1);
+    for (unsigned int n = 1; n < nThreads; n++) {
+        try {
+            threads.emplace_back(worker);
+        } catch (const std::system_error&) {
+            // The threads already started and this one share the remaining inputs
+            break;
+        }
+    }
+    worker();
+    for (std::thread& thread : threads)
+        thread.join();
+    if (error)
+        std::rethrow_exception(error);
+}
+
 bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CMutableTransaction& txTo, unsigned int nIn, const CAmount& amount, int nHashType)
 {
     assert(nIn < txTo.vin.size());
@@ -8,6 +8,8 @@
 
 #include <script/interpreter.h>
 
+#include <functional>
+
 class CKeyID;
 class CKeyStore;
 class CScript;
@@ -70,6 +72,20 @@ struct SignatureData {
 /** Produce a script signature using a generic signature creator. */
 bool ProduceSignature(const BaseSignatureCreator& creator, const CScript& scriptPubKey, SignatureData& sigdata);
 
+/** Most threads used to sign or verify the inputs of one transaction */
+static const unsigned int MAX_SIGNING_THREADS = 16;
+/** Fewest inputs given to each signing thread; smaller transactions are handled inline */
+static const unsigned int MIN_INPUTS_PER_SIGNING_THREAD = 8;
+
+/**
+ * Call fn(nIn) for every input index of a transaction with nInputs inputs,
+ * spreading the calls over several threads when there are enough inputs.
+ * fn must only write state belonging to its own input, and must not take
+ * locks the caller holds. The first exception thrown by fn is rethrown once
+ * all threads have finished.
+ */
+void ForEachInput(unsigned int nInputs, const std::function<void(unsigned int)>& fn);
+
 /** Produce a script signature for a transaction. */
 bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CMutableTransaction& txTo, unsigned int nIn, const CAmount& amount, int nHashType);
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CMutableTransaction& txTo, unsigned int nIn, int nHashType);
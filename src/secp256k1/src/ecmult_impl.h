@@ -31,8 +31,14 @@
 /* optimal for 128-bit and 256-bit exponents. */
 #define WINDOW_A 5
 /** larger numbers may result in slightly better performance, at the cost of
-    exponentially larger precomputed tables. */
-#ifdef USE_ENDOMORPHISM
+    exponentially larger precomputed tables. Set with --with-ecmult-window. */
+#if defined(ECMULT_WINDOW_SIZE)
+#  if ECMULT_WINDOW_SIZE < 2 || ECMULT_WINDOW_SIZE > 24
+#    error Set ECMULT_WINDOW_SIZE to an integer in range [2..24].
+#  endif
+/** One table of 2^(ECMULT_WINDOW_SIZE-2) points, two with the endomorphism. */
+#define WINDOW_G ECMULT_WINDOW_SIZE
+#elif defined(USE_ENDOMORPHISM)
 /** Two tables for window size 15: 1.375 MiB. */
 #define WINDOW_G 15
 #else
@@ -576,6 +576,46 @@ void Unserialize(Stream& is, std::basic_string<C>& str)
 
 
 
+/**
+ * Streams over a buffer in memory (CDataStream, CSpanReader) lend out their
+ * unread bytes through ReadView(n), which checks that n bytes are left and
+ * skips past them. Byte vectors and scripts are then built from the stream's
+ * buffer in one step: nothing is allocated for a size the stream cannot hold,
+ * so no growing chunk by chunk, and the bytes are not zero-filled first.
+ * Returns nullptr for streams that only support read().
+ */
+template<typename Stream>
+auto ReadByteView(Stream& is, size_t nSize, int) -> decltype(is.ReadView(nSize))
+{
+    return is.ReadView(nSize);
+}
+
+template<typename Stream>
+const unsigned char* ReadByteView(Stream& is, size_t nSize, long)
+{
+    return nullptr;
+}
+
+/**
+ * The next unread byte of a stream over a buffer in memory, through its
+ * ReadPos(). Bytes read stay where they are until the stream is modified, or
+ * for CDataStream until read() consumes all of it, so an object can be hashed
+ * from the bytes it was read from. Streams with ReadPos() also have
+ * ReadView(). Returns nullptr for other streams.
+ */
+template<typename Stream>
+auto StreamReadPos(const Stream& is, int) -> decltype(is.ReadPos())
+{
+    return is.ReadPos();
+}
+
+template<typename Stream>
+const unsigned char* StreamReadPos(const Stream& is, long)
+{
+    return nullptr;
+}
+
+
 /**
  * prevector
  */
@@ -605,9 +645,15 @@ inline void Serialize(Stream& os, const prevector<N, T>& v)
 template<typename Stream, unsigned int N, typename T>
 void Unserialize_impl(Stream& is, prevector<N, T>& v, const unsigned char&)
 {
-    // Limit size per read so bogus size value won't cause out of memory
     v.clear();
     unsigned int nSize = ReadCompactSize(is);
+    if (nSize == 0)
+        return;
+    if (const unsigned char* pView = ReadByteView(is, nSize, 0)) {
+        v.assign(pView, pView + nSize);
+        return;
+    }
+    // Limit size per read so bogus size value won't cause out of memory
     unsigned int i = 0;
     while (i < nSize)
     {
@@ -673,9 +719,15 @@ inline void Serialize(Stream& os, const std::vector<T, A>& v)
 template<typename Stream, typename T, typename A>
 void Unserialize_impl(Stream& is, std::vector<T, A>& v, const unsigned char&)
 {
-    // Limit size per read so bogus size value won't cause out of memory
     v.clear();
     unsigned int nSize = ReadCompactSize(is);
+    if (nSize == 0)
+        return;
+    if (const unsigned char* pView = ReadByteView(is, nSize, 0)) {
+        v.assign(pView, pView + nSize);
+        return;
+    }
+    // Limit size per read so bogus size value won't cause out of memory
     unsigned int i = 0;
     while (i < nSize)
     {
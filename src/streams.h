@@ -15,6 +15,7 @@
 #include <limits>
 #include <map>
 #include <set>
+#include <stdexcept>
 #include <stdint.h>
 #include <stdio.h>
 #include <string>
@@ -139,16 +140,141 @@ private:
     size_t nPos;
 };
 
+/**
+ * XOR size bytes at data with key, repeated from the first byte. An eight byte
+ * key, as database obfuscation keys are, is applied a 64-bit word at a time,
+ * four words per step, which compilers widen further to vector instructions.
+ */
+inline void XorWithKey(unsigned char* data, size_t size, const std::vector<unsigned char>& key)
+{
+    if (key.empty()) {
+        return;
+    }
+
+    size_t i = 0;
+    if (key.size() == sizeof(uint64_t)) {
+        uint64_t k;
+        memcpy(&k, key.data(), sizeof(k));
+        for (; i + 4 * sizeof(k) <= size; i += 4 * sizeof(k)) {
+            uint64_t w[4];
+            memcpy(w, data + i, sizeof(w));
+            w[0] ^= k;
+            w[1] ^= k;
+            w[2] ^= k;
+            w[3] ^= k;
+            memcpy(data + i, w, sizeof(w));
+        }
+        for (; i + sizeof(k) <= size; i += sizeof(k)) {
+            uint64_t w;
+            memcpy(&w, data + i, sizeof(w));
+            w ^= k;
+            memcpy(data + i, &w, sizeof(w));
+        }
+    }
+
+    // The rest of the data starts at the beginning of the key again
+    for (size_t j = 0; i != size; i++) {
+        data[i] ^= key[j++];
+
+        // This potentially acts on very many bytes of data, so it's
+        // important that we calculate `j`, i.e. the `key` index in this
+        // way instead of doing a %, which would effectively be a division
+        // for each byte Xor'd -- much slower than need be.
+        if (j == key.size())
+            j = 0;
+    }
+}
+
+/** Minimal stream for reading from a range of memory that it does not own,
+ * such as a memory-mapped file. The memory must outlive the reader.
+ */
+class CSpanReader
+{
+public:
+/*
+ * @param[in]  nTypeIn Serialization Type
+ * @param[in]  nVersionIn Serialization Version (including any flags)
+ * @param[in]  pchDataIn  First byte to read
+ * @param[in]  nSizeIn Number of bytes that can be read
+*/
+    CSpanReader(int nTypeIn, int nVersionIn, const unsigned char* pchDataIn, size_t nSizeIn) : nType(nTypeIn), nVersion(nVersionIn), pchData(pchDataIn), nSize(nSizeIn), nPos(0) {}
+
+    void read(char* pch, size_t nRead)
+    {
+        if (nRead > nSize - nPos) {
+            throw std::ios_base::failure("CSpanReader::read(): end of data");
+        }
+        memcpy(pch, pchData + nPos, nRead);
+        nPos += nRead;
+    }
+    void ignore(size_t nIgnore)
+    {
+        if (nIgnore > nSize - nPos) {
+            throw std::ios_base::failure("CSpanReader::ignore(): end of data");
+        }
+        nPos += nIgnore;
+    }
+    //! The next nRead bytes, which stay valid as long as the underlying buffer (see ReadByteView)
+    const unsigned char* ReadView(size_t nRead)
+    {
+        if (nRead > nSize - nPos) {
+            throw std::ios_base::failure("CSpanReader::ReadView(): end of data");
+        }
+        const unsigned char* pView = pchData + nPos;
+        nPos += nRead;
+        return pView;
+    }
+    //! The next byte to read (see StreamReadPos)
+    const unsigned char* ReadPos() const
+    {
+        return pchData + nPos;
+    }
+    template<typename T>
+    CSpanReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+    int GetVersion() const
+    {
+        return nVersion;
+    }
+    int GetType() const
+    {
+        return nType;
+    }
+    //! Number of bytes not read yet
+    size_t size() const
+    {
+        return nSize - nPos;
+    }
+    bool empty() const
+    {
+        return nPos == nSize;
+    }
+private:
+    const int nType;
+    const int nVersion;
+    const unsigned char* pchData;
+    const size_t nSize;
+    size_t nPos;
+};
+
 //vector构造的类流接口
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
  * Fills with data in linear time; some stringstream implementations take N^2 time.
+ *
+ * The buffer type decides whether memory is cleansed when it is freed, see
+ * CDataStream and CPublicDataStream below.
  */
-class CDataStream
+template <typename SerializeData>
+class CBaseDataStream
 {
 protected:
-    typedef CSerializeData vector_type;
+    typedef SerializeData vector_type;
     vector_type vch;//内容
     unsigned int nReadPos;//位置
 
@@ -156,48 +282,44 @@ protected:
     int nVersion;//终端版本
 public:
 
-    typedef vector_type::allocator_type   allocator_type;
-    typedef vector_type::size_type        size_type;
-    typedef vector_type::difference_type  difference_type;
-    typedef vector_type::reference        reference;
-    typedef vector_type::const_reference  const_reference;
-    typedef vector_type::value_type       value_type;
-    typedef vector_type::iterator         iterator;
-    typedef vector_type::const_iterator   const_iterator;
-    typedef vector_type::reverse_iterator reverse_iterator;
-
-    explicit CDataStream(int nTypeIn, int nVersionIn)
-    {
-        Init(nTypeIn, nVersionIn);
-    }
+    typedef typename vector_type::allocator_type   allocator_type;
+    typedef typename vector_type::size_type        size_type;
+    typedef typename vector_type::difference_type  difference_type;
+    typedef typename vector_type::reference        reference;
+    typedef typename vector_type::const_reference  const_reference;
+    typedef typename vector_type::value_type       value_type;
+    typedef typename vector_type::iterator         iterator;
+    typedef typename vector_type::const_iterator   const_iterator;
+    typedef typename vector_type::reverse_iterator reverse_iterator;
 
-    CDataStream(const_iterator pbegin, const_iterator pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
+    explicit CBaseDataStream(int nTypeIn, int nVersionIn)
     {
         Init(nTypeIn, nVersionIn);
     }
 
-    CDataStream(const char* pbegin, const char* pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
+    CBaseDataStream(const_iterator pbegin, const_iterator pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
     {
         Init(nTypeIn, nVersionIn);
     }
 
-    CDataStream(const vector_type& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
+    CBaseDataStream(const char* pbegin, const char* pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
     {
         Init(nTypeIn, nVersionIn);
     }
 
-    CDataStream(const std::vector<char>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
+    template <typename Allocator>
+    CBaseDataStream(const std::vector<char, Allocator>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
     {
         Init(nTypeIn, nVersionIn);
     }
 
-    CDataStream(const std::vector<unsigned char>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
+    CBaseDataStream(const std::vector<unsigned char>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
     {
         Init(nTypeIn, nVersionIn);
     }
 
     template <typename... Args>
-    CDataStream(int nTypeIn, int nVersionIn, Args&&... args)
+    CBaseDataStream(int nTypeIn, int nVersionIn, Args&&... args)
     {
         Init(nTypeIn, nVersionIn);
         ::SerializeMany(*this, std::forward<Args>(args)...);
@@ -211,15 +333,15 @@ public:
         nVersion = nVersionIn;
     }
 
-    CDataStream& operator+=(const CDataStream& b)
+    CBaseDataStream& operator+=(const CBaseDataStream& b)
     {
         vch.insert(vch.end(), b.begin(), b.end());
         return *this;
     }
 
-    friend CDataStream operator+(const CDataStream& a, const CDataStream& b)
+    friend CBaseDataStream operator+(const CBaseDataStream& a, const CBaseDataStream& b)
     {
-        CDataStream ret = a;
+        CBaseDataStream ret = a;
         ret += b;
         return (ret);
     }
@@ -241,6 +363,7 @@ public:
     bool empty() const                               { return vch.size() == nReadPos; }
     void resize(size_type n, value_type c=0)         { vch.resize(n + nReadPos, c); }
     void reserve(size_type n)                        { vch.reserve(n + nReadPos); }
+    size_type capacity() const                       { return vch.capacity(); }
     const_reference operator[](size_type pos) const  { return vch[pos + nReadPos]; }
     reference operator[](size_type pos)              { return vch[pos + nReadPos]; }
     void clear()                                     { vch.clear(); nReadPos = 0; }
@@ -334,7 +457,7 @@ public:
     // Stream subset
     //
     bool eof() const             { return size() == 0; }
-    CDataStream* rdbuf()         { return this; }
+    CBaseDataStream* rdbuf()     { return this; }
     int in_avail() const         { return size(); }
 
     void SetType(int n)          { nType = n; }
@@ -361,6 +484,24 @@ public:
         nReadPos = nReadPosNext;
     }
 
+    //! The next nSize bytes, which stay valid until the stream is next modified (see ReadByteView)
+    const unsigned char* ReadView(size_t nSize)
+    {
+        if (nSize > vch.size() - nReadPos) {
+            throw std::ios_base::failure("CDataStream::ReadView(): end of data");
+        }
+        // Unlike read(), the buffer is not cleared once it is all consumed, which would invalidate the view
+        const unsigned char* pView = reinterpret_cast<const unsigned char*>(vch.data()) + nReadPos;
+        nReadPos += nSize;
+        return pView;
+    }
+
+    //! The next byte to read (see StreamReadPos)
+    const unsigned char* ReadPos() const
+    {
+        return reinterpret_cast<const unsigned char*>(vch.data()) + nReadPos;
+    }
+
     void ignore(int nSize)
     {
         // Ignore from the beginning of the buffer
@@ -394,7 +535,7 @@ public:
     }
 
     template<typename T>
-    CDataStream& operator<<(const T& obj)
+    CBaseDataStream& operator<<(const T& obj)
     {
         // Serialize to this stream
         ::Serialize(*this, obj);
@@ -402,14 +543,14 @@ public:
     }
 
     template<typename T>
-    CDataStream& operator>>(T& obj)
+    CBaseDataStream& operator>>(T& obj)
     {
         // Unserialize from this stream
         ::Unserialize(*this, obj);
         return (*this);
     }
 
-    void GetAndClear(CSerializeData &d) {
+    void GetAndClear(vector_type &d) {
         d.insert(d.end(), begin(), end());
         clear();
     }
@@ -422,24 +563,19 @@ public:
     //异或算法
     void Xor(const std::vector<unsigned char>& key)
     {
-        if (key.size() == 0) {
-            return;
-        }
-
-        for (size_type i = 0, j = 0; i != size(); i++) {
-            vch[i] ^= key[j++];
-
-            // This potentially acts on very many bytes of data, so it's
-            // important that we calculate `j`, i.e. the `key` index in this
-            // way instead of doing a %, which would effectively be a division
-            // for each byte Xor'd -- much slower than need be.
-            if (j == key.size())
-                j = 0;
-        }
+        XorWithKey((unsigned char*)data(), size(), key);
     }
 };
 
+/** Stream whose buffer is cleansed when freed, for data which may be secret (keys, wallet records) */
+typedef CBaseDataStream<CSerializeData> CDataStream;
 
+/**
+ * Stream for data which is public anyway, such as blocks and transactions
+ * received from the network. Its buffer is not cleansed when freed, which
+ * for large messages costs as much as copying them.
+ */
+typedef CBaseDataStream<std::vector<char>> CPublicDataStream;
 
 
 
@@ -448,6 +584,87 @@ public:
 
 
 
+
+
+/** Reads bits, most significant first, from the bytes of an underlying stream */
+template <typename IStream>
+class BitStreamReader
+{
+private:
+    IStream& m_istream;
+    //! Byte read from the stream, of which m_offset high bits were already returned
+    uint8_t m_buffer;
+    int m_offset;
+
+public:
+    explicit BitStreamReader(IStream& istream) : m_istream(istream), m_buffer(0), m_offset(8) {}
+
+    /** Read the next nbits (0 to 64) bits, returned in the low bits of the result */
+    uint64_t Read(int nbits)
+    {
+        if (nbits < 0 || nbits > 64) {
+            throw std::out_of_range("BitStreamReader::Read(): nbits must be between 0 and 64");
+        }
+        uint64_t data = 0;
+        while (nbits > 0) {
+            if (m_offset == 8) {
+                m_istream >> m_buffer;
+                m_offset = 0;
+            }
+            int bits = std::min(8 - m_offset, nbits);
+            data <<= bits;
+            data |= static_cast<uint8_t>(m_buffer << m_offset) >> (8 - bits);
+            m_offset += bits;
+            nbits -= bits;
+        }
+        return data;
+    }
+};
+
+/** Writes bits, most significant first, as bytes to an underlying stream. The
+ *  last byte is padded with zero bits when the writer is flushed or destroyed. */
+template <typename OStream>
+class BitStreamWriter
+{
+private:
+    OStream& m_ostream;
+    //! Byte being filled, of which m_offset high bits are written
+    uint8_t m_buffer;
+    int m_offset;
+
+public:
+    explicit BitStreamWriter(OStream& ostream) : m_ostream(ostream), m_buffer(0), m_offset(0) {}
+    ~BitStreamWriter() { Flush(); }
+
+    /** Write the low nbits (0 to 64) bits of data */
+    void Write(uint64_t data, int nbits)
+    {
+        if (nbits < 0 || nbits > 64) {
+            throw std::out_of_range("BitStreamWriter::Write(): nbits must be between 0 and 64");
+        }
+        while (nbits > 0) {
+            int bits = std::min(8 - m_offset, nbits);
+            m_buffer |= (data << (64 - nbits)) >> (64 - 8 + m_offset);
+            m_offset += bits;
+            nbits -= bits;
+            if (m_offset == 8) {
+                Flush();
+            }
+        }
+    }
+
+    /** Write out a partially filled byte */
+    void Flush()
+    {
+        if (m_offset == 0) {
+            return;
+        }
+        m_ostream << m_buffer;
+        m_buffer = 0;
+        m_offset = 0;
+    }
+};
+
 /** Non-refcounted RAII wrapper for FILE*
  *
  * Will automatically close the file when it goes out of scope if not null.
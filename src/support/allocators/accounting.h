@@ -0,0 +1,71 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_ACCOUNTING_H
+#define BITCOIN_SUPPORT_ALLOCATORS_ACCOUNTING_H
+
+#include <memusage.h>
+
+#include <cstddef>
+#include <new>
+
+/**
+ * Allocator which adds the memory taken by each allocation, as estimated by
+ * memusage::MallocUsage, to a counter. This gives the exact usage of containers
+ * whose node layout is not known, such as boost::multi_index_container, which
+ * allocates its nodes and bucket arrays through the allocator it is given.
+ *
+ * All copies and rebinds share the counter, which must outlive them. A
+ * default-constructed allocator counts nothing. Not thread-safe: the counter is
+ * protected by whatever protects the container.
+ */
+template <class T>
+class AccountingAllocator
+{
+public:
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind {
+        typedef AccountingAllocator<U> other;
+    };
+
+    AccountingAllocator() noexcept : m_usage(nullptr) {}
+    explicit AccountingAllocator(size_t* usage) noexcept : m_usage(usage) {}
+
+    template <typename U>
+    AccountingAllocator(const AccountingAllocator<U>& other) noexcept : m_usage(other.usage()) {}
+
+    T* allocate(std::size_t n)
+    {
+        T* p = static_cast<T*>(::operator new(n * sizeof(T)));
+        if (m_usage) *m_usage += memusage::MallocUsage(n * sizeof(T));
+        return p;
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        if (m_usage) *m_usage -= memusage::MallocUsage(n * sizeof(T));
+        ::operator delete(p);
+    }
+
+    size_t* usage() const noexcept { return m_usage; }
+
+private:
+    size_t* m_usage;
+};
+
+template <class T1, class T2>
+bool operator==(const AccountingAllocator<T1>& a, const AccountingAllocator<T2>& b) noexcept
+{
+    return a.usage() == b.usage();
+}
+
+template <class T1, class T2>
+bool operator!=(const AccountingAllocator<T1>& a, const AccountingAllocator<T2>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_ACCOUNTING_H
@@ -0,0 +1,233 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <support/largepages.h>
+
+#include <array>
+#include <assert.h>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/**
+ * A memory resource for node-based containers such as std::unordered_map,
+ * which allocate many small objects of the same few sizes.
+ *
+ * Memory is taken from the system in chunks of a fixed size and carved into
+ * blocks which are a multiple of ELEM_ALIGN_BYTES. Freed blocks are kept in a
+ * free list per size and reused, and chunks are only returned to the system
+ * when the resource is destroyed. This avoids the per-allocation malloc
+ * overhead, keeps nodes close together, and makes the memory used exactly
+ * known (see memusage::DynamicUsage). As the blocks of one container tend to
+ * have the same size, freed blocks are as good as unused memory; both are
+ * reported by FreeBytes(). Requests larger than MAX_BLOCK_SIZE_BYTES, or with a
+ * stricter alignment, are passed through to ::operator new.
+ *
+ * With UseLargePages(), chunks are taken from large pages instead, as
+ * configured by SetLargePageMode(), and are at least LARGE_PAGE_SIZE bytes.
+ *
+ * Not thread-safe.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+private:
+    /** In-place linked list of the free blocks of one size */
+    struct ListNode {
+        ListNode* m_next;
+        explicit ListNode(ListNode* next) : m_next(next) {}
+    };
+
+    /** Granularity of all block sizes */
+    static constexpr std::size_t ELEM_ALIGN_BYTES = alignof(ListNode) > ALIGN_BYTES ? alignof(ListNode) : ALIGN_BYTES;
+    static_assert((ELEM_ALIGN_BYTES & (ELEM_ALIGN_BYTES - 1)) == 0, "ELEM_ALIGN_BYTES must be a power of two");
+    static_assert(sizeof(ListNode) <= ELEM_ALIGN_BYTES, "a free block must be able to hold a ListNode");
+    static_assert(ELEM_ALIGN_BYTES <= alignof(std::max_align_t), "chunks are only aligned to max_align_t");
+
+    std::size_t m_chunk_size_bytes;
+    bool m_large_pages;
+    std::vector<void*> m_allocated_chunks;
+    /** Free lists, indexed by block size in units of ELEM_ALIGN_BYTES */
+    std::array<ListNode*, MAX_BLOCK_SIZE_BYTES / ELEM_ALIGN_BYTES + 1> m_free_lists;
+    /** Not yet used part of the newest chunk */
+    char* m_available_memory_it;
+    char* m_available_memory_end;
+    /** Total size of the blocks in the free lists */
+    std::size_t m_free_bytes;
+
+    static constexpr std::size_t NumElemAlignBytes(std::size_t bytes)
+    {
+        return (bytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + (bytes == 0);
+    }
+
+    static constexpr bool IsFreeListUsable(std::size_t bytes, std::size_t alignment)
+    {
+        return alignment <= ELEM_ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void PlacementAddToList(void* p, ListNode*& node)
+    {
+        node = new (p) ListNode(node);
+    }
+
+    void AllocateChunk()
+    {
+        // Hand the rest of the current chunk to the free list of its size.
+        const std::size_t remaining_available_bytes = m_available_memory_end - m_available_memory_it;
+        if (remaining_available_bytes) {
+            PlacementAddToList(m_available_memory_it, m_free_lists[remaining_available_bytes / ELEM_ALIGN_BYTES]);
+            m_free_bytes += remaining_available_bytes;
+        }
+        void* storage = nullptr;
+        if (m_large_pages) {
+            storage = AllocateLargePageChunk(m_chunk_size_bytes);
+            if (storage == nullptr) {
+                throw std::bad_alloc();
+            }
+        } else {
+            storage = ::operator new(m_chunk_size_bytes);
+        }
+        m_allocated_chunks.push_back(storage);
+        m_available_memory_it = static_cast<char*>(storage);
+        m_available_memory_end = m_available_memory_it + m_chunk_size_bytes;
+    }
+
+public:
+    /** The chunk size is rounded up to a multiple of ELEM_ALIGN_BYTES. No memory is allocated until first use. */
+    explicit PoolResource(std::size_t chunk_size_bytes)
+        : m_chunk_size_bytes(NumElemAlignBytes(chunk_size_bytes) * ELEM_ALIGN_BYTES), m_large_pages(false),
+          m_available_memory_it(nullptr), m_available_memory_end(nullptr), m_free_bytes(0)
+    {
+        assert(m_chunk_size_bytes >= MAX_BLOCK_SIZE_BYTES);
+        m_free_lists.fill(nullptr);
+    }
+
+    PoolResource() : PoolResource(262144) {}
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    ~PoolResource()
+    {
+        for (void* chunk : m_allocated_chunks) {
+            if (m_large_pages) {
+                FreeLargePageChunk(chunk, m_chunk_size_bytes);
+            } else {
+                ::operator delete(chunk);
+            }
+        }
+    }
+
+    /** Take the chunks from large pages if they are enabled; must be called before the first allocation */
+    void UseLargePages()
+    {
+        assert(m_allocated_chunks.empty());
+        if (GetLargePageMode() == LargePageMode::NONE) {
+            return;
+        }
+        m_large_pages = true;
+        m_chunk_size_bytes = (m_chunk_size_bytes + LARGE_PAGE_SIZE - 1) / LARGE_PAGE_SIZE * LARGE_PAGE_SIZE;
+    }
+
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (IsFreeListUsable(bytes, alignment)) {
+            const std::size_t num_alignments = NumElemAlignBytes(bytes);
+            ListNode*& free_list = m_free_lists[num_alignments];
+            const std::size_t round_bytes = num_alignments * ELEM_ALIGN_BYTES;
+            if (free_list != nullptr) {
+                ListNode* node = free_list;
+                free_list = node->m_next;
+                node->~ListNode();
+                m_free_bytes -= round_bytes;
+                return node;
+            }
+            if (round_bytes > static_cast<std::size_t>(m_available_memory_end - m_available_memory_it)) {
+                AllocateChunk();
+            }
+            void* p = m_available_memory_it;
+            m_available_memory_it += round_bytes;
+            return p;
+        }
+        return ::operator new(bytes);
+    }
+
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (IsFreeListUsable(bytes, alignment)) {
+            const std::size_t num_alignments = NumElemAlignBytes(bytes);
+            PlacementAddToList(p, m_free_lists[num_alignments]);
+            m_free_bytes += num_alignments * ELEM_ALIGN_BYTES;
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    std::size_t NumAllocatedChunks() const { return m_allocated_chunks.size(); }
+    std::size_t ChunkSizeBytes() const { return m_chunk_size_bytes; }
+    //! Size of the blocks in the free lists and of the not yet used part of the newest chunk
+    std::size_t FreeBytes() const { return m_free_bytes + (m_available_memory_end - m_available_memory_it); }
+};
+
+/**
+ * Allocator drawing from a PoolResource. A default-constructed allocator has
+ * no resource and behaves like std::allocator.
+ */
+template <class T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(T)>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator() noexcept : m_resource(nullptr) {}
+    explicit PoolAllocator(ResourceType* resource) noexcept : m_resource(resource) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept : m_resource(other.resource()) {}
+
+    T* allocate(std::size_t n)
+    {
+        if (m_resource == nullptr) {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(m_resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        if (m_resource == nullptr) {
+            ::operator delete(p);
+        } else {
+            m_resource->Deallocate(p, n * sizeof(T), alignof(T));
+        }
+    }
+
+    ResourceType* resource() const noexcept { return m_resource; }
+
+private:
+    ResourceType* m_resource;
+};
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.resource() == b.resource();
+}
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
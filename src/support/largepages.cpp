@@ -0,0 +1,187 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <support/largepages.h>
+
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+
+static LargePageMode g_large_page_mode = LargePageMode::NONE;
+static NumaPolicy g_numa_policy = NumaPolicy::DEFAULT;
+
+#ifdef __linux__
+// From <linux/mempolicy.h>, which is not always installed
+static const int MPOL_BIND_MODE = 2;
+static const int MPOL_INTERLEAVE_MODE = 3;
+
+/** Nodes the NUMA policy applies to, as a mask for mbind */
+static const size_t MAX_NUMA_NODES = 1024;
+static unsigned long g_numa_nodes[MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+
+static void AddNumaNode(unsigned long node)
+{
+    if (node < MAX_NUMA_NODES) {
+        g_numa_nodes[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    }
+}
+
+/** Read the online nodes, a list of ranges such as "0-1,3" */
+static bool ReadOnlineNumaNodes()
+{
+    std::ifstream file("/sys/devices/system/node/online");
+    std::string list;
+    if (!std::getline(file, list)) {
+        return false;
+    }
+    const char* p = list.c_str();
+    while (*p) {
+        char* end;
+        unsigned long first = strtoul(p, &end, 10);
+        if (end == p) return false;
+        unsigned long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtoul(p + 1, &end, 10);
+            if (end == p + 1) return false;
+            p = end;
+        }
+        for (unsigned long node = first; node <= last && node < MAX_NUMA_NODES; node++) {
+            AddNumaNode(node);
+        }
+        if (*p == ',') p++;
+    }
+    return true;
+}
+
+static void ApplyNumaPolicy(void* p, size_t bytes)
+{
+    if (g_numa_policy == NumaPolicy::DEFAULT) {
+        return;
+    }
+    // Best effort: the memory is usable whatever the policy ends up being
+    syscall(SYS_mbind, p, bytes, g_numa_policy == NumaPolicy::INTERLEAVE ? MPOL_INTERLEAVE_MODE : MPOL_BIND_MODE,
+            g_numa_nodes, (unsigned long)MAX_NUMA_NODES, 0);
+}
+
+/** Map bytes aligned to LARGE_PAGE_SIZE, unmapping the excess around them */
+static void* MapAligned(size_t bytes)
+{
+    char* base = static_cast<char*>(mmap(nullptr, bytes + LARGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+    char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(base) + LARGE_PAGE_SIZE - 1) & ~(uintptr_t)(LARGE_PAGE_SIZE - 1));
+    if (aligned != base) {
+        munmap(base, aligned - base);
+    }
+    munmap(aligned + bytes, base + LARGE_PAGE_SIZE - aligned);
+    return aligned;
+}
+#endif
+
+bool ParseLargePageMode(const std::string& str, LargePageMode& mode)
+{
+    if (str == "none") {
+        mode = LargePageMode::NONE;
+    } else if (str == "transparent") {
+        mode = LargePageMode::TRANSPARENT;
+    } else if (str == "explicit") {
+        mode = LargePageMode::EXPLICIT;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool ParseNumaPolicy(const std::string& str, NumaPolicy& policy, int& node)
+{
+    node = -1;
+    if (str == "default") {
+        policy = NumaPolicy::DEFAULT;
+    } else if (str == "interleave") {
+        policy = NumaPolicy::INTERLEAVE;
+    } else {
+        char* end;
+        long n = strtol(str.c_str(), &end, 10);
+        if (str.empty() || *end != '\0' || n < 0 || n >= 1024) {
+            return false;
+        }
+        policy = NumaPolicy::BIND;
+        node = (int)n;
+    }
+    return true;
+}
+
+bool SetLargePageMode(LargePageMode mode, NumaPolicy policy, int node)
+{
+#ifdef __linux__
+    if (policy == NumaPolicy::INTERLEAVE && !ReadOnlineNumaNodes()) {
+        return false;
+    }
+    if (policy == NumaPolicy::BIND) {
+        AddNumaNode(node);
+    }
+    g_large_page_mode = mode;
+    g_numa_policy = policy;
+    return true;
+#else
+    return mode == LargePageMode::NONE && policy == NumaPolicy::DEFAULT;
+#endif
+}
+
+LargePageMode GetLargePageMode()
+{
+    return g_large_page_mode;
+}
+
+void* AllocateLargePageChunk(size_t bytes)
+{
+#ifdef __linux__
+    void* p = nullptr;
+#ifdef MAP_HUGETLB
+    if (g_large_page_mode == LargePageMode::EXPLICIT) {
+        p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED) {
+            // No huge pages reserved, or not enough left
+            p = nullptr;
+        }
+    }
+#endif
+    if (p == nullptr) {
+        p = MapAligned(bytes);
+        if (p == nullptr) {
+            return nullptr;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+    }
+    ApplyNumaPolicy(p, bytes);
+    return p;
+#else
+    (void)bytes;
+    return nullptr;
+#endif
+}
+
+void FreeLargePageChunk(void* p, size_t bytes)
+{
+#ifdef __linux__
+    munmap(p, bytes);
+#else
+    (void)p;
+    (void)bytes;
+#endif
+}
@@ -0,0 +1,49 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_LARGEPAGES_H
+#define BITCOIN_SUPPORT_LARGEPAGES_H
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Backing of the chunks of the pool resources that opt in to large pages,
+ * those of the coins cache and the block index (see PoolResource). Large
+ * pages cut the TLB misses of lookups spread over gigabytes of memory, and
+ * the NUMA policy keeps one socket from holding all of it.
+ *
+ * Only supported on Linux. Both are set once at startup, before any such
+ * chunk is allocated.
+ */
+enum class LargePageMode {
+    NONE,           //!< Chunks come from the heap
+    TRANSPARENT,    //!< Chunks are mapped aligned to huge pages and advised to be backed by transparent huge pages
+    EXPLICIT,       //!< Chunks are mapped from the reserved huge pages (MAP_HUGETLB), falling back to TRANSPARENT
+};
+
+/** NUMA memory policy of the chunks in large pages */
+enum class NumaPolicy {
+    DEFAULT,        //!< Pages are placed on the node of the thread touching them first
+    INTERLEAVE,     //!< Pages are spread over all online nodes
+    BIND,           //!< Pages are placed on one node
+};
+
+/** Size, and alignment, of large pages (the chunks taken from them are a multiple of it) */
+static const size_t LARGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+/** Parse "none", "transparent" or "explicit". */
+bool ParseLargePageMode(const std::string& str, LargePageMode& mode);
+/** Parse "default", "interleave" or a node number to bind to. */
+bool ParseNumaPolicy(const std::string& str, NumaPolicy& policy, int& node);
+
+/** Set how large page chunks are backed; returns false if the platform does not support it. */
+bool SetLargePageMode(LargePageMode mode, NumaPolicy policy, int node);
+LargePageMode GetLargePageMode();
+
+/** Map a chunk of a multiple of LARGE_PAGE_SIZE bytes; nullptr on failure. */
+void* AllocateLargePageChunk(size_t bytes);
+void FreeLargePageChunk(void* p, size_t bytes);
+
+#endif // BITCOIN_SUPPORT_LARGEPAGES_H
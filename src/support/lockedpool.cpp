@@ -27,7 +27,9 @@
 #endif
 
 #include <algorithm>
+#include <functional>
 #include <memory>
+#include <thread>
 
 LockedPoolManager* LockedPoolManager::_instance = nullptr;
 std::once_flag LockedPoolManager::init_flag;
@@ -48,7 +50,7 @@ Arena::Arena(void *base_in, size_t size_in, size_t alignment_in):
     base(static_cast<char*>(base_in)), end(static_cast<char*>(base_in) + size_in), alignment(alignment_in)
 {
     // Start with one free chunk that covers the entire arena
-    chunks_free.emplace(base, size_in);
+    add_free_chunk(base, size_in);
 }
 
 Arena::~Arena()
@@ -64,26 +66,31 @@ void* Arena::alloc(size_t size)
     if (size == 0)
         return nullptr;
 
-    // Pick a large enough free-chunk
-    auto it = std::find_if(chunks_free.begin(), chunks_free.end(),
-        [=](const std::map<char*, size_t>::value_type& chunk){ return chunk.second >= size; });
-    if (it == chunks_free.end())
+    // Pick the smallest large enough free-chunk
+    auto by_size = chunks_free_by_size.lower_bound(std::make_pair(size, static_cast<char*>(nullptr)));
+    if (by_size == chunks_free_by_size.end())
         return nullptr;
+    char* const chunk = by_size->second;
+    const size_t chunk_size = by_size->first;
+    remove_free_chunk(chunks_free.find(chunk));
 
     // Create the used-chunk, taking its space from the end of the free-chunk
-    auto alloced = chunks_used.emplace(it->first + it->second - size, size).first;
-    if (!(it->second -= size))
-        chunks_free.erase(it);
+    auto alloced = chunks_used.emplace(chunk + chunk_size - size, size).first;
+    if (chunk_size > size)
+        add_free_chunk(chunk, chunk_size - size);
     return reinterpret_cast<void*>(alloced->first);
 }
 
-/* extend the Iterator if other begins at its end */
-template <class Iterator, class Pair> bool extend(Iterator it, const Pair& other) {
-    if (it->first + it->second == other.first) {
-        it->second += other.second;
-        return true;
-    }
-    return false;
+void Arena::add_free_chunk(char* chunk, size_t size)
+{
+    chunks_free.emplace(chunk, size);
+    chunks_free_by_size.emplace(size, chunk);
+}
+
+void Arena::remove_free_chunk(std::map<char*, size_t>::iterator it)
+{
+    chunks_free_by_size.erase(std::make_pair(it->second, it->first));
+    chunks_free.erase(it);
 }
 
 void Arena::free(void *ptr)
@@ -98,16 +105,25 @@ void Arena::free(void *ptr)
     if (i == chunks_used.end()) {
         throw std::runtime_error("Arena: invalid or double free");
     }
-    auto freed = *i;
+    char* chunk = i->first;
+    size_t size = i->second;
     chunks_used.erase(i);
 
     // Add space to free map, coalescing contiguous chunks
-    auto next = chunks_free.upper_bound(freed.first);
-    auto prev = (next == chunks_free.begin()) ? chunks_free.end() : std::prev(next);
-    if (prev == chunks_free.end() || !extend(prev, freed))
-        prev = chunks_free.emplace_hint(next, freed);
-    if (next != chunks_free.end() && extend(prev, *next))
-        chunks_free.erase(next);
+    auto next = chunks_free.upper_bound(chunk);
+    if (next != chunks_free.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == chunk) {
+            chunk = prev->first;
+            size += prev->second;
+            remove_free_chunk(prev);
+        }
+    }
+    if (next != chunks_free.end() && chunk + size == next->first) {
+        size += next->second;
+        remove_free_chunk(next);
+    }
+    add_free_chunk(chunk, size);
 }
 
 Arena::Stats Arena::stats() const
@@ -259,43 +275,96 @@ size_t PosixLockedPageAllocator::GetLimit()
 // Implementation: LockedPool
 
 LockedPool::LockedPool(std::unique_ptr<LockedPageAllocator> allocator_in, LockingFailed_Callback lf_cb_in):
-    allocator(std::move(allocator_in)), lf_cb(lf_cb_in), cumulative_bytes_locked(0)
+    allocator(std::move(allocator_in)), arena_entries(nullptr), lf_cb(lf_cb_in), arena_count(0), cumulative_bytes_locked(0)
 {
 }
 
 LockedPool::~LockedPool()
 {
+    ArenaEntry* entry = arena_entries.load();
+    while (entry) {
+        ArenaEntry* next = entry->next;
+        delete entry;
+        entry = next;
+    }
 }
-void* LockedPool::alloc(size_t size)
+
+LockedPool::Shard& LockedPool::thread_shard()
 {
-    std::lock_guard<std::mutex> lock(mutex);
+    // Thread ids are often aligned addresses; mix all their bits into the high ones
+    uint64_t h = std::hash<std::thread::id>()(std::this_thread::get_id());
+    h *= 0x9E3779B97F4A7C15ULL;
+    return shards[(h >> 32) % SHARDS];
+}
+
+void* LockedPool::alloc_from(Shard& shard, size_t size)
+{
+    for (auto &arena: shard.arenas) {
+        void *addr = arena.alloc(size);
+        if (addr) {
+            return addr;
+        }
+    }
+    return nullptr;
+}
 
+void* LockedPool::alloc_new_arena(Shard& shard, size_t size, bool may_exceed_limit)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!may_exceed_limit && arena_count > 0) {
+            size_t limit = allocator->GetLimit();
+            if (cumulative_bytes_locked >= limit || limit - cumulative_bytes_locked < ARENA_SIZE)
+                return nullptr;
+        }
+        if (!new_arena(shard, ARENA_SIZE, ARENA_ALIGN))
+            return nullptr;
+    }
+    return shard.arenas.back().alloc(size);
+}
+
+void* LockedPool::alloc(size_t size)
+{
     // Don't handle impossible sizes
     if (size == 0 || size > ARENA_SIZE)
         return nullptr;
 
-    // Try allocating from each current arena
-    for (auto &arena: arenas) {
-        void *addr = arena.alloc(size);
-        if (addr) {
+    // Try allocating from each arena of this thread's shard, then from a new
+    // one if that can be locked
+    Shard& own = thread_shard();
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        void *addr = alloc_from(own, size);
+        if (!addr)
+            addr = alloc_new_arena(own, size, false);
+        if (addr)
             return addr;
-        }
     }
-    // If that fails, create a new one
-    if (new_arena(ARENA_SIZE, ARENA_ALIGN)) {
-        return arenas.back().alloc(size);
+    // Then share the arenas of the other shards
+    for (auto &shard: shards) {
+        if (&shard == &own)
+            continue;
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        void *addr = alloc_from(shard, size);
+        if (addr)
+            return addr;
     }
-    return nullptr;
+    // If that fails, create a new one even if it cannot be locked
+    std::lock_guard<std::mutex> lock(own.mutex);
+    void *addr = alloc_from(own, size);
+    return addr ? addr : alloc_new_arena(own, size, true);
 }
 
 void LockedPool::free(void *ptr)
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    // TODO we can do better than this linear search by keeping a map of arena
-    // extents to arena, and looking up the address.
-    for (auto &arena: arenas) {
-        if (arena.addressInArena(ptr)) {
-            arena.free(ptr);
+    // Freeing the nullptr pointer is OK.
+    if (ptr == nullptr) {
+        return;
+    }
+    for (ArenaEntry* entry = arena_entries.load(std::memory_order_acquire); entry; entry = entry->next) {
+        if (ptr >= entry->base && ptr < entry->end) {
+            std::lock_guard<std::mutex> lock(entry->shard->mutex);
+            entry->arena->free(ptr);
             return;
         }
     }
@@ -304,27 +373,31 @@ void LockedPool::free(void *ptr)
 
 LockedPool::Stats LockedPool::stats() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    LockedPool::Stats r{0, 0, 0, cumulative_bytes_locked, 0, 0};
-    for (const auto &arena: arenas) {
-        Arena::Stats i = arena.stats();
-        r.used += i.used;
-        r.free += i.free;
-        r.total += i.total;
-        r.chunks_used += i.chunks_used;
-        r.chunks_free += i.chunks_free;
+    LockedPool::Stats r{0, 0, 0, 0, 0, 0};
+    for (const auto &shard: shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const auto &arena: shard.arenas) {
+            Arena::Stats i = arena.stats();
+            r.used += i.used;
+            r.free += i.free;
+            r.total += i.total;
+            r.chunks_used += i.chunks_used;
+            r.chunks_free += i.chunks_free;
+        }
     }
+    std::lock_guard<std::mutex> lock(mutex);
+    r.locked = cumulative_bytes_locked;
     return r;
 }
 
-bool LockedPool::new_arena(size_t size, size_t align)
+bool LockedPool::new_arena(Shard& shard, size_t size, size_t align)
 {
     bool locked;
     // If this is the first arena, handle this specially: Cap the upper size
     // by the process limit. This makes sure that the first arena will at least
     // be locked. An exception to this is if the process limit is 0:
     // in this case no memory can be locked at all so we'll skip past this logic.
-    if (arenas.empty()) {
+    if (arena_count == 0) {
         size_t limit = allocator->GetLimit();
         if (limit > 0) {
             size = std::min(size, limit);
@@ -342,7 +415,12 @@ bool LockedPool::new_arena(size_t size, size_t align)
             return false;
         }
     }
-    arenas.emplace_back(allocator.get(), addr, size, align);
+    shard.arenas.emplace_back(allocator.get(), addr, size, align);
+    arena_count++;
+
+    // Publish the arena to free, which looks it up without a lock
+    ArenaEntry* entry = new ArenaEntry{static_cast<char*>(addr), static_cast<char*>(addr) + size, &shard, &shard.arenas.back(), arena_entries.load(std::memory_order_relaxed)};
+    arena_entries.store(entry, std::memory_order_release);
     return true;
 }
 
@@ -6,10 +6,14 @@
 #define BITCOIN_SUPPORT_LOCKEDPOOL_H
 
 #include <stdint.h>
+#include <array>
+#include <atomic>
 #include <list>
 #include <map>
 #include <mutex>
 #include <memory>
+#include <set>
+#include <utility>
 
 /**
  * OS-dependent allocation and deallocation of locked/pinned memory pages.
@@ -93,6 +97,13 @@ private:
      */
     std::map<char*, size_t> chunks_free;
     std::map<char*, size_t> chunks_used;
+    /** The free chunks ordered by size, then address, so that the smallest
+     * one that fits is found without scanning them all.
+     */
+    std::set<std::pair<size_t, char*>> chunks_free_by_size;
+
+    void add_free_chunk(char* chunk, size_t size);
+    void remove_free_chunk(std::map<char*, size_t>::iterator it);
     /** Base address of arena */
     char* base;
     /** End address of arena */
@@ -109,6 +120,13 @@ private:
  * An arena manages a contiguous region of memory. The pool starts out with one arena
  * but can grow to multiple arenas if the need arises.
  *
+ * The arenas are spread over SHARDS shards, each with a lock of its own, and
+ * threads allocate from the shard their id hashes to, so that threads
+ * allocating keys at the same time do not wait for each other. A shard only
+ * takes an arena of its own while the process may lock more memory; past
+ * that, threads share the arenas of the other shards first. Memory can be
+ * freed from any thread.
+ *
  * Unlike a normal C heap, the administrative structures are separate from the managed
  * memory. This has been done as the sizes and bases of objects are not in themselves sensitive
  * information, as to conserve precious locked memory. In some operating systems
@@ -128,6 +146,10 @@ public:
      */
     static const size_t ARENA_ALIGN = 16;
 
+    /** Number of independently locked sets of arenas
+     */
+    static const size_t SHARDS = 8;
+
     /** Callback when allocation succeeds but locking fails.
      */
     typedef bool (*LockingFailed_Callback)();
@@ -185,14 +207,45 @@ private:
         LockedPageAllocator *allocator;
     };
 
-    bool new_arena(size_t size, size_t align);
+    /** A set of arenas, and the mutex that protects them */
+    struct Shard
+    {
+        std::list<LockedPageArena> arenas;
+        mutable std::mutex mutex;
+    };
 
-    std::list<LockedPageArena> arenas;
+    /** Address range of an arena and the shard that owns it. Entries are only
+     * ever prepended, and live as long as the pool, so that free can find the
+     * shard of a pointer without taking any lock.
+     */
+    struct ArenaEntry
+    {
+        char* base;
+        char* end;
+        Shard* shard;
+        Arena* arena;
+        ArenaEntry* next;
+    };
+
+    /** Allocate from the arenas of shard; its mutex must be held */
+    static void* alloc_from(Shard& shard, size_t size);
+    /** Add an arena to shard, whose mutex must be held, if may_exceed_limit
+     * or the process may lock another one, and allocate size bytes from it
+     */
+    void* alloc_new_arena(Shard& shard, size_t size, bool may_exceed_limit);
+    /** Add an arena to shard; mutex and the shard's mutex must be held */
+    bool new_arena(Shard& shard, size_t size, size_t align);
+    Shard& thread_shard();
+
+    std::array<Shard, SHARDS> shards;
+    std::atomic<ArenaEntry*> arena_entries;
     LockingFailed_Callback lf_cb;
-    size_t cumulative_bytes_locked;
-    /** Mutex protects access to this pool's data structures, including arenas.
+    /** Mutex protects the allocator, the arena count and cumulative_bytes_locked.
+     * It is taken after a shard's mutex, never before.
      */
     mutable std::mutex mutex;
+    size_t arena_count;
+    size_t cumulative_bytes_locked;
 };
 
 /**
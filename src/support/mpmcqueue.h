@@ -0,0 +1,119 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_MPMCQUEUE_H
+#define BITCOIN_SUPPORT_MPMCQUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Bounded lock-free queue for any number of producer and consumer threads,
+ * after Dmitry Vyukov's design: a ring of cells, each with a sequence number
+ * that says whether it is free for the producer or filled for the consumer
+ * at the current position. A push or pop costs one compare-and-swap on the
+ * shared position when uncontended, and neither ever blocks; they fail when
+ * the queue is full or empty instead.
+ *
+ * T should be cheap to copy, such as a pointer; it is copied in and out.
+ */
+template <typename T>
+class MPMCQueue
+{
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    //! Keep the positions, which producers and consumers write, on separate cache lines
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    const size_t mask;
+    std::unique_ptr<Cell[]> buffer;
+    char pad0[CACHE_LINE_SIZE];
+    std::atomic<size_t> enqueuePos;
+    char pad1[CACHE_LINE_SIZE];
+    std::atomic<size_t> dequeuePos;
+    char pad2[CACHE_LINE_SIZE];
+
+    static size_t RoundUpCapacity(size_t nCapacity)
+    {
+        size_t n = 2;
+        while (n < nCapacity)
+            n *= 2;
+        return n;
+    }
+
+public:
+    /** Create a queue that holds at least nCapacity elements (rounded up to a power of two) */
+    explicit MPMCQueue(size_t nCapacity) :
+        mask(RoundUpCapacity(nCapacity) - 1), buffer(new Cell[mask + 1]), enqueuePos(0), dequeuePos(0)
+    {
+        for (size_t i = 0; i <= mask; i++)
+            buffer[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    MPMCQueue(const MPMCQueue&) = delete;
+    MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+    size_t Capacity() const { return mask + 1; }
+
+    /** Append an element. Returns false if the queue is full. */
+    bool TryPush(const T& data)
+    {
+        Cell* cell;
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &buffer[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                // The cell is free; claim it by moving the position on
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0) {
+                // The cell still holds the element from one lap ago
+                return false;
+            } else {
+                // Another producer claimed the cell first
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = data;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Take the oldest element. Returns false if the queue is empty. */
+    bool TryPop(T& data)
+    {
+        Cell* cell;
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &buffer[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                // The cell is filled; claim it by moving the position on
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0) {
+                // The cell was not filled yet
+                return false;
+            } else {
+                // Another consumer claimed the cell first
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        data = cell->data;
+        // Free the cell for the producer one lap ahead
+        cell->sequence.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+#endif // BITCOIN_SUPPORT_MPMCQUEUE_H
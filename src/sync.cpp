@@ -4,13 +4,143 @@
 
 #include <sync.h>
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
 #include <memory>
 #include <set>
+#include <tuple>
 #include <util.h>
 #include <utilstrencodings.h>
 
 #include <stdio.h>
 
+std::atomic<bool> g_lock_stats(false);
+
+struct LockSiteStats {
+    const char* pszName;
+    const char* pszFile;
+    int nLine;
+    std::atomic<uint64_t> nLocks;
+    std::atomic<uint64_t> nContended;
+    std::atomic<uint64_t> nWaitMicros;
+    std::atomic<uint64_t> nMaxWaitMicros;
+    std::atomic<uint64_t> nHoldMicros;
+    std::atomic<uint64_t> nMaxHoldMicros;
+
+    LockSiteStats(const char* pszNameIn, const char* pszFileIn, int nLineIn) :
+        pszName(pszNameIn), pszFile(pszFileIn), nLine(nLineIn)
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        nLocks = 0;
+        nContended = 0;
+        nWaitMicros = 0;
+        nMaxWaitMicros = 0;
+        nHoldMicros = 0;
+        nMaxHoldMicros = 0;
+    }
+};
+
+/**
+ * The call sites seen, in an open-addressed hash table keyed on the string
+ * constants the LOCK macros pass, so that looking one up takes no lock.
+ * Sites are only ever added, under cs_lock_sites, and live until exit.
+ */
+static const size_t LOCK_SITES_SIZE = 4096;
+static std::atomic<LockSiteStats*> g_lock_sites[LOCK_SITES_SIZE];
+static std::mutex cs_lock_sites;
+
+LockSiteStats* GetLockSiteStats(const char* pszName, const char* pszFile, int nLine)
+{
+    size_t nHash = std::hash<const void*>()(pszFile) ^ (std::hash<const void*>()(pszName) * 31) ^ ((size_t)nLine * 2654435761U);
+    for (size_t i = 0; i < LOCK_SITES_SIZE; i++) {
+        std::atomic<LockSiteStats*>& slot = g_lock_sites[(nHash + i) % LOCK_SITES_SIZE];
+        LockSiteStats* stats = slot.load(std::memory_order_acquire);
+        if (stats == nullptr) {
+            std::lock_guard<std::mutex> lock(cs_lock_sites);
+            // Another thread may have filled the slot meanwhile
+            stats = slot.load(std::memory_order_acquire);
+            if (stats == nullptr) {
+                stats = new LockSiteStats(pszName, pszFile, nLine);
+                slot.store(stats, std::memory_order_release);
+                return stats;
+            }
+        }
+        if (stats->pszFile == pszFile && stats->nLine == nLine && stats->pszName == pszName)
+            return stats;
+    }
+    return nullptr;
+}
+
+int64_t LockStatsMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void UpdateMax(std::atomic<uint64_t>& nMax, uint64_t n)
+{
+    uint64_t nPrev = nMax.load(std::memory_order_relaxed);
+    while (nPrev < n && !nMax.compare_exchange_weak(nPrev, n, std::memory_order_relaxed)) {}
+}
+
+void RecordLockAcquired(LockSiteStats* stats, bool fContended, int64_t nWaitMicros)
+{
+    if (!stats)
+        return;
+    stats->nLocks.fetch_add(1, std::memory_order_relaxed);
+    if (fContended) {
+        stats->nContended.fetch_add(1, std::memory_order_relaxed);
+        stats->nWaitMicros.fetch_add(nWaitMicros, std::memory_order_relaxed);
+        UpdateMax(stats->nMaxWaitMicros, nWaitMicros);
+    }
+}
+
+void RecordLockReleased(LockSiteStats* stats, int64_t nHoldMicros)
+{
+    stats->nHoldMicros.fetch_add(nHoldMicros, std::memory_order_relaxed);
+    UpdateMax(stats->nMaxHoldMicros, nHoldMicros);
+}
+
+std::vector<LockStats> GetLockStats()
+{
+    // The same site may have been seen with different copies of its string
+    // constants, from an inline function in several translation units
+    std::map<std::tuple<std::string, std::string, int>, LockStats> mapStats;
+    for (size_t i = 0; i < LOCK_SITES_SIZE; i++) {
+        const LockSiteStats* site = g_lock_sites[i].load(std::memory_order_acquire);
+        if (site == nullptr || site->nLocks == 0)
+            continue;
+        LockStats& stats = mapStats[std::make_tuple(std::string(site->pszName), std::string(site->pszFile), site->nLine)];
+        stats.name = site->pszName;
+        stats.file = site->pszFile;
+        stats.line = site->nLine;
+        stats.locks += site->nLocks;
+        stats.contended += site->nContended;
+        stats.wait_micros += site->nWaitMicros;
+        stats.max_wait_micros = std::max<uint64_t>(stats.max_wait_micros, site->nMaxWaitMicros);
+        stats.hold_micros += site->nHoldMicros;
+        stats.max_hold_micros = std::max<uint64_t>(stats.max_hold_micros, site->nMaxHoldMicros);
+    }
+    std::vector<LockStats> vStats;
+    for (const auto& entry : mapStats)
+        vStats.push_back(entry.second);
+    return vStats;
+}
+
+void ResetLockStats()
+{
+    for (size_t i = 0; i < LOCK_SITES_SIZE; i++) {
+        LockSiteStats* site = g_lock_sites[i].load(std::memory_order_acquire);
+        if (site != nullptr)
+            site->Reset();
+    }
+}
+
 #ifdef DEBUG_LOCKCONTENTION
 #if !defined(HAVE_THREAD_LOCAL)
 static_assert(false, "thread_local is not supported");
@@ -8,9 +8,13 @@
 
 #include <threadsafety.h>
 
+#include <atomic>
 #include <condition_variable>
+#include <stdint.h>
+#include <string>
 #include <thread>
 #include <mutex>
+#include <vector>
 
 
 ////////////////////////////////////////////////
@@ -112,15 +116,67 @@ typedef std::unique_lock<std::mutex> WaitableLock;
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+static const bool DEFAULT_LOCKSTATS = false;
+
+/** Whether LOCK and TRY_LOCK time how long they wait for and hold their lock (-lockstats) */
+extern std::atomic<bool> g_lock_stats;
+
+/** The times of the locks taken at one call site, see g_lock_stats */
+struct LockSiteStats;
+/** The stats of a call site, or nullptr if there are too many sites to keep */
+LockSiteStats* GetLockSiteStats(const char* pszName, const char* pszFile, int nLine);
+/** A monotonic clock, in microseconds */
+int64_t LockStatsMicros();
+void RecordLockAcquired(LockSiteStats* stats, bool fContended, int64_t nWaitMicros);
+void RecordLockReleased(LockSiteStats* stats, int64_t nHoldMicros);
+
+/** What the locks taken at one call site waited and were held, since startup or the last reset */
+struct LockStats
+{
+    std::string name;
+    std::string file;
+    int line;
+    uint64_t locks;
+    //! Locks that had to wait for another thread
+    uint64_t contended;
+    uint64_t wait_micros;
+    uint64_t max_wait_micros;
+    uint64_t hold_micros;
+    uint64_t max_hold_micros;
+};
+std::vector<LockStats> GetLockStats();
+void ResetLockStats();
+
 /** Wrapper around std::unique_lock<CCriticalSection> */
 class SCOPED_LOCKABLE CCriticalBlock
 {
 private:
     std::unique_lock<CCriticalSection> lock;
+    //! Set while g_lock_stats times this lock
+    LockSiteStats* pLockStats = nullptr;
+    int64_t nLockedMicros = 0;
+
+    void EnterTimed(const char* pszName, const char* pszFile, int nLine)
+    {
+        pLockStats = GetLockSiteStats(pszName, pszFile, nLine);
+        if (lock.try_lock()) {
+            nLockedMicros = LockStatsMicros();
+            RecordLockAcquired(pLockStats, false, 0);
+            return;
+        }
+        int64_t nStartMicros = LockStatsMicros();
+        lock.lock();
+        nLockedMicros = LockStatsMicros();
+        RecordLockAcquired(pLockStats, true, nLockedMicros - nStartMicros);
+    }
 
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+        if (g_lock_stats) {
+            EnterTimed(pszName, pszFile, nLine);
+            return;
+        }
 #ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock()) {
             PrintLockContention(pszName, pszFile, nLine);
@@ -137,6 +193,11 @@ private:
         lock.try_lock();
         if (!lock.owns_lock())
             LeaveCritical();
+        else if (g_lock_stats) {
+            pLockStats = GetLockSiteStats(pszName, pszFile, nLine);
+            nLockedMicros = LockStatsMicros();
+            RecordLockAcquired(pLockStats, false, 0);
+        }
         return lock.owns_lock();
     }
 
@@ -162,8 +223,11 @@ public:
 
     ~CCriticalBlock() UNLOCK_FUNCTION()
     {
-        if (lock.owns_lock())
+        if (lock.owns_lock()) {
+            if (pLockStats)
+                RecordLockReleased(pLockStats, LockStatsMicros() - nLockedMicros);
             LeaveCritical();
+        }
     }
 
     operator bool()
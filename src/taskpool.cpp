@@ -0,0 +1,231 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <taskpool.h>
+
+#include <util.h>
+
+#include <algorithm>
+#include <assert.h>
+
+CTaskPool g_task_pool;
+
+CTaskPool::CTaskPool() : fRunning(false), fStop(false), nNextQueue(0), nMaxBackground(0), nBackgroundRunning(0)
+{
+    for (std::atomic<size_t>& n : nQueued) {
+        n = 0;
+    }
+}
+
+CTaskPool::~CTaskPool()
+{
+    Stop();
+}
+
+void CTaskPool::Start(int nThreads)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    assert(!fRunning);
+    if (nThreads <= 0) return;
+    fRunning = true;
+    fStop = false;
+    nMaxBackground = std::max(1, nThreads / 2);
+    for (int i = 0; i < nThreads; i++) {
+        vQueues.emplace_back(new WorkerQueue());
+    }
+    for (int i = 0; i < nThreads; i++) {
+        vThreads.emplace_back(&TraceThread<std::function<void()>>, "taskpool", std::function<void()>(std::bind(&CTaskPool::ThreadWork, this, i)));
+    }
+}
+
+void CTaskPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (!fRunning) return;
+        fStop = true;
+        condQueued.notify_all();
+    }
+    for (std::thread& thread : vThreads) {
+        thread.join();
+    }
+    std::lock_guard<std::mutex> lock(cs);
+    vThreads.clear();
+    vQueues.clear();
+    for (std::atomic<size_t>& n : nQueued) {
+        n = 0;
+    }
+    fRunning = false;
+}
+
+void CTaskPool::Submit(Task task, TaskPriority priority)
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (fRunning && !fStop) {
+            WorkerQueue& wq = *vQueues[nNextQueue++ % vQueues.size()];
+            {
+                std::lock_guard<std::mutex> lockQueue(wq.mutex);
+                wq.tasks[priority].push_back(std::move(task));
+            }
+            nQueued[priority]++;
+            condQueued.notify_one();
+            return;
+        }
+    }
+    task();
+}
+
+int CTaskPool::GetThreadCount() const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return fStop ? 0 : (int)vThreads.size();
+}
+
+size_t CTaskPool::GetQueueSize() const
+{
+    size_t nSize = 0;
+    for (const std::atomic<size_t>& n : nQueued) {
+        nSize += n.load();
+    }
+    return nSize;
+}
+
+bool CTaskPool::HaveTakeableTask() const
+{
+    for (int priority = 0; priority < NUM_TASK_PRIORITIES; priority++) {
+        if (nQueued[priority] > 0 && (priority != TASK_PRIORITY_BACKGROUND || nBackgroundRunning < nMaxBackground)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CTaskPool::Take(size_t nSelf, Task& task, TaskPriority& priority)
+{
+    for (int p = 0; p < NUM_TASK_PRIORITIES; p++) {
+        if (nQueued[p] == 0) continue;
+        if (p == TASK_PRIORITY_BACKGROUND && ++nBackgroundRunning > nMaxBackground) {
+            nBackgroundRunning--;
+            continue;
+        }
+        for (size_t i = 0; i < vQueues.size(); i++) {
+            WorkerQueue& wq = *vQueues[(nSelf + i) % vQueues.size()];
+            std::lock_guard<std::mutex> lock(wq.mutex);
+            if (wq.tasks[p].empty()) continue;
+            task = std::move(wq.tasks[p].front());
+            wq.tasks[p].pop_front();
+            nQueued[p]--;
+            priority = static_cast<TaskPriority>(p);
+            return true;
+        }
+        if (p == TASK_PRIORITY_BACKGROUND) {
+            nBackgroundRunning--;
+        }
+    }
+    return false;
+}
+
+void CTaskPool::ThreadWork(size_t nSelf)
+{
+    Task task;
+    TaskPriority priority;
+    while (true) {
+        if (Take(nSelf, task, priority)) {
+            try {
+                task();
+            } catch (const std::exception& e) {
+                PrintExceptionContinue(&e, "taskpool");
+            } catch (...) {
+                PrintExceptionContinue(nullptr, "taskpool");
+            }
+            task = nullptr;
+            if (priority == TASK_PRIORITY_BACKGROUND) {
+                // Another worker may be waiting for a background task to be allowed
+                std::lock_guard<std::mutex> lock(cs);
+                nBackgroundRunning--;
+                condQueued.notify_one();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(cs);
+        while (!fStop && !HaveTakeableTask()) {
+            condQueued.wait(lock);
+        }
+        if (fStop) return;
+    }
+}
+
+CTaskGroup::CTaskGroup(CTaskPool& poolIn, TaskPriority priorityIn) : pool(poolIn), priority(priorityIn), state(std::make_shared<State>()) {}
+
+CTaskGroup::~CTaskGroup()
+{
+    try {
+        Wait();
+    } catch (...) {
+    }
+}
+
+bool CTaskGroup::RunNext(State& state)
+{
+    CTaskPool::Task task;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.tasks.empty()) return false;
+        task = std::move(state.tasks.front());
+        state.tasks.pop_front();
+        state.nRunning++;
+    }
+    std::exception_ptr error;
+    try {
+        task();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    task = nullptr;
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (error && !state.error) {
+        state.error = error;
+    }
+    if (--state.nRunning == 0) {
+        state.condDone.notify_all();
+    }
+    return true;
+}
+
+void CTaskGroup::Run(CTaskPool::Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->tasks.push_back(std::move(task));
+    }
+    std::shared_ptr<State> stateTask = state;
+    pool.Submit([stateTask] { RunNext(*stateTask); }, priority);
+}
+
+void CTaskGroup::Wait()
+{
+    while (RunNext(*state)) {}
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (state->nRunning > 0) {
+        state->condDone.wait(lock);
+    }
+    if (state->error) {
+        std::exception_ptr error = state->error;
+        state->error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+unsigned int ParallelRun(CTaskPool& pool, TaskPriority priority, unsigned int nThreads, const std::function<void()>& worker)
+{
+    const unsigned int nCopies = std::min<unsigned int>(std::max(nThreads, 1U), pool.GetThreadCount() + 1);
+    CTaskGroup group(pool, priority);
+    for (unsigned int i = 1; i < nCopies; i++) {
+        group.Run(worker);
+    }
+    worker();
+    group.Wait();
+    return nCopies;
+}
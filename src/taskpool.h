@@ -0,0 +1,150 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TASKPOOL_H
+#define BITCOIN_TASKPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <thread>
+#include <vector>
+
+//! -taskthreads default (0 = as many as cores)
+static const int DEFAULT_TASK_THREADS = 0;
+//! Maximum number of threads of the task pool
+static const int MAX_TASK_THREADS = 64;
+
+/** The order in which the workers of a CTaskPool take queued tasks */
+enum TaskPriority {
+    //! Work holding up validation or block relay
+    TASK_PRIORITY_HIGH,
+    TASK_PRIORITY_NORMAL,
+    //! Long jobs on behalf of RPC calls and the like
+    TASK_PRIORITY_BACKGROUND,
+    NUM_TASK_PRIORITIES
+};
+
+/**
+ * Pool of threads for CPU-bound work which can be split into tasks, shared by
+ * the subsystems which would otherwise start threads of their own for it.
+ *
+ * Every worker has a deque of tasks per priority. Tasks are queued on the
+ * deques in round-robin order, and a worker takes the oldest task of the
+ * highest priority there is, from its own deque or else from the others'.
+ * At most half of the workers (at least one) run background tasks at once,
+ * so that higher priority tasks do not wait for long background jobs.
+ *
+ * Tasks must not block on I/O other than disk, nor on other tasks except
+ * through CTaskGroup. When the pool is not running, tasks are run on the
+ * calling thread; tasks still queued when it stops are dropped.
+ */
+class CTaskPool
+{
+public:
+    typedef std::function<void()> Task;
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks[NUM_TASK_PRIORITIES];
+    };
+
+    //! Protects fRunning, fStop, nNextQueue and the sleeping of the workers
+    mutable std::mutex cs;
+    //! Signalled when tasks are queued, a background task ends or the workers are asked to stop
+    std::condition_variable condQueued;
+    bool fRunning;
+    bool fStop;
+    std::vector<std::unique_ptr<WorkerQueue>> vQueues;
+    std::vector<std::thread> vThreads;
+    size_t nNextQueue;
+    int nMaxBackground;
+    std::atomic<size_t> nQueued[NUM_TASK_PRIORITIES];
+    std::atomic<int> nBackgroundRunning;
+
+    //! Whether a worker could take a task now
+    bool HaveTakeableTask() const;
+    bool Take(size_t nSelf, Task& task, TaskPriority& priority);
+    void ThreadWork(size_t nSelf);
+
+public:
+    CTaskPool();
+    ~CTaskPool();
+    CTaskPool(const CTaskPool&) = delete;
+    CTaskPool& operator=(const CTaskPool&) = delete;
+
+    /** Start nThreads workers */
+    void Start(int nThreads);
+    /** Wait for the running tasks, drop the queued ones and stop the workers */
+    void Stop();
+
+    /** Queue task, or run it right away if the pool is not running */
+    void Submit(Task task, TaskPriority priority = TASK_PRIORITY_NORMAL);
+
+    //! Number of workers, 0 when the pool is not running
+    int GetThreadCount() const;
+    //! Number of tasks waiting for a worker
+    size_t GetQueueSize() const;
+};
+
+/**
+ * Set of tasks run on a CTaskPool which can be waited for. Tasks are queued
+ * on the group, and the pool is given one task per task of the group which
+ * runs whichever of them is next. Wait() runs the tasks no worker has taken
+ * yet on the calling thread, so that a group makes progress however busy the
+ * pool is, and can also be waited for by a task of the pool.
+ */
+class CTaskGroup
+{
+private:
+    struct State {
+        std::mutex mutex;
+        //! Signalled when the last running task ends
+        std::condition_variable condDone;
+        std::deque<CTaskPool::Task> tasks;
+        //! Tasks taken from the deque which have not ended yet
+        size_t nRunning = 0;
+        //! The exception the first failed task threw
+        std::exception_ptr error;
+    };
+
+    CTaskPool& pool;
+    const TaskPriority priority;
+    //! Shared with the tasks given to the pool, which may outlive the group
+    const std::shared_ptr<State> state;
+
+    //! Run the next queued task of the group, returning false if there is none
+    static bool RunNext(State& state);
+
+public:
+    CTaskGroup(CTaskPool& poolIn, TaskPriority priorityIn);
+    //! Waits for the tasks, ignoring their exceptions
+    ~CTaskGroup();
+    CTaskGroup(const CTaskGroup&) = delete;
+    CTaskGroup& operator=(const CTaskGroup&) = delete;
+
+    void Run(CTaskPool::Task task);
+    /** Wait until every task has run, and rethrow the first exception one of them threw */
+    void Wait();
+};
+
+/**
+ * Run worker on the calling thread and on up to nThreads - 1 workers of pool
+ * at once, and wait for all of them. For workers which share out their items
+ * through an atomic index, so that each copy returns once they are taken.
+ * Returns the number of copies run, which is less than nThreads when the
+ * pool has fewer workers.
+ */
+unsigned int ParallelRun(CTaskPool& pool, TaskPriority priority, unsigned int nThreads, const std::function<void()>& worker);
+
+//! The task pool shared by the node's subsystems, started with -taskthreads workers
+extern CTaskPool g_task_pool;
+
+#endif // BITCOIN_TASKPOOL_H
@@ -5,31 +5,38 @@
 // Unit tests for denial-of-service detection/prevention code
 
 #include <chainparams.h>
+#include <coins.h>
+#include <core_memusage.h>
 #include <keystore.h>
 #include <net.h>
 #include <net_processing.h>
 #include <pow.h>
 #include <script/sign.h>
 #include <serialize.h>
+#include <txmempool.h>
 #include <util.h>
 #include <validation.h>
 
 #include <test/test_bitcoin.h>
 
+#include <limits>
 #include <stdint.h>
+#include <unordered_map>
 
 #include <boost/test/unit_test.hpp>
 
 // Tests these internal-to-net_processing.cpp methods:
 extern bool AddOrphanTx(const CTransactionRef& tx, NodeId peer);
 extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
+extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxOrphanUsage);
 struct COrphanTx {
     CTransactionRef tx;
     NodeId fromPeer;
     int64_t nTimeExpire;
+    size_t list_pos;
+    size_t nUsage;
 };
-extern std::map<uint256, COrphanTx> mapOrphanTransactions;
+extern std::unordered_map<uint256, COrphanTx, SaltedTxidHasher> mapOrphanTransactions;
 
 CService ip(uint32_t i)
 {
@@ -293,11 +300,8 @@ BOOST_AUTO_TEST_CASE(DoS_bantime)
 
 CTransactionRef RandomOrphan()
 {
-    std::map<uint256, COrphanTx>::iterator it;
     LOCK(cs_main);
-    it = mapOrphanTransactions.lower_bound(InsecureRand256());
-    if (it == mapOrphanTransactions.end())
-        it = mapOrphanTransactions.begin();
+    auto it = std::next(mapOrphanTransactions.begin(), InsecureRandRange(mapOrphanTransactions.size()));
     return it->second.tx;
 }
 
@@ -374,11 +378,24 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     }
 
     // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
+    const size_t nNoUsageLimit = std::numeric_limits<size_t>::max();
+    LimitOrphanTxSize(40, nNoUsageLimit);
     BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
+
+    // ... with a memory limit
+    size_t nUsage = 0;
+    for (const auto& entry : mapOrphanTransactions)
+        nUsage += RecursiveDynamicUsage(entry.second.tx);
+    LimitOrphanTxSize(40, nUsage / 2);
+    size_t nUsageAfter = 0;
+    for (const auto& entry : mapOrphanTransactions)
+        nUsageAfter += RecursiveDynamicUsage(entry.second.tx);
+    BOOST_CHECK(nUsageAfter <= nUsage / 2);
+    BOOST_CHECK(!mapOrphanTransactions.empty());
+
+    LimitOrphanTxSize(10, nNoUsageLimit);
     BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
+    LimitOrphanTxSize(0, nNoUsageLimit);
     BOOST_CHECK(mapOrphanTransactions.empty());
 }
 
@@ -0,0 +1,119 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <index/addressindex.h>
+#include <script/interpreter.h>
+#include <utiltime.h>
+#include <validation.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, TestChain100Setup)
+
+//! Wait up to ten seconds for the sync thread to catch up
+static bool WaitForSync(CAddressIndex& index)
+{
+    int64_t nTimeout = GetTimeMillis() + 10000;
+    while (!index.BlockUntilSyncedToCurrentChain()) {
+        if (GetTimeMillis() > nTimeout)
+            return false;
+        MilliSleep(100);
+    }
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_history)
+{
+    CAddressIndex index(1 << 20, true);
+    index.Start();
+    BOOST_REQUIRE(WaitForSync(index));
+
+    const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const uint256 scripthash = GetScriptHash(scriptPubKey);
+    CAddressBalance balance;
+    BOOST_REQUIRE(index.FindBalance(scripthash, balance));
+    BOOST_CHECK_EQUAL(balance.nOutputs, 100);
+    BOOST_CHECK_EQUAL(balance.nSpends, 0);
+    BOOST_CHECK_EQUAL(balance.nBalance, 100 * coinbaseTxns[0].vout[0].nValue);
+    BOOST_CHECK_EQUAL(balance.nReceived, balance.nBalance);
+
+    // The history is paged through in the order of the chain
+    std::vector<CAddressHistoryEntry> entries, page;
+    CAddressHistoryPos pos;
+    bool fMore = true;
+    while (fMore) {
+        BOOST_REQUIRE(index.FindHistory(scripthash, pos, 30, page, fMore, pos));
+        BOOST_CHECK(page.size() == 30 || !fMore);
+        entries.insert(entries.end(), page.begin(), page.end());
+    }
+    BOOST_REQUIRE_EQUAL(entries.size(), 100U);
+    for (int i = 0; i < 100; i++) {
+        BOOST_CHECK_EQUAL(entries[i].pos.nHeight, (uint32_t)i + 1);
+        BOOST_CHECK_EQUAL(entries[i].txid, coinbaseTxns[i].GetHash());
+        BOOST_CHECK(!entries[i].IsSpend());
+    }
+
+    // Spends of connected blocks are found from their undo data
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 49 * COIN;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_REQUIRE(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    CBlock block = CreateAndProcessBlock({spend}, scriptPubKey);
+    BOOST_REQUIRE(index.BlockUntilSyncedToCurrentChain());
+
+    BOOST_REQUIRE(index.FindHistory(scripthash, CAddressHistoryPos(101, 0, 0), 10, entries, fMore, pos));
+    BOOST_CHECK(!fMore);
+    BOOST_REQUIRE_EQUAL(entries.size(), 3U);
+    BOOST_CHECK_EQUAL(entries[0].txid, block.vtx[0]->GetHash());
+    BOOST_CHECK_EQUAL(entries[1].txid, spend.GetHash());
+    BOOST_CHECK(!entries[1].IsSpend());
+    BOOST_CHECK_EQUAL(entries[1].nValue, 49 * COIN);
+    BOOST_CHECK(entries[2].IsSpend());
+    BOOST_CHECK(entries[2].prevout == spend.vin[0].prevout);
+    BOOST_CHECK_EQUAL(entries[2].nValue, coinbaseTxns[0].vout[0].nValue);
+
+    CAddressBalance balanceSpent;
+    BOOST_REQUIRE(index.FindBalance(scripthash, balanceSpent));
+    BOOST_CHECK_EQUAL(balanceSpent.nOutputs, 102);
+    BOOST_CHECK_EQUAL(balanceSpent.nSpends, 1);
+    BOOST_CHECK_EQUAL(balanceSpent.nBalance, balance.nBalance - coinbaseTxns[0].vout[0].nValue + 49 * COIN + block.vtx[0]->GetValueOut());
+
+    // The entries of a block that was reorganized away are removed when the
+    // block replacing it is written
+    {
+        CValidationState state;
+        LOCK(cs_main);
+        BOOST_REQUIRE(InvalidateBlock(state, Params(), chainActive.Tip()));
+    }
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript scriptOther = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    CreateAndProcessBlock({}, scriptOther);
+    BOOST_REQUIRE(index.BlockUntilSyncedToCurrentChain());
+
+    BOOST_REQUIRE(index.FindHistory(scripthash, CAddressHistoryPos(101, 0, 0), 10, entries, fMore, pos));
+    BOOST_CHECK(entries.empty());
+    CAddressBalance balanceReorg;
+    BOOST_REQUIRE(index.FindBalance(scripthash, balanceReorg));
+    BOOST_CHECK_EQUAL(balanceReorg.nOutputs, balance.nOutputs);
+    BOOST_CHECK_EQUAL(balanceReorg.nSpends, 0);
+    BOOST_CHECK_EQUAL(balanceReorg.nBalance, balance.nBalance);
+    BOOST_REQUIRE(index.FindBalance(GetScriptHash(scriptOther), balanceReorg));
+    BOOST_CHECK_EQUAL(balanceReorg.nOutputs, 1);
+
+    index.Interrupt();
+    index.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
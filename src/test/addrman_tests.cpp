@@ -6,6 +6,7 @@
 #include <string>
 #include <boost/test/unit_test.hpp>
 
+#include <clientversion.h>
 #include <hash.h>
 #include <netbase.h>
 #include <random.h>
@@ -404,6 +405,42 @@ BOOST_AUTO_TEST_CASE(addrman_getaddr)
 }
 
 
+BOOST_AUTO_TEST_CASE(addrman_serialize_positions)
+{
+    CAddrManTest addrman;
+    std::vector<CAddress> vTried, vNew;
+    for (unsigned int i = 1; i < (4 * 256); i++) {
+        std::string strAddr = boost::to_string(i % 256) + "." + boost::to_string(i >> 8) + ".1.23";
+        CAddress addr = CAddress(ResolveService(strAddr), NODE_NONE);
+        addr.nTime = GetAdjustedTime();
+        if (!addrman.Add(addr, ResolveIP("250.1.2.1")))
+            continue;
+        if (i % 4 == 0) {
+            addrman.Good(addr);
+            vTried.push_back(addr);
+        } else {
+            vNew.push_back(addr);
+        }
+    }
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << addrman;
+    CAddrManTest addrman2;
+    ss >> addrman2;
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK_EQUAL(addrman2.size(), addrman.size());
+
+    // Entries are restored into the same tables, and the tables stay consistent
+    // when entries are moved between them afterwards.
+    for (const CAddress& addr : vTried)
+        BOOST_CHECK(addrman2.Find(addr) != nullptr);
+    for (const CAddress& addr : vNew) {
+        if (addrman2.Find(addr) != nullptr)
+            addrman2.Good(addr);
+    }
+    BOOST_CHECK_EQUAL(addrman2.size(), addrman.size());
+}
+
 BOOST_AUTO_TEST_CASE(caddrinfo_get_tried_bucket)
 {
     CAddrManTest addrman;
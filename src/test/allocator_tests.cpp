@@ -4,10 +4,15 @@
 
 #include <util.h>
 
+#include <memusage.h>
+#include <support/allocators/pool.h>
 #include <support/allocators/secure.h>
 #include <test/test_bitcoin.h>
 
+#include <cstring>
 #include <memory>
+#include <thread>
+#include <unordered_map>
 
 #include <boost/test/unit_test.hpp>
 
@@ -233,4 +238,134 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_live)
     BOOST_CHECK(pool.stats().used == initial.used);
 }
 
+BOOST_AUTO_TEST_CASE(lockedpool_tests_threads)
+{
+    // Threads allocate at the same time, and free each other's chunks
+    std::unique_ptr<LockedPageAllocator> x(new TestLockedPageAllocator(64, 1));
+    LockedPool pool(std::move(x));
+    const int threads = 8;
+    std::vector<std::vector<void*>> addrs(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&pool, &addrs, t] {
+            for (int i = 0; i < 1000; ++i)
+                addrs[t].push_back(pool.alloc(16 + (i % 8) * 16));
+        });
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+    workers.clear();
+    for (const std::vector<void*>& addr : addrs) {
+        for (void* ptr : addr)
+            BOOST_CHECK(ptr != nullptr);
+    }
+    BOOST_CHECK_EQUAL(pool.stats().chunks_used, threads * 1000U);
+
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&pool, &addrs, t] {
+            for (void* ptr : addrs[(t + 1) % threads])
+                pool.free(ptr);
+        });
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+    BOOST_CHECK(pool.stats().used == 0);
+    BOOST_CHECK(pool.stats().locked == LockedPool::ARENA_SIZE);
+}
+
+BOOST_AUTO_TEST_CASE(pool_resource_tests)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+
+    // Blocks of the same size are carved from one chunk, and freed ones are reused.
+    void* a = resource.Allocate(24, 8);
+    void* b = resource.Allocate(24, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL(static_cast<char*>(b) - static_cast<char*>(a), 24);
+    resource.Deallocate(a, 24, 8);
+    BOOST_CHECK(resource.Allocate(20, 8) == a);
+
+    // Oversized or overaligned requests bypass the pool.
+    void* big = resource.Allocate(65, 8);
+    void* aligned = resource.Allocate(16, 16);
+    resource.Deallocate(big, 65, 8);
+    resource.Deallocate(aligned, 16, 16);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+
+    // Exhausting a chunk takes a new one.
+    std::vector<void*> blocks;
+    for (int i = 0; i < 64; i++) {
+        blocks.push_back(resource.Allocate(64, 8));
+    }
+    BOOST_CHECK(resource.NumAllocatedChunks() > 1);
+    for (void* p : blocks) {
+        resource.Deallocate(p, 64, 8);
+    }
+    resource.Deallocate(b, 24, 8);
+}
+
+BOOST_AUTO_TEST_CASE(pool_resource_large_pages_tests)
+{
+    // Without large pages enabled, the resource keeps using the heap.
+    PoolResource<64, 8> heap(1024);
+    heap.UseLargePages();
+    BOOST_CHECK_EQUAL(heap.ChunkSizeBytes(), 1024U);
+
+    if (!SetLargePageMode(LargePageMode::TRANSPARENT, NumaPolicy::DEFAULT, -1)) {
+        return;
+    }
+    {
+        PoolResource<64, 8> resource(1024);
+        resource.UseLargePages();
+        BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), LARGE_PAGE_SIZE);
+        std::vector<void*> blocks;
+        for (size_t i = 0; i < LARGE_PAGE_SIZE / 64 + 1; i++) {
+            blocks.push_back(resource.Allocate(64, 8));
+            memset(blocks.back(), 0xff, 64);
+        }
+        BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+        BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(blocks[0]) % LARGE_PAGE_SIZE, 0U);
+        for (void* p : blocks) {
+            resource.Deallocate(p, 64, 8);
+        }
+    }
+    BOOST_CHECK(SetLargePageMode(LargePageMode::NONE, NumaPolicy::DEFAULT, -1));
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_map_tests)
+{
+    typedef std::pair<const int, int> Value;
+    typedef std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, PoolAllocator<Value, sizeof(Value) + sizeof(void*) * 4> > Map;
+    Map::allocator_type::ResourceType resource;
+    {
+        Map map(0, std::hash<int>(), std::equal_to<int>(), Map::allocator_type(&resource));
+        for (int i = 0; i < 10000; i++) {
+            map[i] = i;
+        }
+        for (int i = 0; i < 10000; i += 2) {
+            map.erase(i);
+        }
+        for (int i = 0; i < 10000; i++) {
+            BOOST_CHECK_EQUAL(map.count(i), (size_t)(i % 2));
+        }
+        // All nodes are accounted for by the chunks holding them, minus the freed ones.
+        BOOST_CHECK(resource.NumAllocatedChunks() > 0);
+        BOOST_CHECK(resource.FreeBytes() >= 5000 * sizeof(Value));
+        BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), memusage::MallocUsage(resource.ChunkSizeBytes()) * resource.NumAllocatedChunks() - resource.FreeBytes() + memusage::MallocUsage(sizeof(void*) * resource.NumAllocatedChunks()) + memusage::MallocUsage(sizeof(void*) * map.bucket_count()));
+        // Refilling the map reuses the freed nodes.
+        size_t chunks = resource.NumAllocatedChunks();
+        for (int i = 0; i < 10000; i += 2) {
+            map[i] = i;
+        }
+        BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), chunks);
+    }
+
+    // Without a resource the allocator falls back to the heap.
+    Map plain;
+    plain[1] = 1;
+    BOOST_CHECK(plain.get_allocator().resource() == nullptr);
+    BOOST_CHECK(memusage::DynamicUsage(plain) > 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
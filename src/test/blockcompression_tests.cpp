@@ -0,0 +1,175 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockcompression.h>
+#include <blockfilemap.h>
+#include <blockfilewriter.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <crypto/common.h>
+#include <script/interpreter.h>
+#include <streams.h>
+#include <validation.h>
+#include <test/test_bitcoin.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockcompression_tests, TestChain100Setup)
+
+static std::vector<unsigned char> RoundTrip(const std::vector<unsigned char>& data)
+{
+    std::vector<unsigned char> compressed;
+    LZCompress(data.data(), data.size(), compressed);
+    std::vector<unsigned char> out(data.size());
+    BOOST_CHECK(LZDecompress(compressed.data(), compressed.size(), out.data(), out.size()));
+    // Neither a byte more nor less
+    std::vector<unsigned char> longer(data.size() + 1);
+    BOOST_CHECK(!LZDecompress(compressed.data(), compressed.size(), longer.data(), longer.size()));
+    if (!data.empty()) {
+        BOOST_CHECK(!LZDecompress(compressed.data(), compressed.size(), out.data(), out.size() - 1));
+    }
+    return out;
+}
+
+BOOST_AUTO_TEST_CASE(lz_roundtrip)
+{
+    FastRandomContext rng(true);
+    for (size_t nSize : {0, 1, 12, 13, 100, 65536, 200000}) {
+        std::vector<unsigned char> random = rng.randbytes(nSize);
+        BOOST_CHECK(RoundTrip(random) == random);
+
+        // Runs, overlapping matches, and matches up to 64KiB back
+        std::vector<unsigned char> repetitive(nSize);
+        for (size_t i = 0; i < nSize; i++) {
+            repetitive[i] = i < 1000 ? (unsigned char)rng.randbits(8) : (i % 3 == 0 ? 7 : repetitive[i - 1000 + rng.randrange(2)]);
+        }
+        BOOST_CHECK(RoundTrip(repetitive) == repetitive);
+    }
+
+    std::vector<unsigned char> zeros(100000), compressed;
+    LZCompress(zeros.data(), zeros.size(), compressed);
+    BOOST_CHECK(compressed.size() < 1000);
+}
+
+BOOST_AUTO_TEST_CASE(lz_corrupt)
+{
+    FastRandomContext rng(true);
+    std::vector<unsigned char> data(10000);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (unsigned char)(i % 10 == 0 ? rng.randbits(8) : i / 100);
+    }
+    std::vector<unsigned char> compressed, out(data.size());
+    LZCompress(data.data(), data.size(), compressed);
+
+    // Truncated input, and offsets before the start of the output, are refused
+    for (size_t nSize = 0; nSize < compressed.size(); nSize++) {
+        BOOST_CHECK(!LZDecompress(compressed.data(), nSize, out.data(), out.size()));
+    }
+    const unsigned char bad_offset[] = {0x10, 'a', 0x05, 0x00, 0x00};
+    BOOST_CHECK(!LZDecompress(bad_offset, sizeof(bad_offset), out.data(), out.size()));
+
+    // Flipped bytes never write past the output
+    for (int i = 0; i < 1000; i++) {
+        std::vector<unsigned char> corrupt = compressed;
+        corrupt[rng.randrange(corrupt.size())] ^= 1 + rng.randrange(255);
+        LZDecompress(corrupt.data(), corrupt.size(), out.data(), out.size());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(compress_record)
+{
+    std::vector<unsigned char> header = {0xfa, 0xbf, 0xb5, 0xda, 0, 0, 0, 0};
+
+    // Records that do not shrink stay raw
+    FastRandomContext rng(true);
+    std::vector<unsigned char> random = header, data = rng.randbytes(1000);
+    random.insert(random.end(), data.begin(), data.end());
+    std::vector<unsigned char> record = random;
+    CompressRecord(record);
+    BOOST_CHECK(record == random);
+
+    std::vector<unsigned char> zeros = header;
+    zeros.resize(8 + 1000);
+    record = zeros;
+    CompressRecord(record);
+    BOOST_CHECK(record.size() < zeros.size());
+    BOOST_CHECK(std::equal(header.begin(), header.begin() + 4, record.begin()));
+    const uint32_t nSize = ReadLE32(record.data() + 4);
+    BOOST_CHECK(nSize & COMPRESSED_RECORD_FLAG);
+    BOOST_CHECK_EQUAL(nSize & ~COMPRESSED_RECORD_FLAG, record.size() - 8);
+    std::vector<unsigned char> out;
+    BOOST_CHECK(DecompressRecord(record.data() + 8, record.size() - 8, out));
+    BOOST_CHECK(out == std::vector<unsigned char>(1000, 0));
+}
+
+/** Whether the record whose data is at pos of a block or undo file is compressed */
+static bool IsCompressedRecord(const CDiskBlockPos& pos, const char* prefix)
+{
+    CAutoFile file(fsbridge::fopen(GetBlockPosFilename(pos, prefix), "rb"), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!file.IsNull());
+    BOOST_REQUIRE(fseek(file.Get(), pos.nPos - 4, SEEK_SET) == 0);
+    uint32_t nSize;
+    file >> nSize;
+    return nSize & COMPRESSED_RECORD_FLAG;
+}
+
+BOOST_AUTO_TEST_CASE(compressed_blocks)
+{
+    const CChainParams& chainparams = Params();
+    fBlockCompression = true;
+    g_blockfilewriter.Start(1 << 20);
+
+    // Outputs with a long script anyone can spend, so that both the block
+    // creating them and the undo data of the block spending them compress
+    const CScript scriptLong = CScript() << std::vector<unsigned char>(500, 0) << OP_DROP << OP_TRUE;
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction create;
+    create.vin.resize(1);
+    create.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    create.vout.assign(2, CTxOut(10 * CENT, scriptLong));
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, create, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_REQUIRE(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    create.vin[0].scriptSig << vchSig;
+    CreateAndProcessBlock({create}, scriptPubKey);
+    CMutableTransaction spend;
+    spend.vin.emplace_back(COutPoint(create.GetHash(), 0));
+    spend.vin.emplace_back(COutPoint(create.GetHash(), 1));
+    spend.vout.assign(1, CTxOut(15 * CENT, scriptLong));
+    const uint256 hashSpend = CreateAndProcessBlock({spend}, scriptPubKey).GetHash();
+    BOOST_REQUIRE(chainActive.Tip()->GetBlockHash() == hashSpend);
+
+    // They are read back, and sent raw, whether they are queued, mapped or
+    // read from the file
+    for (int fMapped = 0; fMapped < 2; fMapped++) {
+        g_blockfilemaps.SetMaxBytes(fMapped ? 1 << 30 : 0);
+        g_blockfilemaps.SetFinalizedFiles(fMapped);
+        for (const CBlockIndex* pindex = chainActive.Tip(); pindex; pindex = pindex->pprev) {
+            CBlock block;
+            BOOST_REQUIRE(ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()));
+            CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+            ssBlock << block;
+            std::vector<unsigned char> raw;
+            BOOST_REQUIRE(ReadRawBlockFromDisk(raw, pindex, chainparams.MessageStart()));
+            BOOST_CHECK(raw == std::vector<unsigned char>(ssBlock.begin(), ssBlock.end()));
+        }
+        BOOST_CHECK(CVerifyDB().VerifyDB(chainparams, pcoinsTip.get(), 4, 10));
+        FlushStateToDisk();
+    }
+    BOOST_CHECK(IsCompressedRecord(chainActive.Tip()->pprev->GetBlockPos(), "blk"));
+    BOOST_CHECK(IsCompressedRecord(chainActive.Tip()->GetUndoPos(), "rev"));
+    // Blocks written before stay raw
+    BOOST_CHECK(!IsCompressedRecord(chainActive.Tip()->pprev->pprev->GetBlockPos(), "blk"));
+
+    g_blockfilemaps.SetMaxBytes(0);
+    g_blockfilemaps.SetFinalizedFiles(0);
+    g_blockfilewriter.Stop();
+    fBlockCompression = false;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -273,6 +273,39 @@ BOOST_AUTO_TEST_CASE(SufficientPreforwardRTTest)
     BOOST_CHECK_EQUAL(pool.mapTx.find(txhash)->GetSharedTx().use_count(), SHARED_TX_OFFSET + 0);
 }
 
+BOOST_AUTO_TEST_CASE(PredictedPrefillRoundTripTest)
+{
+    CTxMemPool pool;
+    CBlock block(BuildBlockTestCase());
+
+    // Prefill tx 1 on top of the coinbase; tx 2 is neither prefilled nor in the mempool
+    {
+        std::vector<bool> vPrefill(block.vtx.size());
+        vPrefill[1] = true;
+        CBlockHeaderAndShortTxIDs shortIDs(block, true, vPrefill);
+        BOOST_CHECK_EQUAL(shortIDs.BlockTxCount(), block.vtx.size());
+
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << shortIDs;
+
+        CBlockHeaderAndShortTxIDs shortIDs2;
+        stream >> shortIDs2;
+
+        PartiallyDownloadedBlock partialBlock(&pool);
+        BOOST_CHECK(partialBlock.InitData(shortIDs2, extra_txn) == READ_STATUS_OK);
+        BOOST_CHECK( partialBlock.IsTxAvailable(0));
+        BOOST_CHECK( partialBlock.IsTxAvailable(1));
+        BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+
+        CBlock block2;
+        BOOST_CHECK(partialBlock.FillBlock(block2, {block.vtx[2]}) == READ_STATUS_OK);
+        BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+        bool mutated;
+        BOOST_CHECK_EQUAL(block.hashMerkleRoot.ToString(), BlockMerkleRoot(block2, &mutated).ToString());
+        BOOST_CHECK(!mutated);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
 {
     CTxMemPool pool;
@@ -317,6 +350,60 @@ BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(ExtraTxnRoundTripTest)
+{
+    // Enough transactions that their short IDs are computed in batches, with
+    // a partial batch at the end, all found among the extra transactions
+    CTxMemPool pool;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(tx));
+    block.nVersion = 42;
+    block.hashPrevBlock = InsecureRand256();
+    block.nBits = 0x207fffff;
+    std::vector<std::pair<uint256, CTransactionRef>> extra;
+    for (int i = 0; i < 11; i++) {
+        tx.vin[0].prevout.hash = InsecureRand256();
+        tx.vin[0].prevout.n = 0;
+        block.vtx.push_back(MakeTransactionRef(tx));
+        extra.emplace_back(block.vtx.back()->GetWitnessHash(), block.vtx.back());
+        // Unrelated extra transactions between them
+        tx.vin[0].prevout.hash = InsecureRand256();
+        CTransactionRef other = MakeTransactionRef(tx);
+        extra.emplace_back(other->GetWitnessHash(), other);
+    }
+
+    bool mutated;
+    block.hashMerkleRoot = BlockMerkleRoot(block, &mutated);
+    assert(!mutated);
+    while (!CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus())) ++block.nNonce;
+
+    CBlockHeaderAndShortTxIDs shortIDs(block, true);
+    TestHeaderAndShortIDs testIDs(shortIDs);
+    BOOST_REQUIRE_EQUAL(testIDs.shorttxids.size(), block.vtx.size() - 1);
+    for (size_t i = 1; i < block.vtx.size(); i++)
+        BOOST_CHECK_EQUAL(testIDs.shorttxids[i - 1], shortIDs.GetShortID(block.vtx[i]->GetWitnessHash()));
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << shortIDs;
+    CBlockHeaderAndShortTxIDs shortIDs2;
+    stream >> shortIDs2;
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs2, extra) == READ_STATUS_OK);
+    for (size_t i = 0; i < block.vtx.size(); i++)
+        BOOST_CHECK(partialBlock.IsTxAvailable(i));
+
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, {}) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+}
+
 BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BlockTransactionsRequest req1;
     req1.blockhash = InsecureRand256();
@@ -0,0 +1,141 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilemap.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <streams.h>
+#include <validation.h>
+#include <test/test_bitcoin.h>
+
+#include <stdio.h>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilemap_tests, TestChain100Setup)
+
+static fs::path WriteTestFile(const fs::path& dir, int nFile, size_t nSize)
+{
+    fs::path path = dir / strprintf("map%05u.dat", nFile);
+    std::vector<unsigned char> data(nSize);
+    for (size_t i = 0; i < nSize; i++) {
+        data[i] = (unsigned char)(nFile + i);
+    }
+    FILE* file = fsbridge::fopen(path, "wb");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(data.data(), 1, nSize, file), nSize);
+    fclose(file);
+    return path;
+}
+
+BOOST_AUTO_TEST_CASE(blockfilemap_lru)
+{
+    std::vector<fs::path> paths;
+    for (int nFile = 0; nFile < 4; nFile++) {
+        paths.push_back(WriteTestFile(pathTemp, nFile, 1000));
+    }
+    paths.push_back(WriteTestFile(pathTemp, 4, 5000));
+
+    CBlockFileMapCache cache;
+    cache.SetFinalizedFiles(5);
+    // Disabled by default
+    BOOST_CHECK(!cache.Get(0, paths[0]));
+
+    cache.SetMaxBytes(3000);
+    std::shared_ptr<const CMappedFile> mapping = cache.Get(1, paths[1]);
+    BOOST_REQUIRE(mapping);
+    BOOST_CHECK_EQUAL(mapping->size(), 1000U);
+    BOOST_CHECK_EQUAL(mapping->data()[0], 1);
+    BOOST_CHECK_EQUAL(mapping->data()[999], (unsigned char)(1 + 999));
+    BOOST_CHECK(cache.Get(1, paths[1]) == mapping);
+
+    // Files larger than the limit, missing or not finalized are not mapped
+    BOOST_CHECK(!cache.Get(4, paths[4]));
+    BOOST_CHECK(!cache.Get(3, pathTemp / "missing.dat"));
+    BOOST_CHECK(!cache.Get(5, paths[0]));
+    BOOST_CHECK_EQUAL(cache.Count(), 1U);
+
+    // Mapping a fourth file drops the least recently used one (file 0), and
+    // a dropped mapping stays valid while it is held
+    std::shared_ptr<const CMappedFile> mapping0 = cache.Get(0, paths[0]);
+    BOOST_REQUIRE(cache.Get(2, paths[2]));
+    BOOST_REQUIRE(cache.Get(1, paths[1]));
+    BOOST_CHECK_EQUAL(cache.MappedBytes(), 3000U);
+    BOOST_REQUIRE(cache.Get(3, paths[3]));
+    BOOST_CHECK_EQUAL(cache.Count(), 3U);
+    BOOST_CHECK_EQUAL(cache.MappedBytes(), 3000U);
+    BOOST_CHECK(cache.Get(1, paths[1]) == mapping);
+    BOOST_CHECK(cache.Get(0, paths[0]) != mapping0);
+    BOOST_CHECK_EQUAL(mapping0->data()[1], 1);
+
+    cache.Erase(0);
+    BOOST_CHECK_EQUAL(cache.MappedBytes(), 2000U);
+    // Files that are appended to again are unmapped
+    cache.SetFinalizedFiles(2);
+    BOOST_CHECK_EQUAL(cache.Count(), 1U);
+    BOOST_CHECK(!cache.Get(3, paths[3]));
+    cache.SetMaxBytes(0);
+    BOOST_CHECK_EQUAL(cache.Count(), 0U);
+    BOOST_CHECK_EQUAL(cache.MappedBytes(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilemap_read_block)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    CBlock blockRead;
+    BOOST_REQUIRE(ReadBlockFromDisk(blockRead, chainActive.Tip(), consensusParams));
+    BOOST_CHECK_EQUAL(g_blockfilemaps.Count(), 0U);
+
+    // Pretend the only block file is finalized
+    g_blockfilemaps.SetMaxBytes(1 << 30);
+    g_blockfilemaps.SetFinalizedFiles(1);
+    for (const CBlockIndex* pindex = chainActive.Tip(); pindex; pindex = pindex->pprev) {
+        CBlock blockMapped;
+        BOOST_REQUIRE(ReadBlockFromDisk(blockMapped, pindex, consensusParams));
+        BOOST_CHECK_EQUAL(blockMapped.GetHash(), pindex->GetBlockHash());
+    }
+    BOOST_CHECK_EQUAL(g_blockfilemaps.Count(), 1U);
+    CBlock blockMapped;
+    BOOST_REQUIRE(ReadBlockFromDisk(blockMapped, chainActive.Tip(), consensusParams));
+    BOOST_CHECK(blockMapped.vtx[0]->GetWitnessHash() == blockRead.vtx[0]->GetWitnessHash());
+
+    // A position past the end of the file fails instead of reading out of the mapping
+    CDiskBlockPos pos(0, g_blockfilemaps.Get(0, GetBlockPosFilename(CDiskBlockPos(0, 0), "blk"))->size());
+    BOOST_CHECK(!ReadBlockFromDisk(blockMapped, pos, consensusParams));
+
+    g_blockfilemaps.SetMaxBytes(0);
+    g_blockfilemaps.SetFinalizedFiles(0);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilemap_read_raw_block)
+{
+    const CChainParams& chainparams = Params();
+    for (int fMapped = 0; fMapped < 2; fMapped++) {
+        g_blockfilemaps.SetMaxBytes(fMapped ? 1 << 30 : 0);
+        g_blockfilemaps.SetFinalizedFiles(fMapped);
+        for (const CBlockIndex* pindex = chainActive.Tip(); pindex; pindex = pindex->pprev) {
+            CBlock block;
+            BOOST_REQUIRE(ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()));
+            CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+            ssBlock << block;
+
+            std::vector<unsigned char> raw;
+            BOOST_REQUIRE(ReadRawBlockFromDisk(raw, pindex, chainparams.MessageStart()));
+            BOOST_CHECK(raw == std::vector<unsigned char>(ssBlock.begin(), ssBlock.end()));
+        }
+        BOOST_CHECK_EQUAL(g_blockfilemaps.Count(), (size_t)fMapped);
+
+        // The index header in front of the block must carry the network magic
+        std::vector<unsigned char> raw;
+        CMessageHeader::MessageStartChars wrongStart = {0, 0, 0, 0};
+        BOOST_CHECK(!ReadRawBlockFromDisk(raw, chainActive.Tip(), wrongStart));
+        BOOST_CHECK(raw.empty());
+        BOOST_CHECK(!ReadRawBlockFromDisk(raw, CDiskBlockPos(0, 4), chainparams.MessageStart()));
+    }
+    g_blockfilemaps.SetMaxBytes(0);
+    g_blockfilemaps.SetFinalizedFiles(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
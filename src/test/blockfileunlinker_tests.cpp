@@ -0,0 +1,97 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfileunlinker.h>
+#include <test/test_bitcoin.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfileunlinker_tests, BasicTestingSetup)
+
+namespace {
+/** Records the files deleted, and can hold the unlinker thread before it deletes one */
+struct TestUnlinks {
+    std::mutex cs;
+    std::condition_variable cond;
+    bool fHold = false;
+    std::vector<int> vUnlinked;
+    std::vector<std::thread::id> vThreads;
+
+    void Unlink(int nFile)
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        cond.wait(lock, [this] { return !fHold; });
+        vUnlinked.push_back(nFile);
+        vThreads.push_back(std::this_thread::get_id());
+    }
+
+    void Hold(bool fHoldIn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            fHold = fHoldIn;
+        }
+        cond.notify_all();
+    }
+
+    std::vector<int> Unlinked()
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        return vUnlinked;
+    }
+};
+} // namespace
+
+BOOST_AUTO_TEST_CASE(blockfileunlinker_inline)
+{
+    // Without the thread, files are deleted before Unlink returns
+    TestUnlinks unlinks;
+    CBlockFileUnlinker unlinker([&](int nFile) { unlinks.Unlink(nFile); });
+    BOOST_CHECK(!unlinker.IsRunning());
+    unlinker.Unlink({3, 1, 2});
+    BOOST_CHECK(unlinks.Unlinked() == std::vector<int>({1, 2, 3}));
+    BOOST_CHECK_EQUAL(unlinks.vThreads[0], std::this_thread::get_id());
+    BOOST_CHECK_EQUAL(unlinker.QueuedFiles(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(blockfileunlinker_thread)
+{
+    TestUnlinks unlinks;
+    CBlockFileUnlinker unlinker([&](int nFile) { unlinks.Unlink(nFile); });
+    unlinker.Start();
+    BOOST_CHECK(unlinker.IsRunning());
+
+    // Unlink returns while the thread is held, with the files still queued
+    unlinks.Hold(true);
+    unlinker.Unlink({1, 2});
+    unlinker.Unlink({5});
+    BOOST_CHECK_EQUAL(unlinker.QueuedFiles(), 3U);
+    BOOST_CHECK(unlinks.Unlinked().empty());
+
+    unlinks.Hold(false);
+    unlinker.Flush();
+    BOOST_CHECK_EQUAL(unlinker.QueuedFiles(), 0U);
+    BOOST_CHECK(unlinks.Unlinked() == std::vector<int>({1, 2, 5}));
+    for (const std::thread::id& id : unlinks.vThreads) {
+        BOOST_CHECK(id != std::this_thread::get_id());
+    }
+
+    // Stopping deletes what is still queued, and later files are deleted inline
+    unlinks.Hold(true);
+    unlinker.Unlink({7});
+    std::thread release([&] { unlinks.Hold(false); });
+    unlinker.Stop();
+    release.join();
+    BOOST_CHECK(!unlinker.IsRunning());
+    unlinker.Unlink({8});
+    BOOST_CHECK(unlinks.Unlinked() == std::vector<int>({1, 2, 5, 7, 8}));
+    BOOST_CHECK_EQUAL(unlinks.vThreads.back(), std::this_thread::get_id());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,166 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilewriter.h>
+#include <chainparams.h>
+#include <fs.h>
+#include <validation.h>
+#include <test/test_bitcoin.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilewriter_tests, TestChain100Setup)
+
+namespace {
+/** Opens files in a test directory, and can hold the writer thread before it opens one */
+struct TestFiles {
+    fs::path dir;
+    std::mutex cs;
+    std::condition_variable cond;
+    bool fHold = false;
+    bool fFail = false;
+    int nOpened = 0;
+
+    FILE* Open(const CDiskBlockPos& pos, bool fUndo)
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        cond.wait(lock, [this] { return !fHold; });
+        nOpened++;
+        if (fFail)
+            return nullptr;
+        fs::path path = dir / strprintf("%s%05u.dat", fUndo ? "rev" : "blk", pos.nFile);
+        FILE* file = fsbridge::fopen(path, "rb+");
+        if (!file)
+            file = fsbridge::fopen(path, "wb+");
+        if (file && fseek(file, pos.nPos, SEEK_SET)) {
+            fclose(file);
+            return nullptr;
+        }
+        return file;
+    }
+
+    void Hold(bool fHoldIn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            fHold = fHoldIn;
+        }
+        cond.notify_all();
+    }
+
+    std::vector<unsigned char> Read(int nFile, bool fUndo)
+    {
+        fs::path path = dir / strprintf("%s%05u.dat", fUndo ? "rev" : "blk", nFile);
+        std::vector<unsigned char> data(fs::exists(path) ? fs::file_size(path) : 0);
+        FILE* file = fsbridge::fopen(path, "rb");
+        if (file) {
+            BOOST_CHECK_EQUAL(fread(data.data(), 1, data.size(), file), data.size());
+            fclose(file);
+        }
+        return data;
+    }
+};
+
+CBlockFileWriter::Record MakeRecord(size_t nSize, unsigned char chFill)
+{
+    return std::make_shared<const std::vector<unsigned char>>(nSize, chFill);
+}
+} // namespace
+
+BOOST_AUTO_TEST_CASE(blockfilewriter_queue)
+{
+    TestFiles files;
+    files.dir = pathTemp;
+    CBlockFileWriter writer([&](const CDiskBlockPos& pos, bool fUndo) { return files.Open(pos, fUndo); });
+
+    // Without the thread, records are written right away
+    BOOST_CHECK(writer.Write(CDiskBlockPos(0, 0), false, MakeRecord(10, 1)));
+    BOOST_CHECK(writer.GetPending(CDiskBlockPos(0, 0), false) == nullptr);
+    BOOST_CHECK(files.Read(0, false) == std::vector<unsigned char>(10, 1));
+
+    // Queued records can be read back until the thread has written them
+    writer.Start(100);
+    BOOST_CHECK(writer.IsRunning());
+    files.Hold(true);
+    CBlockFileWriter::Record record = MakeRecord(20, 2);
+    BOOST_CHECK(writer.Write(CDiskBlockPos(0, 10), false, record));
+    BOOST_CHECK(writer.Write(CDiskBlockPos(0, 0), true, MakeRecord(30, 3)));
+    BOOST_CHECK(writer.GetPending(CDiskBlockPos(0, 10), false) == record);
+    BOOST_CHECK(writer.GetPending(CDiskBlockPos(0, 10), true) == nullptr);
+    BOOST_REQUIRE(writer.GetPending(CDiskBlockPos(0, 0), true));
+    BOOST_CHECK_EQUAL(writer.GetPending(CDiskBlockPos(0, 0), true)->size(), 30U);
+    BOOST_CHECK_EQUAL(writer.QueuedBytes(), 50U);
+    BOOST_CHECK_EQUAL(files.Read(0, false).size(), 10U);
+
+    files.Hold(false);
+    BOOST_CHECK(writer.Flush());
+    BOOST_CHECK_EQUAL(writer.QueuedBytes(), 0U);
+    BOOST_CHECK(writer.GetPending(CDiskBlockPos(0, 10), false) == nullptr);
+    std::vector<unsigned char> expected(10, 1);
+    expected.insert(expected.end(), 20, 2);
+    BOOST_CHECK(files.Read(0, false) == expected);
+    BOOST_CHECK(files.Read(0, true) == std::vector<unsigned char>(30, 3));
+
+    // Records larger than the queue still go through
+    BOOST_CHECK(writer.Write(CDiskBlockPos(1, 0), false, MakeRecord(500, 4)));
+    BOOST_CHECK(writer.Flush());
+    BOOST_CHECK(files.Read(1, false) == std::vector<unsigned char>(500, 4));
+
+    // A failed write fails the flush and all later writes
+    {
+        std::lock_guard<std::mutex> lock(files.cs);
+        files.fFail = true;
+    }
+    BOOST_CHECK(writer.Write(CDiskBlockPos(2, 0), false, MakeRecord(10, 5)));
+    BOOST_CHECK(!writer.Flush());
+    BOOST_CHECK(!writer.Write(CDiskBlockPos(2, 10), false, MakeRecord(10, 5)));
+
+    writer.Stop();
+    BOOST_CHECK(!writer.IsRunning());
+}
+
+BOOST_AUTO_TEST_CASE(blockfilewriter_stop_writes_queue)
+{
+    TestFiles files;
+    files.dir = pathTemp;
+    CBlockFileWriter writer([&](const CDiskBlockPos& pos, bool fUndo) { return files.Open(pos, fUndo); });
+    writer.Start(1 << 20);
+    for (unsigned int i = 0; i < 50; i++) {
+        BOOST_CHECK(writer.Write(CDiskBlockPos(0, i * 4), false, MakeRecord(4, i)));
+    }
+    writer.Stop();
+    BOOST_CHECK_EQUAL(files.nOpened, 50);
+    std::vector<unsigned char> data = files.Read(0, false);
+    BOOST_REQUIRE_EQUAL(data.size(), 200U);
+    for (unsigned int i = 0; i < 200; i++) {
+        BOOST_CHECK_EQUAL(data[i], i / 4);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blockfilewriter_validation)
+{
+    // Blocks and undo data are read back while they are queued, and after they are written
+    g_blockfilewriter.Start(1 << 20);
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    for (int i = 0; i < 10; i++) {
+        CBlock block = CreateAndProcessBlock({}, scriptPubKey);
+        CBlock blockRead;
+        BOOST_REQUIRE(ReadBlockFromDisk(blockRead, chainActive.Tip(), Params().GetConsensus()));
+        BOOST_CHECK_EQUAL(blockRead.GetHash(), block.GetHash());
+        std::vector<unsigned char> raw;
+        BOOST_CHECK(ReadRawBlockFromDisk(raw, chainActive.Tip(), Params().MessageStart()));
+    }
+    BOOST_CHECK(CVerifyDB().VerifyDB(Params(), pcoinsTip.get(), 4, 10));
+    FlushStateToDisk();
+    BOOST_CHECK_EQUAL(g_blockfilewriter.QueuedBytes(), 0U);
+    BOOST_CHECK(CVerifyDB().VerifyDB(Params(), pcoinsTip.get(), 4, 10));
+    g_blockfilewriter.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
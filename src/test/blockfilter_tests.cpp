@@ -0,0 +1,168 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilter.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <random.h>
+#include <script/script.h>
+#include <streams.h>
+#include <undo.h>
+#include <utilstrencodings.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(bitstream_roundtrip)
+{
+    std::vector<unsigned char> data;
+    CVectorWriter stream(SER_NETWORK, 0, data, 0);
+    {
+        BitStreamWriter<CVectorWriter> bitwriter(stream);
+        bitwriter.Write(0, 1);
+        bitwriter.Write(2, 2);
+        bitwriter.Write(6, 3);
+        bitwriter.Write(11, 4);
+        bitwriter.Write(1, 5);
+        bitwriter.Write(32, 6);
+        bitwriter.Write(7, 7);
+        bitwriter.Write(30497, 16);
+        bitwriter.Write(0x0123456789ABCDEFULL, 64);
+    }
+    BOOST_CHECK_EQUAL(data.size(), 14U);
+
+    CSpanReader reader(SER_NETWORK, 0, data.data(), data.size());
+    BitStreamReader<CSpanReader> bitreader(reader);
+    BOOST_CHECK_EQUAL(bitreader.Read(1), 0U);
+    BOOST_CHECK_EQUAL(bitreader.Read(2), 2U);
+    BOOST_CHECK_EQUAL(bitreader.Read(3), 6U);
+    BOOST_CHECK_EQUAL(bitreader.Read(4), 11U);
+    BOOST_CHECK_EQUAL(bitreader.Read(5), 1U);
+    BOOST_CHECK_EQUAL(bitreader.Read(6), 32U);
+    BOOST_CHECK_EQUAL(bitreader.Read(7), 7U);
+    BOOST_CHECK_EQUAL(bitreader.Read(16), 30497U);
+    BOOST_CHECK_EQUAL(bitreader.Read(64), 0x0123456789ABCDEFULL);
+    BOOST_CHECK_THROW(bitreader.Read(8), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    GCSFilter::ElementSet included_elements, excluded_elements;
+    for (int i = 0; i < 100; ++i) {
+        GCSFilter::Element element1(32);
+        element1[0] = i;
+        included_elements.insert(std::move(element1));
+
+        GCSFilter::Element element2(32);
+        element2[1] = i;
+        excluded_elements.insert(std::move(element2));
+    }
+
+    GCSFilter filter(0, 0, 10, 1 << 10, included_elements);
+    for (const auto& element : included_elements) {
+        BOOST_CHECK(filter.Match(element));
+
+        auto insertion = excluded_elements.insert(element);
+        BOOST_CHECK(filter.MatchAny(excluded_elements));
+        excluded_elements.erase(insertion.first);
+    }
+
+    // Reconstructed from its encoding, the filter is the same
+    GCSFilter filter2(0, 0, 10, 1 << 10, filter.GetEncoded());
+    BOOST_CHECK_EQUAL(filter2.GetN(), 100U);
+    BOOST_CHECK(filter2.GetEncoded() == filter.GetEncoded());
+    BOOST_CHECK(filter2.MatchAny(included_elements));
+
+    // Trailing bytes are rejected
+    std::vector<unsigned char> vEncoded = filter.GetEncoded();
+    vEncoded.push_back(0);
+    BOOST_CHECK_THROW(GCSFilter(0, 0, 10, 1 << 10, vEncoded), std::ios_base::failure);
+
+    GCSFilter empty;
+    BOOST_CHECK_EQUAL(empty.GetN(), 0U);
+    BOOST_CHECK(!empty.MatchAny(included_elements));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    CScript included_scripts[5], excluded_scripts[3];
+
+    // First two are outputs on a single transaction
+    included_scripts[0] << std::vector<unsigned char>(0, 65) << OP_CHECKSIG;
+    included_scripts[1] << OP_DUP << OP_HASH160 << std::vector<unsigned char>(1, 20) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    // Third is an output on a second transaction
+    included_scripts[2] << OP_1 << std::vector<unsigned char>(2, 33) << OP_1 << OP_CHECKMULTISIG;
+
+    // Last two are spent by a single transaction
+    included_scripts[3] << OP_0 << std::vector<unsigned char>(3, 32);
+    included_scripts[4] << OP_4 << OP_ADD << OP_8 << OP_EQUAL;
+
+    // OP_RETURN output and empty scripts are not included
+    excluded_scripts[0] << OP_RETURN << std::vector<unsigned char>(4, 40);
+    excluded_scripts[1] << std::vector<unsigned char>(5, 33) << OP_CHECKSIG;
+
+    CMutableTransaction tx_1;
+    tx_1.vout.emplace_back(100, included_scripts[0]);
+    tx_1.vout.emplace_back(200, included_scripts[1]);
+    tx_1.vout.emplace_back(0, excluded_scripts[0]);
+
+    CMutableTransaction tx_2;
+    tx_2.vout.emplace_back(300, included_scripts[2]);
+    tx_2.vout.emplace_back(0, excluded_scripts[2]);
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(tx_1));
+    block.vtx.push_back(MakeTransactionRef(tx_2));
+
+    CBlockUndo block_undo;
+    block_undo.vtxundo.emplace_back();
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(500, included_scripts[3]), 1000, true);
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(600, included_scripts[4]), 10000, false);
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(700, excluded_scripts[2]), 100000, false);
+
+    BlockFilter block_filter(BlockFilterType::BASIC, block, block_undo);
+    const GCSFilter& filter = block_filter.GetFilter();
+
+    for (const CScript& script : included_scripts) {
+        BOOST_CHECK(filter.Match(GCSFilter::Element(script.begin(), script.end())));
+    }
+    for (const CScript& script : excluded_scripts) {
+        BOOST_CHECK(!filter.Match(GCSFilter::Element(script.begin(), script.end())));
+    }
+    BOOST_CHECK_EQUAL(filter.GetN(), 5U);
+
+    // Test serialization/unserialization
+    BlockFilter block_filter2;
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block_filter;
+    stream >> block_filter2;
+
+    BOOST_CHECK(block_filter.GetFilterType() == block_filter2.GetFilterType());
+    BOOST_CHECK_EQUAL(block_filter.GetBlockHash(), block_filter2.GetBlockHash());
+    BOOST_CHECK(block_filter.GetEncodedFilter() == block_filter2.GetEncodedFilter());
+    BOOST_CHECK_EQUAL(block_filter.GetHash(), block_filter2.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_bip158_genesis)
+{
+    // The first test vector of BIP 158, the testnet genesis block
+    const std::unique_ptr<CChainParams> testnet_params = CreateChainParams(CBaseChainParams::TESTNET);
+    BlockFilter filter(BlockFilterType::BASIC, testnet_params->GenesisBlock(), CBlockUndo());
+
+    BOOST_CHECK_EQUAL(HexStr(filter.GetEncodedFilter()), "019dfca8");
+    BOOST_CHECK_EQUAL(filter.ComputeHeader(uint256()).GetHex(),
+                      "21584579b7eb08997773e5aeff3a7f932700042d0ed2a6129012b7d7ae81b750");
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_type_names)
+{
+    BOOST_CHECK_EQUAL(BlockFilterTypeName(BlockFilterType::BASIC), "basic");
+    BOOST_CHECK_EQUAL(BlockFilterTypeName(BlockFilterType::INVALID), "");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,111 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilter.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <index/blockfilterindex.h>
+#include <undo.h>
+#include <utiltime.h>
+#include <validation.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockfilterindex_tests)
+
+//! Wait up to ten seconds for the sync thread to catch up
+static bool WaitForSync(CBlockFilterIndex& filter_index)
+{
+    int64_t nTimeout = GetTimeMillis() + 10000;
+    while (!filter_index.BlockUntilSyncedToCurrentChain()) {
+        if (GetTimeMillis() > nTimeout)
+            return false;
+        MilliSleep(100);
+    }
+    return true;
+}
+
+//! Check the indexed filter and header of a block against ones computed from disk
+static bool CheckFilterLookups(CBlockFilterIndex& filter_index, const CBlockIndex* pindex, uint256& last_header)
+{
+    CBlock block;
+    BOOST_REQUIRE(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
+    CBlockUndo blockundo;
+    if (pindex->nHeight > 0)
+        BOOST_REQUIRE(UndoReadFromDisk(blockundo, pindex));
+    BlockFilter expected_filter(BlockFilterType::BASIC, block, blockundo);
+
+    BlockFilter filter;
+    uint256 filter_header;
+    std::vector<BlockFilter> filters;
+    std::vector<uint256> filter_hashes;
+
+    BOOST_CHECK(filter_index.LookupFilter(pindex, filter));
+    BOOST_CHECK(filter_index.LookupFilterHeader(pindex, filter_header));
+    BOOST_CHECK(filter_index.LookupFilterRange(pindex->nHeight, pindex, filters));
+    BOOST_CHECK(filter_index.LookupFilterHashRange(pindex->nHeight, pindex, filter_hashes));
+
+    BOOST_CHECK_EQUAL(filters.size(), 1U);
+    BOOST_CHECK_EQUAL(filter_hashes.size(), 1U);
+
+    BOOST_CHECK_EQUAL(filter.GetHash(), expected_filter.GetHash());
+    BOOST_CHECK_EQUAL(filter_header, expected_filter.ComputeHeader(last_header));
+    BOOST_CHECK_EQUAL(filters[0].GetHash(), expected_filter.GetHash());
+    BOOST_CHECK_EQUAL(filter_hashes[0], expected_filter.GetHash());
+
+    last_header = filter_header;
+    return true;
+}
+
+BOOST_FIXTURE_TEST_CASE(blockfilterindex_initial_sync, TestChain100Setup)
+{
+    CBlockFilterIndex filter_index(BlockFilterType::BASIC, 1 << 20, true);
+
+    // Nothing is found before the index is built
+    BlockFilter filter;
+    uint256 filter_header;
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    BOOST_CHECK(!filter_index.LookupFilter(pindexTip, filter));
+    BOOST_CHECK(!filter_index.LookupFilterHeader(pindexTip, filter_header));
+    BOOST_CHECK(!filter_index.BlockUntilSyncedToCurrentChain());
+
+    filter_index.Start();
+    BOOST_REQUIRE(WaitForSync(filter_index));
+    BOOST_CHECK(filter_index.IsSynced());
+    BOOST_CHECK_EQUAL(filter_index.GetBestHeight(), chainActive.Height());
+
+    // Every filter header commits to the one before it
+    uint256 last_header;
+    for (int i = 0; i <= chainActive.Height(); i++) {
+        CheckFilterLookups(filter_index, chainActive[i], last_header);
+    }
+
+    // The filters of the whole chain in one request
+    std::vector<BlockFilter> filters;
+    std::vector<uint256> filter_hashes;
+    BOOST_CHECK(filter_index.LookupFilterRange(0, pindexTip, filters));
+    BOOST_CHECK(filter_index.LookupFilterHashRange(0, pindexTip, filter_hashes));
+    BOOST_REQUIRE_EQUAL(filters.size(), (size_t)pindexTip->nHeight + 1);
+    BOOST_REQUIRE_EQUAL(filter_hashes.size(), filters.size());
+    for (size_t i = 0; i < filters.size(); i++) {
+        BOOST_CHECK_EQUAL(filters[i].GetBlockHash(), chainActive[i]->GetBlockHash());
+        BOOST_CHECK_EQUAL(filter_hashes[i], filters[i].GetHash());
+    }
+    BOOST_CHECK(!filter_index.LookupFilterRange(pindexTip->nHeight + 1, pindexTip, filters));
+
+    // Blocks connected from now on are indexed by the validation callbacks
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    for (int i = 0; i < 10; i++) {
+        CreateAndProcessBlock({}, scriptPubKey);
+        BOOST_CHECK(filter_index.BlockUntilSyncedToCurrentChain());
+        CheckFilterLookups(filter_index, chainActive.Tip(), last_header);
+    }
+    BOOST_CHECK_EQUAL(filter_index.GetBestHeight(), chainActive.Height());
+
+    filter_index.Interrupt();
+    filter_index.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,181 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <pow.h>
+#include <streams.h>
+#include <txdb.h>
+#include <validation.h>
+#include <test/test_bitcoin.h>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockindex_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(blockindex_arena)
+{
+    // Entries are packed next to each other, and freed memory is reused
+    CBlockIndex* a = new CBlockIndex();
+    CBlockIndex* b = new CBlockIndex();
+    BOOST_CHECK(a != b);
+    delete b;
+    CBlockIndex* c = new CBlockIndex();
+    BOOST_CHECK(c == b);
+    BOOST_CHECK_EQUAL(c->nHeight, 0);
+    BOOST_CHECK(c->phashBlock == nullptr);
+
+    // Larger derived objects are allocated too
+    std::unique_ptr<CDiskBlockIndex> disk(new CDiskBlockIndex(a));
+    disk->nHeight = 7;
+    BOOST_CHECK_EQUAL(disk->nHeight, 7);
+
+    std::vector<std::unique_ptr<CBlockIndex>> entries;
+    for (int i = 0; i < 20000; i++) {
+        entries.emplace_back(new CBlockIndex());
+        entries.back()->nHeight = i;
+    }
+    for (int i = 0; i < 20000; i++) {
+        BOOST_CHECK_EQUAL(entries[i]->nHeight, i);
+    }
+    delete a;
+    delete c;
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_packed_fields)
+{
+    CBlockIndex index;
+    index.nFile = MAX_BLOCK_FILE;
+    index.nStatus = BLOCK_VALID_SCRIPTS | BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO | BLOCK_OPT_WITNESS;
+    index.nDataPos = 0xffffffff;
+    BOOST_CHECK_EQUAL(index.nFile, MAX_BLOCK_FILE);
+    BOOST_CHECK(index.IsValid(BLOCK_VALID_SCRIPTS));
+    index.nStatus |= BLOCK_FAILED_CHILD;
+    BOOST_CHECK(!index.IsValid(BLOCK_VALID_TREE));
+    BOOST_CHECK_EQUAL(index.nStatus, (uint32_t)(BLOCK_VALID_SCRIPTS | BLOCK_HAVE_MASK | BLOCK_OPT_WITNESS | BLOCK_FAILED_CHILD));
+    index.nStatus &= ~BLOCK_FAILED_MASK;
+    BOOST_CHECK_EQUAL(index.nFile, MAX_BLOCK_FILE);
+    BOOST_CHECK_EQUAL(index.GetBlockPos().nFile, MAX_BLOCK_FILE);
+    BOOST_CHECK_EQUAL(index.GetUndoPos().nFile, MAX_BLOCK_FILE);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << CDiskBlockIndex(&index);
+    CDiskBlockIndex diskindex;
+    ss >> diskindex;
+    BOOST_CHECK_EQUAL(diskindex.nFile, MAX_BLOCK_FILE);
+    BOOST_CHECK_EQUAL(diskindex.nStatus, index.nStatus);
+    BOOST_CHECK_EQUAL(diskindex.nDataPos, index.nDataPos);
+
+    // Values that do not fit are rejected
+    int nVersion = CLIENT_VERSION, nHeight = 1, nFile = MAX_BLOCK_FILE + 1;
+    uint32_t nStatus = MAX_BLOCK_STATUS + 1, nTx = 1;
+    CDataStream ssBad(SER_DISK, CLIENT_VERSION);
+    ssBad << VARINT(nVersion) << VARINT(nHeight) << VARINT(nStatus) << VARINT(nTx);
+    BOOST_CHECK_THROW(ssBad >> diskindex, std::ios_base::failure);
+    ssBad.clear();
+    nStatus = BLOCK_HAVE_DATA;
+    ssBad << VARINT(nVersion) << VARINT(nHeight) << VARINT(nStatus) << VARINT(nTx) << VARINT(nFile);
+    BOOST_CHECK_THROW(ssBad >> diskindex, std::ios_base::failure);
+}
+
+/** Build a block index entry whose header has valid regtest proof of work */
+static std::unique_ptr<CBlockIndex> MineEntry(const CBlockIndex* pprev, uint32_t nStatus, std::vector<std::unique_ptr<uint256>>& hashes)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = pprev ? pprev->GetBlockHash() : uint256();
+    header.hashMerkleRoot = InsecureRand256();
+    header.nTime = 1500000000 + (pprev ? pprev->nHeight + 1 : 0);
+    header.nBits = UintToArith256(params.powLimit).GetCompact();
+    header.nNonce = 0;
+    while (!CheckProofOfWork(header.GetHash(), header.nBits, params)) {
+        header.nNonce++;
+    }
+
+    std::unique_ptr<CBlockIndex> pindex(new CBlockIndex(header));
+    hashes.emplace_back(new uint256(header.GetHash()));
+    pindex->phashBlock = hashes.back().get();
+    pindex->pprev = const_cast<CBlockIndex*>(pprev);
+    pindex->nHeight = pprev ? pprev->nHeight + 1 : 0;
+    pindex->nStatus = nStatus;
+    pindex->nTx = 1;
+    return pindex;
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_load)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const Consensus::Params& params = Params().GetConsensus();
+    CBlockTreeDB blocktree(1 << 20, true);
+
+    // A chain whose first half is fully validated, and whose second half only has valid headers
+    std::vector<std::unique_ptr<uint256>> hashes;
+    std::vector<std::unique_ptr<CBlockIndex>> entries;
+    for (int i = 0; i < 500; i++) {
+        uint32_t nStatus = i < 250 ? (BLOCK_VALID_SCRIPTS | BLOCK_HAVE_DATA) : BLOCK_VALID_TREE;
+        entries.push_back(MineEntry(entries.empty() ? nullptr : entries.back().get(), nStatus, hashes));
+    }
+    std::vector<const CBlockIndex*> vblockinfo;
+    for (const auto& entry : entries) {
+        vblockinfo.push_back(entry.get());
+    }
+    BOOST_REQUIRE(blocktree.WriteBatchSync({}, 0, vblockinfo));
+
+    std::map<uint256, std::unique_ptr<CBlockIndex>> mapLoaded;
+    auto insert = [&](const uint256& hash) -> CBlockIndex* {
+        if (hash.IsNull())
+            return nullptr;
+        std::unique_ptr<CBlockIndex>& pindex = mapLoaded[hash];
+        if (!pindex)
+            pindex.reset(new CBlockIndex());
+        return pindex.get();
+    };
+    BOOST_REQUIRE(blocktree.LoadBlockIndexGuts(params, insert));
+    BOOST_CHECK_EQUAL(mapLoaded.size(), entries.size());
+    for (const auto& entry : entries) {
+        const CBlockIndex* pindex = mapLoaded.at(entry->GetBlockHash()).get();
+        BOOST_CHECK_EQUAL(pindex->nHeight, entry->nHeight);
+        BOOST_CHECK_EQUAL(pindex->nStatus, entry->nStatus);
+        BOOST_CHECK_EQUAL(pindex->nNonce, entry->nNonce);
+        BOOST_CHECK(pindex->hashMerkleRoot == entry->hashMerkleRoot);
+        if (entry->pprev) {
+            BOOST_CHECK(pindex->pprev == mapLoaded.at(entry->pprev->GetBlockHash()).get());
+        } else {
+            BOOST_CHECK(pindex->pprev == nullptr);
+        }
+    }
+
+    // The header of a fully validated entry is not hashed again...
+    std::unique_ptr<CBlockIndex> trusted = MineEntry(entries.back().get(), BLOCK_VALID_SCRIPTS, hashes);
+    *hashes.back() = InsecureRand256();
+    BOOST_REQUIRE(blocktree.WriteBatchSync({}, 0, {trusted.get()}));
+    mapLoaded.clear();
+    BOOST_CHECK(blocktree.LoadBlockIndexGuts(params, insert));
+    BOOST_CHECK_EQUAL(mapLoaded.size(), entries.size() + 1);
+
+    // ...but that of other entries must match the hash they are stored under
+    std::unique_ptr<CBlockIndex> corrupt = MineEntry(entries.back().get(), BLOCK_VALID_TREE, hashes);
+    *hashes.back() = InsecureRand256();
+    BOOST_REQUIRE(blocktree.WriteBatchSync({}, 0, {corrupt.get()}));
+    mapLoaded.clear();
+    BOOST_CHECK(!blocktree.LoadBlockIndexGuts(params, insert));
+}
+
+BOOST_FIXTURE_TEST_CASE(blockindex_memory_stats, TestChain100Setup)
+{
+    BlockIndexMemoryStats stats = GetBlockIndexMemoryStats();
+    BOOST_CHECK_EQUAL(stats.nEntries, 101U);
+    BOOST_CHECK(stats.nArenaBytes >= stats.nEntries * sizeof(CBlockIndex));
+    BOOST_CHECK(stats.nMapBytes >= stats.nEntries * sizeof(uint256));
+    // The groups of members cover the whole entry, so there is no padding
+    BOOST_CHECK_EQUAL(stats.nHeaderBytes + stats.nLinkBytes + stats.nChainWorkBytes + stats.nPositionBytes + stats.nCounterBytes,
+                      stats.nEntries * sizeof(CBlockIndex));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,110 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <miner.h>
+#include <script/standard.h>
+#include <txmempool.h>
+#include <validation.h>
+#include <validationinterface.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blocktemplatecache_tests, TestChain100Setup)
+
+namespace {
+CMutableTransaction Spend(const CTransaction& txPrev, const CKey& key, const CScript& scriptPubKey, CAmount nValue)
+{
+    CMutableTransaction tx;
+    tx.nVersion = 1;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nValue;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(txPrev.vout[0].scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return tx;
+}
+
+bool ToMemPool(const CMutableTransaction& tx)
+{
+    LOCK(cs_main);
+    CValidationState state;
+    return AcceptToMemoryPool(mempool, state, MakeTransactionRef(tx), nullptr, nullptr, true, 0);
+}
+
+/** Check that the cached template is valid and selects what a full selection selects */
+void CheckTemplate(BlockTemplateCache& cache)
+{
+    LOCK(cs_main);
+    std::unique_ptr<CBlockTemplate> pblocktemplate = cache.GetTemplate(true);
+    BOOST_REQUIRE(pblocktemplate);
+    std::unique_ptr<CBlockTemplate> pblocktemplateFull = BlockAssembler(Params()).CreateNewBlock(CScript() << OP_TRUE, true);
+
+    const CBlock& block = pblocktemplate->block;
+    BOOST_CHECK_EQUAL(block.hashPrevBlock, chainActive.Tip()->GetBlockHash());
+    BOOST_REQUIRE_EQUAL(block.vtx.size(), pblocktemplateFull->block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        BOOST_CHECK_EQUAL(block.vtx[i]->GetHash(), pblocktemplateFull->block.vtx[i]->GetHash());
+        BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[i], pblocktemplateFull->vTxFees[i]);
+        BOOST_CHECK_EQUAL(pblocktemplate->vTxSigOpsCost[i], pblocktemplateFull->vTxSigOpsCost[i]);
+    }
+
+    CValidationState state;
+    BOOST_CHECK(TestBlockValidity(state, Params(), block, chainActive.Tip(), false, false));
+}
+} // namespace
+
+BOOST_AUTO_TEST_CASE(blocktemplatecache_updates)
+{
+    BlockTemplateCache cache(Params());
+    RegisterValidationInterface(&cache);
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // Mature the second coinbase
+    CreateAndProcessBlock({}, scriptPubKey);
+    CheckTemplate(cache);
+
+    // Transactions entering the mempool are appended, children after their parents
+    CMutableTransaction tx1 = Spend(coinbaseTxns[0], coinbaseKey, scriptPubKey, 49 * COIN);
+    CMutableTransaction tx2 = Spend(tx1, coinbaseKey, scriptPubKey, 48 * COIN);
+    CMutableTransaction tx3 = Spend(coinbaseTxns[1], coinbaseKey, scriptPubKey, 45 * COIN);
+    BOOST_REQUIRE(ToMemPool(tx1));
+    BOOST_REQUIRE(ToMemPool(tx2));
+    SyncWithValidationInterfaceQueue();
+    CheckTemplate(cache);
+    BOOST_REQUIRE(ToMemPool(tx3));
+    SyncWithValidationInterfaceQueue();
+    {
+        LOCK(cs_main);
+        std::unique_ptr<CBlockTemplate> pblocktemplate = cache.GetTemplate(true);
+        BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 4U);
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[3]->GetHash(), tx3.GetHash());
+        BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -7 * COIN);
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0]->GetValueOut(), 7 * COIN + GetBlockSubsidy(chainActive.Height() + 1, Params().GetConsensus()));
+    }
+
+    // Transactions that leave the mempool leave the template with their descendants
+    {
+        LOCK(mempool.cs);
+        mempool.removeRecursive(tx1, MemPoolRemovalReason::REPLACED);
+    }
+    CheckTemplate(cache);
+
+    // A new tip gets a new template
+    CreateAndProcessBlock({}, scriptPubKey);
+    SyncWithValidationInterfaceQueue();
+    CheckTemplate(cache);
+
+    UnregisterValidationInterface(&cache);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
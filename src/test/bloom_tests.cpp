@@ -467,6 +467,12 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     // last-100-entry, 1% false positive:
     CRollingBloomFilter rb1(100, 0.01);
 
+    // Nothing is allocated until the first insert
+    BOOST_CHECK_EQUAL(rb1.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK(!rb1.contains(RandomData()));
+    rb1.reset();
+    BOOST_CHECK_EQUAL(rb1.DynamicMemoryUsage(), 0U);
+
     // Overfill:
     static const int DATASIZE=399;
     std::vector<unsigned char> data[DATASIZE];
@@ -474,6 +480,7 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
         data[i] = RandomData();
         rb1.insert(data[i]);
     }
+    BOOST_CHECK(rb1.DynamicMemoryUsage() > 0);
     // Last 100 guaranteed to be remembered:
     for (int i = 299; i < DATASIZE; i++) {
         BOOST_CHECK(rb1.contains(data[i]));
@@ -536,4 +543,31 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     }
 }
 
+BOOST_AUTO_TEST_CASE(rolling_bloom_batch)
+{
+    CRollingBloomFilter rb(1000, 0.001);
+    std::vector<uint256> vHashes;
+    for (int i = 0; i < 203; i++) {
+        vHashes.push_back(InsecureRand256());
+        if (i % 2 == 0) {
+            // Both forms of a hash are the same element
+            if (i % 4 == 0) {
+                rb.insert(vHashes.back());
+            } else {
+                rb.insert(std::vector<unsigned char>(vHashes.back().begin(), vHashes.back().end()));
+            }
+        }
+    }
+
+    std::vector<bool> vContained = rb.contains(vHashes);
+    BOOST_CHECK_EQUAL(vContained.size(), vHashes.size());
+    for (size_t i = 0; i < vHashes.size(); i++) {
+        BOOST_CHECK_EQUAL(vContained[i], rb.contains(vHashes[i]));
+        BOOST_CHECK_EQUAL(rb.contains(vHashes[i]), rb.contains(std::vector<unsigned char>(vHashes[i].begin(), vHashes[i].end())));
+        if (i % 2 == 0)
+            BOOST_CHECK(vContained[i]);
+    }
+    BOOST_CHECK(rb.contains(std::vector<uint256>()).empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -146,9 +146,9 @@ typedef CCheckQueue<FrozenCleanupCheck> FrozenCleanup_Queue;
 /** This test case checks that the CCheckQueue works properly
  * with each specified size_t Checks pushed.
  */
-void Correct_Queue_range(std::vector<size_t> range)
+void Correct_Queue_range(std::vector<size_t> range, bool fWorkStealing = false)
 {
-    auto small_queue = std::unique_ptr<Correct_Queue>(new Correct_Queue {QUEUE_BATCH_SIZE});
+    auto small_queue = std::unique_ptr<Correct_Queue>(new Correct_Queue {QUEUE_BATCH_SIZE, fWorkStealing});
     boost::thread_group tg;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
        tg.create_thread([&]{small_queue->Thread();});
@@ -209,6 +209,45 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Correct_Random)
     Correct_Queue_range(range);
 }
 
+/** Test that random numbers of checks are correct with the work-stealing scheduler
+ */
+BOOST_AUTO_TEST_CASE(test_CheckQueue_WorkStealing_Correct_Random)
+{
+    std::vector<size_t> range;
+    range.reserve(100000/1000);
+    for (size_t i = 2; i < 100000; i += std::max((size_t)1, (size_t)InsecureRandRange(std::min((size_t)1000, ((size_t)100000) - i))))
+        range.push_back(i);
+    range.push_back(0);
+    range.push_back(1);
+    Correct_Queue_range(range, true);
+}
+
+// Test that failures are caught, and cleared for future blocks, with the
+// work-stealing scheduler.
+BOOST_AUTO_TEST_CASE(test_CheckQueue_WorkStealing_Recovers_From_Failure)
+{
+    auto fail_queue = std::unique_ptr<Failing_Queue>(new Failing_Queue {QUEUE_BATCH_SIZE, true});
+    boost::thread_group tg;
+    for (auto x = 0; x < nScriptCheckThreads; ++x) {
+       tg.create_thread([&]{fail_queue->Thread();});
+    }
+
+    for (auto times = 0; times < 100; ++times) {
+        for (bool end_fails : {true, false}) {
+            CCheckQueueControl<FailingCheck> control(fail_queue.get());
+            for (int batch = 0; batch < 10; ++batch) {
+                std::vector<FailingCheck> vChecks;
+                vChecks.resize(10, false);
+                vChecks[9] = end_fails && batch == 9;
+                control.Add(vChecks);
+            }
+            bool r = control.Wait();
+            BOOST_REQUIRE(r != end_fails);
+        }
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
 
 /** Test that failing checks are caught */
 BOOST_AUTO_TEST_CASE(test_CheckQueue_Catches_Failure)
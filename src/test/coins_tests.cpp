@@ -4,6 +4,7 @@
 
 #include <coins.h>
 #include <script/standard.h>
+#include <txdb.h>
 #include <uint256.h>
 #include <undo.h>
 #include <utilstrencodings.h>
@@ -11,6 +12,7 @@
 #include <validation.h>
 #include <consensus/validation.h>
 
+#include <algorithm>
 #include <vector>
 #include <map>
 
@@ -52,7 +54,7 @@ public:
 
     uint256 GetBestBlock() const override { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase = true) override
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
@@ -63,7 +65,11 @@ public:
                     map_.erase(it->first);
                 }
             }
-            mapCoins.erase(it++);
+            if (fErase) {
+                it = mapCoins.erase(it);
+            } else {
+                ++it;
+            }
         }
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
@@ -855,4 +861,234 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_prefetch)
+{
+    CCoinsViewTest base;
+    CCoinsViewPrefetch prefetch(&base, &base);
+    COutPoint outpoint1(InsecureRand256(), 0), outpoint2(InsecureRand256(), 1), outpoint3(InsecureRand256(), 2);
+    Coin coin1(CTxOut(1, CScript() << OP_TRUE), 1, false), coin2(CTxOut(2, CScript() << OP_TRUE), 2, true);
+    {
+        CCoinsViewCacheTest cache(&base);
+        cache.AddCoin(outpoint1, Coin(coin1), false);
+        cache.AddCoin(outpoint2, Coin(coin2), false);
+        cache.Flush();
+    }
+
+    uint64_t hits, misses;
+    CCoinsViewCacheTest tip(&prefetch);
+    prefetch.Fetch(outpoint1);
+    prefetch.Fetch(outpoint2);
+    prefetch.Fetch(outpoint3);
+    BOOST_CHECK(prefetch.DynamicMemoryUsage() > 0);
+    BOOST_CHECK(tip.AccessCoin(outpoint1) == coin1);
+    BOOST_CHECK(!tip.HaveCoin(outpoint3));
+    prefetch.GetStats(hits, misses);
+    BOOST_CHECK_EQUAL(hits, 1U);
+    BOOST_CHECK_EQUAL(misses, 1U);
+
+    // Writing through the prefetching view discards the coins fetched so far.
+    tip.SpendCoin(outpoint1);
+    tip.Flush();
+    BOOST_CHECK(!tip.HaveCoin(outpoint1));
+    BOOST_CHECK(tip.AccessCoin(outpoint2) == coin2);
+    prefetch.GetStats(hits, misses);
+    BOOST_CHECK_EQUAL(hits, 1U);
+    BOOST_CHECK_EQUAL(misses, 3U);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_fetch)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    std::vector<COutPoint> outpoints;
+    {
+        CCoinsViewCacheTest cache(&db);
+        for (uint32_t i = 0; i < 10; i++) {
+            outpoints.emplace_back(InsecureRand256(), i);
+            cache.AddCoin(outpoints.back(), Coin(CTxOut(i + 1, CScript() << OP_TRUE), i + 1, false), false);
+        }
+        cache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // Missing coins are looked up together, and unknown ones are not cached.
+    CCoinsViewCacheTest tip(&db);
+    BOOST_CHECK(tip.AccessCoin(outpoints[0]).nHeight == 1);
+    CMutableTransaction mtx;
+    mtx.vin.emplace_back(outpoints[0]);
+    mtx.vin.emplace_back(outpoints[1]);
+    mtx.vin.emplace_back(outpoints[2]);
+    mtx.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+    mtx.vout.emplace_back(1, CScript() << OP_TRUE);
+    CTransaction tx(mtx);
+    BOOST_CHECK_EQUAL(tip.FetchInputs(tx), 2U);
+    BOOST_CHECK_EQUAL(tip.GetCacheSize(), 3U);
+    BOOST_CHECK_EQUAL(tip.FetchInputs(tx), 0U);
+    tip.SelfTest();
+    BOOST_CHECK(tip.AccessCoin(outpoints[2]).nHeight == 3);
+
+    // A block skips the coinbase and outputs created within it.
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.emplace_back(COutPoint());
+    coinbase.vout.emplace_back(50, CScript() << OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    CMutableTransaction spend;
+    spend.vin.emplace_back(outpoints[3]);
+    spend.vin.emplace_back(COutPoint(block.vtx[0]->GetHash(), 0));
+    spend.vout.emplace_back(1, CScript() << OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(spend));
+    CMutableTransaction child;
+    child.vin.emplace_back(block.vtx[1]->GetHash(), 0);
+    child.vin.emplace_back(outpoints[4]);
+    block.vtx.push_back(MakeTransactionRef(child));
+    BOOST_CHECK_EQUAL(tip.FetchInputs(block), 2U);
+    BOOST_CHECK_EQUAL(tip.GetCacheSize(), 5U);
+
+    // Batched lookups through a stack of caches give the same coins as single ones.
+    CCoinsViewCacheTest child_cache(&tip);
+    std::vector<Coin> coins;
+    BOOST_CHECK_EQUAL(child_cache.GetCoins({outpoints[9], COutPoint(), outpoints[0], outpoints[9]}, coins), 3U);
+    BOOST_CHECK_EQUAL(coins.size(), 4U);
+    BOOST_CHECK(coins[0].nHeight == 10 && coins[2].nHeight == 1 && coins[3] == coins[0]);
+    BOOST_CHECK(coins[1].IsSpent());
+    BOOST_CHECK(tip.HaveCoinInCache(outpoints[9]));
+    child_cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_sync_trim)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    std::vector<COutPoint> outpoints;
+    for (uint32_t height = 1; height <= 100; height++) {
+        outpoints.emplace_back(InsecureRand256(), height);
+        cache.AddCoin(outpoints.back(), Coin(CTxOut(height, CScript() << OP_TRUE), height, false), false);
+    }
+    cache.SpendCoin(outpoints[0]);
+    cache.SetBestBlock(InsecureRand256());
+
+    // Sync writes everything but keeps the unspent coins cached as unmodified.
+    BOOST_CHECK(cache.Sync());
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 99U);
+    for (const auto& entry : cache.map()) {
+        BOOST_CHECK_EQUAL(entry.second.flags, 0);
+    }
+    Coin coin;
+    BOOST_CHECK(!base.GetCoin(outpoints[0], coin));
+    BOOST_CHECK(base.GetCoin(outpoints[50], coin) && coin.nHeight == 51);
+    BOOST_CHECK_EQUAL(base.GetBestBlock(), cache.GetBestBlock());
+
+    // Trim evicts unmodified coins, the oldest first, never modified ones.
+    cache.SpendCoin(outpoints[1]);
+    size_t usage = cache.DynamicMemoryUsage();
+    BOOST_CHECK_EQUAL(cache.Trim(usage), 0U);
+    BOOST_CHECK(cache.Trim(usage / 2) > 0);
+    cache.SelfTest();
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= usage / 2);
+    BOOST_CHECK(cache.HaveCoinInCache(outpoints[99]));
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoints[2]));
+    BOOST_CHECK(cache.map().count(outpoints[1]));
+    BOOST_CHECK(cache.Trim(0) > 0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK(cache.map().count(outpoints[1]));
+
+    // Evicted coins are read back from the base.
+    BOOST_CHECK(cache.AccessCoin(outpoints[2]).nHeight == 3);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_cached_outpoints)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    std::vector<COutPoint> outpoints;
+    for (uint32_t i = 0; i < 50; i++) {
+        outpoints.emplace_back(InsecureRand256(), i);
+        cache.AddCoin(outpoints.back(), Coin(CTxOut(i + 1, CScript() << OP_TRUE), 1 + InsecureRandRange(10), false), false);
+    }
+    cache.SpendCoin(outpoints[0]);
+
+    // Spent coins are left out, and the youngest coins come first.
+    std::vector<COutPoint> cached = cache.GetCachedOutpoints();
+    BOOST_CHECK_EQUAL(cached.size(), 49U);
+    BOOST_CHECK(std::find(cached.begin(), cached.end(), outpoints[0]) == cached.end());
+    for (size_t i = 1; i < cached.size(); i++) {
+        BOOST_CHECK(cache.AccessCoin(cached[i - 1]).nHeight >= cache.AccessCoin(cached[i]).nHeight);
+    }
+    for (size_t i = 1; i < outpoints.size(); i++) {
+        BOOST_CHECK(std::find(cached.begin(), cached.end(), outpoints[i]) != cached.end());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_journal)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    std::vector<COutPoint> outpoints;
+    for (uint32_t i = 0; i < 40; i++) {
+        outpoints.emplace_back(InsecureRand256(), i);
+        cache.AddCoin(outpoints.back(), Coin(CTxOut(i + 1, CScript() << OP_TRUE), 1 + i / 20, false), false);
+        // The first half of the coins is in the base and unmodified in the cache, the second FRESH.
+        if (i == 19) {
+            cache.SetBestBlock(InsecureRand256());
+            BOOST_CHECK(cache.Sync());
+        }
+    }
+    cache.Uncache(outpoints[0]);
+    const uint256 best_block = cache.GetBestBlock();
+    const size_t usage = cache.DynamicMemoryUsage();
+    std::map<COutPoint, std::pair<Coin, unsigned char>> entries;
+    for (const auto& entry : cache.map()) {
+        entries[entry.first] = std::make_pair(entry.second.coin, entry.second.flags);
+    }
+
+    // Load a coin from the base, spend every third coin and add back the even ones, add new coins.
+    auto connect = [&]() {
+        BOOST_CHECK(cache.HaveCoin(outpoints[0]));
+        for (size_t i = 0; i < outpoints.size(); i += 3) {
+            Coin coin;
+            BOOST_CHECK(cache.SpendCoin(outpoints[i], &coin));
+            if (i % 2 == 0) cache.AddCoin(outpoints[i], std::move(coin), false);
+        }
+        for (uint32_t i = 0; i < 5; i++) {
+            cache.AddCoin(COutPoint(InsecureRand256(), i), Coin(CTxOut(1, CScript() << OP_TRUE), 3, false), false);
+        }
+        cache.SetBestBlock(InsecureRand256());
+        cache.SelfTest();
+    };
+
+    // Without a commit the changes are undone, but the coin loaded from the base stays cached.
+    {
+        CCoinsViewCacheJournal journal(cache);
+        BOOST_CHECK(cache.HasJournal());
+        connect();
+    }
+    BOOST_CHECK(!cache.HasJournal());
+    cache.SelfTest();
+    BOOST_CHECK(cache.GetBestBlock() == best_block);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), entries.size() + 1);
+    BOOST_CHECK(cache.DynamicMemoryUsage() > usage);
+    for (const auto& entry : entries) {
+        CCoinsMap::const_iterator it = cache.map().find(entry.first);
+        BOOST_CHECK(it != cache.map().end() && it->second.coin == entry.second.first && it->second.flags == entry.second.second);
+    }
+    BOOST_CHECK(cache.map().at(outpoints[0]).flags == 0);
+
+    // A committed journal keeps them.
+    {
+        CCoinsViewCacheJournal journal(cache);
+        connect();
+        journal.Commit();
+    }
+    BOOST_CHECK(!cache.HasJournal());
+    cache.SelfTest();
+    BOOST_CHECK(cache.GetBestBlock() != best_block);
+    // The spent coins of the base are kept as modified entries, the FRESH ones are gone.
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), entries.size() + 1 - 4 + 5);
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoints[3]) && cache.map().count(outpoints[3]));
+    BOOST_CHECK(!cache.map().count(outpoints[21]));
+    BOOST_CHECK(cache.HaveCoinInCache(outpoints[0]) && cache.HaveCoinInCache(outpoints[24]));
+    BOOST_CHECK(cache.Sync());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
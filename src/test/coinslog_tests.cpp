@@ -0,0 +1,183 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coins.h>
+#include <coinslog.h>
+#include <coinstats.h>
+#include <fs.h>
+#include <test/test_bitcoin.h>
+
+#include <map>
+#include <memory>
+#include <stdio.h>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinslog_tests, BasicTestingSetup)
+
+namespace {
+bool SameCoin(const Coin& a, const Coin& b)
+{
+    return a.out == b.out && a.nHeight == b.nHeight && a.fCoinBase == b.fCoinBase;
+}
+
+/** Writes coins through a CCoinsViewLog and keeps what it should hold */
+struct LogTest {
+    fs::path dir = fs::temp_directory_path() / fs::unique_path();
+    std::unique_ptr<CCoinsViewLog> log;
+    std::map<COutPoint, Coin> coins;
+    uint256 best_block;
+
+    LogTest() { Reopen(); }
+    ~LogTest()
+    {
+        log.reset();
+        fs::remove_all(dir);
+    }
+
+    void Reopen()
+    {
+        log.reset();
+        log.reset(new CCoinsViewLog(dir));
+    }
+
+    //! Add n coins and spend every spend_every-th coin held so far
+    void Write(int n, int spend_every = 0)
+    {
+        CCoinsMap map;
+        int i = 0;
+        for (auto it = coins.begin(); spend_every && it != coins.end(); i++) {
+            if (i % spend_every == 0) {
+                map[it->first].flags = CCoinsCacheEntry::DIRTY;
+                it = coins.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        for (int j = 0; j < n; j++) {
+            const COutPoint outpoint(InsecureRand256(), InsecureRandRange(4));
+            const Coin coin(CTxOut(InsecureRandRange(1000000), CScript() << OP_TRUE << insecure_rand_ctx.randbytes(InsecureRandRange(40))), 1 + InsecureRandRange(1000), InsecureRandBool());
+            CCoinsCacheEntry& entry = map[outpoint];
+            entry.coin = coin;
+            entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+            coins[outpoint] = coin;
+        }
+        best_block = InsecureRand256();
+        BOOST_CHECK(log->BatchWrite(map, best_block));
+        BOOST_CHECK(map.empty());
+    }
+
+    void Check()
+    {
+        BOOST_CHECK(log->GetBestBlock() == best_block);
+        BOOST_CHECK(log->GetHeadBlocks().empty());
+        Coin coin;
+        for (const auto& entry : coins) {
+            BOOST_CHECK(log->HaveCoin(entry.first));
+            BOOST_CHECK(log->GetCoin(entry.first, coin));
+            BOOST_CHECK(SameCoin(coin, entry.second));
+        }
+        BOOST_CHECK(!log->HaveCoin(COutPoint(InsecureRand256(), 0)));
+
+        // The cursor sees every coin, in the order of the outpoints
+        std::unique_ptr<CCoinsViewCursor> cursor(log->Cursor());
+        BOOST_CHECK(cursor->GetBestBlock() == best_block);
+        auto it = coins.begin();
+        for (; cursor->Valid(); cursor->Next(), ++it) {
+            COutPoint key;
+            BOOST_CHECK(it != coins.end());
+            BOOST_CHECK(cursor->GetKey(key) && key == it->first);
+            BOOST_CHECK(cursor->GetValue(coin) && SameCoin(coin, it->second));
+        }
+        BOOST_CHECK(it == coins.end());
+    }
+};
+} // namespace
+
+BOOST_AUTO_TEST_CASE(coinslog_write_read)
+{
+    LogTest test;
+    BOOST_CHECK(test.log->GetBestBlock().IsNull());
+    test.Write(200);
+    test.Check();
+    test.Write(100, 3);
+    test.Check();
+
+    // GetCoins finds the coins which exist, in the order asked for
+    std::vector<COutPoint> outpoints{test.coins.begin()->first, COutPoint(InsecureRand256(), 1), test.coins.rbegin()->first};
+    std::vector<Coin> coins;
+    BOOST_CHECK_EQUAL(test.log->GetCoins(outpoints, coins), 2U);
+    BOOST_CHECK(SameCoin(coins[0], test.coins.begin()->second));
+    BOOST_CHECK(coins[1].IsSpent());
+    BOOST_CHECK(SameCoin(coins[2], test.coins.rbegin()->second));
+
+    // A cursor starting in the middle
+    const COutPoint middle = std::next(test.coins.begin(), test.coins.size() / 2)->first;
+    std::unique_ptr<CCoinsViewCursor> cursor(test.log->Cursor(middle));
+    COutPoint key;
+    BOOST_CHECK(cursor->GetKey(key) && key == middle);
+
+    test.Reopen();
+    test.Check();
+}
+
+BOOST_AUTO_TEST_CASE(coinslog_incomplete_batch)
+{
+    LogTest test;
+    test.Write(100);
+    const uint64_t nSize = fs::file_size(test.dir / COINS_LOG_FILENAME);
+    test.log.reset();
+
+    // A batch cut off before its commit record is discarded
+    FILE* file = fsbridge::fopen(test.dir / COINS_LOG_FILENAME, "ab");
+    BOOST_REQUIRE(file);
+    const std::vector<unsigned char> garbage = insecure_rand_ctx.randbytes(1000);
+    fwrite(garbage.data(), 1, garbage.size(), file);
+    fclose(file);
+    test.Reopen();
+    test.Check();
+    BOOST_CHECK_EQUAL(fs::file_size(test.dir / COINS_LOG_FILENAME), nSize);
+
+    // and the log goes on from the last complete one
+    test.Write(50, 2);
+    test.Reopen();
+    test.Check();
+}
+
+BOOST_AUTO_TEST_CASE(coinslog_compact)
+{
+    LogTest test;
+    test.Write(500);
+    CIncrementalCoinsStats stats;
+    stats.nTransactionOutputs = 1234;
+    test.log->TrackCoinsStats(&stats);
+    for (int i = 0; i < 5; i++) {
+        stats.hashBlock = InsecureRand256();
+        test.Write(100, 2);
+        // BatchWrite only stores stats of the block it writes
+        BOOST_CHECK(!test.log->ReadCoinsStats(stats));
+    }
+    test.best_block = stats.hashBlock;
+    CCoinsMap empty;
+    BOOST_CHECK(test.log->BatchWrite(empty, stats.hashBlock));
+    BOOST_CHECK(test.log->GetDeadBytes() > 0);
+
+    const uint64_t nSize = test.log->EstimateSize();
+    const uint64_t nDead = test.log->GetDeadBytes();
+    BOOST_CHECK(test.log->Compact());
+    BOOST_CHECK(test.log->GetDeadBytes() < nDead);
+    BOOST_CHECK(test.log->EstimateSize() < nSize);
+    BOOST_CHECK_EQUAL(fs::file_size(test.dir / COINS_LOG_FILENAME), test.log->EstimateSize());
+    test.Check();
+
+    test.Reopen();
+    test.Check();
+    CIncrementalCoinsStats read;
+    BOOST_CHECK(test.log->ReadCoinsStats(read));
+    BOOST_CHECK(read.hashBlock == stats.hashBlock);
+    BOOST_CHECK_EQUAL(read.nTransactionOutputs, 1234U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <compressor.h>
+#include <streams.h>
 #include <util.h>
 #include <test/test_bitcoin.h>
 
@@ -62,4 +63,53 @@ BOOST_AUTO_TEST_CASE(compress_amounts)
         BOOST_CHECK(TestDecode(i));
 }
 
+static std::vector<unsigned char> CompressScript(const CScript& script, int nVersion, CScript& scriptOut)
+{
+    CDataStream ss(SER_DISK, nVersion);
+    CScript scriptIn = script;
+    ss << CScriptCompressor(scriptIn);
+    std::vector<unsigned char> vch(ss.begin(), ss.end());
+    scriptOut.clear();
+    ss >> REF(CScriptCompressor(scriptOut));
+    BOOST_CHECK(ss.empty());
+    return vch;
+}
+
+BOOST_AUTO_TEST_CASE(compress_script_witness_templates)
+{
+    const int nWitness = CLIENT_VERSION | SERIALIZE_SCRIPT_WITNESS_TEMPLATES;
+    const CScript p2wpkh = CScript() << OP_0 << std::vector<unsigned char>(20, 0xab);
+    const CScript p2wsh = CScript() << OP_0 << std::vector<unsigned char>(32, 0xcd);
+    const CScript p2pkh = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0x12) << OP_EQUALVERIFY << OP_CHECKSIG;
+    const CScript other = CScript() << OP_1 << std::vector<unsigned char>(32, 0xef);
+    CScript out;
+
+    // The original encoding stores native segwit outputs raw
+    std::vector<unsigned char> vch = CompressScript(p2wpkh, CLIENT_VERSION, out);
+    BOOST_CHECK(out == p2wpkh);
+    BOOST_CHECK_EQUAL(vch.size(), 23U);
+    BOOST_CHECK_EQUAL(vch[0], 6 + 22);
+    vch = CompressScript(p2wsh, CLIENT_VERSION, out);
+    BOOST_CHECK(out == p2wsh);
+    BOOST_CHECK_EQUAL(vch.size(), 35U);
+
+    // The extended templates encode them as their hashes
+    vch = CompressScript(p2wpkh, nWitness, out);
+    BOOST_CHECK(out == p2wpkh);
+    BOOST_CHECK_EQUAL(vch.size(), 21U);
+    BOOST_CHECK_EQUAL(vch[0], 0x06);
+    vch = CompressScript(p2wsh, nWitness, out);
+    BOOST_CHECK(out == p2wsh);
+    BOOST_CHECK_EQUAL(vch.size(), 33U);
+    BOOST_CHECK_EQUAL(vch[0], 0x07);
+
+    // The original templates encode the same, and other scripts stay raw
+    BOOST_CHECK(CompressScript(p2pkh, nWitness, out) == CompressScript(p2pkh, CLIENT_VERSION, out));
+    BOOST_CHECK(out == p2pkh);
+    vch = CompressScript(other, nWitness, out);
+    BOOST_CHECK(out == other);
+    BOOST_CHECK_EQUAL(vch.size(), 1 + other.size());
+    BOOST_CHECK_EQUAL(vch[0], 8 + other.size());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
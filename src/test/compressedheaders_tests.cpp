@@ -0,0 +1,105 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <compressedheaders.h>
+#include <random.h>
+#include <streams.h>
+#include <version.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(compressedheaders_tests, BasicTestingSetup)
+
+/** A chain of headers whose versions, bits and times vary like mainnet's */
+static std::vector<CBlockHeader> MakeChain(size_t nCount)
+{
+    FastRandomContext rng(true);
+    std::vector<CBlockHeader> headers;
+    CBlockHeader header;
+    header.nVersion = 0x20000000;
+    header.hashPrevBlock = rng.rand256();
+    header.nTime = 1500000000;
+    header.nBits = 0x1d00ffff;
+    for (size_t i = 0; i < nCount; i++) {
+        if (i > 0)
+            header.hashPrevBlock = headers.back().GetHash();
+        if (i % 10 == 0)
+            header.nVersion = 0x20000000 | (rng.randrange(12) << 1);
+        if (i % 500 == 0)
+            header.nBits = rng.rand32();
+        // Times are not monotonic
+        header.nTime += rng.randrange(1200) - 200;
+        header.hashMerkleRoot = rng.rand256();
+        header.nNonce = rng.rand32();
+        headers.push_back(header);
+    }
+    return headers;
+}
+
+static void CheckEqual(const std::vector<CBlockHeader>& a, const std::vector<CBlockHeader>& b)
+{
+    BOOST_REQUIRE_EQUAL(a.size(), b.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        BOOST_CHECK(a[i].GetHash() == b[i].GetHash());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(compressedheaders_roundtrip)
+{
+    const std::vector<CBlockHeader> headers = MakeChain(2000);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CCompressedHeaders(headers);
+    // Versus 81 bytes each in a "headers" message
+    BOOST_CHECK_LT(ss.size(), headers.size() * 42);
+
+    CCompressedHeaders decoded;
+    ss >> decoded;
+    BOOST_CHECK(ss.empty());
+    CheckEqual(decoded.headers, headers);
+
+    // Headers that do not connect, and an empty list, survive as well
+    std::vector<CBlockHeader> unconnected = MakeChain(20);
+    unconnected[7].hashPrevBlock = uint256S("0x01");
+    unconnected[8].nTime = 0;
+    unconnected[9].nTime = 0xffffffff;
+    for (const std::vector<CBlockHeader>& list : {unconnected, std::vector<CBlockHeader>()}) {
+        ss << CCompressedHeaders(list);
+        ss >> decoded;
+        CheckEqual(decoded.headers, list);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(compressedheaders_invalid)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CCompressedHeaders(MakeChain(3));
+    const std::string good = ss.str();
+    // Offsets of the flags of the first header, and of the second one
+    CDataStream one(SER_NETWORK, PROTOCOL_VERSION);
+    one << CCompressedHeaders(MakeChain(1));
+    const size_t nFirstFlags = 1;
+    const size_t nSecondFlags = one.size();
+
+    CCompressedHeaders decoded;
+    BOOST_CHECK_NO_THROW(CDataStream(good.data(), good.data() + good.size(), SER_NETWORK, PROTOCOL_VERSION) >> decoded);
+
+    // The first header must carry its previous hash and bits
+    std::string bad = good;
+    bad[nFirstFlags] &= ~0x10;
+    BOOST_CHECK_THROW(CDataStream(bad.data(), bad.data() + bad.size(), SER_NETWORK, PROTOCOL_VERSION) >> decoded, std::ios_base::failure);
+    // Unknown flags
+    bad = good;
+    bad[nSecondFlags] |= 0x80;
+    BOOST_CHECK_THROW(CDataStream(bad.data(), bad.data() + bad.size(), SER_NETWORK, PROTOCOL_VERSION) >> decoded, std::ios_base::failure);
+    // A version that was never sent
+    bad = good;
+    bad[nSecondFlags] = (bad[nSecondFlags] & ~0x07) | 0x03;
+    BOOST_CHECK_THROW(CDataStream(bad.data(), bad.data() + bad.size(), SER_NETWORK, PROTOCOL_VERSION) >> decoded, std::ios_base::failure);
+    // Truncated
+    bad = good.substr(0, good.size() - 1);
+    BOOST_CHECK_THROW(CDataStream(bad.data(), bad.data() + bad.size(), SER_NETWORK, PROTOCOL_VERSION) >> decoded, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -10,7 +10,10 @@
 #include <crypto/sha512.h>
 #include <crypto/hmac_sha256.h>
 #include <crypto/hmac_sha512.h>
+#include <crypto/muhash.h>
+#include <hash.h>
 #include <random.h>
+#include <streams.h>
 #include <utilstrencodings.h>
 #include <test/test_bitcoin.h>
 
@@ -524,6 +527,46 @@ BOOST_AUTO_TEST_CASE(chacha20_testvector)
                  "fab78c9");
 }
 
+BOOST_AUTO_TEST_CASE(chacha20_multiblock)
+{
+    // Output of several blocks at once must match that of one block at a
+    // time, including across the 32-bit boundary of the block counter
+    FastRandomContext ctx(true);
+    for (uint64_t seek : {(uint64_t)0, (uint64_t)0xfffffffd, (uint64_t)0xffffffff}) {
+        for (size_t len : {64, 255, 256, 257, 1000, 1024}) {
+            const std::vector<unsigned char> key = ctx.randbytes(32);
+            ChaCha20 rng(key.data(), key.size());
+            rng.SetIV(ctx.rand64());
+            rng.Seek(seek);
+            std::vector<unsigned char> out(len);
+            rng.Output(out.data(), out.size());
+
+            std::vector<unsigned char> expected(len);
+            for (size_t pos = 0; pos < len; pos += 64) {
+                rng.Seek(seek + pos / 64);
+                rng.Output(expected.data() + pos, std::min<size_t>(64, len - pos));
+            }
+            BOOST_CHECK(out == expected);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j) {
+            in[j] = InsecureRandBits(8);
+        }
+        for (int j = 0; j < i; ++j) {
+            CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+        }
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(countbits_tests)
 {
     FastRandomContext ctx;
@@ -546,4 +589,79 @@ BOOST_AUTO_TEST_CASE(countbits_tests)
     }
 }
 
+static uint256 MuHashFinalize(MuHash3072 muhash)
+{
+    uint256 out;
+    muhash.Finalize(out.begin());
+    return out;
+}
+
+BOOST_AUTO_TEST_CASE(muhash_num3072_tests)
+{
+    // p - 1 is its own inverse.
+    unsigned char data[Num3072::BYTE_SIZE];
+    memset(data, 0xff, sizeof(data));
+    WriteLE32(data, 0xffffffff - 1103717);
+    Num3072 minus_one(data);
+    Num3072 x = minus_one;
+    x.Multiply(minus_one);
+    BOOST_CHECK(x.IsOne());
+
+    // The modulus itself reduces to zero, and 2^3072 - 1 to MAX_PRIME_DIFF - 1.
+    WriteLE32(data, 0xffffffff - 1103717 + 1);
+    unsigned char reduced[Num3072::BYTE_SIZE];
+    Num3072(data).ToBytes(reduced);
+    BOOST_CHECK_EQUAL(HexStr(reduced, reduced + sizeof(reduced)), std::string(2 * sizeof(reduced), '0'));
+    WriteLE32(data, 0xffffffff);
+    Num3072(data).ToBytes(reduced);
+    BOOST_CHECK_EQUAL(ReadLE32(reduced), 1103716U);
+
+    // Division by a random value is undone by multiplication.
+    FastRandomContext ctx;
+    for (unsigned int i = 0; i < sizeof(data); ++i) data[i] = ctx.randbits(8);
+    Num3072 r(data), y;
+    y.Divide(r);
+    y.Multiply(r);
+    BOOST_CHECK(y.IsOne());
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    const std::vector<unsigned char> a = ParseHex("00"), b = ParseHex("01"), c = ParseHex("0102");
+
+    // The empty set does not depend on how it was reached.
+    MuHash3072 empty, emptied;
+    emptied.Insert(a.data(), a.size()).Insert(b.data(), b.size()).Remove(a.data(), a.size()).Remove(b.data(), b.size());
+    BOOST_CHECK(MuHashFinalize(empty) == MuHashFinalize(emptied));
+
+    // Insertion is commutative, and removal undoes an insertion in any order.
+    MuHash3072 abc, cba, ac;
+    abc.Insert(a.data(), a.size()).Insert(b.data(), b.size()).Insert(c.data(), c.size());
+    cba.Insert(c.data(), c.size()).Insert(b.data(), b.size()).Insert(a.data(), a.size());
+    ac.Remove(b.data(), b.size()).Insert(c.data(), c.size()).Insert(b.data(), b.size()).Insert(a.data(), a.size());
+    BOOST_CHECK(MuHashFinalize(abc) == MuHashFinalize(cba));
+    BOOST_CHECK(MuHashFinalize(abc) != MuHashFinalize(empty));
+    cba.Remove(b.data(), b.size());
+    BOOST_CHECK(MuHashFinalize(cba) == MuHashFinalize(ac));
+    BOOST_CHECK(MuHashFinalize(cba) != MuHashFinalize(abc));
+
+    // Sets combine by multiplication and division.
+    MuHash3072 combined(a.data(), a.size());
+    combined *= MuHash3072(c.data(), c.size());
+    BOOST_CHECK(MuHashFinalize(combined) == MuHashFinalize(ac));
+    combined /= MuHash3072(a.data(), a.size());
+    BOOST_CHECK(MuHashFinalize(combined) == MuHashFinalize(MuHash3072(c.data(), c.size())));
+
+    // Serialization keeps the numerator and denominator apart.
+    CDataStream ss(SER_DISK, 0);
+    ss << ac;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * Num3072::BYTE_SIZE);
+    MuHash3072 ac2;
+    ss >> ac2;
+    BOOST_CHECK(MuHashFinalize(ac2) == MuHashFinalize(ac));
+    ac2.Insert(b.data(), b.size());
+    ac.Insert(b.data(), b.size());
+    BOOST_CHECK(MuHashFinalize(ac2) == MuHashFinalize(ac));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
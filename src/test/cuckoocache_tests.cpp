@@ -58,6 +58,33 @@ BOOST_AUTO_TEST_CASE(test_cuckoocache_no_fakes)
     }
 };
 
+/* Test that insert reports evictions once the cache is over capacity, and
+ * that setting the cache up again resizes it and drops its contents.
+ */
+BOOST_AUTO_TEST_CASE(test_cuckoocache_evict_and_resize)
+{
+    local_rand_ctx = FastRandomContext(true);
+    CuckooCache::cache<uint256, SignatureCacheHasher> cc{};
+    cc.setup(2);
+    std::vector<uint256> hashes(1 << 10);
+    uint32_t nEvicted = 0;
+    for (size_t i = 0; i < 16; ++i) {
+        insecure_GetRandHash(hashes[i]);
+        nEvicted += !cc.insert(hashes[i]);
+    }
+    BOOST_CHECK(nEvicted > 0);
+
+    BOOST_CHECK_EQUAL(cc.setup(1 << 12), 1u << 12);
+    for (size_t i = 0; i < 16; ++i)
+        BOOST_CHECK(!cc.contains(hashes[i], false));
+    for (uint256& h : hashes) {
+        insecure_GetRandHash(h);
+        BOOST_CHECK(cc.insert(h));
+    }
+    for (const uint256& h : hashes)
+        BOOST_CHECK(cc.contains(h, false));
+}
+
 /** This helper returns the hit rate when megabytes*load worth of entries are
  * inserted into a megabytes sized cache
  */
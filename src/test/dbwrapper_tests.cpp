@@ -42,6 +42,89 @@ BOOST_AUTO_TEST_CASE(dbwrapper)
     }
 }
 
+// Test reading many keys at once
+BOOST_AUTO_TEST_CASE(dbwrapper_readmany)
+{
+    // Perform tests both obfuscated and non-obfuscated.
+    for (bool obfuscate : {false, true}) {
+        fs::path ph = fs::temp_directory_path() / fs::unique_path();
+        CDBWrapper dbw(ph, (1 << 20), true, false, obfuscate);
+
+        // Write every other key of a range, plus one with a value of the wrong type.
+        std::map<uint32_t, uint256> written;
+        CDBBatch batch(dbw);
+        for (uint32_t i = 0; i < 100; i += 2) {
+            written[i] = InsecureRand256();
+            batch.Write(std::make_pair('k', i), written[i]);
+        }
+        batch.Write(std::make_pair('k', (uint32_t)101), 'x');
+        dbw.WriteBatch(batch);
+
+        // Ask in an unsorted order, with duplicates and keys past the end.
+        std::vector<std::pair<char, uint32_t>> keys;
+        for (uint32_t i = 0; i < 200; i++) {
+            keys.emplace_back('k', InsecureRandRange(120));
+        }
+        std::vector<uint256> values;
+        std::vector<bool> vfFound;
+        size_t nExpected = 0;
+        for (const auto& key : keys) nExpected += written.count(key.second);
+        keys.emplace_back('z', 0);
+        BOOST_CHECK_EQUAL(dbw.ReadMany(keys, values, vfFound), nExpected);
+        BOOST_CHECK_EQUAL(values.size(), keys.size());
+        BOOST_CHECK_EQUAL(vfFound.size(), keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            BOOST_CHECK_EQUAL(vfFound[i], keys[i].first == 'k' && written.count(keys[i].second) == 1);
+            if (vfFound[i]) {
+                BOOST_CHECK_EQUAL(values[i].ToString(), written[keys[i].second].ToString());
+                uint256 res;
+                BOOST_CHECK(dbw.Read(keys[i], res));
+                BOOST_CHECK(res == values[i]);
+            }
+        }
+
+        BOOST_CHECK_EQUAL(dbw.ReadMany(std::vector<std::pair<char, uint32_t>>(), values, vfFound), 0U);
+        BOOST_CHECK(values.empty() && vfFound.empty());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_profiles)
+{
+    DBOptions dboptions;
+    BOOST_CHECK(GetDBProfile(DEFAULT_DB_PROFILE, DBKind::CHAINSTATE, dboptions));
+    BOOST_CHECK_EQUAL(dboptions.max_open_files, DEFAULT_DB_OPTIONS.max_open_files);
+    BOOST_CHECK(!GetDBProfile("floppy", DBKind::CHAINSTATE, dboptions));
+    BOOST_CHECK(ListDBProfiles().find("lowmem") != std::string::npos);
+
+    // Every profile opens a working database, with the cache split as configured.
+    for (const std::string& profile : {"default", "ssd", "hdd", "lowmem"}) {
+        for (DBKind kind : {DBKind::CHAINSTATE, DBKind::BLOCK_INDEX}) {
+            BOOST_CHECK(GetDBProfile(profile, kind, dboptions));
+            fs::path ph = fs::temp_directory_path() / fs::unique_path();
+            CDBWrapper dbw(ph, (1 << 20), true, false, false, dboptions);
+            BOOST_CHECK_EQUAL(dbw.GetDBOptions().block_size, dboptions.block_size);
+            BOOST_CHECK_EQUAL(dbw.GetWriteBufferSize(), (1 << 20) * (size_t)dboptions.write_buffer_percent / 100);
+            BOOST_CHECK_EQUAL(dbw.GetBlockCacheSize() + 2 * dbw.GetWriteBufferSize(), (size_t)(1 << 20));
+            uint256 in = InsecureRand256(), res;
+            BOOST_CHECK(dbw.Write('k', in));
+            BOOST_CHECK(dbw.Read('k', res));
+            BOOST_CHECK(res == in);
+            BOOST_CHECK(!dbw.GetProperty("leveldb.stats").empty());
+            BOOST_CHECK(dbw.GetProperty("leveldb.nonexistent").empty());
+        }
+    }
+
+    // A database without a bloom filter.
+    dboptions = DEFAULT_DB_OPTIONS;
+    dboptions.filter_bits = 0;
+    fs::path ph = fs::temp_directory_path() / fs::unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true, false, false, dboptions);
+    uint256 res;
+    BOOST_CHECK(dbw.Write('k', uint256()));
+    BOOST_CHECK(dbw.Read('k', res));
+    BOOST_CHECK(!dbw.Read('l', res));
+}
+
 // Test batch operations
 BOOST_AUTO_TEST_CASE(dbwrapper_batch)
 {
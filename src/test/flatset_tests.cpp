@@ -0,0 +1,60 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <flatset.h>
+#include <memusage.h>
+#include <random.h>
+
+#include <test/test_bitcoin.h>
+
+#include <set>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(flatset_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(flatset_matches_set)
+{
+    FastRandomContext ctx(true);
+    std::set<uint32_t> real;
+    flatset<2, uint32_t> flat;
+
+    for (int i = 0; i < 10000; i++) {
+        uint32_t value = ctx.randrange(64);
+        switch (ctx.randrange(3)) {
+        case 0:
+            BOOST_CHECK_EQUAL(flat.insert(value).second, real.insert(value).second);
+            break;
+        case 1:
+            BOOST_CHECK_EQUAL(flat.erase(value), real.erase(value));
+            break;
+        case 2:
+            BOOST_CHECK_EQUAL(flat.count(value), real.count(value));
+            BOOST_CHECK((flat.find(value) == flat.end()) == (real.find(value) == real.end()));
+            break;
+        }
+        BOOST_CHECK_EQUAL(flat.size(), real.size());
+        BOOST_CHECK(flat.equals(real));
+        if (ctx.randrange(1000) == 0) {
+            flat.clear();
+            real.clear();
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(flatset_small_is_direct)
+{
+    flatset<2, uint32_t> flat;
+    flat.insert(2);
+    flat.insert(1);
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(flat), 0U);
+    BOOST_CHECK_EQUAL(*flat.begin(), 1U);
+
+    flat.insert(3);
+    BOOST_CHECK(memusage::DynamicUsage(flat) > 0);
+    BOOST_CHECK(!flat.insert(3).second);
+    BOOST_CHECK_EQUAL(flat.size(), 3U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -145,6 +145,22 @@ BOOST_AUTO_TEST_CASE(siphash)
         BOOST_CHECK_EQUAL(SipHashUint256(k1, k2, x), sip256.Finalize());
         BOOST_CHECK_EQUAL(SipHashUint256Extra(k1, k2, x, n), sip288.Finalize());
     }
+
+    // Check consistency between SipHashUint256 and SipHashUint256Lanes.
+    for (int i = 0; i < 16; ++i) {
+        uint64_t k1 = ctx.rand64();
+        uint64_t k2 = ctx.rand64();
+        uint256 x[SIPHASH_LANES];
+        const uint256* px[SIPHASH_LANES];
+        for (size_t l = 0; l < SIPHASH_LANES; l++) {
+            x[l] = InsecureRand256();
+            px[l] = &x[l];
+        }
+        uint64_t out[SIPHASH_LANES];
+        SipHashUint256Lanes(k1, k2, px, out);
+        for (size_t l = 0; l < SIPHASH_LANES; l++)
+            BOOST_CHECK_EQUAL(out[l], SipHashUint256(k1, k2, x[l]));
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -112,6 +112,19 @@ BOOST_AUTO_TEST_CASE(key_test1)
         BOOST_CHECK(!pubkey2C.Verify(hashMsg, sign1C));
         BOOST_CHECK( pubkey2C.Verify(hashMsg, sign2C));
 
+        // verification against decoded keys
+
+        CDecodedPubKey decoded1, decoded2C;
+        BOOST_CHECK(pubkey1.Decode(decoded1));
+        BOOST_CHECK(pubkey2C.Decode(decoded2C));
+
+        BOOST_CHECK( CPubKey::VerifyDecoded(hashMsg, sign1, decoded1));
+        BOOST_CHECK(!CPubKey::VerifyDecoded(hashMsg, sign2, decoded1));
+        BOOST_CHECK(!CPubKey::VerifyDecoded(hashMsg, sign1C, decoded2C));
+        BOOST_CHECK( CPubKey::VerifyDecoded(hashMsg, sign2C, decoded2C));
+
+        BOOST_CHECK(!CPubKey().Decode(decoded1));
+
         // compact signatures (with key recovery)
 
         std::vector<unsigned char> csign1, csign2, csign1C, csign2C;
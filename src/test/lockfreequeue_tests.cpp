@@ -0,0 +1,78 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <lockfreequeue.h>
+#include <test/test_bitcoin.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(lockfreequeue_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(lockfreequeue_bounds)
+{
+    CLockFreeQueue<std::string> queue(3);
+    BOOST_CHECK_EQUAL(queue.Capacity(), 4U);
+
+    std::string str;
+    BOOST_CHECK(!queue.TryPop(str));
+    // Around the ring a few times, filling it each time
+    for (int nLap = 0; nLap < 3; nLap++) {
+        for (int i = 0; i < 4; i++) {
+            str = std::to_string(i);
+            BOOST_CHECK(queue.TryPush(str));
+        }
+        str = "dropped";
+        BOOST_CHECK(!queue.TryPush(str));
+        BOOST_CHECK_EQUAL(str, "dropped");
+        for (int i = 0; i < 4; i++) {
+            BOOST_CHECK(queue.TryPop(str));
+            BOOST_CHECK_EQUAL(str, std::to_string(i));
+        }
+        BOOST_CHECK(!queue.TryPop(str));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(lockfreequeue_threads)
+{
+    const int nProducers = 4;
+    const int nPerProducer = 10000;
+    CLockFreeQueue<int> queue(64);
+    std::atomic<int> nDropped(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nProducers; t++) {
+        threads.emplace_back([&queue, &nDropped, t] {
+            for (int i = 0; i < nPerProducer; i++) {
+                int n = t * nPerProducer + i;
+                if (!queue.TryPush(n))
+                    nDropped++;
+            }
+        });
+    }
+
+    // Every value pushed comes out once, and those of one producer in order
+    std::vector<int> vLast(nProducers, -1);
+    int nPopped = 0;
+    int n;
+    auto Pop = [&] {
+        while (queue.TryPop(n)) {
+            int t = n / nPerProducer;
+            BOOST_CHECK(n % nPerProducer > vLast[t]);
+            vLast[t] = n % nPerProducer;
+            nPopped++;
+        }
+    };
+    while (nPopped + nDropped < nProducers * nPerProducer)
+        Pop();
+    for (std::thread& thread : threads)
+        thread.join();
+    Pop();
+    BOOST_CHECK_EQUAL(nPopped + nDropped, nProducers * nPerProducer);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
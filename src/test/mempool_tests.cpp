@@ -105,6 +105,125 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     BOOST_CHECK_EQUAL(testPool.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolRemoveForBlockTest)
+{
+    TestMemPoolEntryHelper entry;
+    // Parent transaction with three children, each with one grandchild
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(3);
+    for (int i = 0; i < 3; i++)
+    {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000LL;
+    }
+    CMutableTransaction txChild[3], txGrandChild[3];
+    for (int i = 0; i < 3; i++)
+    {
+        txChild[i].vin.resize(1);
+        txChild[i].vin[0].scriptSig = CScript() << OP_11;
+        txChild[i].vin[0].prevout = COutPoint(txParent.GetHash(), i);
+        txChild[i].vout.resize(1);
+        txChild[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild[i].vout[0].nValue = 11000LL;
+
+        txGrandChild[i].vin.resize(1);
+        txGrandChild[i].vin[0].scriptSig = CScript() << OP_11;
+        txGrandChild[i].vin[0].prevout = COutPoint(txChild[i].GetHash(), 0);
+        txGrandChild[i].vout.resize(1);
+        txGrandChild[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txGrandChild[i].vout[0].nValue = 11000LL;
+    }
+    // Spends the same output as Child[1]
+    CMutableTransaction txDoubleSpend = txChild[1];
+    txDoubleSpend.vin[0].scriptSig = CScript() << OP_12;
+
+    CTxMemPool testPool;
+    testPool.addUnchecked(txParent.GetHash(), entry.FromTx(txParent));
+    for (int i = 0; i < 3; i++)
+    {
+        testPool.addUnchecked(txChild[i].GetHash(), entry.FromTx(txChild[i]));
+        testPool.addUnchecked(txGrandChild[i].GetHash(), entry.FromTx(txGrandChild[i]));
+    }
+    testPool.PrioritiseTransaction(txParent.GetHash(), 1000);
+    testPool.PrioritiseTransaction(txChild[1].GetHash(), 1000);
+
+    // Parent and Child[0] confirm, Child[1] and its descendant conflict
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(txParent));
+    vtx.push_back(MakeTransactionRef(txChild[0]));
+    vtx.push_back(MakeTransactionRef(txDoubleSpend));
+    testPool.removeForBlock(vtx, 1);
+
+    BOOST_CHECK_EQUAL(testPool.size(), 3U);
+    BOOST_CHECK(testPool.exists(txGrandChild[0].GetHash()));
+    BOOST_CHECK(testPool.exists(txChild[2].GetHash()));
+    BOOST_CHECK(testPool.exists(txGrandChild[2].GetHash()));
+
+    // The entries left behind no longer count the removed ones
+    CTxMemPool::txiter it = testPool.mapTx.find(txGrandChild[0].GetHash());
+    BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), 1U);
+    BOOST_CHECK_EQUAL(it->GetSizeWithAncestors(), it->GetTxSize());
+    it = testPool.mapTx.find(txChild[2].GetHash());
+    BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), 1U);
+    BOOST_CHECK_EQUAL(it->GetCountWithDescendants(), 2U);
+    BOOST_CHECK(testPool.GetMemPoolParents(it).empty());
+    it = testPool.mapTx.find(txGrandChild[2].GetHash());
+    BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), 2U);
+
+    // Prioritisation of confirmed and conflicted transactions is dropped
+    CAmount delta = 0;
+    testPool.ApplyDelta(txParent.GetHash(), delta);
+    BOOST_CHECK_EQUAL(delta, 0);
+    testPool.ApplyDelta(txChild[1].GetHash(), delta);
+    BOOST_CHECK_EQUAL(delta, 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolChangesSinceTest)
+{
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.n = i;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10000LL;
+    }
+
+    CTxMemPool testPool;
+    const uint64_t nStart = testPool.GetSequence();
+    testPool.addUnchecked(tx[0].GetHash(), entry.FromTx(tx[0]));
+    testPool.addUnchecked(tx[1].GetHash(), entry.FromTx(tx[1]));
+    const uint64_t nMiddle = testPool.GetSequence();
+    BOOST_CHECK_EQUAL(nMiddle, nStart + 2);
+    testPool.removeRecursive(tx[0]);
+    testPool.addUnchecked(tx[2].GetHash(), entry.FromTx(tx[2]));
+
+    std::vector<std::pair<uint256, bool>> vChanges;
+    BOOST_CHECK(testPool.GetChangesSince(nMiddle, vChanges));
+    BOOST_CHECK_EQUAL(vChanges.size(), 2U);
+    BOOST_CHECK(vChanges[0] == std::make_pair(tx[0].GetHash(), false));
+    BOOST_CHECK(vChanges[1] == std::make_pair(tx[2].GetHash(), true));
+
+    vChanges.clear();
+    BOOST_CHECK(testPool.GetChangesSince(nStart, vChanges));
+    BOOST_CHECK_EQUAL(vChanges.size(), 4U);
+    BOOST_CHECK(vChanges[0] == std::make_pair(tx[0].GetHash(), true));
+
+    vChanges.clear();
+    BOOST_CHECK(testPool.GetChangesSince(testPool.GetSequence(), vChanges));
+    BOOST_CHECK(vChanges.empty());
+    BOOST_CHECK(!testPool.GetChangesSince(testPool.GetSequence() + 1, vChanges));
+
+    // After a clear the earlier changes are not known
+    testPool.clear();
+    BOOST_CHECK(!testPool.GetChangesSince(nMiddle, vChanges));
+    BOOST_CHECK(testPool.GetChangesSince(testPool.GetSequence(), vChanges));
+}
+
 template<typename name>
 void CheckSort(CTxMemPool &pool, std::vector<std::string> &sortedOrder)
 {
@@ -571,4 +690,115 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolTrimBatchTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    // Independent transactions with one cheap child each, so that both
+    // whole packages and lone children are up for eviction.
+    std::vector<CMutableTransaction> parents, children;
+    for (int i = 0; i < 20; i++) {
+        CMutableTransaction parent;
+        parent.vin.resize(1);
+        parent.vin[0].scriptSig = CScript() << i;
+        parent.vout.resize(1);
+        parent.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        parent.vout[0].nValue = 10 * COIN;
+        pool.addUnchecked(parent.GetHash(), entry.Fee(1000LL * (i + 1)).FromTx(parent));
+
+        CMutableTransaction child;
+        child.vin.resize(1);
+        child.vin[0].prevout = COutPoint(parent.GetHash(), 0);
+        child.vin[0].scriptSig = CScript() << OP_1;
+        child.vout.resize(1);
+        child.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+        child.vout[0].nValue = 10 * COIN;
+        pool.addUnchecked(child.GetHash(), entry.Fee(1000LL * (i % 3)).FromTx(child));
+
+        parents.push_back(parent);
+        children.push_back(child);
+    }
+
+    const size_t limit = pool.DynamicMemoryUsage() / 2;
+    std::vector<COutPoint> vNoSpendsRemaining;
+    pool.TrimToSize(limit, &vNoSpendsRemaining);
+    BOOST_CHECK(pool.DynamicMemoryUsage() <= limit);
+    BOOST_CHECK(pool.size() > 0);
+
+    // A child is never kept without its parent, and the cheapest package goes
+    // before the best-paying one.
+    unsigned int nRemoved = 0, nParentsRemoved = 0;
+    for (int i = 0; i < 20; i++) {
+        bool fParent = pool.exists(parents[i].GetHash());
+        bool fChild = pool.exists(children[i].GetHash());
+        BOOST_CHECK(fParent || !fChild);
+        nRemoved += !fParent + !fChild;
+        nParentsRemoved += !fParent;
+    }
+    BOOST_CHECK(!pool.exists(parents[0].GetHash()));
+    BOOST_CHECK(pool.exists(parents[19].GetHash()));
+
+    // Only inputs spending outside the pool are reported, among them those
+    // of every removed parent
+    unsigned int nNullPrevouts = 0;
+    for (const COutPoint& outpoint : vNoSpendsRemaining) {
+        BOOST_CHECK(!pool.exists(outpoint.hash));
+        nNullPrevouts += outpoint.IsNull();
+    }
+    BOOST_CHECK_EQUAL(nNullPrevouts, nParentsRemoved);
+
+    MempoolEvictionStats stats = pool.GetEvictionStats();
+    BOOST_CHECK_EQUAL(stats.nTrimmedTx, nRemoved);
+    BOOST_CHECK(stats.nTrimPasses > 0);
+    BOOST_CHECK(stats.nTrimPasses < nRemoved);
+    BOOST_CHECK_EQUAL(stats.nExpiredTx, 0U);
+
+    // Expiry is counted separately
+    unsigned int nLeft = pool.size();
+    pool.Expire(GetTime() + 1);
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+    stats = pool.GetEvictionStats();
+    BOOST_CHECK_EQUAL(stats.nTrimmedTx, nRemoved);
+    BOOST_CHECK_EQUAL(stats.nExpiredTx, nLeft);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolMemoryStatsTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    // The indexes allocate their bucket array up front
+    MempoolMemoryStats statsEmpty = pool.GetMemoryStats();
+    BOOST_CHECK_EQUAL(statsEmpty.nInnerBytes, 0U);
+
+    std::vector<CTransactionRef> vtx;
+    for (int i = 0; i < 100; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+        tx.vin[0].scriptSig = CScript() << OP_11;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = 10000LL;
+        vtx.push_back(MakeTransactionRef(tx));
+        pool.addUnchecked(tx.GetHash(), entry.FromTx(tx));
+    }
+
+    // Each entry takes at least one node holding the entry itself
+    MempoolMemoryStats stats = pool.GetMemoryStats();
+    BOOST_CHECK(stats.nIndexBytes >= statsEmpty.nIndexBytes + 100 * memusage::MallocUsage(sizeof(CTxMemPoolEntry)));
+    BOOST_CHECK(stats.nInnerBytes > 0);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), stats.nIndexBytes + stats.nInnerBytes + stats.nOtherBytes);
+
+    // Removing the entries gives back all but the (grown) bucket array
+    for (const CTransactionRef& tx : vtx) {
+        pool.removeRecursive(*tx);
+    }
+    stats = pool.GetMemoryStats();
+    BOOST_CHECK(stats.nIndexBytes >= statsEmpty.nIndexBytes);
+    BOOST_CHECK(stats.nIndexBytes < statsEmpty.nIndexBytes + 100 * memusage::MallocUsage(sizeof(CTxMemPoolEntry)));
+    BOOST_CHECK_EQUAL(stats.nInnerBytes, 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,69 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <metrics.h>
+#include <test/test_bitcoin.h>
+#include <tinyformat.h>
+
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(metrics_tests, BasicTestingSetup)
+
+static bool HasLine(const std::string& strOut, const std::string& strLine)
+{
+    return ("\n" + strOut).find("\n" + strLine + "\n") != std::string::npos;
+}
+
+BOOST_AUTO_TEST_CASE(metrics_register)
+{
+    CMetricCounter* counter = RegisterMetricCounter("test_events_total", "Test events", "kind=\"a\"");
+    BOOST_CHECK_EQUAL(RegisterMetricCounter("test_events_total", "Test events", "kind=\"a\""), counter);
+    BOOST_CHECK(RegisterMetricCounter("test_events_total", "Test events", "kind=\"b\"") != counter);
+    counter->Add();
+    counter->Add(2);
+    BOOST_CHECK_EQUAL(counter->Get(), 3U);
+
+    CMetricGauge* gauge = RegisterMetricGauge("test_level", "Test level");
+    gauge->Set(-5);
+
+    std::string strOut = RenderMetrics();
+    BOOST_CHECK(HasLine(strOut, "# HELP test_events_total Test events"));
+    BOOST_CHECK(HasLine(strOut, "# TYPE test_events_total counter"));
+    BOOST_CHECK(HasLine(strOut, "test_events_total{kind=\"a\"} 3"));
+    BOOST_CHECK(HasLine(strOut, "test_events_total{kind=\"b\"} 0"));
+    BOOST_CHECK(HasLine(strOut, "# TYPE test_level gauge"));
+    BOOST_CHECK(HasLine(strOut, "test_level -5"));
+}
+
+BOOST_AUTO_TEST_CASE(metrics_histogram)
+{
+    BOOST_CHECK_EQUAL(CMetricHistogram::Bucket(0), 0);
+    BOOST_CHECK_EQUAL(CMetricHistogram::Bucket(1), 0);
+    BOOST_CHECK_EQUAL(CMetricHistogram::Bucket(2), 1);
+    BOOST_CHECK_EQUAL(CMetricHistogram::Bucket(3), 2);
+    BOOST_CHECK_EQUAL(CMetricHistogram::Bucket(1024), 10);
+    BOOST_CHECK_EQUAL(CMetricHistogram::Bucket(1025), 11);
+    BOOST_CHECK_EQUAL(CMetricHistogram::Bucket(int64_t{1} << 40), METRIC_HISTOGRAM_BUCKETS - 1);
+
+    CMetricHistogram* histogram = RegisterMetricHistogram("test_duration_seconds", "Test durations", "phase=\"x\"");
+    histogram->Observe(1);
+    histogram->Observe(3);
+    histogram->Observe(1000000);
+    histogram->Observe(int64_t{1} << 40);
+
+    // Buckets are cumulative
+    std::string strOut = RenderMetrics();
+    BOOST_CHECK(HasLine(strOut, "# TYPE test_duration_seconds histogram"));
+    BOOST_CHECK(HasLine(strOut, "test_duration_seconds_bucket{phase=\"x\",le=\"0.000001\"} 1"));
+    BOOST_CHECK(HasLine(strOut, "test_duration_seconds_bucket{phase=\"x\",le=\"0.000002\"} 1"));
+    BOOST_CHECK(HasLine(strOut, "test_duration_seconds_bucket{phase=\"x\",le=\"0.000004\"} 2"));
+    BOOST_CHECK(HasLine(strOut, "test_duration_seconds_bucket{phase=\"x\",le=\"1.048576\"} 3"));
+    BOOST_CHECK(HasLine(strOut, "test_duration_seconds_bucket{phase=\"x\",le=\"+Inf\"} 4"));
+    BOOST_CHECK(HasLine(strOut, "test_duration_seconds_count{phase=\"x\"} 4"));
+    BOOST_CHECK(HasLine(strOut, strprintf("test_duration_seconds_sum{phase=\"x\"} %.6f", ((int64_t{1} << 40) + 1000004) * 0.000001)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
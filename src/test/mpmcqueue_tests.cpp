@@ -0,0 +1,74 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <support/mpmcqueue.h>
+#include <test/test_bitcoin.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(mpmcqueue_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(mpmcqueue_order)
+{
+    MPMCQueue<int> queue(3);
+    BOOST_CHECK_EQUAL(queue.Capacity(), 4U);
+
+    int n;
+    BOOST_CHECK(!queue.TryPop(n));
+    // Go round the ring a few times
+    for (int lap = 0; lap < 3; lap++) {
+        for (int i = 0; i < 4; i++)
+            BOOST_CHECK(queue.TryPush(lap * 4 + i));
+        BOOST_CHECK(!queue.TryPush(-1));
+        for (int i = 0; i < 4; i++) {
+            BOOST_CHECK(queue.TryPop(n));
+            BOOST_CHECK_EQUAL(n, lap * 4 + i);
+        }
+        BOOST_CHECK(!queue.TryPop(n));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(mpmcqueue_threads)
+{
+    static const int THREADS = 4;
+    static const int PER_THREAD = 10000;
+    MPMCQueue<int> queue(16);
+    std::atomic<int> nPopped(0);
+    std::atomic<int64_t> nSum(0);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&] {
+            for (int i = 1; i <= PER_THREAD; i++) {
+                while (!queue.TryPush(i))
+                    std::this_thread::yield();
+            }
+        });
+        threads.emplace_back([&] {
+            int n;
+            while (nPopped < THREADS * PER_THREAD) {
+                if (queue.TryPop(n)) {
+                    nSum += n;
+                    nPopped++;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    // Every element was taken exactly once
+    BOOST_CHECK_EQUAL(nPopped, THREADS * PER_THREAD);
+    BOOST_CHECK_EQUAL(nSum, int64_t{THREADS} * PER_THREAD * (PER_THREAD + 1) / 2);
+    int n;
+    BOOST_CHECK(!queue.TryPop(n));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -10,6 +10,7 @@
 #include <streams.h>
 #include <net.h>
 #include <netbase.h>
+#include <netmessagemaker.h>
 #include <chainparams.h>
 #include <util.h>
 
@@ -187,4 +188,131 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(socket_events_modes)
+{
+    SocketEventsMode mode;
+    BOOST_CHECK(GetSocketEventsMode(DEFAULT_SOCKETEVENTS, mode));
+    BOOST_CHECK(GetSocketEventsMode("select", mode));
+    BOOST_CHECK(mode == SocketEventsMode::SELECT);
+    BOOST_CHECK(!GetSocketEventsMode("carrierpigeon", mode));
+    BOOST_CHECK(ListSocketEventsModes().find(DEFAULT_SOCKETEVENTS) != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(shared_payload)
+{
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    std::vector<uint256> payload{uint256S("1"), uint256S("2")};
+
+    CSerializedNetMsg msg = msgMaker.Make(NetMsgType::GETDATA, payload);
+    std::shared_ptr<const CSharedNetPayload> shared = msgMaker.MakePayload(0, payload);
+    BOOST_CHECK(shared->data == msg.data);
+    BOOST_CHECK(shared->hash == Hash(msg.data.begin(), msg.data.end()));
+
+    CSerializedNetMsg shared_msg = msgMaker.MakeShared(NetMsgType::GETDATA, shared);
+    BOOST_CHECK(shared_msg.data.empty());
+    BOOST_CHECK(shared_msg.shared_payload == shared);
+    BOOST_CHECK_EQUAL(shared_msg.command, NetMsgType::GETDATA);
+}
+
+BOOST_AUTO_TEST_CASE(msg_cmd_counter)
+{
+    CMsgCmdCounter counter;
+    counter.Add(NetMsgType::PING, 32);
+    counter.Add(NetMsgType::PING, 32);
+    counter.Add(NetMsgType::ADDR, 55);
+    // Unknown commands, sorting before and after all known ones, are counted together
+    counter.Add("aaaa", 10);
+    counter.Add("zzzz", 5);
+    mapMsgCmdSize mapCounters = counter.Get();
+    BOOST_CHECK_EQUAL(mapCounters.size(), getAllNetMessageTypes().size() + 1);
+    BOOST_CHECK_EQUAL(mapCounters[NetMsgType::PING], 64U);
+    BOOST_CHECK_EQUAL(mapCounters[NetMsgType::ADDR], 55U);
+    BOOST_CHECK_EQUAL(mapCounters[NetMsgType::VERSION], 0U);
+    BOOST_CHECK_EQUAL(mapCounters["*other*"], 15U);
+}
+
+BOOST_AUTO_TEST_CASE(upload_scheduler)
+{
+    CSerializedNetMsg msg;
+    msg.command = NetMsgType::CMPCTBLOCK;
+    BOOST_CHECK_EQUAL(GetUploadClass(msg), UPLOAD_BLOCK_RELAY);
+    msg.command = NetMsgType::INV;
+    BOOST_CHECK_EQUAL(GetUploadClass(msg), UPLOAD_TX_RELAY);
+    msg.command = NetMsgType::MERKLEBLOCK;
+    BOOST_CHECK_EQUAL(GetUploadClass(msg), UPLOAD_HISTORICAL);
+    msg.command = NetMsgType::BLOCK;
+    BOOST_CHECK_EQUAL(GetUploadClass(msg), UPLOAD_BLOCK_RELAY);
+    msg.historical = true;
+    BOOST_CHECK_EQUAL(GetUploadClass(msg), UPLOAD_HISTORICAL);
+
+    CUploadScheduler scheduler;
+    const CUploadScheduler::Queue blocks{{UPLOAD_BLOCK_RELAY, 2000}, {UPLOAD_OTHER, 100}};
+    const CUploadScheduler::Queue txs{{UPLOAD_TX_RELAY, 2000}};
+    const CUploadScheduler::Queue historical{{UPLOAD_HISTORICAL, 2000}};
+    BOOST_CHECK(!scheduler.IsLimited());
+    BOOST_CHECK_EQUAL(scheduler.GetBudget(blocks, 10, GetTimeMicros()), 2100U);
+
+    // Old blocks leave half of the total bucket to the classes above them,
+    // and transaction relay a quarter
+    std::array<uint64_t, UPLOAD_CLASS_COUNT> vClassRates{};
+    scheduler.SetRateLimits(1000, vClassRates);
+    BOOST_CHECK(scheduler.IsLimited());
+    int64_t nTime = GetTimeMicros();
+    BOOST_CHECK_EQUAL(scheduler.GetBudget(blocks, 10, nTime), 1000U);
+    BOOST_CHECK_EQUAL(scheduler.GetBudget(txs, 10, nTime), 750U);
+    BOOST_CHECK_EQUAL(scheduler.GetBudget(historical, 10, nTime), 500U);
+
+    CUploadScheduler::Queue queue = blocks;
+    scheduler.Consume(queue, 600, true);
+    BOOST_REQUIRE_EQUAL(queue.size(), 2U);
+    BOOST_CHECK_EQUAL(queue.front().second, 1400U);
+    BOOST_CHECK_EQUAL(scheduler.GetBudget(txs, 10, nTime), 150U);
+    BOOST_CHECK_EQUAL(scheduler.GetBudget(historical, 10, nTime), 0U);
+    BOOST_CHECK_EQUAL(scheduler.GetStats(UPLOAD_HISTORICAL).nDeferred, 1U);
+
+    // The buckets refill at their rate, up to a second of it
+    nTime += 200000;
+    BOOST_CHECK_EQUAL(scheduler.GetBudget(queue, 10, nTime), 600U);
+    BOOST_CHECK_EQUAL(scheduler.GetBudget(historical, 10, nTime), 100U);
+    nTime += 5000000;
+    BOOST_CHECK_EQUAL(scheduler.GetBudget(queue, 10, nTime), 1000U);
+    scheduler.Consume(queue, 1500, true);
+    BOOST_CHECK(queue.empty());
+    BOOST_CHECK_EQUAL(scheduler.GetBudget(blocks, 10, nTime), 0U);
+    BOOST_CHECK_EQUAL(scheduler.GetStats(UPLOAD_BLOCK_RELAY).nBytesSent, 2000U);
+    BOOST_CHECK_EQUAL(scheduler.GetStats(UPLOAD_OTHER).nBytesSent, 100U);
+
+    // A class can be limited on its own
+    vClassRates[UPLOAD_TX_RELAY] = 300;
+    scheduler.SetRateLimits(0, vClassRates);
+    nTime = GetTimeMicros();
+    BOOST_CHECK_EQUAL(scheduler.GetBudget(blocks, 10, nTime), 2100U);
+    BOOST_CHECK_EQUAL(scheduler.GetBudget(txs, 10, nTime), 300U);
+    BOOST_CHECK_EQUAL(scheduler.GetStats(UPLOAD_TX_RELAY).nRateLimit, 300U);
+}
+
+BOOST_AUTO_TEST_CASE(cnetmessage_reset)
+{
+    std::vector<unsigned char> payload{1, 2, 3, 4, 5};
+    CMessageHeader hdr(Params().MessageStart(), NetMsgType::PING, payload.size());
+    uint256 hash = Hash(payload.begin(), payload.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream wire(SER_NETWORK, INIT_PROTO_VERSION);
+    wire << hdr;
+    wire.write((const char*)payload.data(), payload.size());
+
+    CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    for (int i = 0; i < 2; i++) {
+        BOOST_CHECK_EQUAL(msg.readHeader(wire.data(), wire.size()), CMessageHeader::HEADER_SIZE);
+        BOOST_CHECK_EQUAL(msg.readData(wire.data() + CMessageHeader::HEADER_SIZE, payload.size()), (int)payload.size());
+        BOOST_CHECK(msg.complete());
+        BOOST_CHECK(msg.GetMessageHash() == hash);
+        BOOST_CHECK_EQUAL(msg.hdr.GetCommand(), NetMsgType::PING);
+        // A reset message receives the next one like a new message would
+        msg.Reset();
+        BOOST_CHECK(!msg.in_data);
+        BOOST_CHECK(msg.vRecv.empty());
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -302,4 +302,64 @@ BOOST_AUTO_TEST_CASE(netbase_getgroup)
     BOOST_CHECK(CreateInternal("baz.net").GetGroup() == internal_group);
 }
 
+BOOST_AUTO_TEST_CASE(subnet_index)
+{
+    // Addresses from a small range, so that subnets overlap a lot
+    auto random_addr = []() {
+        uint8_t ip[4] = {10, (uint8_t)InsecureRandRange(2), (uint8_t)InsecureRandRange(4), (uint8_t)InsecureRandRange(8)};
+        CNetAddr addr;
+        addr.SetRaw(NET_IPV4, ip);
+        return addr;
+    };
+
+    std::map<CSubNet, int64_t> subnets;
+    for (int i = 0; i < 200; i++) {
+        CSubNet subnet = InsecureRandRange(10) == 0 ? CSubNet(random_addr(), ResolveIP("255.255.0.252")) :
+                                                      CSubNet(random_addr(), 8 + InsecureRandRange(25));
+        subnets[subnet] = InsecureRandRange(1000);
+    }
+    subnets[ResolveSubNet("1:2:3:4::/64")] = 1000;
+
+    CSubNetIndex index;
+    BOOST_CHECK(index.Empty());
+    BOOST_CHECK(!index.Match(ResolveIP("10.0.0.1")));
+    for (const auto& entry : subnets) {
+        index.Insert(entry.first, entry.second);
+    }
+    index.Insert(CSubNet(), 2000);
+
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 200; i++) {
+            const CNetAddr addr = random_addr();
+            bool fMatch = false;
+            int64_t nMaxExpected = 0;
+            for (const auto& entry : subnets) {
+                if (entry.first.Match(addr)) {
+                    nMaxExpected = fMatch ? std::max(nMaxExpected, entry.second) : entry.second;
+                    fMatch = true;
+                }
+            }
+            int64_t nMax = -1;
+            BOOST_CHECK_EQUAL(index.Find(addr, nMax), fMatch);
+            if (fMatch)
+                BOOST_CHECK_EQUAL(nMax, nMaxExpected);
+        }
+        // Erase half of the subnets and check again
+        for (auto it = subnets.begin(); it != subnets.end(); ) {
+            if (InsecureRandBool()) {
+                index.Erase(it->first);
+                it = subnets.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    BOOST_CHECK(index.Match(ResolveIP("1:2:3:4:5:6:7:8")) == subnets.count(ResolveSubNet("1:2:3:4::/64")));
+    BOOST_CHECK(!index.Match(ResolveIP("1:2:3:5::1")));
+    BOOST_CHECK(!index.Match(CNetAddr()));
+    index.Clear();
+    BOOST_CHECK(index.Empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
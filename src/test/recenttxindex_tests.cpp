@@ -0,0 +1,83 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <index/recenttxindex.h>
+#include <script/interpreter.h>
+#include <validation.h>
+#include <validationinterface.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(recenttxindex_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(recenttxindex_window)
+{
+    CRecentTxIndex index(5);
+    {
+        LOCK(cs_main);
+        index.Load(Params().GetConsensus());
+    }
+    RegisterValidationInterface(&index);
+    BOOST_CHECK_EQUAL(index.GetBlockCount(), 5U);
+    BOOST_CHECK_EQUAL(index.GetTxCount(), 5U);
+
+    // The transactions of the last blocks are found, older ones are not
+    CTransactionRef tx;
+    uint256 hashBlock;
+    BOOST_REQUIRE(index.FindTx(coinbaseTxns[99].GetHash(), hashBlock, tx));
+    BOOST_CHECK_EQUAL(tx->GetHash(), coinbaseTxns[99].GetHash());
+    BOOST_CHECK_EQUAL(hashBlock, chainActive[100]->GetBlockHash());
+    BOOST_CHECK(index.FindTx(coinbaseTxns[95].GetHash(), hashBlock, tx));
+    BOOST_CHECK(!index.FindTx(coinbaseTxns[94].GetHash(), hashBlock, tx));
+
+    // Connected blocks are indexed, and the oldest evicted
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 49 * COIN;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_REQUIRE(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    CBlock block = CreateAndProcessBlock({spend}, scriptPubKey);
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK_EQUAL(index.GetBlockCount(), 5U);
+    BOOST_REQUIRE(index.FindTx(spend.GetHash(), hashBlock, tx));
+    BOOST_CHECK_EQUAL(tx->GetHash(), spend.GetHash());
+    BOOST_CHECK_EQUAL(hashBlock, block.GetHash());
+    BOOST_CHECK(!index.FindTx(coinbaseTxns[95].GetHash(), hashBlock, tx));
+
+    // Lookups without -txindex go through the index
+    BOOST_CHECK(!GetTransaction(spend.GetHash(), tx, Params().GetConsensus(), hashBlock, false));
+    g_recenttxindex.reset(new CRecentTxIndex(1));
+    {
+        LOCK(cs_main);
+        g_recenttxindex->Load(Params().GetConsensus());
+    }
+    BOOST_CHECK(GetTransaction(spend.GetHash(), tx, Params().GetConsensus(), hashBlock, false));
+    BOOST_CHECK_EQUAL(hashBlock, block.GetHash());
+    g_recenttxindex.reset();
+
+    // Disconnected blocks leave the index
+    {
+        CValidationState state;
+        LOCK(cs_main);
+        BOOST_REQUIRE(InvalidateBlock(state, Params(), chainActive.Tip()));
+    }
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK_EQUAL(index.GetBlockCount(), 4U);
+    BOOST_CHECK(!index.FindTx(spend.GetHash(), hashBlock, tx));
+    BOOST_CHECK(index.FindTx(coinbaseTxns[99].GetHash(), hashBlock, tx));
+
+    UnregisterValidationInterface(&index);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
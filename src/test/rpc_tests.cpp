@@ -4,6 +4,7 @@
 
 #include <rpc/server.h>
 #include <rpc/client.h>
+#include <rpc/jsonwriter.h>
 
 #include <base58.h>
 #include <core_io.h>
@@ -345,4 +346,73 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_batch_order)
+{
+    SetRPCWarmupFinished();
+    gArgs.ForceSetArg("-rpcbatchthreads", "4");
+
+    // Runs of read-only entries, split by an entry executed on its own
+    UniValue batch(UniValue::VARR);
+    for (int i = 0; i < 33; i++) {
+        UniValue req(UniValue::VOBJ);
+        req.pushKV("id", i);
+        req.pushKV("method", i == 16 ? "nosuchmethod" : "decodescript");
+        UniValue params(UniValue::VARR);
+        params.push_back(HexStr(CScript() << CScript::EncodeOP_N(1 + i % 16)));
+        req.pushKV("params", params);
+        batch.push_back(req);
+    }
+    batch.push_back("not an object");
+
+    JSONRPCRequest jreq;
+    UniValue ret;
+    BOOST_CHECK(ret.read(JSONRPCExecBatch(jreq, batch)));
+    BOOST_CHECK_EQUAL(ret.size(), batch.size());
+    for (int i = 0; i < 33; i++) {
+        BOOST_CHECK_EQUAL(find_value(ret[i], "id").get_int(), i);
+        if (i == 16) {
+            BOOST_CHECK_EQUAL(find_value(find_value(ret[i], "error"), "code").get_int(), RPC_METHOD_NOT_FOUND);
+        } else {
+            BOOST_CHECK_EQUAL(find_value(find_value(ret[i], "result"), "asm").get_str(), std::to_string(1 + i % 16));
+        }
+    }
+    BOOST_CHECK(!find_value(ret[33], "error").isNull());
+
+    gArgs.ForceSetArg("-rpcbatchthreads", std::to_string(DEFAULT_RPC_BATCH_THREADS));
+}
+
+BOOST_AUTO_TEST_CASE(rpc_json_stream_writer)
+{
+    UniValue expected;
+    BOOST_CHECK(expected.read("{\"result\":{\"a\":[1,\"x\\\"y\",[],{}],\"b\":{\"c\":null,\"d\":true}},\"error\":null,\"id\":[]}"));
+
+    // A tiny flush size hands nearly every piece to the sink separately
+    std::string strOut;
+    size_t nFlushes = 0;
+    JSONStreamWriter writer([&](const std::string& s) { strOut += s; nFlushes++; }, 4);
+    writer.BeginObject();
+    writer.Key("result");
+    writer.BeginObject();
+    writer.Key("a");
+    writer.BeginArray();
+    writer.Value(1);
+    writer.Value("x\"y");
+    writer.BeginArray();
+    writer.EndArray();
+    writer.Value(UniValue(UniValue::VOBJ));
+    writer.EndArray();
+    writer.Key("b");
+    writer.Value(expected["result"]["b"]);
+    writer.EndObject();
+    writer.Key("error");
+    writer.Value(NullUniValue);
+    writer.Key("id");
+    writer.Value(UniValue(UniValue::VARR));
+    writer.EndObject();
+    writer.Flush();
+
+    BOOST_CHECK_EQUAL(strOut, expected.write());
+    BOOST_CHECK(nFlushes > 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -112,4 +112,68 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+BOOST_AUTO_TEST_CASE(priority_order)
+{
+    // Due tasks of the HIGH lane run first, each lane in order of time
+    CScheduler scheduler;
+    std::vector<int> vOrder;
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    scheduler.schedule([&vOrder] { vOrder.push_back(3); }, now - boost::chrono::seconds(2));
+    scheduler.schedule([&vOrder] { vOrder.push_back(4); }, now - boost::chrono::seconds(1));
+    scheduler.schedule([&vOrder] { vOrder.push_back(2); }, now, CScheduler::Priority::HIGH);
+    scheduler.schedule([&vOrder] { vOrder.push_back(1); }, now - boost::chrono::seconds(1), CScheduler::Priority::HIGH);
+
+    boost::chrono::system_clock::time_point first, last;
+    BOOST_CHECK_EQUAL(scheduler.getQueueInfo(first, last), 4U);
+    BOOST_CHECK(first == now - boost::chrono::seconds(2));
+    BOOST_CHECK(last == now);
+
+    scheduler.stop(true);
+    scheduler.serviceQueue();
+    BOOST_CHECK(vOrder == std::vector<int>({1, 2, 3, 4}));
+}
+
+BOOST_AUTO_TEST_CASE(priority_reserved_thread)
+{
+    // With two threads, a slow NORMAL task does not keep the other thread
+    // from the HIGH lane, and the other NORMAL task waits for it
+    CScheduler scheduler;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fSlowStarted = false, fSlowDone = false, fHighDone = false, fNormalOverlapped = false;
+
+    scheduler.schedule([&] {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fSlowStarted = true;
+        cond.notify_all();
+        while (!fHighDone)
+            cond.wait(lock);
+        fSlowDone = true;
+    });
+    boost::thread_group threads;
+    threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fSlowStarted)
+            cond.wait(lock);
+    }
+    threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    scheduler.schedule([&] {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fNormalOverlapped = !fSlowDone;
+    });
+    scheduler.schedule([&] {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fHighDone = true;
+        cond.notify_all();
+    }, boost::chrono::system_clock::now(), CScheduler::Priority::HIGH);
+
+    scheduler.stop(true);
+    threads.join_all();
+    BOOST_CHECK(fHighDone);
+    BOOST_CHECK(fSlowDone);
+    // The second NORMAL task only ran once the slow one had finished
+    BOOST_CHECK(!fNormalOverlapped);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
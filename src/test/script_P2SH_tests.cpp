@@ -338,6 +338,16 @@ BOOST_AUTO_TEST_CASE(AreInputsStandard)
     txTo.vin[4].scriptSig << std::vector<unsigned char>(fifteenSigops.begin(), fifteenSigops.end());
 
     BOOST_CHECK(::AreInputsStandard(txTo, coins));
+    // The spent scripts, as the input checks of mempool acceptance share them
+    std::vector<SpentScriptInfo> vSpent;
+    SolveSpentScripts(txTo, coins, vSpent);
+    BOOST_REQUIRE_EQUAL(vSpent.size(), 5U);
+    BOOST_CHECK(vSpent[0].whichType == TX_SCRIPTHASH && vSpent[0].fRedeemScript && vSpent[0].redeemScript == pay1);
+    BOOST_CHECK(vSpent[1].whichType == TX_PUBKEYHASH && !vSpent[1].fRedeemScript);
+    BOOST_CHECK(vSpent[2].whichType == TX_MULTISIG);
+    BOOST_CHECK(vSpent[3].whichType == TX_SCRIPTHASH && vSpent[3].redeemScript == oneAndTwo);
+    BOOST_CHECK(vSpent[4].whichType == TX_SCRIPTHASH && vSpent[4].redeemScript == fifteenSigops);
+    BOOST_CHECK(::AreInputsStandard(txTo, vSpent));
     // 22 P2SH sigops for all inputs (1 for vin[0], 6 for vin[3], 15 for vin[4]
     BOOST_CHECK_EQUAL(GetP2SHSigOpCount(txTo, coins), 22U);
 
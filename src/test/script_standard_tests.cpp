@@ -733,4 +733,42 @@ BOOST_AUTO_TEST_CASE(script_standard_IsMine)
     }
 }
 
+BOOST_AUTO_TEST_CASE(script_standard_IsMineCandidate)
+{
+    CKey keys[2];
+    CPubKey pubkeys[2];
+    for (int i = 0; i < 2; i++) {
+        keys[i].MakeNewKey(true);
+        pubkeys[i] = keys[i].GetPubKey();
+    }
+
+    CBasicKeyStore keystore;
+    keystore.AddKey(keys[0]);
+
+    // Scripts of a key, including the implicitly learned witness ones
+    CScript witnessScript = GetScriptForDestination(WitnessV0KeyHash(pubkeys[0].GetID()));
+    BOOST_CHECK(keystore.IsMineCandidate(GetScriptForRawPubKey(pubkeys[0])));
+    BOOST_CHECK(keystore.IsMineCandidate(GetScriptForDestination(pubkeys[0].GetID())));
+    BOOST_CHECK(keystore.IsMineCandidate(witnessScript));
+    BOOST_CHECK(keystore.IsMineCandidate(GetScriptForDestination(CScriptID(witnessScript))));
+    BOOST_CHECK(!keystore.IsMineCandidate(GetScriptForRawPubKey(pubkeys[1])));
+    BOOST_CHECK(!keystore.IsMineCandidate(GetScriptForDestination(pubkeys[1].GetID())));
+
+    // A script and its P2SH
+    CScript multisig = GetScriptForMultisig(1, {pubkeys[0], pubkeys[1]});
+    BOOST_CHECK(!keystore.IsMineCandidate(GetScriptForDestination(CScriptID(multisig))));
+    keystore.AddCScript(multisig);
+    BOOST_CHECK(keystore.IsMineCandidate(GetScriptForDestination(CScriptID(multisig))));
+    BOOST_CHECK_EQUAL(IsMine(keystore, GetScriptForDestination(CScriptID(multisig))), ISMINE_NO);
+
+    // Watch-only scripts stay candidates when removed, but are no longer ours
+    CScript watched = GetScriptForDestination(pubkeys[1].GetID());
+    keystore.AddWatchOnly(watched);
+    BOOST_CHECK(keystore.IsMineCandidate(watched));
+    BOOST_CHECK_EQUAL(IsMine(keystore, watched), ISMINE_WATCH_UNSOLVABLE);
+    keystore.RemoveWatchOnly(watched);
+    BOOST_CHECK(keystore.IsMineCandidate(watched));
+    BOOST_CHECK_EQUAL(IsMine(keystore, watched), ISMINE_NO);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -19,6 +19,7 @@
 #include <script/bitcoinconsensus.h>
 #endif
 
+#include <atomic>
 #include <fstream>
 #include <stdint.h>
 #include <string>
@@ -1464,6 +1465,53 @@ BOOST_AUTO_TEST_CASE(script_HasValidOps)
     BOOST_CHECK(!script.HasValidOps());
 }
 
+BOOST_AUTO_TEST_CASE(script_sign_inputs_parallel)
+{
+    // Every input is visited exactly once, and failures reach the caller
+    std::vector<std::atomic<int>> vVisits(1000);
+    for (auto& visits : vVisits)
+        visits = 0;
+    ForEachInput(vVisits.size(), [&](unsigned int nIn) { vVisits[nIn]++; });
+    for (const auto& visits : vVisits)
+        BOOST_CHECK_EQUAL(visits, 1);
+    BOOST_CHECK_THROW(ForEachInput(1000, [](unsigned int nIn) { if (nIn == 537) throw std::runtime_error("fail"); }), std::runtime_error);
+
+    // Signing the inputs in parallel gives the same transaction as signing them one by one
+    CBasicKeyStore keystore;
+    std::vector<CKey> keys(4);
+    for (CKey& key : keys) {
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+    }
+    CMutableTransaction txFrom;
+    txFrom.vout.resize(100);
+    for (unsigned int i = 0; i < txFrom.vout.size(); i++) {
+        txFrom.vout[i].scriptPubKey = GetScriptForDestination(keys[i % keys.size()].GetPubKey().GetID());
+        txFrom.vout[i].nValue = 1000 + i;
+    }
+    CMutableTransaction txSerial;
+    txSerial.vin.resize(txFrom.vout.size());
+    txSerial.vout.resize(1);
+    for (unsigned int i = 0; i < txSerial.vin.size(); i++)
+        txSerial.vin[i].prevout = COutPoint(txFrom.GetHash(), i);
+    CMutableTransaction txParallel(txSerial);
+
+    for (unsigned int i = 0; i < txSerial.vin.size(); i++)
+        BOOST_CHECK(SignSignature(keystore, txFrom, txSerial, i, SIGHASH_ALL));
+
+    const CTransaction txConst(txParallel);
+    std::vector<SignatureData> vSigData(txParallel.vin.size());
+    std::atomic<bool> fSigned(true);
+    ForEachInput(txParallel.vin.size(), [&](unsigned int i) {
+        if (!ProduceSignature(TransactionSignatureCreator(&keystore, &txConst, i, txFrom.vout[i].nValue, SIGHASH_ALL), txFrom.vout[i].scriptPubKey, vSigData[i]))
+            fSigned = false;
+    });
+    BOOST_CHECK(fSigned);
+    for (unsigned int i = 0; i < txParallel.vin.size(); i++)
+        UpdateTransaction(txParallel, i, vSigData[i]);
+    BOOST_CHECK(CTransaction(txParallel) == CTransaction(txSerial));
+}
+
 BOOST_AUTO_TEST_CASE(script_can_append_self)
 {
     CScript s, d;
@@ -1481,6 +1529,111 @@ BOOST_AUTO_TEST_CASE(script_can_append_self)
     BOOST_CHECK(s == d);
 }
 
+/** Accepts a signature depending on its bytes only, and fails if FindAndDelete changed the script code */
+class StandardScriptSignatureChecker : public BaseSignatureChecker
+{
+public:
+    bool CheckSig(const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const override
+    {
+        return !vchSig.empty() && (vchSig[vchSig.size() / 2] & 1) && scriptCode.size() == 25;
+    }
+};
+
+static std::vector<unsigned char> RandomStandardSignature()
+{
+    static const unsigned char hashtypes[] = {SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE, SIGHASH_ALL | SIGHASH_ANYONECANPAY, 0, 4};
+    if (InsecureRandBits(3) == 0)
+        return insecure_rand_ctx.randbytes(InsecureRandRange(80));
+    std::vector<unsigned char> r = insecure_rand_ctx.randbytes(32), s = insecure_rand_ctx.randbytes(InsecureRandBits(2) ? 32 : 1 + InsecureRandRange(33));
+    r[0] &= InsecureRandBool() ? 0x7f : 0xff;
+    s[0] &= InsecureRandBool() ? 0x3f : 0xff;
+    std::vector<unsigned char> sig = {0x30, (unsigned char)(4 + r.size() + s.size()), 0x02, (unsigned char)r.size()};
+    sig.insert(sig.end(), r.begin(), r.end());
+    sig.push_back(0x02);
+    sig.push_back(s.size());
+    sig.insert(sig.end(), s.begin(), s.end());
+    sig.push_back(hashtypes[InsecureRandRange(sizeof(hashtypes))]);
+    return sig;
+}
+
+static std::vector<unsigned char> RandomStandardPubKey()
+{
+    std::vector<unsigned char> vchPubKey;
+    switch (InsecureRandBits(2)) {
+    case 0: vchPubKey = insecure_rand_ctx.randbytes(InsecureRandRange(600)); break;
+    case 1: vchPubKey = insecure_rand_ctx.randbytes(65); vchPubKey[0] = 4; break;
+    default: vchPubKey = insecure_rand_ctx.randbytes(33); vchPubKey[0] = 2 + InsecureRandBool(); break;
+    }
+    return vchPubKey;
+}
+
+static CScript PushMaybeNonMinimal(CScript script, const std::vector<unsigned char>& data)
+{
+    if (InsecureRandBits(3) == 0 && data.size() < 256) {
+        script.insert(script.end(), OP_PUSHDATA1);
+        script.insert(script.end(), (unsigned char)data.size());
+        script.insert(script.end(), data.begin(), data.end());
+        return script;
+    }
+    return script << data;
+}
+
+/* The fast paths of P2PKH, P2WPKH and P2SH-P2WPKH give what the interpreter does, error included */
+BOOST_AUTO_TEST_CASE(script_standard_fast_paths)
+{
+    const StandardScriptSignatureChecker checker;
+    for (int i = 0; i < 20000; i++) {
+        unsigned int flags = InsecureRandBits(17);
+        if (InsecureRandBits(2) == 0 || (flags & SCRIPT_VERIFY_CLEANSTACK))
+            flags |= SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS;
+        if (flags & SCRIPT_VERIFY_WITNESS)
+            flags |= SCRIPT_VERIFY_P2SH;
+
+        std::vector<unsigned char> vchSig = RandomStandardSignature(), vchPubKey = RandomStandardPubKey();
+        std::vector<unsigned char> vchKeyHash = ToByteVector(Hash160(vchPubKey.begin(), vchPubKey.end()));
+        if (InsecureRandBits(3) == 0)
+            vchKeyHash = insecure_rand_ctx.randbytes(20);
+        if (InsecureRandBits(4) == 0)
+            vchSig = vchKeyHash;
+
+        CScript scriptSig, scriptPubKey;
+        CScriptWitness witness;
+        const CScript program = CScript() << OP_0 << vchKeyHash;
+        switch (InsecureRandRange(3)) {
+        case 0:
+            scriptPubKey = CScript() << OP_DUP << OP_HASH160 << vchKeyHash << OP_EQUALVERIFY << OP_CHECKSIG;
+            if (InsecureRandBits(3))
+                scriptSig = PushMaybeNonMinimal(scriptSig, vchSig);
+            if (InsecureRandBits(3))
+                scriptSig = PushMaybeNonMinimal(scriptSig, vchPubKey);
+            if (InsecureRandBits(3) == 0)
+                witness.stack.push_back(vchSig);
+            break;
+        case 1:
+            scriptPubKey = program;
+            witness.stack = {vchSig, vchPubKey};
+            break;
+        case 2:
+            scriptPubKey = GetScriptForDestination(CScriptID(program));
+            scriptSig = CScript() << ToByteVector(program);
+            witness.stack = {vchSig, vchPubKey};
+            break;
+        }
+        if (InsecureRandBits(4) == 0)
+            scriptSig << OP_NOP;
+        if (InsecureRandBits(4) == 0)
+            scriptSig = PushMaybeNonMinimal(scriptSig, insecure_rand_ctx.randbytes(InsecureRandBits(2)));
+        if (InsecureRandBits(4) == 0)
+            witness.stack.push_back(insecure_rand_ctx.randbytes(InsecureRandBits(2)));
+
+        ScriptError serror, serrorGeneric;
+        bool fResult = VerifyScript(scriptSig, scriptPubKey, &witness, flags, checker, &serror);
+        bool fResultGeneric = VerifyScriptGeneric(scriptSig, scriptPubKey, &witness, flags, checker, &serrorGeneric);
+        BOOST_CHECK_EQUAL(fResult, fResultGeneric);
+        BOOST_CHECK_EQUAL(serror, serrorGeneric);
+    }
+}
+
 
 #if defined(HAVE_CONSENSUS_LIB)
 
@@ -1622,5 +1775,61 @@ BOOST_AUTO_TEST_CASE(bitcoinconsensus_verify_script_invalid_flags)
     BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_INVALID_FLAGS);
 }
 
+/* Test bitcoinconsensus_verify_transaction(s) give the result of every input and transaction */
+BOOST_AUTO_TEST_CASE(bitcoinconsensus_verify_transaction_inputs)
+{
+    unsigned int libconsensus_flags = bitcoinconsensus_SCRIPT_FLAGS_VERIFY_ALL;
+
+    CScript scriptTrue = CScript() << OP_1;
+    CScript scriptFalse = CScript() << OP_0;
+    CMutableTransaction spendTx;
+    spendTx.vin.resize(50);
+    spendTx.vout.resize(1);
+    std::vector<bitcoinconsensus_spent_output> spentOutputs(spendTx.vin.size());
+    for (unsigned int i = 0; i < spendTx.vin.size(); i++) {
+        spendTx.vin[i].prevout = COutPoint(InsecureRand256(), i);
+        const CScript& scriptPubKey = i == 17 ? scriptFalse : scriptTrue;
+        spentOutputs[i] = {scriptPubKey.data(), (unsigned int)scriptPubKey.size(), 1};
+    }
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << spendTx;
+
+    for (unsigned int nThreads : {1, 4}) {
+        std::vector<int> inputResults(spendTx.vin.size());
+        bitcoinconsensus_error err;
+        int result = bitcoinconsensus_verify_transaction((const unsigned char*)&stream[0], stream.size(), spentOutputs.data(), spentOutputs.size(), libconsensus_flags, nThreads, inputResults.data(), &err);
+        BOOST_CHECK_EQUAL(result, 0);
+        BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_OK);
+        for (unsigned int i = 0; i < inputResults.size(); i++) {
+            BOOST_CHECK_EQUAL(inputResults[i], i == 17 ? 0 : 1);
+        }
+    }
+
+    bitcoinconsensus_error err;
+    int result = bitcoinconsensus_verify_transaction((const unsigned char*)&stream[0], stream.size(), spentOutputs.data(), spentOutputs.size() - 1, libconsensus_flags, 1, nullptr, &err);
+    BOOST_CHECK_EQUAL(result, 0);
+    BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_SPENT_OUTPUTS_MISMATCH);
+
+    std::vector<bitcoinconsensus_spent_output> spentOutputsValid(spentOutputs);
+    spentOutputsValid[17] = spentOutputsValid[0];
+    bitcoinconsensus_transaction txs[] = {
+        {(const unsigned char*)&stream[0], (unsigned int)stream.size(), spentOutputsValid.data(), (unsigned int)spentOutputsValid.size()},
+        {(const unsigned char*)&stream[0], (unsigned int)stream.size() * 2, spentOutputsValid.data(), (unsigned int)spentOutputsValid.size()},
+        {(const unsigned char*)&stream[0], (unsigned int)stream.size(), spentOutputs.data(), (unsigned int)spentOutputs.size()},
+    };
+    int results[3];
+    bitcoinconsensus_error errs[3];
+    result = bitcoinconsensus_verify_transactions(txs, 3, libconsensus_flags, 4, results, errs);
+    BOOST_CHECK_EQUAL(result, 0);
+    BOOST_CHECK_EQUAL(results[0], 1);
+    BOOST_CHECK_EQUAL(errs[0], bitcoinconsensus_ERR_OK);
+    BOOST_CHECK_EQUAL(results[1], 0);
+    BOOST_CHECK_EQUAL(errs[1], bitcoinconsensus_ERR_TX_SIZE_MISMATCH);
+    BOOST_CHECK_EQUAL(results[2], 0);
+    BOOST_CHECK_EQUAL(errs[2], bitcoinconsensus_ERR_OK);
+    BOOST_CHECK_EQUAL(bitcoinconsensus_verify_transactions(txs, 1, libconsensus_flags, 4, nullptr, nullptr), 1);
+}
+
 #endif
 BOOST_AUTO_TEST_SUITE_END()
@@ -365,4 +365,47 @@ BOOST_AUTO_TEST_CASE(class_methods)
     BOOST_CHECK(methodtest3 == methodtest4);
 }
 
+BOOST_AUTO_TEST_CASE(byte_vectors_from_view)
+{
+    std::vector<unsigned char> vch(1000);
+    for (size_t i = 0; i < vch.size(); i++)
+        vch[i] = i * 7;
+    prevector<28, unsigned char> pv(vch.begin(), vch.begin() + 100);
+    prevector<28, unsigned char> pv_direct(vch.begin(), vch.begin() + 10);
+
+    CDataStream ss(SER_DISK, 0);
+    ss << vch << pv << pv_direct << std::vector<unsigned char>() << uint8_t(42);
+    std::vector<unsigned char> vSerialized(ss.begin(), ss.end());
+
+    // Read through CDataStream::ReadView, and through CSpanReader::ReadView
+    std::vector<unsigned char> vch2;
+    prevector<28, unsigned char> pv2, pv_direct2;
+    std::vector<unsigned char> vEmpty(1, 1);
+    uint8_t n = 0;
+    ss >> vch2 >> pv2 >> pv_direct2 >> vEmpty >> n;
+    BOOST_CHECK(vch2 == vch);
+    BOOST_CHECK(pv2 == pv);
+    BOOST_CHECK(pv_direct2 == pv_direct);
+    BOOST_CHECK(vEmpty.empty());
+    BOOST_CHECK_EQUAL(n, 42);
+    BOOST_CHECK(ss.empty());
+
+    CSpanReader reader(SER_DISK, 0, vSerialized.data(), vSerialized.size());
+    reader >> vch2 >> pv2 >> pv_direct2 >> vEmpty >> n;
+    BOOST_CHECK(vch2 == vch);
+    BOOST_CHECK(pv2 == pv);
+    BOOST_CHECK(pv_direct2 == pv_direct);
+    BOOST_CHECK_EQUAL(n, 42);
+    BOOST_CHECK(reader.empty());
+
+    // A size beyond the end of the data fails before anything is allocated
+    CDataStream ssBogus(SER_DISK, 0);
+    WriteCompactSize(ssBogus, MAX_SIZE);
+    ssBogus << uint8_t(0);
+    BOOST_CHECK_THROW(ssBogus >> vch2, std::ios_base::failure);
+
+    CSpanReader truncated(SER_DISK, 0, vSerialized.data(), 500);
+    BOOST_CHECK_THROW(truncated >> vch2, std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
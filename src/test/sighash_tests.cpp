@@ -139,6 +139,12 @@ BOOST_AUTO_TEST_CASE(sighash_test)
         uint256 sh, sho;
         sho = SignatureHashOld(scriptCode, txTo, nIn, nHashType);
         sh = SignatureHash(scriptCode, txTo, nIn, nHashType, 0, SIGVERSION_BASE);
+        PrecomputedTransactionData txdata(txTo);
+        BOOST_CHECK(SignatureHash(scriptCode, txTo, nIn, nHashType, 0, SIGVERSION_BASE, &txdata) == sho);
+        // The BIP143 hashes are computed the first time they are needed
+        CAmount amount = InsecureRand32();
+        BOOST_CHECK(SignatureHash(scriptCode, txTo, nIn, nHashType, amount, SIGVERSION_WITNESS_V0, &txdata) ==
+                    SignatureHash(scriptCode, txTo, nIn, nHashType, amount, SIGVERSION_WITNESS_V0));
         #if defined(PRINT_SIGHASH_JSON)
         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
         ss << txTo;
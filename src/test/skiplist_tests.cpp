@@ -177,4 +177,42 @@ BOOST_AUTO_TEST_CASE(findearliestatleast_edge_test)
     BOOST_CHECK(!chain.FindEarliestAtLeast(int64_t(std::numeric_limits<unsigned int>::max()) + 1));
 }
 
+BOOST_AUTO_TEST_CASE(chainsnapshot_test)
+{
+    // A main chain of 1000 blocks, and a branch splitting off at block 499.
+    std::vector<CBlockIndex> vBlocksMain(1000);
+    for (unsigned int i=0; i<vBlocksMain.size(); i++) {
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : nullptr;
+        vBlocksMain[i].BuildSkip();
+    }
+    std::vector<CBlockIndex> vBlocksSide(100);
+    for (unsigned int i=0; i<vBlocksSide.size(); i++) {
+        vBlocksSide[i].nHeight = i + 500;
+        vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[499];
+        vBlocksSide[i].BuildSkip();
+    }
+
+    CChainSnapshot empty;
+    BOOST_CHECK(empty.Tip() == nullptr);
+    BOOST_CHECK_EQUAL(empty.Height(), -1);
+    BOOST_CHECK(empty[0] == nullptr);
+
+    // The snapshot answers like the CChain with the same tip.
+    CChain chain;
+    chain.SetTip(&vBlocksMain.back());
+    CChainSnapshot snapshot(&vBlocksMain.back());
+    BOOST_CHECK(snapshot.Tip() == chain.Tip());
+    BOOST_CHECK_EQUAL(snapshot.Height(), chain.Height());
+    for (int n = -1; n <= 1000; n++) {
+        BOOST_CHECK(snapshot[n] == chain[n]);
+    }
+    for (const std::vector<CBlockIndex>* blocks : {&vBlocksMain, &vBlocksSide}) {
+        for (const CBlockIndex& block : *blocks) {
+            BOOST_CHECK_EQUAL(snapshot.Contains(&block), chain.Contains(&block));
+            BOOST_CHECK(snapshot.Next(&block) == chain.Next(&block));
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
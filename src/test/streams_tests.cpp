@@ -68,6 +68,33 @@ BOOST_AUTO_TEST_CASE(streams_vector_writer)
     vch.clear();
 }
 
+BOOST_AUTO_TEST_CASE(streams_span_reader)
+{
+    unsigned char bytes[] = { 1, 2, 0, 3, 4, 5, 6, 7 };
+    CSpanReader reader(SER_NETWORK, INIT_PROTO_VERSION, bytes, sizeof(bytes));
+    BOOST_CHECK_EQUAL(reader.size(), 8U);
+
+    unsigned char a;
+    uint16_t b;
+    reader >> a >> b;
+    BOOST_CHECK_EQUAL(a, 1);
+    BOOST_CHECK_EQUAL(b, 2);
+    BOOST_CHECK_EQUAL(reader.size(), 5U);
+
+    reader.ignore(1);
+    uint32_t c;
+    reader >> c;
+    BOOST_CHECK_EQUAL(c, 0x07060504U);
+    BOOST_CHECK(reader.empty());
+
+    // Reading past the end throws and does not consume anything
+    BOOST_CHECK_THROW(reader >> a, std::ios_base::failure);
+    BOOST_CHECK_THROW(reader.ignore(1), std::ios_base::failure);
+    CSpanReader short_reader(SER_NETWORK, INIT_PROTO_VERSION, bytes, 3);
+    BOOST_CHECK_THROW(short_reader >> c, std::ios_base::failure);
+    BOOST_CHECK_EQUAL(short_reader.size(), 3U);
+}
+
 BOOST_AUTO_TEST_CASE(streams_serializedata_xor)
 {
     std::vector<char> in;
@@ -123,4 +150,48 @@ BOOST_AUTO_TEST_CASE(streams_serializedata_xor)
             std::string(ds.begin(), ds.end()));  
 }         
 
+BOOST_AUTO_TEST_CASE(streams_xor_with_key)
+{
+    // The word-wide path for eight byte keys agrees with XOR byte by byte,
+    // at any offset and for any length
+    const std::vector<unsigned char> key{0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef};
+    std::vector<unsigned char> data(100);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = i * 7;
+    for (size_t offset = 0; offset < 8; offset++) {
+        for (size_t size = 0; size + offset <= data.size(); size++) {
+            std::vector<unsigned char> obfuscated(data);
+            XorWithKey(obfuscated.data() + offset, size, key);
+            for (size_t i = 0; i < data.size(); i++) {
+                const bool fInside = i >= offset && i < offset + size;
+                BOOST_CHECK_EQUAL(obfuscated[i], fInside ? (unsigned char)(data[i] ^ key[(i - offset) % 8]) : data[i]);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(streams_public_data_stream)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << uint32_t{0x01020304} << std::string("public") << std::vector<unsigned char>{5, 6, 7};
+
+    // Same encoding as CDataStream, and either buffer type can seed the other
+    CPublicDataStream ps(SER_NETWORK, PROTOCOL_VERSION);
+    ps << uint32_t{0x01020304} << std::string("public") << std::vector<unsigned char>{5, 6, 7};
+    BOOST_CHECK_EQUAL(ps.str(), ss.str());
+    CPublicDataStream ps2(CSerializeData(ss.begin(), ss.end()), SER_NETWORK, PROTOCOL_VERSION);
+    CDataStream ss2(std::vector<char>(ps.begin(), ps.end()), SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK_EQUAL(ps2.str(), ss2.str());
+
+    uint32_t n;
+    std::string str;
+    std::vector<unsigned char> vch;
+    ps2 >> n >> str >> vch;
+    BOOST_CHECK_EQUAL(n, 0x01020304U);
+    BOOST_CHECK_EQUAL(str, "public");
+    BOOST_CHECK(vch == std::vector<unsigned char>({5, 6, 7}));
+    BOOST_CHECK(ps2.empty());
+    BOOST_CHECK_THROW(ps2 >> n, std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
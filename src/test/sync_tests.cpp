@@ -0,0 +1,77 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <sync.h>
+#include <test/test_bitcoin.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sync_tests, BasicTestingSetup)
+
+static const LockStats* FindStats(const std::vector<LockStats>& vStats, int nLine)
+{
+    for (const LockStats& stats : vStats) {
+        if (stats.file == __FILE__ && stats.line == nLine)
+            return &stats;
+    }
+    return nullptr;
+}
+
+BOOST_AUTO_TEST_CASE(lock_stats)
+{
+    CCriticalSection cs;
+    g_lock_stats = true;
+
+    std::atomic<bool> fHeld(false);
+    int nHoldLine = __LINE__ + 3;
+    std::thread holder([&] {
+        {
+            LOCK(cs);
+            fHeld = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    });
+    while (!fHeld)
+        std::this_thread::yield();
+    int nWaitLine = __LINE__ + 2;
+    {
+        LOCK(cs);
+    }
+    holder.join();
+    int nTryLine = __LINE__ + 2;
+    {
+        TRY_LOCK(cs, lockTry);
+        bool fLocked = lockTry;
+        BOOST_CHECK(fLocked);
+    }
+    g_lock_stats = false;
+    {
+        // Not timed
+        LOCK(cs);
+    }
+
+    std::vector<LockStats> vStats = GetLockStats();
+    const LockStats* hold = FindStats(vStats, nHoldLine);
+    const LockStats* wait = FindStats(vStats, nWaitLine);
+    const LockStats* tried = FindStats(vStats, nTryLine);
+    BOOST_REQUIRE(hold && wait && tried);
+    BOOST_CHECK_EQUAL(hold->name, "cs");
+    BOOST_CHECK_EQUAL(hold->locks, 1U);
+    BOOST_CHECK_EQUAL(hold->contended, 0U);
+    BOOST_CHECK(hold->hold_micros >= 50000);
+    BOOST_CHECK_EQUAL(hold->max_hold_micros, hold->hold_micros);
+    BOOST_CHECK_EQUAL(wait->locks, 1U);
+    BOOST_CHECK_EQUAL(wait->contended, 1U);
+    BOOST_CHECK(wait->wait_micros > 0);
+    BOOST_CHECK_EQUAL(tried->locks, 1U);
+
+    ResetLockStats();
+    BOOST_CHECK(GetLockStats().empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
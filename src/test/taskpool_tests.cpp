@@ -0,0 +1,128 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <taskpool.h>
+
+#include <test/test_bitcoin.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(taskpool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(taskpool_group)
+{
+    // Without workers the tasks run on the calling thread, with them on the pool
+    for (int nThreads : {0, 1, 4}) {
+        CTaskPool pool;
+        pool.Start(nThreads);
+        BOOST_CHECK_EQUAL(pool.GetThreadCount(), nThreads);
+        std::vector<int> vDone(1000, 0);
+        CTaskGroup group(pool, TASK_PRIORITY_NORMAL);
+        for (size_t i = 0; i < vDone.size(); i++) {
+            group.Run([&vDone, i] { vDone[i]++; });
+        }
+        group.Wait();
+        for (int n : vDone) {
+            BOOST_CHECK_EQUAL(n, 1);
+        }
+
+        // Every copy of a ParallelRun worker shares the items
+        std::atomic<size_t> nNext(0), nSum(0);
+        const unsigned int nCopies = ParallelRun(pool, TASK_PRIORITY_BACKGROUND, 8, [&] {
+            for (size_t i = nNext++; i < 1000; i = nNext++) {
+                nSum += i;
+            }
+        });
+        BOOST_CHECK_EQUAL(nCopies, std::min(8, nThreads + 1));
+        BOOST_CHECK_EQUAL(nSum.load(), 999U * 1000 / 2);
+        pool.Stop();
+        BOOST_CHECK_EQUAL(pool.GetThreadCount(), 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(taskpool_group_exception)
+{
+    CTaskPool pool;
+    pool.Start(2);
+    std::atomic<int> nRun(0);
+    CTaskGroup group(pool, TASK_PRIORITY_HIGH);
+    for (int i = 0; i < 10; i++) {
+        group.Run([&nRun, i] {
+            nRun++;
+            if (i == 5) throw std::runtime_error("task failed");
+        });
+    }
+    BOOST_CHECK_THROW(group.Wait(), std::runtime_error);
+    // The other tasks still run, and the exception is only thrown once
+    BOOST_CHECK_EQUAL(nRun.load(), 10);
+    group.Wait();
+
+    // A task of the pool can wait for a group of its own
+    std::atomic<int> nNested(0);
+    CTaskGroup outer(pool, TASK_PRIORITY_NORMAL);
+    for (int i = 0; i < 4; i++) {
+        outer.Run([&pool, &nNested] {
+            CTaskGroup inner(pool, TASK_PRIORITY_NORMAL);
+            for (int j = 0; j < 4; j++) {
+                inner.Run([&nNested] { nNested++; });
+            }
+            inner.Wait();
+        });
+    }
+    outer.Wait();
+    BOOST_CHECK_EQUAL(nNested.load(), 16);
+}
+
+BOOST_AUTO_TEST_CASE(taskpool_priority)
+{
+    CTaskPool pool;
+    pool.Start(1);
+
+    // Hold up the only worker until all the tasks are queued
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool fRelease = false, fBlocked = false;
+    pool.Submit([&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        fBlocked = true;
+        cond.notify_all();
+        while (!fRelease) cond.wait(lock);
+    });
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!fBlocked) cond.wait(lock);
+    }
+
+    std::vector<int> vOrder;
+    CTaskGroup background(pool, TASK_PRIORITY_BACKGROUND), normal(pool, TASK_PRIORITY_NORMAL), high(pool, TASK_PRIORITY_HIGH);
+    for (int i = 0; i < 3; i++) {
+        background.Run([&vOrder, &mutex, i] { std::lock_guard<std::mutex> lock(mutex); vOrder.push_back(20 + i); });
+        normal.Run([&vOrder, &mutex, i] { std::lock_guard<std::mutex> lock(mutex); vOrder.push_back(10 + i); });
+        high.Run([&vOrder, &mutex, i] { std::lock_guard<std::mutex> lock(mutex); vOrder.push_back(i); });
+    }
+    BOOST_CHECK_EQUAL(pool.GetQueueSize(), 9U);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fRelease = true;
+        cond.notify_all();
+    }
+    // Let the worker run all of them before the groups are waited for, which would run them here
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (vOrder.size() < 9) cond.wait_for(lock, std::chrono::milliseconds(1));
+    }
+    high.Wait();
+    normal.Wait();
+    background.Wait();
+    BOOST_CHECK(vOrder == std::vector<int>({0, 1, 2, 10, 11, 12, 20, 21, 22}));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
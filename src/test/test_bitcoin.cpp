@@ -7,6 +7,7 @@
 #include <chainparams.h>
 #include <consensus/consensus.h>
 #include <consensus/validation.h>
+#include <crypto/aes.h>
 #include <crypto/sha256.h>
 #include <validation.h>
 #include <miner.h>
@@ -46,6 +47,7 @@ std::ostream& operator<<(std::ostream& os, const uint256& num)
 BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
 {
         SHA256AutoDetect();
+        AESAutoDetect();
         RandomInit();
         ECC_Start();
         SetupEnvironment();
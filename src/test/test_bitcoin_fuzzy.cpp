@@ -8,6 +8,7 @@
 
 #include <consensus/merkle.h>
 #include <primitives/block.h>
+#include <script/interpreter.h>
 #include <script/script.h>
 #include <addrman.h>
 #include <chain.h>
@@ -25,6 +26,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <cassert>
 #include <memory>
 #include <vector>
 
@@ -49,9 +51,20 @@ enum TEST_ID {
     CTXOUTCOMPRESSOR_DESERIALIZE,
     BLOCKTRANSACTIONS_DESERIALIZE,
     BLOCKTRANSACTIONSREQUEST_DESERIALIZE,
+    SCRIPT_VERIFY_STANDARD,
     TEST_ID_END
 };
 
+/** Accepts a signature depending on its bytes only, the same way every time */
+class FuzzSignatureChecker : public BaseSignatureChecker
+{
+public:
+    bool CheckSig(const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const override
+    {
+        return !vchSig.empty() && (vchSig[vchSig.size() / 2] & 1);
+    }
+};
+
 bool read_stdin(std::vector<uint8_t> &data) {
     uint8_t buffer[1024];
     ssize_t length=0;
@@ -269,6 +282,29 @@ int test_one_input(std::vector<uint8_t> buffer) {
 
             break;
         }
+        case SCRIPT_VERIFY_STANDARD:
+        {
+            try
+            {
+                // The fast paths of standard scripts must agree with the interpreter
+                unsigned int flags;
+                CScript scriptSig, scriptPubKey;
+                CScriptWitness witness;
+                ds >> flags >> scriptSig >> scriptPubKey >> witness.stack;
+                if (flags & SCRIPT_VERIFY_CLEANSTACK)
+                    flags |= SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS;
+                if (flags & SCRIPT_VERIFY_WITNESS)
+                    flags |= SCRIPT_VERIFY_P2SH;
+                FuzzSignatureChecker checker;
+                ScriptError serror, serrorGeneric;
+                bool fResult = VerifyScript(scriptSig, scriptPubKey, &witness, flags, checker, &serror);
+                bool fResultGeneric = VerifyScriptGeneric(scriptSig, scriptPubKey, &witness, flags, checker, &serrorGeneric);
+                assert(fResult == fResultGeneric);
+                assert(serror == serrorGeneric);
+            } catch (const std::ios_base::failure& e) {return 0;}
+
+            break;
+        }
         default:
             return 0;
     }
@@ -760,4 +760,49 @@ BOOST_AUTO_TEST_CASE(test_IsStandard)
     BOOST_CHECK(!IsStandardTx(t, reason));
 }
 
+BOOST_AUTO_TEST_CASE(test_hash_serialized)
+{
+    // Transactions read from memory are hashed from the bytes they were read
+    // from; the hashes must be those of serializing them again
+    CMutableTransaction mtx;
+    mtx.nVersion = 2;
+    mtx.nLockTime = 0x12345678;
+    mtx.vin.resize(2);
+    mtx.vin[0].prevout = COutPoint(InsecureRand256(), 1);
+    mtx.vin[0].scriptSig = CScript() << OP_1;
+    mtx.vin[1].prevout = COutPoint(InsecureRand256(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1000;
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+    for (bool fWitness : {false, true}) {
+        if (fWitness)
+            mtx.vin[1].scriptWitness.stack.push_back(std::vector<unsigned char>(72, 1));
+        const CTransaction tx(mtx);
+        for (int nVersion : {PROTOCOL_VERSION, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS}) {
+            CDataStream ss(SER_NETWORK, nVersion);
+            ss << tx;
+            const std::vector<unsigned char> data(ss.begin(), ss.end());
+            CSpanReader reader(SER_NETWORK, nVersion, data.data(), data.size());
+            for (const CTransaction& txRead : {CTransaction(deserialize, ss), CTransaction(deserialize, reader)}) {
+                BOOST_CHECK(txRead.GetHash() == tx.GetHash());
+                if (!(nVersion & SERIALIZE_TRANSACTION_NO_WITNESS))
+                    BOOST_CHECK(txRead.GetWitnessHash() == tx.GetWitnessHash());
+            }
+            BOOST_CHECK(ss.empty());
+        }
+    }
+
+    // The extended format without any witness serializes differently again
+    mtx.vin[1].scriptWitness.SetNull();
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << mtx.nVersion << (unsigned char)0 << (unsigned char)1 << mtx.vin << mtx.vout;
+    for (size_t i = 0; i < mtx.vin.size(); i++)
+        ss << std::vector<std::vector<unsigned char>>();
+    ss << mtx.nLockTime;
+    const CTransaction txRead(deserialize, ss);
+    BOOST_CHECK(txRead.GetHash() == mtx.GetHash());
+    BOOST_CHECK(txRead.GetWitnessHash() == mtx.GetHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
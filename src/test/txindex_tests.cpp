@@ -0,0 +1,97 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <index/txindex.h>
+#include <txdb.h>
+#include <utiltime.h>
+#include <validation.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(txindex_tests)
+
+//! Wait up to ten seconds for the sync thread to catch up
+static bool WaitForSync(CTxIndex& txindex)
+{
+    int64_t nTimeout = GetTimeMillis() + 10000;
+    while (!txindex.BlockUntilSyncedToCurrentChain()) {
+        if (GetTimeMillis() > nTimeout)
+            return false;
+        MilliSleep(100);
+    }
+    return true;
+}
+
+BOOST_FIXTURE_TEST_CASE(txindex_initial_sync, TestChain100Setup)
+{
+    CTxIndex txindex(1 << 20, true);
+    CTransactionRef tx;
+    uint256 hashBlock;
+
+    // Nothing is found before the index is built
+    BOOST_CHECK(!txindex.FindTx(coinbaseTxns[0].GetHash(), hashBlock, tx));
+    BOOST_CHECK(!txindex.BlockUntilSyncedToCurrentChain());
+
+    txindex.Start();
+    BOOST_REQUIRE(WaitForSync(txindex));
+    BOOST_CHECK(txindex.IsSynced());
+    BOOST_CHECK_EQUAL(txindex.GetBestHeight(), chainActive.Height());
+
+    for (int i = 0; i < (int)coinbaseTxns.size(); i++) {
+        BOOST_REQUIRE(txindex.FindTx(coinbaseTxns[i].GetHash(), hashBlock, tx));
+        BOOST_CHECK_EQUAL(tx->GetHash(), coinbaseTxns[i].GetHash());
+        BOOST_CHECK_EQUAL(hashBlock, chainActive[i + 1]->GetBlockHash());
+    }
+
+    // Blocks connected from now on are indexed by the validation callbacks
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    for (int i = 0; i < 10; i++) {
+        CBlock block = CreateAndProcessBlock({}, scriptPubKey);
+        BOOST_CHECK(txindex.BlockUntilSyncedToCurrentChain());
+        BOOST_REQUIRE(txindex.FindTx(block.vtx[0]->GetHash(), hashBlock, tx));
+        BOOST_CHECK_EQUAL(hashBlock, block.GetHash());
+    }
+    BOOST_CHECK_EQUAL(txindex.GetBestHeight(), chainActive.Height());
+
+    txindex.Interrupt();
+    txindex.Stop();
+}
+
+BOOST_FIXTURE_TEST_CASE(txindex_migrate_legacy, TestChain100Setup)
+{
+    // Write the index of the first 100 blocks to the block tree database, as older versions did
+    for (int i = 0; i < (int)coinbaseTxns.size(); i++) {
+        CDiskTxPos pos(chainActive[i + 1]->GetBlockPos(), GetSizeOfCompactSize(1));
+        BOOST_REQUIRE(pblocktree->Write(std::make_pair('t', coinbaseTxns[i].GetHash()), pos));
+    }
+    BOOST_REQUIRE(pblocktree->WriteFlag("txindex", true));
+
+    CTxIndex txindex(1 << 20, true);
+    txindex.Start();
+    BOOST_REQUIRE(WaitForSync(txindex));
+
+    CTransactionRef tx;
+    uint256 hashBlock;
+    for (int i = 0; i < (int)coinbaseTxns.size(); i++) {
+        BOOST_REQUIRE(txindex.FindTx(coinbaseTxns[i].GetHash(), hashBlock, tx));
+        BOOST_CHECK_EQUAL(hashBlock, chainActive[i + 1]->GetBlockHash());
+        BOOST_CHECK(!pblocktree->Exists(std::make_pair('t', coinbaseTxns[i].GetHash())));
+    }
+    bool fLegacy = true;
+    BOOST_CHECK(pblocktree->ReadFlag("txindex", fLegacy));
+    BOOST_CHECK(!fLegacy);
+
+    // The index continues from the tip the moved entries covered
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBlock block = CreateAndProcessBlock({}, scriptPubKey);
+    BOOST_CHECK(txindex.BlockUntilSyncedToCurrentChain());
+    BOOST_CHECK(txindex.FindTx(block.vtx[0]->GetHash(), hashBlock, tx));
+
+    txindex.Interrupt();
+    txindex.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
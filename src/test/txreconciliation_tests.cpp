@@ -0,0 +1,81 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <txreconciliation.h>
+
+#include <random.h>
+#include <streams.h>
+#include <version.h>
+#include <test/test_bitcoin.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txreconciliation_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(sketch_decode)
+{
+    FastRandomContext rand(true);
+    std::vector<uint32_t> vCommon, vOnlyLocal, vOnlyRemote;
+    for (int i = 0; i < 500; i++)
+        vCommon.push_back(rand.rand32());
+    for (int i = 0; i < 20; i++)
+        vOnlyLocal.push_back(rand.rand32());
+    for (int i = 0; i < 15; i++)
+        vOnlyRemote.push_back(rand.rand32());
+
+    size_t nCells = GetReconSketchCells(vCommon.size() + vOnlyLocal.size(), vCommon.size() + vOnlyRemote.size());
+    CReconSketch local(nCells), remote(nCells);
+    for (uint32_t id : vCommon) {
+        local.Insert(id);
+        remote.Insert(id);
+    }
+    for (uint32_t id : vOnlyLocal)
+        local.Insert(id);
+    for (uint32_t id : vOnlyRemote)
+        remote.Insert(id);
+
+    // The sketch survives the trip to the peer
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << remote;
+    CReconSketch received;
+    stream >> received;
+    BOOST_CHECK(received.IsValid());
+    BOOST_CHECK_EQUAL(received.GetCells(), local.GetCells());
+
+    local.Subtract(received);
+    std::vector<uint32_t> vInserted, vSubtracted;
+    BOOST_CHECK(local.Decode(vInserted, vSubtracted));
+    std::sort(vInserted.begin(), vInserted.end());
+    std::sort(vSubtracted.begin(), vSubtracted.end());
+    std::sort(vOnlyLocal.begin(), vOnlyLocal.end());
+    std::sort(vOnlyRemote.begin(), vOnlyRemote.end());
+    BOOST_CHECK(vInserted == vOnlyLocal);
+    BOOST_CHECK(vSubtracted == vOnlyRemote);
+}
+
+BOOST_AUTO_TEST_CASE(sketch_too_small)
+{
+    FastRandomContext rand(true);
+    CReconSketch local(MIN_RECON_SKETCH_CELLS), remote(MIN_RECON_SKETCH_CELLS);
+    for (int i = 0; i < 100; i++)
+        local.Insert(rand.rand32());
+    local.Subtract(remote);
+    std::vector<uint32_t> vInserted, vSubtracted;
+    BOOST_CHECK(!local.Decode(vInserted, vSubtracted));
+}
+
+BOOST_AUTO_TEST_CASE(sketch_cells)
+{
+    BOOST_CHECK_EQUAL(GetReconSketchCells(0, 0), MIN_RECON_SKETCH_CELLS);
+    BOOST_CHECK_EQUAL(GetReconSketchCells(1000000, 0), MAX_RECON_SKETCH_CELLS);
+    BOOST_CHECK(GetReconSketchCells(100, 100) < GetReconSketchCells(100, 200));
+    BOOST_CHECK(!CReconSketch().IsValid());
+    BOOST_CHECK(CReconSketch(MAX_RECON_SKETCH_CELLS).IsValid());
+    BOOST_CHECK(!CReconSketch(MAX_RECON_SKETCH_CELLS + 1).IsValid());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
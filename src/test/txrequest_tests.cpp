@@ -0,0 +1,127 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <txrequest.h>
+
+#include <arith_uint256.h>
+#include <test/test_bitcoin.h>
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txrequest_tests, BasicTestingSetup)
+
+static CInv TxInv(int n)
+{
+    return CInv(MSG_TX, ArithToUint256(arith_uint256(n + 1)));
+}
+
+BOOST_AUTO_TEST_CASE(txrequest_preferred_first)
+{
+    TxRequestTracker tracker;
+    const CInv inv = TxInv(0);
+    // Peer 1 is not preferred and announces first, but may only be asked later
+    BOOST_CHECK(tracker.ReceivedInv(1, inv, false, 100 + TX_REQUEST_NONPREFERRED_DELAY));
+    BOOST_CHECK(tracker.ReceivedInv(2, inv, true, 200));
+    BOOST_CHECK(!tracker.ReceivedInv(2, inv, true, 200));
+    BOOST_CHECK_EQUAL(tracker.Size(), 2U);
+
+    BOOST_CHECK(tracker.GetRequestable(1, 199).empty());
+    BOOST_CHECK(tracker.GetRequestable(2, 199).empty());
+    BOOST_CHECK(tracker.GetRequestable(1, 200).empty());
+    std::vector<CInv> vInv = tracker.GetRequestable(2, 200);
+    BOOST_CHECK_EQUAL(vInv.size(), 1U);
+    BOOST_CHECK(vInv[0].hash == inv.hash);
+
+    // Once both are candidates the preferred peer still goes first
+    const int64_t nLater = 100 + TX_REQUEST_NONPREFERRED_DELAY;
+    BOOST_CHECK(tracker.GetRequestable(1, nLater).empty());
+    BOOST_CHECK_EQUAL(tracker.GetRequestable(2, nLater).size(), 1U);
+
+    // Only one peer is asked at a time
+    tracker.RequestedTx(2, inv.hash, nLater + TX_REQUEST_EXPIRY);
+    BOOST_CHECK_EQUAL(tracker.CountInFlight(2), 1U);
+    BOOST_CHECK(tracker.GetRequestable(1, nLater).empty());
+    BOOST_CHECK(tracker.GetRequestable(2, nLater).empty());
+
+    // A notfound moves on to the next peer
+    tracker.ReceivedResponse(2, inv.hash);
+    BOOST_CHECK_EQUAL(tracker.Count(2), 0U);
+    vInv = tracker.GetRequestable(1, nLater);
+    BOOST_CHECK_EQUAL(vInv.size(), 1U);
+    BOOST_CHECK(vInv[0].hash == inv.hash);
+}
+
+BOOST_AUTO_TEST_CASE(txrequest_expiry)
+{
+    TxRequestTracker tracker;
+    const CInv inv = TxInv(0);
+    tracker.ReceivedInv(1, inv, true, 0);
+    tracker.ReceivedInv(2, inv, true, 0);
+    tracker.ReceivedInv(3, inv, true, 0);
+
+    // Announced first, asked first
+    BOOST_CHECK_EQUAL(tracker.GetRequestable(1, 0).size(), 1U);
+    tracker.RequestedTx(1, inv.hash, 1000);
+    // Requesting a transaction that was not picked for the peer does nothing
+    tracker.RequestedTx(3, inv.hash, 1000);
+    BOOST_CHECK_EQUAL(tracker.CountInFlight(3), 0U);
+
+    BOOST_CHECK(tracker.GetRequestable(2, 999).empty());
+    BOOST_CHECK_EQUAL(tracker.GetRequestable(2, 1000).size(), 1U);
+    BOOST_CHECK_EQUAL(tracker.Count(1), 0U);
+    BOOST_CHECK_EQUAL(tracker.CountInFlight(1), 0U);
+    tracker.RequestedTx(2, inv.hash, 2000);
+
+    // The peer asked going away moves on to the next one
+    tracker.DisconnectedPeer(2);
+    BOOST_CHECK_EQUAL(tracker.GetRequestable(3, 1000).size(), 1U);
+    tracker.DisconnectedPeer(3);
+    BOOST_CHECK_EQUAL(tracker.Size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(txrequest_forget)
+{
+    TxRequestTracker tracker;
+    for (int i = 0; i < 10; i++) {
+        tracker.ReceivedInv(1, TxInv(i), true, 0);
+        tracker.ReceivedInv(2, TxInv(i), false, 0);
+    }
+    std::vector<CInv> vInv = tracker.GetRequestable(1, 0);
+    BOOST_CHECK_EQUAL(vInv.size(), 10U);
+    // In the order they were announced
+    for (int i = 0; i < 10; i++)
+        BOOST_CHECK(vInv[i].hash == TxInv(i).hash);
+    tracker.RequestedTx(1, vInv[0].hash, 100);
+
+    tracker.ForgetTxHash(vInv[0].hash);
+    tracker.ForgetTxHash(vInv[1].hash);
+    BOOST_CHECK_EQUAL(tracker.Count(1), 8U);
+    BOOST_CHECK_EQUAL(tracker.Count(2), 8U);
+    BOOST_CHECK_EQUAL(tracker.CountInFlight(1), 0U);
+    BOOST_CHECK_EQUAL(tracker.GetRequestable(1, 0).size(), 8U);
+    BOOST_CHECK(tracker.GetRequestable(2, 0).empty());
+
+    tracker.DisconnectedPeer(1);
+    BOOST_CHECK_EQUAL(tracker.GetRequestable(2, 0).size(), 8U);
+    tracker.DisconnectedPeer(2);
+    BOOST_CHECK_EQUAL(tracker.Size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(txrequest_peer_limit)
+{
+    TxRequestTracker tracker;
+    for (size_t i = 0; i < MAX_PEER_TX_ANNOUNCEMENTS; i++)
+        BOOST_CHECK(tracker.ReceivedInv(1, TxInv(i), true, 0));
+    BOOST_CHECK(!tracker.ReceivedInv(1, TxInv(MAX_PEER_TX_ANNOUNCEMENTS), true, 0));
+    BOOST_CHECK(tracker.ReceivedInv(2, TxInv(MAX_PEER_TX_ANNOUNCEMENTS), true, 0));
+    BOOST_CHECK_EQUAL(tracker.Count(1), MAX_PEER_TX_ANNOUNCEMENTS);
+
+    // Answered announcements make room for new ones
+    tracker.ReceivedResponse(1, TxInv(0).hash);
+    BOOST_CHECK(tracker.ReceivedInv(1, TxInv(MAX_PEER_TX_ANNOUNCEMENTS), true, 0));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -91,6 +91,40 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+BOOST_FIXTURE_TEST_CASE(tx_mempool_block_scripts_verified, TestChain100Setup)
+{
+    // Scripts verified when a transaction entered the mempool are not run
+    // again when it is mined, even if the script execution cache lost them.
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+    spend.vin[0].prevout.n = 0;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11*CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    BOOST_CHECK(ToMemPool(spend));
+    {
+        LOCK(cs_main);
+        InitScriptExecutionCache();
+    }
+    uint64_t nMempoolHits = GetScriptExecutionCacheStats().nMempoolHits;
+
+    CBlock block = CreateAndProcessBlock({spend}, scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(GetScriptExecutionCacheStats().nMempoolHits, nMempoolHits + 1);
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+}
+
 // Run CheckInputs (using pcoinsTip) on the given transaction, for all script
 // flags.  Test that CheckInputs passes for all flags that don't overlap with
 // the failing_flags argument, but otherwise fails.
@@ -368,4 +402,105 @@ BOOST_FIXTURE_TEST_CASE(checkinputs_test, TestChain100Setup)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(tx_mempool_parallel_checks, TestChain100Setup)
+{
+    // Transactions with enough inputs have their scripts checked on the
+    // mempool script check queue, and are rejected for the same reason as
+    // when checked serially.
+    fParallelMempoolChecks = true;
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const size_t nInputs = MIN_PARALLEL_MEMPOOL_INPUTS;
+    for (size_t i = 1; i < nInputs; i++) {
+        CreateAndProcessBlock({}, scriptPubKey);
+    }
+
+    CKey keyWrong;
+    keyWrong.MakeNewKey(true);
+    for (const size_t nBadInput : {nInputs, (size_t)2}) {
+        CMutableTransaction spend;
+        spend.nVersion = 1;
+        spend.vin.resize(nInputs);
+        for (size_t i = 0; i < nInputs; i++) {
+            spend.vin[i].prevout = COutPoint(coinbaseTxns[i].GetHash(), 0);
+        }
+        spend.vout.resize(1);
+        spend.vout[0].nValue = 11*CENT;
+        spend.vout[0].scriptPubKey = scriptPubKey;
+        for (size_t i = 0; i < nInputs; i++) {
+            std::vector<unsigned char> vchSig;
+            uint256 hash = SignatureHash(scriptPubKey, spend, i, SIGHASH_ALL, 0, SIGVERSION_BASE);
+            BOOST_CHECK((i == nBadInput ? keyWrong : coinbaseKey).Sign(hash, vchSig));
+            vchSig.push_back((unsigned char)SIGHASH_ALL);
+            spend.vin[i].scriptSig << vchSig;
+        }
+
+        LOCK(cs_main);
+        CValidationState state;
+        bool fAccepted = AcceptToMemoryPool(mempool, state, MakeTransactionRef(spend), nullptr, nullptr, true, 0);
+        if (nBadInput < nInputs) {
+            fParallelMempoolChecks = false;
+            CValidationState stateSerial;
+            BOOST_CHECK(!AcceptToMemoryPool(mempool, stateSerial, MakeTransactionRef(spend), nullptr, nullptr, true, 0));
+            fParallelMempoolChecks = true;
+
+            int nDoS;
+            BOOST_CHECK(!fAccepted);
+            BOOST_CHECK(state.IsInvalid(nDoS) && nDoS == 100);
+            BOOST_CHECK_EQUAL(state.GetRejectReason(), stateSerial.GetRejectReason());
+        } else {
+            BOOST_CHECK(fAccepted);
+            mempool.clear();
+        }
+    }
+    fParallelMempoolChecks = DEFAULT_PARALLEL_MEMPOOL_CHECKS;
+}
+
+BOOST_FIXTURE_TEST_CASE(mempool_dump_load, TestChain100Setup)
+{
+    // Transactions are loaded back from mempool.dat in batches whose scripts
+    // are checked together, including children of parents in the same batch.
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const int nChains = 10;
+    const int nChainLength = 15;
+
+    std::vector<CMutableTransaction> spends;
+    auto AddSpend = [&](const COutPoint& prevout, const CScript& scriptCode, CAmount nValue) {
+        CMutableTransaction spend;
+        spend.nVersion = 1;
+        spend.vin.resize(1);
+        spend.vin[0].prevout = prevout;
+        spend.vout.emplace_back(nValue, scriptPubKey);
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptCode, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        spend.vin[0].scriptSig << vchSig;
+        BOOST_CHECK(ToMemPool(spend));
+        spends.push_back(spend);
+    };
+
+    // Mature a coinbase for each chain
+    for (int nChain = 1; nChain < nChains; nChain++) {
+        CreateAndProcessBlock({}, scriptPubKey);
+    }
+    for (int nChain = 0; nChain < nChains; nChain++) {
+        const CTransaction& coinbase = coinbaseTxns[nChain];
+        AddSpend(COutPoint(coinbase.GetHash(), 0), coinbase.vout[0].scriptPubKey, COIN);
+        for (int i = 1; i < nChainLength; i++) {
+            AddSpend(COutPoint(spends.back().GetHash(), 0), scriptPubKey, COIN - i * 1000);
+        }
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), spends.size());
+
+    BOOST_CHECK(DumpMempool());
+    mempool.clear();
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), spends.size());
+    for (const CMutableTransaction& spend : spends) {
+        BOOST_CHECK(mempool.exists(spend.GetHash()));
+    }
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
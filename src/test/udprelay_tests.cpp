@@ -0,0 +1,102 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <udprelay.h>
+
+#include <random.h>
+#include <test/test_bitcoin.h>
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(udprelay_tests, BasicTestingSetup)
+
+static std::vector<unsigned char> RandomData(FastRandomContext& rand, size_t nSize)
+{
+    std::vector<unsigned char> data(nSize);
+    for (unsigned char& c : data)
+        c = rand.randbits(8);
+    return data;
+}
+
+BOOST_AUTO_TEST_CASE(fec_parity_chunks)
+{
+    BOOST_CHECK_EQUAL(GetFECParityChunks(0), 0);
+    BOOST_CHECK_EQUAL(GetFECParityChunks(1), 1);
+    BOOST_CHECK_EQUAL(GetFECParityChunks(4), 1);
+    BOOST_CHECK_EQUAL(GetFECParityChunks(5), 2);
+    BOOST_CHECK_EQUAL(GetFECParityChunks(100), 25);
+}
+
+BOOST_AUTO_TEST_CASE(fec_recover)
+{
+    FastRandomContext rand(true);
+    const std::vector<unsigned char> data = RandomData(rand, 20 * UDP_RELAY_CHUNK_SIZE + 123);
+    const uint16_t nDataChunks = 21;
+    const uint16_t nParity = GetFECParityChunks(nDataChunks);
+    BOOST_CHECK_EQUAL(nParity, 6);
+    const std::vector<std::vector<unsigned char>> vChunks = FECEncode(data, nParity);
+    BOOST_CHECK_EQUAL(vChunks.size(), nDataChunks + nParity);
+
+    // All data chunks, in reverse order
+    {
+        FECDecoder decoder(data.size(), nDataChunks, nParity);
+        for (int i = nDataChunks - 1; i > 0; i--)
+            BOOST_CHECK(!decoder.ProvideChunk(i, vChunks[i].data()));
+        BOOST_CHECK(decoder.ProvideChunk(0, vChunks[0].data()));
+        BOOST_CHECK(decoder.GetData() == data);
+    }
+
+    // A burst of as many lost chunks as there are parity chunks
+    {
+        FECDecoder decoder(data.size(), nDataChunks, nParity);
+        for (size_t i = 0; i < vChunks.size(); i++) {
+            if (i >= 3 && i < 3u + nParity)
+                continue;
+            decoder.ProvideChunk(i, vChunks[i].data());
+        }
+        BOOST_CHECK(decoder.IsComplete());
+        BOOST_CHECK(decoder.GetData() == data);
+    }
+
+    // Parity chunks first, and a lost chunk at the end
+    {
+        FECDecoder decoder(data.size(), nDataChunks, nParity);
+        for (size_t i = nDataChunks; i < vChunks.size(); i++)
+            BOOST_CHECK(!decoder.ProvideChunk(i, vChunks[i].data()));
+        for (size_t i = 0; i < nDataChunks - 1; i++)
+            decoder.ProvideChunk(i, vChunks[i].data());
+        BOOST_CHECK(decoder.IsComplete());
+        BOOST_CHECK(decoder.GetData() == data);
+    }
+
+    // Two lost chunks of the same group cannot be recovered
+    {
+        FECDecoder decoder(data.size(), nDataChunks, nParity);
+        for (size_t i = 0; i < vChunks.size(); i++) {
+            if (i != 2 && i != 2u + nParity)
+                decoder.ProvideChunk(i, vChunks[i].data());
+        }
+        BOOST_CHECK(!decoder.IsComplete());
+        // Repeated chunks are ignored
+        BOOST_CHECK(!decoder.ProvideChunk(0, vChunks[0].data()));
+        BOOST_CHECK(decoder.ProvideChunk(2, vChunks[2].data()));
+        BOOST_CHECK(decoder.GetData() == data);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(fec_small)
+{
+    FastRandomContext rand(true);
+    const std::vector<unsigned char> data = RandomData(rand, 100);
+    const std::vector<std::vector<unsigned char>> vChunks = FECEncode(data, GetFECParityChunks(1));
+    BOOST_CHECK_EQUAL(vChunks.size(), 2U);
+    // With one data chunk the parity chunk is a copy of it
+    FECDecoder decoder(data.size(), 1, 1);
+    BOOST_CHECK(decoder.ProvideChunk(1, vChunks[1].data()));
+    BOOST_CHECK(decoder.GetData() == data);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,6 +6,7 @@
 
 #include <clientversion.h>
 #include <primitives/transaction.h>
+#include <random.h>
 #include <sync.h>
 #include <utilstrencodings.h>
 #include <utilmoneystr.h>
@@ -71,6 +72,37 @@ BOOST_AUTO_TEST_CASE(util_ParseHex)
     BOOST_CHECK(result.size() == 2 && result[0] == 0x12 && result[1] == 0x34);
 }
 
+BOOST_AUTO_TEST_CASE(util_ParseHex_long)
+{
+    // Long strings are decoded in blocks while they are plain hex; check that
+    // the bytes around and after the blocks come out the same as one at a time
+    FastRandomContext rng(true);
+    for (size_t len : {15, 16, 17, 31, 32, 33, 100, 1000}) {
+        const std::vector<unsigned char> data = rng.randbytes(len);
+        const std::string str = HexStr(data);
+        BOOST_CHECK(ParseHex(str) == data);
+        BOOST_CHECK(IsHex(str));
+
+        std::string upper = str;
+        for (char& c : upper) c = toupper(c);
+        BOOST_CHECK(ParseHex(upper) == data);
+        BOOST_CHECK(IsHex(upper));
+
+        // Parsing stops at an invalid character, and skips whitespace between bytes
+        for (size_t pos : {(size_t)0, len / 2, len - 1, len}) {
+            std::string invalid = str;
+            invalid.insert(pos * 2, "g0");
+            BOOST_CHECK(ParseHex(invalid) == std::vector<unsigned char>(data.begin(), data.begin() + pos));
+            BOOST_CHECK(!IsHex(invalid));
+
+            std::string spaced = str;
+            spaced.insert(pos * 2, " \n");
+            BOOST_CHECK(ParseHex(spaced) == data);
+            BOOST_CHECK(!IsHex(spaced));
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(util_HexStr)
 {
     BOOST_CHECK_EQUAL(
@@ -90,6 +122,18 @@ BOOST_AUTO_TEST_CASE(util_HexStr)
     BOOST_CHECK_EQUAL(
         HexStr(ParseHex_vec, true),
         "04 67 8a fd b0");
+
+    // Longer data is encoded in blocks
+    FastRandomContext rng(true);
+    for (size_t len : {15, 16, 17, 255, 256, 257, 1000}) {
+        const std::vector<unsigned char> data = rng.randbytes(len);
+        std::string expected;
+        for (unsigned char c : data) {
+            expected += strprintf("%02x", c);
+        }
+        BOOST_CHECK_EQUAL(HexStr(data), expected);
+        BOOST_CHECK_EQUAL(HexStr(data.begin() + 1, data.end()), expected.substr(2));
+    }
 }
 
 
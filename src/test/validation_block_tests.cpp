@@ -148,6 +148,9 @@ BOOST_AUTO_TEST_CASE(processnewblock_signals_ordering)
     }
     TestSubscriber sub(initial_tip->GetBlockHash());
     RegisterValidationInterface(&sub);
+    // and one notified on its own queue, which must see the same ordering
+    TestSubscriber sub_queued(initial_tip->GetBlockHash());
+    RegisterValidationInterface(&sub_queued, true);
 
     // create a bunch of threads that repeatedly process a block generated above at random
     // this will create parallelism and randomness inside validation - the ValidationInterface
@@ -177,8 +180,194 @@ BOOST_AUTO_TEST_CASE(processnewblock_signals_ordering)
     }
 
     UnregisterValidationInterface(&sub);
+    UnregisterValidationInterface(&sub_queued);
 
     BOOST_CHECK_EQUAL(sub.m_expected_tip, chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(sub_queued.m_expected_tip, chainActive.Tip()->GetBlockHash());
+}
+
+/** Records mempool notifications, as delivered by the default MempoolUpdated */
+struct MempoolSubscriber : public CValidationInterface {
+    std::vector<std::string> m_events;
+
+    void TransactionAddedToMempool(const CTransactionRef& tx) override
+    {
+        m_events.push_back("+" + tx->GetHash().ToString());
+    }
+
+    void TransactionRemovedFromMempool(const CTransactionRef& tx) override
+    {
+        m_events.push_back("-" + tx->GetHash().ToString());
+    }
+
+    void SetBestChain(const CBlockLocator& locator) override
+    {
+        m_events.push_back("chain");
+    }
+};
+
+/** Records the batches of mempool notifications themselves */
+struct BatchSubscriber : public MempoolSubscriber {
+    int m_batches = 0;
+
+    void MempoolUpdated(const std::vector<MempoolUpdate>& updates) override
+    {
+        BOOST_CHECK(!updates.empty());
+        m_batches++;
+        CValidationInterface::MempoolUpdated(updates);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(mempool_notifications_batched)
+{
+    std::vector<CTransactionRef> txs;
+    for (int i = 0; i < 3; i++) {
+        CMutableTransaction mtx;
+        mtx.nLockTime = i;
+        txs.push_back(MakeTransactionRef(std::move(mtx)));
+    }
+
+    MempoolSubscriber sub;
+    RegisterValidationInterface(&sub);
+    BatchSubscriber sub_queued;
+    RegisterValidationInterface(&sub_queued, true);
+
+    // Mempool notifications are delivered in order with respect to the
+    // others, and those pending are flushed before the next other one
+    GetMainSignals().TransactionAddedToMempool(txs[0]);
+    GetMainSignals().TransactionAddedToMempool(txs[1]);
+    GetMainSignals().SetBestChain(CBlockLocator());
+    GetMainSignals().TransactionAddedToMempool(txs[2]);
+    SyncWithValidationInterfaceQueue();
+
+    UnregisterValidationInterface(&sub);
+    UnregisterValidationInterface(&sub_queued);
+
+    std::vector<std::string> expected{"+" + txs[0]->GetHash().ToString(), "+" + txs[1]->GetHash().ToString(), "chain", "+" + txs[2]->GetHash().ToString()};
+    BOOST_CHECK(sub.m_events == expected);
+    BOOST_CHECK(sub_queued.m_events == expected);
+    BOOST_CHECK(sub_queued.m_batches >= 2 && sub_queued.m_batches <= 3);
+
+    // Unregistered listeners are not notified
+    GetMainSignals().TransactionAddedToMempool(txs[0]);
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK_EQUAL(sub.m_events.size(), expected.size());
+    BOOST_CHECK_EQUAL(sub_queued.m_events.size(), expected.size());
+}
+
+BOOST_AUTO_TEST_CASE(pipelined_connect)
+{
+    // a chain of good blocks, then an invalid one with more good blocks on top
+    std::vector<std::shared_ptr<const CBlock>> blocks;
+    uint256 prev_hash = Params().GenesisBlock().GetHash();
+    for (int i = 0; i < 22; i++) {
+        blocks.push_back(i == 13 ? BadBlock(prev_hash) : GoodBlock(prev_hash));
+        prev_hash = blocks.back()->GetHash();
+    }
+
+    CValidationState state;
+    std::vector<CBlockHeader> headers;
+    std::transform(blocks.begin(), blocks.end(), std::back_inserter(headers), [](std::shared_ptr<const CBlock> b) { return b->GetBlockHeader(); });
+    BOOST_CHECK(ProcessNewBlockHeaders(headers, state, Params()));
+
+    // hand the blocks over last to first, so they are all connected in one go
+    const unsigned int nScriptCheckPipelineBlocksOld = nScriptCheckPipelineBlocks;
+    nScriptCheckPipelineBlocks = 4;
+    bool ignored;
+    for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+        ProcessNewBlock(Params(), *it, true, &ignored);
+    }
+    nScriptCheckPipelineBlocks = nScriptCheckPipelineBlocksOld;
+
+    LOCK(cs_main);
+    BOOST_CHECK_EQUAL(chainActive.Height(), 13);
+    BOOST_CHECK_EQUAL(chainActive.Tip()->GetBlockHash(), blocks[12]->GetHash());
+    BOOST_CHECK(mapBlockIndex[blocks[13]->GetHash()]->nStatus & BLOCK_FAILED_VALID);
+    for (int i = 0; i < 13; i++) {
+        BOOST_CHECK(chainActive[i + 1]->IsValid(BLOCK_VALID_SCRIPTS));
+        BOOST_CHECK(!chainActive[i + 1]->GetUndoPos().IsNull());
+    }
+    BOOST_CHECK_EQUAL(pcoinsTip->GetBestBlock(), blocks[12]->GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(unserialize_block_parallel_hashing)
+{
+    CBlock block;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    for (int i = 0; i < 50; i++) {
+        tx.vin[0].prevout.hash = InsecureRand256();
+        tx.vin[0].prevout.n = i;
+        // Give every other transaction a witness, so that txid and wtxid differ.
+        tx.vin[0].scriptWitness.stack.assign(i % 2, std::vector<unsigned char>(i, 0x42));
+        tx.vout[0].nValue = i;
+        block.vtx.push_back(MakeTransactionRef(tx));
+    }
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block;
+
+    const bool fParallelBlockHashingOld = fParallelBlockHashing;
+    fParallelBlockHashing = true;
+    CBlock block2;
+    UnserializeBlock(stream, block2);
+    fParallelBlockHashing = fParallelBlockHashingOld;
+
+    BOOST_CHECK(stream.empty());
+    BOOST_CHECK_EQUAL(block2.GetHash(), block.GetHash());
+    BOOST_REQUIRE_EQUAL(block2.vtx.size(), block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        BOOST_CHECK_EQUAL(block2.vtx[i]->GetHash(), block.vtx[i]->GetHash());
+        BOOST_CHECK_EQUAL(block2.vtx[i]->GetWitnessHash(), block.vtx[i]->GetWitnessHash());
+        BOOST_CHECK_EQUAL(block2.vtx[i]->GetWitnessHash(), SerializeHash(*block.vtx[i], SER_GETHASH, 0));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(checkblock_transactions)
+{
+    // Enough transactions for CheckBlock to check them on several threads
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << OP_1 << OP_1;
+    coinbase.vout.resize(1);
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    CMutableTransaction tx;
+    tx.vin.resize(2);
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_CHECKSIG;
+    for (int i = 1; i < 2000; i++) {
+        tx.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+        tx.vin[1].prevout = COutPoint(InsecureRand256(), 1);
+        block.vtx.push_back(MakeTransactionRef(tx));
+    }
+
+    CValidationState state;
+    BOOST_CHECK(CheckBlock(block, state, Params().GetConsensus(), false, false));
+    BOOST_CHECK(state.IsValid());
+
+    // Duplicate inputs are found in blocks too, and the first invalid
+    // transaction is the one reported
+    tx.vin[1].prevout = tx.vin[0].prevout;
+    block.vtx[1500] = MakeTransactionRef(tx);
+    tx.vin[1].prevout = COutPoint(InsecureRand256(), 1);
+    tx.vout[0].nValue = -1;
+    block.vtx[1700] = MakeTransactionRef(tx);
+    BOOST_CHECK(!CheckBlock(block, state, Params().GetConsensus(), false, false));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-inputs-duplicate");
+    BOOST_CHECK(state.GetDebugMessage().find(block.vtx[1500]->GetHash().ToString()) != std::string::npos);
+
+    // Legacy sigops are counted from the counts cached in the transactions
+    tx.vout[0].nValue = 0;
+    tx.vout[0].scriptPubKey = CScript();
+    for (int i = 0; i < 500; i++)
+        tx.vout[0].scriptPubKey << OP_CHECKMULTISIG;
+    block.vtx[1500] = block.vtx[1700] = MakeTransactionRef(tx);
+    BOOST_CHECK_EQUAL(block.vtx[1500]->GetLegacySigOpCount(), 500U * MAX_PUBKEYS_PER_MULTISIG);
+    CValidationState stateSigOps;
+    BOOST_CHECK(!CheckBlock(block, stateSigOps, Params().GetConsensus(), false, false));
+    BOOST_CHECK_EQUAL(stateSigOps.GetRejectReason(), "bad-blk-sigops");
 }
 
 BOOST_AUTO_TEST_SUITE_END()
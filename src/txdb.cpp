@@ -6,14 +6,20 @@
 #include <txdb.h>
 
 #include <chainparams.h>
+#include <coinslog.h>
+#include <coinstats.h>
+#include <compressor.h>
 #include <hash.h>
 #include <random.h>
 #include <pow.h>
+#include <taskpool.h>
 #include <uint256.h>
 #include <util.h>
 #include <ui_interface.h>
 #include <init.h>
 
+#include <atomic>
+#include <mutex>
 #include <stdint.h>
 
 #include <boost/thread.hpp>
@@ -21,14 +27,18 @@
 static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
-static const char DB_TXINDEX = 't';
+static const char DB_TXINDEX = 't'; //!< Only in databases of older versions, see MoveTxIndex
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_HEAD_BLOCKS = 'H';
+static const char DB_COIN_STATS = 'S';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';//reindex标志key
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_SYNC_CHECKPOINT = 'K';
+static const char DB_COINS_FORMAT = 'V';
+static const char DB_COINS_FORMAT_PROGRESS = 'v';
 
 namespace {
 
@@ -54,14 +64,172 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+/** Serialization version of the values of a chainstate of format nFormat */
+static int GetCoinsValueVersion(int nFormat)
 {
+    return nFormat >= COINS_FORMAT_WITNESS_TEMPLATES ? (CLIENT_VERSION | SERIALIZE_SCRIPT_WITNESS_TEMPLATES) : CLIENT_VERSION;
+}
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, const DBOptions& dboptions) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true, dboptions), nFormat(COINS_FORMAT_ORIGINAL)
+{
+    if (!db.Read(DB_COINS_FORMAT, nFormat) && !db.Exists(DB_BEST_BLOCK) && !db.Exists(DB_HEAD_BLOCKS)) {
+        // A new chainstate starts out in the current format
+        nFormat = COINS_FORMAT_WITNESS_TEMPLATES;
+        db.Write(DB_COINS_FORMAT, nFormat);
+    }
+    db.SetValueVersion(GetCoinsValueVersion(nFormat));
 }
 
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
+void CCoinsViewDB::CompactRange(const COutPoint& begin, const COutPoint& end) {
+    db.CompactRange(CoinEntry(&begin), CoinEntry(&end));
+}
+
+size_t CCoinsViewDB::GetCoins(const std::vector<COutPoint>& outpoints, std::vector<Coin>& coins) const {
+    std::vector<CoinEntry> entries;
+    entries.reserve(outpoints.size());
+    for (const COutPoint& outpoint : outpoints) {
+        entries.emplace_back(&outpoint);
+    }
+    std::vector<bool> vfFound;
+    db.ReadMany(entries, coins, vfFound);
+    size_t nFound = 0;
+    for (size_t i = 0; i < coins.size(); i++) {
+        if (vfFound[i] && !coins[i].IsSpent()) {
+            nFound++;
+        } else {
+            coins[i].Clear();
+        }
+    }
+    return nFound;
+}
+
+std::string DetectCoinsBackend(const fs::path& path)
+{
+    if (fs::exists(path / COINS_LOG_FILENAME)) return "log";
+    if (fs::exists(path / "CURRENT")) return "leveldb";
+    return "";
+}
+
+bool IsCoinsBackend(const std::string& strBackend)
+{
+    return strBackend == "leveldb" || strBackend == "log";
+}
+
+std::unique_ptr<CCoinsViewStore> OpenCoinsViewStore(const std::string& strBackend, size_t nCacheSize, bool fMemory, bool fWipe, const DBOptions& dboptions)
+{
+    const fs::path path = GetDataDir() / "chainstate";
+    if (fWipe && !fMemory) {
+        // Including the files of the other backend, so that a wipe can switch between them
+        LogPrintf("Wiping chainstate in %s\n", path.string());
+        fs::remove_all(path);
+    }
+    if (strBackend == "log") {
+        return std::unique_ptr<CCoinsViewStore>(new CCoinsViewLog(path));
+    }
+    return std::unique_ptr<CCoinsViewStore>(new CCoinsViewDB(nCacheSize, fMemory, fWipe, dboptions));
+}
+
+CCoinsViewPrefetch::CCoinsViewPrefetch(CCoinsView* viewIn, CCoinsView* sourceIn) : CCoinsViewBacked(viewIn), source(sourceIn), nGeneration(0), nHits(0), nMisses(0) {}
+
+void CCoinsViewPrefetch::Fetch(const COutPoint& outpoint)
+{
+    uint64_t nGenerationStart;
+    {
+        LOCK(cs_prefetch);
+        if (mapPrefetched.size() >= MAX_PREFETCHED_COINS || mapPrefetched.count(outpoint))
+            return;
+        nGenerationStart = nGeneration;
+    }
+    Coin coin;
+    try {
+        if (!source->GetCoin(outpoint, coin) || coin.IsSpent())
+            return;
+    } catch (const std::runtime_error& e) {
+        // Leave it to the synchronous lookup to report the error.
+        return;
+    }
+    LOCK(cs_prefetch);
+    if (nGeneration == nGenerationStart) {
+        mapPrefetched.emplace(outpoint, std::move(coin));
+    }
+}
+
+bool CCoinsViewPrefetch::GetCoin(const COutPoint& outpoint, Coin& coin) const
+{
+    {
+        LOCK(cs_prefetch);
+        auto it = mapPrefetched.find(outpoint);
+        if (it != mapPrefetched.end()) {
+            coin = std::move(it->second);
+            mapPrefetched.erase(it);
+            nHits++;
+            return true;
+        }
+    }
+    nMisses++;
+    return base->GetCoin(outpoint, coin);
+}
+
+size_t CCoinsViewPrefetch::GetCoins(const std::vector<COutPoint>& outpoints, std::vector<Coin>& coins) const
+{
+    coins.resize(outpoints.size());
+    size_t nFound = 0;
+    std::vector<COutPoint> vMissing;
+    std::vector<size_t> vMissingPos;
+    {
+        LOCK(cs_prefetch);
+        for (size_t i = 0; i < outpoints.size(); i++) {
+            auto it = mapPrefetched.find(outpoints[i]);
+            if (it != mapPrefetched.end()) {
+                coins[i] = std::move(it->second);
+                mapPrefetched.erase(it);
+                nFound++;
+            } else {
+                vMissing.push_back(outpoints[i]);
+                vMissingPos.push_back(i);
+            }
+        }
+    }
+    nHits += nFound;
+    nMisses += vMissing.size();
+    if (vMissing.empty()) return nFound;
+    std::vector<Coin> vCoins;
+    nFound += base->GetCoins(vMissing, vCoins);
+    for (size_t i = 0; i < vMissing.size(); i++) {
+        coins[vMissingPos[i]] = std::move(vCoins[i]);
+    }
+    return nFound;
+}
+
+bool CCoinsViewPrefetch::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase)
+{
+    bool ret = base->BatchWrite(mapCoins, hashBlock, fErase);
+    LOCK(cs_prefetch);
+    nGeneration++;
+    mapPrefetched.clear();
+    return ret;
+}
+
+void CCoinsViewPrefetch::GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut) const
+{
+    nHitsOut = nHits;
+    nMissesOut = nMisses;
+}
+
+size_t CCoinsViewPrefetch::DynamicMemoryUsage() const
+{
+    LOCK(cs_prefetch);
+    size_t nUsage = memusage::DynamicUsage(mapPrefetched);
+    for (const auto& entry : mapPrefetched) {
+        nUsage += entry.second.DynamicMemoryUsage();
+    }
+    return nUsage;
+}
+
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
     return db.Exists(CoinEntry(&outpoint));
 }
@@ -81,7 +249,7 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
     return vhashHeadBlocks;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -116,8 +284,11 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            it = mapCoins.erase(it);
+        } else {
+            ++it;
+        }
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -135,6 +306,13 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     // In the last batch, mark the database as consistent with hashBlock again.
     batch.Erase(DB_HEAD_BLOCKS);
     batch.Write(DB_BEST_BLOCK, hashBlock);
+    if (m_coins_stats) {
+        if (m_coins_stats->hashBlock == hashBlock) {
+            batch.Write(DB_COIN_STATS, *m_coins_stats);
+        } else {
+            batch.Erase(DB_COIN_STATS);
+        }
+    }
 
     LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
     bool ret = db.WriteBatch(batch);
@@ -147,7 +325,7 @@ size_t CCoinsViewDB::EstimateSize() const
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, const DBOptions& dboptions) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, false, dboptions) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -172,13 +350,18 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
-CCoinsViewCursor *CCoinsViewDB::Cursor() const
+bool CCoinsViewDB::ReadCoinsStats(CIncrementalCoinsStats& stats) const
+{
+    return db.Read(DB_COIN_STATS, stats);
+}
+
+CCoinsViewCursor *CCoinsViewDB::Cursor(const COutPoint& start) const
 {
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COIN);
+    i->pcursor->Seek(CoinEntry(&start));
     // Cache key of first record
     if (i->pcursor->Valid()) {
         CoinEntry entry(&i->keyTmp.second);
@@ -226,7 +409,7 @@ void CCoinsViewDBCursor::Next()
     }
 }
 
-bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
+bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo, bool fSync) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_FILES, it->first), *it->second);
@@ -235,18 +418,41 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
     }
-    return WriteBatch(batch, true);
+    return WriteBatch(batch, fSync);
 }
 
-bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
-    return Read(std::make_pair(DB_TXINDEX, txid), pos);
-}
+bool CBlockTreeDB::MoveTxIndex(CDBWrapper& dest, const std::function<bool()>& fnInterrupted) {
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(DB_TXINDEX);
 
-bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
-    CDBBatch batch(*this);
-    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(std::make_pair(DB_TXINDEX, it->first), it->second);
-    return WriteBatch(batch);
+    CDBBatch batchDest(dest);
+    CDBBatch batchErase(*this);
+    size_t nMoved = 0;
+    bool fDone = false;
+    while (!fDone) {
+        std::pair<char, uint256> key;
+        fDone = !pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_TXINDEX;
+        if (!fDone) {
+            CDiskTxPos pos;
+            if (!pcursor->GetValue(pos))
+                return error("%s: failed to read the entry of %s", __func__, key.second.ToString());
+            batchDest.Write(key, pos);
+            batchErase.Erase(key);
+            nMoved++;
+            pcursor->Next();
+        }
+        if (fDone || batchDest.SizeEstimate() > MAX_TXINDEX_MOVE_BATCH_SIZE) {
+            // The entries must be on disk at their new place before they are erased here
+            if (!dest.WriteBatch(batchDest, true) || !WriteBatch(batchErase))
+                return error("%s: failed to move the transaction index", __func__);
+            batchDest.Clear();
+            batchErase.Clear();
+            LogPrintf("Moved %u transaction index entries\n", nMoved);
+            if (!fDone && fnInterrupted())
+                return false;
+        }
+    }
+    return WriteFlag("txindex", false);
 }
 
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
@@ -261,21 +467,44 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
-{
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+bool CBlockTreeDB::WriteSyncCheckpoint(int nHeight) {
+    return Write(DB_SYNC_CHECKPOINT, nHeight, true);
+}
 
-    pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
+bool CBlockTreeDB::ReadSyncCheckpoint(int &nHeight) {
+    return Read(DB_SYNC_CHECKPOINT, nHeight);
+}
 
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
+bool CBlockTreeDB::EraseSyncCheckpoint() {
+    return Erase(DB_SYNC_CHECKPOINT, true);
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+{
+    int64_t nStart = GetTimeMillis();
+
+    // Each thread reads the entries whose hash begins with a range of byte
+    // values, deserializes and checks them outside of the lock, and inserts
+    // them in batches.
+    const int nThreads = std::max(1, std::min(GetNumCores(), MAX_BLOCK_INDEX_LOAD_THREADS));
+    std::mutex cs_insert;
+    std::atomic<size_t> nEntries(0), nChecked(0);
+    std::vector<std::string> vErrors(nThreads);
+
+    auto load_range = [&](int i) {
+        std::unique_ptr<CDBIterator> pcursor(NewIterator());
+        uint256 start;
+        *start.begin() = 256 * i / nThreads;
+        const int nEnd = 256 * (i + 1) / nThreads;
+        pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, start));
+
+        std::vector<std::pair<uint256, CDiskBlockIndex>> vBatch;
+        auto insert_batch = [&]() {
+            std::lock_guard<std::mutex> lock(cs_insert);
+            for (const std::pair<uint256, CDiskBlockIndex>& entry : vBatch) {
+                const CDiskBlockIndex& diskindex = entry.second;
                 // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
+                CBlockIndex* pindexNew = insertBlockIndex(entry.first);
                 pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
                 pindexNew->nHeight        = diskindex.nHeight;
                 pindexNew->nFile          = diskindex.nFile;
@@ -288,19 +517,55 @@ bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams,
                 pindexNew->nNonce         = diskindex.nNonce;
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nTx            = diskindex.nTx;
-
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, consensusParams))
-                    return error("%s: CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
-
-                pcursor->Next();
-            } else {
-                return error("%s: failed to read value", __func__);
             }
-        } else {
-            break;
+            nEntries += vBatch.size();
+            vBatch.clear();
+        };
+
+        while (pcursor->Valid()) {
+            std::pair<char, uint256> key;
+            if (!pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX || *key.second.begin() >= nEnd)
+                break;
+            CDiskBlockIndex diskindex;
+            if (!pcursor->GetValue(diskindex)) {
+                vErrors[i] = "failed to read value";
+                return;
+            }
+            // Blocks that were fully validated were checked when they were
+            // received; trust the hash they are stored under instead of
+            // hashing their header again.
+            if (!diskindex.IsValid(BLOCK_VALID_SCRIPTS)) {
+                const uint256 hash = diskindex.GetBlockHash();
+                if (hash != key.second) {
+                    vErrors[i] = strprintf("header of %s has hash %s", key.second.ToString(), hash.ToString());
+                    return;
+                }
+                if (!CheckProofOfWork(hash, diskindex.nBits, consensusParams)) {
+                    vErrors[i] = strprintf("CheckProofOfWork failed: %s", diskindex.ToString());
+                    return;
+                }
+                nChecked++;
+            }
+            vBatch.emplace_back(key.second, diskindex);
+            if (vBatch.size() >= 1000)
+                insert_batch();
+            pcursor->Next();
         }
+        insert_batch();
+    };
+
+    CTaskGroup group(g_task_pool, TASK_PRIORITY_HIGH);
+    for (int i = 0; i < nThreads; i++) {
+        group.Run(std::bind(load_range, i));
+    }
+    group.Wait();
+    for (const std::string& strError : vErrors) {
+        if (!strError.empty())
+            return error("%s: %s", __func__, strError);
     }
 
+    LogPrintf("%s: read %u entries in %dms using %d threads, checked the proof of work of %u\n", __func__,
+        nEntries.load(), GetTimeMillis() - nStart, nThreads, nChecked.load());
     return true;
 }
 
@@ -361,9 +626,14 @@ public:
 
 /** Upgrade the database from older formats.
  *
- * Currently implemented: from the per-tx utxo model (0.8..0.14.x) to per-txout.
+ * Currently implemented: from the per-tx utxo model (0.8..0.14.x) to per-txout,
+ * and then to the extended script templates (COINS_FORMAT_WITNESS_TEMPLATES).
  */
 bool CCoinsViewDB::Upgrade() {
+    return UpgradePerTxOut() && UpgradeScriptTemplates();
+}
+
+bool CCoinsViewDB::UpgradePerTxOut() {
     std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
     pcursor->Seek(std::make_pair(DB_COINS, uint256()));
     if (!pcursor->Valid()) {
@@ -426,3 +696,84 @@ bool CCoinsViewDB::Upgrade() {
     LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
     return !ShutdownRequested();
 }
+
+bool CCoinsViewDB::UpgradeScriptTemplates() {
+    if (nFormat > COINS_FORMAT_WITNESS_TEMPLATES) {
+        return error("%s: unknown chainstate format %d", __func__, nFormat);
+    }
+    if (nFormat == COINS_FORMAT_WITNESS_TEMPLATES) {
+        return true;
+    }
+
+    // The coins up to the recorded one were rewritten by an interrupted upgrade
+    COutPoint last(uint256(), 0);
+    const bool fResume = db.Read(DB_COINS_FORMAT_PROGRESS, last);
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(CoinEntry(&last));
+
+    int64_t count = 0;
+    LogPrintf("Upgrading utxo-set database to the extended script templates%s...\n", fResume ? " (resuming)" : "");
+    LogPrintf("[0%%]...");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0, true);
+    size_t batch_size = 1 << 24;
+    CDBBatch batch(db, GetCoinsValueVersion(COINS_FORMAT_WITNESS_TEMPLATES));
+    int reportDone = 0;
+    COutPoint prev = last;
+    COutPoint outpoint;
+    CoinEntry entry(&outpoint);
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            break;
+        }
+        if (!pcursor->GetKey(entry) || entry.key != DB_COIN) {
+            break;
+        }
+        if (fResume && outpoint == last) {
+            pcursor->Next();
+            continue;
+        }
+        if (count++ % 256 == 0) {
+            uint32_t high = 0x100 * *outpoint.hash.begin() + *(outpoint.hash.begin() + 1);
+            int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
+            uiInterface.ShowProgress(_("Upgrading UTXO database"), percentageDone, true);
+            if (reportDone < percentageDone/10) {
+                // report max. every 10% step
+                LogPrintf("[%d%%]...", percentageDone);
+                reportDone = percentageDone/10;
+            }
+        }
+        Coin coin;
+        if (!pcursor->GetValue(coin)) {
+            return error("%s: cannot parse coin record", __func__);
+        }
+        batch.Write(entry, coin);
+        last = outpoint;
+        if (batch.SizeEstimate() > batch_size) {
+            // The progress is written along with the coins, so that a crash
+            // never leaves coins whose format is unknown
+            batch.Write(DB_COINS_FORMAT_PROGRESS, last);
+            db.WriteBatch(batch);
+            batch.Clear();
+            db.CompactRange(CoinEntry(&prev), CoinEntry(&last));
+            prev = last;
+        }
+        pcursor->Next();
+    }
+    if (ShutdownRequested()) {
+        batch.Write(DB_COINS_FORMAT_PROGRESS, last);
+        db.WriteBatch(batch, true);
+        uiInterface.ShowProgress("", 100, false);
+        LogPrintf("[CANCELLED].\n");
+        return false;
+    }
+    nFormat = COINS_FORMAT_WITNESS_TEMPLATES;
+    batch.Write(DB_COINS_FORMAT, nFormat);
+    batch.Erase(DB_COINS_FORMAT_PROGRESS);
+    db.WriteBatch(batch, true);
+    db.SetValueVersion(GetCoinsValueVersion(nFormat));
+    db.CompactRange(CoinEntry(&prev), CoinEntry(&last));
+    uiInterface.ShowProgress("", 100, false);
+    LogPrintf("[DONE].\n");
+    return true;
+}
@@ -9,15 +9,20 @@
 #include <coins.h>
 #include <dbwrapper.h>
 #include <chain.h>
+#include <sync.h>
 
+#include <atomic>
+#include <functional>
 #include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 class CBlockIndex;
 class CCoinsViewDBCursor;
+class CIncrementalCoinsStats;
 class uint256;
 
 //! No need to periodic flush if at least this much space still available.
@@ -30,14 +35,27 @@ static const int64_t nDefaultDbBatchSize = 16 << 20;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
 static const int64_t nMinDbCache = 4;
-//! Max memory allocated to block tree DB specific cache, if no -txindex (MiB)
+//! Max memory allocated to block tree DB specific cache (MiB)
 static const int64_t nMaxBlockDBCache = 2;
-//! Max memory allocated to block tree DB specific cache, if -txindex (MiB)
+//! Max memory allocated to the txindex DB specific cache (MiB)
 // Unlike for the UTXO database, for the txindex scenario the leveldb cache make
 // a meaningful difference: https://github.com/bitcoin/bitcoin/pull/8273#issuecomment-229601991
-static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
+static const int64_t nMaxTxIndexCache = 1024;
+//! Max memory allocated to the block filter index cache in MiB
+static const int64_t nMaxFilterIndexCache = 1024;
+//! Max memory allocated to the address index cache in MiB
+static const int64_t nMaxAddressIndexCache = 1024;
+//! Bytes of transaction index entries moved out of the block tree DB at a time
+static const size_t MAX_TXINDEX_MOVE_BATCH_SIZE = 16 << 20;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! Max number of threads reading the block index database at startup
+static const int MAX_BLOCK_INDEX_LOAD_THREADS = 8;
+
+//! Chainstate format of the coins serialized with the original script templates
+static const int COINS_FORMAT_ORIGINAL = 0;
+//! Chainstate format of the coins serialized with SERIALIZE_SCRIPT_WITNESS_TEMPLATES, that new chainstates start out in
+static const int COINS_FORMAT_WITNESS_TEMPLATES = 1;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -64,24 +82,129 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
+//! -coinsbackend default
+static const char* const DEFAULT_COINS_BACKEND = "leveldb";
+
+/**
+ * Storage of the chainstate (chainstate/), which BatchWrite changes only as a
+ * whole: a view over it shows all coins of GetBestBlock() or, after an
+ * interrupted write, reports the blocks in between through GetHeadBlocks().
+ * Implemented by CCoinsViewDB and CCoinsViewLog, see -coinsbackend.
+ */
+class CCoinsViewStore : public CCoinsView
+{
+protected:
+    const CIncrementalCoinsStats* m_coins_stats = nullptr;
+
+public:
+    CCoinsViewCursor *Cursor() const override { return Cursor(COutPoint(uint256(), 0)); }
+    //! Cursor over the coins from start on, in the order of their outpoints (txid, then output index)
+    virtual CCoinsViewCursor *Cursor(const COutPoint& start) const = 0;
+
+    //! Attempt to update from an older format. Returns whether an error occurred.
+    virtual bool Upgrade() { return true; }
+    //! Format of the coins, see COINS_FORMAT_ORIGINAL
+    virtual int GetFormat() const = 0;
+
+    //! Store stats along with each write that brings the coins to stats->hashBlock (and erase them otherwise)
+    void TrackCoinsStats(const CIncrementalCoinsStats* stats) { m_coins_stats = stats; }
+    virtual bool ReadCoinsStats(CIncrementalCoinsStats& stats) const = 0;
+
+    //! Make all writes so far durable
+    virtual bool Sync() = 0;
+
+    //! Compact the coins from begin to end (inclusive), in the order of their outpoints
+    virtual void CompactRange(const COutPoint& begin, const COutPoint& end) = 0;
+
+    //! The LevelDB database holding the coins, if that is the backend
+    virtual const CDBWrapper* GetDB() const { return nullptr; }
+};
+
 /** CCoinsView backed by the coin database (chainstate/) */
-class CCoinsViewDB final : public CCoinsView
+class CCoinsViewDB final : public CCoinsViewStore
 {
 protected:
     CDBWrapper db;
+    //! Format of the coins, see COINS_FORMAT_ORIGINAL
+    int nFormat;
+
+    bool UpgradePerTxOut();
+    //! Rewrite the coins of COINS_FORMAT_ORIGINAL in COINS_FORMAT_WITNESS_TEMPLATES, resuming where an interrupted run stopped
+    bool UpgradeScriptTemplates();
 public:
-    explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const DBOptions& dboptions = DEFAULT_DB_OPTIONS);
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
+    //! Looks all outpoints up with one CDBWrapper::ReadMany
+    size_t GetCoins(const std::vector<COutPoint>& outpoints, std::vector<Coin>& coins) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
-    CCoinsViewCursor *Cursor() const override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase = true) override;
+    using CCoinsViewStore::Cursor;
+    CCoinsViewCursor *Cursor(const COutPoint& start) const override;
 
-    //! Attempt to update from an older database format. Returns whether an error occurred.
-    bool Upgrade();
+    bool Upgrade() override;
+    int GetFormat() const override { return nFormat; }
     size_t EstimateSize() const override;
+
+    bool ReadCoinsStats(CIncrementalCoinsStats& stats) const override;
+
+    const CDBWrapper* GetDB() const override { return &db; }
+
+    bool Sync() override { return db.Sync(); }
+
+    void CompactRange(const COutPoint& begin, const COutPoint& end) override;
+};
+
+/** The -coinsbackend of the chainstate in path, or "" if there is none yet */
+std::string DetectCoinsBackend(const fs::path& path);
+/** Whether strBackend is a valid -coinsbackend */
+bool IsCoinsBackend(const std::string& strBackend);
+/**
+ * Open the chainstate (chainstate/) with the strBackend storage. A wipe
+ * removes the files of either backend. nCacheSize, fMemory and dboptions
+ * only apply to LevelDB.
+ */
+std::unique_ptr<CCoinsViewStore> OpenCoinsViewStore(const std::string& strBackend, size_t nCacheSize, bool fMemory = false, bool fWipe = false, const DBOptions& dboptions = DEFAULT_DB_OPTIONS);
+
+/** Maximum number of prefetched coins held by CCoinsViewPrefetch */
+static const size_t MAX_PREFETCHED_COINS = 200000;
+
+/**
+ * CCoinsView layered between pcoinsTip and the database which holds coins
+ * fetched ahead of time, so that cache misses while connecting a block are
+ * served from memory rather than by one database read at a time.
+ *
+ * Fetch() reads directly from the (thread-safe) source view and may be called
+ * from any thread without cs_main. Any write through this view discards what
+ * was fetched so far, including lookups still in flight, so a prefetched coin
+ * is never older than the database contents.
+ */
+class CCoinsViewPrefetch final : public CCoinsViewBacked
+{
+private:
+    CCoinsView* source;
+    mutable CCriticalSection cs_prefetch;
+    mutable std::unordered_map<COutPoint, Coin, SaltedOutpointHasher> mapPrefetched;
+    uint64_t nGeneration;
+    mutable std::atomic<uint64_t> nHits;
+    mutable std::atomic<uint64_t> nMisses;
+
+public:
+    CCoinsViewPrefetch(CCoinsView* viewIn, CCoinsView* sourceIn);
+
+    //! Look up outpoint in the source view and keep the coin until it is requested.
+    void Fetch(const COutPoint& outpoint);
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const override;
+    //! Serves what was prefetched and passes the rest to the backing view in one call
+    size_t GetCoins(const std::vector<COutPoint>& outpoints, std::vector<Coin>& coins) const override;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase = true) override;
+
+    //! Number of coins requested which were (not) served from prefetched memory.
+    void GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut) const;
+    size_t DynamicMemoryUsage() const;
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -111,20 +234,29 @@ private:
 class CBlockTreeDB : public CDBWrapper
 {
 public:
-    explicit CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    explicit CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const DBOptions& dboptions = DEFAULT_DB_OPTIONS);
 
     CBlockTreeDB(const CBlockTreeDB&) = delete;
     CBlockTreeDB& operator=(const CBlockTreeDB&) = delete;
 
-    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
+    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo, bool fSync = true);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &info);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindexing);
     bool ReadReindexing(bool &fReindexing);
-    bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
-    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &vect);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    /** Record that writes are only durable up to nHeight (see -ibdsyncinterval), or no longer deferred */
+    bool WriteSyncCheckpoint(int nHeight);
+    bool ReadSyncCheckpoint(int &nHeight);
+    bool EraseSyncCheckpoint();
+    /**
+     * Move the transaction index that older versions kept here (see the
+     * "txindex" flag) to dest, erasing it here. Returns false on failure or
+     * when fnInterrupted returns true; the rest is moved on the next call.
+     */
+    bool MoveTxIndex(CDBWrapper& dest, const std::function<bool()>& fnInterrupted);
+    /** Load all block index entries, calling insertBlockIndex (serialized by a lock) from several threads */
     bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
 };
 
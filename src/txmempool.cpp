@@ -17,15 +17,17 @@
 #include <util.h>
 #include <utilmoneystr.h>
 #include <utiltime.h>
+#include <validationinterface.h>
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                                  int64_t _nTime, unsigned int _entryHeight,
                                  bool _spendsCoinbase, int64_t _sigOpsCost, LockPoints lp):
-    tx(_tx), nFee(_nFee), nTime(_nTime), entryHeight(_entryHeight),
-    spendsCoinbase(_spendsCoinbase), sigOpCost(_sigOpsCost), lockPoints(lp)
+    tx(_tx), sigOpCost(_sigOpsCost), nFee(_nFee), nTime(_nTime), lockPoints(lp),
+    entryHeight(_entryHeight), nScriptVerifiedFlags(0), fScriptVerified(false), spendsCoinbase(_spendsCoinbase)
 {
     nTxWeight = GetTransactionWeight(*tx);
     nUsageSize = RecursiveDynamicUsage(tx);
+    m_epoch = 0;
 
     nCountWithDescendants = 1;
     nSizeWithDescendants = GetTxSize();
@@ -61,14 +63,19 @@ size_t CTxMemPoolEntry::GetTxSize() const
 // descendants.
 void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
 {
-    setEntries stageEntries, setAllDescendants;
-    stageEntries = GetMemPoolChildren(updateIt);
+    EpochGuard epoch(*this);
+    setEntries setAllDescendants;
+    std::vector<txiter> stageEntries;
+    for (const txiter childEntry : GetMemPoolChildren(updateIt)) {
+        visited(childEntry);
+        stageEntries.push_back(childEntry);
+    }
 
     while (!stageEntries.empty()) {
-        const txiter cit = *stageEntries.begin();
+        const txiter cit = stageEntries.back();
         setAllDescendants.insert(cit);
-        stageEntries.erase(cit);
-        const setEntries &setChildren = GetMemPoolChildren(cit);
+        stageEntries.pop_back();
+        const setLinks &setChildren = GetMemPoolChildren(cit);
         for (const txiter childEntry : setChildren) {
             cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
             if (cacheIt != cachedDescendants.end()) {
@@ -77,9 +84,9 @@ void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendan
                 for (const txiter cacheEntry : cacheIt->second) {
                     setAllDescendants.insert(cacheEntry);
                 }
-            } else if (!setAllDescendants.count(childEntry)) {
+            } else if (!visited(childEntry) && !setAllDescendants.count(childEntry)) {
                 // Schedule for later processing
-                stageEntries.insert(childEntry);
+                stageEntries.push_back(childEntry);
             }
         }
     }
@@ -153,7 +160,10 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
 {
     LOCK(cs);
 
-    setEntries parentHashes;
+    // Ancestors that were found but not walked yet. Entries are only staged
+    // the first time they are visited, so the stage needs no lookups.
+    EpochGuard epoch(*this);
+    std::vector<txiter> stage;
     const CTransaction &tx = entry.GetTx();
 
     if (fSearchForParents) {
@@ -162,9 +172,9 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // iterate mapTx to find parents.
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             txiter piter = mapTx.find(tx.vin[i].prevout.hash);
-            if (piter != mapTx.end()) {
-                parentHashes.insert(piter);
-                if (parentHashes.size() + 1 > limitAncestorCount) {
+            if (piter != mapTx.end() && !visited(piter)) {
+                stage.push_back(piter);
+                if (stage.size() + 1 > limitAncestorCount) {
                     errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
                     return false;
                 }
@@ -174,16 +184,19 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // If we're not searching for parents, we require this to be an
         // entry in the mempool already.
         txiter it = mapTx.iterator_to(entry);
-        parentHashes = GetMemPoolParents(it);
+        for (const txiter &piter : GetMemPoolParents(it)) {
+            visited(piter);
+            stage.push_back(piter);
+        }
     }
 
     size_t totalSizeWithAncestors = entry.GetTxSize();
 
-    while (!parentHashes.empty()) {
-        txiter stageit = *parentHashes.begin();
+    while (!stage.empty()) {
+        txiter stageit = stage.back();
 
         setAncestors.insert(stageit);
-        parentHashes.erase(stageit);
+        stage.pop_back();
         totalSizeWithAncestors += stageit->GetTxSize();
 
         if (stageit->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
@@ -197,13 +210,13 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
             return false;
         }
 
-        const setEntries & setMemPoolParents = GetMemPoolParents(stageit);
+        const setLinks & setMemPoolParents = GetMemPoolParents(stageit);
         for (const txiter &phash : setMemPoolParents) {
             // If this is a new ancestor, add it.
-            if (setAncestors.count(phash) == 0) {
-                parentHashes.insert(phash);
+            if (!visited(phash)) {
+                stage.push_back(phash);
             }
-            if (parentHashes.size() + setAncestors.size() + 1 > limitAncestorCount) {
+            if (stage.size() + setAncestors.size() + 1 > limitAncestorCount) {
                 errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
                 return false;
             }
@@ -215,7 +228,7 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
 
 void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
 {
-    setEntries parentIters = GetMemPoolParents(it);
+    setLinks parentIters = GetMemPoolParents(it);
     // add or remove this tx as a child of each parent
     for (txiter piter : parentIters) {
         UpdateChild(piter, it, add);
@@ -244,7 +257,7 @@ void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncesto
 
 void CTxMemPool::UpdateChildrenForRemoval(txiter it)
 {
-    const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
+    const setLinks &setMemPoolChildren = GetMemPoolChildren(it);
     for (txiter updateIt : setMemPoolChildren) {
         UpdateParent(updateIt, it, false);
     }
@@ -270,6 +283,8 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
             CAmount modifyFee = -removeIt->GetModifiedFee();
             int modifySigOps = -removeIt->GetSigOpCost();
             for (txiter dit : setDescendants) {
+                // Entries going away too need not be kept consistent
+                if (entriesToRemove.count(dit)) continue;
                 mapTx.modify(dit, update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
             }
         }
@@ -296,6 +311,16 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
         // and it's important that we use the mapLinks[] notion of ancestor
         // transactions as the set of things to update for removal.
         CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        // Ancestors that are removed along with this entry need not have
+        // their descendant state updated; when a whole package is trimmed or
+        // expired that is most of them.
+        for (setEntries::iterator ait = setAncestors.begin(); ait != setAncestors.end(); ) {
+            if (entriesToRemove.count(*ait)) {
+                ait = setAncestors.erase(ait);
+            } else {
+                ++ait;
+            }
+        }
         // Note that UpdateAncestorsOf severs the child links that point to
         // removeIt in the entries for the parents of removeIt.
         UpdateAncestorsOf(false, removeIt, setAncestors);
@@ -313,8 +338,8 @@ void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, CAmount modifyFe
     nSizeWithDescendants += modifySize;
     assert(int64_t(nSizeWithDescendants) > 0);
     nModFeesWithDescendants += modifyFee;
+    assert(int64_t(nCountWithDescendants) + modifyCount > 0);
     nCountWithDescendants += modifyCount;
-    assert(int64_t(nCountWithDescendants) > 0);
 }
 
 void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount, int64_t modifySigOps)
@@ -322,14 +347,15 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
     nSizeWithAncestors += modifySize;
     assert(int64_t(nSizeWithAncestors) > 0);
     nModFeesWithAncestors += modifyFee;
+    assert(int64_t(nCountWithAncestors) + modifyCount > 0);
     nCountWithAncestors += modifyCount;
-    assert(int64_t(nCountWithAncestors) > 0);
     nSigOpCostWithAncestors += modifySigOps;
     assert(int(nSigOpCostWithAncestors) >= 0);
 }
 
 CTxMemPool::CTxMemPool(CBlockPolicyEstimator* estimator) :
-    nTransactionsUpdated(0), minerPolicyEstimator(estimator)
+    nTransactionsUpdated(0), minerPolicyEstimator(estimator), fDeferFeeEstimates(false), nMapTxUsage(0), m_epoch(0), m_has_epoch_guard(false), m_sequence(0),
+    mapTx(indexed_transaction_set::ctor_args_list(), indexed_transaction_set::allocator_type(&nMapTxUsage))
 {
     _clear(); //lock free clear
 
@@ -357,6 +383,23 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
     nTransactionsUpdated += n;
 }
 
+void CTxMemPool::RecordChange(const uint256& hash, bool fAdded)
+{
+    m_sequence++;
+    m_change_log.emplace_back(hash, fAdded);
+    if (m_change_log.size() > MEMPOOL_CHANGE_LOG_SIZE)
+        m_change_log.pop_front();
+}
+
+bool CTxMemPool::GetChangesSince(uint64_t nSequence, std::vector<std::pair<uint256, bool>>& vChanges) const
+{
+    LOCK(cs);
+    if (nSequence > m_sequence || m_sequence - nSequence > m_change_log.size())
+        return false;
+    vChanges.insert(vChanges.end(), m_change_log.end() - (m_sequence - nSequence), m_change_log.end());
+    return true;
+}
+
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, setEntries &setAncestors, bool validFeeEstimate)
 {
     NotifyEntryAdded(entry.GetSharedTx());
@@ -365,7 +408,7 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // all the appropriate checks.
     LOCK(cs);
     indexed_transaction_set::iterator newit = mapTx.insert(entry).first;
-    mapLinks.insert(make_pair(newit, TxLinks()));
+    mapLinks.insert(std::make_pair(newit, TxLinks()));
 
     // Update transaction for any feeDelta created by PrioritiseTransaction
     // TODO: refactor so that the fee delta is calculated before inserting
@@ -407,6 +450,7 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     UpdateEntryForAncestors(newit, setAncestors);
 
     nTransactionsUpdated++;
+    RecordChange(hash, true);
     totalTxSize += entry.GetTxSize();
     if (minerPolicyEstimator) {minerPolicyEstimator->processTransaction(entry, validFeeEstimate);}
 
@@ -438,7 +482,8 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     mapLinks.erase(it);
     mapTx.erase(it);
     nTransactionsUpdated++;
-    if (minerPolicyEstimator) {minerPolicyEstimator->removeTx(hash, false);}
+    RecordChange(hash, false);
+    if (minerPolicyEstimator && reason != MemPoolRemovalReason::BLOCK && reason != MemPoolRemovalReason::CONFLICT) {minerPolicyEstimator->removeTx(hash, false);}
 }
 
 // Calculates descendants of entry that are not already in setDescendants, and adds to
@@ -449,27 +494,44 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
 // can save time by not iterating over those entries.
 void CTxMemPool::CalculateDescendants(txiter entryit, setEntries &setDescendants)
 {
-    setEntries stage;
+    EpochGuard epoch(*this);
+    std::vector<txiter> stage;
     if (setDescendants.count(entryit) == 0) {
-        stage.insert(entryit);
+        visited(entryit);
+        stage.push_back(entryit);
     }
     // Traverse down the children of entry, only adding children that are not
     // accounted for in setDescendants already (because those children have either
     // already been walked, or will be walked in this iteration).
     while (!stage.empty()) {
-        txiter it = *stage.begin();
+        txiter it = stage.back();
         setDescendants.insert(it);
-        stage.erase(it);
+        stage.pop_back();
 
-        const setEntries &setChildren = GetMemPoolChildren(it);
+        const setLinks &setChildren = GetMemPoolChildren(it);
         for (const txiter &childiter : setChildren) {
-            if (!setDescendants.count(childiter)) {
-                stage.insert(childiter);
+            if (!visited(childiter) && !setDescendants.count(childiter)) {
+                stage.push_back(childiter);
             }
         }
     }
 }
 
+CTxMemPool::EpochGuard::EpochGuard(const CTxMemPool& in) : pool(in)
+{
+    assert(!pool.m_has_epoch_guard);
+    ++pool.m_epoch;
+    pool.m_has_epoch_guard = true;
+}
+
+CTxMemPool::EpochGuard::~EpochGuard()
+{
+    // Entries visited during this traversal are left at an older epoch than
+    // the next one
+    ++pool.m_epoch;
+    pool.m_has_epoch_guard = false;
+}
+
 void CTxMemPool::removeRecursive(const CTransaction &origTx, MemPoolRemovalReason reason)
 {
     // Remove transaction from memory pool
@@ -539,51 +601,68 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
     RemoveStaged(setAllRemoves, false, MemPoolRemovalReason::REORG);
 }
 
-void CTxMemPool::removeConflicts(const CTransaction &tx)
-{
-    // Remove transactions which depend on inputs of tx, recursively
-    LOCK(cs);
-    for (const CTxIn &txin : tx.vin) {
-        auto it = mapNextTx.find(txin.prevout);
-        if (it != mapNextTx.end()) {
-            const CTransaction &txConflict = *it->second;
-            if (txConflict != tx)
-            {
-                ClearPrioritisation(txConflict.GetHash());
-                removeRecursive(txConflict, MemPoolRemovalReason::CONFLICT);
-            }
-        }
-    }
-}
-
 /**
  * Called when a block is connected. Removes from mempool and updates the miner fee estimator.
  */
 void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigned int nBlockHeight)
 {
     LOCK(cs);
-    std::vector<const CTxMemPoolEntry*> entries;
+    // Stage every confirmed entry first. The block's in-mempool ancestors are
+    // all in the block too, so removing them together only has to update the
+    // state of the descendants left behind, once per pass.
+    setEntries stage;
+    std::vector<CBlockPolicyEstimator::BlockTx> blockTxs;
     for (const auto& tx : vtx)
     {
         uint256 hash = tx->GetHash();
 
         indexed_transaction_set::iterator i = mapTx.find(hash);
-        if (i != mapTx.end())
-            entries.push_back(&*i);
+        if (i != mapTx.end()) {
+            stage.insert(i);
+            if (minerPolicyEstimator) blockTxs.emplace_back(*i);
+        }
     }
-    // Before the txs in the new block have been removed from the mempool, update policy estimates
-    if (minerPolicyEstimator) {minerPolicyEstimator->processBlock(nBlockHeight, entries);}
+    RemoveStaged(stage, true, MemPoolRemovalReason::BLOCK);
+
+    // With the confirmed entries gone, any remaining spend of a block input is
+    // a conflict. Collect them all, with their descendants, for one more pass.
+    setEntries conflicts;
     for (const auto& tx : vtx)
     {
-        txiter it = mapTx.find(tx->GetHash());
-        if (it != mapTx.end()) {
-            setEntries stage;
-            stage.insert(it);
-            RemoveStaged(stage, true, MemPoolRemovalReason::BLOCK);
+        for (const CTxIn& txin : tx->vin) {
+            auto it = mapNextTx.find(txin.prevout);
+            if (it != mapNextTx.end()) {
+                txiter conflictIt = mapTx.find(it->second->GetHash());
+                assert(conflictIt != mapTx.end());
+                ClearPrioritisation(conflictIt->GetTx().GetHash());
+                CalculateDescendants(conflictIt, conflicts);
+            }
         }
-        removeConflicts(*tx);
         ClearPrioritisation(tx->GetHash());
     }
+    std::vector<uint256> conflictHashes;
+    if (minerPolicyEstimator) {
+        conflictHashes.reserve(conflicts.size());
+        for (txiter it : conflicts) {
+            conflictHashes.push_back(it->GetTx().GetHash());
+        }
+    }
+    RemoveStaged(conflicts, false, MemPoolRemovalReason::CONFLICT);
+
+    // removeUnchecked leaves these to the estimator's block update, which
+    // needs no mempool state and so can be queued behind the block's other
+    // notifications instead of running under cs_main.
+    if (minerPolicyEstimator) {
+        if (fDeferFeeEstimates) {
+            CBlockPolicyEstimator* estimator = minerPolicyEstimator;
+            CallFunctionInValidationInterfaceQueue([estimator, nBlockHeight, blockTxs, conflictHashes] {
+                estimator->processBlock(nBlockHeight, blockTxs, conflictHashes);
+            });
+        } else {
+            minerPolicyEstimator->processBlock(nBlockHeight, blockTxs, conflictHashes);
+        }
+    }
+
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = true;
 }
@@ -599,6 +678,9 @@ void CTxMemPool::_clear()
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
+    // Removals are not recorded, so earlier changes are no use any more
+    m_change_log.clear();
+    ++m_sequence;
 }
 
 void CTxMemPool::clear()
@@ -668,7 +750,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             assert(it3->second == &tx);
             i++;
         }
-        assert(setParentCheck == GetMemPoolParents(it));
+        assert(GetMemPoolParents(it).equals(setParentCheck));
         // Verify ancestor state is correct.
         setEntries setAncestors;
         uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -701,7 +783,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 childSizes += childit->GetTxSize();
             }
         }
-        assert(setChildrenCheck == GetMemPoolChildren(it));
+        assert(GetMemPoolChildren(it).equals(setChildrenCheck));
         // Also check to make sure size is greater than sum with immediate children.
         // just a sanity check, not definitive that this calc is correct...
         assert(it->GetSizeWithDescendants() >= childSizes + it->GetTxSize());
@@ -814,6 +896,15 @@ std::vector<TxMempoolInfo> CTxMemPool::infoAll() const
     return ret;
 }
 
+bool CTxMemPool::IsScriptVerified(const CTransaction& tx, unsigned int flags) const
+{
+    LOCK(cs);
+    indexed_transaction_set::const_iterator i = mapTx.find(tx.GetHash());
+    if (i == mapTx.end())
+        return false;
+    return i->GetTx().GetWitnessHash() == tx.GetWitnessHash() && i->IsScriptVerified(flags);
+}
+
 CTransactionRef CTxMemPool::get(const uint256& hash) const
 {
     LOCK(cs);
@@ -904,10 +995,47 @@ bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return base->GetCoin(outpoint, coin);
 }
 
+size_t CCoinsViewMemPool::GetCoins(const std::vector<COutPoint>& outpoints, std::vector<Coin>& coins) const {
+    coins.resize(outpoints.size());
+    size_t nFound = 0;
+    std::vector<COutPoint> vMissing;
+    std::vector<size_t> vMissingPos;
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        CTransactionRef ptx = mempool.get(outpoints[i].hash);
+        if (!ptx) {
+            vMissing.push_back(outpoints[i]);
+            vMissingPos.push_back(i);
+        } else if (outpoints[i].n < ptx->vout.size()) {
+            coins[i] = Coin(ptx->vout[outpoints[i].n], MEMPOOL_HEIGHT, false);
+            nFound++;
+        } else {
+            coins[i].Clear();
+        }
+    }
+    if (vMissing.empty()) return nFound;
+    std::vector<Coin> vCoins;
+    nFound += base->GetCoins(vMissing, vCoins);
+    for (size_t i = 0; i < vMissing.size(); i++) {
+        coins[vMissingPos[i]] = std::move(vCoins[i]);
+    }
+    return nFound;
+}
+
 size_t CTxMemPool::DynamicMemoryUsage() const {
+    MempoolMemoryStats stats = GetMemoryStats();
+    return stats.nIndexBytes + stats.nInnerBytes + stats.nOtherBytes;
+}
+
+MempoolMemoryStats CTxMemPool::GetMemoryStats() const {
     LOCK(cs);
-    // Estimate the overhead of mapTx to be 12 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    MempoolMemoryStats stats;
+    // No exact formula for the nodes of boost::multi_index_container is
+    // implemented, so its allocator counts what it takes
+    stats.nIndexBytes = nMapTxUsage;
+    stats.nInnerBytes = cachedInnerUsage;
+    stats.nOtherBytes = memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) +
+        m_change_log.size() * sizeof(m_change_log.front());
+    return stats;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
@@ -931,6 +1059,7 @@ int CTxMemPool::Expire(int64_t time) {
         CalculateDescendants(removeit, stage);
     }
     RemoveStaged(stage, false, MemPoolRemovalReason::EXPIRY);
+    evictionStats.nExpiredTx += stage.size();
     return stage.size();
 }
 
@@ -946,25 +1075,31 @@ bool CTxMemPool::addUnchecked(const uint256&hash, const CTxMemPoolEntry &entry,
 
 void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].children.insert(child).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].children.erase(child)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    setLinks& children = mapLinks[entry].children;
+    size_t nUsageBefore = memusage::DynamicUsage(children);
+    if (add) {
+        children.insert(child);
+    } else {
+        children.erase(child);
     }
+    cachedInnerUsage += memusage::DynamicUsage(children);
+    cachedInnerUsage -= nUsageBefore;
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].parents.insert(parent).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].parents.erase(parent)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    setLinks& parents = mapLinks[entry].parents;
+    size_t nUsageBefore = memusage::DynamicUsage(parents);
+    if (add) {
+        parents.insert(parent);
+    } else {
+        parents.erase(parent);
     }
+    cachedInnerUsage += memusage::DynamicUsage(parents);
+    cachedInnerUsage -= nUsageBefore;
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
+const CTxMemPool::setLinks & CTxMemPool::GetMemPoolParents(txiter entry) const
 {
     assert (entry != mapTx.end());
     txlinksMap::const_iterator it = mapLinks.find(entry);
@@ -972,7 +1107,7 @@ const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
     return it->second.parents;
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
+const CTxMemPool::setLinks & CTxMemPool::GetMemPoolChildren(txiter entry) const
 {
     assert (entry != mapTx.end());
     txlinksMap::const_iterator it = mapLinks.find(entry);
@@ -1015,41 +1150,69 @@ void CTxMemPool::trackPackageRemoved(const CFeeRate& rate) {
 void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining) {
     LOCK(cs);
 
+    int64_t nTimeStart = GetTimeMicros();
     unsigned nTxnRemoved = 0;
     CFeeRate maxFeeRateRemoved(0);
     while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
+        // Stage packages from the bottom of the descendant score index until
+        // their estimated usage covers the excess. The estimate leaves out the
+        // link and spend maps, so it falls short rather than overshoots, and
+        // another pass picks up whatever remains.
+        const size_t nExcess = DynamicMemoryUsage() - sizelimit;
+        size_t nFreed = 0;
+        setEntries stage;
         indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
+        while (it != mapTx.get<descendant_score>().end() && nFreed < nExcess) {
+            txiter root = mapTx.project<0>(it);
+            ++it;
+            if (stage.count(root)) continue;
+
+            setEntries package;
+            CalculateDescendants(root, package);
+            // A package sharing descendants with one already staged has a
+            // stale score; leave it for the next pass.
+            if (!stage.empty() && std::any_of(package.begin(), package.end(), [&stage](txiter e) { return stage.count(e) != 0; })) {
+                break;
+            }
 
-        // We set the new mempool min fee to the feerate of the removed set, plus the
-        // "minimum reasonable fee rate" (ie some value under which we consider txn
-        // to have 0 fee). This way, we don't allow txn to enter mempool with feerate
-        // equal to txn which were removed with no block in between.
-        CFeeRate removed(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
-        removed += incrementalRelayFee;
-        trackPackageRemoved(removed);
-        maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
-
-        setEntries stage;
-        CalculateDescendants(mapTx.project<0>(it), stage);
+            // We set the new mempool min fee to the feerate of the removed set, plus the
+            // "minimum reasonable fee rate" (ie some value under which we consider txn
+            // to have 0 fee). This way, we don't allow txn to enter mempool with feerate
+            // equal to txn which were removed with no block in between.
+            CFeeRate removed(root->GetModFeesWithDescendants(), root->GetSizeWithDescendants());
+            removed += incrementalRelayFee;
+            trackPackageRemoved(removed);
+            maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
+
+            for (txiter e : package) {
+                nFreed += memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) + e->DynamicMemoryUsage();
+            }
+            stage.insert(package.begin(), package.end());
+        }
         nTxnRemoved += stage.size();
 
-        std::vector<CTransaction> txn;
+        std::vector<CTransactionRef> txn;
         if (pvNoSpendsRemaining) {
             txn.reserve(stage.size());
             for (txiter iter : stage)
-                txn.push_back(iter->GetTx());
+                txn.push_back(iter->GetSharedTx());
         }
         RemoveStaged(stage, false, MemPoolRemovalReason::SIZELIMIT);
         if (pvNoSpendsRemaining) {
-            for (const CTransaction& tx : txn) {
-                for (const CTxIn& txin : tx.vin) {
+            for (const CTransactionRef& tx : txn) {
+                for (const CTxIn& txin : tx->vin) {
                     if (exists(txin.prevout.hash)) continue;
                     pvNoSpendsRemaining->push_back(txin.prevout);
                 }
             }
         }
+        evictionStats.nTrimPasses++;
     }
 
+    if (nTxnRemoved > 0) {
+        evictionStats.nTrimmedTx += nTxnRemoved;
+        evictionStats.nTrimTime += GetTimeMicros() - nTimeStart;
+    }
     if (maxFeeRateRemoved > CFeeRate(0)) {
         LogPrint(BCLog::MEMPOOL, "Removed %u txn, rolling minimum fee bumped to %s\n", nTxnRemoved, maxFeeRateRemoved.ToString());
     }
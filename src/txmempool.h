@@ -6,6 +6,9 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <algorithm>
+#include <assert.h>
+#include <deque>
 #include <memory>
 #include <set>
 #include <map>
@@ -15,11 +18,13 @@
 
 #include <amount.h>
 #include <coins.h>
+#include <flatset.h>
 #include <indirectmap.h>
 #include <policy/feerate.h>
 #include <primitives/transaction.h>
 #include <sync.h>
 #include <random.h>
+#include <support/allocators/accounting.h>
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/hashed_index.hpp>
@@ -32,6 +37,9 @@ class CBlockIndex;
 /** Fake height value used in Coin to signify they are only in the memory pool (since 0.8) */
 static const uint32_t MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
+/** Number of the latest mempool additions and removals kept for GetChangesSince */
+static const size_t MEMPOOL_CHANGE_LOG_SIZE = 50000;
+
 struct LockPoints
 {
     // Will be set to the blockchain height and median time past
@@ -64,29 +72,37 @@ class CTxMemPool;
 class CTxMemPoolEntry
 {
 private:
+    // Fields are grouped so that everything the ancestor and descendant score
+    // comparisons read sits next to the transaction reference, and narrowed
+    // where policy or consensus bounds them: a transaction's weight and sigop
+    // cost are limited by the block weight, and counts and indexes by the
+    // number of transactions the mempool can hold.
     CTransactionRef tx;
+    uint32_t nTxWeight;        //!< Cached to avoid recomputing tx weight (also used for GetTxSize())
+    int32_t sigOpCost;         //!< Total sigop cost
     CAmount nFee;              //!< Cached to avoid expensive parent-transaction lookups
-    size_t nTxWeight;          //!< ... and avoid recomputing tx weight (also used for GetTxSize())
-    size_t nUsageSize;         //!< ... and total memory usage
-    int64_t nTime;             //!< Local time when entering the mempool
-    unsigned int entryHeight;  //!< Chain height when entering the mempool
-    bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
-    int64_t sigOpCost;         //!< Total sigop cost
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
-    LockPoints lockPoints;     //!< Track the height and time at which tx was final
+
+    // Information about ancestors of this transaction that are in the mempool
+    CAmount nModFeesWithAncestors;   //!< total fees of ancestors (all including us)
+    uint64_t nSizeWithAncestors;     //!< ... and size
+    uint32_t nCountWithAncestors;    //!< ... and number of transactions
 
     // Information about descendants of this transaction that are in the
     // mempool; if we remove this transaction we must remove all of these
     // descendants as well.
-    uint64_t nCountWithDescendants;  //!< number of descendant transactions
+    uint32_t nCountWithDescendants;  //!< number of descendant transactions
     uint64_t nSizeWithDescendants;   //!< ... and size
     CAmount nModFeesWithDescendants; //!< ... and total fees (all including us)
 
-    // Analogous statistics for ancestor transactions
-    uint64_t nCountWithAncestors;
-    uint64_t nSizeWithAncestors;
-    CAmount nModFeesWithAncestors;
     int64_t nSigOpCostWithAncestors;
+    int64_t nTime;             //!< Local time when entering the mempool
+    LockPoints lockPoints;     //!< Track the height and time at which tx was final
+    uint32_t nUsageSize;       //!< Cached total memory usage
+    unsigned int entryHeight;  //!< Chain height when entering the mempool
+    unsigned int nScriptVerifiedFlags; //!< Block script flags the inputs passed with on acceptance
+    bool fScriptVerified;      //!< Whether nScriptVerifiedFlags is set
+    bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
 
 public:
     CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
@@ -115,6 +131,9 @@ public:
     void UpdateFeeDelta(int64_t feeDelta);
     // Update the LockPoints after a reorg
     void UpdateLockPoints(const LockPoints& lp);
+    // Record that all input scripts passed under the given block script flags
+    void SetScriptVerified(unsigned int flags) { nScriptVerifiedFlags = flags; fScriptVerified = true; }
+    bool IsScriptVerified(unsigned int flags) const { return fScriptVerified && nScriptVerifiedFlags == flags; }
 
     uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
     uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
@@ -127,7 +146,8 @@ public:
     CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
-    mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint32_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint64_t m_epoch; //!< Epoch of the mempool traversal that last visited this entry
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -335,6 +355,39 @@ struct TxMempoolInfo
     int64_t nFeeDelta;
 };
 
+/**
+ * Breakdown of CTxMemPool::DynamicMemoryUsage, for getmemoryinfo.
+ */
+struct MempoolMemoryStats
+{
+    /** mapTx: the entries and the nodes and buckets of its indexes, as allocated. */
+    size_t nIndexBytes = 0;
+
+    /** Transactions and in-mempool parent and child sets of the entries. */
+    size_t nInnerBytes = 0;
+
+    /** mapNextTx, mapDeltas, mapLinks and vTxHashes. */
+    size_t nOtherBytes = 0;
+};
+
+/**
+ * Counters for transactions the mempool evicted on its own, for getmempoolinfo.
+ */
+struct MempoolEvictionStats
+{
+    /** Transactions removed by TrimToSize to stay under the size limit. */
+    uint64_t nTrimmedTx = 0;
+
+    /** Passes TrimToSize made over the mempool, each removing a batch of packages. */
+    uint64_t nTrimPasses = 0;
+
+    /** Total time spent in passes that removed transactions, in microseconds. */
+    int64_t nTrimTime = 0;
+
+    /** Transactions removed by Expire for being too old. */
+    uint64_t nExpiredTx = 0;
+};
+
 /** Reason why a transaction was removed from the mempool,
  * this is passed to the notification signal.
  */
@@ -439,14 +492,26 @@ private:
     uint32_t nCheckFrequency; //!< Value n means that n times in 2^32 we check.
     unsigned int nTransactionsUpdated; //!< Used by getblocktemplate to trigger CreateNewBlock() invocation
     CBlockPolicyEstimator* minerPolicyEstimator;
+    bool fDeferFeeEstimates;  //!< Whether removeForBlock queues the fee estimator update on the validation interface queue
 
     uint64_t totalTxSize;      //!< sum of all mempool tx's virtual sizes. Differs from serialized tx size since witness data is discounted. Defined in BIP 141.
     uint64_t cachedInnerUsage; //!< sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+    size_t nMapTxUsage;        //!< memory allocated by mapTx, counted by its allocator
 
     mutable int64_t lastRollingFeeUpdate;
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //!< minimum fee to get into the pool, decreases exponentially
 
+    mutable uint64_t m_epoch;          //!< Current traversal epoch, see EpochGuard
+    mutable bool m_has_epoch_guard;    //!< Whether an EpochGuard is alive
+
+    MempoolEvictionStats evictionStats;
+
+    uint64_t m_sequence; //!< Incremented on every addition and removal
+    //! The latest additions (true) and removals, the last one being change m_sequence
+    std::deque<std::pair<uint256, bool>> m_change_log;
+
+    void RecordChange(const uint256& hash, bool fAdded);
     void trackPackageRemoved(const CFeeRate& rate);
 
 public:
@@ -476,7 +541,8 @@ public:
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByAncestorFee
             >
-        >
+        >,
+        AccountingAllocator<CTxMemPoolEntry>
     > indexed_transaction_set;
 
     mutable CCriticalSection cs;
@@ -491,15 +557,17 @@ public:
         }
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
+    //! The in-mempool parents or children of an entry. Most have no more than two.
+    typedef flatset<2, txiter, CompareIteratorByHash> setLinks;
 
-    const setEntries & GetMemPoolParents(txiter entry) const;
-    const setEntries & GetMemPoolChildren(txiter entry) const;
+    const setLinks & GetMemPoolParents(txiter entry) const;
+    const setLinks & GetMemPoolChildren(txiter entry) const;
 private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
     struct TxLinks {
-        setEntries parents;
-        setEntries children;
+        setLinks parents;
+        setLinks children;
     };
 
     typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
@@ -526,6 +594,8 @@ public:
      */
     void check(const CCoinsViewCache *pcoins) const;
     void setSanityCheck(double dFrequency = 1.0) { nCheckFrequency = static_cast<uint32_t>(dFrequency * 4294967295.0); }
+    /** Update the fee estimator for connected blocks from the validation interface queue, which must have a scheduler */
+    void setDeferFeeEstimates(bool fDefer) { LOCK(cs); fDeferFeeEstimates = fDefer; }
 
     // addUnchecked must updated state for all ancestors of a given transaction,
     // to track size/count of descendant transactions.  First version of
@@ -539,7 +609,6 @@ public:
 
     void removeRecursive(const CTransaction &tx, MemPoolRemovalReason reason = MemPoolRemovalReason::UNKNOWN);
     void removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags);
-    void removeConflicts(const CTransaction &tx);
     void removeForBlock(const std::vector<CTransactionRef>& vtx, unsigned int nBlockHeight);
 
     void clear();
@@ -549,6 +618,18 @@ public:
     bool isSpent(const COutPoint& outpoint);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
+
+    /** Number of the latest addition or removal */
+    uint64_t GetSequence() const
+    {
+        LOCK(cs);
+        return m_sequence;
+    }
+    /**
+     * Append the additions (true) and removals that followed change nSequence,
+     * oldest first. Returns false if they are no longer all known.
+     */
+    bool GetChangesSince(uint64_t nSequence, std::vector<std::pair<uint256, bool>>& vChanges) const;
     /**
      * Check that none of this transactions inputs are in the mempool, and thus
      * the tx is not dependent on other mempool transactions to be included in a block.
@@ -598,6 +679,28 @@ public:
      *  already in it.  */
     void CalculateDescendants(txiter it, setEntries &setDescendants);
 
+    /**
+     * Marks the entries visited by a traversal of the mempool graph, so that it
+     * does not need a set of the entries it has seen. Every entry whose epoch
+     * is older than the current one counts as unvisited, so starting a new
+     * traversal is free. Only one guard may be alive at a time; cs must be held
+     * for its lifetime.
+     */
+    class EpochGuard {
+        const CTxMemPool& pool;
+    public:
+        explicit EpochGuard(const CTxMemPool& in);
+        ~EpochGuard();
+    };
+
+    /** Mark an entry as visited by the traversal of the live EpochGuard. Returns whether it had been visited already. */
+    bool visited(txiter it) const {
+        assert(m_has_epoch_guard);
+        bool ret = it->m_epoch >= m_epoch;
+        it->m_epoch = std::max(it->m_epoch, m_epoch);
+        return ret;
+    }
+
     /** The minimum fee to get into the mempool, which may itself not be enough
       *  for larger-sized transactions.
       *  The incrementalRelayFee policy variable is used to bound the time it
@@ -609,6 +712,9 @@ public:
     /** Remove transactions from the mempool until its dynamic size is <= sizelimit.
       *  pvNoSpendsRemaining, if set, will be populated with the list of outpoints
       *  which are not in mempool which no longer have any spends in this mempool.
+      *  Each pass removes as many of the lowest-scoring packages as are expected
+      *  to bring the usage under the limit, so shared ancestors are updated once
+      *  per pass rather than once per package.
       */
     void TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining=nullptr);
 
@@ -630,17 +736,30 @@ public:
         return totalTxSize;
     }
 
+    MempoolEvictionStats GetEvictionStats() const
+    {
+        LOCK(cs);
+        return evictionStats;
+    }
+
     bool exists(uint256 hash) const
     {
         LOCK(cs);
         return (mapTx.count(hash) != 0);
     }
 
+    /**
+     * Whether tx, with this exact witness, is in the mempool and its input
+     * scripts were verified under the given block script flags.
+     */
+    bool IsScriptVerified(const CTransaction& tx, unsigned int flags) const;
+
     CTransactionRef get(const uint256& hash) const;
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
 
     size_t DynamicMemoryUsage() const;
+    MempoolMemoryStats GetMemoryStats() const;
 
     boost::signals2::signal<void (CTransactionRef)> NotifyEntryAdded;
     boost::signals2::signal<void (CTransactionRef, MemPoolRemovalReason)> NotifyEntryRemoved;
@@ -703,6 +822,9 @@ protected:
 public:
     CCoinsViewMemPool(CCoinsView* baseIn, const CTxMemPool& mempoolIn);
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    //! Take the outputs of mempool transactions from the mempool, as GetCoin
+    //! does, and look up all others in one bulk call to the backing view.
+    size_t GetCoins(const std::vector<COutPoint>& outpoints, std::vector<Coin>& coins) const override;
 };
 
 /**
@@ -0,0 +1,122 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <txreconciliation.h>
+
+#include <hash.h>
+
+#include <algorithm>
+
+/** Cells an id is added to, one in each of as many equal parts of the table */
+static const unsigned int RECON_HASH_COUNT = 3;
+/** Expected share of the smaller set missing from the larger one, in percent */
+static const size_t RECON_Q_PERCENT = 25;
+
+static inline uint64_t MixId(uint32_t id, uint64_t n)
+{
+    uint64_t x = id + n * 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static inline size_t CellIndex(uint32_t id, unsigned int n, size_t nPart)
+{
+    return n * nPart + (size_t)(((MixId(id, n) & 0xffffffff) * nPart) >> 32);
+}
+
+static inline uint32_t CellCheck(uint32_t id)
+{
+    return (uint32_t)MixId(id, RECON_HASH_COUNT);
+}
+
+static inline bool IsPure(const CReconSketch::Cell& cell)
+{
+    return (cell.count == 1 || cell.count == -1) && cell.checkSum == CellCheck(cell.keySum);
+}
+
+uint32_t GetReconShortId(uint64_t k0, uint64_t k1, const uint256& txid)
+{
+    return (uint32_t)SipHashUint256(k0, k1, txid);
+}
+
+size_t GetReconSketchCells(size_t nLocalSet, size_t nRemoteSet)
+{
+    size_t nDiff = std::max(nLocalSet, nRemoteSet) - std::min(nLocalSet, nRemoteSet);
+    nDiff += std::min(nLocalSet, nRemoteSet) * RECON_Q_PERCENT / 100 + 1;
+    return std::max(MIN_RECON_SKETCH_CELLS, std::min(MAX_RECON_SKETCH_CELLS, 2 * nDiff));
+}
+
+CReconSketch::CReconSketch(size_t nCells)
+{
+    nCells = (nCells + RECON_HASH_COUNT - 1) / RECON_HASH_COUNT * RECON_HASH_COUNT;
+    vCells.resize(nCells, Cell{0, 0, 0});
+}
+
+void CReconSketch::Insert(uint32_t id)
+{
+    size_t nPart = vCells.size() / RECON_HASH_COUNT;
+    uint32_t check = CellCheck(id);
+    for (unsigned int n = 0; n < RECON_HASH_COUNT; n++) {
+        Cell& cell = vCells[CellIndex(id, n, nPart)];
+        cell.count++;
+        cell.keySum ^= id;
+        cell.checkSum ^= check;
+    }
+}
+
+void CReconSketch::Subtract(const CReconSketch& other)
+{
+    assert(other.vCells.size() == vCells.size());
+    for (size_t i = 0; i < vCells.size(); i++) {
+        vCells[i].count -= other.vCells[i].count;
+        vCells[i].keySum ^= other.vCells[i].keySum;
+        vCells[i].checkSum ^= other.vCells[i].checkSum;
+    }
+}
+
+bool CReconSketch::Decode(std::vector<uint32_t>& vInserted, std::vector<uint32_t>& vSubtracted) const
+{
+    std::vector<Cell> cells(vCells);
+    size_t nPart = cells.size() / RECON_HASH_COUNT;
+    std::vector<size_t> vPure;
+    for (size_t i = 0; i < cells.size(); i++) {
+        if (IsPure(cells[i]))
+            vPure.push_back(i);
+    }
+
+    // Peel off ids that are alone in a cell until no such cell is left
+    while (!vPure.empty()) {
+        size_t i = vPure.back();
+        vPure.pop_back();
+        if (!IsPure(cells[i]))
+            continue;
+        uint32_t id = cells[i].keySum;
+        int32_t count = cells[i].count;
+        (count == 1 ? vInserted : vSubtracted).push_back(id);
+        // A corrupt or adversarial sketch could otherwise keep producing ids
+        if (vInserted.size() + vSubtracted.size() > cells.size())
+            return false;
+        uint32_t check = CellCheck(id);
+        for (unsigned int n = 0; n < RECON_HASH_COUNT; n++) {
+            size_t j = CellIndex(id, n, nPart);
+            cells[j].count -= count;
+            cells[j].keySum ^= id;
+            cells[j].checkSum ^= check;
+            if (IsPure(cells[j]))
+                vPure.push_back(j);
+        }
+    }
+
+    for (const Cell& cell : cells) {
+        if (cell.count != 0 || cell.keySum != 0 || cell.checkSum != 0)
+            return false;
+    }
+    return true;
+}
+
+bool CReconSketch::IsValid() const
+{
+    return !vCells.empty() && vCells.size() <= MAX_RECON_SKETCH_CELLS && vCells.size() % RECON_HASH_COUNT == 0;
+}
@@ -0,0 +1,88 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXRECONCILIATION_H
+#define BITCOIN_TXRECONCILIATION_H
+
+#include <serialize.h>
+#include <uint256.h>
+
+#include <stdint.h>
+#include <vector>
+
+/** Default for -txreconciliation */
+static const bool DEFAULT_TXRECONCILIATION = false;
+/** Version of the reconciliation protocol announced in "sendrecon" */
+static const uint32_t TXRECONCILIATION_VERSION = 1;
+/** Average delay between reconciliation rounds started with a peer, in seconds */
+static const unsigned int RECON_REQUEST_INTERVAL = 8;
+/** Transactions queued for reconciliation with one peer before further ones are flooded */
+static const size_t MAX_RECON_SET_SIZE = 4000;
+/** Smallest and largest sketch sent or accepted, in cells */
+static const size_t MIN_RECON_SKETCH_CELLS = 12;
+static const size_t MAX_RECON_SKETCH_CELLS = 3000;
+
+/** Short id of a transaction in a reconciliation set, salted per connection */
+uint32_t GetReconShortId(uint64_t k0, uint64_t k1, const uint256& txid);
+
+/**
+ * Number of sketch cells needed to reconcile sets of the given sizes. The
+ * difference is estimated as the difference in size plus a quarter of the
+ * smaller set, and the sketch is made twice as large so it decodes reliably.
+ */
+size_t GetReconSketchCells(size_t nLocalSet, size_t nRemoteSet);
+
+/**
+ * An invertible Bloom lookup table of 32-bit short ids. After subtracting the
+ * sketch of one set from the sketch of another, only the symmetric difference
+ * of the sets remains, and it can be listed if it is small compared to the
+ * number of cells.
+ */
+class CReconSketch
+{
+public:
+    struct Cell {
+        int32_t count;
+        uint32_t keySum;
+        uint32_t checkSum;
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream& s, Operation ser_action) {
+            READWRITE(count);
+            READWRITE(keySum);
+            READWRITE(checkSum);
+        }
+    };
+
+    CReconSketch() {}
+    /** An empty sketch of at least nCells cells */
+    explicit CReconSketch(size_t nCells);
+
+    void Insert(uint32_t id);
+    /** Remove the contents of other, which must have as many cells */
+    void Subtract(const CReconSketch& other);
+    /**
+     * List the ids inserted into this sketch and the ids only subtracted from it.
+     * Returns false if the difference is too large to be listed.
+     */
+    bool Decode(std::vector<uint32_t>& vInserted, std::vector<uint32_t>& vSubtracted) const;
+
+    size_t GetCells() const { return vCells.size(); }
+    /** Whether a sketch received from a peer has a usable size */
+    bool IsValid() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vCells);
+    }
+
+private:
+    std::vector<Cell> vCells;
+};
+
+#endif // BITCOIN_TXRECONCILIATION_H
@@ -0,0 +1,169 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <txrequest.h>
+
+#include <assert.h>
+
+bool TxRequestTracker::ReceivedInv(NodeId peer, const CInv& inv, bool fPreferred, int64_t nReqTime)
+{
+    PeerEntry& peerEntry = mapPeers[peer];
+    if (peerEntry.nAnnouncements >= MAX_PEER_TX_ANNOUNCEMENTS)
+        return false;
+    Announcement ann{inv, nReqTime, nNextSequence, fPreferred, WAITING};
+    if (!mapAnnouncements.emplace(std::make_pair(peer, inv.hash), ann).second)
+        return false;
+    nNextSequence++;
+    peerEntry.nAnnouncements++;
+    mapTxs[inv.hash].setPeers.insert(peer);
+    setTimeline.emplace(nReqTime, peer, inv.hash);
+    return true;
+}
+
+std::vector<CInv> TxRequestTracker::GetRequestable(NodeId peer, int64_t nNow)
+{
+    while (!setTimeline.empty() && std::get<0>(*setTimeline.begin()) <= nNow) {
+        const NodeId annPeer = std::get<1>(*setTimeline.begin());
+        const uint256 txid = std::get<2>(*setTimeline.begin());
+        setTimeline.erase(setTimeline.begin());
+        auto it = mapAnnouncements.find(std::make_pair(annPeer, txid));
+        assert(it != mapAnnouncements.end());
+        if (it->second.state == WAITING) {
+            it->second.state = READY;
+            mapTxs[txid].setReady.insert(GetCandidateKey(annPeer, it->second));
+        } else {
+            // The request expired without an answer; count it as a notfound
+            assert(it->second.state == REQUESTED);
+            RemoveAnnouncement(it);
+        }
+        Reselect(txid);
+    }
+
+    std::vector<CInv> vInv;
+    auto itPeer = mapPeers.find(peer);
+    if (itPeer != mapPeers.end()) {
+        for (const auto& selected : itPeer->second.setSelected)
+            vInv.push_back(mapAnnouncements.at(std::make_pair(peer, selected.second)).inv);
+    }
+    return vInv;
+}
+
+void TxRequestTracker::RequestedTx(NodeId peer, const uint256& txid, int64_t nExpiry)
+{
+    auto itTx = mapTxs.find(txid);
+    if (itTx == mapTxs.end() || itTx->second.selected != peer)
+        return;
+    TxEntry& entry = itTx->second;
+    Announcement& ann = mapAnnouncements.at(std::make_pair(peer, txid));
+    SetSelected(txid, entry, -1);
+    entry.setReady.erase(GetCandidateKey(peer, ann));
+    entry.requested = peer;
+    mapPeers[peer].nRequested++;
+    ann.state = REQUESTED;
+    ann.nTime = nExpiry;
+    setTimeline.emplace(nExpiry, peer, txid);
+}
+
+void TxRequestTracker::ReceivedResponse(NodeId peer, const uint256& txid)
+{
+    auto it = mapAnnouncements.find(std::make_pair(peer, txid));
+    if (it == mapAnnouncements.end())
+        return;
+    RemoveAnnouncement(it);
+    Reselect(txid);
+}
+
+void TxRequestTracker::ForgetTxHash(const uint256& txid)
+{
+    auto itTx = mapTxs.find(txid);
+    if (itTx == mapTxs.end())
+        return;
+    const std::set<NodeId> setPeers = itTx->second.setPeers;
+    for (NodeId peer : setPeers)
+        RemoveAnnouncement(mapAnnouncements.find(std::make_pair(peer, txid)));
+    Reselect(txid);
+}
+
+void TxRequestTracker::DisconnectedPeer(NodeId peer)
+{
+    auto it = mapAnnouncements.lower_bound(std::make_pair(peer, uint256()));
+    while (it != mapAnnouncements.end() && it->first.first == peer) {
+        const uint256 txid = it->first.second;
+        RemoveAnnouncement(it++);
+        Reselect(txid);
+    }
+    mapPeers.erase(peer);
+}
+
+size_t TxRequestTracker::Count(NodeId peer) const
+{
+    auto it = mapPeers.find(peer);
+    return it == mapPeers.end() ? 0 : it->second.nAnnouncements;
+}
+
+size_t TxRequestTracker::CountInFlight(NodeId peer) const
+{
+    auto it = mapPeers.find(peer);
+    return it == mapPeers.end() ? 0 : it->second.nRequested;
+}
+
+void TxRequestTracker::SetSelected(const uint256& txid, TxEntry& entry, NodeId peer)
+{
+    if (entry.selected == peer)
+        return;
+    if (entry.selected != -1) {
+        const Announcement& ann = mapAnnouncements.at(std::make_pair(entry.selected, txid));
+        mapPeers[entry.selected].setSelected.erase(std::make_pair(ann.nSequence, txid));
+    }
+    entry.selected = peer;
+    if (peer != -1) {
+        const Announcement& ann = mapAnnouncements.at(std::make_pair(peer, txid));
+        mapPeers[peer].setSelected.emplace(ann.nSequence, txid);
+    }
+}
+
+void TxRequestTracker::Reselect(const uint256& txid)
+{
+    auto itTx = mapTxs.find(txid);
+    if (itTx == mapTxs.end())
+        return;
+    TxEntry& entry = itTx->second;
+    if (entry.setPeers.empty()) {
+        assert(entry.selected == -1 && entry.requested == -1 && entry.setReady.empty());
+        mapTxs.erase(itTx);
+        return;
+    }
+    // Nothing is picked while a request is outstanding
+    NodeId best = -1;
+    if (entry.requested == -1 && !entry.setReady.empty())
+        best = std::get<2>(*entry.setReady.begin());
+    SetSelected(txid, entry, best);
+}
+
+void TxRequestTracker::RemoveAnnouncement(std::map<std::pair<NodeId, uint256>, Announcement>::iterator it)
+{
+    const NodeId peer = it->first.first;
+    const uint256& txid = it->first.second;
+    const Announcement& ann = it->second;
+    TxEntry& entry = mapTxs.at(txid);
+    PeerEntry& peerEntry = mapPeers.at(peer);
+    switch (ann.state) {
+    case WAITING:
+        setTimeline.erase(std::make_tuple(ann.nTime, peer, txid));
+        break;
+    case READY:
+        if (entry.selected == peer)
+            SetSelected(txid, entry, -1);
+        entry.setReady.erase(GetCandidateKey(peer, ann));
+        break;
+    case REQUESTED:
+        setTimeline.erase(std::make_tuple(ann.nTime, peer, txid));
+        entry.requested = -1;
+        peerEntry.nRequested--;
+        break;
+    }
+    entry.setPeers.erase(peer);
+    peerEntry.nAnnouncements--;
+    mapAnnouncements.erase(it);
+}
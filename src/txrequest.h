@@ -0,0 +1,134 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXREQUEST_H
+#define BITCOIN_TXREQUEST_H
+
+#include <net.h>
+#include <protocol.h>
+#include <uint256.h>
+
+#include <map>
+#include <set>
+#include <tuple>
+#include <vector>
+
+/** Most transactions announced by a peer that are kept track of at once */
+static const size_t MAX_PEER_TX_ANNOUNCEMENTS = MAX_INV_SZ;
+/** How long a transaction request waits for an answer before the next peer is asked, in microseconds */
+static const int64_t TX_REQUEST_EXPIRY = 60 * 1000000;
+/** How much later a transaction announced by a peer that is not preferred may be requested, in microseconds */
+static const int64_t TX_REQUEST_NONPREFERRED_DELAY = 2 * 1000000;
+
+/**
+ * Keeps track of the transactions announced by peers, and of which peer each
+ * is requested from, so that a transaction is only requested from one peer at
+ * a time.
+ *
+ * Every announcement waits until its request time, and then becomes a
+ * candidate. Of the candidates for a transaction, the one of a preferred peer
+ * (outbound or whitelisted) is picked over the others, and then the one
+ * announced first. The transaction is requested from the peer picked, and if
+ * no answer comes before the request expires, or the peer sends a notfound or
+ * goes away, the next candidate is picked.
+ *
+ * Announcements are indexed by peer and by transaction, and the pending
+ * request times and expiries by time, so that every call takes time
+ * logarithmic in the number of announcements, plus what it returns.
+ */
+class TxRequestTracker
+{
+public:
+    /**
+     * Add the announcement of inv by peer, which may be requested from
+     * nReqTime; false if the peer announced it already, or has too many
+     * announcements.
+     */
+    bool ReceivedInv(NodeId peer, const CInv& inv, bool fPreferred, int64_t nReqTime);
+
+    /**
+     * The transactions to request from peer now, in the order they were
+     * announced. The request times and expiries up to nNow are processed for
+     * all peers first.
+     */
+    std::vector<CInv> GetRequestable(NodeId peer, int64_t nNow);
+
+    /** The transaction, returned by GetRequestable, was requested from peer; the request expires at nExpiry */
+    void RequestedTx(NodeId peer, const uint256& txid, int64_t nExpiry);
+
+    /** The peer answered the announcement of txid, with the transaction or a notfound */
+    void ReceivedResponse(NodeId peer, const uint256& txid);
+
+    /** Drop all announcements of txid, once it was received or is no longer wanted */
+    void ForgetTxHash(const uint256& txid);
+
+    /** Drop all announcements of a peer */
+    void DisconnectedPeer(NodeId peer);
+
+    /** Number of announcements of a peer, and of those requested from it */
+    size_t Count(NodeId peer) const;
+    size_t CountInFlight(NodeId peer) const;
+    /** Number of announcements of all peers */
+    size_t Size() const { return mapAnnouncements.size(); }
+
+private:
+    enum State {
+        //! Waiting for its request time
+        WAITING,
+        //! A candidate to be requested
+        READY,
+        //! Requested, waiting for an answer until its expiry
+        REQUESTED,
+    };
+
+    struct Announcement
+    {
+        CInv inv;
+        //! The request time while WAITING, the expiry once REQUESTED
+        int64_t nTime;
+        uint64_t nSequence;
+        bool fPreferred;
+        State state;
+    };
+
+    //! Candidates of a transaction, the one to pick first at the front
+    typedef std::tuple<bool, uint64_t, NodeId> CandidateKey;
+
+    struct TxEntry
+    {
+        std::set<NodeId> setPeers;
+        std::set<CandidateKey> setReady;
+        //! The peer it is requested from, and the candidate picked to request it next; -1 if none
+        NodeId requested = -1;
+        NodeId selected = -1;
+    };
+
+    struct PeerEntry
+    {
+        size_t nAnnouncements = 0;
+        size_t nRequested = 0;
+        //! Transactions to request from the peer, by sequence
+        std::set<std::pair<uint64_t, uint256>> setSelected;
+    };
+
+    std::map<std::pair<NodeId, uint256>, Announcement> mapAnnouncements;
+    std::map<uint256, TxEntry> mapTxs;
+    std::map<NodeId, PeerEntry> mapPeers;
+    //! Request times of WAITING announcements and expiries of REQUESTED ones
+    std::set<std::tuple<int64_t, NodeId, uint256>> setTimeline;
+    uint64_t nNextSequence = 0;
+
+    static CandidateKey GetCandidateKey(NodeId peer, const Announcement& ann)
+    {
+        return CandidateKey(!ann.fPreferred, ann.nSequence, peer);
+    }
+
+    void SetSelected(const uint256& txid, TxEntry& entry, NodeId peer);
+    //! Pick the candidate of a transaction to request it from next, or drop it if it has no announcements left
+    void Reselect(const uint256& txid);
+    //! Remove an announcement; Reselect must be called for its transaction after
+    void RemoveAnnouncement(std::map<std::pair<NodeId, uint256>, Announcement>::iterator it);
+};
+
+#endif // BITCOIN_TXREQUEST_H
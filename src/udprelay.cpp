@@ -0,0 +1,410 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <udprelay.h>
+
+#include <blockencodings.h>
+#include <bloom.h>
+#include <chainparams.h>
+#include <compat.h>
+#include <crypto/common.h>
+#include <net_processing.h>
+#include <netbase.h>
+#include <protocol.h>
+#include <streams.h>
+#include <threadinterrupt.h>
+#include <util.h>
+#include <utiltime.h>
+#include <version.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string.h>
+#include <thread>
+
+uint16_t GetFECParityChunks(uint16_t nDataChunks)
+{
+    if (nDataChunks == 0)
+        return 0;
+    return std::max<uint16_t>(1, (nDataChunks * UDP_RELAY_FEC_PERCENT + 99) / 100);
+}
+
+std::vector<std::vector<unsigned char>> FECEncode(const std::vector<unsigned char>& data, uint16_t nParity)
+{
+    const size_t nDataChunks = (data.size() + UDP_RELAY_CHUNK_SIZE - 1) / UDP_RELAY_CHUNK_SIZE;
+    std::vector<std::vector<unsigned char>> vChunks(nDataChunks + nParity, std::vector<unsigned char>(UDP_RELAY_CHUNK_SIZE, 0));
+    for (size_t i = 0; i < nDataChunks; i++) {
+        const size_t nPos = i * UDP_RELAY_CHUNK_SIZE;
+        std::copy(data.begin() + nPos, data.begin() + std::min(nPos + UDP_RELAY_CHUNK_SIZE, data.size()), vChunks[i].begin());
+        if (nParity == 0)
+            continue;
+        std::vector<unsigned char>& parity = vChunks[nDataChunks + i % nParity];
+        for (size_t j = 0; j < UDP_RELAY_CHUNK_SIZE; j++)
+            parity[j] ^= vChunks[i][j];
+    }
+    return vChunks;
+}
+
+FECDecoder::FECDecoder(uint32_t nDataSizeIn, uint16_t nDataChunksIn, uint16_t nParityChunksIn)
+    : nDataSize(nDataSizeIn), nDataChunks(nDataChunksIn), nParityChunks(nParityChunksIn),
+      vChunks(nDataChunksIn + nParityChunksIn), nMissing(nDataChunksIn)
+{
+}
+
+bool FECDecoder::ProvideChunk(uint16_t nIndex, const unsigned char* pchunk)
+{
+    if (nIndex >= vChunks.size() || !vChunks[nIndex].empty() || IsComplete())
+        return IsComplete();
+    vChunks[nIndex].assign(pchunk, pchunk + UDP_RELAY_CHUNK_SIZE);
+    if (nIndex < nDataChunks)
+        nMissing--;
+    if (nParityChunks > 0)
+        Recover(nIndex < nDataChunks ? nIndex % nParityChunks : nIndex - nDataChunks);
+    return IsComplete();
+}
+
+void FECDecoder::Recover(uint16_t nGroup)
+{
+    std::vector<unsigned char>& parity = vChunks[nDataChunks + nGroup];
+    if (parity.empty())
+        return;
+    size_t nLost = nDataChunks;
+    for (size_t i = nGroup; i < nDataChunks; i += nParityChunks) {
+        if (!vChunks[i].empty())
+            continue;
+        if (nLost != nDataChunks)
+            return; // More than one lost
+        nLost = i;
+    }
+    if (nLost == nDataChunks)
+        return;
+    std::vector<unsigned char> chunk = parity;
+    for (size_t i = nGroup; i < nDataChunks; i += nParityChunks) {
+        if (i == nLost)
+            continue;
+        for (size_t j = 0; j < UDP_RELAY_CHUNK_SIZE; j++)
+            chunk[j] ^= vChunks[i][j];
+    }
+    vChunks[nLost] = std::move(chunk);
+    nMissing--;
+}
+
+std::vector<unsigned char> FECDecoder::GetData() const
+{
+    assert(IsComplete());
+    std::vector<unsigned char> data;
+    data.reserve(nDataChunks * UDP_RELAY_CHUNK_SIZE);
+    for (size_t i = 0; i < nDataChunks; i++)
+        data.insert(data.end(), vChunks[i].begin(), vChunks[i].end());
+    data.resize(nDataSize);
+    return data;
+}
+
+namespace {
+
+/** Most blocks reassembled at once; the oldest is dropped to make room for a new one */
+static const size_t MAX_UDP_RELAY_PARTIAL_BLOCKS = 8;
+/** Bumped when the packet layout changes */
+static const unsigned char UDP_RELAY_VERSION = 1;
+/** Message start, version, block hash, data size, chunk index, data and parity chunk counts */
+static const size_t UDP_RELAY_HEADER_SIZE = CMessageHeader::MESSAGE_START_SIZE + 1 + 32 + 4 + 2 + 2 + 2;
+static const size_t UDP_RELAY_PACKET_SIZE = UDP_RELAY_HEADER_SIZE + UDP_RELAY_CHUNK_SIZE;
+/** Most packets read before checking for shutdown again */
+static const int UDP_RELAY_MAX_READS = 1000;
+
+/**
+ * Sends new blocks to a fixed set of trusted peers as compact blocks split
+ * into chunks plus parity chunks, one UDP packet each, and reassembles the
+ * blocks they send. A block arrives in about the one-way latency, without
+ * waiting for TCP round trips or slow start, and some packets may be lost
+ * without a retransmission. Blocks whose transactions are not all in our
+ * mempool are left to TCP peers.
+ *
+ * Packets are only checked to come from the address of a peer, so the peers
+ * must be reachable over a network that is trusted not to spoof them. Every
+ * peer sends its blocks to all others, nothing is forwarded.
+ */
+class CUDPRelay
+{
+private:
+    struct Peer
+    {
+        CService addr;
+        SOCKET hSocket;
+        struct sockaddr_storage sockaddr;
+        socklen_t len;
+    };
+
+    struct PartialBlock
+    {
+        FECDecoder decoder;
+        int64_t nTime;
+    };
+
+    std::mutex cs;
+    bool fStarted = false;
+    std::vector<SOCKET> vSockets;
+    std::vector<Peer> vPeers;
+    //! Blocks sent or received, which are not sent again
+    CRollingBloomFilter filterKnownBlocks{1000, 0.000001};
+    std::map<uint256, PartialBlock> mapPartialBlocks;
+
+    CThreadInterrupt interrupt;
+    std::thread threadRelay;
+
+    SOCKET BindSocket(const CService& addrBind, std::string& strError)
+    {
+        struct sockaddr_storage sockaddr;
+        socklen_t len = sizeof(sockaddr);
+        if (!addrBind.GetSockAddr((struct sockaddr*)&sockaddr, &len)) {
+            strError = strprintf(_("Bind address family for %s not supported"), addrBind.ToString());
+            return INVALID_SOCKET;
+        }
+        SOCKET hSocket = socket(((struct sockaddr*)&sockaddr)->sa_family, SOCK_DGRAM, IPPROTO_UDP);
+        if (hSocket == INVALID_SOCKET) {
+            strError = strprintf(_("Couldn't open UDP socket (socket returned error %s)"), NetworkErrorString(WSAGetLastError()));
+            return INVALID_SOCKET;
+        }
+#ifdef IPV6_V6ONLY
+        if (addrBind.IsIPv6()) {
+            int nOne = 1;
+            setsockopt(hSocket, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&nOne, sizeof(int));
+        }
+#endif
+        if (::bind(hSocket, (struct sockaddr*)&sockaddr, len) == SOCKET_ERROR) {
+            strError = strprintf(_("Unable to bind to %s for the UDP block relay (bind returned error %s)"), addrBind.ToString(), NetworkErrorString(WSAGetLastError()));
+            CloseSocket(hSocket);
+            return INVALID_SOCKET;
+        }
+        if (!SetSocketNonBlocking(hSocket, true)) {
+            strError = strprintf(_("Setting the UDP block relay socket to non-blocking failed, error %s"), NetworkErrorString(WSAGetLastError()));
+            CloseSocket(hSocket);
+            return INVALID_SOCKET;
+        }
+        LogPrintf("UDP block relay bound to %s\n", addrBind.ToString());
+        return hSocket;
+    }
+
+    void ProcessPacket(const unsigned char* pch, size_t nBytes, const CService& addrFrom)
+    {
+        if (nBytes != UDP_RELAY_PACKET_SIZE)
+            return;
+        if (std::none_of(vPeers.begin(), vPeers.end(), [&addrFrom](const Peer& peer) { return peer.addr == addrFrom; }))
+            return;
+        if (memcmp(pch, Params().MessageStart(), CMessageHeader::MESSAGE_START_SIZE) != 0 ||
+                pch[CMessageHeader::MESSAGE_START_SIZE] != UDP_RELAY_VERSION)
+            return;
+        pch += CMessageHeader::MESSAGE_START_SIZE + 1;
+        uint256 hash;
+        memcpy(hash.begin(), pch, 32);
+        const uint32_t nDataSize = ReadLE32(pch + 32);
+        const uint16_t nIndex = ReadLE16(pch + 36);
+        const uint16_t nDataChunks = ReadLE16(pch + 38);
+        const uint16_t nParityChunks = ReadLE16(pch + 40);
+        pch += 42;
+        if (nDataSize == 0 || nDataSize > MAX_UDP_RELAY_BLOCK_SIZE ||
+                nDataChunks != (nDataSize + UDP_RELAY_CHUNK_SIZE - 1) / UDP_RELAY_CHUNK_SIZE ||
+                nParityChunks != GetFECParityChunks(nDataChunks) || nIndex >= nDataChunks + nParityChunks)
+            return;
+
+        std::vector<unsigned char> data;
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            if (filterKnownBlocks.contains(hash))
+                return;
+            auto it = mapPartialBlocks.find(hash);
+            if (it == mapPartialBlocks.end()) {
+                if (mapPartialBlocks.size() >= MAX_UDP_RELAY_PARTIAL_BLOCKS) {
+                    mapPartialBlocks.erase(std::min_element(mapPartialBlocks.begin(), mapPartialBlocks.end(),
+                        [](const std::pair<const uint256, PartialBlock>& a, const std::pair<const uint256, PartialBlock>& b) { return a.second.nTime < b.second.nTime; }));
+                }
+                it = mapPartialBlocks.emplace(hash, PartialBlock{FECDecoder(nDataSize, nDataChunks, nParityChunks), GetTimeMicros()}).first;
+            } else if (!it->second.decoder.Matches(nDataSize, nDataChunks, nParityChunks)) {
+                return;
+            }
+            if (!it->second.decoder.ProvideChunk(nIndex, pch))
+                return;
+            data = it->second.decoder.GetData();
+            mapPartialBlocks.erase(it);
+            filterKnownBlocks.insert(hash);
+        }
+
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        try {
+            CDataStream ss(data, SER_NETWORK, PROTOCOL_VERSION);
+            ss >> cmpctblock;
+        } catch (const std::exception& e) {
+            LogPrint(BCLog::NET, "UDP block relay: invalid compact block %s from %s: %s\n", hash.ToString(), addrFrom.ToString(), e.what());
+            return;
+        }
+        if (cmpctblock.header.GetHash() != hash) {
+            LogPrint(BCLog::NET, "UDP block relay: compact block from %s does not match hash %s\n", addrFrom.ToString(), hash.ToString());
+            return;
+        }
+        bool fNewBlock = ProcessUDPCmpctBlock(cmpctblock, Params());
+        LogPrint(BCLog::NET, "UDP block relay: %s block %s from %s\n", fNewBlock ? "reconstructed" : "did not use", hash.ToString(), addrFrom.ToString());
+    }
+
+    void ThreadRelay()
+    {
+        std::vector<unsigned char> vBuffer(UDP_RELAY_PACKET_SIZE + 1);
+        while (!interrupt) {
+            fd_set fdsetRecv;
+            FD_ZERO(&fdsetRecv);
+            SOCKET hSocketMax = 0;
+            for (SOCKET hSocket : vSockets) {
+                FD_SET(hSocket, &fdsetRecv);
+                hSocketMax = std::max(hSocketMax, hSocket);
+            }
+            struct timeval timeout;
+            timeout.tv_sec = 0;
+            timeout.tv_usec = 100000;
+            if (select(hSocketMax + 1, &fdsetRecv, nullptr, nullptr, &timeout) == SOCKET_ERROR) {
+                interrupt.sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            for (SOCKET hSocket : vSockets) {
+                if (!FD_ISSET(hSocket, &fdsetRecv))
+                    continue;
+                for (int i = 0; i < UDP_RELAY_MAX_READS && !interrupt; i++) {
+                    struct sockaddr_storage sockaddr;
+                    socklen_t len = sizeof(sockaddr);
+                    int nBytes = recvfrom(hSocket, (char*)vBuffer.data(), vBuffer.size(), 0, (struct sockaddr*)&sockaddr, &len);
+                    if (nBytes < 0)
+                        break;
+                    CService addrFrom;
+                    if (addrFrom.SetSockAddr((const struct sockaddr*)&sockaddr))
+                        ProcessPacket(vBuffer.data(), nBytes, addrFrom);
+                }
+            }
+        }
+    }
+
+public:
+    bool Start(std::string& strError)
+    {
+        const int64_t nPort = gArgs.GetArg("-udprelayport", DEFAULT_UDP_RELAY_PORT);
+        if (nPort <= 0 || nPort > 65535) {
+            strError = strprintf(_("Invalid port for -udprelayport: %d"), nPort);
+            return false;
+        }
+        std::vector<Peer> vNewPeers;
+        for (const std::string& strPeer : gArgs.GetArgs("-udprelaypeer")) {
+            Peer peer;
+            if (!Lookup(strPeer.c_str(), peer.addr, nPort, fNameLookup) || !peer.addr.IsValid()) {
+                strError = strprintf(_("Invalid address for -udprelaypeer: '%s'"), strPeer);
+                return false;
+            }
+            peer.len = sizeof(peer.sockaddr);
+            if (!peer.addr.GetSockAddr((struct sockaddr*)&peer.sockaddr, &peer.len)) {
+                strError = strprintf(_("Address family for -udprelaypeer %s not supported"), strPeer);
+                return false;
+            }
+            vNewPeers.push_back(peer);
+        }
+        if (vNewPeers.empty()) {
+            strError = _("-udprelayport requires at least one -udprelaypeer");
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(cs);
+        // One socket for each address family of the peers
+        SOCKET hSocket4 = INVALID_SOCKET, hSocket6 = INVALID_SOCKET;
+        for (Peer& peer : vNewPeers) {
+            const bool fIPv4 = peer.addr.IsIPv4();
+            SOCKET& hSocket = fIPv4 ? hSocket4 : hSocket6;
+            if (hSocket == INVALID_SOCKET) {
+                struct in_addr inaddr_any;
+                inaddr_any.s_addr = INADDR_ANY;
+                hSocket = BindSocket(fIPv4 ? CService(inaddr_any, nPort) : CService(in6addr_any, nPort), strError);
+                if (hSocket == INVALID_SOCKET) {
+                    for (SOCKET hBound : vSockets)
+                        CloseSocket(hBound);
+                    vSockets.clear();
+                    return false;
+                }
+                vSockets.push_back(hSocket);
+            }
+            peer.hSocket = hSocket;
+            LogPrintf("UDP block relay peer %s\n", peer.addr.ToString());
+        }
+        vPeers = vNewPeers;
+        fStarted = true;
+        interrupt.reset();
+        threadRelay = std::thread(&TraceThread<std::function<void()>>, "udprelay", std::function<void()>(std::bind(&CUDPRelay::ThreadRelay, this)));
+        return true;
+    }
+
+    void Stop()
+    {
+        interrupt();
+        if (threadRelay.joinable())
+            threadRelay.join();
+        std::lock_guard<std::mutex> lock(cs);
+        fStarted = false;
+        for (SOCKET& hSocket : vSockets)
+            CloseSocket(hSocket);
+        vSockets.clear();
+        vPeers.clear();
+        mapPartialBlocks.clear();
+    }
+
+    void RelayBlock(const uint256& hash, const std::vector<unsigned char>& cmpctblock)
+    {
+        if (cmpctblock.empty() || cmpctblock.size() > MAX_UDP_RELAY_BLOCK_SIZE)
+            return;
+        std::lock_guard<std::mutex> lock(cs);
+        if (!fStarted || filterKnownBlocks.contains(hash))
+            return;
+        filterKnownBlocks.insert(hash);
+        mapPartialBlocks.erase(hash);
+
+        const uint16_t nDataChunks = (cmpctblock.size() + UDP_RELAY_CHUNK_SIZE - 1) / UDP_RELAY_CHUNK_SIZE;
+        const uint16_t nParityChunks = GetFECParityChunks(nDataChunks);
+        const std::vector<std::vector<unsigned char>> vChunks = FECEncode(cmpctblock, nParityChunks);
+
+        std::vector<unsigned char> vPacket(UDP_RELAY_PACKET_SIZE);
+        unsigned char* pch = vPacket.data();
+        memcpy(pch, Params().MessageStart(), CMessageHeader::MESSAGE_START_SIZE);
+        pch[CMessageHeader::MESSAGE_START_SIZE] = UDP_RELAY_VERSION;
+        pch += CMessageHeader::MESSAGE_START_SIZE + 1;
+        memcpy(pch, hash.begin(), 32);
+        WriteLE32(pch + 32, cmpctblock.size());
+        WriteLE16(pch + 38, nDataChunks);
+        WriteLE16(pch + 40, nParityChunks);
+
+        // Send every chunk to all peers before the next one, so each gets the start of the block first
+        size_t nFailed = 0;
+        for (uint16_t i = 0; i < vChunks.size(); i++) {
+            WriteLE16(pch + 36, i);
+            memcpy(pch + 42, vChunks[i].data(), UDP_RELAY_CHUNK_SIZE);
+            for (const Peer& peer : vPeers) {
+                if (sendto(peer.hSocket, (const char*)vPacket.data(), vPacket.size(), 0, (const struct sockaddr*)&peer.sockaddr, peer.len) != (int)vPacket.size())
+                    nFailed++;
+            }
+        }
+        LogPrint(BCLog::NET, "UDP block relay: sent block %s in %u+%u chunks to %u peers (%u sends failed)\n",
+            hash.ToString(), nDataChunks, nParityChunks, vPeers.size(), nFailed);
+    }
+};
+
+static CUDPRelay g_udp_relay;
+
+} // namespace
+
+bool StartUDPRelay(std::string& strError)
+{
+    return g_udp_relay.Start(strError);
+}
+
+void StopUDPRelay()
+{
+    g_udp_relay.Stop();
+}
+
+void UDPRelayBlock(const uint256& hash, const std::vector<unsigned char>& cmpctblock)
+{
+    g_udp_relay.RelayBlock(hash, cmpctblock);
+}
@@ -0,0 +1,73 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UDPRELAY_H
+#define BITCOIN_UDPRELAY_H
+
+#include <uint256.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Default for -udprelayport, 0 disables the UDP block relay */
+static const int DEFAULT_UDP_RELAY_PORT = 0;
+/** Bytes of data in every chunk; with the header, a packet fits in the minimum IPv6 MTU */
+static const size_t UDP_RELAY_CHUNK_SIZE = 1152;
+/** Largest serialized compact block sent over UDP; larger ones only go over TCP */
+static const size_t MAX_UDP_RELAY_BLOCK_SIZE = 1000000;
+/** Parity chunks sent for every hundred data chunks */
+static const unsigned int UDP_RELAY_FEC_PERCENT = 25;
+
+/** Number of parity chunks sent along with nDataChunks data chunks */
+uint16_t GetFECParityChunks(uint16_t nDataChunks);
+
+/**
+ * Split data into chunks of UDP_RELAY_CHUNK_SIZE bytes, the last one padded
+ * with zeros, followed by nParity parity chunks. Parity chunk j is the XOR of
+ * the data chunks i with i % nParity == j, so one lost chunk of each group
+ * can be recovered; as consecutive chunks are in different groups, so can a
+ * burst of up to nParity lost ones.
+ */
+std::vector<std::vector<unsigned char>> FECEncode(const std::vector<unsigned char>& data, uint16_t nParity);
+
+/** Reassembles data from the chunks of FECEncode, in any order and with some missing */
+class FECDecoder
+{
+public:
+    FECDecoder(uint32_t nDataSizeIn, uint16_t nDataChunksIn, uint16_t nParityChunksIn);
+
+    /** Add the chunk with index nIndex, data chunks first; returns whether all data is known now */
+    bool ProvideChunk(uint16_t nIndex, const unsigned char* pchunk);
+    bool IsComplete() const { return nMissing == 0; }
+    /** The data, once complete */
+    std::vector<unsigned char> GetData() const;
+
+    bool Matches(uint32_t nDataSizeIn, uint16_t nDataChunksIn, uint16_t nParityChunksIn) const
+    {
+        return nDataSize == nDataSizeIn && nDataChunks == nDataChunksIn && nParityChunks == nParityChunksIn;
+    }
+
+private:
+    uint32_t nDataSize;
+    uint16_t nDataChunks;
+    uint16_t nParityChunks;
+    //! Data chunks, then parity chunks; empty while not known
+    std::vector<std::vector<unsigned char>> vChunks;
+    size_t nMissing;
+
+    void Recover(uint16_t nGroup);
+};
+
+/**
+ * Start sending new blocks to, and receiving them from, the -udprelaypeer
+ * peers over UDP on -udprelayport. Returns false and sets strError if the
+ * options are invalid or the sockets cannot be bound.
+ */
+bool StartUDPRelay(std::string& strError);
+void StopUDPRelay();
+/** Send a serialized compact block to the UDP relay peers, unless they sent it to us */
+void UDPRelayBlock(const uint256& hash, const std::vector<unsigned char>& cmpctblock);
+
+#endif // BITCOIN_UDPRELAY_H
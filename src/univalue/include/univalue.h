@@ -48,7 +48,9 @@ public:
         std::string s(val_);
         setStr(s);
     }
-    ~UniValue() {}
+    // No destructor is declared, so that C++11 compilers generate move
+    // operations and vectors of values are moved rather than deep-copied
+    // when they grow.
 
     void clear();
 
@@ -111,6 +113,8 @@ public:
         return push_back(tmpVal);
     }
     bool push_backV(const std::vector<UniValue>& vec);
+    // Reserve room for n elements of an array, or n members of an object
+    void reserve(size_t n);
 
     void __pushKV(const std::string& key, const UniValue& val);
     bool pushKV(const std::string& key, const UniValue& val);
@@ -156,6 +160,7 @@ private:
     std::vector<UniValue> values;
 
     bool findKey(const std::string& key, size_t& retIdx) const;
+    void writeValue(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
     void writeArray(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
     void writeObject(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
 
@@ -56,22 +56,39 @@ bool UniValue::setNumStr(const string& val_)
     return true;
 }
 
-bool UniValue::setInt(uint64_t val_)
+// Decimal digits of val_, preceded by a minus sign if negative; the result
+// is always a valid number string, so it need not be checked.
+static void formatInt(uint64_t val_, bool negative, string& out)
 {
-    ostringstream oss;
-
-    oss << val_;
+    char buf[21];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+    do {
+        *--p = '0' + (val_ % 10);
+        val_ /= 10;
+    } while (val_);
+    if (negative)
+        *--p = '-';
+    out.assign(p, end);
+}
 
-    return setNumStr(oss.str());
+bool UniValue::setInt(uint64_t val_)
+{
+    clear();
+    typ = VNUM;
+    formatInt(val_, false, val);
+    return true;
 }
 
 bool UniValue::setInt(int64_t val_)
 {
-    ostringstream oss;
-
-    oss << val_;
-
-    return setNumStr(oss.str());
+    clear();
+    typ = VNUM;
+    if (val_ < 0)
+        formatInt((uint64_t)0 - (uint64_t)val_, true, val);
+    else
+        formatInt((uint64_t)val_, false, val);
+    return true;
 }
 
 bool UniValue::setFloat(double val_)
@@ -126,6 +143,13 @@ bool UniValue::push_backV(const std::vector<UniValue>& vec)
     return true;
 }
 
+void UniValue::reserve(size_t n)
+{
+    if (typ == VOBJ)
+        keys.reserve(n);
+    values.reserve(n);
+}
+
 void UniValue::__pushKV(const std::string& key, const UniValue& val_)
 {
     keys.push_back(key);
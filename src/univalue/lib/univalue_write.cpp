@@ -10,22 +10,23 @@
 
 using namespace std;
 
-static string json_escape(const string& inS)
+// Append inS to outS with JSON escapes, copying the runs between characters
+// that need escaping at once
+static void json_escape(const string& inS, string& outS)
 {
-    string outS;
-    outS.reserve(inS.size() * 2);
+    const char *run = inS.data();
+    const char *end = run + inS.size();
 
-    for (unsigned int i = 0; i < inS.size(); i++) {
-        unsigned char ch = inS[i];
-        const char *escStr = escapes[ch];
+    for (const char *p = run; p != end; p++) {
+        const char *escStr = escapes[(unsigned char)*p];
 
-        if (escStr)
+        if (escStr) {
+            outS.append(run, p);
             outS += escStr;
-        else
-            outS += ch;
+            run = p + 1;
+        }
     }
-
-    return outS;
+    outS.append(run, end);
 }
 
 string UniValue::write(unsigned int prettyIndent,
@@ -34,6 +35,15 @@ string UniValue::write(unsigned int prettyIndent,
     string s;
     s.reserve(1024);
 
+    writeValue(prettyIndent, indentLevel, s);
+
+    return s;
+}
+
+// Nested values are appended to the one output string rather than written
+// to strings of their own
+void UniValue::writeValue(unsigned int prettyIndent, unsigned int indentLevel, string& s) const
+{
     unsigned int modIndent = indentLevel;
     if (modIndent == 0)
         modIndent = 1;
@@ -49,7 +59,9 @@ string UniValue::write(unsigned int prettyIndent,
         writeArray(prettyIndent, modIndent, s);
         break;
     case VSTR:
-        s += "\"" + json_escape(val) + "\"";
+        s += '"';
+        json_escape(val, s);
+        s += '"';
         break;
     case VNUM:
         s += val;
@@ -58,8 +70,6 @@ string UniValue::write(unsigned int prettyIndent,
         s += (val == "1" ? "true" : "false");
         break;
     }
-
-    return s;
 }
 
 static void indentStr(unsigned int prettyIndent, unsigned int indentLevel, string& s)
@@ -76,7 +86,7 @@ void UniValue::writeArray(unsigned int prettyIndent, unsigned int indentLevel, s
     for (unsigned int i = 0; i < values.size(); i++) {
         if (prettyIndent)
             indentStr(prettyIndent, indentLevel, s);
-        s += values[i].write(prettyIndent, indentLevel + 1);
+        values[i].writeValue(prettyIndent, indentLevel + 1, s);
         if (i != (values.size() - 1)) {
             s += ",";
         }
@@ -98,10 +108,12 @@ void UniValue::writeObject(unsigned int prettyIndent, unsigned int indentLevel,
     for (unsigned int i = 0; i < keys.size(); i++) {
         if (prettyIndent)
             indentStr(prettyIndent, indentLevel, s);
-        s += "\"" + json_escape(keys[i]) + "\":";
+        s += '"';
+        json_escape(keys[i], s);
+        s += "\":";
         if (prettyIndent)
             s += " ";
-        s += values.at(i).write(prettyIndent, indentLevel + 1);
+        values.at(i).writeValue(prettyIndent, indentLevel + 1, s);
         if (i != (values.size() - 1))
             s += ",";
         if (prettyIndent)
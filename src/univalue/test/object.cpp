@@ -162,6 +162,15 @@ BOOST_AUTO_TEST_CASE(univalue_set)
     BOOST_CHECK(v.isNum());
     BOOST_CHECK_EQUAL(v.getValStr(), "1023");
 
+    BOOST_CHECK(v.setInt((int64_t)0));
+    BOOST_CHECK_EQUAL(v.getValStr(), "0");
+
+    BOOST_CHECK(v.setInt((int64_t)(-9223372036854775807LL - 1)));
+    BOOST_CHECK_EQUAL(v.getValStr(), "-9223372036854775808");
+
+    BOOST_CHECK(v.setInt((uint64_t)18446744073709551615ULL));
+    BOOST_CHECK_EQUAL(v.getValStr(), "18446744073709551615");
+
     BOOST_CHECK(v.setNumStr("-688"));
     BOOST_CHECK(v.isNum());
     BOOST_CHECK_EQUAL(v.getValStr(), "-688");
@@ -6,6 +6,7 @@
 #include <util.h>
 
 #include <chainparamsbase.h>
+#include <lockfreequeue.h>
 #include <random.h>
 #include <serialize.h>
 #include <utilstrencodings.h>
@@ -66,10 +67,20 @@
 #include <sys/prctl.h>
 #endif
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #ifdef HAVE_MALLOPT_ARENA_MAX
 #include <malloc.h>
 #endif
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
 #include <boost/interprocess/sync/file_lock.hpp>
@@ -173,6 +184,19 @@ static FILE* fileout = nullptr;
 static boost::mutex* mutexDebugLog = nullptr;
 static std::list<std::string>* vMsgsBeforeOpenLog;
 
+/**
+ * While the logging thread runs, LogPrintStr only queues the line, dropping
+ * it if the queue is full. The queue is leaked like the above, so that lines
+ * logged as the thread stops cannot find it gone.
+ */
+static CLockFreeQueue<std::string>* logQueue = nullptr;
+static std::atomic<bool> fLogAsync(false);
+static std::atomic<uint64_t> nLogLinesDropped(0);
+static std::mutex csLogThread;
+static std::condition_variable condLogThread;
+static bool fStopLogThread = false;
+static std::thread logThread;
+
 static int FileWriteStr(const std::string &str, FILE *fp)
 {
     return fwrite(str.data(), 1, str.size(), fp);
@@ -195,6 +219,29 @@ fs::path GetDebugLogPath()
     }
 }
 
+/** Append to the open debug log, reopening it first if requested */
+static int DebugLogWrite(const std::string &str)
+{
+    boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+
+    // buffer if we haven't opened the log yet
+    if (fileout == nullptr) {
+        assert(vMsgsBeforeOpenLog);
+        vMsgsBeforeOpenLog->push_back(str);
+        return str.length();
+    }
+
+    // reopen the log file, if requested
+    if (fReopenDebugLog) {
+        fReopenDebugLog = false;
+        fs::path pathDebug = GetDebugLogPath();
+        if (fsbridge::freopen(pathDebug,"a",fileout) != nullptr)
+            setbuf(fileout, nullptr); // unbuffered
+    }
+
+    return FileWriteStr(str, fileout);
+}
+
 bool OpenDebugLog()
 {
     boost::call_once(&DebugPrintInit, debugPrintInitFlag);
@@ -352,28 +399,76 @@ int LogPrintStr(const std::string &str)
     else if (fPrintToDebugLog)
     {
         boost::call_once(&DebugPrintInit, debugPrintInitFlag);
-        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
 
-        // buffer if we haven't opened the log yet
-        if (fileout == nullptr) {
-            assert(vMsgsBeforeOpenLog);
+        if (fLogAsync) {
             ret = strTimestamped.length();
-            vMsgsBeforeOpenLog->push_back(strTimestamped);
+            if (logQueue->TryPush(strTimestamped))
+                condLogThread.notify_one();
+            else
+                nLogLinesDropped++;
+        } else {
+            ret = DebugLogWrite(strTimestamped);
         }
-        else
-        {
-            // reopen the log file, if requested
-            if (fReopenDebugLog) {
-                fReopenDebugLog = false;
-                fs::path pathDebug = GetDebugLogPath();
-                if (fsbridge::freopen(pathDebug,"a",fileout) != nullptr)
-                    setbuf(fileout, nullptr); // unbuffered
-            }
+    }
+    return ret;
+}
 
-            ret = FileWriteStr(strTimestamped, fileout);
+static void ThreadLog()
+{
+    RenameThread("bitcoin-log");
+    std::atomic_bool fStartedNewLine(true);
+    uint64_t nReported = 0;
+    std::string str;
+    while (true) {
+        while (logQueue->TryPop(str))
+            DebugLogWrite(str);
+
+        uint64_t nDropped = nLogLinesDropped;
+        if (nDropped != nReported) {
+            DebugLogWrite(LogTimestampStr(strprintf("Dropped %u log lines, the logging thread fell behind\n", nDropped - nReported), &fStartedNewLine));
+            nReported = nDropped;
         }
+
+        std::unique_lock<std::mutex> lock(csLogThread);
+        if (fStopLogThread)
+            return;
+        // Lines pushed without the lock may not wake us: look again soon anyway
+        condLogThread.wait_for(lock, std::chrono::milliseconds(100));
     }
-    return ret;
+}
+
+void StartLogThread()
+{
+    assert(!logThread.joinable());
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    if (logQueue == nullptr)
+        logQueue = new CLockFreeQueue<std::string>(LOG_ASYNC_QUEUE_LINES);
+    fStopLogThread = false;
+    logThread = std::thread(&ThreadLog);
+    fLogAsync = true;
+}
+
+void StopLogThread()
+{
+    if (!logThread.joinable())
+        return;
+    fLogAsync = false;
+    {
+        std::unique_lock<std::mutex> lock(csLogThread);
+        fStopLogThread = true;
+        condLogThread.notify_one();
+    }
+    logThread.join();
+
+    // Lines queued by threads that saw fLogAsync before it was cleared
+    std::string str;
+    while (logQueue->TryPop(str))
+        DebugLogWrite(str);
+}
+
+uint64_t GetLogLinesDropped()
+{
+    return nLogLinesDropped;
 }
 
 /** A map that contains all the currently held directory locks. After
@@ -647,12 +742,51 @@ const fs::path &GetDataDir(bool fNetSpecific)
     return path;
 }
 
+static fs::path pathBlocksCached;
+static fs::path pathColdBlocksCached;
+
+/** The network specific blocks directory under the directory set by strArg, or under the data directory */
+static const fs::path &GetBlocksDirCached(fs::path& path, const std::string& strArg, bool fDefaultDataDir)
+{
+    LOCK(csPathCached);
+    if (!path.empty())
+        return path;
+
+    if (gArgs.IsArgSet(strArg)) {
+        path = fs::system_complete(gArgs.GetArg(strArg, ""));
+        if (!fs::is_directory(path)) {
+            path = "";
+            return path;
+        }
+        path /= BaseParams().DataDir();
+    } else if (fDefaultDataDir) {
+        path = GetDataDir();
+    } else {
+        return path;
+    }
+    path /= "blocks";
+    fs::create_directories(path);
+    return path;
+}
+
+const fs::path &GetBlocksDir()
+{
+    return GetBlocksDirCached(pathBlocksCached, "-blocksdir", true);
+}
+
+const fs::path &GetColdBlocksDir()
+{
+    return GetBlocksDirCached(pathColdBlocksCached, "-coldblocksdir", false);
+}
+
 void ClearDatadirCache()
 {
     LOCK(csPathCached);
 
     pathCached = fs::path();
     pathCachedNetSpecific = fs::path();
+    pathBlocksCached = fs::path();
+    pathColdBlocksCached = fs::path();
 }
 
 //获取配置文件全路径
@@ -762,9 +896,9 @@ void FileCommit(FILE *file)
 #endif
 }
 
-bool TruncateFile(FILE *file, unsigned int length) {
+bool TruncateFile(FILE *file, uint64_t length) {
 #if defined(WIN32)
-    return _chsize(_fileno(file), length) == 0;
+    return _chsize_s(_fileno(file), length) == 0;
 #else
     return ftruncate(fileno(file), length) == 0;
 #endif
@@ -907,6 +1041,28 @@ void RenameThread(const char* name)
 #endif
 }
 
+bool PinThread(int nIndex)
+{
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        return false;
+    }
+    int n = nIndex % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && n-- == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+        }
+    }
+#else
+    (void)nIndex;
+#endif
+    return false;
+}
+
 void SetupEnvironment()
 {
 #ifdef HAVE_MALLOPT_ARENA_MAX
@@ -37,6 +37,9 @@ int64_t GetStartupTime();
 static const bool DEFAULT_LOGTIMEMICROS = false;
 static const bool DEFAULT_LOGIPS        = false;
 static const bool DEFAULT_LOGTIMESTAMPS = true;
+static const bool DEFAULT_LOGASYNC      = false;
+/** Lines the logging thread may fall behind by before further ones are dropped */
+static const size_t LOG_ASYNC_QUEUE_LINES = 16384;
 extern const char * const DEFAULT_DEBUGLOGFILE;
 
 /** Signals for translation. */
@@ -170,7 +173,7 @@ bool error(const char* fmt, const Args&... args)
 
 void PrintExceptionContinue(const std::exception *pex, const char* pszThread);
 void FileCommit(FILE *file);
-bool TruncateFile(FILE *file, unsigned int length);
+bool TruncateFile(FILE *file, uint64_t length);
 int RaiseFileDescriptorLimit(int nMinFD);
 void AllocateFileRange(FILE *file, unsigned int offset, unsigned int length);
 bool RenameOver(fs::path src, fs::path dest);
@@ -184,6 +187,10 @@ void ReleaseDirectoryLocks();
 bool TryCreateDirectories(const fs::path& p);
 fs::path GetDefaultDataDir();
 const fs::path &GetDataDir(bool fNetSpecific = true);
+/** Directory of the block and undo files, <datadir>/blocks unless moved by -blocksdir. Empty if -blocksdir is not a directory. */
+const fs::path &GetBlocksDir();
+/** Directory the block and undo files no longer written to are moved to, or empty without -coldblocksdir. */
+const fs::path &GetColdBlocksDir();
 void ClearDatadirCache();
 fs::path GetConfigFile(const std::string& confPath);
 #ifndef WIN32
@@ -196,6 +203,12 @@ fs::path GetSpecialFolderPath(int nFolder, bool fCreate = true);
 fs::path GetDebugLogPath();
 bool OpenDebugLog();
 void ShrinkDebugFile();
+/** Write the debug log from a thread of its own rather than from the threads that log (-logasync) */
+void StartLogThread();
+/** Write out the lines still queued, and go back to writing from the threads that log */
+void StopLogThread();
+/** Lines dropped so far because the logging thread fell behind */
+uint64_t GetLogLinesDropped();
 void runCommand(const std::string& strCommand);
 
 inline bool IsSwitchChar(char c)
@@ -312,6 +325,12 @@ int GetNumCores();
 
 void RenameThread(const char* name);
 
+/**
+ * Pin the calling thread to one CPU, the nIndex-th (modulo their number) of
+ * those the process may run on. Returns false where this is not supported.
+ */
+bool PinThread(int nIndex);
+
 /**
  * .. and a wrapper that just calls func once
  */
@@ -12,6 +12,12 @@
 #include <errno.h>
 #include <limits>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 static const std::string CHARS_ALPHA_NUM = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
 
 static const std::string SAFE_CHARS[] =
@@ -56,10 +62,110 @@ signed char HexDigit(char c)
     return p_util_hexdigit[(unsigned char)c];
 }
 
+static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                                 '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+
+// The vectorized hex conversions use SSE2 and NEON, which every x86_64 and
+// ARMv8 CPU has, so they need neither special compiler flags nor runtime
+// detection. They only take runs of 32 hex digits without whitespace; the
+// rest is left to the scalar code.
+
+#if defined(__SSE2__)
+/** Turn 16 hex digits into their values; false if any of them isn't one */
+static inline bool HexValues(__m128i c, __m128i& v)
+{
+    const __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    const __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    const __m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    const __m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+    if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xffff)
+        return false;
+    v = _mm_or_si128(_mm_and_si128(is_digit, d), _mm_andnot_si128(is_digit, _mm_add_epi8(l, _mm_set1_epi8(10))));
+    return true;
+}
+
+/** Join the values of 16 hex digits into 8 bytes, in the low half of each 16-bit lane */
+static inline __m128i HexJoin(__m128i v)
+{
+    return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0xff)), 4), _mm_srli_epi16(v, 8));
+}
+
+static inline __m128i HexChars(__m128i n)
+{
+    const __m128i letter = _mm_cmpgt_epi8(n, _mm_set1_epi8(9));
+    return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), _mm_and_si128(letter, _mm_set1_epi8('a' - '0' - 10)));
+}
+#endif
+
+/**
+ * Decode hex digits 32 at a time, as long as all of them are; returns how
+ * many were decoded. With out null, they are only checked.
+ */
+static size_t DecodeHexBlocks(const char* psz, size_t len, unsigned char* out)
+{
+    size_t pos = 0;
+#if defined(__SSE2__)
+    for (; pos + 32 <= len; pos += 32) {
+        __m128i v0, v1;
+        if (!HexValues(_mm_loadu_si128((const __m128i*)(psz + pos)), v0) ||
+            !HexValues(_mm_loadu_si128((const __m128i*)(psz + pos + 16)), v1))
+            break;
+        if (out)
+            _mm_storeu_si128((__m128i*)(out + pos / 2), _mm_packus_epi16(HexJoin(v0), HexJoin(v1)));
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    for (; pos + 32 <= len; pos += 32) {
+        // High and low digits of 16 bytes
+        const uint8x16x2_t c = vld2q_u8((const uint8_t*)(psz + pos));
+        uint8x16_t v[2];
+        bool valid = true;
+        for (int i = 0; i < 2; i++) {
+            const uint8x16_t d = vsubq_u8(c.val[i], vdupq_n_u8('0'));
+            const uint8x16_t l = vsubq_u8(vorrq_u8(c.val[i], vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+            const uint8x16_t is_digit = vcltq_u8(d, vdupq_n_u8(10));
+            valid &= vminvq_u8(vorrq_u8(is_digit, vcltq_u8(l, vdupq_n_u8(6)))) == 0xff;
+            v[i] = vbslq_u8(is_digit, d, vaddq_u8(l, vdupq_n_u8(10)));
+        }
+        if (!valid)
+            break;
+        if (out)
+            vst1q_u8(out + pos / 2, vorrq_u8(vshlq_n_u8(v[0], 4), v[1]));
+    }
+#endif
+    return pos;
+}
+
+void HexEncode(const unsigned char* in, size_t len, char* out)
+{
+    size_t pos = 0;
+#if defined(__SSE2__)
+    for (; pos + 16 <= len; pos += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(in + pos));
+        const __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), _mm_set1_epi8(0x0f));
+        const __m128i lo = _mm_and_si128(x, _mm_set1_epi8(0x0f));
+        _mm_storeu_si128((__m128i*)(out + pos * 2), HexChars(_mm_unpacklo_epi8(hi, lo)));
+        _mm_storeu_si128((__m128i*)(out + pos * 2 + 16), HexChars(_mm_unpackhi_epi8(hi, lo)));
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    const uint8x16_t table = vld1q_u8((const uint8_t*)hexmap);
+    for (; pos + 16 <= len; pos += 16) {
+        const uint8x16_t x = vld1q_u8(in + pos);
+        uint8x16x2_t chars;
+        chars.val[0] = vqtbl1q_u8(table, vshrq_n_u8(x, 4));
+        chars.val[1] = vqtbl1q_u8(table, vandq_u8(x, vdupq_n_u8(0x0f)));
+        vst2q_u8((uint8_t*)(out + pos * 2), chars);
+    }
+#endif
+    for (; pos < len; pos++) {
+        out[pos * 2] = hexmap[in[pos] >> 4];
+        out[pos * 2 + 1] = hexmap[in[pos] & 15];
+    }
+}
+
 //是否16进制数
 bool IsHex(const std::string& str)
 {
-    for(std::string::const_iterator it(str.begin()); it != str.end(); ++it)
+    for (std::string::const_iterator it(str.begin() + DecodeHexBlocks(str.data(), str.size(), nullptr)); it != str.end(); ++it)
     {
         if (HexDigit(*it) < 0)
             return false;
@@ -81,11 +187,15 @@ bool IsHexNumber(const std::string& str)
     return (str.size() > starting_location);
 }
 
-//解析其中的16进制数，并将其转换成字符串
-std::vector<unsigned char> ParseHex(const char* psz)
+/** Parse the len characters of psz, which must be followed by a null */
+static std::vector<unsigned char> ParseHex(const char* psz, size_t len)
 {
-    // convert hex dump to vector
-    std::vector<unsigned char> vch;
+    // convert hex dump to vector; it can't be longer than half the string
+    std::vector<unsigned char> vch(len / 2);
+    // strings without whitespace are decoded in blocks first
+    size_t pos = DecodeHexBlocks(psz, len, vch.data());
+    psz += pos;
+    size_t n = pos / 2;
     while (true)
     {
         while (isspace(*psz))
@@ -93,20 +203,27 @@ std::vector<unsigned char> ParseHex(const char* psz)
         signed char c = HexDigit(*psz++);
         if (c == (signed char)-1)//映射值为-1，非法
             break;
-        unsigned char n = (c << 4);//十六进制数移向高4位
+        unsigned char b = (c << 4);//十六进制数移向高4位
         c = HexDigit(*psz++);
         if (c == (signed char)-1)
             break;
-        n |= c;//组合低4位
-        vch.push_back(n);
+        b |= c;//组合低4位
+        vch[n++] = b;
     }
+    vch.resize(n);
     return vch;
 }
 
+//解析其中的16进制数，并将其转换成字符串
+std::vector<unsigned char> ParseHex(const char* psz)
+{
+    return ParseHex(psz, strlen(psz));
+}
+
 //解析其中的16进制数，并将其转换成字符串
 std::vector<unsigned char> ParseHex(const std::string& str)
 {
-    return ParseHex(str.c_str());
+    return ParseHex(str.c_str(), str.size());
 }
 
 void SplitHostPort(std::string in, int &portOut, std::string &hostOut) {
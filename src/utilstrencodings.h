@@ -96,21 +96,42 @@ bool ParseUInt64(const std::string& str, uint64_t *out);
  */
 bool ParseDouble(const std::string& str, double *out);
 
+/** Write the 2 * len lowercase hex digits of in to out, 16 bytes at a time where the CPU allows */
+void HexEncode(const unsigned char* in, size_t len, char* out);
+
 //将字符串转换为16进制
 template<typename T>
 std::string HexStr(const T itbegin, const T itend, bool fSpaces=false)
 {
-    std::string rv;
     static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
                                      '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
-    rv.reserve((itend-itbegin)*3);//预分配3倍空间
+    const size_t n = itend > itbegin ? itend - itbegin : 0;
+    if (n == 0)
+        return std::string();
+    // Size the result exactly and fill it in place, instead of growing it one
+    // character at a time
+    std::string rv(fSpaces ? n * 3 - 1 : n * 2, ' ');//fSpaces为true则以空格作间隔
+    char* out = &rv[0];
+    if (!fSpaces) {
+        // Hand the bytes to HexEncode through a buffer, whatever iterator
+        // they come from
+        unsigned char buf[256];
+        for (T it = itbegin; it < itend; ) {
+            size_t len = 0;
+            for (; len < sizeof(buf) && it < itend; ++it)
+                buf[len++] = (unsigned char)(*it);
+            HexEncode(buf, len, out);
+            out += len * 2;
+        }
+        return rv;
+    }
     for(T it = itbegin; it < itend; ++it)
     {
         unsigned char val = (unsigned char)(*it);
         if(fSpaces && it != itbegin)
-            rv.push_back(' ');//fSpaces为true则以空格作间隔
-        rv.push_back(hexmap[val>>4]);//取高4位转换
-        rv.push_back(hexmap[val&15]);//取低4位转换
+            out++;
+        *out++ = hexmap[val>>4];//取高4位转换
+        *out++ = hexmap[val&15];//取低4位转换
     }
 
     return rv;
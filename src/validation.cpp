@@ -6,17 +6,27 @@
 #include <validation.h>
 
 #include <arith_uint256.h>
+#include <blockcompression.h>
+#include <blockfilemap.h>
+#include <blockfileunlinker.h>
+#include <blockfilewriter.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <checkqueue.h>
+#include <coinstats.h>
 #include <consensus/consensus.h>
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
 #include <cuckoocache.h>
 #include <hash.h>
+#include <index/recenttxindex.h>
+#include <index/txindex.h>
 #include <init.h>
+#include <memusage.h>
+#include <metrics.h>
+#include <notifyqueue.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
 #include <policy/rbf.h>
@@ -30,6 +40,7 @@
 #include <script/standard.h>
 #include <timedata.h>
 #include <tinyformat.h>
+#include <trace.h>
 #include <txdb.h>
 #include <txmempool.h>
 #include <ui_interface.h>
@@ -40,8 +51,15 @@
 #include <validationinterface.h>
 #include <warnings.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <future>
+#include <limits>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -89,6 +107,26 @@ enum DisconnectResult
 
 class ConnectTrace;
 
+/**
+ * A block whose inputs have been connected to pcoinsTip while its script
+ * checks are still running on a CCheckQueueControl shared with the blocks
+ * around it (see CChainState::ConnectTipsPipelined). The precomputed
+ * transaction data is kept here since the queued checks point into it.
+ */
+struct PendingBlockConnect {
+    CBlockIndex* pindex = nullptr;
+    std::shared_ptr<const CBlock> pblock;
+    CCheckQueueControl<CScriptCheck>* control = nullptr;
+    CBlockUndo blockundo;
+    std::deque<PrecomputedTransactionData> txdata;
+};
+
+/** The hash of a block header and whether it has the proof of work it claims, computed without cs_main */
+struct HeaderCheckResult {
+    uint256 hash;
+    bool fValidPoW;
+};
+
 /**
  * CChainState stores and provides an API to update our local knowledge of the
  * current best chain and header tree.
@@ -152,7 +190,8 @@ private:
 
 public:
     CChain chainActive;
-    BlockMap mapBlockIndex;
+    BlockMapMemoryResource mapBlockIndexMemoryResource;
+    BlockMap mapBlockIndex{0, BlockHasher(), BlockMap::key_equal(), BlockMap::allocator_type(&mapBlockIndexMemoryResource)};
     std::multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
     CBlockIndex *pindexBestInvalid = nullptr;
 
@@ -160,16 +199,18 @@ public:
 
     bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams, std::shared_ptr<const CBlock> pblock);
 
-    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex);
+    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, const HeaderCheckResult* precheck = nullptr);
     bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock);
 
     // Block (dis)connection on a given view:
     DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view);
+    DisconnectResult DisconnectBlock(const CBlock& block, CBlockUndo& blockUndo, const CBlockIndex* pindex, CCoinsViewCache& view);
     bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false);
+                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false, PendingBlockConnect* pending = nullptr);
 
     // Block disconnection on our pcoinsTip:
     bool DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions *disconnectpool);
+    bool DisconnectTips(CValidationState& state, const CChainParams& chainparams, const CBlockIndex* pindexFork, DisconnectedBlockTransactions& disconnectpool, int& nDisconnected, bool& fRetrySerially);
 
     // Manual block validity manipulation:
     bool PreciousBlock(CValidationState& state, const CChainParams& params, CBlockIndex *pindex);
@@ -178,6 +219,7 @@ public:
 
     bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
     bool RewindBlockIndex(const CChainParams& params);
+    bool ActivateSnapshot(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexBase, uint64_t nChainTx);
     bool LoadGenesisBlock(const CChainParams& chainparams);
 
     void PruneBlockIndexCandidates();
@@ -187,6 +229,7 @@ public:
 private:
     bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace);
     bool ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool);
+    bool ConnectTipsPipelined(CValidationState& state, const CChainParams& chainparams, const std::vector<CBlockIndex*>& vpindexNew, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool, bool& fRetrySerially);
 
     CBlockIndex* AddToBlockIndex(const CBlockHeader& block);
     /** Create a new block index entry for a given block hash */
@@ -198,7 +241,7 @@ private:
     bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBlockIndex *pindexNew, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 
 
-    bool RollforwardBlock(const CBlockIndex* pindex, CCoinsViewCache& inputs, const CChainParams& params);
+    void RollforwardBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& inputs);
 } g_chainstate;
 
 
@@ -207,22 +250,46 @@ CCriticalSection cs_main;
 
 BlockMap& mapBlockIndex = g_chainstate.mapBlockIndex;
 CChain& chainActive = g_chainstate.chainActive;
+/** Taken on top of cs_main to add to or clear mapBlockIndex, for LookupBlockIndexNoLock */
+static std::mutex g_block_index_lookup_mutex;
+/** The snapshot of chainActive returned by GetChainSnapshot */
+static std::shared_ptr<const CChainSnapshot> g_chain_snapshot = std::make_shared<const CChainSnapshot>();
+/** The height of g_chain_snapshot, and the number of times it was rewound */
+static std::atomic<int> g_chain_snapshot_height{-1};
+static std::atomic<uint64_t> g_chain_rewind_count{0};
 CBlockIndex *pindexBestHeader = nullptr;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 uint256 hashBestBlock;
 int nScriptCheckThreads = 0;
+bool fPinScriptCheckThreads = DEFAULT_SCRIPTCHECK_PINNING;
+bool fParallelBlockHashing = DEFAULT_PARALLEL_BLOCK_HASHING;
+bool fParallelMempoolChecks = DEFAULT_PARALLEL_MEMPOOL_CHECKS;
+bool fParallelHeaderChecks = DEFAULT_PARALLEL_HEADER_CHECKS;
+bool fParallelVerifyDB = DEFAULT_PARALLEL_VERIFYDB;
+bool fParallelReorg = DEFAULT_PARALLEL_REORG;
+unsigned int nScriptCheckPipelineBlocks = DEFAULT_SCRIPTCHECK_PIPELINE_BLOCKS;
+int nPrefetchThreads = 0;
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
-bool fTxIndex = false;
 bool fHavePruned = false;
+bool fSnapshotChainstate = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
+bool fPartialCoinsFlush = DEFAULT_PARTIAL_COINS_FLUSH;
+bool fCoinsCacheReclaim = DEFAULT_COINS_CACHE_RECLAIM;
+int nIBDSyncInterval = DEFAULT_IBD_SYNC_INTERVAL;
+int nSyncCheckpointHeight = -1;
+int nHotBlockFiles = DEFAULT_HOT_BLOCK_FILES;
+bool fAutoCompactDB = DEFAULT_AUTOCOMPACTDB;
+CBlockFileMapCache g_blockfilemaps;
+bool fBlockCompression = DEFAULT_BLOCK_COMPRESSION;
 uint64_t nPruneTarget = 0;
+unsigned int nPruneKeepBlocks = MIN_BLOCKS_TO_KEEP;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
 
@@ -263,6 +330,10 @@ namespace {
 
     /** Dirty block file entries. */
     std::set<int> setDirtyFileInfo;
+
+    /** Numbers of the block files, with their undo files, moved to -coldblocksdir */
+    CCriticalSection cs_ColdBlockFiles;
+    std::set<int> setColdBlockFiles;
 } // anon namespace
 
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator)
@@ -283,9 +354,11 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
     return chain.Genesis();
 }
 
-std::unique_ptr<CCoinsViewDB> pcoinsdbview;
+std::unique_ptr<CCoinsViewStore> pcoinsdbview;
+std::unique_ptr<CCoinsViewPrefetch> pcoinsprefetch;
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
 std::unique_ptr<CBlockTreeDB> pblocktree;
+std::unique_ptr<CIncrementalCoinsStats> pcoinsstats;
 
 enum FlushStateMode {
     FLUSH_STATE_NONE,
@@ -300,6 +373,10 @@ static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPr
 static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight);
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr);
 static FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
+static void UnlinkPrunedFile(int nFile);
+
+CBlockFileWriter g_blockfilewriter([](const CDiskBlockPos& pos, bool fUndo) { return fUndo ? OpenUndoFile(pos) : OpenBlockFile(pos); });
+CBlockFileUnlinker g_blockfileunlinker(UnlinkPrunedFile);
 
 bool CheckFinalTx(const CTransaction &tx, int flags)
 {
@@ -459,6 +536,8 @@ static bool IsCurrentForFeeEstimation()
     return true;
 }
 
+static void PrecheckMempoolScripts(const std::vector<CTransactionRef>& vtx);
+
 /* Make mempool consistent after a reorg, by re-adding or recursively erasing
  * disconnected block transactions from the mempool, and also removing any
  * other transactions from the mempool that are no longer valid given the new
@@ -482,6 +561,12 @@ void UpdateMempoolForReorg(DisconnectedBlockTransactions &disconnectpool, bool f
     // Iterate disconnectpool in reverse, so that we add transactions
     // back to the mempool starting with the earliest transaction that had
     // been previously seen in a block.
+    if (fAddToMempool && fParallelMempoolChecks) {
+        // Verify the scripts of all of them at once first, so that each
+        // AcceptToMemoryPool below finds its signatures cached
+        std::vector<CTransactionRef> vtx(disconnectpool.queuedTx.get<insertion_order>().rbegin(), disconnectpool.queuedTx.get<insertion_order>().rend());
+        PrecheckMempoolScripts(vtx);
+    }
     auto it = disconnectpool.queuedTx.get<insertion_order>().rbegin();
     while (it != disconnectpool.queuedTx.get<insertion_order>().rend()) {
         // ignore validation errors in resurrected transactions
@@ -547,6 +632,46 @@ static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationSt
     return CheckInputs(tx, state, view, true, flags, cacheSigStore, true, txdata);
 }
 
+/**
+ * Script checks of transactions entering the mempool. This is a queue of its
+ * own so that it is never held up by, nor holds up, a block whose checks are
+ * still running on scriptcheckqueue.
+ */
+static CCheckQueue<CScriptCheck> mempoolcheckqueue(16);
+
+void ThreadMempoolScriptCheck() {
+    RenameThread("bitcoin-mempoolch");
+    mempoolcheckqueue.Thread();
+}
+
+/**
+ * CheckInputs for a transaction entering the mempool. With -parmempool, the
+ * script checks of a transaction with at least MIN_PARALLEL_MEMPOOL_INPUTS
+ * inputs are spread over the mempool script checking threads. If one fails,
+ * the inputs are checked again serially to fill in state as CheckInputs does.
+ */
+static bool CheckInputsForMempool(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, unsigned int flags, PrecomputedTransactionData& txdata)
+{
+    if (!fParallelMempoolChecks || nScriptCheckThreads == 0 || tx.vin.size() < MIN_PARALLEL_MEMPOOL_INPUTS) {
+        return CheckInputs(tx, state, view, true, flags, true, false, txdata);
+    }
+
+    std::vector<CScriptCheck> vChecks;
+    if (!CheckInputs(tx, state, view, true, flags, true, false, txdata, &vChecks)) {
+        return false;
+    }
+    if (vChecks.empty()) {
+        // Cached as valid already
+        return true;
+    }
+    CCheckQueueControl<CScriptCheck> control(&mempoolcheckqueue);
+    control.Add(vChecks);
+    if (control.Wait()) {
+        return true;
+    }
+    return CheckInputs(tx, state, view, true, flags, true, false, txdata);
+}
+
 static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx,
                               bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
                               bool bypass_limits, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
@@ -685,12 +810,17 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
             return error("%s: Consensus::CheckTxInputs: %s, %s", __func__, tx.GetHash().ToString(), FormatStateMessage(state));
         }
 
+        // The spent scripts are solved once for both input checks
+        std::vector<SpentScriptInfo> vSpent;
+        if (fRequireStandard)
+            SolveSpentScripts(tx, view, vSpent);
+
         // Check for non-standard pay-to-script-hash in inputs
-        if (fRequireStandard && !AreInputsStandard(tx, view))
+        if (fRequireStandard && !AreInputsStandard(tx, vSpent))
             return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
 
         // Check for non-standard witness in P2WSH
-        if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
+        if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view, vSpent))
             return state.DoS(0, false, REJECT_NONSTANDARD, "bad-witness-nonstandard", true);
 
         int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
@@ -900,7 +1030,7 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
+        if (!CheckInputsForMempool(tx, state, view, scriptVerifyFlags, txdata)) {
             // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
             // need to turn both off, and compare against just turning off CLEANSTACK
             // to see if the failure is specifically due to witness validation.
@@ -945,6 +1075,10 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
                     LogPrintf("Warning: -promiscuousmempool flags set to not include currently enforced soft forks, this may break mining or otherwise cause instability!\n");
                 }
             }
+        } else {
+            // Lets ConnectBlock skip these scripts even after their script
+            // execution cache entry has been pushed out
+            entry.SetScriptVerified(currentBlockScriptVerifyFlags);
         }
 
         // Remove conflicting transactions from the mempool
@@ -983,6 +1117,9 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
     return true;
 }
 
+static CMetricCounter* const metricMempoolAccepted = RegisterMetricCounter("bitcoin_mempool_accepted_total", "Transactions accepted to the mempool");
+static CMetricCounter* const metricMempoolRejected = RegisterMetricCounter("bitcoin_mempool_rejected_total", "Transactions rejected from the mempool");
+
 /** (try to) add transaction to memory pool with a specified acceptance time **/
 static bool AcceptToMemoryPoolWithTime(const CChainParams& chainparams, CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx,
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
@@ -990,6 +1127,13 @@ static bool AcceptToMemoryPoolWithTime(const CChainParams& chainparams, CTxMemPo
 {
     std::vector<COutPoint> coins_to_uncache;
     bool res = AcceptToMemoryPoolWorker(chainparams, pool, state, tx, pfMissingInputs, nAcceptTime, plTxnReplaced, bypass_limits, nAbsurdFee, coins_to_uncache);
+    if (res) {
+        TRACE1(mempool, accepted, tx->GetHash().begin());
+        metricMempoolAccepted->Add();
+    } else {
+        metricMempoolRejected->Add();
+        TRACE3(mempool, rejected, tx->GetHash().begin(), state.GetRejectCode(), state.GetRejectReason().c_str());
+    }
     if (!res) {
         for (const COutPoint& hashTx : coins_to_uncache)
             pcoinsTip->Uncache(hashTx);
@@ -1008,16 +1152,75 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return AcceptToMemoryPoolWithTime(chainparams, pool, state, tx, pfMissingInputs, GetTime(), plTxnReplaced, bypass_limits, nAbsurdFee);
 }
 
+bool AcceptPackageToMemoryPool(CTxMemPool& pool, CValidationState& state, const std::vector<CTransactionRef>& package,
+                               std::list<CTransactionRef>* plTxnReplaced)
+{
+    AssertLockHeld(cs_main);
+    const CChainParams& chainparams = Params();
+    if (package.empty() || package.size() > MAX_PACKAGE_COUNT)
+        return state.DoS(0, false, REJECT_NONSTANDARD, "package-bad-size");
+
+    // Work out the fee and size of the whole package, every transaction
+    // seeing the outputs of the ones before it
+    CAmount nPackageFees = 0;
+    int64_t nPackageSize = 0;
+    {
+        LOCK(pool.cs);
+        CCoinsViewMemPool viewMemPool(pcoinsTip.get(), pool);
+        CCoinsViewCache view(&viewMemPool);
+        for (const CTransactionRef& ptx : package) {
+            const CTransaction& tx = *ptx;
+            if (tx.IsCoinBase())
+                return state.DoS(0, false, REJECT_INVALID, "coinbase");
+            CAmount nValueIn = 0;
+            for (const CTxIn& txin : tx.vin) {
+                const Coin& coin = view.AccessCoin(txin.prevout);
+                if (coin.IsSpent())
+                    return state.DoS(0, false, REJECT_INVALID, "package-missing-inputs", false, tx.GetHash().ToString());
+                nValueIn += coin.out.nValue;
+                view.SpendCoin(txin.prevout);
+            }
+            CAmount nFees = nValueIn - tx.GetValueOut();
+            pool.ApplyDelta(tx.GetHash(), nFees);
+            nPackageFees += nFees;
+            nPackageSize += GetVirtualTransactionSize(tx);
+            AddCoins(view, tx, MEMPOOL_HEIGHT, true);
+        }
+    }
+
+    CAmount mempoolRejectFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nPackageSize);
+    CAmount minRelayFee = ::minRelayTxFee.GetFee(nPackageSize);
+    if (nPackageFees < std::max(mempoolRejectFee, minRelayFee)) {
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "package min fee not met", false,
+            strprintf("%d < %d", nPackageFees, std::max(mempoolRejectFee, minRelayFee)));
+    }
+
+    // The fee checks of the single transactions are replaced by the one above
+    for (size_t i = 0; i < package.size(); i++) {
+        if (!AcceptToMemoryPoolWithTime(chainparams, pool, state, package[i], nullptr /* pfMissingInputs */, GetTime(),
+                plTxnReplaced, true /* bypass_limits */, 0 /* nAbsurdFee */)) {
+            for (size_t j = 0; j < i; j++)
+                pool.removeRecursive(*package[j], MemPoolRemovalReason::UNKNOWN);
+            return false;
+        }
+    }
+
+    LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+    if (!pool.exists(package.back()->GetHash()))
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+    return true;
+}
+
 /**
  * Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock.
  * If blockIndex is provided, the transaction is fetched from the corresponding block.
  */
-bool GetTransaction(const uint256& hash, CTransactionRef& txOut, const Consensus::Params& consensusParams, uint256& hashBlock, bool fAllowSlow, CBlockIndex* blockIndex)
+bool GetTransaction(const uint256& hash, CTransactionRef& txOut, const Consensus::Params& consensusParams, uint256& hashBlock, bool fAllowSlow, const CBlockIndex* blockIndex)
 {
-    CBlockIndex* pindexSlow = blockIndex;
-
-    LOCK(cs_main);
+    const CBlockIndex* pindexSlow = blockIndex;
 
+    // The mempool and the transaction index have their own locks; only the
+    // coins and the block position need cs_main
     if (!blockIndex) {
         CTransactionRef ptx = mempool.get(hash);
         if (ptx) {
@@ -1025,31 +1228,17 @@ bool GetTransaction(const uint256& hash, CTransactionRef& txOut, const Consensus
             return true;
         }
 
-        if (fTxIndex) {
-            CDiskTxPos postx;
-            if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
-                CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (const std::exception& e) {
-                    return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-                }
-                hashBlock = header.GetHash();
-                if (txOut->GetHash() != hash)
-                    return error("%s: txid mismatch", __func__);
-                return true;
-            }
-
+        if (g_txindex) {
             // transaction not found in index, nothing more can be done
-            return false;
+            return g_txindex->FindTx(hash, hashBlock, txOut);
+        }
+
+        if (g_recenttxindex && g_recenttxindex->FindTx(hash, hashBlock, txOut)) {
+            return true;
         }
 
         if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
+            LOCK(cs_main);
             const Coin& coin = AccessByTxid(*pcoinsTip, hash);
             if (!coin.IsSpent()) pindexSlow = chainActive[coin.nHeight];
         }
@@ -1081,24 +1270,130 @@ bool GetTransaction(const uint256& hash, CTransactionRef& txOut, const Consensus
 // CBlock and CBlockIndex
 //
 
-static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+/** Serialize the index header and a block into a record, compressed with -blockcompression */
+static std::shared_ptr<std::vector<unsigned char>> MakeBlockRecord(const CBlock& block, const CMessageHeader::MessageStartChars& messageStart)
+{
+    std::shared_ptr<std::vector<unsigned char>> record = std::make_shared<std::vector<unsigned char>>();
+    unsigned int nSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    record->reserve(nSize + 8);
+    CVectorWriter writer(SER_DISK, CLIENT_VERSION, *record, 0);
+    writer << FLATDATA(messageStart) << nSize << block;
+    if (fBlockCompression)
+        CompressRecord(*record);
+    return record;
+}
+
+static bool WriteBlockToDisk(std::shared_ptr<std::vector<unsigned char>> record, CDiskBlockPos& pos)
+{
+    // Queue the record to be written at pos
+    CDiskBlockPos posRecord = pos;
+    pos.nPos += 8;
+    if (!g_blockfilewriter.Write(posRecord, false, std::move(record)))
+        return error("WriteBlockToDisk: writing the block at %s failed", posRecord.ToString());
+
+    return true;
+}
+
+/** Bytes of the checksum after the undo data of an undo record */
+static const unsigned int UNDO_CHECKSUM_SIZE = 32;
+
+/** The data of a block or undo record, if it is in memory */
+struct RecordData
+{
+    CBlockFileWriter::Record pending;
+    std::shared_ptr<const CMappedFile> mapping;
+    //! The decompressed data of a compressed record
+    std::vector<unsigned char> buffer;
+    CMessageHeader::MessageStartChars messageStart;
+    //! The data, or nullptr if it is read from the file
+    const unsigned char* data = nullptr;
+    //! Bytes of data, including the checksum of undo data
+    size_t size = 0;
+
+    CSpanReader Reader() const { return CSpanReader(SER_DISK, CLIENT_VERSION, data, size); }
+};
+
+/** Set the data of a record that is in memory, from the nSize bytes after its index header at p */
+static void SetRecordData(RecordData& record, const unsigned char* p, size_t nAvailable, uint32_t nSize, bool fUndo)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("WriteBlockToDisk: OpenBlockFile failed");
+    if (nSize & COMPRESSED_RECORD_FLAG) {
+        nSize &= ~COMPRESSED_RECORD_FLAG;
+        if (nSize > nAvailable || !DecompressRecord(p, nSize, record.buffer))
+            throw std::ios_base::failure("corrupt compressed record");
+        record.data = record.buffer.data();
+        record.size = record.buffer.size();
+    } else {
+        record.size = nSize + (fUndo ? UNDO_CHECKSUM_SIZE : 0);
+        if (record.size > nAvailable)
+            throw std::ios_base::failure("record extends past the end of the file");
+        record.data = p;
+    }
+}
 
-    // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, block);
-    fileout << FLATDATA(messageStart) << nSize;
+/**
+ * Locate the data of the block or undo record whose index header is at
+ * pos - 8: in the write queue, in the mapping of its file or in the file, and
+ * decompress it if it is compressed. Returns the file, positioned at the
+ * data, if it is to be read from there, and nullptr if the data is in memory.
+ * Throws std::ios_base::failure if the record cannot be read.
+ */
+static FILE* LocateRecord(const CDiskBlockPos& pos, bool fUndo, RecordData& record)
+{
+    if (pos.nPos < 8)
+        throw std::ios_base::failure("no index header in front of the record");
+    const CDiskBlockPos posHeader(pos.nFile, pos.nPos - 8);
+    uint32_t nSize;
+
+    record.pending = g_blockfilewriter.GetPending(posHeader, fUndo);
+    if (!record.pending && !fUndo)
+        record.mapping = g_blockfilemaps.Get(pos.nFile, GetBlockPosFilename(pos, "blk"));
+    if (record.pending || record.mapping) {
+        const unsigned char* begin = record.pending ? record.pending->data() : record.mapping->data();
+        const size_t nEnd = record.pending ? record.pending->size() : record.mapping->size();
+        const size_t nHeader = record.pending ? 0 : posHeader.nPos;
+        if (nHeader + 8 > nEnd)
+            throw std::ios_base::failure("position out of range of the mapped file");
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, begin + nHeader, 8);
+        reader >> FLATDATA(record.messageStart) >> nSize;
+        SetRecordData(record, begin + nHeader + 8, nEnd - nHeader - 8, nSize, fUndo);
+        return nullptr;
+    }
 
-    // Write block
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("WriteBlockToDisk: ftell failed");
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    CAutoFile file(fUndo ? OpenUndoFile(posHeader, true) : OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        throw std::ios_base::failure("unable to open the file");
+    file >> FLATDATA(record.messageStart) >> nSize;
+    if (!(nSize & COMPRESSED_RECORD_FLAG)) {
+        record.size = nSize + (fUndo ? UNDO_CHECKSUM_SIZE : 0);
+        return file.release();
+    }
+    const uint32_t nCompressedSize = nSize & ~COMPRESSED_RECORD_FLAG;
+    if (nCompressedSize > MAX_SIZE)
+        throw std::ios_base::failure("corrupt compressed record");
+    std::vector<unsigned char> compressed(nCompressedSize);
+    file.read((char*)compressed.data(), compressed.size());
+    SetRecordData(record, compressed.data(), compressed.size(), nSize, fUndo);
+    return nullptr;
+}
 
+bool ReadTxFromDisk(const CDiskTxPos& postx, CBlockHeader& header, CTransactionRef& tx)
+{
+    try {
+        RecordData record;
+        CAutoFile file(LocateRecord(postx, false, record), SER_DISK, CLIENT_VERSION);
+        if (record.data) {
+            CSpanReader reader = record.Reader();
+            reader >> header;
+            reader.ignore(postx.nTxOffset);
+            reader >> tx;
+        } else {
+            file >> header;
+            fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+            file >> tx;
+        }
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
     return true;
 }
 
@@ -1106,14 +1401,18 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
-
-    // Read block
+    // Read blocks that are still queued for writing from the queue, blocks in
+    // finalized files from their mapping if -blockmmap allows it, and
+    // compressed blocks from their decompressed data
     try {
-        filein >> block;
+        RecordData record;
+        CAutoFile filein(LocateRecord(pos, false, record), SER_DISK, CLIENT_VERSION);
+        if (record.data) {
+            CSpanReader reader = record.Reader();
+            UnserializeBlock(reader, block);
+        } else {
+            UnserializeBlock(filein, block);
+        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
@@ -1142,6 +1441,51 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    block.clear();
+    try {
+        RecordData record;
+        CAutoFile filein(LocateRecord(pos, false, record), SER_DISK, CLIENT_VERSION);
+        if (memcmp(record.messageStart, messageStart, CMessageHeader::MESSAGE_START_SIZE))
+            throw std::ios_base::failure("block magic mismatch");
+        if (record.size < 80 || record.size > MAX_SIZE)
+            throw std::ios_base::failure(strprintf("invalid block size %u", record.size));
+        // Compressed blocks are sent decompressed
+        if (record.data) {
+            block.assign(record.data, record.data + record.size);
+        } else {
+            block.resize(record.size);
+            filein.read((char*)block.data(), block.size());
+        }
+    }
+    catch (const std::exception& e) {
+        block.clear();
+        return error("%s: Read error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    CDiskBlockPos blockPos;
+    {
+        LOCK(cs_main);
+        blockPos = pindex->GetBlockPos();
+    }
+
+    if (!ReadRawBlockFromDisk(block, blockPos, messageStart))
+        return false;
+    // The header is the first 80 bytes of the serialized block
+    if (Hash(block.begin(), block.begin() + 80) != pindex->GetBlockHash()) {
+        block.clear();
+        return error("ReadRawBlockFromDisk(CBlockIndex*): GetHash() doesn't match index for %s at %s",
+                pindex->ToString(), blockPos.ToString());
+    }
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1194,9 +1538,8 @@ static void AlertNotify(const std::string& strMessage)
     std::string singleQuote("'");
     std::string safeStatus = SanitizeString(strMessage);
     safeStatus = singleQuote+safeStatus+singleQuote;
-    boost::replace_all(strCmd, "%s", safeStatus);
 
-    boost::thread t(runCommand, strCmd); // thread runs free
+    g_notifyqueue.Notify(strCmd, safeStatus);
 }
 
 static void CheckForkWarningConditions()
@@ -1337,16 +1680,35 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
 
 static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
 static uint256 scriptExecutionCacheNonce(GetRandHash());
+static std::atomic<size_t> nScriptCacheElements(0);
+static std::atomic<uint64_t> nScriptCacheHits(0);
+static std::atomic<uint64_t> nScriptCacheMisses(0);
+static std::atomic<uint64_t> nScriptCacheInserts(0);
+static std::atomic<uint64_t> nScriptCacheEvictions(0);
+static std::atomic<uint64_t> nScriptCacheMempoolHits(0);
 
 void InitScriptExecutionCache() {
     // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
     // setup_bytes creates the minimum possible cache (2 elements).
     size_t nMaxCacheSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
     size_t nElems = scriptExecutionCache.setup_bytes(nMaxCacheSize);
+    nScriptCacheElements = nElems;
     LogPrintf("Using %zu MiB out of %zu/2 requested for script execution cache, able to store %zu elements\n",
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+ScriptExecutionCacheStats GetScriptExecutionCacheStats()
+{
+    ScriptExecutionCacheStats stats;
+    stats.nMaxElements = nScriptCacheElements;
+    stats.nHits = nScriptCacheHits.load(std::memory_order_relaxed);
+    stats.nMisses = nScriptCacheMisses.load(std::memory_order_relaxed);
+    stats.nInserts = nScriptCacheInserts.load(std::memory_order_relaxed);
+    stats.nEvictions = nScriptCacheEvictions.load(std::memory_order_relaxed);
+    stats.nMempoolHits = nScriptCacheMempoolHits.load(std::memory_order_relaxed);
+    return stats;
+}
+
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set.
@@ -1390,8 +1752,10 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
             AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
             if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
+                nScriptCacheHits.fetch_add(1, std::memory_order_relaxed);
                 return true;
             }
+            nScriptCacheMisses.fetch_add(1, std::memory_order_relaxed);
 
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
@@ -1436,7 +1800,9 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             if (cacheFullScriptStore && !pvChecks) {
                 // We executed all of the provided scripts, and were told to
                 // cache the result. Do so now.
-                scriptExecutionCache.insert(hashCacheEntry);
+                nScriptCacheInserts.fetch_add(1, std::memory_order_relaxed);
+                if (!scriptExecutionCache.insert(hashCacheEntry))
+                    nScriptCacheEvictions.fetch_add(1, std::memory_order_relaxed);
             }
         }
     }
@@ -1446,64 +1812,86 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
 
 namespace {
 
-bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+/** Serialize the index header, the undo data and its checksum into a record, compressed with -blockcompression */
+std::shared_ptr<std::vector<unsigned char>> MakeUndoRecord(const CBlockUndo& blockundo, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
-    // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, blockundo);
-    fileout << FLATDATA(messageStart) << nSize;
-
-    // Write undo data
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("%s: ftell failed", __func__);
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    std::shared_ptr<std::vector<unsigned char>> record = std::make_shared<std::vector<unsigned char>>();
+    unsigned int nSize = ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION);
+    record->reserve(nSize + 8 + UNDO_CHECKSUM_SIZE);
+    CVectorWriter writer(SER_DISK, CLIENT_VERSION, *record, 0);
+    writer << FLATDATA(messageStart) << nSize << blockundo;
 
     // calculate & write checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
     hasher << hashBlock;
     hasher << blockundo;
-    fileout << hasher.GetHash();
+    writer << hasher.GetHash();
+
+    if (fBlockCompression)
+        CompressRecord(*record);
+    return record;
+}
+
+bool UndoWriteToDisk(std::shared_ptr<std::vector<unsigned char>> record, CDiskBlockPos& pos)
+{
+    // Queue the record to be written at pos
+    CDiskBlockPos posRecord = pos;
+    pos.nPos += 8;
+    if (!g_blockfilewriter.Write(posRecord, true, std::move(record)))
+        return error("%s: writing the undo data at %s failed", __func__, posRecord.ToString());
 
     return true;
 }
 
-static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
+/** Read undo data and the checksum after it. Returns whether the checksum matches. */
+template<typename Stream>
+static bool ReadUndo(Stream& s, CBlockUndo& blockundo, const uint256& hashBlock)
+{
+    uint256 hashChecksum;
+    CHashVerifier<Stream> verifier(&s); // We need a CHashVerifier as reserializing may lose data
+    verifier << hashBlock;
+    verifier >> blockundo;
+    s >> hashChecksum;
+    return hashChecksum == verifier.GetHash();
+}
+
+} // namespace
+
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
 {
-    CDiskBlockPos pos = pindex->GetUndoPos();
+    CDiskBlockPos pos;
+    {
+        LOCK(cs_main);
+        pos = pindex->GetUndoPos();
+    }
     if (pos.IsNull()) {
         return error("%s: no undo data available", __func__);
     }
 
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
-    // Read block
-    uint256 hashChecksum;
-    CHashVerifier<CAutoFile> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
+    bool fChecksumOk;
     try {
-        verifier << pindex->pprev->GetBlockHash();
-        verifier >> blockundo;
-        filein >> hashChecksum;
+        RecordData record;
+        CAutoFile filein(LocateRecord(pos, true, record), SER_DISK, CLIENT_VERSION);
+        if (record.data) {
+            CSpanReader reader = record.Reader();
+            fChecksumOk = ReadUndo(reader, blockundo, pindex->pprev->GetBlockHash());
+        } else {
+            fChecksumOk = ReadUndo(filein, blockundo, pindex->pprev->GetBlockHash());
+        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s", __func__, e.what());
     }
 
     // Verify checksum
-    if (hashChecksum != verifier.GetHash())
+    if (!fChecksumOk)
         return error("%s: Checksum mismatch", __func__);
 
     return true;
 }
 
+namespace {
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1562,13 +1950,18 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
  *  When FAILED is returned, view is left in an indeterminate state. */
 DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view)
 {
-    bool fClean = true;
-
     CBlockUndo blockUndo;
     if (!UndoReadFromDisk(blockUndo, pindex)) {
         error("DisconnectBlock(): failure reading undo data");
         return DISCONNECT_FAILED;
     }
+    return DisconnectBlock(block, blockUndo, pindex, view);
+}
+
+/** Like DisconnectBlock, with the undo data of the block already read. The coins are moved out of blockUndo. */
+DisconnectResult CChainState::DisconnectBlock(const CBlock& block, CBlockUndo& blockUndo, const CBlockIndex* pindex, CCoinsViewCache& view)
+{
+    bool fClean = true;
 
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size()) {
         error("DisconnectBlock(): block and undo data inconsistent");
@@ -1617,17 +2010,22 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
-void static FlushBlockFile(bool fFinalize = false)
+/** Write out the queued block and undo data, and commit the last block and undo files to disk unless !fSync */
+bool static FlushBlockFile(bool fFinalize = false, bool fSync = true)
 {
     LOCK(cs_LastBlockFile);
 
+    // The queue may hold data for any file, not just the last one
+    bool fOk = g_blockfilewriter.Flush();
+
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
         if (fFinalize)
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
-        FileCommit(fileOld);
+        if (fSync)
+            FileCommit(fileOld);
         fclose(fileOld);
     }
 
@@ -1635,9 +2033,11 @@ void static FlushBlockFile(bool fFinalize = false)
     if (fileOld) {
         if (fFinalize)
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
-        FileCommit(fileOld);
+        if (fSync)
+            FileCommit(fileOld);
         fclose(fileOld);
     }
+    return fOk;
 }
 
 static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
@@ -1647,9 +2047,10 @@ static bool WriteUndoDataForBlock(const CBlockUndo& blockundo, CValidationState&
     // Write undo information to disk
     if (pindex->GetUndoPos().IsNull()) {
         CDiskBlockPos _pos;
-        if (!FindUndoPos(state, pindex->nFile, _pos, ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40))
+        std::shared_ptr<std::vector<unsigned char>> record = MakeUndoRecord(blockundo, pindex->pprev->GetBlockHash(), chainparams.MessageStart());
+        if (!FindUndoPos(state, pindex->nFile, _pos, record->size()))
             return error("ConnectBlock(): FindUndoPos failed");
-        if (!UndoWriteToDisk(blockundo, _pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
+        if (!UndoWriteToDisk(std::move(record), _pos))
             return AbortNode(state, "Failed to write undo data");
 
         // update nUndoPos in block index
@@ -1661,33 +2062,159 @@ static bool WriteUndoDataForBlock(const CBlockUndo& blockundo, CValidationState&
     return true;
 }
 
-static bool WriteTxIndexDataForBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex)
+/** Record a connected block whose scripts have been verified: write its undo data. */
+static bool FinishConnectBlock(const CBlock& block, const CBlockUndo& blockundo, CValidationState& state, CBlockIndex* pindex, const CChainParams& chainparams)
 {
-    if (!fTxIndex) return true;
-
-    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
-    vPos.reserve(block.vtx.size());
-    for (const CTransactionRef& tx : block.vtx)
-    {
-        vPos.push_back(std::make_pair(tx->GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
-    }
+    if (!WriteUndoDataForBlock(blockundo, state, pindex, chainparams))
+        return false;
 
-    if (!pblocktree->WriteTxIndex(vPos)) {
-        return AbortNode(state, "Failed to write transaction index");
+    if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        setDirtyBlockIndex.insert(pindex);
     }
 
+    if (pcoinsstats)
+        pcoinsstats->ConnectBlock(block, blockundo, pindex);
     return true;
 }
 
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
 
+void SetScriptCheckWorkStealing(bool fWorkStealing) {
+    scriptcheckqueue.SetWorkStealing(fWorkStealing);
+}
+
 void ThreadScriptCheck() {
     RenameThread("bitcoin-scriptch");
+    if (fPinScriptCheckThreads) {
+        static std::atomic<int> nThreads(0);
+        const int nIndex = nThreads++;
+        if (!PinThread(nIndex)) {
+            LogPrintf("Failed to pin script checking thread %d to a CPU\n", nIndex);
+        }
+    }
     scriptcheckqueue.Thread();
 }
 
+/**
+ * Closure constructing a CTransaction from a deserialized CMutableTransaction,
+ * which computes its txid and wtxid.
+ */
+class CTxHashCheck
+{
+private:
+    CMutableTransaction* mtx;
+    CTransactionRef* ptx;
+
+public:
+    CTxHashCheck(): mtx(nullptr), ptx(nullptr) {}
+    CTxHashCheck(CMutableTransaction* mtxIn, CTransactionRef* ptxIn): mtx(mtxIn), ptx(ptxIn) {}
+
+    bool operator()() {
+        *ptx = MakeTransactionRef(std::move(*mtx));
+        return true;
+    }
+
+    void swap(CTxHashCheck& check) {
+        std::swap(mtx, check.mtx);
+        std::swap(ptx, check.ptx);
+    }
+};
+
+static CCheckQueue<CTxHashCheck> txhashcheckqueue(128);
+
+void ThreadTxHashCheck() {
+    RenameThread("bitcoin-txhash");
+    txhashcheckqueue.Thread();
+}
+
+static int64_t nTimeTxHash = 0;
+static int64_t nTxHashBlocks = 0;
+
+void BuildBlockTransactions(std::vector<CMutableTransaction>& mtxs, std::vector<CTransactionRef>& vtx)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    vtx.resize(mtxs.size());
+    if (nScriptCheckThreads) {
+        CCheckQueueControl<CTxHashCheck> control(&txhashcheckqueue);
+        std::vector<CTxHashCheck> vChecks;
+        vChecks.reserve(mtxs.size());
+        for (size_t i = 0; i < mtxs.size(); i++) {
+            vChecks.emplace_back(&mtxs[i], &vtx[i]);
+        }
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        for (size_t i = 0; i < mtxs.size(); i++) {
+            vtx[i] = MakeTransactionRef(std::move(mtxs[i]));
+        }
+    }
+    int64_t nTimeEnd = GetTimeMicros();
+    nTimeTxHash += nTimeEnd - nTimeStart;
+    nTxHashBlocks++;
+    LogPrint(BCLog::BENCH, "  - Hash %u transactions: %.2fms [%.2fs (%.2fms/blk)]\n", (unsigned)vtx.size(), MILLI * (nTimeEnd - nTimeStart), nTimeTxHash * MICRO, nTimeTxHash * MILLI / nTxHashBlocks);
+}
+
+/**
+ * Closure fetching a coin into pcoinsprefetch.
+ */
+class CCoinsPrefetchCheck
+{
+private:
+    COutPoint outpoint;
+
+public:
+    CCoinsPrefetchCheck() {}
+    explicit CCoinsPrefetchCheck(const COutPoint& outpointIn): outpoint(outpointIn) {}
+
+    bool operator()() {
+        pcoinsprefetch->Fetch(outpoint);
+        return true;
+    }
+
+    void swap(CCoinsPrefetchCheck& check) {
+        std::swap(outpoint, check.outpoint);
+    }
+};
+
+static CCheckQueue<CCoinsPrefetchCheck> prefetchcheckqueue(16);
+
+void ThreadPrefetchCheck() {
+    RenameThread("bitcoin-prefetch");
+    prefetchcheckqueue.Thread();
+}
+
+static int64_t nTimePrefetch = 0;
+static int64_t nPrefetchBlocks = 0;
+
+void PrefetchBlockInputs(const CBlock& block)
+{
+    if (!nPrefetchThreads || !pcoinsprefetch)
+        return;
+    int64_t nTimeStart = GetTimeMicros();
+    // Inputs spending outputs of the block itself are never in the database.
+    std::set<uint256> setBlockTxids;
+    for (const auto& tx : block.vtx) {
+        setBlockTxids.insert(tx->GetHash());
+    }
+    std::vector<CCoinsPrefetchCheck> vChecks;
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        for (const CTxIn& txin : block.vtx[i]->vin) {
+            if (!setBlockTxids.count(txin.prevout.hash)) {
+                vChecks.emplace_back(txin.prevout);
+            }
+        }
+    }
+    size_t nInputs = vChecks.size();
+    CCheckQueueControl<CCoinsPrefetchCheck> control(&prefetchcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+    int64_t nTimeEnd = GetTimeMicros();
+    nTimePrefetch += nTimeEnd - nTimeStart;
+    nPrefetchBlocks++;
+    LogPrint(BCLog::BENCH, "  - Prefetch %u inputs: %.2fms [%.2fs (%.2fms/blk)]\n", (unsigned)nInputs, MILLI * (nTimeEnd - nTimeStart), nTimePrefetch * MICRO, nTimePrefetch * MILLI / nPrefetchBlocks);
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1776,13 +2303,25 @@ static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
+
+static const char* const CONNECT_BLOCK_METRIC = "bitcoin_connect_block_duration_seconds";
+static const char* const CONNECT_BLOCK_METRIC_HELP = "Time ConnectBlock spent in each phase of connecting a block serially";
+static CMetricHistogram* const metricConnectBlockSanity = RegisterMetricHistogram(CONNECT_BLOCK_METRIC, CONNECT_BLOCK_METRIC_HELP, "phase=\"sanity\"");
+static CMetricHistogram* const metricConnectBlockForks = RegisterMetricHistogram(CONNECT_BLOCK_METRIC, CONNECT_BLOCK_METRIC_HELP, "phase=\"forks\"");
+static CMetricHistogram* const metricConnectBlockConnect = RegisterMetricHistogram(CONNECT_BLOCK_METRIC, CONNECT_BLOCK_METRIC_HELP, "phase=\"connect\"");
+static CMetricHistogram* const metricConnectBlockVerify = RegisterMetricHistogram(CONNECT_BLOCK_METRIC, CONNECT_BLOCK_METRIC_HELP, "phase=\"verify\"");
+static CMetricHistogram* const metricConnectBlockIndex = RegisterMetricHistogram(CONNECT_BLOCK_METRIC, CONNECT_BLOCK_METRIC_HELP, "phase=\"index\"");
 static int64_t nBlocksTotal = 0;
+static uint64_t nScriptTxTotal = 0;
+static uint64_t nScriptTxSkipped = 0;
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons).
+ *  If pending is given, the script checks are queued on pending->control and
+ *  left running; the caller must wait for them and call FinishConnectBlock. */
 bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, PendingBlockConnect* pending)
 {
     AssertLockHeld(cs_main);
     assert(pindex);
@@ -1815,8 +2354,11 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     // Special case for the genesis block, skipping connection of its transactions
     // (its coinbase is unspendable)
     if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
-        if (!fJustCheck)
+        if (!fJustCheck) {
             view.SetBestBlock(pindex->GetBlockHash());
+            if (pcoinsstats)
+                pcoinsstats->ConnectBlock(block, CBlockUndo(), pindex);
+        }
         return true;
     }
 
@@ -1901,17 +2443,26 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint(BCLog::BENCH, "    - Fork checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime2 - nTime1), nTimeForks * MICRO, nTimeForks * MILLI / nBlocksTotal);
 
-    CBlockUndo blockundo;
+    // Load the inputs which are not cached yet with one batched lookup through
+    // the views below, rather than one database read per input.
+    view.FetchInputs(block);
+
+    CBlockUndo blockundoLocal;
+    CBlockUndo& blockundo = pending ? pending->blockundo : blockundoLocal;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    CCheckQueueControl<CScriptCheck> controlLocal(!pending && fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    CCheckQueueControl<CScriptCheck>& control = pending ? *pending->control : controlLocal;
 
     std::vector<int> prevheights;
     CAmount nFees = 0;
     int nInputs = 0;
+    unsigned int nMempoolScriptHits = 0;
+    const uint64_t nCacheHitsBefore = nScriptCacheHits.load(std::memory_order_relaxed);
     int64_t nSigOpsCost = 0;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
-    std::vector<PrecomputedTransactionData> txdata;
-    txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+    // A deque, so that pointers to individual PrecomputedTransactionData don't get invalidated
+    std::deque<PrecomputedTransactionData> txdataLocal;
+    std::deque<PrecomputedTransactionData>& txdata = pending ? pending->txdata : txdataLocal;
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = *(block.vtx[i]);
@@ -1958,7 +2509,14 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         {
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : nullptr))
+            // Scripts the mempool verified under this block's flags need not
+            // run again, whether or not the script execution cache kept them
+            bool fTxScriptChecks = fScriptChecks;
+            if (fScriptChecks && mempool.IsScriptVerified(tx, flags)) {
+                fTxScriptChecks = false;
+                nMempoolScriptHits++;
+            }
+            if (!CheckInputs(tx, state, view, fTxScriptChecks, flags, fCacheResults, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : nullptr))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
             control.Add(vChecks);
@@ -1972,6 +2530,13 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     }
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
     LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs (%.2fms/blk)]\n", (unsigned)block.vtx.size(), MILLI * (nTime3 - nTime2), MILLI * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : MILLI * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * MICRO, nTimeConnect * MILLI / nBlocksTotal);
+    if (fScriptChecks) {
+        unsigned int nCacheHits = nScriptCacheHits.load(std::memory_order_relaxed) - nCacheHitsBefore;
+        nScriptCacheMempoolHits.fetch_add(nMempoolScriptHits, std::memory_order_relaxed);
+        nScriptTxTotal += block.vtx.size() - 1;
+        nScriptTxSkipped += nCacheHits + nMempoolScriptHits;
+        LogPrint(BCLog::BENCH, "      - Script checks skipped: %u/%u txs (%u cached, %u verified in mempool) [%.1f%%]\n", nCacheHits + nMempoolScriptHits, (unsigned)block.vtx.size() - 1, nCacheHits, nMempoolScriptHits, nScriptTxTotal ? 100.0 * nScriptTxSkipped / nScriptTxTotal : 0.0);
+    }
 
     CAmount blockReward = nFees + GetBlockSubsidy(pindex->nHeight, chainparams.GetConsensus());
     if (block.vtx[0]->GetValueOut() > blockReward)
@@ -1980,6 +2545,14 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
                                block.vtx[0]->GetValueOut(), blockReward),
                                REJECT_INVALID, "bad-cb-amount");
 
+    if (pending) {
+        // The caller waits for the script checks and then finishes the block
+        // with FinishConnectBlock; the next block is connected on top of view.
+        assert(!fJustCheck && pindex->phashBlock);
+        view.SetBestBlock(pindex->GetBlockHash());
+        return true;
+    }
+
     if (!control.Wait())
         return state.DoS(100, error("%s: CheckQueue failed", __func__), REJECT_INVALID, "block-validation-failed");
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
@@ -1988,15 +2561,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     if (fJustCheck)
         return true;
 
-    if (!WriteUndoDataForBlock(blockundo, state, pindex, chainparams))
-        return false;
-
-    if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
-        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
-        setDirtyBlockIndex.insert(pindex);
-    }
-
-    if (!WriteTxIndexDataForBlock(block, state, pindex))
+    if (!FinishConnectBlock(block, blockundo, state, pindex, chainparams))
         return false;
 
     assert(pindex->phashBlock);
@@ -2009,17 +2574,63 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
     LogPrint(BCLog::BENCH, "    - Callbacks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime6 - nTime5), nTimeCallbacks * MICRO, nTimeCallbacks * MILLI / nBlocksTotal);
 
+    TRACE8(validation, connect_block, pindex->phashBlock->begin(), pindex->nHeight, nInputs,
+           nTime1 - nTimeStart, // sanity checks
+           nTime2 - nTime1,     // fork checks
+           nTime3 - nTime2,     // connecting the transactions
+           nTime4 - nTime3,     // waiting for the script checks
+           nTime5 - nTime4);    // writing the undo data and index
+    metricConnectBlockSanity->Observe(nTime1 - nTimeStart);
+    metricConnectBlockForks->Observe(nTime2 - nTime1);
+    metricConnectBlockConnect->Observe(nTime3 - nTime2);
+    metricConnectBlockVerify->Observe(nTime4 - nTime3);
+    metricConnectBlockIndex->Observe(nTime5 - nTime4);
     return true;
 }
 
+static CMetricGauge* const metricMempoolTransactions = RegisterMetricGauge("bitcoin_mempool_transactions", "Transactions in the mempool");
+static CMetricGauge* const metricMempoolBytes = RegisterMetricGauge("bitcoin_mempool_bytes", "Virtual size of the transactions in the mempool");
+static CMetricGauge* const metricMempoolUsage = RegisterMetricGauge("bitcoin_mempool_usage_bytes", "Memory used by the mempool");
+static CMetricGauge* const metricCoinsCacheUsage = RegisterMetricGauge("bitcoin_coins_cache_usage_bytes", "Memory used by the UTXO cache");
+static CMetricGauge* const metricCoinsCacheCoins = RegisterMetricGauge("bitcoin_coins_cache_coins", "Coins held by the UTXO cache");
+static CMetricHistogram* const metricCoinsFlush = RegisterMetricHistogram("bitcoin_coins_flush_duration_seconds", "Time taken to write the UTXO cache to the chainstate database");
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
  * if they're too large, if it's been a while since the last write,
  * or always and in all cases if we're in prune mode and are deleting files.
  */
+/**
+ * The unused mempool space the coins cache may use on top of nCoinCacheUsage.
+ * During initial block download this is all of it. After, with
+ * -dbcachereclaim, what the mempool has started using is taken back over
+ * COINS_CACHE_RECLAIM_TIME rather than all at once, so that the coins cache
+ * shrinks without having to be flushed in one go.
+ */
+static int64_t GetCoinsCacheLoan(int64_t nMempoolSizeMax, int64_t nMempoolUsage, int64_t nNow)
+{
+    AssertLockHeld(cs_main);
+    static int64_t nLoan = 0;
+    static int64_t nLastReclaim = 0;
+    const int64_t nUnused = std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
+    if (!fCoinsCacheReclaim || IsInitialBlockDownload() || nUnused >= nLoan) {
+        nLoan = nUnused;
+    } else {
+        const int64_t nReclaim = nMempoolSizeMax * (nNow - nLastReclaim) / (COINS_CACHE_RECLAIM_TIME * 1000000);
+        nLoan = std::max(nUnused, nLoan - nReclaim);
+    }
+    nLastReclaim = nNow;
+    return nLoan;
+}
+
 bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &state, FlushStateMode mode, int nManualPruneHeight) {
     int64_t nMempoolUsage = mempool.DynamicMemoryUsage();
+    // Called after every block and transaction accepted, so this keeps the
+    // mempool metrics current without taking the mempool lock to scrape them
+    metricMempoolUsage->Set(nMempoolUsage);
+    metricMempoolTransactions->Set(mempool.size());
+    metricMempoolBytes->Set(mempool.GetTotalTxSize());
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
     static int64_t nLastFlush = 0;
@@ -2057,9 +2668,38 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
         if (nLastSetChain == 0) {
             nLastSetChain = nNow;
         }
+        // With -ibdsyncinterval, initial block download only makes its
+        // writes durable every so many blocks, at a sync checkpoint
+        const int nHeight = chainActive.Height();
+        bool fDeferSync = nIBDSyncInterval > 0 && mode != FLUSH_STATE_ALWAYS && IsInitialBlockDownload();
+        bool fSyncCheckpoint = false;
+        if (fDeferSync) {
+            if (nSyncCheckpointHeight < 0) {
+                // Everything the chainstate holds so far must be durable first
+                if (!pcoinsdbview->Sync())
+                    return AbortNode(state, "Failed to write to coin database");
+                BlockMap::iterator it = mapBlockIndex.find(pcoinsdbview->GetBestBlock());
+                nSyncCheckpointHeight = it != mapBlockIndex.end() ? it->second->nHeight : 0;
+                if (!pblocktree->WriteSyncCheckpoint(nSyncCheckpointHeight))
+                    return AbortNode(state, "Failed to write to block index database");
+            }
+            if (nHeight >= nSyncCheckpointHeight + nIBDSyncInterval) {
+                fSyncCheckpoint = true;
+                fDeferSync = false;
+            }
+        }
         int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
         int64_t cacheSize = pcoinsTip->DynamicMemoryUsage();
-        int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
+        metricCoinsCacheUsage->Set(cacheSize);
+        metricCoinsCacheCoins->Set(pcoinsTip->GetCacheSize());
+        int64_t nTotalSpace = nCoinCacheUsage + GetCoinsCacheLoan(nMempoolSizeMax, nMempoolUsage, nNow);
+        if (fCoinsCacheReclaim && mode != FLUSH_STATE_ALWAYS && cacheSize > (9 * nTotalSpace) / 10 && !IsInitialBlockDownload()) {
+            // Make room by evicting unmodified coins, which needs no writes,
+            // before resorting to a flush
+            size_t nEvicted = pcoinsTip->Trim((8 * nTotalSpace) / 10);
+            cacheSize = pcoinsTip->DynamicMemoryUsage();
+            LogPrint(BCLog::COINDB, "Evicted %u coins for the mempool, %u remain cached (%.1f MiB)\n", nEvicted, pcoinsTip->GetCacheSize(), cacheSize * (1.0 / 1048576.0));
+        }
         // The cache is large and we're within 10% and 10 MiB of the limit, but we have time now (not in the middle of a block processing).
         bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
         // The cache is over the limit, we have to write now.
@@ -2069,14 +2709,15 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
         // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
         bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
         // Combine all conditions that result in a full cache flush.
-        fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
+        fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune || fSyncCheckpoint;
         // Write blocks and block index to disk.
         if (fDoFullFlush || fPeriodicWrite) {
             // Depend on nMinDiskSpace to ensure we can write block index
             if (!CheckDiskSpace(0))
                 return state.Error("out of disk space");
             // First make sure all block and undo data is flushed to disk.
-            FlushBlockFile();
+            if (!FlushBlockFile(false, !fDeferSync))
+                return AbortNode(state, "Failed to write block or undo data");
             // Then update all block file information (which may refer to block and undo files).
             {
                 std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
@@ -2091,13 +2732,13 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
                     vBlocks.push_back(*it);
                     setDirtyBlockIndex.erase(it++);
                 }
-                if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
+                if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks, !fDeferSync)) {
                     return AbortNode(state, "Failed to write to block index database");
                 }
             }
-            // Finally remove any pruned files
+            // Finally remove any pruned files, which nothing refers to any more
             if (fFlushForPrune)
-                UnlinkPrunedFiles(setFilesToPrune);
+                g_blockfileunlinker.Unlink(setFilesToPrune);
             nLastWrite = nNow;
         }
         // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -2110,10 +2751,43 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            int64_t nFlushStart = GetTimeMicros();
+            size_t nFlushCoins = pcoinsTip->GetCacheSize();
+            size_t nFlushMemory = pcoinsTip->DynamicMemoryUsage();
+            if (fPartialCoinsFlush && mode != FLUSH_STATE_ALWAYS) {
+                // Write the modified coins but keep the cache warm, evicting
+                // only the oldest unmodified coins to get well below the limit.
+                if (!pcoinsTip->Sync())
+                    return AbortNode(state, "Failed to write to coin database");
+                size_t nEvicted = pcoinsTip->Trim((8 * nTotalSpace) / 10);
+                LogPrint(BCLog::COINDB, "Evicted %u coins, %u remain cached (%.1f MiB)\n", nEvicted, pcoinsTip->GetCacheSize(), pcoinsTip->DynamicMemoryUsage() * (1.0 / 1048576.0));
+            } else if (!pcoinsTip->Flush()) {
                 return AbortNode(state, "Failed to write to coin database");
+            }
+            int64_t nFlushTime = GetTimeMicros() - nFlushStart;
+            LogPrint(BCLog::COINDB, "Flushed %u coins (%.1f MiB) in %.2fms\n", nFlushCoins, nFlushMemory * (1.0 / 1048576.0), nFlushTime * MILLI);
+            TRACE5(utxocache, flush, nFlushTime, (int)mode, nFlushCoins, nFlushMemory, fPartialCoinsFlush && mode != FLUSH_STATE_ALWAYS);
+            metricCoinsFlush->Observe(nFlushTime);
+            metricCoinsCacheUsage->Set(pcoinsTip->DynamicMemoryUsage());
+            metricCoinsCacheCoins->Set(pcoinsTip->GetCacheSize());
             nLastFlush = nNow;
         }
+        // Once everything written is durable, move the sync checkpoint up,
+        // or drop it when initial block download no longer defers syncs
+        if (nSyncCheckpointHeight >= 0 && !fDeferSync && (fDoFullFlush || fPeriodicWrite)) {
+            if (!pcoinsdbview->Sync())
+                return AbortNode(state, "Failed to write to coin database");
+            if (fSyncCheckpoint) {
+                if (!pblocktree->WriteSyncCheckpoint(nHeight))
+                    return AbortNode(state, "Failed to write to block index database");
+                LogPrint(BCLog::COINDB, "Sync checkpoint at height %d\n", nHeight);
+                nSyncCheckpointHeight = nHeight;
+            } else {
+                if (!pblocktree->EraseSyncCheckpoint())
+                    return AbortNode(state, "Failed to write to block index database");
+                nSyncCheckpointHeight = -1;
+            }
+        }
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
         // Update best block in wallet (so we can detect restored wallets).
@@ -2149,10 +2823,49 @@ static void DoWarning(const std::string& strWarning)
     }
 }
 
+/** Publish the current chainActive for GetChainSnapshot. */
+static void PublishChainSnapshot()
+{
+    AssertLockHeld(cs_main);
+    // Count the rewind before the shorter chain can be seen
+    const CBlockIndex* pindexOld = g_chain_snapshot->Tip();
+    if (pindexOld && chainActive[pindexOld->nHeight] != pindexOld)
+        g_chain_rewind_count++;
+    std::atomic_store(&g_chain_snapshot, std::make_shared<const CChainSnapshot>(chainActive.Tip()));
+    g_chain_snapshot_height = chainActive.Height();
+}
+
+std::shared_ptr<const CChainSnapshot> GetChainSnapshot()
+{
+    return std::atomic_load(&g_chain_snapshot);
+}
+
+int GetChainSnapshotHeight()
+{
+    return g_chain_snapshot_height;
+}
+
+uint64_t GetChainRewindCount()
+{
+    return g_chain_rewind_count;
+}
+
+const CBlockIndex* LookupBlockIndexNoLock(const uint256& hash)
+{
+    std::lock_guard<std::mutex> lock(g_block_index_lookup_mutex);
+    BlockMap::const_iterator it = mapBlockIndex.find(hash);
+    return it == mapBlockIndex.end() ? nullptr : it->second;
+}
+
 /** Check warning conditions and do some notifications on new chain tip set. */
+/** Time in milliseconds of the last UpdateTip, to keep compaction out of the way of block connection */
+static std::atomic<int64_t> nTimeLastTipUpdate{0};
+
 void static UpdateTip(const CBlockIndex *pindexNew, const CChainParams& chainParams) {
     // New best block
+    PublishChainSnapshot();
     mempool.AddTransactionsUpdated(1);
+    nTimeLastTipUpdate = GetTimeMillis();
 
     {
         WaitableLock lock(csBestBlock);
@@ -2227,12 +2940,19 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
     // Apply the block atomically to the chain state.
     int64_t nStart = GetTimeMicros();
     {
-        CCoinsViewCache view(pcoinsTip.get());
-        assert(view.GetBestBlock() == pindexDelete->GetBlockHash());
-        if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK)
+        CCoinsViewCacheJournal journal(*pcoinsTip);
+        assert(pcoinsTip->GetBestBlock() == pindexDelete->GetBlockHash());
+        if (DisconnectBlock(block, pindexDelete, *pcoinsTip) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
-        bool flushed = view.Flush();
-        assert(flushed);
+        journal.Commit();
+    }
+    if (pcoinsstats) {
+        CBlockUndo blockUndo;
+        if (UndoReadFromDisk(blockUndo, pindexDelete)) {
+            pcoinsstats->DisconnectBlock(block, blockUndo, pindexDelete);
+        } else {
+            pcoinsstats->hashBlock.SetNull();
+        }
     }
     LogPrint(BCLog::BENCH, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * MILLI);
     // Write the chain state to disk, if necessary.
@@ -2261,11 +2981,163 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
     return true;
 }
 
+/** A block disconnected by DisconnectTips, and its undo data */
+struct ReorgBlock {
+    CBlockIndex* pindex;
+    std::shared_ptr<CBlock> pblock;
+    CBlockUndo blockUndo;
+    //! A copy of the undo data for pcoinsstats, as DisconnectBlock consumes blockUndo
+    CBlockUndo blockUndoStats;
+    bool fRead;
+
+    explicit ReorgBlock(CBlockIndex* pindexIn) : pindex(pindexIn), pblock(std::make_shared<CBlock>()), fRead(false) {}
+};
+
+/** Closure reading a block and its undo data from disk for DisconnectTips */
+class CReorgReadCheck
+{
+private:
+    ReorgBlock* preorg;
+    const Consensus::Params* pparams;
+
+public:
+    CReorgReadCheck(): preorg(nullptr), pparams(nullptr) {}
+    CReorgReadCheck(ReorgBlock* preorgIn, const Consensus::Params* pparamsIn): preorg(preorgIn), pparams(pparamsIn) {}
+
+    bool operator()() {
+        preorg->fRead = ReadBlockFromDisk(*preorg->pblock, preorg->pindex, *pparams) && UndoReadFromDisk(preorg->blockUndo, preorg->pindex);
+        return true;
+    }
+
+    void swap(CReorgReadCheck& check) {
+        std::swap(preorg, check.preorg);
+        std::swap(pparams, check.pparams);
+    }
+};
+
+static CCheckQueue<CReorgReadCheck> reorgreadcheckqueue(1);
+
+void ThreadReorgReadCheck() {
+    RenameThread("bitcoin-reorgread");
+    reorgreadcheckqueue.Thread();
+}
+
+/** Most blocks DisconnectTips reads and disconnects at once */
+static const size_t DISCONNECT_BATCH_BLOCKS = 32;
+
+/**
+ * Disconnect blocks from chainActive's tip down to pindexFork, up to
+ * DISCONNECT_BATCH_BLOCKS of them, as as many DisconnectTip calls would.
+ * Their blocks and undo data are read at once on the -parreorg threads, and
+ * they are disconnected into a single cache layer, which is flushed into
+ * pcoinsTip once. Nothing changes unless all of them disconnect cleanly. If
+ * one of them cannot be read, fRetrySerially is set instead, so that
+ * DisconnectTip reports it.
+ */
+bool CChainState::DisconnectTips(CValidationState& state, const CChainParams& chainparams, const CBlockIndex* pindexFork, DisconnectedBlockTransactions& disconnectpool, int& nDisconnected, bool& fRetrySerially)
+{
+    AssertLockHeld(cs_main);
+    nDisconnected = 0;
+    fRetrySerially = false;
+
+    std::vector<ReorgBlock> vBlocks;
+    for (CBlockIndex* pindex = chainActive.Tip(); pindex != pindexFork && pindex->pprev && vBlocks.size() < DISCONNECT_BATCH_BLOCKS; pindex = pindex->pprev) {
+        vBlocks.emplace_back(pindex);
+    }
+    if (vBlocks.empty()) {
+        fRetrySerially = true;
+        return true;
+    }
+
+    int64_t nStart = GetTimeMicros();
+    std::vector<CReorgReadCheck> vChecks;
+    vChecks.reserve(vBlocks.size());
+    for (ReorgBlock& reorg : vBlocks) {
+        vChecks.emplace_back(&reorg, &chainparams.GetConsensus());
+    }
+    if (nScriptCheckThreads == 0) {
+        for (CReorgReadCheck& check : vChecks) {
+            check();
+        }
+    } else {
+        CCheckQueueControl<CReorgReadCheck> control(&reorgreadcheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+    for (const ReorgBlock& reorg : vBlocks) {
+        if (!reorg.fRead) {
+            fRetrySerially = true;
+            return true;
+        }
+    }
+    int64_t nRead = GetTimeMicros();
+
+    // Apply the blocks atomically to the chain state.
+    {
+        CCoinsViewCacheJournal journal(*pcoinsTip);
+        assert(pcoinsTip->GetBestBlock() == vBlocks.front().pindex->GetBlockHash());
+        for (ReorgBlock& reorg : vBlocks) {
+            if (pcoinsstats) {
+                reorg.blockUndoStats = reorg.blockUndo;
+            }
+            if (DisconnectBlock(*reorg.pblock, reorg.blockUndo, reorg.pindex, *pcoinsTip) != DISCONNECT_OK)
+                return error("DisconnectTips(): DisconnectBlock %s failed", reorg.pindex->GetBlockHash().ToString());
+        }
+        journal.Commit();
+    }
+    LogPrint(BCLog::BENCH, "- Disconnect %u blocks: %.2fms (read %.2fms)\n", vBlocks.size(), (GetTimeMicros() - nStart) * MILLI, (nRead - nStart) * MILLI);
+
+    for (ReorgBlock& reorg : vBlocks) {
+        const CBlock& block = *reorg.pblock;
+        if (pcoinsstats) {
+            pcoinsstats->DisconnectBlock(block, reorg.blockUndoStats, reorg.pindex);
+        }
+
+        // Save transactions to re-add to mempool at end of reorg
+        for (auto it = block.vtx.rbegin(); it != block.vtx.rend(); ++it) {
+            disconnectpool.addTransaction(*it);
+        }
+        while (disconnectpool.DynamicMemoryUsage() > MAX_DISCONNECTED_TX_POOL_SIZE * 1000) {
+            // Drop the earliest entry, and remove its children from the mempool.
+            auto it = disconnectpool.queuedTx.get<insertion_order>().begin();
+            mempool.removeRecursive(**it, MemPoolRemovalReason::REORG);
+            disconnectpool.removeEntry(it);
+        }
+
+        chainActive.SetTip(reorg.pindex->pprev);
+        UpdateTip(reorg.pindex->pprev, chainparams);
+        GetMainSignals().BlockDisconnected(reorg.pblock);
+        nDisconnected++;
+    }
+
+    // Write the chain state to disk, if necessary.
+    return FlushStateToDisk(chainparams, state, FLUSH_STATE_IF_NEEDED);
+}
+
 static int64_t nTimeReadFromDisk = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
 static int64_t nTimePostConnect = 0;
+static int64_t nTimeRemoveForBlock = 0;
+
+static const char* const CONNECT_TIP_METRIC = "bitcoin_connect_tip_duration_seconds";
+static const char* const CONNECT_TIP_METRIC_HELP = "Time spent in each phase of connecting one or more blocks to the tip";
+static CMetricHistogram* const metricConnectTipLoad = RegisterMetricHistogram(CONNECT_TIP_METRIC, CONNECT_TIP_METRIC_HELP, "phase=\"load\"");
+static CMetricHistogram* const metricConnectTipConnect = RegisterMetricHistogram(CONNECT_TIP_METRIC, CONNECT_TIP_METRIC_HELP, "phase=\"connect\"");
+static CMetricHistogram* const metricConnectTipFlush = RegisterMetricHistogram(CONNECT_TIP_METRIC, CONNECT_TIP_METRIC_HELP, "phase=\"flush\"");
+static CMetricHistogram* const metricConnectTipChainState = RegisterMetricHistogram(CONNECT_TIP_METRIC, CONNECT_TIP_METRIC_HELP, "phase=\"chainstate\"");
+static CMetricHistogram* const metricConnectTipPostProcess = RegisterMetricHistogram(CONNECT_TIP_METRIC, CONNECT_TIP_METRIC_HELP, "phase=\"postprocess\"");
+
+/** Record the phases of connecting one or more blocks to the tip */
+static void ObserveConnectTip(int64_t nTime1, int64_t nTime2, int64_t nTime3, int64_t nTime4, int64_t nTime5, int64_t nTime6)
+{
+    metricConnectTipLoad->Observe(nTime2 - nTime1);
+    metricConnectTipConnect->Observe(nTime3 - nTime2);
+    metricConnectTipFlush->Observe(nTime4 - nTime3);
+    metricConnectTipChainState->Observe(nTime5 - nTime4);
+    metricConnectTipPostProcess->Observe(nTime6 - nTime5);
+}
 
 struct PerBlockConnectTrace {
     CBlockIndex* pindex = nullptr;
@@ -2332,6 +3204,15 @@ public:
     }
 };
 
+/** Log how many coins requested since the given counts were served by pcoinsprefetch. */
+static void LogPrefetchStats(uint64_t nHitsBefore, uint64_t nMissesBefore)
+{
+    uint64_t nHits, nMisses;
+    pcoinsprefetch->GetStats(nHits, nMisses);
+    uint64_t nBlockHits = nHits - nHitsBefore, nBlockLookups = nBlockHits + nMisses - nMissesBefore;
+    LogPrint(BCLog::BENCH, "  - Prefetch hits: %u/%u (%.1f%%) [%.1f%%]\n", nBlockHits, nBlockLookups, nBlockLookups ? 100.0 * nBlockHits / nBlockLookups : 0.0, nHits + nMisses ? 100.0 * nHits / (nHits + nMisses) : 0.0);
+}
+
 /**
  * Connect a new block to chainActive. pblock is either nullptr or a pointer to a CBlock
  * corresponding to pindexNew, to bypass loading it again from disk.
@@ -2348,6 +3229,7 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
         std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
         if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus()))
             return AbortNode(state, "Failed to read block");
+        PrefetchBlockInputs(*pblockNew);
         pthisBlock = pblockNew;
     } else {
         pthisBlock = pblock;
@@ -2358,8 +3240,14 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
     {
-        CCoinsViewCache view(pcoinsTip.get());
-        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
+        // Connect to pcoinsTip itself, undoing the changes if the block turns out invalid
+        CCoinsViewCacheJournal journal(*pcoinsTip);
+        uint64_t nPrefetchHits = 0, nPrefetchMisses = 0;
+        if (pcoinsprefetch)
+            pcoinsprefetch->GetStats(nPrefetchHits, nPrefetchMisses);
+        bool rv = ConnectBlock(blockConnecting, state, pindexNew, *pcoinsTip, chainparams);
+        if (pcoinsprefetch)
+            LogPrefetchStats(nPrefetchHits, nPrefetchMisses);
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2368,8 +3256,7 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
         }
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint(BCLog::BENCH, "  - Connect total: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime3 - nTime2) * MILLI, nTimeConnectTotal * MICRO, nTimeConnectTotal * MILLI / nBlocksTotal);
-        bool flushed = view.Flush();
-        assert(flushed);
+        journal.Commit();
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint(BCLog::BENCH, "  - Flush: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime4 - nTime3) * MILLI, nTimeFlush * MICRO, nTimeFlush * MILLI / nBlocksTotal);
@@ -2381,6 +3268,8 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     // Remove conflicting transactions from the mempool.;
     mempool.removeForBlock(blockConnecting.vtx, pindexNew->nHeight);
     disconnectpool.removeForBlock(blockConnecting.vtx);
+    int64_t nTimeRemove = GetTimeMicros() - nTime5; nTimeRemoveForBlock += nTimeRemove;
+    LogPrint(BCLog::BENCH, "    - Mempool removal: %.2fms [%.2fs (%.2fms/blk)]\n", nTimeRemove * MILLI, nTimeRemoveForBlock * MICRO, nTimeRemoveForBlock * MILLI / nBlocksTotal);
     // Update chainActive & related variables.
     chainActive.SetTip(pindexNew);
     UpdateTip(pindexNew, chainparams);
@@ -2388,11 +3277,117 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint(BCLog::BENCH, "  - Connect postprocess: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime5) * MILLI, nTimePostConnect * MICRO, nTimePostConnect * MILLI / nBlocksTotal);
     LogPrint(BCLog::BENCH, "- Connect block: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime1) * MILLI, nTimeTotal * MICRO, nTimeTotal * MILLI / nBlocksTotal);
+    TRACE8(validation, connect_tip, pindexNew->phashBlock->begin(), pindexNew->nHeight, 1,
+           nTime2 - nTime1,     // loading the block
+           nTime3 - nTime2,     // ConnectBlock
+           nTime4 - nTime3,     // committing the block's coins journal
+           nTime5 - nTime4,     // FlushStateToDisk
+           nTime6 - nTime5);    // mempool removal and tip update
+    ObserveConnectTip(nTime1, nTime2, nTime3, nTime4, nTime5, nTime6);
 
     connectTrace.BlockConnected(pindexNew, std::move(pthisBlock));
     return true;
 }
 
+/**
+ * Connect several consecutive blocks to chainActive, looking up and updating
+ * the inputs of each block while the script checks of the previous ones are
+ * still running. The blocks are connected to pcoinsTip in turn under one
+ * journal, and all their checks share one CCheckQueueControl. Nothing is
+ * committed unless every block passes; otherwise the journal is rolled back
+ * and fRetrySerially is set, so that the caller can
+ * connect the blocks one by one with ConnectTip to find the invalid one.
+ */
+bool CChainState::ConnectTipsPipelined(CValidationState& state, const CChainParams& chainparams, const std::vector<CBlockIndex*>& vpindexNew, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool, bool& fRetrySerially)
+{
+    assert(!vpindexNew.empty() && chainActive.Tip() && vpindexNew.front()->pprev == chainActive.Tip());
+    fRetrySerially = false;
+    // Read blocks from disk.
+    int64_t nTime1 = GetTimeMicros();
+    std::vector<PendingBlockConnect> vpending(vpindexNew.size());
+    for (size_t i = 0; i < vpindexNew.size(); i++) {
+        PendingBlockConnect& pending = vpending[i];
+        pending.pindex = vpindexNew[i];
+        if (pending.pindex == pindexMostWork && pblock) {
+            pending.pblock = pblock;
+        } else {
+            std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
+            if (!ReadBlockFromDisk(*pblockNew, pending.pindex, chainparams.GetConsensus()))
+                return AbortNode(state, "Failed to read block");
+            PrefetchBlockInputs(*pblockNew);
+            pending.pblock = pblockNew;
+        }
+    }
+    int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
+    int64_t nTime3;
+    LogPrint(BCLog::BENCH, "  - Load %u blocks from disk: %.2fms [%.2fs]\n", (unsigned)vpending.size(), (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
+    {
+        bool fValid = true;
+        uint64_t nPrefetchHits = 0, nPrefetchMisses = 0;
+        if (pcoinsprefetch)
+            pcoinsprefetch->GetStats(nPrefetchHits, nPrefetchMisses);
+        CCoinsViewCacheJournal journal(*pcoinsTip);
+        {
+            CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+            for (PendingBlockConnect& pending : vpending) {
+                pending.control = &control;
+                if (!ConnectBlock(*pending.pblock, state, pending.pindex, *pcoinsTip, chainparams, false, &pending)) {
+                    fValid = false;
+                    break;
+                }
+            }
+            // Always wait, as the queued checks refer to the blocks and their precomputed data.
+            if (!control.Wait())
+                fValid = false;
+        }
+        if (pcoinsprefetch)
+            LogPrefetchStats(nPrefetchHits, nPrefetchMisses);
+        if (!fValid) {
+            LogPrint(BCLog::BENCH, "  - Pipelined connect of %s failed (%s), retrying serially\n", vpindexNew.front()->GetBlockHash().ToString(), FormatStateMessage(state));
+            state = CValidationState();
+            fRetrySerially = true;
+            return true;
+        }
+        for (PendingBlockConnect& pending : vpending) {
+            GetMainSignals().BlockChecked(*pending.pblock, state);
+            if (!FinishConnectBlock(*pending.pblock, pending.blockundo, state, pending.pindex, chainparams))
+                return error("ConnectTipsPipelined(): ConnectBlock %s failed", pending.pindex->GetBlockHash().ToString());
+        }
+        nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
+        LogPrint(BCLog::BENCH, "  - Connect %u blocks: %.2fms [%.2fs (%.2fms/blk)]\n", (unsigned)vpending.size(), (nTime3 - nTime2) * MILLI, nTimeConnectTotal * MICRO, nTimeConnectTotal * MILLI / nBlocksTotal);
+        journal.Commit();
+    }
+    int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
+    LogPrint(BCLog::BENCH, "  - Flush: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime4 - nTime3) * MILLI, nTimeFlush * MICRO, nTimeFlush * MILLI / nBlocksTotal);
+    // Write the chain state to disk, if necessary.
+    if (!FlushStateToDisk(chainparams, state, FLUSH_STATE_IF_NEEDED))
+        return false;
+    int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
+    LogPrint(BCLog::BENCH, "  - Writing chainstate: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime5 - nTime4) * MILLI, nTimeChainState * MICRO, nTimeChainState * MILLI / nBlocksTotal);
+    int64_t nTimeRemove = 0;
+    for (PendingBlockConnect& pending : vpending) {
+        // Remove conflicting transactions from the mempool.
+        int64_t nTimeRemoveStart = GetTimeMicros();
+        mempool.removeForBlock(pending.pblock->vtx, pending.pindex->nHeight);
+        disconnectpool.removeForBlock(pending.pblock->vtx);
+        nTimeRemove += GetTimeMicros() - nTimeRemoveStart;
+        // Update chainActive & related variables.
+        chainActive.SetTip(pending.pindex);
+        UpdateTip(pending.pindex, chainparams);
+        connectTrace.BlockConnected(pending.pindex, std::move(pending.pblock));
+    }
+    nTimeRemoveForBlock += nTimeRemove;
+    LogPrint(BCLog::BENCH, "    - Mempool removal: %.2fms [%.2fs (%.2fms/blk)]\n", nTimeRemove * MILLI, nTimeRemoveForBlock * MICRO, nTimeRemoveForBlock * MILLI / nBlocksTotal);
+
+    int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
+    LogPrint(BCLog::BENCH, "  - Connect postprocess: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime5) * MILLI, nTimePostConnect * MICRO, nTimePostConnect * MILLI / nBlocksTotal);
+    LogPrint(BCLog::BENCH, "- Connect %u blocks: %.2fms [%.2fs (%.2fms/blk)]\n", (unsigned)vpending.size(), (nTime6 - nTime1) * MILLI, nTimeTotal * MICRO, nTimeTotal * MILLI / nBlocksTotal);
+    TRACE8(validation, connect_tip, vpindexNew.back()->phashBlock->begin(), vpindexNew.back()->nHeight, vpindexNew.size(),
+           nTime2 - nTime1, nTime3 - nTime2, nTime4 - nTime3, nTime5 - nTime4, nTime6 - nTime5);
+    ObserveConnectTip(nTime1, nTime2, nTime3, nTime4, nTime5, nTime6);
+    return true;
+}
+
 /**
  * Return the tip of the chain with the most work in it, that isn't
  * known to be invalid (it's however far from certain to be valid).
@@ -2476,8 +3471,22 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
 
     // Disconnect active blocks which are no longer in the best chain.
     bool fBlocksDisconnected = false;
+    int nBlocksDisconnected = 0;
     DisconnectedBlockTransactions disconnectpool;
     while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
+        if (fParallelReorg && chainActive.Tip()->pprev != pindexFork) {
+            int nDisconnected = 0;
+            bool fRetrySerially = false;
+            if (!DisconnectTips(state, chainparams, pindexFork, disconnectpool, nDisconnected, fRetrySerially)) {
+                UpdateMempoolForReorg(disconnectpool, false);
+                return false;
+            }
+            if (!fRetrySerially) {
+                fBlocksDisconnected = true;
+                nBlocksDisconnected += nDisconnected;
+                continue;
+            }
+        }
         if (!DisconnectTip(state, chainparams, &disconnectpool)) {
             // This is likely a fatal error, but keep the mempool consistent,
             // just in case. Only remove from the mempool in this case.
@@ -2485,6 +3494,10 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
             return false;
         }
         fBlocksDisconnected = true;
+        nBlocksDisconnected++;
+    }
+    if (fAutoCompactDB && nBlocksDisconnected >= COMPACTDB_REORG_DEPTH) {
+        StartChainstateCompaction(strprintf("reorganization of %d blocks", nBlocksDisconnected));
     }
 
     // Build list of new blocks to connect.
@@ -2504,8 +3517,33 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
         }
         nHeight = nTargetHeight;
 
+        // During initial block download, connect runs of blocks with their
+        // script checks overlapping; anything that fails is retried below.
+        auto itConnect = vpindexToConnect.rbegin();
+        if (nScriptCheckPipelineBlocks > 1 && nScriptCheckThreads && !fBlocksDisconnected && chainActive.Tip() && IsInitialBlockDownload()) {
+            size_t nRemaining = vpindexToConnect.rend() - itConnect;
+            if (nRemaining > 1) {
+                std::vector<CBlockIndex*> vpindexBatch(itConnect, itConnect + std::min<size_t>(nRemaining, nScriptCheckPipelineBlocks));
+                bool fRetrySerially = false;
+                if (!ConnectTipsPipelined(state, chainparams, vpindexBatch, pindexMostWork, pblock, connectTrace, disconnectpool, fRetrySerially)) {
+                    // A system error occurred; see below.
+                    UpdateMempoolForReorg(disconnectpool, false);
+                    return false;
+                }
+                if (!fRetrySerially) {
+                    PruneBlockIndexCandidates();
+                    itConnect += vpindexBatch.size();
+                    if (!pindexOldTip || chainActive.Tip()->nChainWork > pindexOldTip->nChainWork) {
+                        // We're in a better position than we were. Return temporarily to release the lock.
+                        break;
+                    }
+                }
+            }
+        }
+
         // Connect new blocks.
-        for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
+        for (; itConnect != vpindexToConnect.rend(); ++itConnect) {
+            CBlockIndex *pindexConnect = *itConnect;
             if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
@@ -2825,6 +3863,8 @@ CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block)
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
+    // Keep LookupBlockIndexNoLock out until the fields it may read are set
+    std::unique_lock<std::mutex> lookupLock(g_block_index_lookup_mutex);
     BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
@@ -2836,6 +3876,7 @@ CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block)
     }
     pindexNew->nTimeMax = (pindexNew->pprev ? std::max(pindexNew->pprev->nTimeMax, pindexNew->nTime) : pindexNew->nTime);
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
+    lookupLock.unlock();
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
     if (pindexBestHeader == nullptr || pindexBestHeader->nChainWork < pindexNew->nChainWork)
         pindexBestHeader = pindexNew;
@@ -2918,8 +3959,10 @@ static bool FindBlockPos(CDiskBlockPos &pos, unsigned int nAddSize, unsigned int
         if (!fKnown) {
             LogPrintf("Leaving block file %i: %s\n", nLastBlockFile, vinfoBlockFile[nLastBlockFile].ToString());
         }
-        FlushBlockFile(!fKnown);
+        if (!FlushBlockFile(!fKnown, nSyncCheckpointHeight < 0))
+            return error("%s: writing block file %i failed", __func__, nLastBlockFile);
         nLastBlockFile = nFile;
+        g_blockfilemaps.SetFinalizedFiles(nLastBlockFile);
     }
 
     vinfoBlockFile[nFile].AddBlock(nHeight, nTime);
@@ -2934,7 +3977,7 @@ static bool FindBlockPos(CDiskBlockPos &pos, unsigned int nAddSize, unsigned int
         if (nNewChunks > nOldChunks) {
             if (fPruneMode)
                 fCheckForPruning = true;
-            if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
+            if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos, true)) {
                 FILE *file = OpenBlockFile(pos);
                 if (file) {
                     LogPrintf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nNewChunks * BLOCKFILE_CHUNK_SIZE, pos.nFile);
@@ -2967,7 +4010,7 @@ static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
     if (nNewChunks > nOldChunks) {
         if (fPruneMode)
             fCheckForPruning = true;
-        if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
+        if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos, true)) {
             FILE *file = OpenUndoFile(pos);
             if (file) {
                 LogPrintf("Pre-allocating up to position 0x%x in rev%05u.dat\n", nNewChunks * UNDOFILE_CHUNK_SIZE, pos.nFile);
@@ -2982,15 +4025,71 @@ static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
     return true;
 }
 
+static bool InvalidProofOfWork(CValidationState& state)
+{
+    return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
+}
+
 static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true)
 {
     // Check proof of work matches claimed amount
     if (fCheckPOW && !CheckProofOfWork(block.GetHash(), block.nBits, consensusParams))
-        return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
+        return InvalidProofOfWork(state);
 
     return true;
 }
 
+/** Fewest transactions each thread checking the transactions of a block gets */
+static const size_t MIN_TXS_PER_CHECK_THREAD = 250;
+
+/**
+ * Run CheckTransaction over the transactions of a block, on up to the script
+ * check threads and this one when there are enough transactions. Returns the
+ * index of the first transaction that fails, with state filled in as checking
+ * them in order would, or the number of transactions if none does.
+ */
+static size_t CheckBlockTransactions(const CBlock& block, CValidationState& state)
+{
+    const size_t nTxs = block.vtx.size();
+    const size_t nThreads = std::min<size_t>(nScriptCheckThreads + 1, nTxs / MIN_TXS_PER_CHECK_THREAD);
+    if (nThreads <= 1) {
+        for (size_t i = 0; i < nTxs; i++) {
+            if (!CheckTransaction(*block.vtx[i], state))
+                return i;
+        }
+        return nTxs;
+    }
+
+    // Transactions are handed out in order, so once one fails those after it
+    // need not be checked, while all those before it still are
+    std::atomic<size_t> nNext(0);
+    std::atomic<size_t> nFirstInvalid(nTxs);
+    auto worker = [&]() {
+        for (size_t i = nNext++; i < nFirstInvalid; i = nNext++) {
+            CValidationState stateTx;
+            if (!CheckTransaction(*block.vtx[i], stateTx)) {
+                size_t nFirst = nFirstInvalid;
+                while (i < nFirst && !nFirstInvalid.compare_exchange_weak(nFirst, i)) {}
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t n = 1; n < nThreads; n++) {
+        try {
+            threads.emplace_back(worker);
+        } catch (const std::system_error&) {
+            break;
+        }
+    }
+    worker();
+    for (std::thread& thread : threads)
+        thread.join();
+
+    if (nFirstInvalid < nTxs)
+        CheckTransaction(*block.vtx[nFirstInvalid], state);
+    return nFirstInvalid;
+}
+
 bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     // These are checks that are independent of context.
@@ -3035,10 +4134,10 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
             return state.DoS(100, false, REJECT_INVALID, "bad-cb-multiple", false, "more than one coinbase");
 
     // Check transactions
-    for (const auto& tx : block.vtx)
-        if (!CheckTransaction(*tx, state, false))
-            return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
-                                 strprintf("Transaction check failed (tx hash %s) %s", tx->GetHash().ToString(), state.GetDebugMessage()));
+    const size_t nInvalid = CheckBlockTransactions(block, state);
+    if (nInvalid < block.vtx.size())
+        return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
+                             strprintf("Transaction check failed (tx hash %s) %s", block.vtx[nInvalid]->GetHash().ToString(), state.GetDebugMessage()));
 
     unsigned int nSigOps = 0;
     for (const auto& tx : block.vtx)
@@ -3257,11 +4356,11 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
 }
 
 //判断区块头的合法性，接收合法的区块头
-bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, const HeaderCheckResult* precheck)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
+    uint256 hash = precheck ? precheck->hash : block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = nullptr;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
@@ -3277,7 +4376,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
         }
 
         //检查pow共识
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (precheck ? !precheck->fValidPoW && !InvalidProofOfWork(state) : !CheckBlockHeader(block, state, chainparams.GetConsensus()))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3319,16 +4418,78 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
     return true;
 }
 
+/**
+ * Closure computing the hash of a block header and checking its proof of
+ * work, which need no context.
+ */
+class CHeaderCheck
+{
+private:
+    const CBlockHeader* pheader;
+    HeaderCheckResult* presult;
+    const Consensus::Params* pparams;
+
+public:
+    CHeaderCheck(): pheader(nullptr), presult(nullptr), pparams(nullptr) {}
+    CHeaderCheck(const CBlockHeader* pheaderIn, HeaderCheckResult* presultIn, const Consensus::Params* pparamsIn): pheader(pheaderIn), presult(presultIn), pparams(pparamsIn) {}
+
+    bool operator()() {
+        presult->hash = pheader->GetHash();
+        presult->fValidPoW = CheckProofOfWork(presult->hash, pheader->nBits, *pparams);
+        return true;
+    }
+
+    void swap(CHeaderCheck& check) {
+        std::swap(pheader, check.pheader);
+        std::swap(presult, check.presult);
+        std::swap(pparams, check.pparams);
+    }
+};
+
+static CCheckQueue<CHeaderCheck> headercheckqueue(128);
+
+void ThreadHeaderCheck() {
+    RenameThread("bitcoin-headerch");
+    headercheckqueue.Thread();
+}
+
+/**
+ * Hash the headers and check their proof of work before cs_main is taken,
+ * spread over the header checking threads with -parheaders. Checks that fail
+ * are only reported by AcceptBlockHeader, in the order of the headers.
+ */
+static void PreCheckBlockHeaders(const std::vector<CBlockHeader>& headers, std::vector<HeaderCheckResult>& results, const Consensus::Params& consensusParams)
+{
+    results.resize(headers.size());
+    std::vector<CHeaderCheck> vChecks;
+    vChecks.reserve(headers.size());
+    for (size_t i = 0; i < headers.size(); i++) {
+        vChecks.emplace_back(&headers[i], &results[i], &consensusParams);
+    }
+    if (!fParallelHeaderChecks || nScriptCheckThreads == 0 || headers.size() < MIN_PARALLEL_HEADERS) {
+        for (CHeaderCheck& check : vChecks) {
+            check();
+        }
+        return;
+    }
+    CCheckQueueControl<CHeaderCheck> control(&headercheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
 // Exposed wrapper for AcceptBlockHeader
 //处理区块头，接收合法的区块头，找出第一个不合法的区块头
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
 {
     if (first_invalid != nullptr) first_invalid->SetNull();
+    std::vector<HeaderCheckResult> vPreChecks;
+    PreCheckBlockHeaders(headers, vPreChecks, chainparams.GetConsensus());
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex, &vPreChecks[i])) {
                 if (first_invalid) *first_invalid = header;
                 return false;
             }
@@ -3343,16 +4504,24 @@ bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidatio
 
 /** Store block on disk. If dbp is non-nullptr, the file is known to already reside on disk */
 static CDiskBlockPos SaveBlockToDisk(const CBlock& block, int nHeight, const CChainParams& chainparams, const CDiskBlockPos* dbp) {
-    unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    // The size of a block already on disk is that of its record uncompressed
+    std::shared_ptr<std::vector<unsigned char>> record;
+    unsigned int nRecordSize;
+    if (dbp == nullptr) {
+        record = MakeBlockRecord(block, chainparams.MessageStart());
+        nRecordSize = record->size();
+    } else {
+        nRecordSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION) + 8;
+    }
     CDiskBlockPos blockPos;
     if (dbp != nullptr)
         blockPos = *dbp;
-    if (!FindBlockPos(blockPos, nBlockSize+8, nHeight, block.GetBlockTime(), dbp != nullptr)) {
+    if (!FindBlockPos(blockPos, nRecordSize, nHeight, block.GetBlockTime(), dbp != nullptr)) {
         error("%s: FindBlockPos failed", __func__);
         return CDiskBlockPos();
     }
     if (dbp == nullptr) {
-        if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart())) {
+        if (!WriteBlockToDisk(std::move(record), blockPos)) {
             AbortNode("Failed to write block");
             return CDiskBlockPos();
         }
@@ -3454,6 +4623,10 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
         // belt-and-suspenders.
         bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus());
 
+        // Read the spent coins from the database before taking cs_main.
+        if (ret)
+            PrefetchBlockInputs(*pblock);
+
         LOCK(cs_main);
 
         if (ret) {
@@ -3516,12 +4689,20 @@ uint64_t CalculateCurrentUsage()
 
 /* Prune a block file (modify associated database entries)*/
 void PruneOneBlockFile(const int fileNumber)
+{
+    PruneBlockFiles({fileNumber});
+}
+
+void PruneBlockFiles(const std::set<int>& setFiles)
 {
     LOCK(cs_LastBlockFile);
+    if (setFiles.empty())
+        return;
 
+    // A single pass over the block index, however many files are pruned at once
     for (const auto& entry : mapBlockIndex) {
         CBlockIndex* pindex = entry.second;
-        if (pindex->nFile == fileNumber) {
+        if (setFiles.count(pindex->nFile)) {
             pindex->nStatus &= ~BLOCK_HAVE_DATA;
             pindex->nStatus &= ~BLOCK_HAVE_UNDO;
             pindex->nFile = 0;
@@ -3544,18 +4725,47 @@ void PruneOneBlockFile(const int fileNumber)
         }
     }
 
-    vinfoBlockFile[fileNumber].SetNull();
-    setDirtyFileInfo.insert(fileNumber);
+    for (int fileNumber : setFiles) {
+        vinfoBlockFile[fileNumber].SetNull();
+        setDirtyFileInfo.insert(fileNumber);
+    }
 }
 
+static void UnlinkPrunedFile(int nFile)
+{
+    CDiskBlockPos pos(nFile, 0);
+    g_blockfilemaps.Erase(nFile);
+    fs::remove(GetBlockPosFilename(pos, "blk"));
+    fs::remove(GetBlockPosFilename(pos, "rev"));
+    {
+        LOCK(cs_ColdBlockFiles);
+        setColdBlockFiles.erase(nFile);
+    }
+    LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, nFile);
+}
 
 void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
-    for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
-        CDiskBlockPos pos(*it, 0);
-        fs::remove(GetBlockPosFilename(pos, "blk"));
-        fs::remove(GetBlockPosFilename(pos, "rev"));
-        LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
+    for (int nFile : setFilesToPrune) {
+        UnlinkPrunedFile(nFile);
+    }
+}
+
+void UnlinkLeftoverPrunedFiles()
+{
+    std::set<int> setFiles;
+    {
+        LOCK(cs_LastBlockFile);
+        // Files below the last one have no size only once they are pruned
+        for (int nFile = 0; nFile < nLastBlockFile; nFile++) {
+            CDiskBlockPos pos(nFile, 0);
+            if (vinfoBlockFile[nFile].nSize == 0 && (fs::exists(GetBlockPosFilename(pos, "blk")) || fs::exists(GetBlockPosFilename(pos, "rev"))))
+                setFiles.insert(nFile);
+        }
+    }
+    if (!setFiles.empty()) {
+        LogPrintf("Prune: deleting %u blk/rev pairs left behind by an earlier prune\n", setFiles.size());
+        g_blockfileunlinker.Unlink(setFiles);
     }
 }
 
@@ -3565,19 +4775,19 @@ static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPr
     assert(fPruneMode && nManualPruneHeight > 0);
 
     LOCK2(cs_main, cs_LastBlockFile);
-    if (chainActive.Tip() == nullptr)
+    if (chainActive.Tip() == nullptr || chainActive.Tip()->nHeight <= (int)nPruneKeepBlocks)
         return;
 
-    // last block to prune is the lesser of (user-specified height, MIN_BLOCKS_TO_KEEP from the tip)
-    unsigned int nLastBlockWeCanPrune = std::min((unsigned)nManualPruneHeight, chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP);
+    // last block to prune is the lesser of (user-specified height, nPruneKeepBlocks from the tip)
+    unsigned int nLastBlockWeCanPrune = std::min((unsigned)nManualPruneHeight, chainActive.Tip()->nHeight - nPruneKeepBlocks);
     int count=0;
     for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
         if (vinfoBlockFile[fileNumber].nSize == 0 || vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
             continue;
-        PruneOneBlockFile(fileNumber);
         setFilesToPrune.insert(fileNumber);
         count++;
     }
+    PruneBlockFiles(setFilesToPrune);
     LogPrintf("Prune (Manual): prune_height=%d removed %d blk/rev pairs\n", nLastBlockWeCanPrune, count);
 }
 
@@ -3598,7 +4808,7 @@ void PruneBlockFilesManual(int nManualPruneHeight)
  * Pruning functions are called from FlushStateToDisk when the global fCheckForPruning flag has been set.
  * Block and undo files are deleted in lock-step (when blk00003.dat is deleted, so is rev00003.dat.)
  * Pruning cannot take place until the longest chain is at least a certain length (100000 on mainnet, 1000 on testnet, 1000 on regtest).
- * Pruning will never delete a block within a defined distance (currently 288) from the active chain's tip.
+ * Pruning will never delete a block within a defined distance (-prunekeepblocks, at least 288) from the active chain's tip.
  * The block index is updated by unsetting HAVE_DATA and HAVE_UNDO for any blocks that were stored in the deleted files.
  * A db flag records the fact that at least some block files have been pruned.
  *
@@ -3610,11 +4820,11 @@ static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfte
     if (chainActive.Tip() == nullptr || nPruneTarget == 0) {
         return;
     }
-    if ((uint64_t)chainActive.Tip()->nHeight <= nPruneAfterHeight) {
+    if ((uint64_t)chainActive.Tip()->nHeight <= nPruneAfterHeight || chainActive.Tip()->nHeight <= (int)nPruneKeepBlocks) {
         return;
     }
 
-    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
+    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - nPruneKeepBlocks;
     uint64_t nCurrentUsage = CalculateCurrentUsage();
     // We don't check to prune until after we've allocated new space for files
     // So we should leave a buffer under our target to account for another allocation
@@ -3633,16 +4843,16 @@ static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfte
             if (nCurrentUsage + nBuffer < nPruneTarget)  // are we below our target?
                 break;
 
-            // don't prune files that could have a block within MIN_BLOCKS_TO_KEEP of the main chain's tip but keep scanning
+            // don't prune files that could have a block within nPruneKeepBlocks of the main chain's tip but keep scanning
             if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
                 continue;
 
-            PruneOneBlockFile(fileNumber);
             // Queue up the files for removal
             setFilesToPrune.insert(fileNumber);
             nCurrentUsage -= nBytesToPrune;
             count++;
         }
+        PruneBlockFiles(setFilesToPrune);
     }
 
     LogPrint(BCLog::PRUNE, "Prune: target=%dMiB actual=%dMiB diff=%dMiB max_prune_height=%d removed %d blk/rev pairs\n",
@@ -3651,9 +4861,9 @@ static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfte
            nLastBlockWeCanPrune, count);
 }
 
-bool CheckDiskSpace(uint64_t nAdditionalBytes)
+bool CheckDiskSpace(uint64_t nAdditionalBytes, bool fBlocksDir)
 {
-    uint64_t nFreeBytesAvailable = fs::space(GetDataDir()).available;
+    uint64_t nFreeBytesAvailable = fs::space(fBlocksDir ? GetBlocksDir() : GetDataDir()).available;
 
     // Check for nMinDiskSpace bytes (currently 50MB)
     if (nFreeBytesAvailable < nMinDiskSpace + nAdditionalBytes)
@@ -3669,6 +4879,11 @@ static FILE* OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fRe
     fs::path path = GetBlockPosFilename(pos, prefix);
     fs::create_directories(path.parent_path());
     FILE* file = fsbridge::fopen(path, fReadOnly ? "rb": "rb+");
+    if (!file && fReadOnly && !GetColdBlocksDir().empty()) {
+        // The file may have been moved to -coldblocksdir since
+        path = GetBlockPosFilename(pos, prefix);
+        file = fsbridge::fopen(path, "rb");
+    }
     if (!file && !fReadOnly)
         file = fsbridge::fopen(path, "wb+");
     if (!file) {
@@ -3694,9 +4909,149 @@ static FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly) {
     return OpenDiskFile(pos, "rev", fReadOnly);
 }
 
+static fs::path GetBlockFilename(const fs::path& dir, int nFile, const char *prefix)
+{
+    return dir / strprintf("%s%05u.dat", prefix, nFile);
+}
+
 fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix)
 {
-    return GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
+    {
+        LOCK(cs_ColdBlockFiles);
+        if (setColdBlockFiles.count(pos.nFile))
+            return GetBlockFilename(GetColdBlocksDir(), pos.nFile, prefix);
+    }
+    return GetBlockFilename(GetBlocksDir(), pos.nFile, prefix);
+}
+
+void LoadColdBlockFiles()
+{
+    const fs::path& coldDir = GetColdBlocksDir();
+    if (coldDir.empty())
+        return;
+
+    std::vector<int> vFiles;
+    for (fs::directory_iterator it(coldDir); it != fs::directory_iterator(); it++) {
+        const std::string strName = it->path().filename().string();
+        int nFile;
+        if (fs::is_regular_file(*it) && strName.length() == 12 && strName.substr(0, 3) == "blk" &&
+            strName.substr(8, 4) == ".dat" && ParseInt32(strName.substr(3, 5), &nFile)) {
+            vFiles.push_back(nFile);
+        }
+    }
+
+    LOCK(cs_ColdBlockFiles);
+    setColdBlockFiles.clear();
+    for (int nFile : vFiles) {
+        // The block file is removed from the blocks directory as the move
+        // completes; while it is still there, the move did not happen.
+        if (fs::exists(GetBlockFilename(GetBlocksDir(), nFile, "blk"))) {
+            fs::remove(GetBlockFilename(coldDir, nFile, "blk"));
+            fs::remove(GetBlockFilename(coldDir, nFile, "rev"));
+        } else {
+            fs::remove(GetBlockFilename(GetBlocksDir(), nFile, "rev"));
+            setColdBlockFiles.insert(nFile);
+        }
+    }
+    LogPrintf("%u block files in %s\n", setColdBlockFiles.size(), coldDir.string());
+}
+
+/** Copy a block or undo file, and make sure the copy is on disk */
+static bool CopyBlockFile(const fs::path& src, const fs::path& dest)
+{
+    try {
+        fs::copy_file(src, dest, fs::copy_option::overwrite_if_exists);
+    } catch (const fs::filesystem_error& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+    FILE* file = fsbridge::fopen(dest, "rb+");
+    if (!file)
+        return error("%s: unable to open %s", __func__, dest.string());
+    FileCommit(file);
+    fclose(file);
+    return true;
+}
+
+/** Remove a file, returning whether it is gone */
+static bool TryRemoveFile(const fs::path& path)
+{
+    try {
+        fs::remove(path);
+    } catch (const fs::filesystem_error& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+    return true;
+}
+
+void MoveColdBlockFiles()
+{
+    const fs::path& coldDir = GetColdBlocksDir();
+    if (coldDir.empty())
+        return;
+
+    // The oldest file no longer written to, which -hotblockfiles does not
+    // keep, and whose blocks are too deep for a reorganization to add undo
+    // data to its undo file.
+    int nFile = -1;
+    CBlockFileInfo info;
+    {
+        LOCK2(cs_main, cs_LastBlockFile);
+        LOCK(cs_ColdBlockFiles);
+        const int nLastBlockToMove = chainActive.Height() - MIN_BLOCKS_TO_KEEP;
+        for (int i = 0; i < nLastBlockFile - nHotBlockFiles; i++) {
+            // Pruned files have no size
+            if (setColdBlockFiles.count(i) || vinfoBlockFile[i].nSize == 0)
+                continue;
+            if ((int)vinfoBlockFile[i].nHeightLast > nLastBlockToMove)
+                continue;
+            nFile = i;
+            info = vinfoBlockFile[i];
+            break;
+        }
+    }
+    if (nFile < 0)
+        return;
+    // Undo data already allocated in the file may still be queued
+    if (!g_blockfilewriter.Flush())
+        return;
+
+    // Copy the undo file first: the block file being in the cold directory
+    // means its undo file is complete there.
+    int64_t nStart = GetTimeMillis();
+    for (const char* prefix : {"rev", "blk"}) {
+        const fs::path dest = GetBlockFilename(coldDir, nFile, prefix);
+        const fs::path tmp = dest.string() + ".tmp";
+        if (!CopyBlockFile(GetBlockFilename(GetBlocksDir(), nFile, prefix), tmp) || !RenameOver(tmp, dest)) {
+            LogPrintf("%s: unable to move %s%05u.dat to %s\n", __func__, prefix, nFile, coldDir.string());
+            TryRemoveFile(tmp);
+            TryRemoveFile(GetBlockFilename(coldDir, nFile, "rev"));
+            return;
+        }
+    }
+
+    {
+        LOCK2(cs_main, cs_LastBlockFile);
+        const CBlockFileInfo& infoNow = vinfoBlockFile[nFile];
+        bool fMoved = infoNow.nSize == info.nSize && infoNow.nUndoSize == info.nUndoSize;
+        if (fMoved) {
+            LOCK(cs_ColdBlockFiles);
+            setColdBlockFiles.insert(nFile);
+            // Readers that opened the file before keep reading the old copy
+            if (!TryRemoveFile(GetBlockFilename(GetBlocksDir(), nFile, "blk"))) {
+                setColdBlockFiles.erase(nFile);
+                fMoved = false;
+            }
+        }
+        if (!fMoved) {
+            // Written to or pruned in the meantime, or in use; try again later
+            TryRemoveFile(GetBlockFilename(coldDir, nFile, "blk"));
+            TryRemoveFile(GetBlockFilename(coldDir, nFile, "rev"));
+            return;
+        }
+    }
+    g_blockfilemaps.Erase(nFile);
+    TryRemoveFile(GetBlockFilename(GetBlocksDir(), nFile, "rev"));
+    LogPrintf("Moved blk/rev (%05u) to %s in %dms\n", nFile, coldDir.string(), GetTimeMillis() - nStart);
 }
 
 CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
@@ -3711,6 +5066,7 @@ CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
 
     // Create new
     CBlockIndex* pindexNew = new CBlockIndex();
+    std::lock_guard<std::mutex> lock(g_block_index_lookup_mutex);
     mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -3725,6 +5081,7 @@ bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlo
     boost::this_thread::interruption_point();
 
     // Calculate nChainWork
+    int64_t nStart = GetTimeMillis();
     std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex)
@@ -3765,17 +5122,21 @@ bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlo
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == nullptr || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    LogPrintf("%s: linked %u entries in %dms\n", __func__, vSortedByHeight.size(), GetTimeMillis() - nStart);
 
     return true;
 }
 
 bool static LoadBlockIndexDB(const CChainParams& chainparams)
 {
+    int64_t nStart = GetTimeMillis();
     if (!g_chainstate.LoadBlockIndex(chainparams.GetConsensus(), *pblocktree))
         return false;
+    int64_t nTimeIndex = GetTimeMillis();
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
+    g_blockfilemaps.SetFinalizedFiles(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
     LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
     for (int nFile = 0; nFile <= nLastBlockFile; nFile++) {
@@ -3814,14 +5175,21 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     if (fHavePruned)
         LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
 
+    // Check whether the node stopped while durability was deferred
+    if (pblocktree->ReadSyncCheckpoint(nSyncCheckpointHeight))
+        LogPrintf("LoadBlockIndexDB(): Stopped with writes after height %d not synced to disk\n", nSyncCheckpointHeight);
+
+    // Check whether the chainstate was loaded from a UTXO snapshot
+    pblocktree->ReadFlag("snapshotchainstate", fSnapshotChainstate);
+    if (fSnapshotChainstate)
+        LogPrintf("LoadBlockIndexDB(): Chainstate was loaded from a UTXO snapshot\n");
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
     if(fReindexing) fReindex = true;
 
-    // Check whether we have a transaction index
-    pblocktree->ReadFlag("txindex", fTxIndex);
-    LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
+    LogPrintf("%s: loaded in %dms (block index %dms, block files %dms)\n", __func__, GetTimeMillis() - nStart, nTimeIndex - nStart, GetTimeMillis() - nTimeIndex);
 
     return true;
 }
@@ -3845,6 +5213,7 @@ bool LoadChainTip(const CChainParams& chainparams)
     if (it == mapBlockIndex.end())
         return false;
     chainActive.SetTip(it->second);
+    PublishChainSnapshot();
 
     g_chainstate.PruneBlockIndexCandidates();
 
@@ -3865,17 +5234,100 @@ CVerifyDB::~CVerifyDB()
     uiInterface.ShowProgress("", 100, false);
 }
 
-bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth)
-{
-    LOCK(cs_main);
-    if (chainActive.Tip() == nullptr || chainActive.Tip()->pprev == nullptr)
-        return true;
+/** Blocks VerifyDB reads and checks together */
+static const size_t VERIFYDB_BATCH_BLOCKS = 16;
 
-    // Verify blocks in the best chain
-    if (nCheckDepth <= 0 || nCheckDepth > chainActive.Height())
+/** A block VerifyDB has read, and the results of its context free checks */
+struct VerifyDBBlock {
+    CBlockIndex* pindex;
+    CBlock block;
+    CValidationState state;
+    bool fRead;
+    bool fValid;
+    bool fUndoValid;
+
+    explicit VerifyDBBlock(CBlockIndex* pindexIn) : pindex(pindexIn), fRead(false), fValid(false), fUndoValid(false) {}
+};
+
+/**
+ * Closure reading a block and its undo data from disk for VerifyDB, and
+ * checking them up to nCheckLevel 2. These checks need no coins, so that
+ * blocks can be checked in any order; the results are reported in chain order.
+ */
+class CVerifyDBCheck
+{
+private:
+    VerifyDBBlock* pblock;
+    int nCheckLevel;
+    const Consensus::Params* pparams;
+
+public:
+    CVerifyDBCheck(): pblock(nullptr), nCheckLevel(0), pparams(nullptr) {}
+    CVerifyDBCheck(VerifyDBBlock* pblockIn, int nCheckLevelIn, const Consensus::Params* pparamsIn): pblock(pblockIn), nCheckLevel(nCheckLevelIn), pparams(pparamsIn) {}
+
+    bool operator()() {
+        const CBlockIndex* pindex = pblock->pindex;
+        // check level 0: read from disk
+        pblock->fRead = ReadBlockFromDisk(pblock->block, pindex, *pparams);
+        if (!pblock->fRead) {
+            return true;
+        }
+        // check level 1: verify block validity
+        pblock->fValid = nCheckLevel < 1 || CheckBlock(pblock->block, pblock->state, *pparams);
+        if (!pblock->fValid) {
+            return true;
+        }
+        // check level 2: verify undo validity
+        CBlockUndo undo;
+        pblock->fUndoValid = nCheckLevel < 2 || pindex->GetUndoPos().IsNull() || UndoReadFromDisk(undo, pindex);
+        return true;
+    }
+
+    void swap(CVerifyDBCheck& check) {
+        std::swap(pblock, check.pblock);
+        std::swap(nCheckLevel, check.nCheckLevel);
+        std::swap(pparams, check.pparams);
+    }
+};
+
+static CCheckQueue<CVerifyDBCheck> verifydbcheckqueue(1);
+
+void ThreadVerifyDBCheck() {
+    RenameThread("bitcoin-verifydb");
+    verifydbcheckqueue.Thread();
+}
+
+/** Read and check a batch of blocks, on the startup block verification threads with -parverifydb */
+static void CheckVerifyDBBlocks(std::vector<VerifyDBBlock>& vBlocks, int nCheckLevel, const Consensus::Params& consensusParams)
+{
+    std::vector<CVerifyDBCheck> vChecks;
+    vChecks.reserve(vBlocks.size());
+    for (VerifyDBBlock& block : vBlocks) {
+        vChecks.emplace_back(&block, nCheckLevel, &consensusParams);
+    }
+    if (!fParallelVerifyDB || nScriptCheckThreads == 0) {
+        for (CVerifyDBCheck& check : vChecks) {
+            check();
+        }
+        return;
+    }
+    CCheckQueueControl<CVerifyDBCheck> control(&verifydbcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
+bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth)
+{
+    LOCK(cs_main);
+    if (chainActive.Tip() == nullptr || chainActive.Tip()->pprev == nullptr)
+        return true;
+
+    // Verify blocks in the best chain
+    if (nCheckDepth <= 0 || nCheckDepth > chainActive.Height())
         nCheckDepth = chainActive.Height();
     nCheckLevel = std::max(0, std::min(4, nCheckLevel));
     LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+    int64_t nTimeStart = GetTimeMicros();
     CCoinsViewCache coins(coinsview);
     CBlockIndex* pindexState = chainActive.Tip();
     CBlockIndex* pindexFailure = nullptr;
@@ -3883,53 +5335,56 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
     CValidationState state;
     int reportDone = 0;
     LogPrintf("[0%%]...");
-    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
-    {
-        boost::this_thread::interruption_point();
-        int percentageDone = std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100))));
-        if (reportDone < percentageDone/10) {
-            // report every 10% step
-            LogPrintf("[%d%%]...", percentageDone);
-            reportDone = percentageDone/10;
-        }
-        uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone, false);
-        if (pindex->nHeight < chainActive.Height()-nCheckDepth)
-            break;
-        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, only go back as far as we have data.
-            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
-            break;
-        }
-        CBlock block;
-        // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-            return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus()))
-            return error("%s: *** found bad block at %d, hash=%s (%s)\n", __func__,
-                         pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(state));
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            if (!pindex->GetUndoPos().IsNull()) {
-                if (!UndoReadFromDisk(undo, pindex)) {
-                    return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-                }
+    CBlockIndex* pindexNext = chainActive.Tip();
+    bool fDone = false;
+    while (!fDone) {
+        // Collect the next blocks down the chain, and read and check them all
+        // at once; only the disconnects below depend on each other
+        std::vector<VerifyDBBlock> vBlocks;
+        for (; pindexNext && pindexNext->pprev && vBlocks.size() < VERIFYDB_BATCH_BLOCKS; pindexNext = pindexNext->pprev) {
+            if (pindexNext->nHeight < chainActive.Height()-nCheckDepth)
+                break;
+            if ((fPruneMode || fSnapshotChainstate) && !(pindexNext->nStatus & BLOCK_HAVE_DATA)) {
+                // If pruning or started from a snapshot, only go back as far as we have data.
+                LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindexNext->nHeight);
+                break;
             }
+            vBlocks.emplace_back(pindexNext);
         }
-        // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
-            assert(coins.GetBestBlock() == pindex->GetBlockHash());
-            DisconnectResult res = g_chainstate.DisconnectBlock(block, pindex, coins);
-            if (res == DISCONNECT_FAILED) {
-                return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        fDone = vBlocks.size() < VERIFYDB_BATCH_BLOCKS;
+        boost::this_thread::interruption_point();
+        CheckVerifyDBBlocks(vBlocks, nCheckLevel, chainparams.GetConsensus());
+
+        for (VerifyDBBlock& checked : vBlocks) {
+            CBlockIndex* pindex = checked.pindex;
+            int percentageDone = std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100))));
+            if (reportDone < percentageDone/10) {
+                // report every 10% step
+                LogPrintf("[%d%%]...", percentageDone);
+                reportDone = percentageDone/10;
             }
-            pindexState = pindex->pprev;
-            if (res == DISCONNECT_UNCLEAN) {
-                nGoodTransactions = 0;
-                pindexFailure = pindex;
-            } else {
-                nGoodTransactions += block.vtx.size();
+            uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone, false);
+            if (!checked.fRead)
+                return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            if (!checked.fValid)
+                return error("%s: *** found bad block at %d, hash=%s (%s)\n", __func__,
+                             pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(checked.state));
+            if (!checked.fUndoValid)
+                return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+            // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
+            if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
+                assert(coins.GetBestBlock() == pindex->GetBlockHash());
+                DisconnectResult res = g_chainstate.DisconnectBlock(checked.block, pindex, coins);
+                if (res == DISCONNECT_FAILED) {
+                    return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                }
+                pindexState = pindex->pprev;
+                if (res == DISCONNECT_UNCLEAN) {
+                    nGoodTransactions = 0;
+                    pindexFailure = pindex;
+                } else {
+                    nGoodTransactions += checked.block.vtx.size();
+                }
             }
         }
         if (ShutdownRequested())
@@ -3942,32 +5397,38 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
     if (nCheckLevel >= 4) {
         CBlockIndex *pindex = pindexState;
         while (pindex != chainActive.Tip()) {
+            // Read the next blocks up the chain at once, and connect them in order
+            std::vector<VerifyDBBlock> vBlocks;
+            for (CBlockIndex* pindexRead = pindex; pindexRead != chainActive.Tip() && vBlocks.size() < VERIFYDB_BATCH_BLOCKS; ) {
+                pindexRead = chainActive.Next(pindexRead);
+                vBlocks.emplace_back(pindexRead);
+            }
             boost::this_thread::interruption_point();
-            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))), false);
-            pindex = chainActive.Next(pindex);
-            CBlock block;
-            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-                return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            if (!g_chainstate.ConnectBlock(block, state, pindex, coins, chainparams))
-                return error("VerifyDB(): *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            CheckVerifyDBBlocks(vBlocks, 0, chainparams.GetConsensus());
+            for (VerifyDBBlock& read : vBlocks) {
+                uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))), false);
+                pindex = read.pindex;
+                if (!read.fRead)
+                    return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                if (!g_chainstate.ConnectBlock(read.block, state, pindex, coins, chainparams))
+                    return error("VerifyDB(): *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            }
         }
     }
 
     LogPrintf("[DONE].\n");
     LogPrintf("No coin database inconsistencies in last %i blocks (%i transactions)\n", chainActive.Height() - pindexState->nHeight, nGoodTransactions);
+    LogPrint(BCLog::BENCH, "    - VerifyDB: %.2fms\n", (GetTimeMicros() - nTimeStart) * MILLI);
 
     return true;
 }
 
 /** Apply the effects of a block on the utxo cache, ignoring that it may already have been applied. */
-bool CChainState::RollforwardBlock(const CBlockIndex* pindex, CCoinsViewCache& inputs, const CChainParams& params)
+void CChainState::RollforwardBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& inputs)
 {
     // TODO: merge with ConnectBlock
-    CBlock block;
-    if (!ReadBlockFromDisk(block, pindex, params.GetConsensus())) {
-        return error("ReplayBlock(): ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-    }
-
+    // Look the spent coins up at once, as ConnectBlock does
+    inputs.FetchInputs(block);
     for (const CTransactionRef& tx : block.vtx) {
         if (!tx->IsCoinBase()) {
             for (const CTxIn &txin : tx->vin) {
@@ -3977,9 +5438,86 @@ bool CChainState::RollforwardBlock(const CBlockIndex* pindex, CCoinsViewCache& i
         // Pass check = true as every addition may be an overwrite.
         AddCoins(inputs, *tx, pindex->nHeight, true);
     }
-    return true;
 }
 
+/** Most blocks ReplayBlocks reads ahead of the one it rolls forward */
+static const size_t REPLAY_READ_AHEAD_BLOCKS = 32;
+
+/**
+ * Reads the blocks ReplayBlocks rolls forward on threads of their own, up to
+ * REPLAY_READ_AHEAD_BLOCKS ahead of the one it waits for, so that reading
+ * them overlaps with applying them.
+ */
+class CReplayBlockReader
+{
+private:
+    const std::vector<const CBlockIndex*>& vpindex;
+    const Consensus::Params& params;
+    std::mutex cs;
+    std::condition_variable cond;
+    size_t nNextRead;
+    size_t nWanted;
+    //! Blocks read and not taken yet, nullptr for those that could not be read
+    std::map<size_t, std::shared_ptr<CBlock>> mapRead;
+    bool fStop;
+    std::vector<std::thread> threads;
+
+    void ReadBlocks()
+    {
+        while (true) {
+            size_t i;
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                cond.wait(lock, [&] { return fStop || nNextRead >= vpindex.size() || nNextRead < nWanted + REPLAY_READ_AHEAD_BLOCKS; });
+                if (fStop || nNextRead >= vpindex.size())
+                    return;
+                i = nNextRead++;
+            }
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            if (!ReadBlockFromDisk(*pblock, vpindex[i], params))
+                pblock.reset();
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                mapRead.emplace(i, std::move(pblock));
+            }
+            cond.notify_all();
+        }
+    }
+
+public:
+    CReplayBlockReader(const std::vector<const CBlockIndex*>& vpindexIn, const Consensus::Params& paramsIn, int nThreads) :
+        vpindex(vpindexIn), params(paramsIn), nNextRead(0), nWanted(0), fStop(false)
+    {
+        for (int i = 0; i < nThreads; i++) {
+            threads.emplace_back(&CReplayBlockReader::ReadBlocks, this);
+        }
+    }
+
+    ~CReplayBlockReader()
+    {
+        {
+            std::unique_lock<std::mutex> lock(cs);
+            fStop = true;
+        }
+        cond.notify_all();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    /** Wait for the block of vpindex[i], which is nullptr if it could not be read */
+    std::shared_ptr<CBlock> Get(size_t i)
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        nWanted = i;
+        cond.notify_all();
+        cond.wait(lock, [&] { return mapRead.count(i) != 0; });
+        std::shared_ptr<CBlock> pblock = std::move(mapRead[i]);
+        mapRead.erase(i);
+        return pblock;
+    }
+};
+
 bool CChainState::ReplayBlocks(const CChainParams& params, CCoinsView* view)
 {
     LOCK(cs_main);
@@ -4031,12 +5569,23 @@ bool CChainState::ReplayBlocks(const CChainParams& params, CCoinsView* view)
         pindexOld = pindexOld->pprev;
     }
 
-    // Roll forward from the forking point to the new tip.
+    // Roll forward from the forking point to the new tip, reading the blocks ahead.
     int nForkHeight = pindexFork ? pindexFork->nHeight : 0;
+    std::vector<const CBlockIndex*> vpindexForward;
     for (int nHeight = nForkHeight + 1; nHeight <= pindexNew->nHeight; ++nHeight) {
-        const CBlockIndex* pindex = pindexNew->GetAncestor(nHeight);
-        LogPrintf("Rolling forward %s (%i)\n", pindex->GetBlockHash().ToString(), nHeight);
-        if (!RollforwardBlock(pindex, cache, params)) return false;
+        vpindexForward.push_back(pindexNew->GetAncestor(nHeight));
+    }
+    if (!vpindexForward.empty()) {
+        CReplayBlockReader reader(vpindexForward, params.GetConsensus(), std::max(1, std::min<int>(nScriptCheckThreads, vpindexForward.size())));
+        for (size_t i = 0; i < vpindexForward.size(); i++) {
+            const CBlockIndex* pindex = vpindexForward[i];
+            std::shared_ptr<CBlock> pblock = reader.Get(i);
+            if (!pblock) {
+                return error("ReplayBlock(): ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            }
+            LogPrintf("Rolling forward %s (%i)\n", pindex->GetBlockHash().ToString(), pindex->nHeight);
+            RollforwardBlock(*pblock, pindex, cache);
+        }
     }
 
     cache.SetBestBlock(pindexNew->GetBlockHash());
@@ -4153,6 +5702,196 @@ bool RewindBlockIndex(const CChainParams& params) {
     return true;
 }
 
+bool CChainState::ActivateSnapshot(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexBase, uint64_t nChainTx)
+{
+    AssertLockHeld(cs_main);
+    assert(pindexBase->nHeight > 0 && chainActive.Height() == 0);
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+
+    std::vector<CBlockIndex*> vChain;
+    for (CBlockIndex* pindex = pindexBase; pindex->pprev; pindex = pindex->pprev) {
+        if (pindex->nStatus & BLOCK_FAILED_MASK) {
+            return state.Error(strprintf("block %s below the snapshot base is invalid", pindex->GetBlockHash().ToString()));
+        }
+        vChain.push_back(pindex);
+    }
+    std::reverse(vChain.begin(), vChain.end());
+
+    // Blocks below the base whose data we do not have count as one
+    // transaction each; the base makes up for the difference, so that
+    // nChainTx (and with it GuessVerificationProgress) matches the snapshot.
+    uint64_t nTxBelowBase = chainActive.Genesis()->nChainTx;
+    for (size_t i = 0; i + 1 < vChain.size(); i++) {
+        nTxBelowBase += vChain[i]->nTx ? vChain[i]->nTx : 1;
+    }
+    if (pindexBase->nTx == 0 && nChainTx <= nTxBelowBase) {
+        return state.Error(strprintf("snapshot transaction count %u is too low for height %d", nChainTx, pindexBase->nHeight));
+    }
+
+    std::deque<CBlockIndex*> queue;
+    for (size_t i = 0; i < vChain.size(); i++) {
+        CBlockIndex* pindex = vChain[i];
+        if (pindex->nTx == 0) {
+            pindex->nTx = pindex == pindexBase ? nChainTx - nTxBelowBase : 1;
+        }
+        pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+        if (IsWitnessEnabled(pindex->pprev, consensusParams)) {
+            pindex->nStatus |= BLOCK_OPT_WITNESS;
+        }
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        {
+            LOCK(cs_nBlockSequenceId);
+            pindex->nSequenceId = nBlockSequenceId++;
+        }
+        setDirtyBlockIndex.insert(pindex);
+
+        // Blocks that were waiting for this one can now be linked, unless
+        // they are part of the snapshot chain themselves.
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex);
+        while (range.first != range.second) {
+            std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first;
+            if (i + 1 == vChain.size() || it->second != vChain[i + 1]) {
+                queue.push_back(it->second);
+            }
+            range.first++;
+            mapBlocksUnlinked.erase(it);
+        }
+    }
+
+    chainActive.SetTip(pindexBase);
+    setBlockIndexCandidates.insert(pindexBase);
+
+    // Link the blocks we already have on top of the snapshot chain, as in ReceivedBlockTransactions.
+    while (!queue.empty()) {
+        CBlockIndex *pindex = queue.front();
+        queue.pop_front();
+        pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+        {
+            LOCK(cs_nBlockSequenceId);
+            pindex->nSequenceId = nBlockSequenceId++;
+        }
+        if (!setBlockIndexCandidates.value_comp()(pindex, chainActive.Tip())) {
+            setBlockIndexCandidates.insert(pindex);
+        }
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex);
+        while (range.first != range.second) {
+            std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first;
+            queue.push_back(it->second);
+            range.first++;
+            mapBlocksUnlinked.erase(it);
+        }
+    }
+    PruneBlockIndexCandidates();
+
+    fSnapshotChainstate = true;
+    if (!pblocktree->WriteFlag("snapshotchainstate", true)) {
+        return AbortNode(state, "Failed to write snapshot flag");
+    }
+    pcoinsTip->SetBestBlock(pindexBase->GetBlockHash());
+    if (!FlushStateToDisk(chainparams, state, FLUSH_STATE_ALWAYS)) {
+        return false;
+    }
+    if (pcoinsstats) {
+        pcoinsstats->Compute(pcoinsdbview.get());
+    }
+    UpdateTip(pindexBase, chainparams);
+
+    CheckBlockIndex(consensusParams);
+    return true;
+}
+
+bool ActivateSnapshot(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexBase, uint64_t nChainTx) {
+    return g_chainstate.ActivateSnapshot(state, chainparams, pindexBase, nChainTx);
+}
+
+bool LoadCoinsStats()
+{
+    LOCK(cs_main);
+    if (pcoinsTip->GetBestBlock() != pcoinsdbview->GetBestBlock()) {
+        FlushStateToDisk();
+    }
+    pcoinsstats.reset(new CIncrementalCoinsStats());
+    if (!pcoinsdbview->ReadCoinsStats(*pcoinsstats) || pcoinsstats->hashBlock != pcoinsdbview->GetBestBlock()) {
+        LogPrintf("Computing UTXO set statistics...\n");
+        int64_t nStart = GetTimeMillis();
+        if (!pcoinsstats->Compute(pcoinsdbview.get())) {
+            pcoinsstats.reset();
+            return false;
+        }
+        LogPrintf("Computed UTXO set statistics of %u outputs in %dms\n", pcoinsstats->nTransactionOutputs, GetTimeMillis() - nStart);
+    }
+    pcoinsdbview->TrackCoinsStats(pcoinsstats.get());
+    return true;
+}
+
+static CCriticalSection cs_compaction;
+static ChainstateCompactionStatus compactionStatus;
+
+void StartChainstateCompaction(const std::string& strReason)
+{
+    LOCK(cs_compaction);
+    LogPrint(BCLog::COINDB, "Starting chainstate compaction (%s)\n", strReason);
+    compactionStatus.fRunning = true;
+    compactionStatus.strReason = strReason;
+    compactionStatus.nSlicesDone = 0;
+    compactionStatus.nStartTime = GetTime();
+}
+
+ChainstateCompactionStatus GetChainstateCompactionStatus()
+{
+    LOCK(cs_compaction);
+    return compactionStatus;
+}
+
+void CompactChainstateSlice(int64_t nIntervalMillis)
+{
+    // Once a download which took place while we were running finishes, the
+    // database has just absorbed most of the UTXO set.
+    static bool fSawInitialBlockDownload = false;
+    if (fAutoCompactDB) {
+        if (IsInitialBlockDownload()) {
+            fSawInitialBlockDownload = true;
+        } else if (fSawInitialBlockDownload) {
+            fSawInitialBlockDownload = false;
+            StartChainstateCompaction("initial block download");
+        }
+    }
+
+    int nSlice;
+    {
+        LOCK(cs_compaction);
+        if (!compactionStatus.fRunning) return;
+        if (GetTimeMillis() - nTimeLastTipUpdate < nIntervalMillis) {
+            // Blocks are being connected; try again when it is quiet.
+            compactionStatus.nDeferred++;
+            return;
+        }
+        nSlice = compactionStatus.nSlicesDone;
+    }
+
+    // Compact the coins whose txid starts with a byte in [nFirst, nLast].
+    const int nFirst = 256 * nSlice / CHAINSTATE_COMPACTION_SLICES;
+    const int nLast = 256 * (nSlice + 1) / CHAINSTATE_COMPACTION_SLICES - 1;
+    uint256 hashBegin, hashEnd;
+    memset(hashEnd.begin(), 0xff, hashEnd.size());
+    *hashBegin.begin() = nFirst;
+    *hashEnd.begin() = nLast;
+    int64_t nStart = GetTimeMillis();
+    pcoinsdbview->CompactRange(COutPoint(hashBegin, 0), COutPoint(hashEnd, std::numeric_limits<uint32_t>::max()));
+    LogPrint(BCLog::COINDB, "Compacted chainstate slice %d/%d in %dms\n", nSlice + 1, CHAINSTATE_COMPACTION_SLICES, GetTimeMillis() - nStart);
+
+    LOCK(cs_compaction);
+    // Unless it was restarted in the meantime
+    if (compactionStatus.fRunning && compactionStatus.nSlicesDone == nSlice) {
+        if (++compactionStatus.nSlicesDone == CHAINSTATE_COMPACTION_SLICES) {
+            compactionStatus.fRunning = false;
+            compactionStatus.nLastCompletedTime = GetTime();
+            compactionStatus.nCompleted++;
+            LogPrintf("Compacted the chainstate in %ds (%s)\n", compactionStatus.nLastCompletedTime - compactionStatus.nStartTime, compactionStatus.strReason);
+        }
+    }
+}
+
 void CChainState::UnloadBlockIndex() {
     nBlockSequenceId = 1;
     g_failed_blocks.clear();
@@ -4166,12 +5905,14 @@ void UnloadBlockIndex()
 {
     LOCK(cs_main);
     chainActive.SetTip(nullptr);
+    PublishChainSnapshot();
     pindexBestInvalid = nullptr;
     pindexBestHeader = nullptr;
     mempool.clear();
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
+    g_blockfilemaps.SetFinalizedFiles(0);
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
     versionbitscache.Clear();
@@ -4179,15 +5920,37 @@ void UnloadBlockIndex()
         warningcache[b].clear();
     }
 
-    for (BlockMap::value_type& entry : mapBlockIndex) {
-        delete entry.second;
+    {
+        std::lock_guard<std::mutex> lock(g_block_index_lookup_mutex);
+        for (BlockMap::value_type& entry : mapBlockIndex) {
+            delete entry.second;
+        }
+        mapBlockIndex.clear();
     }
-    mapBlockIndex.clear();
     fHavePruned = false;
+    fSnapshotChainstate = false;
 
     g_chainstate.UnloadBlockIndex();
 }
 
+BlockIndexMemoryStats GetBlockIndexMemoryStats()
+{
+    LOCK(cs_main);
+    BlockIndexMemoryStats stats;
+    stats.nEntries = mapBlockIndex.size();
+    stats.nArenaBytes = CBlockIndex::ArenaUsage();
+    stats.nMapBytes = memusage::DynamicUsage(mapBlockIndex);
+    stats.nHeaderBytes = stats.nEntries * (sizeof(CBlockIndex::nVersion) + sizeof(CBlockIndex::hashMerkleRoot) +
+                                           sizeof(CBlockIndex::nTime) + sizeof(CBlockIndex::nBits) + sizeof(CBlockIndex::nNonce));
+    stats.nLinkBytes = stats.nEntries * (sizeof(CBlockIndex::phashBlock) + sizeof(CBlockIndex::pprev) + sizeof(CBlockIndex::pskip));
+    stats.nChainWorkBytes = stats.nEntries * sizeof(CBlockIndex::nChainWork);
+    // nFile and nStatus share a 32-bit word
+    stats.nPositionBytes = stats.nEntries * (sizeof(uint32_t) + sizeof(CBlockIndex::nDataPos) + sizeof(CBlockIndex::nUndoPos));
+    stats.nCounterBytes = stats.nEntries * (sizeof(CBlockIndex::nHeight) + sizeof(CBlockIndex::nTx) + sizeof(CBlockIndex::nChainTx) +
+                                            sizeof(CBlockIndex::nSequenceId) + sizeof(CBlockIndex::nTimeMax));
+    return stats;
+}
+
 bool LoadBlockIndex(const CChainParams& chainparams)
 {
     // Load block index from databases
@@ -4206,9 +5969,6 @@ bool LoadBlockIndex(const CChainParams& chainparams)
         // needs_init.
 
         LogPrintf("Initializing databases...\n");
-        // Use the provided setting for -txindex in the new database
-        fTxIndex = gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX);
-        pblocktree->WriteFlag("txindex", fTxIndex);
     }
     return true;
 }
@@ -4245,121 +6005,288 @@ bool LoadGenesisBlock(const CChainParams& chainparams)
     return g_chainstate.LoadGenesisBlock(chainparams);
 }
 
+namespace {
+/** Map of disk positions for blocks with unknown parent (only used for reindex) */
+std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+} // anon namespace
+
+/**
+ * Find the blocks in a block file and call fn with each of them and its
+ * position in the file, until the file ends or fn returns false. Errors in a
+ * block are logged and skipped; I/O errors of the file are thrown.
+ */
+static void ScanBlockFile(const CChainParams& chainparams, CBufferedFile& blkdat, const std::function<bool(const std::shared_ptr<CBlock>&, uint64_t)>& fn)
+{
+    uint64_t nRewind = blkdat.GetPos();
+    while (!blkdat.eof()) {
+        boost::this_thread::interruption_point();
+
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+            blkdat.FindByte(chainparams.MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            // of the block, or of its compressed record
+            const unsigned int nMinSize = (nSize & COMPRESSED_RECORD_FLAG) ? 4 : 80;
+            if ((nSize & ~COMPRESSED_RECORD_FLAG) < nMinSize || (nSize & ~COMPRESSED_RECORD_FLAG) > MAX_BLOCK_SERIALIZED_SIZE)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            break;
+        }
+        try {
+            // read block
+            uint64_t nBlockPos = blkdat.GetPos();
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            if (nSize & COMPRESSED_RECORD_FLAG) {
+                std::vector<unsigned char> compressed(nSize & ~COMPRESSED_RECORD_FLAG), data;
+                blkdat.SetLimit(nBlockPos + compressed.size());
+                blkdat.read((char*)compressed.data(), compressed.size());
+                nRewind = blkdat.GetPos();
+                if (!DecompressRecord(compressed.data(), compressed.size(), data))
+                    throw std::ios_base::failure("corrupt compressed record");
+                CSpanReader reader(SER_DISK, CLIENT_VERSION, data.data(), data.size());
+                reader >> *pblock;
+            } else {
+                blkdat.SetLimit(nBlockPos + nSize);
+                blkdat.SetPos(nBlockPos);
+                blkdat >> *pblock;
+                nRewind = blkdat.GetPos();
+            }
+
+            if (!fn(pblock, nBlockPos))
+                break;
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+    }
+}
+
+/**
+ * Accept a block read from a block file, or remember it until its parent is
+ * known, and then accept the remembered blocks it is the parent of.
+ * Returns false if importing the rest of the file should be given up.
+ */
+static bool ProcessExternalBlock(const CChainParams& chainparams, const std::shared_ptr<CBlock>& pblock, CDiskBlockPos* dbp, int& nLoaded)
+{
+    const CBlock& block = *pblock;
+
+    // detect out of order blocks, and store them for later
+    uint256 hash = block.GetHash();
+    if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                block.hashPrevBlock.ToString());
+        if (dbp)
+            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+        return true;
+    }
+
+    // process in case the block isn't known yet
+    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+        LOCK(cs_main);
+        CValidationState state;
+        if (g_chainstate.AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+        LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+    }
+
+    // Activate the genesis block so normal node progress can continue
+    if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            return false;
+        }
+    }
+
+    NotifyHeaderTip();
+
+    // Recursively process earlier encountered successors of this block
+    std::deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
+            if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
+            {
+                LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
+                        head.ToString());
+                LOCK(cs_main);
+                CValidationState dummy;
+                if (g_chainstate.AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
+                {
+                    nLoaded++;
+                    queue.push_back(pblockrecursive->GetHash());
+                }
+            }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+            NotifyHeaderTip();
+        }
+    }
+    return true;
+}
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
     int nLoaded = 0;
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
+        ScanBlockFile(chainparams, blkdat, [&](const std::shared_ptr<CBlock>& pblock, uint64_t nBlockPos) {
+            if (dbp)
+                dbp->nPos = nBlockPos;
+            return ProcessExternalBlock(chainparams, pblock, dbp, nLoaded);
+        });
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+    if (nLoaded > 0)
+        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    return nLoaded > 0;
+}
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
+namespace {
+/** The blocks of one block file, parsed and checked by a ReindexBlockFiles worker */
+struct ParsedBlockFile {
+    //! The file does not exist or cannot be opened; no later files are read
+    bool fMissing = false;
+    //! An I/O error that ended reading the file
+    std::string strError;
+    //! Position in the file and block
+    std::vector<std::pair<unsigned int, std::shared_ptr<CBlock>>> vBlocks;
+};
+} // anon namespace
+
+void ReindexBlockFiles(const CChainParams& chainparams, int nThreads)
+{
+    std::mutex cs;
+    std::condition_variable cond;
+    std::map<int, ParsedBlockFile> mapParsed;
+    int nNextFile = 0; // the next file a worker parses
+    int nEndFile = std::numeric_limits<int>::max(); // the first file found missing
+    int nImportingFile = 0; // the file whose blocks are being accepted
+    std::atomic<bool> fStop(false);
+
+    // Workers parse and check the files in order, at most nThreads files
+    // ahead of the import, which bounds the memory used by parsed blocks.
+    auto worker = [&]() {
+        while (true) {
+            int nFile;
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                cond.wait(lock, [&] { return fStop || nNextFile >= nEndFile || nNextFile <= nImportingFile + nThreads; });
+                if (fStop || nNextFile >= nEndFile)
+                    return;
+                nFile = nNextFile++;
             }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-                CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
 
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
+            ParsedBlockFile parsed;
+            CDiskBlockPos pos(nFile, 0);
+            FILE* file = fs::exists(GetBlockPosFilename(pos, "blk")) ? OpenBlockFile(pos, true) : nullptr;
+            if (!file) {
+                parsed.fMissing = true;
+            } else {
+                try {
+                    // This takes over file and calls fclose() on it in the CBufferedFile destructor
+                    CBufferedFile blkdat(file, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+                    ScanBlockFile(chainparams, blkdat, [&](const std::shared_ptr<CBlock>& pblock, uint64_t nBlockPos) {
+                        // Sets fChecked so that AcceptBlock does not check
+                        // the block again; a failure is reported by AcceptBlock.
+                        CValidationState state;
+                        CheckBlock(*pblock, state, chainparams.GetConsensus());
+                        parsed.vBlocks.emplace_back(nBlockPos, pblock);
+                        return !fStop;
+                    });
+                } catch (const std::runtime_error& e) {
+                    parsed.strError = e.what();
                 }
+            }
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    LOCK(cs_main);
-                    CValidationState state;
-                    if (g_chainstate.AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+            {
+                std::lock_guard<std::mutex> lock(cs);
+                if (parsed.fMissing)
+                    nEndFile = std::min(nEndFile, nFile);
+                mapParsed.emplace(nFile, std::move(parsed));
+            }
+            cond.notify_all();
+        }
+    };
 
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
-                        break;
-                    }
-                }
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nThreads; i++) {
+        threads.emplace_back(worker);
+    }
+    auto stop_workers = [&]() {
+        fStop = true;
+        cond.notify_all();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    };
 
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                std::deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
-                        if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (g_chainstate.AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
-                            {
-                                nLoaded++;
-                                queue.push_back(pblockrecursive->GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
-                    }
+    try {
+        for (int nFile = 0; ; nFile++) {
+            ParsedBlockFile parsed;
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                nImportingFile = nFile;
+                cond.notify_all();
+                while (!mapParsed.count(nFile)) {
+                    cond.wait_for(lock, std::chrono::milliseconds(100));
+                    boost::this_thread::interruption_point();
+                }
+                parsed = std::move(mapParsed[nFile]);
+                mapParsed.erase(nFile);
+            }
+            if (parsed.fMissing)
+                break; // No block files left to reindex
+
+            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
+            int64_t nStart = GetTimeMillis();
+            int nLoaded = 0;
+            for (auto& entry : parsed.vBlocks) {
+                boost::this_thread::interruption_point();
+                CDiskBlockPos pos(nFile, entry.first);
+                try {
+                    if (!ProcessExternalBlock(chainparams, entry.second, &pos, nLoaded))
+                        break;
+                } catch (const std::runtime_error& e) {
+                    parsed.strError = e.what();
+                    break;
+                } catch (const std::exception& e) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                // Free the block now rather than with the whole file
+                entry.second.reset();
             }
+            if (!parsed.strError.empty())
+                AbortNode(std::string("System error: ") + parsed.strError);
+            if (nLoaded > 0)
+                LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
         }
-    } catch (const std::runtime_error& e) {
-        AbortNode(std::string("System error: ") + e.what());
+    } catch (...) {
+        stop_workers();
+        throw;
     }
-    if (nLoaded > 0)
-        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
-    return nLoaded > 0;
+    stop_workers();
 }
 
 void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
@@ -4422,7 +6349,7 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
         if (pindex->nChainTx == 0) assert(pindex->nSequenceId <= 0);  // nSequenceId can't be set positive for blocks that aren't linked (negative is used for preciousblock)
         // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
         // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
-        if (!fHavePruned) {
+        if (!fHavePruned && !fSnapshotChainstate) {
             // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
             assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
             assert(pindexFirstMissing == pindexFirstNeverProcessed);
@@ -4481,7 +6408,7 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
         if (pindexFirstMissing == nullptr) assert(!foundInUnlinked); // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
         if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == nullptr && pindexFirstMissing != nullptr) {
             // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
-            assert(fHavePruned); // We must have pruned.
+            assert(fHavePruned || fSnapshotChainstate); // We must have pruned, or started from a snapshot.
             // This block may have entered mapBlocksUnlinked if:
             //  - it has a descendant that at some point had more work than the
             //    tip, and
@@ -4577,6 +6504,46 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params& params, Consensus::D
 }
 
 static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+//! Number of transactions from mempool.dat whose scripts are checked together
+static const size_t MEMPOOL_LOAD_BATCH_SIZE = 100;
+
+/**
+ * Verify the scripts of transactions about to be loaded or added back into the
+ * mempool on the mempool script checking threads, so that the signatures are in
+ * the signature cache by the time AcceptToMemoryPool checks them one by one. The
+ * transactions are expected parents before children; those
+ * with inputs that cannot be found are left to AcceptToMemoryPool to reject,
+ * as are invalid scripts.
+ */
+static void PrecheckMempoolScripts(const std::vector<CTransactionRef>& vtx)
+{
+    AssertLockHeld(cs_main);
+    if (nScriptCheckThreads == 0 || vtx.empty()) {
+        return;
+    }
+
+    CCoinsViewMemPool viewMemPool(pcoinsTip.get(), mempool);
+    CCoinsViewCache view(&viewMemPool);
+    // The checks keep pointers to the precomputed data
+    std::deque<PrecomputedTransactionData> txdata;
+    std::vector<CScriptCheck> vChecks;
+    CCheckQueueControl<CScriptCheck> control(&mempoolcheckqueue);
+    for (const CTransactionRef& tx : vtx) {
+        if (tx->IsCoinBase() || !view.HaveInputs(*tx)) {
+            continue;
+        }
+        txdata.emplace_back(*tx);
+        CValidationState state;
+        if (CheckInputs(*tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, false, txdata.back(), &vChecks)) {
+            control.Add(vChecks);
+        }
+        vChecks.clear();
+        // Children later in the batch spend these outputs
+        AddCoins(view, *tx, MEMPOOL_HEIGHT);
+    }
+    // Failures are reported by AcceptToMemoryPool
+    control.Wait();
+}
 
 bool LoadMempool(void)
 {
@@ -4594,6 +6561,7 @@ bool LoadMempool(void)
     int64_t failed = 0;
     int64_t already_there = 0;
     int64_t nNow = GetTime();
+    int64_t nTimeStart = GetTimeMicros();
 
     try {
         uint64_t version;
@@ -4603,22 +6571,39 @@ bool LoadMempool(void)
         }
         uint64_t num;
         file >> num;
-        while (num--) {
-            CTransactionRef tx;
-            int64_t nTime;
-            int64_t nFeeDelta;
-            file >> tx;
-            file >> nTime;
-            file >> nFeeDelta;
-
-            CAmount amountdelta = nFeeDelta;
-            if (amountdelta) {
-                mempool.PrioritiseTransaction(tx->GetHash(), amountdelta);
+        std::vector<CTransactionRef> vtx;
+        std::vector<int64_t> vTime;
+        while (num) {
+            // Read a batch of unexpired transactions
+            vtx.clear();
+            vTime.clear();
+            while (num && vtx.size() < MEMPOOL_LOAD_BATCH_SIZE) {
+                num--;
+                CTransactionRef tx;
+                int64_t nTime;
+                int64_t nFeeDelta;
+                file >> tx;
+                file >> nTime;
+                file >> nFeeDelta;
+
+                CAmount amountdelta = nFeeDelta;
+                if (amountdelta) {
+                    mempool.PrioritiseTransaction(tx->GetHash(), amountdelta);
+                }
+                if (nTime + nExpiryTimeout > nNow) {
+                    vtx.push_back(std::move(tx));
+                    vTime.push_back(nTime);
+                } else {
+                    ++expired;
+                }
             }
-            CValidationState state;
-            if (nTime + nExpiryTimeout > nNow) {
-                LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(chainparams, mempool, state, tx, nullptr /* pfMissingInputs */, nTime,
+
+            LOCK(cs_main);
+            PrecheckMempoolScripts(vtx);
+            for (size_t i = 0; i < vtx.size(); i++) {
+                const CTransactionRef& tx = vtx[i];
+                CValidationState state;
+                AcceptToMemoryPoolWithTime(chainparams, mempool, state, tx, nullptr /* pfMissingInputs */, vTime[i],
                                            nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */);
                 if (state.IsValid()) {
                     ++count;
@@ -4633,8 +6618,6 @@ bool LoadMempool(void)
                         ++failed;
                     }
                 }
-            } else {
-                ++expired;
             }
             if (ShutdownRequested())
                 return false;
@@ -4650,7 +6633,7 @@ bool LoadMempool(void)
         return false;
     }
 
-    LogPrintf("Imported mempool transactions from disk: %i succeeded, %i failed, %i expired, %i already there\n", count, failed, expired, already_there);
+    LogPrintf("Imported mempool transactions from disk: %i succeeded, %i failed, %i expired, %i already there, %.2fs\n", count, failed, expired, already_there, (GetTimeMicros() - nTimeStart) * MICRO);
     return true;
 }
 
@@ -4703,6 +6686,101 @@ bool DumpMempool(void)
     return true;
 }
 
+static const uint64_t COINS_CACHE_DUMP_VERSION = 1;
+//! Number of coins from coinscache.dat read from the database together
+static const size_t COINS_CACHE_LOAD_BATCH_SIZE = 1000;
+
+bool LoadCoinsCache(void)
+{
+    FILE* filestr = fsbridge::fopen(GetDataDir() / "coinscache.dat", "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open coins cache file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t count = 0;
+    int64_t nTimeStart = GetTimeMicros();
+    // Leave room for the coins of the first blocks
+    const size_t nMaxUsage = nCoinCacheUsage / 10 * 9;
+
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != COINS_CACHE_DUMP_VERSION) {
+            return false;
+        }
+        uint64_t num;
+        file >> num;
+        std::vector<COutPoint> outpoints;
+        while (num) {
+            // Read a batch of outpoints, and look them up without holding
+            // cs_main for longer than a batch
+            outpoints.clear();
+            while (num && outpoints.size() < COINS_CACHE_LOAD_BATCH_SIZE) {
+                num--;
+                COutPoint outpoint;
+                file >> outpoint;
+                outpoints.push_back(outpoint);
+            }
+
+            LOCK(cs_main);
+            if (pcoinsTip->DynamicMemoryUsage() >= nMaxUsage) {
+                break;
+            }
+            count += pcoinsTip->FetchCoins(outpoints);
+            if (ShutdownRequested())
+                return false;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize coins cache data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Imported coins cache from disk: %i coins, %.2fs\n", count, (GetTimeMicros() - nTimeStart) * MICRO);
+    return true;
+}
+
+bool DumpCoinsCache(void)
+{
+    int64_t start = GetTimeMicros();
+
+    std::vector<COutPoint> outpoints;
+    {
+        LOCK(cs_main);
+        outpoints = pcoinsTip->GetCachedOutpoints();
+    }
+
+    int64_t mid = GetTimeMicros();
+
+    try {
+        FILE* filestr = fsbridge::fopen(GetDataDir() / "coinscache.dat.new", "wb");
+        if (!filestr) {
+            return false;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = COINS_CACHE_DUMP_VERSION;
+        file << version;
+
+        file << (uint64_t)outpoints.size();
+        for (const COutPoint& outpoint : outpoints) {
+            file << outpoint;
+        }
+
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / "coinscache.dat.new", GetDataDir() / "coinscache.dat");
+        int64_t last = GetTimeMicros();
+        LogPrintf("Dumped coins cache: %u coins, %gs to copy, %gs to dump\n", outpoints.size(), (mid-start)*MICRO, (last-mid)*MICRO);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump coins cache: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    return true;
+}
+
 //! Guess how far we are in the verification process at the given block index
 double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pindex) {
     if (pindex == nullptr)
@@ -15,6 +15,7 @@
 #include <fs.h>
 #include <protocol.h> // For CMessageHeader::MessageStartChars
 #include <policy/feerate.h>
+#include <primitives/block.h>
 #include <script/script_error.h>
 #include <sync.h>
 #include <versionbits.h>
@@ -31,16 +32,24 @@
 
 #include <atomic>
 
+class CBlockFileMapCache;
+class CBlockFileUnlinker;
+class CBlockFileWriter;
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CChainParams;
-class CCoinsViewDB;
+class CChainSnapshot;
+class CCoinsViewStore;
+class CCoinsViewPrefetch;
+class CIncrementalCoinsStats;
 class CInv;
 class CConnman;
 class CScriptCheck;
 class CBlockPolicyEstimator;
 class CTxMemPool;
 class CValidationState;
+struct CDiskTxPos;
 struct ChainTxData;
 
 struct PrecomputedTransactionData;
@@ -81,8 +90,44 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Default for -parworksteal, scheduling script checks over per-thread deques with work stealing */
+static const bool DEFAULT_SCRIPTCHECK_WORK_STEALING = false;
+/** Default for -parpin, pinning each script checking thread to a CPU of its own */
+static const bool DEFAULT_SCRIPTCHECK_PINNING = false;
+/** Default for -parblockhash, computing the transaction hashes of received and loaded blocks on the script-checking threads */
+static const bool DEFAULT_PARALLEL_BLOCK_HASHING = false;
+/** Default for -parheaders, hashing received headers and checking their proof of work on threads of their own before taking cs_main */
+static const bool DEFAULT_PARALLEL_HEADER_CHECKS = false;
+/** Headers messages with fewer headers are checked on the calling thread */
+static const size_t MIN_PARALLEL_HEADERS = 16;
+/** Default for -parverifydb, reading and checking the blocks verified at startup on threads of their own */
+static const bool DEFAULT_PARALLEL_VERIFYDB = false;
+/** Default for -parreorg, reading the blocks and undo data of a reorganization at once and disconnecting them into one coins cache layer */
+static const bool DEFAULT_PARALLEL_REORG = false;
+/** Default for -parmempool, verifying the scripts of transactions entering the mempool on script-checking threads of their own */
+static const bool DEFAULT_PARALLEL_MEMPOOL_CHECKS = false;
+/** Transactions entering the mempool with fewer inputs have their scripts verified on the calling thread */
+static const unsigned int MIN_PARALLEL_MEMPOOL_INPUTS = 4;
+/** Default for -parpipeline, the number of consecutive blocks whose script checks may overlap during initial block download (0 = disabled) */
+static const unsigned int DEFAULT_SCRIPTCHECK_PIPELINE_BLOCKS = 0;
+/** Maximum for -parpipeline */
+static const unsigned int MAX_SCRIPTCHECK_PIPELINE_BLOCKS = 16;
+/** -parprefetch default (number of threads fetching block inputs ahead of connecting them, 0 = disabled) */
+static const int DEFAULT_PREFETCH_THREADS = 0;
+/** Maximum number of input prefetching threads allowed */
+static const int MAX_PREFETCH_THREADS = 32;
+/** -reindexthreads default (number of threads parsing block files during -reindex, 0 = parse them on the import thread) */
+static const int DEFAULT_REINDEX_THREADS = 0;
+/** Maximum number of block file parsing threads allowed */
+static const int MAX_REINDEX_THREADS = 16;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Fewest and most blocks in transit to a single peer during initial block download, once
+ *  its download speed has been measured (MAX_BLOCKS_IN_TRANSIT_PER_PEER is used until then). */
+static const int MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 64;
+/** Seconds of a peer's measured block download time to keep requested from it. */
+static const int BLOCK_DOWNLOAD_QUEUE_TIME = 8;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -131,9 +176,45 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+/** Default for -dbpartialflush, writing the coins cache without emptying it */
+static const bool DEFAULT_PARTIAL_COINS_FLUSH = false;
+/** Default for -dbcachereclaim, giving the mempool back the space lent to the coins cache gradually after initial block download */
+static const bool DEFAULT_COINS_CACHE_RECLAIM = false;
+/** Time (in seconds) over which -dbcachereclaim gives all of -maxmempool back to the mempool */
+static const int64_t COINS_CACHE_RECLAIM_TIME = 10 * 60;
+/** Default for -hugepages, how the chunks of the coins cache and block index are backed (see support/largepages.h) */
+static const char* const DEFAULT_HUGEPAGES = "none";
+/** Default for -numapolicy, where the chunks in huge pages are placed */
+static const char* const DEFAULT_NUMA_POLICY = "default";
+/** Default for -ibdsyncinterval, the blocks between durable checkpoints of initial block download, which skips fsyncs in between (0 = never skip them) */
+static const int DEFAULT_IBD_SYNC_INTERVAL = 0;
+/** Default for -hotblockfiles, the most recent block files -coldblocksdir leaves in the blocks directory */
+static const int DEFAULT_HOT_BLOCK_FILES = 8;
+/** Milliseconds between moves of a block file to -coldblocksdir */
+static const int64_t COLD_BLOCK_FILES_INTERVAL = 5000;
+/** Default for -coinstats, maintaining UTXO set statistics with every block */
+static const bool DEFAULT_COINSTATS = false;
+/** Default for -autocompactdb, compacting the chainstate after IBD and large reorganizations */
+static const bool DEFAULT_AUTOCOMPACTDB = true;
+/** Default for -compactdbinterval, the milliseconds between compacting two slices of the chainstate */
+static const int64_t DEFAULT_COMPACTDB_INTERVAL = 2000;
+/** Number of key ranges a chainstate compaction is split into */
+static const int CHAINSTATE_COMPACTION_SLICES = 64;
+/** Reorganizations disconnecting at least this many blocks start a compaction (with -autocompactdb) */
+static const int COMPACTDB_REORG_DEPTH = 6;
+/** Default for -blockmmap, the MiB of address space for mapping finalized block files (0 reads them with fread) */
+static const int64_t DEFAULT_BLOCK_MMAP_SIZE = 0;
+/** Default for -blockwritequeue, the MiB of block and undo data queued for the block writer thread (0 writes on the validation thread) */
+static const int64_t DEFAULT_BLOCK_WRITE_QUEUE = 32;
+/** Default for -blockcompression, compressing the blocks and undo data written to the blk and rev files */
+static const bool DEFAULT_BLOCK_COMPRESSION = false;
+/** Default for -prunebackground, deleting pruned block files on a thread of their own */
+static const bool DEFAULT_PRUNE_BACKGROUND = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -persistcoinscache */
+static const bool DEFAULT_PERSIST_COINS_CACHE = false;
 /** Default for -mempoolreplacement */
 static const bool DEFAULT_ENABLE_REPLACEMENT = true;
 /** Default for using fee filter */
@@ -159,7 +240,14 @@ extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CBlockPolicyEstimator feeEstimator;
 extern CTxMemPool mempool;
-typedef std::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
+/**
+ * The nodes of mapBlockIndex are drawn from a PoolResource, like those of a
+ * CCoinsMap, instead of being allocated one by one.
+ */
+typedef std::unordered_map<uint256, CBlockIndex*, BlockHasher, std::equal_to<uint256>,
+                           PoolAllocator<std::pair<const uint256, CBlockIndex*>,
+                                         sizeof(std::pair<const uint256, CBlockIndex*>) + sizeof(void*) * 4>> BlockMap;
+typedef BlockMap::allocator_type::ResourceType BlockMapMemoryResource;
 extern BlockMap& mapBlockIndex;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockWeight;
@@ -170,12 +258,34 @@ extern uint256 hashBestBlock;
 extern std::atomic_bool fImporting;
 extern std::atomic_bool fReindex;
 extern int nScriptCheckThreads;
-extern bool fTxIndex;
+extern bool fPinScriptCheckThreads;
+extern bool fParallelBlockHashing;
+extern bool fParallelMempoolChecks;
+extern bool fParallelHeaderChecks;
+extern bool fParallelVerifyDB;
+extern bool fParallelReorg;
+extern unsigned int nScriptCheckPipelineBlocks;
+extern int nPrefetchThreads;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
+extern bool fPartialCoinsFlush;
+extern bool fCoinsCacheReclaim;
+extern int nIBDSyncInterval;
+/** The height up to which all writes are known to be durable, while -ibdsyncinterval defers them, or -1 */
+extern int nSyncCheckpointHeight;
+extern int nHotBlockFiles;
+extern bool fAutoCompactDB;
+/** Memory mappings of the finalized block files used by ReadBlockFromDisk (see -blockmmap) */
+extern CBlockFileMapCache g_blockfilemaps;
+/** Writes the blk and rev files in the background (see -blockwritequeue) */
+extern CBlockFileWriter g_blockfilewriter;
+/** Deletes pruned blk and rev files in the background (see -prunebackground) */
+extern CBlockFileUnlinker g_blockfileunlinker;
+/** Whether blocks and undo data are compressed as they are written (see blockcompression.h) */
+extern bool fBlockCompression;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
 /** Absolute maximum transaction fee (in satoshis) used by wallet and mempool (rejects high fee in sendrawtransaction) */
@@ -201,10 +311,14 @@ static const uint64_t nMinDiskSpace = 52428800;
 extern bool fHavePruned;
 /** True if we're running in -prune mode. */
 extern bool fPruneMode;
+/** True if the chainstate was loaded from a UTXO snapshot, so blocks below its base may be missing. */
+extern bool fSnapshotChainstate;
 /** Number of MiB of block files that we're trying to stay below. */
 extern uint64_t nPruneTarget;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
 static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
+/** Number of most recent blocks pruning keeps, and serves to peers (see -prunekeepblocks); at least MIN_BLOCKS_TO_KEEP */
+extern unsigned int nPruneKeepBlocks;
 /** Minimum blocks required to signal NODE_NETWORK_LIMITED */
 static const unsigned int NODE_NETWORK_LIMITED_MIN_BLOCKS = 288;
 
@@ -255,14 +369,20 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
  */
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex=nullptr, CBlockHeader *first_invalid=nullptr);
 
-/** Check whether enough disk space is available for an incoming block */
-bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
+/** Check whether enough disk space is available, in the data directory or, for an incoming block, in the blocks directory */
+bool CheckDiskSpace(uint64_t nAdditionalBytes = 0, bool fBlocksDir = false);
 /** Open a block file (blk?????.dat) */
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
-/** Translation to a filesystem path */
+/** Translation to a filesystem path, in the blocks directory or in -coldblocksdir if the file was moved there */
 fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
+/** Find the block files moved to -coldblocksdir, finishing or undoing a move interrupted by a crash */
+void LoadColdBlockFiles();
+/** Move the oldest block file, and its undo file, that -hotblockfiles no longer keeps to -coldblocksdir */
+void MoveColdBlockFiles();
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = nullptr);
+/** Import the blocks of all block files for -reindex, parsing and checking the blocks of up to nThreads files concurrently */
+void ReindexBlockFiles(const CChainParams& chainparams, int nThreads);
 /** Ensures we have a genesis block in the block tree, possibly writing one to disk. */
 bool LoadGenesisBlock(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk,
@@ -272,12 +392,45 @@ bool LoadBlockIndex(const CChainParams& chainparams);
 bool LoadChainTip(const CChainParams& chainparams);
 /** Unload database information */
 void UnloadBlockIndex();
+
+/** Memory used by the block index, in bytes */
+struct BlockIndexMemoryStats
+{
+    size_t nEntries = 0;
+    //! Chunks the CBlockIndex entries are carved from
+    size_t nArenaBytes = 0;
+    //! mapBlockIndex, including the hash of each entry
+    size_t nMapBytes = 0;
+    //! Share of the entries taken by each group of CBlockIndex members
+    size_t nHeaderBytes = 0;
+    size_t nLinkBytes = 0;
+    size_t nChainWorkBytes = 0;
+    size_t nPositionBytes = 0;
+    size_t nCounterBytes = 0;
+};
+BlockIndexMemoryStats GetBlockIndexMemoryStats();
+/** Select the script check scheduler; must be called before any script checking thread is started */
+void SetScriptCheckWorkStealing(bool fWorkStealing);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the transaction hashing thread */
+void ThreadTxHashCheck();
+/** Run an instance of the header checking thread */
+void ThreadHeaderCheck();
+/** Run an instance of the startup block verification thread */
+void ThreadVerifyDBCheck();
+/** Run an instance of the reorganization block reading thread */
+void ThreadReorgReadCheck();
+/** Run an instance of the mempool script checking thread */
+void ThreadMempoolScriptCheck();
+/** Run an instance of the input prefetching thread */
+void ThreadPrefetchCheck();
+/** Warm pcoinsprefetch with the coins spent by block, using the prefetching threads (does not require cs_main) */
+void PrefetchBlockInputs(const CBlock& block);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
-bool GetTransaction(const uint256& hash, CTransactionRef& tx, const Consensus::Params& params, uint256& hashBlock, bool fAllowSlow = false, CBlockIndex* blockIndex = nullptr);
+bool GetTransaction(const uint256& hash, CTransactionRef& tx, const Consensus::Params& params, uint256& hashBlock, bool fAllowSlow = false, const CBlockIndex* blockIndex = nullptr);
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams, std::shared_ptr<const CBlock> pblock = std::shared_ptr<const CBlock>());
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
@@ -292,11 +445,15 @@ uint64_t CalculateCurrentUsage();
  *  Mark one block file as pruned.
  */
 void PruneOneBlockFile(const int fileNumber);
+/** Prune the block files in setFiles, like PruneOneBlockFile for each of them but in a single pass over the block index */
+void PruneBlockFiles(const std::set<int>& setFiles);
 
 /**
  *  Actually unlink the specified files
  */
 void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune);
+/** Delete the blk and rev files of pruned block files that a shutdown left behind */
+void UnlinkLeftoverPrunedFiles();
 
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
@@ -311,6 +468,19 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced,
                         bool bypass_limits, const CAmount nAbsurdFee);
 
+/** Maximum number of transactions in a package passed to AcceptPackageToMemoryPool */
+static const unsigned int MAX_PACKAGE_COUNT = 25;
+
+/**
+ * (try to) add a package of transactions to the memory pool, each one after the
+ * ones it spends. The mempool minimum fee is checked against the fee rate of the
+ * package as a whole rather than each transaction, so a child can pay for a
+ * parent whose own fee is too low. If one of them is rejected, the ones added
+ * before it are removed again.
+ */
+bool AcceptPackageToMemoryPool(CTxMemPool& pool, CValidationState& state, const std::vector<CTransactionRef>& package,
+                               std::list<CTransactionRef>* plTxnReplaced);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -394,10 +564,55 @@ public:
 /** Initializes the script-execution cache */
 void InitScriptExecutionCache();
 
+struct ScriptExecutionCacheStats {
+    size_t nMaxElements;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+    //! Inserts that pushed an entry out of the cache
+    uint64_t nEvictions;
+    //! Block transactions whose scripts were skipped because the mempool had verified them
+    uint64_t nMempoolHits;
+};
+
+ScriptExecutionCacheStats GetScriptExecutionCacheStats();
+
+
+/**
+ * Construct the block transactions from their deserialized mutable form,
+ * computing their txids and wtxids on the transaction hashing threads.
+ */
+void BuildBlockTransactions(std::vector<CMutableTransaction>& mtxs, std::vector<CTransactionRef>& vtx);
+
+/**
+ * Deserialize a block. With -parblockhash, the transactions are first read as
+ * CMutableTransactions so that their hashes can be computed in parallel rather
+ * than serially while each CTransaction is constructed.
+ */
+template <typename Stream>
+void UnserializeBlock(Stream& s, CBlock& block)
+{
+    if (!fParallelBlockHashing || nScriptCheckThreads == 0) {
+        s >> block;
+        return;
+    }
+    block.SetNull();
+    s >> *static_cast<CBlockHeader*>(&block);
+    std::vector<CMutableTransaction> mtxs;
+    s >> mtxs;
+    BuildBlockTransactions(mtxs, block.vtx);
+}
 
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read a block as it is serialized on disk, with witnesses, without deserializing it */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
+/** Read the undo data of a block, that is the outputs it spends */
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
+/** Read the transaction at postx (see the transaction index) and the header of its block */
+bool ReadTxFromDisk(const CDiskTxPos& postx, CBlockHeader& header, CTransactionRef& tx);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -445,8 +660,37 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain& chainActive;
 
+/**
+ * A snapshot of chainActive, published whenever its tip changes. Unlike
+ * chainActive it can be read without cs_main, so that readers need not wait
+ * for cs_main, which is held while blocks are connected.
+ */
+std::shared_ptr<const CChainSnapshot> GetChainSnapshot();
+
+/** The height of the tip of the latest snapshot, without loading it */
+int GetChainSnapshotHeight();
+
+/**
+ * The number of snapshots published whose chain does not extend the one
+ * before, that is, which had blocks disconnected. A block found in a
+ * snapshot is in every later one until this changes. Read it after
+ * GetChainSnapshotHeight, and before GetChainSnapshot, to see the chain the
+ * height or snapshot came from.
+ */
+uint64_t GetChainRewindCount();
+
+/**
+ * Find a block index entry without cs_main; returns nullptr if unknown.
+ * Without cs_main, only the fields CChainSnapshot relies on, and nChainWork,
+ * may be read from the result.
+ */
+const CBlockIndex* LookupBlockIndexNoLock(const uint256& hash);
+
 /** Global variable that points to the coins database (protected by cs_main) */
-extern std::unique_ptr<CCoinsViewDB> pcoinsdbview;
+extern std::unique_ptr<CCoinsViewStore> pcoinsdbview;
+
+/** Global variable that points to the prefetching layer below pcoinsTip, if -parprefetch is enabled (set at startup only) */
+extern std::unique_ptr<CCoinsViewPrefetch> pcoinsprefetch;
 
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
@@ -454,6 +698,35 @@ extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern std::unique_ptr<CBlockTreeDB> pblocktree;
 
+/** Global variable that points to the UTXO set statistics of pcoinsTip, if -coinstats is enabled (protected by cs_main) */
+extern std::unique_ptr<CIncrementalCoinsStats> pcoinsstats;
+
+/** Start maintaining pcoinsstats, computing them from the database if the stored ones are missing or stale */
+bool LoadCoinsStats();
+
+/** Progress of the background chainstate compaction */
+struct ChainstateCompactionStatus {
+    bool fRunning = false;
+    std::string strReason;
+    int nSlicesDone = 0;
+    int64_t nStartTime = 0;
+    int64_t nLastCompletedTime = 0;
+    uint64_t nCompleted = 0;
+    //! Scheduler runs which skipped a slice because the tip had just changed
+    uint64_t nDeferred = 0;
+};
+
+/** Start compacting the chainstate in the background, from the first slice again if one is in progress */
+void StartChainstateCompaction(const std::string& strReason);
+ChainstateCompactionStatus GetChainstateCompactionStatus();
+/**
+ * Compact the next slice of the chainstate, unless the tip changed within the
+ * last nIntervalMillis. Meant to be run by the scheduler every nIntervalMillis;
+ * does not take cs_main while compacting. With fAutoCompactDB it also starts a
+ * compaction once the initial block download it saw has finished.
+ */
+void CompactChainstateSlice(int64_t nIntervalMillis);
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
@@ -485,4 +758,48 @@ bool DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool();
 
+/** Write the outpoints of the coins in pcoinsTip to disk, to warm it with on restart. */
+bool DumpCoinsCache();
+
+/** Load the coins written by DumpCoinsCache into pcoinsTip, as far as -dbcache allows. */
+bool LoadCoinsCache();
+
+static const uint64_t SNAPSHOT_VERSION = 1;
+
+/**
+ * Header of a UTXO snapshot file, as written by the dumptxoutset RPC. It is
+ * followed by coins_count (COutPoint, Coin) pairs in chainstate database
+ * order, so that the outputs of a transaction are adjacent.
+ */
+class SnapshotMetadata
+{
+public:
+    uint64_t version = SNAPSHOT_VERSION;
+    //! Block hash of the chain tip the coins belong to
+    uint256 base_blockhash;
+    uint64_t coins_count = 0;
+    //! Number of transactions in the chain up to and including the base block
+    uint64_t nchaintx = 0;
+    //! hash_serialized_2 of gettxoutsetinfo at the base block
+    uint256 hash_serialized;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(version);
+        READWRITE(base_blockhash);
+        READWRITE(coins_count);
+        READWRITE(nchaintx);
+        READWRITE(hash_serialized);
+    }
+};
+
+/**
+ * Make pindexBase the chain tip after the coins of a UTXO snapshot of it have
+ * been added to pcoinsTip. The blocks below it are marked as validated without
+ * their data, as on a pruned node. Requires cs_main.
+ */
+bool ActivateSnapshot(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexBase, uint64_t nChainTx);
+
 #endif // BITCOIN_VALIDATION_H
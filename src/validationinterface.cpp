@@ -13,33 +13,181 @@
 #include <util.h>
 #include <validation.h>
 
-#include <list>
 #include <atomic>
 #include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
 
-#include <boost/signals2/signal.hpp>
+/** Number of listeners that can be registered at once */
+static const int MAX_VALIDATION_LISTENERS = 128;
+
+/**
+ * A listener registered with its own queue: its background callbacks run in
+ * order with respect to each other, but independently of those of the other
+ * listeners, so that a slow listener does not hold the others back and the
+ * listeners can be notified on as many threads as the scheduler has.
+ */
+struct QueuedListener {
+    CValidationInterface* const pcallbacks;
+    SingleThreadedSchedulerClient m_schedulerClient;
+    //! Held while a callback runs, so that unregistering waits for it
+    std::mutex cs;
+    std::atomic<bool> fActive;
+
+    QueuedListener(CValidationInterface* pcallbacksIn, CScheduler* pscheduler) : pcallbacks(pcallbacksIn), m_schedulerClient(pscheduler), fActive(true) {}
+
+    void AddToProcessQueue(std::function<void (CValidationInterface&)> func) {
+        m_schedulerClient.AddToProcessQueue([this, func] {
+            std::lock_guard<std::mutex> lock(cs);
+            if (fActive) func(*pcallbacks);
+        });
+    }
+};
+
+/**
+ * A registered listener. Notifications walk the slots without taking a lock
+ * or allocating; a call through a slot is counted, so that unregistering the
+ * listener can wait for the calls in progress before it returns.
+ */
+struct ListenerSlot {
+    std::atomic<CValidationInterface*> pcallbacks{nullptr};
+    //! The queue of the listener, if it has its own
+    std::atomic<QueuedListener*> pqueued{nullptr};
+    std::atomic<int> nCalls{0};
+};
 
 struct MainSignalsInstance {
-    boost::signals2::signal<void (const CBlockIndex *, const CBlockIndex *, bool fInitialDownload)> UpdatedBlockTip;
-    boost::signals2::signal<void (const CTransactionRef &)> TransactionAddedToMempool;
-    boost::signals2::signal<void (const std::shared_ptr<const CBlock> &, const CBlockIndex *pindex, const std::vector<CTransactionRef>&)> BlockConnected;
-    boost::signals2::signal<void (const std::shared_ptr<const CBlock> &)> BlockDisconnected;
-    boost::signals2::signal<void (const CTransactionRef &)> TransactionRemovedFromMempool;
-    boost::signals2::signal<void (const CBlockLocator &)> SetBestChain;
-    boost::signals2::signal<void (int64_t nBestBlockTime, CConnman* connman)> Broadcast;
-    boost::signals2::signal<void (const CBlock&, const CValidationState&)> BlockChecked;
-    boost::signals2::signal<void (const CBlockIndex *, const std::shared_ptr<const CBlock>&)> NewPoWValidBlock;
+    ListenerSlot m_slots[MAX_VALIDATION_LISTENERS];
+    //! Slots at this index and above have never been used
+    std::atomic<int> m_slots_used{0};
+    //! Listeners notified on the shared queue
+    std::atomic<int> m_shared_listeners{0};
 
     // We are not allowed to assume the scheduler only runs in one thread,
     // but must ensure all callbacks happen in-order, so we end up creating
     // our own queue here :(
     SingleThreadedSchedulerClient m_schedulerClient;
+    CScheduler* m_pscheduler;
+
+    // Serializes registering and unregistering. The queues of listeners are
+    // never freed, only deactivated, as callbacks still queued refer to them.
+    std::mutex m_cs_listeners;
+    std::vector<std::unique_ptr<QueuedListener>> m_queued_listeners;
+
+    // Held while queueing notifications, so that all queues get them in the
+    // same order. Mempool notifications are collected in m_mempool_batch and
+    // queued together, when a scheduler thread gets to them or before the
+    // next other notification, whichever comes first.
+    std::mutex m_cs_queue;
+    std::vector<MempoolUpdate> m_mempool_batch;
+
+    explicit MainSignalsInstance(CScheduler *pscheduler) : m_schedulerClient(pscheduler), m_pscheduler(pscheduler) {}
+
+    /** Call f(callbacks, pqueued) for each registered listener */
+    template <typename Callable>
+    void ForEachListener(Callable f) {
+        int nUsed = m_slots_used.load();
+        for (int i = 0; i < nUsed; i++) {
+            ListenerSlot& slot = m_slots[i];
+            slot.nCalls++;
+            CValidationInterface* pcallbacks = slot.pcallbacks.load();
+            if (pcallbacks) f(*pcallbacks, slot.pqueued.load());
+            slot.nCalls--;
+        }
+    }
+
+    void Register(CValidationInterface* pcallbacks, bool fOwnQueue) {
+        std::lock_guard<std::mutex> lock(m_cs_listeners);
+        for (int i = 0; i < MAX_VALIDATION_LISTENERS; i++) {
+            ListenerSlot& slot = m_slots[i];
+            if (slot.pcallbacks.load()) continue;
+            if (fOwnQueue) {
+                m_queued_listeners.emplace_back(new QueuedListener(pcallbacks, m_pscheduler));
+                slot.pqueued = m_queued_listeners.back().get();
+            } else {
+                m_shared_listeners++;
+            }
+            slot.pcallbacks = pcallbacks;
+            if (i >= m_slots_used) m_slots_used = i + 1;
+            return;
+        }
+        throw std::runtime_error("Too many validation interface listeners");
+    }
+
+    /** Unregister pcallbacks, or all listeners if nullptr */
+    void Unregister(CValidationInterface* pcallbacks) {
+        std::lock_guard<std::mutex> lock(m_cs_listeners);
+        for (int i = 0; i < m_slots_used; i++) {
+            ListenerSlot& slot = m_slots[i];
+            CValidationInterface* pslot = slot.pcallbacks.load();
+            if (!pslot || (pcallbacks && pslot != pcallbacks)) continue;
+            slot.pcallbacks = nullptr;
+            while (slot.nCalls.load() != 0)
+                std::this_thread::yield();
+            QueuedListener* pqueued = slot.pqueued.exchange(nullptr);
+            if (pqueued) {
+                std::lock_guard<std::mutex> lockCallback(pqueued->cs);
+                pqueued->fActive = false;
+            } else {
+                m_shared_listeners--;
+            }
+        }
+    }
+
+    /** Queue func on the shared queue, for the listeners without their own, and on the queue of each that has one */
+    void QueueLocked(const std::function<void (CValidationInterface&)>& func) {
+        if (m_shared_listeners > 0) {
+            m_schedulerClient.AddToProcessQueue([this, func] {
+                ForEachListener([&func](CValidationInterface& callbacks, QueuedListener* pqueued) {
+                    if (!pqueued) func(callbacks);
+                });
+            });
+        }
+        ForEachListener([&func](CValidationInterface&, QueuedListener* pqueued) {
+            if (pqueued) pqueued->AddToProcessQueue(func);
+        });
+    }
 
-    explicit MainSignalsInstance(CScheduler *pscheduler) : m_schedulerClient(pscheduler) {}
+    void FlushMempoolBatchLocked() {
+        if (m_mempool_batch.empty()) return;
+        auto pbatch = std::make_shared<const std::vector<MempoolUpdate>>(std::move(m_mempool_batch));
+        m_mempool_batch.clear();
+        QueueLocked([pbatch](CValidationInterface& callbacks) {
+            callbacks.MempoolUpdated(*pbatch);
+        });
+    }
+
+    void Queue(const std::function<void (CValidationInterface&)>& func) {
+        std::lock_guard<std::mutex> lock(m_cs_queue);
+        FlushMempoolBatchLocked();
+        QueueLocked(func);
+    }
+
+    void AddMempoolUpdate(const CTransactionRef& ptx, bool fAdded) {
+        std::lock_guard<std::mutex> lock(m_cs_queue);
+        m_mempool_batch.push_back(MempoolUpdate{ptx, fAdded});
+        if (m_mempool_batch.size() == 1) {
+            m_pscheduler->schedule([this] {
+                std::lock_guard<std::mutex> lock(m_cs_queue);
+                FlushMempoolBatchLocked();
+            }, boost::chrono::system_clock::now(), CScheduler::Priority::HIGH);
+        }
+    }
 };
 
 static CMainSignals g_signals;
 
+void CValidationInterface::MempoolUpdated(const std::vector<MempoolUpdate>& updates) {
+    for (const MempoolUpdate& update : updates) {
+        if (update.fAdded) {
+            TransactionAddedToMempool(update.tx);
+        } else {
+            TransactionRemovedFromMempool(update.tx);
+        }
+    }
+}
+
 void CMainSignals::RegisterBackgroundSignalScheduler(CScheduler& scheduler) {
     assert(!m_internals);
     m_internals.reset(new MainSignalsInstance(&scheduler));
@@ -51,13 +199,30 @@ void CMainSignals::UnregisterBackgroundSignalScheduler() {
 
 void CMainSignals::FlushBackgroundCallbacks() {
     if (m_internals) {
+        {
+            std::lock_guard<std::mutex> lock(m_internals->m_cs_queue);
+            m_internals->FlushMempoolBatchLocked();
+        }
         m_internals->m_schedulerClient.EmptyQueue();
+        std::lock_guard<std::mutex> lock(m_internals->m_cs_listeners);
+        for (const auto& listener : m_internals->m_queued_listeners) {
+            listener->m_schedulerClient.EmptyQueue();
+        }
     }
 }
 
 size_t CMainSignals::CallbacksPending() {
     if (!m_internals) return 0;
-    return m_internals->m_schedulerClient.CallbacksPending();
+    size_t nPending = m_internals->m_schedulerClient.CallbacksPending();
+    {
+        std::lock_guard<std::mutex> lock(m_internals->m_cs_queue);
+        if (!m_internals->m_mempool_batch.empty()) nPending++;
+    }
+    std::lock_guard<std::mutex> lock(m_internals->m_cs_listeners);
+    for (const auto& listener : m_internals->m_queued_listeners) {
+        nPending += listener->m_schedulerClient.CallbacksPending();
+    }
+    return nPending;
 }
 
 void CMainSignals::RegisterWithMempoolSignals(CTxMemPool& pool) {
@@ -73,64 +238,57 @@ CMainSignals& GetMainSignals()
     return g_signals;
 }
 
-void RegisterValidationInterface(CValidationInterface* pwalletIn) {
-    g_signals.m_internals->UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
-    g_signals.m_internals->TransactionAddedToMempool.connect(boost::bind(&CValidationInterface::TransactionAddedToMempool, pwalletIn, _1));
-    g_signals.m_internals->BlockConnected.connect(boost::bind(&CValidationInterface::BlockConnected, pwalletIn, _1, _2, _3));
-    g_signals.m_internals->BlockDisconnected.connect(boost::bind(&CValidationInterface::BlockDisconnected, pwalletIn, _1));
-    g_signals.m_internals->TransactionRemovedFromMempool.connect(boost::bind(&CValidationInterface::TransactionRemovedFromMempool, pwalletIn, _1));
-    g_signals.m_internals->SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
-    g_signals.m_internals->Broadcast.connect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1, _2));
-    g_signals.m_internals->BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
-    g_signals.m_internals->NewPoWValidBlock.connect(boost::bind(&CValidationInterface::NewPoWValidBlock, pwalletIn, _1, _2));
+void RegisterValidationInterface(CValidationInterface* pwalletIn, bool fOwnQueue) {
+    g_signals.m_internals->Register(pwalletIn, fOwnQueue);
 }
 
 void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
-    g_signals.m_internals->BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
-    g_signals.m_internals->Broadcast.disconnect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1, _2));
-    g_signals.m_internals->SetBestChain.disconnect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
-    g_signals.m_internals->TransactionAddedToMempool.disconnect(boost::bind(&CValidationInterface::TransactionAddedToMempool, pwalletIn, _1));
-    g_signals.m_internals->BlockConnected.disconnect(boost::bind(&CValidationInterface::BlockConnected, pwalletIn, _1, _2, _3));
-    g_signals.m_internals->BlockDisconnected.disconnect(boost::bind(&CValidationInterface::BlockDisconnected, pwalletIn, _1));
-    g_signals.m_internals->TransactionRemovedFromMempool.disconnect(boost::bind(&CValidationInterface::TransactionRemovedFromMempool, pwalletIn, _1));
-    g_signals.m_internals->UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
-    g_signals.m_internals->NewPoWValidBlock.disconnect(boost::bind(&CValidationInterface::NewPoWValidBlock, pwalletIn, _1, _2));
+    g_signals.m_internals->Unregister(pwalletIn);
 }
 
 void UnregisterAllValidationInterfaces() {
     if (!g_signals.m_internals) {
         return;
     }
-    g_signals.m_internals->BlockChecked.disconnect_all_slots();
-    g_signals.m_internals->Broadcast.disconnect_all_slots();
-    g_signals.m_internals->SetBestChain.disconnect_all_slots();
-    g_signals.m_internals->TransactionAddedToMempool.disconnect_all_slots();
-    g_signals.m_internals->BlockConnected.disconnect_all_slots();
-    g_signals.m_internals->BlockDisconnected.disconnect_all_slots();
-    g_signals.m_internals->TransactionRemovedFromMempool.disconnect_all_slots();
-    g_signals.m_internals->UpdatedBlockTip.disconnect_all_slots();
-    g_signals.m_internals->NewPoWValidBlock.disconnect_all_slots();
+    g_signals.m_internals->Unregister(nullptr);
 }
 
 void CallFunctionInValidationInterfaceQueue(std::function<void ()> func) {
+    std::lock_guard<std::mutex> lock(g_signals.m_internals->m_cs_queue);
+    g_signals.m_internals->FlushMempoolBatchLocked();
     g_signals.m_internals->m_schedulerClient.AddToProcessQueue(std::move(func));
 }
 
 void SyncWithValidationInterfaceQueue() {
     AssertLockNotHeld(cs_main);
-    // Block until the validation queue drains
-    std::promise<void> promise;
-    CallFunctionInValidationInterfaceQueue([&promise] {
-        promise.set_value();
-    });
-    promise.get_future().wait();
+    // Block until the validation queue, and the queue of each listener, drains
+    MainSignalsInstance& internals = *g_signals.m_internals;
+    std::vector<std::shared_ptr<std::promise<void>>> promises;
+    {
+        std::lock_guard<std::mutex> lock(internals.m_cs_queue);
+        internals.FlushMempoolBatchLocked();
+        promises.push_back(std::make_shared<std::promise<void>>());
+        std::shared_ptr<std::promise<void>> promise = promises.back();
+        internals.m_schedulerClient.AddToProcessQueue([promise] {
+            promise->set_value();
+        });
+        internals.ForEachListener([&promises](CValidationInterface&, QueuedListener* pqueued) {
+            if (!pqueued) return;
+            promises.push_back(std::make_shared<std::promise<void>>());
+            std::shared_ptr<std::promise<void>> promise = promises.back();
+            pqueued->m_schedulerClient.AddToProcessQueue([promise] {
+                promise->set_value();
+            });
+        });
+    }
+    for (const auto& promise : promises) {
+        promise->get_future().wait();
+    }
 }
 
 void CMainSignals::MempoolEntryRemoved(CTransactionRef ptx, MemPoolRemovalReason reason) {
     if (reason != MemPoolRemovalReason::BLOCK && reason != MemPoolRemovalReason::CONFLICT) {
-        m_internals->m_schedulerClient.AddToProcessQueue([ptx, this] {
-            m_internals->TransactionRemovedFromMempool(ptx);
-        });
+        m_internals->AddMempoolUpdate(ptx, false);
     }
 }
 
@@ -139,43 +297,47 @@ void CMainSignals::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockInd
     // the chain actually updates. One way to ensure this is for the caller to invoke this signal
     // in the same critical section where the chain is updated
 
-    m_internals->m_schedulerClient.AddToProcessQueue([pindexNew, pindexFork, fInitialDownload, this] {
-        m_internals->UpdatedBlockTip(pindexNew, pindexFork, fInitialDownload);
+    m_internals->Queue([pindexNew, pindexFork, fInitialDownload](CValidationInterface& callbacks) {
+        callbacks.UpdatedBlockTip(pindexNew, pindexFork, fInitialDownload);
     });
 }
 
 void CMainSignals::TransactionAddedToMempool(const CTransactionRef &ptx) {
-    m_internals->m_schedulerClient.AddToProcessQueue([ptx, this] {
-        m_internals->TransactionAddedToMempool(ptx);
-    });
+    m_internals->AddMempoolUpdate(ptx, true);
 }
 
 void CMainSignals::BlockConnected(const std::shared_ptr<const CBlock> &pblock, const CBlockIndex *pindex, const std::shared_ptr<const std::vector<CTransactionRef>>& pvtxConflicted) {
-    m_internals->m_schedulerClient.AddToProcessQueue([pblock, pindex, pvtxConflicted, this] {
-        m_internals->BlockConnected(pblock, pindex, *pvtxConflicted);
+    m_internals->Queue([pblock, pindex, pvtxConflicted](CValidationInterface& callbacks) {
+        callbacks.BlockConnected(pblock, pindex, *pvtxConflicted);
     });
 }
 
 void CMainSignals::BlockDisconnected(const std::shared_ptr<const CBlock> &pblock) {
-    m_internals->m_schedulerClient.AddToProcessQueue([pblock, this] {
-        m_internals->BlockDisconnected(pblock);
+    m_internals->Queue([pblock](CValidationInterface& callbacks) {
+        callbacks.BlockDisconnected(pblock);
     });
 }
 
 void CMainSignals::SetBestChain(const CBlockLocator &locator) {
-    m_internals->m_schedulerClient.AddToProcessQueue([locator, this] {
-        m_internals->SetBestChain(locator);
+    m_internals->Queue([locator](CValidationInterface& callbacks) {
+        callbacks.SetBestChain(locator);
     });
 }
 
 void CMainSignals::Broadcast(int64_t nBestBlockTime, CConnman* connman) {
-    m_internals->Broadcast(nBestBlockTime, connman);
+    m_internals->ForEachListener([nBestBlockTime, connman](CValidationInterface& callbacks, QueuedListener*) {
+        callbacks.ResendWalletTransactions(nBestBlockTime, connman);
+    });
 }
 
 void CMainSignals::BlockChecked(const CBlock& block, const CValidationState& state) {
-    m_internals->BlockChecked(block, state);
+    m_internals->ForEachListener([&block, &state](CValidationInterface& callbacks, QueuedListener*) {
+        callbacks.BlockChecked(block, state);
+    });
 }
 
 void CMainSignals::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock> &block) {
-    m_internals->NewPoWValidBlock(pindex, block);
+    m_internals->ForEachListener([pindex, &block](CValidationInterface& callbacks, QueuedListener*) {
+        callbacks.NewPoWValidBlock(pindex, block);
+    });
 }
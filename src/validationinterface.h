@@ -10,6 +10,7 @@
 
 #include <functional>
 #include <memory>
+#include <vector>
 
 class CBlock;
 class CBlockIndex;
@@ -26,8 +27,14 @@ enum class MemPoolRemovalReason;
 
 // These functions dispatch to one or all registered wallets
 
-/** Register a wallet to receive updates from core */
-void RegisterValidationInterface(CValidationInterface* pwalletIn);
+/**
+ * Register a wallet to receive updates from core. With fOwnQueue, its
+ * background callbacks are queued separately from those of the other
+ * listeners, so that they may run concurrently with them (see -schedulerthreads).
+ * Use it for listeners that do not rely on being notified in step with the
+ * others; the wallets, indexes, ZMQ and the peer logic all do.
+ */
+void RegisterValidationInterface(CValidationInterface* pwalletIn, bool fOwnQueue = false);
 /** Unregister a wallet from core */
 void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister all wallets from core */
@@ -35,6 +42,7 @@ void UnregisterAllValidationInterfaces();
 /**
  * Pushes a function to callback onto the notification queue, guaranteeing any
  * callbacks generated prior to now are finished when the function is called.
+ * This does not cover listeners registered with their own queue.
  *
  * Be very careful blocking on func to be called if any locks are held -
  * validation interface clients may not be able to make progress as they often
@@ -43,16 +51,18 @@ void UnregisterAllValidationInterfaces();
  */
 void CallFunctionInValidationInterfaceQueue(std::function<void ()> func);
 /**
- * This is a synonym for the following, which asserts certain locks are not
- * held:
- *     std::promise<void> promise;
- *     CallFunctionInValidationInterfaceQueue([&promise] {
- *         promise.set_value();
- *     });
- *     promise.get_future().wait();
+ * Block until the callbacks generated prior to now are finished, including
+ * those of listeners registered with their own queue. Asserts that cs_main
+ * is not held.
  */
 void SyncWithValidationInterfaceQueue();
 
+/** A transaction added to, or removed from, the mempool */
+struct MempoolUpdate {
+    CTransactionRef tx;
+    bool fAdded;
+};
+
 class CValidationInterface {
 protected:
     /**
@@ -82,6 +92,16 @@ protected:
      * Called on a background thread.
      */
     virtual void TransactionRemovedFromMempool(const CTransactionRef &ptx) {}
+    /**
+     * Notifies listeners of the transactions added to and removed from the
+     * mempool since the last notification, in order. Mempool notifications are
+     * batched, so that a burst of them costs a listener one callback; the
+     * default calls TransactionAddedToMempool or TransactionRemovedFromMempool
+     * for each.
+     *
+     * Called on a background thread.
+     */
+    virtual void MempoolUpdated(const std::vector<MempoolUpdate>& updates);
     /**
      * Notifies listeners of a block being connected.
      * Provides a vector of transactions evicted from the mempool as a result.
@@ -114,9 +134,11 @@ protected:
      * Notifies listeners that a block which builds directly on our current tip
      * has been received and connected to the headers tree, though not validated yet */
     virtual void NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& block) {};
-    friend void ::RegisterValidationInterface(CValidationInterface*);
+    friend void ::RegisterValidationInterface(CValidationInterface*, bool);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
+    friend class CMainSignals;
+    friend struct MainSignalsInstance;
 };
 
 struct MainSignalsInstance;
@@ -124,10 +146,11 @@ class CMainSignals {
 private:
     std::unique_ptr<MainSignalsInstance> m_internals;
 
-    friend void ::RegisterValidationInterface(CValidationInterface*);
+    friend void ::RegisterValidationInterface(CValidationInterface*, bool);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
     friend void ::CallFunctionInValidationInterfaceQueue(std::function<void ()> func);
+    friend void ::SyncWithValidationInterfaceQueue();
 
     void MempoolEntryRemoved(CTransactionRef tx, MemPoolRemovalReason reason);
 
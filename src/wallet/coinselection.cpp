@@ -0,0 +1,98 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <wallet/coinselection.h>
+
+#include <wallet/wallet.h>
+
+#include <algorithm>
+#include <assert.h>
+
+namespace {
+struct CompareEffectiveValueDescending
+{
+    bool operator()(const CInputCoin& a, const CInputCoin& b) const
+    {
+        return a.effective_value > b.effective_value;
+    }
+};
+} // namespace
+
+bool SelectCoinsBnB(std::vector<CInputCoin>& utxo_pool, const CAmount& target_value, const CAmount& cost_of_change,
+                    std::set<CInputCoin>& out_set, CAmount& value_ret)
+{
+    out_set.clear();
+    value_ret = 0;
+
+    // Sum of the effective values of the coins not decided on yet
+    CAmount curr_available_value = 0;
+    for (const CInputCoin& utxo : utxo_pool) {
+        assert(utxo.effective_value > 0);
+        curr_available_value += utxo.effective_value;
+    }
+    if (curr_available_value < target_value)
+        return false;
+
+    std::sort(utxo_pool.begin(), utxo_pool.end(), CompareEffectiveValueDescending());
+
+    // curr_selection[i] says whether utxo_pool[i] is included on the current branch
+    std::vector<bool> curr_selection;
+    curr_selection.reserve(utxo_pool.size());
+    CAmount curr_value = 0;
+
+    std::vector<bool> best_selection;
+    CAmount best_excess = MAX_MONEY;
+
+    for (size_t tries = 0; tries < BNB_TOTAL_TRIES; tries++) {
+        bool backtrack = false;
+        if (curr_value + curr_available_value < target_value || curr_value > target_value + cost_of_change) {
+            // Can no longer reach the target, or already past it
+            backtrack = true;
+        } else if (curr_value >= target_value) {
+            // A match; adding more coins only increases the excess
+            if (curr_value - target_value < best_excess) {
+                best_selection = curr_selection;
+                best_excess = curr_value - target_value;
+            }
+            if (best_excess == 0)
+                break;
+            backtrack = true;
+        }
+
+        if (backtrack) {
+            // Walk back to the last included coin, and take the branch that leaves it out
+            while (!curr_selection.empty() && !curr_selection.back()) {
+                curr_selection.pop_back();
+                curr_available_value += utxo_pool[curr_selection.size()].effective_value;
+            }
+            if (curr_selection.empty())
+                break;
+            curr_selection.back() = false;
+            curr_value -= utxo_pool[curr_selection.size() - 1].effective_value;
+        } else {
+            const CInputCoin& utxo = utxo_pool[curr_selection.size()];
+            curr_available_value -= utxo.effective_value;
+            // Including a coin worth the same as the one just left out would only
+            // repeat a branch already searched
+            if (!curr_selection.empty() && !curr_selection.back() &&
+                utxo.effective_value == utxo_pool[curr_selection.size() - 1].effective_value) {
+                curr_selection.push_back(false);
+            } else {
+                curr_selection.push_back(true);
+                curr_value += utxo.effective_value;
+            }
+        }
+    }
+
+    if (best_excess == MAX_MONEY)
+        return false;
+
+    for (size_t i = 0; i < best_selection.size(); i++) {
+        if (best_selection[i]) {
+            out_set.insert(utxo_pool[i]);
+            value_ret += utxo_pool[i].txout.nValue;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,49 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_COINSELECTION_H
+#define BITCOIN_WALLET_COINSELECTION_H
+
+#include <amount.h>
+#include <policy/feerate.h>
+
+#include <set>
+#include <stddef.h>
+#include <vector>
+
+class CInputCoin;
+
+/** Number of steps the branch and bound search may take before giving up on an exact match */
+static const size_t BNB_TOTAL_TRIES = 100000;
+
+/** How coin selection values inputs and what it aims for, see CWallet::SelectCoins */
+struct CoinSelectionParams
+{
+    //! Whether to look for an exact match first, with SelectCoinsBnB
+    bool use_bnb = false;
+    //! Fee rate the transaction pays, at which each input's fee is taken off its value
+    CFeeRate effective_fee;
+    //! Fee for the parts of the transaction other than the inputs, at effective_fee
+    CAmount not_input_fees = 0;
+    //! Fee for a change output plus the fee for spending it later; a match may
+    //! exceed its target by up to this much, since making change would cost more
+    CAmount cost_of_change = 0;
+};
+
+/**
+ * Search for a subset of utxo_pool whose effective values (CInputCoin::effective_value)
+ * add up to at least target_value and at most target_value + cost_of_change, so that
+ * no change output is needed. This is a depth first search over the coins sorted by
+ * descending effective value, which at each coin first includes it and then leaves it
+ * out, cutting a branch off as soon as it overshoots or can no longer reach the
+ * target. Of the matches found, the one with the smallest excess is returned; the
+ * search stops at an exact match or after BNB_TOTAL_TRIES steps.
+ *
+ * utxo_pool is reordered. All its effective values must be positive.
+ * value_ret is set to the sum of the selected coins' actual values.
+ */
+bool SelectCoinsBnB(std::vector<CInputCoin>& utxo_pool, const CAmount& target_value, const CAmount& cost_of_change,
+                    std::set<CInputCoin>& out_set, CAmount& value_ret);
+
+#endif // BITCOIN_WALLET_COINSELECTION_H
@@ -10,7 +10,10 @@
 #include <script/standard.h>
 #include <util.h>
 
+#include <algorithm>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <vector>
 
 int CCrypter::BytesToKeySHA512AES(const std::vector<unsigned char>& chSalt, const SecureString& strKeyData, int count, unsigned char *key,unsigned char *iv) const
@@ -175,6 +178,43 @@ bool CCryptoKeyStore::Lock()
     return true;
 }
 
+bool CCryptoKeyStore::CheckCryptedKeys(const CKeyingMaterial& vMasterKeyIn) const
+{
+    AssertLockHeld(cs_KeyStore);
+    std::vector<const std::pair<CPubKey, std::vector<unsigned char>>*> vKeys;
+    vKeys.reserve(mapCryptedKeys.size());
+    for (const auto& entry : mapCryptedKeys) {
+        vKeys.push_back(&entry.second);
+    }
+
+    unsigned int nThreads = std::min<unsigned int>(std::max(GetNumCores(), 1), MAX_UNLOCK_THREADS);
+    nThreads = std::min<size_t>(nThreads, vKeys.size() / MIN_KEYS_PER_UNLOCK_THREAD + 1);
+
+    // Keys are handed out one at a time, until one fails
+    std::atomic<size_t> nNext(0);
+    std::atomic<bool> fFailed(false);
+    auto worker = [&]() {
+        for (size_t i = nNext++; i < vKeys.size() && !fFailed; i = nNext++) {
+            CKey key;
+            if (!DecryptKey(vMasterKeyIn, vKeys[i]->second, vKeys[i]->first, key))
+                fFailed = true;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int n = 1; n < nThreads; n++) {
+        try {
+            threads.emplace_back(worker);
+        } catch (const std::system_error&) {
+            break;
+        }
+    }
+    worker();
+    for (std::thread& thread : threads)
+        thread.join();
+    return !fFailed;
+}
+
 bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
 {
     {
@@ -182,30 +222,18 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
         if (!SetCrypted())
             return false;
 
-        bool keyPass = false;
-        bool keyFail = false;
-        CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        for (; mi != mapCryptedKeys.end(); ++mi)
-        {
-            const CPubKey &vchPubKey = (*mi).second.first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
-            CKey key;
-            if (!DecryptKey(vMasterKeyIn, vchCryptedSecret, vchPubKey, key))
-            {
-                keyFail = true;
-                break;
-            }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
-        }
-        if (keyPass && keyFail)
+        // A wrong passphrase already fails on the first key
+        if (mapCryptedKeys.empty())
+            return false;
+        CKey key;
+        const auto& first = mapCryptedKeys.begin()->second;
+        if (!DecryptKey(vMasterKeyIn, first.second, first.first, key))
+            return false;
+        if (!fDecryptionThoroughlyChecked && !CheckCryptedKeys(vMasterKeyIn))
         {
             LogPrintf("The wallet is probably corrupted: Some keys decrypt but not all.\n");
             assert(false);
         }
-        if (keyFail || !keyPass)
-            return false;
         vMasterKey = vMasterKeyIn;
         fDecryptionThoroughlyChecked = true;
     }
@@ -14,6 +14,10 @@
 const unsigned int WALLET_CRYPTO_KEY_SIZE = 32;
 const unsigned int WALLET_CRYPTO_SALT_SIZE = 8;
 const unsigned int WALLET_CRYPTO_IV_SIZE = 16;
+//! Most threads the keys of a wallet are checked on when it is first unlocked
+static const unsigned int MAX_UNLOCK_THREADS = 8;
+//! Fewest keys worth a thread of their own
+static const unsigned int MIN_KEYS_PER_UNLOCK_THREAD = 100;
 
 /**
  * Private key encryption is done based on a CMasterKey,
@@ -132,6 +136,8 @@ protected:
     bool EncryptKeys(CKeyingMaterial& vMasterKeyIn);
 
     bool Unlock(const CKeyingMaterial& vMasterKeyIn);
+    //! Whether every key decrypts with vMasterKeyIn, checked on several threads
+    bool CheckCryptedKeys(const CKeyingMaterial& vMasterKeyIn) const;
     CryptedKeyMap mapCryptedKeys;
 
 public:
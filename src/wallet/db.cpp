@@ -52,6 +52,14 @@ void CheckUniqueFileid(const CDBEnv& env, const std::string& filename, Db& db)
         }
     }
 }
+
+//! Whether the wallet file is, or is to be created as, an append-only log
+bool IsLogWallet(const fs::path& path)
+{
+    if (fs::exists(path))
+        return CLogDB::IsLogFile(path);
+    return gArgs.GetArg("-walletbackend", DEFAULT_WALLET_BACKEND) == "log";
+}
 } // namespace
 
 //
@@ -225,6 +233,35 @@ bool CDB::Recover(const std::string& filename, void *callbackDataIn, bool (*reco
     int64_t now = GetTime();
     newFilename = strprintf("%s.%d.bak", filename, now);
 
+    fs::path pathFile = GetWalletDir() / filename;
+    if (CLogDB::IsLogFile(pathFile)) {
+        // A log drops torn writes itself when it is opened; keep the file as
+        // it was, and filter the records of the log
+        try {
+            fs::copy_file(pathFile, GetWalletDir() / newFilename);
+            LogPrintf("Copied %s to %s\n", filename, newFilename);
+            CLogDB log(pathFile);
+            CLogDB::Data vchKey, vchValue;
+            bool fInclusive = true;
+            unsigned int nRecords = 0;
+            while (log.ReadNext(vchKey, vchValue, fInclusive)) {
+                fInclusive = false;
+                nRecords++;
+                if (recoverKVcallback) {
+                    CDataStream ssKey(vchKey, SER_DISK, CLIENT_VERSION);
+                    CDataStream ssValue(vchValue, SER_DISK, CLIENT_VERSION);
+                    if (!(*recoverKVcallback)(callbackDataIn, ssKey, ssValue) && !log.Erase(vchKey, nullptr))
+                        return false;
+                }
+            }
+            LogPrintf("Recovered %u records of %s\n", nRecords, filename);
+            return log.Compact(true);
+        } catch (const std::exception& e) {
+            LogPrintf("Failed to recover %s: %s\n", filename, e.what());
+            return false;
+        }
+    }
+
     int result = bitdb.dbenv->dbrename(nullptr, filename.c_str(), nullptr,
                                        newFilename.c_str(), DB_AUTO_COMMIT);
     if (result == 0)
@@ -291,6 +328,15 @@ bool CDB::VerifyEnvironment(const std::string& walletFile, const fs::path& walle
         return false;
     }
 
+    if (IsLogWallet(walletDir / walletFile)) {
+        // A log needs no environment, only the directory to itself
+        if (!LockDirectory(walletDir, ".walletlock")) {
+            errorStr = strprintf(_("Cannot obtain a lock on wallet directory %s. Another instance of bitcoin may be using it."), walletDir.string());
+            return false;
+        }
+        return true;
+    }
+
     if (!bitdb.Open(walletDir, true)) {
         errorStr = strprintf(_("Error initializing wallet database environment %s!"), walletDir);
         return false;
@@ -301,7 +347,8 @@ bool CDB::VerifyEnvironment(const std::string& walletFile, const fs::path& walle
 
 bool CDB::VerifyDatabaseFile(const std::string& walletFile, const fs::path& walletDir, std::string& warningStr, std::string& errorStr, CDBEnv::recoverFunc_type recoverFunc)
 {
-    if (fs::exists(walletDir / walletFile))
+    // A log is checked frame by frame as it is read
+    if (fs::exists(walletDir / walletFile) && !CLogDB::IsLogFile(walletDir / walletFile))
     {
         std::string backup_filename;
         CDBEnv::VerifyResult r = bitdb.Verify(walletFile, recoverFunc, backup_filename);
@@ -398,7 +445,22 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 }
 
 
-CDB::CDB(CWalletDBWrapper& dbw, const char* pszMode, bool fFlushOnCloseIn) : pdb(nullptr), activeTxn(nullptr)
+CWalletDBWrapper::CWalletDBWrapper(CDBEnv *env_in, const std::string &strFile_in) :
+    nUpdateCounter(0), nLastSeen(0), nLastFlushed(0), nLastWalletUpdate(0), env(env_in), strFile(strFile_in)
+{
+    fLog = !env->IsMock() && IsLogWallet(GetWalletDir() / strFile);
+}
+
+CLogDB* CWalletDBWrapper::GetLog()
+{
+    std::lock_guard<std::mutex> lock(cs_log);
+    if (!log) {
+        log.reset(new CLogDB(GetWalletDir() / strFile));
+    }
+    return log.get();
+}
+
+CDB::CDB(CWalletDBWrapper& dbw, const char* pszMode, bool fFlushOnCloseIn) : pdb(nullptr), plog(nullptr), activeTxn(nullptr), nBatchWrites(0), nBatchMaxWrites(0)
 {
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
     fFlushOnClose = fFlushOnCloseIn;
@@ -409,6 +471,17 @@ CDB::CDB(CWalletDBWrapper& dbw, const char* pszMode, bool fFlushOnCloseIn) : pdb
     const std::string &strFilename = dbw.strFile;
 
     bool fCreate = strchr(pszMode, 'c') != nullptr;
+    if (dbw.fLog) {
+        plog = dbw.GetLog();
+        strFile = strFilename;
+        if (fCreate && !Exists(std::string("version"))) {
+            bool fTmp = fReadOnly;
+            fReadOnly = false;
+            WriteVersion(CLIENT_VERSION);
+            fReadOnly = fTmp;
+        }
+        return;
+    }
     unsigned int nFlags = DB_THREAD;
     if (fCreate)
         nFlags |= DB_CREATE;
@@ -459,8 +532,23 @@ CDB::CDB(CWalletDBWrapper& dbw, const char* pszMode, bool fFlushOnCloseIn) : pdb
     }
 }
 
+bool CDB::BatchWritten()
+{
+    if (nBatchMaxWrites == 0 || ++nBatchWrites < nBatchMaxWrites)
+        return true;
+    nBatchWrites = 0;
+    if (TxnCommit() && TxnBegin())
+        return true;
+    nBatchMaxWrites = 0;
+    return false;
+}
+
 void CDB::Flush()
 {
+    if (plog) {
+        plog->Flush();
+        return;
+    }
     if (activeTxn)
         return;
 
@@ -479,11 +567,20 @@ void CWalletDBWrapper::IncrementUpdateCounter()
 
 void CDB::Close()
 {
+    if (plog) {
+        plog->TxnAbort(this);
+        nBatchMaxWrites = 0;
+        if (fFlushOnClose && !fReadOnly)
+            plog->Flush();
+        plog = nullptr;
+        return;
+    }
     if (!pdb)
         return;
     if (activeTxn)
         activeTxn->abort();
     activeTxn = nullptr;
+    nBatchMaxWrites = 0;
     pdb = nullptr;
 
     if (fFlushOnClose)
@@ -514,6 +611,27 @@ bool CDB::Rewrite(CWalletDBWrapper& dbw, const char* pszSkip)
     if (dbw.IsDummy()) {
         return true;
     }
+    if (dbw.fLog) {
+        // Drop the skipped records, and write the log anew without what they
+        // and any records overwritten before were
+        bool fSuccess = true;
+        {
+            CDB db(dbw, "r+");
+            std::unique_ptr<CDBCursor> pcursor = db.GetCursor();
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            while (pszSkip && db.ReadAtCursor(pcursor.get(), ssKey, ssValue) == 0) {
+                if (strncmp(ssKey.data(), pszSkip, std::min(ssKey.size(), strlen(pszSkip))) == 0)
+                    fSuccess &= db.plog->Erase(CLogDB::Data(ssKey.begin(), ssKey.end()), &db);
+            }
+            fSuccess &= db.WriteVersion(CLIENT_VERSION);
+        }
+        LogPrintf("CDB::Rewrite: Rewriting %s...\n", dbw.strFile);
+        fSuccess &= dbw.GetLog()->Compact(true);
+        if (!fSuccess)
+            LogPrintf("CDB::Rewrite: Failed to rewrite %s\n", dbw.strFile);
+        return fSuccess;
+    }
     CDBEnv *env = dbw.env;
     const std::string& strFile = dbw.strFile;
     while (true) {
@@ -543,17 +661,17 @@ bool CDB::Rewrite(CWalletDBWrapper& dbw, const char* pszSkip)
                         fSuccess = false;
                     }
 
-                    Dbc* pcursor = db.GetCursor();
+                    std::unique_ptr<CDBCursor> pcursor = db.GetCursor();
                     if (pcursor)
                         while (fSuccess) {
                             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
                             CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-                            int ret1 = db.ReadAtCursor(pcursor, ssKey, ssValue);
+                            int ret1 = db.ReadAtCursor(pcursor.get(), ssKey, ssValue);
                             if (ret1 == DB_NOTFOUND) {
-                                pcursor->close();
+                                pcursor.reset();
                                 break;
                             } else if (ret1 != 0) {
-                                pcursor->close();
+                                pcursor.reset();
                                 fSuccess = false;
                                 break;
                             }
@@ -643,6 +761,10 @@ bool CDB::PeriodicFlush(CWalletDBWrapper& dbw)
     if (dbw.IsDummy()) {
         return true;
     }
+    if (dbw.fLog) {
+        std::lock_guard<std::mutex> lock(dbw.cs_log);
+        return !dbw.log || (dbw.log->Flush() && dbw.log->Compact());
+    }
     bool ret = false;
     CDBEnv *env = dbw.env;
     const std::string& strFile = dbw.strFile;
@@ -691,6 +813,21 @@ bool CWalletDBWrapper::Backup(const std::string& strDest)
     if (IsDummy()) {
         return false;
     }
+    if (fLog) {
+        fs::path pathDest(strDest);
+        if (fs::is_directory(pathDest))
+            pathDest /= strFile;
+        if (fs::exists(pathDest) && fs::equivalent(GetWalletDir() / strFile, pathDest)) {
+            LogPrintf("cannot backup to wallet source file %s\n", pathDest.string());
+            return false;
+        }
+        if (!GetLog()->Backup(pathDest)) {
+            LogPrintf("error writing %s to %s\n", strFile, pathDest.string());
+            return false;
+        }
+        LogPrintf("copied %s to %s\n", strFile, pathDest.string());
+        return true;
+    }
     while (true)
     {
         {
@@ -729,7 +866,14 @@ bool CWalletDBWrapper::Backup(const std::string& strDest)
 
 void CWalletDBWrapper::Flush(bool shutdown)
 {
-    if (!IsDummy()) {
+    if (fLog) {
+        std::lock_guard<std::mutex> lock(cs_log);
+        if (log) {
+            log->Flush();
+            if (shutdown)
+                log->Compact();
+        }
+    } else if (!IsDummy()) {
         env->Flush(shutdown);
     }
 }
@@ -12,16 +12,20 @@
 #include <streams.h>
 #include <sync.h>
 #include <version.h>
+#include <wallet/logdb.h>
 
 #include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include <db_cxx.h>
 
 static const unsigned int DEFAULT_WALLET_DBLOGSIZE = 100;
+//! Writes per transaction in a batch, see CDB::BatchBegin
+static const unsigned int DEFAULT_WALLET_BATCH_WRITES = 1000;
 static const bool DEFAULT_WALLET_PRIVDB = true;
 
 class CDBEnv
@@ -90,21 +94,20 @@ extern CDBEnv bitdb;
 
 /** An instance of this class represents one database.
  * For BerkeleyDB this is just a (env, strFile) tuple.
+ * A wallet file that is an append-only log (see CLogDB), or that does not
+ * exist yet with -walletbackend=log, is accessed through the log instead.
  **/
 class CWalletDBWrapper
 {
     friend class CDB;
 public:
     /** Create dummy DB handle */
-    CWalletDBWrapper() : nUpdateCounter(0), nLastSeen(0), nLastFlushed(0), nLastWalletUpdate(0), env(nullptr)
+    CWalletDBWrapper() : nUpdateCounter(0), nLastSeen(0), nLastFlushed(0), nLastWalletUpdate(0), env(nullptr), fLog(false)
     {
     }
 
     /** Create DB handle to real database */
-    CWalletDBWrapper(CDBEnv *env_in, const std::string &strFile_in) :
-        nUpdateCounter(0), nLastSeen(0), nLastFlushed(0), nLastWalletUpdate(0), env(env_in), strFile(strFile_in)
-    {
-    }
+    CWalletDBWrapper(CDBEnv *env_in, const std::string &strFile_in);
 
     /** Rewrite the entire database on disk, with the exception of key pszSkip if non-zero
      */
@@ -134,6 +137,14 @@ private:
     CDBEnv *env;
     std::string strFile;
 
+    /** Append-only log specific; the log is opened by the first CDB */
+    bool fLog;
+    std::mutex cs_log;
+    std::unique_ptr<CLogDB> log;
+
+    /** Open the log if it is not yet; throws std::runtime_error on failure */
+    CLogDB* GetLog();
+
     /** Return whether this database handle is a dummy for testing.
      * Only to be used at a low level, application should ideally not care
      * about this.
@@ -142,16 +153,47 @@ private:
 };
 
 
-/** RAII class that provides access to a Berkeley database */
+/** A cursor over the records of a database, see CDB::GetCursor */
+class CDBCursor
+{
+    friend class CDB;
+private:
+    Dbc* pcursor;
+    CLogDB* plog;
+    //! For a log, the key of the record read last, if any was
+    CLogDB::Data vchKey;
+    bool fStarted;
+
+    CDBCursor(Dbc* pcursorIn, CLogDB* plogIn) : pcursor(pcursorIn), plog(plogIn), fStarted(false) {}
+
+public:
+    ~CDBCursor()
+    {
+        if (pcursor)
+            pcursor->close();
+    }
+
+    CDBCursor(const CDBCursor&) = delete;
+    CDBCursor& operator=(const CDBCursor&) = delete;
+};
+
+/** RAII class that provides access to a Berkeley database, or a wallet log */
 class CDB
 {
 protected:
     Db* pdb;
+    CLogDB* plog;
     std::string strFile;
     DbTxn* activeTxn;
     bool fReadOnly;
     bool fFlushOnClose;
     CDBEnv *env;
+    //! Writes made in the current batch transaction, and how many it takes; 0 outside a batch
+    unsigned int nBatchWrites;
+    unsigned int nBatchMaxWrites;
+
+    /** Count a write of a batch, committing the transaction and beginning the next when it is full */
+    bool BatchWritten();
 
 public:
     explicit CDB(CWalletDBWrapper& dbw, const char* pszMode = "r+", bool fFlushOnCloseIn=true);
@@ -176,13 +218,26 @@ public:
     template <typename K, typename T>
     bool Read(const K& key, T& value)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (plog) {
+            CLogDB::Data vchValue;
+            if (!plog->Read(CLogDB::Data(ssKey.begin(), ssKey.end()), vchValue))
+                return false;
+            try {
+                CDataStream ssValue(vchValue, SER_DISK, CLIENT_VERSION);
+                ssValue >> value;
+            } catch (const std::exception&) {
+                return false;
+            }
+            return true;
+        }
         Dbt datKey(ssKey.data(), ssKey.size());
 
         // Read
@@ -211,7 +266,7 @@ public:
     template <typename K, typename T>
     bool Write(const K& key, const T& value, bool fOverwrite = true)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return true;
         if (fReadOnly)
             assert(!"Write called on database in read-only mode");
@@ -220,12 +275,16 @@ public:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
-        Dbt datKey(ssKey.data(), ssKey.size());
 
         // Value
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(10000);
         ssValue << value;
+
+        if (plog) {
+            return plog->Write(CLogDB::Data(ssKey.begin(), ssKey.end()), CLogDB::Data(ssValue.begin(), ssValue.end()), fOverwrite, this) && BatchWritten();
+        }
+        Dbt datKey(ssKey.data(), ssKey.size());
         Dbt datValue(ssValue.data(), ssValue.size());
 
         // Write
@@ -234,13 +293,13 @@ public:
         // Clear memory in case it was a private key
         memory_cleanse(datKey.get_data(), datKey.get_size());
         memory_cleanse(datValue.get_data(), datValue.get_size());
-        return (ret == 0);
+        return (ret == 0) && BatchWritten();
     }
 
     template <typename K>
     bool Erase(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
@@ -249,6 +308,10 @@ public:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (plog) {
+            return plog->Erase(CLogDB::Data(ssKey.begin(), ssKey.end()), this) && BatchWritten();
+        }
         Dbt datKey(ssKey.data(), ssKey.size());
 
         // Erase
@@ -256,19 +319,23 @@ public:
 
         // Clear memory
         memory_cleanse(datKey.get_data(), datKey.get_size());
-        return (ret == 0 || ret == DB_NOTFOUND);
+        return (ret == 0 || ret == DB_NOTFOUND) && BatchWritten();
     }
 
     template <typename K>
     bool Exists(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (plog) {
+            return plog->Exists(CLogDB::Data(ssKey.begin(), ssKey.end()));
+        }
         Dbt datKey(ssKey.data(), ssKey.size());
 
         // Exists
@@ -279,19 +346,39 @@ public:
         return (ret == 0);
     }
 
-    Dbc* GetCursor()
+    std::unique_ptr<CDBCursor> GetCursor()
     {
+        if (plog)
+            return std::unique_ptr<CDBCursor>(new CDBCursor(nullptr, plog));
         if (!pdb)
             return nullptr;
         Dbc* pcursor = nullptr;
         int ret = pdb->cursor(nullptr, &pcursor, 0);
         if (ret != 0)
             return nullptr;
-        return pcursor;
+        return std::unique_ptr<CDBCursor>(new CDBCursor(pcursor, nullptr));
     }
 
-    int ReadAtCursor(Dbc* pcursor, CDataStream& ssKey, CDataStream& ssValue, bool setRange = false)
+    /** Read the next record, or with setRange the first from ssKey on; DB_NOTFOUND at the end */
+    int ReadAtCursor(CDBCursor* pcursorIn, CDataStream& ssKey, CDataStream& ssValue, bool setRange = false)
     {
+        if (pcursorIn->plog) {
+            CLogDB::Data vchValue;
+            if (setRange)
+                pcursorIn->vchKey.assign(ssKey.begin(), ssKey.end());
+            if (!pcursorIn->plog->ReadNext(pcursorIn->vchKey, vchValue, setRange || !pcursorIn->fStarted))
+                return DB_NOTFOUND;
+            pcursorIn->fStarted = true;
+            ssKey.SetType(SER_DISK);
+            ssKey.clear();
+            ssKey.write(pcursorIn->vchKey.data(), pcursorIn->vchKey.size());
+            ssValue.SetType(SER_DISK);
+            ssValue.clear();
+            ssValue.write(vchValue.data(), vchValue.size());
+            return 0;
+        }
+        Dbc* pcursor = pcursorIn->pcursor;
+
         // Read at cursor
         Dbt datKey;
         unsigned int fFlags = DB_NEXT;
@@ -328,6 +415,8 @@ public:
 public:
     bool TxnBegin()
     {
+        if (plog)
+            return plog->TxnBegin(this);
         if (!pdb || activeTxn)
             return false;
         DbTxn* ptxn = bitdb.TxnBegin();
@@ -339,6 +428,8 @@ public:
 
     bool TxnCommit()
     {
+        if (plog)
+            return plog->TxnCommit(this);
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->commit(0);
@@ -348,6 +439,8 @@ public:
 
     bool TxnAbort()
     {
+        if (plog)
+            return plog->TxnAbort(this);
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->abort();
@@ -355,6 +448,30 @@ public:
         return (ret == 0);
     }
 
+    /**
+     * Start a batch of writes, for bulk operations: rather than committing each
+     * write by itself, group them into transactions of nMaxWrites writes, until
+     * BatchCommit. Writes through other handles to the same database wait for
+     * the open transaction, so make all the writes of the batch through this one.
+     */
+    bool BatchBegin(unsigned int nMaxWrites = DEFAULT_WALLET_BATCH_WRITES)
+    {
+        if (nMaxWrites == 0 || !TxnBegin())
+            return false;
+        nBatchWrites = 0;
+        nBatchMaxWrites = nMaxWrites;
+        return true;
+    }
+
+    /** Commit the writes of the batch not committed yet, and end it */
+    bool BatchCommit()
+    {
+        if (nBatchMaxWrites == 0)
+            return false;
+        nBatchMaxWrites = 0;
+        return TxnCommit();
+    }
+
     bool ReadVersion(int& nVersion)
     {
         nVersion = 0;
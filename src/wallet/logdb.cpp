@@ -0,0 +1,379 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <wallet/logdb.h>
+
+#include <crypto/common.h>
+#include <hash.h>
+#include <serialize.h>
+#include <streams.h>
+#include <support/cleanse.h>
+#include <util.h>
+
+#include <string.h>
+
+#include <stdexcept>
+
+namespace {
+//! Start of every log file; BerkeleyDB files cannot start with it
+const unsigned char LOGDB_MAGIC[8] = {0xfa, 'w', 'a', 'l', 'l', 'o', 'g', 0x01};
+//! A frame starts with the size of its payload and a checksum of it
+const size_t LOGDB_FRAME_HEADER_SIZE = 8;
+//! Operations in a frame payload
+const uint8_t LOGDB_OP_WRITE = 1;
+const uint8_t LOGDB_OP_ERASE = 2;
+
+uint32_t Checksum(const CLogDB::Data& payload)
+{
+    uint256 hash = Hash(payload.begin(), payload.end());
+    return ReadLE32(hash.begin());
+}
+
+/** What a record takes in a compacted log, near enough */
+uint64_t RecordSize(const CLogDB::Data& key, const CLogDB::Data& value)
+{
+    return 1 + GetSizeOfCompactSize(key.size()) + key.size() + GetSizeOfCompactSize(value.size()) + value.size();
+}
+
+void AppendOp(CLogDB::Data& payload, const CLogDB::Data& key, const CLogDB::Data* pvalue)
+{
+    CDataStream ss(SER_DISK, 0);
+    ss << (pvalue ? LOGDB_OP_WRITE : LOGDB_OP_ERASE);
+    WriteCompactSize(ss, key.size());
+    ss.write(key.data(), key.size());
+    if (pvalue) {
+        WriteCompactSize(ss, pvalue->size());
+        ss.write(pvalue->data(), pvalue->size());
+    }
+    payload.insert(payload.end(), ss.begin(), ss.end());
+}
+
+void ReadData(CDataStream& ss, CLogDB::Data& data)
+{
+    uint64_t nSize = ReadCompactSize(ss);
+    if (nSize > ss.size())
+        throw std::ios_base::failure("CLogDB: record size out of range");
+    data.assign(ss.begin(), ss.begin() + nSize);
+    ss.ignore(nSize);
+}
+} // namespace
+
+bool CLogDB::DataLess::operator()(const Data& a, const Data& b) const
+{
+    // Bytes compare unsigned, as BerkeleyDB compares them
+    int cmp = memcmp(a.data(), b.data(), std::min(a.size(), b.size()));
+    return cmp < 0 || (cmp == 0 && a.size() < b.size());
+}
+
+bool CLogDB::IsLogFile(const fs::path& path)
+{
+    FILE* f = fsbridge::fopen(path, "rb");
+    if (!f)
+        return false;
+    unsigned char magic[sizeof(LOGDB_MAGIC)];
+    bool ret = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, LOGDB_MAGIC, sizeof(magic)) == 0;
+    fclose(f);
+    return ret;
+}
+
+CLogDB::CLogDB(const fs::path& pathIn) : path(pathIn), file(nullptr), nFileSize(0), nRecordsSize(0), txnOwner(nullptr)
+{
+    if (!fs::exists(path)) {
+        if (!WriteSnapshot(path))
+            throw std::runtime_error(strprintf("CLogDB: Can't create wallet log %s", path.string()));
+    }
+    Load();
+    file = fsbridge::fopen(path, "ab");
+    if (!file)
+        throw std::runtime_error(strprintf("CLogDB: Can't open wallet log %s for writing", path.string()));
+}
+
+CLogDB::~CLogDB()
+{
+    if (file) {
+        fflush(file);
+        FileCommit(file);
+        fclose(file);
+    }
+}
+
+void CLogDB::Load()
+{
+    FILE* f = fsbridge::fopen(path, "rb");
+    if (!f)
+        throw std::runtime_error(strprintf("CLogDB: Can't open wallet log %s", path.string()));
+    Data buf;
+    char chunk[65536];
+    size_t nRead;
+    while ((nRead = fread(chunk, 1, sizeof(chunk), f)) > 0)
+        buf.insert(buf.end(), chunk, chunk + nRead);
+    bool fError = ferror(f);
+    fclose(f);
+    memory_cleanse(chunk, sizeof(chunk));
+    if (fError)
+        throw std::runtime_error(strprintf("CLogDB: Error reading wallet log %s", path.string()));
+    if (buf.size() < sizeof(LOGDB_MAGIC) || memcmp(buf.data(), LOGDB_MAGIC, sizeof(LOGDB_MAGIC)) != 0)
+        throw std::runtime_error(strprintf("CLogDB: %s is not a wallet log", path.string()));
+
+    size_t nPos = sizeof(LOGDB_MAGIC);
+    while (buf.size() - nPos >= LOGDB_FRAME_HEADER_SIZE) {
+        const unsigned char* header = (const unsigned char*)buf.data() + nPos;
+        uint32_t nPayloadSize = ReadLE32(header);
+        if (nPayloadSize > buf.size() - nPos - LOGDB_FRAME_HEADER_SIZE)
+            break;
+        Data payload(buf.begin() + nPos + LOGDB_FRAME_HEADER_SIZE, buf.begin() + nPos + LOGDB_FRAME_HEADER_SIZE + nPayloadSize);
+        if (Checksum(payload) != ReadLE32(header + 4))
+            break;
+
+        // Decode the whole frame before applying any of it
+        std::vector<std::pair<Data, std::pair<bool, Data>>> ops;
+        try {
+            CDataStream ss(payload, SER_DISK, 0);
+            while (!ss.empty()) {
+                uint8_t op;
+                ss >> op;
+                if (op != LOGDB_OP_WRITE && op != LOGDB_OP_ERASE)
+                    throw std::ios_base::failure("CLogDB: unknown operation");
+                ops.emplace_back();
+                ReadData(ss, ops.back().first);
+                ops.back().second.first = op == LOGDB_OP_WRITE;
+                if (op == LOGDB_OP_WRITE)
+                    ReadData(ss, ops.back().second.second);
+            }
+        } catch (const std::exception& e) {
+            LogPrintf("CLogDB: Undecodable frame in %s at %u: %s\n", path.string(), nPos, e.what());
+            break;
+        }
+        for (const auto& op : ops)
+            SetRecord(op.first, op.second.first ? &op.second.second : nullptr);
+        nPos += LOGDB_FRAME_HEADER_SIZE + nPayloadSize;
+    }
+
+    if (nPos < buf.size()) {
+        // What follows the last whole frame was being written when we stopped
+        LogPrintf("CLogDB: Dropping %u bytes of incomplete writes at the end of %s\n", buf.size() - nPos, path.string());
+        FILE* f = fsbridge::fopen(path, "rb+");
+        if (!f || !TruncateFile(f, nPos)) {
+            if (f)
+                fclose(f);
+            throw std::runtime_error(strprintf("CLogDB: Can't truncate wallet log %s", path.string()));
+        }
+        FileCommit(f);
+        fclose(f);
+    }
+    nFileSize = nPos;
+}
+
+void CLogDB::SetRecord(const Data& key, const Data* pvalue)
+{
+    auto it = records.find(key);
+    if (it != records.end()) {
+        nRecordsSize -= RecordSize(it->first, it->second);
+        if (!pvalue) {
+            records.erase(it);
+            return;
+        }
+        it->second = *pvalue;
+    } else {
+        if (!pvalue)
+            return;
+        it = records.emplace(key, *pvalue).first;
+    }
+    nRecordsSize += RecordSize(it->first, it->second);
+}
+
+void CLogDB::WaitForTxn(std::unique_lock<std::mutex>& lock, const void* owner)
+{
+    condTxn.wait(lock, [this, owner] { return txnOwner == nullptr || txnOwner == owner; });
+}
+
+bool CLogDB::AppendFrame(const Data& payload)
+{
+    if (!file)
+        return false;
+    unsigned char header[LOGDB_FRAME_HEADER_SIZE];
+    WriteLE32(header, payload.size());
+    WriteLE32(header + 4, Checksum(payload));
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header) ||
+        fwrite(payload.data(), 1, payload.size(), file) != payload.size() ||
+        fflush(file) != 0) {
+        // Don't leave a torn frame for the next ones to be appended after
+        LogPrintf("CLogDB: Error appending to %s\n", path.string());
+        TruncateFile(file, nFileSize);
+        return false;
+    }
+    nFileSize += sizeof(header) + payload.size();
+    return true;
+}
+
+bool CLogDB::Apply(std::unique_lock<std::mutex>& lock, const void* owner, const Data& key, const Data* pvalue)
+{
+    WaitForTxn(lock, owner);
+    auto it = records.find(key);
+    if (!pvalue && it == records.end())
+        return true;
+
+    if (txnOwner) {
+        txnUndo.emplace_back(key, std::make_pair(it != records.end(), it != records.end() ? it->second : Data()));
+        AppendOp(txnFrame, key, pvalue);
+    } else {
+        Data payload;
+        AppendOp(payload, key, pvalue);
+        if (!AppendFrame(payload))
+            return false;
+    }
+    SetRecord(key, pvalue);
+    return true;
+}
+
+bool CLogDB::Read(const Data& key, Data& value)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    auto it = records.find(key);
+    if (it == records.end())
+        return false;
+    value = it->second;
+    return true;
+}
+
+bool CLogDB::Exists(const Data& key)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    return records.count(key) != 0;
+}
+
+bool CLogDB::Write(const Data& key, const Data& value, bool fOverwrite, const void* owner)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    WaitForTxn(lock, owner);
+    if (!fOverwrite && records.count(key))
+        return false;
+    return Apply(lock, owner, key, &value);
+}
+
+bool CLogDB::Erase(const Data& key, const void* owner)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    return Apply(lock, owner, key, nullptr);
+}
+
+bool CLogDB::ReadNext(Data& key, Data& value, bool fInclusive)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    auto it = fInclusive ? records.lower_bound(key) : records.upper_bound(key);
+    if (it == records.end())
+        return false;
+    key = it->first;
+    value = it->second;
+    return true;
+}
+
+bool CLogDB::TxnBegin(const void* owner)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    WaitForTxn(lock, owner);
+    if (txnOwner)
+        return false;
+    txnOwner = owner;
+    return true;
+}
+
+bool CLogDB::TxnCommit(const void* owner)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    if (txnOwner != owner)
+        return false;
+    bool ret = txnFrame.empty() || AppendFrame(txnFrame);
+    if (!ret) {
+        for (auto it = txnUndo.rbegin(); it != txnUndo.rend(); ++it)
+            SetRecord(it->first, it->second.first ? &it->second.second : nullptr);
+    }
+    txnFrame.clear();
+    txnUndo.clear();
+    txnOwner = nullptr;
+    condTxn.notify_all();
+    return ret;
+}
+
+bool CLogDB::TxnAbort(const void* owner)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    if (txnOwner != owner)
+        return false;
+    for (auto it = txnUndo.rbegin(); it != txnUndo.rend(); ++it)
+        SetRecord(it->first, it->second.first ? &it->second.second : nullptr);
+    txnFrame.clear();
+    txnUndo.clear();
+    txnOwner = nullptr;
+    condTxn.notify_all();
+    return true;
+}
+
+bool CLogDB::Flush()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    if (!file || fflush(file) != 0)
+        return false;
+    FileCommit(file);
+    return true;
+}
+
+bool CLogDB::WriteSnapshot(const fs::path& pathDest)
+{
+    FILE* f = fsbridge::fopen(pathDest, "wb");
+    if (!f)
+        return false;
+    Data payload;
+    for (const auto& entry : records)
+        AppendOp(payload, entry.first, &entry.second);
+    unsigned char header[LOGDB_FRAME_HEADER_SIZE];
+    WriteLE32(header, payload.size());
+    WriteLE32(header + 4, Checksum(payload));
+    bool ret = fwrite(LOGDB_MAGIC, 1, sizeof(LOGDB_MAGIC), f) == sizeof(LOGDB_MAGIC);
+    if (ret && !payload.empty())
+        ret = fwrite(header, 1, sizeof(header), f) == sizeof(header) && fwrite(payload.data(), 1, payload.size(), f) == payload.size();
+    ret = ret && fflush(f) == 0;
+    if (ret)
+        FileCommit(f);
+    fclose(f);
+    return ret;
+}
+
+bool CLogDB::Compact(bool fForce)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    if (txnOwner || !file)
+        return false;
+    if (!fForce && (nFileSize < LOGDB_COMPACT_MIN_SIZE || nFileSize <= LOGDB_COMPACT_RATIO * nRecordsSize))
+        return true;
+
+    int64_t nStart = GetTimeMillis();
+    uint64_t nFileSizeOld = nFileSize;
+    fs::path pathCompact = path.string() + ".compact";
+    if (!WriteSnapshot(pathCompact)) {
+        LogPrintf("CLogDB: Can't write %s\n", pathCompact.string());
+        fs::remove(pathCompact);
+        return false;
+    }
+    fclose(file);
+    bool ret = RenameOver(pathCompact, path);
+    if (!ret)
+        LogPrintf("CLogDB: Can't rename %s over %s\n", pathCompact.string(), path.string());
+    file = fsbridge::fopen(path, "ab");
+    if (!file) {
+        LogPrintf("CLogDB: Can't reopen %s\n", path.string());
+        return false;
+    }
+    if (ret)
+        nFileSize = fs::file_size(path);
+    LogPrint(BCLog::DB, "CLogDB: Compacted %s from %u to %u bytes in %dms\n", path.string(), nFileSizeOld, nFileSize, GetTimeMillis() - nStart);
+    return ret;
+}
+
+bool CLogDB::Backup(const fs::path& pathDest)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    WaitForTxn(lock, nullptr);
+    return WriteSnapshot(pathDest);
+}
@@ -0,0 +1,116 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_LOGDB_H
+#define BITCOIN_WALLET_LOGDB_H
+
+#include <fs.h>
+#include <support/allocators/zeroafterfree.h>
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** Default for -walletbackend, the format new wallets are created in */
+static const char* const DEFAULT_WALLET_BACKEND = "bdb";
+/** Compact a log once it is this many times the size of the records it holds */
+static const uint64_t LOGDB_COMPACT_RATIO = 2;
+/** ...and at least this large */
+static const uint64_t LOGDB_COMPACT_MIN_SIZE = 1 << 20;
+
+/**
+ * A wallet database kept as an append-only log, as an alternative to
+ * BerkeleyDB (see -walletbackend). The records are all held in memory, sorted
+ * as BerkeleyDB sorts them. Each write outside a transaction, and each
+ * committed transaction, is appended to the file as a single frame with a
+ * checksum; a frame torn by a crash fails its checksum and is dropped when
+ * the log is read back, so transactions are atomic. Once the log is mostly
+ * records since overwritten or erased, it is compacted by writing the
+ * records to a new file and renaming that over the log.
+ *
+ * Every wallet is a file of its own; nothing is shared between wallets, and
+ * there is no environment or log directory to checkpoint.
+ *
+ * Transactions belong to an owner (the CDB handle). While one is open, writes
+ * of other owners wait for it to end; their reads do not, and see the writes
+ * of the open transaction.
+ */
+class CLogDB
+{
+public:
+    typedef CSerializeData Data;
+
+    /** Whether the file at path is a log, rather than a BerkeleyDB file */
+    static bool IsLogFile(const fs::path& path);
+
+    /** Open the log at path, creating it if it does not exist; throws std::runtime_error on failure */
+    explicit CLogDB(const fs::path& path);
+    ~CLogDB();
+
+    CLogDB(const CLogDB&) = delete;
+    CLogDB& operator=(const CLogDB&) = delete;
+
+    bool Read(const Data& key, Data& value);
+    bool Exists(const Data& key);
+    bool Write(const Data& key, const Data& value, bool fOverwrite, const void* owner);
+    bool Erase(const Data& key, const void* owner);
+
+    /**
+     * Read the first record with a key after key, or from key on if
+     * fInclusive; return false if there is none.
+     */
+    bool ReadNext(Data& key, Data& value, bool fInclusive);
+
+    bool TxnBegin(const void* owner);
+    bool TxnCommit(const void* owner);
+    bool TxnAbort(const void* owner);
+
+    /** Make the records written so far durable */
+    bool Flush();
+    /** Compact the log if it is mostly overwritten records; fForce compacts it anyway */
+    bool Compact(bool fForce = false);
+    /** Write the records, compacted, to a new log at pathDest */
+    bool Backup(const fs::path& pathDest);
+
+private:
+    struct DataLess {
+        bool operator()(const Data& a, const Data& b) const;
+    };
+    typedef std::map<Data, Data, DataLess> RecordMap;
+
+    const fs::path path;
+    FILE* file;
+
+    std::mutex cs;
+    //! Signalled when a transaction ends
+    std::condition_variable condTxn;
+    RecordMap records;
+    //! Bytes of the file, and bytes the records would take in a compacted one
+    uint64_t nFileSize;
+    uint64_t nRecordsSize;
+
+    //! The owner of the open transaction, or nullptr
+    const void* txnOwner;
+    //! Operations of the open transaction, as they go into its frame
+    Data txnFrame;
+    //! Records the open transaction changed, with whether they existed and their value before
+    std::vector<std::pair<Data, std::pair<bool, Data>>> txnUndo;
+
+    void Load();
+    /** Set (pvalue set) or erase a record in memory */
+    void SetRecord(const Data& key, const Data* pvalue);
+    /** Wait until no other owner has a transaction open */
+    void WaitForTxn(std::unique_lock<std::mutex>& lock, const void* owner);
+    /** Apply a write (pvalue set) or erase, and queue or append it */
+    bool Apply(std::unique_lock<std::mutex>& lock, const void* owner, const Data& key, const Data* pvalue);
+    bool AppendFrame(const Data& payload);
+    bool WriteSnapshot(const fs::path& pathDest);
+};
+
+#endif // BITCOIN_WALLET_LOGDB_H
@@ -0,0 +1,123 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <wallet/rescan.h>
+
+#include <chainparams.h>
+#include <script/ismine.h>
+#include <util.h>
+#include <validation.h>
+#include <wallet/wallet.h>
+
+void CRescanPrefetcher::MatchOutputs(const CWallet& wallet, Block& block)
+{
+    // Read the generation first: a key added while matching changes it
+    block.nGeneration = wallet.GetKeyStoreGeneration();
+    block.vOutputIsMine.assign(block.block.vtx.size(), false);
+    for (size_t i = 0; i < block.block.vtx.size(); i++) {
+        for (const CTxOut& txout : block.block.vtx[i]->vout) {
+            if (::IsMine(wallet, txout.scriptPubKey) != ISMINE_NO) {
+                block.vOutputIsMine[i] = true;
+                break;
+            }
+        }
+    }
+}
+
+void CRescanPrefetcher::Read(Block& block) const
+{
+    block.fRead = ReadBlockFromDisk(block.block, block.pindex, Params().GetConsensus());
+    if (block.fRead)
+        MatchOutputs(wallet, block);
+}
+
+void CRescanPrefetcher::ThreadRead()
+{
+    RenameThread("bitcoin-rescan");
+    std::unique_lock<std::mutex> lock(cs);
+    while (true) {
+        condQueued.wait(lock, [this] { return fStop || !queue.empty(); });
+        if (fStop)
+            return;
+        uint64_t nPos = queue.front().first;
+        std::unique_ptr<Block> block(new Block());
+        block->pindex = queue.front().second;
+        queue.pop_front();
+
+        lock.unlock();
+        Read(*block);
+        lock.lock();
+
+        // Drop it if the rescan cleared its queue meanwhile
+        if (nPos >= nNextPop) {
+            read[nPos] = std::move(block);
+            condRead.notify_all();
+        }
+    }
+}
+
+CRescanPrefetcher::CRescanPrefetcher(const CWallet& _wallet, int nThreads) :
+    wallet(_wallet), nMaxPending(nThreads > 0 ? nThreads * RESCAN_BLOCKS_PER_THREAD : 1),
+    nNextPush(0), nNextPop(0), fStop(false)
+{
+    for (int i = 0; i < nThreads; i++)
+        threads.emplace_back(&CRescanPrefetcher::ThreadRead, this);
+}
+
+CRescanPrefetcher::~CRescanPrefetcher()
+{
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        fStop = true;
+        condQueued.notify_all();
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+bool CRescanPrefetcher::Full()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    return nNextPush - nNextPop >= nMaxPending;
+}
+
+void CRescanPrefetcher::Push(CBlockIndex* pindex)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    queue.emplace_back(nNextPush++, pindex);
+    condQueued.notify_one();
+}
+
+std::unique_ptr<CRescanPrefetcher::Block> CRescanPrefetcher::Pop()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    if (nNextPop == nNextPush)
+        return nullptr;
+
+    std::unique_ptr<Block> block;
+    if (threads.empty()) {
+        block.reset(new Block());
+        block->pindex = queue.front().second;
+        queue.pop_front();
+        nNextPop++;
+        lock.unlock();
+        Read(*block);
+        return block;
+    }
+
+    condRead.wait(lock, [this] { return read.count(nNextPop) != 0; });
+    auto it = read.find(nNextPop);
+    block = std::move(it->second);
+    read.erase(it);
+    nNextPop++;
+    return block;
+}
+
+void CRescanPrefetcher::Clear()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    queue.clear();
+    read.clear();
+    nNextPop = nNextPush;
+}
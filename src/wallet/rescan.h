@@ -0,0 +1,100 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_RESCAN_H
+#define BITCOIN_WALLET_RESCAN_H
+
+#include <primitives/block.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+class CBlockIndex;
+class CWallet;
+
+/** Default for -rescanthreads, 0 = read blocks on the rescanning thread */
+static const int DEFAULT_RESCAN_THREADS = 0;
+/** Maximum for -rescanthreads */
+static const int MAX_RESCAN_THREADS = 16;
+/** Blocks each thread may have read ahead of the rescan */
+static const int RESCAN_BLOCKS_PER_THREAD = 4;
+
+/**
+ * Reads blocks ahead of a wallet rescan, on a number of threads, and matches
+ * their outputs against the wallet, so that the rescanning thread only has to
+ * apply the transactions that may involve the wallet, in order.
+ *
+ * A transaction can involve the wallet without any output matching, by
+ * spending from the wallet or conflicting with a wallet transaction; that
+ * depends on the transactions applied before it, so the rescanning thread
+ * checks it itself (see CWallet::IsConnectedToWallet). Keys added while
+ * blocks are read ahead, as the keypool is topped up, make the output matches
+ * stale; each block records the CWallet::GetKeyStoreGeneration it was matched
+ * at so that it can be matched again.
+ *
+ * Without threads, blocks are read and matched when they are taken.
+ */
+class CRescanPrefetcher
+{
+public:
+    struct Block {
+        CBlockIndex* pindex;
+        //! Whether the block could be read from disk
+        bool fRead;
+        CBlock block;
+        //! For each transaction, whether any of its outputs is the wallet's
+        std::vector<bool> vOutputIsMine;
+        //! The wallet's key store generation before the outputs were matched
+        uint64_t nGeneration;
+    };
+
+    /** Set vOutputIsMine, and nGeneration, for a block that was read */
+    static void MatchOutputs(const CWallet& wallet, Block& block);
+
+private:
+    const CWallet& wallet;
+    const size_t nMaxPending;
+
+    std::mutex cs;
+    //! Signalled when blocks are queued or the threads should stop
+    std::condition_variable condQueued;
+    //! Signalled when a block has been read
+    std::condition_variable condRead;
+    //! Blocks to read, with their position in the rescan
+    std::deque<std::pair<uint64_t, CBlockIndex*>> queue;
+    //! Blocks read, by position in the rescan
+    std::map<uint64_t, std::unique_ptr<Block>> read;
+    //! Position of the next block pushed, and of the next block taken
+    uint64_t nNextPush;
+    uint64_t nNextPop;
+    bool fStop;
+    std::vector<std::thread> threads;
+
+    void Read(Block& block) const;
+    void ThreadRead();
+
+public:
+    CRescanPrefetcher(const CWallet& wallet, int nThreads);
+    ~CRescanPrefetcher();
+
+    CRescanPrefetcher(const CRescanPrefetcher&) = delete;
+    CRescanPrefetcher& operator=(const CRescanPrefetcher&) = delete;
+
+    /** Whether as many blocks are pushed and not taken yet as may be read ahead */
+    bool Full();
+    /** Queue the next block of the rescan */
+    void Push(CBlockIndex* pindex);
+    /** Take the oldest block pushed, waiting until it is read; nullptr if there is none */
+    std::unique_ptr<Block> Pop();
+    /** Forget all blocks pushed and not taken yet */
+    void Clear();
+};
+
+#endif // BITCOIN_WALLET_RESCAN_H
@@ -9,6 +9,7 @@
 #include <wallet/init.h>
 #include <validation.h>
 #include <script/script.h>
+#include <script/sign.h>
 #include <script/standard.h>
 #include <sync.h>
 #include <util.h>
@@ -27,6 +28,9 @@
 
 #include <univalue.h>
 
+/** Dump file lines importwallet decodes and adds per database batch, and keys dumpwallet writes per cs_wallet hold */
+static const size_t IMPORT_WALLET_CHUNK = 1000;
+static const size_t DUMP_WALLET_CHUNK = 1000;
 
 std::string static EncodeDumpTime(int64_t nTime) {
     return DateTimeStrFormat("%Y-%m-%dT%H:%M:%SZ", nTime);
@@ -71,12 +75,10 @@ std::string DecodeDumpString(const std::string &str) {
     return ret.str();
 }
 
-bool GetWalletAddressesForKey(CWallet * const pwallet, const CKeyID &keyid, std::string &strAddr, std::string &strLabel)
+bool GetWalletAddressesForKey(CWallet * const pwallet, const CPubKey &pubkey, std::string &strAddr, std::string &strLabel)
 {
     bool fLabelFound = false;
-    CKey key;
-    pwallet->GetKey(keyid, key);
-    for (const auto& dest : GetAllDestinationsForKey(key.GetPubKey())) {
+    for (const auto& dest : GetAllDestinationsForKey(pubkey)) {
         if (pwallet->mapAddressBook.count(dest)) {
             if (!strAddr.empty()) {
                 strAddr += ",";
@@ -87,7 +89,7 @@ bool GetWalletAddressesForKey(CWallet * const pwallet, const CKeyID &keyid, std:
         }
     }
     if (!fLabelFound) {
-        strAddr = EncodeDestination(GetDestinationForKey(key.GetPubKey(), g_address_type));
+        strAddr = EncodeDestination(GetDestinationForKey(pubkey, g_address_type));
     }
     return fLabelFound;
 }
@@ -124,7 +126,6 @@ UniValue importprivkey(const JSONRPCRequest& request)
         );
 
 
-    WalletRescanReserver reserver(pwallet);
     bool fRescan = true;
     {
         LOCK2(cs_main, pwallet->cs_wallet);
@@ -143,10 +144,6 @@ UniValue importprivkey(const JSONRPCRequest& request)
         if (fRescan && fPruneMode)
             throw JSONRPCError(RPC_WALLET_ERROR, "Rescan is disabled in pruned mode");
 
-        if (fRescan && !reserver.reserve()) {
-            throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is currently rescanning. Abort existing rescan or wait.");
-        }
-
         CBitcoinSecret vchSecret;
         bool fGood = vchSecret.SetString(strSecret);
 
@@ -181,7 +178,7 @@ UniValue importprivkey(const JSONRPCRequest& request)
         }
     }
     if (fRescan) {
-        pwallet->RescanFromTime(TIMESTAMP_MIN, reserver, true /* update */);
+        pwallet->RescanFromTimeQueued(TIMESTAMP_MIN, true /* update */);
     }
 
     return NullUniValue;
@@ -197,7 +194,8 @@ UniValue abortrescan(const JSONRPCRequest& request)
     if (request.fHelp || request.params.size() > 0)
         throw std::runtime_error(
             "abortrescan\n"
-            "\nStops current wallet rescan triggered by an RPC call, e.g. by an importprivkey call.\n"
+            "\nStops current wallet rescan triggered by an RPC call, e.g. by an importprivkey call,\n"
+            "and drops the rescans other imports queued behind it. Those imports are kept without a rescan.\n"
             "\nExamples:\n"
             "\nImport a private key\n"
             + HelpExampleCli("importprivkey", "\"mykey\"") +
@@ -208,7 +206,7 @@ UniValue abortrescan(const JSONRPCRequest& request)
         );
 
     ObserveSafeMode();
-    if (!pwallet->IsScanning() || pwallet->IsAbortingRescan()) return false;
+    if ((!pwallet->IsScanning() && pwallet->GetQueuedRescans() == 0) || pwallet->IsAbortingRescan()) return false;
     pwallet->AbortRescan();
     return true;
 }
@@ -291,11 +289,6 @@ UniValue importaddress(const JSONRPCRequest& request)
     if (fRescan && fPruneMode)
         throw JSONRPCError(RPC_WALLET_ERROR, "Rescan is disabled in pruned mode");
 
-    WalletRescanReserver reserver(pwallet);
-    if (fRescan && !reserver.reserve()) {
-        throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is currently rescanning. Abort existing rescan or wait.");
-    }
-
     // Whether to import a p2sh version, too
     bool fP2SH = false;
     if (!request.params[3].isNull())
@@ -319,7 +312,7 @@ UniValue importaddress(const JSONRPCRequest& request)
     }
     if (fRescan)
     {
-        pwallet->RescanFromTime(TIMESTAMP_MIN, reserver, true /* update */);
+        pwallet->RescanFromTimeQueued(TIMESTAMP_MIN, true /* update */);
         pwallet->ReacceptWalletTransactions();
     }
 
@@ -464,11 +457,6 @@ UniValue importpubkey(const JSONRPCRequest& request)
     if (fRescan && fPruneMode)
         throw JSONRPCError(RPC_WALLET_ERROR, "Rescan is disabled in pruned mode");
 
-    WalletRescanReserver reserver(pwallet);
-    if (fRescan && !reserver.reserve()) {
-        throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is currently rescanning. Abort existing rescan or wait.");
-    }
-
     if (!IsHex(request.params[0].get_str()))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Pubkey must be a hex string");
     std::vector<unsigned char> data(ParseHex(request.params[0].get_str()));
@@ -487,7 +475,7 @@ UniValue importpubkey(const JSONRPCRequest& request)
     }
     if (fRescan)
     {
-        pwallet->RescanFromTime(TIMESTAMP_MIN, reserver, true /* update */);
+        pwallet->RescanFromTimeQueued(TIMESTAMP_MIN, true /* update */);
         pwallet->ReacceptWalletTransactions();
     }
 
@@ -520,31 +508,30 @@ UniValue importwallet(const JSONRPCRequest& request)
     if (fPruneMode)
         throw JSONRPCError(RPC_WALLET_ERROR, "Importing wallets is disabled in pruned mode");
 
-    WalletRescanReserver reserver(pwallet);
-    if (!reserver.reserve()) {
-        throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is currently rescanning. Abort existing rescan or wait.");
-    }
-
     int64_t nTimeBegin = 0;
     bool fGood = true;
     {
         LOCK2(cs_main, pwallet->cs_wallet);
-
         EnsureWalletIsUnlocked(pwallet);
-
-        std::ifstream file;
-        file.open(request.params[0].get_str().c_str(), std::ios::in | std::ios::ate);
-        if (!file.is_open()) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open wallet dump file");
-        }
         nTimeBegin = chainActive.Tip()->GetBlockTime();
+    }
 
-        int64_t nFilesize = std::max((int64_t)1, (int64_t)file.tellg());
-        file.seekg(0, file.beg);
+    std::ifstream file;
+    file.open(request.params[0].get_str().c_str(), std::ios::in | std::ios::ate);
+    if (!file.is_open()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open wallet dump file");
+    }
 
-        pwallet->ShowProgress(_("Importing..."), 0); // show progress dialog in GUI
-        while (file.good()) {
-            pwallet->ShowProgress("", std::max(1, std::min(99, (int)(((double)file.tellg() / (double)nFilesize) * 100))));
+    int64_t nFilesize = std::max((int64_t)1, (int64_t)file.tellg());
+    file.seekg(0, file.beg);
+
+    // The file is read and its keys decoded a chunk at a time without any
+    // lock held, and each chunk is added in one database batch under
+    // cs_main and cs_wallet, so other RPCs get a turn between chunks
+    pwallet->ShowProgress(_("Importing..."), 0); // show progress dialog in GUI
+    while (file.good()) {
+        std::vector<std::vector<std::string>> vLines;
+        while (file.good() && vLines.size() < IMPORT_WALLET_CHUNK) {
             std::string line;
             std::getline(file, line);
             if (line.empty() || line[0] == '#')
@@ -554,11 +541,32 @@ UniValue importwallet(const JSONRPCRequest& request)
             boost::split(vstr, line, boost::is_any_of(" "));
             if (vstr.size() < 2)
                 continue;
+            vLines.push_back(std::move(vstr));
+        }
+
+        // Decoding a key derives its public key, so spread that over several threads
+        std::vector<CKey> vKeys(vLines.size());
+        std::vector<CPubKey> vPubKeys(vLines.size());
+        ForEachInput(vLines.size(), [&](unsigned int i) {
             CBitcoinSecret vchSecret;
-            if (vchSecret.SetString(vstr[0])) {
-                CKey key = vchSecret.GetKey();
-                CPubKey pubkey = key.GetPubKey();
-                assert(key.VerifyPubKey(pubkey));
+            if (vchSecret.SetString(vLines[i][0])) {
+                vKeys[i] = vchSecret.GetKey();
+                vPubKeys[i] = vKeys[i].GetPubKey();
+                assert(vKeys[i].VerifyPubKey(vPubKeys[i]));
+            }
+        });
+
+        LOCK2(cs_main, pwallet->cs_wallet);
+        if (pwallet->IsLocked()) {
+            pwallet->ShowProgress("", 100); // hide progress dialog in GUI
+            throw JSONRPCError(RPC_WALLET_UNLOCK_NEEDED, "Error: Wallet was locked during the import, keys imported so far are kept.");
+        }
+        WalletBatchWriter batch(*pwallet);
+        for (size_t i = 0; i < vLines.size(); i++) {
+            const std::vector<std::string>& vstr = vLines[i];
+            if (vKeys[i].IsValid()) {
+                const CKey& key = vKeys[i];
+                const CPubKey& pubkey = vPubKeys[i];
                 CKeyID keyid = pubkey.GetID();
                 if (pwallet->HaveKey(keyid)) {
                     LogPrintf("Skipping import of %s (key already present)\n", EncodeDestination(keyid));
@@ -607,11 +615,18 @@ UniValue importwallet(const JSONRPCRequest& request)
                }
             }
         }
-        file.close();
+        if (!batch.Commit())
+            fGood = false;
+        if (file.good())
+            pwallet->ShowProgress("", std::max(1, std::min(99, (int)(((double)file.tellg() / (double)nFilesize) * 100))));
+    }
+    file.close();
+    {
+        LOCK(pwallet->cs_wallet);
         pwallet->ShowProgress("", 100); // hide progress dialog in GUI
         pwallet->UpdateTimeFirstKey(nTimeBegin);
     }
-    pwallet->RescanFromTime(nTimeBegin, reserver, false /* update */);
+    pwallet->RescanFromTimeQueued(nTimeBegin, false /* update */);
     pwallet->MarkDirty();
 
     if (!fGood)
@@ -688,10 +703,6 @@ UniValue dumpwallet(const JSONRPCRequest& request)
             + HelpExampleRpc("dumpwallet", "\"test\"")
         );
 
-    LOCK2(cs_main, pwallet->cs_wallet);
-
-    EnsureWalletIsUnlocked(pwallet);
-
     boost::filesystem::path filepath = request.params[0].get_str();
     filepath = boost::filesystem::absolute(filepath);
 
@@ -704,86 +715,121 @@ UniValue dumpwallet(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_PARAMETER, filepath.string() + " already exists. If you are sure this is what you want, move it out of the way first");
     }
 
-    std::ofstream file;
-    file.open(filepath.string().c_str());
-    if (!file.is_open())
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open wallet dump file");
+    // Take a snapshot of what to dump, then write the keys a chunk at a
+    // time; cs_main is not needed past the snapshot and cs_wallet is only
+    // held to read each chunk, not to format or write it
+    std::vector<std::pair<int64_t, CKeyID> > vKeyBirth;
+    std::vector<std::pair<CScriptID, CScript> > vScripts;
+    std::vector<int64_t> vScriptTimes;
+    CKeyID masterKeyID;
+    std::string strHeader;
+    {
+        LOCK2(cs_main, pwallet->cs_wallet);
 
-    std::map<CTxDestination, int64_t> mapKeyBirth;
-    const std::map<CKeyID, int64_t>& mapKeyPool = pwallet->GetAllReserveKeys();
-    pwallet->GetKeyBirthTimes(mapKeyBirth);
+        EnsureWalletIsUnlocked(pwallet);
 
-    std::set<CScriptID> scripts = pwallet->GetCScripts();
-    // TODO: include scripts in GetKeyBirthTimes() output instead of separate
+        std::map<CTxDestination, int64_t> mapKeyBirth;
+        pwallet->GetKeyBirthTimes(mapKeyBirth);
+        for (const auto& entry : mapKeyBirth) {
+            if (const CKeyID* keyID = boost::get<CKeyID>(&entry.first)) { // set and test
+                vKeyBirth.push_back(std::make_pair(entry.second, *keyID));
+            }
+        }
 
-    // sort time/key pairs
-    std::vector<std::pair<int64_t, CKeyID> > vKeyBirth;
-    for (const auto& entry : mapKeyBirth) {
-        if (const CKeyID* keyID = boost::get<CKeyID>(&entry.first)) { // set and test
-            vKeyBirth.push_back(std::make_pair(entry.second, *keyID));
+        // TODO: include scripts in GetKeyBirthTimes() output instead of separate
+        for (const CScriptID &scriptid : pwallet->GetCScripts()) {
+            CScript script;
+            if (pwallet->GetCScript(scriptid, script)) {
+                // get birth times for scripts with metadata
+                auto it = pwallet->m_script_metadata.find(scriptid);
+                vScripts.push_back(std::make_pair(scriptid, script));
+                vScriptTimes.push_back(it != pwallet->m_script_metadata.end() ? it->second.nCreateTime : -1);
+            }
         }
-    }
-    mapKeyBirth.clear();
-    std::sort(vKeyBirth.begin(), vKeyBirth.end());
 
-    // produce output
-    file << strprintf("# Wallet dump created by Bitcoin %s\n", CLIENT_BUILD);
-    file << strprintf("# * Created on %s\n", EncodeDumpTime(GetTime()));
-    file << strprintf("# * Best block at time of backup was %i (%s),\n", chainActive.Height(), chainActive.Tip()->GetBlockHash().ToString());
-    file << strprintf("#   mined on %s\n", EncodeDumpTime(chainActive.Tip()->GetBlockTime()));
-    file << "\n";
+        strHeader += strprintf("# Wallet dump created by Bitcoin %s\n", CLIENT_BUILD);
+        strHeader += strprintf("# * Created on %s\n", EncodeDumpTime(GetTime()));
+        strHeader += strprintf("# * Best block at time of backup was %i (%s),\n", chainActive.Height(), chainActive.Tip()->GetBlockHash().ToString());
+        strHeader += strprintf("#   mined on %s\n", EncodeDumpTime(chainActive.Tip()->GetBlockTime()));
+        strHeader += "\n";
 
-    // add the base58check encoded extended master if the wallet uses HD
-    CKeyID masterKeyID = pwallet->GetHDChain().masterKeyID;
-    if (!masterKeyID.IsNull())
-    {
-        CKey key;
-        if (pwallet->GetKey(masterKeyID, key)) {
-            CExtKey masterKey;
-            masterKey.SetMaster(key.begin(), key.size());
+        // add the base58check encoded extended master if the wallet uses HD
+        masterKeyID = pwallet->GetHDChain().masterKeyID;
+        if (!masterKeyID.IsNull())
+        {
+            CKey key;
+            if (pwallet->GetKey(masterKeyID, key)) {
+                CExtKey masterKey;
+                masterKey.SetMaster(key.begin(), key.size());
 
-            CBitcoinExtKey b58extkey;
-            b58extkey.SetKey(masterKey);
+                CBitcoinExtKey b58extkey;
+                b58extkey.SetKey(masterKey);
 
-            file << "# extended private masterkey: " << b58extkey.ToString() << "\n\n";
+                strHeader += "# extended private masterkey: " + b58extkey.ToString() + "\n\n";
+            }
         }
     }
-    for (std::vector<std::pair<int64_t, CKeyID> >::const_iterator it = vKeyBirth.begin(); it != vKeyBirth.end(); it++) {
-        const CKeyID &keyid = it->second;
-        std::string strTime = EncodeDumpTime(it->first);
-        std::string strAddr;
-        std::string strLabel;
-        CKey key;
-        if (pwallet->GetKey(keyid, key)) {
-            file << strprintf("%s %s ", CBitcoinSecret(key).ToString(), strTime);
-            if (GetWalletAddressesForKey(pwallet, keyid, strAddr, strLabel)) {
-               file << strprintf("label=%s", strLabel);
-            } else if (keyid == masterKeyID) {
-                file << "hdmaster=1";
-            } else if (mapKeyPool.count(keyid)) {
-                file << "reserve=1";
-            } else if (pwallet->mapKeyMetadata[keyid].hdKeypath == "m") {
-                file << "inactivehdmaster=1";
-            } else {
-                file << "change=1";
+
+    // sort time/key pairs
+    std::sort(vKeyBirth.begin(), vKeyBirth.end());
+
+    std::ofstream file;
+    file.open(filepath.string().c_str());
+    if (!file.is_open())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open wallet dump file");
+
+    // produce output
+    file << strHeader;
+    for (size_t nChunk = 0; nChunk < vKeyBirth.size(); nChunk += DUMP_WALLET_CHUNK) {
+        const size_t nKeys = std::min(DUMP_WALLET_CHUNK, vKeyBirth.size() - nChunk);
+        std::vector<CKey> vKeys(nKeys);
+        std::vector<std::string> vSuffixes(nKeys);
+        {
+            LOCK(pwallet->cs_wallet);
+            if (pwallet->IsLocked()) {
+                throw JSONRPCError(RPC_WALLET_UNLOCK_NEEDED, "Error: Wallet was locked during the dump, the dump file is incomplete.");
+            }
+            const std::map<CKeyID, int64_t>& mapKeyPool = pwallet->GetAllReserveKeys();
+            for (size_t i = 0; i < nKeys; i++) {
+                const CKeyID &keyid = vKeyBirth[nChunk + i].second;
+                CPubKey pubkey;
+                if (!pwallet->GetKey(keyid, vKeys[i]) || !pwallet->GetPubKey(keyid, pubkey))
+                    continue;
+                std::string strAddr;
+                std::string strLabel;
+                std::string& strSuffix = vSuffixes[i];
+                if (GetWalletAddressesForKey(pwallet, pubkey, strAddr, strLabel)) {
+                   strSuffix = strprintf("label=%s", strLabel);
+                } else if (keyid == masterKeyID) {
+                    strSuffix = "hdmaster=1";
+                } else if (mapKeyPool.count(keyid)) {
+                    strSuffix = "reserve=1";
+                } else if (pwallet->mapKeyMetadata[keyid].hdKeypath == "m") {
+                    strSuffix = "inactivehdmaster=1";
+                } else {
+                    strSuffix = "change=1";
+                }
+                strSuffix += strprintf(" # addr=%s%s\n", strAddr, (pwallet->mapKeyMetadata[keyid].hdKeypath.size() > 0 ? " hdkeypath="+pwallet->mapKeyMetadata[keyid].hdKeypath : ""));
             }
-            file << strprintf(" # addr=%s%s\n", strAddr, (pwallet->mapKeyMetadata[keyid].hdKeypath.size() > 0 ? " hdkeypath="+pwallet->mapKeyMetadata[keyid].hdKeypath : ""));
+        }
+
+        // Encode the secrets of the chunk on several threads
+        std::vector<std::string> vSecrets(nKeys);
+        ForEachInput(nKeys, [&](unsigned int i) {
+            if (vKeys[i].IsValid())
+                vSecrets[i] = CBitcoinSecret(vKeys[i]).ToString();
+        });
+        for (size_t i = 0; i < nKeys; i++) {
+            if (!vSecrets[i].empty())
+                file << strprintf("%s %s ", vSecrets[i], EncodeDumpTime(vKeyBirth[nChunk + i].first)) << vSuffixes[i];
         }
     }
     file << "\n";
-    for (const CScriptID &scriptid : scripts) {
-        CScript script;
-        std::string create_time = "0";
-        std::string address = EncodeDestination(scriptid);
-        // get birth times for scripts with metadata
-        auto it = pwallet->m_script_metadata.find(scriptid);
-        if (it != pwallet->m_script_metadata.end()) {
-            create_time = EncodeDumpTime(it->second.nCreateTime);
-        }
-        if(pwallet->GetCScript(scriptid, script)) {
-            file << strprintf("%s %s script=1", HexStr(script.begin(), script.end()), create_time);
-            file << strprintf(" # addr=%s\n", address);
-        }
+    for (size_t i = 0; i < vScripts.size(); i++) {
+        const CScript& script = vScripts[i].second;
+        std::string create_time = vScriptTimes[i] == -1 ? "0" : EncodeDumpTime(vScriptTimes[i]);
+        file << strprintf("%s %s script=1", HexStr(script.begin(), script.end()), create_time);
+        file << strprintf(" # addr=%s\n", EncodeDestination(vScripts[i].first));
     }
     file << "\n";
     file << "# End of dump\n";
@@ -1186,11 +1232,6 @@ UniValue importmulti(const JSONRPCRequest& mainRequest)
         }
     }
 
-    WalletRescanReserver reserver(pwallet);
-    if (fRescan && !reserver.reserve()) {
-        throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is currently rescanning. Abort existing rescan or wait.");
-    }
-
     int64_t now = 0;
     bool fRunScan = false;
     int64_t nLowestTimestamp = 0;
@@ -1213,6 +1254,7 @@ UniValue importmulti(const JSONRPCRequest& mainRequest)
             fRescan = false;
         }
 
+        WalletBatchWriter batch(*pwallet);
         for (const UniValue& data : requests.getValues()) {
             const int64_t timestamp = std::max(GetImportTimestamp(data, now), minimumTimestamp);
             const UniValue result = ProcessImport(pwallet, data, timestamp);
@@ -1232,9 +1274,12 @@ UniValue importmulti(const JSONRPCRequest& mainRequest)
                 nLowestTimestamp = timestamp;
             }
         }
+        if (!batch.Commit()) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Error writing imported keys and scripts to the wallet");
+        }
     }
     if (fRescan && fRunScan && requests.size()) {
-        int64_t scannedTime = pwallet->RescanFromTime(nLowestTimestamp, reserver, true /* update */);
+        int64_t scannedTime = pwallet->RescanFromTimeQueued(nLowestTimestamp, true /* update */);
         pwallet->ReacceptWalletTransactions();
 
         if (scannedTime > nLowestTimestamp) {
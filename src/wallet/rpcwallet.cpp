@@ -15,6 +15,7 @@
 #include <policy/fees.h>
 #include <policy/policy.h>
 #include <policy/rbf.h>
+#include <rpc/jsonwriter.h>
 #include <rpc/mining.h>
 #include <rpc/safemode.h>
 #include <rpc/server.h>
@@ -169,7 +170,7 @@ UniValue getnewaddress(const JSONRPCRequest& request)
     }
 
     if (!pwallet->IsLocked()) {
-        pwallet->TopUpKeyPool();
+        pwallet->RefillKeyPool();
     }
 
     // Generate a new key that is added to wallet
@@ -254,7 +255,7 @@ UniValue getrawchangeaddress(const JSONRPCRequest& request)
     LOCK2(cs_main, pwallet->cs_wallet);
 
     if (!pwallet->IsLocked()) {
-        pwallet->TopUpKeyPool();
+        pwallet->RefillKeyPool();
     }
 
     OutputType output_type = g_change_type != OUTPUT_TYPE_NONE ? g_change_type : g_address_type;
@@ -1626,12 +1627,11 @@ static void MaybePushAddress(UniValue & entry, const CTxDestination &dest)
  */
 void ListTransactions(CWallet* const pwallet, const CWalletTx& wtx, const std::string& strAccount, int nMinDepth, bool fLong, UniValue& ret, const isminefilter& filter)
 {
-    CAmount nFee;
-    std::string strSentAccount;
-    std::list<COutputEntry> listReceived;
-    std::list<COutputEntry> listSent;
-
-    wtx.GetAmounts(listReceived, listSent, nFee, strSentAccount, filter);
+    std::shared_ptr<const CWalletTx::Amounts> amounts = wtx.GetCachedAmounts(filter);
+    const std::list<COutputEntry>& listReceived = amounts->listReceived;
+    const std::list<COutputEntry>& listSent = amounts->listSent;
+    const CAmount nFee = amounts->nFee;
+    const std::string& strSentAccount = wtx.strFromAccount;
 
     bool fAllAccounts = (strAccount == std::string("*"));
     bool involvesWatchonly = wtx.IsFromMe(ISMINE_WATCH_ONLY);
@@ -1850,6 +1850,15 @@ UniValue listtransactions(const JSONRPCRequest& request)
 
     std::reverse(arrTmp.begin(), arrTmp.end()); // Return oldest to newest
 
+    if (request.resultStream) {
+        JSONStreamWriter& writer = request.resultStream->Begin();
+        writer.BeginArray();
+        for (const UniValue& entry : arrTmp)
+            writer.Value(entry);
+        writer.EndArray();
+        return NullUniValue;
+    }
+
     ret.clear();
     ret.setArray();
     ret.push_backV(arrTmp);
@@ -1857,6 +1866,89 @@ UniValue listtransactions(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue listtransactionspage(const JSONRPCRequest& request)
+{
+    CWallet * const pwallet = GetWalletForJSONRPCRequest(request);
+    if (!EnsureWalletIsAvailable(pwallet, request.fHelp)) {
+        return NullUniValue;
+    }
+
+    if (request.fHelp || request.params.size() > 3)
+        throw std::runtime_error(
+            "listtransactionspage ( count cursor include_watchonly )\n"
+            "\nReturns a page of at least 'count' entries of the wallet history, those of the transactions\n"
+            "just before 'cursor', or the most recent ones if no cursor is given. Unlike the skip argument\n"
+            "of listtransactions, a cursor costs the same however deep into the history it points.\n"
+            "Every entry of a transaction is on the same page, so a page may hold more than 'count'.\n"
+            "\nArguments:\n"
+            "1. count             (numeric, optional, default=10) The number of entries to return at least\n"
+            "2. cursor            (numeric, optional) The \"next\" value of the previous page\n"
+            "3. include_watchonly (bool, optional, default=false) Include transactions to watch-only addresses (see 'importaddress')\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"transactions\": [ ... ],  (array) Entries as listtransactions returns them, oldest to newest\n"
+            "  \"next\": n                 (numeric) The cursor of the page of older entries, omitted if there are none\n"
+            "}\n"
+            "\nExamples:\n"
+            "\nList the most recent 20 entries\n"
+            + HelpExampleCli("listtransactionspage", "20") +
+            "\nList the 20 entries before those\n"
+            + HelpExampleCli("listtransactionspage", "20 1234") +
+            "\nAs a json rpc call\n"
+            + HelpExampleRpc("listtransactionspage", "20, 1234")
+        );
+
+    ObserveSafeMode();
+
+    // Make sure the results are valid at least up to the most recent block
+    // the user could have gotten from another RPC command prior to now
+    pwallet->BlockUntilSyncedToCurrentChain();
+
+    LOCK2(cs_main, pwallet->cs_wallet);
+
+    int nCount = 10;
+    if (!request.params[0].isNull())
+        nCount = request.params[0].get_int();
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+    const CWallet::TxItems& txOrdered = pwallet->wtxOrdered;
+    CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin();
+    if (!request.params[1].isNull()) {
+        // The cursor is the order position of the oldest transaction of the
+        // previous page; seek to the one before it
+        it = CWallet::TxItems::const_reverse_iterator(txOrdered.lower_bound(request.params[1].get_int64()));
+    }
+    isminefilter filter = ISMINE_SPENDABLE;
+    if (!request.params[2].isNull() && request.params[2].get_bool())
+        filter = filter | ISMINE_WATCH_ONLY;
+
+    UniValue transactions(UniValue::VARR);
+    // Entries of one transaction come out oldest first; keep them so when
+    // reversing the page
+    std::vector<UniValue> arrTmp;
+    int64_t nNext = 0;
+    for (; it != txOrdered.rend() && (int)arrTmp.size() < nCount; ++it) {
+        UniValue entries(UniValue::VARR);
+        CWalletTx *const pwtx = (*it).second.first;
+        if (pwtx != nullptr)
+            ListTransactions(pwallet, *pwtx, "*", 0, true, entries, filter);
+        CAccountingEntry *const pacentry = (*it).second.second;
+        if (pacentry != nullptr)
+            AcentryToJSON(*pacentry, "*", entries);
+        const std::vector<UniValue>& values = entries.getValues();
+        arrTmp.insert(arrTmp.end(), values.rbegin(), values.rend());
+        nNext = (*it).first;
+    }
+    std::reverse(arrTmp.begin(), arrTmp.end()); // Return oldest to newest
+    transactions.push_backV(arrTmp);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("transactions", transactions));
+    if (it != txOrdered.rend())
+        ret.push_back(Pair("next", nNext));
+    return ret;
+}
+
 UniValue listaccounts(const JSONRPCRequest& request)
 {
     CWallet * const pwallet = GetWalletForJSONRPCRequest(request);
@@ -2769,6 +2861,12 @@ UniValue getwalletinfo(const JSONRPCRequest& request)
             "  \"unlocked_until\": ttt,           (numeric) the timestamp in seconds since epoch (midnight Jan 1 1970 GMT) that the wallet is unlocked for transfers, or 0 if the wallet is locked\n"
             "  \"paytxfee\": x.xxxx,              (numeric) the transaction fee configuration, set in " + CURRENCY_UNIT + "/kB\n"
             "  \"hdmasterkeyid\": \"<hash160>\"     (string, optional) the Hash160 of the HD master pubkey (only present when HD is enabled)\n"
+            "  \"scanning\":                      (json object) current rescan details, or false if no rescan is in progress\n"
+            "    {\n"
+            "      \"duration\" : xxxx,             (numeric) elapsed seconds since the rescan started\n"
+            "      \"progress\" : x.xxxx,           (numeric) rescan progress [0.0, 1.0]\n"
+            "      \"queued\" : xxxx                (numeric) number of imports waiting to be served by the next rescan\n"
+            "    }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getwalletinfo", "")
@@ -2804,6 +2902,15 @@ UniValue getwalletinfo(const JSONRPCRequest& request)
     obj.push_back(Pair("paytxfee",      ValueFromAmount(payTxFee.GetFeePerK())));
     if (!masterKeyID.IsNull())
          obj.push_back(Pair("hdmasterkeyid", masterKeyID.GetHex()));
+    if (pwallet->IsScanning()) {
+        UniValue scanning(UniValue::VOBJ);
+        scanning.push_back(Pair("duration", pwallet->ScanningDuration() / 1000));
+        scanning.push_back(Pair("progress", pwallet->ScanningProgress()));
+        scanning.push_back(Pair("queued", (uint64_t)pwallet->GetQueuedRescans()));
+        obj.push_back(Pair("scanning", scanning));
+    } else {
+        obj.push_back(Pair("scanning", false));
+    }
     return obj;
 }
 
@@ -3571,6 +3678,7 @@ static const CRPCCommand commands[] =
     { "wallet",             "listreceivedbyaddress",    &listreceivedbyaddress,    {"minconf","include_empty","include_watchonly"} },
     { "wallet",             "listsinceblock",           &listsinceblock,           {"blockhash","target_confirmations","include_watchonly","include_removed"} },
     { "wallet",             "listtransactions",         &listtransactions,         {"account","count","skip","include_watchonly"} },
+    { "wallet",             "listtransactionspage",     &listtransactionspage,     {"count","cursor","include_watchonly"} },
     { "wallet",             "listunspent",              &listunspent,              {"minconf","maxconf","addresses","include_unsafe","query_options"} },
     { "wallet",             "listwallets",              &listwallets,              {} },
     { "wallet",             "lockunspent",              &lockunspent,              {"unlock","transactions"} },
@@ -0,0 +1,120 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <test/test_bitcoin.h>
+#include <wallet/logdb.h>
+
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(logdb_tests, BasicTestingSetup)
+
+static CLogDB::Data D(const std::string& str)
+{
+    return CLogDB::Data(str.begin(), str.end());
+}
+
+BOOST_AUTO_TEST_CASE(logdb_reopen)
+{
+    fs::path ph = fs::temp_directory_path() / fs::unique_path();
+    CLogDB::Data value;
+    {
+        CLogDB log(ph);
+        BOOST_CHECK(CLogDB::IsLogFile(ph));
+        BOOST_CHECK(log.Write(D("a"), D("1"), true, nullptr));
+        BOOST_CHECK(log.Write(D("b"), D("2"), true, nullptr));
+        BOOST_CHECK(!log.Write(D("b"), D("3"), false, nullptr));
+        BOOST_CHECK(log.Erase(D("a"), nullptr));
+        BOOST_CHECK(log.Erase(D("x"), nullptr));
+
+        // A transaction that is aborted leaves nothing behind
+        int owner;
+        BOOST_CHECK(log.TxnBegin(&owner));
+        BOOST_CHECK(log.Write(D("c"), D("3"), true, &owner));
+        BOOST_CHECK(log.Erase(D("b"), &owner));
+        BOOST_CHECK(!log.Exists(D("b")));
+        BOOST_CHECK(log.TxnAbort(&owner));
+        BOOST_CHECK(!log.Exists(D("c")));
+        BOOST_CHECK(log.Read(D("b"), value) && value == D("2"));
+
+        BOOST_CHECK(log.TxnBegin(&owner));
+        BOOST_CHECK(log.Write(D("d"), D("4"), true, &owner));
+        BOOST_CHECK(log.TxnCommit(&owner));
+    }
+    {
+        CLogDB log(ph);
+        BOOST_CHECK(!log.Exists(D("a")));
+        BOOST_CHECK(!log.Exists(D("c")));
+        BOOST_CHECK(log.Read(D("b"), value) && value == D("2"));
+        BOOST_CHECK(log.Read(D("d"), value) && value == D("4"));
+    }
+    fs::remove(ph);
+}
+
+BOOST_AUTO_TEST_CASE(logdb_torn_write)
+{
+    fs::path ph = fs::temp_directory_path() / fs::unique_path();
+    uintmax_t nSize;
+    {
+        CLogDB log(ph);
+        BOOST_CHECK(log.Write(D("a"), D("1"), true, nullptr));
+        BOOST_CHECK(log.Flush());
+        nSize = fs::file_size(ph);
+        BOOST_CHECK(log.Write(D("b"), D("2"), true, nullptr));
+    }
+    // Cut the last frame short, as a crash while appending it would
+    fs::resize_file(ph, fs::file_size(ph) - 1);
+    {
+        CLogDB log(ph);
+        BOOST_CHECK(log.Exists(D("a")));
+        BOOST_CHECK(!log.Exists(D("b")));
+        BOOST_CHECK_EQUAL(fs::file_size(ph), nSize);
+        BOOST_CHECK(log.Write(D("c"), D("3"), true, nullptr));
+    }
+    {
+        CLogDB log(ph);
+        BOOST_CHECK(log.Exists(D("a")));
+        BOOST_CHECK(log.Exists(D("c")));
+    }
+    fs::remove(ph);
+}
+
+BOOST_AUTO_TEST_CASE(logdb_order_and_compaction)
+{
+    fs::path ph = fs::temp_directory_path() / fs::unique_path();
+    {
+        CLogDB log(ph);
+        // Keys sort bytewise unsigned, whatever the sign of char
+        BOOST_CHECK(log.Write(D("\xff"), D("z"), true, nullptr));
+        BOOST_CHECK(log.Write(D("b"), D("y"), true, nullptr));
+        BOOST_CHECK(log.Write(D("ba"), D("x"), true, nullptr));
+        for (int i = 0; i < 100; i++)
+            BOOST_CHECK(log.Write(D("c"), D(std::string(100, 'a' + i % 26)), true, nullptr));
+
+        uintmax_t nSize = fs::file_size(ph);
+        BOOST_CHECK(log.Compact(true));
+        BOOST_CHECK(fs::file_size(ph) < nSize / 10);
+
+        CLogDB::Data key = D("b"), value;
+        BOOST_CHECK(log.ReadNext(key, value, true) && key == D("b"));
+        BOOST_CHECK(log.ReadNext(key, value, false) && key == D("ba"));
+        BOOST_CHECK(log.ReadNext(key, value, false) && key == D("c"));
+        BOOST_CHECK(value == D(std::string(100, 'a' + 99 % 26)));
+        BOOST_CHECK(log.ReadNext(key, value, false) && key == D("\xff"));
+        BOOST_CHECK(!log.ReadNext(key, value, false));
+
+        // Writes after compaction go to the new file
+        BOOST_CHECK(log.Write(D("d"), D("w"), true, nullptr));
+    }
+    {
+        CLogDB log(ph);
+        CLogDB::Data value;
+        BOOST_CHECK(log.Read(D("d"), value) && value == D("w"));
+        BOOST_CHECK(log.Read(D("\xff"), value) && value == D("z"));
+    }
+    fs::remove(ph);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,17 +4,21 @@
 
 #include <wallet/wallet.h>
 
+#include <limits>
 #include <memory>
 #include <set>
 #include <stdint.h>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#include <chainparams.h>
 #include <consensus/validation.h>
 #include <rpc/server.h>
 #include <test/test_bitcoin.h>
 #include <validation.h>
 #include <wallet/coincontrol.h>
+#include <wallet/rescan.h>
 #include <wallet/test/wallet_test_fixture.h>
 
 #include <boost/test/unit_test.hpp>
@@ -363,6 +367,80 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     empty_wallet();
 }
 
+static std::vector<CInputCoin> bnb_pool(void)
+{
+    std::vector<CInputCoin> utxo_pool;
+    for (const COutput& output : vCoins)
+        utxo_pool.emplace_back(output.tx, output.i);
+    return utxo_pool;
+}
+
+BOOST_AUTO_TEST_CASE(bnb_search_test)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+    std::vector<CInputCoin> utxo_pool;
+
+    LOCK(testWallet.cs_wallet);
+
+    empty_wallet();
+    add_coin(1 * CENT);
+    add_coin(2 * CENT);
+    add_coin(3 * CENT);
+    add_coin(4 * CENT);
+
+    // Exact matches, of one or more coins
+    utxo_pool = bnb_pool();
+    BOOST_CHECK(SelectCoinsBnB(utxo_pool, 3 * CENT, 0, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 3 * CENT);
+    BOOST_CHECK(SelectCoinsBnB(utxo_pool, 7 * CENT, 0, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 7 * CENT);
+    BOOST_CHECK(SelectCoinsBnB(utxo_pool, 10 * CENT, 0, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 10 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 4U);
+
+    // More than there is
+    BOOST_CHECK(!SelectCoinsBnB(utxo_pool, 11 * CENT, 1 * CENT, setCoinsRet, nValueRet));
+    BOOST_CHECK(setCoinsRet.empty());
+
+    // No exact match, but one within the cost of change, preferring the smallest excess
+    empty_wallet();
+    add_coin(4 * CENT);
+    add_coin(6 * CENT);
+    add_coin(7 * CENT);
+    utxo_pool = bnb_pool();
+    BOOST_CHECK(!SelectCoinsBnB(utxo_pool, 5 * CENT, 0, setCoinsRet, nValueRet));
+    BOOST_CHECK(SelectCoinsBnB(utxo_pool, 5 * CENT, 2 * CENT, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 6 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 1U);
+
+    // Through SelectCoinsMinConf, the input fees come off the coin values and
+    // the rest of the transaction's fee is added to the target
+    empty_wallet();
+    add_coin(1 * CENT);
+    add_coin(2 * CENT);
+    add_coin(5 * CENT);
+    for (COutput& output : vCoins)
+        output.nInputBytes = 100;
+    CoinSelectionParams params;
+    params.use_bnb = true;
+    params.effective_fee = CFeeRate(1000);
+    params.not_input_fees = 50;
+    BOOST_CHECK(!testWallet.SelectCoinsMinConf(3 * CENT, 1, 1, 0, vCoins, setCoinsRet, nValueRet, params));
+    BOOST_CHECK(testWallet.SelectCoinsMinConf(3 * CENT - 250, 1, 1, 0, vCoins, setCoinsRet, nValueRet, params));
+    BOOST_CHECK_EQUAL(nValueRet, 3 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+
+    // Coins of unknown input size are left out
+    vCoins[2].nInputBytes = -1;
+    BOOST_CHECK(!testWallet.SelectCoinsMinConf(5 * CENT - 150, 1, 1, 0, vCoins, setCoinsRet, nValueRet, params));
+    vCoins[2].nInputBytes = 100;
+    BOOST_CHECK(testWallet.SelectCoinsMinConf(5 * CENT - 150, 1, 1, 0, vCoins, setCoinsRet, nValueRet, params));
+    BOOST_CHECK_EQUAL(nValueRet, 5 * CENT);
+
+    empty_wallet();
+}
+
 static void AddKey(CWallet& wallet, const CKey& key)
 {
     LOCK(wallet.cs_wallet);
@@ -446,6 +524,82 @@ BOOST_FIXTURE_TEST_CASE(rescan, TestChain100Setup)
     }
 }
 
+// Verify that reading blocks ahead on threads finds the same transactions as
+// reading them on the rescanning thread, for a whole and a partial rescan.
+BOOST_FIXTURE_TEST_CASE(rescan_threads, TestChain100Setup)
+{
+    CBlockIndex* const nullBlock = nullptr;
+    LOCK(cs_main);
+    CBlockIndex* stopBlock = chainActive[50];
+
+    for (CBlockIndex* pindexStop : {nullBlock, stopBlock}) {
+        size_t nTxs[2];
+        CAmount nImmature[2];
+        for (int i = 0; i < 2; i++) {
+            gArgs.ForceSetArg("-rescanthreads", i == 0 ? "0" : "4");
+            CWallet wallet;
+            AddKey(wallet, coinbaseKey);
+            WalletRescanReserver reserver(&wallet);
+            reserver.reserve();
+            BOOST_CHECK_EQUAL(nullBlock, wallet.ScanForWalletTransactions(chainActive.Genesis(), pindexStop, reserver));
+            LOCK(wallet.cs_wallet);
+            nTxs[i] = wallet.mapWallet.size();
+            nImmature[i] = wallet.GetImmatureBalance();
+        }
+        BOOST_CHECK_EQUAL(nTxs[0], pindexStop ? 50U : 100U);
+        BOOST_CHECK_EQUAL(nTxs[0], nTxs[1]);
+        BOOST_CHECK_EQUAL(nImmature[0], nImmature[1]);
+    }
+    gArgs.ForceSetArg("-rescanthreads", std::to_string(DEFAULT_RESCAN_THREADS));
+}
+
+// Imports that queue up behind a running rescan are all served by one scan,
+// and abortrescan drops the ones still waiting
+BOOST_FIXTURE_TEST_CASE(rescan_queued, TestChain100Setup)
+{
+    CWallet wallet;
+    AddKey(wallet, coinbaseKey);
+    int64_t nTime;
+    {
+        LOCK(cs_main);
+        nTime = chainActive[50]->GetBlockTime();
+    }
+
+    int64_t nScannedTime[2];
+    std::vector<std::thread> threads;
+    {
+        // Hold the wallet as a running rescan does
+        WalletRescanReserver reserver(&wallet);
+        BOOST_CHECK(reserver.reserve());
+        threads.emplace_back([&] { nScannedTime[0] = wallet.RescanFromTimeQueued(TIMESTAMP_MIN, true); });
+        threads.emplace_back([&] { nScannedTime[1] = wallet.RescanFromTimeQueued(nTime, true); });
+        while (wallet.GetQueuedRescans() < 2)
+            MilliSleep(1);
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    threads.clear();
+    BOOST_CHECK_EQUAL(nScannedTime[0], TIMESTAMP_MIN);
+    BOOST_CHECK_EQUAL(nScannedTime[1], nTime);
+    BOOST_CHECK_EQUAL(wallet.GetQueuedRescans(), 0U);
+    {
+        LOCK(wallet.cs_wallet);
+        BOOST_CHECK_EQUAL(wallet.mapWallet.size(), 100U);
+    }
+
+    {
+        WalletRescanReserver reserver(&wallet);
+        BOOST_CHECK(reserver.reserve());
+        threads.emplace_back([&] { nScannedTime[0] = wallet.RescanFromTimeQueued(TIMESTAMP_MIN, true); });
+        while (wallet.GetQueuedRescans() < 1)
+            MilliSleep(1);
+        wallet.AbortRescan();
+        BOOST_CHECK_EQUAL(wallet.GetQueuedRescans(), 0U);
+    }
+    threads[0].join();
+    BOOST_CHECK_EQUAL(nScannedTime[0], std::numeric_limits<int64_t>::max());
+}
+
 // Verify importwallet RPC starts rescan at earliest block with timestamp
 // greater or equal than key birthday. Previously there was a bug where
 // importwallet RPC would start the scan at the latest block with timestamp less
@@ -534,6 +688,76 @@ BOOST_FIXTURE_TEST_CASE(coin_mark_dirty_immature_credit, TestChain100Setup)
     BOOST_CHECK_EQUAL(wtx.GetImmatureCredit(), 50*COIN);
 }
 
+BOOST_FIXTURE_TEST_CASE(depth_in_main_chain, TestChain100Setup)
+{
+    CWallet wallet;
+    CWalletTx wtx(&wallet, MakeTransactionRef(coinbaseTxns.back()));
+    auto depth = [&] { LOCK(wallet.cs_wallet); return wtx.GetDepthInMainChain(); };
+    CBlockIndex* pindexTx;
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        pindexTx = chainActive.Tip();
+        wtx.SetMerkleBranch(pindexTx, 0);
+        const CBlockIndex* pindexRet = nullptr;
+        BOOST_CHECK_EQUAL(wtx.GetDepthInMainChain(pindexRet), 1);
+        BOOST_CHECK(pindexRet == pindexTx);
+    }
+
+    // The block found is remembered as the tip moves up
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CreateAndProcessBlock({}, scriptPubKey);
+    BOOST_CHECK_EQUAL(depth(), 2);
+
+    // and forgotten when blocks are disconnected
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(InvalidateBlock(state, Params(), pindexTx));
+    }
+    BOOST_CHECK_EQUAL(depth(), 0);
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(ResetBlockFailureFlags(pindexTx));
+    }
+    BOOST_REQUIRE(ActivateBestChain(state, Params()));
+    BOOST_CHECK_EQUAL(depth(), 2);
+
+    // Conflicts have a negative depth, and a new block is looked up again
+    wtx.nIndex = -1;
+    BOOST_CHECK_EQUAL(depth(), -2);
+    wtx.SetMerkleBranch(pindexTx->pprev, 0);
+    BOOST_CHECK_EQUAL(depth(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(keypool_parallel_derivation)
+{
+    // Two wallets with the same seed, one topped up a key at a time and the
+    // other at once, on several threads, end up with the same keys
+    CKey seed;
+    seed.MakeNewKey(true);
+    CWallet wallets[2];
+    for (CWallet& wallet : wallets) {
+        LOCK(wallet.cs_wallet);
+        wallet.SetMinVersion(FEATURE_LATEST);
+        BOOST_REQUIRE(wallet.AddKeyPubKey(seed, seed.GetPubKey()));
+        wallet.SetHDMasterKey(seed.GetPubKey());
+    }
+    const unsigned int nKeys = 4 * MIN_KEYS_PER_DERIVE_THREAD + 1;
+    for (unsigned int n = 1; n <= nKeys; n++) {
+        BOOST_REQUIRE(wallets[0].TopUpKeyPool(n));
+    }
+    BOOST_REQUIRE(wallets[1].TopUpKeyPool(nKeys));
+
+    LOCK2(wallets[0].cs_wallet, wallets[1].cs_wallet);
+    BOOST_CHECK_EQUAL(wallets[1].GetKeyPoolSize(), 2 * nKeys);
+    BOOST_CHECK(wallets[0].GetKeys() == wallets[1].GetKeys());
+    for (const auto& entry : wallets[0].mapKeyMetadata) {
+        BOOST_CHECK_EQUAL(wallets[1].mapKeyMetadata.at(entry.first).hdKeypath, entry.second.hdKeypath);
+    }
+    BOOST_CHECK_EQUAL(wallets[1].GetHDChain().nExternalChainCounter, nKeys);
+    BOOST_CHECK_EQUAL(wallets[1].GetHDChain().nInternalChainCounter, nKeys);
+}
+
 static int64_t AddTx(CWallet& wallet, uint32_t lockTime, int64_t mockTime, int64_t blockTime)
 {
     CMutableTransaction tx;
@@ -700,4 +924,86 @@ BOOST_FIXTURE_TEST_CASE(ListCoins, ListCoinsTestingSetup)
     BOOST_CHECK_EQUAL(list.begin()->second.size(), 2);
 }
 
+// Verify that the balances and coins kept for settled transactions follow
+// spends, new blocks and reorganizations.
+BOOST_FIXTURE_TEST_CASE(SettledBalances, ListCoinsTestingSetup)
+{
+    BOOST_CHECK_EQUAL(wallet->GetBalance(), 50 * COIN);
+    BOOST_CHECK_EQUAL(wallet->GetImmatureBalance(), 100 * 50 * COIN);
+
+    // Spend from the settled coinbase, and again from the change
+    AddTx(CRecipient{GetScriptForRawPubKey({}), 1 * COIN, false /* subtract fee */});
+    // Each block also matures another coinbase
+    BOOST_CHECK_EQUAL(wallet->GetBalance(), wallet->GetAvailableBalance());
+    BOOST_CHECK(wallet->GetBalance() > 98 * COIN && wallet->GetBalance() < 99 * COIN);
+    std::vector<COutput> available;
+    wallet->AvailableCoins(available);
+    BOOST_CHECK_EQUAL(available.size(), 2U);
+    AddTx(CRecipient{GetScriptForRawPubKey({}), 1 * COIN, false /* subtract fee */});
+    BOOST_CHECK_EQUAL(wallet->GetBalance(), wallet->GetAvailableBalance());
+    BOOST_CHECK(wallet->GetBalance() > 147 * COIN && wallet->GetBalance() < 148 * COIN);
+    wallet->AvailableCoins(available);
+    BOOST_CHECK_EQUAL(available.size(), 3U);
+
+    // Disconnect the last spend; the wallet does not hear of it, but the
+    // settled balances must not be trusted past the reorganization
+    CAmount nBalance = wallet->GetBalance();
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, Params(), chainActive.Tip()));
+    }
+    BOOST_CHECK_EQUAL(wallet->GetBalance(), wallet->GetAvailableBalance());
+    BOOST_CHECK(wallet->GetBalance() != nBalance);
+}
+
+BOOST_AUTO_TEST_CASE(batched_writes)
+{
+    LOCK(pwalletMain->cs_wallet);
+
+    // Three writes per key, so the refill commits more than one transaction
+    BOOST_CHECK(pwalletMain->TopUpKeyPool(400));
+    BOOST_CHECK_EQUAL(pwalletMain->GetKeyPoolSize(), 400U);
+    {
+        CWalletDB walletdb(pwalletMain->GetDBHandle());
+        CKeyPool keypool;
+        for (int64_t i = 1; i <= 400; i++)
+            BOOST_CHECK(walletdb.ReadPool(i, keypool));
+    }
+
+    // A batch started inside another joins it
+    WalletBatchWriter batch(*pwalletMain);
+    BOOST_CHECK(pwalletMain->AddCScript(CScript() << OP_TRUE));
+    {
+        WalletBatchWriter inner(*pwalletMain);
+        BOOST_CHECK(&inner.GetDB() == &batch.GetDB());
+        BOOST_CHECK(pwalletMain->TopUpKeyPool(410));
+    }
+    BOOST_CHECK(batch.Commit());
+    CWalletDB walletdb(pwalletMain->GetDBHandle());
+    CKeyPool keypool;
+    BOOST_CHECK(walletdb.ReadPool(410, keypool));
+}
+
+BOOST_AUTO_TEST_CASE(load_deferred_records)
+{
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->TopUpKeyPool(600));
+    }
+
+    // Loading the same file again decodes its key records on several threads
+    CWallet wallet(std::unique_ptr<CWalletDBWrapper>(new CWalletDBWrapper(&bitdb, "wallet_test.dat")));
+    bool fFirstRun;
+    BOOST_CHECK(wallet.LoadWallet(fFirstRun) == DB_LOAD_OK);
+    BOOST_CHECK(!fFirstRun);
+
+    LOCK2(pwalletMain->cs_wallet, wallet.cs_wallet);
+    BOOST_CHECK_EQUAL(wallet.GetKeyPoolSize(), 600U);
+    std::set<CKeyID> keys = pwalletMain->GetKeys();
+    std::set<CKeyID> keys_loaded = wallet.GetKeys();
+    BOOST_CHECK_EQUAL(keys_loaded.size(), 600U);
+    BOOST_CHECK(keys == keys_loaded);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
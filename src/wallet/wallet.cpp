@@ -17,6 +17,7 @@
 #include <keystore.h>
 #include <validation.h>
 #include <net.h>
+#include <notifyqueue.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
 #include <policy/rbf.h>
@@ -24,14 +25,20 @@
 #include <primitives/transaction.h>
 #include <script/script.h>
 #include <scheduler.h>
+#include <taskpool.h>
 #include <timedata.h>
 #include <txmempool.h>
 #include <util.h>
 #include <utilmoneystr.h>
 #include <wallet/fees.h>
+#include <wallet/rescan.h>
 
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
 #include <future>
+#include <iterator>
+#include <limits>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/thread.hpp>
@@ -178,14 +185,12 @@ CPubKey CWallet::GenerateNewKey(CWalletDB &walletdb, bool internal)
     return pubkey;
 }
 
-void CWallet::DeriveNewChildKey(CWalletDB &walletdb, CKeyMetadata& metadata, CKey& secret, bool internal)
+void CWallet::DeriveChainKey(CExtKey& chainChildKey, bool internal)
 {
     // for now we use a fixed keypath scheme of m/0'/0'/k
     CKey key;                      //master key seed (256bit)
     CExtKey masterKey;             //hd master key
     CExtKey accountKey;            //key at m/0'
-    CExtKey chainChildKey;         //key at m/0'/0' (external) or m/0'/1' (internal)
-    CExtKey childKey;              //key at m/0'/0'/<n>'
 
     // try to get the master key
     if (!GetKey(hdChain.masterKeyID, key))
@@ -200,6 +205,13 @@ void CWallet::DeriveNewChildKey(CWalletDB &walletdb, CKeyMetadata& metadata, CKe
     // derive m/0'/0' (external chain) OR m/0'/1' (internal chain)
     assert(internal ? CanSupportFeature(FEATURE_HD_SPLIT) : true);
     accountKey.Derive(chainChildKey, BIP32_HARDENED_KEY_LIMIT+(internal ? 1 : 0));
+}
+
+void CWallet::DeriveNewChildKey(CWalletDB &walletdb, CKeyMetadata& metadata, CKey& secret, bool internal)
+{
+    CExtKey chainChildKey;         //key at m/0'/0' (external) or m/0'/1' (internal)
+    CExtKey childKey;              //key at m/0'/0'/<n>'
+    DeriveChainKey(chainChildKey, internal);
 
     // derive child key at next index, skip keys already known to the wallet
     do {
@@ -224,6 +236,69 @@ void CWallet::DeriveNewChildKey(CWalletDB &walletdb, CKeyMetadata& metadata, CKe
         throw std::runtime_error(std::string(__func__) + ": Writing HD chain model failed");
 }
 
+std::vector<CPubKey> CWallet::GenerateNewKeys(CWalletDB& walletdb, bool internal, size_t nCount)
+{
+    AssertLockHeld(cs_wallet); // mapKeyMetadata
+    std::vector<CPubKey> vPubKeys;
+    if (!IsHDEnabled() || nCount < 2 * MIN_KEYS_PER_DERIVE_THREAD) {
+        for (size_t i = 0; i < nCount; i++) {
+            vPubKeys.push_back(GenerateNewKey(walletdb, internal));
+        }
+        return vPubKeys;
+    }
+
+    internal = CanSupportFeature(FEATURE_HD_SPLIT) ? internal : false;
+    CExtKey chainChildKey;
+    DeriveChainKey(chainChildKey, internal);
+    uint32_t& nCounter = internal ? hdChain.nInternalChainCounter : hdChain.nExternalChainCounter;
+    const int64_t nCreationTime = GetTime();
+
+    while (vPubKeys.size() < nCount) {
+        // Derive the next keys of the chain, and their public keys, on
+        // several threads; keys are handed out one at a time
+        std::vector<CKey> vKeys(nCount - vPubKeys.size());
+        std::vector<CPubKey> vDerived(vKeys.size());
+        const uint32_t nFirst = nCounter;
+        std::atomic<size_t> nNext(0);
+        auto worker = [&]() {
+            for (size_t i = nNext++; i < vKeys.size(); i = nNext++) {
+                CExtKey childKey;
+                chainChildKey.Derive(childKey, (nFirst + i) | BIP32_HARDENED_KEY_LIMIT);
+                vKeys[i] = childKey.key;
+                vDerived[i] = childKey.key.GetPubKey();
+                assert(childKey.key.VerifyPubKey(vDerived[i]));
+            }
+        };
+        unsigned int nThreads = std::min<unsigned int>(std::max(GetNumCores(), 1), MAX_KEY_DERIVE_THREADS);
+        nThreads = std::min<size_t>(nThreads, vKeys.size() / MIN_KEYS_PER_DERIVE_THREAD + 1);
+        ParallelRun(g_task_pool, TASK_PRIORITY_NORMAL, nThreads, worker);
+
+        // Add them in order, skipping keys already known to the wallet as DeriveNewChildKey does
+        for (size_t i = 0; i < vKeys.size(); i++) {
+            const uint32_t nChild = nCounter++;
+            if (HaveKey(vDerived[i].GetID()))
+                continue;
+            CKeyMetadata metadata(nCreationTime);
+            metadata.hdKeypath = strprintf("m/0'/%d'/%d'", internal ? 1 : 0, nChild);
+            metadata.hdMasterKeyID = hdChain.masterKeyID;
+            mapKeyMetadata[vDerived[i].GetID()] = metadata;
+            if (!AddKeyPubKeyWithDB(walletdb, vKeys[i], vDerived[i])) {
+                throw std::runtime_error(std::string(__func__) + ": AddKey failed");
+            }
+            vPubKeys.push_back(vDerived[i]);
+        }
+    }
+
+    if (CanSupportFeature(FEATURE_COMPRPUBKEY)) {
+        SetMinVersion(FEATURE_COMPRPUBKEY);
+    }
+    UpdateTimeFirstKey(nCreationTime);
+    // update the chain model in the database, once for all keys
+    if (!walletdb.WriteHDChain(hdChain))
+        throw std::runtime_error(std::string(__func__) + ": Writing HD chain model failed");
+    return vPubKeys;
+}
+
 bool CWallet::AddKeyPubKeyWithDB(CWalletDB &walletdb, const CKey& secret, const CPubKey &pubkey)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
@@ -240,6 +315,7 @@ bool CWallet::AddKeyPubKeyWithDB(CWalletDB &walletdb, const CKey& secret, const
         return false;
     }
     if (needsDB) pwalletdbEncryption = nullptr;
+    nKeyStoreGeneration++;
 
     // check if we need to remove from watch-only
     CScript script;
@@ -262,6 +338,9 @@ bool CWallet::AddKeyPubKeyWithDB(CWalletDB &walletdb, const CKey& secret, const
 
 bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
 {
+    LOCK(cs_wallet);
+    if (pwalletdbBatch)
+        return CWallet::AddKeyPubKeyWithDB(*pwalletdbBatch, secret, pubkey);
     CWalletDB walletdb(*dbw);
     return CWallet::AddKeyPubKeyWithDB(walletdb, secret, pubkey);
 }
@@ -277,6 +356,10 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
             return pwalletdbEncryption->WriteCryptedKey(vchPubKey,
                                                         vchCryptedSecret,
                                                         mapKeyMetadata[vchPubKey.GetID()]);
+        else if (pwalletdbBatch)
+            return pwalletdbBatch->WriteCryptedKey(vchPubKey,
+                                                   vchCryptedSecret,
+                                                   mapKeyMetadata[vchPubKey.GetID()]);
         else
             return CWalletDB(*dbw).WriteCryptedKey(vchPubKey,
                                                             vchCryptedSecret,
@@ -325,6 +408,10 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    nKeyStoreGeneration++;
+    LOCK(cs_wallet);
+    if (pwalletdbBatch)
+        return pwalletdbBatch->WriteCScript(Hash160(redeemScript), redeemScript);
     return CWalletDB(*dbw).WriteCScript(Hash160(redeemScript), redeemScript);
 }
 
@@ -348,9 +435,13 @@ bool CWallet::AddWatchOnly(const CScript& dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    nKeyStoreGeneration++;
+    LOCK(cs_wallet);
     const CKeyMetadata& meta = m_script_metadata[CScriptID(dest)];
     UpdateTimeFirstKey(meta.nCreateTime);
     NotifyWatchonlyChanged(true);
+    if (pwalletdbBatch)
+        return pwalletdbBatch->WriteWatchOnly(dest, meta);
     return CWalletDB(*dbw).WriteWatchOnly(dest, meta);
 }
 
@@ -365,8 +456,11 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    nKeyStoreGeneration++;
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
+    if (pwalletdbBatch)
+        return pwalletdbBatch->EraseWatchOnly(dest);
     if (!CWalletDB(*dbw).EraseWatchOnly(dest))
         return false;
 
@@ -466,6 +560,8 @@ bool CWallet::SetMinVersion(enum WalletFeature nVersion, CWalletDB* pwalletdbIn,
         nWalletMaxVersion = nVersion;
 
     {
+        if (!pwalletdbIn)
+            pwalletdbIn = pwalletdbBatch;
         CWalletDB* pwalletdb = pwalletdbIn ? pwalletdbIn : new CWalletDB(*dbw);
         if (nWalletVersion > 40000)
             pwalletdb->WriteMinVersion(nWalletVersion);
@@ -589,6 +685,7 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(std::make_pair(outpoint, wtxid));
+    MarkBalanceUnsettled(outpoint.hash);
 
     std::pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
@@ -703,6 +800,8 @@ DBErrors CWallet::ReorderTransactions()
 {
     LOCK(cs_wallet);
     CWalletDB walletdb(*dbw);
+    // Old wallets may need every transaction rewritten
+    bool fBatch = walletdb.BatchBegin();
 
     // Old wallets didn't have any defined order for transactions
     // Probably a bad idea to change the output of this
@@ -772,6 +871,8 @@ DBErrors CWallet::ReorderTransactions()
         }
     }
     walletdb.WriteOrderPosNext(nOrderPosNext);
+    if (fBatch && !walletdb.BatchCommit())
+        return DB_LOAD_FAIL;
 
     return DB_LOAD_OK;
 }
@@ -868,6 +969,7 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         for (std::pair<const uint256, CWalletTx>& item : mapWallet)
             item.second.MarkDirty();
+        pindexBalanceSettled = nullptr;
     }
 }
 
@@ -918,6 +1020,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
         wtx.nOrderPos = IncOrderPosNext(&walletdb);
         wtx.m_it_wtxOrdered = wtxOrdered.insert(std::make_pair(wtx.nOrderPos, TxPair(&wtx, nullptr)));
         wtx.nTimeSmart = ComputeTimeSmart(wtx);
+        wtx.fBalanceSettled = false;
         AddToSpends(hash);
     }
 
@@ -967,6 +1070,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
 
     // Break debit/credit balance caches:
     wtx.MarkDirty();
+    MarkBalanceUnsettled(hash);
 
     // Notify UI of new or updated transaction
     NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -976,8 +1080,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
 
     if (!strCmd.empty())
     {
-        boost::replace_all(strCmd, "%s", wtxIn.GetHash().GetHex());
-        boost::thread t(runCommand, strCmd); // thread runs free
+        g_notifyqueue.Notify(strCmd, wtxIn.GetHash().GetHex());
     }
 
     return true;
@@ -1059,7 +1162,7 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransactionRef& ptx, const CBlockI
                         LogPrintf("%s: Detected a used keypool key, mark all keypool key up to this key as used\n", __func__);
                         MarkReserveKeysAsUsed(mi->second);
 
-                        if (!TopUpKeyPool()) {
+                        if (!RefillKeyPool()) {
                             LogPrintf("%s: Topping up keypool failed (locked wallet)\n", __func__);
                         }
                     }
@@ -1121,6 +1224,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             wtx.nIndex = -1;
             wtx.setAbandoned();
             wtx.MarkDirty();
+            MarkBalanceUnsettled(now);
             walletdb.WriteTx(wtx);
             NotifyTransactionChanged(this, wtx.GetHash(), CT_UPDATED);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them abandoned too
@@ -1138,6 +1242,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
                 auto it = mapWallet.find(txin.prevout.hash);
                 if (it != mapWallet.end()) {
                     it->second.MarkDirty();
+                    MarkBalanceUnsettled(it->first);
                 }
             }
         }
@@ -1148,13 +1253,14 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
 
 void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
 {
-    LOCK2(cs_main, cs_wallet);
+    LOCK(cs_wallet);
 
     int conflictconfirms = 0;
-    if (mapBlockIndex.count(hashBlock)) {
-        CBlockIndex* pindex = mapBlockIndex[hashBlock];
-        if (chainActive.Contains(pindex)) {
-            conflictconfirms = -(chainActive.Height() - pindex->nHeight + 1);
+    const CBlockIndex* pindex = LookupBlockIndexNoLock(hashBlock);
+    if (pindex) {
+        std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
+        if (chain->Contains(pindex)) {
+            conflictconfirms = -(chain->Height() - pindex->nHeight + 1);
         }
     }
     // If number of conflict confirms cannot be determined, this means
@@ -1186,6 +1292,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             wtx.nIndex = -1;
             wtx.hashBlock = hashBlock;
             wtx.MarkDirty();
+            MarkBalanceUnsettled(now);
             walletdb.WriteTx(wtx);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them conflicted too
             TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(now, 0));
@@ -1201,6 +1308,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
                 auto it = mapWallet.find(txin.prevout.hash);
                 if (it != mapWallet.end()) {
                     it->second.MarkDirty();
+                    MarkBalanceUnsettled(it->first);
                 }
             }
         }
@@ -1220,12 +1328,13 @@ void CWallet::SyncTransaction(const CTransactionRef& ptx, const CBlockIndex *pin
         auto it = mapWallet.find(txin.prevout.hash);
         if (it != mapWallet.end()) {
             it->second.MarkDirty();
+            MarkBalanceUnsettled(it->first);
         }
     }
 }
 
 void CWallet::TransactionAddedToMempool(const CTransactionRef& ptx) {
-    LOCK2(cs_main, cs_wallet);
+    LOCK(cs_wallet);
     SyncTransaction(ptx);
 
     auto it = mapWallet.find(ptx->GetHash());
@@ -1242,8 +1351,22 @@ void CWallet::TransactionRemovedFromMempool(const CTransactionRef &ptx) {
     }
 }
 
+void CWallet::MempoolUpdated(const std::vector<MempoolUpdate>& updates) {
+    // Take cs_wallet once for the whole batch
+    LOCK(cs_wallet);
+    for (const MempoolUpdate& update : updates) {
+        if (update.fAdded) {
+            TransactionAddedToMempool(update.tx);
+        } else {
+            TransactionRemovedFromMempool(update.tx);
+        }
+    }
+}
+
 void CWallet::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex *pindex, const std::vector<CTransactionRef>& vtxConflicted) {
-    LOCK2(cs_main, cs_wallet);
+    // Only cs_wallet is taken, so that wallets registered with their own
+    // queue process the block concurrently, and without waiting for cs_main
+    LOCK(cs_wallet);
     // TODO: Temporarily ensure that mempool removals are notified before
     // connected transactions.  This shouldn't matter, but the abandoned
     // state of transactions in our wallet is currently cleared when we
@@ -1265,7 +1388,7 @@ void CWallet::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const
 }
 
 void CWallet::BlockDisconnected(const std::shared_ptr<const CBlock>& pblock) {
-    LOCK2(cs_main, cs_wallet);
+    LOCK(cs_wallet);
 
     for (const CTransactionRef& ptx : pblock->vtx) {
         SyncTransaction(ptx);
@@ -1280,14 +1403,11 @@ void CWallet::BlockUntilSyncedToCurrentChain() {
 
     {
         // Skip the queue-draining stuff if we know we're caught up with
-        // chainActive.Tip()...
-        // We could also take cs_wallet here, and call m_last_block_processed
-        // protected by cs_wallet instead of cs_main, but as long as we need
-        // cs_main here anyway, its easier to just call it cs_main-protected.
-        LOCK(cs_main);
-        const CBlockIndex* initialChainTip = chainActive.Tip();
+        // the chain tip...
+        const CBlockIndex* initialChainTip = GetChainSnapshot()->Tip();
+        const CBlockIndex* last_block_processed = m_last_block_processed;
 
-        if (m_last_block_processed->GetAncestor(initialChainTip->nHeight) == initialChainTip) {
+        if (last_block_processed->GetAncestor(initialChainTip->nHeight) == initialChainTip) {
             return;
         }
     }
@@ -1511,10 +1631,27 @@ int64_t CWalletTx::GetTxTime() const
 void CWalletTx::GetAmounts(std::list<COutputEntry>& listReceived,
                            std::list<COutputEntry>& listSent, CAmount& nFee, std::string& strSentAccount, const isminefilter& filter) const
 {
-    nFee = 0;
-    listReceived.clear();
-    listSent.clear();
+    std::shared_ptr<const Amounts> amounts = GetCachedAmounts(filter);
+    listReceived = amounts->listReceived;
+    listSent = amounts->listSent;
+    nFee = amounts->nFee;
     strSentAccount = strFromAccount;
+}
+
+std::shared_ptr<const CWalletTx::Amounts> CWalletTx::GetCachedAmounts(const isminefilter& filter) const
+{
+    // Read the generation first: a key added while computing changes it
+    uint64_t nGeneration = pwallet->GetAmountsGeneration();
+    if (pAmountsCached && pAmountsCached->filter == filter && pAmountsCached->nGeneration == nGeneration)
+        return pAmountsCached;
+
+    std::shared_ptr<Amounts> amounts = std::make_shared<Amounts>();
+    amounts->filter = filter;
+    amounts->nGeneration = nGeneration;
+    CAmount& nFee = amounts->nFee;
+    std::list<COutputEntry>& listReceived = amounts->listReceived;
+    std::list<COutputEntry>& listSent = amounts->listSent;
+    nFee = 0;
 
     // Compute fee:
     CAmount nDebit = GetDebit(filter);
@@ -1562,6 +1699,8 @@ void CWalletTx::GetAmounts(std::list<COutputEntry>& listReceived,
             listReceived.push_back(output);
     }
 
+    pAmountsCached = amounts;
+    return pAmountsCached;
 }
 
 /**
@@ -1593,6 +1732,86 @@ int64_t CWallet::RescanFromTime(int64_t startTime, const WalletRescanReserver& r
     return startTime;
 }
 
+/**
+ * RescanFromTime for an import, waiting for its turn instead of failing when
+ * another rescan runs. Imports that queue up behind a running rescan are
+ * served by a single scan from the earliest of their start times, run by
+ * whichever of them gets to reserve the wallet first.
+ *
+ * @return Earliest timestamp that could be successfully scanned from, as for
+ * RescanFromTime; the maximum timestamp if the rescan was aborted before it
+ * started.
+ */
+int64_t CWallet::RescanFromTimeQueued(int64_t startTime, bool update)
+{
+    std::shared_ptr<QueuedRescan> request = std::make_shared<QueuedRescan>();
+    request->nStartTime = startTime;
+    request->fUpdate = update;
+    request->fDone = false;
+    request->nScannedTime = std::numeric_limits<int64_t>::max();
+    {
+        std::lock_guard<std::mutex> lock(mutexScanning);
+        vRescanQueue.push_back(request);
+    }
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutexScanning);
+            condScanning.wait(lock, [&] { return request->fDone || !fScanningWallet; });
+            if (request->fDone)
+                return request->nScannedTime;
+        }
+        WalletRescanReserver reserver(this);
+        if (!reserver.reserve())
+            continue;
+
+        std::vector<std::shared_ptr<QueuedRescan>> vRequests;
+        {
+            std::lock_guard<std::mutex> lock(mutexScanning);
+            vRequests.swap(vRescanQueue);
+        }
+        if (vRequests.empty())
+            continue;
+        int64_t nStartTime = std::numeric_limits<int64_t>::max();
+        bool fUpdate = false;
+        for (const auto& queued : vRequests) {
+            nStartTime = std::min(nStartTime, queued->nStartTime);
+            fUpdate |= queued->fUpdate;
+        }
+        if (vRequests.size() > 1)
+            LogPrintf("%s: Coalescing %u queued rescans\n", __func__, vRequests.size());
+
+        const int64_t nScannedTime = RescanFromTime(nStartTime, reserver, fUpdate);
+        {
+            std::lock_guard<std::mutex> lock(mutexScanning);
+            for (const auto& queued : vRequests) {
+                // A request starting after the block that failed is still served
+                queued->nScannedTime = std::max(nScannedTime, queued->nStartTime);
+                queued->fDone = true;
+            }
+            condScanning.notify_all();
+        }
+    }
+}
+
+void CWallet::AbortRescan()
+{
+    fAbortRescan = true;
+    std::lock_guard<std::mutex> lock(mutexScanning);
+    if (!vRescanQueue.empty())
+        LogPrintf("%s: Dropping %u queued rescans\n", __func__, vRescanQueue.size());
+    for (const auto& queued : vRescanQueue)
+        queued->fDone = true;
+    vRescanQueue.clear();
+    condScanning.notify_all();
+}
+
+size_t CWallet::GetQueuedRescans()
+{
+    std::lock_guard<std::mutex> lock(mutexScanning);
+    return vRescanQueue.size();
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
@@ -1623,6 +1842,8 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
     CBlockIndex* ret = nullptr;
     {
         fAbortRescan = false;
+        nScanningStartTime = GetTimeMillis();
+        dScanningProgress = 0;
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
         CBlockIndex* tip = nullptr;
         double dProgressStart;
@@ -1633,14 +1854,41 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
             dProgressStart = GuessVerificationProgress(chainParams.TxData(), pindex);
             dProgressTip = GuessVerificationProgress(chainParams.TxData(), tip);
         }
-        while (pindex && !fAbortRescan)
+        // Blocks are read, and their outputs matched, ahead of the scan;
+        // pindexQueue is the next block to queue, pindexScanned the last one
+        // applied to the wallet
+        int nThreads = std::max(0, std::min(MAX_RESCAN_THREADS, (int)gArgs.GetArg("-rescanthreads", DEFAULT_RESCAN_THREADS)));
+        CRescanPrefetcher prefetcher(*this, nThreads);
+        CBlockIndex* pindexQueue = pindexStart;
+        CBlockIndex* pindexScanned = nullptr;
+        while (!fAbortRescan)
         {
+            {
+                LOCK(cs_main);
+                while (pindexQueue && !prefetcher.Full()) {
+                    prefetcher.Push(pindexQueue);
+                    pindexQueue = pindexQueue == pindexStop ? nullptr : chainActive.Next(pindexQueue);
+                }
+                if (tip != chainActive.Tip()) {
+                    tip = chainActive.Tip();
+                    // in case the tip has changed, update progress max
+                    dProgressTip = GuessVerificationProgress(chainParams.TxData(), tip);
+                }
+            }
+            std::unique_ptr<CRescanPrefetcher::Block> prefetched = prefetcher.Pop();
+            if (!prefetched) {
+                pindex = nullptr;
+                break;
+            }
+            pindex = prefetched->pindex;
+
             if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0) {
                 double gvp = 0;
                 {
                     LOCK(cs_main);
                     gvp = GuessVerificationProgress(chainParams.TxData(), pindex);
                 }
+                dScanningProgress = (gvp - dProgressStart) / (dProgressTip - dProgressStart);
                 ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((gvp - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
             }
             if (GetTime() >= nNow + 60) {
@@ -1649,33 +1897,36 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), pindex));
             }
 
-            CBlock block;
-            if (ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
+            if (prefetched->fRead) {
                 LOCK2(cs_main, cs_wallet);
-                if (pindex && !chainActive.Contains(pindex)) {
-                    // Abort scan if current block is no longer active, to prevent
-                    // marking transactions as coming from the wrong block.
+                if (!chainActive.Contains(pindex)) {
+                    // The block was queued before the chain changed. Go on
+                    // after the last block scanned if that is still active,
+                    // otherwise abort scan, to prevent marking transactions
+                    // as coming from the wrong block.
+                    if (pindexScanned && chainActive.Contains(pindexScanned)) {
+                        prefetcher.Clear();
+                        pindexQueue = chainActive.Next(pindexScanned);
+                        continue;
+                    }
                     ret = pindex;
                     break;
                 }
+                const CBlock& block = prefetched->block;
                 for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
-                    AddToWalletIfInvolvingMe(block.vtx[posInBlock], pindex, posInBlock, fUpdate);
+                    if (prefetched->nGeneration != GetKeyStoreGeneration()) {
+                        // Keys were added, by reading ahead or by topping up
+                        // the keypool for an earlier transaction
+                        CRescanPrefetcher::MatchOutputs(*this, *prefetched);
+                    }
+                    if (prefetched->vOutputIsMine[posInBlock] || IsConnectedToWallet(*block.vtx[posInBlock])) {
+                        AddToWalletIfInvolvingMe(block.vtx[posInBlock], pindex, posInBlock, fUpdate);
+                    }
                 }
             } else {
                 ret = pindex;
             }
-            if (pindex == pindexStop) {
-                break;
-            }
-            {
-                LOCK(cs_main);
-                pindex = chainActive.Next(pindex);
-                if (tip != chainActive.Tip()) {
-                    tip = chainActive.Tip();
-                    // in case the tip has changed, update progress max
-                    dProgressTip = GuessVerificationProgress(chainParams.TxData(), tip);
-                }
-            }
+            pindexScanned = pindex;
         }
         if (pindex && fAbortRescan) {
             LogPrintf("Rescan aborted at block %d. Progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), pindex));
@@ -1685,6 +1936,18 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
     return ret;
 }
 
+bool CWallet::IsConnectedToWallet(const CTransaction& tx) const
+{
+    AssertLockHeld(cs_wallet);
+    if (mapWallet.count(tx.GetHash()))
+        return true;
+    for (const CTxIn& txin : tx.vin) {
+        if (mapWallet.count(txin.prevout.hash) || mapTxSpends.count(txin.prevout))
+            return true;
+    }
+    return false;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     // If transactions aren't being broadcasted, don't let them into local mempool either
@@ -2013,14 +2276,90 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman
  */
 
 
+bool CWallet::IsBalanceSettled(const CWalletTx& wtx) const
+{
+    AssertLockHeld(cs_wallet);
+    if (wtx.GetDepthInMainChain() < 1 || wtx.GetBlocksToMaturity() > 0)
+        return false;
+    // Whether a pending spend counts depends on the mempool and on abandoning
+    TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(wtx.GetHash(), 0));
+    for (; iter != mapTxSpends.end() && iter->first.hash == wtx.GetHash(); ++iter) {
+        auto it = mapWallet.find(iter->second);
+        if (it != mapWallet.end() && it->second.GetDepthInMainChain() == 0)
+            return false;
+    }
+    return true;
+}
+
+void CWallet::UpdateSettledBalances() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    // A reorganization, or a change to what is ours, can change what any
+    // transaction adds; start over then
+    if (!pindexBalanceSettled || !chainActive.Contains(pindexBalanceSettled) ||
+        nBalanceSettledGeneration != GetKeyStoreGeneration()) {
+        nBalanceSettledGeneration = GetKeyStoreGeneration();
+        nSettledBalance = 0;
+        nSettledWatchOnlyBalance = 0;
+        setBalanceUnsettled.clear();
+        setSettledWithCoins.clear();
+        for (const auto& entry : mapWallet) {
+            entry.second.fBalanceSettled = false;
+            setBalanceUnsettled.insert(entry.first);
+        }
+    }
+    pindexBalanceSettled = chainActive.Tip();
+
+    auto it = setBalanceUnsettled.begin();
+    while (it != setBalanceUnsettled.end()) {
+        const CWalletTx& wtx = mapWallet.at(*it);
+        if (!IsBalanceSettled(wtx)) {
+            ++it;
+            continue;
+        }
+        wtx.nSettledCredit = wtx.GetAvailableCredit(false);
+        wtx.nSettledWatchCredit = wtx.GetAvailableWatchOnlyCredit(false);
+        wtx.fBalanceSettled = true;
+        nSettledBalance += wtx.nSettledCredit;
+        nSettledWatchOnlyBalance += wtx.nSettledWatchCredit;
+        for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+            if (!IsSpent(*it, i) && IsMine(wtx.tx->vout[i]) != ISMINE_NO) {
+                setSettledWithCoins.insert(*it);
+                break;
+            }
+        }
+        it = setBalanceUnsettled.erase(it);
+    }
+}
+
+void CWallet::MarkBalanceUnsettled(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+    auto it = mapWallet.find(hash);
+    if (it == mapWallet.end())
+        return;
+    const CWalletTx& wtx = it->second;
+    if (wtx.fBalanceSettled) {
+        nSettledBalance -= wtx.nSettledCredit;
+        nSettledWatchOnlyBalance -= wtx.nSettledWatchCredit;
+        wtx.fBalanceSettled = false;
+        setSettledWithCoins.erase(hash);
+    }
+    setBalanceUnsettled.insert(hash);
+}
+
 CAmount CWallet::GetBalance() const
 {
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        UpdateSettledBalances();
+        nTotal = nSettledBalance;
+        for (const uint256& hash : setBalanceUnsettled)
         {
-            const CWalletTx* pcoin = &entry.second;
+            const CWalletTx* pcoin = &mapWallet.at(hash);
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -2034,9 +2373,10 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        UpdateSettledBalances();
+        for (const uint256& hash : setBalanceUnsettled)
         {
-            const CWalletTx* pcoin = &entry.second;
+            const CWalletTx* pcoin = &mapWallet.at(hash);
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -2049,9 +2389,10 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        UpdateSettledBalances();
+        for (const uint256& hash : setBalanceUnsettled)
         {
-            const CWalletTx* pcoin = &entry.second;
+            const CWalletTx* pcoin = &mapWallet.at(hash);
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -2063,9 +2404,11 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        UpdateSettledBalances();
+        nTotal = nSettledWatchOnlyBalance;
+        for (const uint256& hash : setBalanceUnsettled)
         {
-            const CWalletTx* pcoin = &entry.second;
+            const CWalletTx* pcoin = &mapWallet.at(hash);
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -2079,9 +2422,10 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        UpdateSettledBalances();
+        for (const uint256& hash : setBalanceUnsettled)
         {
-            const CWalletTx* pcoin = &entry.second;
+            const CWalletTx* pcoin = &mapWallet.at(hash);
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -2094,9 +2438,10 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        UpdateSettledBalances();
+        for (const uint256& hash : setBalanceUnsettled)
         {
-            const CWalletTx* pcoin = &entry.second;
+            const CWalletTx* pcoin = &mapWallet.at(hash);
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
@@ -2170,10 +2515,17 @@ void CWallet::AvailableCoins(std::vector<COutput> &vCoins, bool fOnlySafe, const
 
         CAmount nTotal = 0;
 
-        for (const auto& entry : mapWallet)
+        // Settled transactions whose outputs are all spent, or not ours,
+        // have no coins until the settled balances start over
+        UpdateSettledBalances();
+        std::vector<uint256> vCandidates;
+        vCandidates.reserve(setBalanceUnsettled.size() + setSettledWithCoins.size());
+        std::set_union(setBalanceUnsettled.begin(), setBalanceUnsettled.end(),
+                       setSettledWithCoins.begin(), setSettledWithCoins.end(), std::back_inserter(vCandidates));
+
+        for (const uint256& wtxid : vCandidates)
         {
-            const uint256& wtxid = entry.first;
-            const CWalletTx* pcoin = &entry.second;
+            const CWalletTx* pcoin = &mapWallet.at(wtxid);
 
             if (!CheckFinalTx(*pcoin->tx))
                 continue;
@@ -2234,10 +2586,10 @@ void CWallet::AvailableCoins(std::vector<COutput> &vCoins, bool fOnlySafe, const
                 if (pcoin->tx->vout[i].nValue < nMinimumAmount || pcoin->tx->vout[i].nValue > nMaximumAmount)
                     continue;
 
-                if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(COutPoint(entry.first, i)))
+                if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(COutPoint(wtxid, i)))
                     continue;
 
-                if (IsLockedCoin(entry.first, i))
+                if (IsLockedCoin(wtxid, i))
                     continue;
 
                 if (IsSpent(wtxid, i))
@@ -2381,12 +2733,40 @@ static void ApproximateBestSubset(const std::vector<CInputCoin>& vValue, const C
     }
 }
 
+bool CWallet::OutputEligibleForSpending(const COutput& output, const int nConfMine, const int nConfTheirs, const uint64_t nMaxAncestors) const
+{
+    if (!output.fSpendable)
+        return false;
+
+    if (output.nDepth < (output.tx->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
+        return false;
+
+    if (!mempool.TransactionWithinChainLimit(output.tx->GetHash(), nMaxAncestors))
+        return false;
+
+    return true;
+}
+
 bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMine, const int nConfTheirs, const uint64_t nMaxAncestors, std::vector<COutput> vCoins,
-                                 std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet) const
+                                 std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet, const CoinSelectionParams& coin_selection_params) const
 {
     setCoinsRet.clear();
     nValueRet = 0;
 
+    if (coin_selection_params.use_bnb) {
+        std::vector<CInputCoin> utxo_pool;
+        for (const COutput& output : vCoins) {
+            if (output.nInputBytes < 0 || !OutputEligibleForSpending(output, nConfMine, nConfTheirs, nMaxAncestors))
+                continue;
+            CInputCoin coin(output.tx, output.i);
+            coin.effective_value = coin.txout.nValue - coin_selection_params.effective_fee.GetFee(output.nInputBytes);
+            // Coins that cost more to spend than they are worth never help
+            if (coin.effective_value > 0)
+                utxo_pool.push_back(coin);
+        }
+        return SelectCoinsBnB(utxo_pool, nTargetValue + coin_selection_params.not_input_fees, coin_selection_params.cost_of_change, setCoinsRet, nValueRet);
+    }
+
     // List of values less than target
     boost::optional<CInputCoin> coinLowestLarger;
     std::vector<CInputCoin> vValue;
@@ -2396,17 +2776,10 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMin
 
     for (const COutput &output : vCoins)
     {
-        if (!output.fSpendable)
+        if (!OutputEligibleForSpending(output, nConfMine, nConfTheirs, nMaxAncestors))
             continue;
 
         const CWalletTx *pcoin = output.tx;
-
-        if (output.nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
-            continue;
-
-        if (!mempool.TransactionWithinChainLimit(pcoin->GetHash(), nMaxAncestors))
-            continue;
-
         int i = output.i;
 
         CInputCoin coin = CInputCoin(pcoin, i);
@@ -2487,9 +2860,12 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMin
     return true;
 }
 
-bool CWallet::SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl) const
+bool CWallet::SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl,
+                          const CoinSelectionParams& coin_selection_params, bool* pbnb_used) const
 {
     std::vector<COutput> vCoins(vAvailableCoins);
+    if (pbnb_used)
+        *pbnb_used = false;
 
     // coin control -> return all selected outputs (we want all selected to go into the transaction for sure)
     if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs)
@@ -2538,14 +2914,21 @@ bool CWallet::SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAm
     size_t nMaxChainLength = std::min(gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT), gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT));
     bool fRejectLongChains = gArgs.GetBoolArg("-walletrejectlongchains", DEFAULT_WALLET_REJECT_LONG_CHAINS);
 
+    // The fees of preset inputs are not part of the branch and bound target, so leave them to knapsack
+    CoinSelectionParams params(coin_selection_params);
+    if (!vPresetInputs.empty())
+        params.use_bnb = false;
+    if (pbnb_used)
+        *pbnb_used = params.use_bnb;
+
     bool res = nTargetValue <= nValueFromPresetInputs ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, 0, vCoins, setCoinsRet, nValueRet) ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, 0, vCoins, setCoinsRet, nValueRet) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, 2, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::min((size_t)4, nMaxChainLength/3), vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength/2, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && !fRejectLongChains && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::numeric_limits<uint64_t>::max(), vCoins, setCoinsRet, nValueRet));
+        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, 0, vCoins, setCoinsRet, nValueRet, params) ||
+        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, 0, vCoins, setCoinsRet, nValueRet, params) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, 2, vCoins, setCoinsRet, nValueRet, params)) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::min((size_t)4, nMaxChainLength/3), vCoins, setCoinsRet, nValueRet, params)) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength/2, vCoins, setCoinsRet, nValueRet, params)) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength, vCoins, setCoinsRet, nValueRet, params)) ||
+        (bSpendZeroConfChange && !fRejectLongChains && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::numeric_limits<uint64_t>::max(), vCoins, setCoinsRet, nValueRet, params));
 
     // because SelectCoinsMinConf clears the setCoinsRet, we now add the possible inputs to the coinset
     setCoinsRet.insert(setPresetCoins.begin(), setPresetCoins.end());
@@ -2556,26 +2939,77 @@ bool CWallet::SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAm
     return res;
 }
 
+int CWallet::CalculateMaximumSignedInputSize(const CTxOut& txout) const
+{
+    CMutableTransaction txNew;
+    txNew.vin.push_back(CTxIn(COutPoint()));
+    SignatureData sigdata;
+    if (!ProduceSignature(DummySignatureCreator(this), txout.scriptPubKey, sigdata))
+        return -1;
+    UpdateTransaction(txNew, 0, sigdata);
+
+    // Witness data is discounted as in GetTransactionWeight
+    const CTxIn& txin = txNew.vin[0];
+    int64_t nWeight = ::GetSerializeSize(txin, SER_NETWORK, PROTOCOL_VERSION) * WITNESS_SCALE_FACTOR +
+                      ::GetSerializeSize(txin.scriptWitness.stack, SER_NETWORK, PROTOCOL_VERSION);
+    return (nWeight + WITNESS_SCALE_FACTOR - 1) / WITNESS_SCALE_FACTOR;
+}
+
+WalletBatchWriter::WalletBatchWriter(CWallet& wallet) : m_wallet(wallet), m_fBatch(false)
+{
+    AssertLockHeld(m_wallet.cs_wallet);
+    if (m_wallet.pwalletdbBatch)
+        return;
+    m_walletdb.reset(new CWalletDB(*m_wallet.dbw));
+    m_fBatch = m_walletdb->BatchBegin();
+    m_wallet.pwalletdbBatch = m_walletdb.get();
+}
+
+bool WalletBatchWriter::Commit()
+{
+    if (!m_walletdb)
+        return true;
+    m_wallet.pwalletdbBatch = nullptr;
+    bool ret = !m_fBatch || m_walletdb->BatchCommit();
+    m_walletdb.reset();
+    return ret;
+}
+
+WalletBatchWriter::~WalletBatchWriter()
+{
+    if (!Commit())
+        LogPrintf("%s: committing wallet writes failed\n", __func__);
+}
+
 bool CWallet::SignTransaction(CMutableTransaction &tx)
 {
     AssertLockHeld(cs_wallet); // mapWallet
 
     // sign the new tx
     CTransaction txNewConst(tx);
-    int nIn = 0;
+    std::vector<const CTxOut*> vSpent;
+    vSpent.reserve(tx.vin.size());
     for (const auto& input : tx.vin) {
         std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(input.prevout.hash);
         if(mi == mapWallet.end() || input.prevout.n >= mi->second.tx->vout.size()) {
             return false;
         }
-        const CScript& scriptPubKey = mi->second.tx->vout[input.prevout.n].scriptPubKey;
-        const CAmount& amount = mi->second.tx->vout[input.prevout.n].nValue;
-        SignatureData sigdata;
-        if (!ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, amount, SIGHASH_ALL), scriptPubKey, sigdata)) {
-            return false;
+        vSpent.push_back(&mi->second.tx->vout[input.prevout.n]);
+    }
+
+    // Inputs are signed independently; the key store only takes cs_KeyStore
+    std::vector<SignatureData> vSigData(tx.vin.size());
+    std::atomic<bool> fSigned(true);
+    ForEachInput(tx.vin.size(), [&](unsigned int nIn) {
+        if (!ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, vSpent[nIn]->nValue, SIGHASH_ALL), vSpent[nIn]->scriptPubKey, vSigData[nIn])) {
+            fSigned = false;
         }
-        UpdateTransaction(tx, nIn, sigdata);
-        nIn++;
+    });
+    if (!fSigned) {
+        return false;
+    }
+    for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++) {
+        UpdateTransaction(tx, nIn, vSigData[nIn]);
     }
     return true;
 }
@@ -2766,8 +3200,27 @@ bool CWallet::CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletT
             size_t change_prototype_size = GetSerializeSize(change_prototype_txout, SER_DISK, 0);
 
             CFeeRate discard_rate = GetDiscardRate(::feeEstimator);
+
+            // Look for inputs that pay for the amount and the fee without
+            // change first. That only works when the fee is added to the
+            // amount, not taken out of it.
+            CoinSelectionParams coin_selection_params;
+            coin_selection_params.use_bnb = nSubtractFeeFromAmount == 0;
+            coin_selection_params.effective_fee = CFeeRate(GetMinimumFee(1000, coin_control, ::mempool, ::feeEstimator, nullptr));
+            coin_selection_params.cost_of_change = coin_selection_params.effective_fee.GetFee(change_prototype_size);
+            int change_spend_size = CalculateMaximumSignedInputSize(change_prototype_txout);
+            if (change_spend_size > 0)
+                coin_selection_params.cost_of_change += discard_rate.GetFee(change_spend_size);
+            if (coin_selection_params.use_bnb) {
+                for (COutput& output : vAvailableCoins) {
+                    if (output.fSpendable)
+                        output.nInputBytes = CalculateMaximumSignedInputSize(output.tx->tx->vout[output.i]);
+                }
+            }
+
             nFeeRet = 0;
             bool pick_new_inputs = true;
+            bool bnb_used = false;
             CAmount nValueIn = 0;
             // Start with no fee and loop until there is enough fee
             while (true)
@@ -2818,8 +3271,16 @@ bool CWallet::CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletT
                 if (pick_new_inputs) {
                     nValueIn = 0;
                     setCoins.clear();
-                    if (!SelectCoins(vAvailableCoins, nValueToSelect, setCoins, nValueIn, &coin_control))
+                    // Fee for the transaction without inputs: the payee outputs, and the
+                    // version, counts and locktime, plus one for a witness marker and flag
+                    coin_selection_params.not_input_fees = coin_selection_params.effective_fee.GetFee(GetVirtualTransactionSize(txNew) + 1);
+                    if (!SelectCoins(vAvailableCoins, nValueToSelect, setCoins, nValueIn, &coin_control, coin_selection_params, &bnb_used))
                     {
+                        // No match without change; select again with knapsack
+                        if (bnb_used) {
+                            coin_selection_params.use_bnb = false;
+                            continue;
+                        }
                         strFailReason = _("Insufficient funds");
                         return false;
                     }
@@ -2833,8 +3294,10 @@ bool CWallet::CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletT
                     CTxOut newTxOut(nChange, scriptChange);
 
                     // Never create dust outputs; if we would, just
-                    // add the dust to the fee.
-                    if (IsDust(newTxOut, discard_rate))
+                    // add the dust to the fee. The excess of a branch and
+                    // bound match costs less than change, so it goes to the
+                    // fee as well.
+                    if (IsDust(newTxOut, discard_rate) || bnb_used)
                     {
                         nChangePosInOut = -1;
                         nFeeRet += nChange;
@@ -2958,6 +3421,7 @@ bool CWallet::CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletT
 
                 // Include more fee and try again.
                 nFeeRet = nFeeNeeded;
+                coin_selection_params.use_bnb = false;
                 continue;
             }
         }
@@ -2967,22 +3431,25 @@ bool CWallet::CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletT
         if (sign)
         {
             CTransaction txNewConst(txNew);
-            int nIn = 0;
+            // txNew.vin was filled in the order of setCoins
+            std::vector<const CInputCoin*> vSpent;
+            vSpent.reserve(setCoins.size());
             for (const auto& coin : setCoins)
+                vSpent.push_back(&coin);
+
+            std::vector<SignatureData> vSigData(vSpent.size());
+            std::atomic<bool> fSigned(true);
+            ForEachInput(vSpent.size(), [&](unsigned int nIn) {
+                if (!ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, vSpent[nIn]->txout.nValue, SIGHASH_ALL), vSpent[nIn]->txout.scriptPubKey, vSigData[nIn]))
+                    fSigned = false;
+            });
+            if (!fSigned)
             {
-                const CScript& scriptPubKey = coin.txout.scriptPubKey;
-                SignatureData sigdata;
-
-                if (!ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, coin.txout.nValue, SIGHASH_ALL), scriptPubKey, sigdata))
-                {
-                    strFailReason = _("Signing transaction failed");
-                    return false;
-                } else {
-                    UpdateTransaction(txNew, nIn, sigdata);
-                }
-
-                nIn++;
+                strFailReason = _("Signing transaction failed");
+                return false;
             }
+            for (unsigned int nIn = 0; nIn < vSigData.size(); nIn++)
+                UpdateTransaction(txNew, nIn, vSigData[nIn]);
         }
 
         // Embed the constructed transaction data in wtxNew.
@@ -3130,6 +3597,7 @@ DBErrors CWallet::ZapSelectTx(std::vector<uint256>& vHashIn, std::vector<uint256
         wtxOrdered.erase(it->second.m_it_wtxOrdered);
         mapWallet.erase(it);
     }
+    pindexBalanceSettled = nullptr;
 
     if (nZapSelectTxRet == DB_NEED_REWRITE)
     {
@@ -3184,12 +3652,20 @@ bool CWallet::SetAddressBook(const CTxDestination& address, const std::string& s
         LOCK(cs_wallet); // mapAddressBook
         std::map<CTxDestination, CAddressBookData>::iterator mi = mapAddressBook.find(address);
         fUpdated = mi != mapAddressBook.end();
+        if (!fUpdated)
+            nAddressBookGeneration++;
         mapAddressBook[address].name = strName;
         if (!strPurpose.empty()) /* update purpose only if requested */
             mapAddressBook[address].purpose = strPurpose;
     }
     NotifyAddressBookChanged(this, address, strName, ::IsMine(*this, address) != ISMINE_NO,
                              strPurpose, (fUpdated ? CT_UPDATED : CT_NEW) );
+    LOCK(cs_wallet); // pwalletdbBatch
+    if (pwalletdbBatch) {
+        if (!strPurpose.empty() && !pwalletdbBatch->WritePurpose(EncodeDestination(address), strPurpose))
+            return false;
+        return pwalletdbBatch->WriteName(EncodeDestination(address), strName);
+    }
     if (!strPurpose.empty() && !CWalletDB(*dbw).WritePurpose(EncodeDestination(address), strPurpose))
         return false;
     return CWalletDB(*dbw).WriteName(EncodeDestination(address), strName);
@@ -3207,6 +3683,7 @@ bool CWallet::DelAddressBook(const CTxDestination& address)
             CWalletDB(*dbw).EraseDestData(strAddress, item.first);
         }
         mapAddressBook.erase(address);
+        nAddressBookGeneration++;
     }
 
     NotifyAddressBookChanged(this, address, "", ::IsMine(*this, address) != ISMINE_NO, "", CT_DELETED);
@@ -3310,28 +3787,28 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
             // don't create extra internal keys
             missingInternal = 0;
         }
-        bool internal = false;
-        CWalletDB walletdb(*dbw);
-        for (int64_t i = missingInternal + missingExternal; i--;)
-        {
-            if (i < missingInternal) {
-                internal = true;
-            }
-
-            assert(m_max_keypool_index < std::numeric_limits<int64_t>::max()); // How in the hell did you use so many keys?
-            int64_t index = ++m_max_keypool_index;
-
-            CPubKey pubkey(GenerateNewKey(walletdb, internal));
-            if (!walletdb.WritePool(index, CKeyPool(pubkey, internal))) {
-                throw std::runtime_error(std::string(__func__) + ": writing generated key failed");
-            }
+        WalletBatchWriter batch(*this);
+        CWalletDB& walletdb = batch.GetDB();
+        // External keys first, then internal ones
+        for (bool internal : {false, true}) {
+            for (const CPubKey& pubkey : GenerateNewKeys(walletdb, internal, internal ? missingInternal : missingExternal)) {
+                assert(m_max_keypool_index < std::numeric_limits<int64_t>::max()); // How in the hell did you use so many keys?
+                int64_t index = ++m_max_keypool_index;
+
+                if (!walletdb.WritePool(index, CKeyPool(pubkey, internal))) {
+                    throw std::runtime_error(std::string(__func__) + ": writing generated key failed");
+                }
 
-            if (internal) {
-                setInternalKeyPool.insert(index);
-            } else {
-                setExternalKeyPool.insert(index);
+                if (internal) {
+                    setInternalKeyPool.insert(index);
+                } else {
+                    setExternalKeyPool.insert(index);
+                }
+                m_pool_key_to_index[pubkey.GetID()] = index;
             }
-            m_pool_key_to_index[pubkey.GetID()] = index;
+        }
+        if (!batch.Commit()) {
+            throw std::runtime_error(std::string(__func__) + ": writing generated keys failed");
         }
         if (missingInternal + missingExternal > 0) {
             LogPrintf("keypool added %d keys (%d internal), size=%u (%u internal)\n", missingInternal + missingExternal, missingInternal, setInternalKeyPool.size() + setExternalKeyPool.size(), setInternalKeyPool.size());
@@ -3340,6 +3817,42 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
     return true;
 }
 
+bool CWallet::RefillKeyPool()
+{
+    if (!m_keypool_scheduler)
+        return TopUpKeyPool();
+
+    LOCK(cs_wallet);
+    if (!TopUpKeyPool(1))
+        return false;
+    if (!m_keypool_topup_scheduled.exchange(true)) {
+        m_keypool_scheduler->schedule(std::bind(&CWallet::TopUpKeyPoolInBackground, this));
+    }
+    return true;
+}
+
+void CWallet::TopUpKeyPoolInBackground()
+{
+    // Another refill schedules another top-up from now on
+    m_keypool_topup_scheduled = false;
+    const unsigned int nTargetSize = std::max(gArgs.GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 1);
+    while (true) {
+        LOCK(cs_wallet);
+        size_t nSize = setExternalKeyPool.size();
+        if (IsHDEnabled() && CanSupportFeature(FEATURE_HD_SPLIT))
+            nSize = std::min(nSize, setInternalKeyPool.size());
+        if (nSize >= nTargetSize || IsLocked())
+            return;
+        try {
+            if (!TopUpKeyPool(std::min<size_t>(nTargetSize, nSize + KEYPOOL_BACKGROUND_CHUNK)))
+                return;
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+            return;
+        }
+    }
+}
+
 void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool, bool fRequestedInternal)
 {
     nIndex = -1;
@@ -3348,7 +3861,7 @@ void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool, bool fRe
         LOCK(cs_wallet);
 
         if (!IsLocked())
-            TopUpKeyPool();
+            RefillKeyPool();
 
         bool fReturningInternal = IsHDEnabled() && CanSupportFeature(FEATURE_HD_SPLIT) && fRequestedInternal;
         std::set<int64_t>& setKeyPool = fReturningInternal ? setInternalKeyPool : setExternalKeyPool;
@@ -3781,7 +4294,8 @@ unsigned int CWallet::ComputeTimeSmart(const CWalletTx& wtx) const
 {
     unsigned int nTimeSmart = wtx.nTimeReceived;
     if (!wtx.hashUnset()) {
-        if (mapBlockIndex.count(wtx.hashBlock)) {
+        const CBlockIndex* pindex = LookupBlockIndexNoLock(wtx.hashBlock);
+        if (pindex) {
             int64_t latestNow = wtx.nTimeReceived;
             int64_t latestEntry = 0;
 
@@ -3812,7 +4326,7 @@ unsigned int CWallet::ComputeTimeSmart(const CWalletTx& wtx) const
                 }
             }
 
-            int64_t blocktime = mapBlockIndex[wtx.hashBlock]->GetBlockTime();
+            int64_t blocktime = pindex->GetBlockTime();
             nTimeSmart = std::max(latestEntry, std::min(blocktime, latestNow));
         } else {
             LogPrintf("%s: found %s in block %s not in index\n", __func__, wtx.GetHash().ToString(), wtx.hashBlock.ToString());
@@ -3826,12 +4340,16 @@ bool CWallet::AddDestData(const CTxDestination &dest, const std::string &key, co
     if (boost::get<CNoDestination>(&dest))
         return false;
 
+    if (!mapAddressBook.count(dest))
+        nAddressBookGeneration++;
     mapAddressBook[dest].destdata.insert(std::make_pair(key, value));
     return CWalletDB(*dbw).WriteDestData(EncodeDestination(dest), key, value);
 }
 
 bool CWallet::EraseDestData(const CTxDestination &dest, const std::string &key)
 {
+    if (!mapAddressBook.count(dest))
+        nAddressBookGeneration++;
     if (!mapAddressBook[dest].destdata.erase(key))
         return false;
     return CWalletDB(*dbw).EraseDestData(EncodeDestination(dest), key);
@@ -3992,7 +4510,7 @@ CWallet* CWallet::CreateWalletFromFile(const std::string walletFile)
     }
 
     walletInstance->m_last_block_processed = chainActive.Tip();
-    RegisterValidationInterface(walletInstance);
+    RegisterValidationInterface(walletInstance, true);
 
     if (chainActive.Tip() && chainActive.Tip() != pindexRescan)
     {
@@ -4082,6 +4600,10 @@ void CWallet::postInitProcess(CScheduler& scheduler)
     if (!CWallet::fFlushScheduled.exchange(true)) {
         scheduler.scheduleEvery(MaybeCompactWalletDB, 500);
     }
+
+    if (gArgs.GetBoolArg("-keypoolbackground", DEFAULT_KEYPOOL_BACKGROUND)) {
+        m_keypool_scheduler = &scheduler;
+    }
 }
 
 bool CWallet::BackupWallet(const std::string& strDest)
@@ -4122,18 +4644,27 @@ int CMerkleTx::GetDepthInMainChain(const CBlockIndex* &pindexRet) const
     if (hashUnset())
         return 0;
 
-    AssertLockHeld(cs_main);
+    // The height is read first, so that it is not from a later chain than the rewind count
+    const int nHeight = GetChainSnapshotHeight();
+    const uint64_t nRewindCount = GetChainRewindCount();
+    if (pindexCached && nRewindCountCached == nRewindCount && hashBlockCached == hashBlock) {
+        pindexRet = pindexCached;
+        return ((nIndex == -1) ? (-1) : 1) * (nHeight - pindexCached->nHeight + 1);
+    }
 
     // Find the block it claims to be in
-    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-    if (mi == mapBlockIndex.end())
+    const CBlockIndex* pindex = LookupBlockIndexNoLock(hashBlock);
+    if (!pindex)
         return 0;
-    CBlockIndex* pindex = (*mi).second;
-    if (!pindex || !chainActive.Contains(pindex))
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
+    if (!chain->Contains(pindex))
         return 0;
 
+    pindexCached = pindex;
+    hashBlockCached = hashBlock;
+    nRewindCountCached = nRewindCount;
     pindexRet = pindex;
-    return ((nIndex == -1) ? (-1) : 1) * (chainActive.Height() - pindex->nHeight + 1);
+    return ((nIndex == -1) ? (-1) : 1) * (chain->Height() - pindex->nHeight + 1);
 }
 
 int CMerkleTx::GetBlocksToMaturity() const
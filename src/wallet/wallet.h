@@ -12,15 +12,18 @@
 #include <tinyformat.h>
 #include <ui_interface.h>
 #include <utilstrencodings.h>
+#include <utiltime.h>
 #include <validationinterface.h>
 #include <script/ismine.h>
 #include <script/sign.h>
+#include <wallet/coinselection.h>
 #include <wallet/crypter.h>
 #include <wallet/walletdb.h>
 #include <wallet/rpcwallet.h>
 
 #include <algorithm>
 #include <atomic>
+#include <condition_variable>
 #include <map>
 #include <memory>
 #include <set>
@@ -42,6 +45,14 @@ extern bool bSpendZeroConfChange;
 extern bool fWalletRbf;
 
 static const unsigned int DEFAULT_KEYPOOL_SIZE = 1000;
+//! -keypoolbackground default
+static const bool DEFAULT_KEYPOOL_BACKGROUND = false;
+//! Keys of each kind added at a time by background top-ups, which release cs_wallet in between
+static const unsigned int KEYPOOL_BACKGROUND_CHUNK = 500;
+//! Most threads deriving HD keys for the keypool
+static const unsigned int MAX_KEY_DERIVE_THREADS = 8;
+//! Fewest keys worth deriving on another thread
+static const unsigned int MIN_KEYS_PER_DERIVE_THREAD = 50;
 //! -paytxfee default
 static const CAmount DEFAULT_TRANSACTION_FEE = 0;
 //! -fallbackfee default
@@ -205,6 +216,16 @@ private:
   /** Constant used in hashBlock to indicate tx has been abandoned */
     static const uint256 ABANDON_HASH;
 
+    /**
+     * The block hashBlock was found in the chain at, as of rewind count
+     * nRewindCountCached (see GetChainRewindCount), so that the depth of a
+     * confirmed transaction is found from the tip height alone until a block
+     * is disconnected. Guarded by the cs_wallet of the wallet holding it.
+     */
+    mutable const CBlockIndex* pindexCached = nullptr;
+    mutable uint256 hashBlockCached;
+    mutable uint64_t nRewindCountCached = 0;
+
 public:
     CTransactionRef tx;
     uint256 hashBlock;
@@ -257,6 +278,10 @@ public:
      * <0  : conflicts with a transaction this deep in the blockchain
      *  0  : in memory pool, waiting to be included in a block
      * >=1 : this many blocks deep in the main chain
+     * Reads GetChainSnapshot(), so cs_main is not needed; callers that hold
+     * it see the same chain as chainActive. The block of a confirmed
+     * transaction is remembered until a block is disconnected, so callers
+     * must hold cs_wallet.
      */
     int GetDepthInMainChain(const CBlockIndex* &pindexRet) const;
     int GetDepthInMainChain() const { const CBlockIndex *pindexRet; return GetDepthInMainChain(pindexRet); }
@@ -340,6 +365,7 @@ public:
     mutable bool fAvailableWatchCreditCached;
     mutable bool fChangeCached;
     mutable bool fInMempool;
+    mutable bool fBalanceSettled;
     mutable CAmount nDebitCached;
     mutable CAmount nCreditCached;
     mutable CAmount nImmatureCreditCached;
@@ -349,6 +375,22 @@ public:
     mutable CAmount nImmatureWatchCreditCached;
     mutable CAmount nAvailableWatchCreditCached;
     mutable CAmount nChangeCached;
+    //! What the transaction adds to the wallet's settled balances, if fBalanceSettled
+    mutable CAmount nSettledCredit;
+    mutable CAmount nSettledWatchCredit;
+
+    //! What GetAmounts returns for one filter, see GetCachedAmounts
+    struct Amounts
+    {
+        isminefilter filter;
+        //! CWallet::GetAmountsGeneration when these were computed
+        uint64_t nGeneration;
+        std::list<COutputEntry> listReceived;
+        std::list<COutputEntry> listSent;
+        CAmount nFee;
+    };
+    //! Shared between copies, never modified once computed
+    mutable std::shared_ptr<const Amounts> pAmountsCached;
 
     CWalletTx()
     {
@@ -380,6 +422,7 @@ public:
         fAvailableWatchCreditCached = false;
         fChangeCached = false;
         fInMempool = false;
+        fBalanceSettled = false;
         nDebitCached = 0;
         nCreditCached = 0;
         nImmatureCreditCached = 0;
@@ -389,6 +432,9 @@ public:
         nAvailableWatchCreditCached = 0;
         nImmatureWatchCreditCached = 0;
         nChangeCached = 0;
+        nSettledCredit = 0;
+        nSettledWatchCredit = 0;
+        pAmountsCached.reset();
         nOrderPos = -1;
     }
 
@@ -447,6 +493,7 @@ public:
         fImmatureWatchCreditCached = false;
         fDebitCached = false;
         fChangeCached = false;
+        pAmountsCached.reset();
     }
 
     void BindWallet(CWallet *pwalletIn)
@@ -466,6 +513,13 @@ public:
 
     void GetAmounts(std::list<COutputEntry>& listReceived,
                     std::list<COutputEntry>& listSent, CAmount& nFee, std::string& strSentAccount, const isminefilter& filter) const;
+    /**
+     * GetAmounts without the copies: the result is kept until the transaction
+     * is marked dirty, or a key or address book entry is added that could
+     * change which outputs are ours or change. The sent account is
+     * strFromAccount.
+     */
+    std::shared_ptr<const Amounts> GetCachedAmounts(const isminefilter& filter) const;
 
     bool IsFromMe(const isminefilter& filter) const
     {
@@ -501,10 +555,13 @@ public:
 
         outpoint = COutPoint(walletTx->GetHash(), i);
         txout = walletTx->tx->vout[i];
+        effective_value = txout.nValue;
     }
 
     COutPoint outpoint;
     CTxOut txout;
+    /** Value less the fee for spending it, see SelectCoinsBnB */
+    CAmount effective_value;
 
     bool operator<(const CInputCoin& rhs) const {
         return outpoint < rhs.outpoint;
@@ -539,9 +596,12 @@ public:
      */
     bool fSafe;
 
+    /** Virtual size of a signed input spending this output, or -1 if not known */
+    int nInputBytes;
+
     COutput(const CWalletTx *txIn, int iIn, int nDepthIn, bool fSpendableIn, bool fSolvableIn, bool fSafeIn)
     {
-        tx = txIn; i = iIn; nDepth = nDepthIn; fSpendable = fSpendableIn; fSolvable = fSolvableIn; fSafe = fSafeIn;
+        tx = txIn; i = iIn; nDepth = nDepthIn; fSpendable = fSpendableIn; fSolvable = fSolvableIn; fSafe = fSafeIn; nInputBytes = -1;
     }
 
     std::string ToString() const;
@@ -671,18 +731,69 @@ private:
     static std::atomic<bool> fFlushScheduled;
     std::atomic<bool> fAbortRescan;
     std::atomic<bool> fScanningWallet; //controlled by WalletRescanReserver
+    //! Incremented whenever a key, script or watch-only script is added or removed
+    std::atomic<uint64_t> nKeyStoreGeneration;
+    //! Incremented whenever an address book entry is added or removed
+    std::atomic<uint64_t> nAddressBookGeneration;
+
+    /**
+     * GetBalance and GetWatchOnlyBalance of the settled transactions: those
+     * in a block, mature, and whose outputs are unspent or spent by
+     * transactions that are not pending either. Their contribution only
+     * changes through a reorganization, a change to what is ours, or a new
+     * transaction spending from them, so the balances only need to look at
+     * the other transactions. All guarded by cs_wallet.
+     */
+    mutable CAmount nSettledBalance;
+    mutable CAmount nSettledWatchOnlyBalance;
+    //! The transactions not counted in the settled balances
+    mutable std::set<uint256> setBalanceUnsettled;
+    //! The settled transactions with outputs of ours left unspent; with the
+    //! unsettled ones, the only transactions AvailableCoins has to look at
+    mutable std::set<uint256> setSettledWithCoins;
+    //! Tip the settled balances were computed at; nullptr to start over
+    mutable const CBlockIndex* pindexBalanceSettled;
+    mutable uint64_t nBalanceSettledGeneration;
+
+    bool IsBalanceSettled(const CWalletTx& wtx) const;
+    /** Bring the settled balances up to date with the chain and wallet */
+    void UpdateSettledBalances() const;
+    /** Take a transaction out of the settled balances, as it changed */
+    void MarkBalanceUnsettled(const uint256& hash);
     std::mutex mutexScanning;
+    //! Signalled when a rescan ends or queued rescans are served, guarded by mutexScanning
+    std::condition_variable condScanning;
     friend class WalletRescanReserver;
+    //! When the running rescan started, in milliseconds, and how far it got
+    std::atomic<int64_t> nScanningStartTime;
+    std::atomic<double> dScanningProgress;
+
+    /** A rescan an import asked for, waiting to be served by RescanFromTimeQueued */
+    struct QueuedRescan {
+        int64_t nStartTime;
+        bool fUpdate;
+        bool fDone;
+        //! What RescanFromTime returned for this request, once done
+        int64_t nScannedTime;
+    };
+    //! Rescans waiting for the next scan, guarded by mutexScanning
+    std::vector<std::shared_ptr<QueuedRescan>> vRescanQueue;
 
 
     /**
      * Select a set of coins such that nValueRet >= nTargetValue and at least
      * all coins from coinControl are selected; Never select unconfirmed coins
-     * if they are not ours
+     * if they are not ours. With coin_selection_params.use_bnb, looks for a
+     * match that needs no change first (see SelectCoinsMinConf); *pbnb_used
+     * tells whether that was searched, rather than knapsack
      */
-    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = nullptr) const;
+    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = nullptr,
+                     const CoinSelectionParams& coin_selection_params = CoinSelectionParams(), bool* pbnb_used = nullptr) const;
 
     CWalletDB *pwalletdbEncryption;
+    //! Handle of the write batch in progress, see WalletBatchWriter
+    CWalletDB *pwalletdbBatch;
+    friend class WalletBatchWriter;
 
     //! the current wallet version: clients below this version are not able to load the wallet
     int nWalletVersion;
@@ -718,6 +829,15 @@ private:
 
     /* HD derive new child key (on internal or external chain) */
     void DeriveNewChildKey(CWalletDB &walletdb, CKeyMetadata& metadata, CKey& secret, bool internal = false);
+    /* HD derive the key of the internal or external chain (m/0'/1' or m/0'/0') */
+    void DeriveChainKey(CExtKey& chainChildKey, bool internal);
+    /* Generate nCount new keys, deriving HD keys on several threads */
+    std::vector<CPubKey> GenerateNewKeys(CWalletDB& walletdb, bool internal, size_t nCount);
+
+    //! Where the keypool is topped up in the background, with -keypoolbackground
+    CScheduler* m_keypool_scheduler = nullptr;
+    std::atomic<bool> m_keypool_topup_scheduled{false};
+    void TopUpKeyPoolInBackground();
 
     std::set<int64_t> setInternalKeyPool;
     std::set<int64_t> setExternalKeyPool;
@@ -747,9 +867,10 @@ private:
      * to have seen all transactions in the chain, but is only used to track
      * live BlockConnected callbacks.
      *
-     * Protected by cs_main (see BlockUntilSyncedToCurrentChain)
+     * Atomic, as it is compared against GetChainSnapshot() without cs_main
+     * (see BlockUntilSyncedToCurrentChain)
      */
-    const CBlockIndex* m_last_block_processed;
+    std::atomic<const CBlockIndex*> m_last_block_processed;
 
 public:
     /*
@@ -813,6 +934,7 @@ public:
         nWalletMaxVersion = FEATURE_BASE;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = nullptr;
+        pwalletdbBatch = nullptr;
         nOrderPosNext = 0;
         nAccountingEntryNumber = 0;
         nNextResend = 0;
@@ -823,6 +945,14 @@ public:
         nRelockTime = 0;
         fAbortRescan = false;
         fScanningWallet = false;
+        nScanningStartTime = 0;
+        dScanningProgress = 0;
+        nKeyStoreGeneration = 0;
+        nAddressBookGeneration = 0;
+        nSettledBalance = 0;
+        nSettledWatchOnlyBalance = 0;
+        pindexBalanceSettled = nullptr;
+        nBalanceSettledGeneration = 0;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -863,9 +993,17 @@ public:
      * Shuffle and select coins until nTargetValue is reached while avoiding
      * small change; This method is stochastic for some inputs and upon
      * completion the coin set and corresponding actual target value is
-     * assembled
+     * assembled.
+     *
+     * With coin_selection_params.use_bnb, only looks for a set of coins whose
+     * values less their input fees match nTargetValue plus the fees of the
+     * rest of the transaction, to within the cost of change (SelectCoinsBnB).
+     * Only coins with a known COutput::nInputBytes take part in that.
      */
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, std::vector<COutput> vCoins, std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, std::vector<COutput> vCoins, std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet,
+                            const CoinSelectionParams& coin_selection_params = CoinSelectionParams()) const;
+    /** Whether SelectCoinsMinConf may spend an output at these confirmation and ancestor limits */
+    bool OutputEligibleForSpending(const COutput& output, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
 
@@ -878,9 +1016,21 @@ public:
     /*
      * Rescan abort properties
      */
-    void AbortRescan() { fAbortRescan = true; }
+    /** Abort the running rescan, and drop the ones queued behind it */
+    void AbortRescan();
     bool IsAbortingRescan() { return fAbortRescan; }
+    /** Changes whenever something is added that IsMine may match, so that a
+     * match computed earlier can be known to be stale */
+    uint64_t GetKeyStoreGeneration() const { return nKeyStoreGeneration; }
+    /** Changes whenever IsMine or IsChange of an output may have changed, so
+     * that CWalletTx::GetCachedAmounts can tell its cache is stale */
+    uint64_t GetAmountsGeneration() const { return nKeyStoreGeneration + nAddressBookGeneration; }
     bool IsScanning() { return fScanningWallet; }
+    //! How long the running rescan has taken so far, in milliseconds
+    int64_t ScanningDuration() const { return fScanningWallet ? GetTimeMillis() - nScanningStartTime : 0; }
+    double ScanningProgress() const { return fScanningWallet ? (double)dScanningProgress : 0; }
+    //! Number of rescans waiting for the running one to finish
+    size_t GetQueuedRescans();
 
     /**
      * keystore implementation
@@ -949,9 +1099,16 @@ public:
     void BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex *pindex, const std::vector<CTransactionRef>& vtxConflicted) override;
     void BlockDisconnected(const std::shared_ptr<const CBlock>& pblock) override;
     bool AddToWalletIfInvolvingMe(const CTransactionRef& tx, const CBlockIndex* pIndex, int posInBlock, bool fUpdate);
+    /** Whether a transaction is in the wallet, or spends an output of a
+     * wallet transaction or an outpoint a wallet transaction spends. With an
+     * output matching IsMine, these are the transactions that
+     * AddToWalletIfInvolvingMe may act on. */
+    bool IsConnectedToWallet(const CTransaction& tx) const;
     int64_t RescanFromTime(int64_t startTime, const WalletRescanReserver& reserver, bool update);
+    int64_t RescanFromTimeQueued(int64_t startTime, bool update);
     CBlockIndex* ScanForWalletTransactions(CBlockIndex* pindexStart, CBlockIndex* pindexStop, const WalletRescanReserver& reserver, bool fUpdate = false);
     void TransactionRemovedFromMempool(const CTransactionRef &ptx) override;
+    void MempoolUpdated(const std::vector<MempoolUpdate>& updates) override;
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman) override;
     // ResendWalletTransactionsBefore may only be called if fBroadcastTransactions!
@@ -988,6 +1145,8 @@ public:
     bool AddAccountingEntry(const CAccountingEntry&, CWalletDB *pwalletdb);
     template <typename ContainerType>
     bool DummySignTx(CMutableTransaction &txNew, const ContainerType &coins) const;
+    /** Virtual size of an input spending txout with a maximum size signature, or -1 if we can't sign for it */
+    int CalculateMaximumSignedInputSize(const CTxOut& txout) const;
 
     static CFeeRate minTxFee;
     static CFeeRate fallbackFee;
@@ -996,6 +1155,13 @@ public:
     bool NewKeyPool();
     size_t KeypoolCountExternalKeys();
     bool TopUpKeyPool(unsigned int kpSize = 0);
+    /**
+     * Top up the keypool after keys were taken from it. With
+     * -keypoolbackground, only a key of each kind is added at once, if there
+     * is none left, and the rest in chunks on the scheduler; otherwise the
+     * keypool is topped up at once. Returns false if the wallet is locked.
+     */
+    bool RefillKeyPool();
     void ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool, bool fRequestedInternal);
     void KeepKey(int64_t nIndex);
     void ReturnKey(int64_t nIndex, bool fInternal, const CPubKey& pubkey);
@@ -1290,8 +1456,40 @@ public:
         std::lock_guard<std::mutex> lock(m_wallet->mutexScanning);
         if (m_could_reserve) {
             m_wallet->fScanningWallet = false;
+            m_wallet->condScanning.notify_all();
         }
     }
 };
 
+/**
+ * RAII object that batches a wallet's database writes for a bulk operation,
+ * like a keypool refill or an import. While it exists, the wallet writes
+ * through one handle, committing every DEFAULT_WALLET_BATCH_WRITES writes
+ * rather than each by itself (see CDB::BatchBegin). A batch started inside
+ * another one joins it.
+ *
+ * Hold cs_wallet for the lifetime of the batch, and don't write the wallet's
+ * transactions (AddToWallet, as a rescan does) in the meantime.
+ */
+class WalletBatchWriter
+{
+private:
+    CWallet& m_wallet;
+    //! The handle, unless the batch joined another one
+    std::unique_ptr<CWalletDB> m_walletdb;
+    //! Whether the handle writes in batches; it can't on a dummy database
+    bool m_fBatch;
+public:
+    explicit WalletBatchWriter(CWallet& wallet);
+    ~WalletBatchWriter();
+
+    WalletBatchWriter(const WalletBatchWriter&) = delete;
+    WalletBatchWriter& operator=(const WalletBatchWriter&) = delete;
+
+    /** The handle the batch writes through */
+    CWalletDB& GetDB() { return *m_wallet.pwalletdbBatch; }
+    /** Commit what the batch wrote and end it; for a joined batch the outer one commits */
+    bool Commit();
+};
+
 #endif // BITCOIN_WALLET_WALLET_H
@@ -12,10 +12,12 @@
 #include <protocol.h>
 #include <serialize.h>
 #include <sync.h>
+#include <taskpool.h>
 #include <util.h>
 #include <utiltime.h>
 #include <wallet/wallet.h>
 
+#include <algorithm>
 #include <atomic>
 
 #include <boost/thread.hpp>
@@ -182,7 +184,7 @@ void CWalletDB::ListAccountCreditDebit(const std::string& strAccount, std::list<
 {
     bool fAllAccounts = (strAccount == "*");
 
-    Dbc* pcursor = batch.GetCursor();
+    std::unique_ptr<CDBCursor> pcursor = batch.GetCursor();
     if (!pcursor)
         throw std::runtime_error(std::string(__func__) + ": cannot create DB cursor");
     bool setRange = true;
@@ -193,15 +195,12 @@ void CWalletDB::ListAccountCreditDebit(const std::string& strAccount, std::list<
         if (setRange)
             ssKey << std::make_pair(std::string("acentry"), std::make_pair((fAllAccounts ? std::string("") : strAccount), uint64_t(0)));
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        int ret = batch.ReadAtCursor(pcursor, ssKey, ssValue, setRange);
+        int ret = batch.ReadAtCursor(pcursor.get(), ssKey, ssValue, setRange);
         setRange = false;
         if (ret == DB_NOTFOUND)
             break;
         else if (ret != 0)
-        {
-            pcursor->close();
             throw std::runtime_error(std::string(__func__) + ": error scanning DB");
-        }
 
         // Unserialize
         std::string strType;
@@ -217,10 +216,26 @@ void CWalletDB::ListAccountCreditDebit(const std::string& strAccount, std::list<
         ssKey >> acentry.nEntryNo;
         entries.push_back(acentry);
     }
-
-    pcursor->close();
 }
 
+/** A "key", "wkey" or "tx" record, read and decoded separately, see CWalletDB::LoadWallet */
+class CWalletDeferredRecord {
+public:
+    std::string strType;
+    CDataStream ssKey;
+    CDataStream ssValue;
+
+    bool fValid;
+    std::string strErr;
+    CPubKey vchPubKey;
+    CKey key;
+    CWalletTx wtx;
+    bool fUpgraded;
+
+    CWalletDeferredRecord(const std::string& strTypeIn, CDataStream&& ssKeyIn, CDataStream&& ssValueIn) :
+        strType(strTypeIn), ssKey(std::move(ssKeyIn)), ssValue(std::move(ssValueIn)), fValid(false), fUpgraded(false) {}
+};
+
 class CWalletScanState {
 public:
     unsigned int nKeys;
@@ -231,15 +246,138 @@ public:
     bool fAnyUnordered;
     int nFileVersion;
     std::vector<uint256> vWalletUpgrade;
+    //! Leave key and transaction records in vDeferred, rather than decoding them as they are read
+    bool fDeferRecords;
+    std::vector<CWalletDeferredRecord> vDeferred;
 
     CWalletScanState() {
         nKeys = nCKeys = nWatchKeys = nKeyMeta = 0;
         fIsEncrypted = false;
         fAnyUnordered = false;
         nFileVersion = 0;
+        fDeferRecords = false;
     }
 };
 
+/**
+ * Decode and check a "tx" record. This doesn't touch the wallet, so records
+ * can be decoded on several threads; fUpgraded is set for records of 0.3.16
+ * to 0.3.17 that were repaired and need writing back.
+ */
+static bool ReadTxRecord(CDataStream& ssKey, CDataStream& ssValue, CWalletTx& wtx, bool& fUpgraded, std::string& strErr)
+{
+    fUpgraded = false;
+    try {
+        uint256 hash;
+        ssKey >> hash;
+        ssValue >> wtx;
+        CValidationState state;
+        if (!(CheckTransaction(*wtx.tx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+            return false;
+
+        // Undo serialize changes in 31600
+        if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+        {
+            if (!ssValue.empty())
+            {
+                char fTmp;
+                char fUnused;
+                ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+                strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                                   wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+                wtx.fTimeReceivedIsTxTime = fTmp;
+            }
+            else
+            {
+                strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+                wtx.fTimeReceivedIsTxTime = 0;
+            }
+            fUpgraded = true;
+        }
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
+static void LoadTxRecord(CWallet* pwallet, const CWalletTx& wtx, bool fUpgraded, CWalletScanState& wss)
+{
+    if (fUpgraded)
+        wss.vWalletUpgrade.push_back(wtx.GetHash());
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->LoadToWallet(wtx);
+}
+
+/**
+ * Decode and check a "key" or "wkey" record, which for keys stored without
+ * a checksum takes deriving the public key. This doesn't touch the wallet,
+ * so records can be checked on several threads.
+ */
+static bool ReadKeyRecord(const std::string& strType, CDataStream& ssKey, CDataStream& ssValue, CPubKey& vchPubKey, CKey& key, std::string& strErr)
+{
+    try {
+        ssKey >> vchPubKey;
+        if (!vchPubKey.IsValid())
+        {
+            strErr = "Error reading wallet database: CPubKey corrupt";
+            return false;
+        }
+        CPrivKey pkey;
+        uint256 hash;
+
+        if (strType == "key")
+        {
+            ssValue >> pkey;
+        } else {
+            CWalletKey wkey;
+            ssValue >> wkey;
+            pkey = wkey.vchPrivKey;
+        }
+
+        // Old wallets store keys as "key" [pubkey] => [privkey]
+        // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
+        // using EC operations as a checksum.
+        // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
+        // remaining backwards-compatible.
+        try
+        {
+            ssValue >> hash;
+        }
+        catch (...) {}
+
+        bool fSkipCheck = false;
+
+        if (!hash.IsNull())
+        {
+            // hash pubkey/privkey to accelerate wallet load
+            std::vector<unsigned char> vchKey;
+            vchKey.reserve(vchPubKey.size() + pkey.size());
+            vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
+            vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
+
+            if (Hash(vchKey.begin(), vchKey.end()) != hash)
+            {
+                strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
+                return false;
+            }
+
+            fSkipCheck = true;
+        }
+
+        if (!key.Load(pkey, vchPubKey, fSkipCheck))
+        {
+            strErr = "Error reading wallet database: CPrivKey corrupt";
+            return false;
+        }
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, std::string& strType, std::string& strErr)
@@ -263,38 +401,15 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         }
         else if (strType == "tx")
         {
-            uint256 hash;
-            ssKey >> hash;
+            if (wss.fDeferRecords) {
+                wss.vDeferred.emplace_back(strType, std::move(ssKey), std::move(ssValue));
+                return true;
+            }
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            if (!(CheckTransaction(*wtx.tx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+            bool fUpgraded;
+            if (!ReadTxRecord(ssKey, ssValue, wtx, fUpgraded, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->LoadToWallet(wtx);
+            LoadTxRecord(pwallet, wtx, fUpgraded, wss);
         }
         else if (strType == "acentry")
         {
@@ -326,62 +441,16 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         }
         else if (strType == "key" || strType == "wkey")
         {
-            CPubKey vchPubKey;
-            ssKey >> vchPubKey;
-            if (!vchPubKey.IsValid())
-            {
-                strErr = "Error reading wallet database: CPubKey corrupt";
-                return false;
-            }
-            CKey key;
-            CPrivKey pkey;
-            uint256 hash;
-
             if (strType == "key")
-            {
                 wss.nKeys++;
-                ssValue >> pkey;
-            } else {
-                CWalletKey wkey;
-                ssValue >> wkey;
-                pkey = wkey.vchPrivKey;
-            }
-
-            // Old wallets store keys as "key" [pubkey] => [privkey]
-            // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
-            // using EC operations as a checksum.
-            // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
-            // remaining backwards-compatible.
-            try
-            {
-                ssValue >> hash;
-            }
-            catch (...) {}
-
-            bool fSkipCheck = false;
-
-            if (!hash.IsNull())
-            {
-                // hash pubkey/privkey to accelerate wallet load
-                std::vector<unsigned char> vchKey;
-                vchKey.reserve(vchPubKey.size() + pkey.size());
-                vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
-                vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
-
-                if (Hash(vchKey.begin(), vchKey.end()) != hash)
-                {
-                    strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
-                    return false;
-                }
-
-                fSkipCheck = true;
+            if (wss.fDeferRecords) {
+                wss.vDeferred.emplace_back(strType, std::move(ssKey), std::move(ssValue));
+                return true;
             }
-
-            if (!key.Load(pkey, vchPubKey, fSkipCheck))
-            {
-                strErr = "Error reading wallet database: CPrivKey corrupt";
+            CPubKey vchPubKey;
+            CKey key;
+            if (!ReadKeyRecord(strType, ssKey, ssValue, vchPubKey, key, strErr))
                 return false;
-            }
             if (!pwallet->LoadKey(key, vchPubKey))
             {
                 strErr = "Error reading wallet database: LoadKey failed";
@@ -512,6 +581,27 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
     return true;
 }
 
+/** Decode deferred key and transaction records on up to MAX_WALLET_LOAD_THREADS threads, returning how many were used */
+static unsigned int ReadDeferredRecords(std::vector<CWalletDeferredRecord>& vRecords)
+{
+    unsigned int nThreads = std::min<unsigned int>(std::max(GetNumCores(), 1), MAX_WALLET_LOAD_THREADS);
+    nThreads = std::min<size_t>(nThreads, vRecords.size() / MIN_RECORDS_PER_WALLET_LOAD_THREAD + 1);
+
+    // Records are handed out one at a time; the Read*Record functions don't throw
+    std::atomic<size_t> nNext(0);
+    auto worker = [&]() {
+        for (size_t i = nNext++; i < vRecords.size(); i = nNext++) {
+            CWalletDeferredRecord& rec = vRecords[i];
+            if (rec.strType == "tx")
+                rec.fValid = ReadTxRecord(rec.ssKey, rec.ssValue, rec.wtx, rec.fUpgraded, rec.strErr);
+            else
+                rec.fValid = ReadKeyRecord(rec.strType, rec.ssKey, rec.ssValue, rec.vchPubKey, rec.key, rec.strErr);
+        }
+    };
+
+    return ParallelRun(g_task_pool, TASK_PRIORITY_NORMAL, nThreads, worker);
+}
+
 bool CWalletDB::IsKeyType(const std::string& strType)
 {
     return (strType== "key" || strType == "wkey" ||
@@ -524,6 +614,48 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     bool fNoncriticalErrors = false;
     DBErrors result = DB_LOAD_OK;
 
+    auto record_failed = [&](const std::string& strType) {
+        // losing keys is considered a catastrophic error, anything else
+        // we assume the user can live with:
+        if (IsKeyType(strType) || strType == "defaultkey")
+            result = DB_CORRUPT;
+        else
+        {
+            // Leave other errors alone, if we try to fix them we might make things worse.
+            fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
+            if (strType == "tx")
+                // Rescan if there is a bad transaction record:
+                gArgs.SoftSetBoolArg("-rescan", true);
+        }
+    };
+
+    // Keys, which may take an EC operation each to check, and transactions
+    // are decoded in batches on several threads, then loaded in order
+    int64_t nLoadStart = GetTimeMillis();
+    int64_t nDecodeTime = 0;
+    size_t nDecoded = 0;
+    unsigned int nDecodeThreads = 1;
+    wss.fDeferRecords = true;
+    auto load_deferred = [&]() {
+        int64_t nDecodeStart = GetTimeMillis();
+        nDecodeThreads = std::max(nDecodeThreads, ReadDeferredRecords(wss.vDeferred));
+        nDecodeTime += GetTimeMillis() - nDecodeStart;
+        for (CWalletDeferredRecord& rec : wss.vDeferred) {
+            if (rec.fValid && rec.strType == "tx") {
+                LoadTxRecord(pwallet, rec.wtx, rec.fUpgraded, wss);
+            } else if (rec.fValid && !pwallet->LoadKey(rec.key, rec.vchPubKey)) {
+                rec.strErr = "Error reading wallet database: LoadKey failed";
+                rec.fValid = false;
+            }
+            if (!rec.fValid)
+                record_failed(rec.strType);
+            if (!rec.strErr.empty())
+                LogPrintf("%s\n", rec.strErr);
+        }
+        nDecoded += wss.vDeferred.size();
+        wss.vDeferred.clear();
+    };
+
     LOCK(pwallet->cs_wallet);
     try {
         int nMinVersion = 0;
@@ -535,7 +667,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         }
 
         // Get cursor
-        Dbc* pcursor = batch.GetCursor();
+        std::unique_ptr<CDBCursor> pcursor = batch.GetCursor();
         if (!pcursor)
         {
             LogPrintf("Error getting wallet database cursor\n");
@@ -547,7 +679,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             // Read next record
             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
             CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            int ret = batch.ReadAtCursor(pcursor, ssKey, ssValue);
+            int ret = batch.ReadAtCursor(pcursor.get(), ssKey, ssValue);
             if (ret == DB_NOTFOUND)
                 break;
             else if (ret != 0)
@@ -559,24 +691,14 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             // Try to be tolerant of single corrupt records:
             std::string strType, strErr;
             if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
-            {
-                // losing keys is considered a catastrophic error, anything else
-                // we assume the user can live with:
-                if (IsKeyType(strType) || strType == "defaultkey")
-                    result = DB_CORRUPT;
-                else
-                {
-                    // Leave other errors alone, if we try to fix them we might make things worse.
-                    fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
-                    if (strType == "tx")
-                        // Rescan if there is a bad transaction record:
-                        gArgs.SoftSetBoolArg("-rescan", true);
-                }
-            }
+                record_failed(strType);
             if (!strErr.empty())
                 LogPrintf("%s\n", strErr);
+            if (wss.vDeferred.size() >= WALLET_LOAD_DEFERRED_RECORDS)
+                load_deferred();
         }
-        pcursor->close();
+        pcursor.reset();
+        load_deferred();
     }
     catch (const boost::thread_interrupted&) {
         throw;
@@ -597,6 +719,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 
     LogPrintf("Keys: %u plaintext, %u encrypted, %u w/ metadata, %u total\n",
            wss.nKeys, wss.nCKeys, wss.nKeyMeta, wss.nKeys + wss.nCKeys);
+    int64_t nReadTime = GetTimeMillis() - nLoadStart;
 
     // nTimeFirstKey is only reliable if all keys have metadata
     if ((wss.nKeys + wss.nCKeys + wss.nWatchKeys) != wss.nKeyMeta)
@@ -612,6 +735,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     if (wss.nFileVersion < CLIENT_VERSION) // Update
         WriteVersion(CLIENT_VERSION);
 
+    int64_t nReorderStart = GetTimeMillis();
     if (wss.fAnyUnordered)
         result = pwallet->ReorderTransactions();
 
@@ -621,6 +745,9 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         pwallet->wtxOrdered.insert(make_pair(entry.nOrderPos, CWallet::TxPair(nullptr, &entry)));
     }
 
+    LogPrintf("Wallet records read in %dms, of which %u keys and transactions decoded in %dms on %u threads; transactions ordered in %dms\n",
+              nReadTime, nDecoded, nDecodeTime, nDecodeThreads, GetTimeMillis() - nReorderStart);
+
     return result;
 }
 
@@ -637,7 +764,7 @@ DBErrors CWalletDB::FindWalletTx(std::vector<uint256>& vTxHash, std::vector<CWal
         }
 
         // Get cursor
-        Dbc* pcursor = batch.GetCursor();
+        std::unique_ptr<CDBCursor> pcursor = batch.GetCursor();
         if (!pcursor)
         {
             LogPrintf("Error getting wallet database cursor\n");
@@ -649,7 +776,7 @@ DBErrors CWalletDB::FindWalletTx(std::vector<uint256>& vTxHash, std::vector<CWal
             // Read next record
             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
             CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            int ret = batch.ReadAtCursor(pcursor, ssKey, ssValue);
+            int ret = batch.ReadAtCursor(pcursor.get(), ssKey, ssValue);
             if (ret == DB_NOTFOUND)
                 break;
             else if (ret != 0)
@@ -671,7 +798,7 @@ DBErrors CWalletDB::FindWalletTx(std::vector<uint256>& vTxHash, std::vector<CWal
                 vWtx.push_back(wtx);
             }
         }
-        pcursor->close();
+        pcursor.reset();
     }
     catch (const boost::thread_interrupted&) {
         throw;
@@ -847,6 +974,16 @@ bool CWalletDB::TxnAbort()
     return batch.TxnAbort();
 }
 
+bool CWalletDB::BatchBegin()
+{
+    return batch.BatchBegin();
+}
+
+bool CWalletDB::BatchCommit()
+{
+    return batch.BatchCommit();
+}
+
 bool CWalletDB::ReadVersion(int& nVersion)
 {
     return batch.ReadVersion(nVersion);
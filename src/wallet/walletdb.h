@@ -33,6 +33,12 @@
  */
 
 static const bool DEFAULT_FLUSHWALLET = true;
+//! Key and transaction records decoded at a time while loading a wallet
+static const size_t WALLET_LOAD_DEFERRED_RECORDS = 10000;
+//! Most threads those records are decoded on
+static const unsigned int MAX_WALLET_LOAD_THREADS = 8;
+//! Fewest records worth a thread of their own
+static const unsigned int MIN_RECORDS_PER_WALLET_LOAD_THREAD = 250;
 
 class CAccount;
 class CAccountingEntry;
@@ -239,6 +245,10 @@ public:
     bool TxnCommit();
     //! Abort current transaction
     bool TxnAbort();
+    //! Group the following writes into transactions, see CDB::BatchBegin
+    bool BatchBegin();
+    //! Commit the writes of the current batch and end it
+    bool BatchCommit();
     //! Read wallet version
     bool ReadVersion(int& nVersion);
     //! Write wallet version
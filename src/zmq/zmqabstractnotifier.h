@@ -7,15 +7,24 @@
 
 #include <zmq/zmqconfig.h>
 
+#include <atomic>
+#include <memory>
+
+class CBlock;
 class CBlockIndex;
 class CZMQAbstractNotifier;
+class CZMQPublisher;
 
 typedef CZMQAbstractNotifier* (*CZMQNotifierFactory)();
 
+/** Default for -zmqpub<type>hwm, the high water mark of outbound messages */
+static const int DEFAULT_ZMQ_SNDHWM = 1000;
+
 class CZMQAbstractNotifier
 {
 public:
-    CZMQAbstractNotifier() : psocket(nullptr) { }
+    CZMQAbstractNotifier() : psocket(nullptr), nHighWaterMark(DEFAULT_ZMQ_SNDHWM), publisher(nullptr),
+                             nSequence(0), nPublished(0), nDropped(0), nQueued(0) { }
     virtual ~CZMQAbstractNotifier();
 
     template <typename T>
@@ -28,17 +37,45 @@ public:
     void SetType(const std::string &t) { type = t; }
     std::string GetAddress() const { return address; }
     void SetAddress(const std::string &a) { address = a; }
+    int GetHighWaterMark() const { return nHighWaterMark; }
+    void SetHighWaterMark(int n) { nHighWaterMark = n; }
+    void SetPublisher(CZMQPublisher* p) { publisher = p; }
+
+    //! Sequence number of the next message
+    uint32_t GetSequence() const { return nSequence; }
+    //! Messages sent on the socket
+    uint64_t GetPublished() const { return nPublished; }
+    //! Messages dropped because the queue was full or they could not be sent
+    uint64_t GetDropped() const { return nDropped; }
+    //! Messages waiting to be sent
+    uint64_t GetQueued() const { return nQueued; }
 
     virtual bool Initialize(void *pcontext) = 0;
     virtual void Shutdown() = 0;
 
-    virtual bool NotifyBlock(const CBlockIndex *pindex);
+    //! Notify of a new chain tip; pblock is the block itself if it is at hand, or null
+    virtual bool NotifyBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock);
+    //! Notify of a transaction added to the mempool or in a connected or disconnected block
     virtual bool NotifyTransaction(const CTransaction &transaction);
+    //! Notify of a block connected to or disconnected from the active chain
+    virtual bool NotifyBlockConnect(const uint256 &hash);
+    virtual bool NotifyBlockDisconnect(const uint256 &hash);
+    //! Notify of a transaction added to the mempool, or removed other than for a block
+    virtual bool NotifyTransactionAcceptance(const CTransaction &transaction);
+    virtual bool NotifyTransactionRemoval(const CTransaction &transaction);
 
 protected:
     void *psocket;
     std::string type;
     std::string address;
+    int nHighWaterMark;
+    //! Sends the messages, on a thread of its own
+    CZMQPublisher* publisher;
+
+    std::atomic<uint32_t> nSequence;
+    std::atomic<uint64_t> nPublished;
+    std::atomic<uint64_t> nDropped;
+    std::atomic<uint64_t> nQueued;
 };
 
 #endif // BITCOIN_ZMQ_ZMQABSTRACTNOTIFIER_H
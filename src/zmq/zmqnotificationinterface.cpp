@@ -10,6 +10,8 @@
 #include <streams.h>
 #include <util.h>
 
+CZMQNotificationInterface* g_zmq_notification_interface = nullptr;
+
 void zmqError(const char *str)
 {
     LogPrint(BCLog::ZMQ, "zmq: Error: %s, errno=%s\n", str, zmq_strerror(errno));
@@ -39,6 +41,7 @@ CZMQNotificationInterface* CZMQNotificationInterface::Create()
     factories["pubhashtx"] = CZMQAbstractNotifier::Create<CZMQPublishHashTransactionNotifier>;
     factories["pubrawblock"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
+    factories["pubsequence"] = CZMQAbstractNotifier::Create<CZMQPublishSequenceNotifier>;
 
     for (const auto& entry : factories)
     {
@@ -50,6 +53,7 @@ CZMQNotificationInterface* CZMQNotificationInterface::Create()
             CZMQAbstractNotifier *notifier = factory();
             notifier->SetType(entry.first);
             notifier->SetAddress(address);
+            notifier->SetHighWaterMark(gArgs.GetArg(arg + "hwm", DEFAULT_ZMQ_SNDHWM));
             notifiers.push_back(notifier);
         }
     }
@@ -58,6 +62,8 @@ CZMQNotificationInterface* CZMQNotificationInterface::Create()
     {
         notificationInterface = new CZMQNotificationInterface();
         notificationInterface->notifiers = notifiers;
+        for (CZMQAbstractNotifier* notifier : notifiers)
+            notifier->SetPublisher(&notificationInterface->publisher);
 
         if (!notificationInterface->Initialize())
         {
@@ -103,6 +109,7 @@ bool CZMQNotificationInterface::Initialize()
         return false;
     }
 
+    publisher.Start(std::max<int64_t>(gArgs.GetArg("-zmqqueuesize", DEFAULT_ZMQ_QUEUE_SIZE), 1));
     return true;
 }
 
@@ -112,6 +119,8 @@ void CZMQNotificationInterface::Shutdown()
     LogPrint(BCLog::ZMQ, "zmq: Shutdown notification interface\n");
     if (pcontext)
     {
+        // Send what is queued while the sockets are still open
+        publisher.Stop();
         for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
         {
             CZMQAbstractNotifier *notifier = *i;
@@ -124,59 +133,105 @@ void CZMQNotificationInterface::Shutdown()
     }
 }
 
-void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+std::list<const CZMQAbstractNotifier*> CZMQNotificationInterface::GetActiveNotifiers() const
 {
-    if (fInitialDownload || pindexNew == pindexFork) // In IBD or blocks were disconnected without any new ones
-        return;
+    std::lock_guard<std::mutex> lock(cs);
+    return std::list<const CZMQAbstractNotifier*>(notifiers.begin(), notifiers.end());
+}
 
+template <typename Function>
+void CZMQNotificationInterface::TryForEachAndRemoveFailed(const Function& func)
+{
     for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
     {
         CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(pindexNew))
+        if (func(notifier))
         {
             i++;
         }
         else
         {
+            // The publisher thread may still be sending on the socket
+            publisher.Sync();
             notifier->Shutdown();
+            std::lock_guard<std::mutex> lock(cs);
             i = notifiers.erase(i);
         }
     }
 }
 
+void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    // BlockConnected was called for the new tip before, on the same thread
+    std::shared_ptr<const CBlock> pblock;
+    if (pblockConnected && pblockConnected->GetHash() == pindexNew->GetBlockHash())
+        pblock = pblockConnected;
+    pblockConnected.reset();
+
+    if (fInitialDownload || pindexNew == pindexFork) // In IBD or blocks were disconnected without any new ones
+        return;
+
+    TryForEachAndRemoveFailed([pindexNew, &pblock](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyBlock(pindexNew, pblock);
+    });
+}
+
 void CZMQNotificationInterface::TransactionAddedToMempool(const CTransactionRef& ptx)
 {
-    // Used by BlockConnected and BlockDisconnected as well, because they're
-    // all the same external callback.
     const CTransaction& tx = *ptx;
 
-    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
-    {
-        CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransaction(tx))
-        {
-            i++;
-        }
-        else
-        {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
-        }
-    }
+    TryForEachAndRemoveFailed([&tx](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyTransaction(tx) && notifier->NotifyTransactionAcceptance(tx);
+    });
+}
+
+void CZMQNotificationInterface::TransactionRemovedFromMempool(const CTransactionRef& ptx)
+{
+    // Called for all removals other than for a block; transactions
+    // conflicting with a block are notified by BlockConnected
+    const CTransaction& tx = *ptx;
+
+    TryForEachAndRemoveFailed([&tx](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyTransactionRemoval(tx);
+    });
 }
 
 void CZMQNotificationInterface::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindexConnected, const std::vector<CTransactionRef>& vtxConflicted)
 {
+    for (const CTransactionRef& ptx : vtxConflicted) {
+        const CTransaction& tx = *ptx;
+        TryForEachAndRemoveFailed([&tx](CZMQAbstractNotifier* notifier) {
+            return notifier->NotifyTransactionRemoval(tx);
+        });
+    }
+
     for (const CTransactionRef& ptx : pblock->vtx) {
         // Do a normal notify for each transaction added in the block
-        TransactionAddedToMempool(ptx);
+        const CTransaction& tx = *ptx;
+        TryForEachAndRemoveFailed([&tx](CZMQAbstractNotifier* notifier) {
+            return notifier->NotifyTransaction(tx);
+        });
     }
+
+    const uint256 hash = pindexConnected->GetBlockHash();
+    TryForEachAndRemoveFailed([&hash](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyBlockConnect(hash);
+    });
+    pblockConnected = pblock;
 }
 
 void CZMQNotificationInterface::BlockDisconnected(const std::shared_ptr<const CBlock>& pblock)
 {
     for (const CTransactionRef& ptx : pblock->vtx) {
         // Do a normal notify for each transaction removed in block disconnection
-        TransactionAddedToMempool(ptx);
+        const CTransaction& tx = *ptx;
+        TryForEachAndRemoveFailed([&tx](CZMQAbstractNotifier* notifier) {
+            return notifier->NotifyTransaction(tx);
+        });
     }
+
+    const uint256 hash = pblock->GetHash();
+    TryForEachAndRemoveFailed([&hash](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyBlockDisconnect(hash);
+    });
 }
@@ -6,9 +6,12 @@
 #define BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
 
 #include <validationinterface.h>
+#include <zmq/zmqpublisher.h>
+
 #include <string>
 #include <map>
 #include <list>
+#include <mutex>
 
 class CBlockIndex;
 class CZMQAbstractNotifier;
@@ -20,12 +23,15 @@ public:
 
     static CZMQNotificationInterface* Create();
 
+    std::list<const CZMQAbstractNotifier*> GetActiveNotifiers() const;
+
 protected:
     bool Initialize();
     void Shutdown();
 
     // CValidationInterface
     void TransactionAddedToMempool(const CTransactionRef& tx) override;
+    void TransactionRemovedFromMempool(const CTransactionRef& tx) override;
     void BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindexConnected, const std::vector<CTransactionRef>& vtxConflicted) override;
     void BlockDisconnected(const std::shared_ptr<const CBlock>& pblock) override;
     void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
@@ -33,8 +39,18 @@ protected:
 private:
     CZMQNotificationInterface();
 
+    template <typename Function>
+    void TryForEachAndRemoveFailed(const Function& func);
+
     void *pcontext;
+    CZMQPublisher publisher;
+    //! Only the validation interface thread changes the list; cs guards the changes against GetActiveNotifiers
+    mutable std::mutex cs;
     std::list<CZMQAbstractNotifier*> notifiers;
+    //! The block connected last, for the rawblock of the UpdatedBlockTip that follows
+    std::shared_ptr<const CBlock> pblockConnected;
 };
 
+extern CZMQNotificationInterface* g_zmq_notification_interface;
+
 #endif // BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
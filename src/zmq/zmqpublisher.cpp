@@ -0,0 +1,84 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <zmq/zmqpublisher.h>
+
+#include <util.h>
+#include <zmq/zmqpublishnotifier.h>
+
+CZMQPublisher::CZMQPublisher() : nSending(0), nMaxQueued(0), fRunning(false), fStop(false) {}
+
+CZMQPublisher::~CZMQPublisher()
+{
+    Stop();
+}
+
+void CZMQPublisher::ThreadPublish()
+{
+    RenameThread("bitcoin-zmqpub");
+    std::unique_lock<std::mutex> lock(cs);
+    while (true) {
+        condQueued.wait(lock, [this] { return fStop || !queue.empty(); });
+        if (queue.empty())
+            return;
+
+        std::deque<Message> batch;
+        batch.swap(queue);
+        nSending = batch.size();
+        lock.unlock();
+        for (Message& message : batch)
+            message.notifier->Publish(message);
+        lock.lock();
+
+        nSending = 0;
+        condSent.notify_all();
+    }
+}
+
+void CZMQPublisher::Start(size_t nMaxQueuedIn)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    if (fRunning)
+        return;
+    nMaxQueued = nMaxQueuedIn;
+    fRunning = true;
+    fStop = false;
+    thread = std::thread(&CZMQPublisher::ThreadPublish, this);
+}
+
+void CZMQPublisher::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (!fRunning)
+            return;
+        fRunning = false;
+        fStop = true;
+    }
+    condQueued.notify_all();
+    condSent.notify_all();
+    thread.join();
+}
+
+bool CZMQPublisher::Push(Message&& message)
+{
+    std::unique_lock<std::mutex> lock(cs);
+    if (!fRunning) {
+        lock.unlock();
+        message.notifier->Publish(message);
+        return true;
+    }
+    // The batch being sent counts too, so that the limit bounds the memory used
+    if (queue.size() + nSending >= nMaxQueued)
+        return false;
+    queue.push_back(std::move(message));
+    condQueued.notify_one();
+    return true;
+}
+
+void CZMQPublisher::Sync()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    condSent.wait(lock, [this] { return !fRunning || (queue.empty() && nSending == 0); });
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ZMQ_ZMQPUBLISHER_H
+#define BITCOIN_ZMQ_ZMQPUBLISHER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+
+class CZMQAbstractPublishNotifier;
+
+/** Default for -zmqqueuesize, the most messages waiting to be published */
+static const int DEFAULT_ZMQ_QUEUE_SIZE = 10000;
+
+/**
+ * Sends the messages of the publish notifiers on a thread of its own, so
+ * that the validation interface callbacks only queue them.
+ *
+ * Messages are sent in the order they are queued. The thread takes all the
+ * queued messages at once and sends them as a batch, so that queueing does
+ * not wait for the sockets. When the queue is full new messages are dropped,
+ * and counted by their notifier; as they were given a sequence number,
+ * subscribers see the gap.
+ *
+ * When the thread is not running, messages are sent on the calling thread.
+ */
+class CZMQPublisher
+{
+public:
+    /** Fills in the body of a message on the publisher thread. Returns false if it cannot. */
+    typedef std::function<bool(std::string& body)> BodyFn;
+
+    struct Message {
+        CZMQAbstractPublishNotifier* notifier;
+        const char* command;
+        std::string body;
+        //! If set, called just before sending to fill in body
+        BodyFn fill;
+        uint32_t nSequence;
+    };
+
+private:
+    mutable std::mutex cs;
+    //! Signalled when messages are queued or the thread is asked to stop
+    std::condition_variable condQueued;
+    //! Signalled when a batch has been sent
+    std::condition_variable condSent;
+    std::deque<Message> queue;
+    //! Messages taken from the queue and not sent yet
+    size_t nSending;
+    size_t nMaxQueued;
+    bool fRunning;
+    bool fStop;
+    std::thread thread;
+
+    void ThreadPublish();
+
+public:
+    CZMQPublisher();
+    ~CZMQPublisher();
+    CZMQPublisher(const CZMQPublisher&) = delete;
+    CZMQPublisher& operator=(const CZMQPublisher&) = delete;
+
+    /** Start the publisher thread, queueing up to nMaxQueuedIn messages */
+    void Start(size_t nMaxQueuedIn);
+    /** Send out the queue and stop the thread */
+    void Stop();
+
+    /** Queue message. Returns false, dropping it, if the queue is full. */
+    bool Push(Message&& message);
+    /** Wait until all messages queued so far have been sent */
+    void Sync();
+};
+
+#endif // BITCOIN_ZMQ_ZMQPUBLISHER_H
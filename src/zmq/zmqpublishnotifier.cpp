@@ -10,12 +10,15 @@
 #include <util.h>
 #include <rpc/server.h>
 
+#include <mutex>
+
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
 
 static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
+static const char *MSG_SEQUENCE  = "sequence";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -76,7 +79,17 @@ bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
             return false;
         }
 
-        int rc = zmq_bind(psocket, address.c_str());
+        LogPrint(BCLog::ZMQ, "zmq: Outbound message high water mark for %s at %s is %d\n", type, address, nHighWaterMark);
+
+        int rc = zmq_setsockopt(psocket, ZMQ_SNDHWM, &nHighWaterMark, sizeof(nHighWaterMark));
+        if (rc != 0)
+        {
+            zmqError("Failed to set outbound message high water mark");
+            zmq_close(psocket);
+            return false;
+        }
+
+        rc = zmq_bind(psocket, address.c_str());
         if (rc!=0)
         {
             zmqError("Failed to bind address");
@@ -129,31 +142,62 @@ void CZMQAbstractPublishNotifier::Shutdown()
     psocket = nullptr;
 }
 
-bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* data, size_t size)
+void CZMQAbstractPublishNotifier::Queue(CZMQPublisher::Message&& message)
 {
-    assert(psocket);
+    assert(psocket && publisher);
+
+    /* the sequence number is taken even if the message is dropped, so that subscribers see the gap */
+    message.nSequence = nSequence++;
+    nQueued++;
+    if (!publisher->Push(std::move(message)))
+    {
+        LogPrint(BCLog::ZMQ, "zmq: Queue full, dropped %s message\n", type);
+        nQueued--;
+        nDropped++;
+    }
+}
+
+void CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* data, size_t size)
+{
+    const char* begin = static_cast<const char*>(data);
+    Queue(CZMQPublisher::Message{this, command, std::string(begin, begin + size), nullptr, 0});
+}
+
+void CZMQAbstractPublishNotifier::SendMessage(const char *command, CZMQPublisher::BodyFn fill)
+{
+    Queue(CZMQPublisher::Message{this, command, std::string(), std::move(fill), 0});
+}
+
+void CZMQAbstractPublishNotifier::Publish(CZMQPublisher::Message& message)
+{
+    nQueued--;
+    if (message.fill && !message.fill(message.body))
+    {
+        nDropped++;
+        return;
+    }
 
     /* send three parts, command & data & a LE 4byte sequence number */
     unsigned char msgseq[sizeof(uint32_t)];
-    WriteLE32(&msgseq[0], nSequence);
-    int rc = zmq_send_multipart(psocket, command, strlen(command), data, size, msgseq, (size_t)sizeof(uint32_t), nullptr);
+    WriteLE32(&msgseq[0], message.nSequence);
+    int rc = zmq_send_multipart(psocket, message.command, strlen(message.command), message.body.data(), message.body.size(), msgseq, (size_t)sizeof(uint32_t), nullptr);
     if (rc == -1)
-        return false;
-
-    /* increment memory only sequence number after sending */
-    nSequence++;
-
-    return true;
+    {
+        nDropped++;
+        return;
+    }
+    nPublished++;
 }
 
-bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& /*pblock*/)
 {
     uint256 hash = pindex->GetBlockHash();
     LogPrint(BCLog::ZMQ, "zmq: Publish hashblock %s\n", hash.GetHex());
     char data[32];
     for (unsigned int i = 0; i < 32; i++)
         data[31 - i] = hash.begin()[i];
-    return SendMessage(MSG_HASHBLOCK, data, 32);
+    SendMessage(MSG_HASHBLOCK, data, 32);
+    return true;
 }
 
 bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
@@ -163,28 +207,53 @@ bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &t
     char data[32];
     for (unsigned int i = 0; i < 32; i++)
         data[31 - i] = hash.begin()[i];
-    return SendMessage(MSG_HASHTX, data, 32);
+    SendMessage(MSG_HASHTX, data, 32);
+    return true;
 }
 
-bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+/**
+ * Serialize a block for rawblock, or reuse the last one serialized, so that
+ * several rawblock subscribers cost a single serialization. The block is read
+ * from disk only if it is not at hand.
+ */
+static bool GetRawBlock(const CBlockIndex* pindex, const std::shared_ptr<const CBlock>& pblock, std::string& body)
 {
-    LogPrint(BCLog::ZMQ, "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
-
-    const Consensus::Params& consensusParams = Params().GetConsensus();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    {
-        LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex, consensusParams))
-        {
-            zmqError("Can't read block from disk");
-            return false;
+    static std::mutex cs_raw_block;
+    static uint256 hashRawBlock;
+    static std::string strRawBlock;
+
+    std::lock_guard<std::mutex> lock(cs_raw_block);
+    if (strRawBlock.empty() || hashRawBlock != pindex->GetBlockHash()) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+        if (pblock) {
+            ss << *pblock;
+        } else {
+            LOCK(cs_main);
+            CBlock block;
+            if(!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+            {
+                zmqError("Can't read block from disk");
+                return false;
+            }
+
+            ss << block;
         }
-
-        ss << block;
+        hashRawBlock = pindex->GetBlockHash();
+        strRawBlock = ss.str();
     }
+    body = strRawBlock;
+    return true;
+}
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock)
+{
+    LogPrint(BCLog::ZMQ, "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
+
+    // Serializing the block is left to the publisher thread
+    SendMessage(MSG_RAWBLOCK, [pindex, pblock](std::string& body) {
+        return GetRawBlock(pindex, pblock, body);
+    });
+    return true;
 }
 
 bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
@@ -193,5 +262,46 @@ bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &tr
     LogPrint(BCLog::ZMQ, "zmq: Publish rawtx %s\n", hash.GetHex());
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
     ss << transaction;
-    return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
+    SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
+    return true;
+}
+
+// Send the hash, in the same byte order as hashblock and hashtx, followed by a label
+static void SendSequenceMsg(CZMQAbstractPublishNotifier& notifier, const uint256& hash, char label)
+{
+    char data[sizeof(uint256) + 1];
+    for (unsigned int i = 0; i < 32; i++)
+        data[31 - i] = hash.begin()[i];
+    data[32] = label;
+    notifier.SendMessage(MSG_SEQUENCE, data, sizeof(data));
+}
+
+bool CZMQPublishSequenceNotifier::NotifyBlockConnect(const uint256 &hash)
+{
+    LogPrint(BCLog::ZMQ, "zmq: Publish sequence block connect %s\n", hash.GetHex());
+    SendSequenceMsg(*this, hash, 'C');
+    return true;
+}
+
+bool CZMQPublishSequenceNotifier::NotifyBlockDisconnect(const uint256 &hash)
+{
+    LogPrint(BCLog::ZMQ, "zmq: Publish sequence block disconnect %s\n", hash.GetHex());
+    SendSequenceMsg(*this, hash, 'D');
+    return true;
+}
+
+bool CZMQPublishSequenceNotifier::NotifyTransactionAcceptance(const CTransaction &transaction)
+{
+    uint256 hash = transaction.GetHash();
+    LogPrint(BCLog::ZMQ, "zmq: Publish sequence mempool acceptance %s\n", hash.GetHex());
+    SendSequenceMsg(*this, hash, 'A');
+    return true;
+}
+
+bool CZMQPublishSequenceNotifier::NotifyTransactionRemoval(const CTransaction &transaction)
+{
+    uint256 hash = transaction.GetHash();
+    LogPrint(BCLog::ZMQ, "zmq: Publish sequence mempool removal %s\n", hash.GetHex());
+    SendSequenceMsg(*this, hash, 'R');
+    return true;
 }
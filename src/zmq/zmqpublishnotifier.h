@@ -6,23 +6,31 @@
 #define BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
 
 #include <zmq/zmqabstractnotifier.h>
+#include <zmq/zmqpublisher.h>
 
 class CBlockIndex;
 
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
 private:
-    uint32_t nSequence; //!< upcounting per message sequence number
+    void Queue(CZMQPublisher::Message&& message);
 
 public:
 
-    /* send zmq multipart message
+    /* queue zmq multipart message for the publisher
        parts:
           * command
           * data
           * message sequence number
+       The sequence number counts up per message, also for messages dropped
+       because the queue is full. If fill is given, it makes the data on the
+       publisher thread.
     */
-    bool SendMessage(const char *command, const void* data, size_t size);
+    void SendMessage(const char *command, const void* data, size_t size);
+    void SendMessage(const char *command, CZMQPublisher::BodyFn fill);
+
+    /** Send a queued message, on the publisher thread */
+    void Publish(CZMQPublisher::Message& message);
 
     bool Initialize(void *pcontext) override;
     void Shutdown() override;
@@ -31,7 +39,7 @@ public:
 class CZMQPublishHashBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex) override;
+    bool NotifyBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) override;
 };
 
 class CZMQPublishHashTransactionNotifier : public CZMQAbstractPublishNotifier
@@ -43,7 +51,7 @@ public:
 class CZMQPublishRawBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex) override;
+    bool NotifyBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) override;
 };
 
 class CZMQPublishRawTransactionNotifier : public CZMQAbstractPublishNotifier
@@ -52,4 +60,18 @@ public:
     bool NotifyTransaction(const CTransaction &transaction) override;
 };
 
+/** Publishes the hash of each block connected (C) and disconnected (D), and
+ * of each transaction added to (A) and removed from (R) the mempool, in the
+ * order they happen, so that subscribers can follow the chain and mempool
+ * and see from the sequence numbers whether they missed anything.
+ */
+class CZMQPublishSequenceNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyBlockConnect(const uint256 &hash) override;
+    bool NotifyBlockDisconnect(const uint256 &hash) override;
+    bool NotifyTransactionAcceptance(const CTransaction &transaction) override;
+    bool NotifyTransactionRemoval(const CTransaction &transaction) override;
+};
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
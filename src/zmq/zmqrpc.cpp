@@ -0,0 +1,68 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <zmq/zmqrpc.h>
+
+#include <rpc/server.h>
+#include <utilstrencodings.h>
+#include <zmq/zmqabstractnotifier.h>
+#include <zmq/zmqnotificationinterface.h>
+
+#include <univalue.h>
+
+UniValue getzmqnotifications(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getzmqnotifications\n"
+            "\nReturns information about the active ZeroMQ notifications.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"type\": \"pubhashtx\",   (string) Type of notification\n"
+            "    \"address\": \"...\",      (string) Address of the publisher\n"
+            "    \"hwm\": n,              (numeric) Outbound message high water mark\n"
+            "    \"sequence\": n,         (numeric) Sequence number of the next message\n"
+            "    \"published\": n,        (numeric) Messages sent on the socket\n"
+            "    \"dropped\": n,          (numeric) Messages dropped because the queue was full (-zmqqueuesize) or they could not be sent\n"
+            "    \"queued\": n            (numeric) Messages waiting to be sent\n"
+            "  },\n"
+            "  ...\n"
+            "]\n"
+            "\nMessages beyond the high water mark of a subscriber are dropped by ZeroMQ without notice;\n"
+            "subscribers see them as gaps in the sequence numbers.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getzmqnotifications", "")
+            + HelpExampleRpc("getzmqnotifications", "")
+        );
+
+    UniValue result(UniValue::VARR);
+    if (g_zmq_notification_interface != nullptr) {
+        for (const CZMQAbstractNotifier* n : g_zmq_notification_interface->GetActiveNotifiers()) {
+            UniValue obj(UniValue::VOBJ);
+            obj.pushKV("type", n->GetType());
+            obj.pushKV("address", n->GetAddress());
+            obj.pushKV("hwm", n->GetHighWaterMark());
+            obj.pushKV("sequence", (uint64_t)n->GetSequence());
+            obj.pushKV("published", n->GetPublished());
+            obj.pushKV("dropped", n->GetDropped());
+            obj.pushKV("queued", n->GetQueued());
+            result.push_back(obj);
+        }
+    }
+
+    return result;
+}
+
+static const CRPCCommand commands[] =
+{ //  category              name                      actor (function)         argNames
+  //  --------------------- ------------------------  -----------------------  ----------
+    { "zmq",                "getzmqnotifications",    &getzmqnotifications,    {} },
+};
+
+void RegisterZMQRPCCommands(CRPCTable& t)
+{
+    for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
+        t.appendCommand(commands[vcidx].name, &commands[vcidx]);
+}
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the address index, which is built in the background.
+
+- The history of an address is returned a page at a time.
+- Entries of blocks that were reorganized away are removed.
+"""
+from decimal import Decimal
+
+from test_framework.address import script_to_p2sh
+from test_framework.script import CScript, OP_TRUE
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    wait_until,
+)
+
+class AddressIndexTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def history(self, address, **kwargs):
+        """Return all entries of the history of address, fetching them a page at a time"""
+        node = self.nodes[0]
+        page = node.getaddresshistory(address, **kwargs)
+        entries = page['entries']
+        while 'next' in page:
+            page = node.getaddresshistory(address, count=kwargs.get('count', 1000), cursor=page['next'])
+            entries += page['entries']
+        return entries
+
+    def run_test(self):
+        node = self.nodes[0]
+        address = script_to_p2sh(CScript([OP_TRUE]))
+        other = script_to_p2sh(CScript([OP_TRUE, OP_TRUE]))
+        hashes = node.generatetoaddress(120, address)
+        assert_raises_rpc_error(-1, "Index is not enabled, use -addressindex", node.getaddressbalance, address)
+
+        self.log.info("Enable -addressindex on an existing chain")
+        self.restart_node(0, ['-addressindex'])
+        wait_until(lambda: node.getaddressbalance(address)['height'] == 120, timeout=60)
+        balance = node.getaddressbalance(address)
+        assert_equal(balance['outputs'], 120)
+        assert_equal(balance['unspent'], 120)
+        assert_equal(balance['balance'], Decimal('6000'))
+        assert_raises_rpc_error(-5, "Invalid address", node.getaddressbalance, "notanaddress")
+
+        self.log.info("Page through the history")
+        entries = self.history(address, count=7)
+        assert_equal([e['txid'] for e in entries], [node.getblock(h)['tx'][0] for h in hashes])
+        assert_equal(entries[0]['category'], 'receive')
+        assert_equal(entries[0]['vout'], 0)
+        assert_equal(len(self.history(address, from_height=101)), 20)
+        assert_raises_rpc_error(-8, "Invalid cursor", node.getaddresshistory, address, 0, 10, "zz")
+
+        self.log.info("Remove the entries of blocks reorganized away")
+        node.invalidateblock(hashes[110])
+        node.generatetoaddress(15, other)
+        balance = node.getaddressbalance(address)
+        assert_equal(balance['height'], 125)
+        assert_equal(balance['outputs'], 110)
+        assert_equal(len(self.history(address, count=50)), 110)
+        assert_equal(node.getaddressbalance(other)['outputs'], 15)
+
+if __name__ == '__main__':
+    AddressIndexTest().main()
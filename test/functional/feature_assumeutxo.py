@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the dumptxoutset and loadtxoutset RPCs.
+
+- node0 mines a chain and dumps its UTXO set.
+- node1 starts without blocks, learns the headers of node0's chain from a
+  P2P connection that never serves blocks, and loads the snapshot.
+- node1 then syncs the blocks on top of the snapshot from node0, survives a
+  restart, and reports the blocks below the snapshot as unavailable.
+"""
+import os
+
+from test_framework.address import script_to_p2sh
+from test_framework.messages import CBlockHeader, FromHex, msg_headers
+from test_framework.mininode import P2PInterface, network_thread_start
+from test_framework.script import CScript, OP_TRUE
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    connect_nodes,
+    sync_blocks,
+    wait_until,
+)
+
+SNAPSHOT_HEIGHT = 200
+
+class AssumeutxoTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        self.setup_nodes()
+
+    def run_test(self):
+        node0, node1 = self.nodes
+        address = script_to_p2sh(CScript([OP_TRUE]))
+        node0.generatetoaddress(SNAPSHOT_HEIGHT, address)
+
+        self.log.info("Dump the UTXO set of node0")
+        stats = node0.gettxoutsetinfo()
+        dump = node0.dumptxoutset("utxo.dat")
+        assert_equal(dump['coins_written'], stats['txouts'])
+        assert_equal(dump['base_hash'], node0.getbestblockhash())
+        assert_equal(dump['base_height'], SNAPSHOT_HEIGHT)
+        assert_equal(dump['nchaintx'], SNAPSHOT_HEIGHT + 1)
+        assert_equal(dump['hash_serialized_2'], stats['hash_serialized_2'])
+        path = dump['path']
+        assert os.path.isfile(path)
+        assert_raises_rpc_error(-8, "already exists", node0.dumptxoutset, "utxo.dat")
+        assert_raises_rpc_error(-1, "not connected any blocks", node0.loadtxoutset, path, stats['hash_serialized_2'])
+
+        assert_raises_rpc_error(-1, "is not known yet", node1.loadtxoutset, path, stats['hash_serialized_2'])
+
+        self.log.info("Give node1 the headers of node0's chain")
+        headers = msg_headers()
+        for height in range(1, SNAPSHOT_HEIGHT + 1):
+            header_hex = node0.getblockheader(node0.getblockhash(height), False)
+            headers.headers.append(FromHex(CBlockHeader(), header_hex))
+        node1.add_p2p_connection(P2PInterface())
+        network_thread_start()
+        node1.p2p.wait_for_verack()
+        node1.p2p.send_message(headers)
+        wait_until(lambda: node1.getblockchaininfo()['headers'] == SNAPSHOT_HEIGHT, timeout=30)
+        assert_equal(node1.getblockcount(), 0)
+
+        self.log.info("Refuse to load a snapshot without a trusted hash, or with a wrong one")
+        assert_raises_rpc_error(-8, "expected_hash must be given", node1.loadtxoutset, path)
+        assert_raises_rpc_error(-25, "does not match the expected hash", node1.loadtxoutset, path, "00" * 32)
+
+        self.log.info("Load the snapshot into node1")
+        load = node1.loadtxoutset(path, stats['hash_serialized_2'])
+        assert_equal(load['coins_loaded'], stats['txouts'])
+        assert_equal(load['tip_hash'], dump['base_hash'])
+        assert_equal(node1.getblockcount(), SNAPSHOT_HEIGHT)
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_2'], stats['hash_serialized_2'])
+        assert_raises_rpc_error(-1, "pruned data", node1.getblock, node1.getblockhash(SNAPSHOT_HEIGHT // 2))
+        node1.disconnect_p2ps()
+
+        self.log.info("Sync the blocks on top of the snapshot")
+        node0.generatetoaddress(10, address)
+        connect_nodes(node1, 0)
+        sync_blocks(self.nodes)
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_2'], node0.gettxoutsetinfo()['hash_serialized_2'])
+
+        self.log.info("Restart node1 and check the chainstate persisted")
+        self.restart_node(1)
+        assert_equal(node1.getblockcount(), SNAPSHOT_HEIGHT + 10)
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_2'], node0.gettxoutsetinfo()['hash_serialized_2'])
+        self.stop_node(1)
+        self.assert_start_raises_init_error(1, ["-reindex-chainstate"], "cannot be rebuilt with -reindex-chainstate")
+
+if __name__ == '__main__':
+    AssumeutxoTest().main()
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test -blocksdir and reading block files from -coldblocksdir."""
+import os
+import shutil
+
+from test_framework.address import script_to_p2sh
+from test_framework.script import CScript, OP_TRUE
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal
+
+class BlocksdirTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def run_test(self):
+        node = self.nodes[0]
+        address = script_to_p2sh(CScript([OP_TRUE]))
+        blocksdir = os.path.join(self.options.tmpdir, 'blocksdir')
+        colddir = os.path.join(self.options.tmpdir, 'colddir')
+
+        self.log.info("Refuse blocks directories that do not exist")
+        self.stop_node(0)
+        self.assert_start_raises_init_error(0, ['-blocksdir=' + blocksdir], 'Specified blocks directory "{}" does not exist.'.format(blocksdir))
+        self.assert_start_raises_init_error(0, ['-coldblocksdir=' + colddir], 'Specified cold blocks directory "{}" does not exist.'.format(colddir))
+
+        self.log.info("Store the block files in -blocksdir, and the block index in the data directory")
+        os.mkdir(blocksdir)
+        self.start_node(0, ['-blocksdir=' + blocksdir])
+        hashes = node.generatetoaddress(10, address)
+        self.stop_node(0)
+        hot = os.path.join(blocksdir, 'regtest', 'blocks')
+        assert os.path.isfile(os.path.join(hot, 'blk00000.dat'))
+        assert not os.path.isfile(os.path.join(node.datadir, 'regtest', 'blocks', 'blk00000.dat'))
+        assert os.path.isdir(os.path.join(node.datadir, 'regtest', 'blocks', 'index'))
+
+        self.log.info("Refuse the blocks directory as -coldblocksdir")
+        self.assert_start_raises_init_error(0, ['-blocksdir=' + blocksdir, '-coldblocksdir=' + blocksdir], 'Cannot set -coldblocksdir to the blocks directory.')
+
+        self.log.info("Find the block files in -coldblocksdir")
+        os.mkdir(colddir)
+        cold = os.path.join(colddir, 'regtest', 'blocks')
+        os.makedirs(cold)
+        for name in ['blk00000.dat', 'rev00000.dat']:
+            shutil.move(os.path.join(hot, name), os.path.join(cold, name))
+        self.start_node(0, ['-blocksdir=' + blocksdir, '-coldblocksdir=' + colddir])
+        for blockhash in hashes:
+            assert_equal(node.getblock(blockhash)['hash'], blockhash)
+        self.stop_node(0)
+
+        self.log.info("Keep the files in the blocks directory if a move was interrupted")
+        for name in ['blk00000.dat', 'rev00000.dat']:
+            shutil.copy(os.path.join(cold, name), os.path.join(hot, name))
+        self.start_node(0, ['-blocksdir=' + blocksdir, '-coldblocksdir=' + colddir])
+        assert not os.path.isfile(os.path.join(cold, 'blk00000.dat'))
+        assert not os.path.isfile(os.path.join(cold, 'rev00000.dat'))
+        node.generatetoaddress(1, address)
+        for blockhash in hashes:
+            assert_equal(node.getblock(blockhash)['hash'], blockhash)
+
+if __name__ == '__main__':
+    BlocksdirTest().main()
@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the UTXO set statistics maintained with -coinstats.
+
+- node0 maintains the statistics from genesis while blocks are connected
+  and disconnected, and node1 computes them from scratch on startup.
+- Both report the same MuHash, which survives a restart.
+- gettxoutsetinfo "none" reports the same totals as the default hash_type.
+"""
+from test_framework.address import script_to_p2sh
+from test_framework.messages import COIN, COutPoint, CTransaction, CTxIn, CTxOut
+from test_framework.script import CScript, OP_EQUAL, OP_HASH160, OP_TRUE, hash160
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_is_hash_string,
+    assert_raises_rpc_error,
+    connect_nodes,
+    sync_blocks,
+)
+
+def muhash_stats(node):
+    """gettxoutsetinfo "muhash" without the node-specific disk size"""
+    stats = node.gettxoutsetinfo("muhash")
+    del stats['disk_size']
+    return stats
+
+class CoinStatsTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [['-coinstats'], []]
+
+    def spend_coinbase(self, node, height):
+        """Spend the OP_TRUE coinbase output of the block at height into two outputs."""
+        coinbase = node.getblock(node.getblockhash(height))['tx'][0]
+        script_pubkey = CScript([OP_HASH160, hash160(CScript([OP_TRUE])), OP_EQUAL])
+        tx = CTransaction()
+        tx.vin.append(CTxIn(COutPoint(int(coinbase, 16), 0), CScript([CScript([OP_TRUE])])))
+        tx.vout.append(CTxOut(25 * COIN, script_pubkey))
+        tx.vout.append(CTxOut(25 * COIN - 10000, script_pubkey))
+        return node.sendrawtransaction(tx.serialize().hex())
+
+    def run_test(self):
+        node0, node1 = self.nodes
+        address = script_to_p2sh(CScript([OP_TRUE]))
+
+        self.log.info("Maintain the statistics while connecting blocks")
+        node0.generatetoaddress(110, address)
+        for height in range(1, 6):
+            self.spend_coinbase(node0, height)
+        node0.generatetoaddress(1, address)
+        sync_blocks(self.nodes)
+
+        stats = muhash_stats(node0)
+        assert_is_hash_string(stats['muhash'])
+        assert_equal(stats['height'], 111)
+        assert_equal(stats['bestblock'], node0.getbestblockhash())
+        assert 'transactions' not in stats
+        assert 'hash_serialized_2' not in stats
+        full = node0.gettxoutsetinfo()
+        for key in ['txouts', 'bogosize', 'total_amount']:
+            assert_equal(stats[key], full[key])
+        assert_raises_rpc_error(-1, "restart with -coinstats", node1.gettxoutsetinfo, "muhash")
+        assert_raises_rpc_error(-8, "Unknown hash_type", node0.gettxoutsetinfo, "sha1")
+
+        self.log.info("Compare against statistics computed from scratch")
+        self.restart_node(1, ['-coinstats'])
+        assert_equal(muhash_stats(node1), stats)
+
+        self.log.info("Undo the statistics while disconnecting blocks")
+        before = node0.gettxoutsetinfo("muhash")
+        node0.generatetoaddress(1, address)
+        tip = node0.getbestblockhash()
+        assert node0.gettxoutsetinfo("muhash")['muhash'] != before['muhash']
+        node0.invalidateblock(tip)
+        assert_equal(node0.gettxoutsetinfo("muhash")['muhash'], before['muhash'])
+        node0.invalidateblock(node0.getbestblockhash())
+        assert node0.gettxoutsetinfo("muhash")['muhash'] != before['muhash']
+        node0.reconsiderblock(tip)
+        assert_equal(node0.getbestblockhash(), tip)
+
+        self.log.info("Restart node0 and check the statistics persisted")
+        stats = muhash_stats(node0)
+        self.restart_node(0)
+        assert_equal(muhash_stats(node0), stats)
+        connect_nodes(node1, 0)
+        sync_blocks(self.nodes)
+        assert_equal(muhash_stats(node1), stats)
+
+        self.log.info("Count the totals in parallel without a hash")
+        full = node0.gettxoutsetinfo()
+        fast = node0.gettxoutsetinfo("none")
+        assert 'hash_serialized_2' not in fast
+        for key in ['height', 'bestblock', 'transactions', 'txouts', 'bogosize', 'total_amount']:
+            assert_equal(fast[key], full[key])
+
+if __name__ == '__main__':
+    CoinStatsTest().main()
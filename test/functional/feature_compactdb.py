@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the background compaction of the chain state database.
+
+- node0 compacts after leaving the initial block download, on request, and
+  after a large reorganization.
+- node1 runs with -autocompactdb=0 and only compacts on request.
+"""
+from test_framework.address import script_to_p2sh
+from test_framework.script import CScript, OP_NOP, OP_TRUE
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    connect_nodes,
+    disconnect_nodes,
+    sync_blocks,
+    wait_until,
+)
+
+class CompactDBTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [['-compactdbinterval=10'], ['-compactdbinterval=10', '-autocompactdb=0']]
+
+    def wait_for_compactions(self, node, count):
+        wait_until(lambda: node.compactchainstate()['completed'] == count, timeout=60)
+        status = node.compactchainstate()
+        assert not status['running']
+        assert_equal(status['slices_done'], status['slices'])
+        return status
+
+    def run_test(self):
+        node0, node1 = self.nodes
+        address = script_to_p2sh(CScript([OP_TRUE]))
+
+        status = node0.compactchainstate()
+        assert_equal(status['completed'], 0)
+        assert_equal(status['slices'], 64)
+
+        self.log.info("Compact after the initial block download")
+        node0.generatetoaddress(10, address)
+        sync_blocks(self.nodes)
+        status = self.wait_for_compactions(node0, 1)
+        assert_equal(status['reason'], "initial block download")
+        assert status['last_completed_time'] >= status['start_time']
+        assert_equal(node1.compactchainstate()['completed'], 0)
+
+        self.log.info("Compact on request")
+        status = node1.compactchainstate("start")
+        assert_equal(status['reason'], "requested by RPC")
+        self.wait_for_compactions(node1, 1)
+        assert_raises_rpc_error(-8, "Unknown command", node1.compactchainstate, "stop")
+
+        self.log.info("Compact after a reorganization")
+        disconnect_nodes(node0, 1)
+        node0.generatetoaddress(6, address)
+        # A different address keeps node1 from mining the same blocks as node0
+        node1.generatetoaddress(8, script_to_p2sh(CScript([OP_NOP, OP_TRUE])))
+        connect_nodes(node0, 1)
+        sync_blocks(self.nodes)
+        status = self.wait_for_compactions(node0, 2)
+        assert_equal(status['reason'], "reorganization of 6 blocks")
+        assert_equal(node1.compactchainstate()['completed'], 1)
+
+if __name__ == '__main__':
+    CompactDBTest().main()
@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test -dbprofile and the getdbinfo RPC."""
+from test_framework.address import script_to_p2sh
+from test_framework.script import CScript, OP_TRUE
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal
+
+class DBProfileTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def run_test(self):
+        node = self.nodes[0]
+
+        self.log.info("Check the default profile")
+        info = node.getdbinfo()
+        assert_equal(info['profile'], 'default')
+        for db in ['chainstate', 'blockindex']:
+            assert_equal(info[db]['max_open_files'], 64)
+            assert_equal(info[db]['block_size'], 4096)
+            assert_equal(info[db]['filter_bits'], 10)
+            assert_equal(info[db]['block_cache_size'], 2 * info[db]['write_buffer_size'])
+            assert 'Compactions' in info[db]['stats']
+
+        self.log.info("Use different settings per database")
+        self.restart_node(0, ['-dbprofile=hdd'])
+        node.generatetoaddress(1, script_to_p2sh(CScript([OP_TRUE])))
+        info = node.getdbinfo()
+        assert_equal(info['profile'], 'hdd')
+        assert_equal(info['chainstate']['block_size'], 16384)
+        assert_equal(info['chainstate']['filter_bits'], 14)
+        assert_equal(info['blockindex']['filter_bits'], 10)
+        assert info['chainstate']['max_open_files'] > info['blockindex']['max_open_files']
+
+        self.restart_node(0, ['-dbprofile=lowmem'])
+        info = node.getdbinfo()
+        assert info['chainstate']['block_cache_size'] > 2 * info['chainstate']['write_buffer_size']
+        assert_equal(node.getblockcount(), 1)
+
+        self.log.info("Refuse unknown profiles")
+        self.stop_node(0)
+        self.assert_start_raises_init_error(0, ['-dbprofile=floppy'], "Unknown -dbprofile 'floppy'")
+
+if __name__ == '__main__':
+    DBProfileTest().main()
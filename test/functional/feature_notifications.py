@@ -2,7 +2,7 @@
 # Copyright (c) 2014-2017 The Bitcoin Core developers
 # Distributed under the MIT software license, see the accompanying
 # file COPYING or http://www.opensource.org/licenses/mit-license.php.
-"""Test the -alertnotify, -blocknotify and -walletnotify options."""
+"""Test the -alertnotify, -blocknotify and -walletnotify options, and -notifythreads."""
 import os
 
 from test_framework.test_framework import BitcoinTestFramework
@@ -61,6 +61,23 @@ class NotificationsTest(BitcoinTestFramework):
         with open(self.tx_filename, 'r') as f:
             assert_equal(sorted(txids_rpc), sorted(f.read().splitlines()))
 
+        self.log.info("test -walletnotify on -notifythreads with -notifybatch")
+        os.remove(self.tx_filename)
+        self.restart_node(1, self.extra_args[1] + ["-notifythreads=1", "-notifybatch=100"])
+        connect_nodes_bi(self.nodes, 0, 1)
+
+        # Commands run for several transactions get them separated by spaces
+        wait_until(lambda: os.path.isfile(self.tx_filename) and os.stat(self.tx_filename).st_size >= (block_count * 65), timeout=10)
+        with open(self.tx_filename, 'r') as f:
+            assert_equal(sorted(txids_rpc), sorted(f.read().split()))
+        wait_until(lambda: self.nodes[1].getnotifyinfo()['running'] == 0 and self.nodes[1].getnotifyinfo()['queue_depth'] == 0, timeout=10)
+        info = self.nodes[1].getnotifyinfo()
+        assert_equal(info['threads'], 1)
+        assert_equal(info['max_batch'], 100)
+        assert_equal(info['dropped'], 0)
+        assert_equal(info['notifications'], block_count)
+        assert_equal(info['commands'], info['notifications'] - info['coalesced'])
+
         # Mine another 41 up-version blocks. -alertnotify should trigger on the 51st.
         self.log.info("test -alertnotify")
         self.nodes[1].generate(41)
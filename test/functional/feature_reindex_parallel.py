@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test -reindex with -reindexthreads.
+
+- Mine a chain, stop the node, and split its only block file into several
+  files, with the later blocks in the earlier files, so that most blocks are
+  found before their parent.
+- Reindex with several parsing threads, with one, and on the import thread,
+  and check that each time the same chain and UTXO set are rebuilt.
+"""
+import os
+import struct
+
+from test_framework.address import script_to_p2sh
+from test_framework.script import CScript, OP_TRUE
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, wait_until
+
+NUM_BLOCKS = 60
+NUM_FILES = 4
+
+class ReindexParallelTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def blocks_dir(self):
+        return os.path.join(self.options.tmpdir, "node0", "regtest", "blocks")
+
+    def split_block_file(self):
+        """Split blk00000.dat into NUM_FILES files, in reverse order of the blocks"""
+        path = os.path.join(self.blocks_dir(), "blk00000.dat")
+        with open(path, 'rb') as f:
+            data = f.read()
+        records = []
+        pos = 0
+        while pos + 8 <= len(data) and data[pos:pos + 4] == b'\xfa\xbf\xb5\xda':
+            size = struct.unpack("<I", data[pos + 4:pos + 8])[0]
+            records.append(data[pos:pos + 8 + size])
+            pos += 8 + size
+        assert_equal(len(records), NUM_BLOCKS + 1)
+
+        chunk = (len(records) + NUM_FILES - 1) // NUM_FILES
+        chunks = [records[i:i + chunk] for i in range(0, len(records), chunk)]
+        for name in os.listdir(self.blocks_dir()):
+            if name.startswith("blk") or name.startswith("rev"):
+                os.remove(os.path.join(self.blocks_dir(), name))
+        for n, records_in_file in enumerate(reversed(chunks)):
+            with open(os.path.join(self.blocks_dir(), "blk%05d.dat" % n), 'wb') as f:
+                f.write(b''.join(records_in_file))
+
+    def reindex(self, threads):
+        self.log.info("Reindex with -reindexthreads=%d" % threads)
+        self.start_node(0, ["-reindex", "-reindexthreads=%d" % threads, "-checkblockindex=1"])
+        wait_until(lambda: self.nodes[0].getblockcount() == NUM_BLOCKS)
+        assert_equal(self.nodes[0].getbestblockhash(), self.best_hash)
+        assert_equal(self.nodes[0].gettxoutsetinfo()['hash_serialized_2'], self.utxo_hash)
+        self.stop_node(0)
+
+    def run_test(self):
+        self.nodes[0].generatetoaddress(NUM_BLOCKS, script_to_p2sh(CScript([OP_TRUE])))
+        self.best_hash = self.nodes[0].getbestblockhash()
+        self.utxo_hash = self.nodes[0].gettxoutsetinfo()['hash_serialized_2']
+        self.stop_node(0)
+        self.split_block_file()
+
+        self.reindex(3)
+        self.reindex(1)
+        self.reindex(0)
+        assert os.path.isfile(os.path.join(self.blocks_dir(), "blk%05d.dat" % (NUM_FILES - 1)))
+
+if __name__ == '__main__':
+    ReindexParallelTest().main()
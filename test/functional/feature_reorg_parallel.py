@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test disconnecting the blocks of a reorganization at once (-parreorg)."""
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, connect_nodes_bi, disconnect_nodes, sync_blocks
+
+class ParallelReorgTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [['-parreorg', '-par=2'], []]
+
+    def mine_with_transactions(self, node, blocks):
+        address = node.getnewaddress()
+        for _ in range(blocks):
+            for _ in range(3):
+                node.sendtoaddress(address, 1)
+            node.generate(1)
+
+    def run_test(self):
+        self.nodes[0].generate(110)
+        sync_blocks(self.nodes)
+
+        self.log.info("Build a fork of 40 blocks spending and creating coins on node0")
+        disconnect_nodes(self.nodes[0], 1)
+        disconnect_nodes(self.nodes[1], 0)
+        self.mine_with_transactions(self.nodes[0], 40)
+        self.nodes[1].generate(45)
+
+        self.log.info("Reorganize node0 onto the longer chain of node1")
+        connect_nodes_bi(self.nodes, 0, 1)
+        sync_blocks(self.nodes)
+        assert_equal(self.nodes[0].getbestblockhash(), self.nodes[1].getbestblockhash())
+        assert_equal(self.nodes[0].gettxoutsetinfo()['hash_serialized_2'], self.nodes[1].gettxoutsetinfo()['hash_serialized_2'])
+        # The transactions of the disconnected blocks went back to the mempool
+        assert len(self.nodes[0].getrawmempool()) > 0
+
+        self.log.info("Reorganize back after a restart")
+        self.restart_node(0)
+        self.nodes[0].invalidateblock(self.nodes[0].getblockhash(111))
+        assert_equal(self.nodes[0].getblockcount(), 110)
+        self.nodes[0].reconsiderblock(self.nodes[0].getblockhash(111))
+        assert_equal(self.nodes[0].getbestblockhash(), self.nodes[1].getbestblockhash())
+        assert_equal(self.nodes[0].gettxoutsetinfo()['hash_serialized_2'], self.nodes[1].gettxoutsetinfo()['hash_serialized_2'])
+
+if __name__ == '__main__':
+    ParallelReorgTest().main()
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the transaction index, which is built in the background.
+
+- -txindex can be enabled on an existing chain without -reindex.
+- The index continues where it left off after a restart.
+- Blocks connected after a reorganization are indexed.
+"""
+from test_framework.address import script_to_p2sh
+from test_framework.authproxy import JSONRPCException
+from test_framework.script import CScript, OP_TRUE
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    wait_until,
+)
+
+class TxIndexTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def coinbase(self, height):
+        node = self.nodes[0]
+        return node.getblock(node.getblockhash(height))['tx'][0]
+
+    def indexed_block(self, txid):
+        """Return the block the index has txid in, or None while it is not indexed yet"""
+        try:
+            return self.nodes[0].getrawtransaction(txid, True)['blockhash']
+        except JSONRPCException as e:
+            assert_equal(e.error['code'], -5)
+            return None
+
+    def run_test(self):
+        node = self.nodes[0]
+        address = script_to_p2sh(CScript([OP_TRUE]))
+        node.generatetoaddress(200, address)
+        txid = self.coinbase(100)
+        assert_raises_rpc_error(-5, "Use -txindex to enable blockchain transaction queries", node.getrawtransaction, "00" * 32)
+
+        self.log.info("Enable -txindex on an existing chain")
+        self.restart_node(0, ['-txindex'])
+        wait_until(lambda: self.indexed_block(txid) is not None, timeout=60)
+        assert_raises_rpc_error(-5, "No such mempool or blockchain transaction", node.getrawtransaction, "00" * 32)
+        for height in [1, 100, 200]:
+            tx = node.getrawtransaction(self.coinbase(height), True)
+            assert_equal(tx['blockhash'], node.getblockhash(height))
+
+        self.log.info("Index blocks connected after the index caught up")
+        hashes = node.generatetoaddress(10, address)
+        for blockhash in hashes:
+            txid = node.getblock(blockhash)['tx'][0]
+            assert_equal(node.getrawtransaction(txid, True)['blockhash'], blockhash)
+
+        self.log.info("Continue from the last indexed block after a restart")
+        self.stop_node(0)
+        self.start_node(0, ['-txindex'])
+        hashes = node.generatetoaddress(5, address)
+        for height in [1, 210, 215]:
+            txid = self.coinbase(height)
+            wait_until(lambda: self.indexed_block(txid) == node.getblockhash(height), timeout=60)
+
+        self.log.info("Index the new blocks of a reorganization")
+        node.invalidateblock(node.getblockhash(211))
+        hashes = node.generatetoaddress(10, script_to_p2sh(CScript([OP_TRUE, OP_TRUE])))
+        for blockhash in hashes:
+            txid = node.getblock(blockhash)['tx'][0]
+            assert_equal(node.getrawtransaction(txid, True)['blockhash'], blockhash)
+
+        self.log.info("Disable -txindex again")
+        self.restart_node(0)
+        assert_raises_rpc_error(-5, "Use -txindex to enable blockchain transaction queries", node.getrawtransaction, "00" * 32)
+
+if __name__ == '__main__':
+    TxIndexTest().main()
@@ -35,6 +35,13 @@ class TestBitcoinCli(BitcoinTestFramework):
         assert_equal(["foo", "bar"], self.nodes[0].cli('-rpcuser=%s' % user, '-stdin', '-stdinrpcpass', input=password + "\nfoo\nbar").echo())
         assert_raises_process_error(1, "incorrect rpcuser or rpcpassword", self.nodes[0].cli('-rpcuser=%s' % user, '-stdin', '-stdinrpcpass', input="foo").echo)
 
+        self.log.info("Test -batch, one command per line, in JSON-RPC batches of -batchsize")
+        commands = "getblockcount\necho foo bar\n\ngetblockhash 0\nsetnetworkactive true\n"
+        expected = "0\n[\"foo\",\"bar\"]\n%s\ntrue" % self.nodes[0].getblockhash(0)
+        assert_equal(expected, self.nodes[0].cli('-batch', input=commands).send_cli())
+        assert_equal(expected, self.nodes[0].cli('-batch', '-batchsize=3', input=commands).send_cli())
+        assert_raises_process_error(1, "-batch takes its commands from standard input only", self.nodes[0].cli('-batch').getblockcount)
+
         self.log.info("Make sure that -getinfo with arguments fails")
         assert_raises_process_error(1, "-getinfo takes no arguments", self.nodes[0].cli('-getinfo').help)
 
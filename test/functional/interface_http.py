@@ -13,6 +13,7 @@ import urllib.parse
 class HTTPBasicsTest (BitcoinTestFramework):
     def set_test_params(self):
         self.num_nodes = 3
+        self.extra_args = [[], ["-rpcfairqueue"], ["-metrics"]]
 
     def setup_network(self):
         self.setup_nodes()
@@ -103,6 +104,41 @@ class HTTPBasicsTest (BitcoinTestFramework):
         out1 = conn.getresponse()
         assert_equal(out1.status, http.client.BAD_REQUEST)
 
+        # The persistent connections above served more requests than there were connections
+        info = self.nodes[0].gethttpserverinfo()
+        assert_greater_than(info['requests'], info['connections'])
+        assert_greater_than_or_equal(info['connections'], info['connections_open'])
+        assert_equal(info['workqueue']['fair'], False)
+        assert_equal(info['workqueue']['max_depth'], 16)
+        assert_greater_than_or_equal(info['workqueue']['handled'], 4)
+        assert_equal(info['workqueue']['rejected'], 0)
+        assert_equal(sum(count for _, count in info['wait']['histogram']), info['workqueue']['handled'])
+        assert_equal(sum(count for _, count in info['handle']['histogram']), info['workqueue']['handled'])
+        assert('clients' not in info['workqueue'])
+
+        info = self.nodes[1].gethttpserverinfo()
+        assert_equal(info['workqueue']['fair'], True)
+        assert_equal(info['workqueue']['clients'], 0)
+
+        # Metrics are served without authentication, only when enabled
+        conn = http.client.HTTPConnection(url.hostname, url.port)
+        conn.request('GET', '/metrics')
+        assert_equal(conn.getresponse().status, http.client.NOT_FOUND)
+        conn.close()
+
+        self.nodes[2].uptime()
+        conn = http.client.HTTPConnection(urlNode2.hostname, urlNode2.port)
+        conn.request('GET', '/metrics')
+        out1 = conn.getresponse()
+        assert_equal(out1.status, http.client.OK)
+        metrics = out1.read().decode('utf-8')
+        assert('# TYPE bitcoin_connect_block_duration_seconds histogram' in metrics)
+        assert('bitcoin_net_received_bytes_total{command="version"} 0\n' in metrics)
+        assert('bitcoin_rpc_duration_seconds_count{method="uptime"} 1\n' in metrics)
+        conn.request('POST', '/metrics')
+        assert_equal(conn.getresponse().status, http.client.METHOD_NOT_ALLOWED)
+        conn.close()
+
 
 if __name__ == '__main__':
     HTTPBasicsTest ().main ()
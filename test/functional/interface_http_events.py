@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the stream of validation events at /events (-httpevents)."""
+import http.client
+import json
+import urllib.parse
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal
+
+class HTTPEventsTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.num_nodes = 1
+        self.extra_args = [['-httpevents']]
+
+    def open_stream(self, path):
+        url = urllib.parse.urlparse(self.nodes[0].url)
+        conn = http.client.HTTPConnection(url.hostname, url.port, timeout=30)
+        conn.request('GET', path)
+        return conn.getresponse()
+
+    def read_event(self, response):
+        """Return the next event of the stream as (id, kind, data), skipping comments"""
+        fields = {}
+        while True:
+            line = response.readline().decode('utf-8').rstrip('\n')
+            if line == '':
+                if fields:
+                    return int(fields['id']), fields['event'], json.loads(fields['data'])
+            elif not line.startswith(':'):
+                key, value = line.split(': ', 1)
+                fields[key] = value
+
+    def run_test(self):
+        node = self.nodes[0]
+
+        self.log.info("Refuse unknown event kinds")
+        response = self.open_stream('/events?events=foo')
+        assert_equal(response.status, 400)
+
+        self.log.info("Follow blocks and mempool transactions")
+        blocks = self.open_stream('/events?events=block')
+        assert_equal(blocks.status, 200)
+        assert_equal(blocks.getheader('Content-Type'), 'text/event-stream')
+        everything = self.open_stream('/events')
+        assert_equal(everything.status, 200)
+
+        txid = node.sendtoaddress(node.getnewaddress(), 1)
+        blockhash = node.generate(1)[0]
+
+        id_tx, kind, data = self.read_event(everything)
+        assert_equal(kind, 'tx')
+        assert_equal(data['txid'], txid)
+        id_block, kind, data = self.read_event(everything)
+        assert_equal(kind, 'block')
+        assert_equal(data['hash'], blockhash)
+        assert_equal(data['height'], node.getblockcount())
+        assert id_block > id_tx
+
+        # The same event, with the same id, on the stream following only blocks
+        assert_equal(self.read_event(blocks), (id_block, 'block', data))
+
+        self.log.info("Report disconnected blocks")
+        node.invalidateblock(blockhash)
+        _, kind, data = self.read_event(everything)
+        assert_equal(kind, 'blockdisconnected')
+        assert_equal(data['hash'], blockhash)
+
+if __name__ == '__main__':
+    HTTPEventsTest().main()
@@ -5,6 +5,7 @@
 """Test the REST API."""
 
 from test_framework.test_framework import BitcoinTestFramework
+from test_framework.messages import CTransaction, deser_compact_size, ser_compact_size
 from test_framework.util import *
 from struct import *
 from io import BytesIO
@@ -20,6 +21,36 @@ def deser_uint256(f):
         r += t << (i * 32)
     return r
 
+def deser_varint(f):
+    n = 0
+    while True:
+        ch = f.read(1)[0]
+        n = (n << 7) | (ch & 0x7f)
+        if not ch & 0x80:
+            return n
+        n += 1
+
+def decompress_amount(x):
+    if x == 0:
+        return 0
+    x -= 1
+    e = x % 10
+    x //= 10
+    if e < 9:
+        d = x % 9 + 1
+        x //= 9
+        n = x * 10 + d
+    else:
+        n = x + 1
+    return n * 10 ** e
+
+def getutxos_batch_request(checkmempool, outpoints):
+    request = b'\x01' if checkmempool else b'\x00'
+    request += ser_compact_size(len(outpoints))
+    for (txid, n) in outpoints:
+        request += hex_str_to_bytes(txid)[::-1] + pack("<I", n)
+    return request
+
 #allows simple http get calls
 def http_get_call(host, port, path, response_object = 0):
     conn = http.client.HTTPConnection(host, port)
@@ -46,6 +77,7 @@ class RESTTest (BitcoinTestFramework):
     def set_test_params(self):
         self.setup_clean_chain = True
         self.num_nodes = 3
+        self.extra_args = [["-restmaxoutpoints=100"], [], []]
 
     def setup_network(self, split=False):
         super().setup_network()
@@ -194,6 +226,35 @@ class RESTTest (BitcoinTestFramework):
         response = http_post_call(url.hostname, url.port, '/rest/getutxos'+json_request+self.FORMAT_SEPARATOR+'json', '', True)
         assert_equal(response.status, 200) #must be a 200 because we are within the limits
 
+        ##############################
+        # GETUTXOS: batched requests #
+        ##############################
+        # the mempool output, a spent output and outputs that do not exist
+        outpoints = [(txid, n), (vintx, 0)] + [(txid, 100 + x) for x in range(98)]
+        bin_response = http_post_call(url.hostname, url.port, '/rest/getutxos/batch'+self.FORMAT_SEPARATOR+'bin', getutxos_batch_request(True, outpoints))
+        output = BytesIO(bin_response)
+        assert_equal(unpack("<i", output.read(4))[0], self.nodes[0].getblockcount())
+        assert_equal(hex(deser_uint256(output))[2:].zfill(64), self.nodes[0].getbestblockhash())
+        bitmap = output.read(deser_compact_size(output))
+        assert_equal(bitmap, b'\x01' + b'\x00' * 12)
+        assert_equal(deser_compact_size(output), 1)
+        assert_equal(deser_varint(output), 0x7fffffff * 2) #mempool height, not coinbase
+        assert_equal(decompress_amount(deser_varint(output)), 10000000)
+
+        #the hex format returns the same, and the mempool is only checked on request
+        hex_response = http_post_call(url.hostname, url.port, '/rest/getutxos/batch'+self.FORMAT_SEPARATOR+'hex', bytes_to_hex_str(getutxos_batch_request(True, outpoints)))
+        assert_equal(hex_response.decode('ascii').rstrip(), bytes_to_hex_str(bin_response))
+        bin_response = http_post_call(url.hostname, url.port, '/rest/getutxos/batch'+self.FORMAT_SEPARATOR+'bin', getutxos_batch_request(False, outpoints))
+        assert_equal(bin_response[-15:], b'\x0d' + b'\x00' * 14)
+
+        #the limit is set by -restmaxoutpoints, and only binary formats are served
+        response = http_post_call(url.hostname, url.port, '/rest/getutxos/batch'+self.FORMAT_SEPARATOR+'bin', getutxos_batch_request(True, outpoints + [(txid, n)]), True)
+        assert_equal(response.status, 400)
+        response = http_post_call(url.hostname, url.port, '/rest/getutxos/batch'+self.FORMAT_SEPARATOR+'json', getutxos_batch_request(True, outpoints), True)
+        assert_equal(response.status, 404)
+        response = http_post_call(url.hostname, url.port, '/rest/getutxos/batch'+self.FORMAT_SEPARATOR+'bin', b'\x01', True)
+        assert_equal(response.status, 400)
+
         self.nodes[0].generate(1) #generate block to not affect upcoming tests
         self.sync_all()
 
@@ -298,6 +359,22 @@ class RESTTest (BitcoinTestFramework):
         for tx in txs:
             assert_equal(tx in json_obj, True)
 
+        # the binary format holds the same transactions, each framed by its size
+        response = http_get_call(url.hostname, url.port, '/rest/mempool/contents'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        f = BytesIO(response.read())
+        mempool_txids = []
+        for i in range(3):
+            tx = CTransaction()
+            tx_size = deser_compact_size(f)
+            tx_bytes = f.read(tx_size)
+            tx.deserialize(BytesIO(tx_bytes))
+            assert_equal(len(tx.serialize_with_witness()), tx_size)
+            tx.rehash()
+            mempool_txids.append(tx.hash)
+        assert_equal(f.read(), b'')
+        assert_equal(sorted(mempool_txids), sorted(txs))
+
         # now mine the transactions
         newblockhash = self.nodes[1].generate(1)
         self.sync_all()
@@ -315,6 +392,64 @@ class RESTTest (BitcoinTestFramework):
         for tx in txs:
             assert_equal(tx in json_obj['tx'], True)
 
+        # fetch a range of blocks in one response
+        start_hash = self.nodes[0].getblockhash(1)
+        response = http_get_call(url.hostname, url.port, '/rest/blocks/5/'+start_hash+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        f = BytesIO(response.read())
+        for height in range(1, 6):
+            block_size = deser_compact_size(f)
+            block_bytes = f.read(block_size)
+            assert_equal(bytes_to_hex_str(block_bytes), self.nodes[0].getblock(self.nodes[0].getblockhash(height), 0))
+        assert_equal(f.read(), b'')
+
+        response = http_get_call(url.hostname, url.port, '/rest/blocks/21/'+start_hash+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 400)
+        response = http_get_call(url.hostname, url.port, '/rest/blocks/5/'+start_hash+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 404)
+
+        # undo data of the block with the three transactions: one spent output each
+        response = http_get_call(url.hostname, url.port, '/rest/blockundo/'+newblockhash[0]+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        f = BytesIO(response.read())
+        assert_equal(deser_compact_size(f), 3)
+        response = http_get_call(url.hostname, url.port, '/rest/blockundo/'+self.nodes[0].getblockhash(0)+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 404)
+
+        # fetch ranges by height, streamed with chunked transfer encoding
+        tip_height = self.nodes[0].getblockcount()
+        response = http_get_call(url.hostname, url.port, '/rest/blocks/0/'+str(tip_height + 10)+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        assert_equal(response.getheader('Transfer-Encoding'), 'chunked')
+        f = BytesIO(response.read())
+        for height in range(tip_height + 1):
+            block_size = deser_compact_size(f)
+            block_bytes = f.read(block_size)
+            assert_equal(bytes_to_hex_str(block_bytes), self.nodes[0].getblock(self.nodes[0].getblockhash(height), 0))
+        assert_equal(f.read(), b'')
+
+        response_hex = http_get_call(url.hostname, url.port, '/rest/headers/1/3'+self.FORMAT_SEPARATOR+'hex')
+        assert_equal(response_hex.strip(), ''.join(self.nodes[0].getblockheader(self.nodes[0].getblockhash(h), False) for h in range(1, 4)))
+
+        # the genesis block and a block with only a coinbase spend nothing
+        response = http_get_call(url.hostname, url.port, '/rest/blockundo/0/2'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        assert_equal(response.read(), b'\x01\x00\x01\x00')
+        undo_height = self.nodes[0].getblock(newblockhash[0])['height']
+        response = http_get_call(url.hostname, url.port, '/rest/blockundo/'+str(undo_height)+'/1'+self.FORMAT_SEPARATOR+'bin', True)
+        f = BytesIO(response.read())
+        deser_compact_size(f)
+        assert_equal(deser_compact_size(f), 3)
+
+        for path, status in [('/rest/blocks/'+str(tip_height + 1)+'/1.bin', 404),
+                             ('/rest/blocks/0/0.bin', 400),
+                             ('/rest/blocks/0/10001.bin', 400),
+                             ('/rest/blocks/-1/1.bin', 400),
+                             ('/rest/blocks/0/1.json', 404),
+                             ('/rest/blockundo/0/1.json', 404)]:
+            response = http_get_call(url.hostname, url.port, path, True)
+            assert_equal(response.status, status)
+
         #test rest bestblock
         bb_hash = self.nodes[0].getbestblockhash()
 
@@ -70,8 +70,10 @@ class ZMQTest (BitcoinTestFramework):
         self.hashtx = ZMQSubscriber(socket, b"hashtx")
         self.rawblock = ZMQSubscriber(socket, b"rawblock")
         self.rawtx = ZMQSubscriber(socket, b"rawtx")
+        self.sequence = ZMQSubscriber(socket, b"sequence")
 
-        self.extra_args = [["-zmqpub%s=%s" % (sub.topic.decode(), address) for sub in [self.hashblock, self.hashtx, self.rawblock, self.rawtx]], []]
+        self.extra_args = [["-zmqpub%s=%s" % (sub.topic.decode(), address) for sub in [self.hashblock, self.hashtx, self.rawblock, self.rawtx, self.sequence]], []]
+        self.extra_args[0].append("-zmqpubrawtxhwm=500")
         self.add_nodes(self.num_nodes, self.extra_args)
         self.start_nodes()
 
@@ -100,6 +102,10 @@ class ZMQTest (BitcoinTestFramework):
             tx.calc_sha256()
             assert_equal(tx.hash, bytes_to_hex_str(txid))
 
+            # Should receive the connection of the block, before its tip notifications.
+            body = self.sequence.receive()
+            assert_equal((bytes_to_hex_str(body[:32]), body[32:]), (genhashes[x], b"C"))
+
             # Should receive the generated block hash.
             hash = bytes_to_hex_str(self.hashblock.receive())
             assert_equal(genhashes[x], hash)
@@ -122,5 +128,39 @@ class ZMQTest (BitcoinTestFramework):
         hex = self.rawtx.receive()
         assert_equal(payment_txid, bytes_to_hex_str(hash256(hex)))
 
+        # Should receive its acceptance to the mempool.
+        body = self.sequence.receive()
+        assert_equal((bytes_to_hex_str(body[:32]), body[32:]), (payment_txid, b"A"))
+
+        self.log.info("Disconnect and reconnect the tip")
+        self.nodes[0].invalidateblock(genhashes[-1])
+        # Should receive the coinbase of the disconnected block, then the disconnection.
+        coinbase = bytes_to_hex_str(self.hashtx.receive())
+        self.rawtx.receive()
+        body = self.sequence.receive()
+        assert_equal((bytes_to_hex_str(body[:32]), body[32:]), (genhashes[-1], b"D"))
+
+        self.nodes[0].reconsiderblock(genhashes[-1])
+        assert_equal(bytes_to_hex_str(self.hashtx.receive()), coinbase)
+        self.rawtx.receive()
+        body = self.sequence.receive()
+        assert_equal((bytes_to_hex_str(body[:32]), body[32:]), (genhashes[-1], b"C"))
+        assert_equal(bytes_to_hex_str(self.hashblock.receive()), genhashes[-1])
+        self.rawblock.receive()
+
+        self.log.info("Test the getzmqnotifications RPC")
+        notifications = {n["type"]: n for n in self.nodes[0].getzmqnotifications()}
+        assert_equal(sorted(notifications.keys()), ["pubhashblock", "pubhashtx", "pubrawblock", "pubrawtx", "pubsequence"])
+        assert_equal(notifications["pubrawtx"]["hwm"], 500)
+        assert_equal(notifications["pubhashtx"]["hwm"], 1000)
+        for sub in [self.hashblock, self.hashtx, self.rawblock, self.rawtx, self.sequence]:
+            n = notifications["pub" + sub.topic.decode()]
+            assert_equal(n["address"], "tcp://127.0.0.1:28332")
+            assert_equal(n["sequence"], sub.sequence)
+            assert_equal(n["published"], sub.sequence)
+            assert_equal(n["dropped"], 0)
+            assert_equal(n["queued"], 0)
+        assert_equal(self.nodes[1].getzmqnotifications(), [])
+
 if __name__ == '__main__':
     ZMQTest().main()
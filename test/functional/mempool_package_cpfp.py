@@ -0,0 +1,44 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test that a relayed child can pay for a parent whose own fee is too low.
+
+Node 1 has a higher minimum relay fee than node 0, so it rejects the parent on
+its own, but accepts it together with its child as a package."""
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+class MempoolPackageCPFPTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.num_nodes = 2
+        self.extra_args = [[], ["-minrelaytxfee=0.0001", "-feefilter=0"]]
+
+    def run_test(self):
+        node0, node1 = self.nodes
+        node0.generate(101)
+        self.sync_all()
+
+        address = node0.getnewaddress()
+        coinbase = node0.getblock(node0.getblockhash(1))['tx'][0]
+        # About 2.5 satoshis per byte, between the two minimum fees
+        parent_hex = create_tx(node0, coinbase, address, Decimal("49.999995"))
+        assert_raises_rpc_error(-26, "min relay fee not met", node1.sendrawtransaction, parent_hex)
+        parent_txid = node0.sendrawtransaction(parent_hex)
+
+        child_hex = create_tx(node0, parent_txid, address, Decimal("49.998995"))
+        child_txid = node0.sendrawtransaction(child_hex)
+
+        sync_mempools(self.nodes)
+        assert_equal(sorted(node1.getrawmempool()), sorted([parent_txid, child_txid]))
+        entry = node1.getmempoolentry(child_txid)
+        assert_equal(entry['ancestorcount'], 2)
+
+        # The package is mined like any other transactions
+        node1.generate(1)
+        self.sync_all()
+        assert_equal(node0.getrawmempool(), [])
+
+if __name__ == '__main__':
+    MempoolPackageCPFPTest().main()
@@ -6,6 +6,7 @@
 
 - getmininginfo
 - getblocktemplate proposal mode
+- getblocktemplate coinbase merkle branch
 - submitblock"""
 
 import copy
@@ -13,9 +14,10 @@ from binascii import b2a_hex
 from decimal import Decimal
 
 from test_framework.blocktools import create_coinbase
+from test_framework.messages import CTransaction, FromHex, hash256, ser_uint256, uint256_from_str
 from test_framework.mininode import CBlock
 from test_framework.test_framework import BitcoinTestFramework
-from test_framework.util import assert_equal, assert_raises_rpc_error
+from test_framework.util import assert_equal, assert_raises_rpc_error, hex_str_to_bytes
 
 def b2x(b):
     return b2a_hex(b).decode('ascii')
@@ -30,6 +32,7 @@ class MiningTest(BitcoinTestFramework):
     def set_test_params(self):
         self.num_nodes = 2
         self.setup_clean_chain = False
+        self.extra_args = [[], ['-fastblocktemplate']]
 
     def run_test(self):
         node = self.nodes[0]
@@ -50,6 +53,7 @@ class MiningTest(BitcoinTestFramework):
         self.log.info("getblocktemplate: Test capability advertised")
         assert 'proposal' in tmpl['capabilities']
         assert 'coinbasetxn' not in tmpl
+        assert_equal(tmpl['coinbasemerklebranch'], [])
 
         coinbase_tx = create_coinbase(height=int(tmpl["height"]) + 1)
         # sequence numbers must not be max for nLockTime to have effect
@@ -131,5 +135,23 @@ class MiningTest(BitcoinTestFramework):
         bad_block.hashPrevBlock = 123
         assert_template(node, bad_block, 'inconclusive-not-best-prevblk')
 
+        self.log.info("getblocktemplate: Test coinbase merkle branch")
+        for _ in range(3):
+            node.sendtoaddress(node.getnewaddress(), 1)
+        self.sync_all()
+        # Node 1 returns its templates before checking them
+        for n in self.nodes:
+            tmpl = n.getblocktemplate({'rules': ['segwit']})
+            assert_equal(len(tmpl['transactions']), 3)
+            assert_equal(len(tmpl['coinbasemerklebranch']), 2)
+            block.vtx = [coinbase_tx] + [FromHex(CTransaction(), tx['data']) for tx in tmpl['transactions']]
+            for tx in block.vtx:
+                tx.rehash()
+            root = ser_uint256(coinbase_tx.sha256)
+            for h in tmpl['coinbasemerklebranch']:
+                root = hash256(root + hex_str_to_bytes(h))
+            assert_equal(uint256_from_str(root), block.calc_merkle_root())
+            assert_template(n, block, None)
+
 if __name__ == '__main__':
     MiningTest().main()
@@ -0,0 +1,53 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test getblockstats and getblockstatsrange."""
+from decimal import Decimal
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, assert_raises_rpc_error
+
+class GetBlockStatsTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generate(101)
+        address = node.getnewaddress()
+        for amount in [1, 2, 3]:
+            node.sendtoaddress(address, amount)
+        mempool = node.getrawmempool(True)
+        fees = sorted(int(entry['fee'] * Decimal(1e8)) for entry in mempool.values())
+        blockhash = node.generate(1)[0]
+
+        self.log.info("Compute the statistics of a block from its undo data")
+        stats = node.getblockstats(102)
+        assert_equal(stats, node.getblockstats(blockhash))
+        assert_equal(stats['blockhash'], blockhash)
+        assert_equal(stats['height'], 102)
+        assert_equal(stats['txs'], 4)
+        assert_equal(stats['totalfee'], sum(fees))
+        assert_equal(stats['minfee'], fees[0])
+        assert_equal(stats['maxfee'], fees[-1])
+        assert_equal(stats['medianfee'], fees[1])
+        assert_equal(stats['subsidy'], 50 * 10**8)
+        assert_equal(stats['utxo_increase'], stats['outs'] - stats['ins'])
+        assert_equal(len(stats['feerate_percentiles']), 5)
+        assert_equal(node.getblockstats(102, ['txs', 'height']), {'txs': 4, 'height': 102})
+        assert_equal(node.getblockstats(0)['txs'], 1)
+
+        self.log.info("Compute a range of blocks in parallel")
+        stats_range = node.getblockstatsrange(90, 102)
+        assert_equal(stats_range, [node.getblockstats(height) for height in range(90, 103)])
+        assert_equal(node.getblockstatsrange(102, 102, ['totalfee']), [{'totalfee': sum(fees)}])
+
+        assert_raises_rpc_error(-8, "Target block height 103 after current tip 102", node.getblockstats, 103)
+        assert_raises_rpc_error(-8, "Invalid selected statistic foo", node.getblockstats, 102, ['foo'])
+        assert_raises_rpc_error(-5, "Block not found", node.getblockstats, '00' * 32)
+        assert_raises_rpc_error(-8, "end_height is below start_height", node.getblockstatsrange, 10, 5)
+
+if __name__ == '__main__':
+    GetBlockStatsTest().main()
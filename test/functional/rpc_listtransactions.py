@@ -92,8 +92,29 @@ class ListTransactionsTest(BitcoinTestFramework):
                            {"category":"receive","amount":Decimal("0.1")},
                            {"txid":txid, "account" : "watchonly"} )
 
+        self.run_paging_test()
         self.run_rbf_opt_in_test()
 
+    # Check that walking listtransactionspage gives the same entries as
+    # listtransactions, and never splits a transaction across pages.
+    def run_paging_test(self):
+        for node in self.nodes:
+            expected = node.listtransactions("*", 1000, 0, True)
+            pages = []
+            cursor = None
+            while True:
+                page = node.listtransactionspage(3, cursor, True)
+                assert(len(page["transactions"]) >= 3 or "next" not in page)
+                pages.insert(0, page["transactions"])
+                if "next" not in page:
+                    break
+                cursor = page["next"]
+            listed = [entry for page in pages for entry in page]
+            assert_equal(listed, expected)
+            for older, newer in zip(pages, pages[1:]):
+                if older and newer and "txid" in older[-1]:
+                    assert(older[-1]["txid"] != newer[0].get("txid"))
+
     # Check that the opt-in-rbf flag works properly, for sent and received
     # transactions.
     def run_rbf_opt_in_test(self):
@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the scantxoutset rpc."""
+from decimal import Decimal
+
+from test_framework.address import script_to_p2sh
+from test_framework.script import CScript, OP_TRUE, hash160, OP_HASH160, OP_EQUAL
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, assert_raises_rpc_error, bytes_to_hex_str
+
+class ScanTxoutSetTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def run_test(self):
+        node = self.nodes[0]
+        script = CScript([OP_TRUE])
+        address = script_to_p2sh(script)
+        other = script_to_p2sh(CScript([OP_TRUE, OP_TRUE]))
+        node.generatetoaddress(20, address)
+        node.generatetoaddress(10, other)
+
+        self.log.info("Find the outputs paying to an address")
+        result = node.scantxoutset("start", [address])
+        assert_equal(result['success'], True)
+        assert_equal(result['height'], 30)
+        assert_equal(result['bestblock'], node.getbestblockhash())
+        assert_equal(result['searched_items'], 30)
+        assert_equal(len(result['unspents']), 20)
+        assert_equal(result['total_amount'], Decimal('1000'))
+        assert_equal(sorted(u['height'] for u in result['unspents']), list(range(1, 21)))
+
+        self.log.info("Find them by script, along with those of another address")
+        p2sh = bytes_to_hex_str(CScript([OP_HASH160, hash160(script), OP_EQUAL]))
+        result = node.scantxoutset("start", [{"script": p2sh}, other])
+        assert_equal(len(result['unspents']), 30)
+        assert_equal(result['total_amount'], Decimal('1500'))
+        assert_equal(len([u for u in result['unspents'] if u['scriptPubKey'] == p2sh]), 20)
+
+        self.log.info("No scan is running in between")
+        assert_equal(node.scantxoutset("status"), None)
+        assert_equal(node.scantxoutset("abort"), False)
+
+        assert_raises_rpc_error(-8, "scanobjects argument is required", node.scantxoutset, "start")
+        assert_raises_rpc_error(-5, "Invalid address", node.scantxoutset, "start", ["notanaddress"])
+        assert_raises_rpc_error(-8, "Invalid command", node.scantxoutset, "stop")
+
+if __name__ == '__main__':
+    ScanTxoutSetTest().main()
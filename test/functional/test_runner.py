@@ -92,16 +92,29 @@ BASE_SCRIPTS= [
     'interface_rest.py',
     'mempool_spend_coinbase.py',
     'mempool_reorg.py',
+    'mempool_package_cpfp.py',
     'mempool_persist.py',
     'wallet_multiwallet.py',
     'wallet_multiwallet.py --usecli',
     'interface_http.py',
+    'interface_http_events.py',
     'rpc_users.py',
     'feature_proxy.py',
     'rpc_signrawtransaction.py',
     'p2p_disconnect_ban.py',
     'rpc_decodescript.py',
     'rpc_blockchain.py',
+    'rpc_scantxoutset.py',
+    'rpc_getblockstats.py',
+    'feature_assumeutxo.py',
+    'feature_coinstats.py',
+    'feature_compactdb.py',
+    'feature_reindex_parallel.py',
+    'feature_txindex.py',
+    'feature_addressindex.py',
+    'feature_dbprofile.py',
+    'feature_blocksdir.py',
+    'feature_reorg_parallel.py',
     'rpc_deprecated.py',
     'wallet_disable.py',
     'rpc_net.py',
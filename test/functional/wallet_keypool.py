@@ -80,5 +80,13 @@ class KeyPoolTest(BitcoinTestFramework):
         assert_equal(wi['keypoolsize_hd_internal'], 100)
         assert_equal(wi['keypoolsize'], 100)
 
+        # With -keypoolbackground, keys taken are replaced in the background
+        self.stop_node(0)
+        self.start_node(0, ["-keypoolbackground", "-keypool=1200"])
+        nodes[0].walletpassphrase('test', 100)
+        nodes[0].getnewaddress()
+        nodes[0].getrawchangeaddress()
+        wait_until(lambda: nodes[0].getwalletinfo()['keypoolsize'] == 1200 and nodes[0].getwalletinfo()['keypoolsize_hd_internal'] == 1200, timeout=60)
+
 if __name__ == '__main__':
     KeyPoolTest().main()